@@ -4,11 +4,14 @@
 
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
+#include "redis/TelemetryWriter.h"
 #include "timer/LoopTimer.h"
+#include "timer/LoopHealth.h"
+#include "threads/RealtimeThread.h"
+#include "passivity/WindowedPassivityController.h"
 
 #include <iostream>
 #include <string>
-#include <queue>
 
 #include <signal.h>
 bool runloop = true;
@@ -47,6 +50,7 @@ const string VC_KEY = "sai2::PandaApplication::controller:vc";
 const string ALPHA_KEY = "sai2::PandaApplication::controller:alpha";
 
 const string CONTROLLER_RUNNING_KEY = "sai2::PandaApplication::controller::flag_running";
+const string LOOP_HEALTH_KEY = "sai2::PandaApplication::controller::loop_health";
 
 unsigned long long controller_counter = 0;
 int olfc_counter = 200;
@@ -106,8 +110,7 @@ int main() {
 	double alpha_max = 25.0;
 
 	const int windowed_PO_size = 25;
-	queue<double> windowed_PO;
-	queue<double> windowed_E_correction;
+	PandaUtils::WindowedPassivityController<1> backward_passivity_controller(1, windowed_PO_size, Rc);
 
 	// force chirp
 	double freq_init = 0.0;
@@ -127,16 +130,20 @@ int main() {
 	redis_client.addEigenToReadCallback(0, SENSED_FORCE_FROM_SIM_KEY, sensed_force);
 
 	redis_client.addEigenToWriteCallback(0, JOINT_TORQUES_COMMANDED_KEY, command_torques);
-	redis_client.addDoubleToWriteCallback(0, BACKWARD_PO_KEY, backward_PO);
-	redis_client.addDoubleToWriteCallback(0, FORWARD_PO_KEY, forward_PO);
-	redis_client.addDoubleToWriteCallback(0, RC_KEY, gain_scaling);
-	redis_client.addDoubleToWriteCallback(0, CORRECTION_ENERGY_BACKWARD_KEY, E_correction_backwards);
-	redis_client.addDoubleToWriteCallback(0, ENERGY_TO_DISSIPATE_BACKWARD_KEY, E_to_dissipate_backward);
-	redis_client.addDoubleToWriteCallback(0, CORRECTION_ENERGY_FORWARD_KEY, E_correction_forward);
-	redis_client.addDoubleToWriteCallback(0, DESIRED_EE_FORCE_KEY, Fd);
-	redis_client.addDoubleToWriteCallback(0, SENSED_EE_FORCE_KEY, Fs);
-	redis_client.addDoubleToWriteCallback(0, VC_KEY, vc);
-	redis_client.addDoubleToWriteCallback(0, ALPHA_KEY, alpha_forward);
+
+	// passivity observer values are only monitored, they are sent by a background thread
+	PandaUtils::TelemetryWriter telemetry;
+	telemetry.addDouble(BACKWARD_PO_KEY, backward_PO);
+	telemetry.addDouble(FORWARD_PO_KEY, forward_PO);
+	telemetry.addDouble(RC_KEY, gain_scaling);
+	telemetry.addDouble(CORRECTION_ENERGY_BACKWARD_KEY, E_correction_backwards);
+	telemetry.addDouble(ENERGY_TO_DISSIPATE_BACKWARD_KEY, E_to_dissipate_backward);
+	telemetry.addDouble(CORRECTION_ENERGY_FORWARD_KEY, E_correction_forward);
+	telemetry.addDouble(DESIRED_EE_FORCE_KEY, Fd);
+	telemetry.addDouble(SENSED_EE_FORCE_KEY, Fs);
+	telemetry.addDouble(VC_KEY, vc);
+	telemetry.addDouble(ALPHA_KEY, alpha_forward);
+	telemetry.start();
 
 	redis_client.set(CONTROLLER_RUNNING_KEY, "1");
 
@@ -145,12 +152,13 @@ int main() {
 	LoopTimer timer;
 	timer.initializeTimer();
 	timer.setLoopFrequency(1/dt); 
+	PandaUtils::LoopHealth loop_health(1/dt);
+	PandaUtils::configureRealtimeThread("controller", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
 	double start_time = timer.elapsedTime(); //secs
-	bool fTimerDidSleep = true;
 
 	while (runloop) {
 	// wait for next scheduled loop
-	timer.waitForNextLoop();
+	loop_health.waitForNextLoop(timer);
 	double time = timer.elapsedTime() - start_time;
 
 	// // read robot state from redis
@@ -204,44 +212,13 @@ int main() {
 		double power_5 = Fcmd * vr * dt;
 		power_5 = 0;
 
-		// if(power_1 < 0)
-		// {
-			backward_PO += power_1;	
-		// }
-		// else
-		// {
-			// forward_PO += power_1;
-		// }
-		// if(power_5 < 0)
-		// {
-		// 	backward_PO -= power_5;	
-		// }
-		// else
-		// {
-		// 	forward_PO -= power_5;
-		// }
+		// windowed passivity observer and controller of the backward path
+		backward_passivity_controller.setStoredEnergy(Matrix<double,1,1>::Constant(E_stored));
+		gain_scaling = backward_passivity_controller.update(power_1, vc, dt);
+		Rpc = backward_passivity_controller.passivityResistance()(0);
+		backward_PO = backward_passivity_controller.inputEnergy()(0);
+		E_correction_backwards = backward_passivity_controller.correctionEnergy()(0);
 
-		// passivity controller backward path
-		Rpc = 0;
-		if(backward_PO + E_correction_backwards + E_stored < 0)
-		{
-			// E_to_dissipate_backward -= backward_PO + E_correction_backwards + E_stored;
-		// }
-			// Rc = Rc + (backward_PO + E_correction_backwards + E_stored)/(vc * vc * dt);
-			// Rc = 1 + (backward_PO + E_correction_backwards + E_stored)/(vc * vc * dt);
-			// Rc = 1 + abs(Fs - Fd) * (backward_PO + E_correction_backwards + E_stored + 0.1)/(vc * vc * dt);
-			// Rc = 1 + abs(vc) * (backward_PO + E_correction_backwards + E_stored)/(vc * vc * dt);
-			// Rpc = log(1-(backward_PO + E_correction_backwards + E_stored));
-			Rpc = exp(-(backward_PO + E_correction_backwards + E_stored)) - 1;
-			// Rpc = Rpc + exp(E_to_dissipate_backward) - 1;
-			// Rpc = exp(E_to_dissipate_backward) - 1;
-			// Rpc = - Rc * (backward_PO + E_correction_backwards + E_stored) / (Rc * vc * vc * dt);
-		}
-		if(Rpc < 0)
-		{
-			Rpc = 0;
-		}
-		gain_scaling = Rc/(Rc + Rpc);
 		// // passivity controller forward path
 		// alpha_forward = 0;
 		// if(forward_PO + E_correction_forward < 0)
@@ -256,28 +233,11 @@ int main() {
 		// 	}
 		// }
 
-		// energy correction
-		double current_E_correction = Rpc * gain_scaling * vc * vc * dt;
-		E_correction_backwards += current_E_correction;
-		E_to_dissipate_backward -= current_E_correction;
+		E_to_dissipate_backward -= backward_passivity_controller.currentCorrectionEnergy()(0);
 		if(E_to_dissipate_backward < 0)
 		{
 			E_to_dissipate_backward = 0;
 		}
-		// E_correction_backwards += (1 - Rc) * vc * vc * dt;
-		// E_correction_forward += (1 - Rc) * vc * vr * dt;
-		// E_correction_forward += alpha_forward * vr * vr * dt;
-
-		windowed_PO.push(power_1);
-		windowed_E_correction.push(current_E_correction);
-
-		if(windowed_PO.size() > windowed_PO_size)
-		{
-			backward_PO -= windowed_PO.front();
-			E_correction_backwards -= windowed_E_correction.front();
-			windowed_PO.pop();
-			windowed_E_correction.pop();
-		}
 
 		// gain_scaling = 1;
 
@@ -287,11 +247,18 @@ int main() {
 
 	// // send to redis
 	redis_client.executeWriteCallback(0);
+	telemetry.publish();
+
+	if(controller_counter % 1000 == 0)
+	{
+		loop_health.publish(redis_client, LOOP_HEALTH_KEY);
+	}
 
 	controller_counter++;
 
 	}
 
+	telemetry.stop();
 	redis_client.set(CONTROLLER_RUNNING_KEY, "0");
 
 	command_torques.setZero();
@@ -303,6 +270,7 @@ int main() {
 	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
 	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
     std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+    loop_health.print(std::cout);
 
 
 	return 0;
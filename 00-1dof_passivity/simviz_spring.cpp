@@ -10,6 +10,7 @@
 #include "timer/LoopTimer.h"
 #include "force_sensor/ForceSensorSim.h"
 #include "uiforce/UIForceWidget.h"
+#include "threads/RealtimeThread.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
 
@@ -303,6 +304,8 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, UI
 
 	unsigned long long simulation_counter = 0;
 
+	PandaUtils::configureRealtimeThread("simulation", PandaUtils::RealtimeConfig::fifo(70, PandaUtils::simulationCpus()));
+
 	while (fSimulationRunning) {
 		fTimerDidSleep = timer.waitForNextLoop();
 
@@ -4,6 +4,7 @@
 
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
+#include "model/HandEyeCalibration.h"
 
 #include <iostream>
 #include <string>
@@ -24,6 +25,8 @@ const string robot_name = "PANDA";
 // - read:
 std::string JOINT_ANGLES_KEY = "sai2::FrankaPanda::Clyde::sensors::q";;
 std::string JOINT_VELOCITIES_KEY = "sai2::FrankaPanda::Clyde::sensors::dq";;
+// pose of the marker in the camera frame, 4x4 homogeneous matrix from the marker detection
+std::string MARKER_POSE_KEY = "sai2::camera::marker_pose";
 // - write
 std::string JOINT_TORQUES_COMMANDED_KEY = "sai2::FrankaPanda::Clyde::actuators::fgc";;
 
@@ -61,6 +64,9 @@ int main() {
 	ofstream data_file;
 	data_file.open("ee_pose_in_robot_frame.txt");
 
+	// samples of the hand-eye calibration, solved when the recording ends
+	PandaUtils::HandEyeCalibration hand_eye_calibration;
+
 	int point_number = 0;
 
 	while (runloop) {
@@ -87,6 +93,21 @@ int main() {
 
 		cout << "recorded point number : " << point_number << endl;
 
+		if(!redis_client.exists(MARKER_POSE_KEY))
+		{
+			cout << "no marker pose on " << MARKER_POSE_KEY << ", point not used for the hand-eye calibration" << endl;
+			continue;
+		}
+		const MatrixXd marker_pose = redis_client.getEigenMatrixJSON(MARKER_POSE_KEY);
+		if(marker_pose.rows() != 4 || marker_pose.cols() != 4)
+		{
+			cout << "marker pose should be a 4x4 matrix, point not used for the hand-eye calibration" << endl;
+			continue;
+		}
+		Affine3d T_camera_marker = Affine3d::Identity();
+		T_camera_marker.matrix() = marker_pose;
+		hand_eye_calibration.addSample(T_base_marker_link, T_camera_marker);
+
 	}
 
 	data_file.close();
@@ -94,5 +115,34 @@ int main() {
 	command_torques.setZero();
 	redis_client.setEigenMatrixJSON(JOINT_TORQUES_COMMANDED_KEY, command_torques);
 
+	// camera in the robot base frame and marker in the marker link frame
+	if(hand_eye_calibration.numSamples() >= 3)
+	{
+		cout << "solving the hand-eye calibration with " << hand_eye_calibration.numSamples() << " points" << endl;
+		const PandaUtils::HandEyeResult result = hand_eye_calibration.solve();
+		if(result.success)
+		{
+			cout << result.n_inliers << " points used, " << hand_eye_calibration.numSamples() - result.n_inliers << " rejected" << endl;
+			cout << "rms error : " << 1000 * result.rms_translation << " mm, " << 180.0 / M_PI * result.rms_angle << " deg" << endl;
+			cout << "camera in robot frame :\n" << result.T_base_camera.matrix() << endl;
+			cout << "marker in " << marker_link << " frame :\n" << result.T_link_marker.matrix() << endl;
+
+			// same layout as the recorded poses, columns of the rotation then translation
+			ofstream calibration_file;
+			calibration_file.open("hand_eye_calibration.txt");
+			calibration_file << result.T_base_camera.linear().col(0).transpose() << " " << result.T_base_camera.linear().col(1).transpose() << " " << result.T_base_camera.linear().col(2).transpose() << " " << result.T_base_camera.translation().transpose() << "\n";
+			calibration_file << result.T_link_marker.linear().col(0).transpose() << " " << result.T_link_marker.linear().col(1).transpose() << " " << result.T_link_marker.linear().col(2).transpose() << " " << result.T_link_marker.translation().transpose() << "\n";
+			calibration_file.close();
+		}
+		else
+		{
+			cout << result.error;
+		}
+	}
+	else
+	{
+		cout << "not enough points with a marker pose for the hand-eye calibration" << endl;
+	}
+
 	return 0;
 }
@@ -1,7 +1,11 @@
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
+#include "timer/LoopHealth.h"
+#include "threads/RealtimeThread.h"
 #include "tasks/JointTask.h"
+#include "model/MassMatrixInverse.h"
+#include "model/TaskModelCache.h"
 
 #include <iostream>
 #include <string>
@@ -33,6 +37,7 @@ std::string ROBOT_GRAVITY_KEY;
 // gains
 const string KP_KEY = "sai2::PandaApplication::controller:kp_joint";
 const string KV_KEY = "sai2::PandaApplication::controller:kv_joint";
+const string LOOP_HEALTH_KEY = "sai2::PandaApplication::controller::loop_health";
 
 unsigned long long controller_counter = 0;
 
@@ -92,7 +97,9 @@ int main() {
 
 	// prepare controller	
 	auto joint_task = new Sai2Primitives::JointTask(robot);
+	PandaUtils::TaskModelCache joint_task_model;
 
+	PandaUtils::MassMatrixInverse<7> mass_matrix_inverse(robot->dof(), inertia_regularization ? 0.07 : 0.0);
 	MatrixXd N_prec = MatrixXd::Identity(robot->dof(), robot->dof());
 	VectorXd joint_task_torques = VectorXd::Zero(robot->dof());
 	joint_task->_kp = 100.0;
@@ -106,12 +113,13 @@ int main() {
 	LoopTimer timer;
 	timer.initializeTimer();
 	timer.setLoopFrequency(1000); 
+	PandaUtils::LoopHealth loop_health(1000);
+	PandaUtils::configureRealtimeThread("controller", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
 	double start_time = timer.elapsedTime(); //secs
-	bool fTimerDidSleep = true;
 
 	while (runloop) {
 		// wait for next scheduled loop
-		timer.waitForNextLoop();
+		loop_health.waitForNextLoop(timer);
 		double time = timer.elapsedTime() - start_time;
 
 		// read robot state from redis
@@ -129,17 +137,9 @@ int main() {
 			joint_task->_kv = stod(redis_client.get(KV_KEY));
 			robot->updateKinematics();
 			robot->_M = redis_client.getEigenMatrixJSON(MASSMATRIX_KEY);
-			if(inertia_regularization)
-			{
-				robot->_M(4,4) += 0.07;
-				robot->_M(5,5) += 0.07;
-				robot->_M(6,6) += 0.07;
-			}
-			// cout << robot->_M << endl;
-			// robot->_M = Eigen::MatrixXd::Identity(robot->dof(), robot->dof());
-			robot->_M_inv = robot->_M.inverse();
+			mass_matrix_inverse.update(robot);
 		}
-		joint_task->updateTaskModel(N_prec);
+		joint_task_model.update(joint_task, robot->_q, N_prec);
 
 		// compute torques
 		joint_task->_desired_position(2) = initial_q(2) + 25/180.0*M_PI * sin(2*M_PI*0.3*time);
@@ -150,6 +150,11 @@ int main() {
 		// send to redis
 		redis_client.setEigenMatrixJSON(JOINT_TORQUES_COMMANDED_KEY, command_torques);
 
+		if(controller_counter % 1000 == 0)
+		{
+			loop_health.publish(redis_client, LOOP_HEALTH_KEY);
+		}
+
 		controller_counter++;
 
 	}
@@ -159,6 +164,7 @@ int main() {
     std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
     std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
     std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+    loop_health.print(std::cout);
 
 
 	return 0;
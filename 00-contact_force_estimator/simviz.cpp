@@ -8,8 +8,9 @@
 #include <dynamics3d.h>
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
-#include "KalmanFilter.h"
+#include "kalman_filters/KalmanFilter.h"
 #include "filters/ButterworthFilter.h"
+#include "threads/RealtimeThread.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
 
@@ -283,7 +284,7 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim) {
  
 	MatrixXd R = 0.1 * MatrixXd::Identity(7,7);
 
-	auto kalman_filter = new KalmanFilters::KalmanFilter(1/loop_frequency, F, H, Q, R);
+	auto kalman_filter = new KalmanFilters::KalmanFilter<21,7>(1/loop_frequency, F, H, Q, R);
 	VectorXd x_init = VectorXd::Zero(21);
 	x_init.head(7) = robot->_q;
 	kalman_filter->init(x_init);
@@ -293,7 +294,7 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim) {
 	VectorXd ddq_kalman = VectorXd::Zero(7);
 
 	// prepare individual kalman filters
-	vector<KalmanFilters::KalmanFilter*> individual_kalman_filters;
+	vector<KalmanFilters::KalmanFilter<3,1>*> individual_kalman_filters;
 	MatrixXd F_indiv = MatrixXd::Identity(3,3);
 	F_indiv(0,1) = dt;
 	F_indiv(1,2) = dt;
@@ -307,7 +308,7 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim) {
 	MatrixXd R_indiv = 0.1 * MatrixXd::Identity(1,1);
 	for(int i=0 ; i<dof ; i++)
 	{
-		individual_kalman_filters.push_back(new KalmanFilters::KalmanFilter(1/loop_frequency, F_indiv, H_indiv, Q_indiv, R_indiv));
+		individual_kalman_filters.push_back(new KalmanFilters::KalmanFilter<3,1>(1/loop_frequency, F_indiv, H_indiv, Q_indiv, R_indiv));
 		VectorXd x_indiv_init = VectorXd::Zero(3);
 		x_indiv_init(0) = robot->_q(i);
 		individual_kalman_filters[i]->init(x_indiv_init);
@@ -336,6 +337,8 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim) {
 
 	unsigned long long simulation_counter = 0;
 
+	PandaUtils::configureRealtimeThread("simulation", PandaUtils::RealtimeConfig::fifo(70, PandaUtils::simulationCpus()));
+
 	while (fSimulationRunning) {
 		fTimerDidSleep = timer.waitForNextLoop();
 
@@ -5,8 +5,14 @@
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
+#include "timer/LoopHealth.h"
+#include "threads/RealtimeThread.h"
 #include "filters/ButterworthFilter.h"
 #include "tasks/JointTask.h"
+#include "model/MassMatrixInverse.h"
+#include "model/TaskModelCache.h"
+#include "model/JointIdentification.h"
+#include "logger/Logger.h"
 
 #include <iostream>
 #include <string>
@@ -40,6 +46,7 @@ const string robot_name = "PANDA";
 #define EXPERIMENT_TRACKING        1
 #define EXPERIMENT_REGULATION      2
 #define GO_TO_INITIAL              3
+#define EXPERIMENT_IDENTIFICATION  4
 
 int state = EXPERIMENT_TRACKING;
 int controller_type = 0;
@@ -78,6 +85,7 @@ const string KP_JOINT_KEY = "sai2::PandaApplication::controller:kp_joint";
 const string KV_JOINT_KEY = "sai2::PandaApplication::controller:kv_joint";
 
 const string DESIRED_POSITION_KEY = "sai2::PandaApplication::controller::q_desired";
+const string LOOP_HEALTH_KEY = "sai2::PandaApplication::controller::loop_health";
 
 unsigned long long controller_counter = 0;
 
@@ -87,9 +95,25 @@ const bool flag_simulation = true;
 const string prefix_path = "../../00-experiment_joint_control/data_files/";
 string create_filename();
 
+// identification mode : multisine excitation of all the joints, q, dq and the torques
+// logged at every tick, then analyzed by identify_joints
+const string identification_log_file = prefix_path + "identification.bin";
+const double identification_period = 10.0;
+const int identification_harmonics = 6;
+const double identification_duration = 62.0;
+
+// friction torques of a previous identification added to the command
+const bool flag_friction_compensation = false;
+const string friction_model_file = prefix_path + "joint_identification.xml";
+
 void write_first_line(ofstream& file_handler);
 
-int main() {
+int main(int argc, char** argv) {
+
+	if(argc > 1 && string(argv[1]) == "identification")
+	{
+		state = EXPERIMENT_IDENTIFICATION;
+	}
 
 	if(flag_simulation)
 	{
@@ -140,12 +164,14 @@ int main() {
 
 	// prepare controller	
 	int dof = robot->dof();
+	PandaUtils::MassMatrixInverse<7> mass_matrix_inverse(dof);
 	VectorXd command_torques = VectorXd::Zero(dof);
 	VectorXd coriolis = VectorXd::Zero(dof);
 	MatrixXd N_prec = MatrixXd::Identity(dof, dof);
 
 	// joint task
 	auto joint_task = new Sai2Primitives::JointTask(robot);
+	PandaUtils::TaskModelCache joint_task_model;
 	VectorXd joint_task_torques = VectorXd::Zero(dof);
 	joint_task->_use_interpolation_flag = false;
 
@@ -159,31 +185,58 @@ int main() {
 	VectorXd frequency_scaling = VectorXd::Zero(dof);
 	frequency_scaling << 0.6, 0.8, 0.9, 1.0, 1.1, 1.2, 1.4;
 
+	PandaUtils::JointFrictionModel friction_model(dof);
+	if(flag_friction_compensation && !friction_model.load(friction_model_file))
+	{
+		cout << friction_model.error() << endl;
+		return 0;
+	}
+
 	// prepare file to write data
 	bool newfile = false;
-	string filename = create_filename();
 	ofstream data_file;
-	data_file.open(filename);
-	if(!data_file.is_open())
+	if(state != EXPERIMENT_IDENTIFICATION)
 	{
-		cout << "could not open file at " << filename << endl;
-		return 0;
+		string filename = create_filename();
+		data_file.open(filename);
+		if(!data_file.is_open())
+		{
+			cout << "could not open file at " << filename << endl;
+			return 0;
+		}
+		write_first_line(data_file);
+	}
+
+	// the excitation ends at rest at the initial position, from deviations within the amplitudes
+	PandaUtils::MultisineExcitation excitation(dof, identification_period, identification_harmonics,
+			oscillation_amplitude, 0.5, 2.0, identification_duration);
+	Logging::Logger* identification_logger = NULL;
+	if(state == EXPERIMENT_IDENTIFICATION)
+	{
+		identification_logger = new Logging::Logger(1000, identification_log_file);
+		identification_logger->addVectorToLog(&robot->_q, "q");
+		identification_logger->addVectorToLog(&robot->_dq, "dq");
+		identification_logger->addVectorToLog(&command_torques, "command_torques");
+		identification_logger->enableBinaryFormat();
+		identification_logger->enableCapture(1 << 14);
+		identification_logger->start();
+		cout << "identification up to " << excitation.maxFrequency() << " Hz for " << identification_duration << " s" << endl;
 	}
-	write_first_line(data_file);
 
 	// create a timer
 	LoopTimer timer;
 	timer.initializeTimer();
 	timer.setLoopFrequency(1000); 
+	PandaUtils::LoopHealth loop_health(1000);
+	PandaUtils::configureRealtimeThread("controller", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
 	double current_time = 0;
 	double prev_time = 0;
 	double dt = 0;
-	bool fTimerDidSleep = true;
 	double start_time = timer.elapsedTime(); //secs
 
 	while (runloop) {
 		// wait for next scheduled loop
-		timer.waitForNextLoop();
+		loop_health.waitForNextLoop(timer);
 		current_time = timer.elapsedTime() - start_time;
 		dt = current_time - prev_time;
 
@@ -201,13 +254,13 @@ int main() {
 		{
 			robot->updateKinematics();
 			robot->_M = redis_client.getEigenMatrixJSON(MASSMATRIX_KEY);
-			robot->_M_inv = robot->_M.inverse();
+			mass_matrix_inverse.update(robot);
 
 			coriolis = redis_client.getEigenMatrixJSON(CORIOLIS_KEY);
 		}
 
 		N_prec.setIdentity();
-		joint_task->updateTaskModel(N_prec);
+		joint_task_model.update(joint_task, robot->_q, N_prec);
 
 		// set gains
 		if(gains_value == LOW_GAINS)
@@ -292,6 +345,23 @@ int main() {
 			}
 			experiment_countdown--;
 		}
+		else if(state == EXPERIMENT_IDENTIFICATION)
+		{
+			// stiffer tracking, the estimation does not depend on the tracking error
+			joint_task->_kp = 400.0;
+			joint_task->_kv = 40.0;
+			joint_task->_desired_position = initial_q + excitation.position(current_time);
+			joint_task->_desired_velocity = excitation.velocity(current_time);
+
+			if(identification_logger && excitation.finished(current_time))
+			{
+				identification_logger->stop();
+				delete identification_logger;
+				identification_logger = NULL;
+				cout << "identification done, log in " << identification_log_file << endl;
+				cout << "run identify_joints on it, the robot holds its initial position" << endl;
+			}
+		}
 		else if (state == GO_TO_INITIAL)
 		{
 			// don't update desired position
@@ -344,13 +414,27 @@ int main() {
 
 		// send to redis
 		command_torques = joint_task_torques + coriolis;
+		if(flag_friction_compensation && state != EXPERIMENT_IDENTIFICATION)
+		{
+			command_torques += friction_model.frictionTorques(robot->_dq);
+		}
 
 		// command_torques.setZero(dof);
 		redis_client.setEigenMatrixJSON(JOINT_TORQUES_COMMANDED_KEY, command_torques);
 
 		// write file
+		if(identification_logger)
+		{
+			identification_logger->tick(controller_counter, current_time);
+		}
 
 		prev_time = current_time;
+
+		if(controller_counter % 1000 == 0)
+		{
+			loop_health.publish(redis_client, LOOP_HEALTH_KEY);
+		}
+
 		controller_counter++;
 	}
 
@@ -358,12 +442,18 @@ int main() {
 	redis_client.setEigenMatrixJSON(JOINT_TORQUES_COMMANDED_KEY, command_torques);
 
 	data_file.close();
+	if(identification_logger)
+	{
+		identification_logger->stop();
+		delete identification_logger;
+	}
 
 	double end_time = timer.elapsedTime();
 	std::cout << "\n";
 	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
 	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
     std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+    loop_health.print(std::cout);
 
 	return 0;
 }
@@ -0,0 +1,279 @@
+// Identification of the friction and armature of the joints from the log of the identification
+// mode of the controller (experiment_joint_control identification).
+//
+// reads q, dq and the command torques of the binary log, and :
+//   - filters dq and the torques forward and backward with the same Butterworth filter (no
+//     phase lag), and differentiates the filtered dq for the accelerations,
+//   - computes the torques of the rigid body model, M(q) ddq + c(q, dq), on all the cores with
+//     one model per thread (the gravity is compensated by the robot, as in the controller),
+//   - fits the armature, viscous and Coulomb friction and offset of every joint to the torques
+//     the model does not explain, by least squares, one joint per thread,
+// and writes the parameters to an xml file that JointFrictionModel loads in the controllers.
+//
+// usage : identify_joints identification.bin [-o joint_identification.xml] [-j threads] [-c cutoff_hz]
+//   -o  parameter file (default next to the log, joint_identification.xml)
+//   -j  threads, counting the main thread (default the number of cores)
+//   -c  cutoff frequency of the filter (default 15 Hz)
+//
+// the samples at the start and at the end of the log, where the filters are not settled, and
+// the ones below trim_velocity (where the Coulomb friction is not excited) are not used.
+
+#include "Sai2Model.h"
+#include "logger/BinaryLogReader.h"
+#include "filters/ButterworthFilterBank.h"
+#include "model/JointIdentification.h"
+#include "threads/WorkerPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+const string robot_file = "resources/panda_arm.urdf";
+
+// s dropped at both ends of the log
+const double trim_duration = 0.5;
+// rad/s
+const double trim_velocity = 0.002;
+const double coulomb_velocity = 0.01;
+
+// forward then backward, the filter starts at steady state on the first sample of each pass
+void filtfilt(MatrixXd& signals, const double normalized_cutoff)
+{
+	PandaUtils::ButterworthFilterBank<> filter(signals.rows(), normalized_cutoff);
+	VectorXd x(signals.rows());
+	for(int k=0 ; k<signals.cols() ; k++)
+	{
+		x = signals.col(k);
+		signals.col(k) = filter.update(x);
+	}
+	filter.initializeFilter(signals.col(signals.cols() - 1));
+	for(int k=signals.cols()-1 ; k>=0 ; k--)
+	{
+		x = signals.col(k);
+		signals.col(k) = filter.update(x);
+	}
+}
+
+void printUsage()
+{
+	cout << "usage : identify_joints identification.bin [-o joint_identification.xml] [-j threads] [-c cutoff_hz]" << endl;
+}
+
+int main(int argc, char** argv) {
+
+	if(argc < 2 || string(argv[1]) == "-h")
+	{
+		printUsage();
+		return argc < 2 ? 1 : 0;
+	}
+	const string log_file = argv[1];
+	const size_t directory_end = log_file.find_last_of('/');
+	string output_file = (directory_end == string::npos ? string("") : log_file.substr(0, directory_end + 1)) + "joint_identification.xml";
+	int n_threads = max(1u, thread::hardware_concurrency());
+	double cutoff_frequency = 15.0;
+
+	for(int i=2 ; i<argc ; i++)
+	{
+		const string option = argv[i];
+		if(i + 1 >= argc)
+		{
+			cout << "missing value after " << option << endl;
+			printUsage();
+			return 1;
+		}
+		const string value = argv[++i];
+		if(option == "-o")
+		{
+			output_file = value;
+		}
+		else if(option == "-j")
+		{
+			n_threads = atoi(value.c_str());
+		}
+		else if(option == "-c")
+		{
+			cutoff_frequency = atof(value.c_str());
+		}
+		else
+		{
+			cout << "unknown option " << option << endl;
+			printUsage();
+			return 1;
+		}
+	}
+	if(n_threads < 1 || cutoff_frequency <= 0)
+	{
+		cout << "the number of threads and the cutoff frequency should be positive" << endl;
+		return 1;
+	}
+
+	// read the log
+	Logging::BinaryLogReader reader;
+	if(!reader.open(log_file))
+	{
+		cout << reader.error() << endl;
+		return 1;
+	}
+	const int q_offset = reader.variableOffset("q");
+	const int dq_offset = reader.variableOffset("dq");
+	const int tau_offset = reader.variableOffset("command_torques");
+	if(q_offset < 0 || dq_offset < 0 || tau_offset < 0)
+	{
+		cout << log_file << " should log q, dq and command_torques" << endl;
+		return 1;
+	}
+	int dof = 0;
+	for(int i=0 ; i<reader.numVariables() ; i++)
+	{
+		if(reader.name(i) == "q")
+		{
+			dof = reader.size(i);
+		}
+	}
+
+	vector<double> time;
+	vector<double> record;
+	vector<VectorXd> q_samples, dq_samples, tau_samples;
+	while(reader.next(record))
+	{
+		// us
+		time.push_back(record[0] * 1e-6);
+		q_samples.push_back(Map<const VectorXd>(record.data() + q_offset, dof));
+		dq_samples.push_back(Map<const VectorXd>(record.data() + dq_offset, dof));
+		tau_samples.push_back(Map<const VectorXd>(record.data() + tau_offset, dof));
+	}
+	const int n_samples = time.size();
+	if(n_samples < 100)
+	{
+		cout << "only " << n_samples << " samples in " << log_file << endl;
+		return 1;
+	}
+	const double sample_frequency = (n_samples - 1) / (time.back() - time.front());
+	if(cutoff_frequency >= 0.5 * sample_frequency)
+	{
+		cout << "cutoff frequency above the nyquist frequency of the log (" << 0.5 * sample_frequency << " Hz)" << endl;
+		return 1;
+	}
+	cout << n_samples << " samples at " << sample_frequency << " Hz, " << dof << " joints, " << n_threads << " threads" << endl;
+
+	// velocities, torques and accelerations filtered without lag
+	MatrixXd dq(dof, n_samples), tau(dof, n_samples), ddq(dof, n_samples);
+	for(int k=0 ; k<n_samples ; k++)
+	{
+		dq.col(k) = dq_samples[k];
+		tau.col(k) = tau_samples[k];
+	}
+	filtfilt(dq, cutoff_frequency / sample_frequency);
+	filtfilt(tau, cutoff_frequency / sample_frequency);
+	ddq.col(0).setZero();
+	ddq.col(n_samples - 1).setZero();
+	for(int k=1 ; k<n_samples-1 ; k++)
+	{
+		ddq.col(k) = (dq.col(k+1) - dq.col(k-1)) / (time[k+1] - time[k-1]);
+	}
+
+	const int first_sample = lower_bound(time.begin(), time.end(), time.front() + trim_duration) - time.begin();
+	const int last_sample = lower_bound(time.begin(), time.end(), time.back() - trim_duration) - time.begin();
+	if(last_sample - first_sample < 100)
+	{
+		cout << "log too short" << endl;
+		return 1;
+	}
+
+	// rigid body torques, a model and a range of samples per thread
+	PandaUtils::WorkerPool pool(n_threads);
+	MatrixXd residual_torques = MatrixXd::Zero(dof, n_samples);
+	vector<string> model_errors(pool.size());
+	auto rigid_body_job = [&](const int index, const int n_jobs)
+	{
+		try
+		{
+			Sai2Model::Sai2Model robot(robot_file, false);
+			if(robot.dof() != dof)
+			{
+				throw runtime_error("the model has " + to_string(robot.dof()) + " joints");
+			}
+			VectorXd coriolis = VectorXd::Zero(dof);
+			const int begin = first_sample + (last_sample - first_sample) * index / n_jobs;
+			const int end = first_sample + (last_sample - first_sample) * (index + 1) / n_jobs;
+			for(int k=begin ; k<end ; k++)
+			{
+				robot._q = q_samples[k];
+				robot._dq = dq.col(k);
+				robot.updateModel();
+				robot.coriolisForce(coriolis);
+				residual_torques.col(k) = tau.col(k) - robot._M * ddq.col(k) - coriolis;
+			}
+		}
+		catch(const exception& e)
+		{
+			model_errors[index] = e.what();
+		}
+	};
+	pool.run(rigid_body_job);
+	for(const string& error : model_errors)
+	{
+		if(!error.empty())
+		{
+			cout << "rigid body model failed : " << error << endl;
+			return 1;
+		}
+	}
+
+	// one least squares per joint
+	PandaUtils::JointFrictionModel friction_model(dof);
+	vector<string> fit_errors(dof);
+	auto fit_joint = [&](const int i)
+	{
+		PandaUtils::JointFrictionRegression regression(coulomb_velocity);
+		for(int k=first_sample ; k<last_sample ; k++)
+		{
+			if(std::abs(dq(i,k)) > trim_velocity)
+			{
+				regression.addSample(dq(i,k), ddq(i,k), residual_torques(i,k));
+			}
+		}
+		try
+		{
+			friction_model.joint(i) = regression.solve();
+		}
+		catch(const exception& e)
+		{
+			fit_errors[i] = e.what();
+		}
+	};
+	pool.forEach(dof, fit_joint);
+
+	cout << "\n" << right << setw(6) << "joint" << setw(12) << "armature" << setw(12) << "viscous" << setw(12) << "coulomb"
+			<< setw(12) << "offset" << setw(12) << "rms" << setw(10) << "samples" << endl;
+	cout << fixed << setprecision(4);
+	for(int i=0 ; i<dof ; i++)
+	{
+		if(!fit_errors[i].empty())
+		{
+			cout << "joint " << i << " : " << fit_errors[i] << endl;
+			return 1;
+		}
+		const PandaUtils::JointFrictionParameters& p = friction_model.joint(i);
+		cout << setw(6) << i << setw(12) << p.armature << setw(12) << p.viscous << setw(12) << p.coulomb
+				<< setw(12) << p.offset << setw(12) << p.rms_residual << setw(10) << p.n_samples << endl;
+	}
+
+	if(!friction_model.save(output_file))
+	{
+		cout << friction_model.error() << endl;
+		return 1;
+	}
+	cout << "\nparameters in " << output_file << endl;
+
+	return 0;
+}
@@ -5,9 +5,12 @@
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
+#include "timer/LoopHealth.h"
+#include "threads/RealtimeThread.h"
 #include "filters/ButterworthFilter.h"
 #include "tasks/JointTask.h"
 #include "tasks/PosOriTask.h"
+#include "model/MassMatrixInverse.h"
 
 #include <iostream>
 #include <string>
@@ -93,6 +96,7 @@ const string KV_JOINT_KEY = "sai2::PandaApplication::controller:kv_joint";
 
 const string DESIRED_POSITION_KEY = "sai2::PandaApplication::controller::desired_ee_pos";
 const string CURRENT_POSITION_KEY = "sai2::PandaApplication::controller::current_ee_pos";
+const string LOOP_HEALTH_KEY = "sai2::PandaApplication::controller::loop_health";
 
 unsigned long long controller_counter = 0;
 
@@ -226,6 +230,7 @@ int main() {
 
 	// prepare controller	
 	int dof = robot->dof();
+	PandaUtils::MassMatrixInverse<7> mass_matrix_inverse(dof);
 	VectorXd command_torques = VectorXd::Zero(dof);
 	VectorXd coriolis = VectorXd::Zero(dof);
 	MatrixXd N_prec = MatrixXd::Identity(dof, dof);
@@ -276,15 +281,16 @@ int main() {
 	LoopTimer timer;
 	timer.initializeTimer();
 	timer.setLoopFrequency(1000); 
+	PandaUtils::LoopHealth loop_health(1000);
+	PandaUtils::configureRealtimeThread("controller", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
 	double current_time = 0;
 	double prev_time = 0;
 	double dt = 0;
-	bool fTimerDidSleep = true;
 	double start_time = timer.elapsedTime(); //secs
 
 	while (runloop) {
 		// wait for next scheduled loop
-		timer.waitForNextLoop();
+		loop_health.waitForNextLoop(timer);
 		current_time = timer.elapsedTime() - start_time;
 		dt = current_time - prev_time;
 
@@ -302,7 +308,7 @@ int main() {
 		{
 			robot->updateKinematics();
 			robot->_M = redis_client.getEigenMatrixJSON(MASSMATRIX_KEY);
-			robot->_M_inv = robot->_M.inverse();
+			mass_matrix_inverse.update(robot);
 
 			coriolis = redis_client.getEigenMatrixJSON(CORIOLIS_KEY);
 		}
@@ -616,6 +622,12 @@ int main() {
 		// write file
 
 		prev_time = current_time;
+
+		if(controller_counter % 1000 == 0)
+		{
+			loop_health.publish(redis_client, LOOP_HEALTH_KEY);
+		}
+
 		controller_counter++;
 	}
 
@@ -629,6 +641,7 @@ int main() {
 	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
 	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
     std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+    loop_health.print(std::cout);
 
 	return 0;
 }
@@ -6,6 +6,7 @@
 #include <dynamics3d.h>
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
+#include "threads/RealtimeThread.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
 
@@ -336,6 +337,8 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, Fo
 
 	unsigned long long simulation_counter = 0;
 
+	PandaUtils::configureRealtimeThread("simulation", PandaUtils::RealtimeConfig::fifo(70, PandaUtils::simulationCpus()));
+
 	while (fSimulationRunning) {
 		fTimerDidSleep = timer.waitForNextLoop();
 
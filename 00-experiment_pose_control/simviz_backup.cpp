@@ -8,6 +8,7 @@
 #include <dynamics3d.h>
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
+#include "threads/RealtimeThread.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
 
@@ -290,6 +291,9 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim) {
 	double last_time = start_time;
 
 	fSimulationRunning = true;
+
+	PandaUtils::configureRealtimeThread("simulation", PandaUtils::RealtimeConfig::fifo(70, PandaUtils::simulationCpus()));
+
 	while (fSimulationRunning) {
 		fTimerDidSleep = timer.waitForNextLoop();
 
@@ -0,0 +1,471 @@
+// Sweep of the stiffness experiment of app_stiffness.cpp, without graphics and faster than real time.
+//
+// runs the experiment of app_stiffness for every combination of the decoupling types and of
+// the gains below, one simulation and controller pair per scenario on all the cores, and
+// writes one line of metrics per combination to a summary file. each pair is stepped in
+// lockstep in its thread : one controller step, then the simulation steps of one control
+// period, with the state and torques in an InMemoryTransport.
+//
+// the experiment : the robot goes to its initial posture, then holds the pose of the
+// end effector while the disturbances of app_stiffness are applied for 1 s each, forces
+// along x, y and z then moments about x, y and z, 3 s apart. for each disturbance :
+//   - the peak deviation along (about) the disturbance while it is applied,
+//   - the overshoot after it is released, the deviation to the other side over the peak,
+//   - the settling time after it is released, until the deviation stays under 2 % of the peak.
+// the metrics of a run are the largest over the forces and over the moments, with the peak
+// of the force the task applies (it balances the disturbance at the end effector).
+//
+// usage : experiment_stiffness_sweep [-j threads] [-o summary.csv]
+//   -j  threads, counting the main thread (default the number of cores)
+//   -o  summary file (default ../../00-experiment_pose_control/data_files/data/stiffness_sweep.csv)
+
+#include "Sai2Model.h"
+#include "Sai2Simulation.h"
+#include <dynamics3d.h>
+#include "tasks/JointTask.h"
+#include "tasks/PosOriTask.h"
+#include "sim/AssetRegistry.h"
+#include "sim/BatchRunner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+const string world_file = "./resources/world.urdf";
+const string robot_file = "./resources/panda_arm.urdf";
+const string robot_name = "PANDA";
+const string link_name = "link7";
+const Vector3d pos_in_link = Vector3d(0.0, 0.0, 0.107);
+
+// rates of app_stiffness
+const double control_period = 0.001;
+const int sim_substeps = 5;
+const double sim_period = control_period / sim_substeps;
+
+// disturbances of app_stiffness, from the start of the experiment
+const double fdis = 15.0;
+const double mdis = 0.5;
+const double first_disturbance_time = 2.0;
+const double disturbance_spacing = 3.0;
+const double disturbance_duration = 1.0;
+const int n_disturbances = 6;
+const double experiment_duration = 20.0;
+// to reach the initial posture before the experiment
+const double max_init_duration = 10.0;
+
+// swept values
+const vector<string> controller_types = {
+	"fullDynDecoupling",
+	"partialDynDecoupling",
+	"noDynDecoupling",
+	"inertiaSaturation",
+};
+const vector<double> kp_values = {50.0, 100.0, 200.0, 300.0};
+const vector<double> kv_values = {10.0, 15.0, 20.0, 25.0};
+
+const string default_summary_file = "../../00-experiment_pose_control/data_files/data/stiffness_sweep.csv";
+
+struct SweepParameters
+{
+	int controller_type;
+	double kp;
+	double kv;
+};
+
+struct SweepMetrics
+{
+	// m and rad
+	double max_deviation_pos;
+	double max_deviation_ori;
+	// ratio of the peak deviation
+	double overshoot_pos;
+	double overshoot_ori;
+	// s, at most the time to the next disturbance
+	double settling_time_pos;
+	double settling_time_ori;
+	// norm of the linear force of the task, N
+	double max_task_force;
+	double max_torque;
+	// the state was not finite before the end
+	bool diverged;
+	double diverged_time;
+};
+
+// response to one disturbance, along (about) its axis
+struct DisturbanceResponse
+{
+	double peak;
+	double overshoot;
+	double last_unsettled_time;
+
+	DisturbanceResponse()
+	: peak(0), overshoot(0), last_unsettled_time(0)
+	{}
+};
+
+void setGains(Sai2Primitives::PosOriTask* posori_task, const SweepParameters& parameters)
+{
+	const double kp = parameters.kp;
+	const double kv = parameters.kv;
+	posori_task->_kp_pos = kp;
+	posori_task->_kv_pos = kv;
+	posori_task->_kp_ori = kp;
+	posori_task->_kv_ori = kv;
+
+	// same scalings as app_stiffness
+	const string& controller_type = controller_types[parameters.controller_type];
+	if(controller_type == "noDynDecoupling")
+	{
+		posori_task->_kp_pos = kp * 7;
+		posori_task->_kv_pos = kv * 9;
+		posori_task->_kp_ori = kp * 0.10;
+		posori_task->_kv_ori = kv * 0.18;
+		posori_task->setDynamicDecouplingNone();
+	}
+	else if(controller_type == "fullDynDecoupling")
+	{
+		posori_task->setDynamicDecouplingFull();
+	}
+	else if(controller_type == "partialDynDecoupling")
+	{
+		posori_task->_kp_ori = kp * 0.10;
+		posori_task->_kv_ori = kv * 0.18;
+		posori_task->setDynamicDecouplingPartial();
+	}
+	else if(controller_type == "inertiaSaturation")
+	{
+		posori_task->setDynamicDecouplingInertiaSaturation();
+	}
+	else
+	{
+		throw runtime_error("dynamic decoupling incompatible");
+	}
+}
+
+SweepMetrics runScenario(const SweepParameters& parameters)
+{
+	// built by the first scenarios of the threads, then reused
+	PandaUtils::AssetRegistry::Lease<PandaUtils::SimulationAsset> sim_asset = PandaUtils::leaseSimulation(world_file, {robot_name});
+	Simulation::Sai2Simulation* sim = sim_asset->sim.get();
+	sim->setCollisionRestitution(0);
+
+	PandaUtils::AssetRegistry::Lease<Sai2Model::Sai2Model> robot = PandaUtils::leaseModel(robot_file);
+	const int dof = robot->dof();
+	PandaUtils::InMemoryTransport transport(dof, dof);
+	sim->getJointPositions(robot_name, transport.q);
+	sim->getJointVelocities(robot_name, transport.dq);
+	robot->_q = transport.q;
+	robot->_dq = transport.dq;
+	robot->updateModel();
+
+	VectorXd coriolis = VectorXd::Zero(dof);
+	MatrixXd N_prec = MatrixXd::Identity(dof, dof);
+	VectorXd disturbance_force = VectorXd::Zero(6);
+	VectorXd disturbance_torques = VectorXd::Zero(dof);
+	MatrixXd J_disturbance = MatrixXd::Zero(6, dof);
+
+	VectorXd initial_q = VectorXd::Zero(dof);
+	initial_q << 0.0, 25.0, 0.0, -115.0, 0.0, 140.0, 0.0;
+	initial_q *= M_PI/180.0;
+
+	auto joint_task = new Sai2Primitives::JointTask(robot.get());
+	VectorXd joint_task_torques = VectorXd::Zero(dof);
+	joint_task->_use_interpolation_flag = true;
+	joint_task->_kp = 200.0;
+	joint_task->_kv = 15.0;
+	joint_task->_ki = 5.0;
+	joint_task->_desired_position = initial_q;
+
+	auto posori_task = new Sai2Primitives::PosOriTask(robot.get(), link_name, pos_in_link);
+	VectorXd posori_task_torques = VectorXd::Zero(dof);
+	posori_task->_use_interpolation_flag = false;
+	setGains(posori_task, parameters);
+
+	Vector3d x_init = Vector3d::Zero();
+	Matrix3d R_init = Matrix3d::Identity();
+	bool f_control = false;
+	double initial_time = 0;
+
+	SweepMetrics metrics;
+	metrics.max_deviation_pos = 0;
+	metrics.max_deviation_ori = 0;
+	metrics.overshoot_pos = 0;
+	metrics.overshoot_ori = 0;
+	metrics.settling_time_pos = 0;
+	metrics.settling_time_ori = 0;
+	metrics.max_task_force = 0;
+	metrics.max_torque = 0;
+	metrics.diverged = false;
+	metrics.diverged_time = 0;
+	vector<DisturbanceResponse> responses(n_disturbances);
+
+	const unsigned long long n_steps = (max_init_duration + experiment_duration) / control_period;
+	for(unsigned long long step=0 ; step<n_steps ; step++)
+	{
+		// controller step
+		const double time = transport.time;
+		robot->_q = transport.q;
+		robot->_dq = transport.dq;
+		robot->updateModel();
+		robot->coriolisForce(coriolis);
+		disturbance_torques.setZero();
+
+		if(!f_control)
+		{
+			joint_task->updateTaskModel(MatrixXd::Identity(dof, dof));
+			joint_task->computeTorques(joint_task_torques);
+			transport.command_torques = joint_task_torques + coriolis;
+
+			if((joint_task->_desired_position - joint_task->_current_position).norm() < 1e-1)
+			{
+				posori_task->reInitializeTask();
+				x_init = posori_task->_current_position;
+				R_init = posori_task->_current_orientation;
+				joint_task->_ki = 0;
+				joint_task->_use_interpolation_flag = false;
+				f_control = true;
+				initial_time = time;
+			}
+			else if(time > max_init_duration)
+			{
+				break;
+			}
+		}
+		else
+		{
+			const double experiment_time = time - initial_time;
+			if(experiment_time > experiment_duration)
+			{
+				break;
+			}
+
+			N_prec.setIdentity();
+			posori_task->updateTaskModel(N_prec);
+			N_prec = posori_task->_N;
+			joint_task->updateTaskModel(N_prec);
+
+			// the disturbance of this window, applied for its first second
+			const int disturbance = floor((experiment_time - first_disturbance_time) / disturbance_spacing);
+			if(disturbance >= 0 && disturbance < n_disturbances)
+			{
+				const double window_time = experiment_time - first_disturbance_time - disturbance * disturbance_spacing;
+				const bool f_applied = window_time < disturbance_duration;
+				disturbance_force.setZero();
+				if(f_applied)
+				{
+					disturbance_force(disturbance) = (disturbance < 3) ? fdis : mdis;
+				}
+				robot->J_0(J_disturbance, link_name);
+				disturbance_torques = J_disturbance.transpose() * disturbance_force;
+
+				// deviation from the initial pose along (about) the disturbance
+				double deviation, deviation_norm;
+				if(disturbance < 3)
+				{
+					const Vector3d position_error = posori_task->_current_position - x_init;
+					deviation = position_error(disturbance);
+					deviation_norm = position_error.norm();
+				}
+				else
+				{
+					const AngleAxisd rotation_error(posori_task->_current_orientation * R_init.transpose());
+					const Vector3d orientation_error = rotation_error.angle() * rotation_error.axis();
+					deviation = orientation_error(disturbance - 3);
+					deviation_norm = orientation_error.norm();
+				}
+				DisturbanceResponse& response = responses[disturbance];
+				if(f_applied)
+				{
+					response.peak = max(response.peak, deviation);
+				}
+				else
+				{
+					response.overshoot = max(response.overshoot, -deviation);
+					if(deviation_norm > 0.02 * response.peak)
+					{
+						response.last_unsettled_time = window_time - disturbance_duration;
+					}
+				}
+			}
+
+			posori_task->computeTorques(posori_task_torques);
+			joint_task->computeTorques(joint_task_torques);
+			transport.command_torques = posori_task_torques + joint_task_torques + coriolis;
+
+			metrics.max_task_force = max(metrics.max_task_force, posori_task->_task_force.head(3).norm());
+			metrics.max_torque = max(metrics.max_torque, transport.command_torques.cwiseAbs().maxCoeff());
+		}
+
+		// simulation steps
+		sim->setJointTorques(robot_name, transport.command_torques + disturbance_torques);
+		for(int i=0 ; i<sim_substeps ; i++)
+		{
+			sim->integrate(sim_period);
+		}
+		sim->getJointPositions(robot_name, transport.q);
+		sim->getJointVelocities(robot_name, transport.dq);
+		transport.step++;
+		transport.time = transport.step * control_period;
+
+		if(!transport.q.allFinite() || !transport.dq.allFinite())
+		{
+			metrics.diverged = true;
+			metrics.diverged_time = transport.time;
+			break;
+		}
+	}
+
+	for(int i=0 ; i<n_disturbances ; i++)
+	{
+		const DisturbanceResponse& response = responses[i];
+		const double overshoot = (response.peak > 0) ? response.overshoot / response.peak : 0;
+		if(i < 3)
+		{
+			metrics.max_deviation_pos = max(metrics.max_deviation_pos, response.peak);
+			metrics.overshoot_pos = max(metrics.overshoot_pos, overshoot);
+			metrics.settling_time_pos = max(metrics.settling_time_pos, response.last_unsettled_time);
+		}
+		else
+		{
+			metrics.max_deviation_ori = max(metrics.max_deviation_ori, response.peak);
+			metrics.overshoot_ori = max(metrics.overshoot_ori, overshoot);
+			metrics.settling_time_ori = max(metrics.settling_time_ori, response.last_unsettled_time);
+		}
+	}
+
+	delete posori_task;
+	delete joint_task;
+	if(metrics.diverged)
+	{
+		sim_asset.discard();
+	}
+
+	if(!f_control && !metrics.diverged)
+	{
+		throw runtime_error("initial posture not reached");
+	}
+	return metrics;
+}
+
+void printUsage()
+{
+	cout << "usage : experiment_stiffness_sweep [-j threads] [-o summary.csv]" << endl;
+}
+
+int main(int argc, char** argv) {
+
+	int n_threads = max(1u, thread::hardware_concurrency());
+	string summary_file = default_summary_file;
+
+	for(int i=1 ; i<argc ; i++)
+	{
+		const string option = argv[i];
+		if(option == "-h")
+		{
+			printUsage();
+			return 0;
+		}
+		if(i + 1 >= argc)
+		{
+			cout << "missing value after " << option << endl;
+			printUsage();
+			return 1;
+		}
+		const string value = argv[++i];
+		if(option == "-j")
+		{
+			n_threads = atoi(value.c_str());
+		}
+		else if(option == "-o")
+		{
+			summary_file = value;
+		}
+		else
+		{
+			cout << "unknown option " << option << endl;
+			printUsage();
+			return 1;
+		}
+	}
+	if(n_threads < 1)
+	{
+		cout << "the number of threads should be positive" << endl;
+		return 1;
+	}
+
+	// opened first, not to lose a sweep to a wrong path
+	ofstream summary(summary_file);
+	if(!summary)
+	{
+		cout << "could not open " << summary_file << endl;
+		return 1;
+	}
+
+	vector<SweepParameters> sweep;
+	for(unsigned int controller_type=0 ; controller_type<controller_types.size() ; controller_type++)
+	{
+		for(double kp : kp_values)
+		{
+			for(double kv : kv_values)
+			{
+				sweep.push_back({(int) controller_type, kp, kv});
+			}
+		}
+	}
+
+	cout << sweep.size() << " scenarios of " << experiment_duration << " s on " << n_threads << " threads" << endl;
+
+	PandaUtils::BatchRunner<SweepParameters, SweepMetrics> runner(n_threads);
+	const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	auto results = runner.run(sweep, [](const SweepParameters& parameters, const int index)
+	{
+		return runScenario(parameters);
+	});
+	PandaUtils::AssetRegistry::shared().print(cout);
+	PandaUtils::AssetRegistry::shared().clear();
+	const double wall_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	summary << "controller_type,kp,kv,success,max_deviation_pos,overshoot_pos,settling_time_pos,"
+			<< "max_deviation_ori,overshoot_ori,settling_time_ori,max_task_force,max_torque,diverged,diverged_time,wall_time" << endl;
+	summary << setprecision(6);
+	int n_failed = 0;
+	for(unsigned int i=0 ; i<results.size() ; i++)
+	{
+		const SweepParameters& parameters = sweep[i];
+		const SweepMetrics& metrics = results[i].metrics;
+		summary << controller_types[parameters.controller_type] << "," << parameters.kp << "," << parameters.kv << ","
+				<< results[i].success << ",";
+		if(results[i].success)
+		{
+			summary << metrics.max_deviation_pos << "," << metrics.overshoot_pos << "," << metrics.settling_time_pos << ","
+					<< metrics.max_deviation_ori << "," << metrics.overshoot_ori << "," << metrics.settling_time_ori << ","
+					<< metrics.max_task_force << "," << metrics.max_torque << "," << metrics.diverged << "," << metrics.diverged_time;
+		}
+		else
+		{
+			summary << ",,,,,,,,,";
+			n_failed++;
+		}
+		summary << "," << results[i].wall_time << endl;
+	}
+
+	cout << "sweep done in " << wall_time << " s, " << sweep.size() * experiment_duration / wall_time
+			<< " times real time, summary in " << summary_file << endl;
+	if(n_failed > 0)
+	{
+		cout << n_failed << " scenarios failed" << endl;
+	}
+
+	return 0;
+}
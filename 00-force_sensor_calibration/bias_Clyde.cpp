@@ -6,6 +6,8 @@
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
 #include "tasks/JointTask.h"
+#include "model/MassMatrixInverse.h"
+#include "model/TaskModelCache.h"
 
 #include <iostream>
 #include <fstream>
@@ -97,12 +99,14 @@ int main() {
 
 	// prepare controller	
 	int dof = robot->dof();
+	PandaUtils::MassMatrixInverse<7> mass_matrix_inverse(dof, inertia_regularization ? 0.07 : 0.0);
 	MatrixXd N_prec = MatrixXd::Identity(dof, dof);
 	VectorXd command_torques = VectorXd::Zero(dof);
 	VectorXd coriolis = VectorXd::Zero(dof);
 	
 	// joint task
 	auto joint_task = new Sai2Primitives::JointTask(robot);
+	PandaUtils::TaskModelCache joint_task_model;
 	joint_task->_otg->setMaxVelocity(M_PI/5);
 	joint_task->_otg->setMaxAcceleration(M_PI);
 	joint_task->_otg->setMaxJerk(3*M_PI);
@@ -190,15 +194,9 @@ int main() {
 		{
 			robot->updateKinematics();
 			robot->_M = redis_client.getEigenMatrixJSON(MASSMATRIX_KEY);
-			if(inertia_regularization)
-			{
-				robot->_M(4,4) += 0.07;
-				robot->_M(5,5) += 0.07;
-				robot->_M(6,6) += 0.07;
-			}
-			robot->_M_inv = robot->_M.inverse();
+			mass_matrix_inverse.update(robot);
 		}
-		joint_task->updateTaskModel(N_prec);
+		joint_task_model.update(joint_task, robot->_q, N_prec);
 
 		if(!flag_simulation)
 		{
@@ -0,0 +1,539 @@
+// Force sensor calibration of Bonnie and Clyde at the same time, in one process.
+//
+// the same procedures as bias_Bonnie/Clyde and objectCalibration_Bonnie/Clyde, for both arms :
+//
+//   dual_calibration bias                                : bias of both sensors
+//   dual_calibration tool [Bonnie_tool] [Clyde_tool]     : mass and com of the two tools
+//
+// the main thread does the redis io of both arms, one pipelined read of the joint state,
+// mass matrix and force sensor of both, and one write of both torques. each arm runs its
+// calibration state machine on its own thread, exchanging its state and its torques with
+// the io thread through triple buffers. the results are written by the main thread once
+// both arms are done, so a failed arm does not leave a half written set of files.
+
+#include "Sai2Model.h"
+#include "redis/RedisClient.h"
+#include "redis/MultiRobotRedisIO.h"
+#include "timer/LoopTimer.h"
+#include "threads/TripleBuffer.h"
+#include "tasks/JointTask.h"
+#include "model/MassMatrixInverse.h"
+#include "model/TaskModelCache.h"
+#include "force_control/SensorCalibration.h"
+#include "force_control/ToolCalibrationRLS.h"
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+std::atomic<bool> runloop(true);
+void sighandler(int sig)
+{ runloop = false; }
+
+using namespace std;
+using namespace Eigen;
+
+const string robot_file = "./resources/panda_arm.urdf";
+const string calibration_directory = "../../00-force_sensor_calibration/calibration_files/";
+
+#define BIAS_CALIBRATION     0
+#define TOOL_CALIBRATION     1
+
+const string ALLGERO_PALM_ORIENTATION_KEY = "sai2::allegroHand::controller::palm_orientation";
+
+// tool calibration, as in objectCalibration_*
+const double force_noise = 0.1;
+const double moment_noise = 0.01;
+const double mass_tolerance = 0.005;
+const double com_tolerance = 0.001;
+const unsigned long min_samples = 3000;
+const double sweep_velocity = M_PI/10;
+const double max_sample_velocity = 0.6;
+
+typedef Matrix<double,7,1> Vector7d;
+typedef Matrix<double,7,7> Matrix7d;
+typedef Matrix<double,6,1> Vector6d;
+
+// io thread to calibration thread
+struct RobotInput {
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	RobotInput()
+	: q(Vector7d::Zero()), dq(Vector7d::Zero()), M(Matrix7d::Identity()), force(Vector6d::Zero())
+	{}
+
+	Vector7d q;
+	Vector7d dq;
+	Matrix7d M;
+	Vector6d force;
+};
+
+// calibration thread to io thread
+struct RobotOutput {
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	RobotOutput()
+	: torques(Vector7d::Zero()), R_palm(Matrix3d::Identity())
+	{}
+
+	Vector7d torques;
+	Matrix3d R_palm;
+};
+
+struct CalibrationResult {
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	CalibrationResult()
+	: f_done(false), f_success(false), bias(Vector6d::Zero()), mass(0), com(Vector3d::Zero()), mass_std(0), com_std(0)
+	{}
+
+	bool f_done;
+	bool f_success;
+	Vector6d bias;
+	double mass;
+	Vector3d com;
+	double mass_std;
+	double com_std;
+};
+
+struct RobotCalibration {
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	string name;
+	// first joint of the calibration poses, in degrees
+	double base_joint;
+	// the allegro hand of Clyde follows the palm orientation
+	bool f_palm;
+	string tool_name;
+
+	PandaUtils::TripleBuffer<RobotInput> input_buffer;
+	PandaUtils::TripleBuffer<RobotOutput> output_buffer;
+	std::atomic<bool> f_finished;
+	CalibrationResult result;
+};
+
+void calibrationThread(RobotCalibration* calibration, const int mode);
+void writeBiasXml(const string file_name, const VectorXd sensor_bias);
+void writeCalibrationXml(const string file_name, const string tool_name, const Vector3d object_com, const double object_mass);
+
+int main(int argc, char** argv) {
+
+	if(argc < 2 || (string(argv[1]) != "bias" && string(argv[1]) != "tool"))
+	{
+		cout << "usage :\ndual_calibration bias\ndual_calibration tool [Bonnie_tool_name] [Clyde_tool_name]" << endl;
+		return 0;
+	}
+	const int mode = (string(argv[1]) == "bias") ? BIAS_CALIBRATION : TOOL_CALIBRATION;
+	if(mode == TOOL_CALIBRATION && argc < 4)
+	{
+		cout << "usage :\ndual_calibration tool [Bonnie_tool_name] [Clyde_tool_name]" << endl;
+		return 0;
+	}
+
+	vector<RobotCalibration*> calibrations;
+	const string names[2] = {"Bonnie", "Clyde"};
+	const double base_joints[2] = {0, -90};
+	for(int i=0 ; i<2 ; i++)
+	{
+		RobotCalibration* calibration = new RobotCalibration();
+		calibration->name = names[i];
+		calibration->base_joint = base_joints[i];
+		calibration->f_palm = (names[i] == "Clyde");
+		calibration->tool_name = (mode == TOOL_CALIBRATION) ? string(argv[2+i]) : "";
+		calibration->f_finished = false;
+		calibrations.push_back(calibration);
+	}
+	const int n_robots = calibrations.size();
+
+	// redis keys
+	vector<string> joint_angles_keys, joint_velocities_keys, torques_commanded_keys, massmatrix_keys, force_sensed_keys;
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		const string prefix = "sai2::FrankaPanda::" + calibrations[i]->name;
+		joint_angles_keys.push_back(prefix + "::sensors::q");
+		joint_velocities_keys.push_back(prefix + "::sensors::dq");
+		torques_commanded_keys.push_back(prefix + "::actuators::fgc");
+		massmatrix_keys.push_back(prefix + "::sensors::model::massmatrix");
+		force_sensed_keys.push_back("sai2::ATIGamma_Sensor::" + calibrations[i]->name + "::force_torque");
+	}
+
+	// start redis client
+	auto redis_client = RedisClient();
+	redis_client.connect();
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		if(!redis_client.exists(force_sensed_keys[i]))
+		{
+			redis_client.setEigenMatrixJSON(force_sensed_keys[i], VectorXd::Zero(6));
+		}
+	}
+
+	// set up signal handler
+	signal(SIGABRT, &sighandler);
+	signal(SIGTERM, &sighandler);
+	signal(SIGINT, &sighandler);
+
+	// one read and one write for both arms, the sensors and mass matrices in the same read
+	PandaUtils::MultiRobotRedisIO robots_io(redis_client, joint_angles_keys, joint_velocities_keys, torques_commanded_keys, vector<int>(n_robots, 7));
+	vector<MatrixXd> mass_matrices(n_robots, MatrixXd::Identity(7,7));
+	vector<VectorXd> forces_sensed(n_robots, VectorXd::Zero(6));
+	vector<VectorXd> command_torques(n_robots, VectorXd::Zero(7));
+	MatrixXd R_palm = Matrix3d::Identity();
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		redis_client.addEigenToReadCallback(0, massmatrix_keys[i], mass_matrices[i]);
+		redis_client.addEigenToReadCallback(0, force_sensed_keys[i], forces_sensed[i]);
+		if(calibrations[i]->f_palm)
+		{
+			redis_client.addEigenToWriteCallback(0, ALLGERO_PALM_ORIENTATION_KEY, R_palm);
+		}
+	}
+
+	// the calibration threads start from the current state
+	robots_io.read();
+	RobotInput input;
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		input.q = robots_io._q[i];
+		input.dq = robots_io._dq[i];
+		input.M = mass_matrices[i];
+		input.force = forces_sensed[i];
+		calibrations[i]->input_buffer.reset(input);
+	}
+	vector<thread> calibration_threads;
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		calibration_threads.push_back(thread(calibrationThread, calibrations[i], mode));
+	}
+
+	// io loop
+	LoopTimer timer;
+	timer.initializeTimer();
+	timer.setLoopFrequency(1000);
+	RobotOutput output;
+	bool f_all_finished = false;
+	while(runloop && !f_all_finished)
+	{
+		timer.waitForNextLoop();
+
+		robots_io.read();
+		f_all_finished = true;
+		for(int i=0 ; i<n_robots ; i++)
+		{
+			input.q = robots_io._q[i];
+			input.dq = robots_io._dq[i];
+			input.M = mass_matrices[i];
+			input.force = forces_sensed[i];
+			calibrations[i]->input_buffer.write(input);
+
+			calibrations[i]->output_buffer.read(output);
+			command_torques[i] = output.torques;
+			if(calibrations[i]->f_palm)
+			{
+				R_palm = output.R_palm;
+			}
+			f_all_finished = f_all_finished && calibrations[i]->f_finished;
+		}
+		robots_io.write(command_torques);
+	}
+
+	// a signal stops the calibration threads too
+	runloop = false;
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		calibration_threads[i].join();
+		command_torques[i].setZero();
+	}
+	robots_io.write(command_torques);
+
+	// results, all written here
+	cout << endl;
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		const CalibrationResult& result = calibrations[i]->result;
+		if(!result.f_done)
+		{
+			cout << calibrations[i]->name << " : calibration interrupted, nothing written" << endl;
+			continue;
+		}
+		if(mode == BIAS_CALIBRATION)
+		{
+			cout << calibrations[i]->name << " force bias :\n" << result.bias.transpose() << endl;
+			writeBiasXml(calibration_directory + calibrations[i]->name + "_fsensor_bias.xml", result.bias);
+		}
+		else
+		{
+			cout << calibrations[i]->name << " estimated mass : " << result.mass << " +- " << result.mass_std << endl;
+			cout << calibrations[i]->name << " estimated com : " << result.com.transpose() << " +- " << result.com_std << endl;
+			if(!result.f_success)
+			{
+				cout << "WARNING : " << calibrations[i]->name << " calibration not converged (tolerances " << mass_tolerance << " kg, " << com_tolerance << " m)" << endl;
+			}
+			writeCalibrationXml(calibration_directory + calibrations[i]->tool_name + ".xml", calibrations[i]->tool_name, result.com, result.mass);
+		}
+		cout << endl;
+	}
+
+	double end_time = timer.elapsedTime();
+	cout << "IO Loop run time  : " << end_time << " seconds\n";
+	cout << "IO Loop updates   : " << timer.elapsedCycles() << "\n";
+	cout << "IO Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		delete calibrations[i];
+	}
+	return 0;
+}
+
+// the state machine of one arm, at 1 kHz on its own model
+void calibrationThread(RobotCalibration* calibration, const int mode)
+{
+	auto robot = new Sai2Model::Sai2Model(robot_file, false);
+	const int dof = robot->dof();
+	RobotInput input;
+	RobotOutput output;
+	calibration->input_buffer.read(input);
+	robot->_q = input.q;
+	robot->_dq = input.dq;
+	robot->updateKinematics();
+
+	PandaUtils::MassMatrixInverse<7> mass_matrix_inverse(dof, 0.07);
+	MatrixXd N_prec = MatrixXd::Identity(dof, dof);
+	VectorXd joint_task_torques = VectorXd::Zero(dof);
+
+	auto joint_task = new Sai2Primitives::JointTask(robot);
+	PandaUtils::TaskModelCache joint_task_model;
+	joint_task->_otg->setMaxVelocity(mode == BIAS_CALIBRATION ? M_PI/5 : sweep_velocity);
+	joint_task->_otg->setMaxAcceleration(mode == BIAS_CALIBRATION ? M_PI : M_PI/2);
+	joint_task->_otg->setMaxJerk(3*M_PI);
+	joint_task->_ki = 300.0;
+	joint_task->_kp = 400.0;
+	joint_task->_kv = 25.0;
+
+	Matrix3d R_ee_palm;
+	R_ee_palm << 0, 0, 1,
+				0, -1, 0,
+				1, 0, 0;
+	Matrix3d R_world_ee = Matrix3d::Identity();
+
+	// bias : six poses of the wrist, hold and average
+	vector<VectorXd> q_desired;
+	VectorXd q_des_degrees = VectorXd::Zero(dof);
+	const double q0 = calibration->base_joint;
+	q_des_degrees << q0, 30, 90, -90, -30, 90, 0;
+	q_desired.push_back(M_PI/180.0 * q_des_degrees);
+	q_des_degrees << q0, 30, 90, -90, 60, 90, -135;
+	q_desired.push_back(M_PI/180.0 * q_des_degrees);
+	q_des_degrees << q0, 30, 90, -90, 60, 90, -45;
+	q_desired.push_back(M_PI/180.0 * q_des_degrees);
+	q_des_degrees << q0, 30, 90, -90, 60, 90, 45;
+	q_desired.push_back(M_PI/180.0 * q_des_degrees);
+	q_des_degrees << q0, 30, 90, -90, 60, 90, 135;
+	q_desired.push_back(M_PI/180.0 * q_des_degrees);
+	q_des_degrees << q0, 30, 90, -90, 150, 90, 0;
+	q_desired.push_back(M_PI/180.0 * q_des_degrees);
+	const int measurement_total_length = 1000;
+	int measurement_number = 0;
+	int measurement_counter = measurement_total_length;
+	Vector6d bias_force = Vector6d::Zero();
+	Vector6d current_force_measurement = Vector6d::Zero();
+
+	// tool : a continuous sweep of the last three joints
+	vector<Vector3d> last_joint_positions_increment;
+	last_joint_positions_increment.push_back(M_PI/180.0*Vector3d(-90.0, -45.0, 0.0));
+	last_joint_positions_increment.push_back(M_PI/180.0*Vector3d(0.0, 45.0, 0.0));
+	last_joint_positions_increment.push_back(M_PI/180.0*Vector3d(0.0, 45.0, 0.0));
+	last_joint_positions_increment.push_back(M_PI/180.0*Vector3d(45.0, 0.0, 0.0));
+	last_joint_positions_increment.push_back(M_PI/180.0*Vector3d(0.0, -45.0, 0.0));
+	last_joint_positions_increment.push_back(M_PI/180.0*Vector3d(0.0, -45.0, 0.0));
+	last_joint_positions_increment.push_back(M_PI/180.0*Vector3d(45.0, 0.0, 0.0));
+	last_joint_positions_increment.push_back(M_PI/180.0*Vector3d(0.0, 45.0, 0.0));
+	last_joint_positions_increment.push_back(M_PI/180.0*Vector3d(0.0, 45.0, 0.0));
+	last_joint_positions_increment.push_back(M_PI/180.0*Vector3d(45.0, 0.0, 0.0));
+	last_joint_positions_increment.push_back(M_PI/180.0*Vector3d(0.0, -45.0, 0.0));
+	last_joint_positions_increment.push_back(M_PI/180.0*Vector3d(0.0, -45.0, 0.0));
+	last_joint_positions_increment.push_back(M_PI/180.0*Vector3d(45.0, 0.0, 0.0));
+	last_joint_positions_increment.push_back(M_PI/180.0*Vector3d(0.0, 45.0, 0.0));
+	last_joint_positions_increment.push_back(M_PI/180.0*Vector3d(0.0, 45.0, 0.0));
+	const int n_sweep_points = last_joint_positions_increment.size();
+	int sweep_point = 0;
+	PandaUtils::SensorCalibration sensor_calibration;
+	PandaUtils::ToolCalibrationRLS tool_calibration(force_noise, moment_noise);
+	if(mode == TOOL_CALIBRATION)
+	{
+		if(!sensor_calibration.load(calibration_directory + calibration->name + "_fsensor_bias.xml"))
+		{
+			cout << "WARNING : " << calibration->name << " : " << sensor_calibration.error() << endl;
+		}
+		joint_task->_desired_position = q_desired[0];
+		joint_task->_desired_position.tail(3) += last_joint_positions_increment[sweep_point];
+	}
+	else
+	{
+		joint_task->_desired_position = q_desired[measurement_number];
+	}
+
+	LoopTimer timer;
+	timer.initializeTimer();
+	timer.setLoopFrequency(1000);
+	unsigned long long counter = 0;
+	bool f_done = false;
+
+	while(runloop && !f_done)
+	{
+		timer.waitForNextLoop();
+
+		calibration->input_buffer.read(input);
+		robot->_q = input.q;
+		robot->_dq = input.dq;
+		robot->updateKinematics();
+		robot->_M = input.M;
+		mass_matrix_inverse.update(robot);
+		joint_task_model.update(joint_task, robot->_q, N_prec);
+
+		joint_task->computeTorques(joint_task_torques);
+		output.torques = joint_task_torques;
+		robot->rotation(R_world_ee, "link7");
+		output.R_palm = R_world_ee * R_ee_palm;
+		calibration->output_buffer.write(output);
+
+		if(mode == BIAS_CALIBRATION)
+		{
+			if((joint_task->_current_position - joint_task->_desired_position).norm() < 0.015)
+			{
+				measurement_counter--;
+				if(measurement_counter > measurement_total_length/4.0 && measurement_counter < measurement_total_length/4.0*3.0)
+				{
+					current_force_measurement += input.force;
+				}
+				if(measurement_counter == 0)
+				{
+					bias_force += current_force_measurement*2.0/measurement_total_length;
+					current_force_measurement.setZero();
+
+					measurement_number++;
+					if(measurement_number < (int) q_desired.size())
+					{
+						joint_task->_desired_position = q_desired[measurement_number];
+						measurement_counter = measurement_total_length;
+					}
+					else
+					{
+						cout << calibration->name << " : bias calibration finished" << endl;
+						calibration->result.bias = bias_force / q_desired.size();
+						calibration->result.f_success = true;
+						f_done = true;
+					}
+				}
+			}
+		}
+		else
+		{
+			// the driver gives the force and moment applied by the sensor to the environment
+			if(robot->_dq.norm() < max_sample_velocity)
+			{
+				const Vector6d force = input.force - sensor_calibration.bias();
+				tool_calibration.update(-force.head<3>(), -force.tail<3>(), R_world_ee);
+			}
+
+			if(counter % 1000 == 0)
+			{
+				cout << calibration->name << " : sweep point " << sweep_point+1 << "/" << n_sweep_points << " : mass " << tool_calibration.mass()
+						<< " +- " << tool_calibration.massStd() << ", com " << tool_calibration.com().transpose() << " +- " << tool_calibration.comStd() << endl;
+			}
+
+			if(tool_calibration.converged(mass_tolerance, com_tolerance, min_samples))
+			{
+				cout << calibration->name << " : calibration converged after " << tool_calibration.numSamples() << " samples" << endl;
+				calibration->result.f_success = true;
+				f_done = true;
+			}
+			else if(sweep_point < n_sweep_points-1)
+			{
+				// on to the next position before stopping on this one
+				if((joint_task->_current_position - joint_task->_desired_position).norm() < 0.05)
+				{
+					sweep_point++;
+					joint_task->_desired_position.tail(3) += last_joint_positions_increment[sweep_point];
+				}
+			}
+			else if((joint_task->_current_position - joint_task->_desired_position).norm() < 0.015)
+			{
+				cout << calibration->name << " : end of the sweep" << endl;
+				f_done = true;
+			}
+			if(f_done)
+			{
+				calibration->result.mass = tool_calibration.mass();
+				calibration->result.com = tool_calibration.com();
+				calibration->result.mass_std = tool_calibration.massStd();
+				calibration->result.com_std = tool_calibration.comStd();
+			}
+		}
+
+		counter++;
+	}
+
+	// the arm is released, the io thread sends zero torques until the other one is done
+	output.torques.setZero();
+	calibration->output_buffer.write(output);
+	calibration->result.f_done = f_done;
+	calibration->f_finished = true;
+
+	delete joint_task;
+	delete robot;
+}
+
+void writeBiasXml(const string file_name, const VectorXd sensor_bias)
+{
+	if(sensor_bias.size() != 6)
+	{
+		cout << "bias should be a vector of length 6\nXml file not written" << endl;
+		return;
+	}
+
+	cout << "write bias to file " << file_name << endl;
+
+	ofstream file;
+	file.open(file_name);
+
+	if(file.is_open())
+	{
+		file << "<?xml version=\"1.0\" ?>\n";
+		file << "<force_bias value=\"" << sensor_bias.transpose() << "\"/>\n";
+		file.close();
+	}
+	else
+	{
+		cout << "could not create xml file" << endl;
+	}
+}
+
+void writeCalibrationXml(const string file_name, const string tool_name, const Vector3d object_com, const double object_mass)
+{
+	cout << "write tool properties to file " << file_name << endl;
+
+	ofstream file;
+	file.open(file_name);
+
+	if(file.is_open())
+	{
+		file << "<?xml version=\"1.0\" ?>\n\n";
+		file << "<tool name=\"" << tool_name << "\">\n";
+		file << "\t<inertial>\n";
+		file << "\t\t<origin xyz=\"" << object_com.transpose() << "\" rpy=\"0 0 0\"/>\n";
+		file << "\t\t<mass value=\"" << object_mass << "\"/>\n";
+		file << "\t</inertial>\n";
+		file << "</tool>" << endl;
+		file.close();
+	}
+	else
+	{
+		cout << "could not create xml file" << endl;
+	}
+}
@@ -6,11 +6,14 @@
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
 #include "tasks/JointTask.h"
+#include "model/MassMatrixInverse.h"
+#include "model/TaskModelCache.h"
+#include "force_control/ToolCalibrationRLS.h"
+#include "force_control/SensorCalibration.h"
 
 #include <iostream>
 #include <fstream>
 #include <string>
-#include <tinyxml2.h>
 
 #include <signal.h>
 bool runloop = true;
@@ -42,7 +45,6 @@ string ROBOT_GRAVITY_KEY;
 
 const string ALLGERO_PALM_ORIENTATION_KEY = "sai2::allegroHand::controller::palm_orientation";
 
-VectorXd readBiasXML(const string path_to_bias_file);
 void writeCalibrationXml(const string file_name, const string tool_name, const Vector3d object_com, const double object_mass);
 
 unsigned long long controller_counter = 0;
@@ -52,6 +54,16 @@ const bool flag_simulation = false;
 
 const bool inertia_regularization = true;
 
+// calibration : noise of the sensor readings, standard deviations of the estimate at which the
+// sweep stops, and joint velocity above which the readings are not static enough to be used
+const double force_noise = 0.1;
+const double moment_noise = 0.01;
+const double mass_tolerance = 0.005;
+const double com_tolerance = 0.001;
+const unsigned long min_samples = 3000;
+const double sweep_velocity = M_PI/10;
+const double max_sample_velocity = 0.6;
+
 int main(int argc, char** argv) 
 {
 
@@ -112,14 +124,16 @@ int main(int argc, char** argv)
 
 	// prepare controller	
 	int dof = robot->dof();
+	PandaUtils::MassMatrixInverse<7> mass_matrix_inverse(dof, inertia_regularization ? 0.07 : 0.0);
 	MatrixXd N_prec = MatrixXd::Identity(dof, dof);
 	VectorXd command_torques = VectorXd::Zero(dof);
 	VectorXd coriolis = VectorXd::Zero(dof);
 	
 	// joint task
 	auto joint_task = new Sai2Primitives::JointTask(robot);
-	joint_task->_otg->setMaxVelocity(M_PI/5);
-	joint_task->_otg->setMaxAcceleration(M_PI);
+	PandaUtils::TaskModelCache joint_task_model;
+	joint_task->_otg->setMaxVelocity(sweep_velocity);
+	joint_task->_otg->setMaxAcceleration(M_PI/2);
 	joint_task->_otg->setMaxJerk(3*M_PI);
 
 	VectorXd joint_task_torques = VectorXd::Zero(dof);
@@ -163,30 +177,25 @@ int main(int argc, char** argv)
 	last_joint_positions_increment.push_back(M_PI/180.0*Vector3d(0.0, 45.0, 0.0));
 	last_joint_positions_increment.push_back(M_PI/180.0*Vector3d(0.0, 45.0, 0.0));
 
-	int measurement_number = 0;
-	const int measurement_total_length = 1000;
-	int measurement_counter = measurement_total_length;
-
+	// the wrist sweeps through the positions without stopping, the last one is the end
+	// of the sweep
+	const int n_sweep_points = last_joint_positions_increment.size();
+	int sweep_point = 0;
 	joint_task->_desired_position = q_desired;
-	joint_task->_desired_position.tail(3) += last_joint_positions_increment[measurement_number]; 
+	joint_task->_desired_position.tail(3) += last_joint_positions_increment[sweep_point]; 
 
 	// calibration quantities
-	VectorXd bias_force = readBiasXML(bias_file_name);
+	PandaUtils::SensorCalibration sensor_calibration;
+	if(!sensor_calibration.load(bias_file_name))
+	{
+		cout << "WARNING : " << sensor_calibration.error() << endl;
+	}
+	VectorXd bias_force = sensor_calibration.bias();
 	VectorXd current_force_sensed = VectorXd::Zero(6);
 
-	// return 0;
-
-	Vector3d mean_force = Vector3d::Zero();
-	Vector3d mean_moment = Vector3d::Zero();
-
-	int n_measure_points = last_joint_positions_increment.size();
-	MatrixXd local_gravities_cross = MatrixXd(3*n_measure_points, 3);
-	VectorXd local_moments = VectorXd(3*n_measure_points);
-	Vector3d local_gravity = Vector3d::Zero();
-	Vector3d world_gravity = Vector3d(0.0, 0.0, -9.81);
-	double g2 = world_gravity.transpose() * world_gravity;
-	double estimated_mass = 0;
-	Vector3d estimated_com = Vector3d::Zero();
+	// every reading of the sweep goes in the estimate
+	PandaUtils::ToolCalibrationRLS calibration(force_noise, moment_noise);
+	bool converged = false;
 
 	// create a timer
 	LoopTimer timer;
@@ -215,15 +224,9 @@ int main(int argc, char** argv)
 		{
 			robot->updateKinematics();
 			robot->_M = redis_client.getEigenMatrixJSON(MASSMATRIX_KEY);
-			if(inertia_regularization)
-			{
-				robot->_M(4,4) += 0.07;
-				robot->_M(5,5) += 0.07;
-				robot->_M(6,6) += 0.07;
-			}
-			robot->_M_inv = robot->_M.inverse();
+			mass_matrix_inverse.update(robot);
 		}
-		joint_task->updateTaskModel(N_prec);
+		joint_task_model.update(joint_task, robot->_q, N_prec);
 
 		if(!flag_simulation)
 		{
@@ -241,50 +244,40 @@ int main(int argc, char** argv)
 		// send to redis
 		redis_client.setEigenMatrixJSON(JOINT_TORQUES_COMMANDED_KEY, command_torques);
 
-		// cout << (joint_task->_current_position - joint_task->_desired_position).norm() << endl;
-
-		if((joint_task->_current_position - joint_task->_desired_position).norm() < 0.015)
+		// the driver gives the force and moment applied by the sensor to the environment
+		if(robot->_dq.norm() < max_sample_velocity)
 		{
-			measurement_counter--;
+			Matrix3d R;
+			robot->rotation(R,"link7");
+			calibration.update(-current_force_sensed.head(3), -current_force_sensed.tail(3), R);
+		}
 
-			if(measurement_counter > measurement_total_length/4.0 && measurement_counter < measurement_total_length/4.0*3.0)
-			{
-				mean_force -= current_force_sensed.head(3);   // the driver gives the force and moment applied by the sensor to the environment
-				mean_moment -= current_force_sensed.tail(3);
-			}
+		if(controller_counter % 1000 == 0)
+		{
+			cout << "sweep point " << sweep_point+1 << "/" << n_sweep_points << " : mass " << calibration.mass() << " +- " << calibration.massStd()
+					<< ", com " << calibration.com().transpose() << " +- " << calibration.comStd() << endl;
+		}
 
-			if(measurement_counter == 0)
+		if(calibration.converged(mass_tolerance, com_tolerance, min_samples))
+		{
+			cout << "calibration converged after " << calibration.numSamples() << " samples" << endl;
+			converged = true;
+			runloop = false;
+		}
+		else if(sweep_point < n_sweep_points-1)
+		{
+			// on to the next position before stopping on this one
+			if((joint_task->_current_position - joint_task->_desired_position).norm() < 0.05)
 			{
-				Eigen::Matrix3d R;
-				robot->rotation(R,"link7");
-
-				mean_force /= (measurement_total_length/2);
-				mean_moment /= (measurement_total_length/2);
-				double current_mass = (double) (world_gravity.transpose() * R * mean_force) / g2;
-				estimated_mass += current_mass;
-
-				local_moments.segment<3>(3*(measurement_number)) = mean_moment;
-				local_gravity = R.transpose() * world_gravity;
-				local_gravities_cross.block(3*(measurement_number),0,3,3) = Sai2Model::CrossProductOperator(local_gravity);
-
-				cout << "move to point " << measurement_number+1 << endl;
-
-				measurement_number++;
-
-				if(measurement_number < n_measure_points)
-				{
-					joint_task->_desired_position.tail(3) += last_joint_positions_increment[measurement_number]; 
-					measurement_counter = measurement_total_length;
-					mean_force.setZero();
-					mean_moment.setZero();
-				}
-				else
-				{
-					cout << "bias calibration finished" << endl;
-					runloop = false;
-				}
+				sweep_point++;
+				joint_task->_desired_position.tail(3) += last_joint_positions_increment[sweep_point]; 
 			}
 		}
+		else if((joint_task->_current_position - joint_task->_desired_position).norm() < 0.015)
+		{
+			cout << "end of the sweep" << endl;
+			runloop = false;
+		}
 
 		controller_counter++;
 
@@ -293,18 +286,19 @@ int main(int argc, char** argv)
 	command_torques.setZero();
 	redis_client.setEigenMatrixJSON(JOINT_TORQUES_COMMANDED_KEY, command_torques);
 
-	estimated_mass /= n_measure_points;
-
-	MatrixXd A = - estimated_mass * local_gravities_cross;
-	VectorXd b = local_moments;
-
-	estimated_com = A.colPivHouseholderQr().solve(b);
-
-	writeCalibrationXml(calibration_file_name, tool_name, estimated_com, estimated_mass);
+	if(!converged)
+	{
+		cout << "WARNING : calibration not converged (tolerances " << mass_tolerance << " kg, " << com_tolerance << " m)" << endl;
+	}
+	if(calibration.numSamples() > 0)
+	{
+		writeCalibrationXml(calibration_file_name, tool_name, calibration.com(), calibration.mass());
+	}
 
 	cout << endl;
-	cout << "estimated mass : " << estimated_mass << endl;
-	cout << "estimated com : " << estimated_com.transpose() << endl;
+	cout << "estimated mass : " << calibration.mass() << " +- " << calibration.massStd() << endl;
+	cout << "estimated com : " << calibration.com().transpose() << " +- " << calibration.comStd() << endl;
+	cout << "samples : " << calibration.numSamples() << ", residual rms : " << calibration.residualRms() << endl;
 	cout << endl;
 
 	double end_time = timer.elapsedTime();
@@ -340,39 +334,3 @@ void writeCalibrationXml(const string file_name, const string tool_name, const V
 		cout << "could not create xml file" << endl;
 	}
 }
-
-VectorXd readBiasXML(const string path_to_bias_file)
-{
-	VectorXd sensor_bias = VectorXd::Zero(6);
-	tinyxml2::XMLDocument doc;
-	doc.LoadFile(path_to_bias_file.c_str());
-	if (!doc.Error())
-	{
-		cout << "Loading bias file file ["+path_to_bias_file+"]." << endl;
-		try 
-		{
-
-			std::stringstream bias( doc.FirstChildElement("force_bias")->
-				Attribute("value"));
-			bias >> sensor_bias(0);
-			bias >> sensor_bias(1);
-			bias >> sensor_bias(2);
-			bias >> sensor_bias(3);
-			bias >> sensor_bias(4);
-			bias >> sensor_bias(5);
-			std::stringstream ss; ss << sensor_bias.transpose();
-			cout << "Sensor bias : "+ss.str() << endl;
-		}
-		catch( const std::exception& e ) // reference to the base of a polymorphic object
-		{ 
-			std::cout << e.what(); // information from length_error printed
-			cout << "WARNING : Failed to parse bias file." << endl;
-		}
-	} 
-	else 
-	{
-		cout << "WARNING : Could no load bias file ["+path_to_bias_file+"]" << endl;
-		doc.PrintError();
-	}
-	return sensor_bias;
-}
\ No newline at end of file
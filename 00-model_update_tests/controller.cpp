@@ -1,173 +1,326 @@
+// Micro-benchmark of the robot model and task model computations.
+//
+// times every model computation that the controllers run each tick, one call at a time,
+// at random joint positions, on each robot model that the apps use, and reports the
+// distribution of the time per call. the sum of a group of computations against the
+// period of the loop that runs it tells which ones fit at 1 kHz and which ones should
+// move to a slower model thread.
+//
+// usage : dynamics_benchmark [-n iterations] [-m panda_arm,two_arm_panda] [-s seed] [-o results.csv]
+//   -n  calls timed per computation and per model (default 100000)
+//   -m  models from ./resources, without the .urdf (default all the models below)
+//   -s  seed of the random joint positions (default 1)
+//   -o  csv output file, one line per model and computation
+//
+// the times include one clock read, about 20 to 30 ns. updateModel() includes the
+// kinematics, the mass matrix and its inverse.
+
 #include "Sai2Model.h"
-#include "redis/RedisClient.h"
-#include "timer/LoopTimer.h"
 #include "tasks/JointTask.h"
-
+#include "tasks/PosOriTask.h"
+#include "model/MassMatrixInverse.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <string>
-
-#include <signal.h>
-bool runloop = true;
-void sighandler(int sig)
-{ runloop = false; }
+#include <vector>
 
 using namespace std;
 using namespace Eigen;
 
-const string robot_file = "./resources/panda_arm.urdf";
-const string robot_name = "PANDA";
+struct BenchModel
+{
+	string name;
+	// link of the posori task and the jacobian
+	string link_name;
+};
+
+const vector<BenchModel> bench_models = {
+	{"panda_arm", "link7"},
+	{"panda_arm_hand", "link7"},
+	{"panda_arm_Allegrohand_new", "link7"},
+	{"two_arm_panda", "right_arm_link7"},
+	{"two_pandas_mobile", "link7_arm1"},
+};
+
+const vector<string> computation_names = {
+	"updateKinematics",
+	"updateModel",
+	"J_0",
+	"factorizedChristoffelMatrix",
+	"gravityVector",
+	"coriolisForce",
+	"updateInverseInertia",
+	"M_inverse_LU",
+	"M_inverse_LDLT",
+	"posori_updateTaskModel",
+	"joint_updateTaskModel",
+};
+
+struct BenchResult
+{
+	string model;
+	int dof;
+	string computation;
+	double mean_ns;
+	double p50_ns;
+	double p90_ns;
+	double p99_ns;
+	double p999_ns;
+	double max_ns;
+};
+
+// sorts the durations
+BenchResult summarize(const string& model, const int dof, const string& computation, vector<double>& durations_ns)
+{
+	BenchResult result;
+	result.model = model;
+	result.dof = dof;
+	result.computation = computation;
+
+	const int n = durations_ns.size();
+	sort(durations_ns.begin(), durations_ns.end());
+	double sum = 0;
+	for(int i=0 ; i<n ; i++)
+	{
+		sum += durations_ns[i];
+	}
+	result.mean_ns = sum / n;
+	result.p50_ns = durations_ns[n/2];
+	result.p90_ns = durations_ns[min(n-1, (int)(0.9 * n))];
+	result.p99_ns = durations_ns[min(n-1, (int)(0.99 * n))];
+	result.p999_ns = durations_ns[min(n-1, (int)(0.999 * n))];
+	result.max_ns = durations_ns[n-1];
+	return result;
+}
+
+void benchModel(const BenchModel& bench_model, const int n_iterations, vector<BenchResult>& results)
+{
+	const string filename = "./resources/" + bench_model.name + ".urdf";
+	auto robot = new Sai2Model::Sai2Model(filename, false);
+	const int dof = robot->dof();
+
+	auto posori_task = new Sai2Primitives::PosOriTask(robot, bench_model.link_name, Vector3d::Zero());
+	auto joint_task = new Sai2Primitives::JointTask(robot);
+	PandaUtils::MassMatrixInverse<> mass_matrix_inverse(dof);
+
+	MatrixXd J = MatrixXd::Zero(6, dof);
+	MatrixXd C = MatrixXd::Zero(dof, dof);
+	VectorXd g = VectorXd::Zero(dof);
+	VectorXd b = VectorXd::Zero(dof);
+	MatrixXd M_inv = MatrixXd::Zero(dof, dof);
+	MatrixXd N_prec = MatrixXd::Identity(dof, dof);
 
-// redis keys:
-// - read:
-std::string JOINT_ANGLES_KEY;
-std::string JOINT_VELOCITIES_KEY;
-std::string JOINT_TORQUES_SENSED_KEY;
-// - write
-std::string JOINT_TORQUES_COMMANDED_KEY;
+	const int n_computations = computation_names.size();
+	vector<vector<double>> durations_ns(n_computations, vector<double>(n_iterations));
+
+	chrono::steady_clock::time_point t_start;
+	int k = 0;
+	auto startTimer = [&t_start]()
+	{
+		t_start = chrono::steady_clock::now();
+	};
+	auto stopTimer = [&t_start, &durations_ns, &k](const int iteration)
+	{
+		const auto t_end = chrono::steady_clock::now();
+		durations_ns[k][iteration] = chrono::duration<double, nano>(t_end - t_start).count();
+		k++;
+	};
 
-// - model
-std::string MASSMATRIX_KEY;
-std::string CORIOLIS_KEY;
-std::string ROBOT_GRAVITY_KEY;
+	// warm up the caches and the lazy allocations of the model
+	robot->_q = M_PI / 2 * VectorXd::Random(dof);
+	robot->updateModel();
+	posori_task->updateTaskModel(N_prec);
+	joint_task->updateTaskModel(posori_task->_N);
 
-// - gripper
-std::string GRIPPER_MODE_KEY; // m for move and g for graps
-std::string GRIPPER_MAX_WIDTH_KEY;
-std::string GRIPPER_CURRENT_WIDTH_KEY;
-std::string GRIPPER_DESIRED_WIDTH_KEY;
-std::string GRIPPER_DESIRED_SPEED_KEY;
-std::string GRIPPER_DESIRED_FORCE_KEY;
+	for(int i=0 ; i<n_iterations ; i++)
+	{
+		k = 0;
+		robot->_q = M_PI / 2 * VectorXd::Random(dof);
+		robot->_dq = VectorXd::Random(dof);
 
-// gains
-const string KP_KEY = "sai2::PandaApplication::controller:kp_joint";
-const string KV_KEY = "sai2::PandaApplication::controller:kv_joint";
+		startTimer();
+		robot->updateKinematics();
+		stopTimer(i);
 
-unsigned long long controller_counter = 0;
+		startTimer();
+		robot->updateModel();
+		stopTimer(i);
 
-// const bool flag_simulation = false;
-const bool flag_simulation = true;
+		startTimer();
+		robot->J_0(J, bench_model.link_name, Vector3d::Zero());
+		stopTimer(i);
 
-const bool inertia_regularization = true;
+		startTimer();
+		robot->factorizedChristoffelMatrix(C);
+		stopTimer(i);
 
-int main() {
+		startTimer();
+		robot->gravityVector(g);
+		stopTimer(i);
 
-	if(flag_simulation)
-	{
-		JOINT_ANGLES_KEY  = "sai2::PandaApplication::sensors::q";
-		JOINT_VELOCITIES_KEY = "sai2::PandaApplication::sensors::dq";
-		JOINT_TORQUES_COMMANDED_KEY  = "sai2::PandaApplication::actuators::fgc";
-
-		GRIPPER_MODE_KEY  = "sai2::PandaApplication::gripper::mode"; // m for move and g for graps
-		GRIPPER_MAX_WIDTH_KEY  = "sai2::PandaApplication::gripper::max_width";
-		GRIPPER_CURRENT_WIDTH_KEY  = "sai2::PandaApplication::gripper::current_width";
-		GRIPPER_DESIRED_WIDTH_KEY  = "sai2::PandaApplication::gripper::desired_width";
-		GRIPPER_DESIRED_SPEED_KEY  = "sai2::PandaApplication::gripper::desired_speed";
-		GRIPPER_DESIRED_FORCE_KEY  = "sai2::PandaApplication::gripper::desired_force";		
+		startTimer();
+		robot->coriolisForce(b);
+		stopTimer(i);
+
+		startTimer();
+		robot->updateInverseInertia();
+		stopTimer(i);
+
+		startTimer();
+		M_inv = robot->_M.inverse();
+		stopTimer(i);
+
+		startTimer();
+		mass_matrix_inverse.update(robot);
+		stopTimer(i);
+
+		startTimer();
+		posori_task->updateTaskModel(N_prec);
+		stopTimer(i);
+
+		startTimer();
+		joint_task->updateTaskModel(posori_task->_N);
+		stopTimer(i);
 	}
-	else
+
+	for(int c=0 ; c<n_computations ; c++)
 	{
-		JOINT_TORQUES_COMMANDED_KEY = "sai2::FrankaPanda::actuators::fgc";
-
-		JOINT_ANGLES_KEY  = "sai2::FrankaPanda::sensors::q";
-		JOINT_VELOCITIES_KEY = "sai2::FrankaPanda::sensors::dq";
-		JOINT_TORQUES_SENSED_KEY = "sai2::FrankaPanda::sensors::torques";
-		MASSMATRIX_KEY = "sai2::FrankaPanda::sensors::model::massmatrix";
-		CORIOLIS_KEY = "sai2::FrankaPanda::sensors::model::coriolis";
-		ROBOT_GRAVITY_KEY = "sai2::FrankaPanda::sensors::model::robot_gravity";		
-
-		GRIPPER_MODE_KEY  = "sai2::FrankaPanda::gripper::mode"; // m for move and g for graps
-		GRIPPER_MAX_WIDTH_KEY  = "sai2::FrankaPanda::gripper::max_width";
-		GRIPPER_CURRENT_WIDTH_KEY  = "sai2::FrankaPanda::gripper::current_width";
-		GRIPPER_DESIRED_WIDTH_KEY  = "sai2::FrankaPanda::gripper::desired_width";
-		GRIPPER_DESIRED_SPEED_KEY  = "sai2::FrankaPanda::gripper::desired_speed";
-		GRIPPER_DESIRED_FORCE_KEY  = "sai2::FrankaPanda::gripper::desired_force";
+		results.push_back(summarize(bench_model.name, dof, computation_names[c], durations_ns[c]));
 	}
 
-	// start redis client
-	auto redis_client = RedisClient();
-	redis_client.connect();
+	delete joint_task;
+	delete posori_task;
+	delete robot;
+}
 
-	// set up signal handler
-	signal(SIGABRT, &sighandler);
-	signal(SIGTERM, &sighandler);
-	signal(SIGINT, &sighandler);
+void printUsage()
+{
+	cout << "usage : dynamics_benchmark [-n iterations] [-m panda_arm,two_arm_panda] [-s seed] [-o results.csv]" << endl;
+}
 
-	// load robots
-	auto robot = new Sai2Model::Sai2Model(robot_file, false);
-	robot->_q = redis_client.getEigenMatrixJSON(JOINT_ANGLES_KEY);
-	VectorXd initial_q = robot->_q;
-	robot->updateModel();
+int main(int argc, char** argv) {
 
-	// prepare controller	
-	auto joint_task = new Sai2Primitives::JointTask(robot);
+	int n_iterations = 100000;
+	unsigned int seed = 1;
+	string models_list;
+	string output_file;
 
-	MatrixXd N_prec = MatrixXd::Identity(robot->dof(), robot->dof());
-	VectorXd joint_task_torques = VectorXd::Zero(robot->dof());
-	joint_task->_kp = 100.0;
-	joint_task->_kv = 15.0;
-	redis_client.set(KP_KEY, to_string(joint_task->_kp));
-	redis_client.set(KV_KEY, to_string(joint_task->_kv));
-
-	VectorXd command_torques = VectorXd::Zero(robot->dof());
-
-	// create a timer
-	LoopTimer timer;
-	timer.initializeTimer();
-	timer.setLoopFrequency(1000); 
-	double start_time = timer.elapsedTime(); //secs
-	bool fTimerDidSleep = true;
-
-	while (runloop) {
-		// wait for next scheduled loop
-		timer.waitForNextLoop();
-		double time = timer.elapsedTime() - start_time;
-
-		// read robot state from redis
-		robot->_q = redis_client.getEigenMatrixJSON(JOINT_ANGLES_KEY);
-		robot->_dq = redis_client.getEigenMatrixJSON(JOINT_VELOCITIES_KEY);
-
-		// update model
-		if(flag_simulation)
+	for(int i=1 ; i<argc ; i++)
+	{
+		const string option = argv[i];
+		if(option == "-h")
+		{
+			printUsage();
+			return 0;
+		}
+		if(i + 1 >= argc)
+		{
+			cout << "missing value after " << option << endl;
+			printUsage();
+			return 1;
+		}
+		const string value = argv[++i];
+		if(option == "-n")
 		{
-			robot->updateModel();
+			n_iterations = atoi(value.c_str());
+		}
+		else if(option == "-m")
+		{
+			models_list = value;
+		}
+		else if(option == "-s")
+		{
+			seed = atoi(value.c_str());
+		}
+		else if(option == "-o")
+		{
+			output_file = value;
 		}
 		else
 		{
-			joint_task->_kp = stod(redis_client.get(KP_KEY));
-			joint_task->_kv = stod(redis_client.get(KV_KEY));
-			robot->updateKinematics();
-			robot->_M = redis_client.getEigenMatrixJSON(MASSMATRIX_KEY);
-			if(inertia_regularization)
+			cout << "unknown option " << option << endl;
+			printUsage();
+			return 1;
+		}
+	}
+	if(n_iterations < 1)
+	{
+		cout << "the number of iterations should be positive" << endl;
+		return 1;
+	}
+
+	vector<BenchModel> models;
+	if(models_list.empty())
+	{
+		models = bench_models;
+	}
+	else
+	{
+		stringstream models_stream(models_list);
+		string model_name;
+		while(getline(models_stream, model_name, ','))
+		{
+			bool found = false;
+			for(const BenchModel& bench_model : bench_models)
 			{
-				robot->_M(4,4) += 0.07;
-				robot->_M(5,5) += 0.07;
-				robot->_M(6,6) += 0.07;
+				if(bench_model.name == model_name)
+				{
+					models.push_back(bench_model);
+					found = true;
+				}
+			}
+			if(!found)
+			{
+				cout << "unknown model " << model_name << endl;
+				return 1;
 			}
-			// cout << robot->_M << endl;
-			// robot->_M = Eigen::MatrixXd::Identity(robot->dof(), robot->dof());
-			robot->_M_inv = robot->_M.inverse();
 		}
-		joint_task->updateTaskModel(N_prec);
-
-		// compute torques
-		joint_task->_desired_position(2) = initial_q(2) + 25/180.0*M_PI * sin(2*M_PI*0.3*time);
-		joint_task->computeTorques(joint_task_torques);
-
-		command_torques = joint_task_torques;
-
-		// send to redis
-		redis_client.setEigenMatrixJSON(JOINT_TORQUES_COMMANDED_KEY, command_torques);
+	}
 
-		controller_counter++;
+	// VectorXd::Random uses rand()
+	srand(seed);
 
+	vector<BenchResult> results;
+	for(const BenchModel& bench_model : models)
+	{
+		benchModel(bench_model, n_iterations, results);
 	}
 
-	double end_time = timer.elapsedTime();
-    std::cout << "\n";
-    std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
-    std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
-    std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+	cout << "per call times in ns, " << n_iterations << " calls" << endl;
+	cout << left << setw(28) << "model" << setw(5) << "dof" << setw(30) << "computation" << right
+			<< setw(10) << "mean" << setw(10) << "p50" << setw(10) << "p90" << setw(10) << "p99"
+			<< setw(10) << "p99.9" << setw(10) << "max" << endl;
+	cout << fixed << setprecision(0);
+	for(const BenchResult& result : results)
+	{
+		cout << left << setw(28) << result.model << setw(5) << result.dof << setw(30) << result.computation << right
+				<< setw(10) << result.mean_ns << setw(10) << result.p50_ns << setw(10) << result.p90_ns
+				<< setw(10) << result.p99_ns << setw(10) << result.p999_ns << setw(10) << result.max_ns << endl;
+	}
 
+	if(!output_file.empty())
+	{
+		ofstream csv(output_file);
+		if(!csv)
+		{
+			cout << "could not open " << output_file << endl;
+			return 1;
+		}
+		csv << "model,dof,computation,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns" << endl;
+		csv << fixed << setprecision(1);
+		for(const BenchResult& result : results)
+		{
+			csv << result.model << "," << result.dof << "," << result.computation << ","
+					<< result.mean_ns << "," << result.p50_ns << "," << result.p90_ns << ","
+					<< result.p99_ns << "," << result.p999_ns << "," << result.max_ns << endl;
+		}
+	}
 
 	return 0;
 }
@@ -8,6 +8,7 @@
 #include "filters/ButterworthFilter.h"
 #include "tasks/JointTask.h"
 #include "tasks/PosOriTask.h"
+#include "model/MassMatrixInverse.h"
 
 #include <iostream>
 #include <string>
@@ -104,6 +105,7 @@ int main() {
 
 	// prepare controller	
 	int dof = robot->dof();
+	PandaUtils::MassMatrixInverse<7> mass_matrix_inverse(dof);
 	VectorXd command_torques = VectorXd::Zero(dof);
 	VectorXd coriolis = VectorXd::Zero(dof);
 	MatrixXd N_prec = MatrixXd::Identity(dof, dof);
@@ -182,7 +184,7 @@ int main() {
 		{
 			robot->updateKinematics();
 			robot->_M = redis_client.getEigenMatrixJSON(MASSMATRIX_KEY);
-			robot->_M_inv = robot->_M.inverse();
+			mass_matrix_inverse.update(robot);
 
 			coriolis = redis_client.getEigenMatrixJSON(CORIOLIS_KEY);
 		}
@@ -4,9 +4,14 @@
 
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
+#include "redis/TelemetryWriter.h"
+#include "redis/StampedInput.h"
 #include "timer/LoopTimer.h"
-#include "filters/ButterworthFilter.h"
-#include "KalmanFilter.h"
+#include "timer/LoopHealth.h"
+#include "threads/RealtimeThread.h"
+#include "filters/ButterworthFilterBank.h"
+#include "filters/StreamResampler.h"
+#include "kalman_filters/JointKalmanFilter.h"
 
 #include <iostream>
 #include <string>
@@ -27,6 +32,9 @@ const string robot_name = "PANDA";
 std::string JOINT_ANGLES_KEY;
 std::string JOINT_VELOCITIES_KEY;
 std::string JOINT_TORQUES_SENSED_KEY;
+// time at which the simviz sampled the state. the driver does not stamp it, the samples are
+// then stamped when they arrive
+std::string JOINT_STATE_STAMP_KEY;
 // - write
 std::string JOINT_TORQUES_COMMANDED_KEY;
 
@@ -43,9 +51,11 @@ string LOG_Q_KALMAN_KEY = "sai2::PandaApplication::logger::q_kalman";
 string LOG_DQ_KALMAN_KEY = "sai2::PandaApplication::logger::dq_kalman";
 string LOG_DDQ_KALMAN_KEY = "sai2::PandaApplication::logger::ddq_kalman";
 
+const string LOOP_HEALTH_KEY = "sai2::PandaApplication::controller::loop_health";
 unsigned long long controller_counter = 0;
 
 const bool flag_simulation = false;
+
 // const bool flag_simulation = true;
 
 const bool inertia_regularization = true;
@@ -56,6 +66,7 @@ int main() {
 	{
 		JOINT_ANGLES_KEY  = "sai2::PandaApplication::sensors::q";
 		JOINT_VELOCITIES_KEY = "sai2::PandaApplication::sensors::dq";
+		JOINT_STATE_STAMP_KEY = "sai2::PandaApplication::sensors::state_stamp";
 		JOINT_TORQUES_COMMANDED_KEY  = "sai2::PandaApplication::actuators::fgc";
 	}
 	else
@@ -97,18 +108,20 @@ int main() {
 	VectorXd ddq_from_dq_driver_filtered = VectorXd::Zero(dof);
 	VectorXd ddq_from_dq_diff_filtered = VectorXd::Zero(dof);
 
+	// joint angles aligned on the ticks of the controller, for the kalman filter
+	VectorXd q_aligned = VectorXd::Zero(dof);
 	VectorXd q_kalman = VectorXd::Zero(dof);
 	VectorXd dq_kalman = VectorXd::Zero(dof);
 	VectorXd ddq_kalman = VectorXd::Zero(dof);
 
 	// create filters
-	// - butterworth
-	auto lowpass_filter_dq_driver = new ButterworthFilter(dof, 0.07);
-	auto lowpass_filter_dq_diff = new ButterworthFilter(dof, 0.015);
-	auto lowpass_filter_ddq_from_dq_driver = new ButterworthFilter(dof, 0.015);
-	auto lowpass_filter_ddq_from_dq_diff = new ButterworthFilter(dof, 0.005);
+	// - butterworth, one bank for [dq_driver; dq_from_q_diff; ddq_from_dq_driver; ddq_from_dq_diff]
+	auto lowpass_filter_bank = new PandaUtils::ButterworthFilterBank<>(4*dof, 0.015);
+	lowpass_filter_bank->setCutoffFrequency(0, dof, 0.07);
+	lowpass_filter_bank->setCutoffFrequency(3*dof, dof, 0.005);
+	VectorXd signals_to_filter = VectorXd::Zero(4*dof);
 
-	// - kalman
+	// - kalman, one filter per joint (the matrices do not couple the joints)
 	double dt = 0.001;
 	MatrixXd F = MatrixXd::Identity(21,21);
 	F.block<7,7>(0,7) = dt * MatrixXd::Identity(7,7);
@@ -122,7 +135,8 @@ int main() {
 
 	MatrixXd R = 0.1 * MatrixXd::Identity(7,7);
 
-	auto kalman_filter = new KalmanFilters::KalmanFilter(dt, F, H, Q, R);
+	auto kalman_filter = new KalmanFilters::JointKalmanFilter<7>(dt, F, H, Q, R);
+	kalman_filter->enableSteadyStateGain();
 	VectorXd x0_kalman = VectorXd::Zero(21);
 	x0_kalman.head(7) = robot->_q;
 	kalman_filter->init(x0_kalman);
@@ -131,54 +145,71 @@ int main() {
 
 	// redis setup
 	redis_client.createReadCallback(0);
-	redis_client.createWriteCallback(0);
 
-	redis_client.addEigenToReadCallback(0, JOINT_ANGLES_KEY, q);
+	PandaUtils::StampedInput q_input(JOINT_ANGLES_KEY, JOINT_STATE_STAMP_KEY, dof);
+	q_input.addToReadCallback(redis_client, 0);
 	redis_client.addEigenToReadCallback(0, JOINT_VELOCITIES_KEY, dq_driver);
 
-	redis_client.addEigenToWriteCallback(0, LOG_Q_KEY, q);
-	redis_client.addEigenToWriteCallback(0, LOG_DQ_DRIVER_KEY, dq_driver);
+	// the kalman filter assumes samples every dt : it gets the joint angles interpolated at
+	// the tick, one period late so that there is a sample on each side of it under jitter
+	PandaUtils::StreamResampler<7> q_stream(dof);
+	q_stream.push(PandaUtils::monotonicMicroseconds() * 1e-6 - dt, robot->_q);
+	q = robot->_q;
+
+	// log keys are sent by a background thread, only the latest values
+	PandaUtils::TelemetryWriter telemetry;
+
+	telemetry.addEigen(LOG_Q_KEY, q);
+	telemetry.addEigen(LOG_DQ_DRIVER_KEY, dq_driver);
 
-	redis_client.addEigenToWriteCallback(0, LOG_DQ_DRIVER_FILTERED_KEY, dq_driver_filtered);
-	redis_client.addEigenToWriteCallback(0, LOG_DQ_FROM_QDIFF_FILTERED_KEY, dq_from_q_diff_filtered);
-	redis_client.addEigenToWriteCallback(0, LOG_DDQ_FROM_DQ_DRIVER_FILTERED_KEY, ddq_from_dq_driver_filtered);
-	redis_client.addEigenToWriteCallback(0, LOG_DDQ_FROM_DQ_DIFF_FILTERED_KEY, ddq_from_dq_diff_filtered);
+	telemetry.addEigen(LOG_DQ_DRIVER_FILTERED_KEY, dq_driver_filtered);
+	telemetry.addEigen(LOG_DQ_FROM_QDIFF_FILTERED_KEY, dq_from_q_diff_filtered);
+	telemetry.addEigen(LOG_DDQ_FROM_DQ_DRIVER_FILTERED_KEY, ddq_from_dq_driver_filtered);
+	telemetry.addEigen(LOG_DDQ_FROM_DQ_DIFF_FILTERED_KEY, ddq_from_dq_diff_filtered);
 
-	redis_client.addEigenToWriteCallback(0, LOG_Q_KALMAN_KEY, q_kalman);
-	redis_client.addEigenToWriteCallback(0, LOG_DQ_KALMAN_KEY, dq_kalman);
-	redis_client.addEigenToWriteCallback(0, LOG_DDQ_KALMAN_KEY, ddq_kalman);
+	telemetry.addEigen(LOG_Q_KALMAN_KEY, q_kalman);
+	telemetry.addEigen(LOG_DQ_KALMAN_KEY, dq_kalman);
+	telemetry.addEigen(LOG_DDQ_KALMAN_KEY, ddq_kalman);
+
+	telemetry.start();
 
 	// create a timer
 	LoopTimer timer;
 	timer.initializeTimer();
 	timer.setLoopFrequency(1000); 
+	PandaUtils::LoopHealth loop_health(1000);
+	PandaUtils::configureRealtimeThread("controller", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
 	double start_time = timer.elapsedTime(); //secs
 	double prev_time = 0;
 	double time = 0;
-	bool fTimerDidSleep = true;
 
 	while (runloop) {
 		// wait for next scheduled loop
-		timer.waitForNextLoop();
+		loop_health.waitForNextLoop(timer);
 		prev_time = time;
 		time = timer.elapsedTime() - start_time;
 		// double dt = time - prev_time;
 
 		// read robot state from redis
 		redis_client.executeReadCallback(0);
+		const double read_time = PandaUtils::monotonicMicroseconds();
+		if(q_input.receive(read_time))
+		{
+			q = q_input.value();
+			q_stream.push(q_input.time(), q);
+		}
+		q_aligned = q_stream.sample(read_time * 1e-6 - dt);
 
 		dq_from_q_diff = (q - q_prev)/dt;
 		ddq_from_dq_driver = (dq_driver - dq_driver_prev)/dt;
 		ddq_from_dq_diff = (dq_from_q_diff - dq_from_q_diff_prev)/dt;
 
-		VectorXd dq_driver_filtered_tmp = lowpass_filter_dq_driver->update(dq_driver);
-		VectorXd dq_from_q_diff_filtered_tmp = lowpass_filter_dq_diff->update(dq_from_q_diff);
-		VectorXd ddq_from_dq_driver_filtered_tmp = lowpass_filter_ddq_from_dq_driver->update(ddq_from_dq_driver);
-		VectorXd ddq_from_dq_diff_filtered_tmp = lowpass_filter_ddq_from_dq_diff->update(ddq_from_dq_diff);
-		dq_driver_filtered = dq_driver_filtered_tmp;
-		dq_from_q_diff_filtered = dq_from_q_diff_filtered_tmp;
-		ddq_from_dq_driver_filtered = ddq_from_dq_driver_filtered_tmp;
-		ddq_from_dq_diff_filtered = ddq_from_dq_diff_filtered_tmp;
+		signals_to_filter << dq_driver, dq_from_q_diff, ddq_from_dq_driver, ddq_from_dq_diff;
+		const VectorXd& filtered_signals = lowpass_filter_bank->update(signals_to_filter);
+		dq_driver_filtered = filtered_signals.segment(0, dof);
+		dq_from_q_diff_filtered = filtered_signals.segment(dof, dof);
+		ddq_from_dq_driver_filtered = filtered_signals.segment(2*dof, dof);
+		ddq_from_dq_diff_filtered = filtered_signals.segment(3*dof, dof);
 
 		if(dq_driver_filtered(2) > 3)
 		{
@@ -187,26 +218,34 @@ int main() {
 			cout << endl;
 		}
 
-		kalman_filter->update(q);
+		kalman_filter->update(q_aligned);
 		kalman_state = kalman_filter->getState();
 		q_kalman = kalman_state.segment<7>(0);
 		dq_kalman = kalman_state.segment<7>(7);
 		ddq_kalman = kalman_state.segment<7>(14);
 
-		redis_client.executeWriteCallback(0);
+		telemetry.publish();
 
 		q_prev = q;
 		dq_driver_prev = dq_driver;
 		dq_from_q_diff_prev = dq_from_q_diff;
 
+		if(controller_counter % 1000 == 0)
+		{
+			loop_health.publish(redis_client, LOOP_HEALTH_KEY);
+		}
+
 		controller_counter++;
 	}
 
+	telemetry.stop();
+
 	double end_time = timer.elapsedTime();
     std::cout << "\n";
     std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
     std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
     std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+    loop_health.print(std::cout);
 
 
 	return 0;
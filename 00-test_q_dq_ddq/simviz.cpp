@@ -8,6 +8,8 @@
 #include <dynamics3d.h>
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
+#include "redis/SequenceStamp.h"
+#include "threads/RealtimeThread.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
 
@@ -31,6 +33,8 @@ const string camera_name = "camera_fixed";
 // - write:
 std::string JOINT_ANGLES_KEY  = "sai2::PandaApplication::sensors::q";
 std::string JOINT_VELOCITIES_KEY = "sai2::PandaApplication::sensors::dq";
+// time at which the state was sampled, for the controller to align it on its ticks
+const std::string JOINT_STATE_STAMP_KEY = "sai2::PandaApplication::sensors::state_stamp";
 // - read
 const std::string TORQUES_COMMANDED_KEY  = "sai2::PandaApplication::actuators::fgc";
 
@@ -270,6 +274,9 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim) {
 	bool fTimerDidSleep = true;
 
 	unsigned long long simulation_counter = 0;
+	PandaUtils::SequenceStamper state_stamper;
+
+	PandaUtils::configureRealtimeThread("simulation", PandaUtils::RealtimeConfig::fifo(70, PandaUtils::simulationCpus()));
 
 	while (fSimulationRunning) {
 		fTimerDidSleep = timer.waitForNextLoop();
@@ -351,6 +358,7 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim) {
 		// write new robot state to redis
 		redis_client.setEigenMatrixJSON(JOINT_ANGLES_KEY, robot->_q.head<7>());
 		redis_client.setEigenMatrixJSON(JOINT_VELOCITIES_KEY, robot->_dq.head<7>());
+		redis_client.setEigenMatrixJSON(JOINT_STATE_STAMP_KEY, state_stamper.next());
 		redis_client.set(GRIPPER_CURRENT_WIDTH_KEY, to_string(gripper_width));
 
 		//update last time
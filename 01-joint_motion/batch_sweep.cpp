@@ -0,0 +1,333 @@
+// Parameter sweep of the joint motion controller, without redis and without graphics.
+//
+// runs the simulation of simviz.cpp and the controller of controller.cpp in one process,
+// one pair per scenario, for every combination of the gains, static friction and payload
+// below, on all the cores, and reports the tracking metrics of each combination. each
+// pair is stepped in lockstep in its thread : one controller step, then the simulation
+// steps of one control period, with the state and torques in an InMemoryTransport.
+//
+// usage : batch_sweep01 [-j threads] [-t duration] [-o results.csv]
+//   -j  threads, counting the main thread (default the number of cores)
+//   -t  simulated seconds per scenario (default 10)
+//   -o  csv output file, one line per scenario
+//
+// the payload is a mass held at the flange that the controller does not know about, its
+// weight is applied to the simulated arm as joint torques.
+
+#include "Sai2Model.h"
+#include "Sai2Simulation.h"
+#include <dynamics3d.h>
+#include "tasks/JointTask.h"
+#include "sim/AssetRegistry.h"
+#include "sim/BatchRunner.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+const string world_file = "./resources/world.urdf";
+const string sim_robot_file = "./resources/panda_arm_hand.urdf";
+const string robot_file = "./resources/panda_arm.urdf";
+const string robot_name = "PANDA";
+
+// same periods as the lockstep mode of simviz and controller
+const double control_period = 0.001;
+const double sim_period = 0.0005;
+const int sim_substeps = 2;
+
+// swept values
+const vector<double> kp_values = {50.0, 100.0, 200.0, 400.0};
+const vector<double> kv_values = {10.0, 15.0, 20.0, 30.0};
+const vector<double> friction_values = {0.3, 0.6, 1.0};
+const vector<double> payload_values = {0.0, 1.0, 2.0};
+
+struct SweepParameters
+{
+	double kp;
+	double kv;
+	double friction;
+	// kg at the flange
+	double payload;
+};
+
+struct SweepMetrics
+{
+	// norm of the joint position error, rad
+	double rms_error;
+	double max_error;
+	double max_torque;
+	// integral of the squared torques, N^2m^2s
+	double effort;
+	// the state was not finite before the end
+	bool diverged;
+	double diverged_time;
+};
+
+SweepMetrics runScenario(const SweepParameters& parameters, const double duration)
+{
+	// built by the first scenarios of the threads, then reused
+	PandaUtils::AssetRegistry::Lease<PandaUtils::SimulationAsset> sim_asset = PandaUtils::leaseSimulation(world_file, {robot_name});
+	Simulation::Sai2Simulation* sim = sim_asset->sim.get();
+	sim->setCollisionRestitution(0);
+	sim->setCoeffFrictionStatic(parameters.friction);
+
+	// arm and gripper in the simulation, arm only in the controller
+	PandaUtils::AssetRegistry::Lease<Sai2Model::Sai2Model> sim_robot = PandaUtils::leaseModel(sim_robot_file);
+	sim->getJointPositions(robot_name, sim_robot->_q);
+	sim->getJointVelocities(robot_name, sim_robot->_dq);
+	sim_robot->updateKinematics();
+	const int sim_dof = sim_robot->dof();
+
+	PandaUtils::AssetRegistry::Lease<Sai2Model::Sai2Model> robot = PandaUtils::leaseModel(robot_file);
+	const int dof = robot->dof();
+	PandaUtils::InMemoryTransport transport(dof, dof);
+	transport.q = sim_robot->_q.head(dof);
+	transport.dq = sim_robot->_dq.head(dof);
+
+	robot->_q = transport.q;
+	robot->updateModel();
+	VectorXd initial_q = robot->_q;
+
+	auto joint_task = new Sai2Primitives::JointTask(robot.get());
+	joint_task->_kp = parameters.kp;
+	joint_task->_kv = parameters.kv;
+	MatrixXd N_prec = MatrixXd::Identity(dof, dof);
+	VectorXd joint_task_torques = VectorXd::Zero(dof);
+
+	// gripper held at its initial width, as in simviz
+	const double kp_gripper = 50.0;
+	const double kv_gripper = 14.0;
+	const double gripper_desired_width = sim_robot->_q(7) - sim_robot->_q(8);
+
+	VectorXd command_torques_simulation = VectorXd::Zero(sim_dof);
+	VectorXd payload_torques = VectorXd::Zero(sim_dof);
+	MatrixXd J_payload = MatrixXd::Zero(3, sim_dof);
+	const Vector3d payload_weight = Vector3d(0, 0, -9.81 * parameters.payload);
+	const Vector3d payload_pos_in_link = Vector3d(0, 0, 0.107);
+
+	SweepMetrics metrics;
+	metrics.max_error = 0;
+	metrics.max_torque = 0;
+	metrics.effort = 0;
+	metrics.diverged = false;
+	metrics.diverged_time = 0;
+	double squared_error_sum = 0;
+
+	const unsigned long long n_steps = duration / control_period;
+	for(unsigned long long step=0 ; step<n_steps ; step++)
+	{
+		// controller step
+		const double time = transport.time;
+		robot->_q = transport.q;
+		robot->_dq = transport.dq;
+		robot->updateModel();
+		joint_task->updateTaskModel(N_prec);
+
+		joint_task->_desired_position(2) = initial_q(2) + 25/180.0*M_PI * sin(2*M_PI*0.3*time);
+		joint_task->computeTorques(joint_task_torques);
+		transport.command_torques = joint_task_torques;
+
+		const double error = (joint_task->_desired_position - robot->_q).norm();
+		squared_error_sum += error * error;
+		metrics.max_error = max(metrics.max_error, error);
+		metrics.max_torque = max(metrics.max_torque, transport.command_torques.cwiseAbs().maxCoeff());
+		metrics.effort += transport.command_torques.squaredNorm() * control_period;
+
+		// simulation steps
+		for(int i=0 ; i<sim_substeps ; i++)
+		{
+			const double gripper_width = sim_robot->_q(7) - sim_robot->_q(8);
+			const double gripper_opening_speed = sim_robot->_dq(7) - sim_robot->_dq(8);
+			const double gripper_center_point = sim_robot->_q(7) + sim_robot->_q(8);
+			const double gripper_center_point_velocity = sim_robot->_dq(7) + sim_robot->_dq(8);
+			const double gripper_constraint_force = -400.0*gripper_center_point - 40.0*gripper_center_point_velocity;
+			const double gripper_behavior_force = -kp_gripper*(gripper_width - gripper_desired_width) - kv_gripper*gripper_opening_speed;
+
+			sim_robot->Jv(J_payload, "link7", payload_pos_in_link);
+			payload_torques = J_payload.transpose() * payload_weight;
+
+			command_torques_simulation.head(dof) = transport.command_torques;
+			command_torques_simulation(7) = gripper_constraint_force + gripper_behavior_force;
+			command_torques_simulation(8) = gripper_constraint_force - gripper_behavior_force;
+			command_torques_simulation += payload_torques;
+
+			sim->setJointTorques(robot_name, command_torques_simulation);
+			sim->integrate(sim_period);
+			sim->getJointPositions(robot_name, sim_robot->_q);
+			sim->getJointVelocities(robot_name, sim_robot->_dq);
+			sim_robot->updateKinematics();
+		}
+		transport.q = sim_robot->_q.head(dof);
+		transport.dq = sim_robot->_dq.head(dof);
+		transport.step++;
+		transport.time = transport.step * control_period;
+
+		if(!transport.q.allFinite() || !transport.dq.allFinite())
+		{
+			metrics.diverged = true;
+			metrics.diverged_time = transport.time;
+			break;
+		}
+	}
+	metrics.rms_error = sqrt(squared_error_sum / max<unsigned long long>(transport.step, 1));
+	if(metrics.diverged)
+	{
+		metrics.rms_error = numeric_limits<double>::infinity();
+		sim_asset.discard();
+	}
+
+	delete joint_task;
+
+	return metrics;
+}
+
+void printUsage()
+{
+	cout << "usage : batch_sweep01 [-j threads] [-t duration] [-o results.csv]" << endl;
+}
+
+int main(int argc, char** argv) {
+
+	int n_threads = max(1u, thread::hardware_concurrency());
+	double duration = 10.0;
+	string output_file;
+
+	for(int i=1 ; i<argc ; i++)
+	{
+		const string option = argv[i];
+		if(option == "-h")
+		{
+			printUsage();
+			return 0;
+		}
+		if(i + 1 >= argc)
+		{
+			cout << "missing value after " << option << endl;
+			printUsage();
+			return 1;
+		}
+		const string value = argv[++i];
+		if(option == "-j")
+		{
+			n_threads = atoi(value.c_str());
+		}
+		else if(option == "-t")
+		{
+			duration = atof(value.c_str());
+		}
+		else if(option == "-o")
+		{
+			output_file = value;
+		}
+		else
+		{
+			cout << "unknown option " << option << endl;
+			printUsage();
+			return 1;
+		}
+	}
+	if(n_threads < 1 || duration <= 0)
+	{
+		cout << "the number of threads and the duration should be positive" << endl;
+		return 1;
+	}
+
+	vector<SweepParameters> sweep;
+	for(double kp : kp_values)
+	{
+		for(double kv : kv_values)
+		{
+			for(double friction : friction_values)
+			{
+				for(double payload : payload_values)
+				{
+					sweep.push_back({kp, kv, friction, payload});
+				}
+			}
+		}
+	}
+
+	cout << sweep.size() << " scenarios of " << duration << " s on " << n_threads << " threads" << endl;
+
+	PandaUtils::BatchRunner<SweepParameters, SweepMetrics> runner(n_threads);
+	auto results = runner.run(sweep, [duration](const SweepParameters& parameters, const int index)
+	{
+		return runScenario(parameters, duration);
+	});
+	PandaUtils::AssetRegistry::shared().print(cout);
+	PandaUtils::AssetRegistry::shared().clear();
+
+	// best tracking first
+	vector<int> ranking;
+	for(unsigned int i=0 ; i<results.size() ; i++)
+	{
+		if(results[i].success)
+		{
+			ranking.push_back(i);
+		}
+	}
+	sort(ranking.begin(), ranking.end(), [&results](const int a, const int b)
+	{
+		return results[a].metrics.rms_error < results[b].metrics.rms_error;
+	});
+
+	cout << "\n" << right << setw(8) << "kp" << setw(8) << "kv" << setw(10) << "friction" << setw(9) << "payload"
+			<< setw(12) << "rms error" << setw(12) << "max error" << setw(12) << "max torque" << setw(12) << "effort" << endl;
+	cout << fixed;
+	for(int i : ranking)
+	{
+		const SweepParameters& parameters = sweep[i];
+		const SweepMetrics& metrics = results[i].metrics;
+		cout << setprecision(1) << setw(8) << parameters.kp << setw(8) << parameters.kv << setw(10) << parameters.friction
+				<< setw(9) << parameters.payload << setprecision(5) << setw(12) << metrics.rms_error << setw(12) << metrics.max_error
+				<< setprecision(2) << setw(12) << metrics.max_torque << setw(12) << metrics.effort
+				<< (metrics.diverged ? "  diverged at " + to_string(metrics.diverged_time) + " s" : "") << endl;
+	}
+	const int n_failed = results.size() - ranking.size();
+	if(n_failed > 0)
+	{
+		cout << n_failed << " scenarios failed" << endl;
+	}
+
+	if(!output_file.empty())
+	{
+		ofstream csv(output_file);
+		if(!csv)
+		{
+			cout << "could not open " << output_file << endl;
+			return 1;
+		}
+		csv << "kp,kv,friction,payload,success,rms_error,max_error,max_torque,effort,diverged,diverged_time,wall_time" << endl;
+		csv << setprecision(6);
+		for(unsigned int i=0 ; i<results.size() ; i++)
+		{
+			const SweepParameters& parameters = sweep[i];
+			const SweepMetrics& metrics = results[i].metrics;
+			csv << parameters.kp << "," << parameters.kv << "," << parameters.friction << "," << parameters.payload << ","
+					<< results[i].success << ",";
+			if(results[i].success)
+			{
+				csv << metrics.rms_error << "," << metrics.max_error << "," << metrics.max_torque << "," << metrics.effort << ","
+						<< metrics.diverged << "," << metrics.diverged_time;
+			}
+			else
+			{
+				csv << ",,,,,";
+			}
+			csv << "," << results[i].wall_time << endl;
+		}
+	}
+
+	return 0;
+}
@@ -1,7 +1,17 @@
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
+#include "redis/RedisBinaryEigen.h"
+#include "redis/RobotStateBundle.h"
+#include "shm/SharedMemorySlot.h"
+#include "redis/LockstepSync.h"
+#include "redis/RedisLatencyStats.h"
+#include "redis/GainService.h"
 #include "timer/LoopTimer.h"
+#include "timer/LoopHealth.h"
+#include "threads/RealtimeThread.h"
 #include "tasks/JointTask.h"
+#include "model/MassMatrixInverse.h"
+#include "model/TaskModelCache.h"
 
 #include <iostream>
 #include <string>
@@ -49,6 +59,20 @@ const bool flag_simulation = true;
 
 const bool inertia_regularization = true;
 
+// exchange q, dq and torques with simviz through shared memory instead of redis (simulation only).
+// must match the flag in simviz.cpp
+const bool flag_shared_memory = false;
+
+// step in lockstep with simviz instead of running on the loop timer (simulation only).
+// must match the flag in simviz.cpp
+const bool flag_lockstep = false;
+const string LOCKSTEP_KEY_PREFIX = "sai2::PandaApplication::lockstep";
+const double control_period = 0.001;
+
+// latency of the redis accesses, published every second
+const string LATENCY_STATS_KEY = "sai2::PandaApplication::controller::redis_latency";
+const string LOOP_HEALTH_KEY = "sai2::PandaApplication::controller::loop_health";
+
 int main() {
 
 	if(flag_simulation)
@@ -92,15 +116,36 @@ int main() {
 	signal(SIGTERM, &sighandler);
 	signal(SIGINT, &sighandler);
 
+	// shared memory slots for the hot keys
+	PandaUtils::SharedMemorySlot* q_slot = NULL;
+	PandaUtils::SharedMemorySlot* dq_slot = NULL;
+	PandaUtils::SharedMemorySlot* torques_slot = NULL;
+	if(flag_simulation && flag_shared_memory)
+	{
+		q_slot = new PandaUtils::SharedMemorySlot(JOINT_ANGLES_KEY);
+		dq_slot = new PandaUtils::SharedMemorySlot(JOINT_VELOCITIES_KEY);
+		torques_slot = new PandaUtils::SharedMemorySlot(JOINT_TORQUES_COMMANDED_KEY);
+	}
+
 	// load robots
 	auto robot = new Sai2Model::Sai2Model(robot_file, false);
-	robot->_q = redis_client.getEigenMatrixJSON(JOINT_ANGLES_KEY);
+	if(q_slot)
+	{
+		q_slot->waitForData();
+		q_slot->read(robot->_q);
+	}
+	else
+	{
+		PandaUtils::getEigenMatrixBinary(redis_client, JOINT_ANGLES_KEY, robot->_q);
+	}
 	VectorXd initial_q = robot->_q;
 	robot->updateModel();
 
 	// prepare controller	
 	auto joint_task = new Sai2Primitives::JointTask(robot);
+	PandaUtils::TaskModelCache joint_task_model;
 
+	PandaUtils::MassMatrixInverse<7> mass_matrix_inverse(robot->dof(), inertia_regularization ? 0.07 : 0.0);
 	MatrixXd N_prec = MatrixXd::Identity(robot->dof(), robot->dof());
 	VectorXd joint_task_torques = VectorXd::Zero(robot->dof());
 	joint_task->_kp = 100.0;
@@ -110,21 +155,79 @@ int main() {
 
 	VectorXd command_torques = VectorXd::Zero(robot->dof());
 
+	// real robot: read the whole robot state in one round trip, and the gains
+	// only when they are changed
+	PandaUtils::RobotStateBundle state_bundle(redis_client, robot);
+	PandaUtils::GainService gains;
+	if(!flag_simulation)
+	{
+		state_bundle.setJointKeys(JOINT_ANGLES_KEY, JOINT_VELOCITIES_KEY);
+		state_bundle.setModelKeys(MASSMATRIX_KEY, CORIOLIS_KEY, ROBOT_GRAVITY_KEY);
+		state_bundle.initialize();
+
+		gains.addGain(KP_KEY, joint_task->_kp);
+		gains.addGain(KV_KEY, joint_task->_kv);
+		gains.start();
+	}
+
+	// latency histograms of the state read and torque write
+	PandaUtils::RedisLatencyStats redis_stats;
+	const string transport = flag_shared_memory ? "shm " : "";
+	PandaUtils::LatencyHistogram& state_read_latency = flag_simulation ?
+			redis_stats.histogram("get " + transport + JOINT_ANGLES_KEY + " + dq") :
+			redis_stats.histogram("state bundle " + JOINT_ANGLES_KEY);
+	PandaUtils::LatencyHistogram& torques_write_latency = redis_stats.histogram("set " + transport + JOINT_TORQUES_COMMANDED_KEY);
+
+	// lockstep synchronization with the simulation
+	PandaUtils::LockstepSync lockstep(redis_client, LOCKSTEP_KEY_PREFIX);
+	unsigned long long lockstep_step = 0;
+
 	// create a timer
 	LoopTimer timer;
 	timer.initializeTimer();
-	timer.setLoopFrequency(1000); 
+	timer.setLoopFrequency(1.0/control_period); 
+	PandaUtils::LoopHealth loop_health(1.0/control_period);
+	PandaUtils::configureRealtimeThread("controller", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
 	double start_time = timer.elapsedTime(); //secs
-	bool fTimerDidSleep = true;
 
 	while (runloop) {
-		// wait for next scheduled loop
-		timer.waitForNextLoop();
-		double time = timer.elapsedTime() - start_time;
+		double time = 0;
+		if(flag_simulation && flag_lockstep)
+		{
+			// wait for the simulation to publish the next state, time is the simulated time
+			if(!lockstep.waitForState(lockstep_step))
+			{
+				continue;
+			}
+			time = lockstep_step * control_period;
+		}
+		else
+		{
+			// wait for next scheduled loop
+			loop_health.waitForNextLoop(timer);
+			time = timer.elapsedTime() - start_time;
+		}
 
 		// read robot state from redis
-		robot->_q = redis_client.getEigenMatrixJSON(JOINT_ANGLES_KEY);
-		robot->_dq = redis_client.getEigenMatrixJSON(JOINT_VELOCITIES_KEY);
+		if(flag_simulation)
+		{
+			PandaUtils::ScopedLatency measure(state_read_latency);
+			if(flag_shared_memory)
+			{
+				q_slot->read(robot->_q);
+				dq_slot->read(robot->_dq);
+			}
+			else
+			{
+				PandaUtils::getEigenMatrixBinary(redis_client, JOINT_ANGLES_KEY, robot->_q);
+				PandaUtils::getEigenMatrixBinary(redis_client, JOINT_VELOCITIES_KEY, robot->_dq);
+			}
+		}
+		else
+		{
+			PandaUtils::ScopedLatency measure(state_read_latency);
+			state_bundle.read();
+		}
 
 		// update model
 		if(flag_simulation)
@@ -133,21 +236,11 @@ int main() {
 		}
 		else
 		{
-			joint_task->_kp = stod(redis_client.get(KP_KEY));
-			joint_task->_kv = stod(redis_client.get(KV_KEY));
+			gains.apply();
 			robot->updateKinematics();
-			robot->_M = redis_client.getEigenMatrixJSON(MASSMATRIX_KEY);
-			if(inertia_regularization)
-			{
-				robot->_M(4,4) += 0.07;
-				robot->_M(5,5) += 0.07;
-				robot->_M(6,6) += 0.07;
-			}
-			// cout << robot->_M << endl;
-			// robot->_M = Eigen::MatrixXd::Identity(robot->dof(), robot->dof());
-			robot->_M_inv = robot->_M.inverse();
+			mass_matrix_inverse.update(robot);
 		}
-		joint_task->updateTaskModel(N_prec);
+		joint_task_model.update(joint_task, robot->_q, N_prec);
 
 		// compute torques
 		joint_task->_desired_position(2) = initial_q(2) + 25/180.0*M_PI * sin(2*M_PI*0.3*time);
@@ -156,17 +249,54 @@ int main() {
 		command_torques = joint_task_torques;
 
 		// send to redis
-		redis_client.setEigenMatrixJSON(JOINT_TORQUES_COMMANDED_KEY, command_torques);
+		{
+			PandaUtils::ScopedLatency measure(torques_write_latency);
+			if(flag_simulation && flag_shared_memory)
+			{
+				torques_slot->write(command_torques);
+			}
+			else if(flag_simulation)
+			{
+				PandaUtils::setEigenMatrixBinary(redis_client, JOINT_TORQUES_COMMANDED_KEY, command_torques);
+			}
+			else
+			{
+				redis_client.setEigenMatrixJSON(JOINT_TORQUES_COMMANDED_KEY, command_torques);
+			}
+		}
+		if(flag_simulation && flag_lockstep)
+		{
+			lockstep.publishTorques(lockstep_step);
+		}
+
+		if(controller_counter % 1000 == 0)
+		{
+			redis_stats.publish(redis_client, LATENCY_STATS_KEY);
+		}
+
+		if(controller_counter % 1000 == 0)
+		{
+			loop_health.publish(redis_client, LOOP_HEALTH_KEY);
+		}
 
 		controller_counter++;
 
 	}
 
+	gains.stop();
+
 	double end_time = timer.elapsedTime();
     std::cout << "\n";
     std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
-    std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
-    std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+    std::cout << "Controller Loop updates   : " << controller_counter << "\n";
+    std::cout << "Controller Loop frequency : " << controller_counter/end_time << "Hz\n";
+    loop_health.print(std::cout);
+    std::cout << "\n";
+    redis_stats.print(std::cout);
+
+	delete q_slot;
+	delete dq_slot;
+	delete torques_slot;
 
 
 	return 0;
@@ -7,7 +7,15 @@
 #include "Sai2Simulation.h"
 #include <dynamics3d.h>
 #include "redis/RedisClient.h"
+#include "redis/RedisBinaryEigen.h"
+#include "shm/SharedMemorySlot.h"
+#include "redis/LockstepSync.h"
+#include "redis/RedisParameterCache.h"
 #include "timer/LoopTimer.h"
+#include "sim/HeadlessSimviz.h"
+#include "sim/RenderStateBuffer.h"
+#include "model/UrdfCache.h"
+#include "threads/RealtimeThread.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
 
@@ -45,6 +53,9 @@ const std::string GRIPPER_DESIRED_FORCE_KEY  = "sai2::PandaApplication::gripper:
 
 RedisClient redis_client;
 
+// state of the last simulation step, for the rendering loop
+PandaUtils::RenderStateBuffer* render_state;
+
 // simulation function prototype
 void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim);
 
@@ -69,8 +80,25 @@ bool fRotPanTilt = false;
 // const bool flag_simulation = false;
 const bool flag_simulation = true;
 
-int main() {
+// exchange q, dq and torques with the controller through shared memory instead of redis.
+// must match the flag in controller.cpp
+const bool flag_shared_memory = false;
+
+// step in lockstep with the controller instead of running on the loop timer.
+// each controller step is integrated in lockstep_substeps simulation steps.
+// must match the flag in controller.cpp
+const bool flag_lockstep = false;
+const string LOCKSTEP_KEY_PREFIX = "sai2::PandaApplication::lockstep";
+const double sim_period = 0.0005;
+const int lockstep_substeps = 2;
+
+int main(int argc, char** argv) {
 	cout << "Loading URDF world model file: " << world_file << endl;
+	// the world file with decimated visual meshes, built at the first launch
+	const string loaded_world_file = PandaUtils::cachedWorldFile(world_file);
+
+	// simviz --headless to run the simulation without window, see sim/HeadlessSimviz.h
+	PandaUtils::SimvizMode simviz_mode(argc, argv);
 
 	if(!flag_simulation)
 	{
@@ -83,7 +111,7 @@ int main() {
 	redis_client.connect();
 
 	// load graphics scene
-	auto graphics = new Sai2Graphics::Sai2Graphics(world_file, true);
+	auto graphics = new Sai2Graphics::Sai2Graphics(loaded_world_file, true);
 	Eigen::Vector3d camera_pos, camera_lookat, camera_vertical;
 	graphics->getCameraPose(camera_name, camera_pos, camera_vertical, camera_lookat);
 
@@ -92,7 +120,7 @@ int main() {
 	robot->updateKinematics();
 
 	// load simulation world
-	auto sim = new Simulation::Sai2Simulation(world_file, false);
+	auto sim = new Simulation::Sai2Simulation(loaded_world_file, false);
 	sim->setCollisionRestitution(0);
 	sim->setCoeffFrictionStatic(0.6);
 
@@ -101,6 +129,45 @@ int main() {
 	sim->getJointVelocities(robot_name, robot->_dq);
 	robot->updateKinematics();
 
+	if(!redis_client.exists(JOINT_ANGLES_KEY))
+	{
+		redis_client.setEigenMatrixJSON(JOINT_ANGLES_KEY, VectorXd::Zero(robot->dof()-2));
+	}
+	if(!redis_client.exists(JOINT_VELOCITIES_KEY))
+	{
+		redis_client.setEigenMatrixJSON(JOINT_VELOCITIES_KEY, VectorXd::Zero(robot->dof()-2));
+	}
+
+	// the rendering loop has its own model, updated from the simulation thread without redis
+	auto render_robot = new Sai2Model::Sai2Model(robot_file, false);
+	render_robot->_q = robot->_q;
+	render_robot->updateKinematics();
+	render_state = new PandaUtils::RenderStateBuffer(robot);
+
+	fSimulationRunning = true;
+	thread sim_thread(simulation, robot, sim);
+
+	if(simviz_mode.headless)
+	{
+		auto update_graphics = [&]()
+		{
+			if(!flag_simulation)
+			{
+				render_robot->_q.head(7) = redis_client.getEigenMatrixJSON(JOINT_ANGLES_KEY);
+				render_robot->_dq.head(7) = redis_client.getEigenMatrixJSON(JOINT_VELOCITIES_KEY);
+				render_robot->updateKinematics();
+			}
+			else
+			{
+				render_state->update(render_robot);
+			}
+			graphics->updateGraphics(robot_name, render_robot);
+		};
+		PandaUtils::runHeadless(simviz_mode, graphics, camera_name, update_graphics, fSimulationRunning);
+		sim_thread.join();
+		return 0;
+	}
+
 	/*------- Set up visualization -------*/
 	// set up error callback
 	glfwSetErrorCallback(glfwError);
@@ -135,32 +202,24 @@ int main() {
 	// cache variables
 	double last_cursorx, last_cursory;
 
-
-	if(!redis_client.exists(JOINT_ANGLES_KEY))
-	{
-		redis_client.setEigenMatrixJSON(JOINT_ANGLES_KEY, VectorXd::Zero(robot->dof()-2));
-	}
-	if(!redis_client.exists(JOINT_VELOCITIES_KEY))
-	{
-		redis_client.setEigenMatrixJSON(JOINT_VELOCITIES_KEY, VectorXd::Zero(robot->dof()-2));
-	}
-
-	fSimulationRunning = true;
-	thread sim_thread(simulation, robot, sim);
 	// while window is open:
 	while (!glfwWindowShouldClose(window))
 	{
 		if(!flag_simulation)
 		{
-			robot->_q.head(7) = redis_client.getEigenMatrixJSON(JOINT_ANGLES_KEY);
-			robot->_dq.head(7) = redis_client.getEigenMatrixJSON(JOINT_VELOCITIES_KEY);
-			robot->updateKinematics();
+			render_robot->_q.head(7) = redis_client.getEigenMatrixJSON(JOINT_ANGLES_KEY);
+			render_robot->_dq.head(7) = redis_client.getEigenMatrixJSON(JOINT_VELOCITIES_KEY);
+			render_robot->updateKinematics();
+		}
+		else
+		{
+			render_state->update(render_robot);
 		}
 
 		// update graphics. this automatically waits for the correct amount of time
 		int width, height;
 		glfwGetFramebufferSize(window, &width, &height);
-		graphics->updateGraphics(robot_name, robot);
+		graphics->updateGraphics(robot_name, render_robot);
 		graphics->render(camera_name, width, height);
 
 		// swap buffers
@@ -250,7 +309,32 @@ int main() {
 void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim) {
 
 	VectorXd command_torques = VectorXd::Zero(robot->dof());
-	redis_client.setEigenMatrixJSON(TORQUES_COMMANDED_KEY, command_torques.head<7>());
+	PandaUtils::setEigenMatrixBinary(redis_client, TORQUES_COMMANDED_KEY, command_torques.head<7>());
+
+	// shared memory slots for the hot keys, gripper and ui keys stay on redis
+	PandaUtils::SharedMemorySlot* q_slot = NULL;
+	PandaUtils::SharedMemorySlot* dq_slot = NULL;
+	PandaUtils::SharedMemorySlot* torques_slot = NULL;
+	if(flag_shared_memory)
+	{
+		q_slot = new PandaUtils::SharedMemorySlot(JOINT_ANGLES_KEY);
+		dq_slot = new PandaUtils::SharedMemorySlot(JOINT_VELOCITIES_KEY);
+		torques_slot = new PandaUtils::SharedMemorySlot(TORQUES_COMMANDED_KEY);
+		torques_slot->write(command_torques.head<7>());
+	}
+
+	auto write_robot_state = [&]() {
+		if(flag_shared_memory)
+		{
+			q_slot->write(robot->_q.head<7>());
+			dq_slot->write(robot->_dq.head<7>());
+		}
+		else
+		{
+			PandaUtils::setEigenMatrixBinary(redis_client, JOINT_ANGLES_KEY, robot->_q.head<7>());
+			PandaUtils::setEigenMatrixBinary(redis_client, JOINT_VELOCITIES_KEY, robot->_dq.head<7>());
+		}
+	};
 
 	double kp_gripper = 50.0;
 	double kv_gripper = 14.0;
@@ -271,26 +355,61 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim) {
 	redis_client.set(GRIPPER_DESIRED_FORCE_KEY, to_string(0));
 	redis_client.set(GRIPPER_MODE_KEY, gripper_mode);
 
+	// gripper commands are only read from redis when they change
+	PandaUtils::RedisParameterCache gripper_parameters(redis_client);
+	gripper_parameters.addDouble(GRIPPER_DESIRED_WIDTH_KEY, gripper_desired_width);
+	gripper_parameters.addDouble(GRIPPER_DESIRED_SPEED_KEY, gripper_desired_speed);
+	gripper_parameters.addDouble(GRIPPER_DESIRED_FORCE_KEY, gripper_desired_force);
+	gripper_parameters.addString(GRIPPER_MODE_KEY, gripper_mode);
+	gripper_parameters.start();
+
 	// create a timer
 	LoopTimer timer;
 	timer.initializeTimer();
-	timer.setLoopFrequency(2000); 
+	timer.setLoopFrequency(1.0/sim_period); 
 	double last_time = timer.elapsedTime(); //secs
 	bool fTimerDidSleep = true;
 
 	unsigned long long simulation_counter = 0;
 
+	// lockstep synchronization with the controller, publish the initial state as step 0
+	PandaUtils::LockstepSync lockstep(redis_client, LOCKSTEP_KEY_PREFIX);
+	unsigned long long lockstep_step = 0;
+	if(flag_lockstep)
+	{
+		lockstep.reset();
+		write_robot_state();
+		lockstep.publishState(lockstep_step);
+	}
+
+	PandaUtils::configureRealtimeThread("simulation", PandaUtils::RealtimeConfig::fifo(70, PandaUtils::simulationCpus()));
+
 	while (fSimulationRunning) {
-		fTimerDidSleep = timer.waitForNextLoop();
+		if(flag_lockstep)
+		{
+			// wait for the torques computed from the last published state
+			if(!lockstep.waitForTorques(lockstep_step))
+			{
+				continue;
+			}
+		}
+		else
+		{
+			fTimerDidSleep = timer.waitForNextLoop();
+		}
 
 		// read arm torques from redis
-		command_torques.head<7>() = redis_client.getEigenMatrixJSON(TORQUES_COMMANDED_KEY);
+		if(flag_shared_memory)
+		{
+			torques_slot->read(command_torques.head<7>());
+		}
+		else
+		{
+			PandaUtils::getEigenMatrixBinary(redis_client, TORQUES_COMMANDED_KEY, command_torques.head<7>());
+		}
 
 		// compute gripper torques
-		gripper_desired_width = stod(redis_client.get(GRIPPER_DESIRED_WIDTH_KEY));
-		gripper_desired_speed = stod(redis_client.get(GRIPPER_DESIRED_SPEED_KEY));
-		gripper_desired_force = stod(redis_client.get(GRIPPER_DESIRED_FORCE_KEY));
-		gripper_mode = redis_client.get(GRIPPER_MODE_KEY);
+		gripper_parameters.update();
 		if(gripper_desired_width > gripper_max_width)
 		{
 			gripper_desired_width = gripper_max_width;
@@ -343,7 +462,17 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim) {
 		// integrate forward
 		double curr_time = timer.elapsedTime();
 		double loop_dt = curr_time - last_time; 
-		sim->integrate(loop_dt);
+		if(flag_lockstep)
+		{
+			for(int i=0 ; i<lockstep_substeps ; i++)
+			{
+				sim->integrate(sim_period);
+			}
+		}
+		else
+		{
+			sim->integrate(loop_dt);
+		}
 
 		// read joint positions, velocities, update model
 		sim->getJointPositions(robot_name, robot->_q);
@@ -358,9 +487,14 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim) {
 		// cout << "joint 8 : " << robot->_q(8) << endl;
 
 		// write new robot state to redis
-		redis_client.setEigenMatrixJSON(JOINT_ANGLES_KEY, robot->_q.head<7>());
-		redis_client.setEigenMatrixJSON(JOINT_VELOCITIES_KEY, robot->_dq.head<7>());
+		write_robot_state();
+		render_state->publish(robot);
 		redis_client.set(GRIPPER_CURRENT_WIDTH_KEY, to_string(gripper_width));
+		if(flag_lockstep)
+		{
+			lockstep_step++;
+			lockstep.publishState(lockstep_step);
+		}
 
 		//update last time
 		last_time = curr_time;
@@ -368,11 +502,23 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim) {
 		simulation_counter++;
 	}
 
+	gripper_parameters.stop();
+
 	double end_time = timer.elapsedTime();
 	std::cout << "\n";
 	std::cout << "Simulation Loop run time  : " << end_time << " seconds\n";
-	std::cout << "Simulation Loop updates   : " << timer.elapsedCycles() << "\n";
-	std::cout << "Simulation Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+	std::cout << "Simulation Loop updates   : " << simulation_counter << "\n";
+	std::cout << "Simulation Loop frequency : " << simulation_counter/end_time << "Hz\n";
+
+	if(flag_shared_memory)
+	{
+		q_slot->unlink();
+		dq_slot->unlink();
+		torques_slot->unlink();
+	}
+	delete q_slot;
+	delete dq_slot;
+	delete torques_slot;
 }
 
 //------------------------------------------------------------------------------
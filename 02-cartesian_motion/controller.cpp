@@ -1,45 +1,27 @@
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
-#include "timer/LoopTimer.h"
+#include "redis/SequenceStamp.h"
+#include "threads/AppRuntime.h"
 #include "filters/ButterworthFilter.h"
 #include "tasks/JointTask.h"
 #include "tasks/PosOriTask.h"
 #include "tasks/PositionTask.h"
+#include "model/MassMatrixInverse.h"
+#include "model/TaskModelCache.h"
+#include "trajectories/OnlineTrajectory.h"
 
 #include <iostream>
 #include <string>
 
-#include <signal.h>
-bool runloop = true;
-void sighandler(int sig)
-{ runloop = false; }
-
 using namespace std;
 using namespace Eigen;
 
 const string robot_file = "resources/panda_arm.urdf";
 const string robot_name = "PANDA";
 
-// redis keys:
-// - read:
-std::string JOINT_ANGLES_KEY;
-std::string JOINT_VELOCITIES_KEY;
-std::string JOINT_TORQUES_SENSED_KEY;
-// - write
-std::string JOINT_TORQUES_COMMANDED_KEY;
-
-// - model
-std::string MASSMATRIX_KEY;
-std::string CORIOLIS_KEY;
-std::string ROBOT_GRAVITY_KEY;
-
-// - gripper
-std::string GRIPPER_MODE_KEY; // m for move and g for graps
-std::string GRIPPER_MAX_WIDTH_KEY;
-std::string GRIPPER_CURRENT_WIDTH_KEY;
-std::string GRIPPER_DESIRED_WIDTH_KEY;
-std::string GRIPPER_DESIRED_SPEED_KEY;
-std::string GRIPPER_DESIRED_FORCE_KEY;
+// stamp of the robot state, echoed with the torques. only published by the simviz
+const string SEQUENCE_KEY = "sai2::PandaApplication::sensors::sequence";
+const string SEQUENCE_ECHO_KEY = "sai2::PandaApplication::actuators::sequence_echo";
 
 // gains
 const string KP_JOINT_KEY = "sai2::PandaApplication::controller:kp_joint";
@@ -50,69 +32,36 @@ const string KP_ORI_KEY = "sai2::PandaApplication::controller:kp_ori";
 const string KV_ORI_KEY = "sai2::PandaApplication::controller:kv_ori";
 
 const string DESIRED_POS_KEY = "sai2::PandaApplication::controller::desired_position";
-
-unsigned long long controller_counter = 0;
+const string DESIRED_ORI_KEY = "sai2::PandaApplication::controller::desired_orientation";
+const string LOOP_HEALTH_KEY = "sai2::PandaApplication::controller::loop_health";
 
 // const bool flag_simulation = false;
 const bool flag_simulation = true;
 
 int main() {
 
-	if(flag_simulation)
-	{
-		JOINT_ANGLES_KEY  = "sai2::PandaApplication::sensors::q";
-		JOINT_VELOCITIES_KEY = "sai2::PandaApplication::sensors::dq";
-		JOINT_TORQUES_COMMANDED_KEY  = "sai2::PandaApplication::actuators::fgc";
-
-		GRIPPER_MODE_KEY  = "sai2::PandaApplication::gripper::mode"; // m for move and g for graps
-		GRIPPER_MAX_WIDTH_KEY  = "sai2::PandaApplication::gripper::max_width";
-		GRIPPER_CURRENT_WIDTH_KEY  = "sai2::PandaApplication::gripper::current_width";
-		GRIPPER_DESIRED_WIDTH_KEY  = "sai2::PandaApplication::gripper::desired_width";
-		GRIPPER_DESIRED_SPEED_KEY  = "sai2::PandaApplication::gripper::desired_speed";
-		GRIPPER_DESIRED_FORCE_KEY  = "sai2::PandaApplication::gripper::desired_force";		
-	}
-	else
-	{
-		JOINT_TORQUES_COMMANDED_KEY = "sai2::FrankaPanda::Bonnie::actuators::fgc";
-
-		JOINT_ANGLES_KEY  = "sai2::FrankaPanda::Bonnie::sensors::q";
-		JOINT_VELOCITIES_KEY = "sai2::FrankaPanda::Bonnie::sensors::dq";
-		JOINT_TORQUES_SENSED_KEY = "sai2::FrankaPanda::Bonnie::sensors::torques";
-		MASSMATRIX_KEY = "sai2::FrankaPanda::Bonnie::sensors::model::massmatrix";
-		CORIOLIS_KEY = "sai2::FrankaPanda::Bonnie::sensors::model::coriolis";
-		ROBOT_GRAVITY_KEY = "sai2::FrankaPanda::Bonnie::sensors::model::robot_gravity";		
-
-		GRIPPER_MODE_KEY  = "sai2::FrankaPanda::Bonnie::gripper::mode"; // m for move and g for graps
-		GRIPPER_MAX_WIDTH_KEY  = "sai2::FrankaPanda::Bonnie::gripper::max_width";
-		GRIPPER_CURRENT_WIDTH_KEY  = "sai2::FrankaPanda::Bonnie::gripper::current_width";
-		GRIPPER_DESIRED_WIDTH_KEY  = "sai2::FrankaPanda::Bonnie::gripper::desired_width";
-		GRIPPER_DESIRED_SPEED_KEY  = "sai2::FrankaPanda::Bonnie::gripper::desired_speed";
-		GRIPPER_DESIRED_FORCE_KEY  = "sai2::FrankaPanda::Bonnie::gripper::desired_force";
-	}
-
-	// start redis client
-	auto redis_client = RedisClient();
-	redis_client.connect();
-
-	// set up signal handler
-	signal(SIGABRT, &sighandler);
-	signal(SIGTERM, &sighandler);
-	signal(SIGINT, &sighandler);
+	// redis keys of the robot, the i/o of the loop and the signal handlers are the ones of the runtime
+	const PandaUtils::RobotKeys keys = flag_simulation ? PandaUtils::RobotKeys::simulation()
+			: PandaUtils::RobotKeys::real("sai2::FrankaPanda::Bonnie");
+	PandaUtils::AppRuntime app("Controller Loop", 1000);
+	RedisClient& redis_client = app.redisClient();
 
 	// load robots
 	auto robot = new Sai2Model::Sai2Model(robot_file, false);
-	robot->_q = redis_client.getEigenMatrixJSON(JOINT_ANGLES_KEY);
+	robot->_q = redis_client.getEigenMatrixJSON(keys.joint_angles);
 	VectorXd initial_q = robot->_q;
 	robot->updateModel();
 
 	// prepare controller	
 	int dof = robot->dof();
+	PandaUtils::MassMatrixInverse<7> mass_matrix_inverse(dof);
 	VectorXd command_torques = VectorXd::Zero(dof);
 	VectorXd coriolis = VectorXd::Zero(dof);
 	MatrixXd N_prec = MatrixXd::Identity(dof, dof);
 
 	// joint task
 	auto joint_task = new Sai2Primitives::JointTask(robot);
+	PandaUtils::TaskModelCache joint_task_model;
 	VectorXd joint_task_torques = VectorXd::Zero(dof);
 	joint_task->_kp = 150.0;
 	joint_task->_kv = 5.0;
@@ -121,12 +70,20 @@ int main() {
 	const string link_name = "link7";
 	const Eigen::Vector3d pos_in_link = Vector3d(0.0,0.0,0.107);
 	auto posori_task = new Sai2Primitives::PosOriTask(robot, link_name, pos_in_link);
+	PandaUtils::TaskModelCache posori_task_model;
 
 	redis_client.setEigenMatrixJSON(DESIRED_POS_KEY, posori_task->_current_position);
+	redis_client.setEigenMatrixJSON(DESIRED_ORI_KEY, posori_task->_current_orientation);
 
 	VectorXd posori_task_torques = VectorXd::Zero(dof);
 
-	posori_task->_use_interpolation_flag = true;
+	// the goals from redis go through a jerk limited trajectory instead of the interpolation
+	// of the task, restarted from the current motion whenever they change
+	posori_task->_use_interpolation_flag = false;
+	PandaUtils::OnlineCartesianTrajectory trajectory(0.001, 0.3, 1.0, 5.0, 1.0, 3.0, 15.0);
+	trajectory.reset(posori_task->_current_position, posori_task->_current_orientation);
+	Vector3d goal_position = posori_task->_current_position;
+	Matrix3d goal_orientation = posori_task->_current_orientation;
 
 	Matrix3d R = AngleAxisd(M_PI/2, Vector3d::UnitX()).toRotationMatrix();
 	// posori_task->_desired_orientation = R*posori_task->_desired_orientation;
@@ -136,27 +93,37 @@ int main() {
 	redis_client.set(KV_POS_KEY, to_string(posori_task->_kv_pos));
 	redis_client.set(KV_ORI_KEY, to_string(posori_task->_kv_ori));
 
-	// create a timer
-	LoopTimer timer;
-	timer.initializeTimer();
-	timer.setLoopFrequency(1000); 
-	double current_time = 0;
-	double prev_time = 0;
-	double dt = 0;
-	bool fTimerDidSleep = true;
-	double start_time = timer.elapsedTime(); //secs
-
-	while (runloop) {
-		// wait for next scheduled loop
-		timer.waitForNextLoop();
-		current_time = timer.elapsedTime() - start_time;
-		dt = current_time - prev_time;
-
-		// read robot state from redis
-		robot->_q = redis_client.getEigenMatrixJSON(JOINT_ANGLES_KEY);
-		robot->_dq = redis_client.getEigenMatrixJSON(JOINT_VELOCITIES_KEY);
-
-		// update robot model
+	// read robot state, after its stamp
+	PandaUtils::SequenceEcho sequence;
+	if(flag_simulation)
+	{
+		app.addEigenToRead(SEQUENCE_KEY, sequence.stamp());
+	}
+	app.addEigenToRead(keys.joint_angles, robot->_q);
+	app.addEigenToRead(keys.joint_velocities, robot->_dq);
+	if(!flag_simulation)
+	{
+		app.addEigenToRead(keys.mass_matrix, robot->_M);
+		app.addEigenToRead(keys.coriolis, coriolis);
+	}
+	app.addEigenToRead(DESIRED_POS_KEY, goal_position);
+	app.addEigenToRead(DESIRED_ORI_KEY, goal_orientation);
+
+	// torques, and the echo of the state stamps for the latencies measured by the simviz
+	app.addEigenToWrite(keys.torques_commanded, command_torques);
+	Vector4d sequence_echo = Vector4d::Zero();
+	if(flag_simulation)
+	{
+		app.addEigenToWrite(SEQUENCE_ECHO_KEY, sequence_echo);
+	}
+	app.setLoopHealthKey(LOOP_HEALTH_KEY);
+	// torques and next state in one round trip, off the critical path of the tick
+	app.setOverlappedIO(true);
+
+	// update robot model
+	app.addStage("updateModel", [&](const double time)
+	{
+		sequence.stateRead();
 		if(flag_simulation)
 		{
 			robot->updateModel();
@@ -165,42 +132,48 @@ int main() {
 		else
 		{
 			robot->updateKinematics();
-			robot->_M = redis_client.getEigenMatrixJSON(MASSMATRIX_KEY);
-			robot->_M_inv = robot->_M.inverse();
-
-			coriolis = redis_client.getEigenMatrixJSON(CORIOLIS_KEY);
+			mass_matrix_inverse.update(robot);
 		}
+	});
 
+	app.addStage("updateTaskModel", [&](const double time)
+	{
 		N_prec.setIdentity();
-		posori_task->updateTaskModel(N_prec);
+		posori_task_model.update(posori_task, robot->_q, N_prec);
 		N_prec = posori_task->_N;
-		joint_task->updateTaskModel(N_prec);
-
-		//update desired position
-		posori_task->_desired_position = redis_client.getEigenMatrixJSON(DESIRED_POS_KEY);
+		joint_task_model.update(joint_task, robot->_q, N_prec);
+	});
 
-		// compute torques
+	//update desired position
+	app.addStage("trajectory", [&](const double time)
+	{
+		trajectory.setGoal(goal_position, goal_orientation);
+		trajectory.update();
+		posori_task->_desired_position = trajectory.position();
+		posori_task->_desired_orientation = trajectory.orientation();
+		posori_task->_desired_velocity = trajectory.velocity();
+		posori_task->_desired_angular_velocity = trajectory.angularVelocity();
+		posori_task->_desired_acceleration = trajectory.acceleration();
+		posori_task->_desired_angular_acceleration = trajectory.angularAcceleration();
+	});
+
+	// compute torques
+	app.addStage("computeTorques", [&](const double time)
+	{
 		posori_task->computeTorques(posori_task_torques);
 		joint_task->computeTorques(joint_task_torques);
 
 		command_torques = posori_task_torques + joint_task_torques + coriolis;
-
-		// send to redis
 		// command_torques.setZero(dof);
-		redis_client.setEigenMatrixJSON(JOINT_TORQUES_COMMANDED_KEY, command_torques);
+		sequence_echo = sequence.torquesComputed();
+	});
 
-		prev_time = current_time;
-		controller_counter++;
-	}
-
-	command_torques.setZero(dof);
-	redis_client.setEigenMatrixJSON(JOINT_TORQUES_COMMANDED_KEY, command_torques);
-
-	double end_time = timer.elapsedTime();
-	std::cout << "\n";
-	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
-	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
-    std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+	app.onShutdown([&]()
+	{
+		command_torques.setZero(dof);
+	});
+	app.run(PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
+	app.print(std::cout);
 
 	return 0;
 }
@@ -7,7 +7,11 @@
 #include "Sai2Simulation.h"
 #include <dynamics3d.h>
 #include "redis/RedisClient.h"
+#include "redis/SequenceStamp.h"
 #include "timer/LoopTimer.h"
+#include "graphics/RenderScheduler.h"
+#include "graphics/MeshLod.h"
+#include "threads/RealtimeThread.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
 
@@ -34,6 +38,10 @@ std::string JOINT_VELOCITIES_KEY = "sai2::PandaApplication::sensors::dq";
 
 const string JACOBIAN_KEY = "sai2::PandaApplication::simulation::contact_jacobian";
 const string CONTACT_FORCE_KEY = "sai2::PandaApplication::simulation::current_contact_force";
+// stamp of the robot state, echoed by the controller with the torques
+const string SEQUENCE_KEY = "sai2::PandaApplication::sensors::sequence";
+const string SEQUENCE_ECHO_KEY = "sai2::PandaApplication::actuators::sequence_echo";
+const string LOOP_LATENCY_KEY = "sai2::PandaApplication::simulation::loop_latency";
 
 // - read
 const std::string TORQUES_COMMANDED_KEY  = "sai2::PandaApplication::actuators::fgc";
@@ -134,20 +142,32 @@ int main() {
 	// fSimulationRunning = true;
 	thread sim_thread(simulation, robot, sim);
 
+	// frames at 30 Hz at most and only when the scene changed, decimated meshes far from the camera
+	PandaUtils::RenderScheduler render_scheduler(30.0);
+	PandaUtils::MeshLod mesh_lod(graphics->_world, graphics->getCamera(camera_name));
+
 	// while window is open:
 	while (!glfwWindowShouldClose(window))
 	{
-		// update graphics. this automatically waits for the correct amount of time
+		// update the graphics of what moved, and draw a frame only if something did
+		render_scheduler.waitForNextFrame();
 		int width, height;
 		glfwGetFramebufferSize(window, &width, &height);
-		graphics->updateGraphics(robot_name, robot);
-		graphics->render(camera_name, width, height);
-
-		// swap buffers
-		glfwSwapBuffers(window);
+		if(render_scheduler.robotMoved(robot_name, robot->_q))
+		{
+			graphics->updateGraphics(robot_name, robot);
+		}
+		if(mesh_lod.update())
+		{
+			render_scheduler.invalidate();
+		}
+		if(render_scheduler.frameDue(width, height))
+		{
+			graphics->render(camera_name, width, height);
 
-		// wait until all GL commands are completed
-		glFinish();
+			// swap buffers
+			glfwSwapBuffers(window);
+		}
 
 		// check for any OpenGL errors
 		GLenum err;
@@ -210,6 +230,7 @@ int main() {
 			camera_pos = camera_lookat + m_pan*(camera_pos - camera_lookat);
 		}
 		graphics->setCameraPose(camera_name, camera_pos, cam_up_axis, camera_lookat);
+		render_scheduler.cameraMoved(camera_pos, cam_up_axis, camera_lookat);
 		glfwGetCursorPos(window, &last_cursorx, &last_cursory);
 	}
 
@@ -233,6 +254,10 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim) {
 	VectorXd command_torques = VectorXd::Zero(dof);
 	redis_client.setEigenMatrixJSON(TORQUES_COMMANDED_KEY, command_torques.head<7>());
 
+	// latencies of the control loop, from the stamps echoed by the controller
+	PandaUtils::SequenceStamper stamper;
+	redis_client.setEigenMatrixJSON(SEQUENCE_ECHO_KEY, Vector4d::Zero());
+
 	VectorXd tau_dist = VectorXd::Zero(dof);
 	string disturbance_flag = "0";
 	string dist_link = "link4";
@@ -289,11 +314,15 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim) {
 	double last_time = start_time;
 
 	fSimulationRunning = true;
+
+	PandaUtils::configureRealtimeThread("simulation", PandaUtils::RealtimeConfig::fifo(70, PandaUtils::simulationCpus()));
+
 	while (fSimulationRunning) {
 		fTimerDidSleep = timer.waitForNextLoop();
 
 		// read arm torques from redis
 		command_torques.head<7>() = redis_client.getEigenMatrixJSON(TORQUES_COMMANDED_KEY);
+		stamper.receiveEcho(redis_client.getEigenMatrixJSON(SEQUENCE_ECHO_KEY));
 
 		// compute gripper torques
 		gripper_desired_width = stod(redis_client.get(GRIPPER_DESIRED_WIDTH_KEY));
@@ -416,6 +445,12 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim) {
 		redis_client.set(TIMESTAMP_KEY, to_string(curr_time));
 		redis_client.setEigenMatrixJSON(JACOBIAN_KEY, J_contact_normal.block<1,7>(0,0));
 		redis_client.setEigenMatrixJSON(CONTACT_FORCE_KEY, current_contact_force);
+		redis_client.setEigenMatrixJSON(SEQUENCE_KEY, stamper.next());
+
+		if(simulation_counter % 1000 == 0)
+		{
+			stamper.publish(redis_client, LOOP_LATENCY_KEY);
+		}
 
 		//update last time
 		last_time = curr_time;
@@ -428,6 +463,7 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim) {
 	std::cout << "Simulation Loop run time  : " << end_time << " seconds\n";
 	std::cout << "Simulation Loop updates   : " << timer.elapsedCycles() << "\n";
 	std::cout << "Simulation Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+	stamper.print(std::cout);
 }
 
 //------------------------------------------------------------------------------
@@ -5,11 +5,23 @@
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
+#include "timer/LoopHealth.h"
+#include "timer/PrecisionLoopTimer.h"
+#include "threads/RealtimeThread.h"
+#include "threads/TripleBuffer.h"
 #include "tasks/JointTask.h"
 #include "tasks/PosOriTask.h"
+#include "model/MassMatrixInverse.h"
+#include "observers/MomentumObserver.h"
+#include "observers/ContactDetector.h"
+#include "force_control/ForceLoopKernel.h"
+#include "force_control/SensorCalibration.h"
+#include "force_control/ForceBiasTracker.h"
 
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <thread>
 
 #include <signal.h>
 bool runloop = true;
@@ -33,6 +45,7 @@ int state = MOVE_TO_INITIAL;
 std::string JOINT_ANGLES_KEY;
 std::string JOINT_VELOCITIES_KEY;
 std::string JOINT_TORQUES_SENSED_KEY;
+std::string FORCE_SENSED_KEY;
 // - write
 std::string JOINT_TORQUES_COMMANDED_KEY;
 
@@ -59,6 +72,68 @@ const string KV_ORI_KEY = "sai2::PandaApplication::controller:kv_ori";
 
 // desired force
 const string DESIRED_EE_FORCE_KEY = "sai2::PandaApplication::controller:desried_ee_force";
+const string SENSED_EE_FORCE_KEY = "sai2::PandaApplication::controller::sensed_ee_force";
+const string LOOP_HEALTH_KEY = "sai2::PandaApplication::controller::loop_health";
+const string FORCE_LOOP_HEALTH_KEY = "sai2::PandaApplication::controller::force_loop_health";
+const string FORCE_SENSOR_BIAS_KEY = "sai2::PandaApplication::controller::force_sensor_bias";
+
+// calibration of the sensor and of the tool mounted on it, on the real robot
+const string bias_file = "../../00-force_sensor_calibration/calibration_files/Clyde_fsensor_bias.xml";
+const string tool_file = "../../00-force_sensor_calibration/calibration_files/hand_brush.xml";
+
+// the bias follows its drift in free space : no contact seen by the momentum observer, out of
+// force control and slow enough for the inertia of the hand to be small
+const double bias_time_constant = 5.0;
+const double bias_settle_time = 0.5;
+const double bias_tracking_max_velocity = 0.3;
+
+// the force sensing and the force law run on their own thread, faster than the motion loop.
+// the motion loop hands it its torques and the force space of the task, the force loop
+// adds the force along it and sends the torques
+const double force_loop_frequency = 4000.0;
+
+struct MotionCommand {
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	MotionCommand()
+	: torques(Matrix<double,7,1>::Zero()),
+	  jacobian_transpose(Matrix<double,7,3>::Zero()),
+	  R_sensor(Matrix3d::Identity()),
+	  sigma_force(Matrix3d::Zero()),
+	  desired_force(Vector3d::Zero()),
+	  f_free_space(false)
+	{}
+
+	Matrix<double,7,1> torques;
+	// of the linear velocity of the control point
+	Matrix<double,7,3> jacobian_transpose;
+	Matrix3d R_sensor;
+	// zero out of force control
+	Matrix3d sigma_force;
+	Vector3d desired_force;
+	// the force loop can track the bias of the sensor
+	bool f_free_space;
+};
+
+struct ForceLoopState {
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	ForceLoopState()
+	: force(Vector3d::Zero()),
+	  moment(Vector3d::Zero()),
+	  command_force(Vector3d::Zero())
+	{}
+
+	// filtered, in world
+	Vector3d force;
+	Vector3d moment;
+	Vector3d command_force;
+};
+
+PandaUtils::TripleBuffer<MotionCommand> motion_command_buffer;
+PandaUtils::TripleBuffer<ForceLoopState> force_loop_state_buffer;
+
+void force_loop(PandaUtils::ForceLoopKernel* kernel, PandaUtils::ForceBiasTracker* bias_tracker);
 
 
 unsigned long long controller_counter = 0;
@@ -66,6 +141,9 @@ unsigned long long controller_counter = 0;
 // const bool flag_simulation = false;
 const bool flag_simulation = true;
 
+// cpus of the force loop, next to the control thread, PANDA_FORCE_LOOP_CPUS overrides them
+const vector<int> FORCE_LOOP_CPUS = PandaUtils::cpusFromEnvironment("PANDA_FORCE_LOOP_CPUS", {3});
+
 const bool inertia_regularization = true;
 
 int main() {
@@ -75,6 +153,7 @@ int main() {
 		JOINT_ANGLES_KEY  = "sai2::PandaApplication::sensors::q";
 		JOINT_VELOCITIES_KEY = "sai2::PandaApplication::sensors::dq";
 		JOINT_TORQUES_COMMANDED_KEY  = "sai2::PandaApplication::actuators::fgc";
+		FORCE_SENSED_KEY = "sai2::PandaApplication::sensors::force_torque";
 
 		GRIPPER_MODE_KEY  = "sai2::PandaApplication::gripper::mode"; // m for move and g for graps
 		GRIPPER_MAX_WIDTH_KEY  = "sai2::PandaApplication::gripper::max_width";
@@ -93,6 +172,7 @@ int main() {
 		MASSMATRIX_KEY = "sai2::FrankaPanda::sensors::model::massmatrix";
 		CORIOLIS_KEY = "sai2::FrankaPanda::sensors::model::coriolis";
 		ROBOT_GRAVITY_KEY = "sai2::FrankaPanda::sensors::model::robot_gravity";		
+		FORCE_SENSED_KEY = "sai2::ATIGamma_Sensor::force_torque";
 
 		GRIPPER_MODE_KEY  = "sai2::FrankaPanda::gripper::mode"; // m for move and g for graps
 		GRIPPER_MAX_WIDTH_KEY  = "sai2::FrankaPanda::gripper::max_width";
@@ -120,6 +200,7 @@ int main() {
 	// prepare controller	
 	auto joint_task = new Sai2Primitives::JointTask(robot);
 
+	PandaUtils::MassMatrixInverse<7> mass_matrix_inverse(robot->dof(), inertia_regularization ? 0.07 : 0.0);
 	MatrixXd N_prec = MatrixXd::Identity(robot->dof(), robot->dof());
 	VectorXd joint_task_torques = VectorXd::Zero(robot->dof());
 	joint_task->_kp = 100.0;
@@ -149,16 +230,42 @@ int main() {
 	redis_client.set(KP_ORI_KEY, to_string(posori_task->_kp_ori));
 	redis_client.set(KV_ORI_KEY, to_string(posori_task->_kv_ori));
 
+	// force loop, the simulated sensor has no bias and does not see the weight of the hand
+	PandaUtils::SensorCalibration sensor_calibration;
+	if(!flag_simulation && !sensor_calibration.load(bias_file, tool_file))
+	{
+		cout << "WARNING : " << sensor_calibration.error() << ", force sensor not compensated" << endl;
+	}
+	PandaUtils::ForceLoopKernel force_loop_kernel(force_loop_frequency, 100.0, 0.5, 4.0, 5.0);
+	force_loop_kernel.setCalibration(sensor_calibration.bias(), sensor_calibration.toolMass(), sensor_calibration.toolCom());
+	PandaUtils::ForceBiasTracker bias_tracker(force_loop_frequency, bias_time_constant, bias_settle_time, 3.0, 0.3);
+	bias_tracker.reset(sensor_calibration.bias());
+	bias_tracker.setTool(sensor_calibration.toolMass(), sensor_calibration.toolCom());
+	MotionCommand motion_command;
+	ForceLoopState force_loop_state;
+	Vector3d desired_force = Vector3d::Zero();
+	Matrix3d R_sensor = Matrix3d::Identity();
+
+	// contacts of the robot, the gravity is compensated by the robot so the observer is given
+	// the coriolis alone
+	PandaUtils::MomentumObserver<7> momentum_observer(robot, 0.001);
+	momentum_observer.setGain(15.0 * MatrixXd::Identity(robot->dof(), robot->dof()));
+	PandaUtils::ContactDetector<7> contact_detector(20, 3.0, 2.0);
+	VectorXd coriolis = VectorXd::Zero(robot->dof());
+	const VectorXd zero_torques = VectorXd::Zero(robot->dof());
+
 	// create a timer
 	LoopTimer timer;
 	timer.initializeTimer();
 	timer.setLoopFrequency(1000); 
+	PandaUtils::LoopHealth loop_health(1000);
+	PandaUtils::configureRealtimeThread("controller", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
 	double start_time = timer.elapsedTime(); //secs
-	bool fTimerDidSleep = true;
+	thread force_loop_thread(force_loop, &force_loop_kernel, &bias_tracker);
 
 	while (runloop) {
 	// wait for next scheduled loop
-	timer.waitForNextLoop();
+	loop_health.waitForNextLoop(timer);
 	double time = timer.elapsedTime() - start_time;
 
 	// read robot state from redis
@@ -169,6 +276,7 @@ int main() {
 	if(flag_simulation)
 	{
 		robot->updateModel();
+		robot->coriolisForce(coriolis);
 	}
 	else
 	{
@@ -180,17 +288,15 @@ int main() {
 		posori_task->_kv_ori = stod(redis_client.get(KV_ORI_KEY));
 		robot->updateKinematics();
 		robot->_M = redis_client.getEigenMatrixJSON(MASSMATRIX_KEY);
-		if(inertia_regularization)
-		{
-			robot->_M(4,4) += 0.07;
-			robot->_M(5,5) += 0.07;
-			robot->_M(6,6) += 0.07;
-		}
-		// cout << robot->_M << endl;
-		// robot->_M = Eigen::MatrixXd::Identity(robot->dof(), robot->dof());
-		robot->_M_inv = robot->_M.inverse();
+		mass_matrix_inverse.update(robot);
+		coriolis = redis_client.getEigenMatrixJSON(CORIOLIS_KEY);
 	}
 
+	// filtered force of the force loop
+	force_loop_state_buffer.read(force_loop_state);
+	posori_task->_sensed_force = force_loop_state.force;
+	posori_task->_sensed_moment = force_loop_state.moment;
+
 	if(state == MOVE_TO_INITIAL)
 	{
 		// update tasks model
@@ -232,7 +338,9 @@ int main() {
 		{
 			cout << "open loop force control start" << endl;
 			posori_task->setForceAxis(Vector3d(0,0,1));
-			posori_task->_desired_force = Vector3d(0,0,-2);
+			// the force loop applies the desired force, the task only damps along the force axis
+			posori_task->_desired_force.setZero();
+			desired_force = Vector3d(0,0,-2);
 			redis_client.set(DESIRED_EE_FORCE_KEY, to_string(-2));
 			state = FORCE_CONTROL;
 		}
@@ -246,7 +354,7 @@ int main() {
 		joint_task->updateTaskModel(N_prec);
 
 		// compute torques
-		posori_task->_desired_force(2) = stod(redis_client.get(DESIRED_EE_FORCE_KEY));
+		desired_force(2) = stod(redis_client.get(DESIRED_EE_FORCE_KEY));
 		posori_task->computeTorques(posori_task_torques);
 
 		joint_task->computeTorques(joint_task_torques);
@@ -254,19 +362,110 @@ int main() {
 		command_torques = posori_task_torques + joint_task_torques;		
 	}
 
-	// send to redis
-	redis_client.setEigenMatrixJSON(JOINT_TORQUES_COMMANDED_KEY, command_torques);
+	// to the force loop, that sends the torques
+	robot->rotation(R_sensor, link_name);
+	motion_command.torques = command_torques;
+	motion_command.jacobian_transpose = posori_task->_projected_jacobian.topRows(3).transpose();
+	motion_command.R_sensor = R_sensor;
+	if(state == FORCE_CONTROL)
+	{
+		motion_command.sigma_force = posori_task->_sigma_force;
+		motion_command.desired_force = desired_force;
+	}
+	else
+	{
+		motion_command.sigma_force.setZero();
+		motion_command.desired_force.setZero();
+	}
+	// the force loop adds nothing out of force control, the command torques are the ones applied
+	momentum_observer.update(command_torques, zero_torques, coriolis);
+	contact_detector.update(time, momentum_observer.getDisturbanceTorqueEstimate());
+	motion_command.f_free_space = (state != FORCE_CONTROL) && !contact_detector.inContact()
+			&& robot->_dq.norm() < bias_tracking_max_velocity;
+	motion_command_buffer.write(motion_command);
+
+	redis_client.setEigenMatrixJSON(SENSED_EE_FORCE_KEY, force_loop_state.force);
+
+	if(controller_counter % 1000 == 0)
+	{
+		loop_health.publish(redis_client, LOOP_HEALTH_KEY);
+	}
 
 	controller_counter++;
 
 	}
 
+	force_loop_thread.join();
+
 double end_time = timer.elapsedTime();
 	std::cout << "\n";
 	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
 	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
     std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+    loop_health.print(std::cout);
 
 
 	return 0;
 }
+
+void force_loop(PandaUtils::ForceLoopKernel* kernel, PandaUtils::ForceBiasTracker* bias_tracker)
+{
+	// own redis connection, the sensor reading and the torques are one round trip each
+	RedisClient redis_client_force = RedisClient();
+	redis_client_force.connect();
+
+	VectorXd sensed_force_moment = VectorXd::Zero(6);
+	VectorXd command_torques = VectorXd::Zero(7);
+	redis_client_force.createReadCallback(0);
+	redis_client_force.addEigenToReadCallback(0, FORCE_SENSED_KEY, sensed_force_moment);
+	redis_client_force.createWriteCallback(0);
+	redis_client_force.addEigenToWriteCallback(0, JOINT_TORQUES_COMMANDED_KEY, command_torques);
+
+	MotionCommand motion_command;
+	ForceLoopState force_loop_state;
+	Matrix<double,6,1> raw_wrench = Matrix<double,6,1>::Zero();
+
+	// sleeps until shortly before the deadline and spins to it, at a higher priority than the motion loop
+	PandaUtils::PrecisionLoopTimer timer(100e-6);
+	timer.initializeTimer();
+	timer.setLoopFrequency(force_loop_frequency);
+	PandaUtils::LoopHealth loop_health(force_loop_frequency);
+	PandaUtils::configureRealtimeThread("force_loop", PandaUtils::RealtimeConfig::fifo(85, FORCE_LOOP_CPUS));
+	unsigned long long force_loop_counter = 0;
+
+	while(runloop)
+	{
+		loop_health.waitForNextLoop(timer);
+
+		redis_client_force.executeReadCallback(0);
+		motion_command_buffer.read(motion_command);
+
+		// bias, tool weight, filter and PI in one update
+		raw_wrench = sensed_force_moment;
+		bias_tracker->update(raw_wrench, motion_command.R_sensor, motion_command.f_free_space);
+		kernel->setBias(bias_tracker->bias());
+		const Vector3d& command_force = kernel->update(raw_wrench, motion_command.R_sensor,
+				motion_command.desired_force, motion_command.sigma_force);
+		command_torques = motion_command.torques + motion_command.jacobian_transpose * command_force;
+
+		redis_client_force.executeWriteCallback(0);
+
+		force_loop_state.force = kernel->force();
+		force_loop_state.moment = kernel->moment();
+		force_loop_state.command_force = command_force;
+		force_loop_state_buffer.write(force_loop_state);
+
+		if(force_loop_counter % 4000 == 0)
+		{
+			loop_health.publish(redis_client_force, FORCE_LOOP_HEALTH_KEY);
+			redis_client_force.setEigenMatrixJSON(FORCE_SENSOR_BIAS_KEY, bias_tracker->bias());
+		}
+		force_loop_counter++;
+	}
+
+	std::cout << "\nForce loop\n";
+	loop_health.print(std::cout);
+	std::cout << "bias drift : " << bias_tracker->drift().transpose() << " (" << bias_tracker->numUpdates() << " updates, "
+			<< bias_tracker->numRejected() << " readings rejected)\n";
+}
+
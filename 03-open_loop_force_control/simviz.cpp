@@ -9,6 +9,8 @@
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
 #include "uiforce/UIForceWidget.h"
+#include "force_sensor/ForceSensorSim.h"
+#include "threads/RealtimeThread.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
 
@@ -31,6 +33,7 @@ const string camera_name = "camera_fixed";
 // - write:
 std::string JOINT_ANGLES_KEY  = "sai2::PandaApplication::sensors::q";
 std::string JOINT_VELOCITIES_KEY = "sai2::PandaApplication::sensors::dq";
+const std::string FORCE_SENSED_KEY = "sai2::PandaApplication::sensors::force_torque";
 // - read
 const std::string TORQUES_COMMANDED_KEY  = "sai2::PandaApplication::actuators::fgc";
 
@@ -326,6 +329,14 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, UI
 	redis_client.set(GRIPPER_DESIRED_FORCE_KEY, to_string(0));
 	redis_client.set(GRIPPER_MODE_KEY, gripper_mode);
 
+	// force sensor at the flange, read by the force loop of the controller
+	Affine3d T_link_sensor = Affine3d::Identity();
+	T_link_sensor.translation() = Vector3d(0, 0, 0.107);
+	ForceSensorSim* fsensor = new ForceSensorSim(robot_name, "link7", T_link_sensor, robot);
+	Vector3d sensed_force = Vector3d::Zero();
+	Vector3d sensed_moment = Vector3d::Zero();
+	VectorXd sensed_force_moment = VectorXd::Zero(6);
+
 	// create a timer
 	LoopTimer timer;
 	timer.initializeTimer();
@@ -335,6 +346,8 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, UI
 
 	unsigned long long simulation_counter = 0;
 
+	PandaUtils::configureRealtimeThread("simulation", PandaUtils::RealtimeConfig::fifo(70, PandaUtils::simulationCpus()));
+
 	while (fSimulationRunning) {
 		fTimerDidSleep = timer.waitForNextLoop();
 
@@ -414,6 +427,12 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, UI
 		double loop_dt = curr_time - last_time; 
 		sim->integrate(loop_dt);
 
+		// force applied by the robot, in the sensor frame
+		fsensor->update(sim);
+		fsensor->getForceLocalFrame(sensed_force);
+		fsensor->getMomentLocalFrame(sensed_moment);
+		sensed_force_moment << -sensed_force, -sensed_moment;
+
 		// read joint positions, velocities, update model
 		sim->getJointPositions(robot_name, robot->_q);
 		sim->getJointVelocities(robot_name, robot->_dq);
@@ -430,6 +449,7 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, UI
 		redis_client.setEigenMatrixJSON(JOINT_ANGLES_KEY, robot->_q.head<7>());
 		redis_client.setEigenMatrixJSON(JOINT_VELOCITIES_KEY, robot->_dq.head<7>());
 		redis_client.set(GRIPPER_CURRENT_WIDTH_KEY, to_string(gripper_width));
+		redis_client.setEigenMatrixJSON(FORCE_SENSED_KEY, sensed_force_moment);
 
 		//update last time
 		last_time = curr_time;
@@ -5,8 +5,12 @@
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
+#include "timer/LoopHealth.h"
+#include "threads/RealtimeThread.h"
 #include "tasks/JointTask.h"
 #include "tasks/PosOriTask.h"
+#include "model/MassMatrixInverse.h"
+#include "observers/SurfaceEstimator.h"
 
 #include <iostream>
 #include <string>
@@ -65,6 +69,8 @@ const string BACKWARD_PO_KEY = "sai2::PandaApplication::controller:backward_PO";
 const string STORED_ENERGY_KEY = "sai2::PandaApplication::controller:E_stored";
 const string CORRECTION_ENERGY_KEY = "sai2::PandaApplication::controller:E_correction";
 const string VC_KEY = "sai2::PandaApplication::controller:vc";
+const string LOOP_HEALTH_KEY = "sai2::PandaApplication::controller::loop_health";
+const string SURFACE_NORMAL_KEY = "sai2::PandaApplication::controller:surface_normal";
 
 
 
@@ -119,6 +125,7 @@ int main() {
 	// prepare controller	
 	auto joint_task = new Sai2Primitives::JointTask(robot);
 
+	PandaUtils::MassMatrixInverse<7> mass_matrix_inverse(robot->dof(), inertia_regularization ? 0.07 : 0.0);
 	MatrixXd N_prec = MatrixXd::Identity(robot->dof(), robot->dof());
 	VectorXd joint_task_torques = VectorXd::Zero(robot->dof());
 	joint_task->_kp = 100.0;
@@ -151,6 +158,16 @@ int main() {
 	Vector3d sensed_force = Vector3d::Zero();
 	Vector3d sensed_moment = Vector3d::Zero();
 
+	// plane of the surface fitted from the last 0.5 s of contacts on its own thread. its
+	// normal is fed forward to the orientation and the force axis of the task, at most at
+	// max_alignment_rate, instead of waiting for the moments to turn the tool
+	PandaUtils::SurfaceEstimator surface_estimator(500);
+	PandaUtils::SurfaceEstimator::Plane surface_plane;
+	// out of the surface, the tool axis points along -surface_normal
+	Vector3d surface_normal = Vector3d::UnitZ();
+	const double max_alignment_rate = 0.5;
+	const double desired_normal_force = 10.0;
+
 	// setup redis exchange
 	redis_client.createReadCallback(0);
 	redis_client.createWriteCallback(0);
@@ -170,17 +187,21 @@ int main() {
 	redis_client.addDoubleToWriteCallback(0, BACKWARD_PO_KEY, posori_task->_passivity_observer_force);
 	redis_client.addDoubleToWriteCallback(0, CORRECTION_ENERGY_KEY, posori_task->_E_correction_force);
 	redis_client.addDoubleToWriteCallback(0, FORWARD_PO_KEY, posori_task->_passivity_observer_force_forward);
+	redis_client.addEigenToWriteCallback(0, SURFACE_NORMAL_KEY, surface_normal);
 
 	// create a timer
 	LoopTimer timer;
 	timer.initializeTimer();
 	timer.setLoopFrequency(1000); 
+	PandaUtils::LoopHealth loop_health(1000);
+	PandaUtils::configureRealtimeThread("controller", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
 	double start_time = timer.elapsedTime(); //secs
-	bool fTimerDidSleep = true;
+	double prev_time = 0;
+	surface_estimator.start();
 
 	while (runloop) {
 	// wait for next scheduled loop
-	timer.waitForNextLoop();
+	loop_health.waitForNextLoop(timer);
 	double time = timer.elapsedTime() - start_time;
 
 	// // read robot state from redis
@@ -206,15 +227,7 @@ int main() {
 		posori_task->_kv_ori = stod(redis_client.get(KV_ORI_KEY));
 		robot->updateKinematics();
 		robot->_M = redis_client.getEigenMatrixJSON(MASSMATRIX_KEY);
-		if(inertia_regularization)
-		{
-			robot->_M(4,4) += 0.07;
-			robot->_M(5,5) += 0.07;
-			robot->_M(6,6) += 0.07;
-		}
-		// cout << robot->_M << endl;
-		// robot->_M = Eigen::MatrixXd::Identity(robot->dof(), robot->dof());
-		robot->_M_inv = robot->_M.inverse();
+		mass_matrix_inverse.update(robot);
 	}
 
 	if(state == MOVE_TO_INITIAL)
@@ -258,8 +271,8 @@ int main() {
 		if( sensed_force(2) > 5 )
 		{
 			cout << "open loop force control start" << endl;
-			posori_task->setForceAxis(Vector3d(0,0,1));
-			posori_task->_desired_force = Vector3d(0,0,-10);
+			posori_task->setForceAxis(surface_normal);
+			posori_task->_desired_force = -desired_normal_force * surface_normal;
 			// posori_task->_desired_force = Vector3d(0,0,0);
 			// redis_client.set(DESIRED_EE_FORCE_KEY, to_string(-5));
 			// posori_task->setClosedLoopForceControl();
@@ -269,8 +282,6 @@ int main() {
 	else if(state == FORCE_CONTROL)
 	{
 
-		posori_task->_desired_force = Vector3d(0,0,-10); 
-
 		posori_task->updateSensedForceAndMoment(sensed_force, sensed_moment);
 
 		N_prec.setIdentity();
@@ -278,6 +289,22 @@ int main() {
 		N_prec = posori_task->_N;
 		joint_task->updateTaskModel(N_prec);
 
+		// feedforward alignment : the tool axis turns toward the estimated normal, and the
+		// force is controlled along it
+		surface_estimator.pushContact(time, posori_task->_current_position, posori_task->_sensed_force, posori_task->_sensed_moment);
+		surface_estimator.readPlane(surface_plane);
+		if(surface_plane.valid)
+		{
+			// the sensed force is the force of the tool on the surface, the fitted normal points into it
+			surface_normal = -surface_plane.normal;
+			const Vector3d tool_axis = posori_task->_desired_orientation.col(2);
+			AngleAxisd correction(Quaterniond::FromTwoVectors(tool_axis, -surface_normal));
+			correction.angle() = min(correction.angle(), max_alignment_rate * (time - prev_time));
+			posori_task->_desired_orientation = correction.toRotationMatrix() * posori_task->_desired_orientation;
+			posori_task->setForceAxis(surface_normal);
+		}
+		posori_task->_desired_force = -desired_normal_force * surface_normal;
+
 		// compute torques
 		// posori_task->_desired_force(2) = stod(redis_client.get(DESIRED_EE_FORCE_KEY));
 		posori_task->computeTorques(posori_task_torques);
@@ -323,15 +350,23 @@ int main() {
 	// redis_client.setEigenMatrixJSON(SENSED_EE_FORCE_KEY, posori_task->_sensed_force);
 	// redis_client.setEigenMatrixJSON(JOINT_TORQUES_COMMANDED_KEY, command_torques);
 
+	if(controller_counter % 1000 == 0)
+	{
+		loop_health.publish(redis_client, LOOP_HEALTH_KEY);
+	}
+
+	prev_time = time;
 	controller_counter++;
 
 	}
+	surface_estimator.stop();
 
 double end_time = timer.elapsedTime();
 	std::cout << "\n";
 	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
 	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
     std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+    loop_health.print(std::cout);
 
 
 	return 0;
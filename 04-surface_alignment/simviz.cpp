@@ -10,6 +10,8 @@
 #include "timer/LoopTimer.h"
 #include "force_sensor/ForceSensorSim.h"
 #include "uiforce/UIForceWidget.h"
+#include "sim/AdaptiveStepper.h"
+#include "threads/RealtimeThread.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
 
@@ -40,6 +42,10 @@ const std::string TORQUES_COMMANDED_KEY  = "sai2::PandaApplication::actuators::f
 
 RedisClient redis_client;
 
+// one integration step per loop in free space, substeps in contact, with --adaptive-substeps
+// (see sim/AdaptiveStepper.h)
+bool flag_adaptive_substeps = false;
+
 // simulation function prototype
 void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, UIForceWidget *ui_force_widget);
 
@@ -69,7 +75,8 @@ Eigen::VectorXd ui_force_command_torques;
 // const bool flag_simulation = false;
 const bool flag_simulation = true;
 
-int main() {
+int main(int argc, char** argv) {
+	flag_adaptive_substeps = PandaUtils::AdaptiveStepper::requested(argc, argv);
 	cout << "Loading URDF world model file: " << world_file << endl;
 
 	if(!flag_simulation)
@@ -307,12 +314,17 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, UI
 	// create a timer
 	LoopTimer timer;
 	timer.initializeTimer();
-	timer.setLoopFrequency(1200); 
+	// at the rate of the controller when the contacts are integrated in substeps
+	timer.setLoopFrequency(flag_adaptive_substeps ? 1000 : 1200); 
 	double last_time = timer.elapsedTime(); //secs
 	bool fTimerDidSleep = true;
 
+	PandaUtils::AdaptiveStepper stepper(sim, robot_name, robot);
+
 	unsigned long long simulation_counter = 0;
 
+	PandaUtils::configureRealtimeThread("simulation", PandaUtils::RealtimeConfig::fifo(70, PandaUtils::simulationCpus()));
+
 	while (fSimulationRunning) {
 		fTimerDidSleep = timer.waitForNextLoop();
 
@@ -339,7 +351,14 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, UI
 		// integrate forward
 		double curr_time = timer.elapsedTime();
 		double loop_dt = curr_time - last_time; 
-		sim->integrate(loop_dt);
+		if(flag_adaptive_substeps)
+		{
+			stepper.integrate(loop_dt);
+		}
+		else
+		{
+			sim->integrate(loop_dt);
+		}
 
 		// update force sensor and read values
 		fsensor->update(sim);
@@ -383,6 +402,10 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, UI
 	std::cout << "Simulation Loop run time  : " << end_time << " seconds\n";
 	std::cout << "Simulation Loop updates   : " << timer.elapsedCycles() << "\n";
 	std::cout << "Simulation Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+	if(flag_adaptive_substeps)
+	{
+		std::cout << "Mean integration steps    : " << stepper.meanSubsteps() << " per loop, " << 100*stepper.contactFraction() << "% of the loops in contact\n";
+	}
 }
 
 //------------------------------------------------------------------------------
@@ -5,10 +5,16 @@
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
-#include "filters/ButterworthFilter.h"
+#include "timer/LoopHealth.h"
+#include "threads/RealtimeThread.h"
+#include "filters/ButterworthFilterBank.h"
+#include "observers/ContactEventMonitor.h"
 #include "tasks/JointTask.h"
 #include "tasks/PosOriTask.h"
 #include "tasks/PositionTask.h"
+#include "model/MassMatrixInverse.h"
+#include "model/RankOneProjector.h"
+#include "model/TorqueCommand.h"
 
 #include <iostream>
 #include <string>
@@ -78,6 +84,7 @@ const string CURRENT_JOINT_KEY = "sai2::PandaApplication::controller::logging::c
 const string LINK_IN_CONTACT_KEY = "sai2::PandaApplication::controller::logging::link_in_contact";
 const string COMMAND_TORQUES_LOGGING_KEY = "sai2::PandaApplication::controller::logging::command_torques";
 const string SENSED_TORQUES_LOGGING_KEY = "sai2::PandaApplication::controller::logging::sensed_torques";
+const string LOOP_HEALTH_KEY = "sai2::PandaApplication::controller::loop_health";
 
 int main() {
 
@@ -131,7 +138,11 @@ int main() {
 
 	// prepare controller	
 	int dof = robot->dof();
+	PandaUtils::MassMatrixInverse<7> mass_matrix_inverse(dof, inertia_regularization ? 0.07 : 0.0);
 	VectorXd command_torques = VectorXd::Zero(dof);
+	PandaUtils::TorqueCommand<7>::VectorDof joint_torque_limits;
+	joint_torque_limits << 87, 87, 87, 87, 12, 12, 12;
+	PandaUtils::TorqueCommand<7> torque_command(joint_torque_limits);
 	MatrixXd N_prec = MatrixXd::Identity(dof, dof);
 
 	auto joint_task = new Sai2Primitives::JointTask(robot);
@@ -196,17 +207,15 @@ int main() {
 	int link_in_contact = -1;
 	VectorXd r_filtered = VectorXd::Zero(dof);
 	bool in_contact = false;
-	bool in_contact_prev = false;
 
-	MatrixXd Lambda_contact = MatrixXd::Zero(1,1);
 	MatrixXd Jbar_contact = MatrixXd::Zero(dof,1);
 	MatrixXd Jbar_contact_np = MatrixXd::Zero(dof,1);
 	MatrixXd Proj_contact = MatrixXd::Zero(dof,dof);
 	MatrixXd J_contact = MatrixXd::Zero(1,dof);
 	MatrixXd J_contact_control = MatrixXd::Zero(1,dof);
-	MatrixXd N_contact = MatrixXd::Identity(dof,dof);
+	PandaUtils::RankOneProjector<7> contact_projector(dof);
 
-	ButterworthFilter filter_r = ButterworthFilter(dof, 0.015);
+	PandaUtils::ButterworthFilterBank<> filter_r(dof, 0.015);
 
 	// link centers
 	MatrixXd J_sample = MatrixXd::Zero(3,dof);
@@ -233,12 +242,12 @@ int main() {
 	center_points.push_back(Vector3d(0.088, 0.0, 0.0));
 	center_points.push_back(Vector3d(0.0, 0.0, 0.075));
 
-	int r_buffer_length = 20;
-	MatrixXd r_buffer = MatrixXd::Zero(dof,r_buffer_length);
-	VectorXd r_norm_buffer = VectorXd::Zero(r_buffer_length);
-	VectorXd r_link_in_contact_buffer = -1*VectorXd::Ones(r_buffer_length);
-	VectorXd r_link_in_contact_count = VectorXd::Zero(dof);
-	VectorXd r_mean = VectorXd::Zero(dof);
+	// contact onsets, releases and changes of link, debounced over 20 samples of the filtered
+	// observer, and impacts from its rate of change, before the onset
+	double impact_rate = 10.0;
+	PandaUtils::ContactEventMonitor<7> contact_monitor(link_detection_treshold, 20, impact_rate);
+	PandaUtils::ContactEventMonitor<7>::Event contact_event;
+	contact_monitor.start();
 
 	// torques to compensate contact at task level
 	VectorXd contact_compensation_torques = VectorXd::Zero(dof);
@@ -249,15 +258,16 @@ int main() {
 	LoopTimer timer;
 	timer.initializeTimer();
 	timer.setLoopFrequency(1000); 
+	PandaUtils::LoopHealth loop_health(1000);
+	PandaUtils::configureRealtimeThread("controller", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
 	double current_time = 0;
 	double prev_time = 0;
 	double dt = 0;
-	bool fTimerDidSleep = true;
 	double start_time = timer.elapsedTime(); //secs
 
 	while (runloop) {
 		// wait for next scheduled loop
-		timer.waitForNextLoop();
+		loop_health.waitForNextLoop(timer);
 		current_time = timer.elapsedTime() - start_time;
 		dt = current_time - prev_time;
 
@@ -281,13 +291,7 @@ int main() {
 			pos_task->_kv = stod(redis_client.get(KV_POS_KEY));
 			robot->updateKinematics();
 			robot->_M = redis_client.getEigenMatrixJSON(MASSMATRIX_KEY);
-			if(inertia_regularization)
-			{
-				robot->_M(4,4) += 0.07;
-				robot->_M(5,5) += 0.07;
-				robot->_M(6,6) += 0.07;
-			}
-			robot->_M_inv = robot->_M.inverse();
+			mass_matrix_inverse.update(robot);
 
 			gravity = redis_client.getEigenMatrixJSON(ROBOT_GRAVITY_KEY);
 			coriolis = redis_client.getEigenMatrixJSON(CORIOLIS_KEY);
@@ -302,7 +306,8 @@ int main() {
 
 			joint_task->computeTorques(joint_task_torques);
 
-			command_torques = joint_task_torques + coriolis;
+			torque_command.sum(joint_task_torques, coriolis).saturate();
+			torque_command.copyTo(command_torques);
 
 			if((joint_task->_current_position - joint_task->_desired_position).norm() < 0.2)
 			{
@@ -360,11 +365,13 @@ int main() {
 					J_contact_control = J_contact_control * N_prec;
 
 					J_contact = r_filtered.transpose()/r_filtered.norm();
-					robot->operationalSpaceMatrices(Lambda_contact, Jbar_contact_np, N_contact, J_contact, N_prec);
+					contact_projector.compute(robot->_M_inv, J_contact);
+					Jbar_contact_np = contact_projector.jbar();
 					J_contact = J_contact * N_prec;
-					robot->operationalSpaceMatrices(Lambda_contact, Jbar_contact, N_contact, J_contact, N_prec);
-					Proj_contact = Jbar_contact*J_contact;
-					N_prec = N_prec * N_contact;
+					contact_projector.compute(robot->_M_inv, J_contact, N_prec);
+					Jbar_contact = contact_projector.jbar();
+					Proj_contact.noalias() = Jbar_contact*J_contact;
+					contact_projector.project(N_prec);
 				
 
 					joint_task->updateTaskModel(N_prec);
@@ -382,69 +389,33 @@ int main() {
 				r_mom = K0 * (p - integral_mom);
 			}
 
-			// process velocity observer
+			// process velocity observer, the state follows the contact events
 			r_filtered = filter_r.update(r_mom);
-			int i_buffer = controller_counter % r_buffer_length;
-			r_norm_buffer(i_buffer) = r_filtered.norm();
-			in_contact_prev = in_contact;
-			if(r_link_in_contact_buffer[i_buffer] != -1)
+			contact_monitor.pushSample(current_time, r_filtered);
+			while(contact_monitor.poll(contact_event))
 			{
-				r_link_in_contact_count(r_link_in_contact_buffer[i_buffer]) -= 1;
-			}
-			link_in_contact = -1;
-			for(int i=0 ; i<dof ; i++)
-			{
-				if(r_filtered(i) > link_detection_treshold || -r_filtered(i) > link_detection_treshold)
+				if(contact_event.type == PandaUtils::ContactEventMonitor<7>::ONSET)
 				{
-					link_in_contact = i;						
+					in_contact = true;
+					link_in_contact = contact_event.link;
+					cout << "contact on link " << link_in_contact << " at " << contact_event.time << endl;
 				}
-			}
-			r_link_in_contact_buffer(i_buffer) = link_in_contact;
-			if(link_in_contact > -1)
-			{
-				r_link_in_contact_count(link_in_contact) += 1;
-			}
-
-			bool buffer_all_true = true;
-			bool buffer_all_false = true;
-
-			for (int i = 0; i < r_buffer_length; i++)
-			{
-				buffer_all_true = buffer_all_true && (r_link_in_contact_buffer(i) != -1);
-				buffer_all_false = buffer_all_false && (r_link_in_contact_buffer(i) == -1);
-			}
-
-			if(buffer_all_true)
-			{
-				in_contact = true;
-			}
-			else if(buffer_all_false)
-			{
-				in_contact = false;
-			}
-			else
-			{
-				in_contact = in_contact_prev;
-			}
-
-			if(in_contact)
-			{
-				int lc = 0;
-				for(int i=0 ; i<dof ; i++)
+				else if(contact_event.type == PandaUtils::ContactEventMonitor<7>::LINK_CHANGE)
 				{
-					if(r_link_in_contact_count(i) > r_link_in_contact_count(lc))
-					{
-						lc = i;
-					}
+					link_in_contact = contact_event.link;
+				}
+				else if(contact_event.type == PandaUtils::ContactEventMonitor<7>::RELEASE)
+				{
+					in_contact = false;
+					link_in_contact = -1;
+					cout << "lost contact" << endl;
+					joint_task->reInitializeTask();
+					joint_task->_desired_position = q_init_desired;
+				}
+				else if(contact_event.type == PandaUtils::ContactEventMonitor<7>::IMPACT)
+				{
+					cout << "impact on link " << contact_event.link << " at " << contact_event.time << endl;
 				}
-				link_in_contact = lc;
-			}
-
-			if(!in_contact && in_contact_prev)
-			{
-				cout << "lost contact" << endl;
-				joint_task->reInitializeTask();
-				joint_task->_desired_position = q_init_desired;
 			}
 
 			// compute torques
@@ -465,7 +436,9 @@ int main() {
 				contact_force_control_torques = target_contact_force*J_contact_control.transpose();
 			}
 
-			command_torques = pos_task_torques + joint_task_torques + coriolis - contact_compensation_torques - contact_force_control_torques;
+			torque_command.sum(pos_task_torques, joint_task_torques, coriolis)
+					.subtract(contact_compensation_torques).subtract(contact_force_control_torques).saturate();
+			torque_command.copyTo(command_torques);
 			// command_torques = pos_task_torques + joint_task_torques + coriolis - contact_compensation_torques;
 			// command_torques = pos_task_torques + joint_task_torques + coriolis;
 
@@ -511,8 +484,6 @@ int main() {
 			// cout << in_contact << endl;
 			// cout << r_filtered.transpose() * (command_torques + contact_compensation_torques) << endl;
 			cout << "filtered observer :\n" << r_filtered.transpose() << endl;
-			cout << "link in contact buffer :\n" << r_link_in_contact_buffer.transpose() << endl;
-			cout << "link in contact count :\n" << r_link_in_contact_count.transpose() << endl;
 			cout << "link in contact : " << link_in_contact << endl;
 			cout << "direction : " << Jbar_contact_np.transpose() * (pos_task_torques + joint_task_torques_np) << endl;
 			// cout << "J contact control : " << J_contact_control << endl;
@@ -527,14 +498,23 @@ int main() {
 		}
 
 		prev_time = current_time;
+
+		if(controller_counter % 1000 == 0)
+		{
+			loop_health.publish(redis_client, LOOP_HEALTH_KEY);
+		}
+
 		controller_counter++;
 	}
+	contact_monitor.stop();
 
 	double end_time = timer.elapsedTime();
 	std::cout << "\n";
 	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
 	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
     std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+    loop_health.print(std::cout);
+	std::cout << "Contact events dropped    : " << contact_monitor.numDroppedEvents() << "\n";
 
 	return 0;
 }
@@ -5,8 +5,11 @@
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
+#include "timer/LoopHealth.h"
+#include "threads/RealtimeThread.h"
 #include "tasks/JointTask.h"
 #include "tasks/PosOriTask.h"
+#include "trajectories/JerkLimitedTrajectory.h"
 
 #include <iostream>
 #include <string>
@@ -69,6 +72,10 @@ const vector<string> GRIPPER_DESIRED_FORCE_KEYS = {
 	"sai2::WarehouseSimulation::panda2::gripper::desired_force",
 };
 
+// - state machine, saved in the snapshots of the simviz
+const string CONTROLLER_STATE_KEY = "sai2::WarehouseSimulation::controller::state";
+const string LOOP_HEALTH_KEY = "sai2::WarehouseSimulation::controller::loop_health";
+
 #define GO_TO_INIT_CONFIG       0
 #define PICK_OBJECT             1
 #define TRANSFER_OBJECT         2
@@ -83,7 +90,17 @@ unsigned long long controller_counter = 0;
 
 RedisClient redis_client;
 
-int main() {
+int main(int argc, char** argv) {
+
+	// controller [--restore-state], after a simviz --restore-state
+	bool flag_restore_state = false;
+	for(int i=1 ; i<argc ; i++)
+	{
+		if(string(argv[i]) == "--restore-state")
+		{
+			flag_restore_state = true;
+		}
+	}
 
 	// object gravity
 	VectorXd object_gravity = VectorXd::Zero(6);
@@ -159,26 +176,92 @@ int main() {
 		posori_tasks[i]->_kp_ori = 400.0;
 		posori_tasks[i]->_kv_ori = 40.0;		
 
-		posori_tasks[i]->_use_velocity_saturation_flag = true;
+		// the trajectories below bound the velocity, and the saturation would drop their feedforward
+		posori_tasks[i]->_use_velocity_saturation_flag = false;
 		posori_tasks[i]->_linear_saturation_velocity = 0.1;
 		posori_tasks[i]->_angular_saturation_velocity = 60.0/180.0;
 
 	}
 	// posori_tasks[1]->_angular_saturation_velocity = 20.0/180.0*M_PI*Vector3d::Ones();
 
+	// resume the state machine of the snapshot from the restored configuration
+	if(flag_restore_state && redis_client.exists(CONTROLLER_STATE_KEY))
+	{
+		state = stoi(redis_client.get(CONTROLLER_STATE_KEY));
+		for(int i=0 ; i<n_robots ; i++)
+		{
+			posori_tasks[i]->reInitializeTask();
+		}
+		cout << "restored controller state " << state << endl;
+	}
+	redis_client.set(CONTROLLER_STATE_KEY, to_string(state));
+	int published_state = state;
+
+	// time optimal, jerk limited motions to the goals of the states, planned when a goal
+	// changes (at the state entry) and sampled at the period of the loop
+	const double control_period = 0.001;
+	vector<PandaUtils::JointTrajectory*> joint_trajectories;
+	vector<PandaUtils::CartesianTrajectory*> cartesian_trajectories;
+	vector<bool> joint_trajectory_planned;
+	vector<VectorXd> q_init_goal;
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		VectorXd joint_v_max = VectorXd::Zero(dof[i]);
+		joint_v_max << 2.0, 2.0, 2.0, 2.0, 2.5, 2.5, 2.5;
+		joint_trajectories.push_back(new PandaUtils::JointTrajectory(control_period, 0.5*joint_v_max, 2.0*joint_v_max, 10.0*joint_v_max));
+		cartesian_trajectories.push_back(new PandaUtils::CartesianTrajectory(control_period, 0.3, 1.0, 5.0, 1.0, 3.0, 15.0));
+		joint_trajectory_planned.push_back(false);
+		q_init_goal.push_back(joint_tasks[i]->_desired_position);
+		// no motion until the first goal, and the pose kept by the states that do not move a robot
+		cartesian_trajectories[i]->plan(posori_tasks[i]->_desired_position, posori_tasks[i]->_desired_orientation,
+				posori_tasks[i]->_desired_position, posori_tasks[i]->_desired_orientation, 0);
+
+		posori_tasks[i]->_desired_velocity.setZero();
+		posori_tasks[i]->_desired_angular_velocity.setZero();
+		posori_tasks[i]->_desired_acceleration.setZero();
+		posori_tasks[i]->_desired_angular_acceleration.setZero();
+	}
+	double current_time = 0;
+
+	// streams the setpoints of the joint task i towards q_goal, from the current configuration
+	auto jointMoveTo = [&](const int i, const VectorXd& q_goal)
+	{
+		if(!joint_trajectory_planned[i] || !joint_trajectories[i]->goal().isApprox(q_goal))
+		{
+			joint_trajectories[i]->plan(robots[i]->_q, q_goal, current_time);
+			joint_trajectory_planned[i] = true;
+		}
+		joint_trajectories[i]->setpoint(current_time, joint_tasks[i]->_desired_position,
+				joint_tasks[i]->_desired_velocity, joint_tasks[i]->_desired_acceleration);
+	};
+
+	// streams the setpoints of the posori task i towards a goal, from its last setpoint
+	auto moveTo = [&](const int i, const Vector3d& goal_position, const Matrix3d& goal_orientation)
+	{
+		if(!cartesian_trajectories[i]->goalPosition().isApprox(goal_position, 1e-9)
+			|| !cartesian_trajectories[i]->goalOrientation().isApprox(goal_orientation, 1e-9))
+		{
+			cartesian_trajectories[i]->plan(posori_tasks[i]->_desired_position, posori_tasks[i]->_desired_orientation,
+					goal_position, goal_orientation, current_time);
+		}
+		cartesian_trajectories[i]->setpoint(current_time, posori_tasks[i]->_desired_position, posori_tasks[i]->_desired_orientation,
+				posori_tasks[i]->_desired_velocity, posori_tasks[i]->_desired_angular_velocity,
+				posori_tasks[i]->_desired_acceleration, posori_tasks[i]->_desired_angular_acceleration);
+	};
+
 	// create a timer
 	LoopTimer timer;
 	timer.initializeTimer();
 	timer.setLoopFrequency(1000); 
-	double current_time = 0;
+	PandaUtils::LoopHealth loop_health(1000);
+	PandaUtils::configureRealtimeThread("controller", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
 	double prev_time = 0;
 	double dt = 0;
-	bool fTimerDidSleep = true;
 	double start_time = timer.elapsedTime(); //secs
 
 	while (runloop) {
 		// wait for next scheduled loop
-		timer.waitForNextLoop();
+		loop_health.waitForNextLoop(timer);
 		current_time = timer.elapsedTime() - start_time;
 		dt = current_time - prev_time;
 
@@ -199,6 +282,7 @@ int main() {
 				N_prec[i].setIdentity();
 				joint_tasks[i]->updateTaskModel(N_prec[i]);
 
+				jointMoveTo(i, q_init_goal[i]);
 				joint_tasks[i]->computeTorques(joint_task_torques[i]);
 				command_torques[i] = joint_task_torques[i] + coriolis[i];
 			}
@@ -209,7 +293,7 @@ int main() {
 				cumulative_joint_error += (joint_tasks[i]->_current_position - joint_tasks[i]->_desired_position).norm();
 			}
 
-			if(cumulative_joint_error < 0.3)
+			if(cumulative_joint_error < 0.3 && joint_trajectories[0]->finished(current_time) && joint_trajectories[1]->finished(current_time))
 			{
 				for(int i=0 ; i<n_robots ; i++)
 				{
@@ -235,8 +319,8 @@ int main() {
 			}
 
 			// set goal positions
-			posori_tasks[0]->_desired_position = robot_pose_in_world[0].linear().transpose()*(Vector3d(-0.07,-0.75,0.24) - robot_pose_in_world[0].translation());
-			posori_tasks[0]->_desired_orientation = robot_pose_in_world[0].linear().transpose()*AngleAxisd(180.0/180.0*M_PI, Vector3d::UnitX()).toRotationMatrix()*AngleAxisd(-45.0/180.0*M_PI, Vector3d::UnitZ()).toRotationMatrix();
+			moveTo(0, robot_pose_in_world[0].linear().transpose()*(Vector3d(-0.07,-0.75,0.24) - robot_pose_in_world[0].translation()),
+					robot_pose_in_world[0].linear().transpose()*AngleAxisd(180.0/180.0*M_PI, Vector3d::UnitX()).toRotationMatrix()*AngleAxisd(-45.0/180.0*M_PI, Vector3d::UnitZ()).toRotationMatrix());
 
 			// compute torques
 			for(int i=0 ; i<n_robots ; i++)
@@ -247,7 +331,7 @@ int main() {
 				command_torques[i] = posori_task_torques[i] + joint_task_torques[i] + coriolis[i];
 			}
 
-			if((posori_tasks[0]->_desired_position - posori_tasks[0]->_current_position).norm() < 1e-3)
+			if(cartesian_trajectories[0]->finished(current_time) && (posori_tasks[0]->_desired_position - posori_tasks[0]->_current_position).norm() < 1e-3)
 			{
 				translation_counter++;
 			}
@@ -278,11 +362,11 @@ int main() {
 			}
 
 			// set goal positions
-			posori_tasks[0]->_desired_position = robot_pose_in_world[0].linear().transpose()*(Vector3d(-0.0,-0.025,0.5) - robot_pose_in_world[0].translation());
-			posori_tasks[0]->_desired_orientation = robot_pose_in_world[0].linear().transpose()*AngleAxisd(-90.0/180.0*M_PI, Vector3d::UnitX()).toRotationMatrix()*AngleAxisd(45.0/180.0*M_PI, Vector3d::UnitZ()).toRotationMatrix();
+			moveTo(0, robot_pose_in_world[0].linear().transpose()*(Vector3d(-0.0,-0.025,0.5) - robot_pose_in_world[0].translation()),
+					robot_pose_in_world[0].linear().transpose()*AngleAxisd(-90.0/180.0*M_PI, Vector3d::UnitX()).toRotationMatrix()*AngleAxisd(45.0/180.0*M_PI, Vector3d::UnitZ()).toRotationMatrix());
 			
-			posori_tasks[1]->_desired_position = robot_pose_in_world[1].linear().transpose()*(Vector3d(-0.0,0.025,0.495) - robot_pose_in_world[1].translation());
-			posori_tasks[1]->_desired_orientation = robot_pose_in_world[1].linear().transpose()*AngleAxisd(90.0/180.0*M_PI, Vector3d::UnitX()).toRotationMatrix()*AngleAxisd(-45.0/180.0*M_PI, Vector3d::UnitZ()).toRotationMatrix();
+			moveTo(1, robot_pose_in_world[1].linear().transpose()*(Vector3d(-0.0,0.025,0.495) - robot_pose_in_world[1].translation()),
+					robot_pose_in_world[1].linear().transpose()*AngleAxisd(90.0/180.0*M_PI, Vector3d::UnitX()).toRotationMatrix()*AngleAxisd(-45.0/180.0*M_PI, Vector3d::UnitZ()).toRotationMatrix());
 
 			// compute torques
 			for(int i=0 ; i<n_robots ; i++)
@@ -294,7 +378,8 @@ int main() {
 			}
 			command_torques[0] -= posori_tasks[0]->_projected_jacobian.transpose()*object_gravity;
 
-			if((posori_tasks[0]->_desired_position - posori_tasks[0]->_current_position).norm() < 1e-2
+			if(cartesian_trajectories[0]->finished(current_time) && cartesian_trajectories[1]->finished(current_time)
+				&& (posori_tasks[0]->_desired_position - posori_tasks[0]->_current_position).norm() < 1e-2
 				&& (posori_tasks[1]->_desired_position - posori_tasks[1]->_current_position).norm() < 1e-2)
 			{
 				translation_counter++;
@@ -327,11 +412,11 @@ int main() {
 			}
 
 			// set goal positions
-			posori_tasks[0]->_desired_position = robot_pose_in_world[0].linear().transpose()*(Vector3d(-0.0,-0.2,0.5) - robot_pose_in_world[0].translation());
-			posori_tasks[0]->_desired_orientation = robot_pose_in_world[0].linear().transpose()*AngleAxisd(-90.0/180.0*M_PI, Vector3d::UnitX()).toRotationMatrix()*AngleAxisd(45.0/180.0*M_PI, Vector3d::UnitZ()).toRotationMatrix();
+			moveTo(0, robot_pose_in_world[0].linear().transpose()*(Vector3d(-0.0,-0.2,0.5) - robot_pose_in_world[0].translation()),
+					robot_pose_in_world[0].linear().transpose()*AngleAxisd(-90.0/180.0*M_PI, Vector3d::UnitX()).toRotationMatrix()*AngleAxisd(45.0/180.0*M_PI, Vector3d::UnitZ()).toRotationMatrix());
 			
-			posori_tasks[1]->_desired_position = robot_pose_in_world[1].linear().transpose()*(Vector3d(-0.05,0.7,0.27) - robot_pose_in_world[1].translation());
-			posori_tasks[1]->_desired_orientation = robot_pose_in_world[1].linear().transpose()*AngleAxisd(180.0/180.0*M_PI, Vector3d::UnitX()).toRotationMatrix()*AngleAxisd(-45.0/180.0*M_PI, Vector3d::UnitZ()).toRotationMatrix();
+			moveTo(1, robot_pose_in_world[1].linear().transpose()*(Vector3d(-0.05,0.7,0.27) - robot_pose_in_world[1].translation()),
+					robot_pose_in_world[1].linear().transpose()*AngleAxisd(180.0/180.0*M_PI, Vector3d::UnitX()).toRotationMatrix()*AngleAxisd(-45.0/180.0*M_PI, Vector3d::UnitZ()).toRotationMatrix());
 			// posori_tasks[1]->_desired_position = robot_pose_in_world[1].linear().transpose()*(Vector3d(-0.05,0.7,0.4) - robot_pose_in_world[1].translation());
 			// posori_tasks[1]->_desired_orientation = robot_pose_in_world[1].linear().transpose()*AngleAxisd(90.0/180.0*M_PI, Vector3d::UnitX()).toRotationMatrix()*AngleAxisd(-45.0/180.0*M_PI, Vector3d::UnitZ()).toRotationMatrix();
 
@@ -345,7 +430,8 @@ int main() {
 			}
 			command_torques[1] -= posori_tasks[1]->_projected_jacobian.transpose()*object_gravity;
 
-			if((posori_tasks[0]->_desired_position - posori_tasks[0]->_current_position).norm() < 1e-2
+			if(cartesian_trajectories[0]->finished(current_time) && cartesian_trajectories[1]->finished(current_time)
+				&& (posori_tasks[0]->_desired_position - posori_tasks[0]->_current_position).norm() < 1e-2
 				&& (posori_tasks[1]->_desired_position - posori_tasks[1]->_current_position).norm() < 1e-2)
 			{
 				translation_counter++;
@@ -375,10 +461,11 @@ int main() {
 			}
 
 			// set goal positions
-			posori_tasks[0]->_desired_orientation = robot_pose_in_world[0].linear().transpose()*AngleAxisd(180.0/180.0*M_PI, Vector3d::UnitX()).toRotationMatrix();
+			moveTo(0, cartesian_trajectories[0]->goalPosition(),
+					robot_pose_in_world[0].linear().transpose()*AngleAxisd(180.0/180.0*M_PI, Vector3d::UnitX()).toRotationMatrix());
 			
-			posori_tasks[1]->_desired_position = robot_pose_in_world[1].linear().transpose()*(Vector3d(-0.05,0.7,0.2535) - robot_pose_in_world[1].translation());
-			posori_tasks[1]->_desired_orientation = robot_pose_in_world[1].linear().transpose()*AngleAxisd(180.0/180.0*M_PI, Vector3d::UnitX()).toRotationMatrix()*AngleAxisd(-45.0/180.0*M_PI, Vector3d::UnitZ()).toRotationMatrix();
+			moveTo(1, robot_pose_in_world[1].linear().transpose()*(Vector3d(-0.05,0.7,0.2535) - robot_pose_in_world[1].translation()),
+					robot_pose_in_world[1].linear().transpose()*AngleAxisd(180.0/180.0*M_PI, Vector3d::UnitX()).toRotationMatrix()*AngleAxisd(-45.0/180.0*M_PI, Vector3d::UnitZ()).toRotationMatrix());
 
 			// compute torques
 			for(int i=0 ; i<n_robots ; i++)
@@ -390,7 +477,7 @@ int main() {
 			}
 			command_torques[1] -= posori_tasks[1]->_projected_jacobian.transpose()*object_gravity;
 
-			if((posori_tasks[1]->_desired_position - posori_tasks[1]->_current_position).norm() < 1e-2)
+			if(cartesian_trajectories[1]->finished(current_time) && (posori_tasks[1]->_desired_position - posori_tasks[1]->_current_position).norm() < 1e-2)
 			{
 				translation_counter++;
 			}
@@ -421,9 +508,9 @@ int main() {
 			}
 
 			// set goal positions
-			posori_tasks[1]->_desired_position = robot_pose_in_world[1].linear().transpose()*(Vector3d(-0.0,0.2,0.5) - robot_pose_in_world[1].translation());
 			// posori_tasks[1]->_desired_orientation = robot_pose_in_world[1].linear().transpose()*AngleAxisd(180.0/180.0*M_PI, Vector3d::UnitX()).toRotationMatrix()*AngleAxisd(-45.0/180.0*M_PI, Vector3d::UnitZ()).toRotationMatrix();
-			posori_tasks[1]->_desired_orientation = robot_pose_in_world[1].linear().transpose()*AngleAxisd(180.0/180.0*M_PI, Vector3d::UnitX()).toRotationMatrix();
+			moveTo(1, robot_pose_in_world[1].linear().transpose()*(Vector3d(-0.0,0.2,0.5) - robot_pose_in_world[1].translation()),
+					robot_pose_in_world[1].linear().transpose()*AngleAxisd(180.0/180.0*M_PI, Vector3d::UnitX()).toRotationMatrix());
 
 			// compute torques
 			for(int i=0 ; i<n_robots ; i++)
@@ -449,8 +536,19 @@ int main() {
 		{
 			redis_client.setEigenMatrixJSON(TORQUES_COMMANDED_KEYS[i], command_torques[i]);
 		}
+		if(state != published_state)
+		{
+			redis_client.set(CONTROLLER_STATE_KEY, to_string(state));
+			published_state = state;
+		}
 
 		prev_time = current_time;
+
+		if(controller_counter % 1000 == 0)
+		{
+			loop_health.publish(redis_client, LOOP_HEALTH_KEY);
+		}
+
 		controller_counter++;
 	}
 
@@ -465,6 +563,7 @@ int main() {
 	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
 	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
     std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+    loop_health.print(std::cout);
 
 	return 0;
 }
\ No newline at end of file
@@ -8,6 +8,11 @@
 #include <dynamics3d.h>
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
+#include "graphics/RenderScheduler.h"
+#include "graphics/MeshLod.h"
+#include "sim/SimSnapshot.h"
+#include "model/UrdfCache.h"
+#include "threads/RealtimeThread.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
 
@@ -78,6 +83,10 @@ const vector<string> GRIPPER_DESIRED_FORCE_KEYS = {
 	"sai2::WarehouseSimulation::panda2::gripper::desired_force",
 };
 
+// - snapshots of the simulation state, the save key is polled for a save request (1)
+const string SAVE_STATE_KEY = "sai2::WarehouseSimulation::simulation::save_state";
+const string CONTROLLER_STATE_KEY = "sai2::WarehouseSimulation::controller::state";
+
 const vector<double> gripper_max_widths = {
 	0.08,
 	0.08,
@@ -89,6 +98,7 @@ vector<double> gripper_widths = {
 
 
 RedisClient redis_client;
+PandaUtils::SimSnapshotService* snapshots;
 vector<Vector3d> object_positions;
 vector<Quaterniond> object_orientations;
 
@@ -117,15 +127,28 @@ bool fTransZp = false;
 bool fTransZn = false;
 bool fRotPanTilt = false;
 
-int main() {
+int main(int argc, char** argv) {
 	cout << "Loading URDF world model file: " << world_file << endl;
+	// the world file with decimated visual meshes, built at the first launch
+	const string loaded_world_file = PandaUtils::cachedWorldFile(world_file);
+
+	// simviz [--save-state file [--save-state-at seconds]] [--restore-state file]
+	vector<string> snapshot_redis_keys = {CONTROLLER_STATE_KEY};
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		snapshot_redis_keys.push_back(GRIPPER_MODE_KEYS[i]);
+		snapshot_redis_keys.push_back(GRIPPER_DESIRED_WIDTH_KEYS[i]);
+		snapshot_redis_keys.push_back(GRIPPER_DESIRED_SPEED_KEYS[i]);
+		snapshot_redis_keys.push_back(GRIPPER_DESIRED_FORCE_KEYS[i]);
+	}
+	snapshots = new PandaUtils::SimSnapshotService(argc, argv, SAVE_STATE_KEY, robot_names, object_names, snapshot_redis_keys);
 
 	// start redis client
 	redis_client = RedisClient();
 	redis_client.connect();
 
 	// load graphics scene
-	auto graphics = new Sai2Graphics::Sai2Graphics(world_file, false);
+	auto graphics = new Sai2Graphics::Sai2Graphics(loaded_world_file, false);
 	Eigen::Vector3d camera_pos, camera_lookat, camera_vertical;
 	graphics->getCameraPose(camera_name, camera_pos, camera_vertical, camera_lookat);
 
@@ -137,10 +160,13 @@ int main() {
 	}
 
 	// load simulation world
-	auto sim = new Simulation::Sai2Simulation(world_file, false);
+	auto sim = new Simulation::Sai2Simulation(loaded_world_file, false);
 	sim->setCollisionRestitution(0);
 	sim->setCoeffFrictionStatic(0.8);
 
+	// restore the robots and objects before they are read
+	snapshots->restoreSimulation(sim);
+
 	// read joint positions, velocities, update model
 	for(int i=0 ; i<n_robots ; i++)
 	{
@@ -196,27 +222,42 @@ int main() {
 	fSimulationRunning = true;
 	thread sim_thread(simulation, robots, sim);
 
+	// frames at 30 Hz at most and only when the scene changed, decimated meshes far from the camera
+	PandaUtils::RenderScheduler render_scheduler(30.0);
+	PandaUtils::MeshLod mesh_lod(graphics->_world, graphics->getCamera(camera_name));
+
 	// while window is open:
 	while (!glfwWindowShouldClose(window))
 	{
-		// update graphics. this automatically waits for the correct amount of time
+		// update the graphics of what moved, and draw a frame only if something did
+		render_scheduler.waitForNextFrame();
 		int width, height;
 		glfwGetFramebufferSize(window, &width, &height);
 		for(int i=0 ; i<n_robots ; i++)
 		{
-			graphics->updateGraphics(robot_names[i], robots[i]);
+			if(render_scheduler.robotMoved(robot_names[i], robots[i]->_q))
+			{
+				graphics->updateGraphics(robot_names[i], robots[i]);
+			}
 		}
 		for(int i=0 ; i< n_objects ; i++)
 		{
-			graphics->updateObjectGraphics(object_names[i], object_positions[i], object_orientations[i]);
+			if(render_scheduler.objectMoved(object_names[i], object_positions[i], object_orientations[i]))
+			{
+				graphics->updateObjectGraphics(object_names[i], object_positions[i], object_orientations[i]);
+			}
 		}
-		graphics->render(camera_name, width, height);
-
-		// swap buffers
-		glfwSwapBuffers(window);
+		if(mesh_lod.update())
+		{
+			render_scheduler.invalidate();
+		}
+		if(render_scheduler.frameDue(width, height))
+		{
+			graphics->render(camera_name, width, height);
 
-		// wait until all GL commands are completed
-		glFinish();
+			// swap buffers
+			glfwSwapBuffers(window);
+		}
 
 		// check for any OpenGL errors
 		GLenum err;
@@ -279,6 +320,7 @@ int main() {
 			camera_pos = camera_lookat + m_pan*(camera_pos - camera_lookat);
 		}
 		graphics->setCameraPose(camera_name, camera_pos, cam_up_axis, camera_lookat);
+		render_scheduler.cameraMoved(camera_pos, cam_up_axis, camera_lookat);
 		glfwGetCursorPos(window, &last_cursorx, &last_cursory);
 	}
 
@@ -307,6 +349,7 @@ void simulation(vector<Sai2Model::Sai2Model*> robots, Simulation::Sai2Simulation
 		redis_client.set(GRIPPER_DESIRED_FORCE_KEYS[i], to_string(0));
 		redis_client.set(GRIPPER_MODE_KEYS[i], "m");
 	}
+	snapshots->restoreRedis(redis_client);
 
 	// create a timer
 	LoopTimer timer;
@@ -318,6 +361,8 @@ void simulation(vector<Sai2Model::Sai2Model*> robots, Simulation::Sai2Simulation
 
 	unsigned long long simulation_counter = 0;
 
+	PandaUtils::configureRealtimeThread("simulation", PandaUtils::RealtimeConfig::fifo(70, PandaUtils::simulationCpus()));
+
 	while (fSimulationRunning) {
 		fTimerDidSleep = timer.waitForNextLoop();
 
@@ -369,6 +414,8 @@ void simulation(vector<Sai2Model::Sai2Model*> robots, Simulation::Sai2Simulation
 		}
 		redis_client.set(TIMESTAMP_KEY, to_string(curr_time));
 
+		snapshots->update(sim, redis_client, loop_dt);
+
 		//update last time
 		last_time = curr_time;
 
@@ -4,12 +4,21 @@
 
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
+#include "redis/MultiRobotRedisIO.h"
 #include "timer/LoopTimer.h"
+#include "timer/LoopHealth.h"
+#include "threads/RealtimeThread.h"
 #include "tasks/JointTask.h"
 #include "tasks/PosOriTask.h"
+#include "threads/WorkerPool.h"
+#include "threads/TripleBuffer.h"
+#include "redis/RedisClientPool.h"
+#include "observers/TrayObjectEstimator.h"
 
+#include <atomic>
 #include <iostream>
 #include <string>
+#include <thread>
 
 #include <signal.h>
 bool runloop = false;
@@ -40,6 +49,11 @@ const vector<string> JOINT_VELOCITIES_KEYS = {
 	"sai2::WarehouseSimulation::panda1::sensors::dq",
 	"sai2::WarehouseSimulation::panda2::sensors::dq",
 };
+// contact force of the tray on the fingers and its moment about the world origin, world frame
+const vector<string> GRASP_WRENCH_KEYS = {
+	"sai2::WarehouseSimulation::panda1::sensors::grasp_wrench",
+	"sai2::WarehouseSimulation::panda2::sensors::grasp_wrench",
+};
 
 // - write
 const vector<string> TORQUES_COMMANDED_KEYS = {
@@ -76,10 +90,19 @@ const vector<string> GRIPPER_DESIRED_FORCE_KEYS = {
 // Sai2Primitives::PosOriTask* posori_task_mu_1;
 // Sai2Primitives::PosOriTask* posori_task_mu_2;
 
-// function to update model at a slower rate
-void updateModelThread(vector<shared_ptr<Sai2Model::Sai2Model>> robots, 
-		vector<shared_ptr<Sai2Primitives::JointTask>> joint_tasks, 
-		vector<shared_ptr<Sai2Primitives::PosOriTask>> posori_tasks);
+// the calling thread updates the first robot, the workers the next ones on these cpus
+const vector<int> MODEL_UPDATE_CPUS = {3, 4, 5};
+// the tray estimator runs at the rate of the simulation, which publishes the sensors
+const int TRAY_ESTIMATOR_CPU = 6;
+const double TRAY_ESTIMATOR_FREQUENCY = 1500.0;
+
+// tray of world.urdf in the frame between the grasps : its center is below the grasp points,
+// at the bottom of the side walls, and a ball of 2 cm on it has its center 5 mm below them
+const double TRAY_MASS = 0.5;
+const Vector3d TRAY_COM_IN_GRASP_FRAME = Vector3d(0.0, 0.0, -0.03);
+const double OBJECT_HEIGHT_IN_GRASP_FRAME = -0.005;
+// lighter estimates are no object
+const double OBJECT_MIN_MASS = 0.05;
 
 #define PICK_TRAY               0
 #define LIFT_TRAY               1
@@ -87,6 +110,7 @@ void updateModelThread(vector<shared_ptr<Sai2Model::Sai2Model>> robots,
 int translation_counter = 0;
 
 int state = PICK_TRAY;
+const string LOOP_HEALTH_KEY = "sai2::WarehouseSimulation::controller::loop_health";
 unsigned long long controller_counter = 0;
 
 RedisClient redis_client;
@@ -169,35 +193,150 @@ int main() {
 
 	}
 
-	// start update_model thread
-	thread model_update_thread(updateModelThread, robots, joint_tasks, posori_tasks);
+	// model and task model updates of all the robots in parallel, one robot per thread
+	PandaUtils::WorkerPool model_update_pool(n_robots, MODEL_UPDATE_CPUS);
+	auto update_robot_model = [&](const int i)
+	{
+		robots[i]->updateModel();
+		robots[i]->coriolisForce(coriolis[i]);
+
+		if(state == PICK_TRAY || state == LIFT_TRAY)
+		{
+			N_prec[i].setIdentity();
+			posori_tasks[i]->updateTaskModel(N_prec[i]);
+
+			N_prec[i] = posori_tasks[i]->_N;
+			joint_tasks[i]->updateTaskModel(N_prec[i]);
+		}
+	};
+
+	// state reads and torque writes of all the robots in one round trip each
+	PandaUtils::MultiRobotRedisIO robots_io(redis_client, JOINT_ANGLES_KEYS, JOINT_VELOCITIES_KEYS, TORQUES_COMMANDED_KEYS, dof);
+
+	// tray pose and object state at the rate of the sensors, on a thread of its own with its
+	// own redis connection and copies of the models. the control thread reads the latest
+	// estimate once per tick and gives the same one to both arms
+	PandaUtils::RedisClientPool redis_pool;
+	// the state of a reset estimator (step 0) until the first estimate
+	PandaUtils::TripleBuffer<PandaUtils::TrayObjectEstimator::State> tray_state_buffer(
+			PandaUtils::TrayObjectEstimator(TRAY_MASS, TRAY_COM_IN_GRASP_FRAME, OBJECT_HEIGHT_IN_GRASP_FRAME).state());
+	std::atomic<bool> tray_grasped(false);
+	unsigned long long tray_estimator_wrench_updates = 0;
+	auto tray_estimator_loop = [&]()
+	{
+		PandaUtils::configureRealtimeThread("tray_estimator", PandaUtils::RealtimeConfig::fifo(75, {TRAY_ESTIMATOR_CPU}));
+		RedisClient& estimator_redis_client = redis_pool.client();
+
+		vector<shared_ptr<Sai2Model::Sai2Model>> estimator_robots;
+		vector<VectorXd> grasp_wrenches;
+		estimator_redis_client.createReadCallback(0);
+		for(int i=0 ; i<n_robots ; i++)
+		{
+			estimator_robots.push_back(make_shared<Sai2Model::Sai2Model>(robot_files[i], false));
+			grasp_wrenches.push_back(VectorXd::Zero(6));
+			estimator_redis_client.addEigenToReadCallback(0, JOINT_ANGLES_KEYS[i], estimator_robots[i]->_q);
+			estimator_redis_client.addEigenToReadCallback(0, JOINT_VELOCITIES_KEYS[i], estimator_robots[i]->_dq);
+			estimator_redis_client.addEigenToReadCallback(0, GRASP_WRENCH_KEYS[i], grasp_wrenches[i]);
+		}
+		const string link_name = "link7";
+		const Vector3d pos_in_link = Vector3d(0.0,0.0,0.2);
+
+		PandaUtils::TrayObjectEstimator tray_estimator(TRAY_MASS, TRAY_COM_IN_GRASP_FRAME, OBJECT_HEIGHT_IN_GRASP_FRAME);
+		vector<Vector3d> grasp_positions(n_robots, Vector3d::Zero());
+		bool f_first_estimate = true;
+
+		LoopTimer estimator_timer;
+		estimator_timer.initializeTimer();
+		estimator_timer.setLoopFrequency(TRAY_ESTIMATOR_FREQUENCY);
+		double estimator_prev_time = estimator_timer.elapsedTime();
+
+		while(runloop)
+		{
+			estimator_timer.waitForNextLoop();
+			const double estimator_time = estimator_timer.elapsedTime();
+			const double estimator_dt = estimator_time - estimator_prev_time;
+			estimator_prev_time = estimator_time;
+
+			estimator_redis_client.executeReadCallback(0);
+
+			// tray frame between the grasps : y from the first grasp to the second one, z up
+			// (against the axes of the end effectors), and the mean twist of the grasps
+			Vector3d tray_linear_velocity = Vector3d::Zero();
+			Vector3d tray_angular_velocity = Vector3d::Zero();
+			Vector3d tray_z = Vector3d::Zero();
+			Vector3d grasp_force = Vector3d::Zero();
+			Vector3d grasp_moment = Vector3d::Zero();
+			for(int i=0 ; i<n_robots ; i++)
+			{
+				estimator_robots[i]->updateKinematics();
+				Vector3d position, linear_velocity, angular_velocity;
+				Matrix3d rotation;
+				estimator_robots[i]->position(position, link_name, pos_in_link);
+				estimator_robots[i]->rotation(rotation, link_name);
+				estimator_robots[i]->linearVelocity(linear_velocity, link_name, pos_in_link);
+				estimator_robots[i]->angularVelocity(angular_velocity, link_name);
+
+				const Matrix3d R_world_robot = robot_pose_in_world[i].linear();
+				grasp_positions[i] = robot_pose_in_world[i] * position;
+				tray_linear_velocity += R_world_robot * linear_velocity / n_robots;
+				tray_angular_velocity += R_world_robot * angular_velocity / n_robots;
+				tray_z -= R_world_robot * rotation.col(2);
+				grasp_force += grasp_wrenches[i].head<3>();
+				grasp_moment += grasp_wrenches[i].tail<3>();
+			}
+			const Vector3d tray_position = 0.5 * (grasp_positions[0] + grasp_positions[1]);
+			tray_z.normalize();
+			Vector3d tray_y = grasp_positions[1] - grasp_positions[0];
+			tray_y = (tray_y - tray_z.dot(tray_y) * tray_z).normalized();
+			Matrix3d tray_orientation;
+			tray_orientation << tray_y.cross(tray_z), tray_y, tray_z;
+
+			if(f_first_estimate)
+			{
+				tray_estimator.reset(tray_position, tray_orientation);
+				f_first_estimate = false;
+			}
+			else
+			{
+				tray_estimator.predict(estimator_dt, tray_linear_velocity, tray_angular_velocity);
+			}
+			tray_estimator.updatePose(tray_position, tray_orientation);
+			if(tray_grasped)
+			{
+				tray_estimator.updateWrench(grasp_force, grasp_moment);
+			}
+			tray_state_buffer.write(tray_estimator.state());
+		}
+		tray_estimator_wrench_updates = tray_estimator.numWrenchUpdates();
+	};
 
 	// create a timer
 	LoopTimer timer;
 	timer.initializeTimer();
 	timer.setLoopFrequency(1000); 
+	PandaUtils::LoopHealth loop_health(1000);
+	PandaUtils::configureRealtimeThread("controller", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
 	double current_time = 0;
 	double prev_time = 0;
 	double dt = 0;
-	bool fTimerDidSleep = true;
 	double start_time = timer.elapsedTime(); //secs
 
 	runloop = true;
+	thread tray_estimator_thread(tray_estimator_loop);
 	while (runloop) {
 		// wait for next scheduled loop
-		timer.waitForNextLoop();
+		loop_health.waitForNextLoop(timer);
 		current_time = timer.elapsedTime() - start_time;
 		dt = current_time - prev_time;
 
 		// read robot state from redis and update robot model
+		robots_io.read();
 		for(int i=0 ; i<n_robots ; i++)
 		{
-			robots[i]->_q = redis_client.getEigenMatrixJSON(JOINT_ANGLES_KEYS[i]);
-			robots[i]->_dq = redis_client.getEigenMatrixJSON(JOINT_VELOCITIES_KEYS[i]);
-
-			// robots[i]->updateModel();
-			robots[i]->coriolisForce(coriolis[i]);
+			robots[i]->_q = robots_io._q[i];
+			robots[i]->_dq = robots_io._dq[i];
 		}
+		model_update_pool.forEach(n_robots, update_robot_model);
 
 		if(state == PICK_TRAY)
 		{
@@ -238,6 +377,7 @@ int main() {
 				redis_client.set(GRIPPER_DESIRED_FORCE_KEYS[0], to_string(35));
 				redis_client.set(GRIPPER_DESIRED_FORCE_KEYS[1], to_string(35));
 				state = LIFT_TRAY;
+				tray_grasped = true;
 			}
 		}
 
@@ -258,8 +398,33 @@ int main() {
 			// temporary :
 			Vector3d robot1_desired_position_in_world = Vector3d(0.2, -0.15, 0.2);
 			Vector3d robot2_desired_position_in_world = Vector3d(0.2, 0.15, 0.2);
+			Matrix3d grasp_desired_orientation_in_world = AngleAxisd(180.0/180.0*M_PI, Vector3d::UnitX()).toRotationMatrix()*AngleAxisd(45.0/180.0*M_PI, Vector3d::UnitZ()).toRotationMatrix();
+
+			// tilt the tray about its center so that an object on it rolls back to the center,
+			// both arms from the same estimate
+			const PandaUtils::TrayObjectEstimator::State& tray_state = tray_state_buffer.latest();
+			Vector2d tray_tilt = Vector2d::Zero();
+			if(tray_state.step > 0 && tray_state.object_mass > OBJECT_MIN_MASS)
+			{
+				const double kp_balance = 1.0;
+				const double kv_balance = 0.5;
+				const double max_tilt = 5.0/180.0*M_PI;
+				tray_tilt(0) = kp_balance * tray_state.object_position(1) + kv_balance * tray_state.object_velocity(1);
+				tray_tilt(1) = -kp_balance * tray_state.object_position(0) - kv_balance * tray_state.object_velocity(0);
+				tray_tilt = tray_tilt.cwiseMax(-max_tilt).cwiseMin(max_tilt);
+			}
+			const Matrix3d tilt_in_world = tray_state.tray_orientation
+					* (AngleAxisd(tray_tilt(0), Vector3d::UnitX()) * AngleAxisd(tray_tilt(1), Vector3d::UnitY())).toRotationMatrix()
+					* tray_state.tray_orientation.transpose();
+			const Vector3d tray_center = 0.5 * (robot1_desired_position_in_world + robot2_desired_position_in_world);
+			robot1_desired_position_in_world = tray_center + tilt_in_world * (robot1_desired_position_in_world - tray_center);
+			robot2_desired_position_in_world = tray_center + tilt_in_world * (robot2_desired_position_in_world - tray_center);
+			grasp_desired_orientation_in_world = tilt_in_world * grasp_desired_orientation_in_world;
+
 			posori_tasks[0]->_desired_position = robot_pose_in_world[0].linear().transpose()*(robot1_desired_position_in_world - robot_pose_in_world[0].translation());
 			posori_tasks[1]->_desired_position = robot_pose_in_world[1].linear().transpose()*(robot2_desired_position_in_world - robot_pose_in_world[1].translation());
+			posori_tasks[0]->_desired_orientation = robot_pose_in_world[0].linear().transpose()*grasp_desired_orientation_in_world;
+			posori_tasks[1]->_desired_orientation = robot_pose_in_world[1].linear().transpose()*grasp_desired_orientation_in_world;
 			for(int i=0 ; i<n_robots ; i++)
 			{
 				posori_tasks[i]->computeTorques(posori_task_torques[i]);
@@ -279,14 +444,18 @@ int main() {
 		}
 
 		// send to redis
-		for(int i=0 ; i<n_robots ; i++)
+		robots_io.write(command_torques);
+
+		prev_time = current_time;
+
+		if(controller_counter % 1000 == 0)
 		{
-			redis_client.setEigenMatrixJSON(TORQUES_COMMANDED_KEYS[i], command_torques[i]);
+			loop_health.publish(redis_client, LOOP_HEALTH_KEY);
 		}
 
-		prev_time = current_time;
 		controller_counter++;
 	}
+	tray_estimator_thread.join();
 
 	for(int i=0 ; i<n_robots ; i++)
 	{
@@ -294,72 +463,15 @@ int main() {
 		redis_client.setEigenMatrixJSON(TORQUES_COMMANDED_KEYS[i], command_torques[i]);
 	}
 
-	model_update_thread.join();
-
 	double end_time = timer.elapsedTime();
 	std::cout << "\n";
 	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
 	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
     std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+    loop_health.print(std::cout);
+	const PandaUtils::TrayObjectEstimator::State& tray_state = tray_state_buffer.latest();
+	std::cout << "Tray estimator steps      : " << tray_state.step << ", " << tray_estimator_wrench_updates << " with the wrenches\n";
+	std::cout << "Tray object mass          : " << tray_state.object_mass << " kg\n";
 
 	return 0;
 }
-
-void updateModelThread(vector<shared_ptr<Sai2Model::Sai2Model>> robots, 
-		vector<shared_ptr<Sai2Primitives::JointTask>> joint_tasks, 
-		vector<shared_ptr<Sai2Primitives::PosOriTask>> posori_tasks)
-{
-
-	// prepare task controllers
-	vector<int> dof;
-	vector<MatrixXd> N_prec;
-
-	for(int i=0 ; i<n_robots ; i++)
-	{
-		dof.push_back(robots[i]->dof());
-		N_prec.push_back(MatrixXd::Identity(dof[i],dof[i]));
-	}
-
-	// create a timer
-	LoopTimer timer;
-	timer.initializeTimer();
-	timer.setLoopFrequency(200); 
-	double current_time = 0;
-	double prev_time = 0;
-	double dt = 0;
-	bool fTimerDidSleep = true;
-	double start_time = timer.elapsedTime(); //secs
-
-	while(runloop)
-	{
-		timer.waitForNextLoop();
-		for(int i=0 ; i<n_robots ; i++)
-		{
-			robots[i]->updateModel();
-		}
-
-		if(state == PICK_TRAY)
-		{
-			for(int i=0 ; i<n_robots ; i++)
-			{
-				N_prec[i].setIdentity();
-				posori_tasks[i]->updateTaskModel(N_prec[i]);
-
-				N_prec[i] = posori_tasks[i]->_N;
-				joint_tasks[i]->updateTaskModel(N_prec[i]);
-			}
-		}
-
-		else if(state == LIFT_TRAY)
-		{
-			for(int i=0 ; i<n_robots ; i++)
-			{
-				N_prec[i].setIdentity();
-				posori_tasks[i]->updateTaskModel(N_prec[i]);
-
-				N_prec[i] = posori_tasks[i]->_N;
-				joint_tasks[i]->updateTaskModel(N_prec[i]);
-			}
-		}
-	}
-}
@@ -0,0 +1,494 @@
+// This example application drives the two robots of the dual arm tray with one haptic device.
+// The device is read once per cycle by a haptic thread and fanned out to one control thread
+// per robot : the first robot follows the device motion, the second one the same motion
+// mirrored through the xz plane of the world (controller07_haptic --fan-out parallel for the
+// same motion, the two arms then keep the offset of their workspace centers). The operator
+// feels the average of the feedbacks of the two arms.
+
+#include "Sai2Model.h"
+#include "redis/RedisClient.h"
+#include "redis/RedisClientPool.h"
+#include "timer/PrecisionLoopTimer.h"
+#include "timer/LoopHealth.h"
+#include "threads/RealtimeThread.h"
+#include "threads/CycleBarrier.h"
+#include "tasks/JointTask.h"
+#include "tasks/PosOriTask.h"
+#include "haptic_tasks/HapticController.h"
+#include "haptics/HapticFanOut.h"
+#include "net/UdpHapticDevice.h"
+#include "redis/HapticDeviceBundle.h"
+
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <signal.h>
+bool runloop = false;
+void sighandler(int sig)
+{ runloop = false; }
+
+using namespace std;
+using namespace Eigen;
+
+const vector<string> robot_files = {
+	"./resources/panda_arm.urdf",
+	"./resources/panda_arm.urdf",
+};
+const vector<string> robot_names = {
+	"PANDA1",
+	"PANDA2",
+};
+
+// the fan out holds its buffers by value, it needs the number of robots at compile time
+const int n_robots = 2;
+
+// redis keys:
+// - read:
+const vector<string> JOINT_ANGLES_KEYS  = {
+	"sai2::WarehouseSimulation::panda1::sensors::q",
+	"sai2::WarehouseSimulation::panda2::sensors::q",
+};
+const vector<string> JOINT_VELOCITIES_KEYS = {
+	"sai2::WarehouseSimulation::panda1::sensors::dq",
+	"sai2::WarehouseSimulation::panda2::sensors::dq",
+};
+
+// - write
+const vector<string> TORQUES_COMMANDED_KEYS = {
+	"sai2::WarehouseSimulation::panda1::actuators::fgc",
+	"sai2::WarehouseSimulation::panda2::actuators::fgc",
+};
+
+const vector<string> LOOP_HEALTH_KEYS = {
+	"sai2::WarehouseSimulation::panda1::controller::loop_health",
+	"sai2::WarehouseSimulation::panda2::controller::loop_health",
+};
+const string HAPTIC_LOOP_HEALTH_KEY = "sai2::WarehouseSimulation::haptic::controller::loop_health";
+
+//// Haptic device related keys ////
+// Maximum stiffness, damping and force specifications
+const string DEVICE_MAX_STIFFNESS_KEY = "sai2::ChaiHapticDevice::device0::specifications::max_stiffness";
+const string DEVICE_MAX_DAMPING_KEY = "sai2::ChaiHapticDevice::device0::specifications::max_damping";
+const string DEVICE_MAX_FORCE_KEY = "sai2::ChaiHapticDevice::device0::specifications::max_force";
+// Set force and torque feedback of the haptic device
+const string DEVICE_COMMANDED_FORCE_KEY = "sai2::ChaiHapticDevice::device0::actuators::commanded_force";
+const string DEVICE_COMMANDED_TORQUE_KEY = "sai2::ChaiHapticDevice::device0::actuators::commanded_torque";
+const string DEVICE_COMMANDED_GRIPPER_FORCE_KEY = "sai2::ChaiHapticDevice::device0::actuators::commanded_force_gripper";
+// Haptic device current position and rotation
+const string DEVICE_POSITION_KEY = "sai2::ChaiHapticDevice::device0::sensors::current_position";
+const string DEVICE_ROTATION_KEY = "sai2::ChaiHapticDevice::device0::sensors::current_rotation";
+const string DEVICE_GRIPPER_POSITION_KEY = "sai2::ChaiHapticDevice::device0::sensors::current_position_gripper";
+// Haptic device current velocity
+const string DEVICE_TRANS_VELOCITY_KEY = "sai2::ChaiHapticDevice::device0::sensors::current_trans_velocity";
+const string DEVICE_ROT_VELOCITY_KEY = "sai2::ChaiHapticDevice::device0::sensors::current_rot_velocity";
+const string DEVICE_GRIPPER_VELOCITY_KEY = "sai2::ChaiHapticDevice::device0::sensors::current_gripper_velocity";
+const string DEVICE_SENSED_FORCE_KEY = "sai2::ChaiHapticDevice::device0::sensors::sensed_force";
+const string DEVICE_SENSED_TORQUE_KEY = "sai2::ChaiHapticDevice::device0::sensors::sensed_torque";
+
+#define GOTO_INITIAL_CONFIG     0
+#define HAPTIC_CONTROL          1
+
+// cpus of the haptic thread and of the robot threads
+const int haptic_cpu = 1;
+const vector<int> robot_cpus = {2, 3};
+
+int main(int argc, char** argv) {
+
+	// controller07_haptic --fan-out mirror (default) or parallel
+	string fan_out_mode = "mirror";
+	for(int i=1 ; i<argc-1 ; i++)
+	{
+		if(string(argv[i]) == "--fan-out")
+		{
+			fan_out_mode = argv[i+1];
+		}
+	}
+	if(fan_out_mode != "mirror" && fan_out_mode != "parallel")
+	{
+		cout << "usage : controller07_haptic [--fan-out mirror|parallel] [--udp-teleop <local port> <remote host> <remote port>]" << endl;
+		return -1;
+	}
+
+	// position of robots in world
+	vector<Affine3d> robot_pose_in_world;
+	Affine3d pose = Affine3d::Identity();
+	pose.translation() = Vector3d(0, -0.5, 0.0);
+	pose.linear() = AngleAxisd(0.3010693, Vector3d::UnitZ()).toRotationMatrix();
+	robot_pose_in_world.push_back(pose);
+
+	pose.translation() = Vector3d(-0.06, 0.57, 0.0);
+	pose.linear() = AngleAxisd(-1.0864675, Vector3d::UnitZ()).toRotationMatrix();
+	robot_pose_in_world.push_back(pose);
+
+	auto redis_client = RedisClient();
+	redis_client.connect();
+
+	// set up signal handler
+	signal(SIGABRT, &sighandler);
+	signal(SIGTERM, &sighandler);
+	signal(SIGINT, &sighandler);
+
+	// load robots
+	vector<shared_ptr<Sai2Model::Sai2Model>> robots;
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		robots.push_back(make_shared<Sai2Model::Sai2Model>(robot_files[i], false));
+		robots[i]->_q = redis_client.getEigenMatrixJSON(JOINT_ANGLES_KEYS[i]);
+		robots[i]->_dq = redis_client.getEigenMatrixJSON(JOINT_VELOCITIES_KEYS[i]);
+		robots[i]->updateModel();
+	}
+
+	// device specifications
+	Vector2d max_stiffness = redis_client.getEigenMatrixJSON(DEVICE_MAX_STIFFNESS_KEY);
+	Vector2d max_damping = redis_client.getEigenMatrixJSON(DEVICE_MAX_DAMPING_KEY);
+	Vector2d max_force = redis_client.getEigenMatrixJSON(DEVICE_MAX_FORCE_KEY);
+
+	// prepare task controllers
+	vector<int> dof;
+	vector<VectorXd> command_torques;
+	vector<VectorXd> coriolis;
+	vector<MatrixXd> N_prec;
+
+	vector<shared_ptr<Sai2Primitives::JointTask>> joint_tasks;
+	vector<VectorXd> joint_task_torques;
+	vector<shared_ptr<Sai2Primitives::PosOriTask>> posori_tasks;
+	vector<VectorXd> posori_task_torques;
+	vector<shared_ptr<Sai2Primitives::HapticController>> teleop_tasks;
+
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		dof.push_back(robots[i]->dof());
+		command_torques.push_back(VectorXd::Zero(dof[i]));
+		coriolis.push_back(VectorXd::Zero(dof[i]));
+		N_prec.push_back(MatrixXd::Identity(dof[i],dof[i]));
+
+		// joint tasks, hold the initial configuration until the haptic control starts
+		joint_tasks.push_back(make_shared<Sai2Primitives::JointTask>(robots[i].get()));
+		joint_task_torques.push_back(VectorXd::Zero(dof[i]));
+
+		joint_tasks[i]->_kp = 50.0;
+		joint_tasks[i]->_kv = 14.0;
+		joint_tasks[i]->_desired_position = robots[i]->_q;
+
+		// end effector tasks
+		string link_name = "link7";
+		Eigen::Vector3d pos_in_link = Vector3d(0.0,0.0,0.2);
+		posori_tasks.push_back(make_shared<Sai2Primitives::PosOriTask>(robots[i].get(), link_name, pos_in_link));
+		posori_task_torques.push_back(VectorXd::Zero(dof[i]));
+
+		posori_tasks[i]->_kp_pos = 200.0;
+		posori_tasks[i]->_kv_pos = 25.0;
+		posori_tasks[i]->_kp_ori = 400.0;
+		posori_tasks[i]->_kv_ori = 40.0;
+
+		posori_tasks[i]->_use_velocity_saturation_flag = true;
+		posori_tasks[i]->_linear_saturation_velocity = 0.3;
+		posori_tasks[i]->_angular_saturation_velocity = M_PI/3.0;
+
+		// haptic task of the robot, on the device state mapped by the fan out. the device
+		// frame is the world frame
+		teleop_tasks.push_back(make_shared<Sai2Primitives::HapticController>(posori_tasks[i]->_current_position,
+				posori_tasks[i]->_current_orientation, robot_pose_in_world[i].linear()));
+		teleop_tasks[i]->setScalingFactors(2.0, 1.0);
+		teleop_tasks[i]->_max_linear_stiffness_device = max_stiffness(0);
+		teleop_tasks[i]->_max_angular_stiffness_device = max_stiffness(1);
+		teleop_tasks[i]->_max_linear_damping_device = max_damping(0);
+		teleop_tasks[i]->_max_angular_damping_device = max_damping(1);
+		teleop_tasks[i]->_max_force_device = max_force(0);
+		teleop_tasks[i]->_max_torque_device = max_force(1);
+
+		// no force sensors on these arms : the feedback is the tracking force of the posori
+		// task, from updateSensedForce() in the control loop
+		teleop_tasks[i]->_send_haptic_feedback = true;
+		teleop_tasks[i]->_haptic_feedback_from_proxy = false;
+		teleop_tasks[i]->_filter_on = true;
+		teleop_tasks[i]->setFilterCutOffFreq(0.04, 0.04);
+		teleop_tasks[i]->setReductionFactorForceFeedback(0.7 * Matrix3d::Identity(), 1.0/20.0 * Matrix3d::Identity());
+	}
+
+	// the second robot mirrored through the xz plane of the world, between the two arms
+	vector<PandaUtils::FanOutCoupling> couplings;
+	couplings.push_back(PandaUtils::FanOutCoupling::direct());
+	if(fan_out_mode == "mirror")
+	{
+		couplings.push_back(PandaUtils::FanOutCoupling::mirrored(Vector3d::UnitY()));
+	}
+	else
+	{
+		couplings.push_back(PandaUtils::FanOutCoupling::direct());
+	}
+	// average of the two feedbacks, so that the homing of the device is not twice as stiff
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		couplings[i].feedback_weight = 1.0 / n_robots;
+	}
+	// a robot thread 20 ms behind the device is left out of the feedback
+	PandaUtils::HapticFanOut<n_robots> fan_out(couplings, 20);
+
+	// haptic device from a remote haptic station (controller07_haptic --udp-teleop 9900 station
+	// 9901), or from the binary records of haptic_bundle_bridge, or from the device keys. read
+	// and commanded by the haptic thread only
+	PandaUtils::UdpTeleopConfig udp_config = PandaUtils::UdpTeleopConfig::fromArgs(argc, argv);
+	PandaUtils::HapticDeviceChannel* device_channel = NULL;
+	const bool f_device_bundle = !udp_config.enabled() && PandaUtils::RedisHapticDevice::available(redis_client, 0);
+	if(udp_config.enabled())
+	{
+		device_channel = new PandaUtils::UdpHapticDevice(udp_config.forDevice(0));
+	}
+
+	// one thread for the device and one per robot, each with its own redis connection and cpu.
+	// the timers of the threads start on the time of the start barrier and share their deadlines
+	PandaUtils::RedisClientPool redis_pool;
+	PandaUtils::CycleBarrier start_barrier(n_robots + 1);
+
+	PandaUtils::LoopHealth haptic_loop_health(1000);
+	vector<PandaUtils::LoopHealth*> robot_loop_health;
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		robot_loop_health.push_back(new PandaUtils::LoopHealth(1000));
+	}
+	vector<unsigned long long> robot_counters(n_robots, 0);
+	unsigned long long haptic_counter = 0;
+	double haptic_run_time = 0;
+
+	runloop = true;
+
+	auto haptic_loop = [&]()
+	{
+		PandaUtils::configureRealtimeThread("haptic", PandaUtils::RealtimeConfig::fifo(85, {haptic_cpu}));
+		RedisClient& redis_client = redis_pool.client();
+		if(f_device_bundle)
+		{
+			device_channel = new PandaUtils::RedisHapticDevice(redis_client, 0);
+		}
+
+		PandaUtils::TeleopPacket device_state;
+		Vector3d device_position = Vector3d::Zero();
+		Matrix3d device_rotation = Matrix3d::Identity();
+		Vector3d device_velocity = Vector3d::Zero();
+		Vector3d device_angular_velocity = Vector3d::Zero();
+		Vector3d device_sensed_force = Vector3d::Zero();
+		Vector3d device_sensed_torque = Vector3d::Zero();
+		double device_gripper_position = 0;
+		double device_gripper_velocity = 0;
+
+		Vector3d command_force = Vector3d::Zero();
+		Vector3d command_torque = Vector3d::Zero();
+		double command_gripper_force = 0;
+
+		if(device_channel == NULL)
+		{
+			redis_client.createReadCallback(0);
+			redis_client.addEigenToReadCallback(0, DEVICE_POSITION_KEY, device_position);
+			redis_client.addEigenToReadCallback(0, DEVICE_ROTATION_KEY, device_rotation);
+			redis_client.addEigenToReadCallback(0, DEVICE_TRANS_VELOCITY_KEY, device_velocity);
+			redis_client.addEigenToReadCallback(0, DEVICE_ROT_VELOCITY_KEY, device_angular_velocity);
+			redis_client.addEigenToReadCallback(0, DEVICE_SENSED_FORCE_KEY, device_sensed_force);
+			redis_client.addEigenToReadCallback(0, DEVICE_SENSED_TORQUE_KEY, device_sensed_torque);
+			redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_POSITION_KEY, device_gripper_position);
+			redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_VELOCITY_KEY, device_gripper_velocity);
+
+			redis_client.createWriteCallback(0);
+			redis_client.addEigenToWriteCallback(0, DEVICE_COMMANDED_FORCE_KEY, command_force);
+			redis_client.addEigenToWriteCallback(0, DEVICE_COMMANDED_TORQUE_KEY, command_torque);
+			redis_client.addDoubleToWriteCallback(0, DEVICE_COMMANDED_GRIPPER_FORCE_KEY, command_gripper_force);
+		}
+
+		// create a timer, that spins the last 100 us before the deadlines of the haptic loop
+		PandaUtils::PrecisionLoopTimer timer(100e-6);
+		timer.setLoopFrequency(1000);
+		timer.initializeTimer(start_barrier.wait());
+		double current_time = 0;
+		double start_time = timer.elapsedTime(); //secs
+
+		while (runloop) {
+			// wait for next scheduled loop
+			haptic_loop_health.waitForNextLoop(timer);
+			current_time = timer.elapsedTime() - start_time;
+
+			// read the device once and publish its state to all the robots
+			if(device_channel != NULL)
+			{
+				if(!device_channel->receive(device_state) && device_channel->timedOut())
+				{
+					// no damping on a stale velocity
+					Map<Vector3d>(device_state.velocity).setZero();
+					Map<Vector3d>(device_state.angular_velocity).setZero();
+					device_state.gripper_velocity = 0;
+				}
+			}
+			else
+			{
+				redis_client.executeReadCallback(0);
+				Map<Vector3d>(device_state.position) = device_position;
+				Map<Matrix3d>(device_state.rotation) = device_rotation;
+				Map<Vector3d>(device_state.velocity) = device_velocity;
+				Map<Vector3d>(device_state.angular_velocity) = device_angular_velocity;
+				Map<Vector3d>(device_state.force) = device_sensed_force;
+				Map<Vector3d>(device_state.torque) = device_sensed_torque;
+				device_state.gripper_position = device_gripper_position;
+				device_state.gripper_velocity = device_gripper_velocity;
+			}
+			fan_out.publishState(device_state);
+
+			// feedback of the robots
+			fan_out.aggregateFeedback(max_force(0), max_force(1), command_force, command_torque, command_gripper_force);
+			if(device_channel != NULL)
+			{
+				device_channel->sendCommands(command_force, command_torque, command_gripper_force, current_time);
+			}
+			else
+			{
+				redis_client.executeWriteCallback(0);
+			}
+
+			if(haptic_counter % 1000 == 0)
+			{
+				haptic_loop_health.publish(redis_client, HAPTIC_LOOP_HEALTH_KEY);
+			}
+
+			haptic_counter++;
+		}
+
+		if(device_channel != NULL)
+		{
+			device_channel->sendCommands(Vector3d::Zero(), Vector3d::Zero(), 0, current_time);
+		}
+		else
+		{
+			redis_client.setEigenMatrixJSON(DEVICE_COMMANDED_FORCE_KEY, Vector3d::Zero());
+			redis_client.setEigenMatrixJSON(DEVICE_COMMANDED_TORQUE_KEY, Vector3d::Zero());
+			redis_client.set(DEVICE_COMMANDED_GRIPPER_FORCE_KEY, "0.0");
+		}
+		haptic_run_time = timer.elapsedTime() - start_time;
+	};
+
+	auto robot_loop = [&](const int i)
+	{
+		PandaUtils::configureRealtimeThread(robot_names[i], PandaUtils::RealtimeConfig::fifo(80, {robot_cpus[i]}));
+		RedisClient& redis_client = redis_pool.client();
+
+		redis_client.createReadCallback(0);
+		redis_client.createWriteCallback(0);
+		redis_client.addEigenToReadCallback(0, JOINT_ANGLES_KEYS[i], robots[i]->_q);
+		redis_client.addEigenToReadCallback(0, JOINT_VELOCITIES_KEYS[i], robots[i]->_dq);
+		redis_client.addEigenToWriteCallback(0, TORQUES_COMMANDED_KEYS[i], command_torques[i]);
+
+		int state = GOTO_INITIAL_CONFIG;
+		VectorXd tracking_force = VectorXd::Zero(6);
+
+		unsigned long long& controller_counter = robot_counters[i];
+		PandaUtils::PrecisionLoopTimer timer(100e-6);
+		timer.setLoopFrequency(1000);
+		timer.initializeTimer(start_barrier.wait());
+
+		while (runloop) {
+			// wait for next scheduled loop
+			robot_loop_health[i]->waitForNextLoop(timer);
+
+			// read robot state from redis and update robot model
+			redis_client.executeReadCallback(0);
+			robots[i]->updateModel();
+			robots[i]->coriolisForce(coriolis[i]);
+
+			// newest device state, mapped for this robot
+			fan_out.readDevice(i, *teleop_tasks[i]);
+			teleop_tasks[i]->UseGripperAsSwitch();
+
+			if(state == GOTO_INITIAL_CONFIG)
+			{
+				N_prec[i].setIdentity();
+				joint_tasks[i]->updateTaskModel(N_prec[i]);
+				joint_tasks[i]->computeTorques(joint_task_torques[i]);
+				command_torques[i] = joint_task_torques[i] + coriolis[i];
+
+				// compute homing haptic device
+				teleop_tasks[i]->HomingTask();
+
+				// both threads see the same device and gripper, each robot switches on its next cycle
+				if(teleop_tasks[i]->device_homed && teleop_tasks[i]->gripper_state)
+				{
+					posori_tasks[i]->reInitializeTask();
+					teleop_tasks[i]->setRobotCenter(posori_tasks[i]->_current_position, posori_tasks[i]->_current_orientation);
+					teleop_tasks[i]->setDeviceCenter(teleop_tasks[i]->_current_position_device, teleop_tasks[i]->_current_rotation_device);
+					state = HAPTIC_CONTROL;
+				}
+			}
+
+			else if(state == HAPTIC_CONTROL)
+			{
+				// update tasks model
+				N_prec[i].setIdentity();
+				posori_tasks[i]->updateTaskModel(N_prec[i]);
+				N_prec[i] = posori_tasks[i]->_N;
+				joint_tasks[i]->updateTaskModel(N_prec[i]);
+
+				// force that holds the arm back from its goal, in place of a sensed force
+				tracking_force.head(3) = posori_tasks[i]->_kp_pos * (posori_tasks[i]->_current_position - posori_tasks[i]->_desired_position);
+				teleop_tasks[i]->updateSensedForce(tracking_force);
+
+				// compute haptic commands and robot goal
+				teleop_tasks[i]->computeHapticCommands3d(posori_tasks[i]->_desired_position);
+
+				posori_tasks[i]->computeTorques(posori_task_torques[i]);
+				joint_tasks[i]->computeTorques(joint_task_torques[i]);
+				command_torques[i] = posori_task_torques[i] + joint_task_torques[i] + coriolis[i];
+			}
+
+			// send to redis, and the feedback to the haptic thread
+			redis_client.executeWriteCallback(0);
+			fan_out.sendFeedback(i, teleop_tasks[i]->_commanded_force_device, teleop_tasks[i]->_commanded_torque_device,
+					teleop_tasks[i]->_commanded_gripper_force_device);
+
+			if(controller_counter % 1000 == 0)
+			{
+				robot_loop_health[i]->publish(redis_client, LOOP_HEALTH_KEYS[i]);
+			}
+
+			controller_counter++;
+		}
+
+		command_torques[i].setZero();
+		redis_client.setEigenMatrixJSON(TORQUES_COMMANDED_KEYS[i], command_torques[i]);
+	};
+
+	thread haptic_thread(haptic_loop);
+	vector<thread> robot_threads;
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		robot_threads.push_back(thread(robot_loop, i));
+	}
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		robot_threads[i].join();
+	}
+	haptic_thread.join();
+
+	if(device_channel != NULL)
+	{
+		cout << "haptic device channel : " << device_channel->summary() << endl;
+		delete device_channel;
+	}
+	cout << "haptic fan out : " << fan_out.summary() << endl;
+
+	std::cout << "\n";
+	std::cout << "Controller Loop run time  : " << haptic_run_time << " seconds\n";
+	std::cout << "Haptic Loop updates       : " << haptic_counter << "\n";
+	std::cout << "Haptic Loop frequency     : " << haptic_counter/haptic_run_time << "Hz\n";
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		std::cout << robot_names[i] << " Loop updates    : " << robot_counters[i] << "\n";
+		std::cout << robot_names[i] << " Loop frequency  : " << robot_counters[i]/haptic_run_time << "Hz\n";
+	}
+	std::cout << "haptic loop :\n";
+	haptic_loop_health.print(std::cout);
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		std::cout << robot_names[i] << " loop :\n";
+		robot_loop_health[i]->print(std::cout);
+		delete robot_loop_health[i];
+	}
+
+	return 0;
+}
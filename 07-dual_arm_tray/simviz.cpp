@@ -8,6 +8,7 @@
 #include <dynamics3d.h>
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
+#include "threads/RealtimeThread.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
 
@@ -49,6 +50,11 @@ const vector<string> JOINT_VELOCITIES_KEYS = {
 	"sai2::WarehouseSimulation::panda1::sensors::dq",
 	"sai2::WarehouseSimulation::panda2::sensors::dq",
 };
+// contact force of the tray on the fingers and its moment about the world origin, world frame
+const vector<string> GRASP_WRENCH_KEYS = {
+	"sai2::WarehouseSimulation::panda1::sensors::grasp_wrench",
+	"sai2::WarehouseSimulation::panda2::sensors::grasp_wrench",
+};
 
 // - read
 const vector<string> TORQUES_COMMANDED_KEYS = {
@@ -306,6 +312,7 @@ void simulation(vector<Sai2Model::Sai2Model*> robots, Simulation::Sai2Simulation
 		redis_client.set(GRIPPER_DESIRED_SPEED_KEYS[i], to_string(0));
 		redis_client.set(GRIPPER_DESIRED_FORCE_KEYS[i], to_string(0));
 		redis_client.set(GRIPPER_MODE_KEYS[i], "m");
+		redis_client.setEigenMatrixJSON(GRASP_WRENCH_KEYS[i], VectorXd::Zero(6));
 	}
 
 	// create a timer
@@ -317,8 +324,16 @@ void simulation(vector<Sai2Model::Sai2Model*> robots, Simulation::Sai2Simulation
 	double start_time = timer.elapsedTime(); //secs
 	double last_time = start_time;
 
+	// contacts of the fingers, for the grasp wrenches
+	const vector<string> finger_names = {"leftfinger", "rightfinger"};
+	vector<Vector3d> contact_points;
+	vector<Vector3d> contact_forces;
+	VectorXd grasp_wrench = VectorXd::Zero(6);
+
 	unsigned long long simulation_counter = 0;
 
+	PandaUtils::configureRealtimeThread("simulation", PandaUtils::RealtimeConfig::fifo(70, PandaUtils::simulationCpus()));
+
 	while (fSimulationRunning) {
 		fTimerDidSleep = timer.waitForNextLoop();
 
@@ -371,6 +386,22 @@ void simulation(vector<Sai2Model::Sai2Model*> robots, Simulation::Sai2Simulation
 		}
 		redis_client.set(TIMESTAMP_KEY, to_string(curr_time));
 
+		// write the grasp wrenches, at the rate of the simulation
+		for(int i=0 ; i<n_robots ; i++)
+		{
+			grasp_wrench.setZero();
+			for(unsigned int k=0 ; k<finger_names.size() ; k++)
+			{
+				sim->getContactList(contact_points, contact_forces, robot_names[i], finger_names[k]);
+				for(unsigned int j=0 ; j<contact_points.size() ; j++)
+				{
+					grasp_wrench.head<3>() += contact_forces[j];
+					grasp_wrench.tail<3>() += contact_points[j].cross(contact_forces[j]);
+				}
+			}
+			redis_client.setEigenMatrixJSON(GRASP_WRENCH_KEYS[i], grasp_wrench);
+		}
+
 		//update last time
 		last_time = curr_time;
 
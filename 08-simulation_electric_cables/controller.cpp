@@ -4,7 +4,7 @@
 
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
-#include "timer/LoopTimer.h"
+#include "sim/SimClock.h"
 #include "Sai2Primitives.h"
 
 #include <iostream>
@@ -60,7 +60,10 @@ void updateModelThreadRun(sf::safe_ptr<Sai2Model::Sai2Model> robot,
 		sf::safe_ptr<Sai2Primitives::PosOriTask> left_hand_posori_task,
 		sf::safe_ptr<Sai2Primitives::PosOriTask> right_hand_posori_task);
 
-int main() {
+// sim seconds per wall second, of the control loop and of the model update thread
+double time_scale = 1.0;
+
+int main(int argc, char** argv) {
 
 	// start redis client
 	auto redis_client = RedisClient();
@@ -230,21 +233,18 @@ int main() {
 
 	// redis_client.set(STATE_CHANGE_KEY, to_string(0));
 
+	// controller --time-scale 10, at the time scale of the simviz
+	time_scale = PandaUtils::SimClock::timeScale(argc, argv, 1.0, false);
+
 	// start model update thread
 	thread model_update_thread(updateModelThreadRun, robot, joint_task, left_hand_posori_task, right_hand_posori_task);
 
-	// create a timer
-	LoopTimer timer;
-	timer.initializeTimer();
-	timer.setLoopFrequency(1000); 
-	double start_time = timer.elapsedTime(); //secs
-	bool fTimerDidSleep = true;
+	// 1 kHz of sim time
+	PandaUtils::SimClock clock(time_scale);
 
-	while (runloop) 
+	while (runloop && clock.waitForNextStep(0.001)) 
 	{
-		// wait for next scheduled loop
-		timer.waitForNextLoop();
-		double time = timer.elapsedTime() - start_time;
+		double time = clock.time();
 
 		// read robot state from redis
 		robot->_q = redis_client.getEigenMatrixJSON(JOINT_ANGLES_KEY);
@@ -368,11 +368,11 @@ int main() {
 
 	model_update_thread.join();
 
-	double end_time = timer.elapsedTime();
+	double end_time = clock.time();
 	std::cout << "\n";
-	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
-	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
-    std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+	std::cout << "Controller Loop run time  : " << end_time << " seconds of sim time\n";
+	std::cout << "Controller Loop updates   : " << controller_counter << "\n";
+    std::cout << "Controller Loop frequency : " << controller_counter/end_time << "Hz of sim time\n";
 
 
 	return 0;
@@ -387,16 +387,11 @@ void updateModelThreadRun(sf::safe_ptr<Sai2Model::Sai2Model> robot,
 	int dof = robot->dof();
 	MatrixXd N_prec = MatrixXd::Identity(dof, dof);
 
-	// create a timer
-	LoopTimer timer;
-	timer.initializeTimer();
-	timer.setLoopFrequency(1000); 
-	double start_time = timer.elapsedTime(); //secs
-	bool fTimerDidSleep = true;	
+	// 1 kHz of sim time, like the control loop
+	PandaUtils::SimClock clock(time_scale);
 
-	while(runloop)
+	while(runloop && clock.waitForNextStep(0.001))
 	{
-		timer.waitForNextLoop();
 
 		robot->updateModel();
 
@@ -6,6 +6,7 @@
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
 #include "Sai2Primitives.h"
+#include "model/BlockDiagonalModel.h"
 
 #include <iostream>
 #include <string>
@@ -20,6 +21,9 @@ using namespace Eigen;
 
 const string robot_file = "./resources/two_arm_panda.urdf";
 
+// task models of the two arms by blocks of the mass matrix (see model/BlockDiagonalModel.h)
+const bool use_block_diagonal_model = true;
+
 #define GOTO_GRASP                    0
 #define HAPTIC_CONTROL_1              1
 #define GO_UP                         2
@@ -57,6 +61,13 @@ void updateModelThreadRun(shared_ptr<Sai2Model::Sai2Model> robot,
 		shared_ptr<Sai2Primitives::PosOriTask> left_hand_posori_task,
 		shared_ptr<Sai2Primitives::PosOriTask> right_hand_posori_task);
 
+// updates the posori task models of the two arms, left first, and sets N_prec to the nullspace of the two
+void updateArmTaskModels(PandaUtils::BlockDiagonalModel& block_model,
+		shared_ptr<Sai2Model::Sai2Model> robot,
+		shared_ptr<Sai2Primitives::PosOriTask> left_hand_posori_task,
+		shared_ptr<Sai2Primitives::PosOriTask> right_hand_posori_task,
+		MatrixXd& N_prec);
+
 int main() {
 
 	// start redis client
@@ -394,6 +405,14 @@ void updateModelThreadRun(shared_ptr<Sai2Model::Sai2Model> robot,
 	int dof = robot->dof();
 	MatrixXd N_prec = MatrixXd::Identity(dof, dof);
 
+	// the arms only share the trunk joint, the model was updated at the initial configuration
+	PandaUtils::BlockDiagonalModel block_model(dof);
+	if(use_block_diagonal_model)
+	{
+		block_model.detect(robot->_M);
+		cout << "block diagonal model : " << block_model.summary() << endl;
+	}
+
 	// create a timer
 	LoopTimer timer;
 	timer.initializeTimer();
@@ -407,23 +426,21 @@ void updateModelThreadRun(shared_ptr<Sai2Model::Sai2Model> robot,
 		timer.waitForNextLoop();
 
 		robot->updateModel();
+		if(use_block_diagonal_model)
+		{
+			block_model.compute(robot->_M);
+		}
 
 		if(state == GOTO_GRASP)
 		{
 			N_prec.setIdentity();
-			left_hand_posori_task->updateTaskModel(N_prec);
-			N_prec = left_hand_posori_task->_N;
-			right_hand_posori_task->updateTaskModel(N_prec);
-			N_prec = right_hand_posori_task->_N;
+			updateArmTaskModels(block_model, robot, left_hand_posori_task, right_hand_posori_task, N_prec);
 			joint_task->updateTaskModel(N_prec);
 		}
 		else if(state == HAPTIC_CONTROL_1)
 		{
 			N_prec.setIdentity();
-			left_hand_posori_task->updateTaskModel(N_prec);
-			N_prec = left_hand_posori_task->_N;
-			right_hand_posori_task->updateTaskModel(N_prec);
-			N_prec = right_hand_posori_task->_N;
+			updateArmTaskModels(block_model, robot, left_hand_posori_task, right_hand_posori_task, N_prec);
 			joint_task->updateTaskModel(N_prec);
 		}
 		else if(state == GO_UP)
@@ -434,12 +451,35 @@ void updateModelThreadRun(shared_ptr<Sai2Model::Sai2Model> robot,
 		else if(state == HAPTIC_CONTROL_2)
 		{
 			N_prec.setIdentity();
-			left_hand_posori_task->updateTaskModel(N_prec);
-			N_prec = left_hand_posori_task->_N;
-			right_hand_posori_task->updateTaskModel(N_prec);
-			N_prec = right_hand_posori_task->_N;
+			updateArmTaskModels(block_model, robot, left_hand_posori_task, right_hand_posori_task, N_prec);
 			joint_task->updateTaskModel(N_prec);
 		}
 	}
 
+	if(use_block_diagonal_model)
+	{
+		cout << "block diagonal model updates : " << block_model.blockUpdates() << ", coupled : " << block_model.fullUpdates() << endl;
+	}
+}
+
+void updateArmTaskModels(PandaUtils::BlockDiagonalModel& block_model,
+		shared_ptr<Sai2Model::Sai2Model> robot,
+		shared_ptr<Sai2Primitives::PosOriTask> left_hand_posori_task,
+		shared_ptr<Sai2Primitives::PosOriTask> right_hand_posori_task,
+		MatrixXd& N_prec)
+{
+	if(use_block_diagonal_model)
+	{
+		block_model.updateTaskModel(robot.get(), left_hand_posori_task.get(), N_prec);
+		N_prec = left_hand_posori_task->_N;
+		block_model.updateTaskModel(robot.get(), right_hand_posori_task.get(), N_prec);
+		N_prec = right_hand_posori_task->_N;
+	}
+	else
+	{
+		left_hand_posori_task->updateTaskModel(N_prec);
+		N_prec = left_hand_posori_task->_N;
+		right_hand_posori_task->updateTaskModel(N_prec);
+		N_prec = right_hand_posori_task->_N;
+	}
 }
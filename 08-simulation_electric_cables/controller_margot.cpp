@@ -8,6 +8,7 @@
 #include "tasks/JointTask.h"
 #include "tasks/PosOriTask.h"
 #include "haptic_tasks/OpenLoopTeleop.h"
+#include "model/MassMatrixInverse.h"
 
 #include <iostream>
 #include <string>
@@ -146,6 +147,7 @@ int main() {
 
 	// prepare robot task controllers
 	vector<int> dof;
+	vector<PandaUtils::MassMatrixInverse<7>*> mass_matrix_inverses;
 	vector<VectorXd> command_torques;
 	vector<VectorXd> coriolis;
 	vector<MatrixXd> N_prec;
@@ -167,6 +169,7 @@ int main() {
 	for(int i=0 ; i<n_robots ; i++)
 	{
 		dof.push_back(robots[i]->dof());
+		mass_matrix_inverses.push_back(new PandaUtils::MassMatrixInverse<7>(dof[i], inertia_regularization ? 0.07 : 0.0));
 		command_torques.push_back(VectorXd::Zero(dof[i]));
 		coriolis.push_back(VectorXd::Zero(dof[i]));
 		N_prec.push_back(MatrixXd::Identity(dof[i],dof[i]));
@@ -302,13 +305,7 @@ int main() {
 			{
 				robots[i]->updateKinematics();
 				robots[i]->_M = redis_client.getEigenMatrixJSON(MASSMATRIX_KEYS[i]);
-				if(inertia_regularization)
-				{
-					robots[i]->_M(4,4) += 0.07;
-					robots[i]->_M(5,5) += 0.07;
-					robots[i]->_M(6,6) += 0.07;
-				}
-				robots[i]->_M_inv = robots[i]->_M.inverse();
+				mass_matrix_inverses[i]->update(robots[i]);
 
 				coriolis[i] = redis_client.getEigenMatrixJSON(CORIOLIS_KEYS[i]);
 			}
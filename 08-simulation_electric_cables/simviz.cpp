@@ -8,7 +8,15 @@
 #include "Sai2Primitives.h"
 #include <dynamics3d.h>
 #include "redis/RedisClient.h"
-#include "timer/LoopTimer.h"
+#include "redis/RedisParameterCache.h"
+#include "sim/HeadlessSimviz.h"
+#include "sim/SimClock.h"
+#include "sim/RenderStateBuffer.h"
+#include "sim/CableSimulation.h"
+#include "sim/GripperSimulation.h"
+#include "model/UrdfCache.h"
+#include "threads/StartupTasks.h"
+#include "threads/RealtimeThread.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
 
@@ -22,17 +30,40 @@ void sighandler(int){fSimulationRunning = false;}
 using namespace std;
 using namespace Eigen;
 
-const string world_file = "./resources/world.urdf";
+// simulate the cable as a chain of particles (sim/CableSimulation.h) grasped by the left
+// gripper, instead of the rigid lone_cable object moved with the left hand
+const bool flag_discrete_cable = true;
+
+const string world_file = flag_discrete_cable ? "./resources/world_discrete_cable.urdf" : "./resources/world.urdf";
 const string robot_file = "./resources/panda_no_truck.urdf";
 const string robot_name = "TWO_ARM_PANDA";
 const string camera_name = "camera_fixed";
 
-const vector<string> object_names = {
+const vector<string> object_names = flag_discrete_cable ? vector<string>() : vector<string>{
 	"lone_cable",
 };
 const int n_objects = object_names.size();
 vector<Vector3d> object_positions;
 vector<Quaterniond> object_orientations;
+
+// state of the last simulation step, for the rendering loop
+PandaUtils::RenderStateBuffer* render_state;
+
+// discrete cable, hanging from the plug at the top of the rigid cable
+PandaUtils::CableSimulation* cable = NULL;
+const Vector3d cable_plug_position = Vector3d(1.28, 0.338, 8.476);
+const Vector3d cable_free_end_position = Vector3d(1.28, 1.0, 7.914);
+const double cable_length = 1.3;
+// the cable is grasped by the left fingers when it is closer than the grasp distance
+const string cable_grasp_link = "left_arm_link7";
+const Vector3d cable_grasp_pos_in_link = Vector3d(0, 0, 0.2);
+const double cable_grasp_distance = 0.05;
+// spheres around the arm links, for the collisions of the cable with the robot
+const vector<string> cable_collision_links = {
+	"left_arm_link4", "left_arm_link5", "left_arm_link6", "left_arm_link7",
+	"right_arm_link4", "right_arm_link5", "right_arm_link6", "right_arm_link7",
+};
+const double cable_collision_link_radius = 0.07;
 // redis keys:
 // - write:
 const string TIMESTAMP_KEY = "sai2::PandaApplication::simulation::timestamp";
@@ -61,18 +92,11 @@ string gripper_mode = "m";
 
 // simulation function prototype
 const double sim_frequency = 1000.0;
+// sim seconds per wall second
+double time_scale = 1.0;
 void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim);
 // void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim);
 
-Vector2d grippersControl(Sai2Model::Sai2Model* robot, 
-		const int joint_index_1, 
-		const int joint_index_2, 
-		const string mode_redis_key,
-		const string current_width_redis_key,
-		const string desired_width_redis_key,
-		const string desired_speed_redis_key,
-		const string desired_force_redis_key);
-
 // callback to print glfw errors
 void glfwError(int error, const char* description);
 
@@ -92,33 +116,61 @@ bool fTransZn = false;
 bool fshowCameraPose = false;
 bool fRotPanTilt = false;
 
-int main() {
+int main(int argc, char** argv) {
 	cout << "Loading URDF world model file: " << world_file << endl;
+	// the world file with decimated visual meshes, built at the first launch
+	const string loaded_world_file = PandaUtils::cachedWorldFile(world_file);
 
-	// start redis client
-	redis_client = new RedisClient();
-	redis_client->connect();
+	// simviz --headless to run the simulation without window, see sim/HeadlessSimviz.h
+	PandaUtils::SimvizMode simviz_mode(argc, argv);
+	// simviz --time-scale 10 to simulate 10 times faster than real time, with the controller at the same scale
+	time_scale = PandaUtils::SimClock::timeScale(argc, argv, 1.0, false);
 
-	// load graphics scene
-	auto graphics = new Sai2Graphics::Sai2Graphics(world_file, false);
+	// redis, graphics meshes, robot models and simulation world are independent, loaded in parallel
+	Affine3d T_world_robot = Affine3d::Identity();
+	T_world_robot.translation() << 1.3, -0.3, 7;
+	T_world_robot.linear() = AngleAxisd(M_PI, Vector3d::UnitZ()).toRotationMatrix();
+	PandaUtils::StartupTasks startup;
+	auto redis_connected = startup.run("redis connect", []()
+	{
+		redis_client = new RedisClient();
+		redis_client->connect();
+	});
+	auto graphics_loaded = startup.run("graphics meshes", [loaded_world_file]()
+	{
+		return new Sai2Graphics::Sai2Graphics(loaded_world_file, false);
+	});
+	auto robot_parsed = startup.run("robot model", [&T_world_robot]()
+	{
+		auto robot = new Sai2Model::Sai2Model(robot_file, false, T_world_robot);
+		robot->updateKinematics();
+		return robot;
+	});
+	// the rendering loop has its own model
+	auto render_robot_parsed = startup.run("render robot model", [&T_world_robot]()
+	{
+		return new Sai2Model::Sai2Model(robot_file, false, T_world_robot);
+	});
+	auto sim_built = startup.run("simulation world", [loaded_world_file]()
+	{
+		auto sim = new Simulation::Sai2Simulation(loaded_world_file, false);
+		sim->setCollisionRestitution(0);
+		sim->setCoeffFrictionStatic(15.0);
+		return sim;
+	});
+
+	redis_connected.get();
+	auto graphics = graphics_loaded.get();
 	Eigen::Vector3d camera_pos, camera_lookat, camera_vertical;
 	graphics->getCameraPose(camera_name, camera_pos, camera_vertical, camera_lookat);
 	graphics->_world->setBackgroundColor(160.0/255.0, 187.0/255.0, 232.0/255.0);
 	// graphics->_world->setUseCulling(true,true);
 	graphics->getCamera(camera_name)->setClippingPlanes(0.01, 50.0);
 	// graphics->getCamera(camera_name)->setUseMultipassTransparency(true);
-
-	// load robots
-	Affine3d T_world_robot = Affine3d::Identity();
-	T_world_robot.translation() << 1.3, -0.3, 7;
-	T_world_robot.linear() = AngleAxisd(M_PI, Vector3d::UnitZ()).toRotationMatrix();
-	auto robot = new Sai2Model::Sai2Model(robot_file, false, T_world_robot);
-	robot->updateKinematics();
-
-	// load simulation world
-	auto sim = new Simulation::Sai2Simulation(world_file, false);
-	sim->setCollisionRestitution(0);
-	sim->setCoeffFrictionStatic(15.0);
+	auto robot = robot_parsed.get();
+	auto render_robot = render_robot_parsed.get();
+	auto sim = sim_built.get();
+	startup.report(cout);
 
 	// read joint positions, velocities, update model
 	sim->getJointPositions(robot_name, robot->_q);
@@ -135,6 +187,79 @@ int main() {
 		object_orientations.push_back(obj_ori);
 	}
 
+	if(!redis_client->exists(JOINT_ANGLES_KEY))
+	{
+		redis_client->setEigenMatrixJSON(JOINT_ANGLES_KEY, VectorXd::Zero(robot->dof()));
+	}
+	if(!redis_client->exists(JOINT_VELOCITIES_KEY))
+	{
+		redis_client->setEigenMatrixJSON(JOINT_VELOCITIES_KEY, VectorXd::Zero(robot->dof()));
+	}
+
+	// the rendering loop has its own model and object poses, updated from the simulation thread
+	render_robot->_q = robot->_q;
+	render_robot->updateKinematics();
+	vector<Vector3d> render_object_positions = object_positions;
+	vector<Quaterniond> render_object_orientations = object_orientations;
+	render_state = new PandaUtils::RenderStateBuffer(robot, n_objects);
+
+	// discrete cable, its graphics are spheres at the particles
+	vector<chai3d::cShapeSphere*> cable_graphics;
+	vector<Vector3d> render_cable_positions;
+	if(flag_discrete_cable)
+	{
+		PandaUtils::CableSimulation::Parameters cable_parameters;
+		cable_parameters.radius = 0.01;
+		cable = new PandaUtils::CableSimulation(cable_plug_position, cable_free_end_position, cable_parameters, cable_length);
+		cable->attach(0, cable_plug_position);
+		cable->addPlane(Vector3d::UnitZ(), 0);
+		for(unsigned int i=0 ; i<cable_collision_links.size() ; i++)
+		{
+			Vector3d link_position = Vector3d::Zero();
+			robot->positionInWorld(link_position, cable_collision_links[i], Vector3d::Zero());
+			cable->addSphere(link_position, cable_collision_link_radius);
+		}
+		render_cable_positions = cable->positions();
+		for(int i=0 ; i<cable->numParticles() ; i++)
+		{
+			cable_graphics.push_back(new chai3d::cShapeSphere(cable_parameters.radius));
+			cable_graphics[i]->m_material->setColorf(0.835, 0.282, 0.282);
+			cable_graphics[i]->setLocalPos(render_cable_positions[i]);
+			graphics->_world->addChild(cable_graphics[i]);
+		}
+	}
+	auto update_cable_graphics = [&]()
+	{
+		if(cable != NULL && cable->readPositions(render_cable_positions))
+		{
+			for(unsigned int i=0 ; i<cable_graphics.size() ; i++)
+			{
+				cable_graphics[i]->setLocalPos(render_cable_positions[i]);
+			}
+		}
+	};
+
+	fSimulationRunning = true;
+	thread sim_thread(simulation, robot, sim);
+	// thread control_thread(control, robot, sim);
+
+	if(simviz_mode.headless)
+	{
+		auto update_graphics = [&]()
+		{
+			render_state->update(render_robot, render_object_positions, render_object_orientations);
+			update_cable_graphics();
+			graphics->updateGraphics(robot_name, render_robot);
+			for(int i=0 ; i< n_objects ; i++)
+			{
+				graphics->updateObjectGraphics(object_names[i], render_object_positions[i], render_object_orientations[i]);
+			}
+		};
+		PandaUtils::runHeadless(simviz_mode, graphics, camera_name, update_graphics, fSimulationRunning);
+		sim_thread.join();
+		return 0;
+	}
+
 	/*------- Set up visualization -------*/
 	// set up error callback
 	glfwSetErrorCallback(glfwError);
@@ -169,32 +294,20 @@ int main() {
 	// cache variables
 	double last_cursorx, last_cursory;
 
-	if(!redis_client->exists(JOINT_ANGLES_KEY))
-	{
-		redis_client->setEigenMatrixJSON(JOINT_ANGLES_KEY, VectorXd::Zero(robot->dof()));
-	}
-	if(!redis_client->exists(JOINT_VELOCITIES_KEY))
-	{
-		redis_client->setEigenMatrixJSON(JOINT_VELOCITIES_KEY, VectorXd::Zero(robot->dof()));
-	}
-
-	fSimulationRunning = true;
-	thread sim_thread(simulation, robot, sim);
-	// thread control_thread(control, robot, sim);
-
 	// while window is open:
 	while (!glfwWindowShouldClose(window))
 	{
-		// robot->updateKinematics();
+		render_state->update(render_robot, render_object_positions, render_object_orientations);
+		update_cable_graphics();
 
 		// update graphics. this automatically waits for the correct amount of time
 		int width, height;
 		glfwGetFramebufferSize(window, &width, &height);
-		graphics->updateGraphics(robot_name, robot);
+		graphics->updateGraphics(robot_name, render_robot);
 		// graphics->updateObjectGraphics(object_name, object_position, object_orientation);
 		for(int i=0 ; i< n_objects ; i++)
 		{
-			graphics->updateObjectGraphics(object_names[i], object_positions[i], object_orientations[i]);
+			graphics->updateObjectGraphics(object_names[i], render_object_positions[i], render_object_orientations[i]);
 		}
 		graphics->render(camera_name, width, height);
 
@@ -309,6 +422,26 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim) {
 	redis_client->set(LEFT_GRIPPER_DESIRED_FORCE_KEY, to_string(0));
 	redis_client->set(LEFT_GRIPPER_MODE_KEY, "m");
 
+	// parameters are only read from redis when they change
+	string fix_object_command = "0";
+	PandaUtils::RedisParameterCache simulation_parameters(*redis_client);
+	simulation_parameters.addString(FIX_OBJECT_KEY, fix_object_command);
+	simulation_parameters.start();
+
+	PandaUtils::RedisParameterCache left_gripper_parameters(*redis_client);
+	left_gripper_parameters.addDouble(LEFT_GRIPPER_DESIRED_WIDTH_KEY, gripper_desired_width);
+	left_gripper_parameters.addDouble(LEFT_GRIPPER_DESIRED_SPEED_KEY, gripper_desired_speed);
+	left_gripper_parameters.addDouble(LEFT_GRIPPER_DESIRED_FORCE_KEY, gripper_desired_force);
+	left_gripper_parameters.addString(LEFT_GRIPPER_MODE_KEY, gripper_mode);
+	left_gripper_parameters.start();
+
+	// finger torques at every step from the cached commands, which are only set again when
+	// the parameters changed
+	PandaUtils::GripperSimulation<1> grippers;
+	const int left_gripper = grippers.addGripper(gripper_index_la_1, gripper_index_la_2);
+	grippers.setCommand(left_gripper, gripper_mode, gripper_desired_width, gripper_desired_speed, gripper_desired_force);
+	double published_left_gripper_width = -1;
+
 	vector<int> controller_handled_joints;
 	for(int i=0 ; i<dof ; i++)
 	{
@@ -331,21 +464,42 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim) {
 
 	Matrix3d tmp_rot = Matrix3d::Identity();
 
+	// grasp of the discrete cable, its force is applied to the robot
+	int cable_grasp = -1;
+	Vector3d cable_grasp_position = Vector3d::Zero();
+	Vector3d link_position = Vector3d::Zero();
+	MatrixXd J_cable_grasp = MatrixXd::Zero(3, dof);
+	VectorXd cable_torques = VectorXd::Zero(dof);
+
 	unsigned long long simulation_counter = 0;
 
-	// create a timer
-	LoopTimer timer;
-	timer.initializeTimer();
-	timer.setLoopFrequency(sim_frequency); 
-	bool fTimerDidSleep = true;
-	double start_time = timer.elapsedTime(); //secs
-	double last_time = start_time;
+	// sim time, paced at the time scale
+	PandaUtils::SimClock sim_clock(time_scale);
 
 
-	while (fSimulationRunning) {
-		fTimerDidSleep = timer.waitForNextLoop();
+	PandaUtils::configureRealtimeThread("simulation", PandaUtils::RealtimeConfig::fifo(70, PandaUtils::simulationCpus()));
 
-		if(redis_client->get(FIX_OBJECT_KEY) == "1")
+	while (fSimulationRunning && sim_clock.waitForNextStep(1/sim_frequency)) {
+
+		simulation_parameters.update();
+		if(flag_discrete_cable)
+		{
+			robot->positionInWorld(cable_grasp_position, cable_grasp_link, cable_grasp_pos_in_link);
+			if(fix_object_command == "1" && cable_grasp < 0)
+			{
+				const int particle = cable->nearestParticle(cable_grasp_position);
+				if((cable->positions()[particle] - cable_grasp_position).norm() < cable_grasp_distance)
+				{
+					cable_grasp = cable->attach(particle, cable_grasp_position);
+				}
+			}
+			else if(fix_object_command != "1" && cable_grasp >= 0)
+			{
+				cable->detach(cable_grasp);
+				cable_grasp = -1;
+			}
+		}
+		else if(fix_object_command == "1")
 		{
 			fix_object = true;
 			if(fix_object_init)
@@ -382,22 +536,57 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim) {
 			command_torques_simulation(controller_handled_joints[i]) = command_torques_control(i); 
 		}
 
-		// // compute gripper torques
-		Vector2d left_gripper_torques = grippersControl(robot, gripper_index_la_1, gripper_index_la_2, 
-														LEFT_GRIPPER_MODE_KEY, LEFT_GRIPPER_CURRENT_WIDTH_KEY,
-														LEFT_GRIPPER_DESIRED_WIDTH_KEY, LEFT_GRIPPER_DESIRED_SPEED_KEY, LEFT_GRIPPER_DESIRED_FORCE_KEY);
+		// compute gripper torques
+		if(!fix_object && left_gripper_parameters.update())
+		{
+			if(!grippers.setCommand(left_gripper, gripper_mode, gripper_desired_width, gripper_desired_speed, gripper_desired_force))
+			{
+				// the clamped command back to redis
+				const PandaUtils::GripperSimulation<1>::Command& command = grippers.command(left_gripper);
+				std::cout << "WARNING : left gripper command (" << gripper_mode << ", " << gripper_desired_width << ", "
+					<< gripper_desired_speed << ", " << gripper_desired_force << ") saturated\n" << std::endl;
+				gripper_desired_width = command.width;
+				gripper_desired_speed = command.speed;
+				gripper_desired_force = command.force;
+				redis_client->setCommandIs(LEFT_GRIPPER_DESIRED_WIDTH_KEY, std::to_string(command.width));
+				redis_client->setCommandIs(LEFT_GRIPPER_DESIRED_SPEED_KEY, std::to_string(command.speed));
+				redis_client->setCommandIs(LEFT_GRIPPER_DESIRED_FORCE_KEY, std::to_string(command.force));
+			}
+		}
+		grippers.step(robot->_q, robot->_dq, command_torques_simulation);
+		if(std::abs(grippers.width(left_gripper) - published_left_gripper_width) > 1e-5)
+		{
+			published_left_gripper_width = grippers.width(left_gripper);
+			redis_client->set(LEFT_GRIPPER_CURRENT_WIDTH_KEY, to_string(published_left_gripper_width));
+		}
 
-		command_torques_simulation(gripper_index_la_1) = left_gripper_torques(0);
-		command_torques_simulation(gripper_index_la_2) = left_gripper_torques(1);
+		// step the cable to the current robot state, and apply its pull at the grasp point
+		if(flag_discrete_cable)
+		{
+			for(unsigned int i=0 ; i<cable_collision_links.size() ; i++)
+			{
+				robot->positionInWorld(link_position, cable_collision_links[i], Vector3d::Zero());
+				cable->setSphere(i, link_position);
+			}
+			if(cable_grasp >= 0)
+			{
+				cable->setAttachmentTarget(cable_grasp, cable_grasp_position);
+			}
+			cable->step(1/sim_frequency);
+			cable->publish();
+			if(cable_grasp >= 0)
+			{
+				robot->JvWorldFrame(J_cable_grasp, cable_grasp_link, cable_grasp_pos_in_link);
+				cable_torques = J_cable_grasp.transpose() * cable->attachmentForce(cable_grasp);
+				command_torques_simulation += cable_torques;
+			}
+		}
 
 		// set torques to simulation
 		sim->setJointTorques(robot_name, command_torques_simulation);
 
 		// integrate forward
-		double curr_time = timer.elapsedTime();
-		double loop_dt = curr_time - last_time; 
 		sim->integrate(1/sim_frequency);
-		// sim->integrate(loop_dt);
 
 		// read joint positions, velocities, update model
 		sim->getJointPositions(robot_name, robot->_q);
@@ -409,6 +598,7 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim) {
 		{
 			sim->getObjectPosition(object_names[i], object_positions[i], object_orientations[i]);
 		}
+		render_state->publish(robot, object_positions, object_orientations);
 
 		for(int i=0 ; i<controlled_dof ; i++)
 		{
@@ -419,104 +609,22 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim) {
 		// write new robot state to redis
 		redis_client->setEigenMatrixJSON(JOINT_ANGLES_KEY, q_control);
 		redis_client->setEigenMatrixJSON(JOINT_VELOCITIES_KEY, dq_control);
-		redis_client->set(TIMESTAMP_KEY, to_string(curr_time));
-
-		//update last time
-		last_time = curr_time;
+		redis_client->set(TIMESTAMP_KEY, to_string(sim_clock.time() + 1/sim_frequency));
 
 		simulation_counter++;
 	}
 
 	// gripper_thread.join();
 
-	double end_time = timer.elapsedTime();
-	std::cout << "\n";
-	std::cout << "Simulation Loop run time  : " << end_time << " seconds\n";
-	std::cout << "Simulation Loop updates   : " << timer.elapsedCycles() << "\n";
-	std::cout << "Simulation Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
-}
-
-//------------------------------------------------------------------------------
-Vector2d grippersControl(Sai2Model::Sai2Model* robot, 
-		const int joint_index_1, 
-		const int joint_index_2, 
-		const string mode_redis_key,
-		const string current_width_redis_key,
-		const string desired_width_redis_key,
-		const string desired_speed_redis_key,
-		const string desired_force_redis_key)
-{
-	Vector2d gripper_torques = Vector2d::Zero();
-
-	double max_width = 0.08;
-
-	// controller gains and force
-	double kp_gripper = 400.0;
-	double kv_gripper = 30.0;
-	double gripper_behavior_force = 0;
-
-	// gripper state
-	double gripper_center_point = (robot->_q(joint_index_1) + robot->_q(joint_index_2))/2.0;
-	double gripper_center_point_velocity = (robot->_dq(joint_index_1) + robot->_dq(joint_index_2))/2.0;
-
-	double gripper_width = (robot->_q(joint_index_1) - robot->_q(joint_index_2))/2;
-	double gripper_opening_speed = (robot->_dq(joint_index_1) - robot->_dq(joint_index_2))/2;
-
-	redis_client->set(current_width_redis_key, to_string(gripper_width));
-
-	// compute gripper torques
-	if(!fix_object)
-	{
-		gripper_desired_width = stod(redis_client->get(desired_width_redis_key));
-		gripper_desired_speed = stod(redis_client->get(desired_speed_redis_key));
-		gripper_desired_force = stod(redis_client->get(desired_force_redis_key));
-		gripper_mode = redis_client->get(mode_redis_key);
-	}
-	if(gripper_desired_width > max_width)
-	{
-		gripper_desired_width = max_width;
-		redis_client->setCommandIs(desired_width_redis_key, std::to_string(max_width));
-		std::cout << "WARNING : Desired gripper " << joint_index_1 << " " << joint_index_2 << " width higher than max width. saturating to max width\n" << std::endl;
-	}
-	if(gripper_desired_width < 0)
-	{
-		gripper_desired_width = 0;
-		redis_client->setCommandIs(desired_width_redis_key, std::to_string(0));
-		std::cout << "WARNING : Desired gripper " << joint_index_1 << " " << joint_index_2 << " width lower than 0. saturating to 0\n" << std::endl;
-	}
-	if(gripper_desired_speed < 0)
-	{
-		gripper_desired_speed = 0;
-		redis_client->setCommandIs(desired_speed_redis_key, std::to_string(0));
-		std::cout << "WARNING : Desired gripper " << joint_index_1 << " " << joint_index_2 << " speed lower than 0. saturating to 0\n" << std::endl;
-	} 
-	if(gripper_desired_force < 0)
-	{
-		gripper_desired_force = 0;
-		redis_client->setCommandIs(desired_force_redis_key, std::to_string(0));
-		std::cout << "WARNING : Desired gripper " << joint_index_1 << " " << joint_index_2 << " force lower than 0. saturating to 0\n" << std::endl;
-	}
-
-	double gripper_constraint_force = -200.0*gripper_center_point - 20.0*gripper_center_point_velocity;
-
-	if(gripper_mode == "m")
-	{
-		gripper_behavior_force = -kp_gripper*(gripper_width - gripper_desired_width) - kv_gripper*(gripper_opening_speed - gripper_desired_speed);
-	}
-	else if(gripper_mode == "g")
-	{
-		gripper_behavior_force = -gripper_desired_force;
-	}
-	else
-	{
-		cout << "gripper mode not recognized\n" << endl;
-	}
-
-	gripper_torques(0) = gripper_constraint_force + gripper_behavior_force;
-	gripper_torques(1) = gripper_constraint_force - gripper_behavior_force;
-
-	return gripper_torques;
+	simulation_parameters.stop();
+	left_gripper_parameters.stop();
 
+	double end_time = sim_clock.time();
+	std::cout << "\n";
+	std::cout << "Simulation Loop run time  : " << end_time << " seconds of sim time\n";
+	std::cout << "Simulation Loop updates   : " << simulation_counter << "\n";
+	std::cout << "Simulation Loop frequency : " << simulation_counter/end_time << "Hz of sim time\n";
+	std::cout << "Time scale                : " << sim_clock.measuredTimeScale() << "\n";
 }
 
 //------------------------------------------------------------------------------
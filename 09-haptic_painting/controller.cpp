@@ -4,14 +4,27 @@
 
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
+#include "redis/RedisClientPool.h"
 #include "timer/LoopTimer.h"
+#include "timer/PrecisionLoopTimer.h"
+#include "timer/LoopHealth.h"
+#include "threads/RealtimeThread.h"
+#include "threads/CycleBarrier.h"
 #include "tasks/JointTask.h"
 #include "tasks/PosOriTask.h"
 #include "haptic_tasks/HapticController.h"
-#include "haptic_tasks/BilateralPassivityController.h"
-
+#include "passivity/HapticPassivityController.h"
+#include "net/UdpHapticDevice.h"
+#include "redis/HapticDeviceBundle.h"
+#include "model/MassMatrixInverse.h"
+#include "force_control/ForcePipeline.h"
+#include "haptics/StrokeCapture.h"
+#include "threads/TripleBuffer.h"
+
+#include <atomic>
 #include <iostream>
 #include <string>
+#include <thread>
 
 #include <signal.h>
 bool runloop = true;
@@ -45,6 +58,10 @@ vector<string> FORCE_SENSED_KEYS = {
 
 const string REMOTE_ENABLED_KEY = "sai2::WarehouseSimulation::sensors::remote_enabled";
 const string RESTART_CYCLE_KEY = "sai2::WarehouseSimulation::sensors::restart_cycle";
+vector<string> LOOP_HEALTH_KEYS = {
+	"sai2::WarehouseSimulation::panda1::controller::loop_health",
+	"sai2::WarehouseSimulation::panda2::controller::loop_health",
+};
 
 // - write
 vector<string> JOINT_TORQUES_COMMANDED_KEYS = {
@@ -148,13 +165,15 @@ int remote_enabled = 1; ////////////////////////////////////////////////////////
 int restart_cycle = 0;
 
 int state_palette = GOTO_INITIAL_CONFIG;
-int state_brush = GOTO_INITIAL_CONFIG;
+// read by the palette thread for the restart of the cycle
+std::atomic<int> state_brush(GOTO_INITIAL_CONFIG);
 
-unsigned long long controller_counter = 0;
+// cpus of the palette and brush threads
+const vector<int> pair_cpus = {1, 2};
 
 RedisClient redis_client;
 
-int main() {
+int main(int argc, char** argv) {
 
 	if(!flag_simulation)
 	{
@@ -209,6 +228,7 @@ int main() {
 
 	// prepare robot task controllers
 	vector<int> dof;
+	vector<PandaUtils::MassMatrixInverse<7>*> mass_matrix_inverses;
 	vector<VectorXd> command_torques;
 	vector<VectorXd> coriolis;
 	vector<MatrixXd> N_prec;
@@ -232,6 +252,7 @@ int main() {
 	for(int i=0 ; i<n_robots ; i++)
 	{
 		dof.push_back(robots[i]->dof());
+		mass_matrix_inverses.push_back(new PandaUtils::MassMatrixInverse<7>(dof[i], inertia_regularization ? 0.07 : 0.0));
 		command_torques.push_back(VectorXd::Zero(dof[i]));
 		coriolis.push_back(VectorXd::Zero(dof[i]));
 		N_prec.push_back(MatrixXd::Identity(dof[i],dof[i]));
@@ -318,6 +339,13 @@ int main() {
 		hand_brush_com = Vector3d(-6.19239e-05,  -0.00452189,    0.0777715);
 	}
 
+	// bias, hand gravity and sensor frame of the task in one update, not filtered
+	PandaUtils::ForcePipeline force_pipeline_brush(1000);
+	Affine3d sensor_frame_brush = Affine3d::Identity();
+	sensor_frame_brush.translation() = Vector3d(0, 0, 0.12);
+	force_pipeline_brush.setSensorFrame(sensor_frame_brush, Vector3d(0.0,0.0,0.2));
+	force_pipeline_brush.setCalibration(force_bias_global_brush + force_bias_adjustment_brush, hand_brush_mass, hand_brush_com);
+
 	auto palette_teleop_task = new Sai2Primitives::HapticController(posori_tasks[0]->_current_position, posori_tasks[0]->_current_orientation, robot_pose_in_world[0].linear());
 	// palette_teleop_task->_filter_on = true;
 	// palette_teleop_task->setFilterCutOffFreq(0.04, 0.04);
@@ -380,7 +408,8 @@ int main() {
 	bool previous_gripper_state_brush = false;
 
 	//// passivity observer and controller ////
-	auto passivity_controller_brush = new Sai2Primitives::BilateralPassivityController(posori_tasks[1], brush_teleop_task);
+	auto passivity_controller_brush = new PandaUtils::HapticPassivityController(0.001);
+	passivity_controller_brush->setMaxDamping(0.9 * _max_damping_device1[0], 0.9 * _max_damping_device1[1]);
 	Vector3d haptic_damping_force_passivity_brush = Vector3d::Zero();
 	Vector3d command_force_device_plus_damping_brush = Vector3d::Zero();
 
@@ -392,7 +421,6 @@ int main() {
 	Vector3d hand_acceleration = Vector3d::Zero();
 	Vector3d hand_inertial_forces = Vector3d::Zero();
 
-	// setup redis keys to be updated with the callback
 	// objects to read from redis
 	vector<MatrixXd> mass_from_robots;
 	mass_from_robots.push_back(MatrixXd::Identity(7,7));
@@ -402,402 +430,575 @@ int main() {
 	coriolis_from_robots.push_back(VectorXd::Zero(7));
 	coriolis_from_robots.push_back(VectorXd::Zero(7));
 
-	redis_client.createReadCallback(0);
-	redis_client.createWriteCallback(0);
-
-	redis_client.addEigenToReadCallback(0, JOINT_ANGLES_KEYS[0], robots[0]->_q);
-	redis_client.addEigenToReadCallback(0, JOINT_VELOCITIES_KEYS[0], robots[0]->_dq);
-	redis_client.addEigenToReadCallback(0, JOINT_ANGLES_KEYS[1], robots[1]->_q);
-	redis_client.addEigenToReadCallback(0, JOINT_VELOCITIES_KEYS[1], robots[1]->_dq);
-
-	// redis_client.addEigenToReadCallback(0, FORCE_SENSED_KEYS[0], f_sensed_palette);
-	redis_client.addEigenToReadCallback(0, FORCE_SENSED_KEYS[1], f_sensed_brush);
-
-	redis_client.addEigenToReadCallback(0, DEVICE_POSITION_KEYS[0], palette_teleop_task->_current_position_device);
-	redis_client.addEigenToReadCallback(0, DEVICE_ROTATION_KEYS[0], palette_teleop_task->_current_rotation_device);
-	redis_client.addEigenToReadCallback(0, DEVICE_TRANS_VELOCITY_KEYS[0], palette_teleop_task->_current_trans_velocity_device);
-	redis_client.addEigenToReadCallback(0, DEVICE_ROT_VELOCITY_KEYS[0], palette_teleop_task->_current_rot_velocity_device);
-	redis_client.addEigenToReadCallback(0, DEVICE_SENSED_FORCE_KEYS[0], palette_teleop_task->_sensed_force_device);
-	redis_client.addEigenToReadCallback(0, DEVICE_SENSED_TORQUE_KEYS[0], palette_teleop_task->_sensed_torque_device);
-	redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_POSITION_KEYS[0], palette_teleop_task->_current_position_gripper_device);
-	redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_VELOCITY_KEYS[0], palette_teleop_task->_current_gripper_velocity_device);
-
-	redis_client.addEigenToReadCallback(0, DEVICE_POSITION_KEYS[1], brush_teleop_task->_current_position_device);
-	redis_client.addEigenToReadCallback(0, DEVICE_ROTATION_KEYS[1], brush_teleop_task->_current_rotation_device);
-	redis_client.addEigenToReadCallback(0, DEVICE_TRANS_VELOCITY_KEYS[1], brush_teleop_task->_current_trans_velocity_device);
-	redis_client.addEigenToReadCallback(0, DEVICE_ROT_VELOCITY_KEYS[1], brush_teleop_task->_current_rot_velocity_device);
-	redis_client.addEigenToReadCallback(0, DEVICE_SENSED_FORCE_KEYS[1], brush_teleop_task->_sensed_force_device);
-	redis_client.addEigenToReadCallback(0, DEVICE_SENSED_TORQUE_KEYS[1], brush_teleop_task->_sensed_torque_device);
-	redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_POSITION_KEYS[1], brush_teleop_task->_current_position_gripper_device);
-	redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_VELOCITY_KEYS[1], brush_teleop_task->_current_gripper_velocity_device);
-
-	redis_client.addIntToReadCallback(0, REMOTE_ENABLED_KEY, remote_enabled);
-	redis_client.addIntToReadCallback(0, RESTART_CYCLE_KEY, restart_cycle);
-
-	if(!flag_simulation)
+	// haptic devices from a remote haptic station, the brush device on the ports after the ones
+	// of the palette device : controller09 --udp-teleop 9900 station 9901, or from the binary
+	// records of haptic_bundle_bridge when both devices have one, or from the device keys. the
+	// records are read with the redis connection of the thread of the pair
+	PandaUtils::UdpTeleopConfig udp_config = PandaUtils::UdpTeleopConfig::fromArgs(argc, argv);
+
+	// controller09 --capture-strokes session logs the brush and the palette at every tick of
+	// the brush loop to session.bin, and the strokes painted to session.strokes, for
+	// controller10 --strokes. the palette loop gives its position through palette_position_buffer
+	string capture_prefix = "";
+	for(int i=1 ; i<argc-1 ; i++)
 	{
-		redis_client.addEigenToReadCallback(0, MASSMATRIX_KEYS[0], mass_from_robots[0]);
-		redis_client.addEigenToReadCallback(0, MASSMATRIX_KEYS[1], mass_from_robots[1]);
-		redis_client.addEigenToReadCallback(0, CORIOLIS_KEYS[0], coriolis_from_robots[0]);
-		redis_client.addEigenToReadCallback(0, CORIOLIS_KEYS[1], coriolis_from_robots[1]);
+		if(string(argv[i]) == "--capture-strokes")
+		{
+			capture_prefix = argv[i+1];
+		}
 	}
+	PandaUtils::StrokeCapture* stroke_capture = NULL;
+	if(!capture_prefix.empty())
+	{
+		stroke_capture = new PandaUtils::StrokeCapture(capture_prefix + ".bin", capture_prefix + ".strokes");
+	}
+	PandaUtils::TripleBuffer<Vector3d> palette_position_buffer(Vector3d::Zero());
+	const Vector3d tool_in_link = Vector3d(0.0,0.0,0.2);
+	PandaUtils::HapticDeviceChannel* device_channel_palette = NULL;
+	PandaUtils::HapticDeviceChannel* device_channel_brush = NULL;
+	const bool f_device_bundles = !udp_config.enabled()
+			&& PandaUtils::RedisHapticDevice::available(redis_client, 0)
+			&& PandaUtils::RedisHapticDevice::available(redis_client, 1);
+	if(udp_config.enabled())
+	{
+		device_channel_palette = new PandaUtils::UdpHapticDevice(udp_config.forDevice(0));
+		device_channel_brush = new PandaUtils::UdpHapticDevice(udp_config.forDevice(1));
+	}
+
+	// one thread per robot and haptic device pair, each with its own redis connection and
+	// cpu, so that a pair keeps its 1 kHz when the other one gets expensive. the timers of
+	// the two threads start on the time of the start barrier and share their deadlines.
+	// the pairs only coordinate on the restart of the cycle, through state_brush
+	PandaUtils::RedisClientPool redis_pool;
+	PandaUtils::CycleBarrier start_barrier(n_robots);
+
+	// create the timers, that spin the last 100 us before the deadlines of the haptic loops
+	PandaUtils::PrecisionLoopTimer palette_timer(100e-6);
+	PandaUtils::PrecisionLoopTimer brush_timer(100e-6);
+	palette_timer.setLoopFrequency(1000);
+	brush_timer.setLoopFrequency(1000);
+	PandaUtils::LoopHealth palette_loop_health(1000);
+	PandaUtils::LoopHealth brush_loop_health(1000);
+
+	auto brush_loop = [&]()
+	{
+		PandaUtils::configureRealtimeThread("brush", PandaUtils::RealtimeConfig::fifo(80, {pair_cpus[1]}));
+		RedisClient& redis_client = redis_pool.client();
+		if(f_device_bundles)
+		{
+			device_channel_brush = new PandaUtils::RedisHapticDevice(redis_client, 1);
+		}
 
-	// objects to write to redis
-	redis_client.addEigenToWriteCallback(0, JOINT_TORQUES_COMMANDED_KEYS[0], command_torques[0]);
-	redis_client.addEigenToWriteCallback(0, DEVICE_COMMANDED_FORCE_KEYS[0], command_force_device_plus_damping_palette);
-	redis_client.addDoubleToWriteCallback(0, DEVICE_COMMANDED_GRIPPER_FORCE_KEYS[0], palette_teleop_task->_commanded_gripper_force_device);
-
-	redis_client.addEigenToWriteCallback(0, JOINT_TORQUES_COMMANDED_KEYS[1], command_torques[1]);
-	redis_client.addEigenToWriteCallback(0, DEVICE_COMMANDED_FORCE_KEYS[1], command_force_device_plus_damping_brush);
-	redis_client.addDoubleToWriteCallback(0, DEVICE_COMMANDED_GRIPPER_FORCE_KEYS[1], brush_teleop_task->_commanded_gripper_force_device);
-
-	// create a timer
-	LoopTimer timer;
-	timer.initializeTimer();
-	timer.setLoopFrequency(1000); 
-	double current_time = 0;
-	double prev_time = 0;
-	double dt = 0;
-	bool fTimerDidSleep = true;
-	double start_time = timer.elapsedTime(); //secs
-
-	while (runloop) {
-		// wait for next scheduled loop
-		timer.waitForNextLoop();
-		current_time = timer.elapsedTime() - start_time;
-		dt = current_time - prev_time;
-
-		redis_client.executeReadCallback(0);
-
-		// read robot state from redis and update robot model
-		for(int i=0 ; i<n_robots ; i++)
+		int brush_remote_enabled = remote_enabled;
+		int brush_restart_cycle = restart_cycle;
+
+		// setup redis keys to be updated with the callback
+		redis_client.createReadCallback(0);
+		redis_client.createWriteCallback(0);
+
+		redis_client.addEigenToReadCallback(0, JOINT_ANGLES_KEYS[1], robots[1]->_q);
+		redis_client.addEigenToReadCallback(0, JOINT_VELOCITIES_KEYS[1], robots[1]->_dq);
+		redis_client.addEigenToReadCallback(0, FORCE_SENSED_KEYS[1], f_sensed_brush);
+		if(device_channel_brush == NULL)
+		{
+			redis_client.addEigenToReadCallback(0, DEVICE_POSITION_KEYS[1], brush_teleop_task->_current_position_device);
+			redis_client.addEigenToReadCallback(0, DEVICE_ROTATION_KEYS[1], brush_teleop_task->_current_rotation_device);
+			redis_client.addEigenToReadCallback(0, DEVICE_TRANS_VELOCITY_KEYS[1], brush_teleop_task->_current_trans_velocity_device);
+			redis_client.addEigenToReadCallback(0, DEVICE_ROT_VELOCITY_KEYS[1], brush_teleop_task->_current_rot_velocity_device);
+			redis_client.addEigenToReadCallback(0, DEVICE_SENSED_FORCE_KEYS[1], brush_teleop_task->_sensed_force_device);
+			redis_client.addEigenToReadCallback(0, DEVICE_SENSED_TORQUE_KEYS[1], brush_teleop_task->_sensed_torque_device);
+			redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_POSITION_KEYS[1], brush_teleop_task->_current_position_gripper_device);
+			redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_VELOCITY_KEYS[1], brush_teleop_task->_current_gripper_velocity_device);
+		}
+		redis_client.addIntToReadCallback(0, REMOTE_ENABLED_KEY, brush_remote_enabled);
+		redis_client.addIntToReadCallback(0, RESTART_CYCLE_KEY, brush_restart_cycle);
+		if(!flag_simulation)
 		{
+			redis_client.addEigenToReadCallback(0, MASSMATRIX_KEYS[1], mass_from_robots[1]);
+			redis_client.addEigenToReadCallback(0, CORIOLIS_KEYS[1], coriolis_from_robots[1]);
+		}
+
+		redis_client.addEigenToWriteCallback(0, JOINT_TORQUES_COMMANDED_KEYS[1], command_torques[1]);
+		if(device_channel_brush == NULL)
+		{
+			redis_client.addEigenToWriteCallback(0, DEVICE_COMMANDED_FORCE_KEYS[1], command_force_device_plus_damping_brush);
+			redis_client.addDoubleToWriteCallback(0, DEVICE_COMMANDED_GRIPPER_FORCE_KEYS[1], brush_teleop_task->_commanded_gripper_force_device);
+		}
+
+		unsigned long long controller_counter = 0;
+		double current_time = 0;
+		double prev_time = 0;
+		double dt = 0;
+		brush_timer.initializeTimer(start_barrier.wait());
+		double start_time = brush_timer.elapsedTime(); //secs
+
+		while (runloop) {
+			// wait for next scheduled loop
+			brush_loop_health.waitForNextLoop(brush_timer);
+			current_time = brush_timer.elapsedTime() - start_time;
+			dt = current_time - prev_time;
+
+			redis_client.executeReadCallback(0);
+			if(device_channel_brush != NULL)
+			{
+				device_channel_brush->readDevice(*brush_teleop_task);
+			}
+
 			// update model
 			if(flag_simulation)
 			{
-				robots[i]->updateModel();
-				robots[i]->coriolisForce(coriolis[i]);
+				robots[1]->updateModel();
+				robots[1]->coriolisForce(coriolis[1]);
 			}
 			else
 			{
-				robots[i]->updateKinematics();
-				robots[i]->_M = mass_from_robots[i];
-				if(inertia_regularization)
-				{
-					robots[i]->_M(4,4) += 0.07;
-					robots[i]->_M(5,5) += 0.07;
-					robots[i]->_M(6,6) += 0.07;
-				}
-				robots[i]->_M_inv = robots[i]->_M.inverse();
-				coriolis[i] = coriolis_from_robots[i];
+				robots[1]->updateKinematics();
+				robots[1]->_M = mass_from_robots[1];
+				mass_matrix_inverses[1]->update(robots[1]);
+				coriolis[1] = coriolis_from_robots[1];
 			}
 
-		}
+			// compute hand inertial forces
+			hand_velocity = posori_tasks[1]->_current_velocity + posori_tasks[1]->_current_angular_velocity.cross(hand_brush_com);
+			if(controller_counter > 100)
+			{
+				hand_acceleration = (hand_velocity - prev_hand_velocity)/dt;
+			}
+			prev_hand_velocity = hand_velocity;
+			hand_inertial_forces = hand_brush_mass * hand_acceleration;
+
+
+			// read force sensor data and remove bias and effecto from hand gravity
+			Matrix3d R_sensor_brush = Matrix3d::Identity();
+			robots[1]->rotation(R_sensor_brush, "link7");
+			// hand inertia in the sensor frame, the rest of the compensation is linear after it
+			f_sensed_brush.head(3) -= 0.8 * R_sensor_brush.transpose() * hand_inertial_forces;
+
+			force_pipeline_brush.update(f_sensed_brush, R_sensor_brush);
+			posori_tasks[1]->_sensed_force = force_pipeline_brush.force();
+			posori_tasks[1]->_sensed_moment = force_pipeline_brush.moment();
+			VectorXd sensed_force_brush_world_frame = VectorXd::Zero(6);
+			sensed_force_brush_world_frame << posori_tasks[1]->_sensed_force, posori_tasks[1]->_sensed_moment;
+			brush_teleop_task->updateSensedForce(-sensed_force_brush_world_frame);
+
+			// if(controller_counter % 100 == 0)
+			// {
+			// 	cout << "force brush : " << f_sensed_brush.transpose() << endl;
+			// 	cout << endl;
+			// }
+
+			if(stroke_capture != NULL)
+			{
+				Vector3d brush_position = Vector3d::Zero();
+				Matrix3d brush_orientation = Matrix3d::Identity();
+				Vector3d palette_position = Vector3d::Zero();
+				robots[1]->position(brush_position, "link7", tool_in_link);
+				robots[1]->rotation(brush_orientation, "link7");
+				palette_position_buffer.read(palette_position);
+				stroke_capture->record(controller_counter, current_time, robot_pose_in_world[1] * brush_position,
+						robot_pose_in_world[1].linear() * brush_orientation, f_sensed_brush, palette_position);
+			}
 
-		// compute hand inertial forces
-		hand_velocity = posori_tasks[1]->_current_velocity + posori_tasks[1]->_current_angular_velocity.cross(hand_brush_com);
-		if(controller_counter > 100)
-		{
-			hand_acceleration = (hand_velocity - prev_hand_velocity)/dt;
-		}
-		prev_hand_velocity = hand_velocity;
-		hand_inertial_forces = hand_brush_mass * hand_acceleration;
-
-
-		// read force sensor data and remove bias and effecto from hand gravity
-		f_sensed_brush -= force_bias_global_brush + force_bias_adjustment_brush; 
-		Matrix3d R_sensor_brush = Matrix3d::Identity();
-		robots[1]->rotation(R_sensor_brush, "link7");
-		Vector3d p_tool_sensorFrame_brush = hand_brush_mass * R_sensor_brush.transpose() * Vector3d(0,0,-9.81); 
-		f_sensed_brush.head(3) += p_tool_sensorFrame_brush;
-		f_sensed_brush.tail(3) += hand_brush_com.cross(p_tool_sensorFrame_brush);
-
-		f_sensed_brush.head(3) -= 0.8 * R_sensor_brush.transpose() * hand_inertial_forces;
-
-		posori_tasks[1]->updateSensedForceAndMoment(f_sensed_brush.head(3), f_sensed_brush.tail(3));
-		VectorXd sensed_force_brush_world_frame = VectorXd::Zero(6);
-		sensed_force_brush_world_frame << posori_tasks[1]->_sensed_force, posori_tasks[1]->_sensed_moment;
-		brush_teleop_task->updateSensedForce(-sensed_force_brush_world_frame);
-
-		// f_sensed_palette -= force_bias_global_palette; 
-		// Matrix3d R_sensor_palette = Matrix3d::Identity();
-		// robots[0]->rotation(R_sensor_palette, "link7");
-		// Vector3d p_tool_sensorFrame_palette = hand_palette_mass * R_sensor_palette.transpose() * Vector3d(0,0,-9.81); 
-		// f_sensed_palette.head(3) += p_tool_sensorFrame_palette;
-		// f_sensed_palette.tail(3) += hand_palette_com.cross(p_tool_sensorFrame_palette);
-		// posori_tasks[0]->updateSensedForceAndMoment(f_sensed_palette.head(3), f_sensed_palette.tail(3));
-		// VectorXd sensed_force_palette_world_frame = VectorXd::Zero(6);
-		// sensed_force_palette_world_frame << posori_tasks[0]->_sensed_force, posori_tasks[0]->_sensed_moment;
-		// palette_teleop_task->updateSensedForce(-sensed_force_palette_world_frame);
-
-		// if(controller_counter % 100 == 0)
-		// {
-		// 	cout << "force brush : " << f_sensed_brush.transpose() << endl;
-		// 	cout << "force palette : " << f_sensed_palette.transpose() << endl;
-		// 	cout << endl;
-		// }
-
-		palette_teleop_task->UseGripperAsSwitch();
-		brush_teleop_task->UseGripperAsSwitch();
+			brush_teleop_task->UseGripperAsSwitch();
 
 ///////////////////////////////////////////////////////////////////////////////////////////
-		//// State Machine Robot 1 - Haptic Brush ////
-		if(state_brush == GOTO_INITIAL_CONFIG)
-		{
-			// update robot home position task model
-			N_prec[1].setIdentity();
-			joint_tasks[1]->updateTaskModel(N_prec[1]);
-			// compute robot torques
-			joint_tasks[1]->computeTorques(joint_task_torques[1]);
-			command_torques[1] = joint_task_torques[1] + coriolis[1];
+			//// State Machine Robot 1 - Haptic Brush ////
+			if(state_brush == GOTO_INITIAL_CONFIG)
+			{
+				// update robot home position task model
+				N_prec[1].setIdentity();
+				joint_tasks[1]->updateTaskModel(N_prec[1]);
+				// compute robot torques
+				joint_tasks[1]->computeTorques(joint_task_torques[1]);
+				command_torques[1] = joint_task_torques[1] + coriolis[1];
 			
-			// compute homing haptic device
-			brush_teleop_task->HomingTask();
+				// compute homing haptic device
+				brush_teleop_task->HomingTask();
 
-			// read gripper state
-			gripper_state_brush = brush_teleop_task->gripper_state;
+				// read gripper state
+				gripper_state_brush = brush_teleop_task->gripper_state;
 
-			if(remote_enabled==1 && (joint_tasks[1]->_desired_position - joint_tasks[1]->_current_position).norm() < 0.2 && brush_teleop_task->device_homed && gripper_state_brush)
-			{
-				joint_tasks[1]->_ki = 0;
-				posori_tasks[1]->reInitializeTask();
-				workspace_center_brush = posori_tasks[1]->_current_position;
-				haptic_center_brush = brush_teleop_task->_current_position_device;
+				if(brush_remote_enabled==1 && (joint_tasks[1]->_desired_position - joint_tasks[1]->_current_position).norm() < 0.2 && brush_teleop_task->device_homed && gripper_state_brush)
+				{
+					joint_tasks[1]->_ki = 0;
+					posori_tasks[1]->reInitializeTask();
+					workspace_center_brush = posori_tasks[1]->_current_position;
+					haptic_center_brush = brush_teleop_task->_current_position_device;
 
-				brush_teleop_task->setRobotCenter(workspace_center_brush, posori_tasks[1]->_current_orientation);
-				brush_teleop_task->setDeviceCenter(haptic_center_brush, brush_teleop_task->_current_rotation_device);
+					brush_teleop_task->setRobotCenter(workspace_center_brush, posori_tasks[1]->_current_orientation);
+					brush_teleop_task->setDeviceCenter(haptic_center_brush, brush_teleop_task->_current_rotation_device);
+					passivity_controller_brush->reset();
 				
-				state_brush = HAPTIC_CONTROL;
+					state_brush = HAPTIC_CONTROL;
+				}
 			}
-		}
 
-		else if(state_brush == HAPTIC_CONTROL)
-		{
+			else if(state_brush == HAPTIC_CONTROL)
+			{
 
-			// update tasks model
-			N_prec[1].setIdentity();
-			posori_tasks[1]->updateTaskModel(N_prec[1]);
-			N_prec[1] = posori_tasks[1]->_N;
-			joint_tasks[1]->updateTaskModel(N_prec[1]);
+				// update tasks model
+				N_prec[1].setIdentity();
+				posori_tasks[1]->updateTaskModel(N_prec[1]);
+				N_prec[1] = posori_tasks[1]->_N;
+				joint_tasks[1]->updateTaskModel(N_prec[1]);
 			
-			// // read gripper state
-			gripper_state_brush = brush_teleop_task->gripper_state;
-			// compute haptic commands
-			if(gripper_state_brush) //Full control
+				// // read gripper state
+				gripper_state_brush = brush_teleop_task->gripper_state;
+				// compute haptic commands
+				if(gripper_state_brush) //Full control
+				{
+					if(!previous_gripper_state_brush)
+					{
+						brush_teleop_task->setDeviceCenter(haptic_center_brush, brush_teleop_task->_current_rotation_device);
+						brush_teleop_task->setRobotCenter(workspace_center_brush, posori_tasks[1]->_current_orientation);
+				
+					}
+					Matrix3d desired_rotation_relative = Matrix3d::Identity();
+					brush_teleop_task->computeHapticCommands6d( posori_tasks[1]->_desired_position,
+																	   posori_tasks[1]->_desired_orientation);
+
+				}
+				else //Only position control
+				{
+					brush_teleop_task->computeHapticCommands3d(posori_tasks[1]->_desired_position);
+				}
+
+				// compute robot set torques
+				posori_tasks[1]->computeTorques(posori_task_torques[1]);
+				joint_tasks[1]->computeTorques(joint_task_torques[1]);
+
+				command_torques[1] = joint_task_torques[1] + coriolis[1] + posori_task_torques[1];
+
+				passivity_controller_brush->update(brush_teleop_task->_commanded_force_device, brush_teleop_task->_current_trans_velocity_device);
+				haptic_damping_force_passivity_brush = passivity_controller_brush->dampingForce();
+
+				if(brush_remote_enabled == 0)
+				{
+				// set joint controller to maintin robot in current position
+				joint_tasks[1]->reInitializeTask();
+				// joint_tasks[1]->_desired_position = robot[1]->_q;
+				// set current haptic device position
+				brush_teleop_task->setDeviceCenter(brush_teleop_task->_current_position_device, brush_teleop_task->_current_rotation_device);
+				// no passivity damping outside of the haptic control
+				haptic_damping_force_passivity_brush.setZero();
+
+				state_brush = MAINTAIN_POSITION;
+				}
+			}
+
+			else if(state_brush == MAINTAIN_POSITION)
 			{
-				if(!previous_gripper_state_brush)
+				// update robot home position task model
+				N_prec[1].setIdentity();
+				joint_tasks[1]->updateTaskModel(N_prec[1]);
+				// compute robot torques
+				joint_tasks[1]->computeTorques(joint_task_torques[1]);
+				command_torques[1] = joint_task_torques[1] + coriolis[1];
+
+				// compute homing haptic device
+				brush_teleop_task->HomingTask();
+
+				// read gripper state
+				gripper_state_brush = brush_teleop_task->gripper_state;
+
+
+
+				if (brush_remote_enabled==1 && gripper_state_brush)
 				{
-					brush_teleop_task->setDeviceCenter(haptic_center_brush, brush_teleop_task->_current_rotation_device);
+					posori_tasks[1]->reInitializeTask();
+
 					brush_teleop_task->setRobotCenter(workspace_center_brush, posori_tasks[1]->_current_orientation);
+					brush_teleop_task->setDeviceCenter(haptic_center_brush, brush_teleop_task->_current_rotation_device);
+					passivity_controller_brush->reset();
 				
+					state_brush = HAPTIC_CONTROL;
 				}
-				Matrix3d desired_rotation_relative = Matrix3d::Identity();
-				brush_teleop_task->computeHapticCommands6d( posori_tasks[1]->_desired_position,
-																   posori_tasks[1]->_desired_orientation);
+				else if (brush_restart_cycle == 1)
+				{
+					// set joint controller to robot home position
+					joint_tasks[1]->reInitializeTask();
+					joint_tasks[1]->_desired_position = q_initial[1];
+					// set haptic device home position
+					brush_teleop_task->setDeviceCenter(haptic_center_brush, brush_teleop_task->_current_rotation_device);
 
+					state_brush = GOTO_INITIAL_CONFIG;
+				}
 			}
-			else //Only position control
+			else
 			{
-				brush_teleop_task->computeHapticCommands3d(posori_tasks[1]->_desired_position);
+				command_torques[1].setZero(dof[1]);
+				brush_teleop_task->GravityCompTask();
 			}
+			previous_gripper_state_brush = brush_teleop_task->gripper_state;
 
-			// compute robot set torques
-			posori_tasks[1]->computeTorques(posori_task_torques[1]);
-			joint_tasks[1]->computeTorques(joint_task_torques[1]);
+			// send to redis
+			command_force_device_plus_damping_brush = brush_teleop_task->_commanded_force_device + haptic_damping_force_passivity_brush;
 
-			command_torques[1] = joint_task_torques[1] + coriolis[1] + posori_task_torques[1];
+			if(controller_counter % 100 == 0)
+			{
+				cout << -sensed_force_brush_world_frame.transpose() << endl;
+				cout << endl;
+			}
+			// 
+			// command_force_device_plus_damping_brush.setZero();
+			redis_client.executeWriteCallback(0);
+			if(device_channel_brush != NULL)
+			{
+				device_channel_brush->sendCommands(command_force_device_plus_damping_brush, Vector3d::Zero(),
+						brush_teleop_task->_commanded_gripper_force_device, current_time, posori_tasks[1]->_sigma_force);
+			}
 
-			passivity_controller_brush->computePOPCForce(haptic_damping_force_passivity_brush);
+			prev_time = current_time;
 
-			if(remote_enabled == 0)
+			if(controller_counter % 1000 == 0)
 			{
-			// set joint controller to maintin robot in current position
-			joint_tasks[1]->reInitializeTask();
-			// joint_tasks[1]->_desired_position = robot[1]->_q;
-			// set current haptic device position
-			brush_teleop_task->setDeviceCenter(brush_teleop_task->_current_position_device, brush_teleop_task->_current_rotation_device);
-
-			state_brush = MAINTAIN_POSITION;
+				brush_loop_health.publish(redis_client, LOOP_HEALTH_KEYS[1]);
 			}
+
+			controller_counter++;
 		}
+	};
 
-		else if(state_brush == MAINTAIN_POSITION)
+	auto palette_loop = [&]()
+	{
+		PandaUtils::configureRealtimeThread("palette", PandaUtils::RealtimeConfig::fifo(80, {pair_cpus[0]}));
+		RedisClient& redis_client = redis_pool.client();
+		if(f_device_bundles)
 		{
-			// update robot home position task model
-			N_prec[1].setIdentity();
-			joint_tasks[1]->updateTaskModel(N_prec[1]);
-			// compute robot torques
-			joint_tasks[1]->computeTorques(joint_task_torques[1]);
-			command_torques[1] = joint_task_torques[1] + coriolis[1];
+			device_channel_palette = new PandaUtils::RedisHapticDevice(redis_client, 0);
+		}
 
-			// compute homing haptic device
-			brush_teleop_task->HomingTask();
+		int palette_restart_cycle = restart_cycle;
+		// the restart is cleared on redis once the brush took it
+		bool restart_pending = false;
 
-			// read gripper state
-			gripper_state_brush = brush_teleop_task->gripper_state;
+		// setup redis keys to be updated with the callback
+		redis_client.createReadCallback(0);
+		redis_client.createWriteCallback(0);
 
+		redis_client.addEigenToReadCallback(0, JOINT_ANGLES_KEYS[0], robots[0]->_q);
+		redis_client.addEigenToReadCallback(0, JOINT_VELOCITIES_KEYS[0], robots[0]->_dq);
+		// redis_client.addEigenToReadCallback(0, FORCE_SENSED_KEYS[0], f_sensed_palette);
+		if(device_channel_palette == NULL)
+		{
+			redis_client.addEigenToReadCallback(0, DEVICE_POSITION_KEYS[0], palette_teleop_task->_current_position_device);
+			redis_client.addEigenToReadCallback(0, DEVICE_ROTATION_KEYS[0], palette_teleop_task->_current_rotation_device);
+			redis_client.addEigenToReadCallback(0, DEVICE_TRANS_VELOCITY_KEYS[0], palette_teleop_task->_current_trans_velocity_device);
+			redis_client.addEigenToReadCallback(0, DEVICE_ROT_VELOCITY_KEYS[0], palette_teleop_task->_current_rot_velocity_device);
+			redis_client.addEigenToReadCallback(0, DEVICE_SENSED_FORCE_KEYS[0], palette_teleop_task->_sensed_force_device);
+			redis_client.addEigenToReadCallback(0, DEVICE_SENSED_TORQUE_KEYS[0], palette_teleop_task->_sensed_torque_device);
+			redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_POSITION_KEYS[0], palette_teleop_task->_current_position_gripper_device);
+			redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_VELOCITY_KEYS[0], palette_teleop_task->_current_gripper_velocity_device);
+		}
+		redis_client.addIntToReadCallback(0, RESTART_CYCLE_KEY, palette_restart_cycle);
+		if(!flag_simulation)
+		{
+			redis_client.addEigenToReadCallback(0, MASSMATRIX_KEYS[0], mass_from_robots[0]);
+			redis_client.addEigenToReadCallback(0, CORIOLIS_KEYS[0], coriolis_from_robots[0]);
+		}
 
+		redis_client.addEigenToWriteCallback(0, JOINT_TORQUES_COMMANDED_KEYS[0], command_torques[0]);
+		if(device_channel_palette == NULL)
+		{
+			redis_client.addEigenToWriteCallback(0, DEVICE_COMMANDED_FORCE_KEYS[0], command_force_device_plus_damping_palette);
+			redis_client.addDoubleToWriteCallback(0, DEVICE_COMMANDED_GRIPPER_FORCE_KEYS[0], palette_teleop_task->_commanded_gripper_force_device);
+		}
+
+		unsigned long long controller_counter = 0;
+		double current_time = 0;
+		palette_timer.initializeTimer(start_barrier.wait());
+		double start_time = palette_timer.elapsedTime(); //secs
 
-			if (remote_enabled==1 && gripper_state_brush)
+		while (runloop) {
+			// wait for next scheduled loop
+			palette_loop_health.waitForNextLoop(palette_timer);
+			current_time = palette_timer.elapsedTime() - start_time;
+
+			redis_client.executeReadCallback(0);
+			if(device_channel_palette != NULL)
 			{
-				posori_tasks[1]->reInitializeTask();
+				device_channel_palette->readDevice(*palette_teleop_task);
+			}
 
-				brush_teleop_task->setRobotCenter(workspace_center_brush, posori_tasks[1]->_current_orientation);
-				brush_teleop_task->setDeviceCenter(haptic_center_brush, brush_teleop_task->_current_rotation_device);
-				
-				state_brush = HAPTIC_CONTROL;
+			// update model
+			if(flag_simulation)
+			{
+				robots[0]->updateModel();
+				robots[0]->coriolisForce(coriolis[0]);
 			}
-			else if (restart_cycle == 1)
+			else
 			{
-				// set joint controller to robot home position
-				joint_tasks[1]->reInitializeTask();
-				joint_tasks[1]->_desired_position = q_initial[1];
-				// set haptic device home position
-				brush_teleop_task->setDeviceCenter(haptic_center_brush, brush_teleop_task->_current_rotation_device);
+				robots[0]->updateKinematics();
+				robots[0]->_M = mass_from_robots[0];
+				mass_matrix_inverses[0]->update(robots[0]);
+				coriolis[0] = coriolis_from_robots[0];
+			}
 
-				state_brush = GOTO_INITIAL_CONFIG;
+			// f_sensed_palette -= force_bias_global_palette; 
+			// Matrix3d R_sensor_palette = Matrix3d::Identity();
+			// robots[0]->rotation(R_sensor_palette, "link7");
+			// Vector3d p_tool_sensorFrame_palette = hand_palette_mass * R_sensor_palette.transpose() * Vector3d(0,0,-9.81); 
+			// f_sensed_palette.head(3) += p_tool_sensorFrame_palette;
+			// f_sensed_palette.tail(3) += hand_palette_com.cross(p_tool_sensorFrame_palette);
+			// posori_tasks[0]->updateSensedForceAndMoment(f_sensed_palette.head(3), f_sensed_palette.tail(3));
+			// VectorXd sensed_force_palette_world_frame = VectorXd::Zero(6);
+			// sensed_force_palette_world_frame << posori_tasks[0]->_sensed_force, posori_tasks[0]->_sensed_moment;
+			// palette_teleop_task->updateSensedForce(-sensed_force_palette_world_frame);
+
+			if(stroke_capture != NULL)
+			{
+				Vector3d palette_position = Vector3d::Zero();
+				robots[0]->position(palette_position, "link7", tool_in_link);
+				palette_position_buffer.write(robot_pose_in_world[0] * palette_position);
 			}
-		}
-		else
-		{
-			command_torques[1].setZero(dof[1]);
-			brush_teleop_task->GravityCompTask();
-		}
-		previous_gripper_state_brush = brush_teleop_task->gripper_state;
+
+			palette_teleop_task->UseGripperAsSwitch();
 
 ///////////////////////////////////////////////////////////////////////////////////////////
-		//// State Machine Robot 0 - Haptic Palette ////
-		if(state_palette == GOTO_INITIAL_CONFIG)
-		{
-			// update robot home position task model
-			N_prec[0].setIdentity();
-			joint_tasks[0]->updateTaskModel(N_prec[0]);
-			// compute robot torques
-			joint_tasks[0]->computeTorques(joint_task_torques[0]);
-			command_torques[0] = joint_task_torques[0] + coriolis[0];
+			//// State Machine Robot 0 - Haptic Palette ////
+			if(state_palette == GOTO_INITIAL_CONFIG)
+			{
+				// update robot home position task model
+				N_prec[0].setIdentity();
+				joint_tasks[0]->updateTaskModel(N_prec[0]);
+				// compute robot torques
+				joint_tasks[0]->computeTorques(joint_task_torques[0]);
+				command_torques[0] = joint_task_torques[0] + coriolis[0];
 			
-			// compute homing haptic device
-			palette_teleop_task->HomingTask();
+				// compute homing haptic device
+				palette_teleop_task->HomingTask();
 
-			// read gripper state
-			gripper_state_palette = palette_teleop_task->gripper_state;
+				// read gripper state
+				gripper_state_palette = palette_teleop_task->gripper_state;
 
-			if((joint_tasks[0]->_desired_position - joint_tasks[0]->_current_position).norm() < 0.2 && palette_teleop_task->device_homed && gripper_state_palette)
-			{
-				joint_tasks[0]->_ki = 0;
-				posori_tasks[0]->reInitializeTask();
-				workspace_center_palette = posori_tasks[0]->_current_position;
-				haptic_center_palette = palette_teleop_task->_current_position_device;
-
-				passivity_controller_brush->reInitializeTask();
+				if((joint_tasks[0]->_desired_position - joint_tasks[0]->_current_position).norm() < 0.2 && palette_teleop_task->device_homed && gripper_state_palette)
+				{
+					joint_tasks[0]->_ki = 0;
+					posori_tasks[0]->reInitializeTask();
+					workspace_center_palette = posori_tasks[0]->_current_position;
+					haptic_center_palette = palette_teleop_task->_current_position_device;
 
-				palette_teleop_task->setRobotCenter(workspace_center_palette, posori_tasks[0]->_current_orientation);
-				palette_teleop_task->setDeviceCenter(haptic_center_palette, palette_teleop_task->_current_rotation_device);
+					palette_teleop_task->setRobotCenter(workspace_center_palette, posori_tasks[0]->_current_orientation);
+					palette_teleop_task->setDeviceCenter(haptic_center_palette, palette_teleop_task->_current_rotation_device);
 				
-				state_palette = HAPTIC_CONTROL;
+					state_palette = HAPTIC_CONTROL;
+				}
 			}
-		}
 
-		else if(state_palette == HAPTIC_CONTROL)
-		{
+			else if(state_palette == HAPTIC_CONTROL)
+			{
 
-			// update tasks model
-			N_prec[0].setIdentity();
-			posori_tasks[0]->updateTaskModel(N_prec[0]);
-			N_prec[0] = posori_tasks[0]->_N;
-			joint_tasks[0]->updateTaskModel(N_prec[0]);
+				// update tasks model
+				N_prec[0].setIdentity();
+				posori_tasks[0]->updateTaskModel(N_prec[0]);
+				N_prec[0] = posori_tasks[0]->_N;
+				joint_tasks[0]->updateTaskModel(N_prec[0]);
 
-			//compute haptic commands (only position control) - without force feedback (force_sensed=0)
-			palette_teleop_task->computeHapticCommands3d(posori_tasks[0]->_desired_position);
+				//compute haptic commands (only position control) - without force feedback (force_sensed=0)
+				palette_teleop_task->computeHapticCommands3d(posori_tasks[0]->_desired_position);
 
-			// compute robot set torques
-			posori_tasks[0]->computeTorques(posori_task_torques[0]);
-			joint_tasks[0]->computeTorques(joint_task_torques[0]);
+				// compute robot set torques
+				posori_tasks[0]->computeTorques(posori_task_torques[0]);
+				joint_tasks[0]->computeTorques(joint_task_torques[0]);
 
-			command_torques[0] = joint_task_torques[0] + coriolis[0] + posori_task_torques[0];
+				command_torques[0] = joint_task_torques[0] + coriolis[0] + posori_task_torques[0];
 
 
-			// read gripper state
-			gripper_state_palette = palette_teleop_task->gripper_state;
+				// read gripper state
+				gripper_state_palette = palette_teleop_task->gripper_state;
 
-			if(!gripper_state_palette)
-			{
-			// set joint controller to maintin robot in current position
-			joint_tasks[0]->reInitializeTask();
-			// joint_tasks[0]->_desired_position = robot[0]->_q;
-			// set current haptic device position
-			palette_teleop_task->setDeviceCenter(palette_teleop_task->_current_position_device, palette_teleop_task->_current_rotation_device);
+				if(!gripper_state_palette)
+				{
+				// set joint controller to maintin robot in current position
+				joint_tasks[0]->reInitializeTask();
+				// joint_tasks[0]->_desired_position = robot[0]->_q;
+				// set current haptic device position
+				palette_teleop_task->setDeviceCenter(palette_teleop_task->_current_position_device, palette_teleop_task->_current_rotation_device);
 
-			state_palette = MAINTAIN_POSITION;
+				state_palette = MAINTAIN_POSITION;
+				}
 			}
-		}
 
-		else if(state_palette == MAINTAIN_POSITION)
-		{
-			// update robot home position task model
-			N_prec[0].setIdentity();
-			joint_tasks[0]->updateTaskModel(N_prec[0]);
-			// compute robot torques
-			joint_tasks[0]->computeTorques(joint_task_torques[0]);
-			command_torques[0] = joint_task_torques[0] + coriolis[0];
+			else if(state_palette == MAINTAIN_POSITION)
+			{
+				// update robot home position task model
+				N_prec[0].setIdentity();
+				joint_tasks[0]->updateTaskModel(N_prec[0]);
+				// compute robot torques
+				joint_tasks[0]->computeTorques(joint_task_torques[0]);
+				command_torques[0] = joint_task_torques[0] + coriolis[0];
 
-			// compute homing haptic device
-			palette_teleop_task->HomingTask();
+				// compute homing haptic device
+				palette_teleop_task->HomingTask();
 
-			// read gripper state
-			gripper_state_palette = palette_teleop_task->gripper_state;
+				// read gripper state
+				gripper_state_palette = palette_teleop_task->gripper_state;
 
-			if (gripper_state_palette)
-			{
-				posori_tasks[0]->reInitializeTask();
+				if (gripper_state_palette)
+				{
+					posori_tasks[0]->reInitializeTask();
 
-				palette_teleop_task->setRobotCenter(workspace_center_palette, posori_tasks[0]->_current_orientation);
-				palette_teleop_task->setDeviceCenter(haptic_center_palette, palette_teleop_task->_current_rotation_device);
+					palette_teleop_task->setRobotCenter(workspace_center_palette, posori_tasks[0]->_current_orientation);
+					palette_teleop_task->setDeviceCenter(haptic_center_palette, palette_teleop_task->_current_rotation_device);
 				
-				state_palette = HAPTIC_CONTROL;
+					state_palette = HAPTIC_CONTROL;
+				}
+				else if (palette_restart_cycle == 1)
+				{
+					// set joint controller to robot home position
+					joint_tasks[0]->reInitializeTask();
+					joint_tasks[0]->_desired_position = q_initial[0];
+					// set haptic device home position
+					palette_teleop_task->setDeviceCenter(haptic_center_palette, palette_teleop_task->_current_rotation_device);
+
+					restart_pending = true;
+
+					state_palette = GOTO_INITIAL_CONFIG;
+				}
 			}
-			else if (restart_cycle == 1)
+			else
 			{
-				// set joint controller to robot home position
-				joint_tasks[0]->reInitializeTask();
-				joint_tasks[0]->_desired_position = q_initial[0];
-				// set haptic device home position
-				palette_teleop_task->setDeviceCenter(haptic_center_palette, palette_teleop_task->_current_rotation_device);
+				command_torques[0].setZero(dof[0]);
+				palette_teleop_task->GravityCompTask();
 
-				remote_enabled = 1;
-				restart_cycle = 0;
-				redis_client.set(REMOTE_ENABLED_KEY, to_string(remote_enabled));
-				redis_client.set(RESTART_CYCLE_KEY, to_string(restart_cycle));
+			}
+///////////////////////////////////////////////////////////////////////////////////////////
 
-				state_palette = GOTO_INITIAL_CONFIG;
+			// the brush takes the restart in MAINTAIN_POSITION, it is cleared once it left it
+			if(restart_pending && state_brush != MAINTAIN_POSITION)
+			{
+				redis_client.set(REMOTE_ENABLED_KEY, "1");
+				redis_client.set(RESTART_CYCLE_KEY, "0");
+				restart_pending = false;
 			}
-		}
-		else
-		{
-			command_torques[0].setZero(dof[0]);
-			brush_teleop_task->GravityCompTask();
 
-		}
-///////////////////////////////////////////////////////////////////////////////////////////
+			// send to redis
+			command_force_device_plus_damping_palette = palette_teleop_task->_commanded_force_device;
+			// command_force_device_plus_damping_palette.setZero();
+			redis_client.executeWriteCallback(0);
+			if(device_channel_palette != NULL)
+			{
+				// the palette device has no torque command
+				device_channel_palette->sendCommands(command_force_device_plus_damping_palette, Vector3d::Zero(),
+						palette_teleop_task->_commanded_gripper_force_device, current_time, posori_tasks[0]->_sigma_force);
+			}
 
-		
+			if(controller_counter % 1000 == 0)
+			{
+				palette_loop_health.publish(redis_client, LOOP_HEALTH_KEYS[0]);
+			}
 
-		// send to redis
-		command_force_device_plus_damping_brush = brush_teleop_task->_commanded_force_device + haptic_damping_force_passivity_brush;
-		command_force_device_plus_damping_palette = palette_teleop_task->_commanded_force_device;
-		
-		if(controller_counter % 100 == 0)
-		{
-			cout << -sensed_force_brush_world_frame.transpose() << endl;
-			cout << endl;
+			controller_counter++;
 		}
-		// 
-		// command_force_device_plus_damping_brush.setZero();
-		// command_force_device_plus_damping_palette.setZero();
-		redis_client.executeWriteCallback(0);
+	};
 
-		prev_time = current_time;
-		controller_counter++;
+	thread palette_thread(palette_loop);
+	thread brush_thread(brush_loop);
+	palette_thread.join();
+	brush_thread.join();
+	if(stroke_capture != NULL)
+	{
+		delete stroke_capture;
 	}
 
 	for(int i=0 ; i<n_robots ; i++)
@@ -809,12 +1010,30 @@ int main() {
 		command_torques[i].setZero();
 		redis_client.setEigenMatrixJSON(JOINT_TORQUES_COMMANDED_KEYS[i], command_torques[i]);
 	}
+	if(device_channel_palette != NULL)
+	{
+		device_channel_palette->sendCommands(Vector3d::Zero(), Vector3d::Zero(), 0, palette_timer.elapsedTime());
+		cout << "haptic device channel palette : " << device_channel_palette->summary() << endl;
+		delete device_channel_palette;
+	}
+	if(device_channel_brush != NULL)
+	{
+		device_channel_brush->sendCommands(Vector3d::Zero(), Vector3d::Zero(), 0, brush_timer.elapsedTime());
+		cout << "haptic device channel brush : " << device_channel_brush->summary() << endl;
+		delete device_channel_brush;
+	}
 
-	double end_time = timer.elapsedTime();
+	double end_time = palette_timer.elapsedTime();
 	std::cout << "\n";
 	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
-	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
-    std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+	std::cout << "Palette Loop updates      : " << palette_timer.elapsedCycles() << "\n";
+	std::cout << "Palette Loop frequency    : " << palette_timer.elapsedCycles()/end_time << "Hz\n";
+	std::cout << "Brush Loop updates        : " << brush_timer.elapsedCycles() << "\n";
+	std::cout << "Brush Loop frequency      : " << brush_timer.elapsedCycles()/end_time << "Hz\n";
+	std::cout << "palette loop :\n";
+	palette_loop_health.print(std::cout);
+	std::cout << "brush loop :\n";
+	brush_loop_health.print(std::cout);
 
 	return 0;
 }
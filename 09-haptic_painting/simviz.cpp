@@ -9,7 +9,8 @@
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
 
-#include "force_sensor/ForceSensorSim.h" 
+#include "sim/SimForceSensorBank.h"
+#include "threads/RealtimeThread.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
 
@@ -313,12 +314,13 @@ void simulation(vector<Sai2Model::Sai2Model*> robots, Simulation::Sai2Simulation
 	string link_name = "link7";
 	Affine3d transform_in_link = Affine3d::Identity();
 	transform_in_link.translation() = Vector3d(0.0,0.0,0.12);
-	auto force_sensor_right = new ForceSensorSim(robot_names[0], link_name, transform_in_link, robots[0]);
+	auto force_sensors = new PandaUtils::SimForceSensorBank();
+	const int force_sensor_right = force_sensors->addSensor(robot_names[0], link_name, transform_in_link, robots[0]);
 	VectorXd f_sensed_right = VectorXd::Zero(6);
 	Vector3d sensed_force_right = Vector3d::Zero();
 	Vector3d sensed_moment_right = Vector3d::Zero();
 
-	auto force_sensor_left = new ForceSensorSim(robot_names[1], link_name, transform_in_link, robots[1]);
+	const int force_sensor_left = force_sensors->addSensor(robot_names[1], link_name, transform_in_link, robots[1]);
 	VectorXd f_sensed_left = VectorXd::Zero(6);
 	Vector3d sensed_force_left = Vector3d::Zero();
 	Vector3d sensed_moment_left = Vector3d::Zero();
@@ -333,6 +335,8 @@ void simulation(vector<Sai2Model::Sai2Model*> robots, Simulation::Sai2Simulation
 
 	unsigned long long simulation_counter = 0;
 
+	PandaUtils::configureRealtimeThread("simulation", PandaUtils::RealtimeConfig::fifo(70, PandaUtils::simulationCpus()));
+
 	while (fSimulationRunning) {
 		fTimerDidSleep = timer.waitForNextLoop();
 
@@ -385,14 +389,13 @@ void simulation(vector<Sai2Model::Sai2Model*> robots, Simulation::Sai2Simulation
 		redis_client.set(TIMESTAMP_KEY, to_string(curr_time));
 
 		// read end-effector task forces from the force sensor simulation
-		force_sensor_right->update(sim);
-		force_sensor_right->getForceLocalFrame(sensed_force_right);
-		force_sensor_right->getMomentLocalFrame(sensed_moment_right);
+		force_sensors->update(sim);
+		force_sensors->getForceLocalFrame(force_sensor_right, sensed_force_right);
+		force_sensors->getMomentLocalFrame(force_sensor_right, sensed_moment_right);
 		f_sensed_right << sensed_force_right, sensed_moment_right;
 
-		force_sensor_left->update(sim);
-		force_sensor_left->getForceLocalFrame(sensed_force_left);
-		force_sensor_left->getMomentLocalFrame(sensed_moment_left);
+		force_sensors->getForceLocalFrame(force_sensor_left, sensed_force_left);
+		force_sensors->getMomentLocalFrame(force_sensor_left, sensed_moment_left);
 		f_sensed_left << sensed_force_left, sensed_moment_left;
 
 		// write task force in redis
@@ -5,13 +5,17 @@
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
+#include "timer/LoopHealth.h"
+#include "threads/RealtimeThread.h"
 #include "tasks/JointTask.h"
 #include "tasks/PosOriTask.h"
 #include "haptic_tasks/OpenLoopTeleop.h"
+#include "model/MassMatrixInverse.h"
+#include "trajectories/StrokeStreamer.h"
+#include "force_control/SensorCalibration.h"
 
 #include <iostream>
 #include <string>
-#include <tinyxml2.h>
 
 #include <signal.h>
 bool runloop = true;
@@ -45,6 +49,7 @@ vector<string> FORCE_SENSED_KEYS = {
 
 const string REMOTE_ENABLED_KEY = "sai2::WarehouseSimulation::sensors::remote_enabled";
 const string RESTART_CYCLE_KEY = "sai2::WarehouseSimulation::sensors::restart_cycle";
+const string LOOP_HEALTH_KEY = "sai2::WarehouseSimulation::controller::loop_health";
 
 // - write
 vector<string> JOINT_TORQUES_COMMANDED_KEYS = {
@@ -72,7 +77,6 @@ vector<string> ROBOT_GRAVITY_KEYS =
 };
 
 
-VectorXd readBiasXML(const string path_to_bias_file);
 // void readObjectMassAndCMXml(double object_mass, Vector3d object_com, const string file_name, const string tool_name);
 
 const string bias_file = "../../00-force_sensor_calibration/calibration_files/Clyde_fsensor_bias.xml";
@@ -87,6 +91,7 @@ const bool inertia_regularization = true;
 #define GOTO_INITIAL_CONFIG               0
 #define HAPTIC_CONTROL                    1
 #define MAINTAIN_POSITION				  2
+#define AUTONOMOUS_PAINTING               3
 
 int translation_counter = 0;
 
@@ -99,8 +104,30 @@ unsigned long long controller_counter = 0;
 
 RedisClient redis_client;
 
-int main() {
+int main(int argc, char** argv) {
 
+	// controller10 [--strokes plan.strokes [--stroke-speed-scale 2]] paints the strokes of the
+	// file once in the initial configuration, instead of the haptic control, at their speed
+	// times the scale. a session captured by controller09 --capture-strokes is a strokes file
+	string strokes_file = "";
+	PandaUtils::StrokeStreamer::Limits stroke_limits;
+	for(int i=1 ; i<argc ; i++)
+	{
+		if(string(argv[i]) == "--strokes" && i+1 < argc)
+		{
+			strokes_file = argv[++i];
+		}
+		else if(string(argv[i]) == "--stroke-speed-scale" && i+1 < argc)
+		{
+			stroke_limits.speed_scale = stod(argv[++i]);
+		}
+	}
+	if(!(stroke_limits.speed_scale > 0))
+	{
+		cout << "the stroke speed scale should be positive" << endl;
+		return 1;
+	}
+	PandaUtils::StrokeStreamer* stroke_streamer = NULL;
 
 	if(!flag_simulation)
 	{
@@ -155,6 +182,7 @@ int main() {
 
 	// prepare robot task controllers
 	vector<int> dof;
+	vector<PandaUtils::MassMatrixInverse<7>*> mass_matrix_inverses;
 	vector<VectorXd> command_torques;
 	vector<VectorXd> coriolis;
 	vector<MatrixXd> N_prec;
@@ -183,6 +211,7 @@ int main() {
 	for(int i=0 ; i<n_robots ; i++)
 	{
 		dof.push_back(robots[i]->dof());
+		mass_matrix_inverses.push_back(new PandaUtils::MassMatrixInverse<7>(dof[i], inertia_regularization ? 0.07 : 0.0));
 		command_torques.push_back(VectorXd::Zero(dof[i]));
 		coriolis.push_back(VectorXd::Zero(dof[i]));
 		N_prec.push_back(MatrixXd::Identity(dof[i],dof[i]));
@@ -284,7 +313,15 @@ int main() {
 	Vector3d hand_com = Vector3d::Zero();
 	if(!flag_simulation)
 	{
-		force_bias_global = readBiasXML(bias_file);
+		PandaUtils::SensorCalibration sensor_calibration;
+		if(sensor_calibration.load(bias_file))
+		{
+			force_bias_global = sensor_calibration.bias();
+		}
+		else
+		{
+			cout << "WARNING : " << sensor_calibration.error() << endl;
+		}
 		// force_bias_global << -2.51441,   -3.43109 ,  -133.635,  -0.228287,    1.71627, -0.0227359;
 		// hand_mass = 1.47791;
 		// hand_com = Vector3d(0.0166211, 0.0218277,  0.119471);
@@ -320,17 +357,18 @@ int main() {
 	LoopTimer timer;
 	timer.initializeTimer();
 	timer.setLoopFrequency(1000); 
+	PandaUtils::LoopHealth loop_health(1000);
+	PandaUtils::configureRealtimeThread("controller", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
 	double current_time = 0;
 	double prev_time = 0;
 	double dt = 0;
-	bool fTimerDidSleep = true;
 	double start_time = timer.elapsedTime(); //secs
 
 
 
 	while (runloop) {
 		// wait for next scheduled loop
-		timer.waitForNextLoop();
+		loop_health.waitForNextLoop(timer);
 		current_time = timer.elapsedTime() - start_time;
 		dt = current_time - prev_time;
 
@@ -350,13 +388,7 @@ int main() {
 			{
 				robots[i]->updateKinematics();
 				robots[i]->_M = redis_client.getEigenMatrixJSON(MASSMATRIX_KEYS[i]);
-				if(inertia_regularization)
-				{
-					robots[i]->_M(4,4) += 0.07;
-					robots[i]->_M(5,5) += 0.07;
-					robots[i]->_M(6,6) += 0.07;
-				}
-				robots[i]->_M_inv = robots[i]->_M.inverse();
+				mass_matrix_inverses[i]->update(robots[i]);
 
 				coriolis[i] = redis_client.getEigenMatrixJSON(CORIOLIS_KEYS[i]);
 			}
@@ -403,7 +435,21 @@ int main() {
 
 			// cout << "left robot error : " << (joint_tasks[0]->_desired_position - joint_tasks[0]->_current_position).norm() << endl;
 
-			if(remote_enabled==1 && (joint_tasks[0]->_desired_position - joint_tasks[0]->_current_position).norm() < 0.2 && haptic_controller_brush->device_homed && gripper_state_brush)
+			if(stroke_streamer == NULL && strokes_file != "" && remote_enabled==1 && (joint_tasks[0]->_desired_position - joint_tasks[0]->_current_position).norm() < 0.2)
+			{
+				joint_tasks[0]->_ki = 0;
+				posori_tasks[0]->reInitializeTask();
+				// the setpoints carry the velocity, that the saturation would ignore
+				posori_tasks[0]->_use_velocity_saturation_flag = false;
+
+				// the strokes are in world frame, the setpoints in the robot frame
+				stroke_streamer = new PandaUtils::StrokeStreamer(strokes_file, 0.001, robot_pose_in_world[0].inverse(), stroke_limits);
+				stroke_streamer->start(posori_tasks[0]->_current_position, posori_tasks[0]->_current_orientation);
+				cout << "painting " << stroke_streamer->numStrokes() << " strokes of " << strokes_file << endl;
+
+				state_brush = AUTONOMOUS_PAINTING;
+			}
+			else if(strokes_file == "" && remote_enabled==1 && (joint_tasks[0]->_desired_position - joint_tasks[0]->_current_position).norm() < 0.2 && haptic_controller_brush->device_homed && gripper_state_brush)
 			{
 				joint_tasks[0]->_ki = 0;
 				posori_tasks[0]->reInitializeTask();
@@ -488,6 +534,54 @@ int main() {
 			}
 		}
 
+		else if(state_brush == AUTONOMOUS_PAINTING)
+		{
+			// update tasks model
+			N_prec[0].setIdentity();
+			posori_tasks[0]->updateTaskModel(N_prec[0]);
+			N_prec[0] = posori_tasks[0]->_N;
+			joint_tasks[0]->updateTaskModel(N_prec[0]);
+
+			// setpoints prepared by the reader thread, the last one is kept on an underrun
+			PandaUtils::PaintingSetpoint setpoint;
+			if(stroke_streamer->next(setpoint))
+			{
+				posori_tasks[0]->_desired_position = setpoint.position;
+				posori_tasks[0]->_desired_orientation = setpoint.orientation;
+				posori_tasks[0]->_desired_velocity = setpoint.velocity;
+				posori_tasks[0]->_desired_angular_velocity = setpoint.angular_velocity;
+				posori_tasks[0]->_desired_acceleration = setpoint.acceleration;
+				posori_tasks[0]->_desired_angular_acceleration = setpoint.angular_acceleration;
+			}
+			else
+			{
+				posori_tasks[0]->_desired_velocity.setZero();
+				posori_tasks[0]->_desired_angular_velocity.setZero();
+				posori_tasks[0]->_desired_acceleration.setZero();
+				posori_tasks[0]->_desired_angular_acceleration.setZero();
+			}
+
+			// compute robot set torques
+			posori_tasks[0]->computeTorques(posori_task_torques[0]);
+			joint_tasks[0]->computeTorques(joint_task_torques[0]);
+
+			command_torques[0] = joint_task_torques[0] + coriolis[0] + posori_task_torques[0];
+
+			// keep the haptic device parked
+			haptic_controller_brush->HomingTask();
+
+			if(stroke_streamer->finished() || remote_enabled == 0)
+			{
+				cout << "painting " << (stroke_streamer->finished() ? "done" : "interrupted") << " at stroke " << stroke_streamer->currentStroke()
+					<< ", " << stroke_streamer->numUnderruns() << " setpoint underruns" << endl;
+				stroke_streamer->stop();
+				posori_tasks[0]->_use_velocity_saturation_flag = true;
+				joint_tasks[0]->reInitializeTask();
+
+				state_brush = MAINTAIN_POSITION;
+			}
+		}
+
 		else if(state_brush == MAINTAIN_POSITION)
 		{
 			// update robot home position task model
@@ -503,7 +597,7 @@ int main() {
 			// read gripper state
 			gripper_state_brush = haptic_controller_brush->ReadGripperUserSwitch();
 
-			if (remote_enabled==1 && gripper_state_brush)
+			if (strokes_file == "" && remote_enabled==1 && gripper_state_brush)
 			{
 				posori_tasks[0]->reInitializeTask();
 
@@ -539,6 +633,12 @@ int main() {
 		}
 
 		prev_time = current_time;
+
+		if(controller_counter % 1000 == 0)
+		{
+			loop_health.publish(redis_client, LOOP_HEALTH_KEY);
+		}
+
 		controller_counter++;
 	}
 
@@ -548,52 +648,18 @@ int main() {
 		redis_client.setEigenMatrixJSON(JOINT_TORQUES_COMMANDED_KEYS[i], command_torques[i]);
 	}
 	delete haptic_controller_brush;
+	delete stroke_streamer;
 
 	double end_time = timer.elapsedTime();
 	std::cout << "\n";
 	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
 	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
     std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+    loop_health.print(std::cout);
 
 	return 0;
 }
 
-VectorXd readBiasXML(const string path_to_bias_file)
-{
-	VectorXd sensor_bias = VectorXd::Zero(6);
-	tinyxml2::XMLDocument doc;
-	doc.LoadFile(path_to_bias_file.c_str());
-	if (!doc.Error())
-	{
-		cout << "Loading bias file file ["+path_to_bias_file+"]." << endl;
-		try 
-		{
-
-			std::stringstream bias( doc.FirstChildElement("force_bias")->
-				Attribute("value"));
-			bias >> sensor_bias(0);
-			bias >> sensor_bias(1);
-			bias >> sensor_bias(2);
-			bias >> sensor_bias(3);
-			bias >> sensor_bias(4);
-			bias >> sensor_bias(5);
-			std::stringstream ss; ss << sensor_bias.transpose();
-			cout << "Sensor bias : "+ss.str() << endl;
-		}
-		catch( const std::exception& e ) // reference to the base of a polymorphic object
-		{ 
-			std::cout << e.what(); // information from length_error printed
-			cout << "WARNING : Failed to parse bias file." << endl;
-		}
-	} 
-	else 
-	{
-		cout << "WARNING : Could no load bias file ["+path_to_bias_file+"]" << endl;
-		doc.PrintError();
-	}
-	return sensor_bias;
-}
-
 // void readObjectMassAndCMXml(double object_mass, Vector3d object_com, const string file_name, const string tool_name)
 // {
 // 	tinyxml2::XMLDocument doc;
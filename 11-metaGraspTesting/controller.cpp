@@ -5,11 +5,15 @@
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
+#include "timer/LoopHealth.h"
+#include "threads/RealtimeThread.h"
 #include "filters/ButterworthFilter.h"
 #include "tasks/JointTask.h"
 #include "tasks/PosOriTask.h"
 #include "tasks/PositionTask.h"
 #include "tasks/OrientationTask.h"
+#include "model/MassMatrixInverse.h"
+#include "timer/IdleScheduler.h"
 
 #include <iostream>
 #include <string>
@@ -59,6 +63,8 @@ const string DESIRED_ORI_KEY = "sai2::PandaApplication::controller::desired_orie
 
 const string DSIRED_POS_IN_CAMERA_FRAME_KEY = "sai2::PandaApplication::controller::desired_pos_in_camera_frame";
 const string DSIRED_ROT_IN_CAMERA_FRAME_KEY = "sai2::PandaApplication::controller::desired_rot_in_camera_frame";
+// best grasp candidates of evaluate_grasps11 not tried yet, 15 values each (position, row major rotation and normal in camera frame)
+const string RANKED_GRASP_CANDIDATES_IN_CAMERA_FRAME_KEY = "sai2::PandaApplication::controller::ranked_grasp_candidates_in_camera_frame";
 
 const string GO_TO_INITIAL_KEY = "sai2::PandaApplication::controller::go_to_initial_pos";
 
@@ -66,6 +72,7 @@ const string SVH_HAND_COMMAND_POSITIONS_KEY = "sai2::SVHHand_Right::position_com
 const string SVH_RECEIVED_POSITION_KEY = "sai2::PandaApplication::controller::SVH_position_command";
 const string SVH_CURRENT_KEY = "sai2::SVHHand_Right::current";
 const string SVH_POSITIONS_KEY = "sai2::SVHHand_Right::position";
+const string LOOP_HEALTH_KEY = "sai2::PandaApplication::controller::loop_health";
 
 
 unsigned long long controller_counter = 0;
@@ -146,6 +153,7 @@ int main() {
 
 	// prepare controller	
 	int dof = robot->dof();
+	PandaUtils::MassMatrixInverse<7> mass_matrix_inverse(dof);
 	VectorXd command_torques = VectorXd::Zero(dof);
 	VectorXd coriolis = VectorXd::Zero(dof);
 	MatrixXd N_prec = MatrixXd::Identity(dof, dof);
@@ -267,15 +275,21 @@ int main() {
 	LoopTimer timer;
 	timer.initializeTimer();
 	timer.setLoopFrequency(1000); 
+	PandaUtils::LoopHealth loop_health(1000);
+	PandaUtils::configureRealtimeThread("controller", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
 	double current_time = 0;
 	double prev_time = 0;
 	double dt = 0;
-	bool fTimerDidSleep = true;
 	double start_time = timer.elapsedTime(); //secs
 
+	// the model and the task models at 50 Hz while the robot waits (for the camera, in the
+	// initial configuration), at every tick as soon as it moves or gets a new command
+	PandaUtils::IdleScheduler idle_scheduler(20);
+	VectorXd idle_command = VectorXd::Zero(1 + 3 + 9 + dof);
+
 	while (runloop) {
 		// wait for next scheduled loop
-		timer.waitForNextLoop();
+		loop_health.waitForNextLoop(timer);
 		current_time = timer.elapsedTime() - start_time;
 		dt = current_time - prev_time;
 
@@ -283,8 +297,18 @@ int main() {
 		robot->_q = redis_client.getEigenMatrixJSON(JOINT_ANGLES_KEY);
 		robot->_dq = redis_client.getEigenMatrixJSON(JOINT_VELOCITIES_KEY);
 
+		// commands of the previous tick
+		idle_command << state, posori_task->_desired_position,
+				Map<const Matrix<double, 9, 1>>(posori_task->_desired_orientation.data()), joint_task->_desired_position;
+		const bool f_model_update = idle_scheduler.update(robot->_dq, idle_command);
+
 		// update robot model
-		if(flag_simulation)
+		if(!f_model_update)
+		{
+			// the torques of this tick from the cached model terms
+			robot->updateKinematics();
+		}
+		else if(flag_simulation)
 		{
 			robot->updateModel();
 			robot->coriolisForce(coriolis);
@@ -293,18 +317,21 @@ int main() {
 		{
 			robot->updateKinematics();
 			robot->_M = redis_client.getEigenMatrixJSON(MASSMATRIX_KEY);
-			robot->_M_inv = robot->_M.inverse();
+			mass_matrix_inverse.update(robot);
 
 			coriolis = redis_client.getEigenMatrixJSON(CORIOLIS_KEY);
 		}
 
 		// update tasks models
-		N_prec.setIdentity();
-		posori_task->updateTaskModel(N_prec);
-		// N_prec = pos_task->_N;
-		// ori_task->updateTaskModel(N_prec);
-		N_prec = posori_task->_N;
-		joint_task->updateTaskModel(N_prec);
+		if(f_model_update)
+		{
+			N_prec.setIdentity();
+			posori_task->updateTaskModel(N_prec);
+			// N_prec = pos_task->_N;
+			// ori_task->updateTaskModel(N_prec);
+			N_prec = posori_task->_N;
+			joint_task->updateTaskModel(N_prec);
+		}
 
 
 		if(state == DEBUG)
@@ -334,9 +361,13 @@ int main() {
 			// redis_client.setEigenMatrixJSON(SVH_HAND_COMMAND_POSITIONS_KEY, SVH_desired_positions);
 
 
-			for(int i=3 ; i<6 ; i++)
+			// on the Lambda of an update only, the skipped ticks keep the regularized one
+			if(f_model_update)
 			{
-				posori_task->_Lambda(i,i) += 0.1;
+				for(int i=3 ; i<6 ; i++)
+				{
+					posori_task->_Lambda(i,i) += 0.1;
+				}
 			}
 			// posori_task->_desired_orientation = debug_ori;
 
@@ -351,8 +382,11 @@ int main() {
 			redis_client.setEigenMatrixJSON(SVH_HAND_COMMAND_POSITIONS_KEY, svh_init_config);
 
 
-			N_prec.setIdentity();
-			joint_task->updateTaskModel(N_prec);
+			if(f_model_update)
+			{
+				N_prec.setIdentity();
+				joint_task->updateTaskModel(N_prec);
+			}
 
 			joint_task->_desired_position = q_init;
 
@@ -363,9 +397,12 @@ int main() {
 			// posori_task->_desired_position = init_config_position;
 			// posori_task->_desired_orientation = init_config_orientation;
 
-			for(int i=4 ; i<7 ; i++)
+			if(f_model_update)
 			{
-				robot->_M(i,i) += 0.1;
+				for(int i=4 ; i<7 ; i++)
+				{
+					robot->_M(i,i) += 0.1;
+				}
 			}
 
 			joint_task->computeTorques(joint_task_torques);
@@ -397,9 +434,12 @@ int main() {
 			Matrix3d desired_rot_in_camera_frame = redis_client.getEigenMatrixJSON(DSIRED_ROT_IN_CAMERA_FRAME_KEY);
 			Vector3d desired_pos_in_camera_frame = redis_client.getEigenMatrixJSON(DSIRED_POS_IN_CAMERA_FRAME_KEY); // + desired_rot_in_camera_frame * T_ee_camera.linear().transpose() * p_handBase_controlPoint;
 
-			for(int i=3 ; i<6 ; i++)
+			if(f_model_update)
 			{
-				posori_task->_Lambda(i,i) += 0.1;
+				for(int i=3 ; i<6 ; i++)
+				{
+					posori_task->_Lambda(i,i) += 0.1;
+				}
 			}
 
 			posori_task->computeTorques(posori_task_torques);
@@ -435,9 +475,12 @@ int main() {
 		{
 			// posori_task->_desired_position = redis_client.getEigenMatrixJSON(DESIRED_POS_KEY);
 
-			for(int i=3 ; i<6 ; i++)
+			if(f_model_update)
 			{
-				posori_task->_Lambda(i,i) += 0.1;
+				for(int i=3 ; i<6 ; i++)
+				{
+					posori_task->_Lambda(i,i) += 0.1;
+				}
 			}
 
 			posori_task->computeTorques(posori_task_torques);
@@ -455,9 +498,12 @@ int main() {
 		{
 			// redis_client.setEigenMatrixJSON(SVH_HAND_COMMAND_POSITIONS_KEY, hand_positions_temp);
 
-			for(int i=3 ; i<6 ; i++)
+			if(f_model_update)
 			{
-				posori_task->_Lambda(i,i) += 0.1;
+				for(int i=3 ; i<6 ; i++)
+				{
+					posori_task->_Lambda(i,i) += 0.1;
+				}
 			}
 
 			posori_task->computeTorques(posori_task_torques);
@@ -501,9 +547,12 @@ int main() {
 
 			// posori_task->_desired_position = redis_client.getEigenMatrixJSON(DESIRED_POS_KEY);
 
-			for(int i=3 ; i<6 ; i++)
+			if(f_model_update)
 			{
-				posori_task->_Lambda(i,i) += 0.1;
+				for(int i=3 ; i<6 ; i++)
+				{
+					posori_task->_Lambda(i,i) += 0.1;
+				}
 			}
 
 			posori_task->computeTorques(posori_task_torques);
@@ -539,9 +588,12 @@ int main() {
 
 			posori_task->_desired_position = redis_client.getEigenMatrixJSON(DESIRED_POS_KEY);
 
-			for(int i=3 ; i<6 ; i++)
+			if(f_model_update)
 			{
-				posori_task->_Lambda(i,i) += 0.1;
+				for(int i=3 ; i<6 ; i++)
+				{
+					posori_task->_Lambda(i,i) += 0.1;
+				}
 			}
 
 			posori_task->computeTorques(posori_task_torques);
@@ -555,8 +607,28 @@ int main() {
 				redis_client.set(GO_TO_INITIAL_KEY, "0");
 
 
-				redis_client.setEigenMatrixJSON(DSIRED_POS_IN_CAMERA_FRAME_KEY, Vector3d::Zero());
-				redis_client.setEigenMatrixJSON(DSIRED_ROT_IN_CAMERA_FRAME_KEY, Matrix3d::Identity());
+				// the next ranked candidate of evaluate_grasps11 if there is one, the camera otherwise.
+				// the first candidate of the list is the one that was just tried
+				VectorXd ranked_candidates = VectorXd::Zero(0);
+				if(redis_client.exists(RANKED_GRASP_CANDIDATES_IN_CAMERA_FRAME_KEY))
+				{
+					ranked_candidates = redis_client.getEigenMatrixJSON(RANKED_GRASP_CANDIDATES_IN_CAMERA_FRAME_KEY);
+				}
+				if(ranked_candidates.size() >= 30)
+				{
+					ranked_candidates = ranked_candidates.tail(ranked_candidates.size() - 15).eval();
+					redis_client.setEigenMatrixJSON(RANKED_GRASP_CANDIDATES_IN_CAMERA_FRAME_KEY, ranked_candidates);
+					Matrix3d next_rot_in_camera_frame;
+					next_rot_in_camera_frame << ranked_candidates.segment<3>(3).transpose(), ranked_candidates.segment<3>(6).transpose(), ranked_candidates.segment<3>(9).transpose();
+					redis_client.setEigenMatrixJSON(DSIRED_ROT_IN_CAMERA_FRAME_KEY, next_rot_in_camera_frame);
+					redis_client.setEigenMatrixJSON(DSIRED_POS_IN_CAMERA_FRAME_KEY, Vector3d(ranked_candidates.head<3>()));
+					cout << "Next Ranked Grasp Candidate" << endl;
+				}
+				else
+				{
+					redis_client.setEigenMatrixJSON(DSIRED_POS_IN_CAMERA_FRAME_KEY, Vector3d::Zero());
+					redis_client.setEigenMatrixJSON(DSIRED_ROT_IN_CAMERA_FRAME_KEY, Matrix3d::Identity());
+				}
 				// redis_client.setEigenMatrixJSON(DSIRED_ROT_IN_CAMERA_FRAME_KEY, T_world_camera.linear().transpose() * init_config_orientation * R_ee_hand);
 				// redis_client.setEigenMatrixJSON(DSIRED_ROT_IN_CAMERA_FRAME_KEY, init_config_orientation);
 
@@ -596,6 +668,12 @@ int main() {
 		redis_client.setEigenMatrixJSON(JOINT_TORQUES_COMMANDED_KEY, command_torques);
 
 		prev_time = current_time;
+
+		if(controller_counter % 1000 == 0)
+		{
+			loop_health.publish(redis_client, LOOP_HEALTH_KEY);
+		}
+
 		controller_counter++;
 	}
 
@@ -607,6 +685,8 @@ int main() {
 	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
 	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
     std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+    loop_health.print(std::cout);
+    idle_scheduler.print(std::cout);
 
 	return 0;
 }
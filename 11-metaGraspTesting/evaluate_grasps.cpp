@@ -0,0 +1,185 @@
+// Ranks the grasp candidates of the camera before they are tried on the robot (see
+// model/GraspCandidateEvaluator.h), and hands the best ones to controller11.
+//
+// usage : evaluate_grasps11 [-j threads] [-k n] [-w margin_weight alignment_weight]
+//   -j  threads of the evaluation (default 4)
+//   -k  number of ranked candidates kept for the controller (default 5)
+//   -w  weights of the joint limit margin and of the normal alignment in the score (default 1 1)
+//
+// the candidates are read from GRASP_CANDIDATES_IN_CAMERA_FRAME_KEY, 15 values per candidate :
+// the position in camera frame, the rotation in camera frame (row major), and the surface
+// normal at the grasp in camera frame, pointing out of the object. run it while controller11
+// waits for the camera, from the same configuration of the robot : the candidates are put in
+// world frame as the controller does, scored, and the best reachable ones are written in the
+// same format to RANKED_GRASP_CANDIDATES_IN_CAMERA_FRAME_KEY. the first one also goes to the
+// desired pose keys of the camera, that the controller reads, and the controller tries the
+// next ones of the ranked list when it is sent back to its initial configuration, until it
+// is empty.
+
+#include "Sai2Model.h"
+#include "redis/RedisClient.h"
+#include "model/GraspCandidateEvaluator.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+const string robot_file = "resources/panda_arm.urdf";
+
+// redis keys, as in controller.cpp
+const bool flag_simulation = true;
+string JOINT_ANGLES_KEY;
+const string DSIRED_POS_IN_CAMERA_FRAME_KEY = "sai2::PandaApplication::controller::desired_pos_in_camera_frame";
+const string DSIRED_ROT_IN_CAMERA_FRAME_KEY = "sai2::PandaApplication::controller::desired_rot_in_camera_frame";
+const string GRASP_CANDIDATES_IN_CAMERA_FRAME_KEY = "sai2::PandaApplication::controller::grasp_candidates_in_camera_frame";
+const string RANKED_GRASP_CANDIDATES_IN_CAMERA_FRAME_KEY = "sai2::PandaApplication::controller::ranked_grasp_candidates_in_camera_frame";
+
+const int CANDIDATE_SIZE = 15;
+
+int main(int argc, char** argv)
+{
+	int n_threads = 4;
+	int n_kept = 5;
+	double margin_weight = 1.0;
+	double alignment_weight = 1.0;
+	for(int i=1 ; i<argc ; i++)
+	{
+		const string arg = argv[i];
+		if(arg == "-j" && i+1 < argc)
+		{
+			n_threads = atoi(argv[++i]);
+		}
+		else if(arg == "-k" && i+1 < argc)
+		{
+			n_kept = atoi(argv[++i]);
+		}
+		else if(arg == "-w" && i+2 < argc)
+		{
+			margin_weight = atof(argv[++i]);
+			alignment_weight = atof(argv[++i]);
+		}
+		else
+		{
+			cout << "usage : " << argv[0] << " [-j threads] [-k n] [-w margin_weight alignment_weight]" << endl;
+			return 2;
+		}
+	}
+	if(n_threads < 1 || n_kept < 1)
+	{
+		cout << "the number of threads and of kept candidates should be positive" << endl;
+		return 2;
+	}
+
+	JOINT_ANGLES_KEY = flag_simulation ? "sai2::PandaApplication::sensors::q" : "sai2::FrankaPanda::Clyde::sensors::q";
+
+	auto redis_client = RedisClient();
+	redis_client.connect();
+
+	if(!redis_client.exists(GRASP_CANDIDATES_IN_CAMERA_FRAME_KEY))
+	{
+		cout << "no grasp candidates in " << GRASP_CANDIDATES_IN_CAMERA_FRAME_KEY << endl;
+		return 1;
+	}
+	const VectorXd candidates_in_camera_frame = redis_client.getEigenMatrixJSON(GRASP_CANDIDATES_IN_CAMERA_FRAME_KEY);
+	const int n_candidates = candidates_in_camera_frame.size() / CANDIDATE_SIZE;
+	if(n_candidates == 0 || candidates_in_camera_frame.size() % CANDIDATE_SIZE != 0)
+	{
+		cout << "the grasp candidates should be " << CANDIDATE_SIZE << " values each" << endl;
+		return 1;
+	}
+
+	// the robot in the configuration where the camera saw the candidates
+	auto robot = new Sai2Model::Sai2Model(robot_file, false);
+	robot->_q = redis_client.getEigenMatrixJSON(JOINT_ANGLES_KEY);
+	robot->updateKinematics();
+
+	// camera, hand and control point of controller.cpp
+	const string camera_link = "link7";
+	Affine3d T_ee_camera = Affine3d::Identity();
+	T_ee_camera.translation() = Vector3d(-0.0976, 0.0504, 0.1652);
+	T_ee_camera.linear() << 0.714581219586, -0.699456950306, 0.0115608459457,
+							0.6994185703, 0.714023515461, -0.0313700939647,
+							0.0136873144587, 0.0305023504502, 0.999440974663;
+	const string link_name = "link7";
+	const Vector3d p_handBase_controlPoint = Vector3d(0, 0, 0.10);
+	const Vector3d pos_in_link = Vector3d(0, 0, 0.260);
+	const Matrix3d R_ee_hand = AngleAxisd(3.0/4.0*M_PI, Vector3d::UnitZ()).toRotationMatrix();
+
+	Affine3d T_world_camera = Affine3d::Identity();
+	robot->transform(T_world_camera, camera_link, T_ee_camera.translation());
+	T_world_camera.linear() = T_world_camera.linear()*T_ee_camera.linear();
+
+	vector<PandaUtils::GraspCandidate> candidates(n_candidates);
+	for(int i=0 ; i<n_candidates ; i++)
+	{
+		const VectorXd values = candidates_in_camera_frame.segment<CANDIDATE_SIZE>(CANDIDATE_SIZE*i);
+		Vector3d desired_pos_in_camera_frame = values.segment<3>(0);
+		Matrix3d desired_rot_in_camera_frame;
+		desired_rot_in_camera_frame << values.segment<3>(3).transpose(), values.segment<3>(6).transpose(), values.segment<3>(9).transpose();
+		desired_pos_in_camera_frame = desired_pos_in_camera_frame + desired_rot_in_camera_frame * T_ee_camera.linear().transpose() * p_handBase_controlPoint;
+
+		candidates[i].position = T_world_camera * desired_pos_in_camera_frame;
+		candidates[i].orientation = T_world_camera.linear() * desired_rot_in_camera_frame * R_ee_hand.transpose();
+		candidates[i].contact_normal = T_world_camera.linear() * values.segment<3>(12);
+	}
+
+	VectorXd q_min = VectorXd::Zero(7);
+	VectorXd q_max = VectorXd::Zero(7);
+	q_min << -2.8973, -1.7628, -2.8973, -3.0718, -2.8973, -0.0175, -2.8973;
+	q_max << 2.8973, 1.7628, 2.8973, -0.0698, 2.8973, 3.7525, 2.8973;
+
+	PandaUtils::GraspCandidateEvaluator evaluator(robot_file, n_threads, link_name, pos_in_link, q_min, q_max);
+	evaluator.setInitialGuess(robot->_q);
+	evaluator.setWeights(margin_weight, alignment_weight);
+
+	auto start = chrono::high_resolution_clock::now();
+	const vector<PandaUtils::GraspCandidateEvaluator::Score> ranked = evaluator.evaluate(candidates);
+	const double evaluation_time = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+
+	cout << n_candidates << " candidates evaluated in " << 1e3 * evaluation_time << " ms on " << n_threads << " threads\n";
+	cout << setw(6) << "rank" << setw(11) << "candidate" << setw(12) << "residual" << setw(10) << "margin"
+		<< setw(12) << "alignment" << setw(10) << "score" << "\n";
+	cout << fixed << setprecision(4);
+	int n_reachable = 0;
+	for(unsigned int k=0 ; k<ranked.size() ; k++)
+	{
+		if(ranked[k].reachable)
+		{
+			n_reachable++;
+		}
+		if((int)k < 2 * n_kept)
+		{
+			cout << setw(6) << k << setw(11) << ranked[k].index << setw(12) << ranked[k].residual
+				<< setw(10) << ranked[k].joint_limit_margin << setw(12) << ranked[k].alignment
+				<< setw(10) << ranked[k].score << (ranked[k].reachable ? "" : "  not reachable") << "\n";
+		}
+	}
+	cout << n_reachable << " reachable candidates" << endl;
+	if(n_reachable == 0)
+	{
+		return 1;
+	}
+
+	// the best reachable candidates for the controller, in the format of the input
+	const int n_ranked = min(n_kept, n_reachable);
+	VectorXd ranked_candidates = VectorXd::Zero(CANDIDATE_SIZE * n_ranked);
+	for(int k=0 ; k<n_ranked ; k++)
+	{
+		ranked_candidates.segment<CANDIDATE_SIZE>(CANDIDATE_SIZE*k) = candidates_in_camera_frame.segment<CANDIDATE_SIZE>(CANDIDATE_SIZE*ranked[k].index);
+	}
+	redis_client.setEigenMatrixJSON(RANKED_GRASP_CANDIDATES_IN_CAMERA_FRAME_KEY, ranked_candidates);
+
+	const VectorXd best = ranked_candidates.head<CANDIDATE_SIZE>();
+	Matrix3d best_rot_in_camera_frame;
+	best_rot_in_camera_frame << best.segment<3>(3).transpose(), best.segment<3>(6).transpose(), best.segment<3>(9).transpose();
+	redis_client.setEigenMatrixJSON(DSIRED_ROT_IN_CAMERA_FRAME_KEY, best_rot_in_camera_frame);
+	redis_client.setEigenMatrixJSON(DSIRED_POS_IN_CAMERA_FRAME_KEY, Vector3d(best.head<3>()));
+
+	return 0;
+}
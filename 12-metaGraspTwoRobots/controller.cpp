@@ -1,15 +1,19 @@
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
+#include "redis/MultiRobotRedisIO.h"
+#include "redis/GraspTargetInput.h"
 #include "timer/LoopTimer.h"
+#include "timer/LoopHealth.h"
+#include "threads/RealtimeThread.h"
 #include "filters/ButterworthFilter.h"
 #include "tasks/JointTask.h"
 #include "tasks/PosOriTask.h"
+#include "model/ModelUpdateService.h"
 
+#include <atomic>
 #include <iostream>
 #include <string>
 
-#include "safe_ptr.h"
-
 #include <signal.h>
 bool runloop = true;
 void sighandler(int sig)
@@ -75,12 +79,29 @@ const string SVH_HAND_COMMAND_POSITIONS_KEY = "sai2::SVHHand_Right::position_com
 const string SVH_RECEIVED_POSITION_KEY = "sai2::PandaApplication::controller::SVH_position_command";
 const string SVH_CURRENT_KEY = "sai2::SVHHand_Right::current";
 const string SVH_POSITIONS_KEY = "sai2::SVHHand_Right::position";
+const string LOOP_HEALTH_KEY = "sai2::PandaApplication::controller::loop_health";
 
 
-// function to update model at a slower rate
-void updateModelThread(vector<sf::safe_ptr<Sai2Model::Sai2Model>> robots, 
-		vector<sf::safe_ptr<Sai2Primitives::JointTask>> joint_tasks, 
-		vector<sf::safe_ptr<Sai2Primitives::PosOriTask>> posori_tasks);
+// task models computed by the model update threads, in the model snapshots
+enum TaskModelMatrix
+{
+	JOINT_TASK_N_PREC,
+	JOINT_TASK_N,
+	POSORI_TASK_N_PREC,
+	POSORI_TASK_JACOBIAN,
+	POSORI_TASK_PROJECTED_JACOBIAN,
+	POSORI_TASK_LAMBDA,
+	POSORI_TASK_JBAR,
+	POSORI_TASK_N,
+	N_TASK_MODEL_MATRICES
+};
+
+// the task models of a robot, computed with tasks of its model robot
+PandaUtils::ModelUpdateService::Computation taskModelComputation(const int robot_index,
+		Sai2Primitives::JointTask* joint_task, Sai2Primitives::PosOriTask* posori_task);
+// copies the task models of a snapshot to the tasks of the control loop
+void applyTaskModels(const PandaUtils::ModelUpdateService::Snapshot& snapshot,
+		Sai2Primitives::JointTask* joint_task, Sai2Primitives::PosOriTask* posori_task);
 
 unsigned long long controller_counter = 0;
 
@@ -92,7 +113,8 @@ unsigned long long controller_counter = 0;
 #define LIFT                       5
 #define DEBUG                      10
 
-int state = GO_TO_INIT_CONFIG;
+// also read by the model update threads
+atomic<int> state(GO_TO_INIT_CONFIG);
 
 // const bool flag_simulation = false;
 const bool flag_simulation = true;
@@ -136,14 +158,19 @@ int main() {
 	signal(SIGTERM, &sighandler);
 	signal(SIGINT, &sighandler);
 
-	// load robots
-	vector<sf::safe_ptr<Sai2Model::Sai2Model>> robots;
+	// load robots, and a copy of each robot for its model update thread
+	vector<Sai2Model::Sai2Model*> robots;
+	vector<Sai2Model::Sai2Model*> model_robots;
 	for(int i=0 ; i<n_robots ; i++)
 	{
-		robots.push_back(sf::safe_ptr<Sai2Model::Sai2Model>(robot_files[i], false));
+		robots.push_back(new Sai2Model::Sai2Model(robot_files[i], false));
 		robots[i]->_q = redis_client.getEigenMatrixJSON(JOINT_ANGLES_KEYS[i]);
 		robots[i]->_dq = redis_client.getEigenMatrixJSON(JOINT_VELOCITIES_KEYS[i]);
 		robots[i]->updateModel();
+
+		model_robots.push_back(new Sai2Model::Sai2Model(robot_files[i], false));
+		model_robots[i]->_q = robots[i]->_q;
+		model_robots[i]->_dq = robots[i]->_dq;
 	}
 
 	// prepare task controllers
@@ -152,9 +179,9 @@ int main() {
 	vector<VectorXd> coriolis;
 	vector<MatrixXd> N_prec;
 
-	vector<sf::safe_ptr<Sai2Primitives::JointTask>> joint_tasks;
+	vector<Sai2Primitives::JointTask*> joint_tasks;
 	vector<VectorXd> joint_task_torques;
-	vector<sf::safe_ptr<Sai2Primitives::PosOriTask>> posori_tasks;
+	vector<Sai2Primitives::PosOriTask*> posori_tasks;
 	vector<VectorXd> posori_task_torques;
 
 	const vector<string> link_names =
@@ -195,7 +222,7 @@ int main() {
 		N_prec.push_back(MatrixXd::Identity(dof[i],dof[i]));
 
 		// joint tasks
-		joint_tasks.push_back(sf::safe_ptr<Sai2Primitives::JointTask>(robots[i].get_obj_ptr()));
+		joint_tasks.push_back(new Sai2Primitives::JointTask(robots[i]));
 		joint_task_torques.push_back(VectorXd::Zero(dof[i]));
 
 		joint_tasks[i]->_kp = 50.0;
@@ -206,7 +233,7 @@ int main() {
 		joint_tasks[i]->_otg->setMaxJerk(3*M_PI);
 
 		// end effector tasks
-		posori_tasks.push_back(sf::safe_ptr<Sai2Primitives::PosOriTask>(robots[i].get_obj_ptr(), link_names[i], pos_in_link[i]));
+		posori_tasks.push_back(new Sai2Primitives::PosOriTask(robots[i], link_names[i], pos_in_link[i]));
 		posori_task_torques.push_back(VectorXd::Zero(dof[i]));
 
 		posori_tasks[i]->_kp_pos = 400.0;
@@ -267,6 +294,14 @@ int main() {
 	const Vector3d direction_of_approach_hand_local = AngleAxisd(-M_PI/4, Vector3d(-1/sqrt(2), 1/sqrt(2), 0)).toRotationMatrix() * Vector3d::UnitZ();
 	Vector3d direction_of_approach_hand_global = Vector3d::Zero();
 
+	// the camera targets are read and put in world frame on their own thread
+	PandaUtils::GraspTargetInput grasp_target_input(DSIRED_POS_IN_CAMERA_FRAME_KEY, DSIRED_ROT_IN_CAMERA_FRAME_KEY);
+	grasp_target_input.setCameraMount(T_World_Bonnie, T_eeB_camera);
+	grasp_target_input.setHandFrame(R_eeC_hand, direction_of_approach_hand_local, 0.05);
+	grasp_target_input.start(100.0);
+	PandaUtils::GraspTarget grasp_target;
+	Affine3d T_Bonnie_eeB = Affine3d::Identity();
+
 
 
 	vector<double> buffer_joint_task_error;
@@ -284,34 +319,50 @@ int main() {
 	// --------------------------------------
 	// --------------------------------------
 
-	// start update_model thread
-	thread model_update_thread(updateModelThread, robots, joint_tasks, posori_tasks);
+	// update the models and the task models at 200 Hz, with task models of the model robots
+	vector<PandaUtils::ModelUpdateService*> model_services;
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		model_services.push_back(new PandaUtils::ModelUpdateService(model_robots[i], 200.0, N_TASK_MODEL_MATRICES));
+		model_services[i]->addComputation(taskModelComputation(i, new Sai2Primitives::JointTask(model_robots[i]),
+				new Sai2Primitives::PosOriTask(model_robots[i], link_names[i], pos_in_link[i])));
+		model_services[i]->start();
+	}
+
+	// state reads and torque writes of all the robots in one round trip each
+	PandaUtils::MultiRobotRedisIO robots_io(redis_client, JOINT_ANGLES_KEYS, JOINT_VELOCITIES_KEYS, JOINT_TORQUES_COMMANDED_KEYS, dof);
 
 	// create a timer
 	LoopTimer timer;
 	timer.initializeTimer();
 	timer.setLoopFrequency(1000); 
+	PandaUtils::LoopHealth loop_health(1000);
+	PandaUtils::configureRealtimeThread("controller", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
 	double current_time = 0;
 	double prev_time = 0;
 	double dt = 0;
-	bool fTimerDidSleep = true;
 	double start_time = timer.elapsedTime(); //secs
 
 	runloop = true;
 	while (runloop) {
 		// wait for next scheduled loop
-		timer.waitForNextLoop();
+		loop_health.waitForNextLoop(timer);
 		current_time = timer.elapsedTime() - start_time;
 		dt = current_time - prev_time;
 
 		// read robot state from redis and update robot model
+		robots_io.read();
 		for(int i=0 ; i<n_robots ; i++)
 		{
-			robots[i]->_q = redis_client.getEigenMatrixJSON(JOINT_ANGLES_KEYS[i]);
-			robots[i]->_dq = redis_client.getEigenMatrixJSON(JOINT_VELOCITIES_KEYS[i]);
+			robots[i]->_q = robots_io._q[i];
+			robots[i]->_dq = robots_io._dq[i];
 
 			// robots[i]->updateModel();
 			// robots[i]->coriolisForce(coriolis[i]);
+			if(model_services[i]->updateModel(robots[i]))
+			{
+				applyTaskModels(model_services[i]->latestSnapshot(), joint_tasks[i], posori_tasks[i]);
+			}
 		}
 
 		if(state == DEBUG)
@@ -365,8 +416,8 @@ int main() {
 		else if(state == WAIT_FOR_CAMERA_INFO)
 		{
 
-			Matrix3d desired_rot_in_camera_frame = redis_client.getEigenMatrixJSON(DSIRED_ROT_IN_CAMERA_FRAME_KEY);
-			Vector3d desired_pos_in_camera_frame = redis_client.getEigenMatrixJSON(DSIRED_POS_IN_CAMERA_FRAME_KEY); // + desired_rot_in_camera_frame * T_ee_camera.linear().transpose() * p_handBase_controlPoint;
+			robots[1]->transform(T_Bonnie_eeB, link_names[1]);
+			grasp_target_input.setCameraLinkPose(T_Bonnie_eeB);
 
 			posori_tasks[0]->computeTorques(posori_task_torques[0]);
 			joint_tasks[0]->computeTorques(joint_task_torques[0]);
@@ -374,19 +425,9 @@ int main() {
 			joint_tasks[1]->computeTorques(joint_task_torques[1]);
 
 
-			if(desired_pos_in_camera_frame.norm() > 1e-2)
+			if(grasp_target_input.read(grasp_target))
 			{
-				Affine3d T_world_camera = Affine3d::Identity();
-				Affine3d T_Bonnie_eeB = Affine3d::Identity();
-				robots[1]->transform(T_Bonnie_eeB, link_names[1]);
-
-				T_world_camera = T_World_Bonnie * T_Bonnie_eeB * T_eeB_camera;
-
-				Vector3d desired_pos_in_world_frame = T_world_camera * desired_pos_in_camera_frame;
-				Matrix3d desired_rot_in_world_frame = T_world_camera.linear() * desired_rot_in_camera_frame * R_eeC_hand.transpose();
-
-
-				posori_tasks[0]->_desired_orientation = desired_rot_in_world_frame;
+				posori_tasks[0]->_desired_orientation = grasp_target.orientation;
 
 				
 				// hand_base_offset(0) = desired_rot_in_world_frame(0,2);
@@ -396,8 +437,8 @@ int main() {
 				// hand_base_offset(2) = 0.03;
 				// posori_tasks[0]->_desired_position = desired_pos_in_world_frame + Vector3d(-0.05, 0.0, 0.05);
 				// posori_tasks[0]->_desired_position = desired_pos_in_world_frame + Vector3d(-0.0, 0.0, 0.10);
-				direction_of_approach_hand_global = desired_rot_in_world_frame * direction_of_approach_hand_local;
-				posori_tasks[0]->_desired_position = desired_pos_in_world_frame - 0.05 * direction_of_approach_hand_global;
+				direction_of_approach_hand_global = grasp_target.approach_direction;
+				posori_tasks[0]->_desired_position = grasp_target.pre_grasp_position;
 				state = MOVE_ABOVE_GRASP_POSE;
 
 				joint_tasks[1]->_desired_position = q_Bonnie_wait;
@@ -531,7 +572,7 @@ int main() {
 
 				redis_client.setEigenMatrixJSON(DSIRED_POS_IN_CAMERA_FRAME_KEY, Vector3d::Zero());
 				redis_client.setEigenMatrixJSON(DSIRED_ROT_IN_CAMERA_FRAME_KEY, Matrix3d::Identity());
-
+				grasp_target_input.clear();
 			}
 
 		}
@@ -579,14 +620,24 @@ int main() {
 			command_torques[i] = posori_task_torques[i] + joint_task_torques[i] + coriolis[i] + potential_field[i];
 
 			// command_torques.setZero(dof);
-			redis_client.setEigenMatrixJSON(JOINT_TORQUES_COMMANDED_KEYS[i], command_torques[i]);
 		}
+		robots_io.write(command_torques);
 
 		prev_time = current_time;
+
+		if(controller_counter % 1000 == 0)
+		{
+			loop_health.publish(redis_client, LOOP_HEALTH_KEY);
+		}
+
 		controller_counter++;
 	}
 
-	model_update_thread.join();
+	grasp_target_input.stop();
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		model_services[i]->stop();
+	}
 
 	for(int i=0 ; i<n_robots ; i++)
 	{
@@ -599,6 +650,7 @@ int main() {
 	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
 	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
     std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+    loop_health.print(std::cout);
 
     // for(int i=0 ; i<n_robots ; i++)
     // {
@@ -610,38 +662,13 @@ int main() {
 	return 0;
 }
 
-void updateModelThread(vector<sf::safe_ptr<Sai2Model::Sai2Model>> robots, 
-		vector<sf::safe_ptr<Sai2Primitives::JointTask>> joint_tasks, 
-		vector<sf::safe_ptr<Sai2Primitives::PosOriTask>> posori_tasks)
+PandaUtils::ModelUpdateService::Computation taskModelComputation(const int robot_index,
+		Sai2Primitives::JointTask* joint_task, Sai2Primitives::PosOriTask* posori_task)
 {
-
-	// prepare task controllers
-	vector<int> dof;
-	vector<MatrixXd> N_prec;
-
-	for(int i=0 ; i<n_robots ; i++)
-	{
-		dof.push_back(robots[i]->dof());
-		N_prec.push_back(MatrixXd::Identity(dof[i],dof[i]));
-	}
-
-	// create a timer
-	LoopTimer timer;
-	timer.initializeTimer();
-	timer.setLoopFrequency(200); 
-	double current_time = 0;
-	double prev_time = 0;
-	double dt = 0;
-	bool fTimerDidSleep = true;
-	double start_time = timer.elapsedTime(); //secs
-
-	while(runloop)
+	return [robot_index, joint_task, posori_task](Sai2Model::Sai2Model* robot, PandaUtils::ModelUpdateService::Snapshot& snapshot)
 	{
-		timer.waitForNextLoop();
-		for(int i=0 ; i<n_robots ; i++)
-		{
-			robots[i]->updateModel();
-		}
+		const int dof = robot->dof();
+		MatrixXd N_prec = MatrixXd::Identity(dof, dof);
 
 		if(state == DEBUG)
 		{
@@ -650,38 +677,56 @@ void updateModelThread(vector<sf::safe_ptr<Sai2Model::Sai2Model>> robots,
 
 		else if(state == GO_TO_INIT_CONFIG)
 		{
-			for(int i=0 ; i<n_robots ; i++)
+			joint_task->updateTaskModel(N_prec);
+
+			for(int j=4 ; j<7 ; j++)
 			{
-				N_prec[i].setIdentity();
-				joint_tasks[i]->updateTaskModel(N_prec[i]);
+				robot->_M(j,j) += 0.1;
+			}
+		}
+
+		else if(robot_index == 0)
+		{
+			posori_task->updateTaskModel(N_prec);
+			N_prec = posori_task->_N;
+			joint_task->updateTaskModel(N_prec);
 
-				for(int j=4 ; j<7 ; j++)
-				{
-					robots[i]->_M(j,j) += 0.1;
-				}
+			for(int j=3 ; j<6 ; j++)
+			{
+				posori_task->_Lambda(j,j) += 0.1;
 			}
 		}
 
 		else
 		{
-			N_prec[0].setIdentity();
-			posori_tasks[0]->updateTaskModel(N_prec[0]);
-			N_prec[0] = posori_tasks[0]->_N;
-			joint_tasks[0]->updateTaskModel(N_prec[0]);
-
-			N_prec[1].setIdentity();
-			joint_tasks[1]->updateTaskModel(N_prec[1]);
+			joint_task->updateTaskModel(N_prec);
 
 			for(int j=4 ; j<7 ; j++)
 			{
-				robots[1]->_M(j,j) += 0.1;
-			}
-		
-			for(int j=3 ; j<6 ; j++)
-			{
-				posori_tasks[0]->_Lambda(j,j) += 0.1;
+				robot->_M(j,j) += 0.1;
 			}
 		}
 
-	}
-}
\ No newline at end of file
+		snapshot.matrices[JOINT_TASK_N_PREC] = joint_task->_N_prec;
+		snapshot.matrices[JOINT_TASK_N] = joint_task->_N;
+		snapshot.matrices[POSORI_TASK_N_PREC] = posori_task->_N_prec;
+		snapshot.matrices[POSORI_TASK_JACOBIAN] = posori_task->_jacobian;
+		snapshot.matrices[POSORI_TASK_PROJECTED_JACOBIAN] = posori_task->_projected_jacobian;
+		snapshot.matrices[POSORI_TASK_LAMBDA] = posori_task->_Lambda;
+		snapshot.matrices[POSORI_TASK_JBAR] = posori_task->_Jbar;
+		snapshot.matrices[POSORI_TASK_N] = posori_task->_N;
+	};
+}
+
+void applyTaskModels(const PandaUtils::ModelUpdateService::Snapshot& snapshot,
+		Sai2Primitives::JointTask* joint_task, Sai2Primitives::PosOriTask* posori_task)
+{
+	joint_task->_N_prec = snapshot.matrices[JOINT_TASK_N_PREC];
+	joint_task->_N = snapshot.matrices[JOINT_TASK_N];
+	posori_task->_N_prec = snapshot.matrices[POSORI_TASK_N_PREC];
+	posori_task->_jacobian = snapshot.matrices[POSORI_TASK_JACOBIAN];
+	posori_task->_projected_jacobian = snapshot.matrices[POSORI_TASK_PROJECTED_JACOBIAN];
+	posori_task->_Lambda = snapshot.matrices[POSORI_TASK_LAMBDA];
+	posori_task->_Jbar = snapshot.matrices[POSORI_TASK_JBAR];
+	posori_task->_N = snapshot.matrices[POSORI_TASK_N];
+}
@@ -4,11 +4,15 @@
 #include "filters/ButterworthFilter.h"
 #include "tasks/JointTask.h"
 #include "tasks/PosOriTask.h"
+#include "model/AllegroFingerControl.h"
+#include "model/FrameGraph.h"
 
+#include <atomic>
 #include <iostream>
 #include <string>
+#include <thread>
 
-#include "safe_ptr.h"
+#include "snapshot_ptr.h"
 
 #include <signal.h>
 bool runloop = true;
@@ -94,10 +98,51 @@ const string ALLEGRO_PALM_ORIENTATION_KEY = "sai2::allegroHand::controller::palm
 const string ALLEGRO_CONTROL_MODE = "sai2::allegroHand::controller::control_mode";
 
 
+// state of a robot read by the control thread, for the model thread
+struct RobotState
+{
+	VectorXd q;
+	VectorXd dq;
+	MatrixXd M;
+};
+
+// robot and task models computed by the model thread, for the control thread
+struct RobotModel
+{
+	MatrixXd M;
+	MatrixXd M_inv;
+	MatrixXd joint_task_N_prec;
+	MatrixXd joint_task_N;
+	MatrixXd posori_task_N_prec;
+	MatrixXd posori_task_jacobian;
+	MatrixXd posori_task_projected_jacobian;
+	MatrixXd posori_task_Lambda;
+	MatrixXd posori_task_Jbar;
+	MatrixXd posori_task_N;
+};
+
+// desired finger configuration and palm orientation given by the control thread, for the hand thread
+struct HandCommand
+{
+	VectorXd q_desired;
+	Matrix3d R_palm;
+};
+
 // function to update model at a slower rate
-void updateModelThread(vector<sf::safe_ptr<Sai2Model::Sai2Model>> robots, 
-		vector<sf::safe_ptr<Sai2Primitives::JointTask>> joint_tasks, 
-		vector<sf::safe_ptr<Sai2Primitives::PosOriTask>> posori_tasks);
+void updateModelThread(vector<Sai2Model::Sai2Model*> model_robots, 
+		vector<Sai2Primitives::JointTask*> model_joint_tasks, 
+		vector<Sai2Primitives::PosOriTask*> model_posori_tasks,
+		vector<PandaUtils::snapshot_ptr<RobotState>*> robot_states,
+		vector<PandaUtils::snapshot_ptr<RobotModel>*> robot_models);
+// task models of the state of the model robot
+void computeRobotModel(const int robot_index, Sai2Model::Sai2Model* model_robot,
+		Sai2Primitives::JointTask* model_joint_task, Sai2Primitives::PosOriTask* model_posori_task,
+		RobotModel& robot_model);
+// copies the models computed by the model thread to the robot and tasks of the control loop
+void applyRobotModel(const RobotModel& robot_model, Sai2Model::Sai2Model* robot,
+		Sai2Primitives::JointTask* joint_task, Sai2Primitives::PosOriTask* posori_task);
+// finger joint control at a higher rate than the arms, with its own redis connection
+void handControlThread(PandaUtils::snapshot_ptr<HandCommand>* hand_command);
 
 unsigned long long controller_counter = 0;
 
@@ -109,13 +154,18 @@ unsigned long long controller_counter = 0;
 #define LIFT                       5
 #define DEBUG                      10
 
-int state = GO_TO_INIT_CONFIG;
+// also read by the model update thread
+atomic<int> state(GO_TO_INIT_CONFIG);
 
 bool flagcout = true;
 
 // const bool flag_simulation = false;
 const bool flag_simulation = true;
 
+// torque control of the fingers by the hand thread, instead of the position control of the allegro driver
+const bool flag_hand_torque_control = false;
+const double hand_control_frequency = 3000.0;
+
 int main() {
 
 	if(!flag_simulation)
@@ -157,13 +207,20 @@ int main() {
 	signal(SIGINT, &sighandler);
 
 	// load robots
-	vector<sf::safe_ptr<Sai2Model::Sai2Model>> robots;
+	vector<Sai2Model::Sai2Model*> robots;
+	// robot models used only by the model update thread
+	vector<Sai2Model::Sai2Model*> model_robots;
 	for(int i=0 ; i<n_robots ; i++)
 	{
-		robots.push_back(sf::safe_ptr<Sai2Model::Sai2Model>(robot_files[i], false));
+		robots.push_back(new Sai2Model::Sai2Model(robot_files[i], false));
 		robots[i]->_q = redis_client.getEigenMatrixJSON(JOINT_ANGLES_KEYS[i]);
 		robots[i]->_dq = redis_client.getEigenMatrixJSON(JOINT_VELOCITIES_KEYS[i]);
 		robots[i]->updateModel();
+
+		model_robots.push_back(new Sai2Model::Sai2Model(robot_files[i], false));
+		model_robots[i]->_q = robots[i]->_q;
+		model_robots[i]->_dq = robots[i]->_dq;
+		model_robots[i]->updateModel();
 	}
 
 	// prepare task controllers
@@ -172,11 +229,15 @@ int main() {
 	vector<VectorXd> coriolis;
 	vector<MatrixXd> N_prec;
 
-	vector<sf::safe_ptr<Sai2Primitives::JointTask>> joint_tasks;
+	vector<Sai2Primitives::JointTask*> joint_tasks;
 	vector<VectorXd> joint_task_torques;
-	vector<sf::safe_ptr<Sai2Primitives::PosOriTask>> posori_tasks;
+	vector<Sai2Primitives::PosOriTask*> posori_tasks;
 	vector<VectorXd> posori_task_torques;
 
+	// tasks of the model robots, that compute the task models
+	vector<Sai2Primitives::JointTask*> model_joint_tasks;
+	vector<Sai2Primitives::PosOriTask*> model_posori_tasks;
+
 	const vector<string> link_names =
 	{
 		"link7",
@@ -209,6 +270,12 @@ int main() {
 							 1/sqrt(2), -1/sqrt(2),  0,
 							    0     ,      0    , -1;  
 
+	// frames of the camera on Bonnie, its end effector moved every time the camera is read
+	PandaUtils::FrameGraph frames;
+	const int frame_Bonnie_base = frames.addFrame("Bonnie_base", PandaUtils::FrameGraph::WORLD, T_World_Bonnie);
+	const int frame_Bonnie_ee = frames.addFrame("Bonnie_ee", frame_Bonnie_base);
+	const int frame_camera = frames.addFrame("camera", frame_Bonnie_ee, T_eeB_camera);
+
 	Matrix3d R_eeC_hand = Matrix3d::Identity();
 	R_eeC_hand <<  0, 0, 1,
 				   0,-1, 0,
@@ -223,7 +290,7 @@ int main() {
 		N_prec.push_back(MatrixXd::Identity(dof[i],dof[i]));
 
 		// joint tasks
-		joint_tasks.push_back(sf::safe_ptr<Sai2Primitives::JointTask>(robots[i].get_obj_ptr()));
+		joint_tasks.push_back(new Sai2Primitives::JointTask(robots[i]));
 		joint_task_torques.push_back(VectorXd::Zero(dof[i]));
 
 		joint_tasks[i]->_kp = 200.0;
@@ -234,7 +301,7 @@ int main() {
 		joint_tasks[i]->_otg->setMaxJerk(3*M_PI);
 
 		// end effector tasks
-		posori_tasks.push_back(sf::safe_ptr<Sai2Primitives::PosOriTask>(robots[i].get_obj_ptr(), link_names[i], pos_in_link[i]));
+		posori_tasks.push_back(new Sai2Primitives::PosOriTask(robots[i], link_names[i], pos_in_link[i]));
 		posori_task_torques.push_back(VectorXd::Zero(dof[i]));
 
 		posori_tasks[i]->_kp_pos = 500.0;
@@ -250,6 +317,8 @@ int main() {
 		posori_tasks[i]->_otg->setMaxAngularAcceleration(M_PI/6);
 		posori_tasks[i]->_otg->setMaxAngularJerk(M_PI/2);
 
+		model_joint_tasks.push_back(new Sai2Primitives::JointTask(model_robots[i]));
+		model_posori_tasks.push_back(new Sai2Primitives::PosOriTask(model_robots[i], link_names[i], pos_in_link[i]));
 	}
 
 	vector<VectorXd> potential_field =
@@ -299,7 +368,7 @@ int main() {
 	robots[0]->rotation(R_palm, link_names[0]);
 	R_palm = R_palm * R_eeC_hand;
 	redis_client.setEigenMatrixJSON(ALLEGRO_PALM_ORIENTATION_KEY, R_palm);
-	redis_client.set(ALLEGRO_CONTROL_MODE, "p");
+	redis_client.set(ALLEGRO_CONTROL_MODE, flag_hand_torque_control ? "t" : "p");
 
 	VectorXd allegro_grasp_position_offset = VectorXd::Zero(16);
 	allegro_grasp_position_offset << 0, 0.35, 0.15, 0, 0, 0.35, 0.15, 0, 0, 0, 0, 0, 0, 0, 0.35, 0.05;
@@ -366,9 +435,11 @@ int main() {
 	redis_client.addEigenToReadCallback(0, DESIRED_PALM_ORIENTATION_FROM_IK_KEY, desired_palm_orientation_from_ik);
 	
 	// write
-	redis_client.addEigenToWriteCallback(0, ALLEGRO_PALM_ORIENTATION_KEY, R_palm);
-
-	redis_client.addEigenToWriteCallback(0, ALLEGRO_COMMANDED_JOINT_POSITIONS, allegro_commanded_positons);
+	if(!flag_hand_torque_control)
+	{
+		redis_client.addEigenToWriteCallback(0, ALLEGRO_PALM_ORIENTATION_KEY, R_palm);
+		redis_client.addEigenToWriteCallback(0, ALLEGRO_COMMANDED_JOINT_POSITIONS, allegro_commanded_positons);
+	}
 	redis_client.addEigenToWriteCallback(0, DESIRED_FINGERTIP_POS_IN_WORLD_FRAME_KEY , desired_fingertip_pos_in_world_frame);
 
 	for(int i=0 ; i<n_robots ; i++)
@@ -379,8 +450,38 @@ int main() {
 	redis_client.addEigenToWriteCallback(0, CAMERA_POS_IN_WORLD_KEY, p_world_camera);
 	redis_client.addEigenToWriteCallback(0, CAMERA_ROT_IN_WORLD_KEY, R_world_camera);
 
+	// states published by the control thread and models published by the model thread,
+	// each of them read by the other thread without locking
+	vector<PandaUtils::snapshot_ptr<RobotState>*> robot_states;
+	vector<PandaUtils::snapshot_ptr<RobotModel>*> robot_models;
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		RobotState robot_state;
+		robot_state.q = robots[i]->_q;
+		robot_state.dq = robots[i]->_dq;
+		robot_state.M = robots[i]->_M;
+		robot_states.push_back(new PandaUtils::snapshot_ptr<RobotState>(1, robot_state));
+
+		RobotModel robot_model;
+		computeRobotModel(i, model_robots[i], model_joint_tasks[i], model_posori_tasks[i], robot_model);
+		applyRobotModel(robot_model, robots[i], joint_tasks[i], posori_tasks[i]);
+		robot_models.push_back(new PandaUtils::snapshot_ptr<RobotModel>(1, robot_model));
+	}
+
 	// start update_model thread
-	thread model_update_thread(updateModelThread, robots, joint_tasks, posori_tasks);
+	thread model_update_thread(updateModelThread, model_robots, model_joint_tasks, model_posori_tasks,
+			robot_states, robot_models);
+
+	// commands of the fingers published by the control thread, and the hand thread
+	HandCommand hand_command_init;
+	hand_command_init.q_desired = allegro_commanded_positons;
+	hand_command_init.R_palm = R_palm;
+	PandaUtils::snapshot_ptr<HandCommand> hand_command(1, hand_command_init);
+	thread hand_control_thread;
+	if(flag_hand_torque_control)
+	{
+		hand_control_thread = thread(handControlThread, &hand_command);
+	}
 
 	// create a timer
 	LoopTimer timer;
@@ -443,6 +544,17 @@ int main() {
 
 			robots[i]->updateKinematics();
 			// robots[i]->coriolisForce(coriolis[i]);
+
+			RobotState& robot_state = robot_states[i]->writeBuffer();
+			robot_state.q = robots[i]->_q;
+			robot_state.dq = robots[i]->_dq;
+			robot_state.M = robots[i]->_M;
+			robot_states[i]->publish();
+
+			if(robot_models[i]->update())
+			{
+				applyRobotModel(*robot_models[i]->get(), robots[i], joint_tasks[i], posori_tasks[i]);
+			}
 		}
 
 		// send palm orientation to allegro driver for grav comp
@@ -508,10 +620,10 @@ int main() {
 			// if(desired_fingertip_pos_in_camera_frame.norm() > 1e-2)
 			if(desired_fingertip_pos_in_camera_frame.norm() > 1e-2 && camera_finished == 1)
 			{
-				Affine3d T_world_camera = Affine3d::Identity();
 				Affine3d T_Bonnie_eeB = Affine3d::Identity();
 				robots[1]->transform(T_Bonnie_eeB, link_names[1]);
-				T_world_camera = T_World_Bonnie * T_Bonnie_eeB * T_eeB_camera;
+				frames.setTransform(frame_Bonnie_ee, T_Bonnie_eeB);
+				const Affine3d& T_world_camera = frames.worldTransform(frame_camera);
 
 				p_world_camera = T_world_camera.translation();
 				R_world_camera = T_world_camera.linear();
@@ -754,11 +866,23 @@ int main() {
 
 		redis_client.executeWriteCallback(0);
 
+		if(flag_hand_torque_control)
+		{
+			HandCommand& hand_command_out = hand_command.writeBuffer();
+			hand_command_out.q_desired = allegro_commanded_positons;
+			hand_command_out.R_palm = R_palm;
+			hand_command.publish();
+		}
+
 		prev_time = current_time;
 		controller_counter++;
 	}
 
 	model_update_thread.join();
+	if(flag_hand_torque_control)
+	{
+		hand_control_thread.join();
+	}
 
 	for(int i=0 ; i<n_robots ; i++)
 	{
@@ -785,21 +909,12 @@ int main() {
 	return 0;
 }
 
-void updateModelThread(vector<sf::safe_ptr<Sai2Model::Sai2Model>> robots, 
-		vector<sf::safe_ptr<Sai2Primitives::JointTask>> joint_tasks, 
-		vector<sf::safe_ptr<Sai2Primitives::PosOriTask>> posori_tasks)
+void updateModelThread(vector<Sai2Model::Sai2Model*> model_robots, 
+		vector<Sai2Primitives::JointTask*> model_joint_tasks, 
+		vector<Sai2Primitives::PosOriTask*> model_posori_tasks,
+		vector<PandaUtils::snapshot_ptr<RobotState>*> robot_states,
+		vector<PandaUtils::snapshot_ptr<RobotModel>*> robot_models)
 {
-
-	// prepare task controllers
-	vector<int> dof;
-	vector<MatrixXd> N_prec;
-
-	for(int i=0 ; i<n_robots ; i++)
-	{
-		dof.push_back(robots[i]->dof());
-		N_prec.push_back(MatrixXd::Identity(dof[i],dof[i]));
-	}
-
 	// create a timer
 	LoopTimer timer;
 	timer.initializeTimer();
@@ -815,57 +930,149 @@ void updateModelThread(vector<sf::safe_ptr<Sai2Model::Sai2Model>> robots,
 		timer.waitForNextLoop();
 		for(int i=0 ; i<n_robots ; i++)
 		{
+			const RobotState* robot_state = robot_states[i]->get();
+			model_robots[i]->_q = robot_state->q;
+			model_robots[i]->_dq = robot_state->dq;
+
 			if(flag_simulation)
 			{
-				robots[i]->updateModel();
-				// robots[i]->coriolisForce(coriolis[i]);
+				model_robots[i]->updateModel();
+				// model_robots[i]->coriolisForce(coriolis[i]);
 			}
 			else
 			{
-				robots[i]->updateInverseInertia();
+				model_robots[i]->updateKinematics();
+				model_robots[i]->_M = robot_state->M;
+				model_robots[i]->updateInverseInertia();
 			}
+
+			computeRobotModel(i, model_robots[i], model_joint_tasks[i], model_posori_tasks[i], robot_models[i]->writeBuffer());
+			robot_models[i]->publish();
 		}
+	}
+}
 
-		if(state == DEBUG)
-		{
+void computeRobotModel(const int robot_index, Sai2Model::Sai2Model* model_robot,
+		Sai2Primitives::JointTask* model_joint_task, Sai2Primitives::PosOriTask* model_posori_task,
+		RobotModel& robot_model)
+{
+	const int dof = model_robot->dof();
+	MatrixXd N_prec = MatrixXd::Identity(dof, dof);
 
-		}
+	if(state == DEBUG)
+	{
 
-		else if(state == GO_TO_INIT_CONFIG)
+	}
+
+	else if(state == GO_TO_INIT_CONFIG)
+	{
+		model_joint_task->updateTaskModel(N_prec);
+
+		for(int j=4 ; j<7 ; j++)
 		{
-			for(int i=0 ; i<n_robots ; i++)
-			{
-				N_prec[i].setIdentity();
-				joint_tasks[i]->updateTaskModel(N_prec[i]);
+			model_robot->_M(j,j) += 0.15;
+		}
+	}
 
-				for(int j=4 ; j<7 ; j++)
-				{
-					robots[i]->_M(j,j) += 0.15;
-				}
-			}
+	else if(robot_index == 0)
+	{
+		model_posori_task->updateTaskModel(N_prec);
+		N_prec = model_posori_task->_N;
+		model_joint_task->updateTaskModel(N_prec);
+
+		for(int j=3 ; j<6 ; j++)
+		{
+			model_posori_task->_Lambda(j,j) += 0.15;
 		}
+	}
 
-		else
+	else
+	{
+		model_joint_task->updateTaskModel(N_prec);
+
+		for(int j=4 ; j<7 ; j++)
 		{
-			N_prec[0].setIdentity();
-			posori_tasks[0]->updateTaskModel(N_prec[0]);
-			N_prec[0] = posori_tasks[0]->_N;
-			joint_tasks[0]->updateTaskModel(N_prec[0]);
+			model_robot->_M(j,j) += 0.15;
+		}
+	}
 
-			N_prec[1].setIdentity();
-			joint_tasks[1]->updateTaskModel(N_prec[1]);
+	robot_model.M = model_robot->_M;
+	robot_model.M_inv = model_robot->_M_inv;
+	robot_model.joint_task_N_prec = model_joint_task->_N_prec;
+	robot_model.joint_task_N = model_joint_task->_N;
+	robot_model.posori_task_N_prec = model_posori_task->_N_prec;
+	robot_model.posori_task_jacobian = model_posori_task->_jacobian;
+	robot_model.posori_task_projected_jacobian = model_posori_task->_projected_jacobian;
+	robot_model.posori_task_Lambda = model_posori_task->_Lambda;
+	robot_model.posori_task_Jbar = model_posori_task->_Jbar;
+	robot_model.posori_task_N = model_posori_task->_N;
+}
 
-			for(int j=4 ; j<7 ; j++)
-			{
-				robots[1]->_M(j,j) += 0.15;
-			}
-		
-			for(int j=3 ; j<6 ; j++)
-			{
-				posori_tasks[0]->_Lambda(j,j) += 0.15;
-			}
+void applyRobotModel(const RobotModel& robot_model, Sai2Model::Sai2Model* robot,
+		Sai2Primitives::JointTask* joint_task, Sai2Primitives::PosOriTask* posori_task)
+{
+	robot->_M = robot_model.M;
+	robot->_M_inv = robot_model.M_inv;
+	joint_task->_N_prec = robot_model.joint_task_N_prec;
+	joint_task->_N = robot_model.joint_task_N;
+	posori_task->_N_prec = robot_model.posori_task_N_prec;
+	posori_task->_jacobian = robot_model.posori_task_jacobian;
+	posori_task->_projected_jacobian = robot_model.posori_task_projected_jacobian;
+	posori_task->_Lambda = robot_model.posori_task_Lambda;
+	posori_task->_Jbar = robot_model.posori_task_Jbar;
+	posori_task->_N = robot_model.posori_task_N;
+}
 
-		}
+void handControlThread(PandaUtils::snapshot_ptr<HandCommand>* hand_command)
+{
+	auto redis_client = RedisClient();
+	redis_client.connect();
+
+	// pd and gravity compensation of the fingers, the gravity from the palm orientation
+	PandaUtils::AllegroFingerControl finger_control("./resources/floatingAllegroHand.urdf");
+	finger_control.setGains(40.0, 0.4);
 
+	VectorXd allegro_joint_positions = VectorXd::Zero(16);
+	VectorXd allegro_commanded_torques = VectorXd::Zero(16);
+	PandaUtils::AllegroFingerControl::Vector16d q_hand, q_hand_desired, hand_torques;
+
+	redis_client.createReadCallback(0);
+	redis_client.createWriteCallback(0);
+	redis_client.addEigenToReadCallback(0, ALLEGRO_JOINT_POSITIONS, allegro_joint_positions);
+	redis_client.addEigenToWriteCallback(0, ALLEGRO_COMMANDED_JOINT_TORQUES, allegro_commanded_torques);
+
+	// create a timer
+	LoopTimer timer;
+	timer.initializeTimer();
+	timer.setLoopFrequency(hand_control_frequency);
+	double current_time = 0;
+	double prev_time = 0;
+	double dt = 0;
+	double start_time = timer.elapsedTime(); //secs
+
+	while(runloop)
+	{
+		timer.waitForNextLoop();
+		current_time = timer.elapsedTime() - start_time;
+		dt = current_time - prev_time;
+
+		redis_client.executeReadCallback(0);
+		const HandCommand* command = hand_command->get();
+
+		q_hand = allegro_joint_positions;
+		q_hand_desired = command->q_desired;
+		finger_control.setPalmOrientation(command->R_palm);
+		finger_control.computeTorques(q_hand, q_hand_desired, dt, hand_torques);
+		allegro_commanded_torques = hand_torques;
+
+		redis_client.executeWriteCallback(0);
+
+		prev_time = current_time;
 	}
-}
\ No newline at end of file
+
+	double end_time = timer.elapsedTime();
+	std::cout << "\n";
+	std::cout << "Hand Loop run time  : " << end_time << " seconds\n";
+	std::cout << "Hand Loop updates   : " << timer.elapsedCycles() << "\n";
+	std::cout << "Hand Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+}
@@ -8,8 +8,12 @@
 #include <dynamics3d.h>
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
+#include "threads/StartupTasks.h"
+#include "graphics/RenderScheduler.h"
+#include "graphics/MeshLod.h"
 
 #include "force_sensor/ForceSensorSim.h" 
+#include "threads/RealtimeThread.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
 
@@ -91,27 +95,41 @@ bool fRotPanTilt = false;
 int main() {
 	cout << "Loading URDF world model file: " << world_file << endl;
 
-	// start redis client
-	redis_client = RedisClient();
-	redis_client.connect();
-
-	// load graphics scene
-	auto graphics = new Sai2Graphics::Sai2Graphics(world_file, true);
+	// redis, graphics meshes, robot models and simulation world are independent, loaded in parallel
+	PandaUtils::StartupTasks startup;
+	auto redis_connected = startup.run("redis connect", []()
+	{
+		redis_client = RedisClient();
+		redis_client.connect();
+	});
+	auto graphics_loaded = startup.run("graphics meshes", []()
+	{
+		return new Sai2Graphics::Sai2Graphics(world_file, true);
+	});
+	auto robots_parsed = startup.run("robot models", []()
+	{
+		vector<Sai2Model::Sai2Model*> robots;
+		for(int i=0 ; i<n_robots ; i++)
+		{
+			robots.push_back(new Sai2Model::Sai2Model(robot_files[i], false));
+		}
+		return robots;
+	});
+	auto sim_built = startup.run("simulation world", []()
+	{
+		auto sim = new Simulation::Sai2Simulation(world_file, false);
+		sim->setCollisionRestitution(0);
+		sim->setCoeffFrictionStatic(0.8);
+		return sim;
+	});
+
+	redis_connected.get();
+	auto graphics = graphics_loaded.get();
 	Eigen::Vector3d camera_pos, camera_lookat, camera_vertical;
 	graphics->getCameraPose(camera_name, camera_pos, camera_vertical, camera_lookat);
-
-
-	// load robots
-	vector<Sai2Model::Sai2Model*> robots;
-	for(int i=0 ; i<n_robots ; i++)
-	{
-		robots.push_back(new Sai2Model::Sai2Model(robot_files[i], false));
-	}
-
-	// load simulation world
-	auto sim = new Simulation::Sai2Simulation(world_file, false);
-	sim->setCollisionRestitution(0);
-	sim->setCoeffFrictionStatic(0.8);
+	vector<Sai2Model::Sai2Model*> robots = robots_parsed.get();
+	auto sim = sim_built.get();
+	startup.report(cout);
 
 	// read joint positions, velocities, update model
 	for(int i=0 ; i<n_robots ; i++)
@@ -168,27 +186,42 @@ int main() {
 	fSimulationRunning = true;
 	thread sim_thread(simulation, robots, sim);
 
+	// frames at 30 Hz at most and only when the scene changed, decimated meshes far from the camera
+	PandaUtils::RenderScheduler render_scheduler(30.0);
+	PandaUtils::MeshLod mesh_lod(graphics->_world, graphics->getCamera(camera_name));
+
 	// while window is open:
 	while (!glfwWindowShouldClose(window))
 	{
-		// update graphics. this automatically waits for the correct amount of time
+		// update the graphics of what moved, and draw a frame only if something did
+		render_scheduler.waitForNextFrame();
 		int width, height;
 		glfwGetFramebufferSize(window, &width, &height);
 		for(int i=0 ; i<n_robots ; i++)
 		{
-			graphics->updateGraphics(robot_names[i], robots[i]);
+			if(render_scheduler.robotMoved(robot_names[i], robots[i]->_q))
+			{
+				graphics->updateGraphics(robot_names[i], robots[i]);
+			}
 		}
 		for(int i=0 ; i< n_objects ; i++)
 		{
-			graphics->updateObjectGraphics(object_names[i], object_positions[i], object_orientations[i]);
+			if(render_scheduler.objectMoved(object_names[i], object_positions[i], object_orientations[i]))
+			{
+				graphics->updateObjectGraphics(object_names[i], object_positions[i], object_orientations[i]);
+			}
 		}
-		graphics->render(camera_name, width, height);
-
-		// swap buffers
-		glfwSwapBuffers(window);
+		if(mesh_lod.update())
+		{
+			render_scheduler.invalidate();
+		}
+		if(render_scheduler.frameDue(width, height))
+		{
+			graphics->render(camera_name, width, height);
 
-		// wait until all GL commands are completed
-		glFinish();
+			// swap buffers
+			glfwSwapBuffers(window);
+		}
 
 		// check for any OpenGL errors
 		GLenum err;
@@ -251,6 +284,7 @@ int main() {
 			camera_pos = camera_lookat + m_pan*(camera_pos - camera_lookat);
 		}
 		graphics->setCameraPose(camera_name, camera_pos, cam_up_axis, camera_lookat);
+		render_scheduler.cameraMoved(camera_pos, cam_up_axis, camera_lookat);
 		glfwGetCursorPos(window, &last_cursorx, &last_cursory);
 	}
 
@@ -296,6 +330,8 @@ void simulation(vector<Sai2Model::Sai2Model*> robots, Simulation::Sai2Simulation
 
 	unsigned long long simulation_counter = 0;
 
+	PandaUtils::configureRealtimeThread("simulation", PandaUtils::RealtimeConfig::fifo(70, PandaUtils::simulationCpus()));
+
 	while (fSimulationRunning) {
 		fTimerDidSleep = timer.waitForNextLoop();
 
@@ -5,6 +5,7 @@
 #include "Sai2Model.h"
 #include "Sai2Graphics.h"
 #include "redis/RedisClient.h"
+#include "model/BatchIK.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
 
@@ -27,11 +28,15 @@ const string camera_name = "camera_fixed";
 
 const int n_robots = robot_names.size();
 
+const int n_ik_threads = 4;
+
 // redis keys:
 // - read:
 const string CAMERA_POS_IN_WORLD_KEY = "sai2::PandaApplication::camera::camera_pos_in_world";
 const string CAMERA_ROT_IN_WORLD_KEY = "sai2::PandaApplication::camera::camera_rot_in_world";
 const string DESIRED_FINGERTIP_POSITIONS_IN_CAMERA_FRAME_KEY = "sai2::PandaApplication::desired_fingertip_pos_in_camera_frame";
+// optional, 9 values per candidate fingertip triple. the best candidate is kept
+const string FINGERTIP_CANDIDATES_IN_CAMERA_FRAME_KEY = "sai2::PandaApplication::fingertip_candidates_in_camera_frame";
 
 // - write
 const string ROBOT_DESIRED_PALM_POSITION_KEY = "sai2::unigraspAllegro::desired_palm_position_from_IK";
@@ -144,37 +149,61 @@ int main() {
 	T_world_camera.linear() = redis_client.getEigenMatrixJSON(CAMERA_ROT_IN_WORLD_KEY);
 	VectorXd tmp_fingertip_desired_pos = redis_client.getEigenMatrixJSON(DESIRED_FINGERTIP_POSITIONS_IN_CAMERA_FRAME_KEY);
 
-	// transform the points to world frame
-	ik_desired_positions[0] = T_world_camera * tmp_fingertip_desired_pos.segment<3>(0);
-	ik_desired_positions[1] = T_world_camera * tmp_fingertip_desired_pos.segment<3>(3);
-	ik_desired_positions[2] = T_world_camera * tmp_fingertip_desired_pos.segment<3>(6);
-	
+	// candidate fingertip triples, the desired one by default
+	vector<vector<Vector3d>> ik_candidates;
+	if(redis_client.exists(FINGERTIP_CANDIDATES_IN_CAMERA_FRAME_KEY))
+	{
+		VectorXd tmp_candidates = redis_client.getEigenMatrixJSON(FINGERTIP_CANDIDATES_IN_CAMERA_FRAME_KEY);
+		for(int i=0 ; i<tmp_candidates.size()/9 ; i++)
+		{
+			tmp_fingertip_desired_pos = tmp_candidates.segment<9>(9*i);
+			ik_candidates.push_back(vector<Vector3d>());
+			for(int k=0 ; k<3 ; k++)
+			{
+				// transform the points to world frame
+				ik_candidates.back().push_back(T_world_camera * tmp_fingertip_desired_pos.segment<3>(3*k));
+			}
+		}
+	}
+	if(ik_candidates.empty())
+	{
+		ik_candidates.push_back(vector<Vector3d>());
+		for(int k=0 ; k<3 ; k++)
+		{
+			ik_candidates.back().push_back(T_world_camera * tmp_fingertip_desired_pos.segment<3>(3*k));
+		}
+	}
+
 	// find a good initialization for the position of the hand 
 	// make z hand coincide with the axis from the thumb contact point to the index contact poinr
 	// put the hand above the thumb contact point by 10cm
-	Vector3d p_thumb_index = ik_desired_positions[1] - ik_desired_positions[0];
-	Vector3d p_index_middle = ik_desired_positions[2] - ik_desired_positions[1];
-	p_thumb_index.normalize();
-	p_index_middle.normalize();
-	double angle = atan2(p_thumb_index(1), p_thumb_index(0));
-	robot->_q(3) = angle;
-
-	robot->_q(0) = ik_desired_positions[0](0);
-	robot->_q(1) = ik_desired_positions[0](1);
-	robot->_q(2) = ik_desired_positions[0](2) + 0.17;
-	robot->_q.head(3) += 0.05 * p_index_middle;
-	robot->_q.head(3) += 0.05 * p_thumb_index;
-
-	robot->updateKinematics();
+	VectorXd q_init = robot->_q;
+	auto initial_guess = [q_init](const vector<Vector3d>& desired_positions, VectorXd& q)
+	{
+		q = q_init;
+		Vector3d p_thumb_index = desired_positions[1] - desired_positions[0];
+		Vector3d p_index_middle = desired_positions[2] - desired_positions[1];
+		p_thumb_index.normalize();
+		p_index_middle.normalize();
+		double angle = atan2(p_thumb_index(1), p_thumb_index(0));
+		q(3) = angle;
+
+		q(0) = desired_positions[0](0);
+		q(1) = desired_positions[0](1);
+		q(2) = desired_positions[0](2) + 0.17;
+		q.head(3) += 0.05 * p_index_middle;
+		q.head(3) += 0.05 * p_thumb_index;
+	};
 
+	PandaUtils::BatchIK batch_ik(robot_files[0], n_ik_threads, ik_links, ik_pos_in_link, q_min, q_max, q_weights);
+	batch_ik.setInitialGuess(initial_guess);
 
 	auto t1 = std::chrono::high_resolution_clock::now();
 
-	// compute inverse kinematics
-	VectorXd q_ik = VectorXd::Zero(dof);	
-	robot->computeIK3d_JL(q_ik, ik_links, ik_pos_in_link, ik_desired_positions, q_min, q_max, q_weights);
-	// robot->computeIK3d(q_ik, ik_links, ik_pos_in_link, ik_desired_positions);
-	robot->_q = q_ik;
+	// compute inverse kinematics of all the candidates, the best one first
+	vector<PandaUtils::BatchIK::Solution> ik_solutions = batch_ik.solve(ik_candidates);
+	ik_desired_positions = ik_candidates[ik_solutions[0].index];
+	robot->_q = ik_solutions[0].q;
 	robot->updateKinematics();
 
 	// compute new palm pos and ori
@@ -187,6 +216,12 @@ int main() {
 
     auto duration = std::chrono::duration_cast<std::chrono::microseconds>( t2 - t1 ).count();
 
+    cout << "candidates : " << ik_candidates.size() << ", warm started : " << batch_ik.numWarmStarts() << endl;
+    for(int i=0 ; i<min(5, (int)ik_solutions.size()) ; i++)
+    {
+    	cout << "candidate " << ik_solutions[i].index << " residual : " << ik_solutions[i].residual
+    			<< " joint limit margin : " << ik_solutions[i].joint_limit_margin << endl;
+    }
     cout << "time for IK solver in ms : " << duration/1000.0 << endl;;
 	/*------- Set up visualization -------*/
 	// display contact points
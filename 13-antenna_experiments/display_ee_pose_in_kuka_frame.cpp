@@ -1,9 +1,32 @@
-// This example application loads a URDF world file and simulates two robots
-// with physics and contact in a Dynamics3D virtual world. A graphics model of it is also shown using 
-// Chai3D.
+// Streams the pose of the end effector of Bonnie in the frame of the KUKA, for the external
+// tracking system of the antenna experiments.
+//
+// every new joint configuration of the driver (1 kHz) gives a pose, from the forward
+// kinematics only and the calibrated KUKA to Bonnie transform, published as a binary eigen
+// vector (redis/RedisBinaryEigen.h) :
+//
+//   [sequence, time, x, y, z, qw, qx, qy, qz]
+//
+// time is the arrival of the joint configuration, in us of the unix epoch so that it can be
+// compared with the clock of the tracking system, and the position is in m. the pose is
+// printed once per second.
 
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
+#include "redis/RedisBinaryEigen.h"
+#include "redis/StampedInput.h"
+#include "timer/LoopTimer.h"
+#include "timer/LoopHealth.h"
+#include "threads/RealtimeThread.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include <signal.h>
+bool runloop = true;
+void sighandler(int sig)
+{ runloop = false; }
 
 using namespace std;
 using namespace Eigen;
@@ -11,7 +34,14 @@ using namespace Eigen;
 const string robot_file = "resources/panda_arm.urdf";
 
 // redis keys:
+// - read
 const string JOINT_ANGLES_KEY = "sai2::FrankaPanda::Bonnie::sensors::q";
+// - write
+const string EE_POSE_IN_KUKA_FRAME_KEY = "sai2::PandaApplication::antenna::ee_pose_in_kuka_frame";
+const string LOOP_HEALTH_KEY = "sai2::PandaApplication::antenna::pose_server_loop_health";
+
+// cpus of the pose server thread
+const vector<int> POSE_SERVER_CPUS = {2};
 
 int main() {
 
@@ -19,38 +49,71 @@ int main() {
 	auto redis_client = RedisClient();
 	redis_client.connect();
 
+	// set up signal handler
+	signal(SIGABRT, &sighandler);
+	signal(SIGTERM, &sighandler);
+	signal(SIGINT, &sighandler);
+
+	// the model is in the base frame of Bonnie, the transform to the KUKA frame is applied to
+	// the pose only
 	Affine3d T_kuka_Bonnie = Affine3d::Identity();
 	T_kuka_Bonnie.translation() = Vector3d(1.73603,  -0.421108, -0.0130478);
 	T_kuka_Bonnie.linear() = AngleAxisd(-1.11014, Vector3d::UnitZ()).toRotationMatrix();
-	auto robot = new Sai2Model::Sai2Model(robot_file, false, T_kuka_Bonnie);
+	auto robot = new Sai2Model::Sai2Model(robot_file, false);
 
 	const string link_name = "link7";
 	const Vector3d pos_in_link = Vector3d(0,0,0.211);
 
-	Vector3d ee_pos_in_kuka_frame = Vector3d::Zero();
+	// the driver does not stamp the joint angles, they are stamped when they change
+	PandaUtils::StampedInput q_input(JOINT_ANGLES_KEY, "", robot->dof());
+	redis_client.createReadCallback(0);
+	q_input.addToReadCallback(redis_client, 0);
 
-	bool runloop = true;
+	// offset from CLOCK_MONOTONIC to the unix epoch, in us
+	const double unix_time_offset = chrono::duration_cast<chrono::microseconds>(
+			chrono::system_clock::now().time_since_epoch()).count() - PandaUtils::monotonicMicroseconds();
+
+	Affine3d T_Bonnie_ee = Affine3d::Identity();
+	Affine3d T_kuka_ee = Affine3d::Identity();
+	Matrix<double,9,1> pose = Matrix<double,9,1>::Zero();
+	unsigned long long n_poses = 0;
+
+	LoopTimer timer;
+	timer.initializeTimer();
+	timer.setLoopFrequency(1000);
+	PandaUtils::LoopHealth loop_health(1000);
+	PandaUtils::configureRealtimeThread("pose_server", PandaUtils::RealtimeConfig::fifo(60, POSE_SERVER_CPUS));
+	unsigned long long loop_counter = 0;
 
 	while(runloop)
 	{
-		// wait for user input
-		char s = getchar();
-		if(s == 'q')
-		{
-			runloop = false;
-			break;
-		}
+		loop_health.waitForNextLoop(timer);
 
-		robot->_q = redis_client.getEigenMatrixJSON(JOINT_ANGLES_KEY);
-		robot->updateModel();
+		redis_client.executeReadCallback(0);
+		if(q_input.receive(PandaUtils::monotonicMicroseconds()))
+		{
+			robot->_q = q_input.value();
+			robot->updateKinematics();
+			robot->transform(T_Bonnie_ee, link_name, pos_in_link);
+			T_kuka_ee = T_kuka_Bonnie * T_Bonnie_ee;
 
-		robot->positionInWorld(ee_pos_in_kuka_frame, link_name, pos_in_link);
-		cout << "---------------------------------------------------------------" << endl;
-		cout << ee_pos_in_kuka_frame.transpose() << endl;
-		cout << "---------------------------------------------------------------" << endl;
-		cout << endl << endl << endl;
+			const Quaterniond orientation(T_kuka_ee.linear());
+			pose << (double) n_poses, q_input.time() * 1e6 + unix_time_offset, T_kuka_ee.translation(),
+					orientation.w(), orientation.x(), orientation.y(), orientation.z();
+			PandaUtils::setEigenMatrixBinary(redis_client, EE_POSE_IN_KUKA_FRAME_KEY, pose);
+			n_poses++;
+		}
 
+		if(loop_counter % 1000 == 0)
+		{
+			loop_health.publish(redis_client, LOOP_HEALTH_KEY);
+			cout << "ee pose in kuka frame : " << pose.segment<7>(2).transpose() << endl;
+		}
+		loop_counter++;
 	}
 
+	cout << "\nposes published : " << n_poses << "\n";
+	loop_health.print(cout);
+
 	return 0;
 }
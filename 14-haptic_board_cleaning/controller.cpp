@@ -4,11 +4,17 @@
 
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
-#include "timer/LoopTimer.h"
+#include "sim/SimClock.h"
 #include "tasks/JointTask.h"
 #include "tasks/PosOriTask.h"
 #include "haptic_tasks/HapticController.h"
-#include "haptic_tasks/BilateralPassivityController.h"
+#include "passivity/HapticPassivityController.h"
+#include "net/UdpHapticDevice.h"
+#include "redis/HapticDeviceBundle.h"
+#include "model/MassMatrixInverse.h"
+#include "force_control/ForcePipeline.h"
+#include "coverage/CoverageMap.h"
+#include "redis/AsyncRedisWriter.h"
 
 #include <iostream>
 #include <string>
@@ -41,6 +47,11 @@ vector<string> FORCE_SENSED_KEYS = {
 
 const string REMOTE_ENABLED_KEY = "sai2::WarehouseSimulation::sensors::remote_enabled";
 const string RESTART_CYCLE_KEY = "sai2::WarehouseSimulation::sensors::restart_cycle";
+// state machine, saved in the snapshots of the simviz
+const string CONTROLLER_STATE_KEY = "sai2::WarehouseSimulation::controller::state";
+// cleaned areas of the board, drawn by the simviz
+const string COVERAGE_MAP_KEY = "sai2::WarehouseSimulation::controller::coverage_map";
+const string COVERAGE_KEY = "sai2::WarehouseSimulation::controller::coverage";
 
 // - write
 vector<string> JOINT_TORQUES_COMMANDED_KEYS = {
@@ -131,8 +142,17 @@ unsigned long long controller_counter = 0;
 
 RedisClient redis_client;
 
-int main() {
+int main(int argc, char** argv) {
 
+	// controller --restore-state, after a simviz --restore-state
+	bool flag_restore_state = false;
+	for(int i=1 ; i<argc ; i++)
+	{
+		if(string(argv[i]) == "--restore-state")
+		{
+			flag_restore_state = true;
+		}
+	}
 
 	if(!flag_simulation)
 	{
@@ -176,6 +196,7 @@ int main() {
 
 	// prepare robot task controllers
 	vector<int> dof;
+	vector<PandaUtils::MassMatrixInverse<7>*> mass_matrix_inverses;
 	vector<VectorXd> command_torques;
 	vector<VectorXd> coriolis;
 	vector<MatrixXd> N_prec;
@@ -191,9 +212,13 @@ int main() {
 
 	q_initial.push_back(q_init_1);
 
+	const string link_name = "link7";
+	const Eigen::Vector3d pos_in_link = Vector3d(0.0,0.0,0.2);
+
 	for(int i=0 ; i<n_robots ; i++)
 	{
 		dof.push_back(robots[i]->dof());
+		mass_matrix_inverses.push_back(new PandaUtils::MassMatrixInverse<7>(dof[i], inertia_regularization ? 0.07 : 0.0));
 		command_torques.push_back(VectorXd::Zero(dof[i]));
 		coriolis.push_back(VectorXd::Zero(dof[i]));
 		N_prec.push_back(MatrixXd::Identity(dof[i],dof[i]));
@@ -210,8 +235,6 @@ int main() {
 		joint_tasks[i]->_otg->setMaxVelocity(M_PI/6);
 
 		// end effector tasks
-		string link_name = "link7";
-		Eigen::Vector3d pos_in_link = Vector3d(0.0,0.0,0.2);
 		posori_tasks.push_back(new Sai2Primitives::PosOriTask(robots[i], link_name, pos_in_link));
 
 		Affine3d sensor_frame = Affine3d::Identity();
@@ -234,6 +257,31 @@ int main() {
 	// define home positions of the panda robots
 	Vector3d workspace_center_eraser = posori_tasks[0]->_current_position;
 
+	// the board is a 1.0 x 0.8 m area of the floor centered under the home position of the
+	// eraser, along the axes of the robot
+	VectorXd q_current = robots[0]->_q;
+	robots[0]->_q = q_initial[0];
+	robots[0]->updateKinematics();
+	Vector3d home_eraser_position = Vector3d::Zero();
+	robots[0]->position(home_eraser_position, link_name, pos_in_link);
+	robots[0]->_q = q_current;
+	robots[0]->updateKinematics();
+
+	const double board_size_x = 1.0;
+	const double board_size_y = 0.8;
+	Affine3d board_pose_in_world = Affine3d::Identity();
+	board_pose_in_world.linear() = robot_pose_in_world[0].linear();
+	Vector3d board_center = robot_pose_in_world[0] * home_eraser_position;
+	board_center(2) = 0;
+	board_pose_in_world.translation() = board_center - board_pose_in_world.linear() * Vector3d(0.5 * board_size_x, 0.5 * board_size_y, 0);
+	PandaUtils::CoverageMap coverage_map(board_pose_in_world, board_size_x, board_size_y, 0.005,
+			PandaUtils::CoverageMap::Footprint::rectangle(0.12, 0.05));
+	// the eraser cleans when pressed on the board
+	const double contact_force_threshold = 3.0;
+
+	PandaUtils::AsyncRedisWriter coverage_writer;
+	coverage_writer.start();
+
 	// define home position of the haptic device
 	Vector3d haptic_center_eraser = Vector3d::Zero();
 
@@ -276,6 +324,13 @@ int main() {
 		hand_eraser_com = Vector3d(-6.19239e-05,  -0.00452189,    0.0777715);
 	}
 
+	// bias, hand gravity and sensor frame of the task in one update, not filtered
+	PandaUtils::ForcePipeline force_pipeline_eraser(1000);
+	Affine3d sensor_frame_eraser = Affine3d::Identity();
+	sensor_frame_eraser.translation() = Vector3d(0, 0, 0.12);
+	force_pipeline_eraser.setSensorFrame(sensor_frame_eraser, pos_in_link);
+	force_pipeline_eraser.setCalibration(force_bias_global_eraser + force_bias_adjustment_eraser, hand_eraser_mass, hand_eraser_com);
+
 	// Read haptic device specifications from haptic driver
 	VectorXd _max_stiffness_device0 = redis_client.getEigenMatrixJSON(DEVICE_MAX_STIFFNESS_KEYS[0]);
 	VectorXd _max_damping_device0 = redis_client.getEigenMatrixJSON(DEVICE_MAX_DAMPING_KEYS[0]);
@@ -293,7 +348,8 @@ int main() {
 	bool previous_gripper_state_eraser = false;
 
 	//// passivity observer and controller ////
-	auto passivity_controller_eraser = new Sai2Primitives::BilateralPassivityController(posori_tasks[0], eraser_teleop_task);
+	auto passivity_controller_eraser = new PandaUtils::HapticPassivityController(0.001);
+	passivity_controller_eraser->setMaxDamping(0.9 * _max_damping_device0[0], 0.9 * _max_damping_device0[1]);
 	Vector3d haptic_damping_force_passivity_eraser = Vector3d::Zero();
 	Vector3d command_force_device_plus_damping_eraser = Vector3d::Zero();
 
@@ -319,14 +375,29 @@ int main() {
 
 	redis_client.addEigenToReadCallback(0, FORCE_SENSED_KEYS[0], f_sensed_eraser);
 
-	redis_client.addEigenToReadCallback(0, DEVICE_POSITION_KEYS[0], eraser_teleop_task->_current_position_device);
-	redis_client.addEigenToReadCallback(0, DEVICE_ROTATION_KEYS[0], eraser_teleop_task->_current_rotation_device);
-	redis_client.addEigenToReadCallback(0, DEVICE_TRANS_VELOCITY_KEYS[0], eraser_teleop_task->_current_trans_velocity_device);
-	redis_client.addEigenToReadCallback(0, DEVICE_ROT_VELOCITY_KEYS[0], eraser_teleop_task->_current_rot_velocity_device);
-	redis_client.addEigenToReadCallback(0, DEVICE_SENSED_FORCE_KEYS[0], eraser_teleop_task->_sensed_force_device);
-	redis_client.addEigenToReadCallback(0, DEVICE_SENSED_TORQUE_KEYS[0], eraser_teleop_task->_sensed_torque_device);
-	redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_POSITION_KEYS[0], eraser_teleop_task->_current_position_gripper_device);
-	redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_VELOCITY_KEYS[0], eraser_teleop_task->_current_gripper_velocity_device);
+	// haptic device from a remote haptic station : controller14 --udp-teleop 9900 station 9901,
+	// or from the binary records of haptic_bundle_bridge, or from the device keys
+	PandaUtils::UdpTeleopConfig udp_config = PandaUtils::UdpTeleopConfig::fromArgs(argc, argv);
+	PandaUtils::HapticDeviceChannel* device_channel = NULL;
+	if(udp_config.enabled())
+	{
+		device_channel = new PandaUtils::UdpHapticDevice(udp_config.forDevice(0));
+	}
+	else if(PandaUtils::RedisHapticDevice::available(redis_client, 0))
+	{
+		device_channel = new PandaUtils::RedisHapticDevice(redis_client, 0);
+	}
+	else
+	{
+		redis_client.addEigenToReadCallback(0, DEVICE_POSITION_KEYS[0], eraser_teleop_task->_current_position_device);
+		redis_client.addEigenToReadCallback(0, DEVICE_ROTATION_KEYS[0], eraser_teleop_task->_current_rotation_device);
+		redis_client.addEigenToReadCallback(0, DEVICE_TRANS_VELOCITY_KEYS[0], eraser_teleop_task->_current_trans_velocity_device);
+		redis_client.addEigenToReadCallback(0, DEVICE_ROT_VELOCITY_KEYS[0], eraser_teleop_task->_current_rot_velocity_device);
+		redis_client.addEigenToReadCallback(0, DEVICE_SENSED_FORCE_KEYS[0], eraser_teleop_task->_sensed_force_device);
+		redis_client.addEigenToReadCallback(0, DEVICE_SENSED_TORQUE_KEYS[0], eraser_teleop_task->_sensed_torque_device);
+		redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_POSITION_KEYS[0], eraser_teleop_task->_current_position_gripper_device);
+		redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_VELOCITY_KEYS[0], eraser_teleop_task->_current_gripper_velocity_device);
+	}
 
 	redis_client.addIntToReadCallback(0, REMOTE_ENABLED_KEY, remote_enabled);
 	redis_client.addIntToReadCallback(0, RESTART_CYCLE_KEY, restart_cycle);
@@ -339,26 +410,44 @@ int main() {
 
 	// objects to write to redis
 	redis_client.addEigenToWriteCallback(0, JOINT_TORQUES_COMMANDED_KEYS[0], command_torques[0]);
-	redis_client.addEigenToWriteCallback(0, DEVICE_COMMANDED_FORCE_KEYS[0], command_force_device_plus_damping_eraser);
-	redis_client.addDoubleToWriteCallback(0, DEVICE_COMMANDED_GRIPPER_FORCE_KEYS[0], eraser_teleop_task->_commanded_gripper_force_device);
+	if(device_channel == NULL)
+	{
+		redis_client.addEigenToWriteCallback(0, DEVICE_COMMANDED_FORCE_KEYS[0], command_force_device_plus_damping_eraser);
+		redis_client.addDoubleToWriteCallback(0, DEVICE_COMMANDED_GRIPPER_FORCE_KEYS[0], eraser_teleop_task->_commanded_gripper_force_device);
+	}
 
-	// create a timer
-	LoopTimer timer;
-	timer.initializeTimer();
-	timer.setLoopFrequency(1000); 
+	// resume from the restored configuration. the haptic device is not in the snapshot, so a
+	// restored haptic control waits in maintain position for the gripper switch
+	if(flag_restore_state && redis_client.exists(CONTROLLER_STATE_KEY))
+	{
+		state_eraser = stoi(redis_client.get(CONTROLLER_STATE_KEY));
+		if(state_eraser == HAPTIC_CONTROL || state_eraser == MAINTAIN_POSITION)
+		{
+			joint_tasks[0]->reInitializeTask();
+			posori_tasks[0]->reInitializeTask();
+			workspace_center_eraser = posori_tasks[0]->_current_position;
+			state_eraser = MAINTAIN_POSITION;
+		}
+		cout << "restored controller state " << state_eraser << endl;
+	}
+	redis_client.set(CONTROLLER_STATE_KEY, to_string(state_eraser));
+	int published_state = state_eraser;
+
+	// 1 kHz of sim time, at the time scale of the simviz : controller --time-scale 10
+	PandaUtils::SimClock clock(PandaUtils::SimClock::timeScale(argc, argv, 1.0, false));
 	double current_time = 0;
 	double prev_time = 0;
 	double dt = 0;
-	bool fTimerDidSleep = true;
-	double start_time = timer.elapsedTime(); //secs
 
-	while (runloop) {
-		// wait for next scheduled loop
-		timer.waitForNextLoop();
-		current_time = timer.elapsedTime() - start_time;
+	while (runloop && clock.waitForNextStep(0.001)) {
+		current_time = clock.time();
 		dt = current_time - prev_time;
 
 		redis_client.executeReadCallback(0);
+		if(device_channel != NULL)
+		{
+			device_channel->readDevice(*eraser_teleop_task);
+		}
 
 		// read robot state from redis and update robot model
 		for(int i=0 ; i<n_robots ; i++)
@@ -373,13 +462,7 @@ int main() {
 			{
 				robots[i]->updateKinematics();
 				robots[i]->_M = mass_from_robots[i];
-				if(inertia_regularization)
-				{
-					robots[i]->_M(4,4) += 0.07;
-					robots[i]->_M(5,5) += 0.07;
-					robots[i]->_M(6,6) += 0.07;
-				}
-				robots[i]->_M_inv = robots[i]->_M.inverse();
+				mass_matrix_inverses[i]->update(robots[i]);
 				coriolis[i] = coriolis_from_robots[i];
 			}
 
@@ -396,16 +479,14 @@ int main() {
 
 
 		// read force sensor data and remove bias and effecto from hand gravity
-		f_sensed_eraser -= force_bias_global_eraser + force_bias_adjustment_eraser; 
 		Matrix3d R_sensor_eraser = Matrix3d::Identity();
 		robots[0]->rotation(R_sensor_eraser, "link7");
-		Vector3d p_tool_sensorFrame_eraser = hand_eraser_mass * R_sensor_eraser.transpose() * Vector3d(0,0,-9.81); 
-		f_sensed_eraser.head(3) += p_tool_sensorFrame_eraser;
-		f_sensed_eraser.tail(3) += hand_eraser_com.cross(p_tool_sensorFrame_eraser);
-
+		// hand inertia in the sensor frame, the rest of the compensation is linear after it
 		f_sensed_eraser.head(3) -= 0.8 * R_sensor_eraser.transpose() * hand_inertial_forces;
 
-		posori_tasks[0]->updateSensedForceAndMoment(f_sensed_eraser.head(3), f_sensed_eraser.tail(3));
+		force_pipeline_eraser.update(f_sensed_eraser, R_sensor_eraser);
+		posori_tasks[0]->_sensed_force = force_pipeline_eraser.force();
+		posori_tasks[0]->_sensed_moment = force_pipeline_eraser.moment();
 		VectorXd sensed_force_eraser_world_frame = VectorXd::Zero(6);
 		sensed_force_eraser_world_frame << posori_tasks[0]->_sensed_force, posori_tasks[0]->_sensed_moment;
 		eraser_teleop_task->updateSensedForce(-sensed_force_eraser_world_frame);
@@ -444,6 +525,7 @@ int main() {
 
 				eraser_teleop_task->setRobotCenter(workspace_center_eraser, posori_tasks[0]->_current_orientation);
 				eraser_teleop_task->setDeviceCenter(haptic_center_eraser, eraser_teleop_task->_current_rotation_device);
+				passivity_controller_eraser->reset();
 				
 				state_eraser = HAPTIC_CONTROL;
 			}
@@ -485,7 +567,8 @@ int main() {
 
 			command_torques[0] = joint_task_torques[0] + coriolis[0] + posori_task_torques[0];
 
-			passivity_controller_eraser->computePOPCForce(haptic_damping_force_passivity_eraser);
+			passivity_controller_eraser->update(eraser_teleop_task->_commanded_force_device, eraser_teleop_task->_current_trans_velocity_device);
+			haptic_damping_force_passivity_eraser = passivity_controller_eraser->dampingForce();
 
 			if(remote_enabled == 0)
 			{
@@ -494,6 +577,8 @@ int main() {
 			// joint_tasks[1]->_desired_position = robot[1]->_q;
 			// set current haptic device position
 			eraser_teleop_task->setDeviceCenter(eraser_teleop_task->_current_position_device, eraser_teleop_task->_current_rotation_device);
+			// no passivity damping outside of the haptic control
+			haptic_damping_force_passivity_eraser.setZero();
 
 			state_eraser = MAINTAIN_POSITION;
 			}
@@ -522,6 +607,7 @@ int main() {
 
 				eraser_teleop_task->setRobotCenter(workspace_center_eraser, posori_tasks[0]->_current_orientation);
 				eraser_teleop_task->setDeviceCenter(haptic_center_eraser, eraser_teleop_task->_current_rotation_device);
+				passivity_controller_eraser->reset();
 				
 				state_eraser = HAPTIC_CONTROL;
 			}
@@ -551,6 +637,26 @@ int main() {
 		
 		// 
 		redis_client.executeWriteCallback(0);
+		if(device_channel != NULL)
+		{
+			device_channel->sendCommands(command_force_device_plus_damping_eraser, Vector3d::Zero(),
+					eraser_teleop_task->_commanded_gripper_force_device, current_time, posori_tasks[0]->_sigma_force);
+		}
+		// the eraser covers the board in contact during the haptic control
+		const bool f_eraser_contact = (state_eraser == HAPTIC_CONTROL) && posori_tasks[0]->_sensed_force.norm() > contact_force_threshold;
+		coverage_map.update(robot_pose_in_world[0] * posori_tasks[0]->_current_position,
+				robot_pose_in_world[0].linear() * posori_tasks[0]->_current_orientation, f_eraser_contact);
+		if(controller_counter % 250 == 0)
+		{
+			coverage_writer.set(COVERAGE_MAP_KEY, coverage_map.image());
+			coverage_writer.set(COVERAGE_KEY, to_string(coverage_map.coverage()));
+		}
+
+		if(state_eraser != published_state)
+		{
+			redis_client.set(CONTROLLER_STATE_KEY, to_string(state_eraser));
+			published_state = state_eraser;
+		}
 
 		prev_time = current_time;
 		controller_counter++;
@@ -567,12 +673,23 @@ int main() {
 		command_torques[i].setZero();
 		redis_client.setEigenMatrixJSON(JOINT_TORQUES_COMMANDED_KEYS[i], command_torques[i]);
 	}
+	if(device_channel != NULL)
+	{
+		device_channel->sendCommands(Vector3d::Zero(), Vector3d::Zero(), 0, clock.time());
+		cout << "haptic device channel : " << device_channel->summary() << endl;
+		delete device_channel;
+	}
+
+	coverage_writer.set(COVERAGE_MAP_KEY, coverage_map.image());
+	coverage_writer.set(COVERAGE_KEY, to_string(coverage_map.coverage()));
+	coverage_writer.stop();
 
-	double end_time = timer.elapsedTime();
+	double end_time = clock.time();
 	std::cout << "\n";
-	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
-	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
-    std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+	std::cout << "Controller Loop run time  : " << end_time << " seconds of sim time\n";
+	std::cout << "Controller Loop updates   : " << controller_counter << "\n";
+    std::cout << "Controller Loop frequency : " << controller_counter/end_time << "Hz of sim time\n";
+	std::cout << "Board cleaned             : " << 100 * coverage_map.coverage() << " %\n";
 
 	return 0;
 }
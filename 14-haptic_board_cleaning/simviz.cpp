@@ -7,9 +7,16 @@
 #include "Sai2Simulation.h"
 #include <dynamics3d.h>
 #include "redis/RedisClient.h"
-#include "timer/LoopTimer.h"
+#include "sim/HeadlessSimviz.h"
+#include "sim/SimClock.h"
+#include "sim/SimSnapshot.h"
+#include "sim/RenderStateBuffer.h"
 
 #include "force_sensor/ForceSensorSim.h" 
+#include "model/UrdfCache.h"
+#include "sim/AdaptiveStepper.h"
+#include "graphics/CoverageMapOverlay.h"
+#include "threads/RealtimeThread.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
 
@@ -54,6 +61,7 @@ const vector<string> FORCE_SENSED_KEYS = {
 const vector<string> TORQUES_COMMANDED_KEYS = {
 	"sai2::WarehouseSimulation::panda1::actuators::fgc",
 };
+const string COVERAGE_MAP_KEY = "sai2::WarehouseSimulation::controller::coverage_map";
 
 // - gripper
 const vector<string> GRIPPER_MODE_KEYS = {   // m for move and g for graps
@@ -72,6 +80,10 @@ const vector<string> GRIPPER_DESIRED_FORCE_KEYS = {
 	"sai2::WarehouseSimulation::panda1::gripper::desired_force",
 };
 
+// - snapshots of the simulation state, the save key is polled for a save request (1)
+const string SAVE_STATE_KEY = "sai2::WarehouseSimulation::simulation::save_state";
+const string CONTROLLER_STATE_KEY = "sai2::WarehouseSimulation::controller::state";
+
 const vector<double> gripper_max_widths = {
 	0.08,
 	0.08,
@@ -83,9 +95,17 @@ vector<double> gripper_widths = {
 
 
 RedisClient redis_client;
+
+// one integration step per loop in free space, substeps in contact, with --adaptive-substeps
+// (see sim/AdaptiveStepper.h)
+bool flag_adaptive_substeps = false;
+PandaUtils::SimSnapshotService* snapshots;
 vector<Vector3d> object_positions;
 vector<Quaterniond> object_orientations;
 
+// state of the last simulation step, for the rendering loop
+PandaUtils::RenderStateBuffer* render_state;
+
 // simulation function prototype
 void simulation(vector<Sai2Model::Sai2Model*> robots, Simulation::Sai2Simulation* sim);
 // void simulation(vector<Sai2Model::Sai2Model*> robots, Sai2Model::Sai2Model* objects, Simulation::Sai2Simulation* sim);
@@ -111,15 +131,28 @@ bool fTransZp = false;
 bool fTransZn = false;
 bool fRotPanTilt = false;
 
-int main() {
+// sim seconds per wall second
+double time_scale = 1.0;
+
+int main(int argc, char** argv) {
+	flag_adaptive_substeps = PandaUtils::AdaptiveStepper::requested(argc, argv);
 	cout << "Loading URDF world model file: " << world_file << endl;
+	// the world file with decimated visual meshes, built at the first launch
+	const string loaded_world_file = PandaUtils::cachedWorldFile(world_file);
+
+	// simviz --headless to run the simulation without window, see sim/HeadlessSimviz.h
+	PandaUtils::SimvizMode simviz_mode(argc, argv);
+	// simviz --time-scale 10 to simulate 10 times faster than real time, with the controller at the same scale
+	time_scale = PandaUtils::SimClock::timeScale(argc, argv, 1.0, false);
+	// simviz --save-state file [--save-state-at seconds] or --restore-state file, see sim/SimSnapshot.h
+	snapshots = new PandaUtils::SimSnapshotService(argc, argv, SAVE_STATE_KEY, robot_names, object_names, {CONTROLLER_STATE_KEY});
 
 	// start redis client
 	redis_client = RedisClient();
 	redis_client.connect();
 
 	// load graphics scene
-	auto graphics = new Sai2Graphics::Sai2Graphics(world_file, true);
+	auto graphics = new Sai2Graphics::Sai2Graphics(loaded_world_file, true);
 	Eigen::Vector3d camera_pos, camera_lookat, camera_vertical;
 	graphics->getCameraPose(camera_name, camera_pos, camera_vertical, camera_lookat);
 
@@ -132,10 +165,13 @@ int main() {
 	}
 
 	// load simulation world
-	auto sim = new Simulation::Sai2Simulation(world_file, false);
+	auto sim = new Simulation::Sai2Simulation(loaded_world_file, false);
 	sim->setCollisionRestitution(0);
 	sim->setCoeffFrictionStatic(0.8);
 
+	// restore the robots and objects before they are read
+	snapshots->restoreSimulation(sim);
+
 	// read joint positions, velocities, update model
 	for(int i=0 ; i<n_robots ; i++)
 	{
@@ -154,6 +190,40 @@ int main() {
 		object_orientations.push_back(obj_ori);
 	}
 
+	// the rendering loop has its own models and object poses, updated from the simulation thread
+	vector<Sai2Model::Sai2Model*> render_robots;
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		render_robots.push_back(new Sai2Model::Sai2Model(robot_files[i], false));
+		render_robots[i]->_q = robots[i]->_q;
+		render_robots[i]->updateKinematics();
+	}
+	vector<Vector3d> render_object_positions = object_positions;
+	vector<Quaterniond> render_object_orientations = object_orientations;
+	render_state = new PandaUtils::RenderStateBuffer(robots, n_objects);
+
+	fSimulationRunning = true;
+	thread sim_thread(simulation, robots, sim);
+
+	if(simviz_mode.headless)
+	{
+		auto update_graphics = [&]()
+		{
+			render_state->update(render_robots, render_object_positions, render_object_orientations);
+			for(int i=0 ; i<n_robots ; i++)
+			{
+				graphics->updateGraphics(robot_names[i], render_robots[i]);
+			}
+			for(int i=0 ; i< n_objects ; i++)
+			{
+				graphics->updateObjectGraphics(object_names[i], render_object_positions[i], render_object_orientations[i]);
+			}
+		};
+		PandaUtils::runHeadless(simviz_mode, graphics, camera_name, update_graphics, fSimulationRunning);
+		sim_thread.join();
+		return 0;
+	}
+
 	/*------- Set up visualization -------*/
 	// set up error callback
 	glfwSetErrorCallback(glfwError);
@@ -188,23 +258,29 @@ int main() {
 	// cache variables
 	double last_cursorx, last_cursory;
 
-	fSimulationRunning = true;
-	thread sim_thread(simulation, robots, sim);
+	// cleaned areas of the board over the floor, from its own redis connection since the
+	// simulation thread uses the other one
+	RedisClient coverage_redis_client;
+	coverage_redis_client.connect();
+	PandaUtils::CoverageMapOverlay coverage_overlay(graphics->_world, graphics->getCamera(camera_name), COVERAGE_MAP_KEY);
 
 	// while window is open:
 	while (!glfwWindowShouldClose(window))
 	{
+		render_state->update(render_robots, render_object_positions, render_object_orientations);
+
 		// update graphics. this automatically waits for the correct amount of time
 		int width, height;
 		glfwGetFramebufferSize(window, &width, &height);
 		for(int i=0 ; i<n_robots ; i++)
 		{
-			graphics->updateGraphics(robot_names[i], robots[i]);
+			graphics->updateGraphics(robot_names[i], render_robots[i]);
 		}
 		for(int i=0 ; i< n_objects ; i++)
 		{
-			graphics->updateObjectGraphics(object_names[i], object_positions[i], object_orientations[i]);
+			graphics->updateObjectGraphics(object_names[i], render_object_positions[i], render_object_orientations[i]);
 		}
+		coverage_overlay.update(coverage_redis_client, height);
 		graphics->render(camera_name, width, height);
 
 		// swap buffers
@@ -298,6 +374,7 @@ void simulation(vector<Sai2Model::Sai2Model*> robots, Simulation::Sai2Simulation
 	{
 		redis_client.setEigenMatrixJSON(TORQUES_COMMANDED_KEYS[i], VectorXd::Zero(robots[i]->dof()));
 	}
+	snapshots->restoreRedis(redis_client);
 
 	// Add force sensor to the end-effector
 	string link_name = "link7";
@@ -308,18 +385,17 @@ void simulation(vector<Sai2Model::Sai2Model*> robots, Simulation::Sai2Simulation
 	Vector3d sensed_force_right = Vector3d::Zero();
 	Vector3d sensed_moment_right = Vector3d::Zero();
 
-	// create a timer
-	LoopTimer timer;
-	timer.initializeTimer();
-	timer.setLoopFrequency(1000); 
-	bool fTimerDidSleep = true;
-	double start_time = timer.elapsedTime(); //secs
-	double last_time = start_time;
+	// sim time, paced at the time scale
+	const double sim_dt = 0.001;
+	PandaUtils::SimClock sim_clock(time_scale);
+
+	PandaUtils::AdaptiveStepper stepper(sim, robot_names, robots);
 
 	unsigned long long simulation_counter = 0;
 
-	while (fSimulationRunning) {
-		fTimerDidSleep = timer.waitForNextLoop();
+	PandaUtils::configureRealtimeThread("simulation", PandaUtils::RealtimeConfig::fifo(70, PandaUtils::simulationCpus()));
+
+	while (fSimulationRunning && sim_clock.waitForNextStep(sim_dt)) {
 
 		for(int i=0 ; i<n_robots ; i++)
 		{
@@ -335,9 +411,14 @@ void simulation(vector<Sai2Model::Sai2Model*> robots, Simulation::Sai2Simulation
 		}
 
 		// integrate forward
-		double curr_time = timer.elapsedTime();
-		double loop_dt = curr_time - last_time; 
-		sim->integrate(loop_dt);
+		if(flag_adaptive_substeps)
+		{
+			stepper.integrate(sim_dt);
+		}
+		else
+		{
+			sim->integrate(sim_dt);
+		}
 
 		// read joint positions, velocities, update model
 		for(int i=0 ; i<n_robots ; i++)
@@ -352,6 +433,7 @@ void simulation(vector<Sai2Model::Sai2Model*> robots, Simulation::Sai2Simulation
 		{
 			sim->getObjectPosition(object_names[i], object_positions[i], object_orientations[i]);
 		}
+		render_state->publish(robots, object_positions, object_orientations);
 
 		// write new robot state to redis
 		for(int i=0 ; i<n_robots ; i++)
@@ -360,7 +442,7 @@ void simulation(vector<Sai2Model::Sai2Model*> robots, Simulation::Sai2Simulation
 			redis_client.setEigenMatrixJSON(JOINT_VELOCITIES_KEYS[i], robots[i]->_dq.head<7>());
 			redis_client.set(GRIPPER_CURRENT_WIDTH_KEYS[i], to_string(gripper_widths[i]));
 		}
-		redis_client.set(TIMESTAMP_KEY, to_string(curr_time));
+		redis_client.set(TIMESTAMP_KEY, to_string(sim_clock.time() + sim_dt));
 
 		// read end-effector task forces from the force sensor simulation
 		force_sensor_right->update(sim);
@@ -371,19 +453,23 @@ void simulation(vector<Sai2Model::Sai2Model*> robots, Simulation::Sai2Simulation
 		// write task force in redis
 		redis_client.setEigenMatrixJSON(FORCE_SENSED_KEYS[0], -f_sensed_right);
 
-		//update last time
-		last_time = curr_time;
+		snapshots->update(sim, redis_client, sim_dt);
 
 		simulation_counter++;
 	}
 
 
 
-	double end_time = timer.elapsedTime();
+	double end_time = sim_clock.time();
 	std::cout << "\n";
-	std::cout << "Simulation Loop run time  : " << end_time << " seconds\n";
-	std::cout << "Simulation Loop updates   : " << timer.elapsedCycles() << "\n";
-	std::cout << "Simulation Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+	std::cout << "Simulation Loop run time  : " << end_time << " seconds of sim time\n";
+	std::cout << "Simulation Loop updates   : " << simulation_counter << "\n";
+	std::cout << "Simulation Loop frequency : " << simulation_counter/end_time << "Hz of sim time\n";
+	if(flag_adaptive_substeps)
+	{
+		std::cout << "Mean integration steps    : " << stepper.meanSubsteps() << " per loop, " << 100*stepper.contactFraction() << "% of the loops in contact\n";
+	}
+	std::cout << "Time scale                : " << sim_clock.measuredTimeScale() << "\n";
 }
 
 //------------------------------------------------------------------------------
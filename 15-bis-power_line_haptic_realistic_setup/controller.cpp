@@ -5,10 +5,15 @@
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
+#include "timer/PrecisionLoopTimer.h"
+#include "timer/LoopHealth.h"
+#include "threads/RealtimeThread.h"
 #include "tasks/JointTask.h"
 #include "tasks/PosOriTask.h"
 #include "haptic_tasks/HapticController.h"
-#include "haptic_tasks/BilateralPassivityController.h"
+#include "passivity/HapticPassivityController.h"
+#include "model/MassMatrixInverse.h"
+#include "net/PerceptualDeadband.h"
 
 #include <iostream>
 #include <string>
@@ -76,6 +81,7 @@ const string ALLGERO_CONTROL_MODE_KEY = "sai2::allegroHand::controller::control_
 const string ALLGERO_TORQUE_COMMANDED_KEY = "sai2::allegroHand::controller::joint_torques_commanded";
 const string ALLGERO_POSITION_COMMANDED_KEY = "sai2::allegroHand::controller::joint_positions_commanded";
 const string ALLGERO_PALM_ORIENTATION_KEY = "sai2::allegroHand::controller::palm_orientation";
+const string LOOP_HEALTH_KEY = "sai2::WarehouseSimulation::controller::loop_health";
 
 
 //// Haptic device related keys ////
@@ -141,6 +147,7 @@ vector<string> DEVICE_SENSED_TORQUE_KEYS = {
 };
 
 const bool flag_simulation = false;
+
 // const bool flag_simulation = true;
 
 const bool inertia_regularization = true;
@@ -220,6 +227,7 @@ int main() {
 
 	// prepare robot task controllers
 	vector<int> dof;
+	vector<PandaUtils::MassMatrixInverse<7>*> mass_matrix_inverses;
 	vector<VectorXd> command_torques;
 	vector<VectorXd> coriolis;
 	vector<MatrixXd> N_prec;
@@ -253,6 +261,7 @@ int main() {
 	for(int i=0 ; i<n_robots ; i++)
 	{
 		dof.push_back(robots[i]->dof());
+		mass_matrix_inverses.push_back(new PandaUtils::MassMatrixInverse<7>(dof[i], inertia_regularization ? 0.07 : 0.0));
 		command_torques.push_back(VectorXd::Zero(dof[i]));
 		coriolis.push_back(VectorXd::Zero(dof[i]));
 		N_prec.push_back(MatrixXd::Identity(dof[i],dof[i]));
@@ -331,7 +340,7 @@ int main() {
 	bool close_gripper = true;
 
 	// passivity
-	vector<Sai2Primitives::BilateralPassivityController*> passivity_controllers;
+	vector<PandaUtils::HapticPassivityController*> passivity_controllers;
 	vector<Vector3d> passivity_damping_force;
 	vector<Vector3d> haptic_force_plus_passivity;
 
@@ -378,7 +387,8 @@ int main() {
 		previous_gripper_state.push_back(false);
 
 		// passivity controller		
-		passivity_controllers.push_back(new Sai2Primitives::BilateralPassivityController(posori_tasks[i], teleop_tasks[i]));
+		passivity_controllers.push_back(new PandaUtils::HapticPassivityController(0.001));
+		passivity_controllers[i]->setMaxDamping(0.9 * max_damping(0), 0.9 * max_damping(1));
 		passivity_damping_force.push_back(Vector3d::Zero());
 		haptic_force_plus_passivity.push_back(Vector3d::Zero());
 
@@ -438,6 +448,11 @@ int main() {
 		coriolis_from_robots.push_back(VectorXd::Zero(7));
 	}
 
+	// adaptive rate of the device commands for the constrained links, the commands go when
+	// they change perceptibly, within a budget per device : controller15bis --deadband 200
+	PandaUtils::DeadbandConfig deadband_config = PandaUtils::DeadbandConfig::fromArgs(argc, argv);
+	vector<PandaUtils::PerceptualDeadband> command_deadbands(n_robots, PandaUtils::PerceptualDeadband(deadband_config));
+
 	for(int i=0 ; i<n_robots ; i++)
 	{
 		// read
@@ -461,8 +476,11 @@ int main() {
 
 		// write
 		redis_client.addEigenToWrite(JOINT_TORQUES_COMMANDED_KEYS[i], command_torques[i]);
-		redis_client.addEigenToWrite(DEVICE_COMMANDED_FORCE_KEYS[i], haptic_force_plus_passivity[i]);
-		redis_client.addDoubleToWrite(DEVICE_COMMANDED_GRIPPER_FORCE_KEYS[i], teleop_tasks[i]->_commanded_gripper_force_device);
+		if(!deadband_config.enabled())
+		{
+			redis_client.addEigenToWrite(DEVICE_COMMANDED_FORCE_KEYS[i], haptic_force_plus_passivity[i]);
+			redis_client.addDoubleToWrite(DEVICE_COMMANDED_GRIPPER_FORCE_KEYS[i], teleop_tasks[i]->_commanded_gripper_force_device);
+		}
 	}
 
 	redis_client.addEigenToRead(FORCE_SENSED_KEYS[0], f_sensed[0]);
@@ -474,19 +492,20 @@ int main() {
 	redis_client.addEigenToWrite(ALLGERO_POSITION_COMMANDED_KEY, allegro_desired_config);
 	redis_client.addEigenToWrite(ALLGERO_PALM_ORIENTATION_KEY, R_world_palm);
 
-	// create a timer
-	LoopTimer timer;
+	// create a timer, that spins the last 100 us before the deadlines of the haptic loop
+	PandaUtils::PrecisionLoopTimer timer(100e-6);
 	timer.initializeTimer();
 	timer.setLoopFrequency(1000); 
+	PandaUtils::LoopHealth loop_health(1000);
+	PandaUtils::configureRealtimeThread("controller", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
 	double current_time = 0;
 	double prev_time = 0;
 	double dt = 0;
-	bool fTimerDidSleep = true;
 	double start_time = timer.elapsedTime(); //secs
 
 	while (runloop) {
 		// wait for next scheduled loop
-		timer.waitForNextLoop();
+		loop_health.waitForNextLoop(timer);
 		current_time = timer.elapsedTime() - start_time;
 		dt = current_time - prev_time;
 
@@ -505,13 +524,7 @@ int main() {
 			{
 				robots[i]->updateKinematics();
 				robots[i]->_M = mass_from_robots[i];
-				if(inertia_regularization)
-				{
-					robots[i]->_M(4,4) += 0.07;
-					robots[i]->_M(5,5) += 0.07;
-					robots[i]->_M(6,6) += 0.07;
-				}
-				robots[i]->_M_inv = robots[i]->_M.inverse();
+				mass_matrix_inverses[i]->update(robots[i]);
 				coriolis[i] = coriolis_from_robots[i];
 			}
 
@@ -589,6 +602,7 @@ int main() {
 
 					teleop_tasks[i]->setRobotCenter(workspace_centers[i], posori_tasks[i]->_current_orientation);
 					teleop_tasks[i]->setDeviceCenter(haptic_centers[i], teleop_tasks[i]->_current_rotation_device);
+					passivity_controllers[i]->reset();
 					
 					state[i] = HAPTIC_CONTROL;
 				}
@@ -612,6 +626,7 @@ int main() {
 
 					teleop_tasks[i]->setRobotCenter(workspace_centers[i], posori_tasks[i]->_current_orientation);
 					teleop_tasks[i]->setDeviceCenter(haptic_centers[i], teleop_tasks[i]->_current_rotation_device);
+					passivity_controllers[i]->reset();
 					
 					state[i] = HAPTIC_CONTROL;
 				}
@@ -645,7 +660,8 @@ int main() {
 
 			command_torques[0] = joint_task_torques[0] + coriolis[0] + posori_task_torques[0];
 
-			passivity_controllers[0]->computePOPCForce(passivity_damping_force[0]);
+			passivity_controllers[0]->update(teleop_tasks[0]->_commanded_force_device, teleop_tasks[0]->_current_trans_velocity_device);
+			passivity_damping_force[0] = passivity_controllers[0]->dampingForce();
 
 			if(gripper_state[0] && !previous_gripper_state[0])
 			{
@@ -672,6 +688,8 @@ int main() {
 				// joint_tasks[0]->_desired_position = robot[0]->_q;
 				// set current haptic device position
 				teleop_tasks[0]->setDeviceCenter(teleop_tasks[0]->_current_position_device, teleop_tasks[0]->_current_rotation_device);
+				// no passivity damping outside of the haptic control
+				passivity_damping_force[0].setZero();
 
 				state[0] = MAINTAIN_POSITION;
 			}			
@@ -714,7 +732,8 @@ int main() {
 
 			command_torques[1] = joint_task_torques[1] + coriolis[1] + posori_task_torques[1];
 
-			passivity_controllers[1]->computePOPCForce(passivity_damping_force[1]);
+			passivity_controllers[1]->update(teleop_tasks[1]->_commanded_force_device, teleop_tasks[1]->_current_trans_velocity_device);
+			passivity_damping_force[1] = passivity_controllers[1]->dampingForce();
 
 			if(remote_enabled == 0)
 			{
@@ -723,6 +742,8 @@ int main() {
 				// joint_tasks[1]->_desired_position = robot[1]->_q;
 				// set current haptic device position
 				teleop_tasks[1]->setDeviceCenter(teleop_tasks[1]->_current_position_device, teleop_tasks[1]->_current_rotation_device);
+				// no passivity damping outside of the haptic control
+				passivity_damping_force[1].setZero();
 
 				state[1] = MAINTAIN_POSITION;
 			}		
@@ -744,8 +765,23 @@ int main() {
 			haptic_force_plus_passivity[i] = teleop_tasks[i]->_commanded_force_device + passivity_damping_force[i];
 		}
 		redis_client.writeAllSetupValues();
+		for(int i=0 ; i<n_robots ; i++)
+		{
+			if(deadband_config.enabled() && command_deadbands[i].update(teleop_tasks[i]->_current_position_device,
+					haptic_force_plus_passivity[i], current_time))
+			{
+				redis_client.setEigenMatrixJSON(DEVICE_COMMANDED_FORCE_KEYS[i], haptic_force_plus_passivity[i]);
+				redis_client.set(DEVICE_COMMANDED_GRIPPER_FORCE_KEYS[i], to_string(teleop_tasks[i]->_commanded_gripper_force_device));
+			}
+		}
 
 		prev_time = current_time;
+
+		if(controller_counter % 1000 == 0)
+		{
+			loop_health.publish(redis_client, LOOP_HEALTH_KEY);
+		}
+
 		controller_counter++;
 	}
 
@@ -768,6 +804,14 @@ int main() {
 	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
 	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
     std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+    loop_health.print(std::cout);
+	if(deadband_config.enabled())
+	{
+		for(int i=0 ; i<n_robots ; i++)
+		{
+			std::cout << "device commands " << i << " : " << command_deadbands[i].summary() << "\n";
+		}
+	}
 
 	return 0;
 }
@@ -5,10 +5,19 @@
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
+#include "timer/PrecisionLoopTimer.h"
+#include "timer/LoopHealth.h"
+#include "threads/RealtimeThread.h"
+#include "timer/CycleProfiler.h"
+#include "timer/LoopDashboard.h"
 #include "tasks/JointTask.h"
 #include "tasks/PosOriTask.h"
 #include "haptic_tasks/HapticController.h"
-#include "haptic_tasks/BilateralPassivityController.h"
+#include "passivity/HapticPassivityController.h"
+#include "net/UdpHapticDevice.h"
+#include "redis/HapticDeviceBundle.h"
+#include "net/PerceptualDeadband.h"
+#include "model/MassMatrixInverse.h"
 
 #include <iostream>
 #include <string>
@@ -45,6 +54,8 @@ vector<string> FORCE_SENSED_KEYS = {
 
 const string REMOTE_ENABLED_KEY = "sai2::WarehouseSimulation::sensors::remote_enabled";
 const string RESTART_CYCLE_KEY = "sai2::WarehouseSimulation::sensors::restart_cycle";
+const string LOOP_HEALTH_KEY = "sai2::WarehouseSimulation::controller::loop_health";
+const string CYCLE_PROFILE_KEY = "sai2::WarehouseSimulation::controller::cycle_profile";
 
 // - write
 vector<string> JOINT_TORQUES_COMMANDED_KEYS = {
@@ -179,7 +190,7 @@ unsigned long long controller_counter = 0;
 
 RedisClient redis_client;
 
-int main() {
+int main(int argc, char** argv) {
 
 
 	if(!flag_simulation)
@@ -247,6 +258,7 @@ int main() {
 
 	// prepare robot task controllers
 	vector<int> dof;
+	vector<PandaUtils::MassMatrixInverse<7>*> mass_matrix_inverses;
 	vector<VectorXd> command_torques;
 	vector<VectorXd> coriolis;
 	vector<MatrixXd> N_prec;
@@ -280,6 +292,7 @@ int main() {
 	for(int i=0 ; i<n_robots ; i++)
 	{
 		dof.push_back(robots[i]->dof());
+		mass_matrix_inverses.push_back(new PandaUtils::MassMatrixInverse<7>(dof[i], inertia_regularization ? 0.07 : 0.0));
 		command_torques.push_back(VectorXd::Zero(dof[i]));
 		coriolis.push_back(VectorXd::Zero(dof[i]));
 		N_prec.push_back(MatrixXd::Identity(dof[i],dof[i]));
@@ -335,7 +348,7 @@ int main() {
 	string gripper_mode_to_write = "m";
 
 	// passivity
-	vector<Sai2Primitives::BilateralPassivityController*> passivity_controllers;
+	vector<PandaUtils::HapticPassivityController*> passivity_controllers;
 	vector<Vector3d> passivity_damping_force;
 	vector<Vector3d> haptic_force_plus_passivity;
 
@@ -375,7 +388,8 @@ int main() {
 		previous_gripper_state.push_back(false);
 
 		// passivity controller		
-		passivity_controllers.push_back(new Sai2Primitives::BilateralPassivityController(posori_tasks[i], teleop_tasks[i]));
+		passivity_controllers.push_back(new PandaUtils::HapticPassivityController(0.001));
+		passivity_controllers[i]->setMaxDamping(0.9 * max_damping(0), 0.9 * max_damping(1));
 		passivity_damping_force.push_back(Vector3d::Zero());
 		haptic_force_plus_passivity.push_back(Vector3d::Zero());
 
@@ -430,6 +444,33 @@ int main() {
 		coriolis_from_robots.push_back(VectorXd::Zero(7));
 	}
 
+	// haptic devices from a remote haptic station, device i on the ports after the ones of
+	// device 0 : controller15 --udp-teleop 9900 station 9901, or from the binary records of
+	// haptic_bundle_bridge when all the devices have one, or from the device keys
+	PandaUtils::UdpTeleopConfig udp_config = PandaUtils::UdpTeleopConfig::fromArgs(argc, argv);
+	vector<PandaUtils::HapticDeviceChannel*> device_channels;
+	bool f_device_bundles = !udp_config.enabled();
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		f_device_bundles = f_device_bundles && PandaUtils::RedisHapticDevice::available(redis_client, i);
+	}
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		if(udp_config.enabled())
+		{
+			device_channels.push_back(new PandaUtils::UdpHapticDevice(udp_config.forDevice(i)));
+		}
+		else if(f_device_bundles)
+		{
+			device_channels.push_back(new PandaUtils::RedisHapticDevice(redis_client, i));
+		}
+	}
+
+	// adaptive rate of the device commands for the constrained links, the commands go when
+	// they change perceptibly, within a budget per device : controller15 --deadband 200
+	PandaUtils::DeadbandConfig deadband_config = PandaUtils::DeadbandConfig::fromArgs(argc, argv);
+	vector<PandaUtils::PerceptualDeadband> command_deadbands(n_robots, PandaUtils::PerceptualDeadband(deadband_config));
+
 	redis_client.createReadCallback(0);
 	redis_client.createWriteCallback(0);
 
@@ -439,14 +480,17 @@ int main() {
 		redis_client.addEigenToReadCallback(0, JOINT_ANGLES_KEYS[i], robots[i]->_q);
 		redis_client.addEigenToReadCallback(0, JOINT_VELOCITIES_KEYS[i], robots[i]->_dq);
 		
-		redis_client.addEigenToReadCallback(0, DEVICE_POSITION_KEYS[i], teleop_tasks[i]->_current_position_device);
-		redis_client.addEigenToReadCallback(0, DEVICE_ROTATION_KEYS[i], teleop_tasks[i]->_current_rotation_device);
-		redis_client.addEigenToReadCallback(0, DEVICE_TRANS_VELOCITY_KEYS[i], teleop_tasks[i]->_current_trans_velocity_device);
-		redis_client.addEigenToReadCallback(0, DEVICE_ROT_VELOCITY_KEYS[i], teleop_tasks[i]->_current_rot_velocity_device);
-		redis_client.addEigenToReadCallback(0, DEVICE_SENSED_FORCE_KEYS[i], teleop_tasks[i]->_sensed_force_device);
-		redis_client.addEigenToReadCallback(0, DEVICE_SENSED_TORQUE_KEYS[i], teleop_tasks[i]->_sensed_torque_device);
-		redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_POSITION_KEYS[i], teleop_tasks[i]->_current_position_gripper_device);
-		redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_VELOCITY_KEYS[i], teleop_tasks[i]->_current_gripper_velocity_device);
+		if(device_channels.empty())
+		{
+			redis_client.addEigenToReadCallback(0, DEVICE_POSITION_KEYS[i], teleop_tasks[i]->_current_position_device);
+			redis_client.addEigenToReadCallback(0, DEVICE_ROTATION_KEYS[i], teleop_tasks[i]->_current_rotation_device);
+			redis_client.addEigenToReadCallback(0, DEVICE_TRANS_VELOCITY_KEYS[i], teleop_tasks[i]->_current_trans_velocity_device);
+			redis_client.addEigenToReadCallback(0, DEVICE_ROT_VELOCITY_KEYS[i], teleop_tasks[i]->_current_rot_velocity_device);
+			redis_client.addEigenToReadCallback(0, DEVICE_SENSED_FORCE_KEYS[i], teleop_tasks[i]->_sensed_force_device);
+			redis_client.addEigenToReadCallback(0, DEVICE_SENSED_TORQUE_KEYS[i], teleop_tasks[i]->_sensed_torque_device);
+			redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_POSITION_KEYS[i], teleop_tasks[i]->_current_position_gripper_device);
+			redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_VELOCITY_KEYS[i], teleop_tasks[i]->_current_gripper_velocity_device);
+		}
 
 		if(!flag_simulation)
 		{
@@ -456,8 +500,11 @@ int main() {
 
 		// write
 		redis_client.addEigenToWriteCallback(0, JOINT_TORQUES_COMMANDED_KEYS[i], command_torques[i]);
-		redis_client.addEigenToWriteCallback(0, DEVICE_COMMANDED_FORCE_KEYS[i], haptic_force_plus_passivity[i]);
-		redis_client.addDoubleToWriteCallback(0, DEVICE_COMMANDED_GRIPPER_FORCE_KEYS[i], teleop_tasks[i]->_commanded_gripper_force_device);
+		if(device_channels.empty() && !deadband_config.enabled())
+		{
+			redis_client.addEigenToWriteCallback(0, DEVICE_COMMANDED_FORCE_KEYS[i], haptic_force_plus_passivity[i]);
+			redis_client.addDoubleToWriteCallback(0, DEVICE_COMMANDED_GRIPPER_FORCE_KEYS[i], teleop_tasks[i]->_commanded_gripper_force_device);
+		}
 	}
 
 	// redis_client.addEigenToReadCallback(0, FORCE_SENSED_KEYS[0], f_sensed[0]);
@@ -468,25 +515,46 @@ int main() {
 
 	redis_client.addStringToWriteCallback(0, GRIPPER_MODE_KEYS[0], gripper_mode_to_write);
 
-	// create a timer
-	LoopTimer timer;
+	// create a timer, that spins the last 100 us before the deadlines of the haptic loop
+	PandaUtils::PrecisionLoopTimer timer(100e-6);
 	timer.initializeTimer();
 	timer.setLoopFrequency(1000); 
+	PandaUtils::LoopHealth loop_health(1000);
+	PandaUtils::configureRealtimeThread("controller", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
+	// split of the cycles between the stages, with -DPANDA_CYCLE_PROFILER=ON
+	PandaUtils::CycleProfiler profiler;
+	const int STAGE_REDIS_READ = profiler.addStage("redis read");
+	const int STAGE_MODEL = profiler.addStage("updateModel");
+	const int STAGE_FORCE_SENSOR = profiler.addStage("force sensor");
+	const int STAGE_TASK_MODEL = profiler.addStage("updateTaskModel");
+	const int STAGE_HAPTIC = profiler.addStage("haptic commands");
+	const int STAGE_TORQUES = profiler.addStage("computeTorques");
+	const int STAGE_PASSIVITY = profiler.addStage("passivity");
+	const int STAGE_STATE_MACHINE = profiler.addStage("state machine");
+	const int STAGE_REDIS_WRITE = profiler.addStage("redis write");
+	// rate, p99 and missed deadlines for the simviz overlay, at 4 Hz
+	PandaUtils::LoopDashboard dashboard("controller", loop_health, &profiler);
 	double current_time = 0;
 	double prev_time = 0;
 	double dt = 0;
-	bool fTimerDidSleep = true;
 	double start_time = timer.elapsedTime(); //secs
 
 	while (runloop) {
 		// wait for next scheduled loop
-		timer.waitForNextLoop();
+		loop_health.waitForNextLoop(timer);
 		current_time = timer.elapsedTime() - start_time;
 		dt = current_time - prev_time;
 
+		PANDA_PROFILE_CYCLE(profiler);
+		PANDA_PROFILE_STAGE(STAGE_REDIS_READ);
 		redis_client.executeReadCallback(0);
+		for(unsigned int i=0 ; i<device_channels.size() ; i++)
+		{
+			device_channels[i]->readDevice(*teleop_tasks[i]);
+		}
 
 		// read robot state from redis and update robot model
+		PANDA_PROFILE_STAGE(STAGE_MODEL);
 		for(int i=0 ; i<n_robots ; i++)
 		{
 			// update model
@@ -499,19 +567,14 @@ int main() {
 			{
 				robots[i]->updateKinematics();
 				robots[i]->_M = mass_from_robots[i];
-				if(inertia_regularization)
-				{
-					robots[i]->_M(4,4) += 0.07;
-					robots[i]->_M(5,5) += 0.07;
-					robots[i]->_M(6,6) += 0.07;
-				}
-				robots[i]->_M_inv = robots[i]->_M.inverse();
+				mass_matrix_inverses[i]->update(robots[i]);
 				coriolis[i] = coriolis_from_robots[i];
 			}
 
 		}
 
 		// compute hand inertial forces (only for second robot)
+		PANDA_PROFILE_STAGE(STAGE_FORCE_SENSOR);
 		for(int i=1 ; i<n_robots ; i++)
 		{
 			ee_velocity[i] = posori_tasks[i]->_current_velocity + posori_tasks[i]->_current_angular_velocity.cross(ee_com_in_sensor_frame[i]);
@@ -544,6 +607,7 @@ int main() {
 
 
 		// use gripper as switche
+		PANDA_PROFILE_STAGE(STAGE_STATE_MACHINE);
 		for(int i=0 ; i<n_robots ; i++)
 		{
 			teleop_tasks[i]->UseGripperAsSwitch();
@@ -559,14 +623,18 @@ int main() {
 			if(state[i] == GOTO_INITIAL_CONFIG)
 			{
 				// update robot home position task model
+				PANDA_PROFILE_STAGE(STAGE_TASK_MODEL);
 				N_prec[i].setIdentity();
 				joint_tasks[i]->updateTaskModel(N_prec[i]);
 				// compute robot torques
+				PANDA_PROFILE_STAGE(STAGE_TORQUES);
 				joint_tasks[i]->computeTorques(joint_task_torques[i]);
 				command_torques[i] = joint_task_torques[i] + coriolis[i];
 				
 				// compute homing haptic device
+				PANDA_PROFILE_STAGE(STAGE_HAPTIC);
 				teleop_tasks[i]->HomingTask();
+				PANDA_PROFILE_STAGE(STAGE_STATE_MACHINE);
 
 				if(remote_enabled==1 && (joint_tasks[i]->_desired_position - joint_tasks[i]->_current_position).norm() < 0.2 && teleop_tasks[i]->device_homed && gripper_state[i])
 				{
@@ -577,6 +645,7 @@ int main() {
 
 					teleop_tasks[i]->setRobotCenter(workspace_centers[i], posori_tasks[i]->_current_orientation);
 					teleop_tasks[i]->setDeviceCenter(haptic_centers[i], teleop_tasks[i]->_current_rotation_device);
+					passivity_controllers[i]->reset();
 					
 					state[i] = HAPTIC_CONTROL;
 				}
@@ -585,14 +654,18 @@ int main() {
 			else if(state[i] == MAINTAIN_POSITION)
 			{
 				// update robot home position task model
+				PANDA_PROFILE_STAGE(STAGE_TASK_MODEL);
 				N_prec[i].setIdentity();
 				joint_tasks[i]->updateTaskModel(N_prec[i]);
 				// compute robot torques
+				PANDA_PROFILE_STAGE(STAGE_TORQUES);
 				joint_tasks[i]->computeTorques(joint_task_torques[i]);
 				command_torques[i] = joint_task_torques[i] + coriolis[i];
 
 				// compute homing haptic device
+				PANDA_PROFILE_STAGE(STAGE_HAPTIC);
 				teleop_tasks[i]->HomingTask();
+				PANDA_PROFILE_STAGE(STAGE_STATE_MACHINE);
 
 				if (remote_enabled==1 && gripper_state[i])
 				{
@@ -600,6 +673,7 @@ int main() {
 
 					teleop_tasks[i]->setRobotCenter(workspace_centers[i], posori_tasks[i]->_current_orientation);
 					teleop_tasks[i]->setDeviceCenter(haptic_centers[i], teleop_tasks[i]->_current_rotation_device);
+					passivity_controllers[i]->reset();
 					
 					state[i] = HAPTIC_CONTROL;
 				}
@@ -619,19 +693,23 @@ int main() {
 		if(state[0] == HAPTIC_CONTROL)
 		{
 			// update tasks model
+			PANDA_PROFILE_STAGE(STAGE_TASK_MODEL);
 			N_prec[0].setIdentity();
 			posori_tasks[0]->updateTaskModel(N_prec[0]);
 			N_prec[0] = posori_tasks[0]->_N;
 			joint_tasks[0]->updateTaskModel(N_prec[0]);
 
 			//compute haptic commands (only position control) - without force feedback (force_sensed=0)
+			PANDA_PROFILE_STAGE(STAGE_HAPTIC);
 			teleop_tasks[0]->computeHapticCommands3d(posori_tasks[0]->_desired_position);
 
 			// compute robot set torques
+			PANDA_PROFILE_STAGE(STAGE_TORQUES);
 			posori_tasks[0]->computeTorques(posori_task_torques[0]);
 			joint_tasks[0]->computeTorques(joint_task_torques[0]);
 
 			command_torques[0] = joint_task_torques[0] + coriolis[0] + posori_task_torques[0];
+			PANDA_PROFILE_STAGE(STAGE_STATE_MACHINE);
 
 			if(gripper_state[0] && !previous_gripper_state[0])
 			{
@@ -679,12 +757,14 @@ int main() {
 		if(state[1] == HAPTIC_CONTROL)
 		{
 			// update tasks model
+			PANDA_PROFILE_STAGE(STAGE_TASK_MODEL);
 			N_prec[1].setIdentity();
 			posori_tasks[1]->updateTaskModel(N_prec[1]);
 			N_prec[1] = posori_tasks[1]->_N;
 			joint_tasks[1]->updateTaskModel(N_prec[1]);
 			
 			// compute haptic commands
+			PANDA_PROFILE_STAGE(STAGE_HAPTIC);
 			if(gripper_state[1]) //Full control
 			{
 				if(!previous_gripper_state[1])
@@ -703,12 +783,16 @@ int main() {
 			}
 
 			// compute robot set torques
+			PANDA_PROFILE_STAGE(STAGE_TORQUES);
 			posori_tasks[1]->computeTorques(posori_task_torques[1]);
 			joint_tasks[1]->computeTorques(joint_task_torques[1]);
 
 			command_torques[1] = joint_task_torques[1] + coriolis[1] + posori_task_torques[1];
 
-			passivity_controllers[1]->computePOPCForce(passivity_damping_force[1]);
+			PANDA_PROFILE_STAGE(STAGE_PASSIVITY);
+			passivity_controllers[1]->update(teleop_tasks[1]->_commanded_force_device, teleop_tasks[1]->_current_trans_velocity_device);
+			passivity_damping_force[1] = passivity_controllers[1]->dampingForce();
+			PANDA_PROFILE_STAGE(STAGE_STATE_MACHINE);
 
 			if(remote_enabled == 0)
 			{
@@ -717,6 +801,8 @@ int main() {
 				// joint_tasks[1]->_desired_position = robot[1]->_q;
 				// set current haptic device position
 				teleop_tasks[1]->setDeviceCenter(teleop_tasks[1]->_current_position_device, teleop_tasks[1]->_current_rotation_device);
+				// no passivity damping outside of the haptic control
+				passivity_damping_force[1].setZero();
 
 				state[1] = MAINTAIN_POSITION;
 			}		
@@ -1018,13 +1104,40 @@ int main() {
 		
 
 		// send to redis
+		PANDA_PROFILE_STAGE(STAGE_REDIS_WRITE);
 		for(int i=0 ; i<n_robots ; i++)
 		{
 			haptic_force_plus_passivity[i] = teleop_tasks[i]->_commanded_force_device + passivity_damping_force[i];
 		}
 		redis_client.executeWriteCallback(0);
+		for(int i=0 ; i<n_robots ; i++)
+		{
+			if(deadband_config.enabled() && !command_deadbands[i].update(teleop_tasks[i]->_current_position_device,
+					haptic_force_plus_passivity[i], current_time))
+			{
+				continue;
+			}
+			if(!device_channels.empty())
+			{
+				device_channels[i]->sendCommands(haptic_force_plus_passivity[i], Vector3d::Zero(),
+						teleop_tasks[i]->_commanded_gripper_force_device, current_time, posori_tasks[i]->_sigma_force);
+			}
+			else if(deadband_config.enabled())
+			{
+				redis_client.setEigenMatrixJSON(DEVICE_COMMANDED_FORCE_KEYS[i], haptic_force_plus_passivity[i]);
+				redis_client.set(DEVICE_COMMANDED_GRIPPER_FORCE_KEYS[i], to_string(teleop_tasks[i]->_commanded_gripper_force_device));
+			}
+		}
 
 		prev_time = current_time;
+
+		if(controller_counter % 1000 == 0)
+		{
+			loop_health.publish(redis_client, LOOP_HEALTH_KEY);
+			profiler.publish(redis_client, CYCLE_PROFILE_KEY);
+		}
+		dashboard.publishIfDue(redis_client);
+
 		controller_counter++;
 	}
 
@@ -1039,12 +1152,27 @@ int main() {
 		command_torques[i].setZero();
 		redis_client.setEigenMatrixJSON(JOINT_TORQUES_COMMANDED_KEYS[i], command_torques[i]);
 	}
+	for(unsigned int i=0 ; i<device_channels.size() ; i++)
+	{
+		device_channels[i]->sendCommands(Vector3d::Zero(), Vector3d::Zero(), 0, current_time);
+		cout << "haptic device channel " << i << " : " << device_channels[i]->summary() << endl;
+		delete device_channels[i];
+	}
+	if(deadband_config.enabled())
+	{
+		for(int i=0 ; i<n_robots ; i++)
+		{
+			cout << "device commands " << i << " : " << command_deadbands[i].summary() << endl;
+		}
+	}
 
 	double end_time = timer.elapsedTime();
 	std::cout << "\n";
 	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
 	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
     std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+    loop_health.print(std::cout);
+    profiler.print(std::cout);
 
 	return 0;
 }
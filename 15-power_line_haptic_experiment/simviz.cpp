@@ -8,8 +8,13 @@
 #include <dynamics3d.h>
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
+#include "threads/StartupTasks.h"
+#include "timer/LoopHealth.h"
+#include "timer/LoopDashboard.h"
+#include "graphics/LoopDashboardOverlay.h"
 
 #include "force_sensor/ForceSensorSim.h" 
+#include "threads/RealtimeThread.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
 
@@ -125,27 +130,41 @@ bool fRotPanTilt = false;
 int main() {
 	cout << "Loading URDF world model file: " << world_file << endl;
 
-	// start redis client
-	redis_client = RedisClient();
-	redis_client.connect();
-
-	// load graphics scene
-	auto graphics = new Sai2Graphics::Sai2Graphics(world_file, true);
+	// redis, graphics meshes, robot models and simulation world are independent, loaded in parallel
+	PandaUtils::StartupTasks startup;
+	auto redis_connected = startup.run("redis connect", []()
+	{
+		redis_client = RedisClient();
+		redis_client.connect();
+	});
+	auto graphics_loaded = startup.run("graphics meshes", []()
+	{
+		return new Sai2Graphics::Sai2Graphics(world_file, true);
+	});
+	auto robots_parsed = startup.run("robot models", []()
+	{
+		vector<Sai2Model::Sai2Model*> robots;
+		for(int i=0 ; i<n_robots ; i++)
+		{
+			robots.push_back(new Sai2Model::Sai2Model(robot_files[i], false));
+		}
+		return robots;
+	});
+	auto sim_built = startup.run("simulation world", []()
+	{
+		auto sim = new Simulation::Sai2Simulation(world_file, false);
+		sim->setCollisionRestitution(0);
+		sim->setCoeffFrictionStatic(0.8);
+		return sim;
+	});
+
+	redis_connected.get();
+	auto graphics = graphics_loaded.get();
 	Eigen::Vector3d camera_pos, camera_lookat, camera_vertical;
 	graphics->getCameraPose(camera_name, camera_pos, camera_vertical, camera_lookat);
-
-
-	// load robots
-	vector<Sai2Model::Sai2Model*> robots;
-	for(int i=0 ; i<n_robots ; i++)
-	{
-		robots.push_back(new Sai2Model::Sai2Model(robot_files[i], false));
-	}
-
-	// load simulation world
-	auto sim = new Simulation::Sai2Simulation(world_file, false);
-	sim->setCollisionRestitution(0);
-	sim->setCoeffFrictionStatic(0.8);
+	vector<Sai2Model::Sai2Model*> robots = robots_parsed.get();
+	auto sim = sim_built.get();
+	startup.report(cout);
 
 	// read joint positions, velocities, update model
 	for(int i=0 ; i<n_robots ; i++)
@@ -199,6 +218,12 @@ int main() {
 	// cache variables
 	double last_cursorx, last_cursory;
 
+	// health of the controller and simulation loops over the scene, from its own redis
+	// connection since the simulation thread uses the other one
+	RedisClient dashboard_redis_client;
+	dashboard_redis_client.connect();
+	PandaUtils::LoopDashboardOverlay dashboard_overlay(graphics->getCamera(camera_name), {"controller", "simulation"});
+
 	fSimulationRunning = true;
 	thread sim_thread(simulation, robots, sim);
 
@@ -216,6 +241,7 @@ int main() {
 		{
 			graphics->updateObjectGraphics(object_names[i], object_positions[i], object_orientations[i]);
 		}
+		dashboard_overlay.update(dashboard_redis_client, height);
 		graphics->render(camera_name, width, height);
 
 		// swap buffers
@@ -336,11 +362,15 @@ void simulation(vector<Sai2Model::Sai2Model*> robots, Simulation::Sai2Simulation
 	bool fTimerDidSleep = true;
 	double start_time = timer.elapsedTime(); //secs
 	double last_time = start_time;
+	PandaUtils::LoopHealth loop_health(1000);
+	PandaUtils::LoopDashboard dashboard("simulation", loop_health);
 
 	unsigned long long simulation_counter = 0;
 
+	PandaUtils::configureRealtimeThread("simulation", PandaUtils::RealtimeConfig::fifo(70, PandaUtils::simulationCpus()));
+
 	while (fSimulationRunning) {
-		fTimerDidSleep = timer.waitForNextLoop();
+		fTimerDidSleep = loop_health.waitForNextLoop(timer);
 
 		VectorXd command_torques_left = VectorXd::Zero(9);
 		VectorXd command_torques_right = VectorXd::Zero(7);
@@ -409,6 +439,7 @@ void simulation(vector<Sai2Model::Sai2Model*> robots, Simulation::Sai2Simulation
 		//update last time
 		last_time = curr_time;
 
+		dashboard.publishIfDue(redis_client);
 		simulation_counter++;
 	}
 
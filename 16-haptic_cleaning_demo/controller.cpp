@@ -5,10 +5,19 @@
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
+#include "timer/PrecisionLoopTimer.h"
+#include "timer/LoopHealth.h"
+#include "threads/RealtimeThread.h"
 #include "tasks/JointTask.h"
 #include "tasks/PosOriTask.h"
 #include "haptic_tasks/HapticController.h"
-#include "haptic_tasks/BilateralPassivityController.h"
+#include "passivity/HapticPassivityController.h"
+#include "net/UdpHapticDevice.h"
+#include "redis/HapticDeviceBundle.h"
+#include "model/MassMatrixInverse.h"
+#include "force_control/ForcePipeline.h"
+#include "coverage/CoverageMap.h"
+#include "redis/AsyncRedisWriter.h"
 
 #include <iostream>
 #include <string>
@@ -41,6 +50,10 @@ vector<string> FORCE_SENSED_KEYS = {
 
 const string REMOTE_ENABLED_KEY = "sai2::PandaApplications::sensors::remote_enabled";
 const string RESTART_CYCLE_KEY = "sai2::PandaApplications::sensors::restart_cycle";
+const string LOOP_HEALTH_KEY = "sai2::PandaApplications::controller::loop_health";
+// cleaned areas of the board, drawn by the simviz
+const string COVERAGE_MAP_KEY = "sai2::PandaApplications::controller::coverage_map";
+const string COVERAGE_KEY = "sai2::PandaApplications::controller::coverage";
 
 // - write
 vector<string> JOINT_TORQUES_COMMANDED_KEYS = {
@@ -151,7 +164,7 @@ unsigned long long controller_counter = 0;
 
 RedisClient redis_client;
 
-int main() {
+int main(int argc, char** argv) {
 
 
 	if(!flag_simulation)
@@ -202,6 +215,7 @@ int main() {
 
 	// prepare robot task controllers
 	vector<int> dof;
+	vector<PandaUtils::MassMatrixInverse<7>*> mass_matrix_inverses;
 	vector<VectorXd> command_torques;
 	vector<VectorXd> coriolis;
 	vector<MatrixXd> N_prec;
@@ -211,6 +225,8 @@ int main() {
 	vector<Sai2Primitives::PosOriTask*> posori_tasks;
 	vector<VectorXd> posori_task_torques;
 	vector<VectorXd> f_sensed;
+	// bias, hand gravity and sensor frame of the task in one update, not filtered
+	vector<PandaUtils::ForcePipeline*> force_pipelines;
 
 	vector<VectorXd> q_initial;
 	VectorXd q_init_1 = VectorXd::Zero(7);
@@ -230,6 +246,7 @@ int main() {
 	for(int i=0 ; i<n_robots ; i++)
 	{
 		dof.push_back(robots[i]->dof());
+		mass_matrix_inverses.push_back(new PandaUtils::MassMatrixInverse<7>(dof[i], inertia_regularization ? 0.07 : 0.0));
 		command_torques.push_back(VectorXd::Zero(dof[i]));
 		coriolis.push_back(VectorXd::Zero(dof[i]));
 		N_prec.push_back(MatrixXd::Identity(dof[i],dof[i]));
@@ -251,6 +268,8 @@ int main() {
 		Affine3d sensor_frame = Affine3d::Identity();
 		sensor_frame.translation() = Vector3d(0, 0, 0.12);
 		posori_tasks[i]->setForceSensorFrame(link_names[i], sensor_frame);
+		force_pipelines.push_back(new PandaUtils::ForcePipeline(1000));
+		force_pipelines[i]->setSensorFrame(sensor_frame, pos_in_link[i]);
 
 		posori_task_torques.push_back(VectorXd::Zero(dof[i]));
 		posori_tasks[i]->_use_interpolation_flag = false;
@@ -266,6 +285,31 @@ int main() {
 		f_sensed.push_back(VectorXd::Zero(6));	
 	}
 
+	// the board is a 1.0 x 0.8 m area of the floor centered under the home position of the
+	// tool, along the axes of the robot
+	VectorXd q_current = robots[0]->_q;
+	robots[0]->_q = q_initial[0];
+	robots[0]->updateKinematics();
+	Vector3d home_tool_position = Vector3d::Zero();
+	robots[0]->position(home_tool_position, link_names[0], pos_in_link[0]);
+	robots[0]->_q = q_current;
+	robots[0]->updateKinematics();
+
+	const double board_size_x = 1.0;
+	const double board_size_y = 0.8;
+	Affine3d board_pose_in_world = Affine3d::Identity();
+	board_pose_in_world.linear() = robot_pose_in_world[0].linear();
+	Vector3d board_center = robot_pose_in_world[0] * home_tool_position;
+	board_center(2) = 0;
+	board_pose_in_world.translation() = board_center - board_pose_in_world.linear() * Vector3d(0.5 * board_size_x, 0.5 * board_size_y, 0);
+	PandaUtils::CoverageMap coverage_map(board_pose_in_world, board_size_x, board_size_y, 0.005,
+			PandaUtils::CoverageMap::Footprint::rectangle(0.12, 0.05));
+	// the tool cleans when pressed on the board
+	const double contact_force_threshold = 3.0;
+
+	PandaUtils::AsyncRedisWriter coverage_writer;
+	coverage_writer.start();
+
 
 	////Haptic teleoperation controller ////
 	//Left hand with gripper : Robot[0] && Right hand with wrench : Robot[1]
@@ -279,7 +323,7 @@ int main() {
 	vector<bool> previous_gripper_state;
 
 	// passivity
-	vector<Sai2Primitives::BilateralPassivityController*> passivity_controllers;
+	vector<PandaUtils::HapticPassivityController*> passivity_controllers;
 	vector<Vector3d> passivity_damping_force;
 	vector<Vector3d> haptic_force_plus_passivity;
 
@@ -319,7 +363,8 @@ int main() {
 		previous_gripper_state.push_back(false);
 
 		// passivity controller		
-		passivity_controllers.push_back(new Sai2Primitives::BilateralPassivityController(posori_tasks[i], teleop_tasks[i]));
+		passivity_controllers.push_back(new PandaUtils::HapticPassivityController(0.001));
+		passivity_controllers[i]->setMaxDamping(0.9 * max_damping(0), 0.9 * max_damping(1));
 		passivity_damping_force.push_back(Vector3d::Zero());
 		haptic_force_plus_passivity.push_back(Vector3d::Zero());
 
@@ -361,6 +406,11 @@ int main() {
 		bias_adjustment[0] = redis_client.getEigenMatrixJSON(FORCE_SENSED_KEYS[0]) - force_sensor_bias[0];
 	}
 
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		force_pipelines[i]->setCalibration(force_sensor_bias[i] + bias_adjustment[i], ee_mass[i], ee_com_in_sensor_frame[i]);
+	}
+
 	// setup redis keys to be updated with the callback
 	// objects to read from redis
 	vector<MatrixXd> mass_from_robots;
@@ -372,6 +422,28 @@ int main() {
 		coriolis_from_robots.push_back(VectorXd::Zero(7));
 	}
 
+	// haptic devices from a remote haptic station, device i on the ports after the ones of
+	// device 0 : controller16 --udp-teleop 9900 station 9901, or from the binary records of
+	// haptic_bundle_bridge when all the devices have one, or from the device keys
+	PandaUtils::UdpTeleopConfig udp_config = PandaUtils::UdpTeleopConfig::fromArgs(argc, argv);
+	vector<PandaUtils::HapticDeviceChannel*> device_channels;
+	bool f_device_bundles = !udp_config.enabled();
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		f_device_bundles = f_device_bundles && PandaUtils::RedisHapticDevice::available(redis_client, i);
+	}
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		if(udp_config.enabled())
+		{
+			device_channels.push_back(new PandaUtils::UdpHapticDevice(udp_config.forDevice(i)));
+		}
+		else if(f_device_bundles)
+		{
+			device_channels.push_back(new PandaUtils::RedisHapticDevice(redis_client, i));
+		}
+	}
+
 	redis_client.createReadCallback(0);
 	redis_client.createWriteCallback(1);
 
@@ -381,14 +453,17 @@ int main() {
 		redis_client.addEigenToReadCallback(0, JOINT_ANGLES_KEYS[i], robots[i]->_q);
 		redis_client.addEigenToReadCallback(0, JOINT_VELOCITIES_KEYS[i], robots[i]->_dq);
 		
-		redis_client.addEigenToReadCallback(0, DEVICE_POSITION_KEYS[i], teleop_tasks[i]->_current_position_device);
-		redis_client.addEigenToReadCallback(0, DEVICE_ROTATION_KEYS[i], teleop_tasks[i]->_current_rotation_device);
-		redis_client.addEigenToReadCallback(0, DEVICE_TRANS_VELOCITY_KEYS[i], teleop_tasks[i]->_current_trans_velocity_device);
-		redis_client.addEigenToReadCallback(0, DEVICE_ROT_VELOCITY_KEYS[i], teleop_tasks[i]->_current_rot_velocity_device);
-		redis_client.addEigenToReadCallback(0, DEVICE_SENSED_FORCE_KEYS[i], teleop_tasks[i]->_sensed_force_device);
-		redis_client.addEigenToReadCallback(0, DEVICE_SENSED_TORQUE_KEYS[i], teleop_tasks[i]->_sensed_torque_device);
-		redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_POSITION_KEYS[i], teleop_tasks[i]->_current_position_gripper_device);
-		redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_VELOCITY_KEYS[i], teleop_tasks[i]->_current_gripper_velocity_device);
+		if(device_channels.empty())
+		{
+			redis_client.addEigenToReadCallback(0, DEVICE_POSITION_KEYS[i], teleop_tasks[i]->_current_position_device);
+			redis_client.addEigenToReadCallback(0, DEVICE_ROTATION_KEYS[i], teleop_tasks[i]->_current_rotation_device);
+			redis_client.addEigenToReadCallback(0, DEVICE_TRANS_VELOCITY_KEYS[i], teleop_tasks[i]->_current_trans_velocity_device);
+			redis_client.addEigenToReadCallback(0, DEVICE_ROT_VELOCITY_KEYS[i], teleop_tasks[i]->_current_rot_velocity_device);
+			redis_client.addEigenToReadCallback(0, DEVICE_SENSED_FORCE_KEYS[i], teleop_tasks[i]->_sensed_force_device);
+			redis_client.addEigenToReadCallback(0, DEVICE_SENSED_TORQUE_KEYS[i], teleop_tasks[i]->_sensed_torque_device);
+			redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_POSITION_KEYS[i], teleop_tasks[i]->_current_position_gripper_device);
+			redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_VELOCITY_KEYS[i], teleop_tasks[i]->_current_gripper_velocity_device);
+		}
 
 		if(!flag_simulation)
 		{
@@ -398,8 +473,11 @@ int main() {
 
 		// write
 		redis_client.addEigenToWriteCallback(1, JOINT_TORQUES_COMMANDED_KEYS[i], command_torques[i]);
-		redis_client.addEigenToWriteCallback(1, DEVICE_COMMANDED_FORCE_KEYS[i], haptic_force_plus_passivity[i]);
-		redis_client.addDoubleToWriteCallback(1, DEVICE_COMMANDED_GRIPPER_FORCE_KEYS[i], teleop_tasks[i]->_commanded_gripper_force_device);
+		if(device_channels.empty())
+		{
+			redis_client.addEigenToWriteCallback(1, DEVICE_COMMANDED_FORCE_KEYS[i], haptic_force_plus_passivity[i]);
+			redis_client.addDoubleToWriteCallback(1, DEVICE_COMMANDED_GRIPPER_FORCE_KEYS[i], teleop_tasks[i]->_commanded_gripper_force_device);
+		}
 	}
 
 	redis_client.addEigenToReadCallback(0, FORCE_SENSED_KEYS[0], f_sensed[0]);
@@ -407,23 +485,28 @@ int main() {
 	redis_client.addIntToReadCallback(0, REMOTE_ENABLED_KEY, remote_enabled);
 	redis_client.addIntToReadCallback(0, RESTART_CYCLE_KEY, restart_cycle);
 
-	// create a timer
-	LoopTimer timer;
+	// create a timer, that spins the last 100 us before the deadlines of the haptic loop
+	PandaUtils::PrecisionLoopTimer timer(100e-6);
 	timer.initializeTimer();
 	timer.setLoopFrequency(1000); 
+	PandaUtils::LoopHealth loop_health(1000);
+	PandaUtils::configureRealtimeThread("controller", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
 	double current_time = 0;
 	double prev_time = 0;
 	double dt = 0;
-	bool fTimerDidSleep = true;
 	double start_time = timer.elapsedTime(); //secs
 
 	while (runloop) {
 		// wait for next scheduled loop
-		timer.waitForNextLoop();
+		loop_health.waitForNextLoop(timer);
 		current_time = timer.elapsedTime() - start_time;
 		dt = current_time - prev_time;
 
 		redis_client.executeReadCallback(0);
+		for(unsigned int i=0 ; i<device_channels.size() ; i++)
+		{
+			device_channels[i]->readDevice(*teleop_tasks[i]);
+		}
 
 		// read robot state from redis and update robot model
 		for(int i=0 ; i<n_robots ; i++)
@@ -438,13 +521,7 @@ int main() {
 			{
 				robots[i]->updateKinematics();
 				robots[i]->_M = mass_from_robots[i];
-				if(inertia_regularization)
-				{
-					robots[i]->_M(4,4) += 0.07;
-					robots[i]->_M(5,5) += 0.07;
-					robots[i]->_M(6,6) += 0.07;
-				}
-				robots[i]->_M_inv = robots[i]->_M.inverse();
+				mass_matrix_inverses[i]->update(robots[i]);
 				coriolis[i] = coriolis_from_robots[i];
 			}
 
@@ -466,16 +543,14 @@ int main() {
 		// read force sensor data and remove bias and effecto from hand gravity (only for second robot)
 		for(int i=0 ; i<n_robots ; i++)
 		{
-			f_sensed[i] -= force_sensor_bias[i] + bias_adjustment[i]; 
-			Matrix3d R_sensor = Matrix3d::Identity();
-			robots[i]->rotation(R_sensor, "link7");
-			Vector3d p_tool_sensorFrame = ee_mass[i] * R_sensor.transpose() * Vector3d(0,0,-9.81); 
-			f_sensed[i].head(3) += p_tool_sensorFrame;
-			f_sensed[i].tail(3) += ee_com_in_sensor_frame[i].cross(p_tool_sensorFrame);
+			Matrix3d R_link = Matrix3d::Identity();
+			robots[i]->rotation(R_link, link_names[i]);
+			force_pipelines[i]->update(f_sensed[i], R_link);
+			posori_tasks[i]->_sensed_force = force_pipelines[i]->force();
+			posori_tasks[i]->_sensed_moment = force_pipelines[i]->moment();
 
-			// f_sensed[i].head(3) -= 0.85 * R_sensor.transpose() * ee_inertial_forces[i];
+			// posori_tasks[i]->_sensed_force -= 0.85 * ee_inertial_forces[i];
 
-			posori_tasks[i]->updateSensedForceAndMoment(f_sensed[i].head(3), f_sensed[i].tail(3));
 			VectorXd sensed_force_world_frame = VectorXd::Zero(6);
 			sensed_force_world_frame << posori_tasks[i]->_sensed_force, posori_tasks[i]->_sensed_moment;
 			teleop_tasks[i]->updateSensedForce(-sensed_force_world_frame);
@@ -516,6 +591,7 @@ int main() {
 
 					teleop_tasks[i]->setRobotCenter(workspace_centers[i], posori_tasks[i]->_current_orientation);
 					teleop_tasks[i]->setDeviceCenter(haptic_centers[i], teleop_tasks[i]->_current_rotation_device);
+					passivity_controllers[i]->reset();
 					
 					state[i] = HAPTIC_CONTROL;
 				}
@@ -539,6 +615,7 @@ int main() {
 
 					teleop_tasks[i]->setRobotCenter(workspace_centers[i], posori_tasks[i]->_current_orientation);
 					teleop_tasks[i]->setDeviceCenter(haptic_centers[i], teleop_tasks[i]->_current_rotation_device);
+					passivity_controllers[i]->reset();
 					
 					state[i] = HAPTIC_CONTROL;
 				}
@@ -587,7 +664,8 @@ int main() {
 
 			command_torques[0] = joint_task_torques[0] + coriolis[0] + posori_task_torques[0];
 
-			passivity_controllers[0]->computePOPCForce(passivity_damping_force[0]);
+			passivity_controllers[0]->update(teleop_tasks[0]->_commanded_force_device, teleop_tasks[0]->_current_trans_velocity_device);
+			passivity_damping_force[0] = passivity_controllers[0]->dampingForce();
 
 			if(remote_enabled == 0)
 			{
@@ -596,6 +674,8 @@ int main() {
 				// joint_tasks[0]->_desired_position = robot[0]->_q;
 				// set current haptic device position
 				teleop_tasks[0]->setDeviceCenter(teleop_tasks[0]->_current_position_device, teleop_tasks[0]->_current_rotation_device);
+				// no passivity damping outside of the haptic control
+				passivity_damping_force[0].setZero();
 
 				state[0] = MAINTAIN_POSITION;
 			}		
@@ -625,8 +705,29 @@ int main() {
 		// }
 
 		redis_client.executeWriteCallback(1);
+		for(unsigned int i=0 ; i<device_channels.size() ; i++)
+		{
+			device_channels[i]->sendCommands(haptic_force_plus_passivity[i], Vector3d::Zero(),
+					teleop_tasks[i]->_commanded_gripper_force_device, current_time, posori_tasks[i]->_sigma_force);
+		}
+
+		// the tool covers the board in contact during the haptic control
+		const bool f_tool_contact = (state[0] == HAPTIC_CONTROL) && posori_tasks[0]->_sensed_force.norm() > contact_force_threshold;
+		coverage_map.update(robot_pose_in_world[0] * posori_tasks[0]->_current_position,
+				robot_pose_in_world[0].linear() * posori_tasks[0]->_current_orientation, f_tool_contact);
+		if(controller_counter % 250 == 0)
+		{
+			coverage_writer.set(COVERAGE_MAP_KEY, coverage_map.image());
+			coverage_writer.set(COVERAGE_KEY, to_string(coverage_map.coverage()));
+		}
 
 		prev_time = current_time;
+
+		if(controller_counter % 1000 == 0)
+		{
+			loop_health.publish(redis_client, LOOP_HEALTH_KEY);
+		}
+
 		controller_counter++;
 	}
 
@@ -641,12 +742,24 @@ int main() {
 		command_torques[i].setZero();
 		redis_client.setEigenMatrixJSON(JOINT_TORQUES_COMMANDED_KEYS[i], command_torques[i]);
 	}
+	for(unsigned int i=0 ; i<device_channels.size() ; i++)
+	{
+		device_channels[i]->sendCommands(Vector3d::Zero(), Vector3d::Zero(), 0, current_time);
+		cout << "haptic device channel " << i << " : " << device_channels[i]->summary() << endl;
+		delete device_channels[i];
+	}
+
+	coverage_writer.set(COVERAGE_MAP_KEY, coverage_map.image());
+	coverage_writer.set(COVERAGE_KEY, to_string(coverage_map.coverage()));
+	coverage_writer.stop();
 
 	double end_time = timer.elapsedTime();
 	std::cout << "\n";
 	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
 	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
     std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+    loop_health.print(std::cout);
+	std::cout << "Board cleaned             : " << 100 * coverage_map.coverage() << " %\n";
 
 	return 0;
 }
@@ -10,6 +10,9 @@
 #include "timer/LoopTimer.h"
 
 #include "force_sensor/ForceSensorSim.h" 
+#include "sim/AdaptiveStepper.h"
+#include "graphics/CoverageMapOverlay.h"
+#include "threads/RealtimeThread.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
 
@@ -54,6 +57,7 @@ const vector<string> FORCE_SENSED_KEYS = {
 const vector<string> TORQUES_COMMANDED_KEYS = {
 	"sai2::PandaApplications::panda1::actuators::fgc",
 };
+const string COVERAGE_MAP_KEY = "sai2::PandaApplications::controller::coverage_map";
 
 // - gripper
 const vector<string> GRIPPER_MODE_KEYS = {   // m for move and g for graps
@@ -83,6 +87,10 @@ vector<double> gripper_widths = {
 
 
 RedisClient redis_client;
+
+// one integration step per loop in free space, substeps in contact, with --adaptive-substeps
+// (see sim/AdaptiveStepper.h)
+bool flag_adaptive_substeps = false;
 vector<Vector3d> object_positions;
 vector<Quaterniond> object_orientations;
 
@@ -111,7 +119,8 @@ bool fTransZp = false;
 bool fTransZn = false;
 bool fRotPanTilt = false;
 
-int main() {
+int main(int argc, char** argv) {
+	flag_adaptive_substeps = PandaUtils::AdaptiveStepper::requested(argc, argv);
 	cout << "Loading URDF world model file: " << world_file << endl;
 
 	// start redis client
@@ -188,6 +197,12 @@ int main() {
 	// cache variables
 	double last_cursorx, last_cursory;
 
+	// cleaned areas of the board over the floor, from its own redis connection since the
+	// simulation thread uses the other one
+	RedisClient coverage_redis_client;
+	coverage_redis_client.connect();
+	PandaUtils::CoverageMapOverlay coverage_overlay(graphics->_world, graphics->getCamera(camera_name), COVERAGE_MAP_KEY);
+
 	fSimulationRunning = true;
 	thread sim_thread(simulation, robots, sim);
 
@@ -205,6 +220,7 @@ int main() {
 		{
 			graphics->updateObjectGraphics(object_names[i], object_positions[i], object_orientations[i]);
 		}
+		coverage_overlay.update(coverage_redis_client, height);
 		graphics->render(camera_name, width, height);
 
 		// swap buffers
@@ -320,8 +336,12 @@ void simulation(vector<Sai2Model::Sai2Model*> robots, Simulation::Sai2Simulation
 	double start_time = timer.elapsedTime(); //secs
 	double last_time = start_time;
 
+	PandaUtils::AdaptiveStepper stepper(sim, robot_names, robots);
+
 	unsigned long long simulation_counter = 0;
 
+	PandaUtils::configureRealtimeThread("simulation", PandaUtils::RealtimeConfig::fifo(70, PandaUtils::simulationCpus()));
+
 	while (fSimulationRunning) {
 		fTimerDidSleep = timer.waitForNextLoop();
 
@@ -344,7 +364,14 @@ void simulation(vector<Sai2Model::Sai2Model*> robots, Simulation::Sai2Simulation
 		// integrate forward
 		double curr_time = timer.elapsedTime();
 		double loop_dt = curr_time - last_time; 
-		sim->integrate(loop_dt);
+		if(flag_adaptive_substeps)
+		{
+			stepper.integrate(loop_dt);
+		}
+		else
+		{
+			sim->integrate(loop_dt);
+		}
 
 		// read joint positions, velocities, update model
 		for(int i=0 ; i<n_robots ; i++)
@@ -392,6 +419,10 @@ void simulation(vector<Sai2Model::Sai2Model*> robots, Simulation::Sai2Simulation
 	std::cout << "Simulation Loop run time  : " << end_time << " seconds\n";
 	std::cout << "Simulation Loop updates   : " << timer.elapsedCycles() << "\n";
 	std::cout << "Simulation Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+	if(flag_adaptive_substeps)
+	{
+		std::cout << "Mean integration steps    : " << stepper.meanSubsteps() << " per loop, " << 100*stepper.contactFraction() << "% of the loops in contact\n";
+	}
 }
 
 //------------------------------------------------------------------------------
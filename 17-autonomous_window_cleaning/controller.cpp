@@ -5,8 +5,13 @@
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
+#include "timer/LoopHealth.h"
+#include "threads/RealtimeThread.h"
 #include "tasks/JointTask.h"
 #include "tasks/PosOriTask.h"
+#include "model/MassMatrixInverse.h"
+#include "force_control/ForcePipeline.h"
+#include "trajectories/ViaPointPath.h"
 
 #include <iostream>
 #include <string>
@@ -48,6 +53,12 @@ std::string MASSMATRIX_KEY;
 std::string CORIOLIS_KEY;
 std::string ROBOT_GRAVITY_KEY;
 
+// - state machine, saved in the snapshots of the simviz : the state, and the joint
+// task goal and the window corner of the phase
+const std::string CONTROLLER_STATE_KEY = "sai2::PandaApplication::controller::state";
+const std::string CONTROLLER_STATE_TARGETS_KEY = "sai2::PandaApplication::controller::state_targets";
+const std::string LOOP_HEALTH_KEY = "sai2::PandaApplication::controller::loop_health";
+
 // const bool flag_simulation = false;
 const bool flag_simulation = true;
 
@@ -55,7 +66,17 @@ const bool inertia_regularization = false;
 
 unsigned long long controller_counter = 0;
 
-int main() {
+int main(int argc, char** argv) {
+
+	// controller --restore-state, after a simviz --restore-state
+	bool flag_restore_state = false;
+	for(int i=1 ; i<argc ; i++)
+	{
+		if(string(argv[i]) == "--restore-state")
+		{
+			flag_restore_state = true;
+		}
+	}
 
 	if(flag_simulation)
 	{
@@ -104,6 +125,7 @@ int main() {
 
 	// prepare controller	
 	int dof = robot->dof();
+	PandaUtils::MassMatrixInverse<7> mass_matrix_inverse(dof, inertia_regularization ? 0.07 : 0.0);
 	VectorXd command_torques = VectorXd::Zero(dof);
 	VectorXd coriolis = VectorXd::Zero(dof);
 	MatrixXd N_prec = MatrixXd::Identity(dof, dof);
@@ -156,15 +178,15 @@ int main() {
 	posori_task->setForceSensorFrame(link_name, sensor_frame);
 	VectorXd sensed_force_moment = VectorXd::Zero(6);
 
-	VectorXd force_sensor_bias = VectorXd::Zero(6);
-	double ee_mass = 0;
-	Vector3d ee_com_in_sensor_frame = Vector3d::Zero();
+	// bias, hand gravity and sensor frame of the task in one update, not filtered
+	PandaUtils::ForcePipeline force_pipeline(1000);
+	force_pipeline.setSensorFrame(sensor_frame, pos_in_link);
 
 	if(!flag_simulation)
 	{
+		PandaUtils::ForcePipeline::Vector6d force_sensor_bias;
 		force_sensor_bias << -0.911605,    1.6281,  -0.29196, -0.104877,  0.416328, 0.0185848;
-		ee_mass =  0.249114;
-		ee_com_in_sensor_frame = Vector3d(-0.000571861,  -0.00177381,    0.0725383);
+		force_pipeline.setCalibration(force_sensor_bias, 0.249114, Vector3d(-0.000571861,  -0.00177381,    0.0725383));
 	}
 
 	double force_detection_treshold = 8.0;
@@ -203,6 +225,43 @@ int main() {
 	int n_dry_via_points = dry_window_increments_in_world.size();
 	int current_dry_via_point = -2;
 
+	// the via points of a pass are followed on one blended path instead of stopping at each
+	// of them, at the limits of the interpolation of the task, and the path cuts the
+	// reversals of the strokes by at most 3 cm
+	PandaUtils::ViaPointPath window_path(0.12, 0.2, 0.03);
+	bool f_following_path = false;
+
+	// plans the path through the increments [first, last) from the current desired position
+	auto startPath = [&](const vector<Vector3d>& increments_in_world, const int first, const int last, const double time)
+	{
+		vector<Vector3d> via_points;
+		Vector3d via_point = posori_task->_desired_position;
+		for(int k=first ; k<last ; k++)
+		{
+			via_point += R_robot_world * increments_in_world[k];
+			via_points.push_back(via_point);
+		}
+		window_path.plan(posori_task->_desired_position, via_points, time);
+		posori_task->_use_interpolation_flag = false;
+		f_following_path = true;
+	};
+
+	// streams the path to the task, and gives the task back to its interpolation at the end
+	auto followPath = [&](const double time)
+	{
+		if(!f_following_path)
+		{
+			return;
+		}
+		window_path.sample(time, posori_task->_desired_position, posori_task->_desired_velocity, posori_task->_desired_acceleration);
+		if(window_path.finished(time))
+		{
+			f_following_path = false;
+			posori_task->_otg->reInitialize(posori_task->_desired_position, posori_task->_desired_orientation);
+			posori_task->_use_interpolation_flag = true;
+		}
+	};
+
 	// setup redis exchanges
 	redis_client.createReadCallback(0);
 	redis_client.createWriteCallback(0);
@@ -219,16 +278,62 @@ int main() {
 
 	redis_client.addEigenToWriteCallback(0, JOINT_TORQUES_COMMANDED_KEY, command_torques);
 
+	// a restored phase starts over from its beginning at the restored configuration, the
+	// via points of the cleaning and drying passes are not saved
+	if(flag_restore_state && redis_client.exists(CONTROLLER_STATE_KEY) && redis_client.exists(CONTROLLER_STATE_TARGETS_KEY))
+	{
+		state = stoi(redis_client.get(CONTROLLER_STATE_KEY));
+		VectorXd restored_targets = redis_client.getEigenMatrixJSON(CONTROLLER_STATE_TARGETS_KEY);
+		joint_task->_desired_position = restored_targets.head(dof);
+		initial_pos_clean_dry = restored_targets.tail<3>();
+		joint_task->_ki = (state == MOVE_TO_INITIAL) ? 55.0 : ((state == SWITCH_TOOL) ? 25.0 : 0.0);
+		posori_task->reInitializeTask();
+
+		if(state == ALIGNMENT_PHASE)
+		{
+			posori_task->_desired_position += R_robot_world * Vector3d(-0.1, 0.0, 0.0);
+		}
+		else if(state == CLEAN_WINDOW)
+		{
+			alignment_1_needed = false;
+			alignment_2_needed = false;
+			posori_task->_desired_position = initial_pos_clean_dry;
+
+			Vector3d force_axis_in_robot_frame = R_robot_world * Vector3d::UnitX();
+			posori_task->setForceAxis(force_axis_in_robot_frame);
+			posori_task->_desired_force = R_robot_world * Vector3d(-force_detection_treshold, 0.0, 0.0);
+
+			Vector3d moment_axis_in_robot_frame = R_robot_world * Vector3d::UnitY();
+			posori_task->setMomentAxis(moment_axis_in_robot_frame);
+			posori_task->setClosedLoopMomentControl();
+		}
+		else if(state == DRY_WINDOW)
+		{
+			posori_task->_desired_position = initial_pos_clean_dry + R_robot_world*Vector3d(-0.07, 0.05, 0.0);
+		}
+		else if(state == END1)
+		{
+			posori_task->_desired_position = initial_pos_clean_dry + R_robot_world * Vector3d(0.15, 0.15, 0.0);
+		}
+		cout << "restored controller state " << state << endl;
+	}
+	VectorXd state_targets = VectorXd::Zero(dof + 3);
+	state_targets << joint_task->_desired_position, initial_pos_clean_dry;
+	redis_client.setEigenMatrixJSON(CONTROLLER_STATE_TARGETS_KEY, state_targets);
+	redis_client.set(CONTROLLER_STATE_KEY, to_string(state));
+	int published_state = state;
+
 	// create a timer
 	LoopTimer timer;
 	timer.initializeTimer();
 	timer.setLoopFrequency(1000); 
+	PandaUtils::LoopHealth loop_health(1000);
+	PandaUtils::configureRealtimeThread("controller", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
 	double start_time = timer.elapsedTime(); //secs
-	bool fTimerDidSleep = true;
 
 	while (runloop) {
 		// wait for next scheduled loop
-		timer.waitForNextLoop();
+		loop_health.waitForNextLoop(timer);
 		double time = timer.elapsedTime() - start_time;
 
 		// read robot state from redis
@@ -243,26 +348,15 @@ int main() {
 		else
 		{
 			robot->updateKinematics();
-			if(inertia_regularization)
-			{
-				robot->_M(4,4) += 0.07;
-				robot->_M(5,5) += 0.07;
-				robot->_M(6,6) += 0.07;
-			}
-			// cout << robot->_M << endl;
-			// robot->_M = Eigen::MatrixXd::Identity(dof, dof);
-			robot->_M_inv = robot->_M.inverse();
+			mass_matrix_inverse.update(robot);
 		}
 
 		// read force sensor data and remove bias and effects from hand gravity
-		sensed_force_moment -= force_sensor_bias; 
-		Matrix3d R_sensor = Matrix3d::Identity();
-		robot->rotation(R_sensor, link_name);
-		Vector3d p_tool_sensorFrame = ee_mass * R_sensor.transpose() * Vector3d(0,0,-9.81); 
-		sensed_force_moment.head(3) += p_tool_sensorFrame;
-		sensed_force_moment.tail(3) += ee_com_in_sensor_frame.cross(p_tool_sensorFrame);
-
-		posori_task->updateSensedForceAndMoment(sensed_force_moment.head(3), sensed_force_moment.tail(3));
+		Matrix3d R_link = Matrix3d::Identity();
+		robot->rotation(R_link, link_name);
+		force_pipeline.update(sensed_force_moment, R_link);
+		posori_task->_sensed_force = force_pipeline.force();
+		posori_task->_sensed_moment = force_pipeline.moment();
 
 
 		if(state == MOVE_TO_INITIAL)
@@ -386,17 +480,20 @@ int main() {
 
 			command_torques = posori_task_torques + joint_task_torques + coriolis;
 
-			// via points
-			if(posori_task->goalPositionReached(0.015))
+			// via points, all on one path
+			followPath(time);
+			if(!f_following_path && posori_task->goalPositionReached(0.015))
 			{
 				if(current_clean_via_point < n_clean_via_points)
 				{
-					posori_task->_desired_position += R_robot_world * clean_window_increments_in_world[current_clean_via_point];
+					startPath(clean_window_increments_in_world, current_clean_via_point, n_clean_via_points, time);
+					current_clean_via_point = n_clean_via_points;
 				}
 				else if(current_clean_via_point == n_clean_via_points)
 				{
 					posori_task->setFullLinearMotionControl();
 					posori_task->_desired_position = initial_pos_clean_dry + R_robot_world * Vector3d(0.15, 0.0, 0.0);
+					current_clean_via_point++;
 				}
 				else
 				{
@@ -406,8 +503,6 @@ int main() {
 
 					state = SWITCH_TOOL;
 				}
-				
-				current_clean_via_point++;
 			}
 
 		}
@@ -503,27 +598,28 @@ int main() {
 					current_dry_via_point = 0;
 				}
 			}
-			else if((current_dry_via_point % 4) == 0 && sensed_force_in_world_frame(0) < -force_detection_treshold)
+			// a stroke starts at the contact, once the path back to the window is on its approach
+			else if((current_dry_via_point % 4) == 0 && sensed_force_in_world_frame(0) < -force_detection_treshold
+				&& (!f_following_path || window_path.segment(time) == window_path.numSegments() - 1))
 			{
 				Vector3d force_axis_in_robot_frame = R_robot_world * Vector3d::UnitX();
 				posori_task->setForceAxis(force_axis_in_robot_frame);
 				posori_task->_desired_force = R_robot_world * Vector3d(-force_detection_treshold, 0.0, 0.0);
-				posori_task->_desired_position += R_robot_world * dry_window_increments_in_world[current_dry_via_point];
+				startPath(dry_window_increments_in_world, current_dry_via_point, current_dry_via_point + 1, time);
 
 				current_dry_via_point++;
 			}
 
-			// via points
-			if(current_dry_via_point > 0 && posori_task->goalPositionReached(0.015))
+			// via points, the moves away from the window and back to the next stroke on one path
+			followPath(time);
+			if(current_dry_via_point > 0 && !f_following_path && posori_task->goalPositionReached(0.015))
 			{
-				// if(current_dry_via_point < n_dry_via_points && (current_dry_via_point % 4) == 0)
-				// {
-
-				// }
 				if(current_dry_via_point < n_dry_via_points && (current_dry_via_point % 4) > 0)
 				{
+					const int next_stroke = min(n_dry_via_points, 4 * (current_dry_via_point / 4 + 1));
 					posori_task->setFullLinearMotionControl();
-					posori_task->_desired_position += R_robot_world * dry_window_increments_in_world[current_dry_via_point];
+					startPath(dry_window_increments_in_world, current_dry_via_point, next_stroke, time);
+					current_dry_via_point = next_stroke;
 				}
 				else if(current_dry_via_point == n_dry_via_points)
 				{
@@ -531,9 +627,8 @@ int main() {
 					posori_task->_desired_position = initial_pos_clean_dry + R_robot_world * Vector3d(0.15, 0.15, 0.0);
 
 					state = END1;
+					current_dry_via_point++;
 				}
-				
-				current_dry_via_point++;
 			}
 		}
 
@@ -573,6 +668,18 @@ int main() {
 
 		// send to redis
 		redis_client.executeWriteCallback(0);
+		if(state != published_state)
+		{
+			state_targets << joint_task->_desired_position, initial_pos_clean_dry;
+			redis_client.setEigenMatrixJSON(CONTROLLER_STATE_TARGETS_KEY, state_targets);
+			redis_client.set(CONTROLLER_STATE_KEY, to_string(state));
+			published_state = state;
+		}
+
+		if(controller_counter % 1000 == 0)
+		{
+			loop_health.publish(redis_client, LOOP_HEALTH_KEY);
+		}
 
 		controller_counter++;
 
@@ -586,6 +693,7 @@ int main() {
 	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
 	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
     std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+    loop_health.print(std::cout);
 
 
 	return 0;
@@ -9,6 +9,9 @@
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
 #include "force_sensor/ForceSensorSim.h"
+#include "sim/SimSnapshot.h"
+#include "model/UrdfCache.h"
+#include "threads/RealtimeThread.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
 
@@ -35,8 +38,13 @@ std::string JOINT_VELOCITIES_KEY = "sai2::PandaApplication::sensors::dq";
 std::string	FORCE_SENSED_KEY = "sai2::PandaApplication::sensors::force_moment";
 // - read
 const std::string TORQUES_COMMANDED_KEY  = "sai2::PandaApplication::actuators::fgc";
+// - snapshots of the simulation state, the save key is polled for a save request (1)
+const std::string SAVE_STATE_KEY = "sai2::PandaApplication::simulation::save_state";
+const std::string CONTROLLER_STATE_KEY = "sai2::PandaApplication::controller::state";
+const std::string CONTROLLER_STATE_TARGETS_KEY = "sai2::PandaApplication::controller::state_targets";
 
 RedisClient redis_client;
+PandaUtils::SimSnapshotService* snapshots;
 
 // simulation function prototype
 void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim);
@@ -62,8 +70,14 @@ bool fRotPanTilt = false;
 // const bool flag_simulation = false;
 const bool flag_simulation = true;
 
-int main() {
+int main(int argc, char** argv) {
 	cout << "Loading URDF world model file: " << world_file << endl;
+	// the world file with decimated visual meshes, built at the first launch
+	const string loaded_world_file = PandaUtils::cachedWorldFile(world_file);
+
+	// simviz [--save-state file [--save-state-at seconds]] [--restore-state file]
+	snapshots = new PandaUtils::SimSnapshotService(argc, argv, SAVE_STATE_KEY, {robot_name}, {},
+			{CONTROLLER_STATE_KEY, CONTROLLER_STATE_TARGETS_KEY});
 
 	if(!flag_simulation)
 	{
@@ -76,7 +90,7 @@ int main() {
 	redis_client.connect();
 
 	// load graphics scene
-	auto graphics = new Sai2Graphics::Sai2Graphics(world_file, true);
+	auto graphics = new Sai2Graphics::Sai2Graphics(loaded_world_file, true);
 	Eigen::Vector3d camera_pos, camera_lookat, camera_vertical;
 	graphics->getCameraPose(camera_name, camera_pos, camera_vertical, camera_lookat);
 
@@ -88,10 +102,13 @@ int main() {
 	robot->updateKinematics();
 
 	// load simulation world
-	auto sim = new Simulation::Sai2Simulation(world_file, false);
+	auto sim = new Simulation::Sai2Simulation(loaded_world_file, false);
 	sim->setCollisionRestitution(0);
 	sim->setCoeffFrictionStatic(0.6);
 
+	// restore the robot before it is read
+	snapshots->restoreSimulation(sim);
+
 	// read joint positions, velocities, update model
 	sim->getJointPositions(robot_name, robot->_q);
 	sim->getJointVelocities(robot_name, robot->_dq);
@@ -241,6 +258,7 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim) {
 
 	VectorXd command_torques = VectorXd::Zero(robot->dof());
 	redis_client.setEigenMatrixJSON(TORQUES_COMMANDED_KEY, command_torques);
+	snapshots->restoreRedis(redis_client);
 
 	// create a force sensor
 	const string link_name = "link7";
@@ -260,6 +278,8 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim) {
 
 	unsigned long long simulation_counter = 0;
 
+	PandaUtils::configureRealtimeThread("simulation", PandaUtils::RealtimeConfig::fifo(70, PandaUtils::simulationCpus()));
+
 	while (fSimulationRunning) {
 		fTimerDidSleep = timer.waitForNextLoop();
 
@@ -290,6 +310,8 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim) {
 		redis_client.setEigenMatrixJSON(JOINT_VELOCITIES_KEY, robot->_dq);
 		redis_client.setEigenMatrixJSON(FORCE_SENSED_KEY, -sensed_force_moment);
 
+		snapshots->update(sim, redis_client, loop_dt);
+
 		//update last time
 		last_time = curr_time;
 
@@ -0,0 +1,11 @@
+#include "ParallelForceSpaceParticleFilter.h"
+
+ParallelForceSpaceParticleFilter::ParallelForceSpaceParticleFilter(const int n_particles, const int n_threads,
+			const vector<int>& worker_cpus)
+: ParallelForceSpaceParticleFilterBase(n_particles, n_threads, worker_cpus)
+{
+	_mean_scatter = 0.0;
+	_std_scatter = 0.005;
+
+	_coeff_friction = 0.0;
+}
@@ -0,0 +1,22 @@
+#ifndef PARALLEL_FORCE_SPACE_PARTICLE_FILTER_H_
+#define PARALLEL_FORCE_SPACE_PARTICLE_FILTER_H_
+
+#include "ParallelParticleFilter.h"
+
+// particle filter of app.cpp : tanh weights with the friction along the motion control,
+// on a pool of worker threads
+typedef ParallelParticleFilter<TanhFrictionWeighting, GaussianScatter, LowVarianceResampling> ParallelForceSpaceParticleFilterBase;
+
+class ParallelForceSpaceParticleFilter : public ParallelForceSpaceParticleFilterBase
+{
+public:
+
+	// n_threads counts the calling thread, worker_cpus are the cpus of the other threads
+	ParallelForceSpaceParticleFilter(const int n_particles, const int n_threads = 1,
+			const vector<int>& worker_cpus = vector<int>());
+	~ParallelForceSpaceParticleFilter(){}
+
+};
+
+/* PARALLEL_FORCE_SPACE_PARTICLE_FILTER_H_ */
+#endif
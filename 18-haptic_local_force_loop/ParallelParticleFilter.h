@@ -0,0 +1,331 @@
+#ifndef PARALLEL_PARTICLE_FILTER_H_
+#define PARALLEL_PARTICLE_FILTER_H_
+
+#include <Eigen/Dense>
+#include <algorithm>
+#include <vector>
+
+#include "random/Xoshiro256.h"
+#include "threads/WorkerPool.h"
+#include "ParticleMoments.h"
+#include "ParticleFilterPolicies.h"
+
+using namespace Eigen;
+using namespace std;
+
+// Force space particle filter of ParticleFilter.h, with the same policies, and with the
+// particles split across a pool of worker threads, so that it can run up to the control
+// rate with more particles :
+//
+//   ParallelParticleFilter<TanhFrictionWeighting, GaussianScatter, LowVarianceResampling> pfilter(n_particles, 3, {2, 3});
+//   pfilter._std_scatter = 0.01;
+//   pfilter.update(motion_control, force_control, velocity_measured, force_measured, force_space_dimension);
+//
+// each thread owns a contiguous chunk of the augmented particles : it scatters and
+// weights them with the policies, its own random generator and its own noise buffer, and
+// cumulates their weights. a resampling policy that modifies the weights sees all of them
+// at once, on the calling thread. a scan of the chunk sums gives the offset of each chunk,
+// then each thread resamples its own range of the new particles, starting from a binary
+// search of its first pick, and accumulates their moments for computePCA()
+template<typename WeightingPolicy, typename ScatterPolicy, typename ResamplingPolicy>
+class ParallelParticleFilter : public WeightingPolicy, public ScatterPolicy, public ResamplingPolicy
+{
+public:
+
+	// n_threads counts the calling thread, worker_cpus are the cpus of the other threads
+	ParallelParticleFilter(const int n_particles, const int n_threads = 1,
+			const vector<int>& worker_cpus = vector<int>())
+	: _pool(n_threads, worker_cpus)
+	{
+		_n_particles = n_particles;
+		_particles.assign(_n_particles, Vector3d::Zero());
+
+		_coeff_friction = 0.0;
+		_force_space_dimension = 0;
+
+		_n_max_augmented_particles = _n_particles + this->nCenterParticles(_n_particles) + this->nMaxAddedParticles(_n_particles);
+		_n_augmented_particles = 0;
+		_augmented_x.assign(_n_max_augmented_particles, 0.0);
+		_augmented_y.assign(_n_max_augmented_particles, 0.0);
+		_augmented_z.assign(_n_max_augmented_particles, 0.0);
+		_weights.assign(_n_max_augmented_particles, 0.0);
+		_cumulative_weights.assign(_n_max_augmented_particles, 0.0);
+		_new_particles.assign(_n_particles, Vector3d::Zero());
+
+		const int n_chunks = _pool.size();
+		const int max_chunk_size = _n_max_augmented_particles / n_chunks + 1;
+		_random_generators.resize(n_chunks);
+		_scatter_noise.assign(n_chunks, vector<double>(3 * max_chunk_size, 0.0));
+		_chunk_moments.resize(n_chunks);
+		_chunk_begin.assign(n_chunks + 1, 0);
+		_chunk_sums.assign(n_chunks, 0.0);
+		_chunk_offsets.assign(n_chunks, 0.0);
+
+		_n_center_particles = 0;
+		_n_added_particles = 0;
+		_motion_control_normalized.setZero();
+		_force_control_normalized.setZero();
+		_resampling_start = 0;
+		_resampling_step = 0;
+	}
+	~ParallelParticleFilter(){}
+
+	void update(const Vector3d motion_control, const Vector3d force_control,
+			const Vector3d velocity_measured, const Vector3d force_measured,
+			const int force_space_dimension)
+	{
+		// drawn first, so that the resampled particles do not depend on the number of threads when there is no scatter
+		const double resampling_offset = _random_generators[0].uniform();
+
+		_force_space_dimension = force_space_dimension;
+		_motion_control_normalized = normalizedControl(motion_control);
+		_force_control_normalized = normalizedControl(force_control);
+
+		this->prepare(velocity_measured, force_measured);
+		_n_center_particles = this->nCenterParticles(_n_particles);
+		_n_added_particles = this->nAddedParticles(_n_particles, _motion_control_normalized, _coeff_friction, _force_space_dimension);
+		if(_n_added_particles > this->nMaxAddedParticles(_n_particles))
+		{
+			_n_added_particles = this->nMaxAddedParticles(_n_particles);
+		}
+		_n_augmented_particles = _n_particles + _n_center_particles + _n_added_particles;
+
+		const int n_chunks = _pool.size();
+		for(int c=0 ; c<=n_chunks ; c++)
+		{
+			_chunk_begin[c] = _n_augmented_particles * c / n_chunks;
+		}
+
+		auto motion_update_job = [this](const int index, const int n_threads)
+		{
+			motionUpdateAndWeighting(index);
+		};
+		_pool.run(motion_update_job);
+
+		if(this->modifiesWeights())
+		{
+			this->prepareResampling(_augmented_x.data(), _augmented_y.data(), _augmented_z.data(), _weights.data(),
+					_n_augmented_particles, _force_space_dimension);
+			for(int c=0 ; c<n_chunks ; c++)
+			{
+				cumulateWeights(c);
+			}
+		}
+
+		// exclusive scan of the chunk sums
+		double total_weight = 0;
+		for(int c=0 ; c<n_chunks ; c++)
+		{
+			_chunk_offsets[c] = total_weight;
+			total_weight += _chunk_sums[c];
+		}
+
+		// no particle is consistent with the measurements, keep the current ones
+		if(!(total_weight > 0))
+		{
+			_moments.reset();
+			for(int i=0 ; i<_n_particles ; i++)
+			{
+				_moments.add(_particles[i]);
+			}
+			return;
+		}
+
+		// low variance resampling in the unnormalized weights
+		_resampling_step = total_weight / _n_particles;
+		_resampling_start = resampling_offset * _resampling_step;
+
+		auto resampling_job = [this](const int index, const int n_threads)
+		{
+			resamplingLowVariance(index, n_threads);
+		};
+		_pool.run(resampling_job);
+
+		_moments.reset();
+		for(int c=0 ; c<n_chunks ; c++)
+		{
+			_moments.add(_chunk_moments[c]);
+		}
+		_particles.swap(_new_particles);
+	}
+
+	void computePCA(Vector3d& eigenvalues, Matrix3d& eigenvectors)
+	{
+		// moments accumulated by the last resampling
+		_moments.computePCA(eigenvalues, eigenvectors);
+	}
+
+	// reseed the random generators (one per thread), for reproducible runs
+	void seed(const uint64_t seed_value)
+	{
+		for(unsigned int i=0 ; i<_random_generators.size() ; i++)
+		{
+			_random_generators[i].seed(seed_value + i);
+		}
+	}
+
+	int _n_particles;
+	vector<Vector3d> _particles;
+
+	double _coeff_friction;
+
+	// estimate of the force space dimension given to the last update
+	int _force_space_dimension;
+
+	// moments of the particles, for computePCA()
+	ParticleMoments _moments;
+
+private:
+
+	Vector3d normalizedControl(const Vector3d& control) const
+	{
+		if(control.norm() > this->controlThreshold())
+		{
+			return control/control.norm();
+		}
+		return Vector3d::Zero();
+	}
+
+	// job of the chunk index : the current particles, the center particles, then the
+	// particles on the arc between the motion and force control, scattered and weighted
+	void motionUpdateAndWeighting(const int index)
+	{
+		const int begin = _chunk_begin[index];
+		const int end = _chunk_begin[index+1];
+
+		for(int i=begin ; i<end ; i++)
+		{
+			if(i < _n_particles)
+			{
+				_augmented_x[i] = _particles[i](0);
+				_augmented_y[i] = _particles[i](1);
+				_augmented_z[i] = _particles[i](2);
+			}
+			else if(i < _n_particles + _n_center_particles)
+			{
+				_augmented_x[i] = 0;
+				_augmented_y[i] = 0;
+				_augmented_z[i] = 0;
+			}
+			else
+			{
+				double alpha = (double) (i - _n_particles - _n_center_particles + 0.5) / (double)_n_added_particles;
+				Vector3d new_particle = (1 - alpha) * _motion_control_normalized + alpha * _force_control_normalized;
+				new_particle.normalize();
+				_augmented_x[i] = new_particle(0);
+				_augmented_y[i] = new_particle(1);
+				_augmented_z[i] = new_particle(2);
+			}
+		}
+
+		// control update and measurement update
+		this->scatter(_augmented_x.data() + begin, _augmented_y.data() + begin, _augmented_z.data() + begin, end - begin,
+				_random_generators[index], _scatter_noise[index].data());
+		this->weights(_augmented_x.data() + begin, _augmented_y.data() + begin, _augmented_z.data() + begin,
+				_weights.data() + begin, end - begin);
+		cumulateWeights(index);
+	}
+
+	// cumulative weights inside the chunk, and its sum
+	void cumulateWeights(const int chunk)
+	{
+		double cumulative_weight = 0;
+		for(int i=_chunk_begin[chunk] ; i<_chunk_begin[chunk+1] ; i++)
+		{
+			cumulative_weight += _weights[i];
+			_cumulative_weights[i] = cumulative_weight;
+		}
+		_chunk_sums[chunk] = cumulative_weight;
+	}
+
+	// job of the range index of the new particles
+	void resamplingLowVariance(const int index, const int n_threads)
+	{
+		const int begin = _n_particles * index / n_threads;
+		const int end = _n_particles * (index + 1) / n_threads;
+		ParticleMoments& moments = _chunk_moments[index];
+		moments.reset();
+		if(begin == end)
+		{
+			return;
+		}
+
+		const int last = _n_augmented_particles - 1;
+		const int n_chunks = _pool.size();
+
+		// first pick of the range : chunk containing the target, then binary search in the chunk
+		double r = _resampling_start + begin * _resampling_step;
+		int chunk = 0;
+		while(chunk < n_chunks - 1 &&
+				(_chunk_begin[chunk+1] == _chunk_begin[chunk] || _chunk_offsets[chunk] + _chunk_sums[chunk] < r))
+		{
+			chunk++;
+		}
+		int k = lower_bound(_cumulative_weights.begin() + _chunk_begin[chunk], _cumulative_weights.begin() + _chunk_begin[chunk+1],
+					r - _chunk_offsets[chunk]) - _cumulative_weights.begin();
+		if(k > last)
+		{
+			k = last;
+		}
+		chunk = chunkOf(k, chunk);
+
+		for(int i=begin ; i<end ; i++)
+		{
+			while(k < last && r > cumulativeWeight(k, chunk))
+			{
+				k++;
+				chunk = chunkOf(k, chunk);
+			}
+			_new_particles[i] = Vector3d(_augmented_x[k], _augmented_y[k], _augmented_z[k]);
+			moments.add(_augmented_x[k], _augmented_y[k], _augmented_z[k]);
+			r += _resampling_step;
+		}
+	}
+
+	// cumulative weight of augmented particle k, chunk is the chunk of k
+	double cumulativeWeight(const int k, const int chunk) const
+	{
+		return _cumulative_weights[k] + _chunk_offsets[chunk];
+	}
+
+	// index of the chunk of augmented particles containing k
+	int chunkOf(const int k, int chunk) const
+	{
+		while(k >= _chunk_begin[chunk+1])
+		{
+			chunk++;
+		}
+		return chunk;
+	}
+
+	PandaUtils::WorkerPool _pool;
+	vector<PandaUtils::Xoshiro256> _random_generators;
+	vector<vector<double>> _scatter_noise;
+	vector<ParticleMoments> _chunk_moments;
+
+	// working storage of update(), sized at construction for the largest number of augmented particles
+	int _n_max_augmented_particles;
+	int _n_augmented_particles;
+	vector<double> _augmented_x;
+	vector<double> _augmented_y;
+	vector<double> _augmented_z;
+	vector<double> _weights;
+	// cumulated inside each chunk, the chunk offsets give the cumulative weights over all the particles
+	vector<double> _cumulative_weights;
+	vector<int> _chunk_begin;
+	vector<double> _chunk_sums;
+	vector<double> _chunk_offsets;
+	vector<Vector3d> _new_particles;
+
+	// inputs of the current update
+	int _n_center_particles;
+	int _n_added_particles;
+	Vector3d _motion_control_normalized;
+	Vector3d _force_control_normalized;
+	double _resampling_start;
+	double _resampling_step;
+
+};
+
+/* PARALLEL_PARTICLE_FILTER_H_ */
+#endif
@@ -0,0 +1,486 @@
+
+
+#ifndef PARTICLE_FILTER_H_
+#define PARTICLE_FILTER_H_
+
+#include <Eigen/Dense>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include "random/Xoshiro256.h"
+#include "ParticleMoments.h"
+#include "ParticleFilterPolicies.h"
+
+using namespace Eigen;
+using namespace std;
+
+// Force space particle filter, with the measurement model, the motion model and the
+// resampling given at compile time by the policies of ParticleFilterPolicies.h, so that
+// the update of each variant is fully inlined. The policies are base classes and their
+// parameters are members of the filter :
+//
+//   ParticleFilter<PiecewiseLinearWeighting, GaussianScatter, LowVarianceResampling> pfilter(n_particles);
+//   pfilter._std_scatter = 0.01;
+//   pfilter._F_high = 2.0;
+//   pfilter.update(motion_control, force_control, velocity_measured, force_measured);
+//
+// the particles are augmented with particles at the center and on the arc between the motion
+// and force control, scattered, weighted, then resampled with low variance resampling. The
+// working storage is in x, y and z arrays sized at construction, so that update() does not
+// allocate and the weighting can process several particles per instruction.
+template<typename WeightingPolicy, typename ScatterPolicy, typename ResamplingPolicy>
+class ParticleFilter : public WeightingPolicy, public ScatterPolicy, public ResamplingPolicy
+{
+public:
+
+	ParticleFilter(const int n_particles)
+	{
+		_n_particles = n_particles;
+		_particles.assign(_n_particles, Vector3d::Zero());
+		_particle_weights.assign(_n_particles, 1.0);
+
+		_memory_coefficient = 0.0;
+		_coeff_friction = 0.0;
+		_force_space_dimension = 0;
+
+		_adaptive_particle_count = false;
+		_n_min_particles = _n_particles;
+		_n_max_particles = _n_particles;
+		_kld_epsilon = 0.05;
+		_kld_z = 2.326;
+		_kld_bins_per_side = 0;
+
+		_ess_resampling = false;
+		_ess_threshold = 0.5;
+		_effective_sample_size = _n_particles;
+		_resampled = true;
+
+		allocateWorkingStorage();
+	}
+	~ParticleFilter(){}
+
+	// KLD-sampling : each resampling draws between n_min and n_max particles, enough for the KL distance
+	// to the weighted augmented particles to be below epsilon with probability 1 - delta (z is the upper
+	// 1 - delta normal quantile, 2.326 for delta = 0.01) :
+	//   n = (k-1)/(2 epsilon) * (1 - 2/(9(k-1)) + z sqrt(2/(9(k-1))))^3
+	// with k the number of bins of the unit sphere holding the weight of at least one in n_max particles.
+	// there are bins_per_side x bins_per_side bins on each face of the cube, and one at the center.
+	// _particles then has _n_particles elements, which changes at each update. nothing is allocated after this call
+	void enableAdaptiveParticleCount(const int n_min, const int n_max, const double epsilon = 0.05,
+			const double z = 2.326, const int bins_per_side = 8)
+	{
+		if(n_min < 1 || n_max < n_min)
+		{
+			throw std::invalid_argument("needs 1 <= n_min <= n_max in ParticleFilter::enableAdaptiveParticleCount()\n");
+		}
+		_adaptive_particle_count = true;
+		_n_min_particles = n_min;
+		_n_max_particles = n_max;
+		_kld_epsilon = epsilon;
+		_kld_z = z;
+		_kld_bins_per_side = bins_per_side > 0 ? bins_per_side : 1;
+		_kld_bin_weights.assign(1 + 6 * _kld_bins_per_side * _kld_bins_per_side, 0.0);
+
+		_particles.reserve(_n_max_particles);
+		_particle_weights.reserve(_n_max_particles);
+		_n_particles = std::min(std::max(_n_particles, _n_min_particles), _n_max_particles);
+		_particles.resize(_n_particles, Vector3d::Zero());
+		_particle_weights.resize(_n_particles, 1.0);
+		allocateWorkingStorage();
+	}
+
+	// resample only when the effective sample size (sum w)^2 / (sum w^2) of the particle weights drops below
+	// threshold * _n_particles, or when the measurement model adds particles on the arc. the other updates
+	// only multiply the weights of the particles by their likelihood, and computePCA() uses the weighted
+	// particles. the weights replace the memory of _memory_coefficient in this mode
+	void enableEssResampling(const double threshold = 0.5)
+	{
+		if(!(threshold > 0) || threshold > 1)
+		{
+			throw std::invalid_argument("needs 0 < threshold <= 1 in ParticleFilter::enableEssResampling()\n");
+		}
+		_ess_resampling = true;
+		_ess_threshold = threshold;
+		_particle_weights.assign(_n_particles, 1.0);
+		_effective_sample_size = _n_particles;
+	}
+
+	void update(const Vector3d motion_control, const Vector3d force_control,
+			const Vector3d velocity_measured, const Vector3d force_measured)
+	{
+		// in steady contact, a reweighting pass instead of the motion update and the resampling
+		if(_ess_resampling && reweightInPlace(motion_control, velocity_measured, force_measured))
+		{
+			_resampled = false;
+			return;
+		}
+		motionUpdateAndWeighting(motion_control, force_control, velocity_measured, force_measured);
+		resamplingLowVariance();
+		_resampled = true;
+	}
+
+	// fills the augmented particles and their weights, kept in the filter
+	void motionUpdateAndWeighting(const Vector3d motion_control, const Vector3d force_control,
+			const Vector3d velocity_measured, const Vector3d force_measured)
+	{
+		const Vector3d motion_control_normalized = normalizedControl(motion_control);
+		const Vector3d force_control_normalized = normalizedControl(force_control);
+
+		this->prepare(velocity_measured, force_measured);
+
+		int n_augmented = 0;
+		for( ; n_augmented<_n_particles ; n_augmented++)
+		{
+			_augmented_x[n_augmented] = _particles[n_augmented](0);
+			_augmented_y[n_augmented] = _particles[n_augmented](1);
+			_augmented_z[n_augmented] = _particles[n_augmented](2);
+		}
+
+		// add particles at the center in case of contact loss
+		const int n_added_particles_center = this->nCenterParticles(_n_particles);
+		for(int i=0 ; i<n_added_particles_center ; i++)
+		{
+			_augmented_x[n_augmented] = 0;
+			_augmented_y[n_augmented] = 0;
+			_augmented_z[n_augmented] = 0;
+			n_augmented++;
+		}
+
+		// add particles on the arc between the motion and force control
+		int n_added_particles = this->nAddedParticles(_n_particles, motion_control_normalized, _coeff_friction, _force_space_dimension);
+		if(n_added_particles > this->nMaxAddedParticles(_n_particles))
+		{
+			n_added_particles = this->nMaxAddedParticles(_n_particles);
+		}
+		for(int i=0 ; i<n_added_particles ; i++)
+		{
+			double alpha = (double) (i + 0.5) / (double)n_added_particles;
+			Vector3d new_particle = (1 - alpha) * motion_control_normalized + alpha * force_control_normalized;
+			new_particle.normalize();
+			_augmented_x[n_augmented] = new_particle(0);
+			_augmented_y[n_augmented] = new_particle(1);
+			_augmented_z[n_augmented] = new_particle(2);
+			n_augmented++;
+		}
+		_n_augmented_particles = n_augmented;
+
+		// control update and measurement update
+		this->scatter(_augmented_x.data(), _augmented_y.data(), _augmented_z.data(), n_augmented, _random_generator, _scatter_noise.data());
+		this->weights(_augmented_x.data(), _augmented_y.data(), _augmented_z.data(), _weights.data(), n_augmented);
+
+		// the previous particles keep their weight since the last resampling, or part of their previous weight
+		if(_ess_resampling)
+		{
+			for(int i=0 ; i<_n_particles ; i++)
+			{
+				_weights[i] *= _particle_weights[i];
+			}
+		}
+		else if(_memory_coefficient != 0)
+		{
+			for(int i=0 ; i<_n_particles ; i++)
+			{
+				_weights[i] = (1 - _memory_coefficient) * _weights[i] + _memory_coefficient * _particle_weights[i];
+			}
+		}
+	}
+
+	// draws the new particles from the augmented ones, and accumulates their moments
+	void resamplingLowVariance()
+	{
+		const int n_augmented = _n_augmented_particles;
+		this->prepareResampling(_augmented_x.data(), _augmented_y.data(), _augmented_z.data(), _weights.data(), n_augmented, _force_space_dimension);
+
+		double sum_of_weights = 0;
+		for(int i=0 ; i<n_augmented ; i++)
+		{
+			sum_of_weights += _weights[i];
+			_cumulative_weights[i] = sum_of_weights;
+		}
+
+		_moments.reset();
+
+		// no particle is consistent with the measurements, keep the current ones
+		if(!(sum_of_weights > 0))
+		{
+			for(int i=0 ; i<_n_particles ; i++)
+			{
+				_moments.add(_particles[i](0), _particles[i](1), _particles[i](2), _ess_resampling ? _particle_weights[i] : 1.0);
+			}
+			return;
+		}
+
+		if(_adaptive_particle_count)
+		{
+			_n_particles = kldParticleCount(sum_of_weights);
+			_particles.resize(_n_particles);
+			_particle_weights.resize(_n_particles);
+		}
+
+		const double n_inv = 1.0/(double)_n_particles;
+		double r = sampleUniformDistribution(0,n_inv) * sum_of_weights;
+		const double step = n_inv * sum_of_weights;
+		int k = 0;
+
+		for(int i=0 ; i<_n_particles ; i++)
+		{
+			while(r > _cumulative_weights[k] && k < n_augmented - 1)
+			{
+				k++;
+			}
+			_particles[i] = Vector3d(_augmented_x[k], _augmented_y[k], _augmented_z[k]);
+			_particle_weights[i] = _ess_resampling ? 1.0 : _weights[k];
+			_moments.add(_augmented_x[k], _augmented_y[k], _augmented_z[k]);
+			r += step;
+		}
+		_effective_sample_size = _n_particles;
+	}
+
+	// multiplies the weights of the particles by their likelihood, and accumulates their weighted moments.
+	// returns false without changing the particles or their weights if the filter should resample instead
+	bool reweightInPlace(const Vector3d motion_control, const Vector3d velocity_measured, const Vector3d force_measured)
+	{
+		this->prepare(velocity_measured, force_measured);
+		if(this->nAddedParticles(_n_particles, normalizedControl(motion_control), _coeff_friction, _force_space_dimension) > 0)
+		{
+			return false;
+		}
+
+		// the center particles that a resampling would add are only counted in the moments, so that
+		// the PCA still sees the contact particles against the center
+		const int n_center = this->nCenterParticles(_n_particles);
+		const int n_weighted = _n_particles + n_center;
+		for(int i=0 ; i<_n_particles ; i++)
+		{
+			_augmented_x[i] = _particles[i](0);
+			_augmented_y[i] = _particles[i](1);
+			_augmented_z[i] = _particles[i](2);
+		}
+		for(int i=_n_particles ; i<n_weighted ; i++)
+		{
+			_augmented_x[i] = 0;
+			_augmented_y[i] = 0;
+			_augmented_z[i] = 0;
+		}
+		this->weights(_augmented_x.data(), _augmented_y.data(), _augmented_z.data(), _weights.data(), n_weighted);
+
+		double sum_of_weights = 0;
+		double sum_of_squared_weights = 0;
+		for(int i=0 ; i<_n_particles ; i++)
+		{
+			_weights[i] *= _particle_weights[i];
+			sum_of_weights += _weights[i];
+			sum_of_squared_weights += _weights[i] * _weights[i];
+		}
+		if(!(sum_of_weights > 0))
+		{
+			return false;
+		}
+		const double effective_sample_size = sum_of_weights * sum_of_weights / sum_of_squared_weights;
+		if(effective_sample_size < _ess_threshold * _n_particles)
+		{
+			return false;
+		}
+		_effective_sample_size = effective_sample_size;
+
+		// particle weights normalized to a mean of 1, moments to a total weight of _n_particles like after a resampling
+		double sum_of_center_weights = 0;
+		for(int i=_n_particles ; i<n_weighted ; i++)
+		{
+			sum_of_center_weights += _weights[i];
+		}
+		const double normalization = _n_particles / sum_of_weights;
+		const double moments_normalization = _n_particles / (sum_of_weights + sum_of_center_weights);
+		_moments.reset();
+		for(int i=0 ; i<_n_particles ; i++)
+		{
+			_particle_weights[i] = _weights[i] * normalization;
+			_moments.add(_augmented_x[i], _augmented_y[i], _augmented_z[i], _weights[i] * moments_normalization);
+		}
+		for(int i=_n_particles ; i<n_weighted ; i++)
+		{
+			_moments.add(0, 0, 0, _weights[i] * moments_normalization);
+		}
+		return true;
+	}
+
+	void computePCA(Vector3d& eigenvalues, Matrix3d& eigenvectors)
+	{
+		// moments accumulated by the last resampling
+		_moments.computePCA(eigenvalues, eigenvectors);
+	}
+
+	Vector3d particle(const int i) const
+	{
+		return _particles[i];
+	}
+
+	// reseed the random generator, for reproducible runs
+	void seed(const uint64_t seed_value)
+	{
+		_random_generator.seed(seed_value);
+	}
+
+	double sampleNormalDistribution(const double mean, const double std)
+	{
+		return _random_generator.normal(mean, std);
+	}
+
+	double sampleUniformDistribution(const double min, const double max)
+	{
+		if(min > max)
+		{
+			return _random_generator.uniform(max, min);
+		}
+		return _random_generator.uniform(min, max);
+	}
+
+	// current number of particles, fixed unless enableAdaptiveParticleCount() was called
+	int _n_particles;
+	vector<Vector3d> _particles;
+	// weights of the particles when they were resampled, or since the last resampling with enableEssResampling()
+	vector<double> _particle_weights;
+
+	// part of the previous weight kept by the particles at each update
+	double _memory_coefficient;
+
+	double _coeff_friction;
+
+	// current estimate of the force space dimension, given by the user of the filter
+	int _force_space_dimension;
+
+	// moments of the particles, for computePCA()
+	ParticleMoments _moments;
+
+	// adaptive particle count, see enableAdaptiveParticleCount()
+	bool _adaptive_particle_count;
+	int _n_min_particles;
+	int _n_max_particles;
+	double _kld_epsilon;
+	double _kld_z;
+	int _kld_bins_per_side;
+	vector<double> _kld_bin_weights;
+
+	// resampling triggered by the effective sample size, see enableEssResampling()
+	bool _ess_resampling;
+	double _ess_threshold;
+	// of the particle weights after the last update, and whether it resampled
+	double _effective_sample_size;
+	bool _resampled;
+
+	// seeded once at construction
+	PandaUtils::Xoshiro256 _random_generator;
+
+	// working storage of update(), sized at construction for the largest number of augmented particles
+	int _n_max_augmented_particles;
+	int _n_augmented_particles;
+	vector<double> _augmented_x;
+	vector<double> _augmented_y;
+	vector<double> _augmented_z;
+	vector<double> _weights;
+	vector<double> _cumulative_weights;
+	vector<double> _scatter_noise;
+
+private:
+
+	Vector3d normalizedControl(const Vector3d& control) const
+	{
+		if(control.norm() > this->controlThreshold())
+		{
+			return control/control.norm();
+		}
+		return Vector3d::Zero();
+	}
+
+	// sized for the largest number of particles
+	void allocateWorkingStorage()
+	{
+		const int n_max = std::max(_n_particles, _n_max_particles);
+		_n_max_augmented_particles = n_max + this->nCenterParticles(n_max) + this->nMaxAddedParticles(n_max);
+		_n_augmented_particles = 0;
+		_augmented_x.assign(_n_max_augmented_particles, 0.0);
+		_augmented_y.assign(_n_max_augmented_particles, 0.0);
+		_augmented_z.assign(_n_max_augmented_particles, 0.0);
+		_weights.assign(_n_max_augmented_particles, 0.0);
+		_cumulative_weights.assign(_n_max_augmented_particles, 0.0);
+		_scatter_noise.assign(3 * _n_max_augmented_particles, 0.0);
+	}
+
+	// bin 0 is the center, then the bins of the faces of the cube x > 0, x < 0, y > 0, y < 0, z > 0, z < 0
+	int sphereBin(const double x, const double y, const double z) const
+	{
+		const double ax = abs(x);
+		const double ay = abs(y);
+		const double az = abs(z);
+		if(x*x + y*y + z*z <= PARTICLE_CONTACT_THRESHOLD*PARTICLE_CONTACT_THRESHOLD)
+		{
+			return 0;
+		}
+		int face;
+		double u, v;
+		if(ax >= ay && ax >= az)
+		{
+			face = x > 0 ? 0 : 1;
+			u = y / ax;
+			v = z / ax;
+		}
+		else if(ay >= az)
+		{
+			face = y > 0 ? 2 : 3;
+			u = x / ay;
+			v = z / ay;
+		}
+		else
+		{
+			face = z > 0 ? 4 : 5;
+			u = x / az;
+			v = y / az;
+		}
+		const int s = _kld_bins_per_side;
+		const int iu = std::min((int)((u + 1) * 0.5 * s), s - 1);
+		const int iv = std::min((int)((v + 1) * 0.5 * s), s - 1);
+		return 1 + (face * s + iu) * s + iv;
+	}
+
+	int kldParticleCount(const double sum_of_weights)
+	{
+		std::fill(_kld_bin_weights.begin(), _kld_bin_weights.end(), 0.0);
+		for(int i=0 ; i<_n_augmented_particles ; i++)
+		{
+			_kld_bin_weights[sphereBin(_augmented_x[i], _augmented_y[i], _augmented_z[i])] += _weights[i];
+		}
+
+		const double bin_threshold = sum_of_weights / _n_max_particles;
+		int k = 0;
+		for(unsigned int b=0 ; b<_kld_bin_weights.size() ; b++)
+		{
+			if(_kld_bin_weights[b] > 0 && _kld_bin_weights[b] >= bin_threshold)
+			{
+				k++;
+			}
+		}
+		if(k <= 1)
+		{
+			return _n_min_particles;
+		}
+
+		const double a = 2.0 / (9.0 * (k - 1));
+		const double c = 1.0 - a + sqrt(a) * _kld_z;
+		const double n = ceil((k - 1) / (2.0 * _kld_epsilon) * c * c * c);
+		if(n < _n_min_particles)
+		{
+			return _n_min_particles;
+		}
+		if(n > _n_max_particles)
+		{
+			return _n_max_particles;
+		}
+		return n;
+	}
+
+};
+
+/* PARTICLE_FILTER_H_ */
+#endif
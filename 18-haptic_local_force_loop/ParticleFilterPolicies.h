@@ -0,0 +1,459 @@
+
+
+#ifndef PARTICLE_FILTER_POLICIES_H_
+#define PARTICLE_FILTER_POLICIES_H_
+
+#include <Eigen/Dense>
+#include <cmath>
+#include <vector>
+
+#include "random/Xoshiro256.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PARTICLE_FILTER_POLICIES_AVX2
+#endif
+
+using namespace Eigen;
+using namespace std;
+
+// Policies of the force space particle filter of ParticleFilter.h. They are base
+// classes of the filter, so their parameters are members of the filter.
+//
+// a weighting policy is the measurement model. It gives the normalization threshold of the
+// controls, the number of particles added at the center and on the arc between the motion
+// and force control, and the weights of the scattered particles :
+//
+//   double controlThreshold() const;
+//   int nCenterParticles(const int n_particles) const;
+//   int nMaxAddedParticles(const int n_particles) const;
+//   void prepare(const Vector3d& velocity_measured, const Vector3d& force_measured);
+//   int nAddedParticles(const int n_particles, const Vector3d& motion_control_normalized,
+//           const double coeff_friction, const int force_space_dimension) const;
+//   double weight(const double x, const double y, const double z) const;
+//   void weights(const double* x, const double* y, const double* z, double* weights, const int n) const;
+//
+// a scatter policy is the motion model of the particles in contact :
+//
+//   void scatter(double* x, double* y, double* z, const int n, PandaUtils::Xoshiro256& random_generator, double* noise) const;
+//
+// a resampling policy can modify the weights before the low variance resampling, and says
+// whether it does, so that ParallelParticleFilter only gathers the weights when needed :
+//
+//   bool modifiesWeights() const;
+//   void prepareResampling(const double* x, const double* y, const double* z, double* weights,
+//           const int n, const int force_space_dimension) const;
+
+// particles closer than this to the center are the (no contact) center particle
+const double PARTICLE_CONTACT_THRESHOLD = 1e-3;
+
+inline double clamp01(const double x)
+{
+	return x < 0 ? 0 : (x > 1 ? 1 : x);
+}
+
+// rational approximation of tanh, absolute error below 1e-4. the input is clamped
+// where the approximation reaches 1
+const double FAST_TANH_CLAMP = 4.97;
+
+inline double fastTanh(double x)
+{
+	x = x > FAST_TANH_CLAMP ? FAST_TANH_CLAMP : (x < -FAST_TANH_CLAMP ? -FAST_TANH_CLAMP : x);
+	const double x2 = x*x;
+	return x * (135135.0 + x2*(17325.0 + x2*(378.0 + x2))) / (135135.0 + x2*(62370.0 + x2*(3150.0 + x2*28.0)));
+}
+
+// weights of n particles from the weight() of a policy
+template<typename Weighting>
+inline void computeWeights(const Weighting& weighting, const double* x, const double* y, const double* z,
+		double* weights, const int n)
+{
+	for(int i=0 ; i<n ; i++)
+	{
+		weights[i] = weighting.weight(x[i], y[i], z[i]);
+	}
+}
+
+#ifdef PARTICLE_FILTER_POLICIES_AVX2
+
+inline bool cpuHasAVX2()
+{
+	static const bool has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	return has_avx2;
+}
+
+__attribute__((target("avx2,fma")))
+inline __m256d fastTanhAVX2(__m256d x)
+{
+	x = _mm256_min_pd(_mm256_max_pd(x, _mm256_set1_pd(-FAST_TANH_CLAMP)), _mm256_set1_pd(FAST_TANH_CLAMP));
+	const __m256d x2 = _mm256_mul_pd(x, x);
+	__m256d num = _mm256_add_pd(x2, _mm256_set1_pd(378.0));
+	num = _mm256_fmadd_pd(num, x2, _mm256_set1_pd(17325.0));
+	num = _mm256_fmadd_pd(num, x2, _mm256_set1_pd(135135.0));
+	__m256d den = _mm256_fmadd_pd(x2, _mm256_set1_pd(28.0), _mm256_set1_pd(3150.0));
+	den = _mm256_fmadd_pd(den, x2, _mm256_set1_pd(62370.0));
+	den = _mm256_fmadd_pd(den, x2, _mm256_set1_pd(135135.0));
+	return _mm256_div_pd(_mm256_mul_pd(x, num), den);
+}
+
+#endif
+
+// Measurement model of ForceSpaceParticleFilter : tanh of the force and velocity along the
+// particle, evaluated four particles at a time with AVX2 when the cpu has it
+struct TanhWeighting
+{
+	double controlThreshold() const { return 0.5; }
+
+	// one particle at the center in case of contact loss, and at most 0.2 * n_particles on the arc
+	int nCenterParticles(const int /*n_particles*/) const { return 1; }
+	int nMaxAddedParticles(const int n_particles) const { return 0.2 * n_particles; }
+
+	void prepare(const Vector3d& velocity_measured, const Vector3d& force_measured)
+	{
+		_velocity_measured = velocity_measured;
+		_force_measured = force_measured;
+		_center_weight_force = clamp01(1 - tanh(0.1*force_measured.norm()));
+	}
+
+	// add particles in the direction of the motion control if there is no velocity in that direction
+	int nAddedParticles(const int n_particles, const Vector3d& motion_control_normalized,
+			const double /*coeff_friction*/, const int /*force_space_dimension*/) const
+	{
+		double prob_add_particle = (1 - abs(tanh(25.0*_velocity_measured.dot(motion_control_normalized)))) * (tanh(motion_control_normalized.dot(0.1*_force_measured)));
+		if(prob_add_particle < 0)
+		{
+			prob_add_particle = 0;
+		}
+		return 0.2 * prob_add_particle * n_particles;
+	}
+
+	double weight(const double x, const double y, const double z) const
+	{
+		if(x*x + y*y + z*z > PARTICLE_CONTACT_THRESHOLD*PARTICLE_CONTACT_THRESHOLD) // contact
+		{
+			const double weight_force = clamp01(1.3 * fastTanh(x*_force_measured(0) + y*_force_measured(1) + z*_force_measured(2)));
+			const double weight_velocity = 1 - abs(fastTanh(25.0 * (x*_velocity_measured(0) + y*_velocity_measured(1) + z*_velocity_measured(2))));
+			return weight_force * weight_velocity;
+		}
+		return _center_weight_force * 0.5;
+	}
+
+	void weights(const double* x, const double* y, const double* z, double* weights, const int n) const
+	{
+#ifdef PARTICLE_FILTER_POLICIES_AVX2
+		if(cpuHasAVX2())
+		{
+			weightsAVX2(x, y, z, weights, n);
+			return;
+		}
+#endif
+		computeWeights(*this, x, y, z, weights, n);
+	}
+
+#ifdef PARTICLE_FILTER_POLICIES_AVX2
+	__attribute__((target("avx2,fma")))
+	void weightsAVX2(const double* x, const double* y, const double* z, double* weights, const int n) const
+	{
+		const __m256d fx = _mm256_set1_pd(_force_measured(0));
+		const __m256d fy = _mm256_set1_pd(_force_measured(1));
+		const __m256d fz = _mm256_set1_pd(_force_measured(2));
+		const __m256d vx = _mm256_set1_pd(25.0 * _velocity_measured(0));
+		const __m256d vy = _mm256_set1_pd(25.0 * _velocity_measured(1));
+		const __m256d vz = _mm256_set1_pd(25.0 * _velocity_measured(2));
+		const __m256d zero = _mm256_setzero_pd();
+		const __m256d one = _mm256_set1_pd(1.0);
+		const __m256d sign_mask = _mm256_set1_pd(-0.0);
+		const __m256d center_weight = _mm256_set1_pd(_center_weight_force * 0.5);
+		const __m256d contact_threshold = _mm256_set1_pd(PARTICLE_CONTACT_THRESHOLD*PARTICLE_CONTACT_THRESHOLD);
+
+		int i = 0;
+		for( ; i+4<=n ; i+=4)
+		{
+			const __m256d px = _mm256_loadu_pd(x + i);
+			const __m256d py = _mm256_loadu_pd(y + i);
+			const __m256d pz = _mm256_loadu_pd(z + i);
+			const __m256d norm2 = _mm256_fmadd_pd(px, px, _mm256_fmadd_pd(py, py, _mm256_mul_pd(pz, pz)));
+			const __m256d contact = _mm256_cmp_pd(norm2, contact_threshold, _CMP_GT_OQ);
+
+			const __m256d force_dot = _mm256_fmadd_pd(px, fx, _mm256_fmadd_pd(py, fy, _mm256_mul_pd(pz, fz)));
+			__m256d weight_force = _mm256_mul_pd(_mm256_set1_pd(1.3), fastTanhAVX2(force_dot));
+			weight_force = _mm256_min_pd(_mm256_max_pd(weight_force, zero), one);
+			const __m256d velocity_dot = _mm256_fmadd_pd(px, vx, _mm256_fmadd_pd(py, vy, _mm256_mul_pd(pz, vz)));
+			const __m256d weight_velocity = _mm256_sub_pd(one, _mm256_andnot_pd(sign_mask, fastTanhAVX2(velocity_dot)));
+
+			_mm256_storeu_pd(weights + i, _mm256_blendv_pd(center_weight, _mm256_mul_pd(weight_force, weight_velocity), contact));
+		}
+		computeWeights(*this, x + i, y + i, z + i, weights + i, n - i);
+	}
+#endif
+
+	Vector3d _velocity_measured;
+	Vector3d _force_measured;
+	double _center_weight_force;
+};
+
+// Measurement model of ForceSpaceParticleFilter_weight_mem : piecewise linear weights
+// between low and high force and velocity thresholds
+struct PiecewiseLinearWeighting
+{
+	PiecewiseLinearWeighting()
+	{
+		_F_low = 0.0;
+		_F_high = 5.0;
+		_v_low = 0.005;
+		_v_high = 0.05;
+
+		_F_low_add = 3.0;
+		_F_high_add = 10.0;
+		_v_low_add = 0.0;
+		_v_high_add = 0.01;
+	}
+
+	double controlThreshold() const { return 0.001; }
+
+	// 1% of the particles at the center in case of contact loss, and at most n_particles on the arc
+	int nCenterParticles(const int n_particles) const { return n_particles * 0.01; }
+	int nMaxAddedParticles(const int n_particles) const { return n_particles; }
+
+	void prepare(const Vector3d& velocity_measured, const Vector3d& force_measured)
+	{
+		_velocity_measured = velocity_measured;
+		_force_measured = force_measured;
+	}
+
+	// add particles in the direction of the motion control if there is no velocity in that direction
+	int nAddedParticles(const int n_particles, const Vector3d& motion_control_normalized,
+			const double /*coeff_friction*/, const int /*force_space_dimension*/) const
+	{
+		double prob_add_particle = wf_pw(motion_control_normalized, _force_measured, _F_low_add, _F_high_add) * wv_pw(motion_control_normalized, _velocity_measured, _v_low_add, _v_high_add);
+		if(prob_add_particle < 0)
+		{
+			prob_add_particle = 0;
+		}
+		return prob_add_particle * n_particles * 1.0;
+	}
+
+	double weight(const double x, const double y, const double z) const
+	{
+		const Vector3d particle(x, y, z);
+		return wf_pw(particle, _force_measured, _F_low, _F_high) * wv_pw(particle, _velocity_measured, _v_low, _v_high);
+	}
+
+	void weights(const double* x, const double* y, const double* z, double* weights, const int n) const
+	{
+		computeWeights(*this, x, y, z, weights, n);
+	}
+
+	double wf(const Vector3d particle, const Vector3d sensed_force) const
+	{
+		double wf = 0;
+		if(particle.norm() < 0.1)
+		{
+			wf = 1 - tanh(10 * (sensed_force.norm() - _F_low) / (_F_high - _F_low) );
+		}
+		else
+		{
+			wf = tanh(2 * (particle.dot(sensed_force) - _F_low) / (_F_high - _F_low));
+		}
+
+		if(wf > 1) {wf = 1;}
+		if(wf < 0) {wf = 0;}
+
+		return wf;
+	}
+
+	double wv(const Vector3d particle, const Vector3d sensed_velocity) const
+	{
+		double wv = 0.5;
+		if(particle.norm() > 0.001)
+		{
+			wv = 1 - abs(tanh(2.0 * particle.dot(sensed_velocity) / _v_high));
+		}
+
+		if(wv > 1) {wv = 1;}
+		if(wv < 0) {wv = 0;}
+
+		return wv;
+	}
+
+	double wf_pw(const Vector3d particle, const Vector3d force_measured, const double fl, const double fh) const
+	{
+		double wf = 0;
+
+		if(particle.norm() < 0.1)
+		{
+			wf = 1.0 - (force_measured.norm() - fl) / (fh - fl);
+		}
+		else
+		{
+			wf = (particle.dot(force_measured) - fl) / (fh - fl);
+		}
+
+		if(wf > 1) {wf = 1;}
+		if(wf < 0) {wf = 0;}
+
+		return wf;
+	}
+
+	double wv_pw(const Vector3d particle, const Vector3d velocity_measured, const double vl, const double vh) const
+	{
+		double wv = 0.5;
+		if(particle.norm() > 0.001)
+		{
+			wv = 1 - (particle.dot(velocity_measured) - vl) / (vh - vl);
+		}
+
+		if(wv > 1) {wv = 1;}
+		if(wv < 0) {wv = 0;}
+
+		return wv;
+	}
+
+	double _F_low, _F_high, _v_high, _v_low;
+
+	double _F_low_add, _F_high_add, _v_high_add, _v_low_add;
+
+	Vector3d _velocity_measured;
+	Vector3d _force_measured;
+};
+
+// Measurement model of app.cpp : tanh weights, and fewer added particles when the force
+// along the motion control could be friction
+struct TanhFrictionWeighting
+{
+	double controlThreshold() const { return 0.5; }
+
+	// one particle at the center in case of contact loss, and at most 1.5 * n_particles on the arc
+	int nCenterParticles(const int /*n_particles*/) const { return 1; }
+	int nMaxAddedParticles(const int n_particles) const { return 1.5 * n_particles; }
+
+	void prepare(const Vector3d& velocity_measured, const Vector3d& force_measured)
+	{
+		_velocity_measured = velocity_measured;
+		_force_measured = force_measured;
+		_center_weight_force = clamp01(1-tanh(force_measured.norm()/2));
+	}
+
+	// add particles in the direction of the motion control if there is no velocity in that direction
+	int nAddedParticles(const int n_particles, const Vector3d& motion_control_normalized,
+			const double coeff_friction, const int force_space_dimension) const
+	{
+		double prob_add_particle = (1 - abs(tanh(5.0*_velocity_measured.dot(motion_control_normalized)))) * (tanh(motion_control_normalized.dot(_force_measured)));
+		Matrix3d proj_motion_control_space = motion_control_normalized*motion_control_normalized.transpose();
+		prob_add_particle *= tanh((proj_motion_control_space*_force_measured).norm() - force_space_dimension * 1.5 * coeff_friction * (_force_measured - proj_motion_control_space*_force_measured).norm());
+		if(prob_add_particle < 0)
+		{
+			prob_add_particle = 0;
+		}
+		return 1.5 * prob_add_particle * n_particles;
+	}
+
+	double weight(const double x, const double y, const double z) const
+	{
+		double weight_force = _center_weight_force;
+		if(x*x + y*y + z*z > PARTICLE_CONTACT_THRESHOLD*PARTICLE_CONTACT_THRESHOLD) // contact
+		{
+			weight_force = clamp01(1.3 * tanh(x*_force_measured(0) + y*_force_measured(1) + z*_force_measured(2)));
+		}
+		const double weight_velocity = 1 - abs(tanh(5.0 * (x*_velocity_measured(0) + y*_velocity_measured(1) + z*_velocity_measured(2))));
+		return weight_force * weight_velocity;
+	}
+
+	void weights(const double* x, const double* y, const double* z, double* weights, const int n) const
+	{
+		computeWeights(*this, x, y, z, weights, n);
+	}
+
+	Vector3d _velocity_measured;
+	Vector3d _force_measured;
+	double _center_weight_force;
+};
+
+// Gaussian noise on the particles in contact, which are then normalized back on the unit sphere
+struct GaussianScatter
+{
+	GaussianScatter()
+	{
+		_mean_scatter = 0.0;
+		_std_scatter = 0.005;
+	}
+
+	// noise holds at least 3 * n numbers
+	void scatter(double* x, double* y, double* z, const int n, PandaUtils::Xoshiro256& random_generator, double* noise) const
+	{
+		int n_contact = 0;
+		for(int i=0 ; i<n ; i++)
+		{
+			if(x[i]*x[i] + y[i]*y[i] + z[i]*z[i] > PARTICLE_CONTACT_THRESHOLD*PARTICLE_CONTACT_THRESHOLD)
+			{
+				n_contact++;
+			}
+		}
+		random_generator.fillNormal(noise, 3 * n_contact, _mean_scatter, _std_scatter);
+
+		for(int i=0 ; i<n ; i++)
+		{
+			if(x[i]*x[i] + y[i]*y[i] + z[i]*z[i] > PARTICLE_CONTACT_THRESHOLD*PARTICLE_CONTACT_THRESHOLD) // contact
+			{
+				const double px = x[i] + noise[0];
+				const double py = y[i] + noise[1];
+				const double pz = z[i] + noise[2];
+				noise += 3;
+				const double inv_norm = 1.0 / sqrt(px*px + py*py + pz*pz);
+				x[i] = px * inv_norm;
+				y[i] = py * inv_norm;
+				z[i] = pz * inv_norm;
+			}
+		}
+	}
+
+	double _mean_scatter;
+	double _std_scatter;
+};
+
+// Low variance resampling of the weights as they are
+struct LowVarianceResampling
+{
+	bool modifiesWeights() const { return false; }
+
+	void prepareResampling(const double* /*x*/, const double* /*y*/, const double* /*z*/, double* /*weights*/,
+			const int /*n*/, const int /*force_space_dimension*/) const {}
+};
+
+// Low variance resampling after a penalty on the particles close to the others, to keep
+// the particles spread when the force space has 3 dimensions
+struct ProximityPenaltyResampling
+{
+	bool modifiesWeights() const { return true; }
+
+	void prepareResampling(const double* x, const double* y, const double* z, double* weights,
+			const int n, const int force_space_dimension) const
+	{
+		if(force_space_dimension <= 2)
+		{
+			return;
+		}
+		for(int i=0 ; i<n ; i++)
+		{
+			double average_dist = 0;
+			for(int j=0 ; j<n ; j++)
+			{
+				const double dx = x[i] - x[j];
+				const double dy = y[i] - y[j];
+				const double dz = z[i] - z[j];
+				average_dist += sqrt(dx*dx + dy*dy + dz*dz);
+			}
+			average_dist /= (double) n;
+
+			double penalty_weight = 0.5 + average_dist;
+			if(penalty_weight > 1)
+			{
+				penalty_weight = 1;
+			}
+			weights[i] *= penalty_weight;
+		}
+	}
+};
+
+/* PARTICLE_FILTER_POLICIES_H_ */
+#endif
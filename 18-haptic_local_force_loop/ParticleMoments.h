@@ -0,0 +1,107 @@
+
+
+#ifndef PARTICLE_MOMENTS_H_
+#define PARTICLE_MOMENTS_H_
+
+#include <Eigen/Dense>
+
+using namespace Eigen;
+
+// First and second moments of a set of particles, accumulated while the particles
+// are written, and the PCA of the set computed from them in closed form
+struct ParticleMoments
+{
+	ParticleMoments()
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		_n = 0;
+		_sum.setZero();
+		_sum_of_squares.setZero();
+	}
+
+	void add(const double x, const double y, const double z)
+	{
+		_n++;
+		_sum(0) += x;
+		_sum(1) += y;
+		_sum(2) += z;
+		_sum_of_squares(0,0) += x*x;
+		_sum_of_squares(0,1) += x*y;
+		_sum_of_squares(0,2) += x*z;
+		_sum_of_squares(1,1) += y*y;
+		_sum_of_squares(1,2) += y*z;
+		_sum_of_squares(2,2) += z*z;
+	}
+
+	void add(const Vector3d& particle)
+	{
+		add(particle(0), particle(1), particle(2));
+	}
+
+	// particle counted weight times
+	void add(const double x, const double y, const double z, const double weight)
+	{
+		_n += weight;
+		_sum(0) += weight * x;
+		_sum(1) += weight * y;
+		_sum(2) += weight * z;
+		_sum_of_squares(0,0) += weight * x*x;
+		_sum_of_squares(0,1) += weight * x*y;
+		_sum_of_squares(0,2) += weight * x*z;
+		_sum_of_squares(1,1) += weight * y*y;
+		_sum_of_squares(1,2) += weight * y*z;
+		_sum_of_squares(2,2) += weight * z*z;
+	}
+
+	// merge the moments of another set
+	void add(const ParticleMoments& other)
+	{
+		_n += other._n;
+		_sum += other._sum;
+		_sum_of_squares += other._sum_of_squares;
+	}
+
+	// sum over the particles of the outer products of their deviations to the mean
+	// (the scatter matrix, not divided by the number of particles)
+	Matrix3d scatterMatrix() const
+	{
+		Matrix3d scatter = Matrix3d::Zero();
+		if(!(_n > 0))
+		{
+			return scatter;
+		}
+		const Vector3d mean = _sum / _n;
+		for(int i=0 ; i<3 ; i++)
+		{
+			for(int j=i ; j<3 ; j++)
+			{
+				scatter(i,j) = _sum_of_squares(i,j) - _n * mean(i) * mean(j);
+				scatter(j,i) = scatter(i,j);
+			}
+		}
+		return scatter;
+	}
+
+	// eigenvalues in increasing order and the corresponding eigenvectors of the scatter matrix,
+	// with the closed form solver of Eigen for 3x3 symmetric matrices
+	void computePCA(Vector3d& eigenvalues, Matrix3d& eigenvectors) const
+	{
+		SelfAdjointEigenSolver<Matrix3d> eig;
+		eig.computeDirect(scatterMatrix());
+		eigenvectors = eig.eigenvectors();
+		eigenvalues = eig.eigenvalues();
+	}
+
+	// sum of the weights, the number of particles when they were added without weight
+	double _n;
+	Vector3d _sum;
+	// upper triangle only
+	Matrix3d _sum_of_squares;
+};
+
+/* PARTICLE_MOMENTS_H_ */
+#endif
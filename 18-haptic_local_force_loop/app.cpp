@@ -5,22 +5,34 @@
 #include "Sai2Simulation.h"
 #include <dynamics3d.h>
 #include "redis/RedisClient.h"
+#include "redis/RedisClientPool.h"
+#include "redis/AsyncRedisWriter.h"
 #include "timer/LoopTimer.h"
+#include "timer/TraceRecorder.h"
+#include "timer/PrecisionLoopTimer.h"
+#include "sim/DelayLine.h"
+#include "haptics/HapticForceRenderer.h"
+#include "haptics/DelayCompensation.h"
+#include "net/UdpHapticDevice.h"
+#include "redis/HapticDeviceBundle.h"
 #include "tasks/JointTask.h"
 #include "tasks/PositionTask.h"
 #include "haptic_tasks/HapticController.h"
-#include "filters/ButterworthFilter.h"
-#include "Logger.h"
+#include "filters/ButterworthFilterBank.h"
+#include "logger/Logger.h"
+#include "threads/TripleBuffer.h"
+#include "threads/RealtimeThread.h"
+#include "ParallelForceSpaceParticleFilter.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
 
 #include "force_sensor/ForceSensorSim.h" // Add force sensor simulation and display classes
 #include "force_sensor/ForceSensorDisplay.h"
 
+#include <atomic>
 #include <iostream>
 #include <string>
 #include <random>
-#include <queue>
 
 #define INIT            0
 #define CONTROL         1
@@ -122,32 +134,121 @@ vector<string> DEVICE_SENSED_TORQUE_KEYS = {
 	"sai2::ChaiHapticDevice::device1::sensors::sensed_torque",
 	};
 
-RedisClient redis_client;
+// one redis connection per thread
+PandaUtils::RedisClientPool redis_pool;
+
+// timeline of the threads, written on exit with --trace <file>
+PandaUtils::TraceRecorder* tracer = NULL;
+// haptic device of a remote haptic station with --udp-teleop <port> <station> <station port>
+PandaUtils::UdpTeleopConfig udp_config;
 
 // simulation function prototype
 void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, ForceSensorSim* force_sensor);
 void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim);
+void haptic(const Vector3d robot_center);
 void particle_filter();
 void communication();
 
-Vector3d delayed_robot_position = Vector3d::Zero();
-Vector3d delayed_haptic_position = Vector3d::Zero();
-Vector3d delayed_haptic_velocity = Vector3d::Zero();
 Vector3d delayed_sensed_force = Vector3d::Zero();
-Matrix3d delayed_sigma_force = Matrix3d::Zero();
 
-Vector3d robot_position_global = Vector3d::Zero();
-Vector3d haptic_position_global = Vector3d::Zero();
-Vector3d haptic_velocity_global = Vector3d::Zero();
-Vector3d sensed_force_global = Vector3d::Zero();
-Matrix3d sigma_force_global = Matrix3d::Zero();
 Matrix3d sigma_motion_global = Matrix3d::Identity();
 
+// particle filter inputs as computed (and logged) by the control thread
 Vector3d motion_control_pfilter;
 Vector3d force_control_pfilter;
 Vector3d measured_velocity_pfilter;
 Vector3d measured_force_pfilter;
 
+// state handed between the threads through triple buffers, so that each thread reads whole
+// values (never a sigma matrix that is half old and half new) without locks in the control loop
+struct TeleopState
+{
+	TeleopState()
+	: robot_position(Vector3d::Zero()), haptic_position(Vector3d::Zero()),
+	  haptic_velocity(Vector3d::Zero()), sigma_force(Matrix3d::Zero()),
+	  forward_wave(Vector3d::Zero()), backward_wave(Vector3d::Zero()), delay(0) {}
+
+	Vector3d robot_position;
+	Vector3d haptic_position;
+	Vector3d haptic_velocity;
+	Matrix3d sigma_force;
+	// wave variables, haptic -> robot and robot -> haptic
+	Vector3d forward_wave;
+	Vector3d backward_wave;
+	// seconds in the emulated network, set when the message is delivered
+	double delay;
+};
+
+// what goes through the emulated network, in both directions
+struct TeleopMessage
+{
+	TeleopMessage()
+	: sensed_force(Vector3d::Zero()), send_time(0) {}
+
+	TeleopState teleop_state;
+	Vector3d sensed_force;
+	double send_time;
+};
+
+// what the haptic thread gives the control thread, not delayed : the device side of the
+// homing, and the rendered force for the logs
+struct HapticDeviceState
+{
+	HapticDeviceState()
+	: haptic_position(Vector3d::Zero()), commanded_force(Vector3d::Zero()),
+	  device_homed(false), gripper_state(false) {}
+
+	Vector3d haptic_position;
+	Vector3d commanded_force;
+	bool device_homed;
+	bool gripper_state;
+};
+
+struct ParticleFilterInputs
+{
+	ParticleFilterInputs()
+	: motion_control(Vector3d::Zero()), force_control(Vector3d::Zero()), measured_velocity(Vector3d::Zero()),
+	  measured_force(Vector3d::Zero()), robot_position(Vector3d::Zero()) {}
+
+	Vector3d motion_control;
+	Vector3d force_control;
+	Vector3d measured_velocity;
+	Vector3d measured_force;
+	Vector3d robot_position;
+};
+
+struct ForceSpaceEstimate
+{
+	ForceSpaceEstimate()
+	: force_space_dimension(0), force_axis(Vector3d::Zero()), motion_axis(Vector3d::Zero()),
+	  eigenvalues(Vector3d::Zero()), eigenvectors(Matrix3d::Identity()) {}
+
+	int force_space_dimension;
+	Vector3d force_axis;
+	Vector3d motion_axis;
+	Vector3d eigenvalues;
+	Matrix3d eigenvectors;
+};
+
+// control (robot side) and haptic (haptic side) -> communication, which packs both in one
+// message, and communication -> control and haptic once delayed
+PandaUtils::TripleBuffer<TeleopState> local_robot_state;
+PandaUtils::TripleBuffer<TeleopState> local_haptic_state;
+PandaUtils::TripleBuffer<TeleopState> delayed_teleop_state;
+PandaUtils::TripleBuffer<TeleopState> delayed_teleop_state_haptic;
+// haptic -> control, and the state of the controller (INIT or CONTROL) control -> haptic
+PandaUtils::TripleBuffer<HapticDeviceState> haptic_device_state;
+std::atomic<int> controller_state(INIT);
+// compensation of the communication delay, switched with the C key (none, prediction or wave variables)
+std::atomic<int> delay_compensation_mode(PandaUtils::NO_DELAY_COMPENSATION);
+// control -> particle filter -> control
+PandaUtils::TripleBuffer<ParticleFilterInputs> pfilter_inputs;
+PandaUtils::TripleBuffer<ForceSpaceEstimate> force_space_estimate;
+// simulation -> communication, the sensed force sent to the haptic side
+PandaUtils::TripleBuffer<Vector3d> sensed_force_global(Vector3d::Zero());
+// control -> simulation, the robot position for the contact logs
+PandaUtils::TripleBuffer<Vector3d> robot_position_global(Vector3d::Zero());
+
 // callback to print glfw errors
 void glfwError(int error, const char* description);
 
@@ -187,6 +288,27 @@ const double std_scatter = 0.005;
 
 const double coeff_friction = 0.0;
 
+// loop rates. the haptic loop renders the device force faster than the robot control. the
+// particle filter can run up to the control rate, with its particles split between the filter
+// thread and pfilter_n_threads-1 workers pinned to pfilter_worker_cpus
+const double control_loop_freq = 1000.0;
+const double haptic_loop_freq = 4000.0;
+
+// delay compensation : impedance of the wave variables in N.s/m, and time constant of the
+// robot following the haptic position for the predictor (kv / kp of the position task)
+const double wave_impedance = 20.0;
+const double robot_tracking_time_constant = 0.15;
+const double pfilter_freq = 100.0;
+const int pfilter_n_threads = 2;
+const vector<int> pfilter_worker_cpus = {3};
+
+// cpus of the threads, the filter workers keep theirs
+const vector<int> control_cpus = {1};
+const vector<int> haptic_cpus = {2};
+const vector<int> pfilter_cpus = {4};
+const vector<int> simulation_cpus = {5};
+const vector<int> communication_cpus = {0};
+
 int force_space_dimension = 0;
 int previous_force_space_dimension = 0;
 Vector3d force_axis = Vector3d::Zero();
@@ -219,6 +341,7 @@ Vector3d log_contact_1 = Vector3d::Zero();
 Vector3d log_contact_2 = Vector3d::Zero();
 
 VectorXd log_commfreq_delay_forcespacedim = VectorXd::Zero(4);
+Vector2d log_delay_compensation = Vector2d::Zero();
 
 
 // Get current date/time, format is YYYY-MM-DD.HH:mm:ss
@@ -235,394 +358,12 @@ const std::string currentDateTime() {
 }
 
 
-double sampleNormalDistribution(const double mean, const double std)
-{
-	// random device class instance, source of 'true' randomness for initializing random seed
-    random_device rd; 
-    // Mersenne twister PRNG, initialized with seed from random device instance
-    mt19937 gen(rd()); 
-    // instance of class normal_distribution with specific mean and stddev
-    normal_distribution<float> d(mean, std); 
-    // get random number with normal distribution using gen as random source
-    return d(gen); 
-}
-
-double sampleUniformDistribution(const double min, const double max)
-{
-	double min_internal = min;
-	double max_internal = max;
-	if(min > max)
-	{
-		min_internal = max;
-		max_internal = min;
-	}
-	// random device class instance, source of 'true' randomness for initializing random seed
-    random_device rd; 
-    // Mersenne twister PRNG, initialized with seed from random device instance
-    mt19937 gen(rd()); 
-    // instance of class uniform_distribution with specific min and max
-    uniform_real_distribution<float> d(min_internal, max_internal); 
-    // get random number with normal distribution using gen as random source
-    return d(gen); 
-}
-
-vector<pair<Vector3d, double>> particleFilterMotionUpdate(const vector<Vector3d> particles, 
-														const Vector3d motion_control, 
-														const Vector3d force_control, 
-														const Vector3d measured_velocity, 
-														const Vector3d measured_force,
-														const int contact_space_dimension)
-{
-	int n = particles.size();
-	Vector3d motion_control_normalized = Vector3d::Zero();
-	Vector3d force_control_normalized = Vector3d::Zero();
-	Vector3d measured_velocity_normalized = Vector3d::Zero();
-	Vector3d measured_force_normalized = Vector3d::Zero();
-
-	// cout << "particles size : " << particles.size() << endl;
-
-	// cout << "force control :\n" << force_control.transpose() << endl;
-	// cout << "motion control :\n" << motion_control.transpose() << endl;
-	// cout << endl;
-
-
-	if(motion_control.norm() > 0.5)
-	{
-		motion_control_normalized = motion_control/motion_control.norm();
-	}
-	if(force_control.norm() > 0.5)
-	{
-		force_control_normalized = force_control/force_control.norm();
-	}
-	if(measured_velocity.norm() > 1e-3)
-	{
-		measured_velocity_normalized = measured_velocity/measured_velocity.norm();
-	}
-	// Matrix3d P_orth_vel = Matrix3d::Identity() - measured_velocity_normalized*measured_velocity_normalized.transpose();
-	// Vector3d projected_measured_force = P_orth_vel * measured_force;
-	Vector3d projected_measured_force = measured_force;
-	if(projected_measured_force.norm() > 0.5)
-	{
-		measured_force_normalized = projected_measured_force/projected_measured_force.norm();
-	}
-	vector<Vector3d> augmented_particles = particles;
-
-	int n_added_particles_center = 1;
-	for(int i=0 ; i<n_added_particles_center ; i++)
-	{
-		augmented_particles.push_back(Vector3d::Zero());
-	}
-
-	double prob_add_particle = (1 - abs(tanh(5.0*measured_velocity.dot(motion_control_normalized)))) * (tanh(motion_control_normalized.dot(projected_measured_force)));
-	// prob_add_particle *= tanh(motion_control.norm() - coeff_friction * force_control.norm());
-	Matrix3d proj_motion_control_space = motion_control_normalized*motion_control_normalized.transpose();
-	prob_add_particle *= tanh((proj_motion_control_space*measured_force).norm() - force_space_dimension * 1.5 * coeff_friction * (measured_force - proj_motion_control_space*measured_force).norm());
-
-
-	// cout << "prob add particle : " << prob_add_particle << endl;
-	// cout << "sensed vel : " << measured_velocity.transpose() << endl;
-	// cout << "mot control : " << motion_control.transpose() << endl;
-	// cout << "vel dot mot command : " << motion_control_normalized.dot(measured_velocity_normalized) << endl;
-
-
-	// if((proj_motion_control_space*measured_force).norm() < coeff_friction * (measured_force - proj_motion_control_space*measured_force).norm())
-	// {
-	// 	prob_add_particle = 0;
-	// }
-	if(prob_add_particle < 0)
-	{
-		prob_add_particle = 0;
-	}
-	int n_added_particles = 1.5 * prob_add_particle * n;
-	// int n_added_particles = n/2;
-	// for(int i=0 ; i<n_added_particles ; i++)
-	// {
-	// 	Vector3d new_particle = motion_control_normalized;
-	// 	for(int j=0 ; j<3 ; j++)
-	// 	{
-	// 		new_particle(j) += sampleNormalDistribution(0, 0.1);
-	// 	}
-	// 	new_particle.normalize();
-	// 	augmented_particles.push_back(new_particle);
-	// }
-
-	for(int i=0 ; i<n_added_particles ; i++)
-	{
-		double alpha = (double) (i + 0.5) / (double)n_added_particles;
-		Vector3d new_particle = (1 - alpha) * motion_control_normalized + alpha * force_control_normalized;
-		// for(int j=0 ; j<3 ; j++)
-		// {
-		// 	new_particle(j) += sampleNormalDistribution(0, 0.1);
-		// }
-		new_particle.normalize();
-		augmented_particles.push_back(new_particle);
-	}
-
-
-	augmented_particles.push_back(force_control_normalized);
-
-	int n_new_particles = n_added_particles_center + n_added_particles;
-	// augmented_particles.push_back(force_control_normalized);
-
-	// cout << "motion control : " << motion_control.transpose() << endl;
-	// cout << "force control : " << force_control.transpose() << endl;
-	// cout << endl;
-
-	vector<pair<Vector3d, double>> weighted_particles;
-	double cumulative_weight = 0;
-
-	// cout << "n new particles : " << augmented_particles.size() << endl;
-
-	for(int i=0 ; i<n + n_new_particles ; i++)
-	{
-		// control update : compute new particle location
-		Vector3d current_particle = augmented_particles[i];
-		double uniform_rand = sampleUniformDistribution(0, 1);
-
-		if(current_particle.norm() > 1e-3) // contact
-		{
-			// if(uniform_rand < - percent_chance_contact_disapears * current_particle.dot(force_control_normalized) ||
-			// 	uniform_rand < - percent_chance_contact_disapears * current_particle.dot(motion_control_normalized))
-			// {
-			// 	current_particle.setZero();
-			// }
-			// else
-			// {
-				double normal_rand_1 = sampleNormalDistribution(mean_scatter, std_scatter);
-				double normal_rand_2 = sampleNormalDistribution(mean_scatter, std_scatter);
-				double normal_rand_3 = sampleNormalDistribution(mean_scatter, std_scatter);
-				current_particle += Vector3d(normal_rand_1, normal_rand_2, normal_rand_3);
-
-				// double normal_rand_vel = sampleNormalDistribution(mean_scatter, 5*std_scatter);
-				// current_particle += normal_rand_vel * measured_velocity_normalized;
-
-				current_particle.normalize();
-
-			// }
-
-				// // project on space orthogonal to velocity
-				// Matrix3d P_orth_vel = Matrix3d::Identity() - measured_velocity_normalized*measured_velocity_normalized.transpose();
-				// Vector3d projected_particle = P_orth_vel * current_particle;
-				// current_particle = projected_particle.normalized();
-		}
-
-
-		// measurement update : compute weight due to force measurement
-		double weight_force = 0;
-		if(current_particle.norm() < 1e-3)
-		{
-			weight_force = 1-tanh(projected_measured_force.norm()/2);
-		}
-		else
-		{
-			// weight_force = tanh(current_particle.dot(projected_measured_force));
-			// weight_force = 1.0 * tanh(current_particle.dot(projected_measured_force));
-			weight_force = 1.3 * tanh(current_particle.dot(projected_measured_force));
-			// weight_force = 1.5 * current_particle.dot(measured_force_normalized);
-
-			// Matrix3d proj_particle_space = current_particle*current_particle.transpose();
-			// weight_force *= tanh((proj_particle_space*measured_force).norm() - coeff_friction * (measured_force - proj_particle_space*measured_force).norm());
-		}
-		if(weight_force < 0)
-		{
-			weight_force = 0;
-		}
-		if(weight_force > 1)
-		{
-			weight_force = 1;
-		}
-
-		// measurement update : compute weight due to velocity measurement
-		// double weight_velocity = 1;
-		// double weight_velocity = 1 - abs(measured_velocity_normalized.dot(current_particle));
-		double weight_velocity = 1 - abs(tanh(5.0*measured_velocity.dot(current_particle)));
-
-		// final weight
-		double weight = weight_force * weight_velocity;
-		cumulative_weight += weight;
-
-		// if(force_space_dimension == 1)
-		// {
-		// 	cout << "particle number : " << i << endl;
-		// 	cout << "current particle :\n" << current_particle.transpose() << endl;
-		// 	cout << "measured force : " << projected_measured_force.transpose() << endl;
-		// 	cout << "measured force normalized : " << measured_force_normalized.transpose() << endl;
-		// 	cout << "measured velocity : " << measured_velocity.transpose() << endl;
-		// 	cout << "measured velocity normalized : " << measured_velocity_normalized.transpose() << endl;
-		// 	cout << "weight force : " << weight_force << endl;
-		// 	cout << "weight velocity : " << weight_velocity << endl;
-		// 	cout << endl;
-		// }
-		// else
-		// {
-		// 	cout << "****" << endl;
-		// }
-
-		// if(current_particle.norm() > 1e-3 && weight > 0)
-		// {
-		// 	cout << "particle : " << current_particle.transpose() << endl;
-		// 	cout << "measured force : " << projected_measured_force.transpose() << endl;
-		// 	cout << "measured force normalized : " << measured_force_normalized.transpose() << endl;
-		// 	cout << "measured velocity : " << measured_velocity.transpose() << endl;
-		// 	cout << "measured velocity normalized : " << measured_velocity_normalized.transpose() << endl;
-		// 	cout << "weight force : " << weight_force << endl;
-		// 	cout << "weight velocity : " << weight_velocity << endl;
-		// 	cout << endl;
-		// }
-
-		// if(current_particle.dot(Vector3d::UnitZ()) < -0.95)
-		// {
-		// 	cout << "particle index : " << i << endl;
-		// 	cout << "particle : " << current_particle.transpose() << endl;
-		// 	cout << "measured force : " << projected_measured_force.transpose() << endl;
-		// 	cout << "measured velocity : " << measured_velocity.transpose() << endl;
-		// 	cout << "weight force : " << weight_force << endl;
-		// 	cout << "weight velocity : " << weight_velocity << endl;
-		// 	cout << endl;
-		// }
-
-		weighted_particles.push_back(make_pair(current_particle, cumulative_weight));
-	}
-
-	// if(previous_force_space_dimension == 1 && force_space_dimension == 0)
-	// {
-		// cout << endl << endl << endl;
-	// }
-
-
-	for(int i=0 ; i<n + n_new_particles ; i++)
-	{
-		weighted_particles[i].second /= cumulative_weight;
-	}
-
-	return weighted_particles;
-
-}
-
-
-vector<Vector3d> particleFilterResampling(const vector<pair<Vector3d, double>> weighted_particles, const int n_particles_to_resample)
-{
-	vector<Vector3d> new_particles;
-	int n_weighted_particles = weighted_particles.size();
-
-	// cout << "Resampling ******--------" << endl;
-	// cout << "n weighted particles : " << n_weighted_particles << endl;
-	// cout << "n particles to resample : " << n_particles_to_resample << endl;
-	// cout << "total weights : " << weighted_particles[n_weighted_particles-1].second << endl;
-
-	for(int i=0 ; i<n_particles_to_resample ; i++)
-	{
-
-		int k = 0;
-		double rand = sampleUniformDistribution(0,1);
-		while(weighted_particles[k].second < rand && k < n_weighted_particles)
-		{
-			k++;
-		}
-
-		// cout << "---" << endl;
-		// cout << "rand : " << rand << endl;
-		// cout << "particle selected : " << k << endl;
-		// cout << "particle position : " << weighted_particles[k].first.transpose() << endl;
-
-		new_particles.push_back(weighted_particles[k].first);
-	}
-
-	// cout << endl;
-
-	return new_particles;
-}
-
-vector<pair<Vector3d,double>> particleFilterResamplingLowVariance(const vector<pair<Vector3d, double>> weighted_particles, const int n_particles_to_resample)
-{
-	vector<pair<Vector3d,double>> new_particles_with_weights;
-	int n_weighted_particles = weighted_particles.size();
-
-	double n_inv = 1.0/(double)n_particles_to_resample;
-	double r = sampleUniformDistribution(0,n_inv);
-	int k = 0;
-
-
-	// cout << "Resampling ******--------" << endl;
-	// cout << "n weighted particles : " << n_weighted_particles << endl;
-	// cout << "n particles to resample : " << n_particles_to_resample << endl;
-	// cout << "total weights : " << weighted_particles[n_weighted_particles-1].second << endl;
-
-	for(int i=0 ; i<n_particles_to_resample ; i++)
-	{
-		// cout << weighted_particles.size() << endl;
-		while(r > weighted_particles[k].second)
-		{
-			k++;
-		}
-		double cum_weight_prev = 0;
-		if(k > 0)
-		{
-			cum_weight_prev = weighted_particles[k-1].second;
-		}
-		new_particles_with_weights.push_back(make_pair(weighted_particles[k].first, weighted_particles[k].second - cum_weight_prev));
-		r += n_inv;
-	}
-
-	// cout << "Resampling ******--------" << endl;
-	// cout << "n particles : " << new_particles_with_weights.size() << endl;
-	// cout << endl;
-
-	return new_particles_with_weights;
-}
-
-vector<Vector3d> particleFilterResamplingAfterPCA(const vector<pair<Vector3d, double>> new_particles_with_weights, const int n_particles_to_resample, const Matrix3d eigen_vectors)
-{
-	vector<Vector3d> new_particles;
-
-	VectorXd cluster_average_weight = VectorXd::Zero(4);
-	VectorXd num_particle_in_cluster = VectorXd::Zero(4);
-
-	for(int i=0 ; i<new_particles_with_weights.size() ; i++)
-	{
-		Vector3d current_particle = new_particles_with_weights[i].first;
-		double dist = current_particle.norm();
-		int current_cluster = 0;
-		for(int k=0 ; k < 3 ; k++)
-		{
-			if( (current_particle - eigen_vectors.col(k)).norm() < dist )
-			{
-				current_cluster = k+1;
-				dist = (current_particle - eigen_vectors.col(k)).norm();
-			}
-		}
-		cluster_average_weight(current_cluster) += new_particles_with_weights[i].second;
-		num_particle_in_cluster(current_cluster) += 1;
-	}
-
-	for(int k=0 ; k<4 ; k++)
-	{
-		if(num_particle_in_cluster(k) > 0)
-		{
-			cluster_average_weight(k) /= num_particle_in_cluster(k);
-		}
-	}
-
-
-	// cout << "cluster number part :\n" << num_particle_in_cluster.transpose() << endl;
-	// cout << "cluster average weight before norm :\n" << cluster_average_weight.transpose() << endl;
-
-	cluster_average_weight /= cluster_average_weight.sum();
-
-	// cout << "cluster average weight after norm :\n" << cluster_average_weight.transpose() << endl;
-	// cout << endl;
-
-	for(int i=0 ; i<n_particles ; i++)
-	{
-		new_particles.push_back(new_particles_with_weights[i].first);
-	}
-
-	return new_particles;
-}
-
-int main() {
+int main(int argc, char** argv) {
 	cout << "Loading URDF world model file: " << world_file << endl;
 
+	tracer = new PandaUtils::TraceRecorder(PandaUtils::TraceRecorder::tracePath(argc, argv));
+	udp_config = PandaUtils::UdpTeleopConfig::fromArgs(argc, argv);
+
 
 
 	// for(int i = 0 ; i<50 ; i++)
@@ -633,10 +374,6 @@ int main() {
 	// exit(0);
 
 
-	// start redis client
-	redis_client = RedisClient();
-	redis_client.connect();
-
 	// load graphics scene
 	auto graphics = new Sai2Graphics::Sai2Graphics(world_file, true);
 	Vector3d camera_pos, camera_lookat, camera_vertical;
@@ -730,12 +467,16 @@ int main() {
 	fSimulationRunning = true;
 	thread sim_thread(simulation, robot, sim, force_sensor);
 	thread control_thread(control, robot, sim);
+	thread haptic_thread(haptic, Vector3d(robot->_q));
 	thread particle_filter_thread(particle_filter);
 	thread communication_thread(communication);
 
+	PandaUtils::TraceBuffer* trace = tracer->registerThread("render");
+
 	// while window is open:
 	while (!glfwWindowShouldClose(window) && fSimulationRunning)
 	{
+		PandaUtils::TraceScope iteration(trace, "render");
 		for(int i=0 ; i<n_particles ; i++)
 		{
 			Vector3d particle_pos_circle = particles[i];
@@ -770,10 +511,12 @@ int main() {
 		graphics->render(camera_name, width, height);
 
 		// swap buffers
+		PandaUtils::traceBegin(trace, "swap buffers");
 		glfwSwapBuffers(window);
 
 		// wait until all GL commands are completed
 		glFinish();
+		PandaUtils::traceEnd(trace);
 
 		// check for any OpenGL errors
 		GLenum err;
@@ -849,8 +592,10 @@ int main() {
 	fSimulationRunning = false;
 	sim_thread.join();
 	control_thread.join();
+	haptic_thread.join();
 	particle_filter_thread.join();
 	communication_thread.join();
+	tracer->dump();
 
 	// destroy context
 	glfwDestroyWindow(window);
@@ -870,7 +615,6 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 
 	// joint task
 	auto joint_task = new Sai2Primitives::JointTask(robot);
-	Vector3d x_init = joint_task->_current_position;
 	VectorXd joint_task_torques = VectorXd::Zero(dof);
 	joint_task->_use_interpolation_flag = false;
 	joint_task->_use_velocity_saturation_flag = false;
@@ -885,98 +629,32 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 	pos_task->_kv = 20.0;
 
 	double k_vir_robot = 300.0;
-	const double k_vir_haptic_goal = 300.0;
-	double k_vir_haptic = k_vir_haptic_goal;
-	// Matrix3d k_vir_haptic = k_vir_haptic_goal * Matrix3d::Ones();
 	Vector3d robot_pos_error = Vector3d::Zero();
-	Vector3d haptic_pos_error = Vector3d::Zero();
-
-	double haptic_PO = 0;
 
 	const double max_force_diff_robot = 0.05;
-	const double max_force_diff_haptic = 0.05;
 	Vector3d prev_force_command_robot = Vector3d::Zero();
-	Vector3d prev_force_command_haptic = Vector3d::Zero();
 
-	auto filter_force_command_robot = new ButterworthFilter(3,0.05);
-	auto filter_force_command_haptic = new ButterworthFilter(3,0.05);
+	auto filter_force_command_robot = new PandaUtils::ButterworthFilterBank<3>(3,0.05);
+
+	// robot side of the wave variables, for the force space when they are selected
+	PandaUtils::WaveVariableSlave wave_slave(wave_impedance);
 
 	double kp_force = 0.0;
 	double ki_force = 0.0;
 	Vector3d integrated_force_error = Vector3d::Zero();
 
-	// haptic task
-	////Haptic teleoperation controller ////
-	auto teleop_task = new Sai2Primitives::HapticController(x_init, Matrix3d::Zero());
-	teleop_task->_send_haptic_feedback = false;
-
-	//User switch states
-	teleop_task->UseGripperAsSwitch();
-	bool gripper_state = false;
-	bool gripper_state_prev = false;
-
-	 //Task scaling factors
-	double Ks = 2.5;
-	double KsR = 1.0;
-	teleop_task->setScalingFactors(Ks, KsR);
-
-	double kv_haptic = 25.0;
-
 	int contact_transition_counter = 50;
 
-	// // Center of the haptic device workspace
-	// Vector3d HomePos_op;
-	// HomePos_op << 0.0, 0.0, 0.0;
-	// Matrix3d HomeRot_op;
-	// HomeRot_op.setIdentity();
-	// teleop_task->setDeviceCenter(HomePos_op, HomeRot_op);
-
-	// double force_guidance_position_impedance = 1000.0;
-	// double force_guidance_orientation_impedance = 50.0;
-	// double force_guidance_position_damping = 5.0;
-	// double force_guidance_orientation_damping = 0.1;
-	// teleop_task->setVirtualGuidanceGains (force_guidance_position_impedance, force_guidance_position_damping,
-	// 								force_guidance_orientation_impedance, force_guidance_orientation_damping);
-
-	VectorXd _max_stiffness_device0 = redis_client.getEigenMatrixJSON(DEVICE_MAX_STIFFNESS_KEYS[0]);
-	VectorXd _max_damping_device0 = redis_client.getEigenMatrixJSON(DEVICE_MAX_DAMPING_KEYS[0]);
-	VectorXd _max_force_device0 = redis_client.getEigenMatrixJSON(DEVICE_MAX_FORCE_KEYS[0]);
-
-	//set the device specifications to the haptic controller
-	teleop_task->_max_linear_stiffness_device = _max_stiffness_device0[0];
-	teleop_task->_max_angular_stiffness_device = _max_stiffness_device0[1];
-	teleop_task->_max_linear_damping_device = _max_damping_device0[0];
-	teleop_task->_max_angular_damping_device = _max_damping_device0[1];
-	teleop_task->_max_force_device = _max_force_device0[0];
-	teleop_task->_max_torque_device = _max_force_device0[1];
-
-	// setup redis keys to be updated with the callback
-	redis_client.createReadCallback(0);
-	redis_client.createWriteCallback(0);
-
-	// Objects to read from redis
-    redis_client.addEigenToReadCallback(0, DEVICE_POSITION_KEYS[0], teleop_task->_current_position_device);
-    redis_client.addEigenToReadCallback(0, DEVICE_ROTATION_KEYS[0], teleop_task->_current_rotation_device);
-    redis_client.addEigenToReadCallback(0, DEVICE_TRANS_VELOCITY_KEYS[0], teleop_task->_current_trans_velocity_device);
-    redis_client.addEigenToReadCallback(0, DEVICE_ROT_VELOCITY_KEYS[0], teleop_task->_current_rot_velocity_device);
-    redis_client.addEigenToReadCallback(0, DEVICE_SENSED_FORCE_KEYS[0], teleop_task->_sensed_force_device);
-    redis_client.addEigenToReadCallback(0, DEVICE_SENSED_TORQUE_KEYS[0], teleop_task->_sensed_torque_device);
-    redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_POSITION_KEYS[0], teleop_task->_current_position_gripper_device);
-    redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_VELOCITY_KEYS[0], teleop_task->_current_gripper_velocity_device);
-
-	// Objects to write to redis
-	//write haptic commands
-	redis_client.addEigenToWriteCallback(0, DEVICE_COMMANDED_FORCE_KEYS[0], teleop_task->_commanded_force_device);
-	redis_client.addEigenToWriteCallback(0, DEVICE_COMMANDED_TORQUE_KEYS[0], teleop_task->_commanded_torque_device);
-	redis_client.addDoubleToWriteCallback(0, DEVICE_COMMANDED_GRIPPER_FORCE_KEYS[0], teleop_task->_commanded_gripper_force_device);
-
 	// logger
 	string folder = "../../13-LocallySeparatedHapticControl/data_logging/data/";
 	string timestamp = currentDateTime();
 	string prefix = "data";
-	string suffix = ".csv";
+	string suffix = ".bin";
 	string filename = folder + prefix + "_" + timestamp + suffix;
 	auto logger = new Logging::Logger(1000, filename);
+	logger->enableCompression();
+	logger->enableTimeIndex();
+	logger->enableMappedFile();
 	
 	logger->addVectorToLog(&log_robot_position, "robot_position");
 	logger->addVectorToLog(&log_haptic_position, "haptic_position");
@@ -995,11 +673,22 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 	logger->addVectorToLog(&log_contact_2, "contact_2");
 
 	logger->addVectorToLog(&log_commfreq_delay_forcespacedim, "comm_freq-delay_ms-force_space_dimension");
+	logger->addVectorToLog(&log_delay_compensation, "delay_compensation_mode-measured_delay_ms");
 
+	// particle filter inputs, replayed by bench_pf18
+	logger->addVectorToLog(&motion_control_pfilter, "motion_control_pfilter");
+	logger->addVectorToLog(&force_control_pfilter, "force_control_pfilter");
+	logger->addVectorToLog(&measured_velocity_pfilter, "measured_velocity_pfilter");
+	logger->addVectorToLog(&measured_force_pfilter, "measured_force_pfilter");
+
+	// forces at 50Hz on udp port 9870 for live plots
+	logger->enableLiveStream("127.0.0.1", 9870, 20, {"robot_force", "sensed_force", "haptic_force"});
+
+	// samples are taken by the control loop, after the log variables are updated
+	logger->enableCapture();
 	logger->start();
 
 	// create a timer
-	double control_loop_freq = 1000.0;
 	unsigned long long controller_counter = 0;
 	LoopTimer timer;
 	timer.initializeTimer();
@@ -1010,46 +699,62 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 	bool fTimerDidSleep = true;
 	double start_time = timer.elapsedTime(); //secs
 
+	// latest values of the other threads, and the state published to them
+	ForceSpaceEstimate estimate;
+	TeleopState delayed;
+	TeleopState teleop_state;
+	HapticDeviceState device;
+	ParticleFilterInputs pfilter_input;
+	Vector3d robot_position = Vector3d::Zero();
+
+	PandaUtils::configureRealtimeThread("control", PandaUtils::RealtimeConfig::fifo(80, control_cpus));
+	PandaUtils::TraceBuffer* trace = tracer->registerThread("control");
+
 	while (fSimulationRunning)
 	{
 		// wait for next scheduled loop
-		timer.waitForNextLoop();
+		{
+			PandaUtils::TraceScope wait(trace, "wait");
+			timer.waitForNextLoop();
+		}
+		PandaUtils::TraceScope iteration(trace, "control");
 		current_time = timer.elapsedTime() - start_time;
 
-		// read haptic state and robot state
-		redis_client.executeReadCallback(0);
+		// read the force space estimate, the delayed teleoperation state and the haptic device state
+		force_space_estimate.read(estimate);
+		delayed_teleop_state.read(delayed);
+		haptic_device_state.read(device);
+
+		// read robot state
+		PandaUtils::traceBegin(trace, "updateModel");
 		sim->getJointPositions(robot_name, robot->_q);
 		sim->getJointVelocities(robot_name, robot->_dq);
 		robot->updateModel();
+		PandaUtils::traceEnd(trace);
 
+		PandaUtils::traceBegin(trace, "tasks");
 		N_prec.setIdentity(dof,dof);
 		pos_task->updateTaskModel(N_prec);
 
-		teleop_task->UseGripperAsSwitch();
-		gripper_state_prev = gripper_state;
-		gripper_state = teleop_task->gripper_state;
-
-
 		if(state == INIT)
 		{
 
 			pos_task->computeTorques(pos_task_torques);
 			command_torques = pos_task_torques;
 
-  			// compute homing haptic device
-  			teleop_task->HomingTask();
-
+			// the haptic thread homes the device
 			// if((pos_task->_desired_position - pos_task->_current_position).norm() < 0.2)
-			if(teleop_task->device_homed && gripper_state && (pos_task->_desired_position - pos_task->_current_position).norm() < 0.2)
+			if(device.device_homed && device.gripper_state && (pos_task->_desired_position - pos_task->_current_position).norm() < 0.2)
 			{
-				// Reinitialize controllers
+				// Reinitialize controllers, the haptic thread reinitializes its own
 				pos_task->reInitializeTask();
-				teleop_task->reInitializeTask();
 
 				pos_task->_kp = 200.0;
 				pos_task->_kv = 30.0;
+				wave_slave.reset(pos_task->_current_position);
 
 				state = CONTROL;
+				controller_state = CONTROL;
 			}
 		}
 
@@ -1088,15 +793,15 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 
 
 
-			if(force_space_dimension == 1)
+			if(estimate.force_space_dimension == 1)
 			{
-				pos_task->setForceAxis(force_axis);
+				pos_task->setForceAxis(estimate.force_axis);
 			}
-			else if(force_space_dimension == 2)
+			else if(estimate.force_space_dimension == 2)
 			{
-				pos_task->setMotionAxis(motion_axis);
+				pos_task->setMotionAxis(estimate.motion_axis);
 			}
-			else if(force_space_dimension == 3)
+			else if(estimate.force_space_dimension == 3)
 			{
 				pos_task->setFullForceControl();
 			}
@@ -1104,19 +809,26 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 			{
 				pos_task->setFullMotionControl();
 			}
-			sigma_force_global = pos_task->_sigma_force;
-
-
-			Vector3d desired_position = Vector3d::Zero();
-			teleop_task->computeHapticCommands3d(desired_position);
-			haptic_position_global = desired_position;
-
-			haptic_velocity_global = teleop_task->_current_trans_velocity_device_RobFrame;
-			// Vector3d desired_velocity = teleop_task->_current_trans_velocity_device_RobFrame;
-			// desired_position = teleop_task->_current_position_device;
-
-			pos_task->_desired_position = delayed_haptic_position;
-			pos_task->_desired_velocity = delayed_haptic_velocity;
+			teleop_state.sigma_force = pos_task->_sigma_force;
+
+			// with the wave variables, the force space follows the wave channel and the motion
+			// space the delayed haptic position. otherwise the wave side follows the haptic
+			// position, so that it starts from there when the waves are selected
+			Vector3d force_on_environment = -pos_task->_sigma_force * sensed_force_moment.head(3);
+			wave_slave.update(delayed.forward_wave, force_on_environment, 1.0/control_loop_freq);
+			if(delay_compensation_mode == PandaUtils::WAVE_VARIABLES)
+			{
+				wave_slave.setDesiredPosition(pos_task->_sigma_motion * delayed.haptic_position + pos_task->_sigma_force * wave_slave.desiredPosition());
+				pos_task->_desired_position = wave_slave.desiredPosition();
+				pos_task->_desired_velocity = pos_task->_sigma_motion * delayed.haptic_velocity + pos_task->_sigma_force * wave_slave.desiredVelocity();
+			}
+			else
+			{
+				wave_slave.setDesiredPosition(delayed.haptic_position);
+				pos_task->_desired_position = delayed.haptic_position;
+				pos_task->_desired_velocity = delayed.haptic_velocity;
+			}
+			teleop_state.backward_wave = wave_slave.backwardWave();
 
 			robot_pos_error = pos_task->_current_position - pos_task->_desired_position;
 
@@ -1142,26 +854,277 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 
 			pos_task->computeTorques(pos_task_torques);
 			command_torques = pos_task_torques;
-			robot_position_global = pos_task->_current_position;
+			robot_position = pos_task->_current_position;
+			robot_position_global.write(robot_position);
+			teleop_state.robot_position = pos_task->_current_position;
+
+
+			// previous_force_space_dimension = force_space_dimension;
+			// adding_contact = false;
+			// removing_contact = false;
+			// 
+			prev_force_command_robot = force_command_robot;
+
+		}
+
+		PandaUtils::traceEnd(trace);
+
+		// particle filter
+		PandaUtils::traceBegin(trace, "publish");
+		motion_control_pfilter = pos_task->_sigma_motion * pos_task->_motion_control;
+		// motion_control_pfilter += pos_task->_sigma_motion * pos_task->_motion_control / control_loop_freq;
+		// motion_control_pfilter = pos_task->_sigma_motion * motion_control_pfilter;
+		force_control_pfilter = pos_task->_sigma_force * pos_task->_force_control;
+		measured_velocity_pfilter = pos_task->_current_velocity;
+		measured_force_pfilter = sensed_force_moment.head(3);
+
+		pfilter_input.motion_control = motion_control_pfilter;
+		pfilter_input.force_control = force_control_pfilter;
+		pfilter_input.measured_velocity = measured_velocity_pfilter;
+		pfilter_input.measured_force = measured_force_pfilter;
+		pfilter_input.robot_position = robot_position;
+		pfilter_inputs.write(pfilter_input);
+		local_robot_state.write(teleop_state);
+
+		// if( teleop_task->_current_position_device(2) < -0.0315)
+		// {
+		// 	cout << "motion control :\n" << motion_control_pfilter.transpose() << endl;
+		// 	cout << "force control robot :\n" << force_control_pfilter.transpose() << endl;
+		// 	cout << "force control haptic :\n" << teleop_task->_commanded_force_device.transpose() << endl;
+		// 	cout << "position haptic :\n" << teleop_task->_current_position_device.transpose() << endl;
+		// 	cout << "sigma force :\n" << pos_task->_sigma_force << endl;
+		// 	cout << "sigma motion :\n" << pos_task->_sigma_motion << endl;
+		// 	// cout << "lambda motion control :\n" << (pos_task->_Lambda * motion_control_pfilter).transpose() << endl;
+		// 	cout << endl;
+		// }
+
+		sim->setJointTorques(robot_name, command_torques + fsensor_torques);
+		PandaUtils::traceEnd(trace);
+
+		// logger
+		PandaUtils::traceBegin(trace, "logger");
+		log_robot_position = pos_task->_current_position;
+		log_haptic_position = device.haptic_position;
+		log_robot_force = pos_task->_desired_force;
+		log_haptic_force = device.commanded_force;
+		log_sensed_force = -sensed_force_moment.head(3);
+		log_eigenvalues = estimate.eigenvalues;
+		log_eigenvector_0 = estimate.eigenvectors.col(0);
+		log_eigenvector_1 = estimate.eigenvectors.col(1);
+		log_eigenvector_2 = estimate.eigenvectors.col(2);
+		log_commfreq_delay_forcespacedim(2) = estimate.force_space_dimension;
+		log_delay_compensation << delay_compensation_mode, 1000.0 * delayed.delay;
+		log_force_axis = estimate.force_axis;
+		log_motion_axis = estimate.motion_axis;
+		logger->capture();
+		PandaUtils::traceEnd(trace);
+
+		// // cout statements
+		// if(controller_counter % 500 == 0)
+		// {
+		// 	cout << "controller counter : " << controller_counter << endl;
+		// 	cout << "desired force : " << pos_task->_desired_force.transpose() << endl;
+		// 	cout << endl;
+		// }
+
+		controller_counter++;
+
+	}
+
+	logger->stop();
+
+	double end_time = timer.elapsedTime();
+	std::cout << "\n";
+	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
+	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
+    std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+
+
+}
+
+// device side of the teleoperation : reads the haptic device, renders its force and sends the
+// commands, at the haptic rate, on the latest delayed robot side state
+void haptic(const Vector3d robot_center)
+{
+	RedisClient& redis_client = redis_pool.client();
+
+	// haptic commands are sent from a writer thread so the loop does not wait for redis
+	PandaUtils::AsyncRedisWriter haptic_commands_writer;
+	haptic_commands_writer.start();
+
+	// haptic task
+	////Haptic teleoperation controller ////
+	auto teleop_task = new Sai2Primitives::HapticController(robot_center, Matrix3d::Zero());
+	teleop_task->_send_haptic_feedback = false;
+
+	//User switch states
+	teleop_task->UseGripperAsSwitch();
+
+	 //Task scaling factors
+	double Ks = 2.5;
+	double KsR = 1.0;
+	teleop_task->setScalingFactors(Ks, KsR);
+
+	// spring to the delayed robot position in its force space and damping, the force rate
+	// limit of 0.05 N per control cycle is the same per second at the haptic rate
+	const double k_vir_haptic = 300.0;
+	double kv_haptic = 25.0;
+	PandaUtils::HapticForceRenderer force_renderer(haptic_loop_freq, k_vir_haptic, kv_haptic);
+	force_renderer.setMaxForce(10.0);
+	force_renderer.setMaxForceRate(0.05 * control_loop_freq);
+
+	// delay compensation : haptic side of the wave variables, and the predictor of the robot
+	// position for round trips up to 1 s
+	PandaUtils::WaveVariableMaster wave_master(wave_impedance);
+	PandaUtils::RemotePositionPredictor robot_predictor(haptic_loop_freq, robot_tracking_time_constant, 1.0);
+	int compensation = delay_compensation_mode;
+
+	// // Center of the haptic device workspace
+	// Vector3d HomePos_op;
+	// HomePos_op << 0.0, 0.0, 0.0;
+	// Matrix3d HomeRot_op;
+	// HomeRot_op.setIdentity();
+	// teleop_task->setDeviceCenter(HomePos_op, HomeRot_op);
+
+	// double force_guidance_position_impedance = 1000.0;
+	// double force_guidance_orientation_impedance = 50.0;
+	// double force_guidance_position_damping = 5.0;
+	// double force_guidance_orientation_damping = 0.1;
+	// teleop_task->setVirtualGuidanceGains (force_guidance_position_impedance, force_guidance_position_damping,
+	// 								force_guidance_orientation_impedance, force_guidance_orientation_damping);
+
+	VectorXd _max_stiffness_device0 = redis_client.getEigenMatrixJSON(DEVICE_MAX_STIFFNESS_KEYS[0]);
+	VectorXd _max_damping_device0 = redis_client.getEigenMatrixJSON(DEVICE_MAX_DAMPING_KEYS[0]);
+	VectorXd _max_force_device0 = redis_client.getEigenMatrixJSON(DEVICE_MAX_FORCE_KEYS[0]);
+
+	//set the device specifications to the haptic controller
+	teleop_task->_max_linear_stiffness_device = _max_stiffness_device0[0];
+	teleop_task->_max_angular_stiffness_device = _max_stiffness_device0[1];
+	teleop_task->_max_linear_damping_device = _max_damping_device0[0];
+	teleop_task->_max_angular_damping_device = _max_damping_device0[1];
+	teleop_task->_max_force_device = _max_force_device0[0];
+	teleop_task->_max_torque_device = _max_force_device0[1];
+
+	// setup redis keys to be updated with the callback
+	redis_client.createReadCallback(0);
+
+	// Objects to read from the remote haptic station, from the binary records of
+	// haptic_bundle_bridge, or from the device keys
+	PandaUtils::HapticDeviceChannel* device_channel = NULL;
+	if(udp_config.enabled())
+	{
+		device_channel = new PandaUtils::UdpHapticDevice(udp_config.forDevice(0));
+	}
+	else if(PandaUtils::RedisHapticDevice::available(redis_client, 0))
+	{
+		device_channel = new PandaUtils::RedisHapticDevice(redis_client, 0);
+	}
+	else
+	{
+		redis_client.addEigenToReadCallback(0, DEVICE_POSITION_KEYS[0], teleop_task->_current_position_device);
+		redis_client.addEigenToReadCallback(0, DEVICE_ROTATION_KEYS[0], teleop_task->_current_rotation_device);
+		redis_client.addEigenToReadCallback(0, DEVICE_TRANS_VELOCITY_KEYS[0], teleop_task->_current_trans_velocity_device);
+		redis_client.addEigenToReadCallback(0, DEVICE_ROT_VELOCITY_KEYS[0], teleop_task->_current_rot_velocity_device);
+		redis_client.addEigenToReadCallback(0, DEVICE_SENSED_FORCE_KEYS[0], teleop_task->_sensed_force_device);
+		redis_client.addEigenToReadCallback(0, DEVICE_SENSED_TORQUE_KEYS[0], teleop_task->_sensed_torque_device);
+		redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_POSITION_KEYS[0], teleop_task->_current_position_gripper_device);
+		redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_VELOCITY_KEYS[0], teleop_task->_current_gripper_velocity_device);
+	}
+
+
+	// create a timer, that spins the last 100 us before the deadlines of the haptic loop.
+	// the other threads keep sleeping timers
+	PandaUtils::PrecisionLoopTimer timer(100e-6);
+	timer.initializeTimer();
+	timer.setLoopFrequency(haptic_loop_freq); //Compiler en mode release
+	double start_time = timer.elapsedTime(); //secs
+
+	int state = INIT;
+	TeleopState delayed;
+	TeleopState haptic_state;
+	HapticDeviceState device;
+
+	PandaUtils::configureRealtimeThread("haptic", PandaUtils::RealtimeConfig::fifo(85, haptic_cpus));
+	PandaUtils::TraceBuffer* trace = tracer->registerThread("haptic");
+
+	while(fSimulationRunning)
+	{
+		{
+			PandaUtils::TraceScope wait(trace, "wait");
+			timer.waitForNextLoop();
+		}
+		PandaUtils::TraceScope iteration(trace, "haptic");
+
+		// read haptic state and the delayed robot side state
+		PandaUtils::traceBegin(trace, "redis read");
+		if(device_channel != NULL)
+		{
+			device_channel->readDevice(*teleop_task);
+		}
+		else
+		{
+			redis_client.executeReadCallback(0);
+		}
+		PandaUtils::traceEnd(trace);
+		delayed_teleop_state_haptic.read(delayed);
+
+		teleop_task->UseGripperAsSwitch();
+		device.gripper_state = teleop_task->gripper_state;
+
+		if(state == INIT)
+		{
+			// compute homing haptic device
+			teleop_task->HomingTask();
+			device.device_homed = teleop_task->device_homed;
 
-			haptic_pos_error = delayed_robot_position - desired_position;
-			Vector3d force_command_haptic = delayed_sigma_force * k_vir_robot * haptic_pos_error;
-			Vector3d force_diff_haptic = force_command_haptic - prev_force_command_haptic;
-			if( force_diff_haptic.norm() > max_force_diff_haptic )
+			// the control thread switched to the teleoperation
+			if(controller_state == CONTROL)
 			{
-			// 	// cout << "prev force :\n" << prev_force_command_robot.transpose() << endl;
-			// 	// cout << "new force command :\n" << force_command.transpose() << endl;
-			// 	// cout << endl;
-				force_command_haptic = prev_force_command_haptic + max_force_diff_haptic * force_diff_haptic/force_diff_haptic.norm();
+				teleop_task->reInitializeTask();
+				force_renderer.reset();
+				wave_master.reset();
+				robot_predictor.reset(delayed.robot_position);
+				state = CONTROL;
 			}
-			if(force_command_haptic.norm() > 10.0)
+		}
+
+		else if(state == CONTROL)
+		{
+			Vector3d desired_position = Vector3d::Zero();
+			teleop_task->computeHapticCommands3d(desired_position);
+			haptic_state.haptic_position = desired_position;
+
+			haptic_state.haptic_velocity = teleop_task->_current_trans_velocity_device_RobFrame;
+			// Vector3d desired_velocity = teleop_task->_current_trans_velocity_device_RobFrame;
+			// desired_position = teleop_task->_current_position_device;
+
+			// the waves and the prediction run in all modes, so that the switch is smooth. the
+			// emulated link has the same delay both ways, the round trip is twice the one way
+			if(compensation != delay_compensation_mode)
 			{
-				force_command_haptic *= 10.0/force_command_haptic.norm();
+				compensation = delay_compensation_mode;
+				force_renderer.reset();
 			}
+			const Vector3d& wave_force = wave_master.update(delayed.backward_wave, haptic_state.haptic_velocity);
+			haptic_state.forward_wave = wave_master.forwardWave();
+			robot_predictor.update(delayed.robot_position, desired_position, 2.0 * delayed.delay);
 
-			// teleop_task->_commanded_force_device = filter_force_command_haptic->update(force_command_haptic) - delayed_sigma_force * kv_haptic * teleop_task->_current_trans_velocity_device;
-			// teleop_task->_commanded_force_device = filter_force_command_haptic->update(force_command_haptic);
-			teleop_task->_commanded_force_device = force_command_haptic - delayed_sigma_force * kv_haptic * teleop_task->_current_trans_velocity_device;
+			if(compensation == PandaUtils::WAVE_VARIABLES)
+			{
+				// in the force space, saturated as the spring
+				Vector3d force = delayed.sigma_force * wave_force;
+				if(force.norm() > 10.0)
+				{
+					force *= 10.0/force.norm();
+				}
+				teleop_task->_commanded_force_device = force;
+			}
+			else
+			{
+				const Vector3d& robot_position = (compensation == PandaUtils::PREDICTION) ? robot_predictor.prediction() : delayed.robot_position;
+				teleop_task->_commanded_force_device = force_renderer.update(robot_position, desired_position,
+						delayed.sigma_force, teleop_task->_current_trans_velocity_device);
+			}
 			// teleop_task->_commanded_force_device = -sensed_force_moment.head(3)/Ks - 5.0 * teleop_task->_current_trans_velocity_device;
 			// teleop_task->_commanded_force_device = -delayed_sensed_force/Ks;
 
@@ -1270,146 +1233,111 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 			// cout << endl;
 
 			// cout << "k virtual :\n" << k_vir_haptic << endl;
-
-			// previous_force_space_dimension = force_space_dimension;
-			// adding_contact = false;
-			// removing_contact = false;
-			// 
-			prev_force_command_robot = force_command_robot;
-			prev_force_command_haptic = force_command_haptic;
-
 		}
 
-		// particle filter
-		motion_control_pfilter = pos_task->_sigma_motion * pos_task->_motion_control;
-		// motion_control_pfilter += pos_task->_sigma_motion * pos_task->_motion_control / control_loop_freq;
-		// motion_control_pfilter = pos_task->_sigma_motion * motion_control_pfilter;
-		force_control_pfilter = pos_task->_sigma_force * pos_task->_force_control;
-		measured_velocity_pfilter = pos_task->_current_velocity;
-		measured_force_pfilter = sensed_force_moment.head(3);
-
-		// if( teleop_task->_current_position_device(2) < -0.0315)
-		// {
-		// 	cout << "motion control :\n" << motion_control_pfilter.transpose() << endl;
-		// 	cout << "force control robot :\n" << force_control_pfilter.transpose() << endl;
-		// 	cout << "force control haptic :\n" << teleop_task->_commanded_force_device.transpose() << endl;
-		// 	cout << "position haptic :\n" << teleop_task->_current_position_device.transpose() << endl;
-		// 	cout << "sigma force :\n" << pos_task->_sigma_force << endl;
-		// 	cout << "sigma motion :\n" << pos_task->_sigma_motion << endl;
-		// 	// cout << "lambda motion control :\n" << (pos_task->_Lambda * motion_control_pfilter).transpose() << endl;
-		// 	cout << endl;
-		// }
-
-		// write control torques
-		redis_client.executeWriteCallback(0);
-		sim->setJointTorques(robot_name, command_torques + fsensor_torques);
-
-		// logger
-		log_robot_position = pos_task->_current_position;
-		log_haptic_position = haptic_position_global;
-		log_robot_force = pos_task->_desired_force;
-		log_haptic_force = teleop_task->_commanded_force_device;
-		log_sensed_force = -sensed_force_moment.head(3);
-
-		// // cout statements
-		// if(controller_counter % 500 == 0)
-		// {
-		// 	cout << "controller counter : " << controller_counter << endl;
-		// 	cout << "desired force : " << pos_task->_desired_force.transpose() << endl;
-		// 	cout << endl;
-		// }
-
-		controller_counter++;
+		// publish to the communication and control threads
+		device.haptic_position = haptic_state.haptic_position;
+		device.commanded_force = teleop_task->_commanded_force_device;
+		local_haptic_state.write(haptic_state);
+		haptic_device_state.write(device);
 
+		// write haptic commands
+		if(device_channel != NULL)
+		{
+			device_channel->sendCommands(teleop_task->_commanded_force_device, teleop_task->_commanded_torque_device,
+					teleop_task->_commanded_gripper_force_device, timer.elapsedTime() - start_time, delayed.sigma_force);
+		}
+		else
+		{
+			haptic_commands_writer.setEigenMatrixJSON(DEVICE_COMMANDED_FORCE_KEYS[0], teleop_task->_commanded_force_device);
+			haptic_commands_writer.setEigenMatrixJSON(DEVICE_COMMANDED_TORQUE_KEYS[0], teleop_task->_commanded_torque_device);
+			haptic_commands_writer.set(DEVICE_COMMANDED_GRIPPER_FORCE_KEYS[0], to_string(teleop_task->_commanded_gripper_force_device));
+		}
 	}
 
-	logger->stop();
+	// flush the pending commands before the zero commands below
+	haptic_commands_writer.stop();
 
-	//// Send zero force/torque to robot and haptic device through Redis keys ////
+	//// Send zero force/torque to haptic device through Redis keys ////
 	redis_client.setEigenMatrixJSON(DEVICE_COMMANDED_FORCE_KEYS[0], Vector3d::Zero());
 	redis_client.setEigenMatrixJSON(DEVICE_COMMANDED_TORQUE_KEYS[0], Vector3d::Zero());
 	redis_client.set(DEVICE_COMMANDED_GRIPPER_FORCE_KEYS[0], "0.0");
+	if(device_channel != NULL)
+	{
+		device_channel->sendCommands(Vector3d::Zero(), Vector3d::Zero(), 0, timer.elapsedTime() - start_time);
+		std::cout << "\nHaptic device channel : " << device_channel->summary() << "\n";
+		delete device_channel;
+	}
 
-	double end_time = timer.elapsedTime();
+	double end_time = timer.elapsedTime() - start_time;
 	std::cout << "\n";
-	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
-	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
-    std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
-
-
+	std::cout << "Haptic Loop run time  : " << end_time << " seconds\n";
+	std::cout << "Haptic Loop updates   : " << timer.elapsedCycles() << "\n";
+	std::cout << "Haptic Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
 }
 
 void communication()
 {
+	// emulated network between the haptic and the robot sides, one message per cycle
 	const double communication_delay_ms = 0;
-
-	queue<Vector3d> robot_position_buffer;
-	queue<Vector3d> haptic_position_buffer;
-	queue<Vector3d> haptic_velocity_buffer;
-	queue<Vector3d> sensed_force_buffer;
-	queue<Matrix3d> sigma_force_buffer;
+	PandaUtils::DelayLineConfig link_config = PandaUtils::DelayLineConfig::constant(communication_delay_ms / 1000.0);
+	link_config.jitter = 0;
+	link_config.jitter_distribution = PandaUtils::DelayLineConfig::GAUSSIAN_JITTER;
+	link_config.loss_rate = 0;
+	// up to about 1 s of messages in flight at 1 kHz
+	PandaUtils::DelayLine<TeleopMessage, 1024> link(link_config);
+	TeleopState robot_side;
+	TeleopState haptic_side;
+	TeleopMessage message;
+	TeleopMessage delayed_message;
 
 	// create a timer
-	double communication_freq = 50.0;
+	const double communication_freq = control_loop_freq;
 	LoopTimer timer;
 	timer.initializeTimer();
 	timer.setLoopFrequency(communication_freq); //Compiler en mode release
-	double current_time = 0;
-	double prev_time = 0;
-	// double dt = 0;
-	bool fTimerDidSleep = true;
 	double start_time = timer.elapsedTime(); //secs
 
 	log_commfreq_delay_forcespacedim(0) = communication_freq;
 	log_commfreq_delay_forcespacedim(1) = communication_delay_ms;
 
-	unsigned long long communication_counter = 0;
-	const int communication_delay_ncycles = communication_delay_ms / 1000.0 * communication_freq;
+	PandaUtils::configureRealtimeThread("communication", PandaUtils::RealtimeConfig::fifo(50, communication_cpus));
+	PandaUtils::TraceBuffer* trace = tracer->registerThread("communication");
 	
 	while(fSimulationRunning)
 	{
-		timer.waitForNextLoop();
-
-		if(communication_delay_ncycles == 0)
 		{
-			delayed_haptic_position = haptic_position_global;
-			delayed_haptic_velocity = haptic_velocity_global;
-			delayed_robot_position = robot_position_global;
-			delayed_sensed_force = sensed_force_global;
-			delayed_sigma_force = sigma_force_global;
+			PandaUtils::TraceScope wait(trace, "wait");
+			timer.waitForNextLoop();
 		}
-		else
+		PandaUtils::TraceScope iteration(trace, "communication");
+		const double current_time = timer.elapsedTime() - start_time;
+
+		// robot side from the control thread, haptic side from the haptic thread
+		local_robot_state.read(robot_side);
+		local_haptic_state.read(haptic_side);
+		message.teleop_state.robot_position = robot_side.robot_position;
+		message.teleop_state.sigma_force = robot_side.sigma_force;
+		message.teleop_state.haptic_position = haptic_side.haptic_position;
+		message.teleop_state.haptic_velocity = haptic_side.haptic_velocity;
+		message.teleop_state.forward_wave = haptic_side.forward_wave;
+		message.teleop_state.backward_wave = robot_side.backward_wave;
+		sensed_force_global.read(message.sensed_force);
+		message.send_time = current_time;
+		link.push(current_time, message);
+
+		if(link.pop(current_time, delayed_message))
 		{
-			haptic_position_buffer.push(haptic_position_global);
-			haptic_velocity_buffer.push(haptic_velocity_global);
-			robot_position_buffer.push(robot_position_global);
-			sensed_force_buffer.push(sensed_force_global);
-			sigma_force_buffer.push(sigma_force_global);
-
-			if(communication_counter > communication_delay_ncycles)
-			{
-				delayed_haptic_position = haptic_position_buffer.front();
-				delayed_haptic_velocity = haptic_velocity_buffer.front();
-				delayed_robot_position = robot_position_buffer.front();
-				delayed_sensed_force = sensed_force_buffer.front();
-				delayed_sigma_force = sigma_force_buffer.front();
-
-				haptic_position_buffer.pop();
-				haptic_velocity_buffer.pop();
-				robot_position_buffer.pop();
-				sensed_force_buffer.pop();
-				sigma_force_buffer.pop();
-
-				communication_counter--;
-			}
-
+			delayed_message.teleop_state.delay = current_time - delayed_message.send_time;
+			delayed_teleop_state.write(delayed_message.teleop_state);
+			delayed_teleop_state_haptic.write(delayed_message.teleop_state);
+			delayed_sensed_force = delayed_message.sensed_force;
 		}
-
-
-		communication_counter++;
 	}
 
-
+	std::cout << "\n";
+	std::cout << "Communication messages sent : " << link.sent() << ", lost " << link.lost()
+		<< ", over capacity " << link.overflowed() << ", delivered " << link.delivered() << "\n";
 }
 
 void particle_filter()
@@ -1422,39 +1350,49 @@ void particle_filter()
 	Matrix3d sigma_force_goal = Matrix3d::Zero();
 	Matrix3d sigma_force_prev_goal = Matrix3d::Zero();
 
+	ParallelForceSpaceParticleFilter pfilter(n_particles, pfilter_n_threads, pfilter_worker_cpus);
+	pfilter._mean_scatter = mean_scatter;
+	pfilter._std_scatter = std_scatter;
+	pfilter._coeff_friction = coeff_friction;
+	pfilter._particles = particles;
+
 	// create a timer
-	double pfilter_freq = 100.0;
 	LoopTimer timer;
 	timer.initializeTimer();
-	timer.setLoopFrequency(pfilter_freq); //Compiler en mode release
+	timer.setLoopFrequency(min(pfilter_freq, control_loop_freq)); //Compiler en mode release
 	double current_time = 0;
 	double prev_time = 0;
 	// double dt = 0;
 	bool fTimerDidSleep = true;
 	double start_time = timer.elapsedTime(); //secs
 
+	ParticleFilterInputs inputs;
+	ForceSpaceEstimate estimate;
+
+	// the workers of the filter keep their cpus and the normal scheduling
+	PandaUtils::configureRealtimeThread("particle filter", PandaUtils::RealtimeConfig::fifo(60, pfilter_cpus));
+	PandaUtils::TraceBuffer* trace = tracer->registerThread("particle filter");
+
 	while(fSimulationRunning)
 	{
-		timer.waitForNextLoop();
-		vector<pair<Vector3d, double>> weighted_particles = particleFilterMotionUpdate(particles, motion_control_pfilter, force_control_pfilter, measured_velocity_pfilter, measured_force_pfilter, force_space_dimension);
-		// vector<Vector3d> new_particles = particleFilterResampling(weighted_particles, n_particles);
-		vector<pair<Vector3d,double>> new_particles_with_weights = particleFilterResamplingLowVariance(weighted_particles, n_particles);
-
-		// PCA
-		MatrixXd points_to_PCA = MatrixXd::Zero(3, 1.5*n_particles);
-		for(int i=0 ; i<n_particles ; i++)
 		{
-			points_to_PCA.col(i) = new_particles_with_weights[i].first;
+			PandaUtils::TraceScope wait(trace, "wait");
+			timer.waitForNextLoop();
 		}
-		MatrixXd centered_points_to_PCA = points_to_PCA.colwise() - points_to_PCA.rowwise().mean();
-
-		Matrix3d cov = centered_points_to_PCA * centered_points_to_PCA.transpose();
-
-		SelfAdjointEigenSolver<MatrixXd> eig(cov);
-
-		// Get the eigenvectors and eigenvalues.
-		MatrixXd evecs = eig.eigenvectors();
-		VectorXd evals = eig.eigenvalues();
+		PandaUtils::TraceScope iteration(trace, "particle filter");
+		pfilter_inputs.read(inputs);
+
+		// motion update, weighting and low variance resampling, split across the filter threads
+		PandaUtils::traceBegin(trace, "pfilter update");
+		pfilter.update(inputs.motion_control, inputs.force_control, inputs.measured_velocity, inputs.measured_force, force_space_dimension);
+		PandaUtils::traceEnd(trace);
+
+		// PCA from the moments of the resampled particles
+		Matrix3d evecs;
+		Vector3d evals;
+		PandaUtils::traceBegin(trace, "PCA");
+		pfilter.computePCA(evals, evecs);
+		PandaUtils::traceEnd(trace);
 		if(evals.sum() > 1)
 		{
 			evals /= evals.sum();
@@ -1692,14 +1630,10 @@ void particle_filter()
 
 
 		// final resampling
-		vector<Vector3d> new_particles;
 		// if(force_space_dimension < 1)
-		{
-			for(int i=0 ; i<n_particles ; i++)
-			{
-				new_particles.push_back(new_particles_with_weights[i].first);
-			}
-		}
+		// {
+		// 	new_particles = pfilter._particles;
+		// }
 		// else
 		// {
 		// 	vector<int> n_copies_of_particle(force_space_dimension,0);
@@ -1725,12 +1659,12 @@ void particle_filter()
 		// cout << force_space_dimension << endl;
 
 
-		Vector3d robot_pos_in_world = robot_position_global + Vector3d(0, 0, 0.15);
+		Vector3d robot_pos_in_world = inputs.robot_position + Vector3d(0, 0, 0.15);
 		Vector3d tentative_particle = Vector3d(0, 0, -0.5) - robot_pos_in_world;
 		tentative_particle.normalize();
 
-		double weight_force_tentative_particle = 1.2 * tentative_particle.dot(measured_force_pfilter.normalized());
-		double weight_velocity_tetnative_particle = 1 - abs(measured_velocity_pfilter.normalized().dot(tentative_particle));
+		double weight_force_tentative_particle = 1.2 * tentative_particle.dot(inputs.measured_force.normalized());
+		double weight_velocity_tetnative_particle = 1 - abs(inputs.measured_velocity.normalized().dot(tentative_particle));
 		// double weight_velocity_tetnative_particle = 1 - abs(tanh(15.0*measured_velocity_pfilter.dot(tentative_particle)));
 
 
@@ -1757,15 +1691,13 @@ void particle_filter()
 		// 	cout << endl;
 		// }
 
-		// logger
-		log_eigenvalues = evals;
-		log_eigenvector_0 = evecs.col(0);
-		log_eigenvector_1 = evecs.col(1);
-		log_eigenvector_2 = evecs.col(2);
-		log_commfreq_delay_forcespacedim(2) = force_space_dimension;
-
-		log_force_axis = force_axis;
-		log_motion_axis = motion_axis;
+		// publish to the control thread, which also logs it
+		estimate.force_space_dimension = force_space_dimension;
+		estimate.force_axis = force_axis;
+		estimate.motion_axis = motion_axis;
+		estimate.eigenvalues = evals;
+		estimate.eigenvectors = evecs;
+		force_space_estimate.write(estimate);
 
 		// if(previous_force_space_dimension == 1 && force_space_dimension == 0)
 		// {
@@ -1781,7 +1713,7 @@ void particle_filter()
 		// }
 
 		previous_force_space_dimension = force_space_dimension;
-		particles = new_particles;
+		particles = pfilter._particles;
 
 		pf_counter++;
 	}
@@ -1806,6 +1738,7 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, Fo
 	// contact list
 	vector<Vector3d> contact_points;
 	vector<Vector3d> contact_forces;
+	Vector3d robot_position = Vector3d::Zero();
 
 	// create a timer
 	double sim_frequency = 5000.0;
@@ -1817,8 +1750,16 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, Fo
 
 	unsigned long long simulation_counter = 0;
 
+	PandaUtils::configureRealtimeThread("simulation", PandaUtils::RealtimeConfig::fifo(70, simulation_cpus));
+	// the ring holds about the same duration as the ones of the slower threads
+	PandaUtils::TraceBuffer* trace = tracer->registerThread("simulation", 1 << 20);
+
 	while (fSimulationRunning) {
-		fTimerDidSleep = timer.waitForNextLoop();
+		{
+			PandaUtils::TraceScope wait(trace, "wait");
+			fTimerDidSleep = timer.waitForNextLoop();
+		}
+		PandaUtils::TraceScope iteration(trace, "simulation");
 
 		// sim->setJointTorques(robot_name, command_torques);
 
@@ -1826,7 +1767,9 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, Fo
 		// double curr_time = timer.elapsedTime();
 		// double loop_dt = curr_time - last_time;
 		// sim->integrate(loop_dt);
+		PandaUtils::traceBegin(trace, "integrate");
 		sim->integrate(1.0/sim_frequency);
+		PandaUtils::traceEnd(trace);
 
 		// get contacts for logging
 		contact_points.clear();
@@ -1838,7 +1781,8 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, Fo
 		log_contact_0.setZero();
 		log_contact_1.setZero();
 		log_contact_2.setZero();
-		Vector3d robot_pos_in_world = robot_position_global + Vector3d(0, 0, 0.15);
+		robot_position_global.read(robot_position);
+		Vector3d robot_pos_in_world = robot_position + Vector3d(0, 0, 0.15);
 
 		// Vector3d p_sphere_cylinder = Vector3d(0.0, 0.0, -0.5) - robot_pos_in_world;
 		// p_sphere_cylinder(0) = 0;
@@ -1873,9 +1817,11 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, Fo
 		// robot->updateKinematics();
 
 		// read end-effector task forces from the force sensor simulation
+		PandaUtils::traceBegin(trace, "force sensor");
 		force_sensor->update(sim);
 		force_sensor->getForceLocalFrame(sensed_force);
 		force_sensor->getMomentLocalFrame(sensed_moment);
+		PandaUtils::traceEnd(trace);
 		
 		// sensed_force.setZero();
 		// cout << p_sphere_cylinder.transpose() << endl;
@@ -1891,7 +1837,7 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, Fo
 		// fsensor_torques = Jv.transpose() * sensed_force;
 
 		sensed_force_moment << -sensed_force, -sensed_moment;
-		sensed_force_global = sensed_force_moment.head(3);
+		sensed_force_global.write(sensed_force_moment.head(3));
 
 
 		// cout << sensed_force_moment.transpose() << endl;
@@ -1950,6 +1896,14 @@ void keySelect(GLFWwindow* window, int key, int scancode, int action, int mods)
 		case GLFW_KEY_S:
 			fshowCameraPose = set;
 			break;
+		case GLFW_KEY_C:
+			// next delay compensation mode
+			if(action == GLFW_PRESS)
+			{
+				delay_compensation_mode = (delay_compensation_mode + 1) % PandaUtils::N_DELAY_COMPENSATION_MODES;
+				cout << "delay compensation : " << PandaUtils::delayCompensationName(delay_compensation_mode) << endl;
+			}
+			break;
 	// device input keys
 			case GLFW_KEY_U:
 				fMouseXp = set;
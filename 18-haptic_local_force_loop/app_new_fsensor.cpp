@@ -10,7 +10,7 @@
 #include "tasks/PositionTask.h"
 #include "haptic_tasks/HapticController.h"
 #include "filters/ButterworthFilter.h"
-#include "Logger.h"
+#include "logger/Logger.h"
 
 #include "ForceSpaceParticleFilter_weight_mem.h"
 
@@ -10,7 +10,7 @@
 #include "tasks/PositionTask.h"
 #include "haptic_tasks/HapticController.h"
 #include "filters/ButterworthFilter.h"
-#include "Logger.h"
+#include "logger/Logger.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
 
@@ -236,391 +236,6 @@ const std::string currentDateTime() {
 }
 
 
-double sampleNormalDistribution(const double mean, const double std)
-{
-	// random device class instance, source of 'true' randomness for initializing random seed
-    random_device rd; 
-    // Mersenne twister PRNG, initialized with seed from random device instance
-    mt19937 gen(rd()); 
-    // instance of class normal_distribution with specific mean and stddev
-    normal_distribution<float> d(mean, std); 
-    // get random number with normal distribution using gen as random source
-    return d(gen); 
-}
-
-double sampleUniformDistribution(const double min, const double max)
-{
-	double min_internal = min;
-	double max_internal = max;
-	if(min > max)
-	{
-		min_internal = max;
-		max_internal = min;
-	}
-	// random device class instance, source of 'true' randomness for initializing random seed
-    random_device rd; 
-    // Mersenne twister PRNG, initialized with seed from random device instance
-    mt19937 gen(rd()); 
-    // instance of class uniform_distribution with specific min and max
-    uniform_real_distribution<float> d(min_internal, max_internal); 
-    // get random number with normal distribution using gen as random source
-    return d(gen); 
-}
-
-vector<pair<Vector3d, double>> particleFilterMotionUpdate(const vector<Vector3d> particles, 
-														const Vector3d motion_control, 
-														const Vector3d force_control, 
-														const Vector3d measured_velocity, 
-														const Vector3d measured_force,
-														const int contact_space_dimension)
-{
-	int n = particles.size();
-	Vector3d motion_control_normalized = Vector3d::Zero();
-	Vector3d force_control_normalized = Vector3d::Zero();
-	Vector3d measured_velocity_normalized = Vector3d::Zero();
-	Vector3d measured_force_normalized = Vector3d::Zero();
-
-	// cout << "particles size : " << particles.size() << endl;
-
-	// cout << "force control :\n" << force_control.transpose() << endl;
-	// cout << "motion control :\n" << motion_control.transpose() << endl;
-	// cout << endl;
-
-
-	if(motion_control.norm() > 0.5)
-	{
-		motion_control_normalized = motion_control/motion_control.norm();
-	}
-	if(force_control.norm() > 0.5)
-	{
-		force_control_normalized = force_control/force_control.norm();
-	}
-	if(measured_velocity.norm() > 1e-3)
-	{
-		measured_velocity_normalized = measured_velocity/measured_velocity.norm();
-	}
-	// Matrix3d P_orth_vel = Matrix3d::Identity() - measured_velocity_normalized*measured_velocity_normalized.transpose();
-	// Vector3d projected_measured_force = P_orth_vel * measured_force;
-	Vector3d projected_measured_force = measured_force;
-	if(projected_measured_force.norm() > 0.5)
-	{
-		measured_force_normalized = projected_measured_force/projected_measured_force.norm();
-	}
-	vector<Vector3d> augmented_particles = particles;
-
-	int n_added_particles_center = 1;
-	for(int i=0 ; i<n_added_particles_center ; i++)
-	{
-		augmented_particles.push_back(Vector3d::Zero());
-	}
-
-	double prob_add_particle = (1 - abs(tanh(5.0*measured_velocity.dot(motion_control_normalized)))) * (tanh(motion_control_normalized.dot(projected_measured_force)));
-	// prob_add_particle *= tanh(motion_control.norm() - coeff_friction * force_control.norm());
-	Matrix3d proj_motion_control_space = motion_control_normalized*motion_control_normalized.transpose();
-	prob_add_particle *= tanh((proj_motion_control_space*measured_force).norm() - force_space_dimension * 1.5 * coeff_friction * (measured_force - proj_motion_control_space*measured_force).norm());
-
-
-	// cout << "prob add particle : " << prob_add_particle << endl;
-	// cout << "sensed vel : " << measured_velocity.transpose() << endl;
-	// cout << "mot control : " << motion_control.transpose() << endl;
-	// cout << "vel dot mot command : " << motion_control_normalized.dot(measured_velocity_normalized) << endl;
-
-
-	// if((proj_motion_control_space*measured_force).norm() < coeff_friction * (measured_force - proj_motion_control_space*measured_force).norm())
-	// {
-	// 	prob_add_particle = 0;
-	// }
-	if(prob_add_particle < 0)
-	{
-		prob_add_particle = 0;
-	}
-	int n_added_particles = 1.5 * prob_add_particle * n;
-	// int n_added_particles = n/2;
-	// for(int i=0 ; i<n_added_particles ; i++)
-	// {
-	// 	Vector3d new_particle = motion_control_normalized;
-	// 	for(int j=0 ; j<3 ; j++)
-	// 	{
-	// 		new_particle(j) += sampleNormalDistribution(0, 0.1);
-	// 	}
-	// 	new_particle.normalize();
-	// 	augmented_particles.push_back(new_particle);
-	// }
-
-	for(int i=0 ; i<n_added_particles ; i++)
-	{
-		double alpha = (double) (i + 0.5) / (double)n_added_particles;
-		Vector3d new_particle = (1 - alpha) * motion_control_normalized + alpha * force_control_normalized;
-		// for(int j=0 ; j<3 ; j++)
-		// {
-		// 	new_particle(j) += sampleNormalDistribution(0, 0.1);
-		// }
-		new_particle.normalize();
-		augmented_particles.push_back(new_particle);
-	}
-
-
-	augmented_particles.push_back(force_control_normalized);
-
-	int n_new_particles = n_added_particles_center + n_added_particles;
-	// augmented_particles.push_back(force_control_normalized);
-
-	// cout << "motion control : " << motion_control.transpose() << endl;
-	// cout << "force control : " << force_control.transpose() << endl;
-	// cout << endl;
-
-	vector<pair<Vector3d, double>> weighted_particles;
-	double cumulative_weight = 0;
-
-	// cout << "n new particles : " << augmented_particles.size() << endl;
-
-	for(int i=0 ; i<n + n_new_particles ; i++)
-	{
-		// control update : compute new particle location
-		Vector3d current_particle = augmented_particles[i];
-		double uniform_rand = sampleUniformDistribution(0, 1);
-
-		if(current_particle.norm() > 1e-3) // contact
-		{
-			// if(uniform_rand < - percent_chance_contact_disapears * current_particle.dot(force_control_normalized) ||
-			// 	uniform_rand < - percent_chance_contact_disapears * current_particle.dot(motion_control_normalized))
-			// {
-			// 	current_particle.setZero();
-			// }
-			// else
-			// {
-				double normal_rand_1 = sampleNormalDistribution(mean_scatter, std_scatter);
-				double normal_rand_2 = sampleNormalDistribution(mean_scatter, std_scatter);
-				double normal_rand_3 = sampleNormalDistribution(mean_scatter, std_scatter);
-				current_particle += Vector3d(normal_rand_1, normal_rand_2, normal_rand_3);
-
-				// double normal_rand_vel = sampleNormalDistribution(mean_scatter, 5*std_scatter);
-				// current_particle += normal_rand_vel * measured_velocity_normalized;
-
-				current_particle.normalize();
-
-			// }
-
-				// // project on space orthogonal to velocity
-				// Matrix3d P_orth_vel = Matrix3d::Identity() - measured_velocity_normalized*measured_velocity_normalized.transpose();
-				// Vector3d projected_particle = P_orth_vel * current_particle;
-				// current_particle = projected_particle.normalized();
-		}
-
-
-		// measurement update : compute weight due to force measurement
-		double weight_force = 0;
-		if(current_particle.norm() < 1e-3)
-		{
-			weight_force = 1-tanh(projected_measured_force.norm()/2);
-		}
-		else
-		{
-			// weight_force = tanh(current_particle.dot(projected_measured_force));
-			// weight_force = 1.0 * tanh(current_particle.dot(projected_measured_force));
-			weight_force = 1.3 * tanh(current_particle.dot(projected_measured_force));
-			// weight_force = 1.5 * current_particle.dot(measured_force_normalized);
-
-			// Matrix3d proj_particle_space = current_particle*current_particle.transpose();
-			// weight_force *= tanh((proj_particle_space*measured_force).norm() - coeff_friction * (measured_force - proj_particle_space*measured_force).norm());
-		}
-		if(weight_force < 0)
-		{
-			weight_force = 0;
-		}
-		if(weight_force > 1)
-		{
-			weight_force = 1;
-		}
-
-		// measurement update : compute weight due to velocity measurement
-		// double weight_velocity = 1;
-		// double weight_velocity = 1 - abs(measured_velocity_normalized.dot(current_particle));
-		double weight_velocity = 1 - abs(tanh(5.0*measured_velocity.dot(current_particle)));
-
-		// final weight
-		double weight = weight_force * weight_velocity;
-		cumulative_weight += weight;
-
-		// if(force_space_dimension == 1)
-		// {
-		// 	cout << "particle number : " << i << endl;
-		// 	cout << "current particle :\n" << current_particle.transpose() << endl;
-		// 	cout << "measured force : " << projected_measured_force.transpose() << endl;
-		// 	cout << "measured force normalized : " << measured_force_normalized.transpose() << endl;
-		// 	cout << "measured velocity : " << measured_velocity.transpose() << endl;
-		// 	cout << "measured velocity normalized : " << measured_velocity_normalized.transpose() << endl;
-		// 	cout << "weight force : " << weight_force << endl;
-		// 	cout << "weight velocity : " << weight_velocity << endl;
-		// 	cout << endl;
-		// }
-		// else
-		// {
-		// 	cout << "****" << endl;
-		// }
-
-		// if(current_particle.norm() > 1e-3 && weight > 0)
-		// {
-		// 	cout << "particle : " << current_particle.transpose() << endl;
-		// 	cout << "measured force : " << projected_measured_force.transpose() << endl;
-		// 	cout << "measured force normalized : " << measured_force_normalized.transpose() << endl;
-		// 	cout << "measured velocity : " << measured_velocity.transpose() << endl;
-		// 	cout << "measured velocity normalized : " << measured_velocity_normalized.transpose() << endl;
-		// 	cout << "weight force : " << weight_force << endl;
-		// 	cout << "weight velocity : " << weight_velocity << endl;
-		// 	cout << endl;
-		// }
-
-		// if(current_particle.dot(Vector3d::UnitZ()) < -0.95)
-		// {
-		// 	cout << "particle index : " << i << endl;
-		// 	cout << "particle : " << current_particle.transpose() << endl;
-		// 	cout << "measured force : " << projected_measured_force.transpose() << endl;
-		// 	cout << "measured velocity : " << measured_velocity.transpose() << endl;
-		// 	cout << "weight force : " << weight_force << endl;
-		// 	cout << "weight velocity : " << weight_velocity << endl;
-		// 	cout << endl;
-		// }
-
-		weighted_particles.push_back(make_pair(current_particle, cumulative_weight));
-	}
-
-	// if(previous_force_space_dimension == 1 && force_space_dimension == 0)
-	// {
-		// cout << endl << endl << endl;
-	// }
-
-
-	for(int i=0 ; i<n + n_new_particles ; i++)
-	{
-		weighted_particles[i].second /= cumulative_weight;
-	}
-
-	return weighted_particles;
-
-}
-
-
-vector<Vector3d> particleFilterResampling(const vector<pair<Vector3d, double>> weighted_particles, const int n_particles_to_resample)
-{
-	vector<Vector3d> new_particles;
-	int n_weighted_particles = weighted_particles.size();
-
-	// cout << "Resampling ******--------" << endl;
-	// cout << "n weighted particles : " << n_weighted_particles << endl;
-	// cout << "n particles to resample : " << n_particles_to_resample << endl;
-	// cout << "total weights : " << weighted_particles[n_weighted_particles-1].second << endl;
-
-	for(int i=0 ; i<n_particles_to_resample ; i++)
-	{
-
-		int k = 0;
-		double rand = sampleUniformDistribution(0,1);
-		while(weighted_particles[k].second < rand && k < n_weighted_particles)
-		{
-			k++;
-		}
-
-		// cout << "---" << endl;
-		// cout << "rand : " << rand << endl;
-		// cout << "particle selected : " << k << endl;
-		// cout << "particle position : " << weighted_particles[k].first.transpose() << endl;
-
-		new_particles.push_back(weighted_particles[k].first);
-	}
-
-	// cout << endl;
-
-	return new_particles;
-}
-
-vector<pair<Vector3d,double>> particleFilterResamplingLowVariance(const vector<pair<Vector3d, double>> weighted_particles, const int n_particles_to_resample)
-{
-	vector<pair<Vector3d,double>> new_particles_with_weights;
-	int n_weighted_particles = weighted_particles.size();
-
-	double n_inv = 1.0/(double)n_particles_to_resample;
-	double r = sampleUniformDistribution(0,n_inv);
-	int k = 0;
-
-
-	// cout << "Resampling ******--------" << endl;
-	// cout << "n weighted particles : " << n_weighted_particles << endl;
-	// cout << "n particles to resample : " << n_particles_to_resample << endl;
-	// cout << "total weights : " << weighted_particles[n_weighted_particles-1].second << endl;
-
-	for(int i=0 ; i<n_particles_to_resample ; i++)
-	{
-		// cout << weighted_particles.size() << endl;
-		while(r > weighted_particles[k].second)
-		{
-			k++;
-		}
-		double cum_weight_prev = 0;
-		if(k > 0)
-		{
-			cum_weight_prev = weighted_particles[k-1].second;
-		}
-		new_particles_with_weights.push_back(make_pair(weighted_particles[k].first, weighted_particles[k].second - cum_weight_prev));
-		r += n_inv;
-	}
-
-	// cout << "Resampling ******--------" << endl;
-	// cout << "n particles : " << new_particles_with_weights.size() << endl;
-	// cout << endl;
-
-	return new_particles_with_weights;
-}
-
-vector<Vector3d> particleFilterResamplingAfterPCA(const vector<pair<Vector3d, double>> new_particles_with_weights, const int n_particles_to_resample, const Matrix3d eigen_vectors)
-{
-	vector<Vector3d> new_particles;
-
-	VectorXd cluster_average_weight = VectorXd::Zero(4);
-	VectorXd num_particle_in_cluster = VectorXd::Zero(4);
-
-	for(int i=0 ; i<new_particles_with_weights.size() ; i++)
-	{
-		Vector3d current_particle = new_particles_with_weights[i].first;
-		double dist = current_particle.norm();
-		int current_cluster = 0;
-		for(int k=0 ; k < 3 ; k++)
-		{
-			if( (current_particle - eigen_vectors.col(k)).norm() < dist )
-			{
-				current_cluster = k+1;
-				dist = (current_particle - eigen_vectors.col(k)).norm();
-			}
-		}
-		cluster_average_weight(current_cluster) += new_particles_with_weights[i].second;
-		num_particle_in_cluster(current_cluster) += 1;
-	}
-
-	for(int k=0 ; k<4 ; k++)
-	{
-		if(num_particle_in_cluster(k) > 0)
-		{
-			cluster_average_weight(k) /= num_particle_in_cluster(k);
-		}
-	}
-
-
-	// cout << "cluster number part :\n" << num_particle_in_cluster.transpose() << endl;
-	// cout << "cluster average weight before norm :\n" << cluster_average_weight.transpose() << endl;
-
-	cluster_average_weight /= cluster_average_weight.sum();
-
-	// cout << "cluster average weight after norm :\n" << cluster_average_weight.transpose() << endl;
-	// cout << endl;
-
-	for(int i=0 ; i<n_particles ; i++)
-	{
-		new_particles.push_back(new_particles_with_weights[i].first);
-	}
-
-	return new_particles;
-}
-
 int main() {
 	cout << "Loading URDF world model file: " << world_file << endl;
 
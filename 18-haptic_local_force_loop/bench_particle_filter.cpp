@@ -0,0 +1,487 @@
+// Throughput and accuracy benchmark of the force space particle filters.
+//
+// replays a trace of the particle filter inputs through each filter variant at several
+// numbers of particles, and reports the time per update, the allocations per update, the
+// error of the PCA force axis (motion axis in 2d) and how often the force space dimension
+// is right, as json. the trace is either a binary log of app18 (which logs the filter inputs
+// and the simulated contacts) or a synthetic free space / 1 contact / 2 contacts / free space
+// sequence.
+//
+// usage : bench_pf18 [-t log.bin] [-d decimation] [-n 70,300,1000] [-r repeats] [-s seed] [-o results.json]
+//   -t  binary log recorded by app18, replayed every decimation records (default 10, the
+//       particle filter runs at 100 Hz and the log at 1 kHz). synthetic trace without it
+//   -n  numbers of particles (default 70,300,1000,5000)
+//   -r  number of times the trace is replayed (default 1)
+//   -o  json output file (default stdout)
+
+#include "ForceSpaceParticleFilter.h"
+#include "ForceSpaceParticleFilter_weight_mem.h"
+#include "ParallelForceSpaceParticleFilter.h"
+#include "logger/BinaryLogReader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+// allocations counted while a filter updates
+static atomic<bool> count_allocations(false);
+static atomic<long> n_allocations(0);
+
+void* operator new(size_t size)
+{
+	if(count_allocations.load(memory_order_relaxed))
+	{
+		n_allocations.fetch_add(1, memory_order_relaxed);
+	}
+	void* p = malloc(size == 0 ? 1 : size);
+	if(p == NULL)
+	{
+		throw bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+struct TraceSample
+{
+	Vector3d motion_control;
+	Vector3d force_control;
+	Vector3d velocity;
+	Vector3d force;
+
+	// ground truth : dimension of the force space, and the force axis in 1d or the motion axis in 2d
+	int true_dimension;
+	Vector3d true_axis;
+};
+
+struct BenchResult
+{
+	string variant;
+	int n_particles;
+	int n_updates;
+	double mean_ns;
+	double p99_ns;
+	double allocations_per_update;
+	double axis_error_deg;
+	double dimension_accuracy;
+};
+
+// free space, contact along x then sliding along y, contact along x and y then sliding along z, free space
+void syntheticTrace(const uint64_t seed, vector<TraceSample>& trace)
+{
+	PandaUtils::Xoshiro256 random_generator(seed);
+	const double freq = 100.0;
+	const double force_noise = 0.2;
+	const double velocity_noise = 0.002;
+
+	for(int i=0 ; i<10*freq ; i++)
+	{
+		const double t = i / freq;
+		TraceSample sample;
+		sample.force_control.setZero();
+		sample.true_axis.setZero();
+		if(t < 2)
+		{
+			sample.motion_control = Vector3d(4, 0, 0);
+			sample.velocity = Vector3d(0.05, 0, 0);
+			sample.force.setZero();
+			sample.true_dimension = 0;
+		}
+		else if(t < 3)
+		{
+			sample.motion_control = Vector3d(4, 0, 0);
+			sample.velocity.setZero();
+			sample.force = Vector3d(4, 0, 0);
+			sample.true_dimension = 1;
+			sample.true_axis = Vector3d::UnitX();
+		}
+		else if(t < 5)
+		{
+			sample.motion_control = Vector3d(0, 4, 0);
+			sample.force_control = Vector3d(4, 0, 0);
+			sample.velocity = Vector3d(0, 0.05, 0);
+			sample.force = Vector3d(4, 0, 0);
+			sample.true_dimension = 1;
+			sample.true_axis = Vector3d::UnitX();
+		}
+		else if(t < 6)
+		{
+			sample.motion_control = Vector3d(0, 4, 0);
+			sample.force_control = Vector3d(4, 0, 0);
+			sample.velocity.setZero();
+			sample.force = Vector3d(4, 4, 0);
+			sample.true_dimension = 2;
+			sample.true_axis = Vector3d::UnitZ();
+		}
+		else if(t < 8)
+		{
+			sample.motion_control = Vector3d(0, 0, 4);
+			sample.force_control = Vector3d(4, 4, 0);
+			sample.velocity = Vector3d(0, 0, 0.05);
+			sample.force = Vector3d(4, 4, 0);
+			sample.true_dimension = 2;
+			sample.true_axis = Vector3d::UnitZ();
+		}
+		else
+		{
+			sample.motion_control = Vector3d(-4, 0, 0);
+			sample.velocity = Vector3d(-0.05, 0, 0);
+			sample.force.setZero();
+			sample.true_dimension = 0;
+		}
+		for(int j=0 ; j<3 ; j++)
+		{
+			sample.force(j) += random_generator.normal(0, force_noise);
+			sample.velocity(j) += random_generator.normal(0, velocity_noise);
+		}
+		trace.push_back(sample);
+	}
+}
+
+// filter inputs and simulated contacts logged by app18
+bool loadTrace(const string& fname, const int decimation, vector<TraceSample>& trace)
+{
+	Logging::BinaryLogReader reader;
+	if(!reader.open(fname))
+	{
+		cout << reader.error() << endl;
+		return false;
+	}
+	const int motion_control = reader.variableOffset("motion_control_pfilter");
+	const int force_control = reader.variableOffset("force_control_pfilter");
+	const int velocity = reader.variableOffset("measured_velocity_pfilter");
+	const int force = reader.variableOffset("measured_force_pfilter");
+	const int contact_0 = reader.variableOffset("contact_0");
+	const int contact_1 = reader.variableOffset("contact_1");
+	const int n_contacts = reader.variableOffset("comm_freq-delay_ms-force_space_dimension");
+	if(motion_control < 0 || force_control < 0 || velocity < 0 || force < 0 || contact_0 < 0 || contact_1 < 0 || n_contacts < 0)
+	{
+		cout << fname << " does not have the particle filter inputs and the contacts of app18" << endl;
+		return false;
+	}
+
+	vector<double> record;
+	unsigned long n_records = 0;
+	while(reader.next(record))
+	{
+		if(n_records++ % decimation != 0)
+		{
+			continue;
+		}
+		TraceSample sample;
+		sample.motion_control = Map<const Vector3d>(record.data() + motion_control);
+		sample.force_control = Map<const Vector3d>(record.data() + force_control);
+		sample.velocity = Map<const Vector3d>(record.data() + velocity);
+		sample.force = Map<const Vector3d>(record.data() + force);
+
+		// the number of contact points is the 4th element of the vector
+		sample.true_dimension = min((int)record[n_contacts + 3], 3);
+		sample.true_axis.setZero();
+		const Vector3d c0 = Map<const Vector3d>(record.data() + contact_0);
+		const Vector3d c1 = Map<const Vector3d>(record.data() + contact_1);
+		if(sample.true_dimension == 1)
+		{
+			sample.true_axis = c0;
+		}
+		else if(sample.true_dimension == 2 && c0.cross(c1).norm() > 1e-3)
+		{
+			sample.true_axis = c0.cross(c1).normalized();
+		}
+		trace.push_back(sample);
+	}
+	if(!reader.error().empty())
+	{
+		cout << reader.error() << endl;
+	}
+	return !trace.empty();
+}
+
+// force space dimension from the eigenvalues of the particles, with the hysteresis of app.cpp
+int estimateForceSpaceDimension(Vector3d evals, const int previous_dimension)
+{
+	if(evals.sum() > 1)
+	{
+		evals /= evals.sum();
+	}
+	int dimension_up = 0;
+	int dimension_down = 0;
+	for(int i=0 ; i<3 ; i++)
+	{
+		if(evals(i) > 0.25)
+		{
+			dimension_up++;
+		}
+		if(evals(i) > 0.05)
+		{
+			dimension_down++;
+		}
+	}
+	if(dimension_up == dimension_down || previous_dimension >= dimension_down)
+	{
+		return dimension_down;
+	}
+	if(previous_dimension <= dimension_up)
+	{
+		return dimension_up;
+	}
+	return previous_dimension;
+}
+
+// update(sample, force_space_dimension) runs one filter update, pca(evals, evecs) gives its PCA
+template<typename Update, typename PCA>
+BenchResult runVariant(const string& variant, const int n_particles, const vector<TraceSample>& trace,
+		const int repeats, Update update, PCA pca)
+{
+	BenchResult result;
+	result.variant = variant;
+	result.n_particles = n_particles;
+	result.n_updates = trace.size() * repeats;
+
+	vector<double> durations_ns(result.n_updates);
+	double axis_error_sum = 0;
+	int n_axis_samples = 0;
+	int n_right_dimension = 0;
+	int dimension = 0;
+	long allocations = 0;
+
+	for(int u=0 ; u<result.n_updates ; u++)
+	{
+		const TraceSample& sample = trace[u % trace.size()];
+
+		n_allocations.store(0);
+		count_allocations.store(true);
+		const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		update(sample, dimension);
+		const chrono::steady_clock::time_point end = chrono::steady_clock::now();
+		count_allocations.store(false);
+		allocations += n_allocations.load();
+		durations_ns[u] = chrono::duration<double, nano>(end - start).count();
+
+		Vector3d evals;
+		Matrix3d evecs;
+		pca(evals, evecs);
+		dimension = estimateForceSpaceDimension(evals, dimension);
+
+		if(dimension == sample.true_dimension)
+		{
+			n_right_dimension++;
+		}
+		if(sample.true_axis.norm() > 0.5)
+		{
+			const Vector3d axis = sample.true_dimension == 1 ? evecs.col(2) : evecs.col(0);
+			axis_error_sum += acos(min(1.0, abs(axis.dot(sample.true_axis)))) * 180.0 / M_PI;
+			n_axis_samples++;
+		}
+	}
+
+	double sum_ns = 0;
+	for(int u=0 ; u<result.n_updates ; u++)
+	{
+		sum_ns += durations_ns[u];
+	}
+	result.mean_ns = sum_ns / result.n_updates;
+	nth_element(durations_ns.begin(), durations_ns.begin() + 99 * (durations_ns.size() - 1) / 100, durations_ns.end());
+	result.p99_ns = durations_ns[99 * (durations_ns.size() - 1) / 100];
+	result.allocations_per_update = (double)allocations / result.n_updates;
+	result.axis_error_deg = n_axis_samples > 0 ? axis_error_sum / n_axis_samples : 0;
+	result.dimension_accuracy = (double)n_right_dimension / result.n_updates;
+	return result;
+}
+
+vector<BenchResult> runAllVariants(const int n_particles, const vector<TraceSample>& trace, const int repeats, const uint64_t seed)
+{
+	vector<BenchResult> results;
+
+	ForceSpaceParticleFilter tanh_filter(n_particles);
+	tanh_filter.seed(seed);
+	results.push_back(runVariant("tanh", n_particles, trace, repeats,
+		[&](const TraceSample& s, const int dimension)
+		{
+			tanh_filter._force_space_dimension = dimension;
+			tanh_filter.update(s.motion_control, s.force_control, s.velocity, s.force);
+		},
+		[&](Vector3d& evals, Matrix3d& evecs) { tanh_filter.computePCA(evals, evecs); }));
+
+	ForceSpaceParticleFilter_weight_mem weight_mem_filter(n_particles);
+	weight_mem_filter.seed(seed);
+	results.push_back(runVariant("weight_mem", n_particles, trace, repeats,
+		[&](const TraceSample& s, const int dimension)
+		{
+			weight_mem_filter._force_space_dimension = dimension;
+			weight_mem_filter.update(s.motion_control, s.force_control, s.velocity, s.force);
+		},
+		[&](Vector3d& evals, Matrix3d& evecs) { weight_mem_filter.computePCA(evals, evecs); }));
+
+	ParticleFilter<PiecewiseLinearWeighting, GaussianScatter, ProximityPenaltyResampling> proximity_filter(n_particles);
+	proximity_filter.seed(seed);
+	results.push_back(runVariant("weight_mem_proximity_penalty", n_particles, trace, repeats,
+		[&](const TraceSample& s, const int dimension)
+		{
+			proximity_filter._force_space_dimension = dimension;
+			proximity_filter.update(s.motion_control, s.force_control, s.velocity, s.force);
+		},
+		[&](Vector3d& evals, Matrix3d& evecs) { proximity_filter.computePCA(evals, evecs); }));
+
+	ForceSpaceParticleFilter_weight_mem ess_filter(n_particles);
+	ess_filter.enableEssResampling();
+	ess_filter.seed(seed);
+	results.push_back(runVariant("weight_mem_ess", n_particles, trace, repeats,
+		[&](const TraceSample& s, const int dimension)
+		{
+			ess_filter._force_space_dimension = dimension;
+			ess_filter.update(s.motion_control, s.force_control, s.velocity, s.force);
+		},
+		[&](Vector3d& evals, Matrix3d& evecs) { ess_filter.computePCA(evals, evecs); }));
+
+	ForceSpaceParticleFilter_weight_mem kld_filter(n_particles);
+	kld_filter.enableAdaptiveParticleCount(max(n_particles / 10, 10), n_particles);
+	kld_filter.seed(seed);
+	results.push_back(runVariant("weight_mem_kld", n_particles, trace, repeats,
+		[&](const TraceSample& s, const int dimension)
+		{
+			kld_filter._force_space_dimension = dimension;
+			kld_filter.update(s.motion_control, s.force_control, s.velocity, s.force);
+		},
+		[&](Vector3d& evals, Matrix3d& evecs) { kld_filter.computePCA(evals, evecs); }));
+
+	const int n_threads = max(2, min(4, (int)thread::hardware_concurrency()));
+	for(int threads : {1, n_threads})
+	{
+		ParallelForceSpaceParticleFilter parallel_filter(n_particles, threads);
+		parallel_filter.seed(seed);
+		results.push_back(runVariant("parallel_" + to_string(threads) + "_threads", n_particles, trace, repeats,
+			[&](const TraceSample& s, const int dimension)
+			{
+				parallel_filter.update(s.motion_control, s.force_control, s.velocity, s.force, dimension);
+			},
+			[&](Vector3d& evals, Matrix3d& evecs) { parallel_filter.computePCA(evals, evecs); }));
+	}
+
+	return results;
+}
+
+void writeJson(ostream& out, const string& trace_name, const int n_samples, const vector<BenchResult>& results)
+{
+	out << "{\n";
+	out << "  \"trace\": \"" << trace_name << "\",\n";
+	out << "  \"trace_samples\": " << n_samples << ",\n";
+	out << "  \"results\": [\n";
+	for(unsigned int i=0 ; i<results.size() ; i++)
+	{
+		const BenchResult& r = results[i];
+		out << "    {\"variant\": \"" << r.variant << "\", \"n_particles\": " << r.n_particles
+			<< ", \"updates\": " << r.n_updates
+			<< ", \"mean_ns_per_update\": " << r.mean_ns
+			<< ", \"p99_ns_per_update\": " << r.p99_ns
+			<< ", \"allocations_per_update\": " << r.allocations_per_update
+			<< ", \"axis_error_deg\": " << r.axis_error_deg
+			<< ", \"dimension_accuracy\": " << r.dimension_accuracy << "}"
+			<< (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	out << "  ]\n";
+	out << "}\n";
+}
+
+int main(int argc, char** argv)
+{
+	string trace_file;
+	string output_file;
+	int decimation = 10;
+	int repeats = 1;
+	uint64_t seed = 1;
+	vector<int> particle_counts = {70, 300, 1000, 5000};
+
+	for(int i=1 ; i<argc ; i++)
+	{
+		const string arg = argv[i];
+		if(i + 1 >= argc)
+		{
+			cout << "missing value after " << arg << endl;
+			return 1;
+		}
+		const string value = argv[++i];
+		if(arg == "-t")
+		{
+			trace_file = value;
+		}
+		else if(arg == "-o")
+		{
+			output_file = value;
+		}
+		else if(arg == "-d")
+		{
+			decimation = max(1, atoi(value.c_str()));
+		}
+		else if(arg == "-r")
+		{
+			repeats = max(1, atoi(value.c_str()));
+		}
+		else if(arg == "-s")
+		{
+			seed = strtoull(value.c_str(), NULL, 10);
+		}
+		else if(arg == "-n")
+		{
+			particle_counts.clear();
+			stringstream list(value);
+			string count;
+			while(getline(list, count, ','))
+			{
+				if(atoi(count.c_str()) > 0)
+				{
+					particle_counts.push_back(atoi(count.c_str()));
+				}
+			}
+		}
+		else
+		{
+			cout << "usage : " << argv[0] << " [-t log.bin] [-d decimation] [-n 70,300,1000] [-r repeats] [-s seed] [-o results.json]" << endl;
+			return 1;
+		}
+	}
+
+	vector<TraceSample> trace;
+	if(trace_file.empty())
+	{
+		syntheticTrace(seed, trace);
+	}
+	else if(!loadTrace(trace_file, decimation, trace))
+	{
+		return 1;
+	}
+
+	vector<BenchResult> results;
+	for(const int n_particles : particle_counts)
+	{
+		const vector<BenchResult> variant_results = runAllVariants(n_particles, trace, repeats, seed);
+		results.insert(results.end(), variant_results.begin(), variant_results.end());
+	}
+
+	const string trace_name = trace_file.empty() ? "synthetic" : trace_file;
+	if(output_file.empty())
+	{
+		writeJson(cout, trace_name, trace.size(), results);
+	}
+	else
+	{
+		ofstream out(output_file);
+		writeJson(out, trace_name, trace.size(), results);
+		cout << "wrote " << results.size() << " results to " << output_file << endl;
+	}
+	return 0;
+}
@@ -2,12 +2,15 @@
 
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
+#include "redis/SnapshotPublisher.h"
+#include "redis/StampedInput.h"
 #include "timer/LoopTimer.h"
 #include "tasks/JointTask.h"
 #include "tasks/PosOriTask.h"
 #include "haptic_tasks/HapticController.h"
 #include "filters/ButterworthFilter.h"
-#include "Logger.h"
+#include "filters/StreamResampler.h"
+#include "logger/Logger.h"
 
 #include "ForceSpaceParticleFilter_weight_mem.h"
 
@@ -103,6 +106,9 @@ string JOINT_VELOCITIES_KEY = "sai2::PandaApplications::18::simviz_panda::sensor
 string ROBOT_COMMAND_TORQUES_KEY = "sai2::PandaApplications::18::simviz_panda::actuators::command_torques";
 
 string ROBOT_SENSED_FORCE_KEY = "sai2::PandaApplications::18::simviz_panda::sensors::sensed_force";
+// time at which the simviz sampled the sensed force. the sensor driver does not stamp it, the
+// samples are then stamped when they arrive
+string ROBOT_STATE_STAMP_KEY = "sai2::PandaApplications::18::simviz_panda::sensors::state_stamp";
 
 string PARTICLE_POSITIONS_KEY = "sai2::PandaApplications::18::simviz_panda::particle_positions";
 
@@ -137,7 +143,6 @@ Vector3d measured_force_pfilter;
 
 // particle filter parameters
 const int n_particles = 70;
-MatrixXd particle_positions_to_redis;
 
 // const double percent_chance_contact_appears = 0.01;
 const double percent_chance_contact_disapears = 0.95;
@@ -203,6 +208,7 @@ int main() {
 		MASSMATRIX_KEY = "sai2::FrankaPanda::Bonnie::sensors::model::massmatrix";
 		CORIOLIS_KEY = "sai2::FrankaPanda::Bonnie::sensors::model::coriolis";
 		ROBOT_SENSED_FORCE_KEY = "sai2::ATIGamma_Sensor::Bonnie::force_torque";
+		ROBOT_STATE_STAMP_KEY = "";
 	}
 
 	// start redis client
@@ -214,9 +220,6 @@ int main() {
 	signal(SIGTERM, &sighandler);
 	signal(SIGINT, &sighandler);
 
-	// prepare particles
-	particle_positions_to_redis = MatrixXd::Zero(3,n_particles);
-
 	// load robots
 	Affine3d T_workd_robot = Affine3d::Identity();
 	T_workd_robot.translation() = Vector3d(0, 0, 0);
@@ -291,6 +294,9 @@ int main() {
 
 	VectorXd sensed_force_moment_local_frame = VectorXd::Zero(6);
 	VectorXd sensed_force_moment_world_frame = VectorXd::Zero(6);
+	// the particle filter gets the sensed force of the ticks, aligned on them one period late
+	PandaUtils::StreamResampler<6> sensed_force_stream(6);
+	Vector3d aligned_sensed_force_world_frame = Vector3d::Zero();
 	VectorXd force_bias = VectorXd::Zero(6);
 	double tool_mass = 0;
 	Vector3d tool_com = Vector3d::Zero();
@@ -374,7 +380,8 @@ int main() {
     redis_client.addEigenToReadCallback(0, JOINT_ANGLES_KEY, robot->_q);
     redis_client.addEigenToReadCallback(0, JOINT_VELOCITIES_KEY, robot->_dq);
 
-    redis_client.addEigenToReadCallback(0, ROBOT_SENSED_FORCE_KEY, sensed_force_moment_local_frame);
+    PandaUtils::StampedInput sensed_force_input(ROBOT_SENSED_FORCE_KEY, ROBOT_STATE_STAMP_KEY, 6);
+    sensed_force_input.addToReadCallback(redis_client, 0);
 
     MatrixXd mass_from_robot = MatrixXd::Identity(dof,dof);
     VectorXd coriolis_from_robot = VectorXd::Zero(dof);
@@ -446,6 +453,12 @@ int main() {
 
 		// read haptic state and robot state
 		redis_client.executeReadCallback(0);
+		const double read_time = PandaUtils::monotonicMicroseconds();
+		if(sensed_force_input.receive(read_time))
+		{
+			sensed_force_stream.push(sensed_force_input.time(), sensed_force_input.value());
+		}
+		sensed_force_moment_local_frame = sensed_force_input.value();
 		if(flag_simulation)
 		{
 			robot->updateModel();
@@ -482,6 +495,10 @@ int main() {
 
 		debug_force_world_frame = sensed_force_moment_world_frame.head(3);
 
+		// same compensation of the aligned sensed force
+		const Matrix<double,6,1>& aligned_sensed_force = sensed_force_stream.sample(read_time * 1e-6 - 1.0/control_loop_freq);
+		aligned_sensed_force_world_frame = R_world_sensor * (aligned_sensed_force.head<3>() - force_bias.head<3>() + p_tool_local_frame - init_force);
+
 
 
 		// cout << "sensed force moment local frame after ee compensation : " << sensed_force_moment_local_frame.transpose() << endl;
@@ -694,7 +711,7 @@ int main() {
 		pfilter_motion_control_buffer.push(sigma_position_global * posori_task->_linear_motion_control * freq_ratio_filter_control);
 		pfilter_force_control_buffer.push(sigma_force_global * posori_task->_linear_force_control * freq_ratio_filter_control);
 		pfilter_sensed_velocity_buffer.push(posori_task->_current_velocity * freq_ratio_filter_control);
-		pfilter_sensed_force_buffer.push(sensed_force_moment_world_frame.head(3) * freq_ratio_filter_control);
+		pfilter_sensed_force_buffer.push(aligned_sensed_force_world_frame * freq_ratio_filter_control);
 
 		motion_control_pfilter += pfilter_motion_control_buffer.back();
 		force_control_pfilter += pfilter_force_control_buffer.back();
@@ -846,9 +863,9 @@ void communication()
 void particle_filter()
 {
 
-	// start redis client for particles
-	auto redis_client_particles = RedisClient();
-	redis_client_particles.connect();
+	// snapshots of the particles for the visualizers, sent by a thread of their own
+	PandaUtils::SnapshotPublisher particle_publisher(PARTICLE_POSITIONS_KEY, 3, n_particles, 30.0);
+	particle_publisher.start();
 
 	unsigned long long pf_counter = 0;
 
@@ -1019,15 +1036,21 @@ void particle_filter()
 
 		previous_force_space_dimension = force_space_dimension;
 
-		for(int i=0 ; i<n_particles ; i++)
+		if(particle_publisher.due())
 		{
-			particle_positions_to_redis.col(i) = pfilter->_particles[i];
+			Eigen::Ref<MatrixXd> particle_snapshot = particle_publisher.snapshot(pfilter->_particles.size());
+			for(int i=0 ; i<particle_snapshot.cols() ; i++)
+			{
+				particle_snapshot.col(i) = pfilter->_particles[i];
+			}
+			particle_publisher.publish();
 		}
-		redis_client_particles.setEigenMatrixJSON(PARTICLE_POSITIONS_KEY, particle_positions_to_redis);
 
 		pf_counter++;
 	}
 
+	particle_publisher.stop();
+
 	double end_time = timer.elapsedTime();
 	std::cout << "\n";
 	std::cout << "Particle Filter Loop run time  : " << end_time << " seconds\n";
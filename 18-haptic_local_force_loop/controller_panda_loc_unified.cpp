@@ -2,12 +2,16 @@
 
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
+#include "redis/SnapshotPublisher.h"
 #include "timer/LoopTimer.h"
 #include "tasks/JointTask.h"
 #include "tasks/PosOriTask.h"
 #include "haptic_tasks/HapticController.h"
 #include "filters/ButterworthFilter.h"
-#include "Logger.h"
+#include "logger/Logger.h"
+#include "haptics/ForceSpaceUpdates.h"
+#include "haptics/HapticRecording.h"
+#include "sim/SimClock.h"
 
 #include "ForceSpaceParticleFilter_weight_mem.h"
 
@@ -117,6 +121,13 @@ RedisClient redis_client;
 void particle_filter();
 void communication();
 
+// loop clock of the controller, the communication and particle filter threads tick on it
+PandaUtils::SimClock* control_clock = NULL;
+const double communication_freq = 50.0;
+const double pfilter_freq = 15.0;
+int communication_consumer = 0;
+int particle_filter_consumer = 0;
+
 Vector3d delayed_robot_position = Vector3d::Zero();
 Vector3d delayed_haptic_position = Vector3d::Zero();
 Vector3d delayed_haptic_velocity = Vector3d::Zero();
@@ -129,6 +140,9 @@ Vector3d haptic_velocity_global = Vector3d::Zero();
 Vector3d sensed_force_global = Vector3d::Zero();
 Matrix3d sigma_force_global = Matrix3d::Zero();
 Matrix3d sigma_motion_global = Matrix3d::Identity();
+// force space of sigma_force_global, sent to the haptic side when it changes
+int force_space_dimension_global = 0;
+Vector3d force_space_axis_global = Vector3d::Zero();
 
 Vector3d motion_control_pfilter;
 Vector3d force_control_pfilter;
@@ -137,7 +151,6 @@ Vector3d measured_force_pfilter;
 
 // particle filter parameters
 const int n_particles = 1000;
-MatrixXd particle_positions_to_redis;
 
 // const double percent_chance_contact_appears = 0.01;
 const double percent_chance_contact_disapears = 0.95;
@@ -194,7 +207,11 @@ const std::string currentDateTime() {
 const bool flag_simulation = false;
 // const bool flag_simulation = true;
 
-int main() {
+int main(int argc, char** argv) {
+
+	// app --record-haptics <file> records the device state, app --replay-haptics <file> replays it
+	// in place of the device, app --time-scale <scale> runs the loops faster than real time
+	const PandaUtils::HapticRecordingOptions haptic_recording = PandaUtils::HapticRecordingOptions::fromArgs(argc, argv);
 
 	if(!flag_simulation)
 	{
@@ -215,9 +232,6 @@ int main() {
 	signal(SIGTERM, &sighandler);
 	signal(SIGINT, &sighandler);
 
-	// prepare particles
-	particle_positions_to_redis = MatrixXd::Zero(3,n_particles);
-
 	// load robots
 	Affine3d T_workd_robot = Affine3d::Identity();
 	T_workd_robot.translation() = Vector3d(0, 0, 0);
@@ -388,14 +402,18 @@ int main() {
 	redis_client.createWriteCallback(0);
 
 	// Objects to read from redis
-    redis_client.addEigenToReadCallback(0, DEVICE_POSITION_KEYS[0], teleop_task->_current_position_device);
-    redis_client.addEigenToReadCallback(0, DEVICE_ROTATION_KEYS[0], teleop_task->_current_rotation_device);
-    redis_client.addEigenToReadCallback(0, DEVICE_TRANS_VELOCITY_KEYS[0], teleop_task->_current_trans_velocity_device);
-    redis_client.addEigenToReadCallback(0, DEVICE_ROT_VELOCITY_KEYS[0], teleop_task->_current_rot_velocity_device);
-    redis_client.addEigenToReadCallback(0, DEVICE_SENSED_FORCE_KEYS[0], teleop_task->_sensed_force_device);
-    redis_client.addEigenToReadCallback(0, DEVICE_SENSED_TORQUE_KEYS[0], teleop_task->_sensed_torque_device);
-    redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_POSITION_KEYS[0], teleop_task->_current_position_gripper_device);
-    redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_VELOCITY_KEYS[0], teleop_task->_current_gripper_velocity_device);
+	// the replay writes the device fields
+	if(!haptic_recording.replaying())
+	{
+		redis_client.addEigenToReadCallback(0, DEVICE_POSITION_KEYS[0], teleop_task->_current_position_device);
+		redis_client.addEigenToReadCallback(0, DEVICE_ROTATION_KEYS[0], teleop_task->_current_rotation_device);
+		redis_client.addEigenToReadCallback(0, DEVICE_TRANS_VELOCITY_KEYS[0], teleop_task->_current_trans_velocity_device);
+		redis_client.addEigenToReadCallback(0, DEVICE_ROT_VELOCITY_KEYS[0], teleop_task->_current_rot_velocity_device);
+		redis_client.addEigenToReadCallback(0, DEVICE_SENSED_FORCE_KEYS[0], teleop_task->_sensed_force_device);
+		redis_client.addEigenToReadCallback(0, DEVICE_SENSED_TORQUE_KEYS[0], teleop_task->_sensed_torque_device);
+		redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_POSITION_KEYS[0], teleop_task->_current_position_gripper_device);
+		redis_client.addDoubleToReadCallback(0, DEVICE_GRIPPER_VELOCITY_KEYS[0], teleop_task->_current_gripper_velocity_device);
+	}
 
     redis_client.addEigenToReadCallback(0, JOINT_ANGLES_KEY, robot->_q);
     redis_client.addEigenToReadCallback(0, JOINT_VELOCITIES_KEY, robot->_dq);
@@ -412,9 +430,13 @@ int main() {
 
 	// Objects to write to redis
 	//write haptic commands
-	redis_client.addEigenToWriteCallback(0, DEVICE_COMMANDED_FORCE_KEYS[0], teleop_task->_commanded_force_device);
-	redis_client.addEigenToWriteCallback(0, DEVICE_COMMANDED_TORQUE_KEYS[0], teleop_task->_commanded_torque_device);
-	redis_client.addDoubleToWriteCallback(0, DEVICE_COMMANDED_GRIPPER_FORCE_KEYS[0], teleop_task->_commanded_gripper_force_device);
+	// no live device to command in replay
+	if(!haptic_recording.replaying())
+	{
+		redis_client.addEigenToWriteCallback(0, DEVICE_COMMANDED_FORCE_KEYS[0], teleop_task->_commanded_force_device);
+		redis_client.addEigenToWriteCallback(0, DEVICE_COMMANDED_TORQUE_KEYS[0], teleop_task->_commanded_torque_device);
+		redis_client.addDoubleToWriteCallback(0, DEVICE_COMMANDED_GRIPPER_FORCE_KEYS[0], teleop_task->_commanded_gripper_force_device);
+	}
 
 	redis_client.addEigenToWriteCallback(0, ROBOT_COMMAND_TORQUES_KEY, command_torques);
 
@@ -448,30 +470,48 @@ int main() {
 
 	logger->start();
 
+	PandaUtils::HapticRecorder* haptic_recorder = NULL;
+	PandaUtils::HapticReplay* haptic_replay = NULL;
+	if(haptic_recording.recording())
+	{
+		haptic_recorder = new PandaUtils::HapticRecorder(haptic_recording.record_path);
+	}
+	else if(haptic_recording.replaying())
+	{
+		haptic_replay = new PandaUtils::HapticReplay(haptic_recording.replay_path);
+	}
+
+	control_clock = new PandaUtils::SimClock(PandaUtils::SimClock::timeScale(argc, argv, 1.0, false));
+	communication_consumer = control_clock->addConsumer(1.0/communication_freq);
+	particle_filter_consumer = control_clock->addConsumer(1.0/pfilter_freq);
+
 	runloop = true;
 	thread particle_filter_thread(particle_filter);
 	thread communication_thread(communication);
 
-	// create a timer
+	// loop timing
 	double control_loop_freq = 1000.0;
 	unsigned long long controller_counter = 0;
-	LoopTimer timer;
-	timer.initializeTimer();
-	timer.setLoopFrequency(control_loop_freq); //Compiler en mode release
 	double current_time = 0;
 	double prev_time = 0;
 	// double dt = 0;
-	bool fTimerDidSleep = true;
-	double start_time = timer.elapsedTime(); //secs
 
-	while (runloop)
+	while (runloop && control_clock->waitForNextStep(1.0/control_loop_freq))
 	{
-		// wait for next scheduled loop
-		timer.waitForNextLoop();
-		current_time = timer.elapsedTime() - start_time;
+		current_time = control_clock->time();
 
 		// read haptic state and robot state
 		redis_client.executeReadCallback(0);
+		if(haptic_replay != NULL && !haptic_replay->readDevice(*teleop_task, current_time))
+		{
+			// end of the recording
+			runloop = false;
+			break;
+		}
+		if(haptic_recorder != NULL)
+		{
+			haptic_recorder->record(*teleop_task, controller_counter, current_time);
+		}
 		if(flag_simulation)
 		{
 			robot->updateModel();
@@ -610,6 +650,8 @@ int main() {
 					posori_task->setForceAxis(force_axis);
 				}
 				sigma_force_global = force_axis * force_axis.transpose();
+				force_space_dimension_global = 1;
+				force_space_axis_global = force_axis;
 			}
 			else if(force_space_dimension_controller == 2)
 			{
@@ -622,6 +664,8 @@ int main() {
 					posori_task->setLinearMotionAxis(motion_axis);
 				}
 				sigma_force_global = Matrix3d::Identity() - motion_axis * motion_axis.transpose();
+				force_space_dimension_global = 2;
+				force_space_axis_global = motion_axis;
 			}
 			else if(force_space_dimension_controller == 3)
 			{
@@ -630,6 +674,8 @@ int main() {
 					posori_task->setFullForceControl();
 				}
 				sigma_force_global.setIdentity();
+				force_space_dimension_global = 3;
+				force_space_axis_global = Vector3d::Zero();
 			}
 			else
 			{
@@ -638,6 +684,8 @@ int main() {
 					posori_task->setFullLinearMotionControl();
 				}
 				sigma_force_global.setZero();
+				force_space_dimension_global = 0;
+				force_space_axis_global = Vector3d::Zero();
 			}
 
 
@@ -906,19 +954,31 @@ int main() {
 
 	logger->stop();
 
+	control_clock->stop();
 	communication_thread.join();
 	particle_filter_thread.join();
 
 	//// Send zero force/torque to robot and haptic device through Redis keys ////
-	redis_client.setEigenMatrixJSON(DEVICE_COMMANDED_FORCE_KEYS[0], Vector3d::Zero());
-	redis_client.setEigenMatrixJSON(DEVICE_COMMANDED_TORQUE_KEYS[0], Vector3d::Zero());
-	redis_client.set(DEVICE_COMMANDED_GRIPPER_FORCE_KEYS[0], "0.0");
+	if(!haptic_recording.replaying())
+	{
+		redis_client.setEigenMatrixJSON(DEVICE_COMMANDED_FORCE_KEYS[0], Vector3d::Zero());
+		redis_client.setEigenMatrixJSON(DEVICE_COMMANDED_TORQUE_KEYS[0], Vector3d::Zero());
+		redis_client.set(DEVICE_COMMANDED_GRIPPER_FORCE_KEYS[0], "0.0");
+	}
+
+	delete haptic_recorder;
+	if(haptic_replay != NULL)
+	{
+		cout << "haptic replay : " << haptic_replay->samples() << " samples" << endl;
+		delete haptic_replay;
+	}
 
-	double end_time = timer.elapsedTime();
+	double end_time = control_clock->time();
 	std::cout << "\n";
-	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
-	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
-    std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+	std::cout << "Controller Loop run time  : " << end_time << " seconds of loop time\n";
+	std::cout << "Controller Loop updates   : " << controller_counter << "\n";
+    std::cout << "Controller Loop frequency : " << controller_counter/end_time << "Hz of loop time\n";
+	std::cout << "Time scale                : " << control_clock->measuredTimeScale() << "\n";
 
 
 }
@@ -931,25 +991,24 @@ void communication()
 	queue<Vector3d> haptic_position_buffer;
 	queue<Vector3d> haptic_velocity_buffer;
 	queue<Vector3d> sensed_force_buffer;
-	queue<Matrix3d> sigma_force_buffer;
-
-	// create a timer
-	double communication_freq = 50.0;
-	LoopTimer timer;
-	timer.initializeTimer();
-	timer.setLoopFrequency(communication_freq); //Compiler en mode release
+	// the force space goes as event driven updates : on a change of dimension, a turn of the
+	// axis of more than 2 degrees, or a keyframe every 0.5 s
+	PandaUtils::ForceSpaceEncoder force_space_encoder(2.0 * M_PI / 180.0, 25);
+	PandaUtils::ForceSpaceDecoder force_space_decoder;
+	PandaUtils::ForceSpaceUpdate force_space_update;
+	queue<pair<unsigned long long, PandaUtils::ForceSpaceUpdate>> force_space_buffer;
+	unsigned long long n_cycles = 0;
+
+	// loop timing
 	double current_time = 0;
 	double prev_time = 0;
 	// double dt = 0;
-	bool fTimerDidSleep = true;
-	double start_time = timer.elapsedTime(); //secs
 
 	unsigned long long communication_counter = 0;
 	const int communication_delay_ncycles = communication_delay_ms / 1000.0 * communication_freq;
 	
-	while(runloop)
+	while(runloop && control_clock->waitForNextLoop(communication_consumer))
 	{
-		timer.waitForNextLoop();
 
 		if(communication_delay_ncycles == 0)
 		{
@@ -957,7 +1016,6 @@ void communication()
 			delayed_haptic_velocity = haptic_velocity_global;
 			delayed_robot_position = robot_position_global;
 			delayed_sensed_force = sensed_force_global;
-			delayed_sigma_force = sigma_force_global;
 		}
 		else
 		{
@@ -965,7 +1023,6 @@ void communication()
 			haptic_velocity_buffer.push(haptic_velocity_global);
 			robot_position_buffer.push(robot_position_global);
 			sensed_force_buffer.push(sensed_force_global);
-			sigma_force_buffer.push(sigma_force_global);
 
 			if(communication_counter > communication_delay_ncycles)
 			{
@@ -973,13 +1030,11 @@ void communication()
 				delayed_haptic_velocity = haptic_velocity_buffer.front();
 				delayed_robot_position = robot_position_buffer.front();
 				delayed_sensed_force = sensed_force_buffer.front();
-				delayed_sigma_force = sigma_force_buffer.front();
 
 				haptic_position_buffer.pop();
 				haptic_velocity_buffer.pop();
 				robot_position_buffer.pop();
 				sensed_force_buffer.pop();
-				sigma_force_buffer.pop();
 
 				communication_counter--;
 			}
@@ -987,18 +1042,36 @@ void communication()
 		}
 
 
+		// the updates arrive after the delay, fixed in cycles as the other buffers
+		if(force_space_encoder.update(force_space_dimension_global, force_space_axis_global, force_space_update))
+		{
+			force_space_buffer.push(make_pair(n_cycles, force_space_update));
+		}
+		while(!force_space_buffer.empty() && force_space_buffer.front().first + communication_delay_ncycles <= n_cycles)
+		{
+			if(force_space_decoder.apply(force_space_buffer.front().second))
+			{
+				delayed_sigma_force = force_space_decoder.sigmaForce();
+			}
+			force_space_buffer.pop();
+		}
+
 		communication_counter++;
+		n_cycles++;
 	}
 
+	cout << "force space updates : " << force_space_encoder.updates() << " in " << force_space_encoder.calls()
+		<< " cycles, " << force_space_encoder.keyframes() << " keyframes, " << force_space_decoder.changes() << " sigma force changes" << endl;
+
 
 }
 
 void particle_filter()
 {
 
-	// start redis client for particles
-	auto redis_client_particles = RedisClient();
-	redis_client_particles.connect();
+	// snapshots of the particles for the visualizers, sent by a thread of their own
+	PandaUtils::SnapshotPublisher particle_publisher(PARTICLE_POSITIONS_KEY, 3, n_particles, 30.0);
+	particle_publisher.start();
 
 	unsigned long long pf_counter = 0;
 
@@ -1026,20 +1099,13 @@ void particle_filter()
 	Vector3d evals = Vector3d::Zero();
 	Matrix3d evecs = Matrix3d::Identity();
 
-	// create a timer
-	double pfilter_freq = 15.0;
-	LoopTimer timer;
-	timer.initializeTimer();
-	timer.setLoopFrequency(pfilter_freq); //Compiler en mode release
+	// loop timing
 	double current_time = 0;
 	double prev_time = 0;
 	// double dt = 0;
-	bool fTimerDidSleep = true;
-	double start_time = timer.elapsedTime(); //secs
 
-	while(runloop)
+	while(runloop && control_clock->waitForNextLoop(particle_filter_consumer))
 	{
-		timer.waitForNextLoop();
 
 
 		pfilter->_force_space_dimension = force_space_dimension;
@@ -1276,18 +1342,24 @@ void particle_filter()
 
 		// previous_force_space_dimension = force_space_dimension;
 
-		for(int i=0 ; i<n_particles ; i++)
+		if(particle_publisher.due())
 		{
-			particle_positions_to_redis.col(i) = pfilter->_particles[i];
+			Eigen::Ref<MatrixXd> particle_snapshot = particle_publisher.snapshot(pfilter->_particles.size());
+			for(int i=0 ; i<particle_snapshot.cols() ; i++)
+			{
+				particle_snapshot.col(i) = pfilter->_particles[i];
+			}
+			particle_publisher.publish();
 		}
-		redis_client_particles.setEigenMatrixJSON(PARTICLE_POSITIONS_KEY, particle_positions_to_redis);
 
 		pf_counter++;
 	}
 
-	double end_time = timer.elapsedTime();
+	particle_publisher.stop();
+
+	double end_time = control_clock->time();
 	std::cout << "\n";
-	std::cout << "Particle Filter Loop run time  : " << end_time << " seconds\n";
-	std::cout << "Particle Filter Loop updates   : " << timer.elapsedCycles() << "\n";
-    std::cout << "Particle Filter Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+	std::cout << "Particle Filter Loop run time  : " << end_time << " seconds of loop time\n";
+	std::cout << "Particle Filter Loop updates   : " << pf_counter << "\n";
+    std::cout << "Particle Filter Loop frequency : " << pf_counter/end_time << "Hz of loop time\n";
 }
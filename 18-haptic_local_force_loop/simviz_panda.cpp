@@ -5,7 +5,12 @@
 #include "Sai2Simulation.h"
 #include <dynamics3d.h>
 #include "redis/RedisClient.h"
+#include "redis/RedisBinaryEigen.h"
+#include "graphics/ParticleCloud.h"
 #include "timer/LoopTimer.h"
+#include "sim/SimClock.h"
+#include "redis/SequenceStamp.h"
+#include "threads/RealtimeThread.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
 
@@ -48,6 +53,8 @@ const string ROBOT_VEL_KEY = "sai2::PandaApplications::18::simviz_panda::sensors
 const string ROBOT_COMMAND_TORQUES_KEY = "sai2::PandaApplications::18::simviz_panda::actuators::command_torques";
 
 const string ROBOT_SENSED_FORCE_KEY = "sai2::PandaApplications::18::simviz_panda::sensors::sensed_force";
+// time at which the state and the sensed force were sampled, written with them
+const string ROBOT_STATE_STAMP_KEY = "sai2::PandaApplications::18::simviz_panda::sensors::state_stamp";
 
 const string PARTICLE_POSITIONS_KEY = "sai2::PandaApplications::18::simviz_panda::particle_positions";
 
@@ -81,9 +88,15 @@ bool fOnOffRemote = false;
 
 const double coeff_friction = 0.0;
 
-int main() {
+// sim seconds per wall second
+double time_scale = 1.0;
+
+int main(int argc, char** argv) {
 	cout << "Loading URDF world model file: " << world_file << endl;
 
+	// simviz --time-scale 10 to simulate 10 times faster than real time, with the controller at the same scale
+	time_scale = PandaUtils::SimClock::timeScale(argc, argv, 1.0, false);
+
 	// start redis client
 	redis_client = RedisClient();
 	redis_client.connect();
@@ -125,14 +138,12 @@ int main() {
 	// fsensor_display->_force_line_scale = 10.0;
 	fsensor_display->_force_line_scale = 0.001;
 
-	// prepare particle filter visualization
-	// particle filter parameters
-	int n_particles = 500;
+	// prepare particle filter visualization, the particles of the last snapshot of the
+	// controller in one point cloud
+	const int max_particles = 500;
 	MatrixXd particles_from_redis;
-	particles_from_redis.setZero(3,n_particles);
-	redis_client_particles.setEigenMatrixJSON(PARTICLE_POSITIONS_KEY, particles_from_redis);
-	vector<Vector3d> particles;
-	vector<cShapeSphere*> particles_graphics;
+	particles_from_redis.setZero(3,max_particles);
+	PandaUtils::setEigenMatrixBinary(redis_client_particles, PARTICLE_POSITIONS_KEY, particles_from_redis);
 	const double particle_radius = 0.007;
 	cColorf center_particle_color = cColorf(1.0, 0.1, 0.1, 1.0);
 	cColorf sphere_particle_color = cColorf(1.0, 0.0, 0.0, 1.0);
@@ -152,20 +163,9 @@ int main() {
 	circle_particles->setLocalRot(AngleAxisd(M_PI/2, Vector3d::UnitY()).toRotationMatrix());
 	graphics->_world->addChild(circle_particles);
 
-
-	for(int i=0 ; i<n_particles ; i++)
-	{
-		particles.push_back(Vector3d::Zero());
-		particles_graphics.push_back(new chai3d::cShapeSphere(particle_radius));
-		particles_graphics[i]->m_material->setColor(center_particle_color);
-		graphics->_world->addChild(particles_graphics[i]);
-	}
-
-	for(int i=0 ; i<n_particles/3 ; i++)
-	{
-		particles[i] = Vector3d::Random();
-		particles[i].normalize();
-	}
+	PandaUtils::ParticleCloud particle_cloud(graphics->_world, 6.0);
+	Matrix3Xd particle_positions;
+	Matrix4Xf particle_colors;
 
 	/*------- Set up visualization -------*/
 	// set up error callback
@@ -207,27 +207,22 @@ int main() {
 	// while window is open:
 	while (!glfwWindowShouldClose(window) && fSimulationRunning)
 	{
-		particles_from_redis = redis_client_particles.getEigenMatrixJSON(PARTICLE_POSITIONS_KEY);
+		// the snapshot can hold any number of particles
+		PandaUtils::getEigenMatrixBinary(redis_client_particles, PARTICLE_POSITIONS_KEY, particles_from_redis);
+		const int n_particles = particles_from_redis.cols();
+		particle_positions.resize(3, n_particles);
+		particle_colors.resize(4, n_particles);
 
 		for(int i=0 ; i<n_particles ; i++)
 		{
-			particles[i] = particles_from_redis.col(i);
-		}
-
-
-		for(int i=0 ; i<n_particles ; i++)
-		{
-			Vector3d particle_pos_circle = particles[i];
+			Vector3d particle_pos_circle = particles_from_redis.col(i);
 			double particle_x = particle_pos_circle(0);
 			particle_pos_circle(0) = center_graphic_representation(0);
-			particles_graphics[i]->setLocalPos(center_graphic_representation + graphic_representation_radius * particle_pos_circle);
-			if(particles[i].norm() < 1e-3)
+			particle_positions.col(i) = center_graphic_representation + graphic_representation_radius * particle_pos_circle;
+			cColorf particle_color = center_particle_color;
+			if(particles_from_redis.col(i).norm() >= 1e-3)
 			{
-				particles_graphics[i]->m_material->setColor(center_particle_color);
-			}
-			else
-			{
-				cColorf particle_color = sphere_particle_color;
+				particle_color = sphere_particle_color;
 				if(particle_x >= 0)
 				{
 					particle_color.m_color[1] = particle_x;
@@ -236,10 +231,10 @@ int main() {
 				{
 					particle_color.m_color[2] = -particle_x;
 				}
-
-				particles_graphics[i]->m_material->setColor(particle_color);
 			}
+			particle_colors.col(i) << particle_color.m_color[0], particle_color.m_color[1], particle_color.m_color[2], particle_color.m_color[3];
 		}
+		particle_cloud.update(particle_positions, particle_colors);
 
 		fsensor_display->update();
 		// update graphics. this automatically waits for the correct amount of time
@@ -362,19 +357,19 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, Fo
 	redis_client.addEigenToWriteCallback(0, ROBOT_POS_KEY, robot->_q);
 	redis_client.addEigenToWriteCallback(0, ROBOT_VEL_KEY, robot->_dq);
 	redis_client.addEigenToWriteCallback(0, ROBOT_SENSED_FORCE_KEY, sensed_force_moment);
+	PandaUtils::SequenceStamper state_stamper;
+	VectorXd state_stamp = VectorXd::Zero(2);
+	redis_client.addEigenToWriteCallback(0, ROBOT_STATE_STAMP_KEY, state_stamp);
 
-	// create a timer
+	// sim time, paced at the time scale
 	double sim_frequency = 1000.0;
-	LoopTimer timer;
-	timer.initializeTimer();
-	timer.setLoopFrequency(sim_frequency);
-	double last_time = timer.elapsedTime(); //secs
-	bool fTimerDidSleep = true;
+	PandaUtils::SimClock sim_clock(time_scale);
 
 	unsigned long long simulation_counter = 0;
 
-	while (fSimulationRunning) {
-		fTimerDidSleep = timer.waitForNextLoop();
+	PandaUtils::configureRealtimeThread("simulation", PandaUtils::RealtimeConfig::fifo(70, PandaUtils::simulationCpus()));
+
+	while (fSimulationRunning && sim_clock.waitForNextStep(1.0/sim_frequency)) {
 
 		// particle pos from controller
 		redis_client.executeReadCallback(0);
@@ -402,16 +397,18 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, Fo
 		
 		sensed_force_moment << -sensed_force, -sensed_moment;
 
+		state_stamp = state_stamper.next();
 		redis_client.executeWriteCallback(0);
 
 		simulation_counter++;
 	}
 
-	double end_time = timer.elapsedTime();
+	double end_time = sim_clock.time();
 	std::cout << "\n";
-	std::cout << "Simulation Loop run time  : " << end_time << " seconds\n";
-	std::cout << "Simulation Loop updates   : " << timer.elapsedCycles() << "\n";
-	std::cout << "Simulation Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+	std::cout << "Simulation Loop run time  : " << end_time << " seconds of sim time\n";
+	std::cout << "Simulation Loop updates   : " << simulation_counter << "\n";
+	std::cout << "Simulation Loop frequency : " << simulation_counter/end_time << "Hz of sim time\n";
+	std::cout << "Time scale                : " << sim_clock.measuredTimeScale() << "\n";
 }
 
 //------------------------------------------------------------------------------
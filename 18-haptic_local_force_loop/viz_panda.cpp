@@ -4,6 +4,8 @@
 #include "Sai2Graphics.h"
 #include <dynamics3d.h>
 #include "redis/RedisClient.h"
+#include "redis/RedisBinaryEigen.h"
+#include "graphics/ParticleCloud.h"
 #include "timer/LoopTimer.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
@@ -83,14 +85,12 @@ int main() {
 	Vector3d camera_pos, camera_lookat, camera_vertical;
 	graphics->getCameraPose(camera_name, camera_pos, camera_vertical, camera_lookat);
 
-	// prepare particle filter visualization
-	// particle filter parameters
-	int n_particles = 1000;
+	// prepare particle filter visualization, the particles of the last snapshot of the
+	// controller in one point cloud
+	const int max_particles = 1000;
 	MatrixXd particles_from_redis;
-	particles_from_redis.setZero(3,n_particles);
-	redis_client_particles.setEigenMatrixJSON(PARTICLE_POSITIONS_KEY, particles_from_redis);
-	vector<Vector3d> particles;
-	vector<cShapeSphere*> particles_graphics;
+	particles_from_redis.setZero(3,max_particles);
+	PandaUtils::setEigenMatrixBinary(redis_client_particles, PARTICLE_POSITIONS_KEY, particles_from_redis);
 	const double particle_radius = 0.007;
 	cColorf center_particle_color = cColorf(1.0, 0.1, 0.1, 1.0);
 	cColorf sphere_particle_color = cColorf(1.0, 0.0, 0.0, 1.0);
@@ -110,20 +110,9 @@ int main() {
 	circle_particles->setLocalRot(AngleAxisd(M_PI/2, Vector3d::UnitY()).toRotationMatrix());
 	graphics->_world->addChild(circle_particles);
 
-
-	for(int i=0 ; i<n_particles ; i++)
-	{
-		particles.push_back(Vector3d::Zero());
-		particles_graphics.push_back(new chai3d::cShapeSphere(particle_radius));
-		particles_graphics[i]->m_material->setColor(center_particle_color);
-		graphics->_world->addChild(particles_graphics[i]);
-	}
-
-	for(int i=0 ; i<n_particles/3 ; i++)
-	{
-		particles[i] = Vector3d::Random();
-		particles[i].normalize();
-	}
+	PandaUtils::ParticleCloud particle_cloud(graphics->_world, 6.0);
+	Matrix3Xd particle_positions;
+	Matrix4Xf particle_colors;
 
 	/*------- Set up visualization -------*/
 	// set up error callback
@@ -164,27 +153,22 @@ int main() {
 	// while window is open:
 	while (!glfwWindowShouldClose(window) && fSimulationRunning)
 	{
-		particles_from_redis = redis_client_particles.getEigenMatrixJSON(PARTICLE_POSITIONS_KEY);
-
-		for(int i=0 ; i<n_particles ; i++)
-		{
-			particles[i] = particles_from_redis.col(i);
-		}
-
+		// the snapshot can hold any number of particles
+		PandaUtils::getEigenMatrixBinary(redis_client_particles, PARTICLE_POSITIONS_KEY, particles_from_redis);
+		const int n_particles = particles_from_redis.cols();
+		particle_positions.resize(3, n_particles);
+		particle_colors.resize(4, n_particles);
 
 		for(int i=0 ; i<n_particles ; i++)
 		{
-			Vector3d particle_pos_circle = particles[i];
+			Vector3d particle_pos_circle = particles_from_redis.col(i);
 			double particle_x = particle_pos_circle(0);
 			particle_pos_circle(0) = center_graphic_representation(0);
-			particles_graphics[i]->setLocalPos(center_graphic_representation + graphic_representation_radius * particle_pos_circle);
-			if(particles[i].norm() < 1e-3)
+			particle_positions.col(i) = center_graphic_representation + graphic_representation_radius * particle_pos_circle;
+			cColorf particle_color = center_particle_color;
+			if(particles_from_redis.col(i).norm() >= 1e-3)
 			{
-				particles_graphics[i]->m_material->setColor(center_particle_color);
-			}
-			else
-			{
-				cColorf particle_color = sphere_particle_color;
+				particle_color = sphere_particle_color;
 				if(particle_x >= 0)
 				{
 					particle_color.m_color[1] = particle_x;
@@ -193,10 +177,10 @@ int main() {
 				{
 					particle_color.m_color[2] = -particle_x;
 				}
-
-				particles_graphics[i]->m_material->setColor(particle_color);
 			}
+			particle_colors.col(i) << particle_color.m_color[0], particle_color.m_color[1], particle_color.m_color[2], particle_color.m_color[3];
 		}
+		particle_cloud.update(particle_positions, particle_colors);
 
 		// update graphics. this automatically waits for the correct amount of time
 		int width, height;
@@ -9,6 +9,9 @@
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
 #include "uiforce/UIForceWidget.h"
+#include "sim/HeadlessSimviz.h"
+#include "sim/AdaptiveStepper.h"
+#include "threads/RealtimeThread.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
 
@@ -36,6 +39,10 @@ const string TORQUES_COMMANDED_KEY  = "sai2::PandaApplication::actuators::fgc";
 
 RedisClient redis_client;
 
+// one integration step per loop in free space, substeps in contact, with --adaptive-substeps
+// (see sim/AdaptiveStepper.h)
+bool flag_adaptive_substeps = false;
+
 // simulation function prototype
 void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, UIForceWidget *ui_force_widget);
 
@@ -65,9 +72,13 @@ VectorXd ui_force_command_torques;
 // const bool flag_simulation = false;
 const bool flag_simulation = true;
 
-int main() {
+int main(int argc, char** argv) {
+	flag_adaptive_substeps = PandaUtils::AdaptiveStepper::requested(argc, argv);
 	cout << "Loading URDF world model file: " << world_file << endl;
 
+	// simviz --headless to run the simulation without window, see sim/HeadlessSimviz.h
+	PandaUtils::SimvizMode simviz_mode(argc, argv);
+
 	// start redis client
 	redis_client = RedisClient();
 	redis_client.connect();
@@ -107,6 +118,21 @@ int main() {
 	ui_force_command_torques.setZero(dof);
 
 
+	// start simulation hread
+	fSimulationRunning = true;
+	thread sim_thread(simulation, robot, sim, ui_force_widget);
+
+	if(simviz_mode.headless)
+	{
+		auto update_graphics = [&]()
+		{
+			graphics->updateGraphics(robot_name, robot);
+		};
+		PandaUtils::runHeadless(simviz_mode, graphics, camera_name, update_graphics, fSimulationRunning);
+		sim_thread.join();
+		return 0;
+	}
+
 	/*------- Set up visualization -------*/
 	// set up error callback
 	glfwSetErrorCallback(glfwError);
@@ -141,10 +167,6 @@ int main() {
 	// cache variables
 	double last_cursorx, last_cursory;
 
-	// start simulation hread
-	fSimulationRunning = true;
-	thread sim_thread(simulation, robot, sim, ui_force_widget);
-
 	// while window is open:
 	while (!glfwWindowShouldClose(window))
 	{
@@ -272,12 +294,17 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, UI
 	// create a timer
 	LoopTimer timer;
 	timer.initializeTimer();
-	timer.setLoopFrequency(2000); 
+	// at the rate of the controller when the contacts are integrated in substeps
+	timer.setLoopFrequency(flag_adaptive_substeps ? 1000 : 2000); 
 	double last_time = timer.elapsedTime(); //secs
 	bool fTimerDidSleep = true;
 
+	PandaUtils::AdaptiveStepper stepper(sim, robot_name, robot);
+
 	unsigned long long simulation_counter = 0;
 
+	PandaUtils::configureRealtimeThread("simulation", PandaUtils::RealtimeConfig::fifo(70, PandaUtils::simulationCpus()));
+
 	while (fSimulationRunning) {
 		fTimerDidSleep = timer.waitForNextLoop();
 
@@ -304,7 +331,14 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, UI
 		// integrate forward
 		double curr_time = timer.elapsedTime();
 		double loop_dt = curr_time - last_time; 
-		sim->integrate(loop_dt);
+		if(flag_adaptive_substeps)
+		{
+			stepper.integrate(loop_dt);
+		}
+		else
+		{
+			sim->integrate(loop_dt);
+		}
 
 		// read joint positions, velocities, update model
 		sim->getJointPositions(robot_name, robot->_q);
@@ -326,6 +360,10 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, UI
 	cout << "Simulation Loop run time  : " << end_time << " seconds\n";
 	cout << "Simulation Loop updates   : " << timer.elapsedCycles() << "\n";
 	cout << "Simulation Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+	if(flag_adaptive_substeps)
+	{
+		cout << "Mean integration steps    : " << stepper.meanSubsteps() << " per loop, " << 100*stepper.contactFraction() << "% of the loops in contact\n";
+	}
 }
 
 //------------------------------------------------------------------------------
@@ -6,11 +6,17 @@
 #include "Sai2Graphics.h"
 #include "Sai2Simulation.h"
 #include <dynamics3d.h>
-#include "timer/LoopTimer.h"
 #include "uiforce/UIForceWidget.h"
 #include "force_sensor/ForceSensorSim.h"
-#include "MomentumObserver.h"
-#include "Logger.h"
+#include "observers/MomentumObserver.h"
+#include "observers/EstimationStage.h"
+#include "observers/ContactDetector.h"
+#include "logger/Logger.h"
+#include "model/RankOneProjector.h"
+#include "model/FloatingBaseModel.h"
+#include "sim/SimClock.h"
+#include "sim/CoSimScheduler.h"
+#include "threads/RealtimeThread.h"
 
 #include "tasks/JointTask.h"
 #include "tasks/PositionTask.h"
@@ -36,8 +42,18 @@ const string camera_name = "camera_fixed";
 // simulation function prototype
 void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, UIForceWidget *ui_force_widget, ForceSensorSim* force_sensor);
 unsigned long long controller_counter = 0;
+
+// writes the log files of the app from a single thread
+Logging::LoggingService log_service;
 void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim);
 
+// schedule of the simulation and control threads, 2 simulation steps per control step.
+// app20 --time-scale 10 runs 10 times faster than real time, --time-scale 0 as fast as
+// possible, and --pipelined runs the control step of a period next to its simulation steps
+PandaUtils::CoSimScheduler* scheduler = NULL;
+const double sim_dt = 0.0005;
+const int sim_steps_per_control = 2;
+
 // Get current date/time, format is YYYY-MM-DD.HH:mm:ss
 const std::string currentDateTime() {
 	time_t     now = time(0);
@@ -79,6 +95,20 @@ const string link_name = "end-effector";
 const Vector3d pos_in_link = Vector3d(0,0,0);
 Vector3d sensed_force;
 Vector3d sensed_moment;
+// written by the simulation, exchanged to the controller
+Vector3d sim_sensed_force = Vector3d::Zero();
+Vector3d sim_sensed_moment = Vector3d::Zero();
+// written by the controller, exchanged to the simulation for the contact estimation
+VectorXd sim_command_torques;
+MatrixXd sim_task_contact_jacobian;
+
+// bracing contact detection at 2 kHz : the simulation thread feeds the momentum observer of
+// the estimation thread every simulation step, the control thread polls the contact events
+typedef PandaUtils::EstimationStage<8> ContactEstimation;
+typedef PandaUtils::ContactDetector<8> BracingDetector;
+ContactEstimation* contact_estimation = NULL;
+BracingDetector* bracing_detector = NULL;
+const int sim_steps_per_estimation = 1;
 
 // debug
 VectorXd tau_contact_from_simulation;
@@ -89,7 +119,7 @@ const bool contact_task = true;
 // const bool flag_simulation = false;
 const bool flag_simulation = true;
 
-int main() {
+int main(int argc, char** argv) {
 	cout << "Loading URDF world model file: " << world_file << endl;
 
 	// load graphics scene
@@ -106,6 +136,26 @@ int main() {
 	Affine3d T_world_robot = sim->getRobotBaseTransform(robot_name);
 	auto robot = new Sai2Model::Sai2Model(robot_file, false, T_world_robot);
 	robot->updateKinematics();
+	// model of the contact estimation thread
+	auto estimation_robot = new Sai2Model::Sai2Model(robot_file, false, T_world_robot);
+
+	// momentum observer and bracing contact detection, on the estimation thread
+	auto momentum_observer = new PandaUtils::MomentumObserver<8>(estimation_robot, sim_dt * sim_steps_per_estimation);
+	double gain = 15.0;
+	momentum_observer->setGain(gain * MatrixXd::Identity(robot->dof(),robot->dof()));
+	// 2 ms window at 2 kHz
+	bracing_detector = new BracingDetector(4, 10.0, 8.0);
+	contact_estimation = new ContactEstimation(estimation_robot);
+	contact_estimation->addEstimator([momentum_observer](const ContactEstimation::Sample& sample, Ref<ContactEstimation::VectorDof> estimate)
+	{
+		momentum_observer->update(sample.command_torques, sample.known_torques);
+		estimate = -momentum_observer->getDisturbanceTorqueEstimate();
+		ContactEstimation::VectorDof bracing_torques = estimate;
+		bracing_torques.tail<3>().setZero();
+		bracing_detector->update(sample.time, bracing_torques);
+	});
+	sim_command_torques.setZero(robot->dof());
+	sim_task_contact_jacobian.setZero(3, robot->dof());
 
 	// force sensor
 	Affine3d T_link_oppoint = Affine3d::Identity();
@@ -165,7 +215,13 @@ int main() {
 	double last_cursorx, last_cursory;
 
 	// start simulation hread
+	scheduler = new PandaUtils::CoSimScheduler(sim_dt, sim_steps_per_control, PandaUtils::SimClock::timeScale(argc, argv),
+			PandaUtils::CoSimScheduler::pipelined(argc, argv));
 	fSimulationRunning = true;
+	// pinned to cpu 0, away from the control and simulation threads
+	log_service.start(0);
+	// pinned to cpu 1
+	contact_estimation->start(1);
 	thread sim_thread(simulation, robot, sim, ui_force_widget, force_sensor);
 	thread control_thread(control, robot, sim);
 
@@ -275,8 +331,11 @@ int main() {
 
 	// stop simulation
 	fSimulationRunning = false;
+	scheduler->stop();
 	sim_thread.join();
 	control_thread.join();
+	contact_estimation->stop();
+	log_service.stop();
 
 	// destroy context
 	glfwDestroyWindow(window);
@@ -334,7 +393,7 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 	MatrixXd J_shoulder = MatrixXd::Zero(1,dof);
 	MatrixXd Jbar_shoulder = MatrixXd::Zero(dof,1);
 	MatrixXd Lambda_shoulder = MatrixXd::Zero(1,1);
-	MatrixXd N_shoulder = MatrixXd::Zero(dof,dof);
+	PandaUtils::RankOneProjector<8> shoulder_projector(dof);
 	double shoulder_init = robot->_q(0);
 
 	double kp_shoulder = 100.0;
@@ -342,15 +401,17 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 
 	VectorXd shoulder_task_torques;
 
-	// momentum observer
-	auto momentum_observer = new MomentumObserver(robot, 0.001);
-	double gain = 15.0;
-	momentum_observer->setGain(gain * MatrixXd::Identity(dof,dof));
+	// contact estimate and bracing events of the estimation thread
 	VectorXd tau_contact_observed = VectorXd::Zero(dof);
+	VectorXd task_contact_torques = VectorXd::Zero(dof);
+	BracingDetector::Event bracing_event;
+	bool f_bracing_contact = false;
 
 	// bracing task
 	MatrixXd N_bracing = MatrixXd::Zero(dof,dof);
 	MatrixXd range_space_bracing = MatrixXd::Zero(dof,dof);
+	VectorXd j_bracing_estimate = VectorXd::Zero(dof);
+	PandaUtils::RankOneProjector<8> bracing_projector(dof);
 	double alpha = 0;
 	VectorXd bracing_task_torques = VectorXd::Zero(dof);
 
@@ -370,39 +431,70 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 	logger->addVectorToLog(&current_position, "current_position");
 	logger->addVectorToLog(&desired_position, "desired_position");
 
+	// one sample every 10 control ticks, stamped with the control loop time
+	logger->enableCapture();
+	logger->setDecimation(10);
+	logger->useService(log_service);
 	logger->start();
 
-	// create a timer
-	LoopTimer timer;
-	timer.initializeTimer();
-	timer.setLoopFrequency(1000); 
-	double start_time = timer.elapsedTime(); //secs
-	bool fTimerDidSleep = true;
+	// full rate binary log of the momentum observer inputs, for the observer_replay tool
+	auto replay_logger = new Logging::Logger(1000, folder + "replay_" + timestamp + ".bin");
+	Matrix4d base_transform = sim->getRobotBaseTransform(robot_name).matrix();
+	replay_logger->addVectorToLog(&robot->_q, "q");
+	replay_logger->addVectorToLog(&robot->_dq, "dq");
+	replay_logger->addVectorToLog(&command_torques, "command_torques");
+	replay_logger->addVectorToLog(&task_contact_torques, "known_torques");
+	replay_logger->addVectorToLog(&base_transform, "base_transform");
+	replay_logger->enableCompression();
+	replay_logger->enableTimeIndex();
+	replay_logger->enableCapture();
+	replay_logger->useService(log_service);
+	replay_logger->start();
+
 	double prev_time = 0;
 
-	while (fSimulationRunning) 
-	{
-		// wait for next scheduled loop
-		timer.waitForNextLoop();
-		double time = timer.elapsedTime() - start_time;
-		double dt = time - prev_time;
+	// mass matrix inverse from the blocks of the rail joint and of the arm
+	PandaUtils::FloatingBaseModel<1,7> floating_base_model;
 
-		// read robot state from redis
+	// the only data shared with the simulation thread
+	scheduler->setExchange([&]()
+	{
+		// read robot state, update model
 		sim->getJointPositions(robot_name, robot->_q);
 		sim->getJointVelocities(robot_name, robot->_dq);
+		robot->updateKinematics();
+		floating_base_model.update(robot);
+		sensed_force = sim_sensed_force;
+		sensed_moment = sim_sensed_moment;
+	},
+	[&]()
+	{
+		sim->setJointTorques(robot_name, command_torques);
+		sim_command_torques = command_torques;
+		sim_task_contact_jacobian = posori_task->_jacobian.block(0,0,3,dof);
+	});
+
+	PandaUtils::configureRealtimeThread("control", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
 
-		// update momentum observer
-		VectorXd task_contact_torques = VectorXd::Zero(dof);
+	// wait for the state of the next control step
+	while (fSimulationRunning && scheduler->waitForControl()) 
+	{
+		double time = scheduler->controlTime();
+		double dt = time - prev_time;
+
+		// latest contact estimate, the momentum observer is fed by the simulation thread
 		task_contact_torques = posori_task->_jacobian.block(0,0,3,dof).transpose() * sensed_force;
-		momentum_observer->update(command_torques, task_contact_torques);
-		tau_contact_observed = momentum_observer->getDisturbanceTorqueEstimate();
+		replay_logger->tick(controller_counter, time);
+		tau_contact_observed = contact_estimation->latestEstimate().disturbance_torques.col(0);
+		while(bracing_detector->poll(bracing_event))
+		{
+			f_bracing_contact = (bracing_event.type == BracingDetector::ONSET);
+		}
 		tau_contact_observed.tail(3) = VectorXd::Zero(3);
 
 		// update sensed force
 		posori_task->updateSensedForceAndMoment(posori_task->_current_orientation.transpose() * sensed_force, Vector3d::Zero());
 
-		// update robot model
-		robot->updateModel();
 		robot->gravityVector(gravity);
 
 		// update tasks models
@@ -413,19 +505,21 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 		N_prec = posori_task->_N;
 
 		J_shoulder = J_shoulder_base * N_prec;
-		robot->operationalSpaceMatrices(Lambda_shoulder, Jbar_shoulder, N_shoulder, J_shoulder, N_prec);
-		N_prec = N_shoulder;
+		shoulder_projector.compute(robot->_M_inv, J_shoulder, N_prec);
+		Lambda_shoulder(0,0) = shoulder_projector.lambda();
+		Jbar_shoulder = shoulder_projector.jbar();
+		N_prec = shoulder_projector.nullspace();
 
-		MatrixXd J_bracing_estimate = tau_contact_observed.transpose() * N_prec;
+		// J_bracing_estimate = tau_contact_observed^T N_prec, as a vector
+		j_bracing_estimate.noalias() = N_prec.transpose() * tau_contact_observed;
 		MatrixXd Proj_bracing = MatrixXd::Zero(dof,dof);
-		if(tau_contact_observed.norm() > 10.0)
+		if(f_bracing_contact)
 		{
-			MatrixXd Lambda_bracing = MatrixXd::Zero(1,1);
-			MatrixXd Jbar_bracing = MatrixXd::Zero(dof,1);
 			// robot->nullspaceMatrix(N_bracing, J_bracing_estimate, N_prec);
-			robot->operationalSpaceMatrices(Lambda_bracing, Jbar_bracing, N_bracing, J_bracing_estimate, N_prec);
+			bracing_projector.compute(robot->_M_inv, j_bracing_estimate, N_prec);
+			N_bracing = bracing_projector.nullspace();
 			range_space_bracing = N_prec - N_bracing;
-			Proj_bracing = tau_contact_observed * Jbar_bracing.transpose();
+			Proj_bracing.noalias() = tau_contact_observed * bracing_projector.jbar().transpose();
 			N_prec = N_bracing;
 		}
 		else
@@ -520,10 +614,9 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 		// final torques
 		command_torques = posori_task_torques + bracing_task_torques + joint_task_torques + shoulder_task_torques;
 
-		// send to redis
+		// sent to the simulation by the exchange
 		// command_torques = gravity;
 		// command_torques.setZero();
-		sim->setJointTorques(robot_name, command_torques);
 
 		if(controller_counter % 100 == 0)
 		{
@@ -562,18 +655,27 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 			cout << endl; 
 		}
 
+		// logger
+		current_position = posori_task->_current_position;
+		desired_position = posori_task->_desired_position;
+		logger->tick(controller_counter, time);
+
 		prev_time = time;
 		controller_counter++;
+		scheduler->controlDone();
 
 	}
 
 	logger->stop();
+	replay_logger->stop();
 
-	double end_time = timer.elapsedTime();
+	double end_time = scheduler->simTime();
 	std::cout << "\n";
-	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
-	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
-    std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+	std::cout << "Controller Loop run time  : " << end_time << " seconds of sim time\n";
+	std::cout << "Controller Loop updates   : " << controller_counter << "\n";
+    std::cout << "Controller Loop frequency : " << controller_counter/end_time << "Hz of sim time\n";
+    std::cout << "Time scale                : " << scheduler->measuredTimeScale() << "\n";
+    std::cout << "Pipelined schedule        : " << scheduler->isPipelined() << "\n";
 
 }
 
@@ -594,17 +696,16 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, UI
 	MatrixXd J_bracing = MatrixXd::Zero(3,dof);
 	Vector3d f_sensed_bracing = Vector3d::Zero();
 
-	// create a timer
-	LoopTimer timer;
-	timer.initializeTimer();
-	timer.setLoopFrequency(2000); 
-	double last_time = timer.elapsedTime(); //secs
-	bool fTimerDidSleep = true;
+	// samples of the contact estimation
+	VectorXd sim_q = VectorXd::Zero(dof);
+	VectorXd sim_dq = VectorXd::Zero(dof);
+	VectorXd sim_known_torques = VectorXd::Zero(dof);
 
 	unsigned long long simulation_counter = 0;
 
-	while (fSimulationRunning) {
-		fTimerDidSleep = timer.waitForNextLoop();
+	PandaUtils::configureRealtimeThread("simulation", PandaUtils::RealtimeConfig::fifo(70, PandaUtils::simulationCpus()));
+
+	while (fSimulationRunning && scheduler->waitForSimStep()) {
 
 		// get ui force and torques
 		if(ui_force_widget->getState() == UIForceWidget::UIForceWidgetState::Active)
@@ -624,17 +725,24 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, UI
 		// sim->setJointTorques(robot_name, command_torques);
 
 		// integrate forward
-		double curr_time = timer.elapsedTime();
-		double loop_dt = curr_time - last_time; 
-		sim->integrate(loop_dt);
+		sim->integrate(sim_dt);
 
 		// update force sensor
 		force_sensor->update(sim);
-		force_sensor->getForce(sensed_force);
-		force_sensor->getMoment(sensed_moment);
+		force_sensor->getForce(sim_sensed_force);
+		force_sensor->getMoment(sim_sensed_moment);
+
+		sim_sensed_force *= -1;
+		sim_sensed_moment *= -1;
 
-		sensed_force *= -1;
-		sensed_moment *= -1;
+		// momentum observer sample, at a higher rate than the controller
+		if(simulation_counter % sim_steps_per_estimation == 0)
+		{
+			sim->getJointPositions(robot_name, sim_q);
+			sim->getJointVelocities(robot_name, sim_dq);
+			sim_known_torques.noalias() = sim_task_contact_jacobian.transpose() * sim_sensed_force;
+			contact_estimation->pushSample(scheduler->simTime(), sim_q, sim_dq, sim_command_torques, sim_known_torques);
+		}
 
 		// debug mom observer
 		force_sensor_bracing->update(sim);
@@ -647,17 +755,15 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, UI
 		// sim->getJointVelocities(robot_name, robot->_dq);
 		// robot->updateKinematics();
 
-		//update last time
-		last_time = curr_time;
-
+		scheduler->simStepDone();
 		simulation_counter++;
 	}
 
-	double end_time = timer.elapsedTime();
+	double end_time = scheduler->simTime();
 	cout << "\n";
-	cout << "Simulation Loop run time  : " << end_time << " seconds\n";
-	cout << "Simulation Loop updates   : " << timer.elapsedCycles() << "\n";
-	cout << "Simulation Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+	cout << "Simulation Loop run time  : " << end_time << " seconds of sim time\n";
+	cout << "Simulation Loop updates   : " << simulation_counter << "\n";
+	cout << "Simulation Loop frequency : " << simulation_counter/end_time << "Hz of sim time\n";
 }
 
 //------------------------------------------------------------------------------
@@ -5,6 +5,8 @@
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
+#include "timer/LoopHealth.h"
+#include "threads/RealtimeThread.h"
 #include "tasks/JointTask.h"
 #include "tasks/PositionTask.h"
 
@@ -35,6 +37,7 @@ std::string MASSMATRIX_KEY;
 std::string CORIOLIS_KEY;
 std::string ROBOT_GRAVITY_KEY;
 
+const string LOOP_HEALTH_KEY = "sai2::PandaApplication::controller::loop_health";
 unsigned long long controller_counter = 0;
 
 // const bool flag_simulation = false;
@@ -105,13 +108,14 @@ int main() {
 	LoopTimer timer;
 	timer.initializeTimer();
 	timer.setLoopFrequency(1000); 
+	PandaUtils::LoopHealth loop_health(1000);
+	PandaUtils::configureRealtimeThread("controller", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
 	double start_time = timer.elapsedTime(); //secs
-	bool fTimerDidSleep = true;
 	double prev_time = 0;
 
 	while (runloop) {
 	// wait for next scheduled loop
-	timer.waitForNextLoop();
+	loop_health.waitForNextLoop(timer);
 	double time = timer.elapsedTime() - start_time;
 	double dt = time - prev_time;
 
@@ -152,6 +156,12 @@ int main() {
 	redis_client.setEigenMatrixJSON(JOINT_TORQUES_COMMANDED_KEY, command_torques);
 
 	prev_time = time;
+
+	if(controller_counter % 1000 == 0)
+	{
+		loop_health.publish(redis_client, LOOP_HEALTH_KEY);
+	}
+
 	controller_counter++;
 
 	}
@@ -161,6 +171,7 @@ double end_time = timer.elapsedTime();
 	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
 	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
     std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+    loop_health.print(std::cout);
 
 
 	return 0;
@@ -3,9 +3,11 @@
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
+#include "timer/LoopHealth.h"
+#include "threads/RealtimeThread.h"
 #include "tasks/JointTask.h"
 #include "tasks/PosOriTask.h"
-#include "Logger.h"
+#include "logger/Logger.h"
 
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
 
@@ -37,6 +39,7 @@ string ROBOT_SENSED_FORCE_KEY = "sai2::PandaApplications::simviz_panda::sensors:
 string MASSMATRIX_KEY;
 string CORIOLIS_KEY;
 
+const string LOOP_HEALTH_KEY = "sai2::PandaApplications::controller::loop_health";
 RedisClient redis_client;
 
 #define INIT       0
@@ -68,6 +71,7 @@ const std::string currentDateTime() {
 }
 
 const bool flag_simulation = false;
+
 // const bool flag_simulation = true;
 
 int main(int argc, char *argv[]) {
@@ -239,17 +243,18 @@ int main(int argc, char *argv[]) {
 	LoopTimer timer;
 	timer.initializeTimer();
 	timer.setLoopFrequency(control_loop_freq); //Compiler en mode release
+	PandaUtils::LoopHealth loop_health(control_loop_freq);
+	PandaUtils::configureRealtimeThread("controller", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
 	double current_time = 0;
 	double prev_time = 0;
 	// double dt = 0;
-	bool fTimerDidSleep = true;
 	double start_time = timer.elapsedTime(); //secs
 
 	runloop = true;
 	while (runloop)
 	{
 		// wait for next scheduled loop
-		timer.waitForNextLoop();
+		loop_health.waitForNextLoop(timer);
 		current_time = timer.elapsedTime() - start_time;
 
 		// read haptic state and robot state
@@ -431,6 +436,11 @@ int main(int argc, char *argv[]) {
 		// 	cout << endl;
 		// }
 
+		if(controller_counter % 1000 == 0)
+		{
+			loop_health.publish(redis_client, LOOP_HEALTH_KEY);
+		}
+
 		controller_counter++;
 	}
 
@@ -445,6 +455,7 @@ int main(int argc, char *argv[]) {
 	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
 	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
     std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+    loop_health.print(std::cout);
 
     return 0;
 }
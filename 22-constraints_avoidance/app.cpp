@@ -6,11 +6,16 @@
 #include "Sai2Graphics.h"
 #include "Sai2Simulation.h"
 #include <dynamics3d.h>
-#include "timer/LoopTimer.h"
 #include "uiforce/UIForceWidget.h"
 #include "force_sensor/ForceSensorSim.h"
-#include "MomentumObserver.h"
-#include "Logger.h"
+#include "observers/MomentumObserver.h"
+#include "observers/ContactIsolation.h"
+#include "logger/Logger.h"
+#include "model/RankOneProjector.h"
+#include "model/CollisionDistance.h"
+#include "sim/SimClock.h"
+#include "sim/CoSimScheduler.h"
+#include "threads/RealtimeThread.h"
 
 #include "tasks/JointTask.h"
 #include "tasks/PositionTask.h"
@@ -38,6 +43,18 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, UI
 unsigned long long controller_counter = 0;
 void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim);
 
+// schedule of the simulation and control threads, 15 simulation steps per control step.
+// app22 --time-scale 10 runs 10 times faster than real time, --time-scale 0 as fast as
+// possible, and --pipelined runs the control step of a period next to its simulation steps
+PandaUtils::CoSimScheduler* scheduler = NULL;
+const double sim_dt = 1.0/15000.0;
+const int sim_steps_per_control = 15;
+
+// momentum observer from the coriolis plus gravity vector of the controller, with Mdot
+// differenced between two updates, instead of the christoffel matrix. not the default until
+// its residual is checked against the christoffel one on the panda
+const bool flag_observer_from_coriolis_vector = false;
+
 // Get current date/time, format is YYYY-MM-DD.HH:mm:ss
 const std::string currentDateTime() {
 	time_t     now = time(0);
@@ -79,12 +96,15 @@ const string link_name = "end-effector";
 const Vector3d pos_in_link = Vector3d(0,0,0);
 Vector3d sensed_force;
 Vector3d sensed_moment;
+// written by the simulation, exchanged to the controller
+Vector3d sim_sensed_force = Vector3d::Zero();
+Vector3d sim_sensed_moment = Vector3d::Zero();
 
 // debug
 VectorXd tau_contact_from_simulation;
 Vector3d f_sensed_elbow;
 
-int main() {
+int main(int argc, char** argv) {
 	cout << "Loading URDF world model file: " << world_file << endl;
 
 	// load graphics scene
@@ -160,6 +180,8 @@ int main() {
 	double last_cursorx, last_cursory;
 
 	// start simulation hread
+	scheduler = new PandaUtils::CoSimScheduler(sim_dt, sim_steps_per_control, PandaUtils::SimClock::timeScale(argc, argv),
+			PandaUtils::CoSimScheduler::pipelined(argc, argv));
 	fSimulationRunning = true;
 	thread sim_thread(simulation, robot, sim, ui_force_widget, force_sensor);
 	thread control_thread(control, robot, sim);
@@ -270,6 +292,7 @@ int main() {
 
 	// stop simulation
 	fSimulationRunning = false;
+	scheduler->stop();
 	sim_thread.join();
 	control_thread.join();
 
@@ -335,12 +358,18 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 	const double d_t = r_transition - r_obstacle;
 	double d_c = 0;
 
+	// the obstacle is a post through the table, avoided by the end effector point and by the links
+	vector<PandaUtils::CollisionCapsule> robot_capsules = PandaUtils::pandaLinkCapsules();
+	robot_capsules.push_back(PandaUtils::CollisionCapsule(link_name, pos_in_link, pos_in_link, 0.0));
+	PandaUtils::CollisionDistance collision_distance(robot_capsules);
+	collision_distance.addObstacleCapsule(Vector3d(obstacle_position(0), obstacle_position(1), 0.0),
+			Vector3d(obstacle_position(0), obstacle_position(1), 1.0), r_obstacle);
+	collision_distance.setMaxDistance(d_z);
+
 	Vector3d u_obstacle = Vector3d::Zero();
 
 	MatrixXd J_c = MatrixXd::Zero(1,dof);
-	MatrixXd Lambda_c = MatrixXd::Zero(1,1);
-	MatrixXd Jbar_c = MatrixXd::Zero(dof,1);
-	MatrixXd N_c = MatrixXd::Zero(dof,dof);
+	PandaUtils::RankOneProjector<8> constraint_projector(dof);
 
 	VectorXd F_c = VectorXd::Zero(1);
 
@@ -359,9 +388,10 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 	MatrixXd J_cd_link = MatrixXd::Zero(3,dof);
 	MatrixXd Jbar_cd_link = MatrixXd::Zero(dof,3);
 	MatrixXd J_cd_link_reduced = MatrixXd::Zero(1,dof);
-	MatrixXd Jbar_cd_link_reduced = MatrixXd::Zero(dof,1);
+	PandaUtils::RankOneProjector<8> contact_force_projector(dof);
 
-	MatrixXd N_cd = MatrixXd::Zero(dof,dof);
+	VectorXd j_cd_approx = VectorXd::Zero(dof);
+	PandaUtils::RankOneProjector<8> contact_projector(dof);
 	MatrixXd L_cd = MatrixXd::Zero(dof,dof);
 
 	Vector3d u_contact_driven = Vector3d::Zero();
@@ -374,14 +404,22 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 	int in_contact = 0;
 	const int nsteps_for_contact = 50;
 
+	// link in contact, from a fit of the observer disturbance at the link center of every link
+	PandaUtils::ContactIsolation contact_isolation(robot, contact_driven_torque_threshold);
+	for(unsigned int i=1 ; i<link_names.size() ; i++)
+	{
+		contact_isolation.addCandidate(link_names[i], link_center);
+	}
+
 	// momentum observer
-	auto momentum_observer = new MomentumObserver(robot, 0.001);
+	auto momentum_observer = new PandaUtils::MomentumObserver<8>(robot, 0.001);
 	ButterworthFilter filter_gamma = ButterworthFilter(dof, 0.015);
 
 	double gain = 25.0;
 	momentum_observer->setGain(gain * MatrixXd::Identity(dof,dof));
 	VectorXd gamma_raw = VectorXd::Zero(dof);
 	VectorXd gamma = VectorXd::Zero(dof);
+	VectorXd task_contact_torques = VectorXd::Zero(dof);
 
 	bool constraint_active = false;
 	bool prev_constraint_active = false;
@@ -412,33 +450,71 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 	logger->addVectorToLog(&log_obstacle_avoidance_force, "obstacle_avoidance_force");
 	logger->addVectorToLog(&log_contact_driven_command_force, "contact_driven_command_force");
 
+	// full rate for 200 ms before and 300 ms after each constraint activation or release, 100 Hz otherwise
+	logger->enableCapture();
+	logger->enableTriggeredCapture(200, 300, 10);
 	logger->start();
 
-	// create a timer
-	LoopTimer timer;
-	timer.initializeTimer();
-	timer.setLoopFrequency(1000); 
-	double start_time = timer.elapsedTime(); //secs
-	bool fTimerDidSleep = true;
+	// full rate binary log of the momentum observer inputs, for the observer_replay tool, with the
+	// elbow contact torques of the simulation as reference
+	auto replay_logger = new Logging::Logger(1000, folder + "replay_" + timestamp + ".bin");
+	Matrix4d base_transform = sim->getRobotBaseTransform(robot_name).matrix();
+	VectorXd log_reference_torques = VectorXd::Zero(dof);
+	replay_logger->addVectorToLog(&robot->_q, "q");
+	replay_logger->addVectorToLog(&robot->_dq, "dq");
+	replay_logger->addVectorToLog(&command_torques, "command_torques");
+	replay_logger->addVectorToLog(&task_contact_torques, "known_torques");
+	replay_logger->addVectorToLog(&base_transform, "base_transform");
+	replay_logger->addVectorToLog(&log_reference_torques, "reference_torques");
+	replay_logger->enableCompression();
+	replay_logger->enableTimeIndex();
+	replay_logger->enableCapture();
+	replay_logger->start();
+
 	double prev_time = 0;
 
-	while (fSimulationRunning) 
+	// the only data shared with the simulation thread
+	scheduler->setExchange([&]()
 	{
-		// wait for next scheduled loop
-		timer.waitForNextLoop();
-		double time = timer.elapsedTime() - start_time;
-		double dt = time - prev_time;
-
-		// read robot state from redis
+		// read robot state, update model
 		sim->getJointPositions(robot_name, robot->_q);
 		sim->getJointVelocities(robot_name, robot->_dq);
+		robot->updateModel();
+		sensed_force = sim_sensed_force;
+		sensed_moment = sim_sensed_moment;
+		log_force_elbow = f_sensed_elbow;
+		if(tau_contact_from_simulation.size() == dof)
+		{
+			log_reference_torques = tau_contact_from_simulation;
+		}
+	},
+	[&]()
+	{
+		sim->setJointTorques(robot_name, command_torques + ui_force_command_torques);
+	});
+
+	PandaUtils::configureRealtimeThread("control", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
+
+	// wait for the state of the next control step
+	while (fSimulationRunning && scheduler->waitForControl()) 
+	{
+		double time = scheduler->controlTime();
+		double dt = time - prev_time;
 
-		// update momentum observer
-		VectorXd task_contact_torques = VectorXd::Zero(dof);
-		task_contact_torques = posori_task->_jacobian.block(0,0,3,dof).transpose() * sensed_force;
+		// update momentum observer, on the model of this control step
+		robot->coriolisPlusGravity(coriolis_plus_gravity);
+		task_contact_torques.noalias() = posori_task->_jacobian.block(0,0,3,dof).transpose() * sensed_force;
 		// task_contact_torques = posori_task->_jacobian.block(0,0,3,dof).transpose() * posori_task->_desired_force;
-		momentum_observer->update(command_torques, task_contact_torques);
+		if(flag_observer_from_coriolis_vector)
+		{
+			momentum_observer->update(command_torques, task_contact_torques, coriolis_plus_gravity);
+		}
+		else
+		{
+			momentum_observer->update(command_torques, task_contact_torques);
+		}
 		gamma_raw = momentum_observer->getDisturbanceTorqueEstimate();
+		replay_logger->tick(controller_counter, time);
 		// gamma_raw.tail(3) = VectorXd::Zero(3);
 		// gamma = filter_gamma.update(gamma_raw);
 		gamma = (gamma_raw);
@@ -467,14 +543,10 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 		// update sensed force
 		posori_task->updateSensedForceAndMoment(posori_task->_current_orientation.transpose() * sensed_force, Vector3d::Zero());
 
-		// update robot model
-		robot->updateModel();
-		robot->coriolisPlusGravity(coriolis_plus_gravity);
-
 		// compute distance to obstacle
-		VectorXd p_obstacle_robot = posori_task->_current_position - obstacle_position;
-		p_obstacle_robot(2) = 0;
-		d_c = p_obstacle_robot.norm() - r_obstacle;
+		collision_distance.update(robot);
+		const PandaUtils::CollisionDistanceResult& closest_obstacle = collision_distance.closest();
+		d_c = closest_obstacle.distance;
 
 		// update tasks models
 		N_prec.setIdentity();
@@ -528,19 +600,19 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 		constraint_active = false;
 		// if the constraint is active
 		N_prec.setIdentity();
-		if(d_c <= d_z)
+		if(closest_obstacle.obstacle >= 0 && d_c <= d_z)
 		{
 			constraint_active = true;
-			u_obstacle = p_obstacle_robot / p_obstacle_robot.norm();
+			u_obstacle = closest_obstacle.normal;
 			MatrixXd Jv_robot = MatrixXd::Zero(3,dof);
-			robot->Jv(Jv_robot, link_name, pos_in_link);
+			robot->Jv(Jv_robot, collision_distance.capsule(closest_obstacle.capsule).link_name, closest_obstacle.point_in_link);
 			J_c = u_obstacle.transpose() * Jv_robot;
-			robot->operationalSpaceMatrices(Lambda_c, Jbar_c, N_c, J_c, N_prec);
-			N_prec = N_c;
+			constraint_projector.compute(robot->_M_inv, J_c, N_prec);
+			N_prec = constraint_projector.nullspace();
 
 			// obstacle avoidance torques
 			F_pf(0) = kp_c / d_c/d_c * (1/d_c - 1/d_z);
-			F_tp_c = Jbar_c.transpose() * (joint_task_torques + posori_task_torques);
+			F_tp_c(0) = constraint_projector.jbar().dot(joint_task_torques + posori_task_torques);
 
 
 			double alpha_c = (d_z - d_c) / (d_z - d_t);
@@ -549,7 +621,7 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 
 			F_c(0) = alpha_c * F_pf(0) + (1 - alpha_c) * F_tp_c(0);
 
-			constraint_task_torques = J_c.transpose() * (F_c - kv_c * Lambda_c * J_c * robot->_dq);
+			constraint_task_torques = J_c.transpose() * (F_c - kv_c * constraint_projector.lambda() * J_c * robot->_dq);
 
 			// cout << "Fpf: " << F_pf << endl;
 			// cout << "J_c: " << J_c << endl;
@@ -576,18 +648,14 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 			if(in_contact == nsteps_for_contact)
 			{
 
-				int link_in_contact = 1;
-				for(int i=0 ; i<dof ; i++)
-				{
-					if(abs(gamma(i)) > contact_driven_torque_threshold)
-					{
-						link_in_contact = i;
-					}
-				}
+				// the candidates are link1 to link7
+				const PandaUtils::ContactIsolation::Estimate& contact_estimate = contact_isolation.isolate(gamma);
+				const int link_in_contact = contact_estimate.candidate >= 0 ? contact_estimate.candidate + 1 : 1;
 
 				constraint_active = true;
-				MatrixXd J_cd_approx = gamma.transpose() * N_prec;
-				robot->nullspaceMatrix(N_cd, J_cd_approx, N_prec);
+				// J_cd_approx = gamma^T N_prec, as a vector
+				j_cd_approx.noalias() = N_prec.transpose() * gamma;
+				contact_projector.compute(robot->_M_inv, j_cd_approx, N_prec);
 
 				robot->Jv(J_cd_link, link_names[link_in_contact], link_center);
 				J_cd_link = J_cd_link * N_prec;
@@ -597,17 +665,18 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 				u_contact_driven = F_l / F_l.norm();
 				J_cd_link_reduced = F_l.transpose() * J_cd_link / F_l.norm();
 				J_cd_link_reduced = J_cd_link_reduced;
-				robot->dynConsistentInverseJacobian(Jbar_cd_link_reduced, J_cd_link_reduced);
+				contact_force_projector.compute(robot->_M_inv, J_cd_link_reduced);
 
-				N_prec = N_prec * N_cd;
-				L_cd = MatrixXd::Identity(dof,dof) - N_cd;
+				contact_projector.project(N_prec);
+				L_cd.setIdentity();
+				L_cd -= contact_projector.nullspace();
 
 				// cout << "gamma: " << gamma.transpose() << endl;
 
 				F_cd = F_cd_max;
-				VectorXd F_tp_cd = Jbar_cd_link_reduced.transpose() * (posori_task_torques + joint_task_torques + coriolis_plus_gravity);
+				const double F_tp_cd = contact_force_projector.jbar().dot(posori_task_torques + joint_task_torques + coriolis_plus_gravity);
 
-				VectorXd prev_force_applied = Jbar_cd_link_reduced.transpose() * command_torques;
+				const double prev_force_applied = contact_force_projector.jbar().dot(command_torques);
 
 
 				if(controller_counter % 1 == 0)
@@ -623,7 +692,7 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 					// cout << "f sensed elbow: " << f_sensed_elbow.transpose() << endl;
 					// cout << "f sensed elbow norm: " << f_sensed_elbow.norm() << endl;
 					// // cout << "J center link reduced: " << J_cd_link_reduced << endl;
-					// // cout << "Jbar center link reduced: " << Jbar_cd_link_reduced.transpose() << endl;
+					// // cout << "Jbar center link reduced: " << contact_force_projector.jbar().transpose() << endl;
 					// cout << "F tp cd: " << F_tp_cd << endl;
 					// cout << "prev force applied: " << prev_force_applied << endl;
 					// // cout << "delta x: " << (posori_task->_current_position.transpose() - posori_task->_desired_position.transpose()) << endl;
@@ -635,8 +704,8 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 					// cout << endl;
 				}
 
-				if(F_tp_cd(0) < F_cd_max && -F_cd_max < F_tp_cd(0)){F_cd = F_tp_cd(0);}
-				if(-F_cd_max >= F_tp_cd(0)){F_cd = -F_cd_max;}
+				if(F_tp_cd < F_cd_max && -F_cd_max < F_tp_cd){F_cd = F_tp_cd;}
+				if(-F_cd_max >= F_tp_cd){F_cd = -F_cd_max;}
 
 
 				// contact_driven_torques = L_cd.transpose() * (J_cd_link_reduced.transpose() * F_cd - 35.0 * robot->_dq);
@@ -677,10 +746,9 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 		command_torques = posori_task_torques + joint_task_torques + constraint_task_torques + contact_driven_torques + coriolis_plus_gravity - posori_task->_Jbar.transpose() * gamma;
 		// command_torques = posori_task_torques + joint_task_torques + constraint_task_torques + contact_driven_torques + coriolis_plus_gravity - gamma;
 
-		// send to redis
+		// sent to the simulation by the exchange
 		// command_torques = coriolis_plus_gravity;
 		// command_torques.setZero();
-		sim->setJointTorques(robot_name, command_torques + ui_force_command_torques);
 
 
 		// logger
@@ -688,10 +756,14 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 		log_current_position = posori_task->_current_position;
 		log_sensed_force = sensed_force;
 		log_gamma = gamma;
-		log_force_elbow = f_sensed_elbow;
 		log_obstacle_avoidance_distances << d_c, d_z, d_t;
 		log_obstacle_avoidance_force = F_c(0) * u_obstacle;
 		log_contact_driven_command_force = F_cd * u_contact_driven;
+		logger->tick(controller_counter, time);
+		if(constraint_active != prev_constraint_active)
+		{
+			logger->trigger();
+		}
 
 
 		if(controller_counter % 50 == 0)
@@ -713,16 +785,21 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 
 		prev_time = time;
 		controller_counter++;
+		scheduler->controlDone();
 
 	}
 
 	logger->stop();
+	replay_logger->stop();
 
-	double end_time = timer.elapsedTime();
+	double end_time = scheduler->simTime();
 	std::cout << "\n";
-	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
-	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
-    std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+	std::cout << "Controller Loop run time  : " << end_time << " seconds of sim time\n";
+	std::cout << "Controller Loop updates   : " << controller_counter << "\n";
+    std::cout << "Controller Loop frequency : " << controller_counter/end_time << "Hz of sim time\n";
+	std::cout << "Isolation overruns        : " << contact_isolation.numOverruns() << " / " << contact_isolation.numIsolations() << "\n";
+    std::cout << "Time scale                : " << scheduler->measuredTimeScale() << "\n";
+    std::cout << "Pipelined schedule        : " << scheduler->isPipelined() << "\n";
 
 }
 
@@ -743,18 +820,11 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, UI
 	MatrixXd J_elbow = MatrixXd::Zero(3,dof);
 	f_sensed_elbow = Vector3d::Zero();
 
-	// create a timer
-	double sim_frequency = 15000.0;
-	LoopTimer timer;
-	timer.initializeTimer();
-	timer.setLoopFrequency(sim_frequency); 
-	double last_time = timer.elapsedTime(); //secs
-	bool fTimerDidSleep = true;
-
 	unsigned long long simulation_counter = 0;
 
-	while (fSimulationRunning) {
-		fTimerDidSleep = timer.waitForNextLoop();
+	PandaUtils::configureRealtimeThread("simulation", PandaUtils::RealtimeConfig::fifo(70, PandaUtils::simulationCpus()));
+
+	while (fSimulationRunning && scheduler->waitForSimStep()) {
 
 		// get ui force and torques
 		if(ui_force_widget->getState() == UIForceWidget::UIForceWidgetState::Active)
@@ -774,15 +844,15 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, UI
 		// sim->setJointTorques(robot_name, command_torques);
 
 		// integrate forward
-		sim->integrate(1.0/sim_frequency);
+		sim->integrate(sim_dt);
 
 		// update force sensor
 		force_sensor->update(sim);
-		force_sensor->getForce(sensed_force);
-		force_sensor->getMoment(sensed_moment);
+		force_sensor->getForce(sim_sensed_force);
+		force_sensor->getMoment(sim_sensed_moment);
 
-		sensed_force *= -1;
-		sensed_moment *= -1;
+		sim_sensed_force *= -1;
+		sim_sensed_moment *= -1;
 
 		// debug mom observer
 		force_sensor_elbow->update(sim);
@@ -797,14 +867,15 @@ void simulation(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim, UI
 		// sim->getJointVelocities(robot_name, robot->_dq);
 		// robot->updateKinematics();
 
+		scheduler->simStepDone();
 		simulation_counter++;
 	}
 
-	double end_time = timer.elapsedTime();
+	double end_time = scheduler->simTime();
 	cout << "\n";
-	cout << "Simulation Loop run time  : " << end_time << " seconds\n";
-	cout << "Simulation Loop updates   : " << timer.elapsedCycles() << "\n";
-	cout << "Simulation Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+	cout << "Simulation Loop run time  : " << end_time << " seconds of sim time\n";
+	cout << "Simulation Loop updates   : " << simulation_counter << "\n";
+	cout << "Simulation Loop frequency : " << simulation_counter/end_time << "Hz of sim time\n";
 }
 
 //------------------------------------------------------------------------------
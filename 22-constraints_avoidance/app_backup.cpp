@@ -9,8 +9,8 @@
 #include "timer/LoopTimer.h"
 #include "uiforce/UIForceWidget.h"
 #include "force_sensor/ForceSensorSim.h"
-#include "MomentumObserver.h"
-#include "Logger.h"
+#include "observers/MomentumObserver.h"
+#include "logger/Logger.h"
 
 #include "tasks/JointTask.h"
 #include "tasks/PositionTask.h"
@@ -348,7 +348,7 @@ void control(Sai2Model::Sai2Model* robot, Simulation::Sai2Simulation* sim)
 	double kv_c = 25.0;
 
 	// momentum observer
-	auto momentum_observer = new MomentumObserver(robot, 0.001);
+	auto momentum_observer = new PandaUtils::MomentumObserver<8>(robot, 0.001);
 	double gain = 15.0;
 	momentum_observer->setGain(gain * MatrixXd::Identity(dof,dof));
 	VectorXd tau_contact_observed = VectorXd::Zero(dof);
@@ -0,0 +1,355 @@
+#ifndef BENCHMARKS_BENCHMARK_HARNESS_H_
+#define BENCHMARKS_BENCHMARK_HARNESS_H_
+
+// Common harness of the component benchmarks : warm-up, repetitions, percentiles and json.
+//
+// a benchmark is a function that does one operation of the component, e.g. one filter
+// update. the harness calls it in batches sized so that a batch lasts at least the
+// sample time, so that the clock reads do not weigh in the measure of short operations,
+// and records the time per operation of every batch. the first batches are a warm-up,
+// for the caches, the branch predictors and the lazy allocations, and are not recorded :
+//
+//   int main(int argc, char** argv)
+//   {
+//       PandaUtils::BenchmarkSuite suite("butterworth", argc, argv);
+//       PandaUtils::ButterworthFilterBank<14> filter(14, 0.015);
+//       Eigen::Matrix<double,14,1> x = Eigen::Matrix<double,14,1>::Random();
+//       suite.context("channels", 14);
+//       suite.run("bank<14> update", [&]()
+//       {
+//           PandaUtils::doNotOptimize(filter.update(x));
+//       });
+//       return suite.finish();        // table on stdout, json with -o
+//   }
+//
+// the command line options are common to all the benchmarks :
+//   -w  warm-up batches (default 100)
+//   -r  recorded batches (default 1000)
+//   -b  operations per batch, calibrated to the sample time with 0 (default 0)
+//   -s  sample time in us for the calibration (default 20)
+//   -f  only the benchmarks whose name contains this string
+//   -o  json output file
+//
+// the times are in ns per operation, taken with steady_clock. run on an idle machine, with
+// the cpu governor on performance, or pinned with taskset, for stable percentiles.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace PandaUtils {
+
+// keeps the compiler from dropping the computation of value
+template<typename T>
+inline void doNotOptimize(const T& value)
+{
+	asm volatile("" : : "r"(&value) : "memory");
+}
+
+// forces the pending writes to memory
+inline void clobberMemory()
+{
+	asm volatile("" : : : "memory");
+}
+
+struct BenchmarkOptions
+{
+	int warmup;
+	int repetitions;
+	long batch;
+	double sample_us;
+	std::string filter;
+	std::string json_path;
+
+	BenchmarkOptions()
+	: warmup(100),
+	  repetitions(1000),
+	  batch(0),
+	  sample_us(20)
+	{}
+
+	// throws on an unknown option
+	static BenchmarkOptions parse(const int argc, char** argv)
+	{
+		BenchmarkOptions options;
+		for(int i=1 ; i<argc ; i++)
+		{
+			const std::string arg = argv[i];
+			if(i + 1 >= argc)
+			{
+				throw std::invalid_argument("missing value after " + arg + " in BenchmarkOptions::parse()\n");
+			}
+			const std::string value = argv[++i];
+			if(arg == "-w")
+			{
+				options.warmup = std::max(0, atoi(value.c_str()));
+			}
+			else if(arg == "-r")
+			{
+				options.repetitions = std::max(1, atoi(value.c_str()));
+			}
+			else if(arg == "-b")
+			{
+				options.batch = std::max(0L, atol(value.c_str()));
+			}
+			else if(arg == "-s")
+			{
+				options.sample_us = std::max(0.1, atof(value.c_str()));
+			}
+			else if(arg == "-f")
+			{
+				options.filter = value;
+			}
+			else if(arg == "-o")
+			{
+				options.json_path = value;
+			}
+			else
+			{
+				throw std::invalid_argument("unknown option " + arg + " in BenchmarkOptions::parse()\n");
+			}
+		}
+		return options;
+	}
+
+	static std::string usage(const std::string& program)
+	{
+		return "usage : " + program + " [-w warmup] [-r repetitions] [-b batch] [-s sample_us] [-f filter] [-o results.json]";
+	}
+};
+
+struct BenchmarkResult
+{
+	std::string name;
+	long batch;
+	int repetitions;
+	double mean_ns;
+	double stddev_ns;
+	double min_ns;
+	double p50_ns;
+	double p90_ns;
+	double p99_ns;
+	double max_ns;
+
+	// from the times per operation of the batches
+	static BenchmarkResult fromSamples(const std::string& name, const long batch, std::vector<double> samples)
+	{
+		BenchmarkResult result;
+		result.name = name;
+		result.batch = batch;
+		result.repetitions = samples.size();
+		std::sort(samples.begin(), samples.end());
+		double sum = 0;
+		for(unsigned int i=0 ; i<samples.size() ; i++)
+		{
+			sum += samples[i];
+		}
+		result.mean_ns = samples.empty() ? 0 : sum / samples.size();
+		double sum_squares = 0;
+		for(unsigned int i=0 ; i<samples.size() ; i++)
+		{
+			sum_squares += (samples[i] - result.mean_ns) * (samples[i] - result.mean_ns);
+		}
+		result.stddev_ns = samples.size() < 2 ? 0 : sqrt(sum_squares / (samples.size() - 1));
+		result.min_ns = samples.empty() ? 0 : samples.front();
+		result.p50_ns = percentile(samples, 0.5);
+		result.p90_ns = percentile(samples, 0.9);
+		result.p99_ns = percentile(samples, 0.99);
+		result.max_ns = samples.empty() ? 0 : samples.back();
+		return result;
+	}
+
+	// nearest rank of the sorted samples
+	static double percentile(const std::vector<double>& sorted_samples, const double p)
+	{
+		if(sorted_samples.empty())
+		{
+			return 0;
+		}
+		const size_t rank = (size_t) ceil(p * sorted_samples.size());
+		return sorted_samples[std::min(sorted_samples.size() - 1, rank > 0 ? rank - 1 : 0)];
+	}
+};
+
+class BenchmarkSuite {
+public:
+
+	BenchmarkSuite(const std::string& suite_name, const int argc, char** argv)
+	: _suite_name(suite_name),
+	  _f_usage_error(false)
+	{
+		try
+		{
+			_options = BenchmarkOptions::parse(argc, argv);
+		}
+		catch(const std::invalid_argument& e)
+		{
+			std::cout << e.what() << BenchmarkOptions::usage(argv[0]) << std::endl;
+			_f_usage_error = true;
+		}
+	}
+
+	const BenchmarkOptions& options() const
+	{
+		return _options;
+	}
+
+	// conditions of the run, written with the results (sizes, number of threads, ...)
+	template<typename T>
+	void context(const std::string& key, const T& value)
+	{
+		std::stringstream ss;
+		ss << value;
+		_context.push_back(std::make_pair(key, ss.str()));
+	}
+
+	// times one call of operation, skipped when it does not match the filter
+	template<typename Operation>
+	void run(const std::string& name, Operation operation)
+	{
+		if(_f_usage_error || (!_options.filter.empty() && name.find(_options.filter) == std::string::npos))
+		{
+			return;
+		}
+
+		const long batch = _options.batch > 0 ? _options.batch : calibrateBatch(operation);
+		for(int i=0 ; i<_options.warmup ; i++)
+		{
+			timeBatch(operation, batch);
+		}
+		std::vector<double> samples;
+		samples.reserve(_options.repetitions);
+		for(int i=0 ; i<_options.repetitions ; i++)
+		{
+			samples.push_back(timeBatch(operation, batch) / batch);
+		}
+
+		_results.push_back(BenchmarkResult::fromSamples(name, batch, samples));
+		printRow(_results.back());
+	}
+
+	const std::vector<BenchmarkResult>& results() const
+	{
+		return _results;
+	}
+
+	// writes the json file if asked, returns the exit code of the benchmark
+	int finish()
+	{
+		if(_f_usage_error)
+		{
+			return 1;
+		}
+		if(_options.json_path.empty())
+		{
+			return 0;
+		}
+		std::ofstream file(_options.json_path.c_str());
+		writeJSON(file);
+		file.close();
+		if(!file)
+		{
+			std::cout << "could not write " << _options.json_path << std::endl;
+			return 1;
+		}
+		std::cout << "results written to " << _options.json_path << std::endl;
+		return 0;
+	}
+
+	// {"suite": ..., "context": {...}, "benchmarks": [{"name": ..., "batch": ..., "mean_ns": ..., ...}, ...]}
+	void writeJSON(std::ostream& os) const
+	{
+		os << "{\"suite\": \"" << _suite_name << "\", \"context\": {";
+		for(unsigned int i=0 ; i<_context.size() ; i++)
+		{
+			os << (i > 0 ? ", " : "") << "\"" << _context[i].first << "\": \"" << _context[i].second << "\"";
+		}
+		os << "}, \"warmup\": " << _options.warmup << ", \"benchmarks\": [";
+		os << std::fixed << std::setprecision(2);
+		for(unsigned int i=0 ; i<_results.size() ; i++)
+		{
+			const BenchmarkResult& r = _results[i];
+			os << (i > 0 ? ",\n" : "\n") << "  {\"name\": \"" << r.name << "\", \"batch\": " << r.batch
+				<< ", \"repetitions\": " << r.repetitions << ", \"mean_ns\": " << r.mean_ns
+				<< ", \"stddev_ns\": " << r.stddev_ns << ", \"min_ns\": " << r.min_ns
+				<< ", \"p50_ns\": " << r.p50_ns << ", \"p90_ns\": " << r.p90_ns
+				<< ", \"p99_ns\": " << r.p99_ns << ", \"max_ns\": " << r.max_ns << "}";
+		}
+		os << "\n]}\n";
+	}
+
+private:
+
+	typedef std::chrono::steady_clock Clock;
+
+	template<typename Operation>
+	static double timeBatch(Operation& operation, const long batch)
+	{
+		const Clock::time_point start = Clock::now();
+		for(long k=0 ; k<batch ; k++)
+		{
+			operation();
+		}
+		clobberMemory();
+		return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+	}
+
+	// doubles the batch until it lasts the sample time
+	template<typename Operation>
+	long calibrateBatch(Operation& operation) const
+	{
+		const double sample_ns = _options.sample_us * 1e3;
+		long batch = 1;
+		while(batch < (1L << 30))
+		{
+			const double t = timeBatch(operation, batch);
+			if(t >= sample_ns)
+			{
+				break;
+			}
+			batch = t > 0 ? std::max(2 * batch, (long) (batch * sample_ns / t)) : 2 * batch;
+		}
+		return batch;
+	}
+
+	void printRow(const BenchmarkResult& r)
+	{
+		if(_results.size() == 1)
+		{
+			std::cout << _suite_name;
+			for(unsigned int i=0 ; i<_context.size() ; i++)
+			{
+				std::cout << (i == 0 ? " (" : ", ") << _context[i].first << " " << _context[i].second;
+			}
+			std::cout << (_context.empty() ? "" : ")") << "\n";
+			std::cout << std::left << std::setw(36) << "benchmark (ns per operation)" << std::right
+				<< std::setw(10) << "batch" << std::setw(11) << "mean" << std::setw(11) << "stddev"
+				<< std::setw(11) << "p50" << std::setw(11) << "p90" << std::setw(11) << "p99"
+				<< std::setw(11) << "max" << "\n";
+		}
+		std::cout << std::left << std::setw(36) << r.name << std::right << std::fixed << std::setprecision(1)
+			<< std::setw(10) << r.batch << std::setw(11) << r.mean_ns << std::setw(11) << r.stddev_ns
+			<< std::setw(11) << r.p50_ns << std::setw(11) << r.p90_ns << std::setw(11) << r.p99_ns
+			<< std::setw(11) << r.max_ns << std::endl;
+	}
+
+	const std::string _suite_name;
+	BenchmarkOptions _options;
+	bool _f_usage_error;
+
+	std::vector<std::pair<std::string, std::string>> _context;
+	std::vector<BenchmarkResult> _results;
+};
+
+} /* namespace PandaUtils */
+
+#endif //BENCHMARKS_BENCHMARK_HARNESS_H_
@@ -0,0 +1,110 @@
+// Benchmark of the mass matrix factorization and of the task models of the two arm panda
+// (trunk and two arms, 15 dof) with PandaUtils::BlockDiagonalModel, against the monolithic
+// model and against two 7 dof arms alone. the mass matrix has the structure of the one of
+// two_arm_panda.urdf, with random blocks; the task is one posori task of 6 rows on each arm,
+// the second in the nullspace of the first, as in 08-simulation_electric_cables.
+//
+// usage : bench_block_diagonal_model [harness options, see BenchmarkHarness.h]
+
+#include "BenchmarkHarness.h"
+#include "model/BlockDiagonalModel.h"
+#include <Eigen/Dense>
+
+using namespace std;
+using namespace Eigen;
+
+const int ARM_DOF = 7;
+const int TRUNK_DOF = 1;
+const int DOF = TRUNK_DOF + 2 * ARM_DOF;
+
+MatrixXd randomInertia(const int n)
+{
+	const MatrixXd A = MatrixXd::Random(n, n);
+	return A * A.transpose() + n * MatrixXd::Identity(n, n);
+}
+
+// as Sai2Model::operationalSpaceMatrices() with the inverse of Sai2Model::updateModel()
+void monolithicTaskModel(const MatrixXd& M_inv, const MatrixXd& J, const MatrixXd& N_prec,
+		MatrixXd& Lambda, MatrixXd& Jbar, MatrixXd& N)
+{
+	const MatrixXd Lambda_inv = J * M_inv * J.transpose();
+	Lambda = Lambda_inv.llt().solve(MatrixXd::Identity(Lambda_inv.rows(), Lambda_inv.cols()));
+	Jbar = M_inv * J.transpose() * Lambda;
+	N = (MatrixXd::Identity(M_inv.rows(), M_inv.cols()) - Jbar * J) * N_prec;
+}
+
+int main(int argc, char** argv)
+{
+	PandaUtils::BenchmarkSuite suite("block_diagonal_model", argc, argv);
+	suite.context("dof", DOF);
+
+	// trunk first, then the left and right arms
+	MatrixXd M = MatrixXd::Zero(DOF, DOF);
+	const MatrixXd trunk_coupling = MatrixXd::Random(DOF, TRUNK_DOF);
+	M.leftCols(TRUNK_DOF) = trunk_coupling;
+	M.topRows(TRUNK_DOF) = trunk_coupling.transpose();
+	M.topLeftCorner(TRUNK_DOF, TRUNK_DOF) = 4 * DOF * MatrixXd::Identity(TRUNK_DOF, TRUNK_DOF);
+	M.block(TRUNK_DOF, TRUNK_DOF, ARM_DOF, ARM_DOF) = randomInertia(ARM_DOF);
+	M.block(TRUNK_DOF + ARM_DOF, TRUNK_DOF + ARM_DOF, ARM_DOF, ARM_DOF) = randomInertia(ARM_DOF);
+
+	MatrixXd J_left = MatrixXd::Zero(6, DOF);
+	MatrixXd J_right = MatrixXd::Zero(6, DOF);
+	J_left.leftCols(TRUNK_DOF + ARM_DOF) = MatrixXd::Random(6, TRUNK_DOF + ARM_DOF);
+	J_right.leftCols(TRUNK_DOF) = MatrixXd::Random(6, TRUNK_DOF);
+	J_right.rightCols(ARM_DOF) = MatrixXd::Random(6, ARM_DOF);
+
+	const MatrixXd identity = MatrixXd::Identity(DOF, DOF);
+	MatrixXd M_inv = M.inverse();
+	MatrixXd Lambda, Jbar, N_left, N_right, J_projected;
+
+	suite.run("monolithic 15 dof inverse", [&]()
+	{
+		M_inv = M.inverse();
+		PandaUtils::doNotOptimize(M_inv(0,0));
+	});
+	suite.run("monolithic 15 dof two task models", [&]()
+	{
+		monolithicTaskModel(M_inv, J_left, identity, Lambda, Jbar, N_left);
+		J_projected = J_right * N_left;
+		monolithicTaskModel(M_inv, J_projected, N_left, Lambda, Jbar, N_right);
+		PandaUtils::doNotOptimize(N_right(0,0));
+	});
+
+	PandaUtils::BlockDiagonalModel block_model(DOF);
+	block_model.detect(M);
+	block_model.compute(M);
+	suite.context("blocks", block_model.summary());
+	suite.run("block 15 dof factorization", [&]()
+	{
+		PandaUtils::doNotOptimize(block_model.compute(M));
+	});
+	suite.run("block 15 dof two task models", [&]()
+	{
+		block_model.operationalSpaceMatrices(Lambda, Jbar, N_left, J_left, identity);
+		J_projected.noalias() = J_right * N_left;
+		block_model.operationalSpaceMatrices(Lambda, Jbar, N_right, J_projected, N_left);
+		PandaUtils::doNotOptimize(N_right(0,0));
+	});
+
+	// the two arms as two robots
+	const MatrixXd M_arm[2] = {M.block(TRUNK_DOF, TRUNK_DOF, ARM_DOF, ARM_DOF),
+		M.block(TRUNK_DOF + ARM_DOF, TRUNK_DOF + ARM_DOF, ARM_DOF, ARM_DOF)};
+	const MatrixXd J_arm[2] = {J_left.middleCols(TRUNK_DOF, ARM_DOF), J_right.rightCols(ARM_DOF)};
+	const MatrixXd identity_arm = MatrixXd::Identity(ARM_DOF, ARM_DOF);
+	MatrixXd M_inv_arm[2] = {M_arm[0].inverse(), M_arm[1].inverse()};
+	MatrixXd N_arm;
+	suite.run("two 7 dof inverses", [&]()
+	{
+		M_inv_arm[0] = M_arm[0].inverse();
+		M_inv_arm[1] = M_arm[1].inverse();
+		PandaUtils::doNotOptimize(M_inv_arm[1](0,0));
+	});
+	suite.run("two 7 dof task models", [&]()
+	{
+		monolithicTaskModel(M_inv_arm[0], J_arm[0], identity_arm, Lambda, Jbar, N_arm);
+		monolithicTaskModel(M_inv_arm[1], J_arm[1], identity_arm, Lambda, Jbar, N_arm);
+		PandaUtils::doNotOptimize(N_arm(0,0));
+	});
+
+	return suite.finish();
+}
@@ -0,0 +1,52 @@
+// Benchmark of the Butterworth filter bank against one sai2 ButterworthFilter, for the
+// signals of a panda : q, dq (14 channels) and q, dq, ddq, tau (28 channels).
+//
+// usage : bench_butterworth [harness options, see BenchmarkHarness.h]
+
+#include "BenchmarkHarness.h"
+#include "filters/ButterworthFilterBank.h"
+#include "filters/ButterworthFilter.h"
+#include <Eigen/Dense>
+
+using namespace std;
+using namespace Eigen;
+
+int main(int argc, char** argv)
+{
+	PandaUtils::BenchmarkSuite suite("butterworth", argc, argv);
+	suite.context("cutoff", 0.015);
+
+	const VectorXd signals = VectorXd::Random(28);
+
+	PandaUtils::ButterworthFilterBank<14> bank_14(14, 0.015);
+	const Matrix<double,14,1> x_14 = signals.head(14);
+	suite.run("bank<14> update", [&]()
+	{
+		PandaUtils::doNotOptimize(bank_14.update(x_14));
+	});
+
+	PandaUtils::ButterworthFilterBank<> bank_dynamic_14(14, 0.015);
+	const VectorXd x_dynamic_14 = signals.head(14);
+	suite.run("bank<> update, 14 channels", [&]()
+	{
+		PandaUtils::doNotOptimize(bank_dynamic_14.update(x_dynamic_14));
+	});
+
+	PandaUtils::ButterworthFilterBank<28> bank_28(28, 0.015);
+	bank_28.setCutoffFrequency(14, 14, 0.05);
+	const Matrix<double,28,1> x_28 = signals;
+	suite.run("bank<28> update, 2 cutoffs", [&]()
+	{
+		PandaUtils::doNotOptimize(bank_28.update(x_28));
+	});
+
+	ButterworthFilter sai2_filter_14(14, 0.015);
+	VectorXd y_14 = VectorXd::Zero(14);
+	suite.run("sai2 ButterworthFilter, 14 channels", [&]()
+	{
+		y_14 = sai2_filter_14.update(x_dynamic_14);
+		PandaUtils::doNotOptimize(y_14);
+	});
+
+	return suite.finish();
+}
@@ -0,0 +1,103 @@
+// Benchmark of the distance queries of the links of the panda to static obstacles with
+// PandaUtils::CollisionDistance, for the obstacle of 22-constraints_avoidance and for clouds
+// of spheres around the robot, against the test of every capsule with every obstacle. the
+// robot moves a little between two queries, as in a control loop at 1 kHz.
+//
+// usage : bench_collision_distance [harness options, see BenchmarkHarness.h]
+
+#include "BenchmarkHarness.h"
+#include "Sai2Model.h"
+#include "model/CollisionDistance.h"
+#include <Eigen/Dense>
+
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+// copied next to the binary by cmake
+const string robot_file = "./resources/panda_arm.urdf";
+
+int main(int argc, char** argv)
+{
+	PandaUtils::BenchmarkSuite suite("collision_distance", argc, argv);
+
+	auto robot = new Sai2Model::Sai2Model(robot_file, false);
+	const int dof = robot->dof();
+	const VectorXd q_init = (VectorXd(7) << 0, -0.5, 0, -2.0, 0, 1.5, 0.8).finished();
+	robot->_q = q_init;
+	robot->updateKinematics();
+	unsigned long long tick = 0;
+	auto move_robot = [&]()
+	{
+		tick++;
+		robot->_q = q_init + 0.2 * sin(1e-3 * tick) * VectorXd::Ones(dof);
+		robot->updateKinematics();
+	};
+	const vector<PandaUtils::CollisionCapsule> capsules = PandaUtils::pandaLinkCapsules();
+	suite.context("capsules", (int) capsules.size());
+
+	// the post of 22-constraints_avoidance
+	PandaUtils::CollisionDistance post_distance(capsules);
+	post_distance.addObstacleCapsule(Vector3d(0.8, 0.1, 0.0), Vector3d(0.8, 0.1, 1.0), 0.06);
+	suite.run("1 obstacle", [&]()
+	{
+		move_robot();
+		post_distance.update(robot);
+		PandaUtils::doNotOptimize(post_distance.closest().distance);
+	});
+
+	for(const int n_obstacles : {100, 1000})
+	{
+		mt19937 generator(0);
+		uniform_real_distribution<double> uniform(-1.0, 1.0);
+		vector<Vector3d> centers;
+		PandaUtils::CollisionDistance cloud_distance(capsules);
+		for(int i=0 ; i<n_obstacles ; i++)
+		{
+			centers.push_back(Vector3d(uniform(generator), uniform(generator), 0.5 + 0.5 * uniform(generator)));
+			cloud_distance.addObstacleSphere(centers.back(), 0.03);
+		}
+		const string n = to_string(n_obstacles);
+
+		suite.run(n + " obstacles", [&]()
+		{
+			move_robot();
+			cloud_distance.update(robot);
+			PandaUtils::doNotOptimize(cloud_distance.closest().distance);
+		});
+		cloud_distance.setMaxDistance(0.1);
+		suite.run(n + " obstacles within 0.1 m", [&]()
+		{
+			move_robot();
+			cloud_distance.update(robot);
+			PandaUtils::doNotOptimize(cloud_distance.closest().distance);
+		});
+
+		// every capsule against every obstacle
+		suite.run(n + " obstacles brute force", [&]()
+		{
+			move_robot();
+			double closest = 1e9;
+			Affine3d T_world_link;
+			for(unsigned int i=0 ; i<capsules.size() ; i++)
+			{
+				robot->transform(T_world_link, capsules[i].link_name);
+				const Vector3d a = T_world_link * capsules[i].a;
+				const Vector3d b = T_world_link * capsules[i].b;
+				for(int j=0 ; j<n_obstacles ; j++)
+				{
+					double s, t;
+					const double d = sqrt(PandaUtils::internal::closestPointsOfSegments(a, b, centers[j], centers[j], s, t));
+					closest = min(closest, d - capsules[i].radius - 0.03);
+				}
+			}
+			PandaUtils::doNotOptimize(closest);
+		});
+	}
+
+	delete robot;
+	return suite.finish();
+}
@@ -0,0 +1,112 @@
+// Benchmark of the handoffs of the CoSimScheduler : one control step and its simulation steps,
+// with empty stages, sequential and pipelined, at a time scale of 0.
+//
+// usage : bench_cosim_scheduler [harness options, see BenchmarkHarness.h]
+//
+// it also checks, with the control loop of the bracing apps, that the sim time advances by
+// the control period at every control step, and fails if not or if the schedule stalls.
+
+#include "BenchmarkHarness.h"
+#include "sim/CoSimScheduler.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <thread>
+
+using namespace std;
+
+const double SIM_DT = 0.0005;
+const int SIM_STEPS_PER_CONTROL = 2;
+
+// counts its steps in sim_steps, read by the exchanges only
+void simulationLoop(PandaUtils::CoSimScheduler* scheduler, unsigned long long* sim_steps)
+{
+	while(scheduler->waitForSimStep())
+	{
+		(*sim_steps)++;
+		scheduler->simStepDone();
+	}
+}
+
+// n_control_steps control steps, then the simulation should be at least at the state of the
+// last one. a watchdog stops the schedule if it stalls
+bool checkSimTimeAdvances(const bool pipelined)
+{
+	const int n_control_steps = 2000;
+	PandaUtils::CoSimScheduler scheduler(SIM_DT, SIM_STEPS_PER_CONTROL, 0, pipelined);
+	unsigned long long sim_steps = 0;
+	unsigned long long exchanged_sim_steps = 0;
+	scheduler.setExchange([&]()
+	{
+		exchanged_sim_steps = sim_steps;
+	},
+	[]()
+	{
+	});
+
+	std::atomic<bool> f_done(false);
+	thread watchdog([&]()
+	{
+		const chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::seconds(10);
+		while(!f_done.load() && chrono::steady_clock::now() < deadline)
+		{
+			this_thread::sleep_for(chrono::milliseconds(10));
+		}
+		scheduler.stop();
+	});
+	thread simulation(simulationLoop, &scheduler, &sim_steps);
+
+	int n_steps = 0;
+	bool f_time_advances = true;
+	while(n_steps < n_control_steps && scheduler.waitForControl())
+	{
+		const double expected_time = n_steps * SIM_STEPS_PER_CONTROL * SIM_DT;
+		if(std::abs(scheduler.controlTime() - expected_time) > 1e-9
+				|| exchanged_sim_steps != (unsigned long long) n_steps * SIM_STEPS_PER_CONTROL)
+		{
+			f_time_advances = false;
+		}
+		n_steps++;
+		scheduler.controlDone();
+	}
+	f_done.store(true);
+	watchdog.join();
+	simulation.join();
+
+	const unsigned long long n_sim_steps = scheduler.numSimSteps();
+	const bool f_completed = n_steps == n_control_steps
+			&& n_sim_steps >= (unsigned long long) (n_control_steps - 1) * SIM_STEPS_PER_CONTROL;
+	cout << "sim time, " << (pipelined ? "pipelined" : "sequential") << " : " << n_steps << " control steps, "
+		<< n_sim_steps << " sim steps, " << scheduler.simTime() << " s" << (f_time_advances ? "" : ", wrong control time") << endl;
+	return f_completed && f_time_advances;
+}
+
+void benchmarkHandoffs(PandaUtils::BenchmarkSuite& suite, const string& name, const bool pipelined)
+{
+	PandaUtils::CoSimScheduler scheduler(SIM_DT, SIM_STEPS_PER_CONTROL, 0, pipelined);
+	unsigned long long sim_steps = 0;
+	thread simulation(simulationLoop, &scheduler, &sim_steps);
+	suite.run(name, [&]()
+	{
+		scheduler.waitForControl();
+		scheduler.controlDone();
+	});
+	scheduler.stop();
+	simulation.join();
+}
+
+int main(int argc, char** argv)
+{
+	PandaUtils::BenchmarkSuite suite("cosim_scheduler", argc, argv);
+	suite.context("sim steps per control", SIM_STEPS_PER_CONTROL);
+
+	benchmarkHandoffs(suite, "control step, sequential", false);
+	benchmarkHandoffs(suite, "control step, pipelined", true);
+
+	const bool f_sequential = checkSimTimeAdvances(false);
+	const bool f_pipelined = checkSimTimeAdvances(true);
+	const int exit_code = suite.finish();
+	return f_sequential && f_pipelined ? exit_code : 1;
+}
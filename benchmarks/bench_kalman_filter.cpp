@@ -0,0 +1,116 @@
+// Benchmark of the Kalman filters of the joint states of a panda : the 21 states (q, dq,
+// ddq) and 7 outputs (q) filter of 00-contact_force_estimator, with fixed and dynamic sizes,
+// with the steady state gain, and the per joint JointKalmanFilter.
+//
+// usage : bench_kalman_filter [harness options, see BenchmarkHarness.h]
+
+#include "BenchmarkHarness.h"
+#include "kalman_filters/KalmanFilter.h"
+#include "kalman_filters/JointKalmanFilter.h"
+#include <Eigen/Dense>
+
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+const int DOF = 7;
+const double DT = 0.001;
+
+// measurements of a joint trajectory, replayed in a loop
+class Measurements {
+public:
+
+	Measurements()
+	: _index(0)
+	{
+		for(int i=0 ; i<1000 ; i++)
+		{
+			Matrix<double,DOF,1> q;
+			for(int j=0 ; j<DOF ; j++)
+			{
+				q(j) = 0.5 * sin(2 * M_PI * i * DT + j) + 1e-3 * ((i * 7919 + j * 104729) % 1000 - 500) / 500.0;
+			}
+			_q.push_back(q);
+		}
+	}
+
+	const Matrix<double,DOF,1>& next()
+	{
+		_index = (_index + 1) % _q.size();
+		return _q[_index];
+	}
+
+private:
+	vector<Matrix<double,DOF,1>, aligned_allocator<Matrix<double,DOF,1>>> _q;
+	unsigned int _index;
+};
+
+int main(int argc, char** argv)
+{
+	PandaUtils::BenchmarkSuite suite("kalman_filter", argc, argv);
+	suite.context("dof", DOF);
+	suite.context("dt", DT);
+
+	MatrixXd F = MatrixXd::Identity(3*DOF,3*DOF);
+	F.block(0,DOF,DOF,DOF) = DT * MatrixXd::Identity(DOF,DOF);
+	F.block(DOF,2*DOF,DOF,DOF) = DT * MatrixXd::Identity(DOF,DOF);
+	MatrixXd H = MatrixXd::Zero(DOF,3*DOF);
+	H.block(0,0,DOF,DOF) = MatrixXd::Identity(DOF,DOF);
+	MatrixXd Q = MatrixXd::Zero(3*DOF,3*DOF);
+	Q.block(2*DOF,2*DOF,DOF,DOF) = 1000 * MatrixXd::Identity(DOF,DOF);
+	const MatrixXd R = 0.1 * MatrixXd::Identity(DOF,DOF);
+
+	Measurements measurements;
+
+	KalmanFilters::KalmanFilter<3*DOF,DOF> fixed_filter(DT, F, H, Q, R);
+	fixed_filter.init();
+	suite.run("KalmanFilter<21,7> update", [&]()
+	{
+		fixed_filter.update(measurements.next());
+		PandaUtils::doNotOptimize(fixed_filter.getState());
+	});
+
+	KalmanFilters::KalmanFilter<3*DOF,DOF> joseph_filter(DT, F, H, Q, R);
+	joseph_filter.setJosephForm(true);
+	joseph_filter.init();
+	suite.run("KalmanFilter<21,7> joseph form", [&]()
+	{
+		joseph_filter.update(measurements.next());
+		PandaUtils::doNotOptimize(joseph_filter.getState());
+	});
+
+	KalmanFilters::KalmanFilter<3*DOF,DOF> steady_filter(DT, F, H, Q, R);
+	steady_filter.enableSteadyStateGain();
+	steady_filter.init();
+	suite.run("KalmanFilter<21,7> steady state gain", [&]()
+	{
+		steady_filter.update(measurements.next());
+		PandaUtils::doNotOptimize(steady_filter.getState());
+	});
+
+	KalmanFilters::KalmanFilter<> dynamic_filter(DT, F, H, Q, R);
+	dynamic_filter.init();
+	VectorXd y = VectorXd::Zero(DOF);
+	suite.run("KalmanFilter<> update", [&]()
+	{
+		y = measurements.next();
+		dynamic_filter.update(y);
+		PandaUtils::doNotOptimize(dynamic_filter.getState());
+	});
+
+	Matrix3d F_joint = Matrix3d::Identity();
+	F_joint(0,1) = DT;
+	F_joint(1,2) = DT;
+	const RowVector3d H_joint(1, 0, 0);
+	const Matrix3d Q_joint = Vector3d(0, 0, 1000).asDiagonal();
+	KalmanFilters::JointKalmanFilter<DOF> joint_filter(DOF, DT, F_joint, H_joint, Q_joint, 0.1);
+	joint_filter.init();
+	suite.run("JointKalmanFilter<7> update", [&]()
+	{
+		joint_filter.update(measurements.next());
+		PandaUtils::doNotOptimize(joint_filter.getState());
+	});
+
+	return suite.finish();
+}
@@ -0,0 +1,189 @@
+// Benchmark of the control thread side of the Logger : the ticks and captures of the
+// variables of a controller (10 vectors of 7) into the ring, while the logging thread
+// writes them to a binary log, with its own thread and with a LoggingService.
+//
+// usage : bench_logger [harness options, see BenchmarkHarness.h]
+//
+// the logs are written to bench_logger*.bin in the working directory, and removed. it also
+// checks that a triggered capture writes its pre-trigger window at full rate, and fails if not.
+
+#include "BenchmarkHarness.h"
+#include "logger/Logger.h"
+#include "logger/BinaryLogReader.h"
+#include <Eigen/Dense>
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+const int N_VARIABLES = 10;
+const int DOF = 7;
+
+// 1 kHz ticks with a trigger at t = 500 ms, a pre-trigger span of 100 ms, a post-trigger span
+// of 20 ms and 1 sample in 10 outside of them : every sample of t = 400 to 520 ms should be
+// in the log, in order
+bool checkTriggeredCapture()
+{
+	VectorXd variable = VectorXd::Zero(DOF);
+	{
+		Logging::Logger logger(0, "bench_logger_triggered.bin");
+		logger.addVectorToLog(&variable, "var");
+		logger.enableBinaryFormat();
+		logger.enableCapture(1 << 16);
+		logger.enableTriggeredCapture(100, 20, 10);
+		logger.start();
+		for(unsigned long long counter=1 ; counter<=1000 ; counter++)
+		{
+			variable(0) = counter;
+			logger.tick(counter, counter * 1e-3);
+			if(counter == 500)
+			{
+				logger.trigger();
+			}
+			// in real time, so that the logging thread is not behind at the trigger
+			usleep(1000);
+		}
+		logger.stop();
+	}
+
+	Logging::BinaryLogReader reader;
+	if(!reader.open("bench_logger_triggered.bin"))
+	{
+		cout << "triggered capture : " << reader.error() << endl;
+		return false;
+	}
+	const int offset = reader.variableOffset("var");
+	vector<double> record;
+	vector<bool> written(1001, false);
+	int n_written = 0;
+	double previous_sample = 0;
+	bool f_ordered = true;
+	while(reader.next(record))
+	{
+		const int sample = record[offset];
+		if(sample < 1 || sample > 1000 || sample <= previous_sample)
+		{
+			f_ordered = false;
+		}
+		else
+		{
+			written[sample] = true;
+		}
+		previous_sample = sample;
+		n_written++;
+	}
+	remove("bench_logger_triggered.bin");
+
+	int n_missing = 0;
+	for(int sample=400 ; sample<=520 ; sample++)
+	{
+		if(!written[sample])
+		{
+			n_missing++;
+		}
+	}
+	cout << "triggered capture : " << n_written << " samples written, " << n_missing
+		<< " missing of the 121 of the window" << (f_ordered ? "" : ", out of order") << endl;
+	return f_ordered && n_missing == 0;
+}
+
+int main(int argc, char** argv)
+{
+	PandaUtils::BenchmarkSuite suite("logger", argc, argv);
+	suite.context("variables", N_VARIABLES);
+	suite.context("size", DOF);
+
+	vector<VectorXd> variables(N_VARIABLES, VectorXd::Zero(DOF));
+	unsigned long long counter = 0;
+
+	{
+		Logging::Logger logger(0, "bench_logger_tick.bin");
+		for(int i=0 ; i<N_VARIABLES ; i++)
+		{
+			logger.addVectorToLog(&variables[i], "var" + to_string(i));
+		}
+		logger.enableBinaryFormat();
+		logger.enableCapture(1 << 16);
+		logger.start();
+		suite.run("tick, every cycle", [&]()
+		{
+			variables[counter % N_VARIABLES](counter % DOF) = counter;
+			counter++;
+			PandaUtils::doNotOptimize(logger.tick(counter, counter * 1e-3));
+		});
+		logger.stop();
+	}
+
+	{
+		Logging::Logger logger(0, "bench_logger_decimated.bin");
+		for(int i=0 ; i<N_VARIABLES ; i++)
+		{
+			logger.addVectorToLog(&variables[i], "var" + to_string(i));
+		}
+		logger.enableBinaryFormat();
+		logger.enableCapture(1 << 16);
+		logger.setDecimation(10);
+		logger.start();
+		suite.run("tick, 1 sample in 10", [&]()
+		{
+			variables[counter % N_VARIABLES](counter % DOF) = counter;
+			counter++;
+			PandaUtils::doNotOptimize(logger.tick(counter, counter * 1e-3));
+		});
+		logger.stop();
+	}
+
+	{
+		Logging::Logger logger(0, "bench_logger_capture.bin");
+		for(int i=0 ; i<N_VARIABLES ; i++)
+		{
+			logger.addVectorToLog(&variables[i], "var" + to_string(i));
+		}
+		logger.enableCompression();
+		logger.enableCapture(1 << 16);
+		logger.start();
+		suite.run("capture, compressed log", [&]()
+		{
+			variables[counter % N_VARIABLES](counter % DOF) = counter;
+			counter++;
+			PandaUtils::doNotOptimize(logger.capture());
+		});
+		logger.stop();
+	}
+
+	{
+		Logging::LoggingService service(8);
+		Logging::Logger logger(0, "bench_logger_service.bin");
+		for(int i=0 ; i<N_VARIABLES ; i++)
+		{
+			logger.addVectorToLog(&variables[i], "var" + to_string(i));
+		}
+		logger.enableBinaryFormat();
+		logger.enableCapture(1 << 16);
+		logger.useService(service);
+		service.start();
+		logger.start();
+		suite.run("tick, logging service", [&]()
+		{
+			variables[counter % N_VARIABLES](counter % DOF) = counter;
+			counter++;
+			PandaUtils::doNotOptimize(logger.tick(counter, counter * 1e-3));
+		});
+		logger.stop();
+		service.stop();
+	}
+
+	remove("bench_logger_tick.bin");
+	remove("bench_logger_decimated.bin");
+	remove("bench_logger_capture.bin");
+	remove("bench_logger_service.bin");
+
+	const bool f_triggered_capture = checkTriggeredCapture();
+	const int exit_code = suite.finish();
+	return f_triggered_capture ? exit_code : 1;
+}
@@ -0,0 +1,71 @@
+// Benchmark of one update of the momentum observer on the panda model, with the Christoffel
+// matrix computed by the observer and with the coriolis plus gravity of the controller, with
+// the size of the robot fixed and dynamic.
+//
+// usage : bench_momentum_observer [harness options, see BenchmarkHarness.h]
+
+#include "BenchmarkHarness.h"
+#include "Sai2Model.h"
+#include "observers/MomentumObserver.h"
+#include <Eigen/Dense>
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+using namespace Eigen;
+
+// copied next to the binary by cmake
+const string robot_file = "./resources/panda_arm.urdf";
+
+int main(int argc, char** argv)
+{
+	PandaUtils::BenchmarkSuite suite("momentum_observer", argc, argv);
+
+	auto robot = new Sai2Model::Sai2Model(robot_file, false);
+	const int dof = robot->dof();
+	robot->_q << 0, -0.5, 0, -2.0, 0, 1.5, 0.8;
+	robot->_dq = 0.2 * VectorXd::Ones(dof);
+	robot->updateModel();
+	suite.context("dof", dof);
+
+	VectorXd command_torques = VectorXd::Random(dof);
+	VectorXd known_contact_torques = VectorXd::Zero(dof);
+	VectorXd coriolis_plus_gravity = VectorXd::Zero(dof);
+	robot->coriolisPlusGravity(coriolis_plus_gravity);
+
+	PandaUtils::MomentumObserver<7> observer(robot, 0.001);
+	observer.setGain(25.0 * MatrixXd::Identity(dof,dof));
+	suite.run("MomentumObserver<7> christoffel", [&]()
+	{
+		observer.update(command_torques, known_contact_torques);
+		PandaUtils::doNotOptimize(observer.getDisturbanceTorqueEstimate());
+	});
+	suite.run("MomentumObserver<7> coriolis+gravity", [&]()
+	{
+		observer.update(command_torques, known_contact_torques, coriolis_plus_gravity);
+		PandaUtils::doNotOptimize(observer.getDisturbanceTorqueEstimate());
+	});
+
+	PandaUtils::MomentumObserver<> dynamic_observer(robot, 0.001);
+	dynamic_observer.setGain(25.0 * MatrixXd::Identity(dof,dof));
+	suite.run("MomentumObserver<> christoffel", [&]()
+	{
+		dynamic_observer.update(command_torques, known_contact_torques);
+		PandaUtils::doNotOptimize(dynamic_observer.getDisturbanceTorqueEstimate());
+	});
+	suite.run("MomentumObserver<> coriolis+gravity", [&]()
+	{
+		dynamic_observer.update(command_torques, known_contact_torques, coriolis_plus_gravity);
+		PandaUtils::doNotOptimize(dynamic_observer.getDisturbanceTorqueEstimate());
+	});
+
+	// the model update the observer reads, for scale
+	suite.run("Sai2Model updateModel", [&]()
+	{
+		robot->updateModel();
+	});
+
+	delete robot;
+	return suite.finish();
+}
@@ -0,0 +1,124 @@
+// Benchmark of one update of the force space particle filters of 18-haptic_local_force_loop,
+// in a steady contact along x while sliding along y, at the numbers of particles of the apps.
+// the accuracy of the filters on contact transitions is measured by bench_pf18.
+//
+// usage : bench_particle_filter [harness options, see BenchmarkHarness.h]
+
+#include "BenchmarkHarness.h"
+#include "ForceSpaceParticleFilter.h"
+#include "ForceSpaceParticleFilter_weight_mem.h"
+#include "ParallelForceSpaceParticleFilter.h"
+#include "random/Xoshiro256.h"
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+// noisy measurements of the contact, replayed in a loop
+class ContactInputs {
+public:
+
+	ContactInputs(const uint64_t seed)
+	: motion_control(0, 4, 0),
+	  force_control(4, 0, 0),
+	  _index(0)
+	{
+		PandaUtils::Xoshiro256 random_generator(seed);
+		for(int i=0 ; i<1000 ; i++)
+		{
+			Vector3d velocity(0, 0.05, 0);
+			Vector3d force(4, 0, 0);
+			for(int j=0 ; j<3 ; j++)
+			{
+				velocity(j) += random_generator.normal(0, 0.002);
+				force(j) += random_generator.normal(0, 0.2);
+			}
+			_velocities.push_back(velocity);
+			_forces.push_back(force);
+		}
+	}
+
+	void next()
+	{
+		_index = (_index + 1) % _forces.size();
+	}
+
+	const Vector3d& velocity() const { return _velocities[_index]; }
+	const Vector3d& force() const { return _forces[_index]; }
+
+	const Vector3d motion_control;
+	const Vector3d force_control;
+
+private:
+	vector<Vector3d, aligned_allocator<Vector3d>> _velocities;
+	vector<Vector3d, aligned_allocator<Vector3d>> _forces;
+	unsigned int _index;
+};
+
+int main(int argc, char** argv)
+{
+	PandaUtils::BenchmarkSuite suite("particle_filter", argc, argv);
+	const int n_threads = max(2, min(4, (int)thread::hardware_concurrency()));
+	suite.context("force_space_dimension", 1);
+	suite.context("parallel_threads", n_threads);
+
+	const uint64_t seed = 1;
+	ContactInputs inputs(seed);
+	Vector3d eigenvalues;
+	Matrix3d eigenvectors;
+
+	for(int n_particles : {300, 1000})
+	{
+		const string particles = " " + to_string(n_particles);
+
+		ForceSpaceParticleFilter filter(n_particles);
+		filter.seed(seed);
+		filter._force_space_dimension = 1;
+		suite.run("tanh" + particles, [&]()
+		{
+			inputs.next();
+			filter.update(inputs.motion_control, inputs.force_control, inputs.velocity(), inputs.force());
+		});
+
+		ForceSpaceParticleFilter_weight_mem weight_mem_filter(n_particles);
+		weight_mem_filter.seed(seed);
+		weight_mem_filter._force_space_dimension = 1;
+		suite.run("weight_mem" + particles, [&]()
+		{
+			inputs.next();
+			weight_mem_filter.update(inputs.motion_control, inputs.force_control, inputs.velocity(), inputs.force());
+		});
+		suite.run("weight_mem computePCA" + particles, [&]()
+		{
+			weight_mem_filter.computePCA(eigenvalues, eigenvectors);
+			PandaUtils::doNotOptimize(eigenvalues);
+		});
+
+		ForceSpaceParticleFilter_weight_mem ess_filter(n_particles);
+		ess_filter.enableEssResampling();
+		ess_filter.seed(seed);
+		ess_filter._force_space_dimension = 1;
+		suite.run("weight_mem ess" + particles, [&]()
+		{
+			inputs.next();
+			ess_filter.update(inputs.motion_control, inputs.force_control, inputs.velocity(), inputs.force());
+		});
+
+		for(int threads : {1, n_threads})
+		{
+			ParallelForceSpaceParticleFilter parallel_filter(n_particles, threads);
+			parallel_filter.seed(seed);
+			suite.run("parallel " + to_string(threads) + " threads" + particles, [&]()
+			{
+				inputs.next();
+				parallel_filter.update(inputs.motion_control, inputs.force_control, inputs.velocity(), inputs.force(), 1);
+			});
+		}
+	}
+
+	return suite.finish();
+}
@@ -0,0 +1,72 @@
+// Benchmark of the encodings of the Eigen values of the redis keys, without a server : the
+// json of RedisClient, the same json encoded on a cycle arena and decoded in place
+// (RedisJsonEigen.h), and the binary encoding of RedisBinaryEigen.h, for a joint vector
+// (7), a mass matrix (7x7) and a jacobian (6x7).
+//
+// usage : bench_redis_codec [harness options, see BenchmarkHarness.h]
+
+#include "BenchmarkHarness.h"
+#include "redis/RedisClient.h"
+#include "redis/RedisBinaryEigen.h"
+#include "redis/RedisJsonEigen.h"
+#include "memory/CycleArena.h"
+#include <Eigen/Dense>
+
+#include <string>
+
+using namespace std;
+using namespace Eigen;
+
+template<typename Matrix>
+void runCodecs(PandaUtils::BenchmarkSuite& suite, const string& name, const Matrix& value)
+{
+	const string json = RedisClient::encodeEigenMatrixJSON(value);
+	suite.run("json encode " + name, [&]()
+	{
+		PandaUtils::doNotOptimize(RedisClient::encodeEigenMatrixJSON(value));
+	});
+	suite.run("json decode " + name, [&]()
+	{
+		PandaUtils::doNotOptimize(RedisClient::decodeEigenMatrixJSON(json));
+	});
+
+	PandaUtils::CycleArena arena;
+	suite.run("arena json encode " + name, [&]()
+	{
+		arena.reset();
+		PandaUtils::ArenaString payload(arena);
+		PandaUtils::encodeEigenMatrixJSON(value, payload);
+		PandaUtils::doNotOptimize(payload);
+	});
+	Matrix json_decoded = value;
+	suite.run("in place json decode " + name, [&]()
+	{
+		PandaUtils::decodeEigenMatrixJSON(json.data(), json.size(), json_decoded);
+		PandaUtils::doNotOptimize(json_decoded);
+	});
+
+	string binary;
+	PandaUtils::encodeEigenMatrixBinary(value, binary);
+	suite.run("binary encode " + name, [&]()
+	{
+		PandaUtils::encodeEigenMatrixBinary(value, binary);
+		PandaUtils::doNotOptimize(binary);
+	});
+	Matrix decoded = value;
+	suite.run("binary decode " + name, [&]()
+	{
+		PandaUtils::decodeEigenMatrixBinary(binary, decoded);
+		PandaUtils::doNotOptimize(decoded);
+	});
+}
+
+int main(int argc, char** argv)
+{
+	PandaUtils::BenchmarkSuite suite("redis_codec", argc, argv);
+
+	runCodecs(suite, "q (7)", VectorXd::Random(7).eval());
+	runCodecs(suite, "M (7x7)", MatrixXd::Random(7,7).eval());
+	runCodecs(suite, "J (6x7)", MatrixXd::Random(6,7).eval());
+
+	return suite.finish();
+}
@@ -0,0 +1,84 @@
+// Benchmark of one access to a robot model shared with sf::safe_ptr, its contention free
+// variant, and PandaUtils::snapshot_ptr, without contention. the cost with a writer thread
+// is measured by bench_shared_model (utils/threads).
+//
+// usage : bench_safe_ptr [harness options, see BenchmarkHarness.h]
+
+#include "BenchmarkHarness.h"
+#include "safe_ptr.h"
+#include "snapshot_ptr.h"
+#include <Eigen/Dense>
+
+using namespace std;
+using namespace Eigen;
+
+const int DOF = 7;
+
+// the part of a Sai2Model the control loop reads
+struct ModelData
+{
+	ModelData()
+	{
+		q.setZero(DOF);
+		dq.setZero(DOF);
+		M.setIdentity(DOF, DOF);
+	}
+
+	VectorXd q;
+	VectorXd dq;
+	MatrixXd M;
+};
+
+int main(int argc, char** argv)
+{
+	PandaUtils::BenchmarkSuite suite("safe_ptr", argc, argv);
+	suite.context("dof", DOF);
+
+	int j = 0;
+
+	sf::safe_ptr<ModelData> safe_model;
+	suite.run("safe_ptr read access", [&]()
+	{
+		j = (j + 1) % DOF;
+		PandaUtils::doNotOptimize(safe_model->q(j));
+	});
+	suite.run("safe_ptr write access", [&]()
+	{
+		j = (j + 1) % DOF;
+		safe_model->dq(j) = j;
+	});
+	suite.run("safe_ptr xlock of 3 accesses", [&]()
+	{
+		j = (j + 1) % DOF;
+		auto locked_model = sf::xlock_safe_ptr(safe_model);
+		PandaUtils::doNotOptimize(locked_model->q(j) + locked_model->dq(j) + locked_model->M(j,j));
+	});
+
+	sf::contfree_safe_ptr<ModelData> contfree_model;
+	const sf::contfree_safe_ptr<ModelData>& const_contfree_model = contfree_model;
+	suite.run("contfree_safe_ptr read access", [&]()
+	{
+		j = (j + 1) % DOF;
+		PandaUtils::doNotOptimize(const_contfree_model->q(j));
+	});
+	suite.run("contfree_safe_ptr write access", [&]()
+	{
+		j = (j + 1) % DOF;
+		contfree_model->dq(j) = j;
+	});
+
+	PandaUtils::snapshot_ptr<ModelData> snapshot_model(1, ModelData());
+	suite.run("snapshot_ptr get", [&]()
+	{
+		j = (j + 1) % DOF;
+		PandaUtils::doNotOptimize(snapshot_model.get()->q(j));
+	});
+	suite.run("snapshot_ptr publish", [&]()
+	{
+		j = (j + 1) % DOF;
+		snapshot_model.writeBuffer().dq(j) = j;
+		snapshot_model.publish();
+	});
+
+	return suite.finish();
+}
@@ -0,0 +1,385 @@
+// Comparison of benchmark results against a baseline of the same machine.
+//
+// reads the json files written by the benchmarks (BenchmarkHarness.h, -o), matches the
+// benchmarks by suite and name, and flags every one whose p50 or p99 is slower than the
+// baseline by more than a threshold. the baselines are results of the same binaries kept in
+// benchmarks/baselines/<machine>/, one file per benchmark binary, so both arguments can be
+// directories, in which case every result file is compared to the baseline file of the same
+// name :
+//
+//   make run_benchmarks
+//   compare_benchmarks benchmarks/baselines/$(hostname) bin/benchmarks/results
+//
+// usage : compare_benchmarks [-t p50_threshold] [-u p99_threshold] [-a] baseline current
+//   -t  relative p50 regression that fails (default 0.10, 10 % slower)
+//   -u  relative p99 regression that fails (default 0.25, the tail is noisier)
+//   -a  print all the benchmarks, not only the regressions and the missing ones
+//
+// the exit code is 1 when a benchmark regressed, 0 otherwise. benchmarks missing from the
+// baseline are listed but do not fail, so that new ones can be added before their baseline.
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct BenchmarkStats
+{
+	double p50_ns;
+	double p99_ns;
+};
+
+// suite/name -> stats
+typedef map<string, BenchmarkStats> BenchmarkTable;
+
+// reader of the subset of json the harness writes : objects, arrays, strings without
+// escapes other than \" and \\, numbers, true, false and null
+class JsonReader {
+public:
+
+	JsonReader(const string& text)
+	: _text(text), _pos(0)
+	{}
+
+	void expect(const char c)
+	{
+		skipSpaces();
+		if(_pos >= _text.size() || _text[_pos] != c)
+		{
+			throw runtime_error(string("expected '") + c + "' at offset " + to_string(_pos) + " in JsonReader::expect()\n");
+		}
+		_pos++;
+	}
+
+	// consumes c if it is the next character
+	bool accept(const char c)
+	{
+		skipSpaces();
+		if(_pos < _text.size() && _text[_pos] == c)
+		{
+			_pos++;
+			return true;
+		}
+		return false;
+	}
+
+	char peek()
+	{
+		skipSpaces();
+		return _pos < _text.size() ? _text[_pos] : '\0';
+	}
+
+	string readString()
+	{
+		expect('"');
+		string value;
+		while(_pos < _text.size() && _text[_pos] != '"')
+		{
+			if(_text[_pos] == '\\' && _pos + 1 < _text.size())
+			{
+				_pos++;
+			}
+			value += _text[_pos++];
+		}
+		expect('"');
+		return value;
+	}
+
+	double readNumber()
+	{
+		skipSpaces();
+		const char* start = _text.c_str() + _pos;
+		char* end;
+		const double value = strtod(start, &end);
+		if(end == start)
+		{
+			throw runtime_error("expected a number at offset " + to_string(_pos) + " in JsonReader::readNumber()\n");
+		}
+		_pos += end - start;
+		return value;
+	}
+
+	// any value, with its content dropped
+	void skipValue()
+	{
+		const char c = peek();
+		if(c == '"')
+		{
+			readString();
+		}
+		else if(c == '{' || c == '[')
+		{
+			const char close = (c == '{') ? '}' : ']';
+			expect(c);
+			if(accept(close))
+			{
+				return;
+			}
+			do
+			{
+				if(close == '}')
+				{
+					readString();
+					expect(':');
+				}
+				skipValue();
+			}
+			while(accept(','));
+			expect(close);
+		}
+		else if(isalpha(c))
+		{
+			while(_pos < _text.size() && isalpha(_text[_pos]))
+			{
+				_pos++;
+			}
+		}
+		else
+		{
+			readNumber();
+		}
+	}
+
+private:
+
+	void skipSpaces()
+	{
+		while(_pos < _text.size() && isspace(_text[_pos]))
+		{
+			_pos++;
+		}
+	}
+
+	const string _text;
+	size_t _pos;
+};
+
+// adds the benchmarks of one result file to the table
+void readResults(const string& path, BenchmarkTable& table)
+{
+	ifstream file(path.c_str());
+	if(!file)
+	{
+		throw runtime_error("could not open " + path + "\n");
+	}
+	stringstream buffer;
+	buffer << file.rdbuf();
+
+	JsonReader reader(buffer.str());
+	string suite;
+	reader.expect('{');
+	do
+	{
+		const string key = reader.readString();
+		reader.expect(':');
+		if(key == "suite")
+		{
+			suite = reader.readString();
+		}
+		else if(key == "benchmarks")
+		{
+			reader.expect('[');
+			if(reader.accept(']'))
+			{
+				continue;
+			}
+			do
+			{
+				string name;
+				BenchmarkStats stats;
+				stats.p50_ns = -1;
+				stats.p99_ns = -1;
+				reader.expect('{');
+				do
+				{
+					const string field = reader.readString();
+					reader.expect(':');
+					if(field == "name")
+					{
+						name = reader.readString();
+					}
+					else if(field == "p50_ns")
+					{
+						stats.p50_ns = reader.readNumber();
+					}
+					else if(field == "p99_ns")
+					{
+						stats.p99_ns = reader.readNumber();
+					}
+					else
+					{
+						reader.skipValue();
+					}
+				}
+				while(reader.accept(','));
+				reader.expect('}');
+				if(name.empty() || stats.p50_ns < 0 || stats.p99_ns < 0)
+				{
+					throw runtime_error("benchmark without name, p50_ns or p99_ns in " + path + "\n");
+				}
+				// the suite is written before the benchmarks
+				table[suite + "/" + name] = stats;
+			}
+			while(reader.accept(','));
+			reader.expect(']');
+		}
+		else
+		{
+			reader.skipValue();
+		}
+	}
+	while(reader.accept(','));
+	reader.expect('}');
+}
+
+bool isDirectory(const string& path)
+{
+	struct stat info;
+	return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+// the json files of a directory, sorted
+vector<string> jsonFiles(const string& directory)
+{
+	vector<string> files;
+	DIR* dir = opendir(directory.c_str());
+	if(dir == NULL)
+	{
+		throw runtime_error("could not open the directory " + directory + "\n");
+	}
+	struct dirent* entry;
+	while((entry = readdir(dir)) != NULL)
+	{
+		const string file = entry->d_name;
+		if(file.size() > 5 && file.compare(file.size() - 5, 5, ".json") == 0)
+		{
+			files.push_back(file);
+		}
+	}
+	closedir(dir);
+	sort(files.begin(), files.end());
+	return files;
+}
+
+// relative change of current over baseline, +0.1 for 10 % slower
+double relativeChange(const double baseline, const double current)
+{
+	return baseline > 0 ? current / baseline - 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+	double p50_threshold = 0.10;
+	double p99_threshold = 0.25;
+	bool print_all = false;
+	vector<string> paths;
+
+	for(int i=1 ; i<argc ; i++)
+	{
+		const string arg = argv[i];
+		if((arg == "-t" || arg == "-u") && i + 1 < argc)
+		{
+			(arg == "-t" ? p50_threshold : p99_threshold) = max(0.0, atof(argv[++i]));
+		}
+		else if(arg == "-a")
+		{
+			print_all = true;
+		}
+		else if(!arg.empty() && arg[0] != '-')
+		{
+			paths.push_back(arg);
+		}
+		else
+		{
+			paths.clear();
+			break;
+		}
+	}
+	if(paths.size() != 2)
+	{
+		cout << "usage : " << argv[0] << " [-t p50_threshold] [-u p99_threshold] [-a] baseline current" << endl;
+		return 2;
+	}
+
+	BenchmarkTable baseline;
+	BenchmarkTable current;
+	try
+	{
+		if(isDirectory(paths[1]))
+		{
+			const vector<string> files = jsonFiles(paths[1]);
+			for(unsigned int i=0 ; i<files.size() ; i++)
+			{
+				readResults(paths[1] + "/" + files[i], current);
+				const string baseline_file = (isDirectory(paths[0]) ? paths[0] + "/" : "") + files[i];
+				ifstream exists(baseline_file.c_str());
+				if(exists)
+				{
+					readResults(baseline_file, baseline);
+				}
+				else
+				{
+					cout << "no baseline " << baseline_file << endl;
+				}
+			}
+		}
+		else
+		{
+			readResults(paths[0], baseline);
+			readResults(paths[1], current);
+		}
+	}
+	catch(const runtime_error& e)
+	{
+		cout << e.what();
+		return 2;
+	}
+
+	cout << left << setw(56) << "benchmark" << right << setw(12) << "p50 ns" << setw(9) << "change"
+		<< setw(12) << "p99 ns" << setw(9) << "change" << endl;
+	cout << fixed;
+	int n_regressions = 0;
+	int n_missing = 0;
+	for(BenchmarkTable::const_iterator it = current.begin() ; it != current.end() ; ++it)
+	{
+		BenchmarkTable::const_iterator base = baseline.find(it->first);
+		if(base == baseline.end())
+		{
+			n_missing++;
+			cout << left << setw(56) << it->first << right << setprecision(1) << setw(12) << it->second.p50_ns
+				<< setw(9) << "new" << setw(12) << it->second.p99_ns << setw(9) << "new" << endl;
+			continue;
+		}
+		const double p50_change = relativeChange(base->second.p50_ns, it->second.p50_ns);
+		const double p99_change = relativeChange(base->second.p99_ns, it->second.p99_ns);
+		const bool regressed = p50_change > p50_threshold || p99_change > p99_threshold;
+		if(regressed)
+		{
+			n_regressions++;
+		}
+		if(regressed || print_all)
+		{
+			cout << left << setw(56) << it->first << right << setprecision(1)
+				<< setw(12) << it->second.p50_ns << setw(8) << 100 * p50_change << "%"
+				<< setw(12) << it->second.p99_ns << setw(8) << 100 * p99_change << "%"
+				<< (regressed ? "  REGRESSED" : "") << endl;
+		}
+	}
+
+	cout << current.size() << " benchmarks, " << n_regressions << " regressed (p50 over "
+		<< setprecision(0) << 100 * p50_threshold << " %, p99 over " << 100 * p99_threshold << " %), "
+		<< n_missing << " without baseline" << endl;
+	return n_regressions > 0 ? 1 : 0;
+}
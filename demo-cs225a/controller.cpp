@@ -1,8 +1,11 @@
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
+#include "timer/LoopHealth.h"
+#include "threads/RealtimeThread.h"
 #include "tasks/JointTask.h"
 #include "tasks/PosOriTask.h"
+#include "model/MassMatrixInverse.h"
 
 #include <iostream>
 #include <string>
@@ -47,10 +50,12 @@ const string KV_POS_KEY = "sai2::PandaApplication::controller::kv_pos";
 
 // controller state
 const string STATE_KEY = "sai2::PandaApplication::controller::state";
+const string LOOP_HEALTH_KEY = "sai2::PandaApplication::controller::loop_health";
 
 unsigned long long controller_counter = 0;
 
 const bool flag_simulation = false;
+
 // const bool flag_simulation = true;
 
 const bool inertia_regularization = true;
@@ -95,13 +100,7 @@ int main() {
 
 	// prepare controller	
 	int dof = robot->dof();
-	MatrixXd M_reg = MatrixXd::Zero(dof,dof);
-	if(inertia_regularization)
-	{
-		M_reg(4,4) = 0.07;
-		M_reg(5,5) = 0.07;
-		M_reg(6,6) = 0.07;
-	}
+	PandaUtils::MassMatrixInverse<7> mass_matrix_inverse(dof, inertia_regularization ? 0.07 : 0.0);
 	VectorXd command_torques = VectorXd::Zero(dof);
 	VectorXd coriolis = VectorXd::Zero(dof);
 	MatrixXd N_prec = MatrixXd::Identity(dof, dof);
@@ -150,15 +149,16 @@ int main() {
 	LoopTimer timer;
 	timer.initializeTimer();
 	timer.setLoopFrequency(1000); 
+	PandaUtils::LoopHealth loop_health(1000);
+	PandaUtils::configureRealtimeThread("controller", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
 	double current_time = 0;
 	double prev_time = 0;
 	double dt = 0;
-	bool fTimerDidSleep = true;
 	double start_time = timer.elapsedTime(); //secs
 
 	while (runloop) {
 		// wait for next scheduled loop
-		timer.waitForNextLoop();
+		loop_health.waitForNextLoop(timer);
 		current_time = timer.elapsedTime() - start_time;
 		dt = current_time - prev_time;
 
@@ -183,8 +183,8 @@ int main() {
 			posori_task->_kp_pos_vec = redis_client.getEigenMatrixJSON(KP_POS_KEY);
 			posori_task->_kv_pos_vec = redis_client.getEigenMatrixJSON(KV_POS_KEY);
 			robot->updateKinematics();
-			robot->_M = redis_client.getEigenMatrixJSON(MASSMATRIX_KEY) + M_reg;
-			robot->_M_inv = robot->_M.inverse();
+			robot->_M = redis_client.getEigenMatrixJSON(MASSMATRIX_KEY);
+			mass_matrix_inverse.update(robot);
 
 			coriolis = redis_client.getEigenMatrixJSON(CORIOLIS_KEY);
 		}
@@ -254,6 +254,12 @@ int main() {
 
 		previous_state = state;
 		prev_time = current_time;
+
+		if(controller_counter % 1000 == 0)
+		{
+			loop_health.publish(redis_client, LOOP_HEALTH_KEY);
+		}
+
 		controller_counter++;
 	}
 
@@ -266,6 +272,7 @@ int main() {
 	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
 	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
     std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+    loop_health.print(std::cout);
 
 	return 0;
 }
@@ -0,0 +1,408 @@
+#ifndef UTILS_COVERAGE_COVERAGE_MAP_H_
+#define UTILS_COVERAGE_COVERAGE_MAP_H_
+
+// Grid of the areas of a board already covered by a tool in contact, e.g. an eraser, updated
+// at every tick of the control loop.
+//
+// the board is a rectangle of the plane z = 0 of its frame, from (0, 0) to (size_x, size_y),
+// cut in square cells. a cell keeps the number of passes of the tool over it, saturated at
+// 255. the footprint of the tool (a disc, or a rectangle turning with the tool around the
+// normal of the board) is rasterized once per orientation at construction, so covering the
+// footprint at a position is a loop over a fixed list of cells : the cost of a tick does
+// not depend on the size of the board nor on what is covered already. moves longer than
+// half a cell between two ticks are filled with up to max_substeps footprints.
+//
+// the number of covered cells, the covered cells of every tile of tile_cells x tile_cells
+// cells, and a bit per cell image are updated with the passes, so the coverage is a
+// division, the least covered tiles a pass over the tiles, and the image is ready to be
+// sent as it is :
+//
+//   PandaUtils::CoverageMap coverage_map(T_world_board, 1.0, 0.8, 0.005,
+//           PandaUtils::CoverageMap::Footprint::rectangle(0.12, 0.05));
+//   while(...) {                                                  // control loop
+//       coverage_map.update(tool_position_in_world, tool_orientation_in_world, f_contact);
+//       if(controller_counter % 250 == 0) {
+//           redis_writer.set(COVERAGE_MAP_KEY, coverage_map.image());
+//       }
+//   }
+//   cout << 100 * coverage_map.coverage() << " % of the board cleaned" << endl;
+//
+// the image is a CoverageImageHeader followed by the bits of the cells, row after row
+// (least significant bit first), and is decoded by decodeImage(), e.g. by the simviz overlay
+// graphics/CoverageMapOverlay.h. nothing is allocated after the construction.
+
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+struct CoverageImageHeader {
+	// "CMAP"
+	uint32_t magic;
+	uint32_t version;
+	uint32_t cells_x;
+	uint32_t cells_y;
+	uint32_t n_covered;
+	uint32_t reserved;
+	double cell_size;
+	// pose of the board frame, in the frame of the map (the world for the simviz)
+	double position[3];
+	// w x y z
+	double orientation[4];
+
+	static const uint32_t MAGIC = 0x50414d43;
+	static const uint32_t VERSION = 1;
+};
+
+class CoverageMap {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	struct Footprint {
+		enum Shape {DISC, RECTANGLE};
+
+		Shape shape;
+		// radius of the disc, or length (along the x axis of the tool) and width of the rectangle
+		double length;
+		double width;
+
+		static Footprint disc(const double radius)
+		{
+			Footprint footprint;
+			footprint.shape = DISC;
+			footprint.length = 2 * radius;
+			footprint.width = 2 * radius;
+			return footprint;
+		}
+
+		static Footprint rectangle(const double length, const double width)
+		{
+			Footprint footprint;
+			footprint.shape = RECTANGLE;
+			footprint.length = length;
+			footprint.width = width;
+			return footprint;
+		}
+	};
+
+	// T_frame_board is the pose of the board in the frame of the points given to update()
+	CoverageMap(const Eigen::Affine3d& T_frame_board, const double size_x, const double size_y, const double cell_size,
+			const Footprint& footprint, const int n_orientations = 36, const int tile_cells = 10, const int max_substeps = 8)
+	: _T_frame_board(T_frame_board),
+	  _T_board_frame(T_frame_board.inverse()),
+	  _cell_size(cell_size),
+	  _cells_x(std::ceil(size_x / cell_size - 1e-9)),
+	  _cells_y(std::ceil(size_y / cell_size - 1e-9)),
+	  _tile_cells(tile_cells),
+	  _tiles_x((_cells_x + tile_cells - 1) / tile_cells),
+	  _tiles_y((_cells_y + tile_cells - 1) / tile_cells),
+	  _max_substeps(max_substeps),
+	  _n_covered(0),
+	  _f_last_stamp(false),
+	  _last_stamp(Eigen::Vector2d::Zero()),
+	  _last_orientation(0)
+	{
+		if(size_x <= 0 || size_y <= 0 || cell_size <= 0 || footprint.length <= 0 || footprint.width <= 0)
+		{
+			throw std::invalid_argument("board, cells and footprint should have positive sizes in CoverageMap::CoverageMap()\n");
+		}
+		if(n_orientations < 1 || tile_cells < 1 || max_substeps < 1)
+		{
+			throw std::invalid_argument("orientations, tiles and substeps should be at least 1 in CoverageMap::CoverageMap()\n");
+		}
+		_passes.assign(_cells_x * _cells_y, 0);
+		_tile_covered.assign(_tiles_x * _tiles_y, 0);
+
+		// the footprint for the tool turned by k / n_orientations of a turn, the rectangle has
+		// the same footprint after a half turn and the disc after any
+		const int n_stencils = (footprint.shape == Footprint::DISC) ? 1 : n_orientations;
+		_orientation_step = ((footprint.shape == Footprint::DISC) ? 2 * M_PI : M_PI) / n_stencils;
+		_stencils.resize(n_stencils);
+		const int reach = std::ceil(0.5 * std::sqrt(footprint.length * footprint.length + footprint.width * footprint.width) / cell_size) + 1;
+		for(int k=0 ; k<n_stencils ; k++)
+		{
+			const double angle = k * _orientation_step;
+			const double c = std::cos(angle), s = std::sin(angle);
+			for(int dy=-reach ; dy<=reach ; dy++)
+			{
+				for(int dx=-reach ; dx<=reach ; dx++)
+				{
+					// center of the cell in the frame of the tool
+					const double x = cell_size * (c * dx + s * dy);
+					const double y = cell_size * (-s * dx + c * dy);
+					const bool inside = (footprint.shape == Footprint::DISC)
+						? (x * x + y * y <= 0.25 * footprint.length * footprint.length)
+						: (std::abs(x) <= 0.5 * footprint.length && std::abs(y) <= 0.5 * footprint.width);
+					if(inside)
+					{
+						_stencils[k].push_back(Eigen::Vector2i(dx, dy));
+					}
+				}
+			}
+			// a footprint smaller than a cell still covers the cell of the contact
+			if(_stencils[k].empty())
+			{
+				_stencils[k].push_back(Eigen::Vector2i(0, 0));
+			}
+		}
+
+		CoverageImageHeader header;
+		memset(&header, 0, sizeof(header));
+		header.magic = CoverageImageHeader::MAGIC;
+		header.version = CoverageImageHeader::VERSION;
+		header.cells_x = _cells_x;
+		header.cells_y = _cells_y;
+		header.cell_size = cell_size;
+		const Eigen::Quaterniond orientation(T_frame_board.linear());
+		for(int i=0 ; i<3 ; i++)
+		{
+			header.position[i] = T_frame_board.translation()(i);
+		}
+		header.orientation[0] = orientation.w();
+		header.orientation[1] = orientation.x();
+		header.orientation[2] = orientation.y();
+		header.orientation[3] = orientation.z();
+		_image.assign(sizeof(CoverageImageHeader) + (_cells_x * _cells_y + 7) / 8, '\0');
+		memcpy(&_image[0], &header, sizeof(header));
+	}
+
+	// control loop, every tick : the tool position and orientation in the frame of the map.
+	// a contact covers the footprint at the projection of the position on the board
+	void update(const Eigen::Vector3d& tool_position, const Eigen::Matrix3d& tool_orientation, const bool f_contact)
+	{
+		if(!f_contact)
+		{
+			_f_last_stamp = false;
+			return;
+		}
+		const Eigen::Vector2d position = (_T_board_frame * tool_position).head<2>();
+		const Eigen::Vector3d tool_axis = _T_board_frame.linear() * tool_orientation.col(0);
+		const int orientation = stencilIndex(std::atan2(tool_axis(1), tool_axis(0)));
+
+		if(!_f_last_stamp)
+		{
+			stamp(position, orientation);
+			return;
+		}
+		const double distance = (position - _last_stamp).norm();
+		if(distance < 0.5 * _cell_size && orientation == _last_orientation)
+		{
+			return;
+		}
+		// the cells swept since the last footprint, at most max_substeps footprints
+		const int n_steps = std::min(_max_substeps, std::max(1, (int) std::ceil(distance / (0.5 * _cell_size))));
+		const Eigen::Vector2d start = _last_stamp;
+		for(int i=1 ; i<=n_steps ; i++)
+		{
+			stamp(start + (position - start) * ((double) i / n_steps), orientation);
+		}
+	}
+
+	void clear()
+	{
+		std::fill(_passes.begin(), _passes.end(), 0);
+		std::fill(_tile_covered.begin(), _tile_covered.end(), 0);
+		std::fill(_image.begin() + sizeof(CoverageImageHeader), _image.end(), '\0');
+		_n_covered = 0;
+		_f_last_stamp = false;
+		setImageCount();
+	}
+
+	// fraction of the cells of the board covered at least once
+	double coverage() const
+	{
+		return (double) _n_covered / _passes.size();
+	}
+
+	int numCovered() const { return _n_covered; }
+	int numCells() const { return _passes.size(); }
+	int cellsX() const { return _cells_x; }
+	int cellsY() const { return _cells_y; }
+	double cellSize() const { return _cell_size; }
+
+	// passes over the cell, 0 outside the board
+	int passes(const int ix, const int iy) const
+	{
+		if(ix < 0 || iy < 0 || ix >= _cells_x || iy >= _cells_y)
+		{
+			return 0;
+		}
+		return _passes[iy * _cells_x + ix];
+	}
+
+	int numTiles() const { return _tiles_x * _tiles_y; }
+
+	// fraction of the cells of the tile not covered yet
+	double tileUncovered(const int tile) const
+	{
+		return 1.0 - (double) _tile_covered[tile] / tileCells(tile);
+	}
+
+	// center of the tile, in the frame of the map
+	Eigen::Vector3d tileCenter(const int tile) const
+	{
+		const int tx = tile % _tiles_x, ty = tile / _tiles_x;
+		const double x0 = tx * _tile_cells * _cell_size, y0 = ty * _tile_cells * _cell_size;
+		const double x1 = std::min(_cells_x, (tx + 1) * _tile_cells) * _cell_size;
+		const double y1 = std::min(_cells_y, (ty + 1) * _tile_cells) * _cell_size;
+		return _T_frame_board * Eigen::Vector3d(0.5 * (x0 + x1), 0.5 * (y0 + y1), 0);
+	}
+
+	// the tile with the largest uncovered fraction (the closest one to the position if several),
+	// -1 when the board is covered
+	int leastCoveredTile(const Eigen::Vector3d& position) const
+	{
+		int best = -1;
+		double best_uncovered = 0, best_distance = 0;
+		for(int tile=0 ; tile<numTiles() ; tile++)
+		{
+			const double uncovered = tileUncovered(tile);
+			if(uncovered <= 0)
+			{
+				continue;
+			}
+			const double distance = (tileCenter(tile) - position).squaredNorm();
+			if(best < 0 || uncovered > best_uncovered + 1e-9 || (uncovered > best_uncovered - 1e-9 && distance < best_distance))
+			{
+				best = tile;
+				best_uncovered = uncovered;
+				best_distance = distance;
+			}
+		}
+		return best;
+	}
+
+	// tiles with more than min_uncovered of their cells not covered, in the given vector
+	// (cleared, with the capacity of its last use)
+	void uncoveredTiles(std::vector<int>& tiles, const double min_uncovered) const
+	{
+		tiles.clear();
+		for(int tile=0 ; tile<numTiles() ; tile++)
+		{
+			if(tileUncovered(tile) > min_uncovered)
+			{
+				tiles.push_back(tile);
+			}
+		}
+	}
+
+	// header and bits of the cells, see decodeImage()
+	const std::string& image() const
+	{
+		return _image;
+	}
+
+	// a received image : its header, and covered(ix, iy) of its cells. false if it is not an
+	// image of this version or it is truncated
+	static bool decodeImage(const std::string& image, CoverageImageHeader& header)
+	{
+		if(image.size() < sizeof(CoverageImageHeader))
+		{
+			return false;
+		}
+		memcpy(&header, image.data(), sizeof(header));
+		return header.magic == CoverageImageHeader::MAGIC && header.version == CoverageImageHeader::VERSION
+			&& image.size() == sizeof(CoverageImageHeader) + ((uint64_t) header.cells_x * header.cells_y + 7) / 8;
+	}
+
+	static bool covered(const std::string& image, const CoverageImageHeader& header, const int ix, const int iy)
+	{
+		const uint64_t cell = (uint64_t) iy * header.cells_x + ix;
+		return (image[sizeof(CoverageImageHeader) + cell / 8] >> (cell % 8)) & 1;
+	}
+
+private:
+
+	int stencilIndex(const double angle) const
+	{
+		const int n = _stencils.size();
+		int k = (int) std::floor(angle / _orientation_step + 0.5) % n;
+		return (k < 0) ? k + n : k;
+	}
+
+	void stamp(const Eigen::Vector2d& position, const int orientation)
+	{
+		_f_last_stamp = true;
+		_last_stamp = position;
+		_last_orientation = orientation;
+
+		const int cx = (int) std::floor(position(0) / _cell_size);
+		const int cy = (int) std::floor(position(1) / _cell_size);
+		const std::vector<Eigen::Vector2i>& stencil = _stencils[orientation];
+		bool f_new = false;
+		for(unsigned int i=0 ; i<stencil.size() ; i++)
+		{
+			const int ix = cx + stencil[i](0), iy = cy + stencil[i](1);
+			if(ix < 0 || iy < 0 || ix >= _cells_x || iy >= _cells_y)
+			{
+				continue;
+			}
+			const int cell = iy * _cells_x + ix;
+			if(_passes[cell] == 0)
+			{
+				_n_covered++;
+				_tile_covered[(iy / _tile_cells) * _tiles_x + ix / _tile_cells]++;
+				_image[sizeof(CoverageImageHeader) + cell / 8] |= (char) (1 << (cell % 8));
+				f_new = true;
+			}
+			if(_passes[cell] < 255)
+			{
+				_passes[cell]++;
+			}
+		}
+		if(f_new)
+		{
+			setImageCount();
+		}
+	}
+
+	void setImageCount()
+	{
+		const uint32_t n_covered = _n_covered;
+		memcpy(&_image[offsetof(CoverageImageHeader, n_covered)], &n_covered, sizeof(n_covered));
+	}
+
+	int tileCells(const int tile) const
+	{
+		const int tx = tile % _tiles_x, ty = tile / _tiles_x;
+		return (std::min(_cells_x, (tx + 1) * _tile_cells) - tx * _tile_cells)
+			* (std::min(_cells_y, (ty + 1) * _tile_cells) - ty * _tile_cells);
+	}
+
+	const Eigen::Affine3d _T_frame_board;
+	const Eigen::Affine3d _T_board_frame;
+	const double _cell_size;
+	const int _cells_x;
+	const int _cells_y;
+	const int _tile_cells;
+	const int _tiles_x;
+	const int _tiles_y;
+	const int _max_substeps;
+
+	// row after row
+	std::vector<uint8_t> _passes;
+	std::vector<int> _tile_covered;
+	int _n_covered;
+
+	// cells of the footprint around the cell of the contact, for each orientation
+	std::vector<std::vector<Eigen::Vector2i> > _stencils;
+	double _orientation_step;
+
+	bool _f_last_stamp;
+	Eigen::Vector2d _last_stamp;
+	int _last_orientation;
+
+	std::string _image;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_COVERAGE_COVERAGE_MAP_H_
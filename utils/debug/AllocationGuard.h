@@ -0,0 +1,335 @@
+#ifndef UTILS_DEBUG_ALLOCATION_GUARD_H_
+#define UTILS_DEBUG_ALLOCATION_GUARD_H_
+
+// Heap allocations in the body of a control loop, counted by call site or aborted on.
+//
+// with PANDA_ALLOCATION_GUARD defined (cmake -DPANDA_ALLOCATION_GUARD=ON), this header
+// replaces malloc, calloc, realloc and the aligned allocations of the executable, which
+// covers operator new, the eigen temporaries and the strings. an allocation of a thread
+// inside a guarded scope is counted with its call stack, or aborts the app with the call
+// stack in ABORT mode. without the define, the scopes compile to nothing :
+//
+//   PandaUtils::AllocationGuard allocation_guard(PandaUtils::AllocationGuard::COUNT);
+//   while(runloop)
+//   {
+//       timer.waitForNextLoop();
+//       PANDA_ALLOCATION_GUARD_SCOPE(allocation_guard);      // until the end of the loop body
+//       ...
+//   }
+//   allocation_guard.report(std::cout);                     // call sites, most frequent first
+//
+// the header defines malloc itself when enabled, so it is included by one translation unit
+// of the executable only, the one of the loop. the call sites are raw addresses of the
+// executable without -rdynamic, for addr2line -f -C -e <app> <address>. with
+// EIGEN_RUNTIME_NO_MALLOC in a debug build, eigen also asserts at the allocating expression.
+
+#include <iostream>
+#include <string>
+
+#ifdef PANDA_ALLOCATION_GUARD
+#include <Eigen/Core>
+#include <execinfo.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#endif
+
+namespace PandaUtils {
+
+#ifdef PANDA_ALLOCATION_GUARD
+
+namespace internal {
+
+struct AllocationSite
+{
+	static const int DEPTH = 12;
+	void* frames[DEPTH];
+	int depth;
+	uint64_t count;
+	uint64_t bytes;
+};
+
+// zero initialized before any allocation, without constructor
+struct AllocationGuardState
+{
+	static const int MAX_SITES = 64;
+	AllocationSite sites[MAX_SITES];
+	int n_sites;
+	uint64_t n_allocations;
+	uint64_t n_unrecorded;
+	std::atomic_flag lock;
+	// 0 count, 1 abort
+	int mode;
+};
+
+inline AllocationGuardState& allocationGuardState()
+{
+	static AllocationGuardState state;
+	return state;
+}
+
+inline int& allocationGuardArmed()
+{
+	static thread_local int armed = 0;
+	return armed;
+}
+
+inline int& allocationGuardInHook()
+{
+	static thread_local int in_hook = 0;
+	return in_hook;
+}
+
+inline void onAllocation(const size_t size)
+{
+	if(!allocationGuardArmed() || allocationGuardInHook())
+	{
+		return;
+	}
+	allocationGuardInHook() = 1;
+
+	void* frames[AllocationSite::DEPTH];
+	const int depth = backtrace(frames, AllocationSite::DEPTH);
+	AllocationGuardState& state = allocationGuardState();
+
+	if(state.mode == 1)
+	{
+		static const char message[] = "heap allocation in a guarded scope, aborting. call stack :\n";
+		ssize_t written = write(STDERR_FILENO, message, sizeof(message) - 1);
+		(void) written;
+		backtrace_symbols_fd(frames, depth, STDERR_FILENO);
+		abort();
+	}
+
+	while(state.lock.test_and_set(std::memory_order_acquire))
+	{}
+	state.n_allocations++;
+	int site = -1;
+	for(int i=0 ; i<state.n_sites && site < 0 ; i++)
+	{
+		if(state.sites[i].depth == depth && std::memcmp(state.sites[i].frames, frames, depth * sizeof(void*)) == 0)
+		{
+			site = i;
+		}
+	}
+	if(site < 0 && state.n_sites < AllocationGuardState::MAX_SITES)
+	{
+		site = state.n_sites++;
+		std::memcpy(state.sites[site].frames, frames, depth * sizeof(void*));
+		state.sites[site].depth = depth;
+	}
+	if(site >= 0)
+	{
+		state.sites[site].count++;
+		state.sites[site].bytes += size;
+	}
+	else
+	{
+		state.n_unrecorded++;
+	}
+	state.lock.clear(std::memory_order_release);
+
+	allocationGuardInHook() = 0;
+}
+
+} /* namespace internal */
+
+class AllocationGuard {
+public:
+
+	enum Mode {COUNT, ABORT};
+
+	AllocationGuard(const Mode mode = COUNT)
+	: _n_scopes(0)
+	{
+		internal::allocationGuardState().mode = (mode == ABORT) ? 1 : 0;
+		// the first backtrace loads the unwinder, which allocates
+		void* frames[2];
+		backtrace(frames, 2);
+	}
+
+	// for the calling thread
+	void arm()
+	{
+		internal::allocationGuardArmed() = 1;
+		_n_scopes++;
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+		Eigen::internal::set_is_malloc_allowed(false);
+#endif
+	}
+
+	void disarm()
+	{
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+		Eigen::internal::set_is_malloc_allowed(true);
+#endif
+		internal::allocationGuardArmed() = 0;
+	}
+
+	uint64_t allocations() const
+	{
+		return internal::allocationGuardState().n_allocations;
+	}
+
+	void report(std::ostream& os) const
+	{
+		internal::AllocationGuardState& state = internal::allocationGuardState();
+		while(state.lock.test_and_set(std::memory_order_acquire))
+		{}
+		int order[internal::AllocationGuardState::MAX_SITES];
+		const int n_sites = state.n_sites;
+		for(int i=0 ; i<n_sites ; i++)
+		{
+			order[i] = i;
+		}
+		std::sort(order, order + n_sites, [&](const int a, const int b)
+		{
+			return state.sites[a].count > state.sites[b].count;
+		});
+		internal::AllocationSite sites[internal::AllocationGuardState::MAX_SITES];
+		for(int i=0 ; i<n_sites ; i++)
+		{
+			sites[i] = state.sites[order[i]];
+		}
+		const uint64_t n_allocations = state.n_allocations;
+		const uint64_t n_unrecorded = state.n_unrecorded;
+		state.lock.clear(std::memory_order_release);
+
+		os << "heap allocations in guarded scopes : " << n_allocations << " in " << _n_scopes << " scopes, "
+			<< n_sites << " call sites";
+		if(n_unrecorded > 0)
+		{
+			os << " (" << n_unrecorded << " from sites over the table)";
+		}
+		os << "\n";
+		for(int i=0 ; i<n_sites ; i++)
+		{
+			os << std::setw(10) << sites[i].count << " allocations, " << sites[i].bytes << " bytes\n";
+			// the first frames are the hook and malloc
+			char** symbols = backtrace_symbols(sites[i].frames, sites[i].depth);
+			for(int j=2 ; j<sites[i].depth ; j++)
+			{
+				os << "        " << (symbols != NULL ? symbols[j] : "?") << "\n";
+			}
+			free(symbols);
+		}
+	}
+
+private:
+	unsigned long long _n_scopes;
+};
+
+#else
+
+class AllocationGuard {
+public:
+
+	enum Mode {COUNT, ABORT};
+
+	AllocationGuard(const Mode = COUNT) {}
+
+	void arm() {}
+	void disarm() {}
+
+	unsigned long long allocations() const
+	{
+		return 0;
+	}
+
+	void report(std::ostream& os) const
+	{
+		os << "heap allocations : not guarded, build with -DPANDA_ALLOCATION_GUARD=ON\n";
+	}
+};
+
+#endif
+
+// arms the guard for the calling thread over its lifetime
+class AllocationGuardScope {
+public:
+
+	AllocationGuardScope(AllocationGuard& guard)
+	: _guard(guard)
+	{
+		_guard.arm();
+	}
+
+	~AllocationGuardScope()
+	{
+		_guard.disarm();
+	}
+
+private:
+	AllocationGuard& _guard;
+};
+
+} /* namespace PandaUtils */
+
+#ifdef PANDA_ALLOCATION_GUARD
+
+#define PANDA_ALLOCATION_GUARD_SCOPE(guard) PandaUtils::AllocationGuardScope panda_allocation_guard_scope(guard)
+
+// the allocator of glibc behind the replaced functions
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+
+void* malloc(size_t size)
+{
+	PandaUtils::internal::onAllocation(size);
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+	PandaUtils::internal::onAllocation(n * size);
+	return __libc_calloc(n, size);
+}
+
+void* realloc(void* pointer, size_t size)
+{
+	PandaUtils::internal::onAllocation(size);
+	return __libc_realloc(pointer, size);
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+	PandaUtils::internal::onAllocation(size);
+	return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+	PandaUtils::internal::onAllocation(size);
+	return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** pointer, size_t alignment, size_t size)
+{
+	PandaUtils::internal::onAllocation(size);
+	void* allocated = __libc_memalign(alignment, size);
+	if(allocated == NULL)
+	{
+		return ENOMEM;
+	}
+	*pointer = allocated;
+	return 0;
+}
+}
+
+#else
+
+#define PANDA_ALLOCATION_GUARD_SCOPE(guard) do { (void)(guard); } while(0)
+
+#endif
+
+#endif //UTILS_DEBUG_ALLOCATION_GUARD_H_
@@ -0,0 +1,141 @@
+#ifndef UTILS_FILTERS_BUTTERWORTH_FILTER_BANK_H_
+#define UTILS_FILTERS_BUTTERWORTH_FILTER_BANK_H_
+
+// Second order low pass Butterworth filters (the ones of sai2 ButterworthFilter) on a
+// bank of channels, filtered all at once.
+//
+// the coefficients and the state of the filters are stored as one array per term with
+// one value per channel, so one update is a few array operations that Eigen vectorizes
+// over the channels, and filtering all the signals of a robot costs about one of the
+// per signal updates. every channel has its own cutoff frequency, so that signals with
+// different cutoffs can share a bank :
+//
+//   PandaUtils::ButterworthFilterBank<14> filter(14, 0.015);
+//   filter.setCutoffFrequency(0, 7, 0.07);        // channels 0 to 6
+//   const Eigen::Matrix<double,14,1>& filtered = filter.update(signals);
+//
+// CHANNELS is the number of channels, or Eigen::Dynamic. nothing is allocated in update().
+// the cutoff frequencies are normalized by the sampling frequency, in (0, 0.5). the filters
+// start at steady state on the first sample, unless initializeFilter() was called.
+
+#include <Eigen/Dense>
+
+#include <math.h>
+#include <stdexcept>
+
+namespace PandaUtils {
+
+template<int CHANNELS = Eigen::Dynamic>
+class ButterworthFilterBank {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Matrix<double, CHANNELS, 1> VectorChannels;
+	typedef Eigen::Array<double, CHANNELS, 1> ArrayChannels;
+
+	ButterworthFilterBank(const int channels, const double normalized_cutoff_freq)
+	: _channels(channels), _initialized(false)
+	{
+		if(CHANNELS != Eigen::Dynamic && channels != CHANNELS)
+		{
+			throw std::invalid_argument("number of channels inconsistent with the filter bank size in ButterworthFilterBank::ButterworthFilterBank()\n");
+		}
+
+		_b0.setZero(channels);
+		_b1.setZero(channels);
+		_b2.setZero(channels);
+		_a1.setZero(channels);
+		_a2.setZero(channels);
+		_s1.setZero(channels);
+		_s2.setZero(channels);
+		_output.setZero(channels);
+
+		setCutoffFrequency(0, channels, normalized_cutoff_freq);
+	}
+
+	int channels() const
+	{
+		return _channels;
+	}
+
+	void setCutoffFrequency(const double normalized_cutoff_freq)
+	{
+		setCutoffFrequency(0, _channels, normalized_cutoff_freq);
+	}
+
+	// cutoff frequency of the channels first_channel to first_channel + n_channels - 1
+	void setCutoffFrequency(const int first_channel, const int n_channels, const double normalized_cutoff_freq)
+	{
+		if(first_channel < 0 || n_channels < 0 || first_channel + n_channels > _channels)
+		{
+			throw std::invalid_argument("channels out of the filter bank in ButterworthFilterBank::setCutoffFrequency()\n");
+		}
+		if(normalized_cutoff_freq <= 0 || normalized_cutoff_freq >= 0.5)
+		{
+			throw std::invalid_argument("normalized cutoff frequency should be in (0, 0.5) in ButterworthFilterBank::setCutoffFrequency()\n");
+		}
+
+		// bilinear transform of the analog filter, prewarped at the cutoff
+		const double wc = tan(M_PI * normalized_cutoff_freq);
+		const double k1 = sqrt(2.0) * wc;
+		const double k2 = wc * wc;
+		const double norm = 1.0 / (1.0 + k1 + k2);
+
+		_b0.segment(first_channel, n_channels).setConstant(k2 * norm);
+		_b1.segment(first_channel, n_channels).setConstant(2.0 * k2 * norm);
+		_b2.segment(first_channel, n_channels).setConstant(k2 * norm);
+		_a1.segment(first_channel, n_channels).setConstant(2.0 * (k2 - 1.0) * norm);
+		_a2.segment(first_channel, n_channels).setConstant((1.0 - k1 + k2) * norm);
+	}
+
+	// start all the filters at steady state with the input x
+	void initializeFilter(const Eigen::Ref<const VectorChannels>& x)
+	{
+		if(x.size() != _channels)
+		{
+			throw std::invalid_argument("size of input inconsistent with the filter bank in ButterworthFilterBank::initializeFilter()\n");
+		}
+
+		_output = x;
+		_s1 = (1.0 - _b0) * x.array();
+		_s2 = (_b2 - _a2) * x.array();
+		_initialized = true;
+	}
+
+	// filter one sample of every channel, the output is valid until the next update
+	const VectorChannels& update(const Eigen::Ref<const VectorChannels>& x)
+	{
+		if(!_initialized)
+		{
+			initializeFilter(x);
+		}
+
+		// transposed direct form II
+		_output.array() = _b0 * x.array() + _s1;
+		_s1 = _b1 * x.array() - _a1 * _output.array() + _s2;
+		_s2 = _b2 * x.array() - _a2 * _output.array();
+
+		return _output;
+	}
+
+	const VectorChannels& getOutput() const
+	{
+		return _output;
+	}
+
+private:
+
+	int _channels;
+	bool _initialized;
+
+	// coefficients per channel, y = (b0 + b1 z^-1 + b2 z^-2) / (1 + a1 z^-1 + a2 z^-2) x
+	ArrayChannels _b0, _b1, _b2, _a1, _a2;
+
+	// state per channel
+	ArrayChannels _s1, _s2;
+	VectorChannels _output;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_FILTERS_BUTTERWORTH_FILTER_BANK_H_
@@ -0,0 +1,123 @@
+#ifndef UTILS_FILTERS_SLIDING_WINDOW_SUM_H_
+#define UTILS_FILTERS_SLIDING_WINDOW_SUM_H_
+
+// Sum of the last window_size samples of one or several channels.
+//
+// the samples are kept in a ring allocated at construction and the sum is
+// updated with the new sample and the one leaving the window, so push() is
+// constant time whatever the window and does not allocate:
+//
+//   PandaUtils::SlidingWindowSum<> windowed_energy(25);    // one channel
+//   windowed_energy.push(power * dt);
+//   double energy = windowed_energy.sum()(0);
+//
+// the running sum is recomputed from the ring every time the ring wraps,
+// so the rounding errors of the additions and subtractions do not build up
+// over long runs.
+
+#include <Eigen/Dense>
+
+#include <stdexcept>
+
+namespace PandaUtils {
+
+template<int CHANNELS = 1>
+class SlidingWindowSum {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Matrix<double, CHANNELS, 1> VectorChannels;
+
+	SlidingWindowSum(const int window_size, const int channels = (CHANNELS == Eigen::Dynamic ? 1 : CHANNELS))
+	: _window_size(window_size), _count(0), _next(0)
+	{
+		if(window_size < 1)
+		{
+			throw std::invalid_argument("window size should be at least 1 in SlidingWindowSum::SlidingWindowSum()\n");
+		}
+		if(CHANNELS != Eigen::Dynamic && channels != CHANNELS)
+		{
+			throw std::invalid_argument("number of channels inconsistent with the sum channels in SlidingWindowSum::SlidingWindowSum()\n");
+		}
+		_samples.setZero(channels, window_size);
+		_sum.setZero(channels);
+	}
+
+	template<typename Derived>
+	void push(const Eigen::MatrixBase<Derived>& x)
+	{
+		if(_count == _window_size)
+		{
+			_sum -= _samples.col(_next);
+		}
+		else
+		{
+			_count++;
+		}
+		_samples.col(_next) = x;
+		_sum += x;
+
+		_next++;
+		if(_next == _window_size)
+		{
+			_next = 0;
+			if(_count == _window_size)
+			{
+				_sum = _samples.rowwise().sum();
+			}
+		}
+	}
+
+	// single channel
+	void push(const double x)
+	{
+		if(_sum.size() != 1)
+		{
+			throw std::invalid_argument("scalar sample with several channels in SlidingWindowSum::push()\n");
+		}
+		push(Eigen::Matrix<double, 1, 1>::Constant(x));
+	}
+
+	void clear()
+	{
+		_samples.setZero();
+		_sum.setZero();
+		_count = 0;
+		_next = 0;
+	}
+
+	// sum of the samples in the window
+	const VectorChannels& sum() const
+	{
+		return _sum;
+	}
+
+	int size() const
+	{
+		return _count;
+	}
+
+	int windowSize() const
+	{
+		return _window_size;
+	}
+
+	bool full() const
+	{
+		return _count == _window_size;
+	}
+
+private:
+
+	const int _window_size;
+	int _count;
+	int _next;
+
+	// one column per sample, ring indexed by _next
+	Eigen::Matrix<double, CHANNELS, Eigen::Dynamic> _samples;
+	VectorChannels _sum;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_FILTERS_SLIDING_WINDOW_SUM_H_
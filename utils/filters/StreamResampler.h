@@ -0,0 +1,175 @@
+#ifndef UTILS_FILTERS_STREAM_RESAMPLER_H_
+#define UTILS_FILTERS_STREAM_RESAMPLER_H_
+
+// The value of a sampled signal at any time, from its last samples and their times.
+//
+// the samples of a sensor (force sensor, robot state, haptic device) do not come at the ticks
+// of the control loop : they come at the rate of their source, with the jitter of the source
+// and of redis, and a tick can see no new sample or skip one. the resampler keeps the last
+// samples with their source times, and gives the value of the signal at the time of the tick,
+// linearly interpolated between the samples around it, so that the filters and observers
+// that assume regular samples get them :
+//
+//   PandaUtils::StreamResampler<6> force_stream(6);
+//   while(runloop) {                                              // control loop
+//       if(force_input.receive(now_us)) {
+//           force_stream.push(force_input.time(), force_input.value());
+//       }
+//       // one period of the source late, so that there is a sample on each side of the tick
+//       const Eigen::Matrix<double,6,1>& force = force_stream.sample(tick_time - source_period);
+//   }
+//
+// before the oldest sample the value is the oldest one. after the newest one it is held, or
+// extrapolated from the last two samples up to setMaxExtrapolation() seconds and held after
+// that. N is the size of the signal, or Eigen::Dynamic. nothing is allocated after the
+// construction.
+
+#include <Eigen/Dense>
+
+#include <stdexcept>
+
+namespace PandaUtils {
+
+template<int N = Eigen::Dynamic>
+class StreamResampler {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Matrix<double, N, 1> VectorN;
+
+	// size of the signal, number of samples kept
+	StreamResampler(const int size, const int capacity = 16)
+	: _size(size),
+	  _capacity(capacity),
+	  _newest(-1),
+	  _n_samples(0),
+	  _max_extrapolation(0)
+	{
+		if(N != Eigen::Dynamic && size != N)
+		{
+			throw std::invalid_argument("signal size inconsistent with the resampler size in StreamResampler::StreamResampler()\n");
+		}
+		if(capacity < 2)
+		{
+			throw std::invalid_argument("at least two samples should be kept in StreamResampler::StreamResampler()\n");
+		}
+		_times.setZero(capacity);
+		_values.setZero(size, capacity);
+		_output.setZero(size);
+	}
+
+	// seconds after the newest sample for which the signal is extrapolated
+	void setMaxExtrapolation(const double max_extrapolation)
+	{
+		if(max_extrapolation < 0)
+		{
+			throw std::invalid_argument("max extrapolation should not be negative in StreamResampler::setMaxExtrapolation()\n");
+		}
+		_max_extrapolation = max_extrapolation;
+	}
+
+	void reset()
+	{
+		_newest = -1;
+		_n_samples = 0;
+		_output.setZero();
+	}
+
+	// a sample and its time in seconds. the samples come in order of their times, false for a
+	// sample that is not newer than the newest one (the same sample read again)
+	bool push(const double time, const Eigen::Ref<const VectorN>& value)
+	{
+		if(_n_samples > 0 && time <= _times(_newest))
+		{
+			return false;
+		}
+		_newest = (_newest + 1) % _capacity;
+		_times(_newest) = time;
+		_values.col(_newest) = value;
+		if(_n_samples < _capacity)
+		{
+			_n_samples++;
+		}
+		return true;
+	}
+
+	// value of the signal at time, zero without samples
+	const VectorN& sample(const double time)
+	{
+		if(_n_samples == 0)
+		{
+			return _output;
+		}
+		const int oldest = index(_n_samples - 1);
+		if(_n_samples == 1 || time <= _times(oldest))
+		{
+			_output = _values.col(oldest);
+			return _output;
+		}
+
+		// the first sample that is not after time, from the newest one
+		int after = _newest;
+		int before = index(1);
+		if(time >= _times(_newest))
+		{
+			// extrapolated from the last two samples
+			const double t = (time - _times(_newest) < _max_extrapolation) ? time : _times(_newest) + _max_extrapolation;
+			interpolate(before, after, t);
+			return _output;
+		}
+		for(int k=1 ; k<_n_samples ; k++)
+		{
+			before = index(k);
+			if(_times(before) <= time)
+			{
+				break;
+			}
+			after = before;
+		}
+		interpolate(before, after, time);
+		return _output;
+	}
+
+	bool empty() const { return _n_samples == 0; }
+	int numSamples() const { return _n_samples; }
+	int size() const { return _size; }
+	// time of the newest sample, time - newestTime() is the age of the signal
+	double newestTime() const { return _n_samples > 0 ? _times(_newest) : 0; }
+	double oldestTime() const { return _n_samples > 0 ? _times(index(_n_samples - 1)) : 0; }
+	const VectorN& newest() const
+	{
+		if(_n_samples == 0)
+		{
+			throw std::runtime_error("no samples in StreamResampler::newest()\n");
+		}
+		return _values.col(_newest);
+	}
+
+private:
+
+	// of the k-th sample from the newest one
+	int index(const int k) const
+	{
+		return (_newest - k + _capacity) % _capacity;
+	}
+
+	void interpolate(const int before, const int after, const double time)
+	{
+		const double alpha = (time - _times(before)) / (_times(after) - _times(before));
+		_output = _values.col(before) + alpha * (_values.col(after) - _values.col(before));
+	}
+
+	int _size;
+	int _capacity;
+	int _newest;
+	int _n_samples;
+	double _max_extrapolation;
+
+	Eigen::VectorXd _times;
+	Eigen::Matrix<double, N, Eigen::Dynamic> _values;
+	VectorN _output;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_FILTERS_STREAM_RESAMPLER_H_
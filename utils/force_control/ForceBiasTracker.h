@@ -0,0 +1,155 @@
+#ifndef UTILS_FORCE_CONTROL_FORCE_BIAS_TRACKER_H_
+#define UTILS_FORCE_CONTROL_FORCE_BIAS_TRACKER_H_
+
+// Slow tracking of the bias of a force sensor while the tool is in free space, for the
+// drift of the bias with the temperature over a session.
+//
+// in free space, a reading of the sensor is its bias minus the weight of the tool (mass and
+// center of mass in the sensor frame, as in the calibration files). every reading taken in
+// free space is a measure of the bias, and the bias follows it with a first order filter of
+// time constant time_constant, a constant time update :
+//
+//   bias += dt / time_constant * (raw + tool weight terms - bias)
+//
+// the caller says when the tool is in free space, e.g. no contact seen by a ContactDetector
+// on the momentum observer, out of force control and moving slowly (the inertia of the tool
+// is not compensated). the tracking starts again settle_time after the free space begins,
+// for the contact forces to go away, and a reading further than outlier_force or
+// outlier_moment from the current bias is taken as a contact that the caller did not see :
+// it is not used, and the settling starts over :
+//
+//   PandaUtils::ForceBiasTracker tracker(4000, 5.0, 0.5, 3.0, 0.3);
+//   tracker.reset(calibration.bias());
+//   tracker.setTool(calibration.toolMass(), calibration.toolCom());
+//   while(...) {                                                  // force loop
+//       tracker.update(raw_wrench, R_sensor, f_free_space);
+//       kernel.setBias(tracker.bias());
+//   }
+//
+// an error of the tool calibration looks like a bias that changes with the orientation,
+// the tracker follows it with the same time constant, so the time constant should stay
+// long compared to the reorientations of the tool. nothing is allocated in update().
+
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace PandaUtils {
+
+class ForceBiasTracker {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Matrix<double, 6, 1> Vector6d;
+
+	ForceBiasTracker(const double frequency, const double time_constant, const double settle_time,
+			const double outlier_force, const double outlier_moment)
+	: _alpha(0),
+	  _settle_samples(0),
+	  _outlier_force(outlier_force),
+	  _outlier_moment(outlier_moment),
+	  _tool_mass(0),
+	  _tool_com(Eigen::Vector3d::Zero()),
+	  _bias(Vector6d::Zero()),
+	  _initial_bias(Vector6d::Zero()),
+	  _settle_count(0),
+	  _f_tracking(false),
+	  _n_updates(0),
+	  _n_rejected(0)
+	{
+		if(frequency <= 0 || time_constant <= 0 || settle_time < 0)
+		{
+			throw std::invalid_argument("frequency and time constant should be positive in ForceBiasTracker::ForceBiasTracker()\n");
+		}
+		if(outlier_force <= 0 || outlier_moment <= 0)
+		{
+			throw std::invalid_argument("outlier thresholds should be positive in ForceBiasTracker::ForceBiasTracker()\n");
+		}
+		_alpha = std::min(1.0, 1.0 / (frequency * time_constant));
+		_settle_samples = (unsigned long) std::ceil(settle_time * frequency);
+	}
+
+	// the bias of the calibration, the reference of drift()
+	void reset(const Eigen::Ref<const Vector6d>& bias)
+	{
+		_bias = bias;
+		_initial_bias = bias;
+		_settle_count = 0;
+		_f_tracking = false;
+		_n_updates = 0;
+		_n_rejected = 0;
+	}
+
+	// center of mass in the sensor frame
+	void setTool(const double tool_mass, const Eigen::Vector3d& tool_com)
+	{
+		_tool_mass = tool_mass;
+		_tool_com = tool_com;
+	}
+
+	// one reading of the sensor driver in the sensor frame, R_sensor the orientation of the
+	// sensor in world. returns the current bias
+	const Vector6d& update(const Eigen::Ref<const Vector6d>& raw_wrench, const Eigen::Matrix3d& R_sensor, const bool f_free_space)
+	{
+		_f_tracking = false;
+		if(!f_free_space)
+		{
+			_settle_count = 0;
+			return _bias;
+		}
+
+		// the reading with the weight of the tool removed, the bias in free space
+		const Eigen::Vector3d tool_weight = _tool_mass * R_sensor.transpose() * Eigen::Vector3d(0, 0, -9.81);
+		Vector6d innovation = raw_wrench - _bias;
+		innovation.head<3>() += tool_weight;
+		innovation.tail<3>() += _tool_com.cross(tool_weight);
+		if(innovation.head<3>().norm() > _outlier_force || innovation.tail<3>().norm() > _outlier_moment)
+		{
+			_settle_count = 0;
+			_n_rejected++;
+			return _bias;
+		}
+		if(_settle_count < _settle_samples)
+		{
+			_settle_count++;
+			return _bias;
+		}
+
+		_bias += _alpha * innovation;
+		_f_tracking = true;
+		_n_updates++;
+		return _bias;
+	}
+
+	const Vector6d& bias() const { return _bias; }
+	// since the last reset()
+	Vector6d drift() const { return _bias - _initial_bias; }
+	// the last reading updated the bias
+	bool tracking() const { return _f_tracking; }
+	unsigned long long numUpdates() const { return _n_updates; }
+	// readings in free space too far from the bias
+	unsigned long long numRejected() const { return _n_rejected; }
+
+private:
+
+	double _alpha;
+	unsigned long _settle_samples;
+	const double _outlier_force;
+	const double _outlier_moment;
+
+	double _tool_mass;
+	Eigen::Vector3d _tool_com;
+
+	Vector6d _bias;
+	Vector6d _initial_bias;
+	unsigned long _settle_count;
+	bool _f_tracking;
+	unsigned long long _n_updates;
+	unsigned long long _n_rejected;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_FORCE_CONTROL_FORCE_BIAS_TRACKER_H_
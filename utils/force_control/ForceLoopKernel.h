@@ -0,0 +1,132 @@
+#ifndef UTILS_FORCE_CONTROL_FORCE_LOOP_KERNEL_H_
+#define UTILS_FORCE_CONTROL_FORCE_LOOP_KERNEL_H_
+
+// The processing of a force sensor reading and the force law of a force loop, in one update
+// on fixed size values, to run at the rate of the sensor on its own thread.
+//
+// a tick takes the raw wrench in the sensor frame and the orientation of the sensor, and :
+//
+//   - removes the bias and the weight of the tool, rotates the wrench to the world frame and
+//     filters it, with a ForcePipeline (at the sensor, no control point),
+//   - computes the force to apply along the force space of the task (sigma_force) : the
+//     desired force, plus a PI on the force error. the integral is clamped to integral_limit
+//     in norm, so that it does not wind up while the tool is out of contact.
+//
+// the sign of the wrench is the one of the sensor, the force applied by the tool on the
+// environment once compensated (that controllers give updateSensedForceAndMoment()), and
+// the desired force is in the same convention :
+//
+//   PandaUtils::ForceLoopKernel kernel(4000, 100.0, 0.5, 4.0, 5.0);
+//   kernel.setCalibration(force_bias, tool_mass, tool_com);
+//   while(...) {                                                  // force loop
+//       const Vector3d& force = kernel.update(raw_wrench, R_sensor, desired_force, sigma_force);
+//       command_torques = motion_torques + J_v.transpose() * force;
+//   }
+//
+// nothing is allocated in update().
+
+#include "force_control/ForcePipeline.h"
+#include <Eigen/Dense>
+
+#include <stdexcept>
+
+namespace PandaUtils {
+
+class ForceLoopKernel {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Matrix<double, 6, 1> Vector6d;
+
+	ForceLoopKernel(const double frequency, const double cutoff_frequency, const double kp, const double ki,
+			const double integral_limit)
+	: _period(0),
+	  _pipeline(frequency > 0 ? frequency : 1, cutoff_frequency > 0 ? cutoff_frequency : 0),
+	  _integral(Eigen::Vector3d::Zero()),
+	  _command_force(Eigen::Vector3d::Zero())
+	{
+		if(frequency <= 0 || cutoff_frequency <= 0)
+		{
+			throw std::invalid_argument("frequencies should be positive in ForceLoopKernel::ForceLoopKernel()\n");
+		}
+		_period = 1.0 / frequency;
+		setGains(kp, ki, integral_limit);
+	}
+
+	void setGains(const double kp, const double ki, const double integral_limit)
+	{
+		if(kp < 0 || ki < 0 || integral_limit < 0)
+		{
+			throw std::invalid_argument("gains and integral limit should not be negative in ForceLoopKernel::setGains()\n");
+		}
+		_kp = kp;
+		_ki = ki;
+		_integral_limit = integral_limit;
+	}
+
+	// bias in the sensor frame, tool center of mass in the sensor frame
+	void setCalibration(const Eigen::Ref<const Vector6d>& bias, const double tool_mass, const Eigen::Vector3d& tool_com)
+	{
+		_pipeline.setCalibration(bias, tool_mass, tool_com);
+	}
+
+	// the bias only, e.g. from a ForceBiasTracker
+	void setBias(const Eigen::Ref<const Vector6d>& bias)
+	{
+		_pipeline.setBias(bias);
+	}
+
+	// forgets the integral, and starts the filters again on the next reading
+	void reset()
+	{
+		_integral.setZero();
+		_command_force.setZero();
+		_pipeline.reset();
+	}
+
+	// one tick : raw wrench (force, moment) in the sensor frame, orientation of the sensor in
+	// world, desired force and force space in world. returns the force to apply in world
+	const Eigen::Vector3d& update(const Eigen::Ref<const Vector6d>& raw_wrench, const Eigen::Matrix3d& R_sensor,
+			const Eigen::Vector3d& desired_force, const Eigen::Matrix3d& sigma_force)
+	{
+		// compensated and filtered in world
+		_pipeline.update(raw_wrench, R_sensor);
+
+		// PI in the force space, the integral clamped in norm
+		const Eigen::Vector3d error = sigma_force * (desired_force - _pipeline.force());
+		_integral = sigma_force * (_integral + _ki * _period * error);
+		const double integral_norm = _integral.norm();
+		if(integral_norm > _integral_limit)
+		{
+			_integral *= _integral_limit / integral_norm;
+		}
+		_command_force = sigma_force * desired_force + _kp * error + _integral;
+
+		return _command_force;
+	}
+
+	// of the last update, in the sensor frame
+	const Vector6d& compensatedWrench() const { return _pipeline.compensatedWrench(); }
+	// of the last update, filtered, in world
+	const Eigen::Vector3d& force() const { return _pipeline.force(); }
+	const Eigen::Vector3d& moment() const { return _pipeline.moment(); }
+	const Eigen::Vector3d& commandForce() const { return _command_force; }
+	const Eigen::Vector3d& integral() const { return _integral; }
+	double period() const { return _period; }
+
+private:
+
+	double _period;
+	ForcePipeline _pipeline;
+
+	double _kp;
+	double _ki;
+	double _integral_limit;
+
+	Eigen::Vector3d _integral;
+	Eigen::Vector3d _command_force;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_FORCE_CONTROL_FORCE_LOOP_KERNEL_H_
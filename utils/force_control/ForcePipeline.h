@@ -0,0 +1,162 @@
+#ifndef UTILS_FORCE_CONTROL_FORCE_PIPELINE_H_
+#define UTILS_FORCE_CONTROL_FORCE_PIPELINE_H_
+
+// The processing of a force sensor reading, from the raw wrench of the sensor to the sensed
+// force and moment of a task, in one update on fixed size values.
+//
+// an update takes the raw wrench in the sensor frame and the orientation of the link the
+// sensor is mounted on, and :
+//
+//   - removes the bias of the sensor, and the weight of the tool (mass and center of mass in
+//     the sensor frame, as in the calibration files of 00-force_sensor_calibration) that the
+//     sensor holds in its current orientation,
+//   - rotates the wrench to the world frame and filters it with second order Butterworth
+//     filters, in the world frame so that the rotation of the sensor is not filtered,
+//   - moves the moment to the control point of the task, as PosOriTask::updateSensedForceAndMoment()
+//     with the sensor frame of setForceSensorFrame().
+//
+// the sign of the wrench is the one of the sensor, the force applied by the tool on the
+// environment once compensated. force() and moment() are the _sensed_force and _sensed_moment
+// of the task, in world at its control point :
+//
+//   PandaUtils::ForcePipeline force_pipeline(1000, 100.0);
+//   force_pipeline.setCalibration(force_bias, tool_mass, tool_com);
+//   force_pipeline.setSensorFrame(sensor_frame, pos_in_link);     // as setForceSensorFrame(link_name, sensor_frame)
+//   while(...) {                                                    // control loop
+//       robot->rotation(R_link, link_name);
+//       force_pipeline.update(sensed_force_moment, R_link);
+//       posori_task->_sensed_force = force_pipeline.force();
+//       posori_task->_sensed_moment = force_pipeline.moment();
+//   }
+//
+// a cutoff frequency of 0 does not filter the wrench. the pipeline can run at the rate of
+// the sensor on its own thread with a ForcePipelineThread. nothing is allocated in update().
+
+#include "filters/ButterworthFilterBank.h"
+#include <Eigen/Dense>
+
+#include <stdexcept>
+
+namespace PandaUtils {
+
+class ForcePipeline {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Matrix<double, 6, 1> Vector6d;
+
+	// frequency of the updates, cutoff frequency of the filters (0 for no filter), in Hz
+	ForcePipeline(const double frequency, const double cutoff_frequency = 0)
+	: _filter(6, 0.1),
+	  _f_filter(cutoff_frequency > 0),
+	  _f_reset_filter(true),
+	  _bias(Vector6d::Zero()),
+	  _tool_mass(0),
+	  _tool_com(Eigen::Vector3d::Zero()),
+	  _R_link_sensor(Eigen::Matrix3d::Identity()),
+	  _p_control_sensor(Eigen::Vector3d::Zero()),
+	  _compensated_wrench(Vector6d::Zero()),
+	  _world_wrench(Vector6d::Zero()),
+	  _force(Eigen::Vector3d::Zero()),
+	  _moment(Eigen::Vector3d::Zero())
+	{
+		if(frequency <= 0 || cutoff_frequency < 0)
+		{
+			throw std::invalid_argument("frequencies should be positive in ForcePipeline::ForcePipeline()\n");
+		}
+		if(_f_filter)
+		{
+			_filter.setCutoffFrequency(cutoff_frequency / frequency);
+		}
+	}
+
+	// bias in the sensor frame, tool center of mass in the sensor frame
+	void setCalibration(const Eigen::Ref<const Vector6d>& bias, const double tool_mass, const Eigen::Vector3d& tool_com)
+	{
+		_bias = bias;
+		_tool_mass = tool_mass;
+		_tool_com = tool_com;
+	}
+
+	// the bias only, e.g. from a ForceBiasTracker
+	void setBias(const Eigen::Ref<const Vector6d>& bias)
+	{
+		_bias = bias;
+	}
+
+	// pose of the sensor in the link, and control point of the task in the link (the control
+	// frame has the orientation of the link, as the one of PosOriTask)
+	void setSensorFrame(const Eigen::Affine3d& T_link_sensor, const Eigen::Vector3d& pos_in_link = Eigen::Vector3d::Zero())
+	{
+		_R_link_sensor = T_link_sensor.linear();
+		_p_control_sensor = T_link_sensor.translation() - pos_in_link;
+	}
+
+	// starts the filters again on the next reading
+	void reset()
+	{
+		_f_reset_filter = true;
+	}
+
+	// raw wrench (force, moment) in the sensor frame, orientation of the link in world.
+	// returns the wrench at the control point in world
+	const Vector6d& update(const Eigen::Ref<const Vector6d>& raw_wrench, const Eigen::Matrix3d& R_link)
+	{
+		// bias and weight of the tool, in the sensor frame
+		const Eigen::Matrix3d R_sensor = R_link * _R_link_sensor;
+		const Eigen::Vector3d tool_weight = _tool_mass * R_sensor.transpose() * Eigen::Vector3d(0, 0, -9.81);
+		_compensated_wrench = raw_wrench - _bias;
+		_compensated_wrench.head<3>() += tool_weight;
+		_compensated_wrench.tail<3>() += _tool_com.cross(tool_weight);
+
+		// filtered in world, at the sensor
+		_world_wrench.head<3>() = R_sensor * _compensated_wrench.head<3>();
+		_world_wrench.tail<3>() = R_sensor * _compensated_wrench.tail<3>();
+		if(_f_filter)
+		{
+			if(_f_reset_filter)
+			{
+				_filter.initializeFilter(_world_wrench);
+				_f_reset_filter = false;
+			}
+			_world_wrench = _filter.update(_world_wrench);
+		}
+
+		// at the control point
+		_force = _world_wrench.head<3>();
+		_moment = (R_link * _p_control_sensor).cross(_force) + _world_wrench.tail<3>();
+		_world_wrench.tail<3>() = _moment;
+
+		return _world_wrench;
+	}
+
+	// of the last update, in the sensor frame
+	const Vector6d& compensatedWrench() const { return _compensated_wrench; }
+	// of the last update, filtered, in world at the control point
+	const Vector6d& wrench() const { return _world_wrench; }
+	const Eigen::Vector3d& force() const { return _force; }
+	const Eigen::Vector3d& moment() const { return _moment; }
+
+private:
+
+	ButterworthFilterBank<6> _filter;
+	bool _f_filter;
+	bool _f_reset_filter;
+
+	Vector6d _bias;
+	double _tool_mass;
+	Eigen::Vector3d _tool_com;
+
+	Eigen::Matrix3d _R_link_sensor;
+	// in the link frame
+	Eigen::Vector3d _p_control_sensor;
+
+	Vector6d _compensated_wrench;
+	Vector6d _world_wrench;
+	Eigen::Vector3d _force;
+	Eigen::Vector3d _moment;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_FORCE_CONTROL_FORCE_PIPELINE_H_
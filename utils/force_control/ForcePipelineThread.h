@@ -0,0 +1,191 @@
+#ifndef UTILS_FORCE_CONTROL_FORCE_PIPELINE_THREAD_H_
+#define UTILS_FORCE_CONTROL_FORCE_PIPELINE_THREAD_H_
+
+// A ForcePipeline on its own thread, at the rate of the force sensor rather than the one of
+// the control loop.
+//
+// the thread has its own redis connection and reads the wrench of the sensor driver every
+// period, so that the filters see every reading of the sensor. the control loop hands it the
+// orientation of the link through a triple buffer, and reads the latest sensed force and
+// moment of the task from a second one, without locking :
+//
+//   PandaUtils::ForcePipelineThread force_thread(FORCE_SENSED_KEY, 4000, 100.0);
+//   force_thread.pipeline().setCalibration(force_bias, tool_mass, tool_com);
+//   force_thread.pipeline().setSensorFrame(sensor_frame, pos_in_link);
+//   force_thread.start(PandaUtils::RealtimeConfig::fifo(85));   // above the control loop
+//   while(...) {                                                  // control loop
+//       robot->rotation(R_link, link_name);
+//       force_thread.setLinkRotation(R_link);
+//       const PandaUtils::ForcePipelineThread::Output& sensed = force_thread.latest();
+//       posori_task->_sensed_force = sensed.force;
+//       posori_task->_sensed_moment = sensed.moment;
+//   }
+//   force_thread.stop();
+//
+// the pipeline is configured before start(), it belongs to the thread afterwards. the
+// orientation of the link changes slowly next to the rate of the sensor, the thread uses the
+// latest one. setLinkRotation() and latest() do not allocate.
+
+#include "force_control/ForcePipeline.h"
+#include "redis/RedisClient.h"
+#include "threads/RealtimeThread.h"
+#include "threads/TripleBuffer.h"
+#include "timer/LoopHealth.h"
+#include "timer/PrecisionLoopTimer.h"
+#include <Eigen/Dense>
+
+#include <atomic>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace PandaUtils {
+
+class ForcePipelineThread {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	struct Output {
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+		Output()
+		: n_updates(0),
+		  force(Eigen::Vector3d::Zero()),
+		  moment(Eigen::Vector3d::Zero()),
+		  compensated_wrench(ForcePipeline::Vector6d::Zero())
+		{}
+
+		// 0 before the first reading of the sensor
+		unsigned long long n_updates;
+		// filtered, in world at the control point
+		Eigen::Vector3d force;
+		Eigen::Vector3d moment;
+		// in the sensor frame
+		ForcePipeline::Vector6d compensated_wrench;
+	};
+
+	// redis key of the sensor wrench, frequency of the thread and cutoff frequency of the
+	// filters (0 for no filter), in Hz
+	ForcePipelineThread(const std::string& sensor_key, const double frequency, const double cutoff_frequency = 0,
+			const std::string& hostname = "127.0.0.1", const int port = 6379)
+	: _sensor_key(sensor_key),
+	  _frequency(frequency),
+	  _hostname(hostname),
+	  _port(port),
+	  _pipeline(frequency, cutoff_frequency),
+	  _loop_health(frequency),
+	  _running(false),
+	  _rotations(Eigen::Matrix3d::Identity())
+	{}
+
+	~ForcePipelineThread()
+	{
+		stop();
+	}
+
+	// before start()
+	ForcePipeline& pipeline()
+	{
+		if(_running)
+		{
+			throw std::runtime_error("the pipeline belongs to the thread once started in ForcePipelineThread::pipeline()\n");
+		}
+		return _pipeline;
+	}
+
+	void start(const RealtimeConfig& config = RealtimeConfig())
+	{
+		if(_running)
+		{
+			return;
+		}
+		_redis_client.connect(_hostname, _port);
+		_pipeline.reset();
+		_outputs.reset(Output());
+		_loop_health.reset();
+		_config = config;
+		_running = true;
+		_thread = std::thread(&ForcePipelineThread::pipelineLoop, this);
+	}
+
+	void stop()
+	{
+		if(!_running)
+		{
+			return;
+		}
+		_running = false;
+		_thread.join();
+	}
+
+	// control thread only : orientation of the link in world, for the next readings
+	void setLinkRotation(const Eigen::Matrix3d& R_link)
+	{
+		_rotations.write(R_link);
+	}
+
+	// control thread only : output of the latest reading, valid until the next call
+	const Output& latest()
+	{
+		_outputs.update();
+		return _outputs.latest();
+	}
+
+	// overruns and jitter of the thread, to print after stop()
+	const LoopHealth& loopHealth() const { return _loop_health; }
+	double frequency() const { return _frequency; }
+
+private:
+
+	void pipelineLoop()
+	{
+		Eigen::VectorXd sensed_force_moment = Eigen::VectorXd::Zero(6);
+		_redis_client.createReadCallback(0);
+		_redis_client.addEigenToReadCallback(0, _sensor_key, sensed_force_moment);
+
+		PrecisionLoopTimer timer(100e-6);
+		timer.initializeTimer();
+		timer.setLoopFrequency(_frequency);
+		configureRealtimeThread("force_pipeline", _config);
+
+		ForcePipeline::Vector6d raw_wrench = ForcePipeline::Vector6d::Zero();
+		unsigned long long n_updates = 0;
+		while(_running)
+		{
+			_loop_health.waitForNextLoop(timer);
+
+			_redis_client.executeReadCallback(0);
+			raw_wrench = sensed_force_moment;
+			_rotations.update();
+			_pipeline.update(raw_wrench, _rotations.latest());
+
+			Output& output = _outputs.writeBuffer();
+			output.n_updates = ++n_updates;
+			output.force = _pipeline.force();
+			output.moment = _pipeline.moment();
+			output.compensated_wrench = _pipeline.compensatedWrench();
+			_outputs.publish();
+		}
+	}
+
+	const std::string _sensor_key;
+	const double _frequency;
+	const std::string _hostname;
+	const int _port;
+
+	ForcePipeline _pipeline;
+	RedisClient _redis_client;
+	LoopHealth _loop_health;
+	RealtimeConfig _config;
+
+	std::atomic<bool> _running;
+	std::thread _thread;
+
+	TripleBuffer<Eigen::Matrix3d> _rotations;
+	TripleBuffer<Output> _outputs;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_FORCE_CONTROL_FORCE_PIPELINE_THREAD_H_
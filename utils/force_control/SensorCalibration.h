@@ -0,0 +1,308 @@
+#ifndef UTILS_FORCE_CONTROL_SENSOR_CALIBRATION_H_
+#define UTILS_FORCE_CONTROL_SENSOR_CALIBRATION_H_
+
+// Calibration of a force sensor and of the tool it holds, from the bias and tool files of
+// 00-force_sensor_calibration, with the gravity compensation of the tool.
+//
+// load() parses and checks the two xml files (a finite bias, a non negative mass, a center
+// of mass within a meter of the sensor) and writes the result to a binary file next to the
+// tool file, with the hash of the content of both files. the next launches hash the files,
+// map the binary file and use it when the hash matches, without parsing xml. editing either
+// file changes the hash and the files are parsed again. no tool file is a tool of zero mass :
+//
+//   PandaUtils::SensorCalibration calibration;
+//   if(!calibration.load(bias_file, tool_file)) { ... calibration.error() ... }
+//   // world loop
+//   f_sensed = raw_wrench;
+//   calibration.compensate(f_sensed, R_sensor);                   // sensor frame
+//
+// the wrench is the one of the sensor driver (the force applied by the sensor on the tool,
+// the opposite of the weight of the tool), compensate() removes the bias and adds the weight
+// of the tool in its current orientation, so that only the contact forces are left.
+// bias(), toolMass() and toolCom() give the terms to the force pipelines that do the same
+// computation in their own loop (ForceLoopKernel::setCalibration()).
+//
+// the cache is a few bytes, deleting the *.calib files is safe.
+
+#include <Eigen/Dense>
+#include <tinyxml2.h>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace PandaUtils {
+
+static const char SENSOR_CALIBRATION_MAGIC[8] = {'P','F','S','C','A','L','I','B'};
+static const uint32_t SENSOR_CALIBRATION_VERSION = 1;
+
+// the binary file, in the byte order of the machine
+struct SensorCalibrationRecord {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	// of the bias file and of the tool file
+	uint64_t hash;
+	double bias[6];
+	double tool_mass;
+	double tool_com[3];
+};
+
+class SensorCalibration {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Matrix<double, 6, 1> Vector6d;
+
+	SensorCalibration()
+	: _bias(Vector6d::Zero()),
+	  _tool_mass(0),
+	  _tool_com(Eigen::Vector3d::Zero()),
+	  _f_from_cache(false)
+	{}
+
+	// empty tool_file for no tool. on failure the calibration is left as it was
+	bool load(const std::string& bias_file, const std::string& tool_file = "")
+	{
+		std::string bias_content, tool_content;
+		if(!readContent(bias_file, bias_content))
+		{
+			_error = "could not open " + bias_file;
+			return false;
+		}
+		if(!tool_file.empty() && !readContent(tool_file, tool_content))
+		{
+			_error = "could not open " + tool_file;
+			return false;
+		}
+		uint64_t hash = 14695981039346656037ull;
+		hashAppend(hash, bias_content);
+		hashAppend(hash, tool_content);
+
+		const std::string cache_file = cacheFile(bias_file, tool_file);
+		SensorCalibrationRecord record;
+		if(readCache(cache_file, hash, record))
+		{
+			set(record);
+			_f_from_cache = true;
+			return true;
+		}
+
+		std::memset(&record, 0, sizeof(record));
+		std::memcpy(record.magic, SENSOR_CALIBRATION_MAGIC, sizeof(record.magic));
+		record.version = SENSOR_CALIBRATION_VERSION;
+		record.hash = hash;
+		if(!parseBias(bias_file, record) || (!tool_file.empty() && !parseTool(tool_file, record)))
+		{
+			return false;
+		}
+		set(record);
+		_f_from_cache = false;
+		// the calibration does not need the cache, a read only directory only costs the parsing
+		writeCache(cache_file, record);
+		return true;
+	}
+
+	// removes the bias and the weight of the tool from a wrench of the sensor driver, in the
+	// sensor frame, R_sensor the orientation of the sensor in world
+	void compensate(Eigen::Ref<Eigen::VectorXd> wrench, const Eigen::Matrix3d& R_sensor) const
+	{
+		const Eigen::Vector3d tool_weight = toolWeight(R_sensor);
+		wrench -= _bias;
+		wrench.head<3>() += tool_weight;
+		wrench.tail<3>() += _tool_com.cross(tool_weight);
+	}
+
+	// in the sensor frame
+	Eigen::Vector3d toolWeight(const Eigen::Matrix3d& R_sensor) const
+	{
+		return _tool_mass * R_sensor.transpose() * Eigen::Vector3d(0, 0, -9.81);
+	}
+
+	const Vector6d& bias() const { return _bias; }
+	double toolMass() const { return _tool_mass; }
+	// in the sensor frame
+	const Eigen::Vector3d& toolCom() const { return _tool_com; }
+
+	// the last load() used the binary file
+	bool fromCache() const { return _f_from_cache; }
+	const std::string& error() const { return _error; }
+
+	// next to the tool file, or to the bias file without tool
+	static std::string cacheFile(const std::string& bias_file, const std::string& tool_file)
+	{
+		const std::string& reference = tool_file.empty() ? bias_file : tool_file;
+		const size_t slash = reference.find_last_of('/');
+		const std::string directory = (slash == std::string::npos) ? std::string("") : reference.substr(0, slash + 1);
+		return directory + "." + (tool_file.empty() ? std::string("") : stemOf(tool_file) + "_") + stemOf(bias_file) + ".calib";
+	}
+
+private:
+
+	static std::string stemOf(const std::string& filename)
+	{
+		const size_t slash = filename.find_last_of('/');
+		const std::string name = (slash == std::string::npos) ? filename : filename.substr(slash + 1);
+		const size_t dot = name.find('.');
+		return (dot == std::string::npos) ? name : name.substr(0, dot);
+	}
+
+	static bool readContent(const std::string& filename, std::string& content)
+	{
+		std::ifstream file(filename.c_str(), std::ios::binary);
+		if(!file)
+		{
+			return false;
+		}
+		std::ostringstream stream;
+		stream << file.rdbuf();
+		content = stream.str();
+		return true;
+	}
+
+	// fnv-1a, with a separator between the files
+	static void hashAppend(uint64_t& hash, const std::string& data)
+	{
+		for(unsigned int i=0 ; i<data.size() ; i++)
+		{
+			hash ^= (unsigned char)data[i];
+			hash *= 1099511628211ull;
+		}
+		hash ^= 0xff;
+		hash *= 1099511628211ull;
+	}
+
+	static bool readCache(const std::string& cache_file, const uint64_t hash, SensorCalibrationRecord& record)
+	{
+		const int fd = open(cache_file.c_str(), O_RDONLY);
+		if(fd < 0)
+		{
+			return false;
+		}
+		struct stat info;
+		bool f_valid = false;
+		if(fstat(fd, &info) == 0 && info.st_size == (off_t) sizeof(SensorCalibrationRecord))
+		{
+			void* data = mmap(NULL, sizeof(SensorCalibrationRecord), PROT_READ, MAP_PRIVATE, fd, 0);
+			if(data != MAP_FAILED)
+			{
+				std::memcpy(&record, data, sizeof(record));
+				munmap(data, sizeof(SensorCalibrationRecord));
+				f_valid = std::memcmp(record.magic, SENSOR_CALIBRATION_MAGIC, sizeof(record.magic)) == 0
+						&& record.version == SENSOR_CALIBRATION_VERSION && record.hash == hash;
+			}
+		}
+		close(fd);
+		return f_valid;
+	}
+
+	static void writeCache(const std::string& cache_file, const SensorCalibrationRecord& record)
+	{
+		// written then renamed, for the controllers launched at the same time
+		const std::string temporary = cache_file + ".tmp" + std::to_string(getpid());
+		{
+			std::ofstream file(temporary.c_str(), std::ios::binary);
+			file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+			if(!file)
+			{
+				file.close();
+				std::remove(temporary.c_str());
+				return;
+			}
+		}
+		if(std::rename(temporary.c_str(), cache_file.c_str()) != 0)
+		{
+			std::remove(temporary.c_str());
+		}
+	}
+
+	bool parseBias(const std::string& bias_file, SensorCalibrationRecord& record)
+	{
+		tinyxml2::XMLDocument doc;
+		doc.LoadFile(bias_file.c_str());
+		const tinyxml2::XMLElement* element = doc.Error() ? NULL : doc.FirstChildElement("force_bias");
+		const char* value = (element == NULL) ? NULL : element->Attribute("value");
+		if(value == NULL)
+		{
+			_error = bias_file + " is not a bias file";
+			return false;
+		}
+		std::stringstream bias(value);
+		for(int i=0 ; i<6 ; i++)
+		{
+			bias >> record.bias[i];
+			if(bias.fail() || !std::isfinite(record.bias[i]))
+			{
+				_error = "the bias in " + bias_file + " should be 6 numbers";
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool parseTool(const std::string& tool_file, SensorCalibrationRecord& record)
+	{
+		tinyxml2::XMLDocument doc;
+		doc.LoadFile(tool_file.c_str());
+		const tinyxml2::XMLElement* tool = doc.Error() ? NULL : doc.FirstChildElement("tool");
+		const tinyxml2::XMLElement* inertial = (tool == NULL) ? NULL : tool->FirstChildElement("inertial");
+		const tinyxml2::XMLElement* mass = (inertial == NULL) ? NULL : inertial->FirstChildElement("mass");
+		const tinyxml2::XMLElement* origin = (inertial == NULL) ? NULL : inertial->FirstChildElement("origin");
+		const char* xyz = (origin == NULL) ? NULL : origin->Attribute("xyz");
+		if(mass == NULL || xyz == NULL || mass->QueryDoubleAttribute("value", &record.tool_mass) != tinyxml2::XML_SUCCESS)
+		{
+			_error = tool_file + " is not a tool file";
+			return false;
+		}
+		if(!std::isfinite(record.tool_mass) || record.tool_mass < 0)
+		{
+			_error = "the tool mass in " + tool_file + " should not be negative";
+			return false;
+		}
+		std::stringstream com(xyz);
+		double com_squared_norm = 0;
+		for(int i=0 ; i<3 ; i++)
+		{
+			com >> record.tool_com[i];
+			if(com.fail() || !std::isfinite(record.tool_com[i]))
+			{
+				_error = "the tool center of mass in " + tool_file + " should be 3 numbers";
+				return false;
+			}
+			com_squared_norm += record.tool_com[i] * record.tool_com[i];
+		}
+		if(com_squared_norm > 1.0)
+		{
+			_error = "the tool center of mass in " + tool_file + " is more than a meter from the sensor";
+			return false;
+		}
+		return true;
+	}
+
+	void set(const SensorCalibrationRecord& record)
+	{
+		_bias = Eigen::Map<const Vector6d>(record.bias);
+		_tool_mass = record.tool_mass;
+		_tool_com = Eigen::Map<const Eigen::Vector3d>(record.tool_com);
+		_error.clear();
+	}
+
+	Vector6d _bias;
+	double _tool_mass;
+	Eigen::Vector3d _tool_com;
+	bool _f_from_cache;
+	std::string _error;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_FORCE_CONTROL_SENSOR_CALIBRATION_H_
@@ -0,0 +1,182 @@
+#ifndef UTILS_FORCE_CONTROL_TOOL_CALIBRATION_RLS_H_
+#define UTILS_FORCE_CONTROL_TOOL_CALIBRATION_RLS_H_
+
+// Recursive least squares estimate of the mass and center of mass of the tool held by a
+// force sensor, from every reading of the sensor while the robot turns the tool slowly.
+//
+// the weight of the tool in the sensor frame is linear in theta = (m, m com) :
+//
+//   f = m g_s                   g_s = R^T g, the gravity in the sensor frame
+//   t = com x (m g_s) = -[g_s]x (m com)
+//
+// so a reading is 6 equations in 4 parameters. every update folds one reading in (the force
+// rows weighted by force_noise, the moment rows by moment_noise), and the estimate and its
+// covariance are there at any time. the noise scale is estimated from the residuals, and the
+// covariance is scaled by it, so massStd() and comStd() are standard deviations in kg and m.
+// the directions that the orientations seen so far do not excite keep the large initial
+// covariance, and the estimate is converged once both deviations are under their tolerance :
+//
+//   PandaUtils::ToolCalibrationRLS calibration(0.1, 0.01);
+//   while(...) {                                                  // control loop
+//       // force applied by the tool on the sensor, bias removed, in the sensor frame
+//       calibration.update(tool_force, tool_moment, R_sensor);
+//       if(calibration.converged(0.005, 0.001)) break;
+//   }
+//   writeCalibrationXml(file, name, calibration.com(), calibration.mass());
+//
+// the readings are taken as static, the tool should move slowly enough that its acceleration
+// is small compared to gravity. a forgetting factor below 1 tracks a tool that changes, at
+// the price of a noisier estimate. update() does not allocate.
+
+#include <Eigen/Dense>
+
+#include <cmath>
+#include <stdexcept>
+
+namespace PandaUtils {
+
+class ToolCalibrationRLS {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Matrix<double, 4, 1> Vector4d;
+	typedef Eigen::Matrix<double, 4, 4> Matrix4d;
+	typedef Eigen::Matrix<double, 6, 1> Vector6d;
+	typedef Eigen::Matrix<double, 6, 4> Matrix64d;
+	typedef Eigen::Matrix<double, 6, 6> Matrix6d;
+
+	ToolCalibrationRLS(const double force_noise, const double moment_noise, const double forgetting_factor = 1.0,
+			const double initial_covariance = 1e4)
+	: _forgetting_factor(forgetting_factor),
+	  _initial_covariance(initial_covariance),
+	  _noise(Vector6d::Zero()),
+	  _gravity(0.0, 0.0, -9.81)
+	{
+		if(force_noise <= 0 || moment_noise <= 0 || initial_covariance <= 0)
+		{
+			throw std::invalid_argument("noise and initial covariance should be positive in ToolCalibrationRLS::ToolCalibrationRLS()\n");
+		}
+		if(forgetting_factor <= 0 || forgetting_factor > 1)
+		{
+			throw std::invalid_argument("forgetting factor should be in (0, 1] in ToolCalibrationRLS::ToolCalibrationRLS()\n");
+		}
+		_noise << force_noise * force_noise, force_noise * force_noise, force_noise * force_noise,
+				moment_noise * moment_noise, moment_noise * moment_noise, moment_noise * moment_noise;
+		reset();
+	}
+
+	void reset()
+	{
+		_theta.setZero();
+		_P = _initial_covariance * Matrix4d::Identity();
+		_weighted_residuals = 0;
+		_residuals = 0;
+		_n_samples = 0;
+	}
+
+	// one reading : force and moment applied by the tool on the sensor, in the sensor frame,
+	// and orientation of the sensor in world
+	void update(const Eigen::Vector3d& force, const Eigen::Vector3d& moment, const Eigen::Matrix3d& R_sensor)
+	{
+		const Eigen::Vector3d g_s = R_sensor.transpose() * _gravity;
+		Matrix64d phi = Matrix64d::Zero();
+		phi.block<3,1>(0,0) = g_s;
+		phi.block<3,3>(3,1) <<  0.0,     g_s(2), -g_s(1),
+		                       -g_s(2),  0.0,     g_s(0),
+		                        g_s(1), -g_s(0),  0.0;
+		Vector6d y;
+		y << force, moment;
+
+		// gain and covariance, in the form that keeps P symmetric
+		const Eigen::Matrix<double, 4, 6> P_phi_t = _P * phi.transpose();
+		Matrix6d S = phi * P_phi_t;
+		S.diagonal() += _forgetting_factor * _noise;
+		const Eigen::Matrix<double, 4, 6> K = S.ldlt().solve(P_phi_t.transpose()).transpose();
+		_theta += K * (y - phi * _theta);
+		_P = (_P - K * S * K.transpose()) / _forgetting_factor;
+		_P = 0.5 * (_P + _P.transpose()).eval();
+
+		// residual of the updated estimate, for the noise scale
+		const Vector6d r = y - phi * _theta;
+		_weighted_residuals = _forgetting_factor * _weighted_residuals + r.cwiseQuotient(_noise).dot(r);
+		_residuals = _forgetting_factor * _residuals + r.squaredNorm();
+		_n_samples++;
+	}
+
+	double mass() const { return _theta(0); }
+	// in the sensor frame
+	Eigen::Vector3d com() const
+	{
+		return (std::abs(_theta(0)) > 1e-9) ? Eigen::Vector3d(_theta.tail<3>() / _theta(0)) : Eigen::Vector3d::Zero();
+	}
+	// (m, m com)
+	const Vector4d& parameters() const { return _theta; }
+
+	// ratio of the residuals to the noise given to the constructor, 1 when the noise is right.
+	// the samples are correlated over a sweep, take it as an order of magnitude
+	double noiseScale() const
+	{
+		const double redundancy = 6.0 * effectiveSamples() - 4.0;
+		return (redundancy > 0) ? _weighted_residuals / redundancy : 1.0;
+	}
+
+	// of (m, m com)
+	Matrix4d covariance() const { return noiseScale() * _P; }
+
+	double massStd() const { return std::sqrt(covariance()(0,0)); }
+
+	// norm of the standard deviations of the center of mass, to first order in com = (m com) / m
+	double comStd() const
+	{
+		if(std::abs(_theta(0)) <= 1e-9)
+		{
+			return std::sqrt(_initial_covariance);
+		}
+		Eigen::Matrix<double, 3, 4> J;
+		J.col(0) = -_theta.tail<3>() / (_theta(0) * _theta(0));
+		J.rightCols<3>() = Eigen::Matrix3d::Identity() / _theta(0);
+		return std::sqrt((J * covariance() * J.transpose()).trace());
+	}
+
+	// both deviations under their tolerance, after min_samples readings
+	bool converged(const double mass_tolerance, const double com_tolerance, const unsigned long min_samples = 500) const
+	{
+		return _n_samples >= min_samples && massStd() < mass_tolerance && comStd() < com_tolerance;
+	}
+
+	unsigned long numSamples() const { return _n_samples; }
+
+	// rms of the residuals per equation, N and Nm mixed
+	double residualRms() const
+	{
+		const double n = effectiveSamples();
+		return (n > 0) ? std::sqrt(_residuals / (6.0 * n)) : 0.0;
+	}
+
+private:
+
+	// samples in the memory of the forgetting factor
+	double effectiveSamples() const
+	{
+		if(_forgetting_factor >= 1.0)
+		{
+			return _n_samples;
+		}
+		return (1.0 - std::pow(_forgetting_factor, (double) _n_samples)) / (1.0 - _forgetting_factor);
+	}
+
+	const double _forgetting_factor;
+	const double _initial_covariance;
+	Vector6d _noise;
+	const Eigen::Vector3d _gravity;
+
+	Vector4d _theta;
+	Matrix4d _P;
+	double _weighted_residuals;
+	double _residuals;
+	unsigned long _n_samples;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_FORCE_CONTROL_TOOL_CALIBRATION_RLS_H_
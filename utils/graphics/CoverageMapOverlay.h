@@ -0,0 +1,202 @@
+#ifndef UTILS_GRAPHICS_COVERAGE_MAP_OVERLAY_H_
+#define UTILS_GRAPHICS_COVERAGE_MAP_OVERLAY_H_
+
+// The covered cells of a CoverageMap (see coverage/CoverageMap.h) drawn over the board in the
+// simviz scene, and the coverage in a label of the window.
+//
+// the controller publishes the image of its map to a redis key a few times per second. the
+// overlay reads it at the poll frequency, and shows it as a texture on a plane laid on the
+// board, at the pose of the header : the covered cells in transparent green, the others
+// left as they are. the plane is made again only when the size of the board changes :
+//
+//   PandaUtils::CoverageMapOverlay coverage_overlay(graphics->_world, graphics->getCamera(camera_name),
+//           COVERAGE_MAP_KEY);
+//   while (!glfwWindowShouldClose(window))
+//   {
+//       glfwGetFramebufferSize(window, &width, &height);
+//       coverage_overlay.update(redis_client, height);
+//       graphics->render(camera_name, width, height);
+//       ...
+//   }
+
+#include "coverage/CoverageMap.h"
+#include "redis/RedisClient.h"
+#include <hiredis/hiredis.h>
+#include <chai3d.h>
+#include <Eigen/Dense>
+
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+namespace PandaUtils {
+
+class CoverageMapOverlay {
+public:
+
+	CoverageMapOverlay(chai3d::cWorld* world, chai3d::cCamera* camera, const std::string& key,
+			const double poll_frequency = 4.0)
+	: _world(world),
+	  _camera(camera),
+	  _key(key),
+	  _font(NEW_CFONTCALIBRI20()),
+	  _mesh(NULL),
+	  _cells_x(0),
+	  _cells_y(0)
+	{
+		if(world == NULL || camera == NULL)
+		{
+			throw std::invalid_argument("no world or camera for the overlay in CoverageMapOverlay::CoverageMapOverlay()\n");
+		}
+		if(poll_frequency <= 0)
+		{
+			throw std::invalid_argument("poll frequency should be positive in CoverageMapOverlay::CoverageMapOverlay()\n");
+		}
+		_poll_period = std::chrono::nanoseconds((int64_t)(1e9 / poll_frequency + 0.5));
+		_next_poll = std::chrono::steady_clock::now();
+
+		_label = new chai3d::cLabel(_font);
+		_label->m_fontColor.setGrayLevel(0.6);
+		_label->setText("coverage : no data");
+		_camera->m_frontLayer->addChild(_label);
+	}
+
+	~CoverageMapOverlay()
+	{
+		_camera->m_frontLayer->removeChild(_label);
+		delete _label;
+		removeMesh();
+	}
+
+	void setVisible(const bool visible)
+	{
+		_label->setShowEnabled(visible);
+		if(_mesh)
+		{
+			_mesh->setShowEnabled(visible);
+		}
+	}
+
+	// before the render, with the height of the window in pixels
+	void update(RedisClient& redis_client, const int window_height)
+	{
+		_label->setLocalPos(10, window_height - 1.3 * _font->getPointSize() * 6);
+
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if(now < _next_poll)
+		{
+			return;
+		}
+		_next_poll = now + _poll_period;
+		poll(redis_client);
+	}
+
+private:
+
+	void poll(RedisClient& redis_client)
+	{
+		redisReply* reply = (redisReply*) redisCommand(redis_client.context_.get(), "GET %b", _key.data(), _key.size());
+		if(reply == NULL)
+		{
+			return;
+		}
+		if(reply->type == REDIS_REPLY_STRING)
+		{
+			_image.assign(reply->str, reply->len);
+		}
+		else
+		{
+			_image.clear();
+		}
+		freeReplyObject(reply);
+
+		CoverageImageHeader header;
+		if(!CoverageMap::decodeImage(_image, header))
+		{
+			_label->m_fontColor.setGrayLevel(0.6);
+			_label->setText("coverage : no data");
+			return;
+		}
+		if(header.cells_x != _cells_x || header.cells_y != _cells_y || !_mesh)
+		{
+			makeMesh(header);
+		}
+		placeMesh(header);
+
+		chai3d::cImagePtr texture_image = _mesh->m_texture->m_image;
+		const chai3d::cColorb covered(40, 200, 60, 150);
+		const chai3d::cColorb uncovered(0, 0, 0, 0);
+		for(unsigned int iy=0 ; iy<header.cells_y ; iy++)
+		{
+			for(unsigned int ix=0 ; ix<header.cells_x ; ix++)
+			{
+				texture_image->setPixelColor(ix, iy, CoverageMap::covered(_image, header, ix, iy) ? covered : uncovered);
+			}
+		}
+		_mesh->m_texture->markForUpdate();
+
+		char text[64];
+		snprintf(text, sizeof(text), "coverage : %.1f %%", 100.0 * header.n_covered / ((double) header.cells_x * header.cells_y));
+		_label->m_fontColor.setWhite();
+		_label->setText(text);
+	}
+
+	void makeMesh(const CoverageImageHeader& header)
+	{
+		removeMesh();
+		_cells_x = header.cells_x;
+		_cells_y = header.cells_y;
+		const double size_x = header.cells_x * header.cell_size;
+		const double size_y = header.cells_y * header.cell_size;
+
+		// the plane is centered on its origin, the board starts at the origin of its frame
+		_mesh = new chai3d::cMesh();
+		chai3d::cCreatePlane(_mesh, size_x, size_y, chai3d::cVector3d(0.5 * size_x, 0.5 * size_y, 0));
+		_mesh->m_texture = chai3d::cTexture2d::create();
+		_mesh->m_texture->m_image->allocate(header.cells_x, header.cells_y, GL_RGBA);
+		_mesh->m_texture->setUseMipmaps(false);
+		_mesh->setUseTexture(true);
+		_mesh->setUseTransparency(true);
+		_world->addChild(_mesh);
+	}
+
+	// 1 mm over the board, not to fight with its surface
+	void placeMesh(const CoverageImageHeader& header)
+	{
+		const Eigen::Quaterniond orientation(header.orientation[0], header.orientation[1], header.orientation[2], header.orientation[3]);
+		const Eigen::Matrix3d R = orientation.normalized().toRotationMatrix();
+		const Eigen::Vector3d position = Eigen::Vector3d(header.position[0], header.position[1], header.position[2]) + 0.001 * R.col(2);
+		chai3d::cMatrix3d rotation;
+		rotation.set(R(0,0), R(0,1), R(0,2), R(1,0), R(1,1), R(1,2), R(2,0), R(2,1), R(2,2));
+		_mesh->setLocalPos(position(0), position(1), position(2));
+		_mesh->setLocalRot(rotation);
+	}
+
+	void removeMesh()
+	{
+		if(_mesh)
+		{
+			_world->removeChild(_mesh);
+			delete _mesh;
+			_mesh = NULL;
+		}
+	}
+
+	chai3d::cWorld* _world;
+	chai3d::cCamera* _camera;
+	const std::string _key;
+	chai3d::cFontPtr _font;
+	chai3d::cLabel* _label;
+	chai3d::cMesh* _mesh;
+	unsigned int _cells_x;
+	unsigned int _cells_y;
+	std::string _image;
+
+	std::chrono::nanoseconds _poll_period;
+	std::chrono::steady_clock::time_point _next_poll;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_GRAPHICS_COVERAGE_MAP_OVERLAY_H_
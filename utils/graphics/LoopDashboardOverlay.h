@@ -0,0 +1,171 @@
+#ifndef UTILS_GRAPHICS_LOOP_DASHBOARD_OVERLAY_H_
+#define UTILS_GRAPHICS_LOOP_DASHBOARD_OVERLAY_H_
+
+// Labels over the simviz scene with the health of the loop threads of the running apps.
+//
+// reads the stats published by timer/LoopDashboard.h for a list of threads, which can be in
+// other processes, and shows one line per thread in the top left corner of the window : the
+// control rate, the p99 of the cycle time, the missed deadlines and the top stage. a label
+// turns red while its thread misses deadlines, and grey when its thread stopped publishing.
+// called in the graphics loop, it reads redis at the poll frequency only :
+//
+//   PandaUtils::LoopDashboardOverlay dashboard_overlay(graphics->getCamera(camera_name),
+//           {"controller", "simulation"});
+//   while (!glfwWindowShouldClose(window))
+//   {
+//       glfwGetFramebufferSize(window, &width, &height);
+//       dashboard_overlay.update(redis_client, height);
+//       graphics->render(camera_name, width, height);
+//       ...
+//   }
+
+#include "timer/LoopDashboard.h"
+#include "redis/RedisClient.h"
+#include <chai3d.h>
+#include <Eigen/Dense>
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+class LoopDashboardOverlay {
+public:
+
+	LoopDashboardOverlay(chai3d::cCamera* camera, const std::vector<std::string>& thread_names,
+			const double poll_frequency = 4.0)
+	: _camera(camera),
+	  _thread_names(thread_names),
+	  _font(NEW_CFONTCALIBRI20()),
+	  _last_cycles(thread_names.size(), -1),
+	  _last_missed(thread_names.size(), -1),
+	  _stale_polls(thread_names.size(), 0)
+	{
+		if(camera == NULL)
+		{
+			throw std::invalid_argument("no camera for the overlay in LoopDashboardOverlay::LoopDashboardOverlay()\n");
+		}
+		if(poll_frequency <= 0)
+		{
+			throw std::invalid_argument("poll frequency should be positive in LoopDashboardOverlay::LoopDashboardOverlay()\n");
+		}
+		_poll_period = std::chrono::nanoseconds((int64_t)(1e9 / poll_frequency + 0.5));
+		_next_poll = std::chrono::steady_clock::now();
+		for(unsigned int i=0 ; i<_thread_names.size() ; i++)
+		{
+			chai3d::cLabel* label = new chai3d::cLabel(_font);
+			label->m_fontColor.setGrayLevel(0.6);
+			label->setText(_thread_names[i] + " : no data");
+			_camera->m_frontLayer->addChild(label);
+			_labels.push_back(label);
+		}
+	}
+
+	~LoopDashboardOverlay()
+	{
+		for(unsigned int i=0 ; i<_labels.size() ; i++)
+		{
+			_camera->m_frontLayer->removeChild(_labels[i]);
+			delete _labels[i];
+		}
+	}
+
+	void setVisible(const bool visible)
+	{
+		for(unsigned int i=0 ; i<_labels.size() ; i++)
+		{
+			_labels[i]->setShowEnabled(visible);
+		}
+	}
+
+	// before the render, with the height of the window in pixels
+	void update(RedisClient& redis_client, const int window_height)
+	{
+		const double line_height = 1.3 * _font->getPointSize();
+		for(unsigned int i=0 ; i<_labels.size() ; i++)
+		{
+			_labels[i]->setLocalPos(10, window_height - (i + 1) * line_height);
+		}
+
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if(now < _next_poll)
+		{
+			return;
+		}
+		_next_poll = now + _poll_period;
+		for(unsigned int i=0 ; i<_labels.size() ; i++)
+		{
+			poll(redis_client, i);
+		}
+	}
+
+private:
+
+	void poll(RedisClient& redis_client, const int i)
+	{
+		LoopStats stats;
+		try
+		{
+			stats = LoopStats::fromVector(redis_client.getEigenMatrixJSON(LoopDashboard::key(_thread_names[i])));
+		}
+		catch(const std::exception&)
+		{
+			// not published yet, or not a loop stats vector
+			_labels[i]->m_fontColor.setGrayLevel(0.6);
+			_labels[i]->setText(_thread_names[i] + " : no data");
+			return;
+		}
+		try
+		{
+			stats.top_stage = redis_client.get(LoopDashboard::stageKey(_thread_names[i]));
+		}
+		catch(const std::exception&)
+		{
+			// no profiler
+		}
+
+		// 4 polls without a new cycle, 1 s at the default poll frequency
+		_stale_polls[i] = (stats.cycles == _last_cycles[i]) ? _stale_polls[i] + 1 : 0;
+		const bool stopped = _stale_polls[i] >= 4;
+		const bool missing_deadlines = _last_missed[i] >= 0 && stats.missed_deadlines > _last_missed[i];
+		_last_cycles[i] = stats.cycles;
+		_last_missed[i] = stats.missed_deadlines;
+
+		if(stopped)
+		{
+			_labels[i]->m_fontColor.setGrayLevel(0.6);
+			_labels[i]->setText(_thread_names[i] + " : stopped");
+		}
+		else
+		{
+			if(missing_deadlines)
+			{
+				_labels[i]->m_fontColor.setRedCrimson();
+			}
+			else
+			{
+				_labels[i]->m_fontColor.setWhite();
+			}
+			_labels[i]->setText(_thread_names[i] + " : " + stats.summary());
+		}
+	}
+
+	chai3d::cCamera* _camera;
+	const std::vector<std::string> _thread_names;
+	chai3d::cFontPtr _font;
+	std::vector<chai3d::cLabel*> _labels;
+
+	std::chrono::nanoseconds _poll_period;
+	std::chrono::steady_clock::time_point _next_poll;
+
+	// per thread, at the last poll
+	std::vector<double> _last_cycles;
+	std::vector<double> _last_missed;
+	std::vector<int> _stale_polls;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_GRAPHICS_LOOP_DASHBOARD_OVERLAY_H_
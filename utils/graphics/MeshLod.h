@@ -0,0 +1,211 @@
+#ifndef UTILS_GRAPHICS_MESH_LOD_H_
+#define UTILS_GRAPHICS_MESH_LOD_H_
+
+// Decimated copies of the meshes of the scene, drawn instead of the full ones far from the camera.
+//
+// the visual meshes of the Panda and the Allegro hand in Model/meshes have tens of thousands
+// of triangles per link, drawn at full resolution even when the robot is a few hundred pixels
+// wide. at construction every mesh of the world with more than min_triangles triangles gets a
+// decimated copy, made by vertex clustering : the vertices in one cell of a grid of the given
+// size are merged into their mean and the triangles that collapse are dropped (see
+// model/VertexClustering.h). the copy is a sibling of the mesh with the same pose and
+// material, and update() shows one of the two depending on the distance between the mesh
+// and the camera :
+//
+//   PandaUtils::MeshLod mesh_lod(graphics->_world, graphics->getCamera(camera_name), 2.5, 0.01);
+//   std::cout << mesh_lod.numTrianglesFull() << " -> " << mesh_lod.numTrianglesLod() << " triangles\n";
+//   while (!glfwWindowShouldClose(window))
+//   {
+//       ...                                                             // updates of the graphics
+//       if(mesh_lod.update())
+//       {
+//           render_scheduler.invalidate();                              // a mesh switched
+//       }
+//       ...                                                             // render
+//   }
+//
+// the switch has a hysteresis of 10% of the distance so a mesh at the limit does not flicker.
+// the copies are made once, from the meshes as loaded, and have no texture. meshes added to
+// the world after the construction are not reduced.
+
+#include "model/VertexClustering.h"
+
+#include <chai3d.h>
+#include <Eigen/Dense>
+
+#include <stdexcept>
+#include <vector>
+
+namespace PandaUtils {
+
+class MeshLod {
+public:
+
+	// beyond switch_distance of the camera a mesh is drawn decimated, on a grid of cell_size
+	MeshLod(chai3d::cWorld* world, chai3d::cCamera* camera, const double switch_distance = 2.5,
+			const double cell_size = 0.01, const unsigned int min_triangles = 500)
+	: _camera(camera),
+	  _switch_distance(switch_distance),
+	  _n_triangles_full(0),
+	  _n_triangles_lod(0)
+	{
+		if(world == NULL || camera == NULL)
+		{
+			throw std::invalid_argument("no world or camera in MeshLod::MeshLod()\n");
+		}
+		if(switch_distance <= 0 || cell_size <= 0)
+		{
+			throw std::invalid_argument("distance and cell size should be positive in MeshLod::MeshLod()\n");
+		}
+
+		// all the meshes first, the copies are added to the scene after
+		std::vector<chai3d::cMesh*> meshes;
+		collectMeshes(world, meshes);
+		for(unsigned int i=0 ; i<meshes.size() ; i++)
+		{
+			chai3d::cMesh* mesh = meshes[i];
+			if(mesh->getNumTriangles() < min_triangles || mesh->getParent() == NULL)
+			{
+				continue;
+			}
+			Level level;
+			level.full = mesh;
+			level.lod = decimate(mesh, cell_size);
+			level.f_lod_shown = false;
+			level.lod->setShowEnabled(false);
+			mesh->getParent()->addChild(level.lod);
+			_n_triangles_full += mesh->getNumTriangles();
+			_n_triangles_lod += level.lod->getNumTriangles();
+			_levels.push_back(level);
+		}
+	}
+
+	~MeshLod()
+	{
+		for(unsigned int i=0 ; i<_levels.size() ; i++)
+		{
+			_levels[i].full->setShowEnabled(true);
+			_levels[i].lod->getParent()->removeChild(_levels[i].lod);
+			delete _levels[i].lod;
+		}
+	}
+
+	// shows the level of each mesh for the current camera, true when one of them switched
+	bool update()
+	{
+		const chai3d::cVector3d camera_pos = _camera->getGlobalPos();
+		bool switched = false;
+		for(unsigned int i=0 ; i<_levels.size() ; i++)
+		{
+			Level& level = _levels[i];
+			const double distance = (level.full->getGlobalPos() - camera_pos).length();
+			const bool show_lod = level.f_lod_shown ? distance > 0.9 * _switch_distance
+			                                        : distance > 1.1 * _switch_distance;
+			if(show_lod != level.f_lod_shown)
+			{
+				level.full->setShowEnabled(!show_lod);
+				level.lod->setShowEnabled(show_lod);
+				level.f_lod_shown = show_lod;
+				switched = true;
+			}
+		}
+		return switched;
+	}
+
+	void setSwitchDistance(const double switch_distance)
+	{
+		_switch_distance = switch_distance;
+	}
+
+	int numMeshes() const { return (int) _levels.size(); }
+	// of the meshes that have a decimated copy
+	unsigned long long numTrianglesFull() const { return _n_triangles_full; }
+	unsigned long long numTrianglesLod() const { return _n_triangles_lod; }
+
+private:
+
+	struct Level {
+		chai3d::cMesh* full;
+		chai3d::cMesh* lod;
+		bool f_lod_shown;
+	};
+
+	static void collectMeshes(chai3d::cGenericObject* object, std::vector<chai3d::cMesh*>& meshes)
+	{
+		chai3d::cMesh* mesh = dynamic_cast<chai3d::cMesh*>(object);
+		if(mesh != NULL)
+		{
+			meshes.push_back(mesh);
+		}
+		chai3d::cMultiMesh* multi_mesh = dynamic_cast<chai3d::cMultiMesh*>(object);
+		if(multi_mesh != NULL)
+		{
+			for(unsigned int i=0 ; i<multi_mesh->getNumMeshes() ; i++)
+			{
+				collectMeshes(multi_mesh->getMesh(i), meshes);
+			}
+		}
+		for(unsigned int i=0 ; i<object->getNumChildren() ; i++)
+		{
+			collectMeshes(object->getChild(i), meshes);
+		}
+	}
+
+	// vertex clustering on a grid in the frame of the mesh
+	static chai3d::cMesh* decimate(chai3d::cMesh* mesh, const double cell_size)
+	{
+		chai3d::cMesh* lod = new chai3d::cMesh(mesh->m_material);
+		lod->setLocalPos(mesh->getLocalPos());
+		lod->setLocalRot(mesh->getLocalRot());
+		lod->setUseVertexColors(mesh->getUseVertexColors());
+		lod->setUseTexture(false);
+
+		chai3d::cVertexArrayPtr vertices = mesh->m_vertices;
+		chai3d::cTriangleArrayPtr triangles = mesh->m_triangles;
+		std::vector<Eigen::Vector3d> positions(mesh->getNumVertices());
+		for(unsigned int i=0 ; i<positions.size() ; i++)
+		{
+			const chai3d::cVector3d p = vertices->getLocalPos(i);
+			positions[i] = Eigen::Vector3d(p.x(), p.y(), p.z());
+		}
+		std::vector<Eigen::Vector3i> faces;
+		for(unsigned int i=0 ; i<mesh->getNumTriangles() ; i++)
+		{
+			if(triangles->getAllocated(i))
+			{
+				faces.push_back(Eigen::Vector3i(triangles->getVertexIndex0(i), triangles->getVertexIndex1(i),
+						triangles->getVertexIndex2(i)));
+			}
+		}
+
+		// the clusters take the color of their first vertex
+		VertexClusters clusters;
+		clusterVertices(positions, cell_size, clusters);
+		std::vector<Eigen::Vector3i> lod_faces;
+		std::vector<int> sources;
+		clusterTriangles(clusters, faces, std::vector<int>(), lod_faces, sources);
+		for(unsigned int c=0 ; c<clusters.positions.size() ; c++)
+		{
+			const Eigen::Vector3d& mean = clusters.positions[c];
+			const unsigned int v = lod->newVertex(chai3d::cVector3d(mean(0), mean(1), mean(2)));
+			lod->m_vertices->setColor(v, vertices->getColor(clusters.first_vertices[c]));
+		}
+		for(unsigned int i=0 ; i<lod_faces.size() ; i++)
+		{
+			lod->newTriangle(lod_faces[i](0), lod_faces[i](1), lod_faces[i](2));
+		}
+		lod->computeAllNormals();
+		return lod;
+	}
+
+	chai3d::cCamera* _camera;
+	double _switch_distance;
+	std::vector<Level> _levels;
+
+	unsigned long long _n_triangles_full;
+	unsigned long long _n_triangles_lod;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_GRAPHICS_MESH_LOD_H_
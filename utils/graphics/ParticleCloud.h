@@ -0,0 +1,111 @@
+#ifndef UTILS_GRAPHICS_PARTICLE_CLOUD_H_
+#define UTILS_GRAPHICS_PARTICLE_CLOUD_H_
+
+// Thousands of particles drawn as one point cloud of the scene instead of one object each.
+//
+// a sphere per particle is one object of the scene graph, with its own traversal, material
+// and draw call, and the frame time grows with the number of particles. the cloud is a
+// single chai3d::cMultiPoint : the positions and colors of all the particles are packed in
+// its vertex array and drawn as point sprites of a given size in pixels in one draw call.
+// the graphics loop packs the particles of the last snapshot once per frame :
+//
+//   PandaUtils::ParticleCloud particle_cloud(graphics->_world, 6.0);
+//   Eigen::Matrix3Xd positions;
+//   Eigen::Matrix4Xf colors;                                          // rgba
+//   while (!glfwWindowShouldClose(window))
+//   {
+//       PandaUtils::getEigenMatrixBinary(redis_client, PARTICLE_POSITIONS_KEY, particles);
+//       ...                                                           // positions and colors of the particles
+//       particle_cloud.update(positions, colors);
+//       graphics->render(camera_name, width, height);
+//   }
+//
+// the points are made again only when the number of particles changes, a frame with the
+// same number only rewrites the vertex array.
+
+#include <chai3d.h>
+#include <Eigen/Dense>
+
+#include <stdexcept>
+
+namespace PandaUtils {
+
+class ParticleCloud {
+public:
+
+	// point size in pixels
+	ParticleCloud(chai3d::cWorld* world, const double point_size = 5.0)
+	: _world(world),
+	  _n_points(0)
+	{
+		if(world == NULL)
+		{
+			throw std::invalid_argument("no world for the particle cloud in ParticleCloud::ParticleCloud()\n");
+		}
+		_cloud = new chai3d::cMultiPoint();
+		_cloud->setPointSize(point_size);
+		_cloud->setUseVertexColors(true);
+		_world->addChild(_cloud);
+	}
+
+	~ParticleCloud()
+	{
+		_world->removeChild(_cloud);
+		delete _cloud;
+	}
+
+	// positions in world and rgba colors of the particles, one column each
+	void update(const Eigen::Ref<const Eigen::Matrix3Xd>& positions, const Eigen::Ref<const Eigen::Matrix4Xf>& colors)
+	{
+		if(positions.cols() != colors.cols())
+		{
+			throw std::invalid_argument("one color per particle in ParticleCloud::update()\n");
+		}
+		resize(positions.cols());
+
+		// the vertex of the i-th point is the i-th one, they are all made by resize()
+		chai3d::cVertexArrayPtr vertices = _cloud->m_vertices;
+		for(int i=0 ; i<_n_points ; i++)
+		{
+			vertices->setLocalPos(i, positions(0,i), positions(1,i), positions(2,i));
+			vertices->setColor(i, colors(0,i), colors(1,i), colors(2,i), colors(3,i));
+		}
+		_cloud->markForUpdate(false);
+	}
+
+	void setPointSize(const double point_size)
+	{
+		_cloud->setPointSize(point_size);
+	}
+
+	void setVisible(const bool visible)
+	{
+		_cloud->setShowEnabled(visible);
+	}
+
+	int numPoints() const { return _n_points; }
+
+private:
+
+	void resize(const int n_points)
+	{
+		if(n_points == _n_points)
+		{
+			return;
+		}
+		_cloud->clear();
+		for(int i=0 ; i<n_points ; i++)
+		{
+			_cloud->newPoint(chai3d::cVector3d(0, 0, 0));
+		}
+		_n_points = n_points;
+	}
+
+	chai3d::cWorld* _world;
+	chai3d::cMultiPoint* _cloud;
+	int _n_points;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_GRAPHICS_PARTICLE_CLOUD_H_
@@ -0,0 +1,196 @@
+#ifndef UTILS_GRAPHICS_RENDER_SCHEDULER_H_
+#define UTILS_GRAPHICS_RENDER_SCHEDULER_H_
+
+// Frames of the simviz graphics loop drawn only when the scene changed, at a bounded rate.
+//
+// the graphics loop updates the graphics of every robot and object and renders the whole
+// scene as fast as the gpu and the vsync allow, with a glFinish() per frame, even when
+// nothing moved. with several simviz on one machine they all compete for the gpu at full
+// rate. the scheduler keeps the last state given to the graphics of each robot, object and
+// the camera : the graphics of a robot are updated only when its joints moved, and a frame is
+// drawn only when something changed, the window was resized, or at the idle frequency to keep
+// the overlays alive. waitForNextFrame() sleeps to the max frequency between frames :
+//
+//   PandaUtils::RenderScheduler render_scheduler(30.0);                 // frames per second at most
+//   while (!glfwWindowShouldClose(window))
+//   {
+//       render_scheduler.waitForNextFrame();
+//       glfwGetFramebufferSize(window, &width, &height);
+//       if(render_scheduler.robotMoved(robot_name, robot->_q))
+//       {
+//           graphics->updateGraphics(robot_name, robot);
+//       }
+//       if(render_scheduler.frameDue(width, height))
+//       {
+//           graphics->render(camera_name, width, height);
+//           glfwSwapBuffers(window);
+//       }
+//       glfwPollEvents();
+//       ...                                                             // camera motion
+//       graphics->setCameraPose(camera_name, camera_pos, cam_up_axis, camera_lookat);
+//       render_scheduler.cameraMoved(camera_pos, cam_up_axis, camera_lookat);
+//   }
+//
+// a state is compared to the last one element by element with the tolerance, a new name
+// always counts as a change. other changes of the scene (a label, a particle cloud) call
+// invalidate().
+
+#include <Eigen/Dense>
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace PandaUtils {
+
+class RenderScheduler {
+public:
+
+	// most frames per second, frames per second of a still scene (0 for none)
+	RenderScheduler(const double max_frequency = 30.0, const double idle_frequency = 1.0,
+			const double tolerance = 1e-5)
+	: _tolerance(tolerance),
+	  _width(-1),
+	  _height(-1),
+	  _f_dirty(true),
+	  _n_frames(0),
+	  _n_skipped(0)
+	{
+		if(max_frequency <= 0)
+		{
+			throw std::invalid_argument("max frequency should be positive in RenderScheduler::RenderScheduler()\n");
+		}
+		if(idle_frequency < 0)
+		{
+			throw std::invalid_argument("idle frequency should not be negative in RenderScheduler::RenderScheduler()\n");
+		}
+		_frame_period = std::chrono::nanoseconds((int64_t)(1e9 / max_frequency + 0.5));
+		_idle_period = std::chrono::nanoseconds(idle_frequency > 0 ? (int64_t)(1e9 / idle_frequency + 0.5) : 0);
+		_next_frame = std::chrono::steady_clock::now();
+		_last_frame = _next_frame;
+	}
+
+	// sleeps until the next frame can be drawn
+	void waitForNextFrame()
+	{
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if(now < _next_frame)
+		{
+			std::this_thread::sleep_until(_next_frame);
+			_next_frame += _frame_period;
+		}
+		else
+		{
+			_next_frame = now + _frame_period;
+		}
+	}
+
+	// true when the joints of the robot changed since the last call, to update its graphics
+	template<typename Derived>
+	bool robotMoved(const std::string& robot_name, const Eigen::MatrixBase<Derived>& q)
+	{
+		return changed("robot::" + robot_name, q);
+	}
+
+	template<typename Derived>
+	bool objectMoved(const std::string& object_name, const Eigen::MatrixBase<Derived>& position,
+			const Eigen::Quaterniond& orientation)
+	{
+		Eigen::Matrix<double, 7, 1> pose;
+		pose << position, orientation.coeffs();
+		return changed("object::" + object_name, pose);
+	}
+
+	bool cameraMoved(const Eigen::Vector3d& position, const Eigen::Vector3d& vertical, const Eigen::Vector3d& lookat)
+	{
+		Eigen::Matrix<double, 9, 1> pose;
+		pose << position, vertical, lookat;
+		return changed("camera", pose);
+	}
+
+	// any state of the scene, true when it changed since the last call with this name
+	template<typename Derived>
+	bool changed(const std::string& name, const Eigen::MatrixBase<Derived>& state)
+	{
+		std::map<std::string, Eigen::VectorXd>::iterator it = _states.find(name);
+		if(it == _states.end())
+		{
+			it = _states.insert(std::make_pair(name, Eigen::VectorXd())).first;
+		}
+		Eigen::VectorXd& last = it->second;
+		if(last.size() == state.size() && last.size() > 0)
+		{
+			bool same = true;
+			for(int i=0 ; i<state.size() && same ; i++)
+			{
+				same = std::abs(last(i) - state(i % state.rows(), i / state.rows())) <= _tolerance;
+			}
+			if(same)
+			{
+				return false;
+			}
+		}
+		last.resize(state.size());
+		for(int i=0 ; i<state.size() ; i++)
+		{
+			last(i) = state(i % state.rows(), i / state.rows());
+		}
+		_f_dirty = true;
+		return true;
+	}
+
+	// the next frame is drawn whatever the states
+	void invalidate()
+	{
+		_f_dirty = true;
+	}
+
+	// true when a frame should be drawn now, after the updates of the graphics
+	bool frameDue(const int width, const int height)
+	{
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if(width != _width || height != _height)
+		{
+			_width = width;
+			_height = height;
+			_f_dirty = true;
+		}
+		if(!_f_dirty && (_idle_period.count() == 0 || now - _last_frame < _idle_period))
+		{
+			_n_skipped++;
+			return false;
+		}
+		_f_dirty = false;
+		_last_frame = now;
+		_n_frames++;
+		return true;
+	}
+
+	unsigned long long numFrames() const { return _n_frames; }
+	unsigned long long numSkipped() const { return _n_skipped; }
+
+private:
+
+	const double _tolerance;
+	std::chrono::nanoseconds _frame_period;
+	std::chrono::nanoseconds _idle_period;
+	std::chrono::steady_clock::time_point _next_frame;
+	std::chrono::steady_clock::time_point _last_frame;
+
+	std::map<std::string, Eigen::VectorXd> _states;
+	int _width;
+	int _height;
+	bool _f_dirty;
+
+	unsigned long long _n_frames;
+	unsigned long long _n_skipped;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_GRAPHICS_RENDER_SCHEDULER_H_
@@ -0,0 +1,277 @@
+#ifndef UTILS_HAPTICS_DELAY_COMPENSATION_H_
+#define UTILS_HAPTICS_DELAY_COMPENSATION_H_
+
+// Compensation of the communication delay of a teleoperation channel, between the haptic
+// side and the robot side, selectable at runtime for A/B comparisons.
+//
+// PREDICTION : the haptic side renders its force on a prediction of the current robot
+// position instead of the delayed one. RemotePositionPredictor is a Smith predictor : a
+// local first order model of the robot following the haptic commands runs without delay,
+// and the difference between the model now and the model one round trip ago is added to
+// the delayed robot position. the delayed measurement corrects the model errors, the model
+// only fills the round trip. on a stiff contact the robot does not follow the model, so the
+// prediction goes into the contact and the rendered spring is softer during the transients.
+//
+// WAVE_VARIABLES : the sides exchange the waves u = (F + b v) / sqrt(2b) (haptic to robot)
+// and v = (F - b v) / sqrt(2b) (robot to haptic) instead of a position and a force, with
+// F the force that flows from the operator to the environment and b the wave impedance.
+// the delayed wave channel stores the energy it receives and never generates any, for any
+// constant delay, so the teleoperation stays passive whatever the delay. the operator feels
+// the environment through the wave impedance : soft and damped with long delays, but stable
+// on the contacts where the undelayed coupling oscillates.
+//
+//   PandaUtils::WaveVariableMaster wave_master(25.0);            // haptic side
+//   PandaUtils::WaveVariableSlave wave_slave(25.0);              // robot side
+//   wave_slave.reset(robot_position);
+//   ...
+//   // haptic loop, backward wave from the delayed robot side state
+//   device_force = wave_master.update(delayed.backward_wave, haptic_velocity);
+//   haptic_state.forward_wave = wave_master.forwardWave();
+//   // robot loop, forward wave from the delayed haptic side state
+//   wave_slave.update(delayed.forward_wave, force_on_environment, dt);
+//   desired_position = wave_slave.desiredPosition();
+//   robot_state.backward_wave = wave_slave.backwardWave();
+//
+// the forces and velocities are in the robot frame. update() works on fixed size values
+// and does not allocate, the predictor allocates its history once in the constructor.
+
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+namespace PandaUtils {
+
+enum DelayCompensationMode {NO_DELAY_COMPENSATION, PREDICTION, WAVE_VARIABLES, N_DELAY_COMPENSATION_MODES};
+
+inline const char* delayCompensationName(const int mode)
+{
+	switch(mode)
+	{
+		case NO_DELAY_COMPENSATION :
+			return "none";
+		case PREDICTION :
+			return "prediction";
+		case WAVE_VARIABLES :
+			return "wave variables";
+		default :
+			return "unknown";
+	}
+}
+
+// haptic side of the wave transform
+class WaveVariableMaster {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Ref<const Eigen::Vector3d> Vector3dInput;
+
+	// wave impedance in N.s/m
+	WaveVariableMaster(const double impedance)
+	{
+		setImpedance(impedance);
+		reset();
+	}
+
+	void setImpedance(const double impedance)
+	{
+		if(impedance <= 0)
+		{
+			throw std::invalid_argument("wave impedance should be positive in WaveVariableMaster::setImpedance()\n");
+		}
+		_b = impedance;
+		_sqrt_2b = std::sqrt(2.0 * impedance);
+	}
+
+	void reset()
+	{
+		_forward_wave.setZero();
+		_force.setZero();
+	}
+
+	// decodes the force from the received backward wave and the velocity of the operator,
+	// and encodes the forward wave. returns the force to apply on the operator
+	const Eigen::Vector3d& update(const Vector3dInput& backward_wave, const Vector3dInput& velocity)
+	{
+		// operator force into the channel F = b v + sqrt(2b) v_wave, the device applies -F
+		_force.noalias() = -_b * velocity - _sqrt_2b * backward_wave;
+		_forward_wave.noalias() = _sqrt_2b * velocity + backward_wave;
+		return _force;
+	}
+
+	const Eigen::Vector3d& forwardWave() const
+	{
+		return _forward_wave;
+	}
+
+	// force on the operator of the last update
+	const Eigen::Vector3d& force() const
+	{
+		return _force;
+	}
+
+private:
+	double _b;
+	double _sqrt_2b;
+
+	Eigen::Vector3d _forward_wave;
+	Eigen::Vector3d _force;
+};
+
+// robot side of the wave transform, with the desired position integrated from the
+// desired velocity
+class WaveVariableSlave {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Ref<const Eigen::Vector3d> Vector3dInput;
+
+	WaveVariableSlave(const double impedance)
+	{
+		setImpedance(impedance);
+		reset(Eigen::Vector3d::Zero());
+	}
+
+	void setImpedance(const double impedance)
+	{
+		if(impedance <= 0)
+		{
+			throw std::invalid_argument("wave impedance should be positive in WaveVariableSlave::setImpedance()\n");
+		}
+		_b = impedance;
+		_sqrt_2b = std::sqrt(2.0 * impedance);
+	}
+
+	// the desired position restarts from position, with no velocity
+	void reset(const Vector3dInput& position)
+	{
+		_desired_position = position;
+		_desired_velocity.setZero();
+		_backward_wave.setZero();
+	}
+
+	// decodes the desired velocity from the received forward wave and the force that the
+	// robot applies on the environment, integrates it over dt, and encodes the backward wave.
+	// the channel ends on a damper of the wave impedance in series with the environment, so
+	// the waves are not reflected back to the operator (who feels this damping in free motion)
+	void update(const Vector3dInput& forward_wave, const Vector3dInput& force, const double dt)
+	{
+		_desired_velocity.noalias() = (_sqrt_2b * forward_wave - force) / (2.0 * _b);
+		_desired_position.noalias() += dt * _desired_velocity;
+		_backward_wave.noalias() = force / _sqrt_2b;
+	}
+
+	// the components that are not wave controlled, e.g. the motion space, follow the
+	// undelayed coupling and the wave ones start from there when they change
+	void setDesiredPosition(const Vector3dInput& position)
+	{
+		_desired_position = position;
+	}
+
+	const Eigen::Vector3d& desiredPosition() const
+	{
+		return _desired_position;
+	}
+
+	const Eigen::Vector3d& desiredVelocity() const
+	{
+		return _desired_velocity;
+	}
+
+	const Eigen::Vector3d& backwardWave() const
+	{
+		return _backward_wave;
+	}
+
+private:
+	double _b;
+	double _sqrt_2b;
+
+	Eigen::Vector3d _desired_position;
+	Eigen::Vector3d _desired_velocity;
+	Eigen::Vector3d _backward_wave;
+};
+
+// Smith predictor of the remote position, from its delayed measurement and the commands
+// sent to it. the remote is modeled as a first order follower of the commanded position
+class RemotePositionPredictor {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Ref<const Eigen::Vector3d> Vector3dInput;
+
+	// loop frequency of update() in Hz, time constant of the model in seconds, and the
+	// longest round trip to compensate in seconds (longer ones are clamped to it)
+	RemotePositionPredictor(const double loop_frequency, const double time_constant, const double max_round_trip)
+	{
+		if(loop_frequency <= 0 || max_round_trip <= 0)
+		{
+			throw std::invalid_argument("loop frequency and max round trip should be positive in RemotePositionPredictor::RemotePositionPredictor()\n");
+		}
+		_dt = 1.0 / loop_frequency;
+		setTimeConstant(time_constant);
+		_history.resize((size_t) std::ceil(max_round_trip * loop_frequency) + 1);
+		reset(Eigen::Vector3d::Zero());
+	}
+
+	void setTimeConstant(const double time_constant)
+	{
+		if(time_constant <= 0)
+		{
+			throw std::invalid_argument("time constant should be positive in RemotePositionPredictor::setTimeConstant()\n");
+		}
+		_model_gain = std::min(1.0, _dt / time_constant);
+	}
+
+	// the model restarts at position, as if the remote was there for the whole history
+	void reset(const Vector3dInput& position)
+	{
+		_model_position = position;
+		for(size_t i=0 ; i<_history.size() ; i++)
+		{
+			_history[i] = position;
+		}
+		_head = 0;
+		_prediction = position;
+	}
+
+	// one tick : advances the model with the command sent now, and predicts the remote
+	// position from its measurement round_trip seconds after the command that it answers
+	const Eigen::Vector3d& update(const Vector3dInput& delayed_position, const Vector3dInput& command, const double round_trip)
+	{
+		_model_position += _model_gain * (command - _model_position);
+		_head = (_head + 1) % _history.size();
+		_history[_head] = _model_position;
+
+		int n_steps = (int) std::round(std::max(0.0, round_trip) / _dt);
+		n_steps = std::min(n_steps, (int) _history.size() - 1);
+		const Eigen::Vector3d& delayed_model = _history[(_head + _history.size() - n_steps) % _history.size()];
+		_prediction.noalias() = delayed_position + (_model_position - delayed_model);
+		return _prediction;
+	}
+
+	const Eigen::Vector3d& prediction() const
+	{
+		return _prediction;
+	}
+
+	const Eigen::Vector3d& modelPosition() const
+	{
+		return _model_position;
+	}
+
+private:
+	double _dt;
+	double _model_gain;
+
+	Eigen::Vector3d _model_position;
+	Eigen::Vector3d _prediction;
+	std::vector<Eigen::Vector3d, Eigen::aligned_allocator<Eigen::Vector3d>> _history;
+	size_t _head;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_HAPTICS_DELAY_COMPENSATION_H_
@@ -0,0 +1,244 @@
+#ifndef UTILS_HAPTICS_FORCE_SPACE_UPDATES_H_
+#define UTILS_HAPTICS_FORCE_SPACE_UPDATES_H_
+
+// Event driven transmission of the force space of the local force loop teleoperation, from
+// the robot side (the particle filter output) to the haptic side.
+//
+// the force space is the dimension of the force space and one unit axis : the force axis in
+// dimension 1, the motion axis in dimension 2, none in dimensions 0 and 3. the encoder sends
+// an update when the dimension changes or the axis turns more than the angle threshold since
+// the last update sent, and a keyframe every keyframe period otherwise, so a lost update is
+// recovered. the decoder rebuilds sigma_force only when an update changes it :
+//
+//   PandaUtils::ForceSpaceEncoder force_space_encoder(2.0 * M_PI / 180.0, 25);  // robot side
+//   PandaUtils::ForceSpaceDecoder force_space_decoder;                           // haptic side
+//   PandaUtils::ForceSpaceUpdate update;
+//   while(runloop)
+//   {
+//       if(force_space_encoder.update(force_space_dimension, force_space_axis, update))
+//       {
+//           link.send(update);
+//       }
+//       ...
+//       if(link.receive(update) && force_space_decoder.apply(update))
+//       {
+//           delayed_sigma_force = force_space_decoder.sigmaForce();
+//       }
+//   }
+//
+// sigma_force does not depend on the sign of the axis, the particle filter can flip it
+// between two estimates, so the angle is taken between the lines of the axes.
+
+#include <Eigen/Dense>
+
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+
+namespace PandaUtils {
+
+struct ForceSpaceUpdate
+{
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	uint32_t sequence;
+	// 0 to 3
+	int dimension;
+	// unit force axis in dimension 1, unit motion axis in dimension 2, zero otherwise
+	Eigen::Vector3d axis;
+	bool keyframe;
+
+	ForceSpaceUpdate()
+	: sequence(0),
+	  dimension(0),
+	  axis(Eigen::Vector3d::Zero()),
+	  keyframe(false)
+	{}
+};
+
+// sigma_force of a force space
+inline Eigen::Matrix3d forceSpaceProjection(const int dimension, const Eigen::Vector3d& axis)
+{
+	switch(dimension)
+	{
+		case 1 :
+			return axis * axis.transpose();
+		case 2 :
+			return Eigen::Matrix3d::Identity() - axis * axis.transpose();
+		case 3 :
+			return Eigen::Matrix3d::Identity();
+		default :
+			return Eigen::Matrix3d::Zero();
+	}
+}
+
+class ForceSpaceEncoder {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Ref<const Eigen::Vector3d> Vector3dInput;
+
+	// angle threshold of the axis in radians, keyframe period in calls of update()
+	ForceSpaceEncoder(const double angle_threshold, const unsigned int keyframe_period)
+	: _keyframe_period(keyframe_period)
+	{
+		if(angle_threshold < 0 || angle_threshold >= M_PI / 2 || keyframe_period == 0)
+		{
+			throw std::invalid_argument("angle threshold should be in [0, pi/2) and keyframe period positive in ForceSpaceEncoder::ForceSpaceEncoder()\n");
+		}
+		_cos_threshold = std::cos(angle_threshold);
+		reset();
+	}
+
+	// the next update() sends a keyframe
+	void reset()
+	{
+		_last = ForceSpaceUpdate();
+		_calls_since_update = _keyframe_period;
+		_n_calls = 0;
+		_n_updates = 0;
+		_n_keyframes = 0;
+	}
+
+	// one cycle of the sender. returns true and the update to send when the force space
+	// changed beyond the threshold or a keyframe is due, false otherwise (update is not changed)
+	bool update(const int dimension, const Vector3dInput& axis, ForceSpaceUpdate& update)
+	{
+		_n_calls++;
+		_calls_since_update++;
+
+		Eigen::Vector3d unit_axis = Eigen::Vector3d::Zero();
+		if(dimension == 1 || dimension == 2)
+		{
+			const double norm = axis.norm();
+			if(norm > 1e-9)
+			{
+				unit_axis = axis / norm;
+			}
+		}
+
+		bool f_changed = dimension != _last.dimension;
+		if(!f_changed && (dimension == 1 || dimension == 2))
+		{
+			f_changed = std::abs(unit_axis.dot(_last.axis)) < _cos_threshold;
+		}
+		const bool f_keyframe = _calls_since_update >= _keyframe_period;
+		if(!f_changed && !f_keyframe)
+		{
+			return false;
+		}
+
+		_last.sequence++;
+		_last.dimension = dimension;
+		_last.axis = unit_axis;
+		_last.keyframe = !f_changed;
+		_calls_since_update = 0;
+		_n_updates++;
+		if(_last.keyframe)
+		{
+			_n_keyframes++;
+		}
+		update = _last;
+		return true;
+	}
+
+	unsigned long long calls() const { return _n_calls; }
+	// keyframes included
+	unsigned long long updates() const { return _n_updates; }
+	unsigned long long keyframes() const { return _n_keyframes; }
+
+private:
+	unsigned int _keyframe_period;
+	double _cos_threshold;
+
+	ForceSpaceUpdate _last;
+	unsigned int _calls_since_update;
+
+	unsigned long long _n_calls;
+	unsigned long long _n_updates;
+	unsigned long long _n_keyframes;
+};
+
+class ForceSpaceDecoder {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	ForceSpaceDecoder()
+	{
+		reset();
+	}
+
+	// back to the empty force space, the next update is accepted whatever its sequence
+	void reset()
+	{
+		_dimension = 0;
+		_axis.setZero();
+		_sigma_force.setZero();
+		_f_received = false;
+		_last_sequence = 0;
+		_n_received = 0;
+		_n_stale = 0;
+		_n_changes = 0;
+	}
+
+	// returns true when update changed the force space, and sigmaForce() with it. the
+	// updates older than the last one applied are dropped, and the keyframes that repeat
+	// the current force space do not rebuild sigma_force
+	bool apply(const ForceSpaceUpdate& update)
+	{
+		_n_received++;
+		if(_f_received && update.sequence <= _last_sequence)
+		{
+			_n_stale++;
+			return false;
+		}
+		_f_received = true;
+		_last_sequence = update.sequence;
+
+		if(update.dimension == _dimension && (_dimension == 0 || _dimension == 3 || update.axis == _axis))
+		{
+			return false;
+		}
+		_dimension = update.dimension;
+		_axis = update.axis;
+		_sigma_force = forceSpaceProjection(_dimension, _axis);
+		_n_changes++;
+		return true;
+	}
+
+	const Eigen::Matrix3d& sigmaForce() const
+	{
+		return _sigma_force;
+	}
+
+	int dimension() const
+	{
+		return _dimension;
+	}
+
+	const Eigen::Vector3d& axis() const
+	{
+		return _axis;
+	}
+
+	unsigned long long received() const { return _n_received; }
+	unsigned long long stale() const { return _n_stale; }
+	// updates that rebuilt sigma_force
+	unsigned long long changes() const { return _n_changes; }
+
+private:
+	int _dimension;
+	Eigen::Vector3d _axis;
+	Eigen::Matrix3d _sigma_force;
+
+	bool _f_received;
+	uint32_t _last_sequence;
+
+	unsigned long long _n_received;
+	unsigned long long _n_stale;
+	unsigned long long _n_changes;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_HAPTICS_FORCE_SPACE_UPDATES_H_
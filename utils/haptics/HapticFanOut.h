@@ -0,0 +1,296 @@
+#ifndef UTILS_HAPTICS_HAPTIC_FAN_OUT_H_
+#define UTILS_HAPTICS_HAPTIC_FAN_OUT_H_
+
+// One haptic device driving several robots, each robot controlled by its own thread.
+//
+// the haptic thread reads the device once per cycle and publishes its state, every robot
+// thread reads the newest state for its robot, computes its haptic feedback and publishes it,
+// and the haptic thread sums the feedbacks of the robots into the device command. the states
+// and the feedbacks go through one triple buffer per robot and direction (see
+// threads/TripleBuffer.h), so no thread waits on another and a slow robot thread does not
+// delay the haptic loop. the coupling of each robot maps the device motion to the motion that
+// robot follows : the same motion with an offset, or the motion mirrored through a plane of
+// the device frame, for two arms working symmetrically :
+//
+//   PandaUtils::HapticFanOut<2> fan_out({PandaUtils::FanOutCoupling::direct(),
+//                                        PandaUtils::FanOutCoupling::mirrored(Eigen::Vector3d::UnitY())});
+//
+//   while(runloop)                                      // haptic thread
+//   {
+//       if(device_channel->receive(device_state))
+//       {
+//           fan_out.publishState(device_state);
+//       }
+//       fan_out.aggregateFeedback(max_force, max_torque, command_force, command_torque, gripper_force);
+//       device_channel->sendCommands(command_force, command_torque, gripper_force, time);
+//   }
+//
+//   while(runloop)                                      // thread of robot i
+//   {
+//       fan_out.readDevice(i, *teleop_task);
+//       teleop_task->computeHapticCommands3d(posori_task->_desired_position);
+//       ...
+//       fan_out.sendFeedback(i, teleop_task->_commanded_force_device, teleop_task->_commanded_torque_device,
+//               teleop_task->_commanded_gripper_force_device);
+//   }
+//
+// each feedback is tagged with the device state it was computed from : a robot thread that
+// fell behind by more than the feedback lag (in states published) is left out of the sum, so
+// its last force does not stay on the operator hand. the state and feedback copies are fixed
+// size, the loops do not allocate.
+
+#include "net/TeleopPacket.h"
+#include "threads/TripleBuffer.h"
+
+#include <Eigen/Dense>
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+// device frame of the robot i = transform * device frame + offset. transform is orthogonal :
+// the identity, or a reflection for a mirrored robot
+struct FanOutCoupling
+{
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	Eigen::Matrix3d transform;
+	// m, in the device frame
+	Eigen::Vector3d offset;
+	// of the feedback of the robot in the device command
+	double feedback_weight;
+
+	FanOutCoupling()
+	: transform(Eigen::Matrix3d::Identity()),
+	  offset(Eigen::Vector3d::Zero()),
+	  feedback_weight(1.0)
+	{}
+
+	static FanOutCoupling direct(const Eigen::Vector3d& offset = Eigen::Vector3d::Zero())
+	{
+		FanOutCoupling coupling;
+		coupling.offset = offset;
+		return coupling;
+	}
+
+	// motion mirrored through the plane of the device frame origin with this normal
+	static FanOutCoupling mirrored(const Eigen::Vector3d& normal, const Eigen::Vector3d& offset = Eigen::Vector3d::Zero())
+	{
+		if(normal.norm() < 1e-9)
+		{
+			throw std::invalid_argument("null normal of the mirror plane in FanOutCoupling::mirrored()\n");
+		}
+		const Eigen::Vector3d n = normal.normalized();
+		FanOutCoupling coupling;
+		coupling.transform = Eigen::Matrix3d::Identity() - 2 * n * n.transpose();
+		coupling.offset = offset;
+		return coupling;
+	}
+
+	// the angular velocities and torques are pseudovectors, they change sign in a mirror
+	double handedness() const
+	{
+		return transform.determinant() > 0 ? 1.0 : -1.0;
+	}
+};
+
+// robot side of the fan out, in the device frame
+struct FanOutFeedback
+{
+	Eigen::Vector3d force;
+	Eigen::Vector3d torque;
+	double gripper_force;
+	// sequence of the device state the feedback was computed from, 0 before the first one
+	uint64_t state_sequence;
+
+	FanOutFeedback()
+	: force(Eigen::Vector3d::Zero()),
+	  torque(Eigen::Vector3d::Zero()),
+	  gripper_force(0),
+	  state_sequence(0)
+	{}
+};
+
+template<int N_ROBOTS>
+class HapticFanOut {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Ref<const Eigen::Vector3d> Vector3dInput;
+
+	// max_feedback_lag in device states published, e.g. 20 at 1 kHz for 20 ms
+	HapticFanOut(const std::vector<FanOutCoupling>& couplings, const unsigned int max_feedback_lag = 20)
+	: _max_feedback_lag(max_feedback_lag),
+	  _sequence(0),
+	  _n_published(0),
+	  _n_aggregated(0)
+	{
+		if(couplings.size() != N_ROBOTS)
+		{
+			throw std::invalid_argument("one coupling per robot in HapticFanOut::HapticFanOut()\n");
+		}
+		for(int i=0 ; i<N_ROBOTS ; i++)
+		{
+			if(!couplings[i].transform.isUnitary(1e-6))
+			{
+				throw std::invalid_argument("the coupling transforms should be orthogonal in HapticFanOut::HapticFanOut()\n");
+			}
+			_couplings[i] = couplings[i];
+			_handedness[i] = couplings[i].handedness();
+			_read_sequence[i] = 0;
+			_n_stale[i] = 0;
+		}
+	}
+
+	// haptic thread : the device state to every robot, mapped by its coupling
+	void publishState(const TeleopPacket& device_state)
+	{
+		_sequence++;
+		const Eigen::Map<const Eigen::Vector3d> position(device_state.position);
+		const Eigen::Map<const Eigen::Matrix3d> rotation(device_state.rotation);
+		const Eigen::Map<const Eigen::Vector3d> velocity(device_state.velocity);
+		const Eigen::Map<const Eigen::Vector3d> angular_velocity(device_state.angular_velocity);
+		const Eigen::Map<const Eigen::Vector3d> force(device_state.force);
+		const Eigen::Map<const Eigen::Vector3d> torque(device_state.torque);
+		for(int i=0 ; i<N_ROBOTS ; i++)
+		{
+			const Eigen::Matrix3d& T = _couplings[i].transform;
+			TeleopPacket& state = _states[i].writeBuffer();
+			state = device_state;
+			state.sequence = _sequence;
+			Eigen::Map<Eigen::Vector3d>(state.position) = T * position + _couplings[i].offset;
+			Eigen::Map<Eigen::Matrix3d>(state.rotation) = T * rotation * T.transpose();
+			Eigen::Map<Eigen::Vector3d>(state.velocity) = T * velocity;
+			Eigen::Map<Eigen::Vector3d>(state.angular_velocity) = _handedness[i] * T * angular_velocity;
+			Eigen::Map<Eigen::Vector3d>(state.force) = T * force;
+			Eigen::Map<Eigen::Vector3d>(state.torque) = _handedness[i] * T * torque;
+			_states[i].publish();
+		}
+		_n_published++;
+	}
+
+	// thread of robot i : copies the newest device state for that robot to the device fields
+	// of teleop_task (a Sai2Primitives::HapticController). returns true when a new state
+	// was published since the last call
+	template<typename HapticTask>
+	bool readDevice(const int i, HapticTask& teleop_task)
+	{
+		const bool f_new_state = _states[i].update();
+		const TeleopPacket& state = _states[i].latest();
+		if(state.sequence == 0)
+		{
+			return false;
+		}
+		_read_sequence[i] = state.sequence;
+		teleop_task._current_position_device = Eigen::Map<const Eigen::Vector3d>(state.position);
+		teleop_task._current_rotation_device = Eigen::Map<const Eigen::Matrix3d>(state.rotation);
+		teleop_task._current_trans_velocity_device = Eigen::Map<const Eigen::Vector3d>(state.velocity);
+		teleop_task._current_rot_velocity_device = Eigen::Map<const Eigen::Vector3d>(state.angular_velocity);
+		teleop_task._sensed_force_device = Eigen::Map<const Eigen::Vector3d>(state.force);
+		teleop_task._sensed_torque_device = Eigen::Map<const Eigen::Vector3d>(state.torque);
+		teleop_task._current_position_gripper_device = state.gripper_position;
+		teleop_task._current_gripper_velocity_device = state.gripper_velocity;
+		return f_new_state;
+	}
+
+	// thread of robot i : the device command computed by that robot, in its device frame
+	void sendFeedback(const int i, const Vector3dInput& force, const Vector3dInput& torque, const double gripper_force)
+	{
+		const Eigen::Matrix3d& T = _couplings[i].transform;
+		FanOutFeedback& feedback = _feedbacks[i].writeBuffer();
+		feedback.force = T.transpose() * force;
+		feedback.torque = _handedness[i] * T.transpose() * torque;
+		feedback.gripper_force = gripper_force;
+		feedback.state_sequence = _read_sequence[i];
+		_feedbacks[i].publish();
+	}
+
+	// haptic thread : weighted sum of the newest feedbacks of the robots, without the ones
+	// computed from a device state older than the feedback lag, saturated at the max force
+	// and torque of the device. returns the number of robots in the sum
+	int aggregateFeedback(const double max_force, const double max_torque,
+			Eigen::Vector3d& force, Eigen::Vector3d& torque, double& gripper_force)
+	{
+		force.setZero();
+		torque.setZero();
+		gripper_force = 0;
+		int n_robots = 0;
+		for(int i=0 ; i<N_ROBOTS ; i++)
+		{
+			const FanOutFeedback& feedback = _feedbacks[i].latest();
+			if(feedback.state_sequence == 0)
+			{
+				continue;
+			}
+			if(_sequence - feedback.state_sequence > _max_feedback_lag)
+			{
+				_n_stale[i]++;
+				continue;
+			}
+			const double weight = _couplings[i].feedback_weight;
+			force += weight * feedback.force;
+			torque += weight * feedback.torque;
+			gripper_force += weight * feedback.gripper_force;
+			n_robots++;
+		}
+		saturate(force, max_force);
+		saturate(torque, max_torque);
+		_n_aggregated++;
+		return n_robots;
+	}
+
+	const FanOutCoupling& coupling(const int i) const
+	{
+		return _couplings[i];
+	}
+
+	uint64_t published() const { return _n_published; }
+	uint64_t aggregated() const { return _n_aggregated; }
+	// haptic cycles where the feedback of robot i was left out as too old
+	uint64_t stale(const int i) const { return _n_stale[i]; }
+
+	// one line, e.g. "published 60000 states, aggregated 60000 feedbacks, stale 0 3"
+	std::string summary() const
+	{
+		std::string line = "published " + std::to_string(_n_published) + " states, aggregated "
+			+ std::to_string(_n_aggregated) + " feedbacks, stale";
+		for(int i=0 ; i<N_ROBOTS ; i++)
+		{
+			line += " " + std::to_string(_n_stale[i]);
+		}
+		return line;
+	}
+
+private:
+	static void saturate(Eigen::Vector3d& v, const double max_norm)
+	{
+		const double norm = v.norm();
+		if(max_norm > 0 && norm > max_norm)
+		{
+			v *= max_norm / norm;
+		}
+	}
+
+	FanOutCoupling _couplings[N_ROBOTS];
+	double _handedness[N_ROBOTS];
+	const unsigned int _max_feedback_lag;
+
+	// written by the haptic thread
+	TripleBuffer<TeleopPacket> _states[N_ROBOTS];
+	uint64_t _sequence;
+	uint64_t _n_published;
+	uint64_t _n_aggregated;
+	uint64_t _n_stale[N_ROBOTS];
+
+	// written by the robot threads
+	TripleBuffer<FanOutFeedback> _feedbacks[N_ROBOTS];
+	// owned by the robot thread i
+	uint64_t _read_sequence[N_ROBOTS];
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_HAPTICS_HAPTIC_FAN_OUT_H_
@@ -0,0 +1,139 @@
+#ifndef UTILS_HAPTICS_HAPTIC_FORCE_RENDERER_H_
+#define UTILS_HAPTICS_HAPTIC_FORCE_RENDERER_H_
+
+// Device side force feedback of the local force loop teleoperation, for a haptic loop that
+// runs faster than the robot loop.
+//
+// the feedback is a virtual spring between the device proxy and the robot position, in
+// the force space of the robot (sigma_force), rate limited and saturated, plus a damping
+// on the device velocity in the force space. the robot side values (robot position and
+// sigma_force) come from the robot loop, e.g. through a TripleBuffer, and are held between
+// their updates, while the device position and velocity are the ones of the current haptic
+// tick, so the force follows the hand at the haptic rate :
+//
+//   PandaUtils::HapticForceRenderer renderer(4000, 300.0, 25.0);   // haptic loop at 4 kHz
+//   renderer.setMaxForce(10.0);
+//   renderer.setMaxForceRate(50.0);                                // N/s
+//   while(runloop)
+//   {
+//       robot_side.read(robot_state);                              // from the robot loop
+//       ...
+//       teleop_task->_commanded_force_device = renderer.update(robot_state.robot_position,
+//               haptic_position, robot_state.sigma_force, teleop_task->_current_trans_velocity_device);
+//   }
+//
+// the rate limit is a force change per second, so the rendering does not change with the
+// haptic rate. update() works on fixed size values and does not allocate.
+
+#include <Eigen/Dense>
+
+#include <stdexcept>
+
+namespace PandaUtils {
+
+class HapticForceRenderer {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Ref<const Eigen::Vector3d> Vector3dInput;
+	typedef Eigen::Ref<const Eigen::Matrix3d> Matrix3dInput;
+
+	// loop frequency in Hz, stiffness in N/m and damping in N.s/m
+	HapticForceRenderer(const double loop_frequency, const double stiffness, const double damping)
+	: _max_force(1e6),
+	  _max_force_step(1e6)
+	{
+		if(loop_frequency <= 0)
+		{
+			throw std::invalid_argument("loop frequency should be positive in HapticForceRenderer::HapticForceRenderer()\n");
+		}
+		_dt = 1.0 / loop_frequency;
+		setGains(stiffness, damping);
+		reset();
+	}
+
+	void setGains(const double stiffness, const double damping)
+	{
+		if(stiffness < 0 || damping < 0)
+		{
+			throw std::invalid_argument("stiffness and damping should be positive in HapticForceRenderer::setGains()\n");
+		}
+		_stiffness = stiffness;
+		_damping = damping;
+	}
+
+	// norm of the spring force, in N
+	void setMaxForce(const double max_force)
+	{
+		if(max_force < 0)
+		{
+			throw std::invalid_argument("max force should be positive in HapticForceRenderer::setMaxForce()\n");
+		}
+		_max_force = max_force;
+	}
+
+	// norm of the change of the spring force, in N/s
+	void setMaxForceRate(const double max_force_rate)
+	{
+		if(max_force_rate < 0)
+		{
+			throw std::invalid_argument("max force rate should be positive in HapticForceRenderer::setMaxForceRate()\n");
+		}
+		_max_force_step = max_force_rate * _dt;
+	}
+
+	// the spring force restarts from 0, when the haptic control (re)starts
+	void reset()
+	{
+		_spring_force.setZero();
+		_force.setZero();
+	}
+
+	// one haptic tick. the positions are in the robot frame, the device velocity in the
+	// device frame, as the command. returns the force to command to the device
+	const Eigen::Vector3d& update(const Vector3dInput& robot_position, const Vector3dInput& haptic_position,
+			const Matrix3dInput& sigma_force, const Vector3dInput& device_velocity)
+	{
+		Eigen::Vector3d spring_force = _stiffness * (sigma_force * (robot_position - haptic_position));
+		const Eigen::Vector3d force_step = spring_force - _spring_force;
+		const double step_norm = force_step.norm();
+		if(step_norm > _max_force_step)
+		{
+			spring_force = _spring_force + (_max_force_step / step_norm) * force_step;
+		}
+		const double force_norm = spring_force.norm();
+		if(force_norm > _max_force)
+		{
+			spring_force *= _max_force / force_norm;
+		}
+		_spring_force = spring_force;
+
+		_force.noalias() = _spring_force - _damping * (sigma_force * device_velocity);
+		return _force;
+	}
+
+	// spring part of the last force, without the damping
+	const Eigen::Vector3d& springForce() const
+	{
+		return _spring_force;
+	}
+
+	const Eigen::Vector3d& force() const
+	{
+		return _force;
+	}
+
+private:
+	double _dt;
+	double _stiffness;
+	double _damping;
+	double _max_force;
+	double _max_force_step;
+
+	Eigen::Vector3d _spring_force;
+	Eigen::Vector3d _force;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_HAPTICS_HAPTIC_FORCE_RENDERER_H_
@@ -0,0 +1,258 @@
+#ifndef UTILS_HAPTICS_HAPTIC_RECORDING_H_
+#define UTILS_HAPTICS_HAPTIC_RECORDING_H_
+
+// Recording of the haptic device state read by a teleoperation controller, and its replay in
+// place of the live device, to run several controllers on the same operator input.
+//
+// the recording is a compressed binary log of Logging::Logger (see logger/Logger.h), taken on
+// every control tick with the loop time, so that the replay sees the device state the
+// controller saw at the same time of its loop. the state is the device fields that the
+// controllers read from the driver keys : position, rotation, velocities, sensed force and
+// torque, gripper position and velocity. binary_log_to_csv converts a recording to csv.
+//
+//   // app --record-haptics operator.bin
+//   PandaUtils::HapticRecorder recorder(path);
+//   while(runloop)
+//   {
+//       redis_client.executeReadCallback(0);               // live device keys
+//       recorder.record(*teleop_task, controller_counter, time);
+//       ...
+//   }
+//   recorder.stop();
+//
+//   // app --replay-haptics operator.bin, the device keys are not read
+//   PandaUtils::HapticReplay replay(path);
+//   while(runloop)
+//   {
+//       redis_client.executeReadCallback(0);
+//       if(!replay.readDevice(*teleop_task, time))         // holds the sample at or before time
+//       {
+//           runloop = false;                               // end of the recording
+//       }
+//       ...
+//   }
+//
+// the replay follows the loop time, not the wall time, so a controller on a sim clock at a
+// time scale above 1 (sim/SimClock.h) replays the operator faster than real time. the replay
+// reads the log one record ahead, it does not load the whole recording.
+
+#include "logger/BinaryLogReader.h"
+#include "logger/Logger.h"
+
+#include <Eigen/Dense>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+// options of the apps : --record-haptics <file> and --replay-haptics <file>
+struct HapticRecordingOptions
+{
+	std::string record_path;
+	std::string replay_path;
+
+	static HapticRecordingOptions fromArgs(const int argc, char** argv)
+	{
+		HapticRecordingOptions options;
+		for(int i=1 ; i<argc-1 ; i++)
+		{
+			const std::string arg = argv[i];
+			if(arg == "--record-haptics")
+			{
+				options.record_path = argv[i+1];
+			}
+			else if(arg == "--replay-haptics")
+			{
+				options.replay_path = argv[i+1];
+			}
+		}
+		if(!options.record_path.empty() && !options.replay_path.empty())
+		{
+			throw std::invalid_argument("--record-haptics and --replay-haptics cannot be used together in HapticRecordingOptions::fromArgs()\n");
+		}
+		return options;
+	}
+
+	bool recording() const
+	{
+		return !record_path.empty();
+	}
+
+	bool replaying() const
+	{
+		return !replay_path.empty();
+	}
+};
+
+class HapticRecorder {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	// ring_capacity is the number of ticks the logging thread can lag behind
+	HapticRecorder(const std::string& path, const unsigned int ring_capacity = 4096)
+	: _logger(0, path),
+	  _position(Eigen::Vector3d::Zero()),
+	  _rotation(Eigen::Matrix3d::Identity()),
+	  _velocity(Eigen::Vector3d::Zero()),
+	  _angular_velocity(Eigen::Vector3d::Zero()),
+	  _force(Eigen::Vector3d::Zero()),
+	  _torque(Eigen::Vector3d::Zero()),
+	  _gripper(Eigen::Vector2d::Zero())
+	{
+		_logger.addVectorToLog(&_position, "position");
+		_logger.addVectorToLog(&_rotation, "rotation");
+		_logger.addVectorToLog(&_velocity, "velocity");
+		_logger.addVectorToLog(&_angular_velocity, "angular_velocity");
+		_logger.addVectorToLog(&_force, "force");
+		_logger.addVectorToLog(&_torque, "torque");
+		_logger.addVectorToLog(&_gripper, "gripper");
+		_logger.enableCompression();
+		_logger.enableCapture(ring_capacity);
+		_logger.start();
+	}
+
+	~HapticRecorder()
+	{
+		stop();
+	}
+
+	// copies the device fields of teleop_task (a Sai2Primitives::HapticController) to the
+	// log, stamped with the loop time in seconds. false when the logger dropped the tick
+	template<typename HapticTask>
+	bool record(const HapticTask& teleop_task, const unsigned long long counter, const double time)
+	{
+		_position = teleop_task._current_position_device;
+		_rotation = teleop_task._current_rotation_device;
+		_velocity = teleop_task._current_trans_velocity_device;
+		_angular_velocity = teleop_task._current_rot_velocity_device;
+		_force = teleop_task._sensed_force_device;
+		_torque = teleop_task._sensed_torque_device;
+		_gripper << teleop_task._current_position_gripper_device, teleop_task._current_gripper_velocity_device;
+		return _logger.tick(counter, time);
+	}
+
+	// writes what the logging thread did not yet, and prints the counters of the logger
+	void stop()
+	{
+		_logger.stop();
+	}
+
+private:
+	Logging::Logger _logger;
+
+	Eigen::Vector3d _position;
+	Eigen::Matrix3d _rotation;
+	Eigen::Vector3d _velocity;
+	Eigen::Vector3d _angular_velocity;
+	Eigen::Vector3d _force;
+	Eigen::Vector3d _torque;
+	// position, velocity
+	Eigen::Vector2d _gripper;
+};
+
+class HapticReplay {
+public:
+
+	HapticReplay(const std::string& path)
+	: _n_samples(0),
+	  _f_last_sample(false),
+	  _f_finished(false)
+	{
+		if(!_reader.open(path))
+		{
+			throw std::runtime_error(_reader.error() + " in HapticReplay::HapticReplay()\n");
+		}
+		_position = offset("position");
+		_rotation = offset("rotation");
+		_velocity = offset("velocity");
+		_angular_velocity = offset("angular_velocity");
+		_force = offset("force");
+		_torque = offset("torque");
+		_gripper = offset("gripper");
+		if(!_reader.next(_current) || !_reader.next(_next))
+		{
+			throw std::runtime_error("less than two samples in " + path + " in HapticReplay::HapticReplay()\n");
+		}
+		_start_time = _current[0] * 1e-6;
+		_n_samples = 1;
+	}
+
+	// copies to the device fields of teleop_task the last sample at or before time (seconds
+	// of the loop, 0 at the first sample of the recording). returns false once time is after
+	// the last sample, teleop_task is then not changed
+	template<typename HapticTask>
+	bool readDevice(HapticTask& teleop_task, const double time)
+	{
+		while(!_f_last_sample && sampleTime(_next) <= time + 1e-9)
+		{
+			_current.swap(_next);
+			_n_samples++;
+			_f_last_sample = !_reader.next(_next);
+		}
+		if(_f_finished || (_f_last_sample && time > sampleTime(_current) + 1e-9))
+		{
+			_f_finished = true;
+			return false;
+		}
+		teleop_task._current_position_device = Eigen::Map<const Eigen::Vector3d>(&_current[_position]);
+		teleop_task._current_rotation_device = Eigen::Map<const Eigen::Matrix3d>(&_current[_rotation]);
+		teleop_task._current_trans_velocity_device = Eigen::Map<const Eigen::Vector3d>(&_current[_velocity]);
+		teleop_task._current_rot_velocity_device = Eigen::Map<const Eigen::Vector3d>(&_current[_angular_velocity]);
+		teleop_task._sensed_force_device = Eigen::Map<const Eigen::Vector3d>(&_current[_force]);
+		teleop_task._sensed_torque_device = Eigen::Map<const Eigen::Vector3d>(&_current[_torque]);
+		teleop_task._current_position_gripper_device = _current[_gripper];
+		teleop_task._current_gripper_velocity_device = _current[_gripper + 1];
+		return true;
+	}
+
+	bool finished() const
+	{
+		return _f_finished;
+	}
+
+	// samples passed so far
+	unsigned long long samples() const
+	{
+		return _n_samples;
+	}
+
+private:
+	int offset(const std::string& name)
+	{
+		const int i = _reader.variableOffset(name);
+		if(i < 0)
+		{
+			throw std::runtime_error("no " + name + " in the haptic recording in HapticReplay::HapticReplay()\n");
+		}
+		return i;
+	}
+
+	// the log timestamps are in microseconds
+	double sampleTime(const std::vector<double>& record) const
+	{
+		return record[0] * 1e-6 - _start_time;
+	}
+
+	Logging::BinaryLogReader _reader;
+	int _position;
+	int _rotation;
+	int _velocity;
+	int _angular_velocity;
+	int _force;
+	int _torque;
+	int _gripper;
+
+	std::vector<double> _current;
+	std::vector<double> _next;
+	double _start_time;
+	unsigned long long _n_samples;
+	// _current is the last sample of the log
+	bool _f_last_sample;
+	bool _f_finished;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_HAPTICS_HAPTIC_RECORDING_H_
@@ -0,0 +1,311 @@
+#ifndef UTILS_HAPTICS_STROKE_CAPTURE_H_
+#define UTILS_HAPTICS_STROKE_CAPTURE_H_
+
+// Capture of the brush strokes of a haptic painting session, at the rate of the haptic loop.
+//
+// two files are written :
+//
+//   - a compressed binary log of Logging::Logger (see logger/Logger.h) with every tick of
+//     the loop : the pose of the brush and the palette in world frame, the force sensed on
+//     the brush, and the stroke of the tick (its index, -1 out of contact, -2 in the paint
+//     of the palette). the Logger copies the tick to its ring and writes from its thread.
+//   - the strokes on the canvas as a stroke file (see trajectories/StrokeFile.h), the job
+//     format of the painting controllers, so the session can be painted again autonomously,
+//     e.g. by controller10 --strokes session.strokes, faster with --stroke-speed-scale.
+//
+// a stroke is a contact of the brush : from the sensed force going above onset_force to it
+// going back below release_force. a contact closer than palette_radius to the palette is
+// the brush taking paint, logged and not kept as a stroke. the points of a stroke are kept
+// every point_spacing along the brush path, and go through a lock-free queue to a builder
+// thread that assembles the strokes (points, mean speed, mean brush orientation). record()
+// only compares and copies, it never waits nor allocates :
+//
+//   // controller09 --capture-strokes session
+//   PandaUtils::StrokeCapture capture("session.bin", "session.strokes");
+//   while(runloop)
+//   {
+//       ...
+//       capture.record(controller_counter, time, brush_position, brush_orientation,
+//               f_sensed_brush, palette_position);
+//   }
+//   capture.stop();                                        // writes session.strokes
+
+#include "logger/Logger.h"
+#include "threads/SpscQueue.h"
+#include "trajectories/StrokeFile.h"
+
+#include <Eigen/Dense>
+#include <Eigen/StdVector>
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+namespace PandaUtils {
+
+class StrokeCapture {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	struct Options {
+		// norm of the sensed force (N)
+		double onset_force;
+		double release_force;
+		// distance between the kept points of a stroke (m)
+		double point_spacing;
+		// contacts around the palette (m)
+		double palette_radius;
+		// ticks the logging thread and points the builder thread can lag behind
+		unsigned int ring_capacity;
+
+		Options()
+		: onset_force(3.0), release_force(1.5), point_spacing(0.002), palette_radius(0.12), ring_capacity(4096)
+		{}
+	};
+
+	static const long NO_CONTACT = -1;
+	static const long PALETTE_CONTACT = -2;
+
+	StrokeCapture(const std::string& log_path, const std::string& strokes_path, const Options& options = Options())
+	: _logger(0, log_path),
+	  _strokes_path(strokes_path),
+	  _options(options),
+	  _points(options.ring_capacity),
+	  _brush_position(Eigen::Vector3d::Zero()),
+	  _brush_orientation(Eigen::Matrix3d::Identity()),
+	  _brush_force(Eigen::Matrix<double,6,1>::Zero()),
+	  _palette_position(Eigen::Vector3d::Zero()),
+	  _stroke(Eigen::Matrix<double,1,1>::Constant(NO_CONTACT)),
+	  _current_stroke(NO_CONTACT),
+	  _n_strokes(0),
+	  _n_palette_contacts(0),
+	  _n_dropped_points(0),
+	  _last_point(Eigen::Vector3d::Zero()),
+	  _f_point_kept(true),
+	  _f_stop(false),
+	  _f_stopped(false)
+	{
+		if(options.release_force > options.onset_force || options.point_spacing <= 0)
+		{
+			throw std::invalid_argument("release force above the onset force or no point spacing in StrokeCapture::StrokeCapture()\n");
+		}
+		_logger.addVectorToLog(&_brush_position, "brush_position");
+		_logger.addVectorToLog(&_brush_orientation, "brush_orientation");
+		_logger.addVectorToLog(&_brush_force, "brush_force");
+		_logger.addVectorToLog(&_palette_position, "palette_position");
+		_logger.addVectorToLog(&_stroke, "stroke");
+		_logger.enableCompression();
+		_logger.enableCapture(options.ring_capacity);
+		_logger.start();
+		_builder = std::thread(&StrokeCapture::buildStrokes, this);
+	}
+
+	~StrokeCapture()
+	{
+		stop();
+	}
+
+	StrokeCapture(const StrokeCapture&) = delete;
+	StrokeCapture& operator=(const StrokeCapture&) = delete;
+
+	// haptic loop, every tick : poses in world frame, force sensed on the brush (force and
+	// moment). false when the logger dropped the tick or the builder a point
+	template<typename ForceVector>
+	bool record(const unsigned long long counter, const double time,
+			const Eigen::Vector3d& brush_position, const Eigen::Matrix3d& brush_orientation,
+			const ForceVector& brush_force, const Eigen::Vector3d& palette_position)
+	{
+		_brush_position = brush_position;
+		_brush_orientation = brush_orientation;
+		_brush_force = brush_force;
+		_palette_position = palette_position;
+
+		const double force = _brush_force.template head<3>().norm();
+		if(_current_stroke == NO_CONTACT && force > _options.onset_force)
+		{
+			if((brush_position - palette_position).norm() < _options.palette_radius)
+			{
+				_current_stroke = PALETTE_CONTACT;
+				_n_palette_contacts++;
+			}
+			else
+			{
+				_current_stroke = _n_strokes++;
+				_last_point = brush_position;
+				pushPoint(time, brush_position, brush_orientation);
+			}
+		}
+		else if(_current_stroke != NO_CONTACT && force < _options.release_force)
+		{
+			// the last point of a stroke, wherever it is
+			if(_current_stroke >= 0 && (brush_position - _last_point).norm() > 1e-6)
+			{
+				pushPoint(time, brush_position, brush_orientation);
+			}
+			_current_stroke = NO_CONTACT;
+		}
+		else if(_current_stroke >= 0 && (brush_position - _last_point).norm() >= _options.point_spacing)
+		{
+			_last_point = brush_position;
+			pushPoint(time, brush_position, brush_orientation);
+		}
+		_stroke(0) = _current_stroke;
+
+		const bool f_point_kept = _f_point_kept;
+		_f_point_kept = true;
+		return _logger.tick(counter, time) && f_point_kept;
+	}
+
+	// writes what the threads did not yet, the strokes file last
+	void stop()
+	{
+		if(_f_stopped)
+		{
+			return;
+		}
+		_f_stopped = true;
+		_logger.stop();
+		_f_stop = true;
+		if(_builder.joinable())
+		{
+			_builder.join();
+		}
+		try
+		{
+			_writer.write(_strokes_path);
+			std::cout << "stroke capture : " << _writer.numStrokes() << " strokes to " << _strokes_path
+				<< ", " << _n_palette_contacts << " palette contacts, " << _n_dropped_points << " points dropped" << std::endl;
+		}
+		catch(const std::exception& e)
+		{
+			std::cout << e.what();
+		}
+	}
+
+	// of the current tick, NO_CONTACT or PALETTE_CONTACT out of a stroke
+	long currentStroke() const { return _current_stroke; }
+	long numStrokes() const { return _n_strokes; }
+	unsigned long numPaletteContacts() const { return _n_palette_contacts; }
+
+private:
+
+	struct Point {
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+		double time;
+		long stroke;
+		Eigen::Vector3d position;
+		Eigen::Quaterniond orientation;
+	};
+
+	void pushPoint(const double time, const Eigen::Vector3d& position, const Eigen::Matrix3d& orientation)
+	{
+		Point* point = _points.beginPush();
+		if(!point)
+		{
+			_n_dropped_points++;
+			_f_point_kept = false;
+			return;
+		}
+		point->time = time;
+		point->stroke = _current_stroke;
+		point->position = position;
+		point->orientation = Eigen::Quaterniond(orientation);
+		_points.endPush();
+	}
+
+	// builder thread : a stroke is complete when a point of the next one arrives, or at the end
+	void buildStrokes()
+	{
+		std::vector<Eigen::Vector3d> positions;
+		Eigen::Vector4d orientation_sum = Eigen::Vector4d::Zero();
+		Eigen::Quaterniond reference = Eigen::Quaterniond::Identity();
+		long stroke = NO_CONTACT;
+		double start_time = 0, end_time = 0, length = 0;
+		Point point;
+
+		while(true)
+		{
+			const bool f_stop = _f_stop;
+			if(!_points.pop(point))
+			{
+				if(f_stop)
+				{
+					break;
+				}
+				usleep(1000);
+				continue;
+			}
+			if(point.stroke != stroke)
+			{
+				addStroke(positions, orientation_sum, end_time - start_time, length);
+				positions.clear();
+				orientation_sum.setZero();
+				reference = point.orientation;
+				stroke = point.stroke;
+				start_time = point.time;
+				length = 0;
+			}
+			else
+			{
+				length += (point.position - positions.back()).norm();
+			}
+			end_time = point.time;
+			positions.push_back(point.position);
+			// q and -q are the same orientation, summed on the side of the first one
+			const double sign = (point.orientation.coeffs().dot(reference.coeffs()) < 0) ? -1.0 : 1.0;
+			orientation_sum += sign * point.orientation.coeffs();
+		}
+		addStroke(positions, orientation_sum, end_time - start_time, length);
+	}
+
+	void addStroke(const std::vector<Eigen::Vector3d>& positions, const Eigen::Vector4d& orientation_sum,
+			const double duration, const double length)
+	{
+		if(positions.empty())
+		{
+			return;
+		}
+		// x y z w, as the coefficients of Eigen
+		Eigen::Quaterniond orientation(orientation_sum(3), orientation_sum(0), orientation_sum(1), orientation_sum(2));
+		orientation.normalize();
+		const double speed = (duration > 0 && length > 0) ? length / duration : 0.01;
+		_writer.addStroke(positions, std::max(speed, 0.01), orientation);
+	}
+
+	Logging::Logger _logger;
+	const std::string _strokes_path;
+	const Options _options;
+
+	SpscQueue<Point, Eigen::aligned_allocator<Point> > _points;
+	StrokeFileWriter _writer;
+
+	// the logged values of the tick
+	Eigen::Vector3d _brush_position;
+	Eigen::Matrix3d _brush_orientation;
+	Eigen::Matrix<double,6,1> _brush_force;
+	Eigen::Vector3d _palette_position;
+	Eigen::Matrix<double,1,1> _stroke;
+
+	// haptic loop only
+	long _current_stroke;
+	long _n_strokes;
+	unsigned long _n_palette_contacts;
+	unsigned long _n_dropped_points;
+	Eigen::Vector3d _last_point;
+	bool _f_point_kept;
+
+	std::thread _builder;
+	std::atomic<bool> _f_stop;
+	bool _f_stopped;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_HAPTICS_STROKE_CAPTURE_H_
@@ -0,0 +1,470 @@
+#ifndef UTILS_KALMAN_FILTERS_JOINT_KALMAN_FILTER_H_
+#define UTILS_KALMAN_FILTERS_JOINT_KALMAN_FILTER_H_
+
+#include <math.h>
+#include <stdexcept>
+#include <iostream>
+#include <Eigen/Dense>
+
+namespace KalmanFilters
+{
+
+/**
+* Kalman filter of DOF independent 3 states chains with one output each, typically the
+* q, dq, ddq of every joint from the measured q. It is the KalmanFilter of the stacked
+* state [q; dq; ddq] when all the matrices are made of diagonal DOF x DOF blocks, but
+* the joints are batched (one array of DOF values per coefficient) instead of dense
+* 3*DOF matrix products, and the gain needs no matrix inverse.
+* With the same matrices it gives the same estimates as KalmanFilter<3*DOF,DOF>, and it
+* has the same steady state gain option (see KalmanFilter).
+*/
+template<int DOF = Eigen::Dynamic>
+class JointKalmanFilter {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	static const int N = (DOF == Eigen::Dynamic) ? Eigen::Dynamic : 3*DOF;
+
+	typedef Eigen::Matrix<double, N, 1> VectorN;
+	typedef Eigen::Matrix<double, DOF, 1> VectorM;
+	typedef Eigen::Array<double, DOF, 1> ArrayDof;
+
+	/**
+	Constructor from the matrices of the stacked state [q; dq; ddq], that must be made
+	of diagonal dof x dof blocks :
+	* 	F - dynamics matrix (A), 3*dof x 3*dof
+	*	H - output matrix (C), dof x 3*dof
+	*	Q - process noise covariance matrix, 3*dof x 3*dof
+	*	R - measurement noise covariance matrix, dof x dof
+	*/
+	JointKalmanFilter(
+		const double dt,
+		const Eigen::MatrixXd& F,
+		const Eigen::MatrixXd& H,
+		const Eigen::MatrixXd& Q,
+		const Eigen::MatrixXd& R
+		)
+	: _dof(H.rows()), _t(0), _dt(dt), _initialized(false),
+	_joseph_form(false), _steady_state_gain_enabled(false), _steady_state_gain(false), _gain_tolerance(0), _max_riccati_iterations(0)
+	{
+		if(DOF != Eigen::Dynamic && _dof != DOF)
+		{
+			throw std::invalid_argument("matrix sizes inconsistent with the filter dof in JointKalmanFilter::JointKalmanFilter()\n");
+		}
+
+		allocate();
+		setMatrices(F, H, Q, R);
+	}
+
+	/**
+	Constructor with the same 3 states chain for every joint :
+	* 	F - dynamics matrix (A), 3x3
+	*	H - output matrix (C), 1x3
+	*	Q - process noise covariance matrix, 3x3
+	*	R - measurement noise covariance matrix, 1x1
+	*/
+	JointKalmanFilter(
+		const int dof,
+		const double dt,
+		const Eigen::Matrix3d& F,
+		const Eigen::RowVector3d& H,
+		const Eigen::Matrix3d& Q,
+		const double R
+		)
+	: _dof(dof), _t(0), _dt(dt), _initialized(false),
+	_joseph_form(false), _steady_state_gain_enabled(false), _steady_state_gain(false), _gain_tolerance(0), _max_riccati_iterations(0)
+	{
+		if(DOF != Eigen::Dynamic && _dof != DOF)
+		{
+			throw std::invalid_argument("dof inconsistent with the filter dof in JointKalmanFilter::JointKalmanFilter()\n");
+		}
+
+		allocate();
+		for(int a=0 ; a<3 ; a++)
+		{
+			_H[a].setConstant(H(a));
+			for(int b=0 ; b<3 ; b++)
+			{
+				_F[a][b].setConstant(F(a,b));
+				_Q[a][b].setConstant(Q(a,b));
+			}
+		}
+		_R.setConstant(R);
+	}
+
+	/**
+	* Replace the matrices of the stacked state (same sizes, diagonal blocks). Goes back to the
+	* full covariance update if the steady state gain was used
+	*/
+	void setMatrices(
+		const Eigen::MatrixXd& F,
+		const Eigen::MatrixXd& H,
+		const Eigen::MatrixXd& Q,
+		const Eigen::MatrixXd& R
+		)
+	{
+		if(H.rows() != _dof || F.rows() != 3*_dof || F.cols() != 3*_dof || H.cols() != 3*_dof || Q.rows() != 3*_dof || Q.cols() != 3*_dof || R.rows() != _dof || R.cols() != _dof)
+		{
+			throw std::invalid_argument("inconsistent matrix sizes in JointKalmanFilter::setMatrices()\n");
+		}
+
+		for(int a=0 ; a<3 ; a++)
+		{
+			_H[a] = diagonalBlock(H, 0, a);
+			for(int b=0 ; b<3 ; b++)
+			{
+				_F[a][b] = diagonalBlock(F, a, b);
+				_Q[a][b] = diagonalBlock(Q, a, b);
+			}
+		}
+		_R = diagonalBlock(R, 0, 0);
+		_steady_state_gain = false;
+	}
+
+	/**
+	* Use the Joseph form of the covariance correction (see KalmanFilter::setJosephForm())
+	*/
+	void setJosephForm(const bool joseph_form)
+	{
+		_joseph_form = joseph_form;
+	}
+
+	/**
+	* Use the steady state Kalman gain, for constant matrices (see KalmanFilter::enableSteadyStateGain())
+	*/
+	void enableSteadyStateGain(const double tolerance = 1e-9, const int max_iterations = 100000)
+	{
+		_steady_state_gain_enabled = true;
+		_gain_tolerance = tolerance;
+		_max_riccati_iterations = max_iterations;
+		if(_initialized)
+		{
+			solveSteadyStateGain();
+		}
+	}
+
+	void disableSteadyStateGain()
+	{
+		_steady_state_gain_enabled = false;
+		_steady_state_gain = false;
+	}
+
+	/**
+	* true if update() currently uses the steady state gain
+	*/
+	bool usesSteadyStateGain() const
+	{
+		return _steady_state_gain;
+	}
+
+	/**
+	* Initialize filter with initial states and intial error covariance as zero
+	*/
+	void init()
+	{
+		setState(Eigen::VectorXd::Zero(3*_dof));
+		setCovarianceZero();
+		_t = 0;
+		_initialized = true;
+		if(_steady_state_gain_enabled)
+		{
+			solveSteadyStateGain();
+		}
+	}
+
+	/**
+	* Initialize filter with intial error covariance as zero
+	*/
+	void init(const Eigen::VectorXd& x0, const double t0 = 0)
+	{
+		setState(x0);
+		setCovarianceZero();
+		_t = t0;
+		_initialized = true;
+		if(_steady_state_gain_enabled)
+		{
+			solveSteadyStateGain();
+		}
+	}
+
+	/**
+	* Initialize filter with a guess for initial states and error covariance
+	* (only the diagonals of the dof x dof blocks of P0 are used)
+	*/
+	void init(const Eigen::VectorXd& x0, const Eigen::MatrixXd& P0, const double t0 = 0)
+	{
+		setState(x0);
+		for(int a=0 ; a<3 ; a++)
+		{
+			for(int b=0 ; b<3 ; b++)
+			{
+				_P[a][b] = P0.block(a*_dof, b*_dof, _dof, _dof).diagonal().array();
+			}
+		}
+		_t = t0;
+		_initialized = true;
+		if(_steady_state_gain_enabled)
+		{
+			solveSteadyStateGain();
+		}
+	}
+
+	/**
+	* Update the estimated state based on measured values
+	* time step is assumed to remain constant
+	*/
+	void update(const Eigen::Ref<const VectorM>& y)
+	{
+		if(!_initialized)
+			throw std::runtime_error("Kalman Filter is not initialized!");
+
+		//First phase: Prediction, x = F x for all the joints at once
+		for(int a=0 ; a<3 ; a++)
+		{
+			_x_new[a] = _F[a][0] * _x[0] + _F[a][1] * _x[1] + _F[a][2] * _x[2];
+		}
+		if(!_steady_state_gain)
+		{
+			updateCovariance();
+			if(_steady_state_gain_enabled && gainConverged())
+			{
+				_steady_state_gain = true;
+			}
+		}
+
+		//Second phase: Correction of predicted variables based on Kalman gain
+		_innovation = y.array() - (_H[0] * _x_new[0] + _H[1] * _x_new[1] + _H[2] * _x_new[2]);
+		for(int a=0 ; a<3 ; a++)
+		{
+			_x[a] = _x_new[a] + _K[a] * _innovation;
+			_x_hat.segment(a*_dof, _dof) = _x[a].matrix();
+		}
+
+		_t += _dt;
+	}
+
+	/**
+	* return current state [q; dq; ddq] and time
+	*/
+	const VectorN& getState() const
+	{
+		return _x_hat;
+	}
+
+	double getTime() const
+	{
+		return _t;
+	}
+
+private:
+
+	/**
+	* One step of the Riccati recursion of all the joints : P = F P F^T + Q, Kalman gain and corrected P
+	*/
+	void updateCovariance()
+	{
+		for(int a=0 ; a<3 ; a++)
+		{
+			for(int b=0 ; b<3 ; b++)
+			{
+				_FP[a][b] = _F[a][0] * _P[0][b] + _F[a][1] * _P[1][b] + _F[a][2] * _P[2][b];
+			}
+		}
+		for(int a=0 ; a<3 ; a++)
+		{
+			for(int b=0 ; b<3 ; b++)
+			{
+				_P[a][b] = _FP[a][0] * _F[b][0] + _FP[a][1] * _F[b][1] + _FP[a][2] * _F[b][2] + _Q[a][b];
+			}
+		}
+
+		for(int a=0 ; a<3 ; a++)
+		{
+			_PHt[a] = _P[a][0] * _H[0] + _P[a][1] * _H[1] + _P[a][2] * _H[2];
+		}
+		_S = _H[0] * _PHt[0] + _H[1] * _PHt[1] + _H[2] * _PHt[2] + _R;
+		for(int a=0 ; a<3 ; a++)
+		{
+			_K[a] = _PHt[a] / _S; //Kalman gain
+		}
+		// P = (I - K H) P
+		for(int a=0 ; a<3 ; a++)
+		{
+			for(int b=0 ; b<3 ; b++)
+			{
+				_FP[a][b] = _P[a][b] - _K[a] * (_H[0] * _P[0][b] + _H[1] * _P[1][b] + _H[2] * _P[2][b]);
+			}
+		}
+		if(_joseph_form)
+		{
+			// P = (I - K H) P (I - K H)^T + K R K^T, symmetric
+			for(int a=0 ; a<3 ; a++)
+			{
+				_PHt[a] = _FP[a][0] * _H[0] + _FP[a][1] * _H[1] + _FP[a][2] * _H[2];
+			}
+			for(int a=0 ; a<3 ; a++)
+			{
+				for(int b=0 ; b<=a ; b++)
+				{
+					_P[a][b] = 0.5 * (_FP[a][b] - _PHt[a] * _K[b] + _FP[b][a] - _PHt[b] * _K[a]) + _K[a] * _K[b] * _R;
+					_P[b][a] = _P[a][b];
+				}
+			}
+			return;
+		}
+		for(int a=0 ; a<3 ; a++)
+		{
+			for(int b=0 ; b<3 ; b++)
+			{
+				_P[a][b] = _FP[a][b];
+			}
+		}
+	}
+
+	/**
+	* true if the gain of every joint did not change more than the tolerance since the previous call
+	*/
+	bool gainConverged()
+	{
+		const bool converged =
+			(_K[0].abs().max(_K[1].abs()).max(_K[2].abs()) > 0).all() &&
+			((_K[0] - _K_prev[0]).abs().max((_K[1] - _K_prev[1]).abs()).max((_K[2] - _K_prev[2]).abs())
+				<= _gain_tolerance * _K[0].abs().max(_K[1].abs()).max(_K[2].abs())).all();
+		for(int a=0 ; a<3 ; a++)
+		{
+			_K_prev[a] = _K[a];
+		}
+		return converged;
+	}
+
+	void solveSteadyStateGain()
+	{
+		_steady_state_gain = false;
+		for(int a=0 ; a<3 ; a++)
+		{
+			_K_prev[a].setZero();
+			for(int b=0 ; b<3 ; b++)
+			{
+				_P_init[a][b] = _P[a][b];
+			}
+		}
+		for(int i=0 ; i<_max_riccati_iterations ; i++)
+		{
+			updateCovariance();
+			if(gainConverged())
+			{
+				_steady_state_gain = true;
+				return;
+			}
+		}
+		std::cout << "WARNING : steady state gain did not converge in JointKalmanFilter::enableSteadyStateGain(), using the full update" << std::endl;
+		for(int a=0 ; a<3 ; a++)
+		{
+			for(int b=0 ; b<3 ; b++)
+			{
+				_P[a][b] = _P_init[a][b];
+			}
+		}
+	}
+
+	void allocate()
+	{
+		_x_hat.setZero(3*_dof);
+		for(int a=0 ; a<3 ; a++)
+		{
+			_H[a].setZero(_dof);
+			_x[a].setZero(_dof);
+			_x_new[a].setZero(_dof);
+			_PHt[a].setZero(_dof);
+			_K[a].setZero(_dof);
+			_K_prev[a].setZero(_dof);
+			for(int b=0 ; b<3 ; b++)
+			{
+				_F[a][b].setZero(_dof);
+				_Q[a][b].setZero(_dof);
+				_P[a][b].setZero(_dof);
+				_FP[a][b].setZero(_dof);
+				_P_init[a][b].setZero(_dof);
+			}
+		}
+		_R.setZero(_dof);
+		_S.setZero(_dof);
+		_innovation.setZero(_dof);
+	}
+
+	void setCovarianceZero()
+	{
+		for(int a=0 ; a<3 ; a++)
+		{
+			for(int b=0 ; b<3 ; b++)
+			{
+				_P[a][b].setZero();
+			}
+		}
+	}
+
+	// diagonal of the dof x dof block (a,b), that must be the only non zero values of the block
+	ArrayDof diagonalBlock(const Eigen::MatrixXd& matrix, const int a, const int b) const
+	{
+		Eigen::MatrixXd block = matrix.block(a*_dof, b*_dof, _dof, _dof);
+		ArrayDof diagonal = block.diagonal().array();
+		block.diagonal().setZero();
+		if(!block.isZero(0))
+		{
+			throw std::invalid_argument("matrices are not decoupled between the joints in JointKalmanFilter::setMatrices()\n");
+		}
+		return diagonal;
+	}
+
+	void setState(const Eigen::VectorXd& x)
+	{
+		_x_hat = x;
+		for(int a=0 ; a<3 ; a++)
+		{
+			_x[a] = x.segment(a*_dof, _dof).array();
+		}
+	}
+
+	//Number of joints
+	int _dof;
+
+	//Coefficients of the 3x3 matrices of every joint
+	ArrayDof _F[3][3], _Q[3][3], _P[3][3];
+	ArrayDof _H[3];
+	ArrayDof _R;
+
+	//Current time
+	double _t;
+
+	//discrete time step
+	double _dt;
+
+	//Is the filter initialized?
+	bool _initialized;
+
+	//Estimated states, stacked and per state variable (q, dq, ddq) for all the joints
+	VectorN _x_hat;
+	ArrayDof _x[3], _x_new[3];
+
+	//Intermediate results of update()
+	ArrayDof _FP[3][3];
+	ArrayDof _PHt[3];
+	ArrayDof _S;
+	ArrayDof _K[3];
+	ArrayDof _innovation;
+
+	//Joseph form of the covariance correction
+	bool _joseph_form;
+
+	//Steady state gain
+	bool _steady_state_gain_enabled;
+	bool _steady_state_gain;
+	double _gain_tolerance;
+	int _max_riccati_iterations;
+	ArrayDof _K_prev[3];
+	ArrayDof _P_init[3][3];
+};
+
+} /* namespace KalmanFilters */
+
+#endif //UTILS_KALMAN_FILTERS_JOINT_KALMAN_FILTER_H_
@@ -0,0 +1,368 @@
+#ifndef UTILS_KALMAN_FILTERS_KALMAN_FILTER_H_
+#define UTILS_KALMAN_FILTERS_KALMAN_FILTER_H_
+
+#include <math.h>
+#include <stdexcept>
+#include <string>
+#include <iostream>
+#include <Eigen/Dense>
+
+namespace KalmanFilters
+{
+
+/**
+* Linear Kalman filter with N states and M outputs. With sizes known at compile time
+* (e.g. KalmanFilter<21,7> for the q, dq, ddq of a panda) all the matrices are fixed
+* size Eigen types, so the products are unrolled and the filter lives on the stack.
+* KalmanFilter<> takes the sizes from the matrices given to the constructor.
+* All the intermediate matrices are members, update() does not allocate with fixed sizes.
+*
+* With constant matrices the covariance, hence the gain, converges. enableSteadyStateGain()
+* solves the Riccati recursion once at init(), after which update() only does the fixed gain
+* prediction and correction of the state. setMatrices() goes back to the full update, which
+* switches to the new steady state gain by itself once it converged again.
+*
+* The gain is computed with a Cholesky solve of the innovation covariance instead of its
+* inverse. For long runs, setJosephForm(true) updates the covariance with the Joseph form
+* (I - KH) P (I - KH)^T + K R K^T, kept symmetric, which does not drift from positive definite.
+*/
+template<int N = Eigen::Dynamic, int M = Eigen::Dynamic>
+class KalmanFilter {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Matrix<double, N, 1> VectorN;
+	typedef Eigen::Matrix<double, M, 1> VectorM;
+	typedef Eigen::Matrix<double, N, N> MatrixNN;
+	typedef Eigen::Matrix<double, M, N> MatrixMN;
+	typedef Eigen::Matrix<double, N, M> MatrixNM;
+	typedef Eigen::Matrix<double, M, M> MatrixMM;
+
+	/**
+	Constructor Kalman filter with the following matrices:
+	* 	F - dynamics matrix (A)
+	*	H - output matrix (C)
+	*	Q - process noise covariance matrix
+	*	R - measurement noise covariance matrix
+	*/
+	KalmanFilter(
+		const double dt,
+		const Eigen::MatrixXd& F,
+		const Eigen::MatrixXd& H,
+		const Eigen::MatrixXd& Q,
+		const Eigen::MatrixXd& R
+		)
+	: _n(F.rows()), _m(H.rows()), _t(0), _dt(dt), _initialized(false),
+	_joseph_form(false), _steady_state_gain_enabled(false), _steady_state_gain(false), _gain_tolerance(0), _max_riccati_iterations(0)
+	{
+		checkSizes(F, H, Q, R, "KalmanFilter::KalmanFilter()");
+
+		_F = F;
+		_H = H;
+		_Q = Q;
+		_R = R;
+		_P.setZero(_n,_n);
+		_I.setIdentity(_n,_n);
+		_x_hat.setZero(_n);
+		_x_hat_new.setZero(_n);
+
+		_FP.setZero(_n,_n);
+		_PHt.setZero(_n,_m);
+		_S.setZero(_m,_m);
+		_K.setZero(_n,_m);
+		_Kt.setZero(_m,_n);
+		_KR.setZero(_n,_m);
+		_IKH.setZero(_n,_n);
+		_S_llt.compute(_R); // sizes the factorization storage
+		_K_prev.setZero(_n,_m);
+		_P_init.setZero(_n,_n);
+		_innovation.setZero(_m);
+	}
+
+	/**
+	* Replace the matrices of the filter (same sizes). Goes back to the full covariance update
+	* if the steady state gain was used
+	*/
+	void setMatrices(
+		const Eigen::MatrixXd& F,
+		const Eigen::MatrixXd& H,
+		const Eigen::MatrixXd& Q,
+		const Eigen::MatrixXd& R
+		)
+	{
+		checkSizes(F, H, Q, R, "KalmanFilter::setMatrices()");
+		if(F.rows() != _n || H.rows() != _m)
+		{
+			throw std::invalid_argument("matrix sizes changed in KalmanFilter::setMatrices()\n");
+		}
+
+		_F = F;
+		_H = H;
+		_Q = Q;
+		_R = R;
+		_steady_state_gain = false;
+	}
+
+	/**
+	* Use the Joseph form of the covariance correction (more operations, numerically robust)
+	* instead of (I - KH) P
+	*/
+	void setJosephForm(const bool joseph_form)
+	{
+		_joseph_form = joseph_form;
+	}
+
+	/**
+	* Use the steady state Kalman gain, for constant matrices. The Riccati recursion is iterated
+	* from the initial covariance at init() (or now if already initialized) until the relative
+	* change of the gain is below tolerance. If it does not converge within max_iterations, the
+	* full update is used until the gain converges
+	*/
+	void enableSteadyStateGain(const double tolerance = 1e-9, const int max_iterations = 100000)
+	{
+		_steady_state_gain_enabled = true;
+		_gain_tolerance = tolerance;
+		_max_riccati_iterations = max_iterations;
+		if(_initialized)
+		{
+			solveSteadyStateGain();
+		}
+	}
+
+	void disableSteadyStateGain()
+	{
+		_steady_state_gain_enabled = false;
+		_steady_state_gain = false;
+	}
+
+	/**
+	* true if update() currently uses the steady state gain
+	*/
+	bool usesSteadyStateGain() const
+	{
+		return _steady_state_gain;
+	}
+
+	/**
+	* Initialize filter with initial states and intial error covariance as zero
+	*/
+	void init()
+	{
+		_x_hat.setZero();
+		_P.setZero(_n,_n);
+		_t = 0;
+		_initialized = true;
+		if(_steady_state_gain_enabled)
+		{
+			solveSteadyStateGain();
+		}
+	}
+
+	/**
+	* Initialize filter with intial error covariance as zero
+	*/
+	void init(const Eigen::VectorXd& x0, const double t0 = 0)
+	{
+		_x_hat = x0;
+		_P.setZero(_n,_n);
+		_t = t0;
+		_initialized = true;
+		if(_steady_state_gain_enabled)
+		{
+			solveSteadyStateGain();
+		}
+	}
+
+	/**
+	* Initialize filter with a guess for initial states and error covariance
+	*/
+	void init(const Eigen::VectorXd& x0, const Eigen::MatrixXd& P0, const double t0 = 0)
+	{
+		_x_hat = x0;
+		_P = P0;
+		_t = t0;
+		_initialized = true;
+		if(_steady_state_gain_enabled)
+		{
+			solveSteadyStateGain();
+		}
+	}
+
+	/**
+	* Update the estimated state based on measured values
+	* time step is assumed to remain constant
+	*/
+	void update(const Eigen::Ref<const VectorM>& y)
+	{
+		if(!_initialized)
+			throw std::runtime_error("Kalman Filter is not initialized!");
+
+		//First phase: Prediction
+		_x_hat_new.noalias() = _F * _x_hat;
+		if(!_steady_state_gain)
+		{
+			updateCovariance();
+			if(_steady_state_gain_enabled && gainConverged())
+			{
+				_steady_state_gain = true;
+			}
+		}
+
+		//Second phase: Correction of predicted variables based on Kalman gain
+		_innovation = y;
+		_innovation.noalias() -= _H * _x_hat_new;
+		_x_hat_new.noalias() += _K * _innovation;
+		_x_hat = _x_hat_new;
+
+		_t += _dt;
+	}
+
+	/**
+	* return current state and time
+	*/
+	const VectorN& getState() const
+	{
+		return _x_hat;
+	}
+
+	double getTime() const
+	{
+		return _t;
+	}
+
+private:
+
+	void checkSizes(
+		const Eigen::MatrixXd& F,
+		const Eigen::MatrixXd& H,
+		const Eigen::MatrixXd& Q,
+		const Eigen::MatrixXd& R,
+		const std::string& method
+		) const
+	{
+		const int n = F.rows();
+		const int m = H.rows();
+		if(F.cols() != n || H.cols() != n || Q.rows() != n || Q.cols() != n || R.rows() != m || R.cols() != m)
+		{
+			throw std::invalid_argument("inconsistent matrix sizes in " + method + "\n");
+		}
+		if((N != Eigen::Dynamic && n != N) || (M != Eigen::Dynamic && m != M))
+		{
+			throw std::invalid_argument("matrix sizes inconsistent with the filter sizes in " + method + "\n");
+		}
+	}
+
+	/**
+	* One step of the Riccati recursion : predicted covariance, Kalman gain and corrected covariance
+	*/
+	void updateCovariance()
+	{
+		_FP.noalias() = _F * _P;
+		_P.noalias() = _FP * _F.transpose();
+		_P += _Q;
+
+		_PHt.noalias() = _P * _H.transpose();
+		_S.noalias() = _H * _PHt;
+		_S += _R;
+
+		//Kalman gain K = P H^T S^-1, from S K^T = H P^T with S symmetric positive definite
+		_S_llt.compute(_S);
+		if(_S_llt.info() != Eigen::Success)
+		{
+			throw std::runtime_error("innovation covariance is not positive definite in KalmanFilter::update()\n");
+		}
+		_Kt = _PHt.transpose();
+		_S_llt.solveInPlace(_Kt);
+		_K = _Kt.transpose();
+
+		_IKH = _I;
+		_IKH.noalias() -= _K * _H;
+		_FP.noalias() = _IKH * _P;
+		if(_joseph_form)
+		{
+			_P.noalias() = _FP * _IKH.transpose();
+			_KR.noalias() = _K * _R;
+			_P.noalias() += _KR * _K.transpose();
+			_FP = 0.5 * (_P + _P.transpose());
+		}
+		_P = _FP;
+	}
+
+	/**
+	* true if the gain did not change more than the tolerance since the previous call
+	*/
+	bool gainConverged()
+	{
+		const double gain_norm = _K.template lpNorm<Eigen::Infinity>();
+		const bool converged = gain_norm > 0 && (_K - _K_prev).template lpNorm<Eigen::Infinity>() <= _gain_tolerance * gain_norm;
+		_K_prev = _K;
+		return converged;
+	}
+
+	void solveSteadyStateGain()
+	{
+		_steady_state_gain = false;
+		_P_init = _P;
+		_K_prev.setZero();
+		for(int i=0 ; i<_max_riccati_iterations ; i++)
+		{
+			updateCovariance();
+			if(gainConverged())
+			{
+				_steady_state_gain = true;
+				return;
+			}
+		}
+		std::cout << "WARNING : steady state gain did not converge in KalmanFilter::enableSteadyStateGain(), using the full update" << std::endl;
+		_P = _P_init;
+	}
+
+	//System dimensions
+	int _n, _m;
+
+	//Matrices for computation
+	MatrixNN _F, _Q, _P;
+	MatrixMN _H;
+	MatrixMM _R;
+
+	//Current time
+	double _t;
+
+	//discrete time step
+	double _dt;
+
+	//Is the filter initialized?
+	bool _initialized;
+
+	//n-size idenity
+	MatrixNN _I;
+
+	//Estimated states
+	VectorN _x_hat, _x_hat_new;
+
+	//Intermediate results of update()
+	MatrixNN _FP;
+	MatrixNM _PHt;
+	MatrixMM _S;
+	MatrixNM _K;
+	MatrixMN _Kt;
+	MatrixNM _KR;
+	MatrixNN _IKH;
+	Eigen::LLT<MatrixMM> _S_llt;
+	VectorM _innovation;
+
+	//Joseph form of the covariance correction
+	bool _joseph_form;
+
+	//Steady state gain
+	bool _steady_state_gain_enabled;
+	bool _steady_state_gain;
+	double _gain_tolerance;
+	int _max_riccati_iterations;
+	MatrixNM _K_prev;
+	MatrixNN _P_init;
+};
+
+} /* namespace KalmanFilters */
+
+#endif //UTILS_KALMAN_FILTERS_KALMAN_FILTER_H_
@@ -0,0 +1,158 @@
+#ifndef UTILS_LOGGER_BINARY_LOG_READER_H_
+#define UTILS_LOGGER_BINARY_LOG_READER_H_
+
+// Reads the binary logs of Logging::Logger (both the plain and the compressed format)
+// one record at a time:
+//
+//   Logging::BinaryLogReader reader;
+//   if (!reader.open("log.bin")) { ... reader.error() ... }
+//   const int force = reader.variableOffset("sensed_force");
+//   std::vector<double> record;
+//   while (reader.next(record)) {
+//       Eigen::Map<const Eigen::Vector3d> sensed_force(record.data() + force);
+//   }
+//
+// record[0] is the timestamp, then the values of the variables in the order of the
+// header, column major.
+
+#include "Logger.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace Logging {
+
+class BinaryLogReader {
+public:
+	BinaryLogReader() : _version(0), _record_size(1), _block_records_left(0), _block_position(NULL) {}
+
+	bool open(const std::string& fname) {
+		_in.open(fname, std::ios::in | std::ios::binary);
+		if (!_in) {
+			_error = "could not open " + fname;
+			return false;
+		}
+
+		char magic[8];
+		uint32_t n_vars;
+		_in.read(magic, sizeof(magic));
+		if (!_in || memcmp(magic, BINARY_LOG_MAGIC, sizeof(magic)) != 0 || !readUint32(_version) || !readUint32(n_vars)) {
+			_error = fname + " is not a binary log";
+			return false;
+		}
+		if (_version != BINARY_LOG_VERSION && _version != BINARY_LOG_VERSION_COMPRESSED) {
+			_error = "unsupported binary log version " + std::to_string(_version);
+			return false;
+		}
+
+		_names.resize(n_vars);
+		_rows.resize(n_vars);
+		_cols.resize(n_vars);
+		_offsets.resize(n_vars);
+		_record_size = 1;
+		for (uint32_t i = 0; i < n_vars; i++) {
+			uint32_t name_length;
+			if (!readUint32(name_length)) {
+				_error = "truncated header in " + fname;
+				return false;
+			}
+			_names[i].resize(name_length);
+			_in.read(&_names[i][0], name_length);
+			if (!readUint32(_rows[i]) || !readUint32(_cols[i])) {
+				_error = "truncated header in " + fname;
+				return false;
+			}
+			_offsets[i] = _record_size;
+			_record_size += _rows[i] * _cols[i];
+		}
+		return true;
+	}
+
+	// next record, false at the end of the log. a truncated last record or block is
+	// ignored, and error() says so
+	bool next(std::vector<double>& record) {
+		record.resize(_record_size);
+		if (_version == BINARY_LOG_VERSION) {
+			if (_in.read(reinterpret_cast<char*>(record.data()), _record_size * sizeof(double))) {
+				return true;
+			}
+			if (_in.gcount() != 0) {
+				_error = "ignoring truncated last record";
+			}
+			return false;
+		}
+
+		while (_block_records_left == 0) {
+			uint32_t block_bytes;
+			if (!readUint32(_block_records_left) || !readUint32(block_bytes)) {
+				_block_records_left = 0;
+				return false;
+			}
+			_block.resize(block_bytes);
+			_in.read(&_block[0], block_bytes);
+			if (!_in) {
+				_error = "ignoring truncated last block";
+				_block_records_left = 0;
+				return false;
+			}
+			_block_position = _block.data();
+			_previous.assign(_record_size, 0.0);
+		}
+		if (!decompressRecord(_block_position, _block.data() + _block.size(), _previous.data(), _record_size)) {
+			_error = "corrupted block";
+			_block_records_left = 0;
+			return false;
+		}
+		_block_records_left--;
+		record = _previous;
+		return true;
+	}
+
+	int numVariables() const { return _names.size(); }
+	const std::string& name(const int i) const { return _names[i]; }
+	int rows(const int i) const { return _rows[i]; }
+	int cols(const int i) const { return _cols[i]; }
+	int size(const int i) const { return _rows[i] * _cols[i]; }
+	// doubles per record, the timestamp included
+	int recordSize() const { return _record_size; }
+
+	// offset of a variable in the records, -1 if it is not in the log
+	int variableOffset(const std::string& name) const {
+		for (unsigned int i = 0; i < _names.size(); i++) {
+			if (_names[i] == name) {
+				return _offsets[i];
+			}
+		}
+		return -1;
+	}
+
+	const std::string& error() const { return _error; }
+
+private:
+	bool readUint32(uint32_t& value) {
+		_in.read(reinterpret_cast<char*>(&value), sizeof(uint32_t));
+		return bool(_in);
+	}
+
+	std::ifstream _in;
+	uint32_t _version;
+	std::vector<std::string> _names;
+	std::vector<uint32_t> _rows;
+	std::vector<uint32_t> _cols;
+	std::vector<int> _offsets;
+	int _record_size;
+	std::string _error;
+
+	// current block of a compressed log
+	uint32_t _block_records_left;
+	std::string _block;
+	const char* _block_position;
+	std::vector<double> _previous;
+};
+
+} /* namespace Logging */
+
+#endif //UTILS_LOGGER_BINARY_LOG_READER_H_
@@ -0,0 +1,527 @@
+#ifndef UTILS_LOGGER_INDEXED_LOG_READER_H_
+#define UTILS_LOGGER_INDEXED_LOG_READER_H_
+
+// Random access to the binary logs of Logging::Logger (plain or compressed, in one file or in
+// mapped segments) by time, without reading the log from the start:
+//
+//   Logging::IndexedLogReader reader;
+//   if (!reader.open("log.bin")) { ... reader.error() ... }
+//   std::vector<int> variables = {reader.variableIndex("q"), reader.variableIndex("dq")};
+//   std::vector<double> records;
+//   // 2 s of q and dq, 10 s after the start, the timestamps are in microseconds
+//   const unsigned long n = reader.readWindow(reader.startTime() + 10e6, reader.startTime() + 12e6, records, variables);
+//   const int record_size = reader.windowRecordSize(variables);
+//   for (unsigned long i = 0; i < n; i++) {
+//       Eigen::Map<const Eigen::VectorXd> q(records.data() + i * record_size + 1, 7);
+//   }
+//
+// the log and its segments are mapped in memory, and the time index written next to the log
+// (Logger::enableTimeIndex(), see BINARY_LOG_INDEX_MAGIC) gives the block where a window
+// starts, so only the blocks of the window are read and decompressed. without index, or with
+// the partial index of a logger that did not stop, open() builds the missing entries by going
+// over the block headers (compressed) or every few records (plain) of the rest of the log.
+//
+// readWindow() does not change the reader, several threads can read windows of the same log
+// at the same time. seek() and next() read the log sequentially from a time, as
+// BinaryLogReader does from the start. the timestamps should increase along the log, as the
+// Logger writes them.
+
+#include "Logger.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Logging {
+
+// records per index entry built by the reader for the plain logs without index
+const unsigned int INDEXED_LOG_READER_RECORDS_PER_ENTRY = 256;
+
+class IndexedLogReader {
+public:
+	IndexedLogReader() : _version(0), _record_size(1), _f_indexed(false), _start_time(0), _end_time(0) {}
+	~IndexedLogReader() { close(); }
+
+	bool open(const std::string& fname) {
+		close();
+		_error.clear();
+		if (!mapSegment(fname)) {
+			_error = "could not open " + fname;
+			return false;
+		}
+		if (!parseHeader(_segments[0])) {
+			close();
+			return false;
+		}
+		// the next segments of a mapped log, with the same header
+		for (unsigned int i = 1; ; i++) {
+			if (!mapSegment(segmentName(fname, i))) {
+				break;
+			}
+			Segment& segment = _segments.back();
+			if (segment.size < _header.size() || memcmp(segment.data, _header.data(), _header.size()) != 0) {
+				unmapSegment(segment);
+				_segments.pop_back();
+				break;
+			}
+			segment.data_start = _header.size();
+		}
+
+		readIndex(fname + ".idx");
+		completeIndex();
+		_start_time = 0;
+		_end_time = 0;
+		if (_index.empty()) {
+			_cursor.segment = _segments.size();
+			return true;
+		}
+		_start_time = _index.front().timestamp;
+		setCursor(_cursor, _index.size() - 1);
+		while (nextRecord(_cursor)) {
+			_end_time = _cursor.record[0];
+		}
+		// next() without seek() reads from the start
+		setCursor(_cursor, 0);
+		return true;
+	}
+
+	void close() {
+		for (Segment& segment: _segments) {
+			unmapSegment(segment);
+		}
+		_segments.clear();
+		_index.clear();
+		_f_indexed = false;
+		_cursor = Cursor();
+	}
+
+	int numVariables() const { return _names.size(); }
+	const std::string& name(const int i) const { return _names[i]; }
+	int rows(const int i) const { return _rows[i]; }
+	int cols(const int i) const { return _cols[i]; }
+	int size(const int i) const { return _rows[i] * _cols[i]; }
+	// of variable i in the full records
+	int offset(const int i) const { return _offsets[i]; }
+	// doubles per record, the timestamp included
+	int recordSize() const { return _record_size; }
+
+	// index of a variable, -1 if it is not in the log
+	int variableIndex(const std::string& name) const {
+		for (unsigned int i = 0; i < _names.size(); i++) {
+			if (_names[i] == name) {
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	// offset of a variable in the full records, -1 if it is not in the log
+	int variableOffset(const std::string& name) const {
+		const int i = variableIndex(name);
+		return (i < 0) ? -1 : _offsets[i];
+	}
+
+	// timestamps of the first and last records
+	double startTime() const { return _start_time; }
+	double endTime() const { return _end_time; }
+	int numSegments() const { return _segments.size(); }
+	// the index written by the logger was found (possibly completed by open())
+	bool indexed() const { return _f_indexed; }
+	int numIndexEntries() const { return _index.size(); }
+
+	// doubles per record of readWindow() : the timestamp, then the given variables
+	int windowRecordSize(const std::vector<int>& variables) const {
+		if (variables.empty()) {
+			return _record_size;
+		}
+		int record_size = 1;
+		for (const int i: variables) {
+			record_size += size(i);
+		}
+		return record_size;
+	}
+
+	// records with start_time <= timestamp <= end_time, each one the timestamp and the values of
+	// the variables (all of them if empty, in the order of the header) packed one after the
+	// other in records. returns the number of records
+	unsigned long readWindow(const double start_time, const double end_time, std::vector<double>& records,
+			const std::vector<int>& variables = std::vector<int>()) const {
+		records.clear();
+		if (_index.empty() || end_time < start_time) {
+			return 0;
+		}
+		for (const int i: variables) {
+			if (i < 0 || i >= numVariables()) {
+				return 0;
+			}
+		}
+		Cursor cursor;
+		setCursor(cursor, findEntry(start_time));
+		unsigned long n_records = 0;
+		while (nextRecord(cursor)) {
+			const double* record = cursor.record.data();
+			if (record[0] < start_time) {
+				continue;
+			}
+			if (record[0] > end_time) {
+				break;
+			}
+			if (variables.empty()) {
+				records.insert(records.end(), record, record + _record_size);
+			} else {
+				records.push_back(record[0]);
+				for (const int i: variables) {
+					records.insert(records.end(), record + _offsets[i], record + _offsets[i] + size(i));
+				}
+			}
+			n_records++;
+		}
+		return n_records;
+	}
+
+	// next() starts at the first record at or after time. false if there is none
+	bool seek(const double time) {
+		if (_index.empty()) {
+			return false;
+		}
+		setCursor(_cursor, findEntry(time));
+		while (nextRecord(_cursor)) {
+			if (_cursor.record[0] >= time) {
+				_cursor.f_pending = true;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// next full record, from the start of the log or after seek(), as BinaryLogReader::next().
+	// false at the end of the log
+	bool next(std::vector<double>& record) {
+		if (!_cursor.f_pending && !nextRecord(_cursor)) {
+			return false;
+		}
+		_cursor.f_pending = false;
+		record = _cursor.record;
+		return true;
+	}
+
+	const std::string& error() const { return _error; }
+
+private:
+	struct Segment {
+		int fd;
+		const char* data;
+		size_t size;
+		// first block or record, and end of the valid data
+		size_t data_start;
+		size_t data_end;
+	};
+
+	// position in the log of a sequential read
+	struct Cursor {
+		Cursor() : segment(0), position(0), block_records_left(0), block_position(NULL), block_end(NULL), f_pending(false) {}
+		unsigned int segment;
+		size_t position;
+		uint32_t block_records_left;
+		const char* block_position;
+		const char* block_end;
+		// the full record last read, the previous record of the block for the decompression
+		std::vector<double> record;
+		bool f_pending;
+	};
+
+	static std::string segmentName(const std::string& fname, const unsigned int index) {
+		const size_t extension = fname.find_last_of('.');
+		const size_t folder = fname.find_last_of('/');
+		if (extension == std::string::npos || (folder != std::string::npos && extension < folder)) {
+			return fname + "_" + std::to_string(index);
+		}
+		return fname.substr(0, extension) + "_" + std::to_string(index) + fname.substr(extension);
+	}
+
+	bool mapSegment(const std::string& fname) {
+		Segment segment;
+		segment.fd = ::open(fname.c_str(), O_RDONLY);
+		if (segment.fd < 0) {
+			return false;
+		}
+		struct stat info;
+		if (fstat(segment.fd, &info) != 0 || info.st_size == 0) {
+			::close(segment.fd);
+			return false;
+		}
+		segment.size = info.st_size;
+		void* data = mmap(NULL, segment.size, PROT_READ, MAP_PRIVATE, segment.fd, 0);
+		if (data == MAP_FAILED) {
+			::close(segment.fd);
+			return false;
+		}
+		// the windows are anywhere in the log
+		madvise(data, segment.size, MADV_RANDOM);
+		segment.data = static_cast<const char*>(data);
+		segment.data_start = 0;
+		segment.data_end = segment.size;
+		_segments.push_back(segment);
+		return true;
+	}
+
+	void unmapSegment(Segment& segment) {
+		if (segment.data != NULL) {
+			munmap(const_cast<char*>(segment.data), segment.size);
+			segment.data = NULL;
+		}
+		if (segment.fd >= 0) {
+			::close(segment.fd);
+			segment.fd = -1;
+		}
+	}
+
+	bool readUint32(const Segment& segment, size_t& position, uint32_t& value) const {
+		if (position + sizeof(uint32_t) > segment.size) {
+			return false;
+		}
+		memcpy(&value, segment.data + position, sizeof(uint32_t));
+		position += sizeof(uint32_t);
+		return true;
+	}
+
+	bool parseHeader(Segment& segment) {
+		size_t position = sizeof(BINARY_LOG_MAGIC);
+		uint32_t n_vars;
+		if (segment.size < position || memcmp(segment.data, BINARY_LOG_MAGIC, sizeof(BINARY_LOG_MAGIC)) != 0
+				|| !readUint32(segment, position, _version) || !readUint32(segment, position, n_vars)) {
+			_error = "not a binary log";
+			return false;
+		}
+		if (_version != BINARY_LOG_VERSION && _version != BINARY_LOG_VERSION_COMPRESSED) {
+			_error = "unsupported binary log version " + std::to_string(_version);
+			return false;
+		}
+		_names.resize(n_vars);
+		_rows.resize(n_vars);
+		_cols.resize(n_vars);
+		_offsets.resize(n_vars);
+		_record_size = 1;
+		for (uint32_t i = 0; i < n_vars; i++) {
+			uint32_t name_length;
+			if (!readUint32(segment, position, name_length) || position + name_length > segment.size) {
+				_error = "truncated header";
+				return false;
+			}
+			_names[i].assign(segment.data + position, name_length);
+			position += name_length;
+			if (!readUint32(segment, position, _rows[i]) || !readUint32(segment, position, _cols[i])) {
+				_error = "truncated header";
+				return false;
+			}
+			_offsets[i] = _record_size;
+			_record_size += _rows[i] * _cols[i];
+		}
+		_header.assign(segment.data, position);
+		segment.data_start = position;
+		return true;
+	}
+
+	// the entries of the index file that point in the log, in time order
+	void readIndex(const std::string& index_name) {
+		std::ifstream in(index_name, std::ios::in | std::ios::binary);
+		char magic[8];
+		uint32_t version, reserved;
+		in.read(magic, sizeof(magic));
+		in.read(reinterpret_cast<char*>(&version), sizeof(uint32_t));
+		in.read(reinterpret_cast<char*>(&reserved), sizeof(uint32_t));
+		if (!in || memcmp(magic, BINARY_LOG_INDEX_MAGIC, sizeof(magic)) != 0 || version != BINARY_LOG_INDEX_VERSION) {
+			return;
+		}
+		_f_indexed = true;
+		BinaryLogIndexEntry entry;
+		while (in.read(reinterpret_cast<char*>(&entry), sizeof(entry))) {
+			if (entry.segment >= _segments.size() || entry.offset < _segments[entry.segment].data_start
+					|| entry.offset >= _segments[entry.segment].size
+					|| (!_index.empty() && (entry.timestamp < _index.back().timestamp || entry.segment < _index.back().segment))) {
+				break;
+			}
+			_index.push_back(entry);
+		}
+		// the last entry is checked again when the index is completed
+		if (!_index.empty()) {
+			_index.pop_back();
+		}
+	}
+
+	// entries of the rest of the log, from the last entry of the index file, and the end of
+	// the valid data of the segments (a logger that did not stop leaves a preallocated segment)
+	void completeIndex() {
+		unsigned int segment = 0;
+		size_t position = _segments[0].data_start;
+		if (!_index.empty()) {
+			segment = _index.back().segment;
+			position = _index.back().offset;
+			_index.pop_back();
+		}
+		const size_t record_bytes = _record_size * sizeof(double);
+		for (; segment < _segments.size(); segment++) {
+			Segment& current = _segments[segment];
+			if (position < current.data_start) {
+				position = current.data_start;
+			}
+			const size_t plain_end = current.data_start + (current.size - current.data_start) / record_bytes * record_bytes;
+			while (true) {
+				double timestamp;
+				size_t next;
+				if (_version == BINARY_LOG_VERSION) {
+					// the timestamp of one record in INDEXED_LOG_READER_RECORDS_PER_ENTRY
+					if (position + record_bytes > current.size) {
+						break;
+					}
+					memcpy(&timestamp, current.data + position, sizeof(double));
+					next = position + INDEXED_LOG_READER_RECORDS_PER_ENTRY * record_bytes;
+				} else {
+					uint32_t block_records, block_bytes;
+					size_t block = position;
+					if (!readUint32(current, block, block_records) || !readUint32(current, block, block_bytes)
+							|| block_records == 0 || block + block_bytes > current.size) {
+						break;
+					}
+					const char* in = current.data + block;
+					timestamp = 0;
+					if (!decompressRecord(in, current.data + block + block_bytes, &timestamp, 1)) {
+						break;
+					}
+					next = block + block_bytes;
+				}
+				if (!_index.empty() && timestamp < _index.back().timestamp) {
+					break;
+				}
+				BinaryLogIndexEntry entry;
+				entry.timestamp = timestamp;
+				entry.segment = segment;
+				entry.reserved = 0;
+				entry.offset = position;
+				_index.push_back(entry);
+				position = next;
+			}
+			if (_version == BINARY_LOG_VERSION) {
+				current.data_end = findPlainEnd(segment, plain_end);
+			} else {
+				current.data_end = position;
+			}
+			position = 0;
+		}
+	}
+
+	// the records of the last stride of a plain segment that go back in time are left out, the
+	// zeros of a preallocated segment
+	size_t findPlainEnd(const unsigned int segment_index, const size_t end) const {
+		const size_t record_bytes = _record_size * sizeof(double);
+		if (_index.empty() || _index.back().segment != segment_index || _index.back().offset >= end) {
+			return end;
+		}
+		const Segment& segment = _segments[segment_index];
+		double previous = _index.back().timestamp;
+		for (size_t position = _index.back().offset; position < end; position += record_bytes) {
+			double timestamp;
+			memcpy(&timestamp, segment.data + position, sizeof(double));
+			if (timestamp < previous) {
+				return position;
+			}
+			previous = timestamp;
+		}
+		return end;
+	}
+
+	// the last entry before time, the first one if there is none
+	unsigned int findEntry(const double time) const {
+		unsigned int low = 0;
+		unsigned int high = _index.size();
+		while (high - low > 1) {
+			const unsigned int middle = (low + high) / 2;
+			if (_index[middle].timestamp < time) {
+				low = middle;
+			} else {
+				high = middle;
+			}
+		}
+		return low;
+	}
+
+	void setCursor(Cursor& cursor, const unsigned int entry) const {
+		cursor.segment = _index[entry].segment;
+		cursor.position = _index[entry].offset;
+		cursor.block_records_left = 0;
+		cursor.record.assign(_record_size, 0.0);
+		cursor.f_pending = false;
+	}
+
+	// the next full record in cursor.record. a corrupted block ends its segment
+	bool nextRecord(Cursor& cursor) const {
+		const size_t record_bytes = _record_size * sizeof(double);
+		while (cursor.segment < _segments.size()) {
+			const Segment& segment = _segments[cursor.segment];
+			if (_version == BINARY_LOG_VERSION) {
+				if (cursor.position + record_bytes <= segment.data_end) {
+					memcpy(cursor.record.data(), segment.data + cursor.position, record_bytes);
+					cursor.position += record_bytes;
+					return true;
+				}
+			} else {
+				if (cursor.block_records_left > 0) {
+					if (decompressRecord(cursor.block_position, cursor.block_end, cursor.record.data(), _record_size)) {
+						cursor.block_records_left--;
+						return true;
+					}
+				} else {
+					uint32_t block_records, block_bytes;
+					size_t block = cursor.position;
+					if (cursor.position < segment.data_end && readUint32(segment, block, block_records)
+							&& readUint32(segment, block, block_bytes) && block + block_bytes <= segment.data_end) {
+						cursor.block_records_left = block_records;
+						cursor.block_position = segment.data + block;
+						cursor.block_end = segment.data + block + block_bytes;
+						cursor.position = block + block_bytes;
+						std::fill(cursor.record.begin(), cursor.record.end(), 0.0);
+						continue;
+					}
+				}
+			}
+			cursor.segment++;
+			cursor.block_records_left = 0;
+			if (cursor.segment < _segments.size()) {
+				cursor.position = _segments[cursor.segment].data_start;
+			}
+		}
+		return false;
+	}
+
+	uint32_t _version;
+	std::vector<std::string> _names;
+	std::vector<uint32_t> _rows;
+	std::vector<uint32_t> _cols;
+	std::vector<int> _offsets;
+	int _record_size;
+	// bytes of the header, the same at the start of every segment
+	std::string _header;
+
+	std::vector<Segment> _segments;
+	std::vector<BinaryLogIndexEntry> _index;
+	bool _f_indexed;
+	double _start_time;
+	double _end_time;
+
+	// of seek() and next()
+	Cursor _cursor;
+
+	std::string _error;
+};
+
+} /* namespace Logging */
+
+#endif //UTILS_LOGGER_INDEXED_LOG_READER_H_
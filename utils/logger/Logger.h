@@ -0,0 +1,1289 @@
+#ifndef UTILS_LOGGER_LOGGER_H_
+#define UTILS_LOGGER_LOGGER_H_
+
+// Logger shared by the apps: logs Eigen variables to a text or binary file from its own thread.
+//
+//   auto logger = new Logging::Logger(1000, filename);
+//   logger->addVectorToLog(&sensed_force, "sensed_force");
+//   logger->enableCapture();
+//   logger->start();
+//   while(...) {
+//       ...
+//       logger->tick(controller_counter, time);
+//   }
+//   logger->stop();
+
+#include <fstream>
+#include <unistd.h>
+#include <chrono>
+using std::chrono::system_clock;
+using std::chrono::milliseconds;
+using std::chrono::microseconds;
+#include <Eigen/Dense>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <mutex>
+#include <cerrno>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+namespace Logging {
+
+// Log formatter
+// TODO: allow user defined log formatter
+static Eigen::IOFormat logVecFmt(Eigen::StreamPrecision, Eigen::DontAlignCols, ", ");
+
+// Binary log format:
+//   "SAI2BLOG" magic, uint32 format version, uint32 number of variables
+//   for each variable: uint32 name length, name, uint32 rows, uint32 cols
+//   then one record per sample: the timestamp and the values of all the variables
+//   (column major), as packed doubles in the byte order of the machine
+// in the compressed variant (version 2) the records are grouped in blocks:
+//   uint32 number of records, uint32 number of bytes, then the compressed records.
+//   each double is xor-ed with the same column of the previous record of the block
+//   (delta encoding, slowly varying signals give mostly zero bytes), and the resulting
+//   64 bit word is written as a mask byte of its non zero bytes followed by these bytes.
+//   blocks do not depend on each other.
+const char BINARY_LOG_MAGIC[8] = {'S', 'A', 'I', '2', 'B', 'L', 'O', 'G'};
+const uint32_t BINARY_LOG_VERSION = 1;
+const uint32_t BINARY_LOG_VERSION_COMPRESSED = 2;
+
+// Time index of a binary log, in a file next to it (the log file name followed by .idx):
+//   "SAI2BIDX" magic, uint32 index version, uint32 reserved
+//   then one entry per compressed block, or every few records of a plain log, and at the
+//   start of every segment: double timestamp of the first record of the block, uint32
+//   segment (0 for the log file, then the _1, _2, ... segments), uint32 reserved, uint64
+//   offset of the block (or record) in the segment, in the byte order of the machine.
+// the log itself is unchanged, the index only lets a reader go to a time without reading
+// what is before (see IndexedLogReader).
+const char BINARY_LOG_INDEX_MAGIC[8] = {'S', 'A', 'I', '2', 'B', 'I', 'D', 'X'};
+const uint32_t BINARY_LOG_INDEX_VERSION = 1;
+
+struct BinaryLogIndexEntry {
+	double timestamp;
+	uint32_t segment;
+	uint32_t reserved;
+	uint64_t offset;
+};
+
+// write latencies are kept in a histogram of LATENCY_BIN_NS wide bins, the last bin
+// holds everything above
+const int LATENCY_BIN_NS = 100;
+const int LATENCY_N_BINS = 1000;
+
+// append a record to a compressed block. previous holds the last record of the block
+inline void compressRecord(const double* record, double* previous, const int n, std::string& out) {
+	for (int i = 0; i < n; i++) {
+		uint64_t current_bits, previous_bits;
+		memcpy(&current_bits, &record[i], sizeof(uint64_t));
+		memcpy(&previous_bits, &previous[i], sizeof(uint64_t));
+		const uint64_t delta = current_bits ^ previous_bits;
+		previous[i] = record[i];
+
+		char bytes[9];
+		unsigned char mask = 0;
+		int n_bytes = 1;
+		for (int b = 0; b < 8; b++) {
+			const char byte = static_cast<char>((delta >> (8*b)) & 0xff);
+			if (byte != 0) {
+				mask |= (1 << b);
+				bytes[n_bytes++] = byte;
+			}
+		}
+		bytes[0] = static_cast<char>(mask);
+		out.append(bytes, n_bytes);
+	}
+}
+
+// read back a record written by compressRecord. returns false if the data is truncated
+inline bool decompressRecord(const char*& in, const char* end, double* previous, const int n) {
+	for (int i = 0; i < n; i++) {
+		if (in >= end) {
+			return false;
+		}
+		const unsigned char mask = static_cast<unsigned char>(*in++);
+		uint64_t delta = 0;
+		for (int b = 0; b < 8; b++) {
+			if (mask & (1 << b)) {
+				if (in >= end) {
+					return false;
+				}
+				delta |= static_cast<uint64_t>(static_cast<unsigned char>(*in++)) << (8*b);
+			}
+		}
+		uint64_t previous_bits;
+		memcpy(&previous_bits, &previous[i], sizeof(uint64_t));
+		previous_bits ^= delta;
+		memcpy(&previous[i], &previous_bits, sizeof(uint64_t));
+	}
+	return true;
+}
+
+// log file segment preallocated on disk and mapped in memory. appending is a memcpy,
+// the kernel writes the pages back in the background.
+class MappedLogFile {
+public:
+	MappedLogFile() : _fd(-1), _data(NULL), _size(0), _used(0) {}
+	~MappedLogFile() { close(); }
+
+	bool open(const std::string& fname, const size_t size) {
+		close();
+		_fd = ::open(fname.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (_fd < 0) {
+			return false;
+		}
+		// reserve the blocks now so the file does not grow during the experiment. a write to a
+		// page of the mapping without a block raises SIGBUS, so the file is never left sparse :
+		// without fallocate support the zeros are written, and a full disk fails here
+		const int error = posix_fallocate(_fd, 0, size);
+		if (error != 0 && ((error != EOPNOTSUPP && error != EINVAL) || !writeZeros(size))) {
+			::close(_fd);
+			_fd = -1;
+			::unlink(fname.c_str());
+			return false;
+		}
+		void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+		if (data == MAP_FAILED) {
+			::close(_fd);
+			_fd = -1;
+			::unlink(fname.c_str());
+			return false;
+		}
+		madvise(data, size, MADV_SEQUENTIAL);
+		_data = static_cast<char*>(data);
+		_size = size;
+		_used = 0;
+		return true;
+	}
+
+	bool isOpen() const { return _data != NULL; }
+
+	bool fits(const size_t n) const { return _data != NULL && _used + n <= _size; }
+
+	// bytes written since open
+	size_t used() const { return _used; }
+
+	void append(const char* data, const size_t n) {
+		memcpy(_data + _used, data, n);
+		_used += n;
+	}
+
+	// unmap and cut the file to what was written
+	void close() {
+		if (_data != NULL) {
+			munmap(_data, _size);
+			_data = NULL;
+		}
+		if (_fd >= 0) {
+			if (ftruncate(_fd, _used) != 0) {}
+			::close(_fd);
+			_fd = -1;
+		}
+	}
+
+private:
+	bool writeZeros(const size_t size) {
+		const std::vector<char> zeros(1 << 20, 0);
+		for (size_t offset = 0; offset < size; ) {
+			const ssize_t written = pwrite(_fd, zeros.data(), std::min(zeros.size(), size - offset), offset);
+			if (written < 0 && errno == EINTR) {
+				continue;
+			}
+			if (written <= 0) {
+				return false;
+			}
+			offset += written;
+		}
+		return true;
+	}
+
+	int _fd;
+	char* _data;
+	size_t _size;
+	size_t _used;
+};
+
+// a logged variable. the copy function is instantiated for the type of the variable,
+// so fixed size vectors (Vector3d, Matrix<double,7,1>, ...) are copied with a size known
+// at compile time. channels are stored by value, contiguously, in the logger.
+struct LogChannel {
+	const void* data;
+	int rows;
+	int cols;
+	// copy the current value, column major, to a buffer of rows*cols doubles.
+	// returns false if the size of the variable changed
+	bool (*copy)(const void* data, double* out, const int rows, const int cols);
+	// current size of the variable
+	void (*size)(const void* data, int& rows, int& cols);
+};
+
+template <typename Derived>
+struct LogChannelOps {
+	typedef Eigen::Matrix<double, Derived::RowsAtCompileTime, Derived::ColsAtCompileTime> Sample;
+
+	static bool copy(const void* data, double* out, const int rows, const int cols) {
+		const Derived& var = *static_cast<const Derived*>(data);
+		if (Derived::SizeAtCompileTime == Eigen::Dynamic && (var.rows() != rows || var.cols() != cols)) {
+			return false;
+		}
+		Eigen::Map<Sample>(out, rows, cols) = var.template cast<double>();
+		return true;
+	}
+
+	static void size(const void* data, int& rows, int& cols) {
+		const Derived& var = *static_cast<const Derived*>(data);
+		rows = var.rows();
+		cols = var.cols();
+	}
+};
+
+class LoggingService;
+
+// Logger class
+class Logger {
+public:
+	// what statistics() returns: samples taken, samples dropped (ring full or variable resized),
+	// samples written, ring capacity, ring high water mark (samples), max write latency (us)
+	typedef Eigen::Matrix<double, 6, 1> Statistics;
+
+	// ctor
+	Logger(long interval, std::string fname, const double realtime_scaling_factor = 1.0)
+	: _f_is_logging(false), _log_interval_(interval), _f_capture(false), _f_binary(false), _decimation(1),
+	  _segment_size(0), _segment_index(0), _n_segment_drops(0), _f_triggered(false), _compression_block_records(0), _index_records(0), _stream_socket(-1), _fname(fname),
+	  _record_size(0), _ring_capacity(0), _ring_head(0), _ring_tail(0),
+	  _trigger_timestamp(0), _trigger_count(0),
+	  _n_taken(0), _n_dropped(0), _n_written(0), _ring_high_water(0), _max_write_latency_ns(0),
+	  _service(NULL)
+	{
+		// create log file
+		_logfile.open(fname, std::ios::out | std::ios::binary);
+		_realtime_scaling_factor = realtime_scaling_factor;
+	}
+
+	// add Eigen vector type variable to watch
+	template <typename Derived>
+	bool addVectorToLog (Eigen::MatrixBase <Derived>* var, const std::string& var_name = "") {
+		if (_f_is_logging) {
+			return false;
+		}
+		LogChannel channel;
+		channel.data = &var->derived();
+		channel.rows = 0;
+		channel.cols = 0;
+		channel.copy = &LogChannelOps<Derived>::copy;
+		channel.size = &LogChannelOps<Derived>::size;
+		_vars_to_log.push_back(channel);
+		// for (uint i = 0; i < var->size(); i++) {
+		// 	if (!var_name.empty()) {
+		// 		_logfile << var_name << "_" << i << ", ";
+		// 	} else {
+		// 		_logfile << "var" << _vars_to_log.size() << "_" << i << ", ";
+		// 	}
+		// }
+		_var_names.push_back(var_name);
+		return true;
+	}
+
+	// write packed doubles after a self describing header instead of text (see BINARY_LOG_MAGIC).
+	// convert to csv with the binary_log_to_csv tool.
+	bool enableBinaryFormat() {
+		if (_f_is_logging) {
+			return false;
+		}
+		_f_binary = true;
+		return true;
+	}
+
+	// binary format with delta encoding and byte compression done by the logging thread,
+	// in independent blocks of block_records samples (see BINARY_LOG_VERSION_COMPRESSED).
+	bool enableCompression(const unsigned int block_records = 256) {
+		if (_f_is_logging || block_records == 0) {
+			return false;
+		}
+		_f_binary = true;
+		_compression_block_records = block_records;
+		return true;
+	}
+
+	// binary format with a time index written next to the log (see BINARY_LOG_INDEX_MAGIC) : an
+	// entry per compressed block, or every index_records samples of a plain binary log. the
+	// logging thread writes it, the control thread does not see any difference.
+	bool enableTimeIndex(const unsigned int index_records = 256) {
+		if (_f_is_logging || index_records == 0) {
+			return false;
+		}
+		_f_binary = true;
+		_index_records = index_records;
+		return true;
+	}
+
+	// also send a decimated stream of some variables (all of them if channels is empty) as udp
+	// datagrams: each one holds the binary header of these variables followed by one record, so
+	// a receiver needs no state. sent by the logging thread, never by the control thread.
+	// the variables must be added before.
+	bool enableLiveStream(const std::string& host, const int port, const unsigned int decimation,
+			const std::vector<std::string>& channels = std::vector<std::string>()) {
+		if (_f_is_logging || decimation == 0) {
+			return false;
+		}
+		std::vector<int> stream_vars;
+		for (unsigned int i = 0; i < _var_names.size(); i++) {
+			if (channels.empty() || std::find(channels.begin(), channels.end(), _var_names[i]) != channels.end()) {
+				stream_vars.push_back(i);
+			}
+		}
+		if (stream_vars.empty() || (!channels.empty() && stream_vars.size() != channels.size())) {
+			return false;
+		}
+		memset(&_stream_address, 0, sizeof(_stream_address));
+		_stream_address.sin_family = AF_INET;
+		_stream_address.sin_port = htons(port);
+		if (inet_pton(AF_INET, host.c_str(), &_stream_address.sin_addr) != 1) {
+			return false;
+		}
+		if (_stream_socket < 0) {
+			_stream_socket = socket(AF_INET, SOCK_DGRAM, 0);
+			if (_stream_socket < 0) {
+				return false;
+			}
+		}
+		_stream_vars = stream_vars;
+		_stream_decimation = decimation;
+		return true;
+	}
+
+	// switch to capture mode: instead of the logging thread reading the variables
+	// while they are written, the control thread calls capture() after updating them
+	// and a consistent snapshot of all of them is pushed to a preallocated ring.
+	// ring_capacity is the number of samples the logging thread can lag behind.
+	bool enableCapture(const unsigned int ring_capacity = 1024) {
+		if (_f_is_logging || ring_capacity == 0) {
+			return false;
+		}
+		_f_capture = true;
+		_ring_capacity = ring_capacity + 1;
+		return true;
+	}
+
+	// write to preallocated memory mapped segments of segment_bytes instead of a stream.
+	// when a segment is full the logger continues in a new one, named like the log file with
+	// _1, _2, ... before the extension. each segment starts with the header and can be read alone.
+	// segment_bytes should hold the header and a record of the variables added so far, start()
+	// checks it again with all of them.
+	bool enableMappedFile(const size_t segment_bytes = 64*1024*1024) {
+		if (_f_is_logging || segment_bytes < minSegmentBytes()) {
+			return false;
+		}
+		_segment_size = segment_bytes;
+		return true;
+	}
+
+	// capture mode only. the control loop captures at full rate, but outside of trigger windows
+	// only one sample every decimation_outside_window is written. the last history_capacity
+	// samples are kept in memory so that on trigger() the pre_trigger_ms before it are written
+	// too, then everything is written for post_trigger_ms. windows are in logged time. the
+	// samples are written pre_trigger_ms late, history_capacity should hold that many.
+	bool enableTriggeredCapture(const double pre_trigger_ms, const double post_trigger_ms,
+			const unsigned int decimation_outside_window, const unsigned int history_capacity = 4096) {
+		if (_f_is_logging || decimation_outside_window == 0 || history_capacity == 0) {
+			return false;
+		}
+		_f_triggered = true;
+		_pre_trigger_us = pre_trigger_ms * 1e3;
+		_post_trigger_us = post_trigger_ms * 1e3;
+		_decimation_outside_window = decimation_outside_window;
+		_history_capacity = history_capacity;
+		return true;
+	}
+
+	// mark an event at the time of the last captured sample (e.g. a contact transition).
+	// called from the control thread
+	void trigger() {
+		_trigger_timestamp.store(_last_pushed_timestamp, std::memory_order_relaxed);
+		_trigger_count.fetch_add(1, std::memory_order_release);
+	}
+
+	// capture mode only: the samples are written by the thread of a LoggingService shared
+	// with other loggers instead of a thread of this logger
+	bool useService(LoggingService& service) {
+		if (_f_is_logging || !_f_capture) {
+			return false;
+		}
+		_service = &service;
+		return true;
+	}
+
+	// number of control ticks between two samples taken by tick()
+	bool setDecimation(const unsigned int decimation) {
+		if (_f_is_logging || decimation == 0) {
+			return false;
+		}
+		_decimation = decimation;
+		return true;
+	}
+
+	// start logging
+	bool start() {
+		// save start time
+		_t_start = system_clock::now();
+		_last_capture_time = _t_start - microseconds(_log_interval_);
+
+		computeLayout();
+		if (_segment_size > 0 && _segment_size < minSegmentBytes()) {
+			std::cout << "log segments of " << _segment_size << " bytes smaller than a header and a record in Logger::start()" << std::endl;
+			return false;
+		}
+		_record_scratch.assign(_record_size, 0.0);
+		_block_buffer.clear();
+		_block_previous.assign(_record_size, 0.0);
+		_block_records = 0;
+		if (_stream_socket >= 0) {
+			std::stringstream header;
+			writeBinaryHeader(header, _stream_vars, BINARY_LOG_VERSION);
+			_stream_header = header.str();
+			_n_stream_records = 0;
+		}
+		_n_taken = 0;
+		_n_dropped = 0;
+		_n_written = 0;
+		_ring_high_water = 0;
+		_max_write_latency_ns = 0;
+		_latency_histogram.assign(LATENCY_N_BINS, 0);
+		if (_f_capture) {
+			_ring.assign(_ring_capacity * _record_size, 0.0);
+			_ring_head = 0;
+			_ring_tail = 0;
+		}
+		if (_f_triggered) {
+			_history.assign(_history_capacity * _record_size, 0.0);
+			_history_start = 0;
+			_history_size = 0;
+			_n_outside_window = 0;
+			_window_start = 0.0;
+			_window_end = -1.0;
+			_handled_trigger_count = _trigger_count.load();
+			_last_pushed_timestamp = 0;
+		}
+
+		if (_segment_size > 0) {
+			// header kept for the next segments
+			_logfile.close();
+			_format_buffer.str("");
+			writeHeader(_format_buffer);
+			_header_bytes = _format_buffer.str();
+			_segment_index = 0;
+			_n_segment_drops = 0;
+			if (!openSegment()) {
+				std::cout << "could not open the log segment " << segmentName(_segment_index) << " in Logger::start()" << std::endl;
+				return false;
+			}
+		} else {
+			writeHeader(_logfile);
+			_file_bytes = _logfile.tellp();
+		}
+
+		_f_index_pending = false;
+		if (_index_records > 0) {
+			openIndex();
+		}
+
+		// set logging to true
+		_f_is_logging = true;
+
+		if (_service) {
+			registerWithService();
+		} else {
+			// start logging thread by move assignment
+			_log_thread = std::thread{&Logger::logWorker, this};
+		}
+
+		return true;
+	}
+
+	// capture mode only, called from the control thread after the logged variables are updated.
+	// copies them to the ring if the log interval elapsed, without locks or system calls.
+	// returns true if a sample was taken.
+	bool capture() {
+		if (!_f_capture || !_f_is_logging) {
+			return false;
+		}
+		system_clock::time_point curr_time = system_clock::now();
+		if (curr_time - _last_capture_time < microseconds(_log_interval_)) {
+			return false;
+		}
+		microseconds t_elapsed = std::chrono::duration_cast<microseconds>(curr_time - _t_start);
+		if (!pushRecord(t_elapsed.count() * _realtime_scaling_factor)) {
+			return false;
+		}
+		_last_capture_time = curr_time;
+		return true;
+	}
+
+	// capture mode only, tick synchronous alternative to capture(): called on every control
+	// cycle with the loop counter and the loop time (in seconds), takes a sample every
+	// setDecimation() ticks, stamped with the loop time in microseconds. on the other ticks
+	// it only does a modulo. loggers ticked with the same counter stay aligned row for row.
+	bool tick(const unsigned long long counter, const double loop_time) {
+		if (counter % _decimation != 0 || !_f_capture || !_f_is_logging) {
+			return false;
+		}
+		return pushRecord(loop_time * 1e6 * _realtime_scaling_factor);
+	}
+
+	void stop() {
+		// not started, or start() failed
+		if (!_f_is_logging) {
+			return;
+		}
+		// set logging false
+		_f_is_logging = false;
+
+		// join thread, or leave the service and write what it did not
+		if (_service) {
+			unregisterFromService();
+			drainRing();
+		} else {
+			_log_thread.join();
+		}
+		if (_f_triggered) {
+			releaseRecordsBefore(std::numeric_limits<double>::infinity());
+		}
+
+		// last partial block
+		if (_compression_block_records > 0) {
+			flushBlock();
+		}
+		if (_index_file.is_open()) {
+			_index_file.close();
+		}
+
+		if (_stream_socket >= 0) {
+			::close(_stream_socket);
+			_stream_socket = -1;
+		}
+
+		printSummary();
+
+		// close file
+		if (_segment_size > 0) {
+			_mapped_file.close();
+		} else {
+			_logfile.close();
+		}
+	}
+
+	// counters of the logger, can be called from any thread. to log them, call it
+	// on a Statistics variable added to a logger before capturing
+	void statistics(Statistics& stats) const {
+		stats << _n_taken.load(std::memory_order_relaxed),
+				_n_dropped.load(std::memory_order_relaxed),
+				_n_written.load(std::memory_order_relaxed),
+				_f_capture ? _ring_capacity - 1 : 0,
+				_ring_high_water.load(std::memory_order_relaxed),
+				_max_write_latency_ns.load(std::memory_order_relaxed) * 1e-3;
+	}
+
+	// write latency in us below which a fraction p of the writes were done (logging thread
+	// histogram, read it after stop())
+	double writeLatencyPercentile(const double p) const {
+		unsigned long long n_total = 0;
+		for (const unsigned long long n: _latency_histogram) {
+			n_total += n;
+		}
+		if (n_total == 0) {
+			return 0.0;
+		}
+		unsigned long long n_below = 0;
+		for (int i = 0; i < LATENCY_N_BINS - 1; i++) {
+			n_below += _latency_histogram[i];
+			if (n_below >= p * n_total) {
+				return (i + 1) * LATENCY_BIN_NS * 1e-3;
+			}
+		}
+		return _max_write_latency_ns.load() * 1e-3;
+	}
+
+	// variables registered with the logger
+	std::vector<LogChannel> _vars_to_log;
+
+	// state
+	std::atomic<bool> _f_is_logging;
+
+	// start time
+	system_clock::time_point _t_start;
+
+	// log interval in microseconds
+	long _log_interval_;
+
+	// log file
+	std::fstream _logfile;
+
+	// thread
+	std::thread _log_thread;
+
+	// realtime scaling factor
+	double _realtime_scaling_factor;
+
+	// capture mode
+	bool _f_capture;
+
+	// binary format
+	bool _f_binary;
+
+	// ticks between two samples in tick()
+	unsigned int _decimation;
+
+	// memory mapped segments, 0 when writing to _logfile
+	size_t _segment_size;
+	unsigned int _segment_index;
+	// writes of the logging thread that no segment could hold
+	unsigned long long _n_segment_drops;
+
+	// triggered capture
+	bool _f_triggered;
+
+	// samples per compressed block, 0 when not compressing
+	unsigned int _compression_block_records;
+
+	// samples per entry of the time index of a plain binary log, 0 when not indexing
+	unsigned int _index_records;
+
+	// live stream, -1 when not streaming
+	int _stream_socket;
+
+private:
+	// base name of the log file
+	std::string _fname;
+
+	// current mapped segment and what starts each segment
+	MappedLogFile _mapped_file;
+	std::string _header_bytes;
+	std::stringstream _format_buffer;
+
+	// names of the variables for the header
+	std::vector<std::string> _var_names;
+
+	// layout of a sample in the ring
+	int _record_size;
+	std::vector<int> _var_offsets;
+	std::vector<int> _var_rows;
+	std::vector<int> _var_cols;
+
+	// ring of captured samples. _ring_head is written by the control thread, _ring_tail by the logging thread
+	std::vector<double> _ring;
+	unsigned int _ring_capacity;
+	std::atomic<unsigned int> _ring_head;
+	std::atomic<unsigned int> _ring_tail;
+	system_clock::time_point _last_capture_time;
+
+	// sample of the polling mode
+	std::vector<double> _record_scratch;
+
+	// triggered capture. the trigger is set by the control thread, the rest belongs to the logging thread
+	double _pre_trigger_us;
+	double _post_trigger_us;
+	unsigned int _decimation_outside_window;
+	unsigned int _history_capacity;
+	double _last_pushed_timestamp;
+	std::atomic<double> _trigger_timestamp;
+	std::atomic<unsigned long> _trigger_count;
+	unsigned long _handled_trigger_count;
+	std::vector<double> _history;
+	unsigned int _history_start;
+	unsigned int _history_size;
+	unsigned int _n_outside_window;
+	double _window_start;
+	double _window_end;
+
+	// statistics. _n_taken and _n_dropped are written by the control thread in capture mode,
+	// the rest by the logging thread
+	std::atomic<unsigned long long> _n_taken;
+	std::atomic<unsigned long long> _n_dropped;
+	std::atomic<unsigned long long> _n_written;
+	std::atomic<unsigned int> _ring_high_water;
+	std::atomic<unsigned long long> _max_write_latency_ns;
+	std::vector<unsigned long long> _latency_histogram;
+
+	// shared logging thread, NULL when the logger has its own
+	LoggingService* _service;
+	friend class LoggingService;
+	void registerWithService ();
+	void unregisterFromService ();
+	void wakeService (const unsigned int head);
+
+	// samples waiting in the ring
+	unsigned int backlog (const unsigned int head) const {
+		return (head + _ring_capacity - _ring_tail.load(std::memory_order_acquire)) % _ring_capacity;
+	}
+
+	void printSummary () {
+		Statistics stats;
+		statistics(stats);
+		std::cout << "logger " << _fname << " : " << stats(0) << " samples taken, " << stats(1) << " dropped, "
+				<< stats(2) << " written" << std::endl;
+		if (_n_segment_drops > 0) {
+			std::cout << "  " << _n_segment_drops << " writes dropped, no segment could hold them" << std::endl;
+		}
+		if (_f_capture) {
+			std::cout << "  ring high water " << stats(4) << " / " << stats(3) << " samples" << std::endl;
+		}
+		std::cout << "  write latency (us) p50 " << writeLatencyPercentile(0.5) << ", p99 " << writeLatencyPercentile(0.99)
+				<< ", p99.9 " << writeLatencyPercentile(0.999) << ", max " << stats(5) << std::endl;
+	}
+
+	// triggered capture: write the oldest sample of the history if it is in the trigger
+	// window or one in _decimation_outside_window, and drop it
+	void releaseOldestRecord () {
+		const double* oldest = &_history[_history_start * _record_size];
+		if (oldest[0] >= _window_start && oldest[0] <= _window_end) {
+			writeRecord(oldest);
+		} else if (_n_outside_window++ % _decimation_outside_window == 0) {
+			writeRecord(oldest);
+		}
+		_history_start = (_history_start + 1) % _history_capacity;
+		_history_size--;
+	}
+
+	void releaseRecordsBefore (const double timestamp) {
+		while (_history_size > 0 && _history[_history_start * _record_size] < timestamp) {
+			releaseOldestRecord();
+		}
+	}
+
+	// triggered capture: the samples wait in the history for the pre-trigger span before
+	// they are written or not, so that a trigger still finds the ones of its window there
+	// and they come out at full rate and in order
+	void processTriggeredRecord (const double* record) {
+		const unsigned long trigger_count = _trigger_count.load(std::memory_order_acquire);
+		if (trigger_count != _handled_trigger_count) {
+			_handled_trigger_count = trigger_count;
+			const double trigger_timestamp = _trigger_timestamp.load(std::memory_order_relaxed);
+			// the samples before the new window are decided with the previous one
+			releaseRecordsBefore(trigger_timestamp - _pre_trigger_us);
+			_window_start = trigger_timestamp - _pre_trigger_us;
+			_window_end = trigger_timestamp + _post_trigger_us;
+		}
+
+		if (_history_size == _history_capacity) {
+			// history shorter than the pre-trigger span, the oldest sample is decided early
+			releaseOldestRecord();
+		}
+		const unsigned int slot = (_history_start + _history_size) % _history_capacity;
+		std::copy(record, record + _record_size, &_history[slot * _record_size]);
+		_history_size++;
+		releaseRecordsBefore(record[0] - _pre_trigger_us);
+	}
+
+	// copy all the variables after the timestamp of a sample. a variable resized after
+	// start() would not fit its column anymore, the sample is not taken then
+	bool copyChannels (double* record) {
+		for (unsigned int i = 0; i < _vars_to_log.size(); i++) {
+			const LogChannel& channel = _vars_to_log[i];
+			if (!channel.copy(channel.data, record + _var_offsets[i], channel.rows, channel.cols)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// copy the variables to the next free sample of the ring. returns false if the ring is full
+	bool pushRecord (const double timestamp) {
+		const unsigned int head = _ring_head.load(std::memory_order_relaxed);
+		const unsigned int next = (head + 1) % _ring_capacity;
+		if (next == _ring_tail.load(std::memory_order_acquire)) {
+			// logging thread is behind, drop the sample
+			_n_dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		double* record = &_ring[head * _record_size];
+		record[0] = timestamp;
+		_last_pushed_timestamp = timestamp;
+		if (!copyChannels(record)) {
+			_n_dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		_ring_head.store(next, std::memory_order_release);
+		_n_taken.fetch_add(1, std::memory_order_relaxed);
+		if (_service) {
+			wakeService(next);
+		}
+		return true;
+	}
+
+	// binary header describing some of the variables
+	void writeBinaryHeader (std::ostream& out, const std::vector<int>& vars, const uint32_t version) {
+		const uint32_t n_vars = vars.size();
+		out.write(BINARY_LOG_MAGIC, sizeof(BINARY_LOG_MAGIC));
+		out.write(reinterpret_cast<const char*>(&version), sizeof(uint32_t));
+		out.write(reinterpret_cast<const char*>(&n_vars), sizeof(uint32_t));
+		for (const int i: vars) {
+			const uint32_t name_length = _var_names[i].size();
+			const uint32_t rows = _var_rows[i];
+			const uint32_t cols = _var_cols[i];
+			out.write(reinterpret_cast<const char*>(&name_length), sizeof(uint32_t));
+			out.write(_var_names[i].data(), name_length);
+			out.write(reinterpret_cast<const char*>(&rows), sizeof(uint32_t));
+			out.write(reinterpret_cast<const char*>(&cols), sizeof(uint32_t));
+		}
+	}
+
+	void writeHeader (std::ostream& out) {
+		if (_f_binary) {
+			std::vector<int> vars;
+			for (unsigned int i = 0; i < _vars_to_log.size(); i++) {
+				vars.push_back(i);
+			}
+			writeBinaryHeader(out, vars, _compression_block_records > 0 ? BINARY_LOG_VERSION_COMPRESSED : BINARY_LOG_VERSION);
+			return;
+		}
+		out << "timestamp, ";
+		for (unsigned int i = 0; i < _vars_to_log.size(); i++) {
+			if (_var_names[i].empty()) {
+				out << "var[" << i + 1 << "], ";
+			} else {
+				out << _var_names[i] << "[" << _var_rows[i] * _var_cols[i] << "], ";
+			}
+		}
+		out << "\n";
+	}
+
+	void formatRecord (std::ostream& out, const double* record) {
+		out << record[0];
+		for (unsigned int i = 0; i < _vars_to_log.size(); i++) {
+			out << ", ";
+			out << Eigen::Map<const Eigen::MatrixXd>(record + _var_offsets[i], _var_rows[i], _var_cols[i]).transpose().format(logVecFmt);
+		}
+		out << "\n";
+	}
+
+	// raw bytes to the file or the current segment
+	void writeBytes (const char* data, const size_t n) {
+		if (_segment_size == 0) {
+			writeIndexEntry(0, _file_bytes);
+			_logfile.write(data, n);
+			_file_bytes += n;
+		} else {
+			appendToSegment(data, n);
+		}
+	}
+
+	// time index, written by the logging thread. an entry is pending for the next bytes
+	// written, which start with the record of timestamp _index_timestamp
+	std::ofstream _index_file;
+	bool _f_index_pending;
+	double _index_timestamp;
+	unsigned long long _n_indexed_records;
+	// bytes in the log file when not writing segments
+	uint64_t _file_bytes;
+
+	void openIndex () {
+		_index_file.open(_fname + ".idx", std::ios::out | std::ios::binary | std::ios::trunc);
+		const uint32_t reserved = 0;
+		_index_file.write(BINARY_LOG_INDEX_MAGIC, sizeof(BINARY_LOG_INDEX_MAGIC));
+		_index_file.write(reinterpret_cast<const char*>(&BINARY_LOG_INDEX_VERSION), sizeof(uint32_t));
+		_index_file.write(reinterpret_cast<const char*>(&reserved), sizeof(uint32_t));
+		_index_timestamp = 0;
+		_n_indexed_records = 0;
+	}
+
+	void writeIndexEntry (const uint32_t segment, const uint64_t offset) {
+		if (!_f_index_pending) {
+			return;
+		}
+		BinaryLogIndexEntry entry;
+		entry.timestamp = _index_timestamp;
+		entry.segment = segment;
+		entry.reserved = 0;
+		entry.offset = offset;
+		_index_file.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+		_f_index_pending = false;
+	}
+
+	// live stream state, used by the logging thread
+	sockaddr_in _stream_address;
+	std::vector<int> _stream_vars;
+	unsigned int _stream_decimation;
+	unsigned long long _n_stream_records;
+	std::string _stream_header;
+	std::string _stream_packet;
+
+	void streamRecord (const double* record) {
+		if (_stream_socket < 0 || _n_stream_records++ % _stream_decimation != 0) {
+			return;
+		}
+		_stream_packet.assign(_stream_header);
+		_stream_packet.append(reinterpret_cast<const char*>(record), sizeof(double));
+		for (const int i: _stream_vars) {
+			_stream_packet.append(reinterpret_cast<const char*>(record + _var_offsets[i]), _var_rows[i] * _var_cols[i] * sizeof(double));
+		}
+		// nobody listening or a full socket buffer are not errors, the datagram is lost
+		sendto(_stream_socket, _stream_packet.data(), _stream_packet.size(), MSG_DONTWAIT,
+			reinterpret_cast<const sockaddr*>(&_stream_address), sizeof(_stream_address));
+	}
+
+	// compressed block being filled by the logging thread
+	std::string _block_buffer;
+	std::vector<double> _block_previous;
+	uint32_t _block_records;
+	double _block_first_timestamp;
+
+	void flushBlock () {
+		if (_block_records > 0) {
+			_f_index_pending = (_index_records > 0);
+			_index_timestamp = _block_first_timestamp;
+			const uint32_t n_bytes = _block_buffer.size();
+			std::string block(2*sizeof(uint32_t), '\0');
+			memcpy(&block[0], &_block_records, sizeof(uint32_t));
+			memcpy(&block[sizeof(uint32_t)], &n_bytes, sizeof(uint32_t));
+			block += _block_buffer;
+			writeBytes(block.data(), block.size());
+		}
+		_block_buffer.clear();
+		_block_previous.assign(_record_size, 0.0);
+		_block_records = 0;
+	}
+
+	// write one sample and account for the time it took
+	void writeRecord (const double* record) {
+		const std::chrono::steady_clock::time_point t_write = std::chrono::steady_clock::now();
+		writeRecordData(record);
+		const unsigned long long latency_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - t_write).count();
+		_latency_histogram[std::min<unsigned long long>(latency_ns / LATENCY_BIN_NS, LATENCY_N_BINS - 1)]++;
+		if (latency_ns > _max_write_latency_ns.load(std::memory_order_relaxed)) {
+			_max_write_latency_ns.store(latency_ns, std::memory_order_relaxed);
+		}
+		_n_written.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// timestamp then the variables
+	void writeRecordData (const double* record) {
+		if (_compression_block_records > 0) {
+			if (_block_records == 0) {
+				_block_first_timestamp = record[0];
+			}
+			compressRecord(record, _block_previous.data(), _record_size, _block_buffer);
+			_block_records++;
+			if (_block_records == _compression_block_records) {
+				flushBlock();
+			}
+			return;
+		}
+		if (_f_binary && _index_records > 0) {
+			_f_index_pending = (_n_indexed_records++ % _index_records == 0);
+			_index_timestamp = record[0];
+		}
+		if (_segment_size == 0) {
+			if (_f_binary) {
+				writeBytes(reinterpret_cast<const char*>(record), _record_size * sizeof(double));
+			} else {
+				formatRecord(_logfile, record);
+			}
+			return;
+		}
+		if (_f_binary) {
+			appendToSegment(reinterpret_cast<const char*>(record), _record_size * sizeof(double));
+		} else {
+			_format_buffer.str("");
+			formatRecord(_format_buffer, record);
+			const std::string text = _format_buffer.str();
+			appendToSegment(text.data(), text.size());
+		}
+	}
+
+	std::string segmentName (const unsigned int index) {
+		if (index == 0) {
+			return _fname;
+		}
+		const size_t extension = _fname.find_last_of('.');
+		const size_t folder = _fname.find_last_of('/');
+		if (extension == std::string::npos || (folder != std::string::npos && extension < folder)) {
+			return _fname + "_" + std::to_string(index);
+		}
+		return _fname.substr(0, extension) + "_" + std::to_string(index) + _fname.substr(extension);
+	}
+
+	// layout of the captured samples: timestamp then each variable
+	void computeLayout () {
+		_record_size = 1;
+		_var_offsets.clear();
+		_var_rows.clear();
+		_var_cols.clear();
+		for (auto& channel: _vars_to_log) {
+			channel.size(channel.data, channel.rows, channel.cols);
+			_var_offsets.push_back(_record_size);
+			_var_rows.push_back(channel.rows);
+			_var_cols.push_back(channel.cols);
+			_record_size += channel.rows * channel.cols;
+		}
+	}
+
+	// header and one binary record of the current variables
+	size_t minSegmentBytes () {
+		computeLayout();
+		std::stringstream header;
+		writeHeader(header);
+		return static_cast<size_t>(header.tellp()) + _record_size * sizeof(double);
+	}
+
+	bool openSegment () {
+		if (!_mapped_file.open(segmentName(_segment_index), _segment_size)) {
+			return false;
+		}
+		if (_mapped_file.fits(_header_bytes.size())) {
+			_mapped_file.append(_header_bytes.data(), _header_bytes.size());
+		}
+		return true;
+	}
+
+	// a write that does not fit in the current segment goes to a new one. it is dropped, and
+	// counted, if it does not fit in an empty segment or if the segment could not be opened,
+	// which stops the logging to segments, so that a full disk does not get a file per record
+	void appendToSegment (const char* data, const size_t n) {
+		if (!_mapped_file.isOpen() || _header_bytes.size() + n > _segment_size) {
+			_n_segment_drops++;
+			return;
+		}
+		if (!_mapped_file.fits(n)) {
+			_mapped_file.close();
+			_segment_index++;
+			if (!openSegment()) {
+				std::cout << "could not open the log segment " << segmentName(_segment_index) << ", the next samples are dropped" << std::endl;
+				_n_segment_drops++;
+				return;
+			}
+			// every segment starts with an entry, the records of a plain log included
+			_f_index_pending = (_index_records > 0 && _f_binary);
+		}
+		writeIndexEntry(_segment_index, _mapped_file.used());
+		_mapped_file.append(data, n);
+	}
+
+	// write the captured samples waiting in the ring
+	void drainRing () {
+		unsigned int tail = _ring_tail.load(std::memory_order_relaxed);
+		const unsigned int head = _ring_head.load(std::memory_order_acquire);
+		const unsigned int backlog = (head + _ring_capacity - tail) % _ring_capacity;
+		if (backlog > _ring_high_water.load(std::memory_order_relaxed)) {
+			_ring_high_water.store(backlog, std::memory_order_relaxed);
+		}
+		while (tail != head) {
+			streamRecord(&_ring[tail * _record_size]);
+			if (_f_triggered) {
+				processTriggeredRecord(&_ring[tail * _record_size]);
+			} else {
+				writeRecord(&_ring[tail * _record_size]);
+			}
+			tail = (tail + 1) % _ring_capacity;
+		}
+		_ring_tail.store(tail, std::memory_order_release);
+	}
+
+	// thread function for logging. Note that we are not using mutexes here, no there might be weirdness
+	void logWorker () {
+		if (_f_capture) {
+			while (_f_is_logging) {
+				usleep(_log_interval_/2);
+				drainRing();
+			}
+			drainRing();
+			return;
+		}
+		system_clock::time_point curr_time;
+		system_clock::time_point last_time = system_clock::now();
+		while (_f_is_logging) {
+			usleep(_log_interval_/2);
+			curr_time = system_clock::now();
+			auto time_diff = std::chrono::duration_cast<microseconds>(curr_time - last_time);
+			if (_log_interval_ > 0 && time_diff >= microseconds(static_cast<uint>(_log_interval_))) {
+				microseconds t_elapsed = std::chrono::duration_cast<microseconds>(curr_time - _t_start);
+				_record_scratch[0] = t_elapsed.count() * _realtime_scaling_factor;
+				if (copyChannels(_record_scratch.data())) {
+					_n_taken.fetch_add(1, std::memory_order_relaxed);
+					streamRecord(_record_scratch.data());
+					writeRecord(_record_scratch.data());
+				} else {
+					_n_dropped.fetch_add(1, std::memory_order_relaxed);
+				}
+				last_time = curr_time;
+			}
+		}
+	}
+
+	// hide default constructor
+	Logger () {
+
+	}
+};
+
+// One logging thread for several loggers in capture mode. it sleeps until the control thread
+// of one of them pushed wake_batch samples, then writes the rings of all of them. the
+// control threads only do an eventfd write when the service went to sleep, never lock.
+//
+//   Logging::LoggingService log_service;
+//   log_service.start(0);   // pinned to cpu 0, away from the control threads
+//   logger->enableCapture();
+//   logger->useService(log_service);
+//   logger->start();
+//   ...
+//   logger->stop();
+//   log_service.stop();
+class LoggingService {
+public:
+	// ctor
+	LoggingService(const unsigned int wake_batch = 1)
+	: _wake_batch(wake_batch > 0 ? wake_batch : 1), _f_running(false), _f_sleeping(false)
+	{
+		_event_fd = eventfd(0, 0);
+		if (_event_fd < 0) {
+			throw std::runtime_error("could not create the eventfd in LoggingService::LoggingService()\n");
+		}
+	}
+
+	~LoggingService() {
+		stop();
+		::close(_event_fd);
+	}
+
+	// start the thread, pinned to the given cpu if it is not negative
+	bool start(const int cpu = -1) {
+		if (_f_running) {
+			return false;
+		}
+		_f_running = true;
+		_thread = std::thread{&LoggingService::serviceWorker, this};
+		if (cpu >= 0) {
+			cpu_set_t cpu_set;
+			CPU_ZERO(&cpu_set);
+			CPU_SET(cpu, &cpu_set);
+			if (pthread_setaffinity_np(_thread.native_handle(), sizeof(cpu_set_t), &cpu_set) != 0) {
+				std::cout << "could not pin the logging service to cpu " << cpu << std::endl;
+			}
+		}
+		return true;
+	}
+
+	// loggers still attached are written by their own stop()
+	void stop() {
+		if (!_f_running) {
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_f_running = false;
+		}
+		wake();
+		_thread.join();
+	}
+
+private:
+	friend class Logger;
+
+	void add (Logger* logger) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		_loggers.push_back(logger);
+	}
+
+	// waits for the drain in progress, the logger is not touched by the service afterwards
+	void remove (Logger* logger) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		_loggers.erase(std::remove(_loggers.begin(), _loggers.end(), logger), _loggers.end());
+	}
+
+	// control thread side
+	void notify (const unsigned int backlog) {
+		if (backlog < _wake_batch) {
+			return;
+		}
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (_f_sleeping.load(std::memory_order_relaxed) && _f_sleeping.exchange(false)) {
+			wake();
+		}
+	}
+
+	void wake () {
+		const uint64_t one = 1;
+		if (write(_event_fd, &one, sizeof(one)) < 0) {
+			// the counter can only overflow, the service is awake then
+		}
+	}
+
+	bool hasBatch () {
+		for (Logger* logger: _loggers) {
+			if (logger->backlog(logger->_ring_head.load(std::memory_order_acquire)) >= _wake_batch) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void serviceWorker () {
+		while (true) {
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				if (!_f_running) {
+					return;
+				}
+				for (Logger* logger: _loggers) {
+					logger->drainRing();
+				}
+			}
+
+			// sleep unless a batch arrived while draining. the fences pair with notify()
+			// so that either it sees _f_sleeping or this sees the samples
+			_f_sleeping.store(true);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			bool f_pending;
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				f_pending = hasBatch() || !_f_running;
+			}
+			if (f_pending) {
+				_f_sleeping.store(false);
+				continue;
+			}
+			uint64_t count;
+			if (read(_event_fd, &count, sizeof(count)) < 0) {
+				_f_sleeping.store(false);
+			}
+		}
+	}
+
+	unsigned int _wake_batch;
+	int _event_fd;
+	std::thread _thread;
+	std::mutex _mutex;
+	std::vector<Logger*> _loggers;
+	bool _f_running;
+	std::atomic<bool> _f_sleeping;
+};
+
+inline void Logger::registerWithService () {
+	_service->add(this);
+}
+
+inline void Logger::unregisterFromService () {
+	_service->remove(this);
+}
+
+inline void Logger::wakeService (const unsigned int head) {
+	_service->notify(backlog(head));
+}
+
+}
+
+#endif //UTILS_LOGGER_LOGGER_H_
\ No newline at end of file
@@ -0,0 +1,147 @@
+// Converts a binary log written by Logging::Logger (enableBinaryFormat or enableCompression) to the
+// csv format of the text logger, so the data_logging/plotter.py scripts can read it.
+//
+// usage : binary_log_to_csv log.bin [log.csv] [options]
+//   -from s         start of the window, in seconds from the start of the log
+//   -to s           end of the window, in seconds from the start of the log
+//   -vars a,b,...   only these variables
+// without output file name, the csv is written next to the input with the .csv extension.
+// the segments of a mapped log (log_1.bin, ...) are converted with it, and a window of a long
+// log is read directly with the time index of the logger (see IndexedLogReader)
+
+#include "logger/IndexedLogReader.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace Logging;
+
+// log timestamps are in microseconds
+const double TIMESTAMP_SCALE = 1e6;
+
+int main(int argc, char** argv)
+{
+	if(argc < 2)
+	{
+		cout << "usage : " << argv[0] << " log.bin [log.csv] [-from s] [-to s] [-vars a,b,...]" << endl;
+		return 1;
+	}
+	const string input_file = argv[1];
+	string output_file;
+	double from = 0;
+	double to = -1;
+	string variable_list;
+	for(int i=2 ; i<argc ; i++)
+	{
+		const string arg = argv[i];
+		if((arg == "-from" || arg == "-to" || arg == "-vars") && i+1 >= argc)
+		{
+			cout << arg << " needs a value" << endl;
+			return 1;
+		}
+		if(arg == "-from")
+		{
+			from = atof(argv[++i]);
+		}
+		else if(arg == "-to")
+		{
+			to = atof(argv[++i]);
+		}
+		else if(arg == "-vars")
+		{
+			variable_list = argv[++i];
+		}
+		else if(output_file.empty())
+		{
+			output_file = arg;
+		}
+		else
+		{
+			cout << "unknown option " << arg << endl;
+			return 1;
+		}
+	}
+	if(output_file.empty())
+	{
+		const size_t extension = input_file.find_last_of('.');
+		output_file = (extension == string::npos ? input_file : input_file.substr(0, extension)) + ".csv";
+	}
+
+	IndexedLogReader reader;
+	if(!reader.open(input_file))
+	{
+		cout << reader.error() << endl;
+		return 1;
+	}
+
+	vector<int> variables;
+	stringstream list(variable_list);
+	string variable_name;
+	while(getline(list, variable_name, ','))
+	{
+		const int variable = reader.variableIndex(variable_name);
+		if(variable < 0)
+		{
+			cout << variable_name << " is not in " << input_file << endl;
+			return 1;
+		}
+		variables.push_back(variable);
+	}
+	if(variables.empty())
+	{
+		for(int i=0 ; i<reader.numVariables() ; i++)
+		{
+			variables.push_back(i);
+		}
+	}
+
+	ofstream out(output_file, ios::out);
+	out << "timestamp, ";
+	for(const int i : variables)
+	{
+		if(reader.name(i).empty())
+		{
+			out << "var[" << i + 1 << "], ";
+		}
+		else
+		{
+			out << reader.name(i) << "[" << reader.size(i) << "], ";
+		}
+	}
+	out << "\n";
+
+	// records, same precision as the text logger. read sequentially from the start of the
+	// window, a whole log does not have to fit in memory
+	const double start_time = reader.startTime() + from * TIMESTAMP_SCALE;
+	const double end_time = (to < 0) ? reader.endTime() : reader.startTime() + to * TIMESTAMP_SCALE;
+	vector<double> record;
+	unsigned long n_records = 0;
+	if(reader.seek(start_time))
+	{
+		while(reader.next(record) && record[0] <= end_time)
+		{
+			out << record[0];
+			for(const int i : variables)
+			{
+				for(int j=0 ; j<reader.size(i) ; j++)
+				{
+					out << ", " << record[reader.offset(i) + j];
+				}
+			}
+			out << "\n";
+			n_records++;
+		}
+	}
+	if(!reader.error().empty())
+	{
+		cout << reader.error() << endl;
+	}
+
+	cout << "wrote " << n_records << " samples to " << output_file << endl;
+	return 0;
+}
@@ -0,0 +1,229 @@
+#ifndef UTILS_MEMORY_CYCLE_ARENA_H_
+#define UTILS_MEMORY_CYCLE_ARENA_H_
+
+// Bump allocator for the temporaries of one control cycle, reset at the top of the next one.
+//
+// the strings of the redis I/O, the temporary vectors of the estimators and the dynamic
+// matrices of the helpers live for one cycle only. from the arena an allocation is the
+// bump of an offset in a preallocated block and a deallocation is nothing, everything is
+// released at once by reset(), so there is no call to malloc in the loop and no
+// fragmentation over a long run. the allocators adapt it to the containers of the standard
+// library, and matrix() gives eigen matrices on its memory :
+//
+//   PandaUtils::CycleArena& arena = PandaUtils::CycleArena::local();    // of this thread
+//   while(runloop)
+//   {
+//       timer.waitForNextLoop();
+//       arena.reset();                                                  // top of the cycle
+//       PandaUtils::ArenaVector<std::pair<Vector3d, double>>::type weighted(arena);
+//       weighted.reserve(n_particles);
+//       PandaUtils::ArenaString payload(arena);
+//       Eigen::Map<Eigen::MatrixXd, Eigen::AlignedMax> J_tmp = arena.matrix(6, dof);
+//       ...
+//   }
+//   std::cout << arena.highWaterMark() << " bytes at most in a cycle\n";
+//
+// nothing allocated from the arena survives reset(), and the destructors of the objects on
+// it are not called by it (the ones of the containers do run, and free nothing). a cycle
+// that needs more than the capacity gets a new block from the heap, counted in numGrowths(),
+// and the next reset() merges the blocks into one, so after the first cycles the arena has
+// the size of the largest cycle and does not allocate anymore. an arena is used by one
+// thread at a time, local() is the one of the calling thread.
+
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+class CycleArena {
+public:
+
+	// initial size of the block, in bytes
+	explicit CycleArena(const size_t capacity = 64 * 1024)
+	: _chunk(0),
+	  _offset(0),
+	  _used_before(0),
+	  _high_water_mark(0),
+	  _n_growths(0)
+	{
+		addChunk(std::max(capacity, (size_t) 64));
+	}
+
+	// the arena of the calling thread
+	static CycleArena& local()
+	{
+		static thread_local CycleArena arena;
+		return arena;
+	}
+
+	// alignment is a power of two
+	void* allocate(const size_t bytes, const size_t alignment = alignof(std::max_align_t))
+	{
+		for(;;)
+		{
+			Chunk& chunk = _chunks[_chunk];
+			const uintptr_t base = reinterpret_cast<uintptr_t>(chunk.data.get());
+			const uintptr_t aligned = (base + _offset + alignment - 1) & ~(uintptr_t) (alignment - 1);
+			const size_t end = (aligned - base) + bytes;
+			if(end <= chunk.size)
+			{
+				_offset = end;
+				return reinterpret_cast<void*>(aligned);
+			}
+
+			// next block, allocated by this cycle only if there is none
+			_used_before += _offset;
+			_offset = 0;
+			_chunk++;
+			if(_chunk == _chunks.size())
+			{
+				addChunk(std::max(2 * chunk.size, bytes + alignment));
+				_n_growths++;
+			}
+		}
+	}
+
+	template<typename T>
+	T* allocateArray(const size_t n)
+	{
+		return static_cast<T*>(allocate(n * sizeof(T), alignof(T)));
+	}
+
+	// uninitialized, aligned for the vectorized operations of eigen
+	Eigen::Map<Eigen::MatrixXd, Eigen::AlignedMax> matrix(const int rows, const int cols)
+	{
+		return Eigen::Map<Eigen::MatrixXd, Eigen::AlignedMax>(
+				static_cast<double*>(allocate(sizeof(double) * rows * cols, eigenAlignment())), rows, cols);
+	}
+
+	Eigen::Map<Eigen::VectorXd, Eigen::AlignedMax> vector(const int size)
+	{
+		return Eigen::Map<Eigen::VectorXd, Eigen::AlignedMax>(
+				static_cast<double*>(allocate(sizeof(double) * size, eigenAlignment())), size);
+	}
+
+	// releases everything allocated since the last reset, at the top of a cycle
+	void reset()
+	{
+		_high_water_mark = std::max(_high_water_mark, used());
+		if(_chunks.size() > 1)
+		{
+			size_t total = 0;
+			for(unsigned int i=0 ; i<_chunks.size() ; i++)
+			{
+				total += _chunks[i].size;
+			}
+			_chunks.clear();
+			addChunk(total);
+		}
+		_chunk = 0;
+		_offset = 0;
+		_used_before = 0;
+	}
+
+	// bytes used since the last reset, alignment included
+	size_t used() const { return _used_before + _offset; }
+	size_t capacity() const
+	{
+		size_t total = 0;
+		for(unsigned int i=0 ; i<_chunks.size() ; i++)
+		{
+			total += _chunks[i].size;
+		}
+		return total;
+	}
+	// most bytes used in a cycle, up to the last reset
+	size_t highWaterMark() const { return _high_water_mark; }
+	// blocks allocated from the heap after the construction
+	unsigned long long numGrowths() const { return _n_growths; }
+
+private:
+
+	struct Chunk {
+		std::unique_ptr<char[]> data;
+		size_t size;
+	};
+
+	static size_t eigenAlignment()
+	{
+		return EIGEN_MAX_ALIGN_BYTES > 0 ? EIGEN_MAX_ALIGN_BYTES : alignof(double);
+	}
+
+	void addChunk(const size_t size)
+	{
+		Chunk chunk;
+		chunk.data.reset(new char[size]);
+		chunk.size = size;
+		_chunks.push_back(std::move(chunk));
+	}
+
+	CycleArena(const CycleArena&);
+	CycleArena& operator=(const CycleArena&);
+
+	std::vector<Chunk> _chunks;
+	size_t _chunk;
+	size_t _offset;
+	// in the blocks before the current one
+	size_t _used_before;
+	size_t _high_water_mark;
+	unsigned long long _n_growths;
+};
+
+// allocator of the standard containers on a CycleArena, deallocate() does nothing
+template<typename T>
+class ArenaAllocator {
+public:
+	typedef T value_type;
+
+	ArenaAllocator(CycleArena& arena)
+	: _arena(&arena)
+	{}
+
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other)
+	: _arena(other.arena())
+	{}
+
+	T* allocate(const std::size_t n)
+	{
+		return _arena->allocateArray<T>(n);
+	}
+
+	void deallocate(T*, std::size_t)
+	{}
+
+	CycleArena* arena() const { return _arena; }
+
+private:
+	CycleArena* _arena;
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+	return a.arena() == b.arena();
+}
+
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+	return a.arena() != b.arena();
+}
+
+// PandaUtils::ArenaVector<Vector3d>::type particles(arena)
+template<typename T>
+struct ArenaVector {
+	typedef std::vector<T, ArenaAllocator<T> > type;
+};
+
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char> > ArenaString;
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_MEMORY_CYCLE_ARENA_H_
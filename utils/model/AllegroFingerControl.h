@@ -0,0 +1,172 @@
+#ifndef UTILS_MODEL_ALLEGRO_FINGER_CONTROL_H_
+#define UTILS_MODEL_ALLEGRO_FINGER_CONTROL_H_
+
+// Joint PD and gravity compensation of the 16 finger joints of an Allegro hand, on fixed
+// size vectors, for a hand loop faster than the arm loop.
+//
+// the 4 fingers x 4 joints are stored in one Eigen::Matrix<double,16,1>, in the order of
+// the driver (index, middle, ring, thumb, from the base of each finger), so the whole law
+//
+//   torques = -kp .* (q - q_desired) - kv .* dq + gravity,   clamped to +- torque_limits
+//
+// is a few coefficient wise operations that Eigen vectorizes, without allocation and
+// without the 16 + 6 dof task model of a JointTask. the velocity is estimated from the
+// difference of the measured positions, low pass filtered, as the driver only sends the
+// positions. the gravity of the fingers depends on the orientation of the palm : it is
+// computed with a model of the floating hand (floatingAllegroHand.urdf, 6 virtual joints
+// px py pz rz rx ry then the fingers), whose virtual joints are set from the orientation
+// given by setPalmOrientation(), and only every gravity_decimation cycles as it changes
+// slowly :
+//
+//   PandaUtils::AllegroFingerControl finger_control("./resources/floatingAllegroHand.urdf");
+//   finger_control.setGains(40.0, 0.4);
+//   while(...) {    // e.g. at 3 kHz
+//       finger_control.setPalmOrientation(R_world_palm);
+//       finger_control.computeTorques(q_hand, q_hand_desired, dt, hand_torques);
+//   }
+
+#include "Sai2Model.h"
+#include <Eigen/Dense>
+
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+namespace PandaUtils {
+
+class AllegroFingerControl {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Matrix<double,16,1> Vector16d;
+
+	static const int N_FINGER_JOINTS = 16;
+	static const int N_VIRTUAL_JOINTS = 6;
+
+	AllegroFingerControl(const std::string& hand_file, const int gravity_decimation = 3,
+			const double velocity_cutoff = 100.0)
+	: _hand(new Sai2Model::Sai2Model(hand_file, false)),
+	  _gravity_decimation(gravity_decimation),
+	  _velocity_cutoff(velocity_cutoff),
+	  _cycles_to_gravity(0),
+	  _f_first_cycle(true),
+	  _f_gravity_compensation(true)
+	{
+		if(_hand->dof() != N_VIRTUAL_JOINTS + N_FINGER_JOINTS)
+		{
+			delete _hand;
+			throw std::invalid_argument("hand model should have 6 virtual and 16 finger joints in AllegroFingerControl::AllegroFingerControl()\n");
+		}
+		if(gravity_decimation < 1 || velocity_cutoff <= 0)
+		{
+			delete _hand;
+			throw std::invalid_argument("gravity decimation and velocity cutoff should be positive in AllegroFingerControl::AllegroFingerControl()\n");
+		}
+		_kp.setConstant(40.0);
+		_kv.setConstant(0.4);
+		_torque_limits.setConstant(0.7);
+		_q_prev.setZero();
+		_dq.setZero();
+		_gravity.setZero();
+		_hand->_q.setZero();
+	}
+
+	~AllegroFingerControl()
+	{
+		delete _hand;
+	}
+
+	AllegroFingerControl(const AllegroFingerControl&) = delete;
+	AllegroFingerControl& operator=(const AllegroFingerControl&) = delete;
+
+	void setGains(const double kp, const double kv)
+	{
+		_kp.setConstant(kp);
+		_kv.setConstant(kv);
+	}
+
+	void setGains(const Vector16d& kp, const Vector16d& kv)
+	{
+		_kp = kp;
+		_kv = kv;
+	}
+
+	void setTorqueLimits(const Vector16d& torque_limits)
+	{
+		_torque_limits = torque_limits.cwiseAbs();
+	}
+
+	// e.g. off when the driver compensates the gravity itself
+	void enableGravityCompensation(const bool f_gravity_compensation)
+	{
+		_f_gravity_compensation = f_gravity_compensation;
+		_gravity.setZero();
+	}
+
+	// orientation of the palm frame in world, for the gravity
+	void setPalmOrientation(const Eigen::Matrix3d& R_world_palm)
+	{
+		// R = Rz(a) * Rx(b) * Ry(c), the order of the virtual joints
+		_hand->_q.segment<3>(3) = R_world_palm.eulerAngles(2, 0, 1);
+	}
+
+	// q, q_desired and torques of the 16 finger joints, dt since the previous call
+	void computeTorques(const Vector16d& q, const Vector16d& q_desired, const double dt, Vector16d& torques)
+	{
+		if(_f_first_cycle)
+		{
+			_q_prev = q;
+			_f_first_cycle = false;
+		}
+		if(dt > 0)
+		{
+			// first order low pass of the finite difference
+			const double alpha = 1.0 - std::exp(-2.0 * M_PI * _velocity_cutoff * dt);
+			_dq += alpha * ((q - _q_prev) / dt - _dq);
+		}
+		_q_prev = q;
+
+		if(_f_gravity_compensation && --_cycles_to_gravity <= 0)
+		{
+			_hand->_q.tail<N_FINGER_JOINTS>() = q;
+			_hand->updateKinematics();
+			_hand->gravityVector(_gravity_full);
+			_gravity = _gravity_full.tail<N_FINGER_JOINTS>();
+			_cycles_to_gravity = _gravity_decimation;
+		}
+
+		torques = _gravity - _kp.cwiseProduct(q - q_desired) - _kv.cwiseProduct(_dq);
+		torques = torques.cwiseMin(_torque_limits).cwiseMax(-_torque_limits);
+	}
+
+	// forgets the velocity estimate, e.g. after the loop was paused
+	void reset()
+	{
+		_f_first_cycle = true;
+		_dq.setZero();
+	}
+
+	const Vector16d& velocities() const { return _dq; }
+	const Vector16d& gravity() const { return _gravity; }
+
+private:
+
+	Sai2Model::Sai2Model* _hand;
+	int _gravity_decimation;
+	double _velocity_cutoff;
+	int _cycles_to_gravity;
+	bool _f_first_cycle;
+	bool _f_gravity_compensation;
+
+	Vector16d _kp;
+	Vector16d _kv;
+	Vector16d _torque_limits;
+	Vector16d _q_prev;
+	Vector16d _dq;
+	Vector16d _gravity;
+	Eigen::VectorXd _gravity_full;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_MODEL_ALLEGRO_FINGER_CONTROL_H_
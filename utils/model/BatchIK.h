@@ -0,0 +1,310 @@
+#ifndef UTILS_MODEL_BATCH_IK_H_
+#define UTILS_MODEL_BATCH_IK_H_
+
+// Inverse kinematics of many candidate targets at once, for grasp planning.
+//
+// every candidate is a set of desired positions of the ik points (e.g. the 3 fingertips
+// of a grasp). the candidates are solved with computeIK3d_JL on a WorkerPool, each
+// thread with its own copy of the robot model. a solution starts from the solution of
+// the nearest targets solved before, kept in a small cache, when they are closer than
+// warm_start_distance, and from the initial guess otherwise. the candidates are solved
+// in blocks of WARM_START_BLOCK, from the cache of the previous blocks, and the cache is
+// filled in candidate order after each block, so the solutions do not depend on the
+// number of threads nor on the order the threads finish. the solutions are returned
+// ranked, the ones that reach the targets first (residual below residual_tolerance) by
+// decreasing joint limit margin, then the others by increasing residual :
+//
+//   PandaUtils::BatchIK batch_ik(robot_file, 4, ik_links, ik_pos_in_link, q_min, q_max, q_weights);
+//   batch_ik.setInitialGuess([](const std::vector<Eigen::Vector3d>& targets, Eigen::VectorXd& q) { ... });
+//   std::vector<std::vector<Eigen::Vector3d>> candidates = ...;      // hundreds of fingertip triples
+//   std::vector<PandaUtils::BatchIK::Solution> solutions = batch_ik.solve(candidates);
+//   robot->_q = solutions[0].q;                                      // best candidate is candidates[solutions[0].index]
+//
+// the residual is the norm of the stacked position errors of the ik points, in m. the
+// joint limit margin is the smallest distance to a joint limit, as a fraction of the
+// joint range, so 0.5 is a configuration in the middle of all the ranges and 0 one on a
+// limit. the cache keeps the last cache_size solutions that reached their targets, and
+// is shared by the threads and by the successive calls to solve().
+
+#include "Sai2Model.h"
+#include "threads/WorkerPool.h"
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+class BatchIK {
+public:
+
+	// candidates solved from the same state of the cache
+	static const int WARM_START_BLOCK = 16;
+
+	struct Solution
+	{
+		// index of the candidate in the targets given to solve()
+		int index;
+		Eigen::VectorXd q;
+		double residual;
+		double joint_limit_margin;
+		bool warm_started;
+	};
+
+	// sets q, at the size of the robot dof and at the joint positions of the urdf, to the initial guess for the targets
+	typedef std::function<void(const std::vector<Eigen::Vector3d>& targets, Eigen::VectorXd& q)> InitialGuess;
+
+	BatchIK(const std::string& robot_file, const int n_threads,
+			const std::vector<std::string>& ik_links, const std::vector<Eigen::Vector3d>& ik_pos_in_link,
+			const Eigen::VectorXd& q_min, const Eigen::VectorXd& q_max, const Eigen::VectorXd& q_weights,
+			const int cache_size = 64, const double warm_start_distance = 0.03, const double residual_tolerance = 1e-3)
+	: _pool(n_threads),
+	  _ik_links(ik_links),
+	  _ik_pos_in_link(ik_pos_in_link),
+	  _q_min(q_min),
+	  _q_max(q_max),
+	  _q_weights(q_weights),
+	  _cache_size(cache_size),
+	  _warm_start_distance(warm_start_distance),
+	  _residual_tolerance(residual_tolerance),
+	  _n_cached(0),
+	  _next_cache_entry(0),
+	  _n_warm_starts(0)
+	{
+		if(ik_links.empty() || ik_links.size() != ik_pos_in_link.size())
+		{
+			throw std::invalid_argument("there should be one position in link per ik link in BatchIK::BatchIK()\n");
+		}
+		if(cache_size < 0 || warm_start_distance < 0 || residual_tolerance < 0)
+		{
+			throw std::invalid_argument("cache size, warm start distance and residual tolerance should be positive in BatchIK::BatchIK()\n");
+		}
+
+		// one model per thread
+		for(int i=0 ; i<_pool.size() ; i++)
+		{
+			_robots.push_back(new Sai2Model::Sai2Model(robot_file, false));
+		}
+		_dof = _robots[0]->dof();
+		if(q_min.size() != _dof || q_max.size() != _dof || q_weights.size() != _dof)
+		{
+			throw std::invalid_argument("joint limits and weights should be of size dof in BatchIK::BatchIK()\n");
+		}
+		_q_default = _robots[0]->_q;
+
+		_cache_targets.resize(cache_size);
+		_cache_q.resize(cache_size);
+	}
+
+	~BatchIK()
+	{
+		for(unsigned int i=0 ; i<_robots.size() ; i++)
+		{
+			delete _robots[i];
+		}
+	}
+
+	void setInitialGuess(const InitialGuess& initial_guess)
+	{
+		_initial_guess = initial_guess;
+	}
+
+	// solutions of all the candidates, ranked
+	std::vector<Solution> solve(const std::vector<std::vector<Eigen::Vector3d>>& targets)
+	{
+		const int n_candidates = targets.size();
+		const int n_points = _ik_links.size();
+		for(int i=0 ; i<n_candidates ; i++)
+		{
+			if((int)targets[i].size() != n_points)
+			{
+				throw std::invalid_argument("there should be one target per ik link in BatchIK::solve()\n");
+			}
+		}
+
+		std::vector<Solution> solutions(n_candidates);
+		for(int begin=0 ; begin<n_candidates ; begin+=WARM_START_BLOCK)
+		{
+			const int end = std::min(begin + WARM_START_BLOCK, n_candidates);
+			std::atomic<int> next_candidate(begin);
+
+			// the threads take the next candidate when they are done with one, the solve times vary a lot
+			auto job = [&](const int index, const int)
+			{
+				Sai2Model::Sai2Model* robot = _robots[index];
+				int i;
+				while((i = next_candidate.fetch_add(1)) < end)
+				{
+					solveCandidate(robot, targets[i], solutions[i]);
+					solutions[i].index = i;
+				}
+			};
+			_pool.run(job);
+
+			for(int i=begin ; i<end ; i++)
+			{
+				if(solutions[i].residual <= _residual_tolerance)
+				{
+					addToCache(targets[i], solutions[i].q);
+				}
+			}
+		}
+
+		const double residual_tolerance = _residual_tolerance;
+		std::sort(solutions.begin(), solutions.end(), [residual_tolerance](const Solution& a, const Solution& b)
+		{
+			const bool a_reached = a.residual <= residual_tolerance;
+			const bool b_reached = b.residual <= residual_tolerance;
+			if(a_reached != b_reached)
+			{
+				return a_reached;
+			}
+			if(a_reached)
+			{
+				return a.joint_limit_margin > b.joint_limit_margin;
+			}
+			return a.residual < b.residual;
+		});
+		return solutions;
+	}
+
+	// forgets the previous solutions, e.g. when the object moved
+	void clearCache()
+	{
+		std::lock_guard<std::mutex> lock(_cache_mutex);
+		_n_cached = 0;
+		_next_cache_entry = 0;
+	}
+
+	int dof() const
+	{
+		return _dof;
+	}
+
+	// candidates solved from a cached solution since the construction
+	int numWarmStarts() const
+	{
+		return _n_warm_starts.load();
+	}
+
+private:
+
+	void solveCandidate(Sai2Model::Sai2Model* robot, const std::vector<Eigen::Vector3d>& targets, Solution& solution)
+	{
+		solution.warm_started = findWarmStart(targets, robot->_q);
+		if(solution.warm_started)
+		{
+			_n_warm_starts++;
+		}
+		else
+		{
+			robot->_q = _q_default;
+			if(_initial_guess)
+			{
+				_initial_guess(targets, robot->_q);
+			}
+		}
+		robot->updateKinematics();
+
+		solution.q.setZero(_dof);
+		robot->computeIK3d_JL(solution.q, _ik_links, _ik_pos_in_link, targets, _q_min, _q_max, _q_weights);
+
+		// residual and margin of the solution
+		robot->_q = solution.q;
+		robot->updateKinematics();
+		double squared_residual = 0;
+		Eigen::Vector3d position;
+		for(unsigned int k=0 ; k<_ik_links.size() ; k++)
+		{
+			robot->position(position, _ik_links[k], _ik_pos_in_link[k]);
+			squared_residual += (position - targets[k]).squaredNorm();
+		}
+		solution.residual = std::sqrt(squared_residual);
+
+		solution.joint_limit_margin = 0.5;
+		for(int j=0 ; j<_dof ; j++)
+		{
+			const double range = _q_max(j) - _q_min(j);
+			if(range > 0)
+			{
+				const double margin = std::min(solution.q(j) - _q_min(j), _q_max(j) - solution.q(j)) / range;
+				solution.joint_limit_margin = std::min(solution.joint_limit_margin, margin);
+			}
+		}
+	}
+
+	// q of the nearest cached targets, false if there is none within the warm start distance
+	bool findWarmStart(const std::vector<Eigen::Vector3d>& targets, Eigen::VectorXd& q)
+	{
+		std::lock_guard<std::mutex> lock(_cache_mutex);
+		int nearest = -1;
+		double nearest_squared_distance = _warm_start_distance * _warm_start_distance;
+		for(int i=0 ; i<_n_cached ; i++)
+		{
+			double squared_distance = 0;
+			for(unsigned int k=0 ; k<targets.size() ; k++)
+			{
+				squared_distance += (_cache_targets[i][k] - targets[k]).squaredNorm();
+			}
+			if(squared_distance <= nearest_squared_distance)
+			{
+				nearest = i;
+				nearest_squared_distance = squared_distance;
+			}
+		}
+		if(nearest < 0)
+		{
+			return false;
+		}
+		q = _cache_q[nearest];
+		return true;
+	}
+
+	// replaces the oldest entry when the cache is full
+	void addToCache(const std::vector<Eigen::Vector3d>& targets, const Eigen::VectorXd& q)
+	{
+		if(_cache_size == 0)
+		{
+			return;
+		}
+		std::lock_guard<std::mutex> lock(_cache_mutex);
+		_cache_targets[_next_cache_entry] = targets;
+		_cache_q[_next_cache_entry] = q;
+		_next_cache_entry = (_next_cache_entry + 1) % _cache_size;
+		_n_cached = std::min(_n_cached + 1, _cache_size);
+	}
+
+	WorkerPool _pool;
+	std::vector<Sai2Model::Sai2Model*> _robots;
+	int _dof;
+
+	const std::vector<std::string> _ik_links;
+	const std::vector<Eigen::Vector3d> _ik_pos_in_link;
+	const Eigen::VectorXd _q_min;
+	const Eigen::VectorXd _q_max;
+	const Eigen::VectorXd _q_weights;
+	Eigen::VectorXd _q_default;
+	InitialGuess _initial_guess;
+
+	// solutions that reached their targets, in a ring
+	const int _cache_size;
+	const double _warm_start_distance;
+	const double _residual_tolerance;
+	std::mutex _cache_mutex;
+	std::vector<std::vector<Eigen::Vector3d>> _cache_targets;
+	std::vector<Eigen::VectorXd> _cache_q;
+	int _n_cached;
+	int _next_cache_entry;
+
+	std::atomic<int> _n_warm_starts;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_MODEL_BATCH_IK_H_
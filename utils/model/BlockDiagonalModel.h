@@ -0,0 +1,431 @@
+#ifndef UTILS_MODEL_BLOCK_DIAGONAL_MODEL_H_
+#define UTILS_MODEL_BLOCK_DIAGONAL_MODEL_H_
+
+// Mass matrix inverse and task models of a robot made of independent subtrees, e.g. the
+// two arms of two_arm_panda.urdf on their common trunk.
+//
+// the joints of two subtrees that only share their root joints are not coupled in the mass
+// matrix : with the shared joints first (the border, the trunk joint of the two arm panda)
+// and the joints of each subtree next to each other, M is block diagonal but for the rows
+// and columns of the border :
+//
+//       | C    b_1^T  b_2^T |
+//   M = | b_1  A_1    0     |
+//       | b_2  0      A_2   |
+//
+// the blocks A_k are factorized one by one, and the border through its Schur complement
+// S = C - sum b_k^T A_k^-1 b_k, so the factorization costs about the one of the subtrees
+// alone. the task models only go through the blocks where the jacobian is not zero :
+//
+//   M^-1 J^T = [S^-1 U^T ; A_k^-1 J_k^T - A_k^-1 b_k S^-1 U^T]    with U = J_0 - sum J_k A_k^-1 b_k
+//
+// where J_0 and J_k are the columns of J of the border and of the block k. the results are
+// the ones of the monolithic model up to the rounding, in the same formulas as
+// Sai2Model::operationalSpaceMatrices() :
+//
+//   PandaUtils::BlockDiagonalModel block_model(dof);
+//   robot->updateModel();
+//   block_model.detect(robot->_M);                    // "15 dof : border 1, blocks 7 7"
+//   ...
+//   robot->updateModel();
+//   block_model.compute(robot->_M);
+//   N_prec.setIdentity();
+//   block_model.updateTaskModel(robot, left_hand_posori_task, N_prec);    // in place of left_hand_posori_task->updateTaskModel(N_prec)
+//   N_prec = left_hand_posori_task->_N;
+//   block_model.updateTaskModel(robot, right_hand_posori_task, N_prec);
+//
+// the blocks are found from the zeros of the mass matrix, relative to its diagonal. compute()
+// checks that the blocks are still not coupled, and uses a factorization of the whole mass
+// matrix when they are, so the task models stay the ones of the robot. compute() and the task
+// models do not allocate once the task sizes were seen.
+
+#include <Eigen/Dense>
+
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+class BlockDiagonalModel {
+public:
+
+	// coupling_tolerance relative to sqrt(M_ii M_jj) : the joints i and j are not coupled
+	// when |M_ij| is below it
+	BlockDiagonalModel(const int dof, const double coupling_tolerance = 1e-12)
+	: _dof(dof),
+	  _coupling_tolerance(coupling_tolerance),
+	  _border(0),
+	  _f_blocks_used(false),
+	  _n_nonzero_columns(0),
+	  _n_block_updates(0),
+	  _n_full_updates(0)
+	{
+		if(dof <= 0)
+		{
+			throw std::invalid_argument("dof should be positive in BlockDiagonalModel::BlockDiagonalModel()\n");
+		}
+		if(coupling_tolerance < 0)
+		{
+			throw std::invalid_argument("coupling tolerance should be positive in BlockDiagonalModel::BlockDiagonalModel()\n");
+		}
+		_full_ldlt.compute(Eigen::MatrixXd::Identity(dof, dof));
+		setBlocks(0, std::vector<int>(1, dof));
+	}
+
+	// border joints 0 to border-1, then the blocks of block_sizes in the joint order
+	void setBlocks(const int border, const std::vector<int>& block_sizes)
+	{
+		int n = border;
+		for(unsigned int k=0 ; k<block_sizes.size() ; k++)
+		{
+			if(block_sizes[k] <= 0)
+			{
+				throw std::invalid_argument("block sizes should be positive in BlockDiagonalModel::setBlocks()\n");
+			}
+			n += block_sizes[k];
+		}
+		if(border < 0 || block_sizes.empty() || n != _dof)
+		{
+			throw std::invalid_argument("the border and the blocks should cover the dof in BlockDiagonalModel::setBlocks()\n");
+		}
+
+		_border = border;
+		_starts.clear();
+		_sizes = block_sizes;
+		_ldlts.clear();
+		_X.clear();
+		int start = border;
+		for(unsigned int k=0 ; k<block_sizes.size() ; k++)
+		{
+			_starts.push_back(start);
+			start += block_sizes[k];
+			_ldlts.push_back(Eigen::LDLT<Eigen::MatrixXd>(Eigen::MatrixXd::Identity(block_sizes[k], block_sizes[k])));
+			_X.push_back(Eigen::MatrixXd::Zero(block_sizes[k], border));
+		}
+		_S.setIdentity(border, border);
+		_S_ldlt.compute(_S);
+		_f_blocks_used = false;
+
+		_segment_starts = _starts;
+		_segment_sizes = _sizes;
+		if(border > 0)
+		{
+			_segment_starts.insert(_segment_starts.begin(), 0);
+			_segment_sizes.insert(_segment_sizes.begin(), border);
+		}
+		_nonzero_starts.resize(_segment_starts.size());
+		_nonzero_sizes.resize(_segment_starts.size());
+	}
+
+	// finds the smallest border after which the joints split into independent blocks of
+	// consecutive joints. returns false, with one block of all the joints, when there are none
+	bool detect(const Eigen::MatrixXd& M)
+	{
+		checkSize(M, "detect");
+		for(int border=0 ; border<_dof-1 ; border++)
+		{
+			std::vector<int> block_sizes;
+			int start = border;
+			for(int k=border+1 ; k<_dof ; k++)
+			{
+				if(!coupled(M, start, k, k, _dof))
+				{
+					block_sizes.push_back(k - start);
+					start = k;
+				}
+			}
+			block_sizes.push_back(_dof - start);
+			if(block_sizes.size() > 1)
+			{
+				setBlocks(border, block_sizes);
+				return true;
+			}
+		}
+		setBlocks(0, std::vector<int>(1, _dof));
+		return false;
+	}
+
+	// factorizes M by blocks, or whole when the blocks are coupled in M (or there is one
+	// block). returns true when the blocks were used
+	bool compute(const Eigen::MatrixXd& M)
+	{
+		checkSize(M, "compute");
+		_f_blocks_used = _sizes.size() > 1;
+		for(unsigned int k=0 ; k<_sizes.size() && _f_blocks_used ; k++)
+		{
+			for(unsigned int l=k+1 ; l<_sizes.size() && _f_blocks_used ; l++)
+			{
+				_f_blocks_used = !coupled(M, _starts[k], _starts[k] + _sizes[k], _starts[l], _starts[l] + _sizes[l]);
+			}
+		}
+		if(!_f_blocks_used)
+		{
+			_full_ldlt.compute(M);
+			_n_full_updates++;
+			return false;
+		}
+
+		if(_border > 0)
+		{
+			_S = M.topLeftCorner(_border, _border);
+		}
+		for(unsigned int k=0 ; k<_sizes.size() ; k++)
+		{
+			_ldlts[k].compute(M.block(_starts[k], _starts[k], _sizes[k], _sizes[k]));
+			if(_border > 0)
+			{
+				// X_k = A_k^-1 b_k
+				_X[k] = M.block(_starts[k], 0, _sizes[k], _border);
+				_ldlts[k].solveInPlace(_X[k]);
+				_S.noalias() -= M.block(_starts[k], 0, _sizes[k], _border).transpose() * _X[k];
+			}
+		}
+		if(_border > 0)
+		{
+			_S_ldlt.compute(_S);
+		}
+		_n_block_updates++;
+		return true;
+	}
+
+	// M^-1 of the last compute()
+	void inverse(Eigen::MatrixXd& M_inv)
+	{
+		M_inv.setIdentity(_dof, _dof);
+		inverseTimes(M_inv, M_inv);
+	}
+
+	// M_inv_Jt = M^-1 J^T of the last compute(), J is m x dof
+	template<typename DerivedJ>
+	void inverseTimesTranspose(const Eigen::MatrixBase<DerivedJ>& J, Eigen::MatrixXd& M_inv_Jt)
+	{
+		if(J.cols() != _dof)
+		{
+			throw std::invalid_argument("jacobian of the wrong size in BlockDiagonalModel::inverseTimesTranspose()\n");
+		}
+		inverseTimes(J.transpose(), M_inv_Jt);
+	}
+
+	// Lambda, Jbar and N of the jacobian J with the nullspace N_prec, same as
+	// robot->operationalSpaceMatrices(Lambda, Jbar, N, J, N_prec) with the mass matrix of the
+	// last compute()
+	template<typename DerivedJ>
+	void operationalSpaceMatrices(Eigen::MatrixXd& Lambda, Eigen::MatrixXd& Jbar, Eigen::MatrixXd& N,
+			const Eigen::MatrixBase<DerivedJ>& J, const Eigen::MatrixXd& N_prec)
+	{
+		if(J.cols() != _dof || N_prec.rows() != _dof || N_prec.cols() != _dof)
+		{
+			throw std::invalid_argument("jacobian or nullspace of the wrong size in BlockDiagonalModel::operationalSpaceMatrices()\n");
+		}
+		const int m = J.rows();
+		inverseTimes(J.transpose(), _M_inv_Jt);
+
+		// the border and the blocks where J is not zero
+		_n_nonzero_columns = 0;
+		if(_f_blocks_used)
+		{
+			for(unsigned int k=0 ; k<_segment_starts.size() ; k++)
+			{
+				if(!J.middleCols(_segment_starts[k], _segment_sizes[k]).isZero(0))
+				{
+					_nonzero_starts[_n_nonzero_columns] = _segment_starts[k];
+					_nonzero_sizes[_n_nonzero_columns] = _segment_sizes[k];
+					_n_nonzero_columns++;
+				}
+			}
+		}
+		else
+		{
+			_nonzero_starts[0] = 0;
+			_nonzero_sizes[0] = _dof;
+			_n_nonzero_columns = 1;
+		}
+
+		// J M^-1 J^T
+		_Lambda_inv.setZero(m, m);
+		for(int k=0 ; k<_n_nonzero_columns ; k++)
+		{
+			_Lambda_inv.noalias() += J.middleCols(_nonzero_starts[k], _nonzero_sizes[k])
+					* _M_inv_Jt.middleRows(_nonzero_starts[k], _nonzero_sizes[k]);
+		}
+
+		_lambda_llt.compute(_Lambda_inv);
+		Lambda.setIdentity(m, m);
+		_lambda_llt.solveInPlace(Lambda);
+		Jbar.resize(_dof, m);
+		Jbar.noalias() = _M_inv_Jt * Lambda;
+
+		// N = (I - Jbar J) N_prec, the columns of the zeros of J are the ones of N_prec
+		if(N_prec.isIdentity(0))
+		{
+			N.setIdentity(_dof, _dof);
+			for(int k=0 ; k<_n_nonzero_columns ; k++)
+			{
+				N.middleCols(_nonzero_starts[k], _nonzero_sizes[k]).noalias() -= Jbar * J.middleCols(_nonzero_starts[k], _nonzero_sizes[k]);
+			}
+		}
+		else
+		{
+			_J_N_prec.setZero(m, _dof);
+			for(int k=0 ; k<_n_nonzero_columns ; k++)
+			{
+				_J_N_prec.noalias() += J.middleCols(_nonzero_starts[k], _nonzero_sizes[k])
+						* N_prec.middleRows(_nonzero_starts[k], _nonzero_sizes[k]);
+			}
+			N = N_prec;
+			N.noalias() -= Jbar * _J_N_prec;
+		}
+	}
+
+	// sets the jacobian, projected jacobian, Lambda, Jbar and N of a Sai2Primitives::PosOriTask
+	// as its updateTaskModel(N_prec) does, with the mass matrix of the last compute()
+	template<typename Robot, typename PosOriTask>
+	void updateTaskModel(Robot* robot, PosOriTask* task, const Eigen::MatrixXd& N_prec)
+	{
+		task->_N_prec = N_prec;
+		robot->J_0(task->_jacobian, task->_link_name, task->_control_frame.translation());
+		if(N_prec.isIdentity(0))
+		{
+			task->_projected_jacobian = task->_jacobian;
+		}
+		else
+		{
+			task->_projected_jacobian.noalias() = task->_jacobian * N_prec;
+		}
+		operationalSpaceMatrices(task->_Lambda, task->_Jbar, task->_N, task->_projected_jacobian, N_prec);
+	}
+
+	int dof() const { return _dof; }
+	int border() const { return _border; }
+	int blocks() const { return _sizes.size(); }
+	int blockStart(const int k) const { return _starts[k]; }
+	int blockSize(const int k) const { return _sizes[k]; }
+
+	// the last compute() used the blocks
+	bool blocksUsed() const { return _f_blocks_used; }
+	unsigned long long blockUpdates() const { return _n_block_updates; }
+	// compute() calls where the blocks were coupled
+	unsigned long long fullUpdates() const { return _n_full_updates; }
+
+	// e.g. "15 dof : border 1, blocks 7 7"
+	std::string summary() const
+	{
+		std::string line = std::to_string(_dof) + " dof : border " + std::to_string(_border) + ", blocks";
+		for(unsigned int k=0 ; k<_sizes.size() ; k++)
+		{
+			line += " " + std::to_string(_sizes[k]);
+		}
+		return line;
+	}
+
+private:
+	void checkSize(const Eigen::MatrixXd& M, const std::string& function) const
+	{
+		if(M.rows() != _dof || M.cols() != _dof)
+		{
+			throw std::invalid_argument("mass matrix of the wrong size in BlockDiagonalModel::" + function + "()\n");
+		}
+	}
+
+	// the joints [i_begin, i_end) are coupled with the joints [j_begin, j_end) in M
+	bool coupled(const Eigen::MatrixXd& M, const int i_begin, const int i_end, const int j_begin, const int j_end) const
+	{
+		for(int j=j_begin ; j<j_end ; j++)
+		{
+			for(int i=i_begin ; i<i_end ; i++)
+			{
+				if(std::abs(M(j,i)) > _coupling_tolerance * std::sqrt(std::abs(M(i,i) * M(j,j))))
+				{
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	// result = M^-1 rhs, rhs is dof x n and can be result
+	template<typename Rhs>
+	void inverseTimes(const Eigen::MatrixBase<Rhs>& rhs, Eigen::MatrixXd& result)
+	{
+		if(!_f_blocks_used)
+		{
+			result = rhs;
+			_full_ldlt.solveInPlace(result);
+			return;
+		}
+		const int n = rhs.cols();
+		// U^T = rhs_0 - sum X_k^T rhs_k, then S^-1 U^T
+		if(_border > 0)
+		{
+			_S_inv_Ut.resize(_border, n);
+			_S_inv_Ut = rhs.topRows(_border);
+			for(unsigned int k=0 ; k<_sizes.size() ; k++)
+			{
+				if(!rhs.middleRows(_starts[k], _sizes[k]).isZero(0))
+				{
+					_S_inv_Ut.noalias() -= _X[k].transpose() * rhs.middleRows(_starts[k], _sizes[k]);
+				}
+			}
+			_S_ldlt.solveInPlace(_S_inv_Ut);
+		}
+		if(&rhs.derived() != static_cast<const void*>(&result))
+		{
+			result = rhs;
+		}
+		for(unsigned int k=0 ; k<_sizes.size() ; k++)
+		{
+			Eigen::Block<Eigen::MatrixXd> rows = result.middleRows(_starts[k], _sizes[k]);
+			if(!rows.isZero(0))
+			{
+				_ldlts[k].solveInPlace(rows);
+			}
+			if(_border > 0)
+			{
+				rows.noalias() -= _X[k] * _S_inv_Ut;
+			}
+		}
+		if(_border > 0)
+		{
+			result.topRows(_border) = _S_inv_Ut;
+		}
+	}
+
+	const int _dof;
+	const double _coupling_tolerance;
+
+	int _border;
+	std::vector<int> _starts;
+	std::vector<int> _sizes;
+
+	bool _f_blocks_used;
+	std::vector<Eigen::LDLT<Eigen::MatrixXd> > _ldlts;
+	// A_k^-1 b_k
+	std::vector<Eigen::MatrixXd> _X;
+	// Schur complement of the border
+	Eigen::MatrixXd _S;
+	Eigen::LDLT<Eigen::MatrixXd> _S_ldlt;
+	// when the blocks are coupled
+	Eigen::LDLT<Eigen::MatrixXd> _full_ldlt;
+
+	// the border and the blocks, and the ones where the jacobian is not zero
+	std::vector<int> _segment_starts;
+	std::vector<int> _segment_sizes;
+	std::vector<int> _nonzero_starts;
+	std::vector<int> _nonzero_sizes;
+	int _n_nonzero_columns;
+
+	Eigen::MatrixXd _S_inv_Ut;
+	Eigen::MatrixXd _M_inv_Jt;
+	Eigen::MatrixXd _Lambda_inv;
+	Eigen::LLT<Eigen::MatrixXd> _lambda_llt;
+	Eigen::MatrixXd _J_N_prec;
+
+	unsigned long long _n_block_updates;
+	unsigned long long _n_full_updates;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_MODEL_BLOCK_DIAGONAL_MODEL_H_
@@ -0,0 +1,450 @@
+#ifndef UTILS_MODEL_COLLISION_DISTANCE_H_
+#define UTILS_MODEL_COLLISION_DISTANCE_H_
+
+// Distances between the links of the robot, as capsules, and static obstacles, for the
+// constraint avoidance tasks.
+//
+// a link is one or a few capsules (a segment in the frame of the link and a radius), and an
+// obstacle is a capsule in the world frame, a sphere being a capsule of zero length. the
+// obstacles are static, and sorted once in a bounding volume hierarchy of axis aligned boxes.
+// the query of a link capsule starts from the obstacle that was the closest to it at the last
+// tick, whose distance prunes most of the tree, and only the boxes that can hold a closer
+// obstacle are opened. update() gives, for every capsule, the closest obstacle, the distance
+// between the surfaces, the direction from the obstacle to the link and the point of the axis
+// of the capsule in the frame of its link, for the jacobian of the constraint :
+//
+//   PandaUtils::CollisionDistance collision_distance(PandaUtils::pandaLinkCapsules());
+//   collision_distance.addObstacleCapsule(Vector3d(0.8, 0.1, 0.0), Vector3d(0.8, 0.1, 1.0), 0.06);
+//   collision_distance.setMaxDistance(r_influence);                     // farther is not reported
+//   ...
+//   robot->updateModel();
+//   collision_distance.update(robot);
+//   const PandaUtils::CollisionDistanceResult& closest = collision_distance.closest();
+//   if(closest.obstacle >= 0 && closest.distance <= d_z)
+//   {
+//       robot->Jv(Jv, collision_distance.capsule(closest.capsule).link_name, closest.point_in_link);
+//       J_c = closest.normal.transpose() * Jv;
+//       ...
+//   }
+//
+// the distance is negative for capsules that overlap. the tree is rebuilt by the first
+// update() after an obstacle was added, not in the loop. update() does not allocate.
+
+#include "Sai2Model.h"
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+struct CollisionCapsule
+{
+	std::string link_name;
+	// ends of the axis, in the frame of the link
+	Eigen::Vector3d a;
+	Eigen::Vector3d b;
+	double radius;
+
+	CollisionCapsule(const std::string& link_name, const Eigen::Vector3d& a, const Eigen::Vector3d& b, const double radius)
+	: link_name(link_name), a(a), b(b), radius(radius) {}
+};
+
+// coarse capsules of the links of the panda, from the cylinders of its collision model
+inline std::vector<CollisionCapsule> pandaLinkCapsules()
+{
+	using Eigen::Vector3d;
+	std::vector<CollisionCapsule> capsules;
+	capsules.push_back(CollisionCapsule("link1", Vector3d(0, 0, -0.333), Vector3d(0, 0, -0.050), 0.06));
+	capsules.push_back(CollisionCapsule("link2", Vector3d(0, 0, -0.060), Vector3d(0, 0, 0.060), 0.06));
+	capsules.push_back(CollisionCapsule("link3", Vector3d(0, 0, -0.220), Vector3d(0, 0, -0.070), 0.06));
+	capsules.push_back(CollisionCapsule("link4", Vector3d(0, 0, -0.060), Vector3d(0, 0, 0.060), 0.06));
+	capsules.push_back(CollisionCapsule("link5", Vector3d(0, 0, -0.310), Vector3d(0, 0, -0.210), 0.06));
+	capsules.push_back(CollisionCapsule("link5", Vector3d(0, 0.08, -0.200), Vector3d(0, 0.08, -0.060), 0.025));
+	capsules.push_back(CollisionCapsule("link6", Vector3d(0, 0, -0.070), Vector3d(0, 0, 0.010), 0.05));
+	capsules.push_back(CollisionCapsule("link7", Vector3d(0, 0, -0.060), Vector3d(0, 0, 0.080), 0.04));
+	return capsules;
+}
+
+struct CollisionDistanceResult
+{
+	int capsule;
+	// -1 when no obstacle is closer than the max distance
+	int obstacle;
+	// between the surfaces
+	double distance;
+	// closest points of the axes, in world
+	Eigen::Vector3d robot_point;
+	Eigen::Vector3d obstacle_point;
+	// unit, from the obstacle to the link
+	Eigen::Vector3d normal;
+	// robot_point in the frame of the link of the capsule
+	Eigen::Vector3d point_in_link;
+
+	CollisionDistanceResult()
+	: capsule(-1), obstacle(-1), distance(std::numeric_limits<double>::infinity()),
+	  robot_point(Eigen::Vector3d::Zero()), obstacle_point(Eigen::Vector3d::Zero()),
+	  normal(Eigen::Vector3d::UnitZ()), point_in_link(Eigen::Vector3d::Zero()) {}
+};
+
+namespace internal {
+
+inline double clamp01(const double x)
+{
+	return x < 0 ? 0 : (x > 1 ? 1 : x);
+}
+
+// closest points of the segments [p1,q1] and [p2,q2] at p1 + s (q1 - p1) and p2 + t (q2 - p2),
+// returns the squared distance
+inline double closestPointsOfSegments(const Eigen::Vector3d& p1, const Eigen::Vector3d& q1,
+		const Eigen::Vector3d& p2, const Eigen::Vector3d& q2, double& s, double& t)
+{
+	const double eps = 1e-12;
+	const Eigen::Vector3d d1 = q1 - p1;
+	const Eigen::Vector3d d2 = q2 - p2;
+	const Eigen::Vector3d r = p1 - p2;
+	const double a = d1.squaredNorm();
+	const double e = d2.squaredNorm();
+	const double f = d2.dot(r);
+	if(a <= eps && e <= eps)
+	{
+		s = 0;
+		t = 0;
+	}
+	else if(a <= eps)
+	{
+		s = 0;
+		t = clamp01(f / e);
+	}
+	else
+	{
+		const double c = d1.dot(r);
+		if(e <= eps)
+		{
+			t = 0;
+			s = clamp01(-c / a);
+		}
+		else
+		{
+			const double b = d1.dot(d2);
+			const double denom = a * e - b * b;
+			s = denom > eps ? clamp01((b * f - c * e) / denom) : 0;
+			t = (b * s + f) / e;
+			if(t < 0)
+			{
+				t = 0;
+				s = clamp01(-c / a);
+			}
+			else if(t > 1)
+			{
+				t = 1;
+				s = clamp01((b - c) / a);
+			}
+		}
+	}
+	return (p1 + s * d1 - p2 - t * d2).squaredNorm();
+}
+
+struct CollisionBox
+{
+	Eigen::Vector3d lo;
+	Eigen::Vector3d hi;
+};
+
+// lower bound of the distance between two objects in the boxes when it is positive, zero when they overlap
+inline double distanceOfBoxes(const CollisionBox& a, const CollisionBox& b)
+{
+	const Eigen::Vector3d gap = (b.lo - a.hi).cwiseMax(a.lo - b.hi).cwiseMax(0.0);
+	return gap.norm();
+}
+
+} /* namespace internal */
+
+class CollisionDistance {
+public:
+
+	CollisionDistance(const std::vector<CollisionCapsule>& capsules)
+	: _capsules(capsules),
+	  _results(capsules.size()),
+	  _max_distance(std::numeric_limits<double>::infinity()),
+	  _closest(-1),
+	  _f_tree_built(true),
+	  _n_tests(0)
+	{
+		if(capsules.empty())
+		{
+			throw std::invalid_argument("no capsules in CollisionDistance::CollisionDistance()\n");
+		}
+		for(unsigned int i=0 ; i<_capsules.size() ; i++)
+		{
+			_results[i].capsule = i;
+		}
+	}
+
+	// axis from a to b in world, a sphere when a == b
+	void addObstacleCapsule(const Eigen::Vector3d& a, const Eigen::Vector3d& b, const double radius)
+	{
+		if(radius < 0)
+		{
+			throw std::invalid_argument("radius should not be negative in CollisionDistance::addObstacleCapsule()\n");
+		}
+		Obstacle obstacle;
+		obstacle.a = a;
+		obstacle.b = b;
+		obstacle.radius = radius;
+		_obstacles.push_back(obstacle);
+		_f_tree_built = false;
+	}
+
+	void addObstacleSphere(const Eigen::Vector3d& center, const double radius)
+	{
+		addObstacleCapsule(center, center, radius);
+	}
+
+	// obstacles farther than this from a capsule are not reported
+	void setMaxDistance(const double max_distance)
+	{
+		_max_distance = max_distance;
+	}
+
+	// positions of the capsules from the kinematics of the robot, then the closest obstacles
+	void update(Sai2Model::Sai2Model* robot)
+	{
+		if(!_f_tree_built)
+		{
+			buildTree();
+		}
+		_closest = -1;
+		double closest_distance = std::numeric_limits<double>::infinity();
+		Eigen::Affine3d T_world_link;
+		for(unsigned int i=0 ; i<_capsules.size() ; i++)
+		{
+			robot->transform(T_world_link, _capsules[i].link_name);
+			query(i, T_world_link * _capsules[i].a, T_world_link * _capsules[i].b);
+			if(_results[i].obstacle >= 0 && _results[i].distance < closest_distance)
+			{
+				closest_distance = _results[i].distance;
+				_closest = i;
+			}
+		}
+	}
+
+	// closest pair over all the capsules, obstacle = -1 when there is none
+	const CollisionDistanceResult& closest() const
+	{
+		return _closest >= 0 ? _results[_closest] : _no_result;
+	}
+
+	const CollisionDistanceResult& result(const int capsule) const { return _results.at(capsule); }
+	const CollisionCapsule& capsule(const int index) const { return _capsules.at(index); }
+	int numCapsules() const { return (int) _capsules.size(); }
+	int numObstacles() const { return (int) _obstacles.size(); }
+	// capsule to obstacle distances computed, over all the updates
+	unsigned long long numTests() const { return _n_tests; }
+
+private:
+
+	struct Obstacle {
+		Eigen::Vector3d a;
+		Eigen::Vector3d b;
+		double radius;
+	};
+
+	struct Node {
+		internal::CollisionBox box;
+		// children, or -1 for a leaf of the obstacles [first, first + count) of _order
+		int left;
+		int right;
+		int first;
+		int count;
+		// of the obstacles of the node
+		double max_radius;
+	};
+
+	static const int max_leaf_size = 2;
+	static const int max_depth = 64;
+
+	static internal::CollisionBox boxOf(const Eigen::Vector3d& a, const Eigen::Vector3d& b, const double radius)
+	{
+		internal::CollisionBox box;
+		box.lo = a.cwiseMin(b).array() - radius;
+		box.hi = a.cwiseMax(b).array() + radius;
+		return box;
+	}
+
+	void buildTree()
+	{
+		_nodes.clear();
+		_order.resize(_obstacles.size());
+		for(unsigned int i=0 ; i<_order.size() ; i++)
+		{
+			_order[i] = i;
+		}
+		if(!_obstacles.empty())
+		{
+			buildNode(0, _obstacles.size(), 0);
+		}
+		for(unsigned int i=0 ; i<_results.size() ; i++)
+		{
+			_results[i].obstacle = -1;
+		}
+		_f_tree_built = true;
+	}
+
+	// node of the obstacles [first, first + count) of _order, split at the median of the longest axis
+	int buildNode(const int first, const int count, const int depth)
+	{
+		Node node;
+		node.box = boxOf(_obstacles[_order[first]].a, _obstacles[_order[first]].b, _obstacles[_order[first]].radius);
+		node.max_radius = _obstacles[_order[first]].radius;
+		for(int i=first+1 ; i<first+count ; i++)
+		{
+			const Obstacle& obstacle = _obstacles[_order[i]];
+			const internal::CollisionBox box = boxOf(obstacle.a, obstacle.b, obstacle.radius);
+			node.box.lo = node.box.lo.cwiseMin(box.lo);
+			node.box.hi = node.box.hi.cwiseMax(box.hi);
+			node.max_radius = std::max(node.max_radius, obstacle.radius);
+		}
+		node.left = -1;
+		node.right = -1;
+		node.first = first;
+		node.count = count;
+		const int index = _nodes.size();
+		_nodes.push_back(node);
+		if(count <= max_leaf_size || depth >= max_depth - 2)
+		{
+			return index;
+		}
+
+		int axis = 0;
+		const Eigen::Vector3d extent = node.box.hi - node.box.lo;
+		extent.maxCoeff(&axis);
+		const std::vector<Obstacle>& obstacles = _obstacles;
+		std::nth_element(_order.begin() + first, _order.begin() + first + count / 2, _order.begin() + first + count,
+			[&obstacles, axis](const int i, const int j)
+			{
+				return obstacles[i].a(axis) + obstacles[i].b(axis) < obstacles[j].a(axis) + obstacles[j].b(axis);
+			});
+		const int left = buildNode(first, count / 2, depth + 1);
+		const int right = buildNode(first + count / 2, count - count / 2, depth + 1);
+		_nodes[index].left = left;
+		_nodes[index].right = right;
+		return index;
+	}
+
+	// distance of the capsule i, with its axis from a to b in world, to an obstacle
+	double test(const int i, const Eigen::Vector3d& a, const Eigen::Vector3d& b, const int o, double& s, double& t)
+	{
+		_n_tests++;
+		const Obstacle& obstacle = _obstacles[o];
+		const double d2 = internal::closestPointsOfSegments(a, b, obstacle.a, obstacle.b, s, t);
+		return std::sqrt(d2) - _capsules[i].radius - obstacle.radius;
+	}
+
+	void query(const int i, const Eigen::Vector3d& a, const Eigen::Vector3d& b)
+	{
+		CollisionDistanceResult& result = _results[i];
+		int best = -1;
+		double best_distance = _max_distance;
+		double best_s = 0;
+		double best_t = 0;
+
+		// the closest obstacle of the last tick first, it is very likely still the closest
+		if(result.obstacle >= 0)
+		{
+			double s, t;
+			const double distance = test(i, a, b, result.obstacle, s, t);
+			if(distance <= best_distance)
+			{
+				best = result.obstacle;
+				best_distance = distance;
+				best_s = s;
+				best_t = t;
+			}
+		}
+
+		if(!_nodes.empty())
+		{
+			const internal::CollisionBox capsule_box = boxOf(a, b, _capsules[i].radius);
+			int stack[max_depth];
+			int n_stack = 0;
+			stack[n_stack++] = 0;
+			while(n_stack > 0)
+			{
+				const Node& node = _nodes[stack[--n_stack]];
+				// boxes apart bound the distance, overlapping ones only the depth of the penetration
+				const double gap = internal::distanceOfBoxes(capsule_box, node.box);
+				const double lower_bound = gap > 0 ? gap : -(_capsules[i].radius + node.max_radius);
+				if(lower_bound > best_distance)
+				{
+					continue;
+				}
+				if(node.left < 0)
+				{
+					for(int k=node.first ; k<node.first+node.count ; k++)
+					{
+						const int o = _order[k];
+						if(o == result.obstacle)
+						{
+							continue;
+						}
+						double s, t;
+						const double distance = test(i, a, b, o, s, t);
+						if(distance < best_distance)
+						{
+							best = o;
+							best_distance = distance;
+							best_s = s;
+							best_t = t;
+						}
+					}
+				}
+				else
+				{
+					stack[n_stack++] = node.right;
+					stack[n_stack++] = node.left;
+				}
+			}
+		}
+
+		result.obstacle = best;
+		if(best < 0)
+		{
+			result.distance = std::numeric_limits<double>::infinity();
+			return;
+		}
+		const Obstacle& obstacle = _obstacles[best];
+		result.distance = best_distance;
+		result.robot_point = a + best_s * (b - a);
+		result.obstacle_point = obstacle.a + best_t * (obstacle.b - obstacle.a);
+		const Eigen::Vector3d direction = result.robot_point - result.obstacle_point;
+		const double norm = direction.norm();
+		if(norm > 1e-9)
+		{
+			result.normal = direction / norm;
+		}
+		const CollisionCapsule& capsule = _capsules[i];
+		result.point_in_link = capsule.a + best_s * (capsule.b - capsule.a);
+	}
+
+	std::vector<CollisionCapsule> _capsules;
+	std::vector<Obstacle> _obstacles;
+	std::vector<CollisionDistanceResult> _results;
+	CollisionDistanceResult _no_result;
+
+	std::vector<Node> _nodes;
+	std::vector<int> _order;
+
+	double _max_distance;
+	int _closest;
+	bool _f_tree_built;
+	unsigned long long _n_tests;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_MODEL_COLLISION_DISTANCE_H_
@@ -0,0 +1,256 @@
+#ifndef UTILS_MODEL_DUAL_ARM_TASK_PIPELINE_H_
+#define UTILS_MODEL_DUAL_ARM_TASK_PIPELINE_H_
+
+// Model and task model updates of two robots holding one object, in three steps : the
+// robots one per thread, the coupled two hand step, and the robots again.
+//
+// the two robots are two models, each with its own mass matrix. everything but the grasp
+// matrix and the object space task model only depends on one robot : the model update,
+// the contact jacobian and the inverse inertia at the contact, and, once the nullspace of
+// the two hand task is known, the task models below it. update() runs the robot steps on
+// a WorkerPool (see threads/WorkerPool.h) and the coupled step on the calling thread :
+//
+//   PandaUtils::WorkerPool model_update_pool(2, {3});
+//   PandaUtils::DualArmTaskPipeline pipeline(model_update_pool, robot_1, robot_2);
+//   auto update_robot = [&](const int i) { robots[i]->coriolisForce(coriolis[i]); };      // after updateModel()
+//   auto update_coupled = [&]() { two_hand_task->updateTaskModel(N_prec[0], N_prec[1]); };
+//   auto update_nullspace = [&](const int i) { joint_tasks[i]->updateTaskModel(two_hand_N[i]); };
+//   pipeline.update(update_robot, update_coupled, update_nullspace);
+//
+// with setContacts(), the coupled step also computes the object space task model of the
+// two contacts at their geometric center, from the contact quantities of the robot steps :
+// the grasp matrix G, the jacobian J_r = G^-T J_c of the stacked contact jacobians, Lambda_r
+// (12 x 12), Jbar_r and N_r (14 x 14). since the mass matrix of the two robots is block
+// diagonal, J_r M^-1 J_r^T = G^-T (J_c M^-1 J_c^T) G^-1 is assembled from the two 6 x 6
+// contact inverse inertias, the 14 x 14 mass matrix is never formed :
+//
+//   pipeline.setContacts("link7", pos_in_link, "link7", pos_in_link);
+//   pipeline.update();
+//   pipeline.graspMatrix(); pipeline.objectLambda(); pipeline.objectNullspace();
+//
+// the rows of J_c and of G are the ones of Sai2Model::graspMatrixAtGeometricCenter() :
+// the linear velocities of the contacts 1 and 2, then their angular velocities. the jobs
+// of a step must only touch their own robot, update() returns after the three steps.
+
+#include "Sai2Model.h"
+#include "threads/WorkerPool.h"
+
+#include <Eigen/Dense>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+class DualArmTaskPipeline {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	// the robots are updated on the threads of pool, at most one thread per robot is used
+	DualArmTaskPipeline(WorkerPool& pool, Sai2Model::Sai2Model* robot_1, Sai2Model::Sai2Model* robot_2)
+	: _pool(pool),
+	  _f_contacts(false)
+	{
+		if(robot_1 == NULL || robot_2 == NULL || robot_1 == robot_2)
+		{
+			throw std::invalid_argument("two different robots are needed in DualArmTaskPipeline::DualArmTaskPipeline()\n");
+		}
+		_robots[0] = robot_1;
+		_robots[1] = robot_2;
+		_dof_total = 0;
+		for(int i=0 ; i<2 ; i++)
+		{
+			_dof[i] = _robots[i]->dof();
+			_dof_total += _dof[i];
+			_contact_jacobians[i].setZero(6, _dof[i]);
+			_M_inv_Jct[i].setZero(_dof[i], 6);
+			_contact_inverse_inertias[i].setIdentity();
+			_object_jacobians[i].setZero(12, _dof[i]);
+			_object_Jbar[i].setZero(_dof[i], 12);
+		}
+		_contact_locations.assign(2, Eigen::Vector3d::Zero());
+		_constrained_rotations.assign(2, 2);
+		_G.setIdentity(12, 12);
+		_G_inv.setIdentity(12, 12);
+		_G_lu.compute(_G);
+		_R_g.setIdentity();
+		_geometric_center.setZero();
+		_Lambda_inv.setIdentity(12, 12);
+		_Lambda.setIdentity(12, 12);
+		_G_inv_Lambda.setIdentity(12, 12);
+		_lambda_llt.compute(_Lambda_inv);
+		_N.setIdentity(_dof_total, _dof_total);
+	}
+
+	// contact points of the object space task model, in the frames of the links. the
+	// constrained rotations are the ones of Sai2Model::graspMatrixAtGeometricCenter()
+	void setContacts(const std::string& link_1, const Eigen::Vector3d& pos_in_link_1,
+			const std::string& link_2, const Eigen::Vector3d& pos_in_link_2,
+			const int constrained_rotations_1 = 2, const int constrained_rotations_2 = 2)
+	{
+		_links[0] = link_1;
+		_links[1] = link_2;
+		_pos_in_links[0] = pos_in_link_1;
+		_pos_in_links[1] = pos_in_link_2;
+		_constrained_rotations[0] = constrained_rotations_1;
+		_constrained_rotations[1] = constrained_rotations_2;
+		_f_contacts = true;
+	}
+
+	// robot step : updateModel(), the contact quantities and robot_job(i) for the two robots
+	// in parallel. coupled step : the object space task model and coupled_job(). nullspace
+	// step : nullspace_job(i) for the two robots in parallel
+	template<typename RobotJob, typename CoupledJob, typename NullspaceJob>
+	void update(RobotJob& robot_job, CoupledJob& coupled_job, NullspaceJob& nullspace_job)
+	{
+		auto robot_step = [this, &robot_job](const int i)
+		{
+			updateRobot(i);
+			robot_job(i);
+		};
+		_pool.forEach(2, robot_step);
+
+		updateObjectModel();
+		coupled_job();
+
+		_pool.forEach(2, nullspace_job);
+	}
+
+	template<typename RobotJob, typename CoupledJob>
+	void update(RobotJob& robot_job, CoupledJob& coupled_job)
+	{
+		auto no_job = [](const int) {};
+		update(robot_job, coupled_job, no_job);
+	}
+
+	void update()
+	{
+		auto no_robot_job = [](const int) {};
+		auto no_coupled_job = []() {};
+		update(no_robot_job, no_coupled_job, no_robot_job);
+	}
+
+	// contact jacobian of robot i in world frame, its rows (v, w)
+	const Eigen::MatrixXd& contactJacobian(const int i) const { return _contact_jacobians[i]; }
+	// J_c M^-1 J_c^T of robot i
+	const Eigen::Matrix<double,6,6>& contactInverseInertia(const int i) const { return _contact_inverse_inertias[i]; }
+	const std::vector<Eigen::Vector3d>& contactLocations() const { return _contact_locations; }
+
+	const Eigen::MatrixXd& graspMatrix() const { return _G; }
+	const Eigen::MatrixXd& graspMatrixInverse() const { return _G_inv; }
+	const Eigen::Matrix3d& graspFrame() const { return _R_g; }
+	const Eigen::Vector3d& geometricCenter() const { return _geometric_center; }
+
+	// columns of robot i of the object space jacobian
+	const Eigen::MatrixXd& objectJacobian(const int i) const { return _object_jacobians[i]; }
+	const Eigen::MatrixXd& objectLambda() const { return _Lambda; }
+	// rows of robot i of the object space Jbar
+	const Eigen::MatrixXd& objectJbar(const int i) const { return _object_Jbar[i]; }
+	// nullspace of the two robots, robot 1 first
+	const Eigen::MatrixXd& objectNullspace() const { return _N; }
+	Eigen::Block<const Eigen::MatrixXd> objectNullspace(const int i) const
+	{
+		return _N.block(i * _dof[0], i * _dof[0], _dof[i], _dof[i]);
+	}
+
+private:
+	// on the thread of robot i
+	void updateRobot(const int i)
+	{
+		Sai2Model::Sai2Model* robot = _robots[i];
+		robot->updateModel();
+		if(!_f_contacts)
+		{
+			return;
+		}
+		robot->J_0WorldFrame(_contact_jacobians[i], _links[i], _pos_in_links[i]);
+		robot->positionInWorld(_contact_locations[i], _links[i], _pos_in_links[i]);
+		_M_inv_Jct[i].noalias() = robot->_M_inv * _contact_jacobians[i].transpose();
+		_contact_inverse_inertias[i].noalias() = _contact_jacobians[i] * _M_inv_Jct[i];
+	}
+
+	// the rows of the linear velocity of contact i in J_c and G
+	static int linearRows(const int i) { return 3 * i; }
+	static int angularRows(const int i) { return 6 + 3 * i; }
+
+	void updateObjectModel()
+	{
+		if(!_f_contacts)
+		{
+			return;
+		}
+		Sai2Model::graspMatrixAtGeometricCenter(_G, _R_g, _geometric_center, _contact_locations, _constrained_rotations);
+		_G_lu.compute(_G);
+		_G_inv = _G_lu.inverse();
+
+		// J_r = G^-T J_c, J_c M^-1 J_c^T is block diagonal per robot in (v, w)
+		_Lambda_inv.setZero();
+		for(int i=0 ; i<2 ; i++)
+		{
+			const int v = linearRows(i);
+			const int w = angularRows(i);
+			_object_jacobians[i].noalias() = _G_inv.middleRows(v, 3).transpose() * _contact_jacobians[i].topRows(3);
+			_object_jacobians[i].noalias() += _G_inv.middleRows(w, 3).transpose() * _contact_jacobians[i].bottomRows(3);
+
+			_G_inv_rows_i.resize(6, 12);
+			_G_inv_rows_i.topRows(3) = _G_inv.middleRows(v, 3);
+			_G_inv_rows_i.bottomRows(3) = _G_inv.middleRows(w, 3);
+			_Lambda_inv.noalias() += _G_inv_rows_i.transpose() * _contact_inverse_inertias[i] * _G_inv_rows_i;
+		}
+		_lambda_llt.compute(_Lambda_inv);
+		_Lambda.setIdentity(12, 12);
+		_lambda_llt.solveInPlace(_Lambda);
+
+		// Jbar_r = M^-1 J_c^T G^-1 Lambda_r, N_r = I - Jbar_r J_r
+		_G_inv_Lambda.noalias() = _G_inv * _Lambda;
+		for(int i=0 ; i<2 ; i++)
+		{
+			_object_Jbar[i].noalias() = _M_inv_Jct[i].leftCols(3) * _G_inv_Lambda.middleRows(linearRows(i), 3);
+			_object_Jbar[i].noalias() += _M_inv_Jct[i].rightCols(3) * _G_inv_Lambda.middleRows(angularRows(i), 3);
+		}
+		_N.setIdentity();
+		for(int i=0 ; i<2 ; i++)
+		{
+			for(int j=0 ; j<2 ; j++)
+			{
+				_N.block(i * _dof[0], j * _dof[0], _dof[i], _dof[j]).noalias() -= _object_Jbar[i] * _object_jacobians[j];
+			}
+		}
+	}
+
+	WorkerPool& _pool;
+	Sai2Model::Sai2Model* _robots[2];
+	int _dof[2];
+	int _dof_total;
+
+	bool _f_contacts;
+	std::string _links[2];
+	Eigen::Vector3d _pos_in_links[2];
+
+	// written by the thread of each robot
+	Eigen::MatrixXd _contact_jacobians[2];
+	Eigen::MatrixXd _M_inv_Jct[2];
+	Eigen::Matrix<double,6,6> _contact_inverse_inertias[2];
+	std::vector<Eigen::Vector3d> _contact_locations;
+	std::vector<int> _constrained_rotations;
+
+	// coupled step
+	Eigen::MatrixXd _G;
+	Eigen::MatrixXd _G_inv;
+	Eigen::PartialPivLU<Eigen::MatrixXd> _G_lu;
+	Eigen::Matrix3d _R_g;
+	Eigen::Vector3d _geometric_center;
+	Eigen::MatrixXd _G_inv_rows_i;
+	Eigen::MatrixXd _Lambda_inv;
+	Eigen::MatrixXd _Lambda;
+	Eigen::LLT<Eigen::MatrixXd> _lambda_llt;
+	Eigen::MatrixXd _G_inv_Lambda;
+	Eigen::MatrixXd _object_jacobians[2];
+	Eigen::MatrixXd _object_Jbar[2];
+	Eigen::MatrixXd _N;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_MODEL_DUAL_ARM_TASK_PIPELINE_H_
@@ -0,0 +1,148 @@
+#ifndef UTILS_MODEL_FLOATING_BASE_MODEL_H_
+#define UTILS_MODEL_FLOATING_BASE_MODEL_H_
+
+// Mass matrix inverse of an arm on a moving base, from the blocks of the base and of the arm.
+//
+// with the NB joints of the base first (6 virtual joints of a floating base, 1 prismatic
+// joint for the rail of app20) and the NA joints of the arm next, the mass matrix is
+//
+//   M = | M_bb  M_ba |       M_bb the composite rigid body inertia of the whole robot
+//       | M_ab  M_aa |       seen from the base, M_aa the mass matrix of the arm alone
+//
+// only the arm block is factorized, and the base through the Schur complement
+//
+//   S = M_bb - M_ba M_aa^-1 M_ab
+//
+// the articulated inertia of the base (the inertia the base feels with the arm joints
+// free), of size NB. with Y = M_aa^-1 M_ab, the inverse is
+//
+//   M^-1 = | S^-1          -S^-1 Y^T                |
+//          | -Y S^-1       M_aa^-1 + Y S^-1 Y^T      |
+//
+// all the sizes known at compile time, the products are unrolled and nothing is allocated.
+// it replaces the generic inverse of updateInverseInertia() after the kinematics update :
+//
+//   PandaUtils::FloatingBaseModel<1,7> floating_base_model;        // app20, rail + panda
+//   robot->updateKinematics();
+//   floating_base_model.update(robot);                            // sets robot->_M_inv
+//   double base_inertia = floating_base_model.articulatedBaseInertia()(0,0);
+//
+// a robot made of several arms on a common trunk, with the arms not coupled to each other,
+// is better served by BlockDiagonalModel (see model/BlockDiagonalModel.h).
+
+#include "Sai2Model.h"
+#include <Eigen/Dense>
+
+#include <stdexcept>
+
+namespace PandaUtils {
+
+template<int NB, int NA>
+class FloatingBaseModel {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	static const int DOF = NB + NA;
+
+	typedef Eigen::Matrix<double, DOF, DOF> MatrixDof;
+	typedef Eigen::Matrix<double, DOF, 1> VectorDof;
+	typedef Eigen::Matrix<double, NB, NB> MatrixBase;
+	typedef Eigen::Matrix<double, NA, NA> MatrixArm;
+	typedef Eigen::Matrix<double, NA, NB> MatrixArmBase;
+
+	FloatingBaseModel()
+	{
+		_composite_inertia.setIdentity();
+		_articulated_inertia.setIdentity();
+		_Y.setZero();
+		_M_inv.setIdentity();
+		_M_aa_inv.setIdentity();
+		_S_inv.setIdentity();
+	}
+
+	template<typename Derived>
+	void compute(const Eigen::MatrixBase<Derived>& M)
+	{
+		if(M.rows() != DOF || M.cols() != DOF)
+		{
+			throw std::invalid_argument("mass matrix of the wrong size in FloatingBaseModel::compute()\n");
+		}
+		_composite_inertia = M.template topLeftCorner<NB,NB>();
+
+		_llt_arm.compute(M.template bottomRightCorner<NA,NA>());
+		_Y = _llt_arm.solve(M.template bottomLeftCorner<NA,NB>());
+		_articulated_inertia = _composite_inertia;
+		_articulated_inertia.noalias() -= M.template topRightCorner<NB,NA>() * _Y;
+		_llt_base.compute(_articulated_inertia);
+
+		_S_inv.setIdentity();
+		_llt_base.solveInPlace(_S_inv);
+		_M_aa_inv.setIdentity();
+		_llt_arm.solveInPlace(_M_aa_inv);
+
+		_M_inv.template topLeftCorner<NB,NB>() = _S_inv;
+		_M_inv.template bottomLeftCorner<NA,NB>().noalias() = -_Y * _S_inv;
+		_M_inv.template topRightCorner<NB,NA>() = _M_inv.template bottomLeftCorner<NA,NB>().transpose();
+		_M_inv.template bottomRightCorner<NA,NA>() = _M_aa_inv;
+		_M_inv.template bottomRightCorner<NA,NA>().noalias() -= _M_inv.template bottomLeftCorner<NA,NB>() * _Y.transpose();
+	}
+
+	// from robot->_M of the kinematics update, sets robot->_M_inv
+	void update(Sai2Model::Sai2Model* robot)
+	{
+		if(robot->dof() != DOF)
+		{
+			throw std::invalid_argument("robot dof inconsistent with the model dof in FloatingBaseModel::update()\n");
+		}
+		compute(robot->_M);
+		robot->_M_inv = _M_inv;
+	}
+
+	// M^-1 * tau from the block factorizations, without the inverse
+	VectorDof solve(const VectorDof& tau) const
+	{
+		VectorDof x;
+		const Eigen::Matrix<double, NA, 1> arm = _llt_arm.solve(tau.template tail<NA>());
+		x.template head<NB>() = _llt_base.solve(tau.template head<NB>() - _Y.transpose() * tau.template tail<NA>());
+		x.template tail<NA>() = arm - _Y * x.template head<NB>();
+		return x;
+	}
+
+	const MatrixDof& inverse() const
+	{
+		return _M_inv;
+	}
+
+	// M_bb, inertia of the whole robot with the arm joints locked
+	const MatrixBase& compositeBaseInertia() const
+	{
+		return _composite_inertia;
+	}
+
+	// S, inertia of the base with the arm joints free
+	const MatrixBase& articulatedBaseInertia() const
+	{
+		return _articulated_inertia;
+	}
+
+	// M_aa^-1 M_ab, the arm joint accelerations per unit base acceleration, with a minus sign
+	const MatrixArmBase& armCoupling() const
+	{
+		return _Y;
+	}
+
+private:
+
+	MatrixBase _composite_inertia;
+	MatrixBase _articulated_inertia;
+	MatrixArmBase _Y;
+	Eigen::LLT<MatrixArm> _llt_arm;
+	Eigen::LLT<MatrixBase> _llt_base;
+	MatrixArm _M_aa_inv;
+	MatrixBase _S_inv;
+	MatrixDof _M_inv;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_MODEL_FLOATING_BASE_MODEL_H_
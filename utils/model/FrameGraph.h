@@ -0,0 +1,264 @@
+#ifndef UTILS_MODEL_FRAME_GRAPH_H_
+#define UTILS_MODEL_FRAME_GRAPH_H_
+
+// Tree of rigid frames with cached transforms to world, recomputed only below the links
+// that changed.
+//
+// every frame has a parent and the transform from the parent, T_parent_frame, constant
+// for a robot base or a sensor mount and set every cycle for a link that moves. the
+// transform of a frame to world is composed lazily when it is asked, and kept with the
+// version of the local transform and of the parent it was composed from : a query walks up
+// to the root comparing versions, and only the frames whose own transform or an ancestor
+// changed since the last query are composed again. the inverse transforms are cached the
+// same way, so a relative transform between two frames is one product once their world
+// transforms are up to date :
+//
+//   PandaUtils::FrameGraph frames;
+//   const int bonnie_base = frames.addFrame("bonnie_base", "world", T_world_bonnie);
+//   const int bonnie_ee = frames.addFrame("bonnie_ee", bonnie_base);
+//   const int camera = frames.addFrame("camera", bonnie_ee, T_ee_camera);
+//   const int clyde_base = frames.addFrame("clyde_base", "world", T_world_clyde);
+//   const int clyde_ee = frames.addFrame("clyde_ee", clyde_base);
+//   while(...) {
+//       robot->transform(T_bonnie_ee, link_name);
+//       frames.setTransform(bonnie_ee, T_bonnie_ee);
+//       ...
+//       Eigen::Affine3d T_camera_clyde_ee = frames.transform(camera, clyde_ee);
+//   }
+//
+// the transforms are rigid (the inverses are computed as isometries). the frames are
+// added at setup in any order of the tree, a parent before its children, and looked up
+// by id in the loops. not thread safe : one thread sets and queries the frames.
+
+#include <Eigen/Dense>
+#include <Eigen/StdVector>
+
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace PandaUtils {
+
+class FrameGraph {
+public:
+
+	static const int WORLD = 0;
+
+	FrameGraph(const std::string& world_name = "world")
+	: _stamp(1),
+	  _n_compositions(0)
+	{
+		Frame world;
+		world.name = world_name;
+		world.parent = -1;
+		world.T_parent_frame.setIdentity();
+		world.local_stamp = 1;
+		world.T_world_frame.setIdentity();
+		world.world_stamp = 1;
+		world.composed_local_stamp = 1;
+		world.composed_parent_stamp = 0;
+		world.T_frame_world.setIdentity();
+		world.inverse_stamp = 1;
+		_frames.push_back(world);
+		_ids[world_name] = WORLD;
+	}
+
+	// returns the id of the new frame
+	int addFrame(const std::string& name, const int parent,
+			const Eigen::Affine3d& T_parent_frame = Eigen::Affine3d::Identity())
+	{
+		if(_ids.count(name))
+		{
+			throw std::invalid_argument("frame " + name + " already exists in FrameGraph::addFrame()\n");
+		}
+		if(parent < 0 || parent >= (int)_frames.size())
+		{
+			throw std::invalid_argument("unknown parent of frame " + name + " in FrameGraph::addFrame()\n");
+		}
+		Frame frame;
+		frame.name = name;
+		frame.parent = parent;
+		frame.T_parent_frame = T_parent_frame;
+		frame.local_stamp = ++_stamp;
+		frame.T_world_frame.setIdentity();
+		frame.world_stamp = 0;
+		frame.composed_local_stamp = 0;
+		frame.composed_parent_stamp = 0;
+		frame.T_frame_world.setIdentity();
+		frame.inverse_stamp = 0;
+		_frames.push_back(frame);
+		_ids[name] = _frames.size() - 1;
+		return _frames.size() - 1;
+	}
+
+	int addFrame(const std::string& name, const std::string& parent_name,
+			const Eigen::Affine3d& T_parent_frame = Eigen::Affine3d::Identity())
+	{
+		return addFrame(name, id(parent_name), T_parent_frame);
+	}
+
+	int id(const std::string& name) const
+	{
+		std::unordered_map<std::string, int>::const_iterator it = _ids.find(name);
+		if(it == _ids.end())
+		{
+			throw std::invalid_argument("unknown frame " + name + " in FrameGraph::id()\n");
+		}
+		return it->second;
+	}
+
+	const std::string& name(const int id) const
+	{
+		return frame(id).name;
+	}
+
+	int parent(const int id) const
+	{
+		return frame(id).parent;
+	}
+
+	int size() const
+	{
+		return _frames.size();
+	}
+
+	// new transform of the frame in its parent, the frame and all the frames below it are
+	// composed again at their next query
+	void setTransform(const int id, const Eigen::Affine3d& T_parent_frame)
+	{
+		if(id == WORLD)
+		{
+			throw std::invalid_argument("world frame cannot be moved in FrameGraph::setTransform()\n");
+		}
+		Frame& f = frame(id);
+		f.T_parent_frame = T_parent_frame;
+		f.local_stamp = ++_stamp;
+	}
+
+	const Eigen::Affine3d& localTransform(const int id) const
+	{
+		return frame(id).T_parent_frame;
+	}
+
+	// T_world_frame
+	const Eigen::Affine3d& worldTransform(const int id)
+	{
+		frame(id);
+		compose(id);
+		return _frames[id].T_world_frame;
+	}
+
+	// T_frame_world
+	const Eigen::Affine3d& inverseWorldTransform(const int id)
+	{
+		frame(id);
+		compose(id);
+		Frame& f = _frames[id];
+		if(f.inverse_stamp != f.world_stamp)
+		{
+			f.T_frame_world = f.T_world_frame.inverse(Eigen::Isometry);
+			f.inverse_stamp = f.world_stamp;
+		}
+		return f.T_frame_world;
+	}
+
+	// T_from_to, the pose of frame to in frame from
+	Eigen::Affine3d transform(const int from, const int to)
+	{
+		if(from == WORLD)
+		{
+			return worldTransform(to);
+		}
+		if(to == WORLD)
+		{
+			return inverseWorldTransform(from);
+		}
+		return inverseWorldTransform(from) * worldTransform(to);
+	}
+
+	// changes every time the world transform of the frame is composed again, e.g. to know
+	// whether a value computed from it is still valid
+	unsigned long version(const int id)
+	{
+		frame(id);
+		compose(id);
+		return _frames[id].world_stamp;
+	}
+
+	// number of transforms composed since the construction
+	unsigned long compositions() const
+	{
+		return _n_compositions;
+	}
+
+private:
+
+	struct Frame
+	{
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+		std::string name;
+		int parent;
+		Eigen::Affine3d T_parent_frame;
+		unsigned long local_stamp;
+
+		Eigen::Affine3d T_world_frame;
+		// new value every time T_world_frame is composed
+		unsigned long world_stamp;
+		// versions of the local transform and of the parent T_world_frame was composed from
+		unsigned long composed_local_stamp;
+		unsigned long composed_parent_stamp;
+
+		Eigen::Affine3d T_frame_world;
+		// world_stamp the inverse was computed from
+		unsigned long inverse_stamp;
+	};
+
+	Frame& frame(const int id)
+	{
+		if(id < 0 || id >= (int)_frames.size())
+		{
+			throw std::out_of_range("unknown frame id in FrameGraph\n");
+		}
+		return _frames[id];
+	}
+
+	const Frame& frame(const int id) const
+	{
+		if(id < 0 || id >= (int)_frames.size())
+		{
+			throw std::out_of_range("unknown frame id in FrameGraph\n");
+		}
+		return _frames[id];
+	}
+
+	// the parents have smaller ids, so the ancestors are up to date before their children
+	void compose(const int id)
+	{
+		Frame& f = _frames[id];
+		if(f.parent < 0)
+		{
+			return;
+		}
+		compose(f.parent);
+		const Frame& p = _frames[f.parent];
+		if(f.composed_local_stamp != f.local_stamp || f.composed_parent_stamp != p.world_stamp)
+		{
+			f.T_world_frame = p.T_world_frame * f.T_parent_frame;
+			f.composed_local_stamp = f.local_stamp;
+			f.composed_parent_stamp = p.world_stamp;
+			f.world_stamp = ++_stamp;
+			_n_compositions++;
+		}
+	}
+
+	std::vector<Frame, Eigen::aligned_allocator<Frame>> _frames;
+	std::unordered_map<std::string, int> _ids;
+	unsigned long _stamp;
+	unsigned long _n_compositions;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_MODEL_FRAME_GRAPH_H_
@@ -0,0 +1,182 @@
+#ifndef UTILS_MODEL_GRASP_CANDIDATE_EVALUATOR_H_
+#define UTILS_MODEL_GRASP_CANDIDATE_EVALUATOR_H_
+
+// Offline scores of many grasp poses of an arm, to only try the best ones on the robot.
+//
+// a candidate is a desired pose of the hand link in world frame and the normal of the
+// object surface at the grasp. the pose is reached by a 3 point inverse kinematics on a
+// BatchIK (see model/BatchIK.h, a model copy per thread) : the control point of the link,
+// and two points at point_distance along its x and y axes, so that the residual of the
+// 3 points measures both the position and the orientation error. every candidate gets :
+//
+//   reachable            the residual is below the tolerance of the BatchIK
+//   joint_limit_margin   smallest distance to a joint limit in the solution, as a fraction
+//                        of the range (0.5 in the middle of all the ranges)
+//   alignment            cosine between the approach axis of the hand and the inward
+//                        normal of the surface, 1 when the hand comes straight at it
+//   score                margin_weight * joint_limit_margin + alignment_weight * alignment
+//
+// and the candidates are returned ranked, the reachable ones first by decreasing score,
+// then the others by increasing residual :
+//
+//   PandaUtils::GraspCandidateEvaluator evaluator(robot_file, 4, "link7", pos_in_link, q_min, q_max);
+//   evaluator.setInitialGuess(robot->_q);
+//   std::vector<PandaUtils::GraspCandidate> candidates = ...;
+//   std::vector<PandaUtils::GraspCandidateEvaluator::Score> ranked = evaluator.evaluate(candidates);
+//   ... candidates[ranked[0].index] is the one to try first, ranked[0].q its joint configuration
+
+#include "model/BatchIK.h"
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+struct GraspCandidate {
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	// of the control point and of the link frame, in world
+	Eigen::Vector3d position;
+	Eigen::Matrix3d orientation;
+	// of the object surface at the grasp, in world, pointing out of the object
+	Eigen::Vector3d contact_normal;
+};
+
+class GraspCandidateEvaluator {
+public:
+
+	struct Score
+	{
+		// index of the candidate in the candidates given to evaluate()
+		int index;
+		Eigen::VectorXd q;
+		double residual;
+		bool reachable;
+		double joint_limit_margin;
+		double alignment;
+		double score;
+	};
+
+	GraspCandidateEvaluator(const std::string& robot_file, const int n_threads,
+			const std::string& link_name, const Eigen::Vector3d& pos_in_link,
+			const Eigen::VectorXd& q_min, const Eigen::VectorXd& q_max,
+			const Eigen::Vector3d& approach_axis_in_link = Eigen::Vector3d::UnitZ(),
+			const double point_distance = 0.05, const double residual_tolerance = 2e-3)
+	: _batch_ik(robot_file, n_threads,
+			std::vector<std::string>(3, link_name),
+			orientationPoints(pos_in_link, point_distance),
+			q_min, q_max, Eigen::VectorXd::Ones(q_min.size()),
+			64, 0.03, residual_tolerance),
+	  _pos_in_link(pos_in_link),
+	  _approach_axis_in_link(approach_axis_in_link.normalized()),
+	  _point_distance(point_distance),
+	  _residual_tolerance(residual_tolerance),
+	  _margin_weight(1.0),
+	  _alignment_weight(1.0)
+	{
+		if(point_distance <= 0)
+		{
+			throw std::invalid_argument("point distance should be positive in GraspCandidateEvaluator::GraspCandidateEvaluator()\n");
+		}
+	}
+
+	// the solutions start from q when no close candidate was solved before, e.g. the
+	// current configuration of the robot
+	void setInitialGuess(const Eigen::VectorXd& q)
+	{
+		if(q.size() != _batch_ik.dof())
+		{
+			throw std::invalid_argument("initial guess should be of size dof in GraspCandidateEvaluator::setInitialGuess()\n");
+		}
+		_batch_ik.setInitialGuess([q](const std::vector<Eigen::Vector3d>&, Eigen::VectorXd& q_guess)
+		{
+			q_guess = q;
+		});
+	}
+
+	void setWeights(const double margin_weight, const double alignment_weight)
+	{
+		_margin_weight = margin_weight;
+		_alignment_weight = alignment_weight;
+	}
+
+	// scores of all the candidates, ranked
+	std::vector<Score> evaluate(const std::vector<GraspCandidate>& candidates)
+	{
+		std::vector<std::vector<Eigen::Vector3d>> targets(candidates.size());
+		for(unsigned int i=0 ; i<candidates.size() ; i++)
+		{
+			const GraspCandidate& candidate = candidates[i];
+			targets[i].push_back(candidate.position);
+			targets[i].push_back(candidate.position + _point_distance * candidate.orientation.col(0));
+			targets[i].push_back(candidate.position + _point_distance * candidate.orientation.col(1));
+		}
+		const std::vector<BatchIK::Solution> solutions = _batch_ik.solve(targets);
+
+		std::vector<Score> scores(solutions.size());
+		for(unsigned int k=0 ; k<solutions.size() ; k++)
+		{
+			const BatchIK::Solution& solution = solutions[k];
+			const GraspCandidate& candidate = candidates[solution.index];
+			Score& score = scores[k];
+			score.index = solution.index;
+			score.q = solution.q;
+			score.residual = solution.residual;
+			score.reachable = solution.residual <= _residual_tolerance;
+			score.joint_limit_margin = solution.joint_limit_margin;
+			score.alignment = -(candidate.orientation * _approach_axis_in_link).dot(candidate.contact_normal.normalized());
+			score.score = _margin_weight * score.joint_limit_margin + _alignment_weight * score.alignment;
+		}
+
+		std::stable_sort(scores.begin(), scores.end(), [](const Score& a, const Score& b)
+		{
+			if(a.reachable != b.reachable)
+			{
+				return a.reachable;
+			}
+			if(a.reachable)
+			{
+				return a.score > b.score;
+			}
+			return a.residual < b.residual;
+		});
+		return scores;
+	}
+
+	int dof() const
+	{
+		return _batch_ik.dof();
+	}
+
+	// forgets the previous solutions, e.g. when the object moved
+	void clearCache()
+	{
+		_batch_ik.clearCache();
+	}
+
+private:
+
+	static std::vector<Eigen::Vector3d> orientationPoints(const Eigen::Vector3d& pos_in_link, const double point_distance)
+	{
+		std::vector<Eigen::Vector3d> points;
+		points.push_back(pos_in_link);
+		points.push_back(pos_in_link + point_distance * Eigen::Vector3d::UnitX());
+		points.push_back(pos_in_link + point_distance * Eigen::Vector3d::UnitY());
+		return points;
+	}
+
+	BatchIK _batch_ik;
+	Eigen::Vector3d _pos_in_link;
+	Eigen::Vector3d _approach_axis_in_link;
+	double _point_distance;
+	double _residual_tolerance;
+	double _margin_weight;
+	double _alignment_weight;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_MODEL_GRASP_CANDIDATE_EVALUATOR_H_
@@ -0,0 +1,426 @@
+#ifndef UTILS_MODEL_HAND_EYE_CALIBRATION_H_
+#define UTILS_MODEL_HAND_EYE_CALIBRATION_H_
+
+// Hand-eye calibration of a camera fixed in the robot base frame, looking at a marker held
+// by a link of the robot, from pairs of link poses (robot model) and marker poses (camera).
+//
+// with B_i the pose of the link in the base frame and C_i the pose of the marker in the
+// camera frame, the unknown camera pose X in the base and marker pose Y in the link are
+// such that B_i Y = X C_i for every sample. between two samples, X cancels :
+//
+//   (B_j^-1 B_i) Y = Y (C_j^-1 C_i)           the AX = XB form, for Y
+//
+// solve() runs three stages, the first and the last on all the threads of a WorkerPool :
+//
+//   - RANSAC : hypotheses from 3 random samples, each solved with the linear solution below,
+//     scored by the samples they explain within inlier_translation and inlier_angle,
+//   - linear solution on the inliers of the best hypothesis, batched over all their pairs :
+//     the rotation of Y from the rotation vectors (Procrustes), its translation from the
+//     stacked normal equations of (R_A - I) t_Y = R_Y t_B - t_A, and X the mean of
+//     B_i Y C_i^-1,
+//   - Gauss-Newton refinement of X and Y together on B_i Y = X C_i over the inliers, the
+//     residuals scaled by the inlier thresholds, the normal equations summed per thread,
+//
+// then classifies the samples again with the refined solution :
+//
+//   PandaUtils::HandEyeCalibration calibration;
+//   calibration.addSample(T_base_link, T_camera_marker);         // for every pose
+//   ...
+//   PandaUtils::HandEyeResult result = calibration.solve();
+//   if(result.success) { ... result.T_base_camera, result.T_link_marker ... }
+//
+// the samples should turn the link about different axes, a sequence of rotations about a
+// single axis does not determine the translation along it.
+
+#include "random/Xoshiro256.h"
+#include "threads/WorkerPool.h"
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace PandaUtils {
+
+struct HandEyeOptions
+{
+	int ransac_iterations;
+	// m and rad, for a sample to be explained by a solution
+	double inlier_translation;
+	double inlier_angle;
+	int refine_iterations;
+	uint64_t seed;
+
+	HandEyeOptions()
+	: ransac_iterations(1000),
+	  inlier_translation(0.005),
+	  inlier_angle(M_PI / 180.0),
+	  refine_iterations(30),
+	  seed(1)
+	{}
+};
+
+struct HandEyeResult
+{
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	bool success;
+	std::string error;
+	Eigen::Affine3d T_base_camera;
+	Eigen::Affine3d T_link_marker;
+	std::vector<bool> inliers;
+	int n_inliers;
+	// over the inliers, of B_i Y against X C_i
+	double rms_translation;
+	double rms_angle;
+
+	HandEyeResult()
+	: success(false),
+	  T_base_camera(Eigen::Affine3d::Identity()),
+	  T_link_marker(Eigen::Affine3d::Identity()),
+	  n_inliers(0),
+	  rms_translation(0),
+	  rms_angle(0)
+	{}
+};
+
+class HandEyeCalibration {
+public:
+
+	typedef Eigen::Matrix<double, 12, 1> Vector12d;
+	typedef Eigen::Matrix<double, 12, 12> Matrix12d;
+	typedef Eigen::Matrix<double, 6, 1> Vector6d;
+
+	// n_threads counts the calling thread, 0 for the number of cores
+	HandEyeCalibration(const int n_threads = 0)
+	: _pool(n_threads > 0 ? n_threads : std::max(1u, std::thread::hardware_concurrency()))
+	{}
+
+	// B_i and C_i
+	void addSample(const Eigen::Affine3d& T_base_link, const Eigen::Affine3d& T_camera_marker)
+	{
+		_B.push_back(T_base_link);
+		_C.push_back(T_camera_marker);
+	}
+
+	void clear()
+	{
+		_B.clear();
+		_C.clear();
+	}
+
+	int numSamples() const { return _B.size(); }
+
+	HandEyeResult solve(const HandEyeOptions& options = HandEyeOptions())
+	{
+		HandEyeResult result;
+		const int n = _B.size();
+		if(n < 3)
+		{
+			result.error = "at least 3 samples are needed in HandEyeCalibration::solve()\n";
+			return result;
+		}
+
+		// hypotheses from minimal sets, the best one per thread
+		std::vector<int> best_counts(_pool.size(), -1);
+		std::vector<double> best_costs(_pool.size(), std::numeric_limits<double>::infinity());
+		std::vector<Eigen::Affine3d, Eigen::aligned_allocator<Eigen::Affine3d> > best_X(_pool.size()), best_Y(_pool.size());
+		auto ransac_job = [&](const int index, const int n_threads)
+		{
+			Xoshiro256 rng(options.seed + index);
+			std::vector<int> subset(3);
+			Eigen::Affine3d X, Y;
+			for(int k=index ; k<options.ransac_iterations ; k+=n_threads)
+			{
+				subset[0] = rng() % n;
+				do { subset[1] = rng() % n; } while(subset[1] == subset[0]);
+				do { subset[2] = rng() % n; } while(subset[2] == subset[0] || subset[2] == subset[1]);
+				if(!linearSolve(subset, X, Y))
+				{
+					continue;
+				}
+				double cost = 0;
+				const int count = countInliers(X, Y, options, NULL, &cost);
+				if(count > best_counts[index] || (count == best_counts[index] && cost < best_costs[index]))
+				{
+					best_counts[index] = count;
+					best_costs[index] = cost;
+					best_X[index] = X;
+					best_Y[index] = Y;
+				}
+			}
+		};
+		_pool.run(ransac_job);
+		int best = 0;
+		for(int i=1 ; i<_pool.size() ; i++)
+		{
+			if(best_counts[i] > best_counts[best] || (best_counts[i] == best_counts[best] && best_costs[i] < best_costs[best]))
+			{
+				best = i;
+			}
+		}
+		if(best_counts[best] < 3)
+		{
+			result.error = "no consistent solution, the samples may all turn about one axis in HandEyeCalibration::solve()\n";
+			return result;
+		}
+
+		// all the inliers, linear then refined
+		std::vector<bool> inliers;
+		countInliers(best_X[best], best_Y[best], options, &inliers, NULL);
+		std::vector<int> inlier_indices;
+		for(int i=0 ; i<n ; i++)
+		{
+			if(inliers[i])
+			{
+				inlier_indices.push_back(i);
+			}
+		}
+		Eigen::Affine3d X = best_X[best], Y = best_Y[best];
+		if(!linearSolve(inlier_indices, X, Y))
+		{
+			X = best_X[best];
+			Y = best_Y[best];
+		}
+		refine(inlier_indices, options, X, Y);
+
+		result.n_inliers = countInliers(X, Y, options, &result.inliers, NULL);
+		double squared_translation = 0, squared_angle = 0;
+		for(int i=0 ; i<n ; i++)
+		{
+			if(result.inliers[i])
+			{
+				const Eigen::Affine3d E = (X * _C[i]).inverse() * _B[i] * Y;
+				squared_translation += E.translation().squaredNorm();
+				const double angle = Eigen::AngleAxisd(E.linear()).angle();
+				squared_angle += angle * angle;
+			}
+		}
+		if(result.n_inliers == 0)
+		{
+			result.error = "the refined solution explains no sample in HandEyeCalibration::solve()\n";
+			return result;
+		}
+		result.rms_translation = std::sqrt(squared_translation / result.n_inliers);
+		result.rms_angle = std::sqrt(squared_angle / result.n_inliers);
+		result.T_base_camera = X;
+		result.T_link_marker = Y;
+		result.success = true;
+		return result;
+	}
+
+	// linear solution from the samples of indices, over all their pairs. false if the
+	// rotations do not determine Y (fewer than two independent axes)
+	bool linearSolve(const std::vector<int>& indices, Eigen::Affine3d& X, Eigen::Affine3d& Y) const
+	{
+		// rotation of Y, alpha = R_Y beta for the rotation vectors of the pairs
+		Eigen::Matrix3d H = Eigen::Matrix3d::Zero();
+		for(unsigned int j=0 ; j<indices.size() ; j++)
+		{
+			for(unsigned int i=j+1 ; i<indices.size() ; i++)
+			{
+				const Eigen::Affine3d A = _B[indices[j]].inverse() * _B[indices[i]];
+				const Eigen::Affine3d B = _C[indices[j]].inverse() * _C[indices[i]];
+				H += rotationVector(B.linear()) * rotationVector(A.linear()).transpose();
+			}
+		}
+		Eigen::JacobiSVD<Eigen::Matrix3d> svd(H, Eigen::ComputeFullU | Eigen::ComputeFullV);
+		if(svd.singularValues()(1) < 1e-6 * std::max(1.0, svd.singularValues()(0)))
+		{
+			return false;
+		}
+		Eigen::Matrix3d D = Eigen::Matrix3d::Identity();
+		D(2,2) = (svd.matrixV() * svd.matrixU().transpose()).determinant() > 0 ? 1.0 : -1.0;
+		const Eigen::Matrix3d R_Y = svd.matrixV() * D * svd.matrixU().transpose();
+
+		// translation of Y, normal equations of (R_A - I) t_Y = R_Y t_B - t_A
+		Eigen::Matrix3d N = Eigen::Matrix3d::Zero();
+		Eigen::Vector3d b = Eigen::Vector3d::Zero();
+		for(unsigned int j=0 ; j<indices.size() ; j++)
+		{
+			for(unsigned int i=j+1 ; i<indices.size() ; i++)
+			{
+				const Eigen::Affine3d A = _B[indices[j]].inverse() * _B[indices[i]];
+				const Eigen::Affine3d B = _C[indices[j]].inverse() * _C[indices[i]];
+				const Eigen::Matrix3d M = A.linear() - Eigen::Matrix3d::Identity();
+				N += M.transpose() * M;
+				b += M.transpose() * (R_Y * B.translation() - A.translation());
+			}
+		}
+		Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigen(N);
+		if(eigen.eigenvalues()(0) < 1e-6 * std::max(1.0, eigen.eigenvalues()(2)))
+		{
+			return false;
+		}
+		Y.setIdentity();
+		Y.linear() = R_Y;
+		Y.translation() = N.ldlt().solve(b);
+
+		// X the mean of B_i Y C_i^-1, the rotation projected back on SO(3)
+		Eigen::Matrix3d R_sum = Eigen::Matrix3d::Zero();
+		Eigen::Vector3d t_sum = Eigen::Vector3d::Zero();
+		for(unsigned int k=0 ; k<indices.size() ; k++)
+		{
+			const Eigen::Affine3d X_k = _B[indices[k]] * Y * _C[indices[k]].inverse();
+			R_sum += X_k.linear();
+			t_sum += X_k.translation();
+		}
+		X.setIdentity();
+		X.linear() = closestRotation(R_sum);
+		X.translation() = t_sum / indices.size();
+		return true;
+	}
+
+private:
+
+	static Eigen::Vector3d rotationVector(const Eigen::Matrix3d& R)
+	{
+		const Eigen::AngleAxisd angle_axis(R);
+		return angle_axis.angle() * angle_axis.axis();
+	}
+
+	static Eigen::Matrix3d rotationFromVector(const Eigen::Vector3d& w)
+	{
+		const double angle = w.norm();
+		return (angle > 1e-12) ? Eigen::AngleAxisd(angle, w / angle).toRotationMatrix() : Eigen::Matrix3d::Identity();
+	}
+
+	static Eigen::Matrix3d closestRotation(const Eigen::Matrix3d& M)
+	{
+		Eigen::JacobiSVD<Eigen::Matrix3d> svd(M, Eigen::ComputeFullU | Eigen::ComputeFullV);
+		Eigen::Matrix3d D = Eigen::Matrix3d::Identity();
+		D(2,2) = (svd.matrixU() * svd.matrixV().transpose()).determinant() > 0 ? 1.0 : -1.0;
+		return svd.matrixU() * D * svd.matrixV().transpose();
+	}
+
+	// X and Y moved by the 12 parameters (rotation vector and translation of each), the
+	// rotations on the right
+	static void perturb(const Vector12d& delta, Eigen::Affine3d& X, Eigen::Affine3d& Y)
+	{
+		X.linear() = X.linear() * rotationFromVector(delta.segment<3>(0));
+		X.translation() += delta.segment<3>(3);
+		Y.linear() = Y.linear() * rotationFromVector(delta.segment<3>(6));
+		Y.translation() += delta.segment<3>(9);
+	}
+
+	// mismatch of B_i Y and X C_i, translation over inlier_translation and rotation vector
+	// over inlier_angle
+	Vector6d residual(const int i, const Eigen::Affine3d& X, const Eigen::Affine3d& Y, const HandEyeOptions& options) const
+	{
+		const Eigen::Affine3d E = (X * _C[i]).inverse() * _B[i] * Y;
+		Vector6d r;
+		r.head<3>() = E.translation() / options.inlier_translation;
+		r.tail<3>() = rotationVector(E.linear()) / options.inlier_angle;
+		return r;
+	}
+
+	// samples where both errors are under their threshold, cost the truncated squared error
+	int countInliers(const Eigen::Affine3d& X, const Eigen::Affine3d& Y, const HandEyeOptions& options,
+			std::vector<bool>* inliers, double* cost) const
+	{
+		int count = 0;
+		double total = 0;
+		if(inliers != NULL)
+		{
+			inliers->assign(_B.size(), false);
+		}
+		for(unsigned int i=0 ; i<_B.size() ; i++)
+		{
+			const Vector6d r = residual(i, X, Y, options);
+			const bool f_inlier = r.head<3>().norm() <= 1.0 && r.tail<3>().norm() <= 1.0;
+			if(f_inlier)
+			{
+				count++;
+				if(inliers != NULL)
+				{
+					(*inliers)[i] = true;
+				}
+			}
+			total += std::min(r.squaredNorm(), 2.0);
+		}
+		if(cost != NULL)
+		{
+			*cost = total;
+		}
+		return count;
+	}
+
+	// Gauss-Newton with numerical jacobians, the normal equations of the samples summed on
+	// every thread
+	void refine(const std::vector<int>& indices, const HandEyeOptions& options, Eigen::Affine3d& X, Eigen::Affine3d& Y)
+	{
+		const double step = 1e-6;
+		std::vector<Matrix12d, Eigen::aligned_allocator<Matrix12d> > JtJ(_pool.size());
+		std::vector<Vector12d, Eigen::aligned_allocator<Vector12d> > Jtr(_pool.size());
+		std::vector<double> costs(_pool.size());
+		for(int iteration=0 ; iteration<options.refine_iterations ; iteration++)
+		{
+			auto normal_equations_job = [&](const int index, const int n_threads)
+			{
+				JtJ[index].setZero();
+				Jtr[index].setZero();
+				costs[index] = 0;
+				Eigen::Matrix<double, 6, 12> J;
+				for(unsigned int k=index ; k<indices.size() ; k+=n_threads)
+				{
+					const int i = indices[k];
+					const Vector6d r = residual(i, X, Y, options);
+					for(int p=0 ; p<12 ; p++)
+					{
+						Vector12d delta = Vector12d::Zero();
+						delta(p) = step;
+						Eigen::Affine3d X_plus = X, Y_plus = Y, X_minus = X, Y_minus = Y;
+						perturb(delta, X_plus, Y_plus);
+						perturb(-delta, X_minus, Y_minus);
+						J.col(p) = (residual(i, X_plus, Y_plus, options) - residual(i, X_minus, Y_minus, options)) / (2 * step);
+					}
+					JtJ[index] += J.transpose() * J;
+					Jtr[index] += J.transpose() * r;
+					costs[index] += r.squaredNorm();
+				}
+			};
+			_pool.run(normal_equations_job);
+			Matrix12d H = Matrix12d::Zero();
+			Vector12d g = Vector12d::Zero();
+			double cost = 0;
+			for(int i=0 ; i<_pool.size() ; i++)
+			{
+				H += JtJ[i];
+				g += Jtr[i];
+				cost += costs[i];
+			}
+			// a little damping for the directions the samples do not see
+			H.diagonal() += Vector12d::Constant(1e-9 * std::max(1.0, H.diagonal().maxCoeff()));
+			const Vector12d delta = -H.ldlt().solve(g);
+
+			Eigen::Affine3d X_new = X, Y_new = Y;
+			perturb(delta, X_new, Y_new);
+			double new_cost = 0;
+			for(unsigned int k=0 ; k<indices.size() ; k++)
+			{
+				new_cost += residual(indices[k], X_new, Y_new, options).squaredNorm();
+			}
+			if(!(new_cost < cost))
+			{
+				break;
+			}
+			X = X_new;
+			Y = Y_new;
+			if(cost - new_cost < 1e-12 * cost)
+			{
+				break;
+			}
+		}
+	}
+
+	WorkerPool _pool;
+	std::vector<Eigen::Affine3d, Eigen::aligned_allocator<Eigen::Affine3d> > _B;
+	std::vector<Eigen::Affine3d, Eigen::aligned_allocator<Eigen::Affine3d> > _C;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_MODEL_HAND_EYE_CALIBRATION_H_
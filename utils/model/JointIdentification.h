@@ -0,0 +1,391 @@
+#ifndef UTILS_MODEL_JOINT_IDENTIFICATION_H_
+#define UTILS_MODEL_JOINT_IDENTIFICATION_H_
+
+// Identification of the friction and of the inertia missing from the model of every joint,
+// from an excitation of the joints and a log of the motion.
+//
+// the joints follow MultisineExcitation : a sum of sines per joint, on harmonics of one base
+// frequency that no other joint uses, so the excitations of the joints are uncorrelated over
+// a period. the phases are the ones of Schroeder (low peak to average for a given spectrum),
+// the amplitudes scaled to stay within the position and velocity amplitudes, and a raised
+// cosine window starts and ends the motion at rest :
+//
+//   PandaUtils::MultisineExcitation excitation(7, 10.0, 6, M_PI/12, 0.5);
+//   joint_task->_desired_position = initial_q + excitation.position(time);
+//   joint_task->_desired_velocity = excitation.velocity(time);
+//
+// a joint is then modelled as the torque of the rigid body model plus an armature inertia
+// (the rotor inertia the URDF does not have), viscous and Coulomb friction, and an offset :
+//
+//   tau_i - (M(q) ddq + c(q, dq))_i = armature ddq_i + viscous dq_i + coulomb tanh(dq_i / v_s) + offset
+//
+// which is linear in the 4 parameters of the joint. JointFrictionRegression accumulates the
+// normal equations of one joint a sample at a time and solves them, the joints are
+// independent and can be solved in parallel. the parameters are saved to an xml file read
+// back by JointFrictionModel, that gives the friction torques to add to a controller :
+//
+//   PandaUtils::JointFrictionModel friction_model;
+//   if(!friction_model.load(file)) { ... friction_model.error() ... }
+//   command_torques += friction_model.frictionTorques(robot->_dq);
+
+#include <Eigen/Dense>
+#include <tinyxml2.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+class MultisineExcitation {
+public:
+
+	// n_harmonics sines per joint on harmonics of 1/period, within the position amplitude (rad)
+	// and the velocity amplitude (rad/s) around the initial position, ramp_duration of
+	// window at the start and at the end of duration (0 for no end)
+	MultisineExcitation(const int dof, const double period, const int n_harmonics, const double position_amplitude,
+			const double velocity_amplitude, const double ramp_duration = 2.0, const double duration = 0)
+	: _dof(dof),
+	  _ramp_duration(ramp_duration),
+	  _duration(duration),
+	  _time(-1)
+	{
+		if(dof < 1 || period <= 0 || n_harmonics < 1 || position_amplitude <= 0 || velocity_amplitude <= 0)
+		{
+			throw std::invalid_argument("dof, period, harmonics and amplitudes should be positive in MultisineExcitation::MultisineExcitation()\n");
+		}
+		if(ramp_duration < 0 || (duration > 0 && duration < 2 * ramp_duration))
+		{
+			throw std::invalid_argument("ramps longer than the excitation in MultisineExcitation::MultisineExcitation()\n");
+		}
+
+		// joint i on the harmonics i+1, i+1+dof, ... with amplitudes in 1/k, a flat velocity spectrum
+		_omega.setZero(dof, n_harmonics);
+		_amplitude.setZero(dof, n_harmonics);
+		_phase.setZero(dof, n_harmonics);
+		for(int i=0 ; i<dof ; i++)
+		{
+			double position_sum = 0;
+			double velocity_sum = 0;
+			for(int m=0 ; m<n_harmonics ; m++)
+			{
+				const int k = i + 1 + m * dof;
+				_omega(i,m) = 2 * M_PI * k / period;
+				_amplitude(i,m) = 1.0 / k;
+				_phase(i,m) = -M_PI * m * (m + 1) / n_harmonics;
+				position_sum += _amplitude(i,m);
+				velocity_sum += _amplitude(i,m) * _omega(i,m);
+			}
+			// the window adds at most pi/2 / ramp_duration of the position to the velocity
+			const double window_rate = (ramp_duration > 0) ? M_PI / (2 * ramp_duration) : 0;
+			const double scale = std::min(position_amplitude / position_sum,
+					velocity_amplitude / (velocity_sum + window_rate * position_sum));
+			_amplitude.row(i) *= scale;
+		}
+
+		_position.setZero(dof);
+		_velocity.setZero(dof);
+		_acceleration.setZero(dof);
+	}
+
+	// offsets from the initial position, at time from the start of the excitation
+	const Eigen::VectorXd& position(const double time) { update(time); return _position; }
+	const Eigen::VectorXd& velocity(const double time) { update(time); return _velocity; }
+	const Eigen::VectorXd& acceleration(const double time) { update(time); return _acceleration; }
+
+	// past the end of the excitation
+	bool finished(const double time) const
+	{
+		return _duration > 0 && time >= _duration;
+	}
+
+	// highest frequency of the excitation, Hz
+	double maxFrequency() const
+	{
+		return _omega.maxCoeff() / (2 * M_PI);
+	}
+
+private:
+
+	void update(const double time)
+	{
+		if(time == _time)
+		{
+			return;
+		}
+		_time = time;
+
+		// window and its derivatives
+		double w = 1, dw = 0, ddw = 0;
+		double t_ramp = -1;
+		if(time <= 0 || finished(time))
+		{
+			w = 0;
+		}
+		else if(time < _ramp_duration)
+		{
+			t_ramp = time;
+		}
+		else if(_duration > 0 && time > _duration - _ramp_duration)
+		{
+			t_ramp = _duration - time;
+		}
+		if(t_ramp >= 0)
+		{
+			const double a = M_PI / _ramp_duration;
+			const double sign = (time < _ramp_duration) ? 1.0 : -1.0;
+			w = 0.5 * (1 - std::cos(a * t_ramp));
+			dw = sign * 0.5 * a * std::sin(a * t_ramp);
+			ddw = 0.5 * a * a * std::cos(a * t_ramp);
+		}
+
+		for(int i=0 ; i<_dof ; i++)
+		{
+			double s = 0, ds = 0, dds = 0;
+			for(int m=0 ; m<_omega.cols() ; m++)
+			{
+				const double angle = _omega(i,m) * time + _phase(i,m);
+				const double sin_angle = std::sin(angle);
+				const double cos_angle = std::cos(angle);
+				s += _amplitude(i,m) * sin_angle;
+				ds += _amplitude(i,m) * _omega(i,m) * cos_angle;
+				dds -= _amplitude(i,m) * _omega(i,m) * _omega(i,m) * sin_angle;
+			}
+			_position(i) = w * s;
+			_velocity(i) = dw * s + w * ds;
+			_acceleration(i) = ddw * s + 2 * dw * ds + w * dds;
+		}
+	}
+
+	const int _dof;
+	const double _ramp_duration;
+	const double _duration;
+	Eigen::MatrixXd _omega;
+	Eigen::MatrixXd _amplitude;
+	Eigen::MatrixXd _phase;
+
+	double _time;
+	Eigen::VectorXd _position;
+	Eigen::VectorXd _velocity;
+	Eigen::VectorXd _acceleration;
+};
+
+// identified parameters of one joint
+struct JointFrictionParameters
+{
+	// kg.m^2, Nm.s/rad, Nm, Nm
+	double armature;
+	double viscous;
+	double coulomb;
+	double offset;
+	// rad/s, width of the tanh of the Coulomb friction
+	double coulomb_velocity;
+	// of the fit, Nm
+	double rms_residual;
+	int n_samples;
+
+	JointFrictionParameters()
+	: armature(0), viscous(0), coulomb(0), offset(0), coulomb_velocity(0.01), rms_residual(0), n_samples(0)
+	{}
+};
+
+// least squares of the parameters of one joint, from samples of its velocity, acceleration
+// and of the torque not explained by the rigid body model
+class JointFrictionRegression {
+public:
+
+	JointFrictionRegression(const double coulomb_velocity = 0.01)
+	: _coulomb_velocity(coulomb_velocity)
+	{
+		if(coulomb_velocity <= 0)
+		{
+			throw std::invalid_argument("coulomb velocity should be positive in JointFrictionRegression::JointFrictionRegression()\n");
+		}
+		reset();
+	}
+
+	void reset()
+	{
+		_ATA.setZero();
+		_ATy.setZero();
+		_yTy = 0;
+		_n_samples = 0;
+	}
+
+	void addSample(const double dq, const double ddq, const double residual_torque)
+	{
+		const Eigen::Vector4d a = regressor(dq, ddq);
+		_ATA.noalias() += a * a.transpose();
+		_ATy += a * residual_torque;
+		_yTy += residual_torque * residual_torque;
+		_n_samples++;
+	}
+
+	// the samples of another regression of the same joint, e.g. of another thread
+	void merge(const JointFrictionRegression& other)
+	{
+		_ATA += other._ATA;
+		_ATy += other._ATy;
+		_yTy += other._yTy;
+		_n_samples += other._n_samples;
+	}
+
+	JointFrictionParameters solve() const
+	{
+		if(_n_samples < 4)
+		{
+			throw std::runtime_error("not enough samples in JointFrictionRegression::solve()\n");
+		}
+		const Eigen::Vector4d x = _ATA.ldlt().solve(_ATy);
+		JointFrictionParameters parameters;
+		parameters.armature = x(0);
+		parameters.viscous = x(1);
+		parameters.coulomb = x(2);
+		parameters.offset = x(3);
+		parameters.coulomb_velocity = _coulomb_velocity;
+		// |y - A x|^2 = yTy - 2 x.ATy + x.ATA x
+		const double squared_residual = _yTy - 2 * x.dot(_ATy) + x.dot(_ATA * x);
+		parameters.rms_residual = std::sqrt(std::max(0.0, squared_residual) / _n_samples);
+		parameters.n_samples = _n_samples;
+		return parameters;
+	}
+
+	Eigen::Vector4d regressor(const double dq, const double ddq) const
+	{
+		return Eigen::Vector4d(ddq, dq, std::tanh(dq / _coulomb_velocity), 1.0);
+	}
+
+	int numSamples() const { return _n_samples; }
+
+private:
+
+	double _coulomb_velocity;
+	Eigen::Matrix4d _ATA;
+	Eigen::Vector4d _ATy;
+	double _yTy;
+	int _n_samples;
+};
+
+// the parameters of all the joints, saved to and loaded from xml :
+//
+//   <joint_identification>
+//       <joint index="0" armature="..." viscous="..." coulomb="..." offset="..." coulomb_velocity="..." rms_residual="..." samples="..."/>
+//       ...
+//   </joint_identification>
+class JointFrictionModel {
+public:
+
+	JointFrictionModel(const int dof = 0)
+	: _joints(dof)
+	{}
+
+	int dof() const { return _joints.size(); }
+	JointFrictionParameters& joint(const int i) { return _joints.at(i); }
+	const JointFrictionParameters& joint(const int i) const { return _joints.at(i); }
+
+	// viscous and Coulomb friction, to add to the command torques
+	Eigen::VectorXd frictionTorques(const Eigen::VectorXd& dq) const
+	{
+		if(dq.size() != dof())
+		{
+			throw std::invalid_argument("size of dq inconsistent with the model in JointFrictionModel::frictionTorques()\n");
+		}
+		Eigen::VectorXd torques(dof());
+		for(int i=0 ; i<dof() ; i++)
+		{
+			const JointFrictionParameters& p = _joints[i];
+			torques(i) = p.viscous * dq(i) + p.coulomb * std::tanh(dq(i) / p.coulomb_velocity);
+		}
+		return torques;
+	}
+
+	// the armature inertias, to add to the diagonal of a mass matrix
+	Eigen::VectorXd armature() const
+	{
+		Eigen::VectorXd armature(dof());
+		for(int i=0 ; i<dof() ; i++)
+		{
+			armature(i) = _joints[i].armature;
+		}
+		return armature;
+	}
+
+	bool save(const std::string& path) const
+	{
+		std::ofstream file(path);
+		if(!file)
+		{
+			_error = "could not open " + path;
+			return false;
+		}
+		file.precision(9);
+		file << "<?xml version=\"1.0\" ?>\n\n<joint_identification>\n";
+		for(int i=0 ; i<dof() ; i++)
+		{
+			const JointFrictionParameters& p = _joints[i];
+			file << "\t<joint index=\"" << i << "\" armature=\"" << p.armature << "\" viscous=\"" << p.viscous
+					<< "\" coulomb=\"" << p.coulomb << "\" offset=\"" << p.offset << "\" coulomb_velocity=\"" << p.coulomb_velocity
+					<< "\" rms_residual=\"" << p.rms_residual << "\" samples=\"" << p.n_samples << "\"/>\n";
+		}
+		file << "</joint_identification>\n";
+		return true;
+	}
+
+	bool load(const std::string& path)
+	{
+		tinyxml2::XMLDocument doc;
+		doc.LoadFile(path.c_str());
+		if(doc.Error())
+		{
+			_error = "could not load " + path;
+			return false;
+		}
+		const tinyxml2::XMLElement* root = doc.FirstChildElement("joint_identification");
+		if(root == NULL)
+		{
+			_error = path + " is not a joint identification file";
+			return false;
+		}
+		std::vector<JointFrictionParameters> joints;
+		for(const tinyxml2::XMLElement* element = root->FirstChildElement("joint") ; element != NULL ;
+				element = element->NextSiblingElement("joint"))
+		{
+			JointFrictionParameters p;
+			const int index = element->IntAttribute("index", -1);
+			if(index != (int) joints.size() || element->QueryDoubleAttribute("armature", &p.armature) != tinyxml2::XML_SUCCESS
+					|| element->QueryDoubleAttribute("viscous", &p.viscous) != tinyxml2::XML_SUCCESS
+					|| element->QueryDoubleAttribute("coulomb", &p.coulomb) != tinyxml2::XML_SUCCESS
+					|| element->QueryDoubleAttribute("offset", &p.offset) != tinyxml2::XML_SUCCESS)
+			{
+				_error = "joint " + std::to_string(joints.size()) + " missing or incomplete in " + path;
+				return false;
+			}
+			p.coulomb_velocity = element->DoubleAttribute("coulomb_velocity", p.coulomb_velocity);
+			p.rms_residual = element->DoubleAttribute("rms_residual", 0);
+			p.n_samples = element->IntAttribute("samples", 0);
+			if(p.coulomb_velocity <= 0)
+			{
+				_error = "coulomb velocity of joint " + std::to_string(joints.size()) + " should be positive in " + path;
+				return false;
+			}
+			joints.push_back(p);
+		}
+		_joints = joints;
+		return true;
+	}
+
+	const std::string& error() const { return _error; }
+
+private:
+
+	std::vector<JointFrictionParameters> _joints;
+	mutable std::string _error;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_MODEL_JOINT_IDENTIFICATION_H_
@@ -0,0 +1,147 @@
+#ifndef UTILS_MODEL_MASS_MATRIX_INVERSE_H_
+#define UTILS_MODEL_MASS_MATRIX_INVERSE_H_
+
+// Regularization and inverse of the mass matrix read from the robot.
+//
+// on the real robot, the controllers read the mass matrix from the driver, add the
+// inertia regularization on the wrist joints (4 to 6) and invert it every tick.
+// the mass matrix is symmetric positive definite, so it is factorized once with
+// LDLT in preallocated storage and the inverse is solved from the factorization,
+// instead of a general LU inverse that allocates:
+//
+//   PandaUtils::MassMatrixInverse<7> mass_matrix_inverse(dof, inertia_regularization ? 0.07 : 0.0);
+//   ...
+//   robot->updateKinematics();
+//   robot->_M = redis_client.getEigenMatrixJSON(MASSMATRIX_KEY);
+//   mass_matrix_inverse.update(robot);           // regularizes robot->_M and sets robot->_M_inv
+//
+// when only products with the inverse are needed, update(robot, false) skips the
+// inverse and solve() uses the factorization, at about half the cost:
+//
+//   mass_matrix_inverse.update(robot, false);
+//   ddq = mass_matrix_inverse.solve(tau - coriolis - gravity);
+//
+// the factorization only reads the lower triangle of the mass matrix. compute(),
+// update() and solve() into a vector of the right size do not allocate.
+
+#include "Sai2Model.h"
+#include <Eigen/Dense>
+
+#include <stdexcept>
+
+namespace PandaUtils {
+
+template<int DOF = Eigen::Dynamic>
+class MassMatrixInverse {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Matrix<double, DOF, DOF> MatrixDof;
+	typedef Eigen::Matrix<double, DOF, 1> VectorDof;
+	typedef Eigen::Ref<const VectorDof> VectorDofInput;
+
+	// wrist_regularization is added on the diagonal of the joints 4 to dof-1
+	MassMatrixInverse(const int dof, const double wrist_regularization = 0.0)
+	: _dof(dof),
+	  _ldlt(dof)
+	{
+		if(DOF != Eigen::Dynamic && dof != DOF)
+		{
+			throw std::invalid_argument("dof inconsistent with the mass matrix dof in MassMatrixInverse::MassMatrixInverse()\n");
+		}
+		if(wrist_regularization < 0)
+		{
+			throw std::invalid_argument("regularization should be positive in MassMatrixInverse::MassMatrixInverse()\n");
+		}
+
+		_regularization.setZero(dof);
+		for(int i=4 ; i<dof ; i++)
+		{
+			_regularization(i) = wrist_regularization;
+		}
+		_M.setIdentity(dof, dof);
+		_M_inv.setIdentity(dof, dof);
+		_ldlt.compute(_M);
+	}
+
+	// any diagonal regularization
+	void setRegularization(const VectorDofInput& diagonal_regularization)
+	{
+		if(diagonal_regularization.size() != _dof)
+		{
+			throw std::invalid_argument("regularization of the wrong size in MassMatrixInverse::setRegularization()\n");
+		}
+		_regularization = diagonal_regularization;
+	}
+
+	// regularizes M, factorizes it, and computes its inverse if compute_inverse
+	template<typename Derived>
+	void compute(const Eigen::MatrixBase<Derived>& M, const bool compute_inverse = true)
+	{
+		if(M.rows() != _dof || M.cols() != _dof)
+		{
+			throw std::invalid_argument("mass matrix of the wrong size in MassMatrixInverse::compute()\n");
+		}
+		_M = M;
+		_M.diagonal() += _regularization;
+		_ldlt.compute(_M);
+		if(compute_inverse)
+		{
+			_M_inv.setIdentity();
+			_ldlt.solveInPlace(_M_inv);
+		}
+	}
+
+	// regularizes robot->_M in place and sets robot->_M_inv if compute_inverse
+	void update(Sai2Model::Sai2Model* robot, const bool compute_inverse = true)
+	{
+		compute(robot->_M, compute_inverse);
+		robot->_M = _M;
+		if(compute_inverse)
+		{
+			robot->_M_inv = _M_inv;
+		}
+	}
+
+	// M^-1 * rhs from the factorization
+	template<typename Rhs>
+	const Eigen::Solve<Eigen::LDLT<MatrixDof>, Rhs> solve(const Eigen::MatrixBase<Rhs>& rhs) const
+	{
+		return _ldlt.solve(rhs);
+	}
+
+	// regularized mass matrix
+	const MatrixDof& massMatrix() const
+	{
+		return _M;
+	}
+
+	// inverse of the last compute() with compute_inverse
+	const MatrixDof& inverse() const
+	{
+		return _M_inv;
+	}
+
+	const Eigen::LDLT<MatrixDof>& ldlt() const
+	{
+		return _ldlt;
+	}
+
+	const VectorDof& regularization() const
+	{
+		return _regularization;
+	}
+
+private:
+
+	const int _dof;
+
+	VectorDof _regularization;
+	MatrixDof _M;
+	MatrixDof _M_inv;
+	Eigen::LDLT<MatrixDof> _ldlt;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_MODEL_MASS_MATRIX_INVERSE_H_
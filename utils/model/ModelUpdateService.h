@@ -0,0 +1,329 @@
+#ifndef UTILS_MODEL_MODEL_UPDATE_SERVICE_H_
+#define UTILS_MODEL_MODEL_UPDATE_SERVICE_H_
+
+// Robot model updates on their own thread, at a slower rate than the control loop.
+//
+// the control loop pushes its (q, dq) every tick through a triple buffer. a
+// background thread (optionally pinned to a cpu) takes the latest state at the
+// rate of the service, updates its own robot model with it, runs the computations
+// added by the application (jacobians, task models...), and publishes the mass
+// matrix, its inverse, the gravity and coriolis torques and the matrices of the
+// computations as one snapshot through a second triple buffer. the control loop
+// reads the latest snapshot without locking and always gets a consistent model,
+// all of it computed from the same state.
+//
+// for an application that updates its model inline every tick, the multi-rate
+// update is one line in the control loop :
+//
+//   // robot model used only by the model thread
+//   auto model_robot = new Sai2Model::Sai2Model(robot_file, false, T_world_robot);
+//   model_robot->_q = robot->_q;
+//
+//   PandaUtils::ModelUpdateService model_service(model_robot, 200.0);
+//   model_service.start();
+//
+//   while(...) {                                   // control loop
+//       robot->_q = ...;
+//       robot->_dq = ...;
+//       model_service.updateModel(robot);          // instead of robot->updateModel()
+//       ...
+//   }
+//   model_service.stop();
+//
+// updateModel() pushes the state, copies the mass matrix and its inverse of the
+// latest snapshot to the control robot and updates its kinematics at the control
+// rate. the task models are computed by computations on task objects of the model
+// robot, that copy the matrices in the snapshot for the control loop :
+//
+//   auto model_posori_task = new Sai2Primitives::PosOriTask(model_robot, link_name, pos_in_link);
+//   PandaUtils::ModelUpdateService model_service(model_robot, 200.0, 2);
+//   model_service.addComputation([model_posori_task](Sai2Model::Sai2Model* robot,
+//           PandaUtils::ModelUpdateService::Snapshot& snapshot)
+//   {
+//       model_posori_task->updateTaskModel(MatrixXd::Identity(robot->dof(), robot->dof()));
+//       snapshot.matrices[0] = model_posori_task->_Lambda;
+//       snapshot.matrices[1] = model_posori_task->_N;
+//   });
+//   ...
+//   model_service.updateModel(robot);
+//   posori_task->_Lambda = model_service.latestSnapshot().matrices[0];
+//
+// the computations run in the order they were added, all of them before start(),
+// and the robot model is copied to the snapshot after them so that they can modify
+// it (e.g. regularize the mass matrix). pushState(), updateModel() and
+// latestSnapshot() do not allocate.
+
+#include "Sai2Model.h"
+#include "threads/TripleBuffer.h"
+#include <Eigen/Dense>
+
+#include <pthread.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace PandaUtils {
+
+class ModelUpdateService {
+public:
+
+	struct State {
+		State(const int dof = 0)
+		: index(0)
+		{
+			q.setZero(dof);
+			dq.setZero(dof);
+		}
+
+		// number of states pushed before this one
+		unsigned long long index;
+		Eigen::VectorXd q;
+		Eigen::VectorXd dq;
+	};
+
+	struct Snapshot {
+		Snapshot(const int dof = 0, const int n_matrices = 0)
+		: state_index(0), n_updates(0), matrices(n_matrices)
+		{
+			q.setZero(dof);
+			dq.setZero(dof);
+			M.setIdentity(dof, dof);
+			M_inv.setIdentity(dof, dof);
+			gravity.setZero(dof);
+			coriolis.setZero(dof);
+		}
+
+		// index of the state the snapshot was computed from
+		unsigned long long state_index;
+		// 0 for the snapshot published by start()
+		unsigned long long n_updates;
+
+		Eigen::VectorXd q;
+		Eigen::VectorXd dq;
+		Eigen::MatrixXd M;
+		Eigen::MatrixXd M_inv;
+		Eigen::VectorXd gravity;
+		Eigen::VectorXd coriolis;
+
+		// filled by the computations of the application
+		std::vector<Eigen::MatrixXd> matrices;
+	};
+
+	// computes part of the snapshot, the robot model is up to date
+	typedef std::function<void(Sai2Model::Sai2Model*, Snapshot&)> Computation;
+
+	// robot is used (and updated) by the model thread only. the first snapshot is
+	// computed from its current configuration, so that the model is valid before start()
+	ModelUpdateService(Sai2Model::Sai2Model* robot, const double frequency, const int n_matrices = 0)
+	: _robot(robot),
+	  _dof(robot->dof()),
+	  _n_matrices(n_matrices),
+	  _period_us(frequency > 0 ? 1e6 / frequency : 0),
+	  _running(false),
+	  _n_pushed(0),
+	  _state(robot->dof()),
+	  _n_updates(0)
+	{
+		if(frequency <= 0)
+		{
+			throw std::invalid_argument("update frequency should be positive in ModelUpdateService::ModelUpdateService()\n");
+		}
+		if(n_matrices < 0)
+		{
+			throw std::invalid_argument("number of matrices should be positive in ModelUpdateService::ModelUpdateService()\n");
+		}
+
+		_state.q = _robot->_q;
+		_state.dq = _robot->_dq;
+		_states.reset(_state);
+		_robot->updateModel();
+
+		Snapshot snapshot(_dof, _n_matrices);
+		fillSnapshot(snapshot);
+		_snapshots.reset(snapshot);
+	}
+
+	~ModelUpdateService()
+	{
+		stop();
+	}
+
+	void addComputation(const Computation& computation)
+	{
+		if(_running)
+		{
+			throw std::runtime_error("computations must be added before start() in ModelUpdateService::addComputation()\n");
+		}
+		_computations.push_back(computation);
+	}
+
+	// cpu < 0 does not pin the thread
+	void start(const int cpu = -1)
+	{
+		if(_running)
+		{
+			return;
+		}
+		// the first snapshot, with the computations and the latest pushed state, is
+		// published before the thread starts
+		_states.update();
+		_state = _states.latest();
+		_robot->_q = _state.q;
+		_robot->_dq = _state.dq;
+		_robot->updateModel();
+
+		Snapshot snapshot(_dof, _n_matrices);
+		snapshot.state_index = _state.index;
+		fillSnapshot(snapshot);
+		_snapshots.reset(snapshot);
+		_n_updates = 0;
+
+		_running = true;
+		_thread = std::thread(&ModelUpdateService::updateLoop, this);
+		if(cpu >= 0)
+		{
+			cpu_set_t cpu_set;
+			CPU_ZERO(&cpu_set);
+			CPU_SET(cpu, &cpu_set);
+			if(pthread_setaffinity_np(_thread.native_handle(), sizeof(cpu_set_t), &cpu_set) != 0)
+			{
+				std::cout << "could not pin the model update thread to cpu " << cpu << std::endl;
+			}
+		}
+	}
+
+	void stop()
+	{
+		if(!_running)
+		{
+			return;
+		}
+		_running = false;
+		_thread.join();
+	}
+
+	// control thread only : state used by the next model update
+	void pushState(const Eigen::VectorXd& q, const Eigen::VectorXd& dq)
+	{
+		State& state = _states.writeBuffer();
+		state.index = _n_pushed;
+		state.q = q;
+		state.dq = dq;
+		_states.publish();
+		_n_pushed++;
+	}
+
+	// control thread only : latest published snapshot, valid until the next call,
+	// applyTo() or updateModel()
+	const Snapshot& latestSnapshot()
+	{
+		return _snapshots.latest();
+	}
+
+	// control thread only : copies the mass matrix and its inverse of the latest snapshot
+	// to robot, returns true if the snapshot is new since the last call
+	bool applyTo(Sai2Model::Sai2Model* robot)
+	{
+		const bool new_snapshot = _snapshots.update();
+		const Snapshot& snapshot = _snapshots.latest();
+		robot->_M = snapshot.M;
+		robot->_M_inv = snapshot.M_inv;
+		return new_snapshot;
+	}
+
+	// control thread only : replaces robot->updateModel() with the q and dq of robot
+	bool updateModel(Sai2Model::Sai2Model* robot)
+	{
+		pushState(robot->_q, robot->_dq);
+		robot->updateKinematics();
+		return applyTo(robot);
+	}
+
+	// control thread only : number of states pushed since the state of the latest snapshot
+	unsigned long long lag()
+	{
+		const unsigned long long state_index = _snapshots.latest().state_index;
+		return _n_pushed > state_index ? _n_pushed - 1 - state_index : 0;
+	}
+
+	int numMatrices() const
+	{
+		return _n_matrices;
+	}
+
+private:
+
+	void updateLoop()
+	{
+		std::chrono::steady_clock::time_point next_update = std::chrono::steady_clock::now();
+		while(_running)
+		{
+			if(_states.update())
+			{
+				_state = _states.latest();
+				_robot->_q = _state.q;
+				_robot->_dq = _state.dq;
+				_robot->updateModel();
+
+				Snapshot& snapshot = _snapshots.writeBuffer();
+				snapshot.state_index = _state.index;
+				snapshot.n_updates = ++_n_updates;
+				fillSnapshot(snapshot);
+				_snapshots.publish();
+			}
+
+			// a late update does not make the next ones come faster
+			next_update += std::chrono::microseconds(_period_us);
+			const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if(next_update < now)
+			{
+				next_update = now;
+			}
+			std::this_thread::sleep_until(next_update);
+		}
+	}
+
+	// the robot model is up to date
+	void fillSnapshot(Snapshot& snapshot)
+	{
+		for(unsigned int i=0 ; i<_computations.size() ; i++)
+		{
+			_computations[i](_robot, snapshot);
+		}
+		snapshot.q = _robot->_q;
+		snapshot.dq = _robot->_dq;
+		snapshot.M = _robot->_M;
+		snapshot.M_inv = _robot->_M_inv;
+		_robot->gravityVector(snapshot.gravity);
+		_robot->coriolisForce(snapshot.coriolis);
+	}
+
+	Sai2Model::Sai2Model* _robot;
+	const int _dof;
+	const int _n_matrices;
+	const long _period_us;
+
+	std::vector<Computation> _computations;
+
+	std::atomic<bool> _running;
+	std::thread _thread;
+
+	// owned by the control thread
+	unsigned long long _n_pushed;
+
+	TripleBuffer<State> _states;
+	TripleBuffer<Snapshot> _snapshots;
+
+	// owned by the model thread
+	State _state;
+	unsigned long long _n_updates;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_MODEL_MODEL_UPDATE_SERVICE_H_
@@ -0,0 +1,169 @@
+#ifndef UTILS_MODEL_RANK_ONE_PROJECTOR_H_
+#define UTILS_MODEL_RANK_ONE_PROJECTOR_H_
+
+// Task model of a one dimensional task or constraint, in closed form.
+//
+// the contact driven and bracing apps add a one row task every tick, e.g. along the
+// disturbance torques of the momentum observer (j = gamma^T N_prec) or along the direction
+// to an obstacle. for one row, the operational space matrices are a scalar and a vector :
+//
+//   Lambda = 1 / (j M^-1 j^T)
+//   Jbar = M^-1 j^T Lambda
+//   N = (I - Jbar j) N_prec = N_prec - Jbar (j N_prec)
+//
+// which costs a few dof^2 products in preallocated storage, instead of the dof^3 products,
+// the factorization and the allocations of the general Sai2Model functions :
+//
+//   PandaUtils::RankOneProjector<7> contact_projector(dof);
+//   ...
+//   j_contact = N_prec.transpose() * gamma;
+//   contact_projector.compute(robot->_M_inv, j_contact, N_prec);   // same as robot->operationalSpaceMatrices(Lambda, Jbar, N, j_contact^T, N_prec)
+//   F_contact = contact_projector.lambda() * ...;
+//   contact_projector.project(N_prec);                             // N_prec = N_prec * N
+//
+// the jacobian is given as a vector (j^T) or a 1 x dof matrix. when j M^-1 j^T is below
+// min_inverse_lambda (e.g. j is zero, or in the nullspace of N_prec), the task has no
+// dimension left : Lambda and Jbar are zero and N is N_prec. compute() and project() do not
+// allocate, for dynamic sizes once the projector is constructed.
+
+#include <Eigen/Dense>
+
+#include <stdexcept>
+
+namespace PandaUtils {
+
+template<int DOF = Eigen::Dynamic>
+class RankOneProjector {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Matrix<double, DOF, DOF> MatrixDof;
+	typedef Eigen::Matrix<double, DOF, 1> VectorDof;
+
+	RankOneProjector(const int dof, const double min_inverse_lambda = 1e-10)
+	: _dof(dof),
+	  _min_inverse_lambda(min_inverse_lambda),
+	  _inverse_lambda(0),
+	  _Lambda(0)
+	{
+		if(DOF != Eigen::Dynamic && dof != DOF)
+		{
+			throw std::invalid_argument("dof inconsistent with the projector dof in RankOneProjector::RankOneProjector()\n");
+		}
+		if(min_inverse_lambda < 0)
+		{
+			throw std::invalid_argument("min inverse lambda should be positive in RankOneProjector::RankOneProjector()\n");
+		}
+		_j.setZero(dof);
+		_M_inv_j.setZero(dof);
+		_Jbar.setZero(dof);
+		_j_N_prec.setZero(dof);
+		_N.setIdentity(dof, dof);
+		_product.setZero(dof, dof);
+	}
+
+	// Lambda and Jbar of the jacobian j, the nullspace is not updated
+	template<typename DerivedM, typename DerivedJ>
+	void compute(const Eigen::MatrixBase<DerivedM>& M_inv, const Eigen::MatrixBase<DerivedJ>& j)
+	{
+		if(j.size() != _dof || (j.rows() != 1 && j.cols() != 1))
+		{
+			throw std::invalid_argument("jacobian should be a vector of size dof in RankOneProjector::compute()\n");
+		}
+		if(M_inv.rows() != _dof || M_inv.cols() != _dof)
+		{
+			throw std::invalid_argument("inverse mass matrix of the wrong size in RankOneProjector::compute()\n");
+		}
+		for(int i=0 ; i<_dof ; i++)
+		{
+			_j(i) = j(i);
+		}
+
+		// M^-1 is symmetric, M^-1 j^T is its product with the column j
+		_M_inv_j.noalias() = M_inv * _j;
+		_inverse_lambda = _j.dot(_M_inv_j);
+		_Lambda = _inverse_lambda > _min_inverse_lambda ? 1.0 / _inverse_lambda : 0.0;
+		_Jbar = _Lambda * _M_inv_j;
+	}
+
+	// Lambda, Jbar and the nullspace (I - Jbar j) N_prec
+	template<typename DerivedM, typename DerivedJ, typename DerivedN>
+	void compute(const Eigen::MatrixBase<DerivedM>& M_inv, const Eigen::MatrixBase<DerivedJ>& j,
+			const Eigen::MatrixBase<DerivedN>& N_prec)
+	{
+		if(N_prec.rows() != _dof || N_prec.cols() != _dof)
+		{
+			throw std::invalid_argument("nullspace of the previous tasks of the wrong size in RankOneProjector::compute()\n");
+		}
+		compute(M_inv, j);
+		_j_N_prec.noalias() = N_prec.transpose() * _j;
+		_N = N_prec;
+		_N.noalias() -= _Jbar * _j_N_prec.transpose();
+	}
+
+	// N = N * nullspace(), e.g. the nullspace of the previous tasks for the next ones
+	template<typename Derived>
+	void project(Eigen::MatrixBase<Derived>& N)
+	{
+		if(N.rows() != _dof || N.cols() != _dof)
+		{
+			throw std::invalid_argument("nullspace of the wrong size in RankOneProjector::project()\n");
+		}
+		_product.noalias() = N * _N;
+		N = _product;
+	}
+
+	// false if the task had no dimension left at the last compute()
+	bool active() const
+	{
+		return _Lambda > 0;
+	}
+
+	double lambda() const
+	{
+		return _Lambda;
+	}
+
+	// j M^-1 j^T
+	double inverseLambda() const
+	{
+		return _inverse_lambda;
+	}
+
+	// Jbar, dof x 1
+	const VectorDof& jbar() const
+	{
+		return _Jbar;
+	}
+
+	// nullspace of the last compute() with N_prec
+	const MatrixDof& nullspace() const
+	{
+		return _N;
+	}
+
+	// j^T
+	const VectorDof& jacobian() const
+	{
+		return _j;
+	}
+
+private:
+
+	const int _dof;
+	const double _min_inverse_lambda;
+
+	double _inverse_lambda;
+	double _Lambda;
+
+	VectorDof _j;
+	VectorDof _M_inv_j;
+	VectorDof _Jbar;
+	VectorDof _j_N_prec;
+	MatrixDof _N;
+	MatrixDof _product;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_MODEL_RANK_ONE_PROJECTOR_H_
@@ -0,0 +1,116 @@
+#ifndef UTILS_MODEL_TASK_MODEL_CACHE_H_
+#define UTILS_MODEL_TASK_MODEL_CACHE_H_
+
+// Skips the task model updates that would give the same task model.
+//
+// the task model (jacobian, Lambda, Jbar, N) of a task only depends on the robot
+// model and on the nullspace of the tasks above it. the cache remembers the joint
+// positions, the model version and the nullspace of the last update of its task,
+// and calls updateTaskModel() again only when the joints moved by more than
+// q_tolerance, or the model version or the nullspace changed. otherwise the task
+// keeps its last Lambda, Jbar and N :
+//
+//   PandaUtils::TaskModelCache posori_task_model, joint_task_model;
+//   ...
+//   N_prec.setIdentity();
+//   posori_task_model.update(posori_task, robot->_q, N_prec);
+//   N_prec = posori_task->_N;
+//   joint_task_model.update(joint_task, robot->_q, N_prec);     // skipped when the posori update was
+//
+// the model version is any number that changes when the robot model changes for
+// another reason than the joint positions, e.g. the n_updates of the snapshots of a
+// ModelUpdateService, or a change of the inertia regularization. a model that is
+// updated from the current joint positions every tick keeps the version 0.
+//
+// the task model of a skipped update is the one of joint positions at most q_tolerance
+// away, the nullspaces are compared exactly. update() does not allocate once the
+// nullspace size is known.
+
+#include <Eigen/Dense>
+
+#include <stdexcept>
+
+namespace PandaUtils {
+
+class TaskModelCache {
+public:
+
+	TaskModelCache(const double q_tolerance = 1e-4)
+	: _q_tolerance(q_tolerance),
+	  _valid(false),
+	  _model_version(0),
+	  _n_updates(0),
+	  _n_skipped(0)
+	{
+		if(q_tolerance < 0)
+		{
+			throw std::invalid_argument("joint tolerance should be positive in TaskModelCache::TaskModelCache()\n");
+		}
+	}
+
+	// true if the task model should be recomputed for these inputs, which are then
+	// remembered as the ones of the last update
+	bool needsUpdate(const Eigen::VectorXd& q, const Eigen::MatrixXd& N_prec,
+			const unsigned long long model_version = 0)
+	{
+		if(_valid && model_version == _model_version
+				&& q.size() == _q.size() && (q - _q).cwiseAbs().maxCoeff() <= _q_tolerance
+				&& N_prec.rows() == _N_prec.rows() && N_prec.cols() == _N_prec.cols() && N_prec == _N_prec)
+		{
+			_n_skipped++;
+			return false;
+		}
+		_q = q;
+		_N_prec = N_prec;
+		_model_version = model_version;
+		_valid = true;
+		_n_updates++;
+		return true;
+	}
+
+	// task->updateTaskModel(N_prec) if needed, returns true if it was called
+	template<typename Task>
+	bool update(Task* task, const Eigen::VectorXd& q, const Eigen::MatrixXd& N_prec,
+			const unsigned long long model_version = 0)
+	{
+		if(!needsUpdate(q, N_prec, model_version))
+		{
+			return false;
+		}
+		task->updateTaskModel(N_prec);
+		return true;
+	}
+
+	// the next update is not skipped, e.g. after reInitializeTask() or a change of the task frame
+	void invalidate()
+	{
+		_valid = false;
+	}
+
+	unsigned long long numUpdates() const
+	{
+		return _n_updates;
+	}
+
+	unsigned long long numSkipped() const
+	{
+		return _n_skipped;
+	}
+
+private:
+
+	const double _q_tolerance;
+
+	// inputs of the last update
+	bool _valid;
+	Eigen::VectorXd _q;
+	Eigen::MatrixXd _N_prec;
+	unsigned long long _model_version;
+
+	unsigned long long _n_updates;
+	unsigned long long _n_skipped;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_MODEL_TASK_MODEL_CACHE_H_
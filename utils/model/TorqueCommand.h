@@ -0,0 +1,178 @@
+#ifndef UTILS_MODEL_TORQUE_COMMAND_H_
+#define UTILS_MODEL_TORQUE_COMMAND_H_
+
+// Per tick combination of the task torques into the command torques, at a fixed dof.
+//
+// the controllers sum the torques of their tasks, add the coriolis (and gravity in
+// simulation) and remove the compensation torques every tick, in dynamic vectors. the
+// command keeps the sum in fixed size storage for the robot dof (7 for the panda, 9
+// with the gripper, 14 for two arms, 23 for the arm and the Allegro hand), so the sums
+// are unrolled at compile time, and saturates it to the joint torque limits before it
+// is sent :
+//
+//   PandaUtils::TorqueCommand<7> torque_command(PandaUtils::TorqueCommand<7>::VectorDof(joint_torque_limits));
+//   ...
+//   torque_command.sum(posori_task_torques, joint_task_torques, coriolis).subtract(contact_compensation_torques);
+//   torque_command.addJacobianTranspose(J_contact, F_contact);    // + J^T F, without temporary
+//   torque_command.saturate();
+//   torque_command.copyTo(command_torques);                      // dynamic vector of size dof, e.g. for redis
+//
+// the inputs are dynamic or fixed size vectors of size DOF, dynamic inputs are checked.
+// none of the functions allocates or creates an Eigen temporary.
+
+#include <Eigen/Dense>
+
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+namespace PandaUtils {
+
+template<int DOF>
+class TorqueCommand {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	static_assert(DOF > 0, "TorqueCommand needs a fixed dof");
+
+	typedef Eigen::Matrix<double, DOF, 1> VectorDof;
+	typedef Eigen::Matrix<double, DOF, DOF> MatrixDof;
+
+	// no saturation by default
+	TorqueCommand(const VectorDof& torque_limits = VectorDof::Constant(std::numeric_limits<double>::infinity()))
+	: _torque_limits(torque_limits),
+	  _n_saturated(0)
+	{
+		if((torque_limits.array() < 0).any())
+		{
+			throw std::invalid_argument("torque limits should be positive in TorqueCommand::TorqueCommand()\n");
+		}
+		_torques.setZero();
+		_product.setZero();
+	}
+
+	TorqueCommand& reset()
+	{
+		_torques.setZero();
+		_n_saturated = 0;
+		return *this;
+	}
+
+	template<typename Derived>
+	TorqueCommand& add(const Eigen::MatrixBase<Derived>& torques)
+	{
+		checkSize(torques, "add");
+		_torques += torques;
+		return *this;
+	}
+
+	template<typename Derived>
+	TorqueCommand& subtract(const Eigen::MatrixBase<Derived>& torques)
+	{
+		checkSize(torques, "subtract");
+		_torques -= torques;
+		return *this;
+	}
+
+	// torques = first + others..., e.g. sum(posori_task_torques, joint_task_torques, coriolis)
+	template<typename Derived, typename... Others>
+	TorqueCommand& sum(const Eigen::MatrixBase<Derived>& first, const Others&... others)
+	{
+		reset();
+		return addAll(first, others...);
+	}
+
+	// torques += J^T F, for the force and the compensation terms of a task of jacobian J
+	template<typename DerivedJ, typename DerivedF>
+	TorqueCommand& addJacobianTranspose(const Eigen::MatrixBase<DerivedJ>& J, const Eigen::MatrixBase<DerivedF>& F)
+	{
+		if(J.cols() != DOF || F.rows() != J.rows() || F.cols() != 1)
+		{
+			throw std::invalid_argument("jacobian and force of inconsistent sizes in TorqueCommand::addJacobianTranspose()\n");
+		}
+		_product.noalias() = J.transpose() * F;
+		_torques += _product;
+		return *this;
+	}
+
+	// clamps every joint to its torque limit, returns the number of saturated joints
+	int saturate()
+	{
+		_n_saturated = 0;
+		for(int i=0 ; i<DOF ; i++)
+		{
+			if(_torques(i) > _torque_limits(i))
+			{
+				_torques(i) = _torque_limits(i);
+				_n_saturated++;
+			}
+			else if(_torques(i) < -_torque_limits(i))
+			{
+				_torques(i) = -_torque_limits(i);
+				_n_saturated++;
+			}
+		}
+		return _n_saturated;
+	}
+
+	// output of size DOF, resized if it is dynamic and of another size
+	template<typename Derived>
+	void copyTo(Eigen::MatrixBase<Derived>& output) const
+	{
+		output.derived() = _torques;
+	}
+
+	const VectorDof& torques() const
+	{
+		return _torques;
+	}
+
+	VectorDof& torques()
+	{
+		return _torques;
+	}
+
+	const VectorDof& torqueLimits() const
+	{
+		return _torque_limits;
+	}
+
+	// joints saturated by the last saturate()
+	int numSaturated() const
+	{
+		return _n_saturated;
+	}
+
+private:
+
+	TorqueCommand& addAll()
+	{
+		return *this;
+	}
+
+	template<typename Derived, typename... Others>
+	TorqueCommand& addAll(const Eigen::MatrixBase<Derived>& first, const Others&... others)
+	{
+		add(first);
+		return addAll(others...);
+	}
+
+	template<typename Derived>
+	static void checkSize(const Eigen::MatrixBase<Derived>& torques, const char* function)
+	{
+		if(torques.rows() != DOF || torques.cols() != 1)
+		{
+			throw std::invalid_argument(std::string("torques should be a vector of size dof in TorqueCommand::") + function + "()\n");
+		}
+	}
+
+	const VectorDof _torque_limits;
+
+	VectorDof _torques;
+	VectorDof _product;
+	int _n_saturated;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_MODEL_TORQUE_COMMAND_H_
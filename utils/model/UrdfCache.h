@@ -0,0 +1,521 @@
+#ifndef UTILS_MODEL_URDF_CACHE_H_
+#define UTILS_MODEL_URDF_CACHE_H_
+
+// Startup cache of the world files of the simviz apps, with decimated visual meshes.
+//
+// most of the startup time of a simviz goes to the text parsing of the visual meshes of
+// the robots, about 11 MB of obj files for two pandas. the cache writes, once per content
+// of the world file, of its robot files and of their visual meshes, a copy of the robot
+// files whose visual meshes are replaced by decimated ones (vertex clustering), and a
+// world file that loads them. the next launches load the cached world file :
+//
+//   const string world_file = PandaUtils::cachedWorldFile("./resources/world.urdf");
+//   auto graphics = new Sai2Graphics::Sai2Graphics(world_file, false);
+//   auto sim = new Simulation::Sai2Simulation(world_file, false);
+//
+// the cache is in resources/urdf_cache/<hash>/, the cached world file is next to the
+// original one, as it can refer to meshes by relative paths. the collision meshes are
+// not decimated and still read from their files, so the contacts are the same ones.
+// the controllers do not need the cache, Sai2Model does not load meshes.
+//
+// the given world file is returned when the cache can not be written. old caches are
+// not removed, deleting resources/urdf_cache and the *.cache.urdf files is safe.
+
+#include "model/VertexClustering.h"
+
+#include <Eigen/Dense>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+struct UrdfCacheOptions
+{
+	// grid cell of the vertex clustering, as a fraction of the diagonal of the mesh
+	double cell_fraction;
+	bool verbose;
+
+	UrdfCacheOptions() : cell_fraction(0.02), verbose(true) {}
+};
+
+namespace internal {
+
+inline bool readFile(const std::string& filename, std::string& content)
+{
+	std::ifstream file(filename.c_str(), std::ios::binary);
+	if(!file)
+	{
+		return false;
+	}
+	std::ostringstream stream;
+	stream << file.rdbuf();
+	content = stream.str();
+	return true;
+}
+
+inline void writeFile(const std::string& filename, const std::string& content)
+{
+	// written then renamed, for the simviz launched at the same time
+	const std::string temporary = filename + ".tmp" + std::to_string(getpid());
+	{
+		std::ofstream file(temporary.c_str(), std::ios::binary);
+		file << content;
+		if(!file)
+		{
+			throw std::runtime_error("could not write " + temporary + " in cachedWorldFile()\n");
+		}
+	}
+	if(std::rename(temporary.c_str(), filename.c_str()) != 0)
+	{
+		throw std::runtime_error("could not write " + filename + " in cachedWorldFile()\n");
+	}
+}
+
+inline bool fileExists(const std::string& filename)
+{
+	struct stat info;
+	return stat(filename.c_str(), &info) == 0;
+}
+
+inline void makeDirectory(const std::string& directory)
+{
+	if(mkdir(directory.c_str(), 0775) != 0 && !fileExists(directory))
+	{
+		throw std::runtime_error("could not create " + directory + " in cachedWorldFile()\n");
+	}
+}
+
+inline std::string directoryOf(const std::string& filename)
+{
+	const size_t slash = filename.find_last_of('/');
+	return slash == std::string::npos ? std::string(".") : filename.substr(0, slash);
+}
+
+inline std::string stemOf(const std::string& filename)
+{
+	const size_t slash = filename.find_last_of('/');
+	const std::string name = slash == std::string::npos ? filename : filename.substr(slash + 1);
+	const size_t dot = name.find_last_of('.');
+	return dot == std::string::npos ? name : name.substr(0, dot);
+}
+
+// fnv-1a
+inline void hashAppend(uint64_t& hash, const std::string& data)
+{
+	for(unsigned int i=0 ; i<data.size() ; i++)
+	{
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ull;
+	}
+	// separates the consecutive strings
+	hash ^= 0xff;
+	hash *= 1099511628211ull;
+}
+
+// value of the attribute of the tag that starts at tag_start, empty if there is none
+inline std::string attribute(const std::string& xml, const size_t tag_start, const std::string& name,
+		size_t* value_start = NULL)
+{
+	const size_t tag_end = xml.find('>', tag_start);
+	size_t position = tag_start;
+	while(true)
+	{
+		position = xml.find(name + "=\"", position);
+		if(position == std::string::npos || position > tag_end)
+		{
+			return "";
+		}
+		// not the end of another attribute name, e.g. xdir for dir
+		const char before = xml[position - 1];
+		if(before == ' ' || before == '\t' || before == '\n' || before == '\r')
+		{
+			break;
+		}
+		position++;
+	}
+	const size_t start = position + name.size() + 2;
+	const size_t end = xml.find('"', start);
+	if(value_start != NULL)
+	{
+		*value_start = start;
+	}
+	return xml.substr(start, end - start);
+}
+
+// true if the tag at position is inside a <visual> element
+inline bool insideVisual(const std::string& xml, const size_t position)
+{
+	const size_t visual = xml.rfind("<visual", position);
+	const size_t collision = xml.rfind("<collision", position);
+	if(visual == std::string::npos)
+	{
+		return false;
+	}
+	return collision == std::string::npos || visual > collision;
+}
+
+// obj with vertices, normals and faces, the faces between two usemtl use the material
+struct ObjMesh
+{
+	std::string mtllib;
+	std::vector<Eigen::Vector3d> vertices;
+	std::vector<Eigen::Vector3d> normals;
+	// vertex and normal indices of the corners, normal -1 if none
+	std::vector<Eigen::Vector3i> face_vertices;
+	std::vector<Eigen::Vector3i> face_normals;
+	std::vector<int> face_materials;
+	std::vector<std::string> materials;
+};
+
+// triangulated as fans, false for the meshes with texture coordinates
+inline bool parseObj(const std::string& content, ObjMesh& mesh)
+{
+	std::istringstream stream(content);
+	std::string line;
+	int material = -1;
+	std::vector<int> corner_vertices, corner_normals;
+	while(std::getline(stream, line))
+	{
+		if(line.size() < 2)
+		{
+			continue;
+		}
+		if(line[0] == 'v' && line[1] == ' ')
+		{
+			Eigen::Vector3d v;
+			if(std::sscanf(line.c_str() + 2, "%lf %lf %lf", &v(0), &v(1), &v(2)) == 3)
+			{
+				mesh.vertices.push_back(v);
+			}
+		}
+		else if(line[0] == 'v' && line[1] == 'n')
+		{
+			Eigen::Vector3d n;
+			if(std::sscanf(line.c_str() + 3, "%lf %lf %lf", &n(0), &n(1), &n(2)) == 3)
+			{
+				mesh.normals.push_back(n);
+			}
+		}
+		else if(line[0] == 'v' && line[1] == 't')
+		{
+			return false;
+		}
+		else if(line[0] == 'f' && line[1] == ' ')
+		{
+			corner_vertices.clear();
+			corner_normals.clear();
+			std::istringstream corners(line.substr(2));
+			std::string corner;
+			while(corners >> corner)
+			{
+				int v = 0, t = 0, n = 0;
+				if(std::sscanf(corner.c_str(), "%d//%d", &v, &n) == 2
+						|| std::sscanf(corner.c_str(), "%d/%d/%d", &v, &t, &n) == 3)
+				{
+					if(t != 0)
+					{
+						return false;
+					}
+				}
+				else if(std::sscanf(corner.c_str(), "%d", &v) != 1)
+				{
+					continue;
+				}
+				// negative indices count from the last vertex
+				corner_vertices.push_back(v > 0 ? v - 1 : mesh.vertices.size() + v);
+				corner_normals.push_back(n > 0 ? n - 1 : (n < 0 ? (int)mesh.normals.size() + n : -1));
+			}
+			for(unsigned int i=2 ; i<corner_vertices.size() ; i++)
+			{
+				mesh.face_vertices.push_back(Eigen::Vector3i(corner_vertices[0], corner_vertices[i-1], corner_vertices[i]));
+				mesh.face_normals.push_back(Eigen::Vector3i(corner_normals[0], corner_normals[i-1], corner_normals[i]));
+				mesh.face_materials.push_back(material);
+			}
+		}
+		else if(line.compare(0, 7, "usemtl ") == 0)
+		{
+			mesh.materials.push_back(line.substr(7));
+			material = mesh.materials.size() - 1;
+		}
+		else if(line.compare(0, 7, "mtllib ") == 0)
+		{
+			mesh.mtllib = line.substr(7);
+		}
+	}
+	for(unsigned int i=0 ; i<mesh.face_vertices.size() ; i++)
+	{
+		for(int j=0 ; j<3 ; j++)
+		{
+			if(mesh.face_vertices[i](j) < 0 || mesh.face_vertices[i](j) >= (int)mesh.vertices.size()
+					|| mesh.face_normals[i](j) >= (int)mesh.normals.size())
+			{
+				return false;
+			}
+		}
+	}
+	return !mesh.face_vertices.empty();
+}
+
+// vertex clustering (see model/VertexClustering.h), the clusters get the mean of the
+// normals of their vertices
+inline std::string decimatedObj(const ObjMesh& mesh, const double cell_fraction, const std::string& mtllib)
+{
+	Eigen::Vector3d min_corner = mesh.vertices[0];
+	Eigen::Vector3d max_corner = mesh.vertices[0];
+	for(unsigned int i=1 ; i<mesh.vertices.size() ; i++)
+	{
+		min_corner = min_corner.cwiseMin(mesh.vertices[i]);
+		max_corner = max_corner.cwiseMax(mesh.vertices[i]);
+	}
+	const double cell = std::max(cell_fraction * (max_corner - min_corner).norm(), 1e-9);
+
+	VertexClusters clusters;
+	clusterVertices(mesh.vertices, cell, clusters);
+	std::vector<Eigen::Vector3i> faces;
+	std::vector<int> sources;
+	clusterTriangles(clusters, mesh.face_vertices, mesh.face_materials, faces, sources);
+
+	const std::vector<Eigen::Vector3d>& cluster_positions = clusters.positions;
+	std::vector<Eigen::Vector3d> cluster_normals(cluster_positions.size(), Eigen::Vector3d::Zero());
+	for(unsigned int i=0 ; i<mesh.face_vertices.size() ; i++)
+	{
+		for(int j=0 ; j<3 ; j++)
+		{
+			const int normal = mesh.face_normals[i](j);
+			if(normal >= 0)
+			{
+				cluster_normals[clusters.vertex_clusters[mesh.face_vertices[i](j)]] += mesh.normals[normal];
+			}
+		}
+	}
+	std::vector<int> face_materials(faces.size());
+	for(unsigned int i=0 ; i<faces.size() ; i++)
+	{
+		face_materials[i] = mesh.face_materials[sources[i]];
+	}
+
+	std::ostringstream obj;
+	obj.precision(7);
+	obj << "# decimated by cachedWorldFile()\n";
+	if(!mtllib.empty())
+	{
+		obj << "mtllib " << mtllib << "\n";
+	}
+	for(unsigned int i=0 ; i<cluster_positions.size() ; i++)
+	{
+		const Eigen::Vector3d& position = cluster_positions[i];
+		obj << "v " << position(0) << " " << position(1) << " " << position(2) << "\n";
+	}
+	const bool with_normals = !mesh.normals.empty();
+	if(with_normals)
+	{
+		for(unsigned int i=0 ; i<cluster_normals.size() ; i++)
+		{
+			const double norm = cluster_normals[i].norm();
+			const Eigen::Vector3d normal = norm > 0 ? Eigen::Vector3d(cluster_normals[i] / norm) : Eigen::Vector3d::UnitZ();
+			obj << "vn " << normal(0) << " " << normal(1) << " " << normal(2) << "\n";
+		}
+	}
+	int material = -1;
+	for(unsigned int i=0 ; i<faces.size() ; i++)
+	{
+		if(face_materials[i] != material && face_materials[i] >= 0)
+		{
+			obj << "usemtl " << mesh.materials[face_materials[i]] << "\n";
+		}
+		material = face_materials[i];
+		obj << "f";
+		for(int j=0 ; j<3 ; j++)
+		{
+			obj << " " << faces[i](j) + 1;
+			if(with_normals)
+			{
+				obj << "//" << faces[i](j) + 1;
+			}
+		}
+		obj << "\n";
+	}
+	return obj.str();
+}
+
+} /* namespace internal */
+
+// world file to load : the cached one, built if needed, or world_file if the cache can not be written
+inline std::string cachedWorldFile(const std::string& world_file, const UrdfCacheOptions& options = UrdfCacheOptions())
+{
+	using namespace internal;
+	try
+	{
+		std::string world;
+		if(!readFile(world_file, world))
+		{
+			return world_file;
+		}
+
+		// robot files of the world, relative to the working directory like the model dir
+		struct Model
+		{
+			size_t dir_start, dir_size, path_start, path_size;
+			std::string dir, path, content;
+		};
+		std::vector<Model> models;
+		for(size_t position = world.find("<model"); position != std::string::npos; position = world.find("<model", position + 1))
+		{
+			Model model;
+			model.dir = attribute(world, position, "dir", &model.dir_start);
+			model.path = attribute(world, position, "path", &model.path_start);
+			model.dir_size = model.dir.size();
+			model.path_size = model.path.size();
+			if(model.dir.empty() || model.path.empty() || model.dir[0] == '/' || model.dir.find("..") != std::string::npos
+					|| !readFile(model.dir + "/" + model.path, model.content))
+			{
+				return world_file;
+			}
+			models.push_back(model);
+		}
+		if(models.empty())
+		{
+			return world_file;
+		}
+
+		// the key covers all the inputs of the cached files
+		uint64_t hash = 14695981039346656037ull;
+		hashAppend(hash, "urdf cache 1 " + std::to_string(options.cell_fraction));
+		hashAppend(hash, world);
+		std::vector<std::string> visual_meshes;
+		for(unsigned int i=0 ; i<models.size() ; i++)
+		{
+			hashAppend(hash, models[i].dir + "/" + models[i].path);
+			hashAppend(hash, models[i].content);
+			const std::string& robot = models[i].content;
+			for(size_t position = robot.find("<mesh"); position != std::string::npos; position = robot.find("<mesh", position + 1))
+			{
+				const std::string filename = attribute(robot, position, "filename");
+				std::string mesh;
+				if(insideVisual(robot, position) && !filename.empty() && readFile(models[i].dir + "/" + filename, mesh))
+				{
+					hashAppend(hash, mesh);
+				}
+			}
+		}
+		char hash_string[17];
+		std::snprintf(hash_string, sizeof(hash_string), "%016llx", (unsigned long long)hash);
+
+		const std::string cached_world_file = directoryOf(world_file) + "/" + stemOf(world_file) + "." + hash_string + ".cache.urdf";
+		if(fileExists(cached_world_file))
+		{
+			return cached_world_file;
+		}
+
+		if(options.verbose)
+		{
+			std::cout << "building the urdf cache of " << world_file << std::endl;
+		}
+		// the robot files and decimated meshes of a model dir, the paths of the cached robot
+		// files go up to the model dir, which has no ..
+		std::map<std::string, std::string> written_meshes;
+		int n_meshes = 0;
+		std::string cached_world = world;
+		for(int i=models.size()-1 ; i>=0 ; i--)
+		{
+			const std::string cache_root = models[i].dir + "/urdf_cache";
+			const std::string cache_directory = cache_root + "/" + hash_string;
+			makeDirectory(cache_root);
+			makeDirectory(cache_directory);
+			std::string robot = models[i].content;
+
+			// from the end, for the positions of the filenames before
+			size_t position = robot.rfind("<mesh");
+			while(position != std::string::npos)
+			{
+				size_t filename_start = 0;
+				const std::string filename = attribute(robot, position, "filename", &filename_start);
+				if(!filename.empty() && filename[0] != '/')
+				{
+					std::string replacement = "../../" + filename;
+					const std::string source = models[i].dir + "/" + filename;
+					std::string mesh;
+					if(insideVisual(robot, position) && filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".obj") == 0
+							&& readFile(source, mesh))
+					{
+						auto written = written_meshes.find(cache_directory + " " + source);
+						if(written != written_meshes.end())
+						{
+							replacement = written->second;
+						}
+						else
+						{
+							ObjMesh obj;
+							if(parseObj(mesh, obj))
+							{
+								const std::string name = "mesh" + std::to_string(n_meshes++);
+								std::string mtllib;
+								std::string material_library;
+								const std::string mtl_source = directoryOf(source) + "/" + obj.mtllib;
+								// the textures of a material library would be looked up next to the copy
+								if(!obj.mtllib.empty() && readFile(mtl_source, material_library)
+										&& material_library.find("map_") == std::string::npos)
+								{
+									mtllib = name + ".mtl";
+									writeFile(cache_directory + "/" + mtllib, material_library);
+								}
+								if(obj.mtllib.empty() || !mtllib.empty())
+								{
+									writeFile(cache_directory + "/" + name + ".obj", decimatedObj(obj, options.cell_fraction, mtllib));
+									replacement = name + ".obj";
+								}
+							}
+							written_meshes[cache_directory + " " + source] = replacement;
+						}
+					}
+					robot.replace(filename_start, filename.size(), replacement);
+				}
+				position = position == 0 ? std::string::npos : robot.rfind("<mesh", position - 1);
+			}
+			const std::string cached_robot_file = stemOf(models[i].path) + ".urdf";
+			writeFile(cache_directory + "/" + cached_robot_file, robot);
+
+			// the later attribute first
+			if(models[i].path_start > models[i].dir_start)
+			{
+				cached_world.replace(models[i].path_start, models[i].path_size, cached_robot_file);
+				cached_world.replace(models[i].dir_start, models[i].dir_size, cache_directory);
+			}
+			else
+			{
+				cached_world.replace(models[i].dir_start, models[i].dir_size, cache_directory);
+				cached_world.replace(models[i].path_start, models[i].path_size, cached_robot_file);
+			}
+		}
+		// last, its existence is the one of the cache
+		writeFile(cached_world_file, cached_world);
+		if(options.verbose)
+		{
+			std::cout << n_meshes << " visual meshes decimated in " << cached_world_file << std::endl;
+		}
+		return cached_world_file;
+	}
+	catch(const std::exception& e)
+	{
+		std::cout << e.what() << "loading " << world_file << " without the cache" << std::endl;
+		return world_file;
+	}
+}
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_MODEL_URDF_CACHE_H_
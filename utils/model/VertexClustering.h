@@ -0,0 +1,121 @@
+#ifndef UTILS_MODEL_VERTEX_CLUSTERING_H_
+#define UTILS_MODEL_VERTEX_CLUSTERING_H_
+
+// Decimation of a triangle mesh by vertex clustering, for the decimated obj files of
+// model/UrdfCache.h and the decimated chai3d meshes of graphics/MeshLod.h.
+//
+// the vertices in one cell of a grid of the given size, from the min corner of the mesh,
+// are merged into their mean. the triangles that collapse are dropped and the copies of a
+// triangle left by the merge are kept once :
+//
+//   PandaUtils::VertexClusters clusters;
+//   PandaUtils::clusterVertices(vertices, 0.01, clusters);
+//   std::vector<Eigen::Vector3i> decimated_triangles;
+//   std::vector<int> sources;
+//   PandaUtils::clusterTriangles(clusters, triangles, std::vector<int>(), decimated_triangles, sources);
+//   // clusters.positions are the vertices of decimated_triangles
+//
+// the attributes of the vertices (normals, colors) are left to the caller, with the cluster
+// of each vertex and the first vertex of each cluster.
+
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace PandaUtils {
+
+struct VertexClusters
+{
+	// cluster of each vertex
+	std::vector<int> vertex_clusters;
+	// mean of the vertices of each cluster, and the first of them
+	std::vector<Eigen::Vector3d> positions;
+	std::vector<int> first_vertices;
+};
+
+inline void clusterVertices(const std::vector<Eigen::Vector3d>& vertices, const double cell_size, VertexClusters& clusters)
+{
+	if(!(cell_size > 0))
+	{
+		throw std::invalid_argument("cell size should be positive in clusterVertices()\n");
+	}
+	clusters.vertex_clusters.resize(vertices.size());
+	clusters.positions.clear();
+	clusters.first_vertices.clear();
+	if(vertices.empty())
+	{
+		return;
+	}
+
+	Eigen::Vector3d min_corner = vertices[0];
+	for(unsigned int i=1 ; i<vertices.size() ; i++)
+	{
+		min_corner = min_corner.cwiseMin(vertices[i]);
+	}
+
+	std::unordered_map<uint64_t, int> cell_indices;
+	std::vector<int> cluster_counts;
+	for(unsigned int i=0 ; i<vertices.size() ; i++)
+	{
+		const Eigen::Vector3d grid = ((vertices[i] - min_corner) / cell_size).array().floor();
+		const uint64_t key = (((uint64_t)grid(0) & 0x1FFFFF) << 42) | (((uint64_t)grid(1) & 0x1FFFFF) << 21)
+				| ((uint64_t)grid(2) & 0x1FFFFF);
+		auto found = cell_indices.find(key);
+		if(found == cell_indices.end())
+		{
+			found = cell_indices.insert(std::make_pair(key, (int)clusters.positions.size())).first;
+			clusters.positions.push_back(Eigen::Vector3d::Zero());
+			clusters.first_vertices.push_back(i);
+			cluster_counts.push_back(0);
+		}
+		clusters.vertex_clusters[i] = found->second;
+		clusters.positions[found->second] += vertices[i];
+		cluster_counts[found->second]++;
+	}
+	for(unsigned int c=0 ; c<clusters.positions.size() ; c++)
+	{
+		clusters.positions[c] /= cluster_counts[c];
+	}
+}
+
+// triangles on the clusters of their vertices. groups (e.g. the materials, or empty for a
+// single group) keep apart the copies of a triangle from different groups. sources gives
+// the triangle each decimated one comes from
+inline void clusterTriangles(const VertexClusters& clusters, const std::vector<Eigen::Vector3i>& triangles,
+		const std::vector<int>& groups, std::vector<Eigen::Vector3i>& decimated_triangles, std::vector<int>& sources)
+{
+	decimated_triangles.clear();
+	sources.clear();
+	std::map<std::vector<int>, int> seen_triangles;
+	for(unsigned int i=0 ; i<triangles.size() ; i++)
+	{
+		Eigen::Vector3i triangle;
+		for(int j=0 ; j<3 ; j++)
+		{
+			triangle(j) = clusters.vertex_clusters[triangles[i](j)];
+		}
+		if(triangle(0) == triangle(1) || triangle(1) == triangle(2) || triangle(2) == triangle(0))
+		{
+			continue;
+		}
+		// the same triangle from several triangles of a cell, in any order of its corners
+		std::vector<int> sorted(triangle.data(), triangle.data() + 3);
+		std::sort(sorted.begin(), sorted.end());
+		sorted.push_back(groups.empty() ? 0 : groups[i]);
+		if(seen_triangles.insert(std::make_pair(sorted, 0)).second)
+		{
+			decimated_triangles.push_back(triangle);
+			sources.push_back(i);
+		}
+	}
+}
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_MODEL_VERTEX_CLUSTERING_H_
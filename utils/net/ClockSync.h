@@ -0,0 +1,114 @@
+#ifndef UTILS_NET_CLOCK_SYNC_H_
+#define UTILS_NET_CLOCK_SYNC_H_
+
+// Offset between the clock of this machine and the clock of a peer, from timestamped round
+// trips, so that the times stamped on one node can be compared with the times of the other.
+//
+// a round trip gives four times : t0 the ping leaves here, t1 it arrives at the peer, t2 the
+// answer leaves the peer, t3 it arrives here (t1 and t2 on the clock of the peer). as in ntp,
+// offset = ((t1 - t0) + (t2 - t3)) / 2 and round trip = (t3 - t0) - (t2 - t1). the error of a
+// sample is at most half of its round trip, and the queueing delays only make it longer, so
+// the estimate is the sample with the shortest round trip of the last window samples. the
+// older samples leave the window, so a slow drift of the clocks is followed :
+//
+//   PandaUtils::ClockSync clock_sync(32);
+//   ...                                            // on every answer to a ping
+//   clock_sync.addSample(t0, t1, t2, t3);
+//   ...
+//   if(clock_sync.synchronized())
+//   {
+//       const double one_way_latency = receive_time - clock_sync.toLocal(packet.send_time);
+//   }
+//
+// the times are seconds on any clock of each machine (e.g. steady_clock since boot), the
+// offset accounts for the different origins. addSample() does not allocate.
+
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace PandaUtils {
+
+class ClockSync {
+public:
+
+	ClockSync(const int window = 32)
+	: _offsets(window, 0.0),
+	  _round_trips(window, 0.0),
+	  _n_samples(0),
+	  _n_rejected(0),
+	  _offset(0),
+	  _round_trip(std::numeric_limits<double>::infinity())
+	{
+		if(window < 1)
+		{
+			throw std::invalid_argument("window should be positive in ClockSync::ClockSync()\n");
+		}
+	}
+
+	// t0 and t3 on the local clock, t1 and t2 on the clock of the peer. returns false for an
+	// inconsistent sample (negative round trip), which is dropped
+	bool addSample(const double t0, const double t1, const double t2, const double t3)
+	{
+		const double round_trip = (t3 - t0) - (t2 - t1);
+		if(!(round_trip >= 0) || t2 < t1)
+		{
+			_n_rejected++;
+			return false;
+		}
+		const int window = (int) _offsets.size();
+		const int index = (int) (_n_samples % window);
+		_offsets[index] = 0.5 * ((t1 - t0) + (t2 - t3));
+		_round_trips[index] = round_trip;
+		_n_samples++;
+
+		const int n = _n_samples < (unsigned long long) window ? (int) _n_samples : window;
+		int best = 0;
+		for(int i=1 ; i<n ; i++)
+		{
+			if(_round_trips[i] < _round_trips[best])
+			{
+				best = i;
+			}
+		}
+		_offset = _offsets[best];
+		_round_trip = _round_trips[best];
+		return true;
+	}
+
+	bool synchronized() const { return _n_samples > 0; }
+
+	// seconds, clock of the peer minus local clock
+	double offset() const { return _offset; }
+	// seconds, of the sample the offset comes from. the offset is within half of it
+	double roundTrip() const { return _round_trip; }
+	double uncertainty() const { return 0.5 * _round_trip; }
+
+	double toLocal(const double remote_time) const { return remote_time - _offset; }
+	double toRemote(const double local_time) const { return local_time + _offset; }
+
+	unsigned long long numSamples() const { return _n_samples; }
+	unsigned long long numRejected() const { return _n_rejected; }
+
+	void reset()
+	{
+		_n_samples = 0;
+		_offset = 0;
+		_round_trip = std::numeric_limits<double>::infinity();
+	}
+
+private:
+
+	std::vector<double> _offsets;
+	std::vector<double> _round_trips;
+	unsigned long long _n_samples;
+	unsigned long long _n_rejected;
+
+	double _offset;
+	double _round_trip;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_NET_CLOCK_SYNC_H_
@@ -0,0 +1,108 @@
+#ifndef UTILS_NET_HAPTIC_DEVICE_CHANNEL_H_
+#define UTILS_NET_HAPTIC_DEVICE_CHANNEL_H_
+
+// Haptic device read and commanded through one TeleopPacket each way per cycle, for the
+// controllers that otherwise read the device keys of a HapticController one by one.
+//
+// the transports implement receive() and send() : UdpHapticDevice (net/UdpHapticDevice.h)
+// for a remote haptic station, RedisHapticDevice (redis/HapticDeviceBundle.h) for the
+// binary device keys on the redis server. the controllers use either one through this
+// interface, in place of the device keys of their read and write callbacks :
+//
+//   PandaUtils::HapticDeviceChannel* device_channel = NULL;
+//   if(udp_config.enabled())
+//   {
+//       device_channel = new PandaUtils::UdpHapticDevice(udp_config.forDevice(0));
+//   }
+//   else if(PandaUtils::RedisHapticDevice::available(redis_client, 0))
+//   {
+//       device_channel = new PandaUtils::RedisHapticDevice(redis_client, 0);
+//   }
+//   else
+//   {
+//       redis_client.addEigenToReadCallback(0, DEVICE_POSITION_KEYS[0], teleop_task->_current_position_device);
+//       ...
+//   }
+//   while(runloop)
+//   {
+//       redis_client.executeReadCallback(0);
+//       if(device_channel != NULL)
+//       {
+//           device_channel->readDevice(*teleop_task);
+//       }
+//       ...
+//       if(device_channel != NULL)
+//       {
+//           device_channel->sendCommands(command_force, command_torque, teleop_task->_commanded_gripper_force_device, time);
+//       }
+//   }
+//
+// when the channel times out (no new device state), the device velocities are set to 0 so
+// that the damping terms do not act on a stale velocity.
+
+#include "net/TeleopPacket.h"
+#include <Eigen/Dense>
+
+#include <string>
+
+namespace PandaUtils {
+
+class HapticDeviceChannel {
+public:
+
+	virtual ~HapticDeviceChannel() {}
+
+	// newest device state since the last call, false when there is none
+	virtual bool receive(TeleopPacket& packet) = 0;
+	// false when the commands could not be sent
+	virtual bool send(TeleopPacket& packet, const double time) = 0;
+	// no new device state for the timeout of the transport, or none yet
+	virtual bool timedOut() const = 0;
+	// one line of counters of the transport
+	virtual std::string summary() const = 0;
+
+	// copies the newest device state to the device fields of teleop_task (a
+	// Sai2Primitives::HapticController). returns true when a new state arrived
+	template<typename HapticTask>
+	bool readDevice(HapticTask& teleop_task)
+	{
+		if(!receive(_state))
+		{
+			if(timedOut())
+			{
+				teleop_task._current_trans_velocity_device.setZero();
+				teleop_task._current_rot_velocity_device.setZero();
+				teleop_task._current_gripper_velocity_device = 0;
+			}
+			return false;
+		}
+		teleop_task._current_position_device = Eigen::Map<const Eigen::Vector3d>(_state.position);
+		teleop_task._current_rotation_device = Eigen::Map<const Eigen::Matrix3d>(_state.rotation);
+		teleop_task._current_trans_velocity_device = Eigen::Map<const Eigen::Vector3d>(_state.velocity);
+		teleop_task._current_rot_velocity_device = Eigen::Map<const Eigen::Vector3d>(_state.angular_velocity);
+		teleop_task._sensed_force_device = Eigen::Map<const Eigen::Vector3d>(_state.force);
+		teleop_task._sensed_torque_device = Eigen::Map<const Eigen::Vector3d>(_state.torque);
+		teleop_task._current_position_gripper_device = _state.gripper_position;
+		teleop_task._current_gripper_velocity_device = _state.gripper_velocity;
+		return true;
+	}
+
+	// force and torque in the device frame, as the commanded force and torque keys
+	bool sendCommands(const Eigen::Vector3d& force, const Eigen::Vector3d& torque, const double gripper_force,
+			const double time, const Eigen::Matrix3d& sigma_force = Eigen::Matrix3d::Zero())
+	{
+		Eigen::Map<Eigen::Vector3d>(_command.force) = force;
+		Eigen::Map<Eigen::Vector3d>(_command.torque) = torque;
+		Eigen::Map<Eigen::Matrix3d>(_command.sigma_force) = sigma_force;
+		_command.gripper_force = gripper_force;
+		return send(_command, time);
+	}
+
+private:
+	TeleopPacket _state;
+	TeleopPacket _command;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_NET_HAPTIC_DEVICE_CHANNEL_H_
@@ -0,0 +1,208 @@
+#ifndef UTILS_NET_PERCEPTUAL_DEADBAND_H_
+#define UTILS_NET_PERCEPTUAL_DEADBAND_H_
+
+// Adaptive rate of a teleoperation stream : a sample is sent only when it differs from the
+// last one sent by more than what the operator can perceive, so the stream runs at the
+// rate of the loop during fast motions and contacts, and drops to a keepalive when the
+// operator is still.
+//
+// the position changes are compared to an absolute threshold (the smallest displacement
+// felt by the hand), the force changes to a fraction of the last force sent (the Weber
+// fraction of the force perception) with an absolute floor for the small forces. the
+// receiver holds the last sample between two of them. the stream never goes below the
+// keepalive rate, so the timeout of the link does not trip, and never above the budget
+// rate, the sample deferred by the budget goes at the next cycle allowed :
+//
+//   PandaUtils::DeadbandConfig deadband_config = PandaUtils::DeadbandConfig::fromArgs(argc, argv);
+//   // app --deadband 200        (budget of 200 Hz per stream)
+//   PandaUtils::PerceptualDeadband deadband(deadband_config);
+//   while(runloop)
+//   {
+//       ...
+//       if(!deadband_config.enabled() || deadband.update(device_position, command_force, time))
+//       {
+//           device_channel->sendCommands(command_force, command_torque, gripper_force, time);
+//       }
+//   }
+//
+// update() works on fixed size values and does not allocate.
+
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+namespace PandaUtils {
+
+struct DeadbandConfig
+{
+	// m
+	double position_threshold;
+	// of the norm of the last force sent
+	double force_fraction;
+	// N
+	double force_threshold;
+	// Hz, 0 when the deadband is not used
+	double max_rate;
+	// Hz, keepalive below the timeout of the link
+	double min_rate;
+
+	DeadbandConfig()
+	: position_threshold(0.5e-3),
+	  force_fraction(0.1),
+	  force_threshold(0.05),
+	  max_rate(0),
+	  min_rate(20)
+	{}
+
+	bool enabled() const
+	{
+		return max_rate > 0;
+	}
+
+	// app --deadband <budget in Hz> [--deadband-position <m>] [--deadband-force <fraction>],
+	// not enabled without --deadband
+	static DeadbandConfig fromArgs(const int argc, char** argv)
+	{
+		DeadbandConfig config;
+		for(int i=1 ; i<argc-1 ; i++)
+		{
+			const std::string arg = argv[i];
+			if(arg == "--deadband")
+			{
+				config.max_rate = atof(argv[i+1]);
+				if(config.max_rate <= config.min_rate)
+				{
+					throw std::invalid_argument("the budget of --deadband should be above the keepalive rate in DeadbandConfig::fromArgs()\n");
+				}
+			}
+			else if(arg == "--deadband-position")
+			{
+				config.position_threshold = atof(argv[i+1]);
+			}
+			else if(arg == "--deadband-force")
+			{
+				config.force_fraction = atof(argv[i+1]);
+			}
+		}
+		return config;
+	}
+};
+
+class PerceptualDeadband {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Ref<const Eigen::Vector3d> Vector3dInput;
+
+	PerceptualDeadband(const DeadbandConfig& config)
+	: _config(config)
+	{
+		if(config.position_threshold < 0 || config.force_fraction < 0 || config.force_threshold < 0
+			|| config.min_rate <= 0 || config.max_rate < config.min_rate)
+		{
+			throw std::invalid_argument("thresholds should be positive and the budget above the keepalive rate in PerceptualDeadband::PerceptualDeadband()\n");
+		}
+		_min_interval = 1.0 / config.max_rate;
+		_max_interval = 1.0 / config.min_rate;
+		reset();
+	}
+
+	// the next update() sends
+	void reset()
+	{
+		_f_sent = false;
+		_sent_position.setZero();
+		_sent_force.setZero();
+		_last_send_time = 0;
+		_first_time = 0;
+		_last_time = 0;
+		_n_samples = 0;
+		_n_sent = 0;
+		_n_deferred = 0;
+	}
+
+	// one cycle of the sender, time in seconds. returns true when the sample should be sent,
+	// and then takes it as the reference of the next ones
+	bool update(const Vector3dInput& position, const Vector3dInput& force, const double time)
+	{
+		if(_n_samples == 0)
+		{
+			_first_time = time;
+		}
+		_n_samples++;
+		_last_time = time;
+
+		if(_f_sent)
+		{
+			const double elapsed = time - _last_send_time;
+			const bool f_keepalive = elapsed >= _max_interval;
+			const bool f_perceived = (position - _sent_position).norm() > _config.position_threshold
+					|| (force - _sent_force).norm() > std::max(_config.force_fraction * _sent_force.norm(), _config.force_threshold);
+			if(!f_keepalive && !f_perceived)
+			{
+				return false;
+			}
+			if(!f_keepalive && elapsed < _min_interval)
+			{
+				_n_deferred++;
+				return false;
+			}
+		}
+
+		_f_sent = true;
+		_sent_position = position;
+		_sent_force = force;
+		_last_send_time = time;
+		_n_sent++;
+		return true;
+	}
+
+	const DeadbandConfig& config() const
+	{
+		return _config;
+	}
+
+	unsigned long long samples() const { return _n_samples; }
+	unsigned long long sent() const { return _n_sent; }
+	// cycles with a perceived change held back by the budget
+	unsigned long long deferred() const { return _n_deferred; }
+
+	// average rate of the samples sent, in Hz
+	double averageRate() const
+	{
+		const double duration = _last_time - _first_time;
+		return duration > 0 ? _n_sent / duration : 0;
+	}
+
+	// one line, e.g. "sent 5120 of 60000 samples (8.5 %), 85.3 Hz average, 12 deferred"
+	std::string summary() const
+	{
+		const double percent = _n_samples > 0 ? 100.0 * _n_sent / _n_samples : 0;
+		return "sent " + std::to_string(_n_sent) + " of " + std::to_string(_n_samples) + " samples ("
+			+ std::to_string(percent) + " %), " + std::to_string(averageRate()) + " Hz average, "
+			+ std::to_string(_n_deferred) + " deferred";
+	}
+
+private:
+	const DeadbandConfig _config;
+	double _min_interval;
+	double _max_interval;
+
+	bool _f_sent;
+	Eigen::Vector3d _sent_position;
+	Eigen::Vector3d _sent_force;
+	double _last_send_time;
+
+	double _first_time;
+	double _last_time;
+	unsigned long long _n_samples;
+	unsigned long long _n_sent;
+	unsigned long long _n_deferred;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_NET_PERCEPTUAL_DEADBAND_H_
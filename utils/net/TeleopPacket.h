@@ -0,0 +1,58 @@
+#ifndef UTILS_NET_TELEOP_PACKET_H_
+#define UTILS_NET_TELEOP_PACKET_H_
+
+// Fixed binary record of the teleoperation channel, for the UDP link (net/UdpTeleopLink.h)
+// and the binary device keys on redis (redis/HapticDeviceBundle.h).
+//
+// the fields are in the byte order of the machines, both sides should be little endian
+// (x86 or arm linux). the receivers check the magic, the version and the channel :
+//
+//   PandaUtils::TeleopPacket packet;
+//   Eigen::Map<Eigen::Vector3d>(packet.position) = device_position;
+//   packet.gripper_position = gripper_position;
+
+#include <cstdint>
+#include <cstring>
+
+namespace PandaUtils {
+
+// one datagram, or one binary redis value. the device state (position, rotation, velocities,
+// sensed force and torque, gripper) from the haptic station, or the commands (force, torque,
+// gripper force) and the force space of the robot to the haptic station. the fields a
+// direction does not use are 0
+struct TeleopPacket
+{
+	static const uint32_t MAGIC = 0x504c5450;
+	static const uint16_t VERSION = 1;
+
+	uint32_t magic;
+	uint16_t version;
+	uint16_t channel;
+	uint64_t sequence;
+	// seconds, clock of the sender
+	double send_time;
+
+	double position[3];
+	// column major
+	double rotation[9];
+	double velocity[3];
+	double angular_velocity[3];
+	double force[3];
+	double torque[3];
+	// column major
+	double sigma_force[9];
+	double gripper_position;
+	double gripper_velocity;
+	double gripper_force;
+
+	TeleopPacket()
+	{
+		memset(this, 0, sizeof(TeleopPacket));
+	}
+};
+
+static_assert(sizeof(TeleopPacket) == 312, "the teleop packet has padding");
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_NET_TELEOP_PACKET_H_
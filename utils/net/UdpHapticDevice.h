@@ -0,0 +1,67 @@
+#ifndef UTILS_NET_UDP_HAPTIC_DEVICE_H_
+#define UTILS_NET_UDP_HAPTIC_DEVICE_H_
+
+// Haptic device of a remote haptic station, through the UDP teleoperation link, for the
+// controllers that read the device keys of a HapticController from redis.
+//
+// on the haptic station, udp_haptic_bridge (utils/net/udp_haptic_bridge.cpp) reads the
+// device keys of the local haptic driver and sends them every cycle, and writes the
+// commands it receives back to the driver. on the robot side, this class fills the device
+// fields of the haptic controller from the newest packet and sends the commands, in place of
+// the device keys of the read and write callbacks (see net/HapticDeviceChannel.h) :
+//
+//   PandaUtils::UdpTeleopConfig udp_config = PandaUtils::UdpTeleopConfig::fromArgs(argc, argv);
+//   PandaUtils::HapticDeviceChannel* device_channel = NULL;
+//   if(udp_config.enabled())
+//   {
+//       device_channel = new PandaUtils::UdpHapticDevice(udp_config.forDevice(0));
+//   }
+//
+// the specifications of the device (max stiffness, damping and force) are read once at the
+// start, they stay on redis : udp_haptic_bridge --robot-redis <host> copies them to the
+// redis of the robot side.
+
+#include "net/HapticDeviceChannel.h"
+#include "net/UdpTeleopLink.h"
+
+namespace PandaUtils {
+
+class UdpHapticDevice : public HapticDeviceChannel {
+public:
+
+	UdpHapticDevice(const UdpTeleopConfig& config)
+	: _link(config)
+	{}
+
+	bool receive(TeleopPacket& packet)
+	{
+		return _link.receive(packet);
+	}
+
+	bool send(TeleopPacket& packet, const double time)
+	{
+		return _link.send(packet, time);
+	}
+
+	bool timedOut() const
+	{
+		return _link.timedOut();
+	}
+
+	std::string summary() const
+	{
+		return "udp link, " + _link.summary();
+	}
+
+	const UdpTeleopLink& link() const
+	{
+		return _link;
+	}
+
+private:
+	UdpTeleopLink _link;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_NET_UDP_HAPTIC_DEVICE_H_
@@ -0,0 +1,389 @@
+#ifndef UTILS_NET_UDP_KEY_BRIDGE_H_
+#define UTILS_NET_UDP_KEY_BRIDGE_H_
+
+// UDP transport of a vector of values between two machines, with the clock offset between
+// them and the latency of the link, for apps split across nodes (the simulation on one
+// machine, the controllers and the haptic stations on others).
+//
+// every cycle one side sends its values (e.g. the redis keys it owns, packed in one vector)
+// in a datagram stamped with its clock, and receives the newest values of the other side.
+// as in the teleoperation link (net/UdpTeleopLink.h) a lost datagram is not sent again, the
+// reordered ones are dropped. between the states, the two sides exchange pings : the answer
+// carries the times the ping arrived and left, from which ClockSync (net/ClockSync.h) finds
+// the offset of the clocks. the send time of a state, moved to the local clock, then gives
+// the one way latency of the link. a ping waits on the peer for its next receive(), these
+// round trips are longer and ClockSync keeps the ones answered right away :
+//
+//   PandaUtils::UdpKeyBridge bridge(config, n_local_values, n_remote_values);
+//   while(runloop)
+//   {
+//       ...                                                   // local values from redis
+//       bridge.send(local_values);
+//       if(bridge.receive(remote_values))                     // newest values since the last call
+//       {
+//           ...                                               // remote values to redis
+//           if(bridge.clock().synchronized())
+//           {
+//               one_way_latency.record(1e9 * bridge.lastLatency());
+//           }
+//       }
+//       if(time > next_ping_time)
+//       {
+//           bridge.ping();
+//       }
+//   }
+//
+// the times are seconds of the steady clock of each machine, localTime(). the datagram
+// only carries the values in use, a vector can have up to MAX_VALUES of them. both sides
+// should be little endian and use the same channel, the sizes of the vectors are checked.
+
+#include "net/ClockSync.h"
+#include "net/UdpTeleopLink.h"
+#include <Eigen/Dense>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace PandaUtils {
+
+struct KeyBridgePacket
+{
+	static const uint32_t MAGIC = 0x42444b50;
+	static const uint16_t VERSION = 1;
+	static const int MAX_VALUES = 1024;
+
+	enum Kind
+	{
+		STATE = 0,
+		PING = 1,
+		PONG = 2
+	};
+
+	uint32_t magic;
+	uint16_t version;
+	uint16_t channel;
+	uint32_t kind;
+	uint32_t n_values;
+	uint64_t sequence;
+	// seconds, clock of the sender
+	double send_time;
+	// of a PONG : the send time of the ping it answers (clock of the receiver of the pong),
+	// and the time the ping arrived (clock of the sender of the pong)
+	double ping_send_time;
+	double ping_receive_time;
+	// only the n_values first are sent
+	double values[MAX_VALUES];
+
+	KeyBridgePacket()
+	{
+		memset(this, 0, sizeof(KeyBridgePacket));
+	}
+
+	size_t size() const
+	{
+		return offsetof(KeyBridgePacket, values) + n_values * sizeof(double);
+	}
+};
+
+static_assert(offsetof(KeyBridgePacket, values) == 48, "the key bridge packet has padding");
+
+class UdpKeyBridge {
+public:
+
+	// the socket settings of a teleoperation link, the timeout is the one of the remote values
+	UdpKeyBridge(const UdpTeleopConfig& config, const int n_local_values, const int n_remote_values,
+			const int clock_window = 32)
+	: _config(config),
+	  _n_local_values(n_local_values),
+	  _n_remote_values(n_remote_values),
+	  _socket(-1),
+	  _clock(clock_window),
+	  _sequence(0),
+	  _ping_sequence(0),
+	  _last_sequence(0),
+	  _f_received(false),
+	  _last_send_time(0),
+	  _last_latency(0),
+	  _last_round_trip(0),
+	  _n_sent(0),
+	  _n_send_errors(0),
+	  _n_received(0),
+	  _n_stale(0),
+	  _n_gaps(0),
+	  _n_malformed(0),
+	  _n_pings(0),
+	  _n_pongs(0)
+	{
+		if(!config.enabled() || config.remote_port <= 0 || config.timeout <= 0)
+		{
+			throw std::invalid_argument("ports and timeout should be positive in UdpKeyBridge::UdpKeyBridge()\n");
+		}
+		if(n_local_values < 0 || n_local_values > KeyBridgePacket::MAX_VALUES
+			|| n_remote_values < 0 || n_remote_values > KeyBridgePacket::MAX_VALUES)
+		{
+			throw std::invalid_argument("at most " + std::to_string(KeyBridgePacket::MAX_VALUES)
+				+ " values each way in UdpKeyBridge::UdpKeyBridge()\n");
+		}
+
+		addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_DGRAM;
+		addrinfo* remote = NULL;
+		if(getaddrinfo(config.remote_host.c_str(), NULL, &hints, &remote) != 0 || remote == NULL)
+		{
+			throw std::runtime_error("could not resolve " + config.remote_host + " in UdpKeyBridge::UdpKeyBridge()\n");
+		}
+		memcpy(&_remote_address, remote->ai_addr, sizeof(_remote_address));
+		_remote_address.sin_port = htons(config.remote_port);
+		freeaddrinfo(remote);
+
+		_socket = socket(AF_INET, SOCK_DGRAM, 0);
+		if(_socket < 0)
+		{
+			throw std::runtime_error("could not open the socket in UdpKeyBridge::UdpKeyBridge()\n");
+		}
+		sockaddr_in local_address;
+		memset(&local_address, 0, sizeof(local_address));
+		local_address.sin_family = AF_INET;
+		local_address.sin_addr.s_addr = htonl(INADDR_ANY);
+		local_address.sin_port = htons(config.local_port);
+		if(bind(_socket, reinterpret_cast<const sockaddr*>(&local_address), sizeof(local_address)) < 0)
+		{
+			::close(_socket);
+			throw std::runtime_error("could not bind the port " + std::to_string(config.local_port) + " in UdpKeyBridge::UdpKeyBridge()\n");
+		}
+		fcntl(_socket, F_SETFL, fcntl(_socket, F_GETFL, 0) | O_NONBLOCK);
+		int tos = IPTOS_LOWDELAY;
+		setsockopt(_socket, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+
+		_last_packet_time = std::chrono::steady_clock::now();
+	}
+
+	~UdpKeyBridge()
+	{
+		if(_socket >= 0)
+		{
+			::close(_socket);
+		}
+	}
+
+	// seconds, steady clock of this machine
+	static double localTime()
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// sends the local values, of size n_local_values. returns false when the datagram could
+	// not be queued, it is then lost
+	bool send(const Eigen::VectorXd& values)
+	{
+		if(values.size() != _n_local_values)
+		{
+			throw std::invalid_argument("values should have n_local_values in UdpKeyBridge::send()\n");
+		}
+		stamp(_send_packet, KeyBridgePacket::STATE, ++_sequence);
+		_send_packet.n_values = _n_local_values;
+		Eigen::Map<Eigen::VectorXd>(_send_packet.values, _n_local_values) = values;
+		return sendPacket(_send_packet);
+	}
+
+	// asks the peer for the times of a round trip, the answer is read by receive()
+	bool ping()
+	{
+		stamp(_ping_packet, KeyBridgePacket::PING, ++_ping_sequence);
+		_n_pings++;
+		return sendPacket(_ping_packet);
+	}
+
+	// reads all the datagrams waiting on the socket and answers the pings. returns true and
+	// the newest remote values when they are newer than the last values returned, false
+	// otherwise (values is not changed). does not allocate once values has its size
+	bool receive(Eigen::VectorXd& values)
+	{
+		bool f_new_values = false;
+		while(true)
+		{
+			const ssize_t n = recv(_socket, &_buffer, sizeof(KeyBridgePacket), MSG_DONTWAIT);
+			if(n < 0)
+			{
+				break;
+			}
+			const double receive_time = localTime();
+			if(n < (ssize_t) offsetof(KeyBridgePacket, values) || _buffer.magic != KeyBridgePacket::MAGIC
+				|| _buffer.version != KeyBridgePacket::VERSION || _buffer.channel != _config.channel
+				|| _buffer.n_values > (uint32_t) KeyBridgePacket::MAX_VALUES || n != (ssize_t) _buffer.size())
+			{
+				_n_malformed++;
+				continue;
+			}
+
+			if(_buffer.kind == KeyBridgePacket::PING)
+			{
+				stamp(_pong_packet, KeyBridgePacket::PONG, _buffer.sequence);
+				_pong_packet.ping_send_time = _buffer.send_time;
+				_pong_packet.ping_receive_time = receive_time;
+				// stamped again, so that the time to answer is not in the round trip
+				_pong_packet.send_time = localTime();
+				sendPacket(_pong_packet);
+				continue;
+			}
+			if(_buffer.kind == KeyBridgePacket::PONG)
+			{
+				if(_clock.addSample(_buffer.ping_send_time, _buffer.ping_receive_time, _buffer.send_time, receive_time))
+				{
+					_n_pongs++;
+					_last_round_trip = (receive_time - _buffer.ping_send_time) - (_buffer.send_time - _buffer.ping_receive_time);
+				}
+				continue;
+			}
+			if(_buffer.kind != KeyBridgePacket::STATE || _buffer.n_values != (uint32_t) _n_remote_values)
+			{
+				_n_malformed++;
+				continue;
+			}
+
+			_n_received++;
+			if(_f_received && _buffer.sequence <= _last_sequence && !timedOut())
+			{
+				_n_stale++;
+				continue;
+			}
+			if(_f_received && _buffer.sequence > _last_sequence + 1)
+			{
+				_n_gaps += _buffer.sequence - _last_sequence - 1;
+			}
+			_last_sequence = _buffer.sequence;
+			_f_received = true;
+			_last_packet_time = std::chrono::steady_clock::now();
+			_last_send_time = _buffer.send_time;
+			_last_latency = _clock.synchronized() ? receive_time - _clock.toLocal(_buffer.send_time) : 0;
+			values = Eigen::Map<const Eigen::VectorXd>(_buffer.values, _n_remote_values);
+			f_new_values = true;
+		}
+		return f_new_values;
+	}
+
+	// no remote values for the timeout, or none yet
+	bool timedOut() const
+	{
+		return !_f_received || secondsSinceLastPacket() > _config.timeout;
+	}
+
+	double secondsSinceLastPacket() const
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - _last_packet_time).count();
+	}
+
+	const ClockSync& clock() const { return _clock; }
+	// seconds, from the send time of the newest remote values to their arrival here. 0 before
+	// the clocks are synchronized, within clock().uncertainty() after
+	double lastLatency() const { return _last_latency; }
+	// seconds, of the last answered ping
+	double lastRoundTrip() const { return _last_round_trip; }
+	// clock of the peer
+	double lastRemoteSendTime() const { return _last_send_time; }
+
+	const UdpTeleopConfig& config() const { return _config; }
+	int numLocalValues() const { return _n_local_values; }
+	int numRemoteValues() const { return _n_remote_values; }
+
+	uint64_t sent() const { return _n_sent; }
+	uint64_t sendErrors() const { return _n_send_errors; }
+	uint64_t received() const { return _n_received; }
+	uint64_t stale() const { return _n_stale; }
+	uint64_t gaps() const { return _n_gaps; }
+	uint64_t malformed() const { return _n_malformed; }
+	uint64_t pings() const { return _n_pings; }
+	// answered pings
+	uint64_t pongs() const { return _n_pongs; }
+
+	// one line, e.g. "sent 40000, received 39871, stale 12, gaps 117, malformed 0, pongs 399 of 400, offset 1.52 ms +- 41 us"
+	std::string summary() const
+	{
+		std::string line = "sent " + std::to_string(_n_sent) + ", received " + std::to_string(_n_received)
+			+ ", stale " + std::to_string(_n_stale) + ", gaps " + std::to_string(_n_gaps)
+			+ ", malformed " + std::to_string(_n_malformed)
+			+ ", pongs " + std::to_string(_n_pongs) + " of " + std::to_string(_n_pings);
+		if(_clock.synchronized())
+		{
+			line += ", offset " + std::to_string(1e3 * _clock.offset()) + " ms +- "
+				+ std::to_string(1e6 * _clock.uncertainty()) + " us";
+		}
+		return line;
+	}
+
+private:
+	UdpKeyBridge(const UdpKeyBridge&);
+	UdpKeyBridge& operator=(const UdpKeyBridge&);
+
+	void stamp(KeyBridgePacket& packet, const KeyBridgePacket::Kind kind, const uint64_t sequence)
+	{
+		packet.magic = KeyBridgePacket::MAGIC;
+		packet.version = KeyBridgePacket::VERSION;
+		packet.channel = _config.channel;
+		packet.kind = kind;
+		packet.n_values = 0;
+		packet.sequence = sequence;
+		packet.send_time = localTime();
+	}
+
+	bool sendPacket(const KeyBridgePacket& packet)
+	{
+		const ssize_t n = sendto(_socket, &packet, packet.size(), MSG_DONTWAIT,
+				reinterpret_cast<const sockaddr*>(&_remote_address), sizeof(_remote_address));
+		if(n != (ssize_t) packet.size())
+		{
+			_n_send_errors++;
+			return false;
+		}
+		_n_sent++;
+		return true;
+	}
+
+	const UdpTeleopConfig _config;
+	const int _n_local_values;
+	const int _n_remote_values;
+	int _socket;
+	sockaddr_in _remote_address;
+
+	ClockSync _clock;
+	uint64_t _sequence;
+	uint64_t _ping_sequence;
+	uint64_t _last_sequence;
+	bool _f_received;
+	std::chrono::steady_clock::time_point _last_packet_time;
+	double _last_send_time;
+	double _last_latency;
+	double _last_round_trip;
+
+	KeyBridgePacket _send_packet;
+	KeyBridgePacket _ping_packet;
+	KeyBridgePacket _pong_packet;
+	KeyBridgePacket _buffer;
+
+	uint64_t _n_sent;
+	uint64_t _n_send_errors;
+	uint64_t _n_received;
+	uint64_t _n_stale;
+	uint64_t _n_gaps;
+	uint64_t _n_malformed;
+	uint64_t _n_pings;
+	uint64_t _n_pongs;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_NET_UDP_KEY_BRIDGE_H_
@@ -0,0 +1,286 @@
+#ifndef UTILS_NET_UDP_TELEOP_LINK_H_
+#define UTILS_NET_UDP_TELEOP_LINK_H_
+
+// UDP transport of the teleoperation channel between a haptic station and a robot.
+//
+// the state of the haptic device one way and the commands the other way go in fixed
+// binary packets with a sequence number, one datagram per cycle, instead of the redis keys
+// of a server on one side of the link. a lost datagram is not sent again and does not hold
+// back the next ones : the receiver drains the socket every cycle and keeps the newest
+// packet, the ones older than the last it used (reordered or duplicated) are counted as
+// stale and dropped. both sides of the link use the same class :
+//
+//   PandaUtils::UdpTeleopConfig config = PandaUtils::UdpTeleopConfig::fromArgs(argc, argv);
+//   // app --udp-teleop 9900 haptic-station.local 9901
+//   PandaUtils::UdpTeleopLink link(config);
+//   PandaUtils::TeleopPacket packet;
+//   while(runloop)
+//   {
+//       if(link.receive(packet))                          // newest packet since the last call
+//       {
+//           device_position = Eigen::Map<Eigen::Vector3d>(packet.position);
+//       }
+//       Eigen::Map<Eigen::Vector3d>(command.force) = commanded_force;
+//       link.send(command, time);                         // never blocks
+//   }
+//
+// the packets are sent in the byte order of the machines, both sides should be little
+// endian (x86 or arm linux). the magic, version and channel of every datagram are checked,
+// so that two links on the same port or two versions of the apps do not mix. when no packet
+// arrived for the timeout, a new sequence is accepted, so a restarted peer is picked up.
+
+#include "net/TeleopPacket.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace PandaUtils {
+
+struct UdpTeleopConfig
+{
+	// 0 when the udp transport is not used
+	int local_port;
+	std::string remote_host;
+	int remote_port;
+	// both sides of a link use the same channel
+	uint16_t channel;
+	// seconds without packet after which the link is timed out
+	double timeout;
+
+	UdpTeleopConfig()
+	: local_port(0),
+	  remote_port(0),
+	  channel(0),
+	  timeout(0.1)
+	{}
+
+	bool enabled() const
+	{
+		return local_port > 0;
+	}
+
+	// the same link for another device, on the next ports and channel
+	UdpTeleopConfig forDevice(const int device_index) const
+	{
+		UdpTeleopConfig config = *this;
+		config.local_port += device_index;
+		config.remote_port += device_index;
+		config.channel += device_index;
+		return config;
+	}
+
+	// app --udp-teleop <local port> <remote host> <remote port>, not enabled without it
+	static UdpTeleopConfig fromArgs(const int argc, char** argv)
+	{
+		UdpTeleopConfig config;
+		for(int i=1 ; i<argc-3 ; i++)
+		{
+			if(std::string(argv[i]) == "--udp-teleop")
+			{
+				config.local_port = atoi(argv[i+1]);
+				config.remote_host = argv[i+2];
+				config.remote_port = atoi(argv[i+3]);
+				if(config.local_port <= 0 || config.remote_port <= 0)
+				{
+					throw std::invalid_argument("usage : --udp-teleop <local port> <remote host> <remote port> in UdpTeleopConfig::fromArgs()\n");
+				}
+			}
+		}
+		return config;
+	}
+};
+
+class UdpTeleopLink {
+public:
+
+	UdpTeleopLink(const UdpTeleopConfig& config)
+	: _config(config),
+	  _socket(-1),
+	  _sequence(0),
+	  _last_sequence(0),
+	  _f_received(false),
+	  _n_sent(0),
+	  _n_send_errors(0),
+	  _n_received(0),
+	  _n_stale(0),
+	  _n_gaps(0),
+	  _n_malformed(0)
+	{
+		if(!config.enabled() || config.remote_port <= 0 || config.timeout <= 0)
+		{
+			throw std::invalid_argument("ports and timeout should be positive in UdpTeleopLink::UdpTeleopLink()\n");
+		}
+
+		addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_DGRAM;
+		addrinfo* remote = NULL;
+		if(getaddrinfo(config.remote_host.c_str(), NULL, &hints, &remote) != 0 || remote == NULL)
+		{
+			throw std::runtime_error("could not resolve " + config.remote_host + " in UdpTeleopLink::UdpTeleopLink()\n");
+		}
+		memcpy(&_remote_address, remote->ai_addr, sizeof(_remote_address));
+		_remote_address.sin_port = htons(config.remote_port);
+		freeaddrinfo(remote);
+
+		_socket = socket(AF_INET, SOCK_DGRAM, 0);
+		if(_socket < 0)
+		{
+			throw std::runtime_error("could not open the socket in UdpTeleopLink::UdpTeleopLink()\n");
+		}
+		sockaddr_in local_address;
+		memset(&local_address, 0, sizeof(local_address));
+		local_address.sin_family = AF_INET;
+		local_address.sin_addr.s_addr = htonl(INADDR_ANY);
+		local_address.sin_port = htons(config.local_port);
+		if(bind(_socket, reinterpret_cast<const sockaddr*>(&local_address), sizeof(local_address)) < 0)
+		{
+			::close(_socket);
+			throw std::runtime_error("could not bind the port " + std::to_string(config.local_port) + " in UdpTeleopLink::UdpTeleopLink()\n");
+		}
+		fcntl(_socket, F_SETFL, fcntl(_socket, F_GETFL, 0) | O_NONBLOCK);
+		// low delay class for the routers that honor it, nothing when they do not
+		int tos = IPTOS_LOWDELAY;
+		setsockopt(_socket, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+
+		_last_packet_time = std::chrono::steady_clock::now();
+	}
+
+	~UdpTeleopLink()
+	{
+		if(_socket >= 0)
+		{
+			::close(_socket);
+		}
+	}
+
+	// stamps packet with the header and the next sequence number and sends it. returns false
+	// when the datagram could not be queued (full socket buffer, no route), it is then lost
+	bool send(TeleopPacket& packet, const double time)
+	{
+		packet.magic = TeleopPacket::MAGIC;
+		packet.version = TeleopPacket::VERSION;
+		packet.channel = _config.channel;
+		packet.sequence = ++_sequence;
+		packet.send_time = time;
+		const ssize_t n = sendto(_socket, &packet, sizeof(TeleopPacket), MSG_DONTWAIT,
+				reinterpret_cast<const sockaddr*>(&_remote_address), sizeof(_remote_address));
+		if(n != (ssize_t) sizeof(TeleopPacket))
+		{
+			_n_send_errors++;
+			return false;
+		}
+		_n_sent++;
+		return true;
+	}
+
+	// reads all the datagrams waiting on the socket. returns true and the newest packet when
+	// one is newer than the last packet returned, false otherwise (packet is not changed)
+	bool receive(TeleopPacket& packet)
+	{
+		bool f_new_packet = false;
+		while(true)
+		{
+			const ssize_t n = recv(_socket, &_buffer, sizeof(TeleopPacket), MSG_DONTWAIT);
+			if(n < 0)
+			{
+				// EAGAIN when drained, the other errors (e.g. icmp port unreachable of a
+				// stopped peer) are left to the timeout
+				break;
+			}
+			if(n != (ssize_t) sizeof(TeleopPacket) || _buffer.magic != TeleopPacket::MAGIC
+				|| _buffer.version != TeleopPacket::VERSION || _buffer.channel != _config.channel)
+			{
+				_n_malformed++;
+				continue;
+			}
+			_n_received++;
+			if(_f_received && _buffer.sequence <= _last_sequence && !timedOut())
+			{
+				_n_stale++;
+				continue;
+			}
+			if(_f_received && _buffer.sequence > _last_sequence + 1)
+			{
+				_n_gaps += _buffer.sequence - _last_sequence - 1;
+			}
+			_last_sequence = _buffer.sequence;
+			_f_received = true;
+			_last_packet_time = std::chrono::steady_clock::now();
+			packet = _buffer;
+			f_new_packet = true;
+		}
+		return f_new_packet;
+	}
+
+	// no packet for the timeout, or none yet
+	bool timedOut() const
+	{
+		return !_f_received || secondsSinceLastPacket() > _config.timeout;
+	}
+
+	double secondsSinceLastPacket() const
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - _last_packet_time).count();
+	}
+
+	const UdpTeleopConfig& config() const
+	{
+		return _config;
+	}
+
+	uint64_t sent() const { return _n_sent; }
+	uint64_t sendErrors() const { return _n_send_errors; }
+	uint64_t received() const { return _n_received; }
+	// older than the last packet returned, dropped
+	uint64_t stale() const { return _n_stale; }
+	// sequence numbers skipped, lost or still in flight
+	uint64_t gaps() const { return _n_gaps; }
+	uint64_t malformed() const { return _n_malformed; }
+
+	// one line, e.g. "sent 40000, received 39871, stale 12, gaps 117, malformed 0"
+	std::string summary() const
+	{
+		return "sent " + std::to_string(_n_sent) + ", received " + std::to_string(_n_received)
+			+ ", stale " + std::to_string(_n_stale) + ", gaps " + std::to_string(_n_gaps)
+			+ ", malformed " + std::to_string(_n_malformed);
+	}
+
+private:
+	UdpTeleopLink(const UdpTeleopLink&);
+	UdpTeleopLink& operator=(const UdpTeleopLink&);
+
+	const UdpTeleopConfig _config;
+	int _socket;
+	sockaddr_in _remote_address;
+
+	uint64_t _sequence;
+	uint64_t _last_sequence;
+	bool _f_received;
+	std::chrono::steady_clock::time_point _last_packet_time;
+	TeleopPacket _buffer;
+
+	uint64_t _n_sent;
+	uint64_t _n_send_errors;
+	uint64_t _n_received;
+	uint64_t _n_stale;
+	uint64_t _n_gaps;
+	uint64_t _n_malformed;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_NET_UDP_TELEOP_LINK_H_
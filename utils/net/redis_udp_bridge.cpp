@@ -0,0 +1,316 @@
+// Node to node bridge of redis keys over UDP, for running the simulation, the controllers and
+// the haptic stations of an app on different machines, each with its own redis server.
+//
+// usage : redis_udp_bridge <node> <keys file> <local port> <remote host> <remote port> [options]
+//   -f hz        rate of the bridge (default 1000)
+//   -c channel   channel of the link, the same on both nodes (default 0)
+//   --cpu n      runs the bridge with the fifo scheduler on cpu n
+//
+// the keys file is the same on both nodes, one key per line : the node that owns the key,
+// the key and its size (n for a vector, rxc for a matrix, 1 for a number). '#' starts a
+// comment. every cycle the bridge reads the keys of its node from the local redis server in
+// one round trip and sends them in one datagram, and writes the newest keys of the other
+// node to the local server, e.g. with the simulation of 08-simulation_electric_cables on a
+// machine sim-pc and its controller on ctrl-pc :
+//
+//   sim-pc  : redis-server & simviz08 & redis_udp_bridge sim distributed.keys 9910 ctrl-pc 9911 --cpu 3
+//   ctrl-pc : redis-server & controller08 & redis_udp_bridge ctrl distributed.keys 9911 sim-pc 9910 --cpu 3
+//
+// the apps are unchanged, they talk to the redis server of their machine. the keys of the
+// other node are not written before they arrive, and keep their last values when the link
+// is down. only numeric keys are bridged, string keys (modes, flags) should be set on both
+// nodes. the bridges ping each other ten times a second to synchronize their clocks (see
+// net/ClockSync.h), and publish every second :
+//
+//   sai2::PandaApplication::bridge::<node>::latency_stats   one way latency and round trips
+//   sai2::PandaApplication::bridge::<node>::clock_offset    seconds, clock of the other node
+//                                                           minus the steady clock of this one
+
+#include "redis/RedisClient.h"
+#include "redis/RedisLatencyStats.h"
+#include "timer/LoopTimer.h"
+#include "threads/RealtimeThread.h"
+#include "net/UdpKeyBridge.h"
+
+#include <signal.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+bool runloop = false;
+void sighandler(int){runloop = false;}
+
+const string BRIDGE_KEY_PREFIX = "sai2::PandaApplication::bridge::";
+
+struct BridgedKey
+{
+	string node;
+	string key;
+	int rows;
+	int cols;
+};
+
+// the keys of the file, in its order. throws on a malformed line
+vector<BridgedKey> readKeysFile(const string& file_name)
+{
+	ifstream file(file_name);
+	if(!file)
+	{
+		throw runtime_error("could not open " + file_name + " in readKeysFile()\n");
+	}
+	vector<BridgedKey> keys;
+	string line;
+	int line_number = 0;
+	while(getline(file, line))
+	{
+		line_number++;
+		const size_t comment = line.find('#');
+		if(comment != string::npos)
+		{
+			line = line.substr(0, comment);
+		}
+		istringstream words(line);
+		BridgedKey bridged_key;
+		string size;
+		if(!(words >> bridged_key.node))
+		{
+			continue;
+		}
+		string extra;
+		if(!(words >> bridged_key.key >> size) || (words >> extra))
+		{
+			throw runtime_error("expected <node> <key> <size> at line " + to_string(line_number) + " of " + file_name + " in readKeysFile()\n");
+		}
+		bridged_key.cols = 1;
+		if(sscanf(size.c_str(), "%dx%d", &bridged_key.rows, &bridged_key.cols) < 1
+			|| bridged_key.rows < 1 || bridged_key.cols < 1)
+		{
+			throw runtime_error("bad size " + size + " at line " + to_string(line_number) + " of " + file_name + " in readKeysFile()\n");
+		}
+		keys.push_back(bridged_key);
+	}
+	return keys;
+}
+
+int main(int argc, char** argv)
+{
+	if(argc < 6)
+	{
+		cout << "usage : " << argv[0] << " <node> <keys file> <local port> <remote host> <remote port> [-f hz] [-c channel] [--cpu n]" << endl;
+		return 2;
+	}
+
+	const string node = argv[1];
+	PandaUtils::UdpTeleopConfig config;
+	config.local_port = atoi(argv[3]);
+	config.remote_host = argv[4];
+	config.remote_port = atoi(argv[5]);
+	double frequency = 1000.0;
+	int cpu = -1;
+	for(int i=6 ; i<argc-1 ; i++)
+	{
+		const string arg = argv[i];
+		if(arg == "-f")
+		{
+			frequency = atof(argv[++i]);
+		}
+		else if(arg == "-c")
+		{
+			config.channel = atoi(argv[++i]);
+		}
+		else if(arg == "--cpu")
+		{
+			cpu = atoi(argv[++i]);
+		}
+	}
+	if(frequency <= 0)
+	{
+		cout << "the rate should be positive" << endl;
+		return 2;
+	}
+
+	const vector<BridgedKey> keys = readKeysFile(argv[2]);
+	vector<BridgedKey> local_keys;
+	vector<BridgedKey> remote_keys;
+	int n_local_values = 0;
+	int n_remote_values = 0;
+	for(unsigned int i=0 ; i<keys.size() ; i++)
+	{
+		if(keys[i].node == node)
+		{
+			local_keys.push_back(keys[i]);
+			n_local_values += keys[i].rows * keys[i].cols;
+		}
+		else
+		{
+			remote_keys.push_back(keys[i]);
+			n_remote_values += keys[i].rows * keys[i].cols;
+		}
+	}
+
+	RedisClient redis_client;
+	redis_client.connect();
+
+	// one matrix or number per key, registered in the callbacks once, so they should not move
+	vector<MatrixXd> local_matrices(local_keys.size());
+	vector<double> local_numbers(local_keys.size(), 0.0);
+	redis_client.createReadCallback(0);
+	for(unsigned int i=0 ; i<local_keys.size() ; i++)
+	{
+		if(local_keys[i].rows * local_keys[i].cols == 1)
+		{
+			redis_client.addDoubleToReadCallback(0, local_keys[i].key, local_numbers[i]);
+		}
+		else
+		{
+			local_matrices[i] = MatrixXd::Zero(local_keys[i].rows, local_keys[i].cols);
+			redis_client.addEigenToReadCallback(0, local_keys[i].key, local_matrices[i]);
+		}
+	}
+	vector<MatrixXd> remote_matrices(remote_keys.size());
+	vector<double> remote_numbers(remote_keys.size(), 0.0);
+	redis_client.createWriteCallback(0);
+	for(unsigned int i=0 ; i<remote_keys.size() ; i++)
+	{
+		if(remote_keys[i].rows * remote_keys[i].cols == 1)
+		{
+			redis_client.addDoubleToWriteCallback(0, remote_keys[i].key, remote_numbers[i]);
+		}
+		else
+		{
+			remote_matrices[i] = MatrixXd::Zero(remote_keys[i].rows, remote_keys[i].cols);
+			redis_client.addEigenToWriteCallback(0, remote_keys[i].key, remote_matrices[i]);
+		}
+	}
+
+	const string LATENCY_STATS_KEY = BRIDGE_KEY_PREFIX + node + "::latency_stats";
+	const string CLOCK_OFFSET_KEY = BRIDGE_KEY_PREFIX + node + "::clock_offset";
+	PandaUtils::RedisLatencyStats link_stats;
+	PandaUtils::LatencyHistogram& one_way_latency = link_stats.histogram("one way latency");
+	PandaUtils::LatencyHistogram& round_trip = link_stats.histogram("round trip");
+
+	PandaUtils::UdpKeyBridge bridge(config, n_local_values, n_remote_values);
+	VectorXd local_values = VectorXd::Zero(n_local_values);
+	VectorXd remote_values = VectorXd::Zero(n_remote_values);
+
+	if(cpu >= 0 && !PandaUtils::configureRealtimeThread("redis_udp_bridge", PandaUtils::RealtimeConfig::fifo(80, {cpu})))
+	{
+		cout << "could not run the bridge with the fifo scheduler on cpu " << cpu << endl;
+	}
+
+	LoopTimer timer;
+	timer.initializeTimer();
+	timer.setLoopFrequency(frequency);
+	double start_time = timer.elapsedTime();
+	double next_ping_time = 0;
+	double next_publish_time = 1.0;
+	unsigned long long n_size_errors = 0;
+	uint64_t n_pongs = 0;
+	bool f_receiving = false;
+
+	signal(SIGABRT, &sighandler);
+	signal(SIGTERM, &sighandler);
+	signal(SIGINT, &sighandler);
+	runloop = true;
+
+	cout << "bridging " << local_keys.size() << " keys to and " << remote_keys.size() << " keys from "
+		<< config.remote_host << ":" << config.remote_port << " from port " << config.local_port
+		<< " at " << frequency << " Hz" << endl;
+
+	while(runloop)
+	{
+		timer.waitForNextLoop();
+		const double time = timer.elapsedTime() - start_time;
+
+		redis_client.executeReadCallback(0);
+		int index = 0;
+		for(unsigned int i=0 ; i<local_keys.size() ; i++)
+		{
+			const int size = local_keys[i].rows * local_keys[i].cols;
+			if(size == 1)
+			{
+				local_values(index) = local_numbers[i];
+			}
+			else if(local_matrices[i].rows() == local_keys[i].rows && local_matrices[i].cols() == local_keys[i].cols)
+			{
+				local_values.segment(index, size) = Map<const VectorXd>(local_matrices[i].data(), size);
+			}
+			else
+			{
+				// not the size of the keys file, the last value is sent
+				n_size_errors++;
+			}
+			index += size;
+		}
+		bridge.send(local_values);
+
+		if(bridge.receive(remote_values))
+		{
+			index = 0;
+			for(unsigned int i=0 ; i<remote_keys.size() ; i++)
+			{
+				const int size = remote_keys[i].rows * remote_keys[i].cols;
+				if(size == 1)
+				{
+					remote_numbers[i] = remote_values(index);
+				}
+				else
+				{
+					remote_matrices[i] = Map<const MatrixXd>(remote_values.data() + index, remote_keys[i].rows, remote_keys[i].cols);
+				}
+				index += size;
+			}
+			redis_client.executeWriteCallback(0);
+			if(bridge.clock().synchronized())
+			{
+				one_way_latency.record(bridge.lastLatency() > 0 ? (uint64_t) (1e9 * bridge.lastLatency()) : 0);
+			}
+			if(!f_receiving)
+			{
+				cout << "keys from " << config.remote_host << endl;
+				f_receiving = true;
+			}
+		}
+		else if(f_receiving && bridge.timedOut())
+		{
+			cout << "no keys from " << config.remote_host << " for " << config.timeout << " s" << endl;
+			f_receiving = false;
+		}
+		if(bridge.pongs() != n_pongs)
+		{
+			n_pongs = bridge.pongs();
+			round_trip.record((uint64_t) (1e9 * bridge.lastRoundTrip()));
+		}
+
+		if(time >= next_ping_time)
+		{
+			bridge.ping();
+			next_ping_time = time + 0.1;
+		}
+		if(time >= next_publish_time)
+		{
+			link_stats.publish(redis_client, LATENCY_STATS_KEY);
+			if(bridge.clock().synchronized())
+			{
+				redis_client.set(CLOCK_OFFSET_KEY, to_string(bridge.clock().offset()));
+			}
+			next_publish_time = time + 1.0;
+		}
+	}
+
+	cout << "\nudp bridge : " << bridge.summary() << endl;
+	if(n_size_errors > 0)
+	{
+		cout << n_size_errors << " local keys with a size other than in the keys file" << endl;
+	}
+	link_stats.print(cout);
+	return 0;
+}
@@ -0,0 +1,206 @@
+// Haptic station side of the UDP teleoperation link : sends the state of a haptic device to
+// the robot controller and renders the commands it sends back.
+//
+// usage : udp_haptic_bridge <local port> <robot host> <robot port> [options]
+//   -d n             device index of the haptic driver keys (default 0), also the channel
+//   -f hz            rate of the device state packets (default 1000)
+//   --robot-redis h  copies the device specifications to the redis server of the robot side
+//                    once, for the controllers that read them at the start
+//   --deadband hz    sends the device state only when the position or the sensed force
+//                    changes perceptibly, within a budget of hz (see net/PerceptualDeadband.h)
+//
+// the bridge reads the sensor keys of the chai haptic driver on the local redis server every
+// cycle, sends them in one datagram, and writes the newest commands received to the actuator
+// keys. the controller on the robot side runs with --udp-teleop <its port> <station host>
+// <bridge port> (see net/UdpHapticDevice.h), e.g. for one device :
+//
+//   haptic station : udp_haptic_bridge 9901 robot-pc.local 9900 --robot-redis robot-pc.local
+//   robot          : controller14 --udp-teleop 9900 haptic-station.local 9901
+//
+// for device n, the controllers use the ports after the ones of device 0 (9900 + n and
+// 9901 + n), and the bridge of device n is started with -d n on these ports. when no
+// command arrives for the link timeout (the controller stopped, or the link is down), the
+// bridge commands zero force to the device until the commands come back.
+
+#include "redis/RedisClient.h"
+#include "timer/LoopTimer.h"
+#include "net/UdpTeleopLink.h"
+#include "net/PerceptualDeadband.h"
+
+#include <signal.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace std;
+using namespace Eigen;
+
+bool runloop = false;
+void sighandler(int){runloop = false;}
+
+const string DEVICE_KEY_PREFIX = "sai2::ChaiHapticDevice::device";
+
+int main(int argc, char** argv)
+{
+	if(argc < 4)
+	{
+		cout << "usage : " << argv[0] << " <local port> <robot host> <robot port> [-d device] [-f hz] [--robot-redis host] [--deadband hz]" << endl;
+		return 2;
+	}
+
+	PandaUtils::UdpTeleopConfig config;
+	config.local_port = atoi(argv[1]);
+	config.remote_host = argv[2];
+	config.remote_port = atoi(argv[3]);
+	int device_index = 0;
+	double frequency = 1000.0;
+	string robot_redis_host;
+	for(int i=4 ; i<argc-1 ; i++)
+	{
+		const string arg = argv[i];
+		if(arg == "-d")
+		{
+			device_index = atoi(argv[++i]);
+		}
+		else if(arg == "-f")
+		{
+			frequency = atof(argv[++i]);
+		}
+		else if(arg == "--robot-redis")
+		{
+			robot_redis_host = argv[++i];
+		}
+	}
+	config.channel = device_index;
+	if(frequency <= 0)
+	{
+		cout << "the rate should be positive" << endl;
+		return 2;
+	}
+
+	const string prefix = DEVICE_KEY_PREFIX + to_string(device_index);
+	const string MAX_STIFFNESS_KEY = prefix + "::specifications::max_stiffness";
+	const string MAX_DAMPING_KEY = prefix + "::specifications::max_damping";
+	const string MAX_FORCE_KEY = prefix + "::specifications::max_force";
+	const string COMMANDED_FORCE_KEY = prefix + "::actuators::commanded_force";
+	const string COMMANDED_TORQUE_KEY = prefix + "::actuators::commanded_torque";
+	const string COMMANDED_GRIPPER_FORCE_KEY = prefix + "::actuators::commanded_force_gripper";
+
+	RedisClient redis_client;
+	redis_client.connect();
+
+	if(!robot_redis_host.empty())
+	{
+		RedisClient robot_redis_client;
+		robot_redis_client.connect(robot_redis_host);
+		robot_redis_client.setEigenMatrixJSON(MAX_STIFFNESS_KEY, redis_client.getEigenMatrixJSON(MAX_STIFFNESS_KEY));
+		robot_redis_client.setEigenMatrixJSON(MAX_DAMPING_KEY, redis_client.getEigenMatrixJSON(MAX_DAMPING_KEY));
+		robot_redis_client.setEigenMatrixJSON(MAX_FORCE_KEY, redis_client.getEigenMatrixJSON(MAX_FORCE_KEY));
+		cout << "device specifications copied to " << robot_redis_host << endl;
+	}
+
+	// device state, read in one round trip
+	Vector3d position = Vector3d::Zero();
+	Matrix3d rotation = Matrix3d::Identity();
+	Vector3d velocity = Vector3d::Zero();
+	Vector3d angular_velocity = Vector3d::Zero();
+	Vector3d sensed_force = Vector3d::Zero();
+	Vector3d sensed_torque = Vector3d::Zero();
+	double gripper_position = 0;
+	double gripper_velocity = 0;
+	redis_client.createReadCallback(0);
+	redis_client.addEigenToReadCallback(0, prefix + "::sensors::current_position", position);
+	redis_client.addEigenToReadCallback(0, prefix + "::sensors::current_rotation", rotation);
+	redis_client.addEigenToReadCallback(0, prefix + "::sensors::current_trans_velocity", velocity);
+	redis_client.addEigenToReadCallback(0, prefix + "::sensors::current_rot_velocity", angular_velocity);
+	redis_client.addEigenToReadCallback(0, prefix + "::sensors::sensed_force", sensed_force);
+	redis_client.addEigenToReadCallback(0, prefix + "::sensors::sensed_torque", sensed_torque);
+	redis_client.addDoubleToReadCallback(0, prefix + "::sensors::current_position_gripper", gripper_position);
+	redis_client.addDoubleToReadCallback(0, prefix + "::sensors::current_gripper_velocity", gripper_velocity);
+
+	// commands, written in one round trip
+	Vector3d commanded_force = Vector3d::Zero();
+	Vector3d commanded_torque = Vector3d::Zero();
+	double commanded_gripper_force = 0;
+	redis_client.createWriteCallback(0);
+	redis_client.addEigenToWriteCallback(0, COMMANDED_FORCE_KEY, commanded_force);
+	redis_client.addEigenToWriteCallback(0, COMMANDED_TORQUE_KEY, commanded_torque);
+	redis_client.addDoubleToWriteCallback(0, COMMANDED_GRIPPER_FORCE_KEY, commanded_gripper_force);
+
+	const PandaUtils::DeadbandConfig deadband_config = PandaUtils::DeadbandConfig::fromArgs(argc, argv);
+	PandaUtils::PerceptualDeadband state_deadband(deadband_config);
+
+	PandaUtils::UdpTeleopLink link(config);
+	PandaUtils::TeleopPacket state;
+	PandaUtils::TeleopPacket command;
+
+	LoopTimer timer;
+	timer.initializeTimer();
+	timer.setLoopFrequency(frequency);
+	double start_time = timer.elapsedTime();
+	bool f_commanding = false;
+
+	signal(SIGABRT, &sighandler);
+	signal(SIGTERM, &sighandler);
+	signal(SIGINT, &sighandler);
+	runloop = true;
+
+	cout << "bridging device " << device_index << " to " << config.remote_host << ":" << config.remote_port
+		<< " from port " << config.local_port << " at " << frequency << " Hz" << endl;
+
+	while(runloop)
+	{
+		timer.waitForNextLoop();
+		const double time = timer.elapsedTime() - start_time;
+
+		redis_client.executeReadCallback(0);
+		Map<Vector3d>(state.position) = position;
+		Map<Matrix3d>(state.rotation) = rotation;
+		Map<Vector3d>(state.velocity) = velocity;
+		Map<Vector3d>(state.angular_velocity) = angular_velocity;
+		Map<Vector3d>(state.force) = sensed_force;
+		Map<Vector3d>(state.torque) = sensed_torque;
+		state.gripper_position = gripper_position;
+		state.gripper_velocity = gripper_velocity;
+		if(!deadband_config.enabled() || state_deadband.update(position, sensed_force, time))
+		{
+			link.send(state, time);
+		}
+
+		if(link.receive(command))
+		{
+			commanded_force = Map<const Vector3d>(command.force);
+			commanded_torque = Map<const Vector3d>(command.torque);
+			commanded_gripper_force = command.gripper_force;
+			if(!f_commanding)
+			{
+				cout << "commands from the robot side" << endl;
+				f_commanding = true;
+			}
+		}
+		else if(link.timedOut())
+		{
+			commanded_force.setZero();
+			commanded_torque.setZero();
+			commanded_gripper_force = 0;
+			if(f_commanding)
+			{
+				cout << "no commands for " << config.timeout << " s, zero force" << endl;
+				f_commanding = false;
+			}
+		}
+		redis_client.executeWriteCallback(0);
+	}
+
+	redis_client.setEigenMatrixJSON(COMMANDED_FORCE_KEY, Vector3d::Zero());
+	redis_client.setEigenMatrixJSON(COMMANDED_TORQUE_KEY, Vector3d::Zero());
+	redis_client.set(COMMANDED_GRIPPER_FORCE_KEY, "0.0");
+
+	cout << "\nudp link : " << link.summary() << endl;
+	if(deadband_config.enabled())
+	{
+		cout << "device state : " << state_deadband.summary() << endl;
+	}
+	return 0;
+}
@@ -0,0 +1,156 @@
+#ifndef UTILS_OBSERVERS_CONTACT_DETECTOR_H_
+#define UTILS_OBSERVERS_CONTACT_DETECTOR_H_
+
+// Contact onsets and releases from the disturbance torques of an observer, detected on
+// the estimation thread and polled by the control thread.
+//
+// the detector keeps the mean and the standard deviation of the norm of the disturbance
+// over the last window_size samples, with a SlidingWindowSum of the norm and of its square
+// (see filters/SlidingWindowSum.h), so an update is constant time whatever the window. a
+// contact starts when the windowed mean goes above the onset threshold and ends when it
+// goes back below the release threshold, lower for an hysteresis. every change is an event
+// pushed to a lock-free queue with the disturbance that triggered it, so the control loop
+// only polls the queue, e.g. with the detector run by an estimator of an EstimationStage
+// (see observers/EstimationStage.h) at the rate of the simulation :
+//
+//   PandaUtils::ContactDetector<7> detector(4, 10.0, 8.0);
+//   estimation.addEstimator([&](const Sample& sample, Eigen::Ref<Eigen::Matrix<double,7,1>> estimate)
+//   {
+//       momentum_observer->update(sample.command_torques, sample.known_torques);
+//       estimate = -momentum_observer->getDisturbanceTorqueEstimate();
+//       detector.update(sample.time, estimate);                   // estimation thread
+//   });
+//
+//   PandaUtils::ContactDetector<7>::Event event;
+//   while(detector.poll(event)) {                                 // control thread
+//       f_contact = (event.type == PandaUtils::ContactDetector<7>::ONSET);
+//   }
+//
+// events pushed while the queue is full are dropped and counted, inContact() still gives
+// the current state. nothing is allocated by update() and poll().
+
+#include "filters/SlidingWindowSum.h"
+#include "threads/SpscQueue.h"
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <stdexcept>
+
+namespace PandaUtils {
+
+template<int DOF = Eigen::Dynamic>
+class ContactDetector {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Matrix<double, DOF, 1> VectorDof;
+	typedef Eigen::Ref<const VectorDof> VectorDofInput;
+
+	enum EventType {ONSET, RELEASE};
+
+	struct Event {
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+		Event(const int dof = (DOF == Eigen::Dynamic ? 0 : DOF))
+		: type(ONSET), time(0), mean(0), stddev(0)
+		{
+			disturbance_torques.setZero(dof);
+		}
+
+		EventType type;
+		// time of the sample that changed the state
+		double time;
+		// of the norm of the disturbance over the window
+		double mean;
+		double stddev;
+		VectorDof disturbance_torques;
+	};
+
+	ContactDetector(const int window_size, const double onset_threshold, const double release_threshold,
+			const int dof = (DOF == Eigen::Dynamic ? 0 : DOF), const int queue_capacity = 16)
+	: _window(window_size),
+	  _onset_threshold(onset_threshold),
+	  _release_threshold(release_threshold),
+	  _events(queue_capacity, Event(dof)),
+	  _f_contact(false),
+	  _n_dropped(0)
+	{
+		if(DOF == Eigen::Dynamic && dof < 1)
+		{
+			throw std::invalid_argument("dof should be given for a dynamic size detector in ContactDetector::ContactDetector()\n");
+		}
+		if(release_threshold > onset_threshold)
+		{
+			throw std::invalid_argument("release threshold should not be above the onset threshold in ContactDetector::ContactDetector()\n");
+		}
+		_stats.setZero();
+	}
+
+	// estimation thread only : updates the window with the disturbance of a sample, returns
+	// true if the contact state changed
+	bool update(const double time, const VectorDofInput& disturbance_torques)
+	{
+		const double norm = disturbance_torques.norm();
+		_stats(0) = norm;
+		_stats(1) = norm * norm;
+		_window.push(_stats);
+
+		const bool f_contact = _f_contact.load(std::memory_order_relaxed);
+		const double mean = _window.sum()(0) / _window.size();
+		const bool f_new_contact = f_contact ? (mean >= _release_threshold) : (mean > _onset_threshold);
+		if(f_new_contact == f_contact)
+		{
+			return false;
+		}
+		_f_contact.store(f_new_contact, std::memory_order_release);
+
+		Event* event = _events.beginPush();
+		if(!event)
+		{
+			_n_dropped++;
+			return true;
+		}
+		event->type = f_new_contact ? ONSET : RELEASE;
+		event->time = time;
+		event->mean = mean;
+		event->stddev = std::sqrt(std::max(0.0, _window.sum()(1) / _window.size() - mean * mean));
+		event->disturbance_torques = disturbance_torques;
+		_events.endPush();
+		return true;
+	}
+
+	// control thread only : copies the oldest event not polled yet, false if there is none
+	bool poll(Event& event)
+	{
+		return _events.pop(event);
+	}
+
+	// state after the last update, from any thread
+	bool inContact() const
+	{
+		return _f_contact.load(std::memory_order_acquire);
+	}
+
+	unsigned long long numDroppedEvents() const
+	{
+		return _n_dropped;
+	}
+
+private:
+
+	// norm of the disturbance and its square
+	SlidingWindowSum<2> _window;
+	Eigen::Vector2d _stats;
+	const double _onset_threshold;
+	const double _release_threshold;
+
+	SpscQueue<Event, Eigen::aligned_allocator<Event> > _events;
+	std::atomic<bool> _f_contact;
+	std::atomic<unsigned long long> _n_dropped;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_OBSERVERS_CONTACT_DETECTOR_H_
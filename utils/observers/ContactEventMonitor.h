@@ -0,0 +1,366 @@
+#ifndef UTILS_OBSERVERS_CONTACT_EVENT_MONITOR_H_
+#define UTILS_OBSERVERS_CONTACT_EVENT_MONITOR_H_
+
+// Contact transitions of the links of a robot as timestamped events, detected on their own
+// thread from the disturbance torques of an observer.
+//
+// the control loop pushes the (filtered) disturbance torques to a lock-free queue. the
+// monitor thread runs two detectors on every sample :
+//
+//   - the link detector : the last joint whose disturbance is above link_threshold is the
+//     link in contact of the sample. the links of the last debounce_samples samples are
+//     counted, a contact starts when all of them have a link and ends when none has. the
+//     link in contact is the most counted one, a change of it is an event too.
+//   - the impact detector : the rate of change of the norm of the disturbance above
+//     impact_rate is an impact, a few samples before the debounced onset. it re-arms when
+//     the rate goes back below half of impact_rate.
+//
+// the events go to a second queue, the state machine of the control loop polls it and only
+// reacts to the transitions instead of evaluating the conditions at every tick :
+//
+//   PandaUtils::ContactEventMonitor<7> contact_monitor(0.3, 20, 30.0);
+//   contact_monitor.start();
+//   while(...) {                                                  // control loop
+//       contact_monitor.pushSample(time, r_filtered);
+//       PandaUtils::ContactEventMonitor<7>::Event event;
+//       while(contact_monitor.poll(event)) {
+//           if(event.type == PandaUtils::ContactEventMonitor<7>::ONSET) ... event.link ...
+//       }
+//   }
+//   contact_monitor.stop();
+//
+// update() runs the detectors on the calling thread, without start(). samples and events
+// pushed while a queue is full are dropped and counted. nothing is allocated by
+// pushSample() and poll().
+
+#include "threads/SpscQueue.h"
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace PandaUtils {
+
+template<int DOF = Eigen::Dynamic>
+class ContactEventMonitor {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Matrix<double, DOF, 1> VectorDof;
+	typedef Eigen::Ref<const VectorDof> VectorDofInput;
+
+	enum EventType {ONSET, RELEASE, LINK_CHANGE, IMPACT};
+
+	struct Event {
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+		Event(const int dof = (DOF == Eigen::Dynamic ? 0 : DOF))
+		: type(ONSET), time(0), link(-1), rate(0)
+		{
+			disturbance_torques.setZero(dof);
+		}
+
+		EventType type;
+		// time of the sample that triggered the event
+		double time;
+		// link in contact after the event, -1 after a release. the link of the sample for an impact
+		int link;
+		// rate of change of the norm of the disturbance
+		double rate;
+		VectorDof disturbance_torques;
+	};
+
+	ContactEventMonitor(const double link_threshold, const int debounce_samples, const double impact_rate,
+			const int dof = (DOF == Eigen::Dynamic ? 0 : DOF), const int queue_capacity = 64,
+			const int event_capacity = 16, const int idle_sleep_us = 100)
+	: _dof(dof),
+	  _link_threshold(link_threshold),
+	  _impact_rate(impact_rate),
+	  _samples(queue_capacity, Sample(dof)),
+	  _events(event_capacity, Event(dof)),
+	  _idle_sleep_us(idle_sleep_us),
+	  _running(false),
+	  _n_dropped_samples(0),
+	  _n_dropped_events(0)
+	{
+		if(DOF == Eigen::Dynamic && dof < 1)
+		{
+			throw std::invalid_argument("dof should be given for a dynamic size monitor in ContactEventMonitor::ContactEventMonitor()\n");
+		}
+		if(debounce_samples < 1 || link_threshold <= 0 || impact_rate <= 0)
+		{
+			throw std::invalid_argument("debounce samples and thresholds should be positive in ContactEventMonitor::ContactEventMonitor()\n");
+		}
+		_sample_links.assign(debounce_samples, -1);
+		_link_counts.assign(dof, 0);
+		reset();
+	}
+
+	~ContactEventMonitor()
+	{
+		stop();
+	}
+
+	ContactEventMonitor(const ContactEventMonitor&) = delete;
+	ContactEventMonitor& operator=(const ContactEventMonitor&) = delete;
+
+	void start()
+	{
+		if(_running)
+		{
+			return;
+		}
+		_running = true;
+		_thread = std::thread(&ContactEventMonitor::monitorLoop, this);
+	}
+
+	// processes the samples already queued, then joins the thread
+	void stop()
+	{
+		if(!_running)
+		{
+			return;
+		}
+		_running = false;
+		_thread.join();
+	}
+
+	// control thread only, false if the queue was full and the sample dropped
+	bool pushSample(const double time, const VectorDofInput& disturbance_torques)
+	{
+		Sample* sample = _samples.beginPush();
+		if(!sample)
+		{
+			_n_dropped_samples++;
+			return false;
+		}
+		sample->time = time;
+		sample->disturbance_torques = disturbance_torques;
+		_samples.endPush();
+		return true;
+	}
+
+	// control thread only : copies the oldest event not polled yet, false if there is none
+	bool poll(Event& event)
+	{
+		return _events.pop(event);
+	}
+
+	unsigned long long numDroppedSamples() const { return _n_dropped_samples; }
+	unsigned long long numDroppedEvents() const { return _n_dropped_events; }
+
+	// monitor thread, or without start() : runs the detectors on a sample
+	void update(const double time, const VectorDofInput& disturbance_torques)
+	{
+		// impact detector
+		const double norm = disturbance_torques.norm();
+		if(_f_first_sample)
+		{
+			_f_first_sample = false;
+		}
+		else if(time > _prev_time)
+		{
+			const double rate = (norm - _prev_norm) / (time - _prev_time);
+			if(_f_impact_armed && rate > _impact_rate)
+			{
+				_f_impact_armed = false;
+				pushEvent(IMPACT, time, sampleLink(disturbance_torques), rate, disturbance_torques);
+			}
+			else if(!_f_impact_armed && rate < 0.5 * _impact_rate)
+			{
+				_f_impact_armed = true;
+			}
+			_rate = rate;
+		}
+		_prev_norm = norm;
+		_prev_time = time;
+
+		// link detector, the sample replaces the oldest one of the window
+		const int link = sampleLink(disturbance_torques);
+		const int n_window = _sample_links.size();
+		int& oldest = _sample_links[_next_sample];
+		if(oldest == -1)
+		{
+			_n_without_link--;
+		}
+		else
+		{
+			_link_counts[oldest]--;
+		}
+		oldest = link;
+		if(link == -1)
+		{
+			_n_without_link++;
+		}
+		else
+		{
+			_link_counts[link]++;
+		}
+		_next_sample = (_next_sample + 1) % n_window;
+
+		if(!_f_contact && _n_without_link == 0)
+		{
+			_f_contact = true;
+			_link = mostCountedLink();
+			pushEvent(ONSET, time, _link, _rate, disturbance_torques);
+		}
+		else if(_f_contact && _n_without_link == n_window)
+		{
+			_f_contact = false;
+			_link = -1;
+			pushEvent(RELEASE, time, -1, _rate, disturbance_torques);
+		}
+		else if(_f_contact)
+		{
+			const int most_counted = mostCountedLink();
+			if(most_counted != _link)
+			{
+				_link = most_counted;
+				pushEvent(LINK_CHANGE, time, _link, _rate, disturbance_torques);
+			}
+		}
+	}
+
+	// forgets the samples, without events
+	void reset()
+	{
+		std::fill(_sample_links.begin(), _sample_links.end(), -1);
+		std::fill(_link_counts.begin(), _link_counts.end(), 0);
+		_n_without_link = _sample_links.size();
+		_next_sample = 0;
+		_f_contact = false;
+		_link = -1;
+		_f_first_sample = true;
+		_f_impact_armed = true;
+		_prev_norm = 0;
+		_prev_time = 0;
+		_rate = 0;
+	}
+
+	// monitor thread, or without start()
+	bool inContact() const { return _f_contact; }
+	int linkInContact() const { return _link; }
+
+private:
+
+	struct Sample {
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+		Sample(const int dof = (DOF == Eigen::Dynamic ? 0 : DOF))
+		: time(0)
+		{
+			disturbance_torques.setZero(dof);
+		}
+
+		double time;
+		VectorDof disturbance_torques;
+	};
+
+	// the last joint above the threshold, -1 if none
+	int sampleLink(const VectorDofInput& disturbance_torques) const
+	{
+		int link = -1;
+		for(int i=0 ; i<_dof ; i++)
+		{
+			if(std::abs(disturbance_torques(i)) > _link_threshold)
+			{
+				link = i;
+			}
+		}
+		return link;
+	}
+
+	// the first one on a tie
+	int mostCountedLink() const
+	{
+		int link = 0;
+		for(int i=1 ; i<_dof ; i++)
+		{
+			if(_link_counts[i] > _link_counts[link])
+			{
+				link = i;
+			}
+		}
+		return link;
+	}
+
+	void pushEvent(const EventType type, const double time, const int link, const double rate,
+			const VectorDofInput& disturbance_torques)
+	{
+		Event* event = _events.beginPush();
+		if(!event)
+		{
+			_n_dropped_events++;
+			return;
+		}
+		event->type = type;
+		event->time = time;
+		event->link = link;
+		event->rate = rate;
+		event->disturbance_torques = disturbance_torques;
+		_events.endPush();
+	}
+
+	void monitorLoop()
+	{
+		while(true)
+		{
+			// read the flag before emptying the queue, so that the samples pushed before stop() are processed
+			const bool running = _running;
+			bool processed = false;
+			const Sample* sample;
+			while((sample = _samples.front()) != NULL)
+			{
+				update(sample->time, sample->disturbance_torques);
+				_samples.pop();
+				processed = true;
+			}
+			if(!processed && !running)
+			{
+				return;
+			}
+			if(!processed)
+			{
+				std::this_thread::sleep_for(std::chrono::microseconds(_idle_sleep_us));
+			}
+		}
+	}
+
+	const int _dof;
+	const double _link_threshold;
+	const double _impact_rate;
+
+	// owned by the monitor thread
+	std::vector<int> _sample_links;
+	std::vector<int> _link_counts;
+	int _n_without_link;
+	int _next_sample;
+	bool _f_contact;
+	int _link;
+	bool _f_first_sample;
+	bool _f_impact_armed;
+	double _prev_norm;
+	double _prev_time;
+	double _rate;
+
+	SpscQueue<Sample, Eigen::aligned_allocator<Sample> > _samples;
+	SpscQueue<Event, Eigen::aligned_allocator<Event> > _events;
+
+	const int _idle_sleep_us;
+	std::atomic<bool> _running;
+	std::thread _thread;
+
+	// owned by the control thread
+	unsigned long long _n_dropped_samples;
+	// owned by the monitor thread
+	std::atomic<unsigned long long> _n_dropped_events;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_OBSERVERS_CONTACT_EVENT_MONITOR_H_
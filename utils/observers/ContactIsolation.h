@@ -0,0 +1,238 @@
+#ifndef UTILS_OBSERVERS_CONTACT_ISOLATION_H_
+#define UTILS_OBSERVERS_CONTACT_ISOLATION_H_
+
+// The link in contact and the contact force, from the disturbance torques of a momentum
+// observer, by fitting a force at a candidate point of every link.
+//
+// a contact force F at a point of a link gives disturbance torques Jv^T F, with the
+// jacobian of the point, which has zeros for the joints after the link. for every candidate
+// point the stage solves the least squares problem min |gamma - Jv^T F| (3 unknowns), and
+// the candidate that explains the disturbance best is the most likely contact. picking the
+// last joint whose torque is above a threshold goes wrong as soon as several joints see the
+// contact; the fit uses all of them. the jacobians are computed on the calling thread (the
+// robot model is not thread safe) in preallocated matrices, and the fits run on the threads
+// of a WorkerPool when one is given :
+//
+//   PandaUtils::ContactIsolation contact_isolation(robot, 0.5);          // no contact below 0.5 Nm
+//   for(int i=1 ; i<=7 ; i++)
+//   {
+//       contact_isolation.addCandidate("link" + std::to_string(i), Vector3d::Zero());
+//   }
+//   ...
+//   const PandaUtils::ContactIsolation::Estimate& contact = contact_isolation.isolate(gamma);
+//   if(contact.candidate >= 0)
+//   {
+//       robot->Jv(J_contact, contact_isolation.candidate(contact.candidate).link_name,
+//               contact_isolation.candidate(contact.candidate).point_in_link);
+//       ...                                                             // contact.force in world
+//   }
+//
+// among candidates that fit as well as the best one (to the tolerance), the one closest to the
+// base is chosen, a distal link can also explain a proximal contact with its extra joints.
+// isolate() does not allocate; its duration is checked against a budget (1 ms by default)
+// and the overruns are counted.
+
+#include "Sai2Model.h"
+#include "threads/WorkerPool.h"
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+class ContactIsolation {
+public:
+
+	struct Candidate {
+		std::string link_name;
+		Eigen::Vector3d point_in_link;
+	};
+
+	struct Estimate {
+		// -1 when the disturbance is below the threshold
+		int candidate;
+		// in world, with gamma = Jv^T force (the sign of the disturbance of the observer)
+		Eigen::Vector3d force;
+		// |gamma - Jv^T F| / |gamma| of the fit
+		double relative_residual;
+	};
+
+	// no contact for disturbances of norm below threshold
+	ContactIsolation(Sai2Model::Sai2Model* robot, const double threshold, const double tolerance = 0.05,
+			const double regularization = 1e-6)
+	: _robot(robot),
+	  _threshold(threshold),
+	  _tolerance(tolerance),
+	  _regularization(regularization),
+	  _pool(NULL),
+	  _fit_function(this),
+	  _gamma(NULL),
+	  _budget(1e-3),
+	  _last_duration(0),
+	  _n_isolations(0),
+	  _n_overruns(0)
+	{
+		if(robot == NULL)
+		{
+			throw std::invalid_argument("no robot in ContactIsolation::ContactIsolation()\n");
+		}
+		_estimate.candidate = -1;
+		_estimate.force.setZero();
+		_estimate.relative_residual = 0;
+	}
+
+	// candidates in the order of the chain, from the base to the end effector
+	void addCandidate(const std::string& link_name, const Eigen::Vector3d& point_in_link)
+	{
+		Candidate candidate;
+		candidate.link_name = link_name;
+		candidate.point_in_link = point_in_link;
+		_candidates.push_back(candidate);
+		_jacobians.push_back(Eigen::MatrixXd::Zero(3, _robot->dof()));
+		Fit fit;
+		fit.force.setZero();
+		fit.residual = 0;
+		_fits.push_back(fit);
+	}
+
+	// the fits of the candidates run on the threads of the pool
+	void setWorkerPool(WorkerPool* pool)
+	{
+		_pool = pool;
+	}
+
+	// seconds
+	void setBudget(const double budget)
+	{
+		_budget = budget;
+	}
+
+	const Estimate& isolate(const Eigen::VectorXd& gamma)
+	{
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		if(_candidates.empty())
+		{
+			throw std::logic_error("no candidates in ContactIsolation::isolate()\n");
+		}
+		if(gamma.size() != _robot->dof())
+		{
+			throw std::invalid_argument("gamma should have the size of the robot in ContactIsolation::isolate()\n");
+		}
+
+		_estimate.candidate = -1;
+		_estimate.force.setZero();
+		_estimate.relative_residual = 0;
+		const double gamma_squared_norm = gamma.squaredNorm();
+		if(gamma_squared_norm >= _threshold * _threshold)
+		{
+			for(unsigned int i=0 ; i<_candidates.size() ; i++)
+			{
+				_robot->Jv(_jacobians[i], _candidates[i].link_name, _candidates[i].point_in_link);
+			}
+			_gamma = &gamma;
+			if(_pool != NULL)
+			{
+				_pool->forEach(_candidates.size(), _fit_function);
+			}
+			else
+			{
+				for(unsigned int i=0 ; i<_candidates.size() ; i++)
+				{
+					fit(i);
+				}
+			}
+
+			double best_residual = _fits[0].residual;
+			for(unsigned int i=1 ; i<_fits.size() ; i++)
+			{
+				if(_fits[i].residual < best_residual)
+				{
+					best_residual = _fits[i].residual;
+				}
+			}
+			// the most proximal candidate that fits about as well as the best one
+			const double tolerance = _tolerance * _tolerance * gamma_squared_norm;
+			for(unsigned int i=0 ; i<_fits.size() ; i++)
+			{
+				if(_fits[i].residual <= best_residual + tolerance)
+				{
+					_estimate.candidate = i;
+					_estimate.force = _fits[i].force;
+					_estimate.relative_residual = std::sqrt(std::max(_fits[i].residual, 0.0) / gamma_squared_norm);
+					break;
+				}
+			}
+		}
+
+		_last_duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		_n_isolations++;
+		if(_last_duration > _budget)
+		{
+			_n_overruns++;
+		}
+		return _estimate;
+	}
+
+	const Estimate& estimate() const { return _estimate; }
+	const Candidate& candidate(const int index) const { return _candidates.at(index); }
+	int numCandidates() const { return (int) _candidates.size(); }
+	// seconds of the last isolate()
+	double lastDuration() const { return _last_duration; }
+	unsigned long long numIsolations() const { return _n_isolations; }
+	unsigned long long numOverruns() const { return _n_overruns; }
+
+private:
+
+	struct Fit {
+		Eigen::Vector3d force;
+		// |gamma - Jv^T F|^2
+		double residual;
+	};
+
+	// least squares force of candidate i, with the squared residual from the normal
+	// equations : |gamma|^2 - 2 F.(J gamma) + F^T (J J^T) F, without a temporary of size dof
+	void fit(const int i)
+	{
+		const Eigen::MatrixXd& J = _jacobians[i];
+		const Eigen::VectorXd& gamma = *_gamma;
+		Eigen::Matrix3d JJt = J * J.transpose();
+		JJt.diagonal().array() += _regularization;
+		const Eigen::Vector3d J_gamma = J * gamma;
+		const Eigen::Vector3d force = JJt.ldlt().solve(J_gamma);
+		_fits[i].force = force;
+		_fits[i].residual = gamma.squaredNorm() - 2 * force.dot(J_gamma) + force.dot((JJt * force) - _regularization * force);
+	}
+
+	struct FitFunction {
+		FitFunction(ContactIsolation* isolation) : isolation(isolation) {}
+		void operator()(const int i) { isolation->fit(i); }
+		ContactIsolation* isolation;
+	};
+
+	Sai2Model::Sai2Model* _robot;
+	const double _threshold;
+	const double _tolerance;
+	const double _regularization;
+	WorkerPool* _pool;
+	FitFunction _fit_function;
+
+	std::vector<Candidate> _candidates;
+	std::vector<Eigen::MatrixXd> _jacobians;
+	std::vector<Fit> _fits;
+	const Eigen::VectorXd* _gamma;
+
+	Estimate _estimate;
+	double _budget;
+	double _last_duration;
+	unsigned long long _n_isolations;
+	unsigned long long _n_overruns;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_OBSERVERS_CONTACT_ISOLATION_H_
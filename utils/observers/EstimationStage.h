@@ -0,0 +1,272 @@
+#ifndef UTILS_OBSERVERS_ESTIMATION_STAGE_H_
+#define UTILS_OBSERVERS_ESTIMATION_STAGE_H_
+
+// Contact estimation on its own thread, out of the control loop.
+//
+// the control loop pushes its (q, dq, tau) samples to a lock-free queue, a
+// background thread (optionally pinned to a cpu) updates its own robot model
+// with each sample and runs the estimators on it, and publishes the disturbance
+// torque estimates through a triple buffer, stamped with the time of the sample
+// they come from. the control loop only copies a sample in and the latest
+// estimate out, whatever the number and the cost of the estimators:
+//
+//   // robot model used only by the estimation thread
+//   auto estimation_robot = new Sai2Model::Sai2Model(robot_file, false, T_world_robot);
+//   auto momentum_observer = new PandaUtils::MomentumObserver<7>(estimation_robot, 0.001);
+//
+//   PandaUtils::EstimationStage<7> estimation(estimation_robot);
+//   estimation.addEstimator([momentum_observer](const PandaUtils::EstimationStage<7>::Sample& sample,
+//           Eigen::Ref<Eigen::Matrix<double,7,1>> estimate)
+//   {
+//       momentum_observer->update(sample.command_torques, sample.known_torques);
+//       estimate = momentum_observer->getDisturbanceTorqueEstimate();
+//   });
+//   estimation.start(3);                                          // pinned to cpu 3
+//
+//   while(...) {                                                  // control loop
+//       estimation.pushSample(time, robot->_q, robot->_dq, command_torques, known_torques);
+//       const auto& estimate = estimation.latestEstimate();
+//       tau_contact = estimate.disturbance_torques.col(0);        // column of the first estimator
+//   }
+//   estimation.stop();
+//
+// the estimators run in the order they were added, all of them before start().
+// samples pushed while the queue is full are dropped and counted. nothing is
+// allocated by pushSample() and latestEstimate().
+
+#include "Sai2Model.h"
+#include "threads/SpscQueue.h"
+#include "threads/TripleBuffer.h"
+#include <Eigen/Dense>
+
+#include <pthread.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace PandaUtils {
+
+template<int DOF = Eigen::Dynamic>
+class EstimationStage {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Matrix<double, DOF, 1> VectorDof;
+	typedef Eigen::Ref<const VectorDof> VectorDofInput;
+
+	struct Sample {
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+		Sample(const int dof = (DOF == Eigen::Dynamic ? 0 : DOF))
+		: time(0)
+		{
+			q.setZero(dof);
+			dq.setZero(dof);
+			command_torques.setZero(dof);
+			known_torques.setZero(dof);
+		}
+
+		double time;
+		VectorDof q;
+		VectorDof dq;
+		VectorDof command_torques;
+		// joint torques of the contacts that are measured, e.g. J^T of a force sensor
+		VectorDof known_torques;
+	};
+
+	struct Estimate {
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+		Estimate(const int dof = (DOF == Eigen::Dynamic ? 0 : DOF), const int n_estimators = 0)
+		: time(0), n_samples(0)
+		{
+			disturbance_torques.setZero(dof, n_estimators);
+		}
+
+		// time of the last sample used, 0 before the first estimate
+		double time;
+		unsigned long long n_samples;
+		// one column per estimator, in the order they were added
+		Eigen::Matrix<double, DOF, Eigen::Dynamic> disturbance_torques;
+	};
+
+	// computes the estimate of one estimator from a sample, the robot model is up to date
+	typedef std::function<void(const Sample&, Eigen::Ref<VectorDof>)> Estimator;
+
+	// robot is used (and updated) by the estimation thread only
+	EstimationStage(Sai2Model::Sai2Model* robot, const int queue_capacity = 64, const int idle_sleep_us = 50)
+	: _robot(robot),
+	  _dof(robot->dof()),
+	  _queue(queue_capacity, Sample(robot->dof())),
+	  _estimates(Estimate(robot->dof(), 0)),
+	  _idle_sleep_us(idle_sleep_us),
+	  _running(false),
+	  _n_dropped(0)
+	{
+		if(DOF != Eigen::Dynamic && _dof != DOF)
+		{
+			throw std::invalid_argument("robot dof inconsistent with the estimation stage dof in EstimationStage::EstimationStage()\n");
+		}
+	}
+
+	~EstimationStage()
+	{
+		stop();
+	}
+
+	void addEstimator(const Estimator& estimator)
+	{
+		if(_running)
+		{
+			throw std::runtime_error("estimators must be added before start() in EstimationStage::addEstimator()\n");
+		}
+		_estimators.push_back(estimator);
+	}
+
+	int numEstimators() const
+	{
+		return _estimators.size();
+	}
+
+	// cpu < 0 does not pin the thread
+	void start(const int cpu = -1)
+	{
+		if(_running)
+		{
+			return;
+		}
+		_estimate = Estimate(_dof, _estimators.size());
+		_estimates.reset(_estimate);
+		_running = true;
+		_thread = std::thread(&EstimationStage::estimationLoop, this);
+		if(cpu >= 0)
+		{
+			cpu_set_t cpu_set;
+			CPU_ZERO(&cpu_set);
+			CPU_SET(cpu, &cpu_set);
+			if(pthread_setaffinity_np(_thread.native_handle(), sizeof(cpu_set_t), &cpu_set) != 0)
+			{
+				std::cout << "could not pin the estimation thread to cpu " << cpu << std::endl;
+			}
+		}
+	}
+
+	// processes the samples already queued, then joins the thread
+	void stop()
+	{
+		if(!_running)
+		{
+			return;
+		}
+		_running = false;
+		_thread.join();
+	}
+
+	// control thread only. false if the queue was full and the sample dropped
+	bool pushSample(const double time, const VectorDofInput& q, const VectorDofInput& dq,
+			const VectorDofInput& command_torques, const VectorDofInput& known_torques)
+	{
+		Sample* sample = _queue.beginPush();
+		if(!sample)
+		{
+			_n_dropped++;
+			return false;
+		}
+		sample->time = time;
+		sample->q = q;
+		sample->dq = dq;
+		sample->command_torques = command_torques;
+		sample->known_torques = known_torques;
+		_queue.endPush();
+		return true;
+	}
+
+	// control thread only : latest published estimate, valid until the next call
+	const Estimate& latestEstimate()
+	{
+		return _estimates.latest();
+	}
+
+	// control thread only : copies the latest estimate, true if it is new since the last call
+	bool readEstimate(Estimate& estimate)
+	{
+		return _estimates.read(estimate);
+	}
+
+	unsigned long long numDroppedSamples() const
+	{
+		return _n_dropped;
+	}
+
+private:
+
+	void estimationLoop()
+	{
+		while(true)
+		{
+			// read the flag before emptying the queue, so that the samples pushed before stop() are processed
+			const bool running = _running;
+			bool processed = false;
+			const Sample* sample;
+			while((sample = _queue.front()) != NULL)
+			{
+				process(*sample);
+				_queue.pop();
+				processed = true;
+			}
+			if(processed)
+			{
+				_estimates.write(_estimate);
+			}
+			else if(!running)
+			{
+				return;
+			}
+			else
+			{
+				std::this_thread::sleep_for(std::chrono::microseconds(_idle_sleep_us));
+			}
+		}
+	}
+
+	void process(const Sample& sample)
+	{
+		_robot->_q = sample.q;
+		_robot->_dq = sample.dq;
+		_robot->updateModel();
+
+		for(unsigned int i=0 ; i<_estimators.size() ; i++)
+		{
+			_estimators[i](sample, _estimate.disturbance_torques.col(i));
+		}
+		_estimate.time = sample.time;
+		_estimate.n_samples++;
+	}
+
+	Sai2Model::Sai2Model* _robot;
+	const int _dof;
+
+	std::vector<Estimator> _estimators;
+
+	SpscQueue<Sample, Eigen::aligned_allocator<Sample> > _queue;
+	TripleBuffer<Estimate> _estimates;
+
+	// owned by the estimation thread
+	Estimate _estimate;
+
+	const int _idle_sleep_us;
+	std::atomic<bool> _running;
+	std::thread _thread;
+
+	// owned by the control thread
+	unsigned long long _n_dropped;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_OBSERVERS_ESTIMATION_STAGE_H_
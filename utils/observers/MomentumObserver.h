@@ -0,0 +1,174 @@
+#ifndef UTILS_OBSERVERS_MOMENTUM_OBSERVER_H_
+#define UTILS_OBSERVERS_MOMENTUM_OBSERVER_H_
+
+// Generalized momentum observer of the external joint torques:
+//
+//   r = K0 (M dq - M dq(0) - integral(tau + C^T dq - g - tau_known + r))
+//
+// DOF is the number of joints of the robot, known at compile time so that all
+// the products are unrolled and the state is on the stack, or Eigen::Dynamic:
+//
+//   PandaUtils::MomentumObserver<7> observer(robot, 0.001);   // panda
+//   PandaUtils::MomentumObserver<> observer(robot, 0.001);    // any robot
+//   observer.setGain(25.0 * MatrixXd::Identity(dof,dof));
+//   observer.update(command_torques, known_contact_torques, coriolis_plus_gravity);
+//   external_torques = observer.getDisturbanceTorqueEstimate();
+//
+// everything is sized at construction, update() does not allocate.
+
+#include "Sai2Model.h"
+#include <Eigen/Dense>
+
+#include <stdexcept>
+
+namespace PandaUtils {
+
+template<int DOF = Eigen::Dynamic>
+class MomentumObserver {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Matrix<double, DOF, 1> VectorDof;
+	typedef Eigen::Matrix<double, DOF, DOF> MatrixDof;
+	typedef Eigen::Ref<const VectorDof> VectorDofInput;
+
+	MomentumObserver(Sai2Model::Sai2Model* robot, const double update_rate)
+	: _robot(robot), _dt(update_rate)
+	{
+		const int dof = _robot->dof();
+		if(DOF != Eigen::Dynamic && dof != DOF)
+		{
+			throw std::invalid_argument("robot dof inconsistent with the observer dof in MomentumObserver::MomentumObserver()\n");
+		}
+
+		_K0.setIdentity(dof,dof);
+
+		_C_model.setZero(dof,dof);
+		_g_model.setZero(dof);
+		_C.setZero(dof,dof);
+		_M.setZero(dof,dof);
+		_M_prev.setZero(dof,dof);
+		_M_dot.setZero(dof,dof);
+		_dq.setZero(dof);
+		_rho_hat_dot.setZero(dof);
+		_momentum_error.setZero(dof);
+		_zero_torques.setZero(dof);
+
+		reInitialize();
+	}
+
+	~MomentumObserver(){}
+
+	void reInitialize()
+	{
+		const int dof = _robot->dof();
+		_beta.setZero(dof);
+		_rho.setZero(dof);
+		_integrated_rho_hat.setZero(dof);
+		_r.setZero(dof);
+
+		readModel();
+		_rho_0.noalias() = _M * _dq;
+		_M_prev = _M;
+	}
+
+	void setGain(const Eigen::MatrixXd& K)
+	{
+		const int dof = _robot->dof();
+		if(K.rows() != dof || K.cols() != dof)
+		{
+			throw std::invalid_argument("size of gain matrix inconsistent with robot model in MomentumObserver::setGain()\n");
+		}
+
+		_K0 = K;
+	}
+
+	void update(const VectorDofInput& command_torques)
+	{
+		update(command_torques, _zero_torques);
+	}
+
+	void update(const VectorDofInput& command_torques, const VectorDofInput& known_contact_torques)
+	{
+		_robot->factorizedChristoffelMatrix(_C_model);
+		_robot->gravityVector(_g_model);
+		_C = _C_model;
+		readModel();
+
+		_beta = _g_model;
+		_beta.noalias() -= _C.transpose() * _dq;
+
+		integrate(command_torques, known_contact_torques);
+	}
+
+	// with the coriolis plus gravity vector already computed by the controller, instead of the
+	// factorized christoffel matrix. C^T dq is then Mdot dq - C dq, with Mdot from the mass
+	// matrices of two successive updates
+	void update(const VectorDofInput& command_torques, const VectorDofInput& known_contact_torques,
+			const VectorDofInput& coriolis_plus_gravity)
+	{
+		readModel();
+
+		// g - C^T dq = (C dq + g) - Mdot dq
+		_M_dot = (_M - _M_prev) / _dt;
+		_beta = coriolis_plus_gravity;
+		_beta.noalias() -= _M_dot * _dq;
+
+		integrate(command_torques, known_contact_torques);
+	}
+
+	const VectorDof& getDisturbanceTorqueEstimate() const
+	{
+		return _r;
+	}
+
+	Sai2Model::Sai2Model* _robot;
+
+	MatrixDof _K0;
+
+	VectorDof _beta;
+	VectorDof _rho;
+	VectorDof _integrated_rho_hat;
+	VectorDof _r;
+	VectorDof _rho_0;
+
+	double _dt;
+
+private:
+
+	// copy of the mass matrix and the joint velocities of the model, in the sizes of the observer
+	void readModel()
+	{
+		_M = _robot->_M;
+		_dq = _robot->_dq;
+	}
+
+	void integrate(const VectorDofInput& command_torques, const VectorDofInput& known_contact_torques)
+	{
+		_rho.noalias() = _M * _dq;
+		_M_prev = _M;
+
+		_rho_hat_dot = command_torques - _beta - known_contact_torques + _r;
+		_integrated_rho_hat += _rho_hat_dot * _dt;
+
+		_momentum_error = _rho - _rho_0 - _integrated_rho_hat;
+		_r.noalias() = _K0 * _momentum_error;
+	}
+
+	// buffers of the model interface, which takes dynamic sizes
+	Eigen::MatrixXd _C_model;
+	Eigen::VectorXd _g_model;
+
+	MatrixDof _C;
+	MatrixDof _M;
+	MatrixDof _M_prev;
+	MatrixDof _M_dot;
+	VectorDof _dq;
+	VectorDof _rho_hat_dot;
+	VectorDof _momentum_error;
+	VectorDof _zero_torques;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_OBSERVERS_MOMENTUM_OBSERVER_H_
@@ -0,0 +1,332 @@
+#ifndef UTILS_OBSERVERS_SURFACE_ESTIMATOR_H_
+#define UTILS_OBSERVERS_SURFACE_ESTIMATOR_H_
+
+// Plane of a contact surface fitted online from the contact points and the sensed
+// wrenches, on its own thread, out of the control loop.
+//
+// the control loop pushes the position of the tool and the force and moment sensed at it
+// to a lock-free queue. the estimation thread gets the contact point from the wrench (the
+// point of the line of action of the force closest to the tool), and keeps the sums of
+// the last window_size contacts in a SlidingWindowSum (see filters/SlidingWindowSum.h) :
+// the points, their second moments and the second moments of the force directions. a
+// contact added and the one leaving the window update the sums in constant time, nothing
+// grows with the window. the normal n is the direction that minimizes
+//
+//   sum_i (n . (p_i - c))^2 + force_weight * sum_i |n x f_i / |f_i||^2
+//
+// the spread of the points out of the plane, and the angle of the forces to the normal.
+// the points alone fix the plane once they spread along the surface, the forces alone
+// before that (normal to the surface without friction), force_weight (m^2) trades the
+// two. the normal points along the mean force : out of the surface for the force the
+// surface applies to the tool, into it for the force of the tool on the surface. it is the
+// eigenvector of a 3x3 matrix, and is published through a triple buffer at every update :
+//
+//   PandaUtils::SurfaceEstimator surface_estimator(500);
+//   surface_estimator.start();
+//   while(...) {                                                  // control loop
+//       posori_task->updateSensedForceAndMoment(sensed_force, sensed_moment);
+//       surface_estimator.pushContact(time, posori_task->_current_position,
+//               posori_task->_sensed_force, posori_task->_sensed_moment);
+//       const PandaUtils::SurfaceEstimator::Plane& plane = surface_estimator.latestPlane();
+//       if(plane.valid) ... plane.normal ...
+//   }
+//   surface_estimator.stop();
+//
+// the contacts with a force below min_force are not used. samples pushed while the queue
+// is full are dropped and counted. nothing is allocated by pushContact() and latestPlane().
+
+#include "filters/SlidingWindowSum.h"
+#include "threads/SpscQueue.h"
+#include "threads/TripleBuffer.h"
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+
+namespace PandaUtils {
+
+class SurfaceEstimator {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	struct Plane {
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+		Plane()
+		: valid(false), time(0), n_contacts(0), point_spread(0), force_deviation(0),
+		  normal(Eigen::Vector3d::UnitZ()), point(Eigen::Vector3d::Zero())
+		{}
+
+		// enough contacts in the window
+		bool valid;
+		// time of the last contact used
+		double time;
+		int n_contacts;
+		// rms distance of the contact points along the surface, in its least spread
+		// direction (m) : the points constrain the plane when it is well above zero
+		double point_spread;
+		// rms angle of the forces to the normal (rad)
+		double force_deviation;
+		Eigen::Vector3d normal;
+		// mean of the contact points, on the plane
+		Eigen::Vector3d point;
+	};
+
+	SurfaceEstimator(const int window_size, const double force_weight = 1e-4, const double min_force = 2.0,
+			const int min_contacts = 50, const double max_lever = 0.05, const int queue_capacity = 64, const int idle_sleep_us = 100)
+	: _window(window_size),
+	  _force_weight(force_weight),
+	  _min_force(min_force),
+	  _min_contacts(std::min(min_contacts, window_size)),
+	  _max_lever(max_lever),
+	  _queue(queue_capacity),
+	  _idle_sleep_us(idle_sleep_us),
+	  _running(false),
+	  _n_dropped(0)
+	{
+		if(force_weight < 0 || min_force <= 0)
+		{
+			throw std::invalid_argument("negative force weight or minimum force in SurfaceEstimator::SurfaceEstimator()\n");
+		}
+	}
+
+	~SurfaceEstimator()
+	{
+		stop();
+	}
+
+	SurfaceEstimator(const SurfaceEstimator&) = delete;
+	SurfaceEstimator& operator=(const SurfaceEstimator&) = delete;
+
+	void start()
+	{
+		if(_running)
+		{
+			return;
+		}
+		_running = true;
+		_thread = std::thread(&SurfaceEstimator::estimationLoop, this);
+	}
+
+	// processes the contacts already queued, then joins the thread
+	void stop()
+	{
+		if(!_running)
+		{
+			return;
+		}
+		_running = false;
+		_thread.join();
+	}
+
+	// control thread only : tool position, force and moment at the tool, in the same frame.
+	// false if the queue was full and the contact dropped
+	bool pushContact(const double time, const Eigen::Vector3d& tool_position,
+			const Eigen::Vector3d& force, const Eigen::Vector3d& moment)
+	{
+		Contact* contact = _queue.beginPush();
+		if(!contact)
+		{
+			_n_dropped++;
+			return false;
+		}
+		contact->f_reset = false;
+		contact->time = time;
+		contact->tool_position = tool_position;
+		contact->force = force;
+		contact->moment = moment;
+		_queue.endPush();
+		return true;
+	}
+
+	// control thread only : forgets the contacts, e.g. when the tool leaves the surface
+	bool pushReset(const double time)
+	{
+		Contact* contact = _queue.beginPush();
+		if(!contact)
+		{
+			_n_dropped++;
+			return false;
+		}
+		contact->f_reset = true;
+		contact->time = time;
+		_queue.endPush();
+		return true;
+	}
+
+	// control thread only : latest published plane, valid until the next call
+	const Plane& latestPlane()
+	{
+		return _planes.latest();
+	}
+
+	// control thread only : copies the latest plane, true if it is new since the last call
+	bool readPlane(Plane& plane)
+	{
+		return _planes.read(plane);
+	}
+
+	unsigned long long numDroppedContacts() const
+	{
+		return _n_dropped;
+	}
+
+	// estimation thread, or without start() : adds a contact to the window and fits the plane
+	void update(const double time, const Eigen::Vector3d& tool_position,
+			const Eigen::Vector3d& force, const Eigen::Vector3d& moment)
+	{
+		const double force_norm = force.norm();
+		if(force_norm < _min_force)
+		{
+			return;
+		}
+		// moment = r x force for the contact at tool_position + r, r along the surface
+		Eigen::Vector3d lever = force.cross(moment) / (force_norm * force_norm);
+		if(lever.norm() > _max_lever)
+		{
+			lever *= _max_lever / lever.norm();
+		}
+		const Eigen::Vector3d p = tool_position + lever;
+		const Eigen::Vector3d u = force / force_norm;
+
+		_sample << p,
+				p(0)*p(0), p(0)*p(1), p(0)*p(2), p(1)*p(1), p(1)*p(2), p(2)*p(2),
+				u,
+				u(0)*u(0), u(0)*u(1), u(0)*u(2), u(1)*u(1), u(1)*u(2), u(2)*u(2);
+		_window.push(_sample);
+		fit(time);
+	}
+
+	void reset()
+	{
+		_window.clear();
+		_plane = Plane();
+	}
+
+	// estimation thread, or without start()
+	const Plane& plane() const
+	{
+		return _plane;
+	}
+
+private:
+
+	typedef Eigen::Matrix<double, 18, 1> Vector18d;
+
+	struct Contact {
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+		bool f_reset;
+		double time;
+		Eigen::Vector3d tool_position;
+		Eigen::Vector3d force;
+		Eigen::Vector3d moment;
+	};
+
+	// symmetric matrix of the 6 second moments xx xy xz yy yz zz
+	static Eigen::Matrix3d secondMoments(const Eigen::Matrix<double,6,1>& s)
+	{
+		Eigen::Matrix3d m;
+		m << s(0), s(1), s(2),
+			 s(1), s(3), s(4),
+			 s(2), s(4), s(5);
+		return m;
+	}
+
+	void fit(const double time)
+	{
+		const int n = _window.size();
+		const Vector18d mean = _window.sum() / n;
+		const Eigen::Vector3d center = mean.segment<3>(0);
+		const Eigen::Matrix3d point_covariance = secondMoments(mean.segment<6>(3)) - center * center.transpose();
+		const Eigen::Vector3d mean_direction = mean.segment<3>(9);
+		const Eigen::Matrix3d direction_moments = secondMoments(mean.segment<6>(12));
+
+		// n^T (P + w (I - U)) n, with |n x u|^2 = 1 - (n . u)^2
+		const Eigen::Matrix3d A = point_covariance + _force_weight * (Eigen::Matrix3d::Identity() - direction_moments);
+		_solver.computeDirect(A);
+		Eigen::Vector3d normal = _solver.eigenvectors().col(0);
+		if(normal.dot(mean_direction) < 0)
+		{
+			normal = -normal;
+		}
+
+		_plane.valid = (n >= _min_contacts);
+		_plane.time = time;
+		_plane.n_contacts = n;
+		_plane.normal = normal;
+		_plane.point = center;
+		// the least spread direction of the points along the plane
+		const Eigen::Matrix3d projection = Eigen::Matrix3d::Identity() - normal * normal.transpose();
+		_point_solver.computeDirect(projection * point_covariance * projection);
+		_plane.point_spread = std::sqrt(std::max(0.0, _point_solver.eigenvalues()(1)));
+		_plane.force_deviation = std::asin(std::sqrt(std::min(1.0, std::max(0.0, 1.0 - normal.dot(direction_moments * normal)))));
+	}
+
+	void estimationLoop()
+	{
+		while(true)
+		{
+			// read the flag before emptying the queue, so that the contacts pushed before stop() are processed
+			const bool running = _running;
+			bool processed = false;
+			const Contact* contact;
+			while((contact = _queue.front()) != NULL)
+			{
+				if(contact->f_reset)
+				{
+					reset();
+					_plane.time = contact->time;
+				}
+				else
+				{
+					update(contact->time, contact->tool_position, contact->force, contact->moment);
+				}
+				_queue.pop();
+				processed = true;
+			}
+			if(processed)
+			{
+				_planes.write(_plane);
+			}
+			else if(!running)
+			{
+				return;
+			}
+			else
+			{
+				std::this_thread::sleep_for(std::chrono::microseconds(_idle_sleep_us));
+			}
+		}
+	}
+
+	// owned by the estimation thread
+	SlidingWindowSum<18> _window;
+	Vector18d _sample;
+	Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> _solver;
+	Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> _point_solver;
+	Plane _plane;
+
+	const double _force_weight;
+	const double _min_force;
+	const int _min_contacts;
+	const double _max_lever;
+
+	SpscQueue<Contact, Eigen::aligned_allocator<Contact> > _queue;
+	TripleBuffer<Plane> _planes;
+
+	const int _idle_sleep_us;
+	std::atomic<bool> _running;
+	std::thread _thread;
+
+	// owned by the control thread
+	unsigned long long _n_dropped;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_OBSERVERS_SURFACE_ESTIMATOR_H_
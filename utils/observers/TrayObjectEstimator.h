@@ -0,0 +1,378 @@
+#ifndef UTILS_OBSERVERS_TRAY_OBJECT_ESTIMATOR_H_
+#define UTILS_OBSERVERS_TRAY_OBJECT_ESTIMATOR_H_
+
+// Pose of a tray held by two arms and position of an object rolling on it, from the
+// kinematics of the grasps and the wrench the tray applies on the grippers.
+//
+// an extended Kalman filter with a state of fixed size : the tray position and orientation
+// (as an error rotation about the current estimate, applied to it after every correction),
+// the position and velocity of the object in the plane of the tray, and the mass of the
+// object. the prediction integrates the twist of the tray from the kinematics and rolls the
+// object down the slope of the tray. the tray pose is corrected by the pose of the grasps,
+// and the whole state by the wrench : its force gives the mass, its moment the position of
+// the object. all the matrices are fixed size members, nothing is allocated after the
+// construction :
+//
+//   PandaUtils::TrayObjectEstimator tray_estimator(0.5, Vector3d::Zero(), 0.02);
+//   tray_estimator.reset(tray_position, tray_orientation);
+//   while(runloop)                                                   // at the sensor rate
+//   {
+//       ...                                                          // grasp kinematics
+//       tray_estimator.predict(dt, tray_linear_velocity, tray_angular_velocity);
+//       tray_estimator.updatePose(tray_position, tray_orientation);
+//       tray_estimator.updateWrench(grasp_force, grasp_moment);      // world frame, about the world origin
+//       tray_state_buffer.write(tray_estimator.state());
+//   }
+//
+// the wrench is the sum over the grippers of the forces the tray applies on them, which is
+// the weight of the tray and the object when the tray does not accelerate; the squeeze of
+// the grasp cancels in the sum. the accelerations of the tray are left to the measurement
+// noise. without an object the mass stays near zero and the position of the object is not
+// observable, it is then kept within the extents of the tray.
+
+#include <Eigen/Dense>
+
+#include <cmath>
+#include <stdexcept>
+
+namespace PandaUtils {
+
+class TrayObjectEstimator {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	// tray position (3), tray orientation error (3), object position (2), object velocity (2), object mass
+	static const int N = 11;
+	typedef Eigen::Matrix<double, N, 1> VectorN;
+	typedef Eigen::Matrix<double, N, N> MatrixNN;
+
+	// published to the controllers of the arms
+	struct State {
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+		Eigen::Vector3d tray_position;
+		Eigen::Matrix3d tray_orientation;
+		// in the frame of the tray
+		Eigen::Vector2d object_position;
+		Eigen::Vector2d object_velocity;
+		double object_mass;
+		// standard deviations
+		Eigen::Vector2d object_position_std;
+		double object_mass_std;
+		// number of the filter step, 0 before reset()
+		unsigned long long step;
+	};
+
+	// tray_mass and tray_com (in the frame of the tray) are known, the object touches the tray
+	// at object_height above the origin of the tray frame. rolling_factor scales the slope
+	// acceleration, 5/7 for a ball rolling without slipping, 1 for a frictionless slide
+	TrayObjectEstimator(const double tray_mass, const Eigen::Vector3d& tray_com, const double object_height,
+			const double rolling_factor = 5.0/7.0, const Eigen::Vector3d& gravity = Eigen::Vector3d(0, 0, -9.81))
+	: _tray_mass(tray_mass),
+	  _tray_com(tray_com),
+	  _object_height(object_height),
+	  _rolling_factor(rolling_factor),
+	  _gravity(gravity),
+	  _object_damping(0),
+	  _tray_half_extents(0.1, 0.15),
+	  _linear_velocity_std(0.01),
+	  _angular_velocity_std(0.02),
+	  _object_acceleration_std(1.0),
+	  _mass_rate_std(0.05),
+	  _position_std(0.002),
+	  _orientation_std(0.01),
+	  _force_std(0.5),
+	  _moment_std(0.05),
+	  _n_wrench_updates(0)
+	{
+		if(tray_mass < 0 || rolling_factor < 0)
+		{
+			throw std::invalid_argument("mass and rolling factor should not be negative in TrayObjectEstimator::TrayObjectEstimator()\n");
+		}
+		reset(Eigen::Vector3d::Zero(), Eigen::Matrix3d::Identity());
+		_state.step = 0;
+	}
+
+	// viscous friction of the object on the tray (1/s)
+	void setObjectDamping(const double damping)
+	{
+		_object_damping = damping;
+	}
+
+	// the object stays within +- half_extents of the origin of the tray
+	void setTrayExtents(const Eigen::Vector2d& half_extents)
+	{
+		if(half_extents.minCoeff() <= 0)
+		{
+			throw std::invalid_argument("extents should be positive in TrayObjectEstimator::setTrayExtents()\n");
+		}
+		_tray_half_extents = half_extents;
+	}
+
+	// standard deviations of the twist of the tray (m/s, rad/s), of the acceleration of the
+	// object, and of the rate of change of the mass (kg/sqrt(s))
+	void setProcessNoise(const double linear_velocity_std, const double angular_velocity_std,
+			const double object_acceleration_std, const double mass_rate_std)
+	{
+		_linear_velocity_std = linear_velocity_std;
+		_angular_velocity_std = angular_velocity_std;
+		_object_acceleration_std = object_acceleration_std;
+		_mass_rate_std = mass_rate_std;
+	}
+
+	void setPoseNoise(const double position_std, const double orientation_std)
+	{
+		_position_std = position_std;
+		_orientation_std = orientation_std;
+	}
+
+	void setWrenchNoise(const double force_std, const double moment_std)
+	{
+		_force_std = force_std;
+		_moment_std = moment_std;
+	}
+
+	// tray at the given pose, object at rest at the center with an unknown position and no mass
+	void reset(const Eigen::Vector3d& tray_position, const Eigen::Matrix3d& tray_orientation)
+	{
+		_x.setZero();
+		_x.segment<3>(0) = tray_position;
+		_R = tray_orientation;
+		_P.setZero();
+		_P.diagonal().segment<3>(0).setConstant(_position_std * _position_std);
+		_P.diagonal().segment<3>(3).setConstant(_orientation_std * _orientation_std);
+		_P.diagonal().segment<2>(6) = _tray_half_extents.cwiseProduct(_tray_half_extents) / 3.0;
+		_P.diagonal().segment<2>(8).setConstant(0.01);
+		_P(10, 10) = 1.0;
+		_state.step = 0;
+		publishState();
+	}
+
+	// tray twist in the world frame, from the kinematics of the grasps
+	void predict(const double dt, const Eigen::Vector3d& linear_velocity, const Eigen::Vector3d& angular_velocity)
+	{
+		if(dt <= 0)
+		{
+			return;
+		}
+		const Eigen::Matrix3d R_step = exp(angular_velocity * dt);
+		const Eigen::Vector2d u = _x.segment<2>(8);
+
+		// slope of the tray and its derivative in the orientation error
+		const Eigen::Vector3d gravity_tray = _R.transpose() * _gravity;
+		_da_dtheta = _rolling_factor * (_R.transpose() * skew(_gravity)).topRows<2>();
+		const Eigen::Vector2d a = _rolling_factor * gravity_tray.head<2>() - _object_damping * u;
+
+		_x.segment<3>(0) += linear_velocity * dt;
+		_R = R_step * _R;
+		_x.segment<2>(6) += u * dt + 0.5 * a * dt * dt;
+		_x.segment<2>(8) += a * dt;
+
+		_F.setIdentity();
+		_F.block<3,3>(3,3) = R_step;
+		_F.block<2,2>(6,8) = Eigen::Matrix2d::Identity() * dt;
+		_F.block<2,2>(8,8) = Eigen::Matrix2d::Identity() * (1 - _object_damping * dt);
+		_F.block<2,3>(6,3) = 0.5 * dt * dt * _da_dtheta;
+		_F.block<2,3>(8,3) = dt * _da_dtheta;
+
+		_Q.setZero();
+		const double qv = _linear_velocity_std * dt;
+		const double qw = _angular_velocity_std * dt;
+		const double qa = _object_acceleration_std * dt;
+		_Q.diagonal().segment<3>(0).setConstant(qv * qv);
+		_Q.diagonal().segment<3>(3).setConstant(qw * qw);
+		_Q.diagonal().segment<2>(6).setConstant(0.25 * qa * qa * dt * dt);
+		_Q.diagonal().segment<2>(8).setConstant(qa * qa);
+		_Q(10, 10) = _mass_rate_std * _mass_rate_std * dt;
+
+		_FP.noalias() = _F * _P;
+		_P.noalias() = _FP * _F.transpose();
+		_P += _Q;
+
+		boundObject();
+		_state.step++;
+		publishState();
+	}
+
+	// pose of the tray from the grasps
+	void updatePose(const Eigen::Vector3d& tray_position, const Eigen::Matrix3d& tray_orientation)
+	{
+		Eigen::Matrix<double, 6, 1> y;
+		y.head<3>() = tray_position - _x.segment<3>(0);
+		y.tail<3>() = log(tray_orientation * _R.transpose());
+
+		Eigen::Matrix<double, 6, N> H = Eigen::Matrix<double, 6, N>::Zero();
+		H.leftCols<6>().setIdentity();
+		Eigen::Matrix<double, 6, 1> noise_std;
+		noise_std << Eigen::Vector3d::Constant(_position_std), Eigen::Vector3d::Constant(_orientation_std);
+
+		correct(y, H, noise_std);
+		boundObject();
+		publishState();
+	}
+
+	// sum of the forces applied by the tray on the grippers and of their moments about the
+	// world origin, world frame
+	void updateWrench(const Eigen::Vector3d& force, const Eigen::Vector3d& moment)
+	{
+		const Eigen::Vector3d p = _x.segment<3>(0);
+		const double m = _x(10);
+		const Eigen::Vector3d object_in_tray(_x(6), _x(7), _object_height);
+		const Eigen::Vector3d Rs = _R * object_in_tray;
+		const Eigen::Vector3d Rc = _R * _tray_com;
+
+		// weight of the tray and the object, with its moment
+		const Eigen::Vector3d force_predicted = (_tray_mass + m) * _gravity;
+		const Eigen::Vector3d moment_predicted = p.cross(force_predicted)
+				+ _tray_mass * Rc.cross(_gravity) + m * Rs.cross(_gravity);
+
+		Eigen::Matrix<double, 6, 1> y;
+		y.head<3>() = force - force_predicted;
+		y.tail<3>() = moment - moment_predicted;
+
+		const Eigen::Matrix3d g_skew = skew(_gravity);
+		Eigen::Matrix<double, 6, N> H = Eigen::Matrix<double, 6, N>::Zero();
+		H.block<3,1>(0,10) = _gravity;
+		H.block<3,3>(3,0) = -skew(force_predicted);
+		H.block<3,3>(3,3) = _tray_mass * g_skew * skew(Rc) + m * g_skew * skew(Rs);
+		H.block<3,2>(3,6) = -m * g_skew * _R.leftCols<2>();
+		H.block<3,1>(3,10) = (p + Rs).cross(_gravity);
+		Eigen::Matrix<double, 6, 1> noise_std;
+		noise_std << Eigen::Vector3d::Constant(_force_std), Eigen::Vector3d::Constant(_moment_std);
+
+		correct(y, H, noise_std);
+		if(_x(10) < 0)
+		{
+			_x(10) = 0;
+		}
+		boundObject();
+		_n_wrench_updates++;
+		publishState();
+	}
+
+	const State& state() const { return _state; }
+	const MatrixNN& covariance() const { return _P; }
+	unsigned long long numWrenchUpdates() const { return _n_wrench_updates; }
+
+private:
+
+	// kalman correction with a 6 dimensional measurement of diagonal noise, in the Joseph form,
+	// then the orientation error is applied to the estimate of the orientation
+	void correct(const Eigen::Matrix<double, 6, 1>& y, const Eigen::Matrix<double, 6, N>& H,
+			const Eigen::Matrix<double, 6, 1>& noise_std)
+	{
+		_PHt.noalias() = _P * H.transpose();
+		_S.noalias() = H * _PHt;
+		_S.diagonal() += noise_std.cwiseProduct(noise_std);
+		_K.transpose() = _S.llt().solve(_PHt.transpose());
+
+		_x.noalias() += _K * y;
+		_IKH.setIdentity();
+		_IKH.noalias() -= _K * H;
+		_FP.noalias() = _IKH * _P;
+		_P.noalias() = _FP * _IKH.transpose();
+		for(int i=0 ; i<6 ; i++)
+		{
+			_P.noalias() += noise_std(i) * noise_std(i) * _K.col(i) * _K.col(i).transpose();
+		}
+		_P = 0.5 * (_P + _P.transpose()).eval();
+
+		_R = exp(_x.segment<3>(3)) * _R;
+		_x.segment<3>(3).setZero();
+	}
+
+	// the object does not leave the tray, and its uncertainty does not exceed a uniform
+	// distribution over it (the rows and columns of the covariance are scaled, which keeps
+	// it positive)
+	void boundObject()
+	{
+		for(int j=0 ; j<2 ; j++)
+		{
+			const double limit = _tray_half_extents(j);
+			if(std::abs(_x(6+j)) > limit)
+			{
+				_x(6+j) = _x(6+j) > 0 ? limit : -limit;
+				_x(8+j) = 0;
+			}
+			const double max_variance = limit * limit / 3.0;
+			if(_P(6+j, 6+j) > max_variance)
+			{
+				const double scale = std::sqrt(max_variance / _P(6+j, 6+j));
+				_P.row(6+j) *= scale;
+				_P.col(6+j) *= scale;
+			}
+		}
+	}
+
+	void publishState()
+	{
+		_state.tray_position = _x.segment<3>(0);
+		_state.tray_orientation = _R;
+		_state.object_position = _x.segment<2>(6);
+		_state.object_velocity = _x.segment<2>(8);
+		_state.object_mass = _x(10);
+		_state.object_position_std << std::sqrt(_P(6,6)), std::sqrt(_P(7,7));
+		_state.object_mass_std = std::sqrt(_P(10,10));
+	}
+
+	static Eigen::Matrix3d skew(const Eigen::Vector3d& v)
+	{
+		Eigen::Matrix3d S;
+		S << 0, -v(2), v(1),
+		     v(2), 0, -v(0),
+		     -v(1), v(0), 0;
+		return S;
+	}
+
+	static Eigen::Matrix3d exp(const Eigen::Vector3d& rotation_vector)
+	{
+		const double angle = rotation_vector.norm();
+		if(angle < 1e-12)
+		{
+			return Eigen::Matrix3d::Identity() + skew(rotation_vector);
+		}
+		return Eigen::AngleAxisd(angle, rotation_vector / angle).toRotationMatrix();
+	}
+
+	static Eigen::Vector3d log(const Eigen::Matrix3d& R)
+	{
+		const Eigen::AngleAxisd angle_axis(R);
+		return angle_axis.angle() * angle_axis.axis();
+	}
+
+	const double _tray_mass;
+	const Eigen::Vector3d _tray_com;
+	const double _object_height;
+	const double _rolling_factor;
+	const Eigen::Vector3d _gravity;
+	double _object_damping;
+	Eigen::Vector2d _tray_half_extents;
+
+	double _linear_velocity_std;
+	double _angular_velocity_std;
+	double _object_acceleration_std;
+	double _mass_rate_std;
+	double _position_std;
+	double _orientation_std;
+	double _force_std;
+	double _moment_std;
+
+	VectorN _x;
+	Eigen::Matrix3d _R;
+	MatrixNN _P;
+	State _state;
+	unsigned long long _n_wrench_updates;
+
+	// preallocated intermediates
+	MatrixNN _F;
+	MatrixNN _Q;
+	MatrixNN _FP;
+	MatrixNN _IKH;
+	Eigen::Matrix<double, 2, 3> _da_dtheta;
+	Eigen::Matrix<double, N, 6> _PHt;
+	Eigen::Matrix<double, 6, 6> _S;
+	Eigen::Matrix<double, N, 6> _K;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_OBSERVERS_TRAY_OBJECT_ESTIMATOR_H_
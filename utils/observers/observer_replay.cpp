@@ -0,0 +1,540 @@
+// Replays the momentum observer and the joint Kalman filters offline on a log of their inputs,
+// for many gain sets at once, to tune them without running the robot again.
+//
+// usage : observer_replay robot.urdf replay_log.bin configurations.txt [options]
+//   -j n            number of threads (default : all the cpus)
+//   -dt s           sampling period of the log and the observers (default 0.001, the one of the apps)
+//   -skip s         seconds at the start of the log left out of the statistics (default 0.5)
+//   -max_lag s      largest lag searched (default 0.2)
+//   -from s         replay from this time, in seconds from the start of the log (default 0)
+//   -to s           replay until this time (default : the end of the log)
+//   -o results.csv  also write the results as csv
+//
+// the log is the full rate binary log that 19, 20 and 22 write for this tool (replay_*.bin), a window
+// of a long session is read directly with its time index (see Logging::IndexedLogReader) :
+// q, dq, command_torques, known_torques, base_transform (the 4x4 world to robot base transform)
+// and optionally reference_torques, the true disturbance torques in the convention of the
+// observer estimate (e.g. from the simulation). without them, the reference is the inverse
+// dynamics residual M ddq + C dq + g - command_torques + known_torques, with ddq from centered
+// differences of dq, that the observer estimate follows more closely as the gain grows.
+//
+// configurations, one per line, # starts a comment :
+//   observer 25                        K0 = 25 I
+//   observer 10 10 10 20 20 20 20      diagonal K0, one gain per joint
+//   observer_sweep 1 200 100           100 observers K0 = k I, k log spaced from 1 to 200
+//   kalman 1000 0.1                    joint kalman filters of q, dq, ddq from q, with the process
+//                                      noise of ddq and the measurement noise of q
+// the observers are compared with the reference torques, the kalman filters dq with the logged dq.
+// for every configuration the tool reports the rms and max error of the estimate, its lag (the
+// delay that best aligns it with the reference) and the rms error once this lag is removed.
+//
+// the robot model terms do not depend on the gains, so they are computed once per sample, in
+// parallel, and each observer is then a few vector operations per sample. the configurations
+// run in parallel on a PandaUtils::WorkerPool.
+
+#include "Sai2Model.h"
+#include "kalman_filters/JointKalmanFilter.h"
+#include "logger/IndexedLogReader.h"
+#include "threads/WorkerPool.h"
+
+#include <math.h>
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+struct Configuration
+{
+	string label;
+	bool kalman;
+	// observer
+	VectorXd gains;
+	// kalman
+	double process_noise;
+	double measurement_noise;
+};
+
+struct Result
+{
+	double rms_error;
+	double max_error;
+	double lag;
+	double rms_error_without_lag;
+};
+
+// index of a variable of the log, -1 if it is not there
+int findVariable(const Logging::IndexedLogReader& reader, const string& name)
+{
+	for(int i=0 ; i<reader.numVariables() ; i++)
+	{
+		if(reader.name(i) == name)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+bool parseConfigurations(const string& fname, const int dof, vector<Configuration>& configurations)
+{
+	ifstream in(fname);
+	if(!in)
+	{
+		cout << "could not open " << fname << endl;
+		return false;
+	}
+	string line;
+	int line_number = 0;
+	while(getline(in, line))
+	{
+		line_number++;
+		const size_t comment = line.find('#');
+		if(comment != string::npos)
+		{
+			line = line.substr(0, comment);
+		}
+		istringstream words(line);
+		string type;
+		if(!(words >> type))
+		{
+			continue;
+		}
+
+		vector<double> values;
+		double value;
+		while(words >> value)
+		{
+			values.push_back(value);
+		}
+		if(!words.eof())
+		{
+			cout << "not a number on line " << line_number << " of " << fname << endl;
+			return false;
+		}
+
+		Configuration configuration;
+		configuration.kalman = false;
+		configuration.process_noise = 0;
+		configuration.measurement_noise = 0;
+		if(type == "observer" && (values.size() == 1 || (int)values.size() == dof))
+		{
+			ostringstream label;
+			label << "observer";
+			if(values.size() == 1)
+			{
+				configuration.gains = VectorXd::Constant(dof, values[0]);
+			}
+			else
+			{
+				configuration.gains = Map<VectorXd>(values.data(), dof);
+			}
+			for(unsigned int i=0 ; i<values.size() ; i++)
+			{
+				label << " " << values[i];
+			}
+			configuration.label = label.str();
+			configurations.push_back(configuration);
+		}
+		else if(type == "observer_sweep" && values.size() == 3 && values[0] > 0 && values[1] > 0 && values[2] >= 1)
+		{
+			const int n = values[2];
+			for(int i=0 ; i<n ; i++)
+			{
+				const double gain = (n == 1) ? values[0] : values[0] * pow(values[1] / values[0], double(i) / (n - 1));
+				configuration.gains = VectorXd::Constant(dof, gain);
+				ostringstream label;
+				label << "observer " << gain;
+				configuration.label = label.str();
+				configurations.push_back(configuration);
+			}
+		}
+		else if(type == "kalman" && values.size() == 2 && values[0] > 0 && values[1] > 0)
+		{
+			configuration.kalman = true;
+			configuration.process_noise = values[0];
+			configuration.measurement_noise = values[1];
+			ostringstream label;
+			label << "kalman " << values[0] << " " << values[1];
+			configuration.label = label.str();
+			configurations.push_back(configuration);
+		}
+		else
+		{
+			cout << "invalid configuration on line " << line_number << " of " << fname << " : " << line << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+// mean over the joints and the samples n >= first of the squared error between estimate(n) and reference(n - lag)
+double meanSquaredError(const MatrixXd& estimate, const MatrixXd& reference, const int first, const int lag)
+{
+	const int n = estimate.cols() - first;
+	return (estimate.middleCols(first, n) - reference.middleCols(first - lag, n)).squaredNorm() / (double(n) * estimate.rows());
+}
+
+// lag in [0, max_lag] samples that minimizes the error, searched on a coarse grid then
+// refined around the best lag with steps halved every time
+int bestLag(const MatrixXd& estimate, const MatrixXd& reference, const int first, const int max_lag)
+{
+	int step = max(1, max_lag / 16);
+	int best = 0;
+	double best_error = meanSquaredError(estimate, reference, first, 0);
+	for(int lag=step ; lag<=max_lag ; lag+=step)
+	{
+		const double error = meanSquaredError(estimate, reference, first, lag);
+		if(error < best_error)
+		{
+			best_error = error;
+			best = lag;
+		}
+	}
+	while(step > 1)
+	{
+		step /= 2;
+		const int center = best;
+		for(int lag=center-step ; lag<=center+step ; lag+=2*step)
+		{
+			if(lag < 0 || lag > max_lag)
+			{
+				continue;
+			}
+			const double error = meanSquaredError(estimate, reference, first, lag);
+			if(error < best_error)
+			{
+				best_error = error;
+				best = lag;
+			}
+		}
+	}
+	return best;
+}
+
+int main(int argc, char** argv)
+{
+	if(argc < 4)
+	{
+		cout << "usage : " << argv[0] << " robot.urdf replay_log.bin configurations.txt [-j n_threads] [-dt s] [-skip s] [-max_lag s] [-from s] [-to s] [-o results.csv]" << endl;
+		return 1;
+	}
+	const string robot_file = argv[1];
+	const string log_file = argv[2];
+	const string configurations_file = argv[3];
+
+	int n_threads = thread::hardware_concurrency();
+	double dt = 0.001;
+	double skip_time = 0.5;
+	double max_lag_time = 0.2;
+	double from_time = 0;
+	double to_time = -1;
+	string output_file;
+	for(int i=4 ; i<argc ; i++)
+	{
+		const string option = argv[i];
+		if(i + 1 >= argc)
+		{
+			cout << "missing value of option " << option << endl;
+			return 1;
+		}
+		const string value = argv[++i];
+		if(option == "-j")
+		{
+			n_threads = stoi(value);
+		}
+		else if(option == "-dt")
+		{
+			dt = stod(value);
+		}
+		else if(option == "-skip")
+		{
+			skip_time = stod(value);
+		}
+		else if(option == "-max_lag")
+		{
+			max_lag_time = stod(value);
+		}
+		else if(option == "-from")
+		{
+			from_time = stod(value);
+		}
+		else if(option == "-to")
+		{
+			to_time = stod(value);
+		}
+		else if(option == "-o")
+		{
+			output_file = value;
+		}
+		else
+		{
+			cout << "unknown option " << option << endl;
+			return 1;
+		}
+	}
+	if(n_threads < 1)
+	{
+		n_threads = 1;
+	}
+	if(dt <= 0)
+	{
+		cout << "the sampling period should be positive" << endl;
+		return 1;
+	}
+
+	// read the log
+	auto start_time = chrono::steady_clock::now();
+	Logging::IndexedLogReader reader;
+	if(!reader.open(log_file))
+	{
+		cout << reader.error() << endl;
+		return 1;
+	}
+	const vector<string> input_names = {"q", "dq", "command_torques", "known_torques"};
+	vector<int> input_offsets;
+	for(unsigned int i=0 ; i<input_names.size() ; i++)
+	{
+		const int variable = findVariable(reader, input_names[i]);
+		if(variable < 0)
+		{
+			cout << input_names[i] << " is not in " << log_file << endl;
+			return 1;
+		}
+		if(reader.size(variable) != reader.size(findVariable(reader, "q")))
+		{
+			cout << "size of " << input_names[i] << " inconsistent with the size of q in " << log_file << endl;
+			return 1;
+		}
+		input_offsets.push_back(reader.variableOffset(input_names[i]));
+	}
+	const int dof = reader.size(findVariable(reader, "q"));
+
+	const int base_transform_variable = findVariable(reader, "base_transform");
+	if(base_transform_variable < 0 || reader.size(base_transform_variable) != 16)
+	{
+		cout << "no 4x4 base_transform in " << log_file << endl;
+		return 1;
+	}
+	const int base_transform_offset = reader.variableOffset("base_transform");
+
+	const int reference_variable = findVariable(reader, "reference_torques");
+	const bool logged_reference = (reference_variable >= 0);
+	if(logged_reference && reader.size(reference_variable) != dof)
+	{
+		cout << "size of reference_torques inconsistent with the size of q in " << log_file << endl;
+		return 1;
+	}
+	const int reference_offset = reader.variableOffset("reference_torques");
+
+	vector<vector<double> > data(5);
+	Affine3d T_world_robot = Affine3d::Identity();
+	// log timestamps in microseconds
+	vector<double> record;
+	const double end_timestamp = (to_time < 0) ? reader.endTime() : reader.startTime() + to_time * 1e6;
+	const bool f_window = reader.seek(reader.startTime() + from_time * 1e6);
+	while(f_window && reader.next(record) && record[0] <= end_timestamp)
+	{
+		if(data[0].empty())
+		{
+			T_world_robot.matrix() = Map<Matrix4d>(record.data() + base_transform_offset);
+		}
+		for(unsigned int i=0 ; i<input_offsets.size() ; i++)
+		{
+			data[i].insert(data[i].end(), record.begin() + input_offsets[i], record.begin() + input_offsets[i] + dof);
+		}
+		if(logged_reference)
+		{
+			data[4].insert(data[4].end(), record.begin() + reference_offset, record.begin() + reference_offset + dof);
+		}
+	}
+	if(!reader.error().empty())
+	{
+		cout << reader.error() << endl;
+	}
+
+	// one column per sample
+	const int n_samples = data[0].size() / dof;
+	const MatrixXd q = Map<MatrixXd>(data[0].data(), dof, n_samples);
+	const MatrixXd dq = Map<MatrixXd>(data[1].data(), dof, n_samples);
+	const MatrixXd command_torques = Map<MatrixXd>(data[2].data(), dof, n_samples);
+	const MatrixXd known_torques = Map<MatrixXd>(data[3].data(), dof, n_samples);
+	MatrixXd reference_torques = logged_reference ? MatrixXd(Map<MatrixXd>(data[4].data(), dof, n_samples)) : MatrixXd::Zero(dof, n_samples);
+	data.clear();
+
+	const int max_lag = max_lag_time / dt;
+	const int first_sample = max((int)(skip_time / dt), max_lag);
+	if(n_samples < first_sample + 2)
+	{
+		cout << "the log is too short (" << n_samples << " samples) for the skipped time and the max lag" << endl;
+		return 1;
+	}
+
+	vector<Configuration> configurations;
+	if(!parseConfigurations(configurations_file, dof, configurations))
+	{
+		return 1;
+	}
+
+	PandaUtils::WorkerPool pool(n_threads);
+
+	// model terms of the observer, independent of the gain :
+	// momentum M dq, and command_torques - (g - C^T dq) - known_torques
+	MatrixXd momentum = MatrixXd::Zero(dof, n_samples);
+	MatrixXd momentum_derivative_inputs = MatrixXd::Zero(dof, n_samples);
+	vector<Sai2Model::Sai2Model*> robots;
+	for(int i=0 ; i<pool.size() ; i++)
+	{
+		robots.push_back(new Sai2Model::Sai2Model(robot_file, false, T_world_robot));
+		if(robots.back()->dof() != dof)
+		{
+			cout << "robot dof inconsistent with the size of q in " << log_file << endl;
+			return 1;
+		}
+	}
+
+	auto compute_model_terms = [&](const int index, const int n_jobs)
+	{
+		Sai2Model::Sai2Model* robot = robots[index];
+		MatrixXd C = MatrixXd::Zero(dof, dof);
+		VectorXd g = VectorXd::Zero(dof);
+		VectorXd ddq = VectorXd::Zero(dof);
+		const int begin = (long)n_samples * index / n_jobs;
+		const int end = (long)n_samples * (index + 1) / n_jobs;
+		for(int n=begin ; n<end ; n++)
+		{
+			robot->_q = q.col(n);
+			robot->_dq = dq.col(n);
+			robot->updateModel();
+			robot->factorizedChristoffelMatrix(C);
+			robot->gravityVector(g);
+
+			momentum.col(n).noalias() = robot->_M * dq.col(n);
+			momentum_derivative_inputs.col(n) = command_torques.col(n) - g - known_torques.col(n);
+			momentum_derivative_inputs.col(n).noalias() += C.transpose() * dq.col(n);
+
+			if(!logged_reference)
+			{
+				const int previous = (n > 0) ? n - 1 : n;
+				const int next = (n < n_samples - 1) ? n + 1 : n;
+				ddq = (dq.col(next) - dq.col(previous)) / ((next - previous) * dt);
+				reference_torques.col(n) = g - command_torques.col(n) + known_torques.col(n);
+				reference_torques.col(n).noalias() += robot->_M * ddq;
+				reference_torques.col(n).noalias() += C * dq.col(n);
+			}
+		}
+	};
+	pool.run(compute_model_terms);
+	const double model_time = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+
+	// replay every configuration
+	vector<Result> results(configurations.size());
+	vector<MatrixXd> estimates(pool.size(), MatrixXd::Zero(dof, n_samples));
+
+	auto replay = [&](const int index, const int n_jobs)
+	{
+		MatrixXd& estimate = estimates[index];
+		vector<double> r(dof);
+		vector<double> integrated_momentum_derivative(dof);
+		Matrix3d F = Matrix3d::Identity();
+		F(0,1) = dt;
+		F(1,2) = dt;
+		const RowVector3d H(1, 0, 0);
+		VectorXd x0 = VectorXd::Zero(3*dof);
+
+		for(unsigned int c=index ; c<configurations.size() ; c+=n_jobs)
+		{
+			const Configuration& configuration = configurations[c];
+			if(!configuration.kalman)
+			{
+				// MomentumObserver::update() with the model terms of the sample. the gain is diagonal,
+				// so the joints are independent scalar recursions, interleaved so that they overlap
+				r.assign(dof, 0.0);
+				integrated_momentum_derivative.assign(dof, 0.0);
+				const double* gains = configuration.gains.data();
+				const double* initial_momentum = momentum.data();
+				for(int n=0 ; n<n_samples ; n++)
+				{
+					const double* sample_momentum = momentum.data() + (long)n * dof;
+					const double* sample_inputs = momentum_derivative_inputs.data() + (long)n * dof;
+					double* sample_estimate = estimate.data() + (long)n * dof;
+					for(int j=0 ; j<dof ; j++)
+					{
+						integrated_momentum_derivative[j] += (sample_inputs[j] + r[j]) * dt;
+						r[j] = gains[j] * (sample_momentum[j] - initial_momentum[j] - integrated_momentum_derivative[j]);
+						sample_estimate[j] = r[j];
+					}
+				}
+			}
+			else
+			{
+				Matrix3d Q = Matrix3d::Zero();
+				Q(2,2) = configuration.process_noise;
+				KalmanFilters::JointKalmanFilter<> kalman_filter(dof, dt, F, H, Q, configuration.measurement_noise);
+				kalman_filter.enableSteadyStateGain();
+				x0.head(dof) = q.col(0);
+				x0.segment(dof, dof) = dq.col(0);
+				kalman_filter.init(x0);
+				for(int n=0 ; n<n_samples ; n++)
+				{
+					kalman_filter.update(q.col(n));
+					estimate.col(n) = kalman_filter.getState().segment(dof, dof);
+				}
+			}
+
+			const MatrixXd& reference = configuration.kalman ? dq : reference_torques;
+			Result& result = results[c];
+			result.rms_error = sqrt(meanSquaredError(estimate, reference, first_sample, 0));
+			result.max_error = (estimate.rightCols(n_samples - first_sample) - reference.rightCols(n_samples - first_sample)).cwiseAbs().maxCoeff();
+			const int lag = bestLag(estimate, reference, first_sample, max_lag);
+			result.lag = lag * dt;
+			result.rms_error_without_lag = sqrt(meanSquaredError(estimate, reference, first_sample, lag));
+		}
+	};
+	pool.run(replay);
+	const double total_time = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+
+	for(unsigned int i=0 ; i<robots.size() ; i++)
+	{
+		delete robots[i];
+	}
+
+	// report
+	cout << n_samples << " samples (" << n_samples * dt << " s) of " << dof << " joints, "
+			<< configurations.size() << " configurations, " << pool.size() << " threads" << endl;
+	cout << "observer reference : " << (logged_reference ? "reference_torques of the log" : "inverse dynamics residual") << endl;
+	cout << "model terms in " << model_time << " s, total " << total_time << " s" << endl << endl;
+
+	size_t label_width = 14;
+	for(unsigned int c=0 ; c<configurations.size() ; c++)
+	{
+		label_width = max(label_width, configurations[c].label.size() + 2);
+	}
+	cout << left << setw(label_width) << "configuration" << right << setw(14) << "rms error" << setw(14) << "max error"
+			<< setw(12) << "lag (ms)" << setw(20) << "rms error - lag" << endl;
+	for(unsigned int c=0 ; c<configurations.size() ; c++)
+	{
+		cout << left << setw(label_width) << configurations[c].label << right << setw(14) << results[c].rms_error
+				<< setw(14) << results[c].max_error << setw(12) << 1000 * results[c].lag << setw(20) << results[c].rms_error_without_lag << endl;
+	}
+
+	if(!output_file.empty())
+	{
+		ofstream out(output_file, ios::out);
+		out << "configuration, rms_error, max_error, lag, rms_error_without_lag\n";
+		for(unsigned int c=0 ; c<configurations.size() ; c++)
+		{
+			out << configurations[c].label << ", " << results[c].rms_error << ", " << results[c].max_error << ", "
+					<< results[c].lag << ", " << results[c].rms_error_without_lag << "\n";
+		}
+		cout << endl << "wrote the results to " << output_file << endl;
+	}
+	return 0;
+}
@@ -0,0 +1,209 @@
+#ifndef UTILS_PASSIVITY_HAPTIC_PASSIVITY_CONTROLLER_H_
+#define UTILS_PASSIVITY_HAPTIC_PASSIVITY_CONTROLLER_H_
+
+// Time domain passivity observer and controller at the port of a 6 dof haptic device,
+// per task space axis, for the translations and the rotations at once.
+//
+// every haptic tick, the energy that the operator put in the teleoperation system along
+// each axis is -F_i * v_i * dt (force and linear velocity for the 3 first axes, torque
+// and angular velocity for the 3 last ones). when the observed energy of an axis, the
+// input energy plus what the controller already dissipated, becomes negative, the system
+// is generating energy along this axis and the controller adds the damping
+// alpha_i = -E_i / (v_i^2 dt) on it, capped by the max damping of the device, so that
+// the damping dissipates the energy in excess :
+//
+//   PandaUtils::HapticPassivityController haptic_passivity(0.001);
+//   haptic_passivity.setMaxDamping(0.9 * max_damping(0), 0.9 * max_damping(1));
+//   ...
+//   haptic_passivity.update(teleop_task->_commanded_force_device, teleop_task->_commanded_torque_device,
+//           teleop_task->_current_trans_velocity_device, teleop_task->_current_rot_velocity_device);
+//   haptic_force = teleop_task->_commanded_force_device + haptic_passivity.dampingForce();
+//   haptic_torque = teleop_task->_commanded_torque_device + haptic_passivity.dampingTorque();
+//
+// the commands and velocities are the ones of the device, in the device frame. the
+// energies are accumulated since the last reset(), or over the last window_size ticks
+// when a window is given. all the axes are computed together on fixed size arrays and
+// update() does not allocate, it costs well under a microsecond.
+
+#include "filters/SlidingWindowSum.h"
+#include <Eigen/Dense>
+
+#include <stdexcept>
+
+namespace PandaUtils {
+
+class HapticPassivityController {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Matrix<double, 6, 1> Vector6d;
+	typedef Eigen::Array<double, 6, 1> Array6d;
+	typedef Eigen::Ref<const Eigen::Vector3d> Vector3dInput;
+
+	// window_size = 0 accumulates the energy since the last reset()
+	HapticPassivityController(const double dt, const int window_size = 0, const double min_velocity = 1e-3)
+	: _dt(dt),
+	  _windowed(window_size > 0),
+	  _min_squared_velocity(min_velocity * min_velocity),
+	  _windowed_input_energy(window_size > 0 ? window_size : 1, 6),
+	  _windowed_correction_energy(window_size > 0 ? window_size : 1, 6)
+	{
+		if(dt <= 0)
+		{
+			throw std::invalid_argument("sampling period should be positive in HapticPassivityController::HapticPassivityController()\n");
+		}
+		if(window_size < 0)
+		{
+			throw std::invalid_argument("window size should be positive in HapticPassivityController::HapticPassivityController()\n");
+		}
+		if(min_velocity < 0)
+		{
+			throw std::invalid_argument("min velocity should be positive in HapticPassivityController::HapticPassivityController()\n");
+		}
+
+		_max_damping.setConstant(1e6);
+		reset();
+	}
+
+	// max damping added along the translation and the rotation axes, in N.s/m and N.m.s/rad
+	void setMaxDamping(const double max_linear_damping, const double max_angular_damping)
+	{
+		if(max_linear_damping < 0 || max_angular_damping < 0)
+		{
+			throw std::invalid_argument("max damping should be positive in HapticPassivityController::setMaxDamping()\n");
+		}
+		_max_damping.head<3>().setConstant(max_linear_damping);
+		_max_damping.tail<3>().setConstant(max_angular_damping);
+	}
+
+	// one haptic tick with the commands rendered by the device and the device velocities.
+	// returns the damping wrench to add to the commands (force, then torque)
+	const Vector6d& update(const Vector3dInput& commanded_force, const Vector3dInput& commanded_torque,
+			const Vector3dInput& linear_velocity, const Vector3dInput& angular_velocity)
+	{
+		_command.head<3>() = commanded_force;
+		_command.tail<3>() = commanded_torque;
+		_velocity.head<3>() = linear_velocity;
+		_velocity.tail<3>() = angular_velocity;
+
+		const Array6d squared_velocity = _velocity.square();
+		_current_input_energy = -_command * _velocity * _dt;
+
+		if(_windowed)
+		{
+			_windowed_input_energy.push(_current_input_energy.matrix());
+			_input_energy = _windowed_input_energy.sum();
+		}
+		else
+		{
+			_input_energy += _current_input_energy;
+		}
+		_observed_energy = _input_energy + _correction_energy;
+
+		// damping that dissipates the energy in excess during this tick
+		_damping = (_observed_energy < 0 && squared_velocity > _min_squared_velocity).select(
+				-_observed_energy / (squared_velocity.max(_min_squared_velocity) * _dt), 0.0).min(_max_damping);
+		_damping_wrench = (-_damping * _velocity).matrix();
+
+		_current_correction_energy = _damping * squared_velocity * _dt;
+		if(_windowed)
+		{
+			_windowed_correction_energy.push(_current_correction_energy.matrix());
+			_correction_energy = _windowed_correction_energy.sum();
+		}
+		else
+		{
+			_correction_energy += _current_correction_energy;
+		}
+
+		return _damping_wrench;
+	}
+
+	// 3 dof devices, or when only the force is rendered
+	const Vector6d& update(const Vector3dInput& commanded_force, const Vector3dInput& linear_velocity)
+	{
+		return update(commanded_force, Eigen::Vector3d::Zero(), linear_velocity, Eigen::Vector3d::Zero());
+	}
+
+	void reset()
+	{
+		_windowed_input_energy.clear();
+		_windowed_correction_energy.clear();
+		_command.setZero();
+		_velocity.setZero();
+		_current_input_energy.setZero();
+		_current_correction_energy.setZero();
+		_input_energy.setZero();
+		_correction_energy.setZero();
+		_observed_energy.setZero();
+		_damping.setZero();
+		_damping_wrench.setZero();
+	}
+
+	const Vector6d& dampingWrench() const
+	{
+		return _damping_wrench;
+	}
+
+	Eigen::Vector3d dampingForce() const
+	{
+		return _damping_wrench.head<3>();
+	}
+
+	Eigen::Vector3d dampingTorque() const
+	{
+		return _damping_wrench.tail<3>();
+	}
+
+	// damping added along every axis during the last update
+	Vector6d dampingCoefficients() const
+	{
+		return _damping.matrix();
+	}
+
+	// energy put in by the operator along every axis (the passivity observer)
+	Vector6d inputEnergy() const
+	{
+		return _input_energy.matrix();
+	}
+
+	// energy dissipated by the damping along every axis
+	Vector6d correctionEnergy() const
+	{
+		return _correction_energy.matrix();
+	}
+
+	// energy used by the last update, input and correction energies
+	Vector6d observedEnergy() const
+	{
+		return _observed_energy.matrix();
+	}
+
+private:
+
+	const double _dt;
+	const bool _windowed;
+	const double _min_squared_velocity;
+
+	Array6d _max_damping;
+
+	SlidingWindowSum<6> _windowed_input_energy;
+	SlidingWindowSum<6> _windowed_correction_energy;
+
+	// [force; torque] and [linear velocity; angular velocity] of the last update
+	Array6d _command;
+	Array6d _velocity;
+
+	Array6d _current_input_energy;
+	Array6d _current_correction_energy;
+	Array6d _input_energy;
+	Array6d _correction_energy;
+	Array6d _observed_energy;
+
+	Array6d _damping;
+	Vector6d _damping_wrench;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_PASSIVITY_HAPTIC_PASSIVITY_CONTROLLER_H_
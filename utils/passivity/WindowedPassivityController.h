@@ -0,0 +1,166 @@
+#ifndef UTILS_PASSIVITY_WINDOWED_PASSIVITY_CONTROLLER_H_
+#define UTILS_PASSIVITY_WINDOWED_PASSIVITY_CONTROLLER_H_
+
+// Time domain passivity observer and controller over a sliding window, per DOF.
+//
+// the observer sums, for every DOF, the energy that flowed into the port during
+// the last window_size samples and the energy that the passivity controller
+// dissipated during the same samples. when this observed energy E (plus the
+// stored energy, if known) is negative, the controller puts the resistance
+// Rpc = exp(-E) - 1 in series with the controller resistance Rc, which scales
+// the controller output vc by Rc / (Rc + Rpc) and dissipates
+// Rpc * scaling * vc^2 * dt, as in 00-1dof_passivity:
+//
+//   PandaUtils::WindowedPassivityController<1> passivity_controller(1, 25);
+//   ...
+//   double scaling = passivity_controller.update(Fs * vc * dt, vc, dt);
+//   Fcmd = Fc * scaling;
+//
+// windows are SlidingWindowSum, update() is constant time in the window size
+// and does not allocate, for haptic rates of several kHz.
+
+#include "filters/SlidingWindowSum.h"
+#include <Eigen/Dense>
+
+#include <math.h>
+#include <stdexcept>
+
+namespace PandaUtils {
+
+template<int DOF = Eigen::Dynamic>
+class WindowedPassivityController {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Matrix<double, DOF, 1> VectorDof;
+	typedef Eigen::Ref<const VectorDof> VectorDofInput;
+
+	WindowedPassivityController(const int dof, const int window_size, const double Rc = 1.0)
+	: _dof(dof),
+	  _Rc(Rc),
+	  _input_energy(window_size, dof),
+	  _correction_energy(window_size, dof)
+	{
+		if(DOF != Eigen::Dynamic && dof != DOF)
+		{
+			throw std::invalid_argument("dof inconsistent with the controller dof in WindowedPassivityController::WindowedPassivityController()\n");
+		}
+		if(Rc <= 0)
+		{
+			throw std::invalid_argument("controller resistance should be positive in WindowedPassivityController::WindowedPassivityController()\n");
+		}
+
+		_observed_energy.setZero(dof);
+		_stored_energy.setZero(dof);
+		_Rpc.setZero(dof);
+		_gain_scaling.setOnes(dof);
+		_current_correction.setZero(dof);
+	}
+
+	// energy stored in the controller (e.g. in its integrator), added to the observed energy
+	void setStoredEnergy(const VectorDofInput& stored_energy)
+	{
+		_stored_energy = stored_energy;
+	}
+
+	// one sample : input_energy is the energy that flowed in during this sample (power * dt),
+	// controller_output the vc of every DOF. returns the gain scaling of the controller output
+	const VectorDof& update(const VectorDofInput& input_energy, const VectorDofInput& controller_output, const double dt)
+	{
+		_input_energy.push(input_energy);
+		_observed_energy = _input_energy.sum() + _correction_energy.sum() + _stored_energy;
+
+		for(int i=0 ; i<_dof ; i++)
+		{
+			_Rpc(i) = 0;
+			if(_observed_energy(i) < 0)
+			{
+				_Rpc(i) = exp(-_observed_energy(i)) - 1;
+			}
+			if(_Rpc(i) < 0)
+			{
+				_Rpc(i) = 0;
+			}
+			_gain_scaling(i) = _Rc / (_Rc + _Rpc(i));
+			_current_correction(i) = _Rpc(i) * _gain_scaling(i) * controller_output(i) * controller_output(i) * dt;
+		}
+		_correction_energy.push(_current_correction);
+
+		return _gain_scaling;
+	}
+
+	// single DOF
+	double update(const double input_energy, const double controller_output, const double dt)
+	{
+		if(_dof != 1)
+		{
+			throw std::invalid_argument("scalar update with several dof in WindowedPassivityController::update()\n");
+		}
+		Eigen::Matrix<double, 1, 1> input_energy_vector, controller_output_vector;
+		input_energy_vector(0) = input_energy;
+		controller_output_vector(0) = controller_output;
+		return update(input_energy_vector, controller_output_vector, dt)(0);
+	}
+
+	void reset()
+	{
+		_input_energy.clear();
+		_correction_energy.clear();
+		_observed_energy.setZero();
+		_Rpc.setZero();
+		_gain_scaling.setOnes();
+		_current_correction.setZero();
+	}
+
+	// windowed energy that flowed in (the passivity observer)
+	const VectorDof& inputEnergy() const
+	{
+		return _input_energy.sum();
+	}
+
+	// windowed energy dissipated by the controller
+	const VectorDof& correctionEnergy() const
+	{
+		return _correction_energy.sum();
+	}
+
+	// energy used by the last update : input, correction and stored energies
+	const VectorDof& observedEnergy() const
+	{
+		return _observed_energy;
+	}
+
+	const VectorDof& passivityResistance() const
+	{
+		return _Rpc;
+	}
+
+	const VectorDof& gainScaling() const
+	{
+		return _gain_scaling;
+	}
+
+	// energy dissipated during the last update
+	const VectorDof& currentCorrectionEnergy() const
+	{
+		return _current_correction;
+	}
+
+private:
+
+	const int _dof;
+	const double _Rc;
+
+	SlidingWindowSum<DOF> _input_energy;
+	SlidingWindowSum<DOF> _correction_energy;
+
+	VectorDof _observed_energy;
+	VectorDof _stored_energy;
+	VectorDof _Rpc;
+	VectorDof _gain_scaling;
+	VectorDof _current_correction;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_PASSIVITY_WINDOWED_PASSIVITY_CONTROLLER_H_
@@ -0,0 +1,177 @@
+#ifndef UTILS_REDIS_ASYNC_REDIS_WRITER_H_
+#define UTILS_REDIS_ASYNC_REDIS_WRITER_H_
+
+// Non-blocking redis writes.
+//
+// a background thread owns its own connection and sends the queued SETs
+// as one pipeline. the calling thread only copies the value into the
+// pending set (the lock is held for the copy, never across a network
+// call), so a control loop does not wait for redis on its write path.
+// writes to the same key that were not sent yet are coalesced, only the
+// latest value goes out. matrices are encoded to json on the writer thread.
+//
+//   PandaUtils::AsyncRedisWriter redis_writer;
+//   redis_writer.start();
+//   while(...) {
+//       ...
+//       redis_writer.setEigenMatrixJSON(DEVICE_COMMANDED_FORCE_KEY, commanded_force);
+//   }
+//   redis_writer.stop();   // flushes the pending writes
+//
+// writes become visible to other clients shortly after the call, in no
+// particular order across keys. keys that must be read back in order on
+// the same connection (e.g. lockstep handoffs) should keep a synchronous
+// client.
+
+#include "redis/RedisClient.h"
+#include <hiredis/hiredis.h>
+#include <Eigen/Dense>
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace PandaUtils {
+
+class AsyncRedisWriter {
+public:
+
+	AsyncRedisWriter(const std::string& hostname = "127.0.0.1", const int port = 6379)
+	: _hostname(hostname),
+	  _port(port),
+	  _running(false),
+	  _n_sent(0)
+	{}
+
+	~AsyncRedisWriter()
+	{
+		stop();
+	}
+
+	void start()
+	{
+		if(_running)
+		{
+			return;
+		}
+		_redis_client.connect(_hostname, _port);
+		_running = true;
+		_writer_thread = std::thread(&AsyncRedisWriter::writerWorker, this);
+	}
+
+	// send what is pending and stop the writer thread
+	void stop()
+	{
+		if(_running)
+		{
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_running = false;
+			}
+			_condition.notify_one();
+			_writer_thread.join();
+		}
+	}
+
+	void set(const std::string& key, const std::string& value)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			PendingWrite& write = _pending[key];
+			write.is_matrix = false;
+			write.value = value;
+		}
+		_condition.notify_one();
+	}
+
+	template<typename Derived>
+	void setEigenMatrixJSON(const std::string& key, const Eigen::MatrixBase<Derived>& value)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			PendingWrite& write = _pending[key];
+			write.is_matrix = true;
+			write.matrix = value;
+		}
+		_condition.notify_one();
+	}
+
+	// number of SET commands sent to the server so far
+	unsigned long long sentCount() const { return _n_sent.load(std::memory_order_relaxed); }
+
+private:
+
+	struct PendingWrite {
+		bool is_matrix;
+		std::string value;
+		Eigen::MatrixXd matrix;
+	};
+
+	void writerWorker()
+	{
+		std::map<std::string, PendingWrite> sending;
+		bool running = true;
+		while(running)
+		{
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_condition.wait(lock, [this]{ return !_pending.empty() || !_running; });
+				sending.swap(_pending);
+				running = _running;
+			}
+			send(sending);
+			sending.clear();
+		}
+	}
+
+	// one pipeline for the whole batch
+	void send(std::map<std::string, PendingWrite>& writes)
+	{
+		if(writes.empty())
+		{
+			return;
+		}
+		redisContext* context = _redis_client.context_.get();
+		for(auto it = writes.begin() ; it != writes.end() ; ++it)
+		{
+			if(it->second.is_matrix)
+			{
+				it->second.value = RedisClient::encodeEigenMatrixJSON(it->second.matrix);
+			}
+			redisAppendCommand(context, "SET %b %b", it->first.data(), it->first.size(),
+				it->second.value.data(), it->second.value.size());
+		}
+		for(unsigned int i=0 ; i<writes.size() ; i++)
+		{
+			void* reply;
+			if(redisGetReply(context, &reply) != REDIS_OK)
+			{
+				throw std::runtime_error("redis write failed in AsyncRedisWriter::send()\n");
+			}
+			freeReplyObject(reply);
+		}
+		_n_sent.fetch_add(writes.size(), std::memory_order_relaxed);
+	}
+
+	std::string _hostname;
+	int _port;
+
+	// used by the writer thread only
+	RedisClient _redis_client;
+	std::thread _writer_thread;
+
+	std::mutex _mutex;
+	std::condition_variable _condition;
+	std::map<std::string, PendingWrite> _pending;
+	bool _running;
+	std::atomic<unsigned long long> _n_sent;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_REDIS_ASYNC_REDIS_WRITER_H_
@@ -0,0 +1,209 @@
+#ifndef UTILS_REDIS_GAIN_SERVICE_H_
+#define UTILS_REDIS_GAIN_SERVICE_H_
+
+// Hot-reloadable controller gains.
+//
+// a background thread owns its own redis connection, watches the gain keys
+// (through a RedisParameterCache, so only changed keys are read) and
+// publishes every change as a new immutable GainSet through an atomic
+// pointer swap. the control loop only does an acquire load and, when the
+// version changed, copies the new values into the task gains it bound:
+//
+//   PandaUtils::GainService gains;
+//   gains.addGain(KP_KEY, joint_task->_kp);
+//   gains.addGain(KV_KEY, joint_task->_kv);
+//   gains.start();
+//   while(...) {
+//       gains.apply();     // control thread, no redis access
+//       ...
+//   }
+//   gains.stop();
+//
+// any double member works as a target (JointTask::_kp, PosOriTask::_kp_pos,
+// HapticController::_kv_haptic_pos, ...). apply() must be called from a
+// single thread, other threads can read the latest values with snapshot().
+
+#include "redis/RedisClient.h"
+#include "redis/RedisParameterCache.h"
+
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace PandaUtils {
+
+// immutable set of gain values, in the order the gains were added
+struct GainSet {
+	unsigned long long version;
+	std::vector<double> values;
+};
+
+class GainService {
+public:
+
+	GainService(const std::string& hostname = "127.0.0.1", const int port = 6379, const int poll_period_ms = 20)
+	: _hostname(hostname),
+	  _port(port),
+	  _poll_period_ms(poll_period_ms),
+	  _last_version(0),
+	  _running(false),
+	  _current(NULL),
+	  _applied_version(0)
+	{}
+
+	~GainService()
+	{
+		stop();
+		delete _current.load();
+		for(auto it = _retired.begin() ; it != _retired.end() ; ++it)
+		{
+			delete *it;
+		}
+	}
+
+	// bind a gain key to a variable of the controller. the variable keeps its value
+	// until the key exists in redis. returns the index of the gain in the GainSet.
+	int addGain(const std::string& key, double& target)
+	{
+		if(_running)
+		{
+			throw std::logic_error("GainService::addGain() cannot be called after start()\n");
+		}
+		_keys.push_back(key);
+		_targets.push_back(&target);
+		_watched_values.push_back(target);
+		return _keys.size() - 1;
+	}
+
+	// connect, publish the initial values to redis if the keys do not exist, and start watching
+	void start()
+	{
+		_redis_client.connect(_hostname, _port);
+		for(unsigned int i=0 ; i<_keys.size() ; i++)
+		{
+			if(!_redis_client.exists(_keys[i]))
+			{
+				_redis_client.set(_keys[i], std::to_string(_watched_values[i]));
+			}
+		}
+		_parameter_cache.reset(new RedisParameterCache(_redis_client, _hostname, _port));
+		for(unsigned int i=0 ; i<_keys.size() ; i++)
+		{
+			_parameter_cache->addDouble(_keys[i], _watched_values[i]);
+		}
+		_parameter_cache->start();
+		publish();
+
+		_running = true;
+		_watch_thread = std::thread(&GainService::watchWorker, this);
+	}
+
+	void stop()
+	{
+		if(_running)
+		{
+			_running = false;
+			_watch_thread.join();
+			_parameter_cache->stop();
+		}
+	}
+
+	// control thread: copy the latest gains into the bound variables if they changed.
+	// an acquire load and a compare when nothing changed. returns true if the gains were updated.
+	bool apply()
+	{
+		const GainSet* gains = _current.load(std::memory_order_acquire);
+		if(gains == NULL || gains->version == _applied_version.load(std::memory_order_relaxed))
+		{
+			return false;
+		}
+		for(unsigned int i=0 ; i<_targets.size() ; i++)
+		{
+			*_targets[i] = gains->values[i];
+		}
+		// lets the watcher free the sets older than this one
+		_applied_version.store(gains->version, std::memory_order_release);
+		return true;
+	}
+
+	// copy of the latest gains, for threads other than the control thread
+	GainSet snapshot()
+	{
+		std::lock_guard<std::mutex> lock(_retire_mutex);
+		const GainSet* gains = _current.load(std::memory_order_acquire);
+		return gains == NULL ? GainSet() : *gains;
+	}
+
+private:
+
+	void watchWorker()
+	{
+		while(_running)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(_poll_period_ms));
+			if(_parameter_cache->update())
+			{
+				publish();
+			}
+			reclaim();
+		}
+	}
+
+	// swap in a new immutable set and retire the previous one
+	void publish()
+	{
+		GainSet* gains = new GainSet();
+		gains->version = ++_last_version;
+		gains->values = _watched_values;
+		std::lock_guard<std::mutex> lock(_retire_mutex);
+		GainSet* previous = _current.exchange(gains, std::memory_order_acq_rel);
+		if(previous != NULL)
+		{
+			_retired.push_back(previous);
+		}
+	}
+
+	// free the retired sets the control thread can no longer be reading: it
+	// acknowledged a newer version in apply(), so it loaded the pointer after the swap
+	void reclaim()
+	{
+		const unsigned long long applied = _applied_version.load(std::memory_order_acquire);
+		std::lock_guard<std::mutex> lock(_retire_mutex);
+		while(!_retired.empty() && _retired.front()->version < applied)
+		{
+			delete _retired.front();
+			_retired.pop_front();
+		}
+	}
+
+	std::string _hostname;
+	int _port;
+	int _poll_period_ms;
+
+	std::vector<std::string> _keys;
+	std::vector<double*> _targets;
+
+	// written by the watcher thread only
+	RedisClient _redis_client;
+	std::unique_ptr<RedisParameterCache> _parameter_cache;
+	std::vector<double> _watched_values;
+	unsigned long long _last_version;
+
+	std::atomic<bool> _running;
+	std::thread _watch_thread;
+
+	std::atomic<GainSet*> _current;
+	std::atomic<unsigned long long> _applied_version;
+	std::mutex _retire_mutex;
+	std::list<GainSet*> _retired;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_REDIS_GAIN_SERVICE_H_
@@ -0,0 +1,274 @@
+#ifndef UTILS_REDIS_GRASP_TARGET_INPUT_H_
+#define UTILS_REDIS_GRASP_TARGET_INPUT_H_
+
+// Grasp targets of a camera, read and put in world frame on a background thread.
+//
+// the perception publishes the desired pose of the grasp in the frame of a camera mounted
+// on a robot link. a background thread polls the two keys on its own connection, parses
+// them, and computes the target in world frame with the latest pose of the camera link
+// given by the control thread : the orientation of the controlled frame, the approach
+// direction and the pre grasp position at a distance along it. the ready target is handed
+// to the control thread through a TripleBuffer (see threads/TripleBuffer.h), so a control
+// loop waiting for the camera only does a non blocking read per cycle :
+//
+//   PandaUtils::GraspTargetInput grasp_input(DESIRED_POS_IN_CAMERA_FRAME_KEY, DESIRED_ROT_IN_CAMERA_FRAME_KEY);
+//   grasp_input.setCameraMount(T_world_base, T_link_camera);
+//   grasp_input.setHandFrame(R_link_hand, approach_direction_in_hand, 0.05);
+//   grasp_input.start(100.0);
+//   PandaUtils::GraspTarget grasp_target;
+//   while(...) {
+//       robot->transform(T_base_link, camera_link);
+//       grasp_input.setCameraLinkPose(T_base_link);
+//       if(grasp_input.read(grasp_target)) {
+//           posori_task->_desired_orientation = grasp_target.orientation;
+//           posori_task->_desired_position = grasp_target.pre_grasp_position;
+//       }
+//   }
+//   grasp_input.stop();
+//
+// a target is valid when the position in camera frame is further than the minimum distance
+// from the camera (the perception writes zero when it has no target). clear() forgets the
+// current target : call it after resetting the keys, the targets read before are dropped.
+// an optional preparation function runs on the background thread for every valid target,
+// e.g. to compute the initial guess of an IK in q_seed.
+
+#include "redis/RedisClient.h"
+#include "threads/TripleBuffer.h"
+#include <Eigen/Dense>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace PandaUtils {
+
+struct GraspTarget {
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	bool valid;
+	// incremented for every target computed by the background thread
+	unsigned long sequence;
+	// value of the clear() counter the target was read after
+	unsigned long epoch;
+
+	// in world frame
+	Eigen::Vector3d position;
+	Eigen::Matrix3d orientation;
+	Eigen::Vector3d approach_direction;
+	Eigen::Vector3d pre_grasp_position;
+	// pose of the camera the target was computed with
+	Eigen::Affine3d T_world_camera;
+
+	// filled by the preparation function
+	Eigen::VectorXd q_seed;
+
+	GraspTarget()
+	: valid(false),
+	  sequence(0),
+	  epoch(0),
+	  position(Eigen::Vector3d::Zero()),
+	  orientation(Eigen::Matrix3d::Identity()),
+	  approach_direction(Eigen::Vector3d::UnitZ()),
+	  pre_grasp_position(Eigen::Vector3d::Zero()),
+	  T_world_camera(Eigen::Affine3d::Identity())
+	{}
+};
+
+class GraspTargetInput {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	GraspTargetInput(const std::string& position_key, const std::string& rotation_key,
+			const std::string& hostname = "127.0.0.1", const int port = 6379)
+	: _position_key(position_key),
+	  _rotation_key(rotation_key),
+	  _hostname(hostname),
+	  _port(port),
+	  _T_world_base(Eigen::Affine3d::Identity()),
+	  _T_link_camera(Eigen::Affine3d::Identity()),
+	  _R_link_hand(Eigen::Matrix3d::Identity()),
+	  _approach_direction_in_hand(Eigen::Vector3d::UnitZ()),
+	  _approach_distance(0),
+	  _minimum_distance(1e-2),
+	  _camera_link_pose(Eigen::Affine3d::Identity()),
+	  _epoch(0),
+	  _running(false),
+	  _n_polls(0),
+	  _n_failed_polls(0)
+	{}
+
+	~GraspTargetInput()
+	{
+		stop();
+	}
+
+	// pose of the base of the robot carrying the camera in world, and of the camera in the
+	// link given to setCameraLinkPose(). before start()
+	void setCameraMount(const Eigen::Affine3d& T_world_base, const Eigen::Affine3d& T_link_camera)
+	{
+		_T_world_base = T_world_base;
+		_T_link_camera = T_link_camera;
+	}
+
+	// rotation of the controlled frame of the hand in the grasp frame of the perception, the
+	// target orientation is R_world_camera * R_camera_grasp * R_link_hand^T. the pre grasp
+	// position is approach_distance before the target along the approach direction. before start()
+	void setHandFrame(const Eigen::Matrix3d& R_link_hand, const Eigen::Vector3d& approach_direction_in_hand,
+			const double approach_distance)
+	{
+		_R_link_hand = R_link_hand;
+		_approach_direction_in_hand = approach_direction_in_hand.normalized();
+		_approach_distance = approach_distance;
+	}
+
+	// positions closer to the camera are no target. before start()
+	void setMinimumDistance(const double minimum_distance)
+	{
+		_minimum_distance = minimum_distance;
+	}
+
+	// runs on the background thread on every valid target. before start()
+	void setPreparation(const std::function<void(GraspTarget&)>& preparation)
+	{
+		_preparation = preparation;
+	}
+
+	void start(const double poll_frequency = 100.0)
+	{
+		if(_running)
+		{
+			return;
+		}
+		if(poll_frequency <= 0)
+		{
+			throw std::invalid_argument("poll frequency must be positive in GraspTargetInput::start()\n");
+		}
+		_poll_period = std::chrono::nanoseconds((long long) (1e9 / poll_frequency));
+		_redis_client.connect(_hostname, _port);
+		_running = true;
+		_poll_thread = std::thread(&GraspTargetInput::pollWorker, this);
+	}
+
+	void stop()
+	{
+		if(_running)
+		{
+			_running = false;
+			_poll_thread.join();
+		}
+	}
+
+	// control thread only : pose of the camera link in the base of its robot. no target is
+	// computed before the first call
+	void setCameraLinkPose(const Eigen::Affine3d& T_base_link)
+	{
+		_camera_link_pose.write(T_base_link);
+	}
+
+	// control thread only : copies the latest target to target, returns true if it is valid
+	// and was read after the last clear()
+	bool read(GraspTarget& target)
+	{
+		target = _targets.latest();
+		return target.valid && target.epoch == _epoch.load(std::memory_order_relaxed);
+	}
+
+	// control thread only : drop the current target, the next one is read after this call
+	void clear()
+	{
+		_epoch.fetch_add(1, std::memory_order_release);
+	}
+
+	unsigned long polls() const { return _n_polls; }
+	// polls where a key was missing or of the wrong size
+	unsigned long failedPolls() const { return _n_failed_polls; }
+
+private:
+
+	void pollWorker()
+	{
+		bool f_camera_pose = false;
+		Eigen::Affine3d T_base_link = Eigen::Affine3d::Identity();
+		unsigned long sequence = 0;
+		auto next_poll = std::chrono::steady_clock::now();
+		while(_running)
+		{
+			next_poll += _poll_period;
+			std::this_thread::sleep_until(next_poll);
+
+			if(_camera_link_pose.read(T_base_link))
+			{
+				f_camera_pose = true;
+			}
+			// loaded before the keys, so that a target read after a clear() got the keys after it
+			const unsigned long epoch = _epoch.load(std::memory_order_acquire);
+
+			Eigen::MatrixXd position_in_camera, rotation_in_camera;
+			try
+			{
+				position_in_camera = _redis_client.getEigenMatrixJSON(_position_key);
+				rotation_in_camera = _redis_client.getEigenMatrixJSON(_rotation_key);
+			}
+			catch(const std::exception&)
+			{
+				_n_failed_polls++;
+				continue;
+			}
+			_n_polls++;
+			if(position_in_camera.size() != 3 || rotation_in_camera.rows() != 3 || rotation_in_camera.cols() != 3)
+			{
+				_n_failed_polls++;
+				continue;
+			}
+
+			GraspTarget& target = _targets.writeBuffer();
+			target.sequence = ++sequence;
+			target.epoch = epoch;
+			target.valid = f_camera_pose && Eigen::Map<const Eigen::Vector3d>(position_in_camera.data()).norm() > _minimum_distance;
+			if(target.valid)
+			{
+				target.T_world_camera = _T_world_base * T_base_link * _T_link_camera;
+				target.position = target.T_world_camera * Eigen::Map<const Eigen::Vector3d>(position_in_camera.data());
+				target.orientation = target.T_world_camera.linear() * rotation_in_camera * _R_link_hand.transpose();
+				target.approach_direction = target.orientation * _approach_direction_in_hand;
+				target.pre_grasp_position = target.position - _approach_distance * target.approach_direction;
+				if(_preparation)
+				{
+					_preparation(target);
+				}
+			}
+			_targets.publish();
+		}
+	}
+
+	std::string _position_key;
+	std::string _rotation_key;
+	std::string _hostname;
+	int _port;
+	RedisClient _redis_client;
+
+	Eigen::Affine3d _T_world_base;
+	Eigen::Affine3d _T_link_camera;
+	Eigen::Matrix3d _R_link_hand;
+	Eigen::Vector3d _approach_direction_in_hand;
+	double _approach_distance;
+	double _minimum_distance;
+	std::function<void(GraspTarget&)> _preparation;
+
+	TripleBuffer<Eigen::Affine3d> _camera_link_pose;
+	TripleBuffer<GraspTarget> _targets;
+	std::atomic<unsigned long> _epoch;
+
+	std::chrono::nanoseconds _poll_period;
+	std::atomic<bool> _running;
+	std::atomic<unsigned long> _n_polls;
+	std::atomic<unsigned long> _n_failed_polls;
+	std::thread _poll_thread;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_REDIS_GRASP_TARGET_INPUT_H_
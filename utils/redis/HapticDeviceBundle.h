@@ -0,0 +1,227 @@
+#ifndef UTILS_REDIS_HAPTIC_DEVICE_BUNDLE_H_
+#define UTILS_REDIS_HAPTIC_DEVICE_BUNDLE_H_
+
+// Binary device state and command records of a haptic device on the redis server, one GET
+// and one SET per tick in place of the 8 device keys read and the 3 written as JSON.
+//
+// the records are TeleopPackets (net/TeleopPacket.h) under two keys per device :
+//   sai2::ChaiHapticDevice::device<n>::bundle::state      written by the haptic side
+//   sai2::ChaiHapticDevice::device<n>::bundle::commands   written by the controller
+// next to the chai haptic driver, haptic_bundle_bridge (utils/redis/haptic_bundle_bridge.cpp)
+// packs the sensor keys of the driver into the state record and writes the commands record
+// back to the actuator keys, on the same machine. the controllers read the device through
+// RedisHapticDevice, a HapticDeviceChannel (see net/HapticDeviceChannel.h), when the state
+// record is there, and keep the JSON keys otherwise :
+//
+//   PandaUtils::HapticDeviceChannel* device_channel = NULL;
+//   if(PandaUtils::RedisHapticDevice::available(redis_client, 0))
+//   {
+//       device_channel = new PandaUtils::RedisHapticDevice(redis_client, 0);
+//   }
+//   else
+//   {
+//       redis_client.addEigenToReadCallback(0, DEVICE_POSITION_KEYS[0], teleop_task->_current_position_device);
+//       ...
+//   }
+//
+// the values are sent with %b, the records can contain null bytes. a state record with the
+// sequence of the last one read is not new : the bridge stopped or runs slower than the
+// reader, and after the timeout without a new record the channel is timed out. the device
+// specifications stay JSON keys, read once at the start.
+
+#include "redis/RedisClient.h"
+#include "net/HapticDeviceChannel.h"
+#include <hiredis/hiredis.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace PandaUtils {
+
+const std::string HAPTIC_DEVICE_KEY_PREFIX = "sai2::ChaiHapticDevice::device";
+
+inline std::string hapticDeviceStateKey(const int device_index)
+{
+	return HAPTIC_DEVICE_KEY_PREFIX + std::to_string(device_index) + "::bundle::state";
+}
+
+inline std::string hapticDeviceCommandsKey(const int device_index)
+{
+	return HAPTIC_DEVICE_KEY_PREFIX + std::to_string(device_index) + "::bundle::commands";
+}
+
+// sets key to packet, as a binary value
+inline bool setTeleopPacket(RedisClient& redis_client, const std::string& key, const TeleopPacket& packet)
+{
+	redisReply* reply = (redisReply*) redisCommand(redis_client.context_.get(), "SET %b %b",
+			key.data(), key.size(), &packet, sizeof(TeleopPacket));
+	if(reply == NULL)
+	{
+		return false;
+	}
+	const bool ok = reply->type != REDIS_REPLY_ERROR;
+	freeReplyObject(reply);
+	return ok;
+}
+
+// reads the packet of key. false when the key does not exist or does not hold a packet of
+// this version and channel (packet is then not changed)
+inline bool getTeleopPacket(RedisClient& redis_client, const std::string& key, const uint16_t channel, TeleopPacket& packet)
+{
+	redisReply* reply = (redisReply*) redisCommand(redis_client.context_.get(), "GET %b", key.data(), key.size());
+	if(reply == NULL)
+	{
+		throw std::runtime_error("GET '" + key + "' failed in getTeleopPacket()\n");
+	}
+	bool ok = false;
+	if(reply->type == REDIS_REPLY_STRING && reply->len == sizeof(TeleopPacket))
+	{
+		TeleopPacket received;
+		memcpy(&received, reply->str, sizeof(TeleopPacket));
+		if(received.magic == TeleopPacket::MAGIC && received.version == TeleopPacket::VERSION && received.channel == channel)
+		{
+			packet = received;
+			ok = true;
+		}
+	}
+	freeReplyObject(reply);
+	return ok;
+}
+
+class RedisHapticDevice : public HapticDeviceChannel {
+public:
+
+	// redis_client is the connection of the thread that uses the device. timeout in seconds
+	RedisHapticDevice(RedisClient& redis_client, const int device_index, const double timeout = 0.1)
+	: _redis_client(redis_client),
+	  _state_key(hapticDeviceStateKey(device_index)),
+	  _commands_key(hapticDeviceCommandsKey(device_index)),
+	  _channel(device_index),
+	  _timeout(timeout),
+	  _sequence(0),
+	  _last_sequence(0),
+	  _f_received(false),
+	  _n_sent(0),
+	  _n_send_errors(0),
+	  _n_received(0),
+	  _n_repeated(0),
+	  _n_missing(0)
+	{
+		if(device_index < 0 || timeout <= 0)
+		{
+			throw std::invalid_argument("device index and timeout should be positive in RedisHapticDevice::RedisHapticDevice()\n");
+		}
+		_last_record_time = std::chrono::steady_clock::now();
+	}
+
+	// a state record of the device is on redis, i.e. its bundle bridge runs or ran
+	static bool available(RedisClient& redis_client, const int device_index)
+	{
+		TeleopPacket packet;
+		return getTeleopPacket(redis_client, hapticDeviceStateKey(device_index), device_index, packet);
+	}
+
+	// the specifications of the device (JSON keys of the driver), once at the start
+	template<typename HapticTask>
+	void readSpecifications(HapticTask& teleop_task)
+	{
+		const std::string prefix = HAPTIC_DEVICE_KEY_PREFIX + std::to_string(_channel) + "::specifications::";
+		Eigen::VectorXd max_stiffness = _redis_client.getEigenMatrixJSON(prefix + "max_stiffness");
+		Eigen::VectorXd max_damping = _redis_client.getEigenMatrixJSON(prefix + "max_damping");
+		Eigen::VectorXd max_force = _redis_client.getEigenMatrixJSON(prefix + "max_force");
+		teleop_task._max_linear_stiffness_device = max_stiffness(0);
+		teleop_task._max_angular_stiffness_device = max_stiffness(1);
+		teleop_task._max_linear_damping_device = max_damping(0);
+		teleop_task._max_angular_damping_device = max_damping(1);
+		teleop_task._max_force_device = max_force(0);
+		teleop_task._max_torque_device = max_force(1);
+	}
+
+	bool receive(TeleopPacket& packet)
+	{
+		if(!getTeleopPacket(_redis_client, _state_key, _channel, _buffer))
+		{
+			_n_missing++;
+			return false;
+		}
+		// a restarted bridge starts its sequence again, taken after the timeout
+		if(_f_received && _buffer.sequence == _last_sequence)
+		{
+			_n_repeated++;
+			return false;
+		}
+		if(_f_received && _buffer.sequence < _last_sequence && !timedOut())
+		{
+			_n_repeated++;
+			return false;
+		}
+		_last_sequence = _buffer.sequence;
+		_f_received = true;
+		_last_record_time = std::chrono::steady_clock::now();
+		_n_received++;
+		packet = _buffer;
+		return true;
+	}
+
+	bool send(TeleopPacket& packet, const double time)
+	{
+		packet.magic = TeleopPacket::MAGIC;
+		packet.version = TeleopPacket::VERSION;
+		packet.channel = _channel;
+		packet.sequence = ++_sequence;
+		packet.send_time = time;
+		if(!setTeleopPacket(_redis_client, _commands_key, packet))
+		{
+			_n_send_errors++;
+			return false;
+		}
+		_n_sent++;
+		return true;
+	}
+
+	bool timedOut() const
+	{
+		return !_f_received || std::chrono::duration<double>(std::chrono::steady_clock::now() - _last_record_time).count() > _timeout;
+	}
+
+	// e.g. "redis bundle, sent 40000, received 39990, repeated 10, missing 0"
+	std::string summary() const
+	{
+		return "redis bundle, sent " + std::to_string(_n_sent) + ", received " + std::to_string(_n_received)
+			+ ", repeated " + std::to_string(_n_repeated) + ", missing " + std::to_string(_n_missing);
+	}
+
+	uint64_t sent() const { return _n_sent; }
+	uint64_t sendErrors() const { return _n_send_errors; }
+	uint64_t received() const { return _n_received; }
+	// reads of a record already read
+	uint64_t repeated() const { return _n_repeated; }
+	// reads without a valid record
+	uint64_t missing() const { return _n_missing; }
+
+private:
+	RedisClient& _redis_client;
+	const std::string _state_key;
+	const std::string _commands_key;
+	const uint16_t _channel;
+	const double _timeout;
+
+	uint64_t _sequence;
+	uint64_t _last_sequence;
+	bool _f_received;
+	std::chrono::steady_clock::time_point _last_record_time;
+	TeleopPacket _buffer;
+
+	uint64_t _n_sent;
+	uint64_t _n_send_errors;
+	uint64_t _n_received;
+	uint64_t _n_repeated;
+	uint64_t _n_missing;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_REDIS_HAPTIC_DEVICE_BUNDLE_H_
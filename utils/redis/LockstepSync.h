@@ -0,0 +1,121 @@
+#ifndef UTILS_REDIS_LOCKSTEP_SYNC_H_
+#define UTILS_REDIS_LOCKSTEP_SYNC_H_
+
+// Lockstep stepping between a simviz and a controller.
+//
+// instead of running on two independent LoopTimers, the simulation
+// publishes the state of step n and blocks until the controller has
+// published the torques of step n. the controller blocks until a new state
+// is available. the handoff uses two redis lists (RPUSH / BLPOP) so both
+// sides sleep in the redis server instead of polling, and the pair runs as
+// fast as the cpu allows, independently of wall clock time.
+//
+// the data keys (q, dq, torques) are written as usual, before the step is
+// published, on the same connection. redis executes the commands of a
+// connection in order so the data is always in place when the other side
+// wakes up.
+//
+//   simviz:                              controller:
+//     write q, dq                          lockstep.waitForState(step)
+//     lockstep.publishState(n)             read q, dq, compute torques
+//     lockstep.waitForTorques(n)           write torques
+//     read torques, integrate              lockstep.publishTorques(step)
+
+#include "redis/RedisClient.h"
+#include <hiredis/hiredis.h>
+
+#include <stdexcept>
+#include <string>
+
+namespace PandaUtils {
+
+class LockstepSync {
+public:
+
+	// keys are created under key_prefix, e.g. "sai2::PandaApplication::lockstep"
+	LockstepSync(RedisClient& redis_client, const std::string& key_prefix)
+	: _redis_client(redis_client),
+	  _state_step_key(key_prefix + "::state_step"),
+	  _torques_step_key(key_prefix + "::torques_step")
+	{}
+
+	~LockstepSync(){}
+
+	// clear pending steps from a previous run. call from the simviz before the first publishState()
+	void reset()
+	{
+		command("DEL %s %s", _state_step_key.c_str(), _torques_step_key.c_str());
+	}
+
+	// simviz side: announce that the state of step is written
+	void publishState(const unsigned long long step)
+	{
+		command("RPUSH %s %llu", _state_step_key.c_str(), step);
+	}
+
+	// simviz side: wait for the torques computed from the state of step.
+	// returns false on timeout so the caller can check its stop flag.
+	bool waitForTorques(const unsigned long long step, const int timeout_seconds = 1)
+	{
+		unsigned long long received_step;
+		while(pop(_torques_step_key, received_step, timeout_seconds))
+		{
+			if(received_step == step)
+			{
+				return true;
+			}
+			// stale torques from an earlier step (e.g. controller restarted), skip them
+		}
+		return false;
+	}
+
+	// controller side: wait for the next state. returns false on timeout.
+	bool waitForState(unsigned long long& step, const int timeout_seconds = 1)
+	{
+		return pop(_state_step_key, step, timeout_seconds);
+	}
+
+	// controller side: announce that the torques for step are written
+	void publishTorques(const unsigned long long step)
+	{
+		command("RPUSH %s %llu", _torques_step_key.c_str(), step);
+	}
+
+private:
+
+	template<typename... Args>
+	void command(const char* format, Args... args)
+	{
+		redisReply* reply = (redisReply*) redisCommand(_redis_client.context_.get(), format, args...);
+		if(reply == NULL)
+		{
+			throw std::runtime_error("LockstepSync: redis command failed\n");
+		}
+		freeReplyObject(reply);
+	}
+
+	bool pop(const std::string& key, unsigned long long& step, const int timeout_seconds)
+	{
+		redisReply* reply = (redisReply*) redisCommand(_redis_client.context_.get(), "BLPOP %s %d", key.c_str(), timeout_seconds);
+		if(reply == NULL)
+		{
+			throw std::runtime_error("LockstepSync: BLPOP on " + key + " failed\n");
+		}
+		bool success = false;
+		if(reply->type == REDIS_REPLY_ARRAY && reply->elements == 2)
+		{
+			step = std::stoull(std::string(reply->element[1]->str, reply->element[1]->len));
+			success = true;
+		}
+		freeReplyObject(reply);
+		return success;
+	}
+
+	RedisClient& _redis_client;
+	std::string _state_step_key;
+	std::string _torques_step_key;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_REDIS_LOCKSTEP_SYNC_H_
@@ -0,0 +1,109 @@
+#ifndef UTILS_REDIS_MULTI_ROBOT_REDIS_IO_H_
+#define UTILS_REDIS_MULTI_ROBOT_REDIS_IO_H_
+
+// Joint state reads and torque writes for several robots in one pipelined
+// exchange each, built on the read/write callbacks of RedisClient. the
+// per-cycle redis cost does not grow with the number of arms.
+//
+// the values are staged in the object rather than written into the robot
+// models, so apps that share their models through sf::safe_ptr keep doing
+// the copy under their own lock:
+//
+//   PandaUtils::MultiRobotRedisIO robots_io(redis_client, JOINT_ANGLES_KEYS,
+//           JOINT_VELOCITIES_KEYS, JOINT_TORQUES_COMMANDED_KEYS, dofs);
+//   ...
+//   robots_io.read();
+//   for(int i=0 ; i<n_robots ; i++)
+//   {
+//       robots[i]->_q = robots_io._q[i];
+//       robots[i]->_dq = robots_io._dq[i];
+//   }
+//   ...
+//   robots_io.write(command_torques);
+
+#include "redis/RedisClient.h"
+#include <Eigen/Dense>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+class MultiRobotRedisIO {
+public:
+
+	MultiRobotRedisIO(RedisClient& redis_client,
+			const std::vector<std::string>& joint_angles_keys,
+			const std::vector<std::string>& joint_velocities_keys,
+			const std::vector<std::string>& joint_torques_commanded_keys,
+			const std::vector<int>& dofs,
+			const int read_callback_number = 0,
+			const int write_callback_number = 0)
+	: _redis_client(redis_client),
+	  _read_callback_number(read_callback_number),
+	  _write_callback_number(write_callback_number)
+	{
+		const unsigned int n_robots = dofs.size();
+		if(joint_angles_keys.size() != n_robots || joint_velocities_keys.size() != n_robots
+			|| joint_torques_commanded_keys.size() != n_robots)
+		{
+			throw std::invalid_argument("number of keys inconsistent with number of robots in MultiRobotRedisIO\n");
+		}
+
+		// the callbacks keep references to the elements, so the vectors are not resized afterwards
+		for(unsigned int i=0 ; i<n_robots ; i++)
+		{
+			_q.push_back(Eigen::VectorXd::Zero(dofs[i]));
+			_dq.push_back(Eigen::VectorXd::Zero(dofs[i]));
+			_command_torques.push_back(Eigen::VectorXd::Zero(dofs[i]));
+		}
+
+		_redis_client.createReadCallback(_read_callback_number);
+		_redis_client.createWriteCallback(_write_callback_number);
+		for(unsigned int i=0 ; i<n_robots ; i++)
+		{
+			_redis_client.addEigenToReadCallback(_read_callback_number, joint_angles_keys[i], _q[i]);
+			_redis_client.addEigenToReadCallback(_read_callback_number, joint_velocities_keys[i], _dq[i]);
+			_redis_client.addEigenToWriteCallback(_write_callback_number, joint_torques_commanded_keys[i], _command_torques[i]);
+		}
+	}
+
+	~MultiRobotRedisIO(){}
+
+	int nRobots() const { return _q.size(); }
+
+	// q and dq of all the robots in one round trip
+	void read()
+	{
+		_redis_client.executeReadCallback(_read_callback_number);
+	}
+
+	// torques of all the robots in one round trip
+	void write(const std::vector<Eigen::VectorXd>& command_torques)
+	{
+		if(command_torques.size() != _command_torques.size())
+		{
+			throw std::invalid_argument("number of torque vectors inconsistent with number of robots in MultiRobotRedisIO::write()\n");
+		}
+		for(unsigned int i=0 ; i<_command_torques.size() ; i++)
+		{
+			_command_torques[i] = command_torques[i];
+		}
+		_redis_client.executeWriteCallback(_write_callback_number);
+	}
+
+	// staged values, one entry per robot
+	std::vector<Eigen::VectorXd> _q;
+	std::vector<Eigen::VectorXd> _dq;
+	std::vector<Eigen::VectorXd> _command_torques;
+
+private:
+	RedisClient& _redis_client;
+	int _read_callback_number;
+	int _write_callback_number;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_REDIS_MULTI_ROBOT_REDIS_IO_H_
@@ -0,0 +1,245 @@
+#ifndef UTILS_REDIS_OVERLAPPED_REDIS_IO_H_
+#define UTILS_REDIS_OVERLAPPED_REDIS_IO_H_
+
+// The write of the commands of a tick and the read of the state of the next one in one
+// round trip, sent right after the computation and received at the start of the next tick.
+//
+// with the read and write callbacks of RedisClient a tick waits for two round trips : the
+// read of the state before the computation and the write of the torques after it. here the
+// SETs of the write keys and the GETs of the read keys go out as one pipeline as soon as the
+// torques are computed, without waiting for the replies, and the replies are taken at the
+// start of the next tick, after the sleep of the loop, when they have arrived. the critical
+// path of a tick has no round trip left :
+//
+//   PandaUtils::OverlappedRedisIO io(redis_client);
+//   io.addEigenToRead(JOINT_ANGLES_KEY, robot->_q);
+//   io.addEigenToRead(JOINT_VELOCITIES_KEY, robot->_dq);
+//   io.addEigenToWrite(JOINT_TORQUES_COMMANDED_KEY, command_torques);
+//   io.prefetch();                      // state of the first tick
+//   while(runloop) {
+//       timer.waitForNextLoop();
+//       io.complete();                  // state prefetched by the previous tick
+//       ...
+//       io.writeAndPrefetch();          // torques of this tick, state of the next one
+//   }
+//   io.complete();
+//
+// the state a tick computes with is read at the end of the previous tick instead of at its
+// start, older by the sleep of the loop (at most one period), and the torques reach redis
+// at the same time as with the write callbacks. the read and write objects are encoded and
+// decoded as with the callbacks of RedisClient (json, doubles as strings), a read key that
+// does not exist leaves its object unchanged. the connection is used by nothing else
+// between writeAndPrefetch() and complete(). the values are encoded on a CycleArena reset
+// by every pipeline and decoded in place (redis/RedisJsonEigen.h), a tick allocates nothing
+// but the replies of hiredis.
+
+#include "memory/CycleArena.h"
+#include "redis/RedisClient.h"
+#include "redis/RedisJsonEigen.h"
+#include <hiredis/hiredis.h>
+#include <Eigen/Dense>
+
+#include <cstdlib>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+class OverlappedRedisIO {
+public:
+
+	OverlappedRedisIO(RedisClient& redis_client)
+	: _redis_client(redis_client),
+	  _arena(4096),
+	  _n_pending_writes(0),
+	  _f_in_flight(false),
+	  _n_exchanges(0)
+	{}
+
+	template<typename Scalar, int Rows, int Cols>
+	void addEigenToRead(const std::string& key, Eigen::Matrix<Scalar, Rows, Cols>& object)
+	{
+		Eigen::Matrix<Scalar, Rows, Cols>* target = &object;
+		Read read;
+		read.key = key;
+		read.decode = [target](const char* value, const size_t len)
+		{
+			decodeEigenMatrixJSON(value, len, *target);
+		};
+		_reads.push_back(read);
+	}
+
+	void addDoubleToRead(const std::string& key, double& object)
+	{
+		double* target = &object;
+		Read read;
+		read.key = key;
+		read.decode = [target](const char* value, const size_t) { *target = std::strtod(value, NULL); };
+		_reads.push_back(read);
+	}
+
+	template<typename Scalar, int Rows, int Cols>
+	void addEigenToWrite(const std::string& key, const Eigen::Matrix<Scalar, Rows, Cols>& object)
+	{
+		const Eigen::Matrix<Scalar, Rows, Cols>* source = &object;
+		Write write;
+		write.key = key;
+		write.size = 0;
+		write.encode = [source](ArenaString& value)
+		{
+			encodeEigenMatrixJSON(*source, value);
+		};
+		_writes.push_back(write);
+	}
+
+	void addDoubleToWrite(const std::string& key, const double& object)
+	{
+		const double* source = &object;
+		Write write;
+		write.key = key;
+		write.size = 0;
+		write.encode = [source](ArenaString& value)
+		{
+			internal::appendJSONDouble(*source, value);
+		};
+		_writes.push_back(write);
+	}
+
+	// sends the reads only, e.g. for the first tick
+	void prefetch()
+	{
+		send(false);
+	}
+
+	// sends the writes and the reads, right after the computation
+	void writeAndPrefetch()
+	{
+		send(true);
+	}
+
+	// takes the replies of the last pipeline and decodes the read keys, waiting only for the
+	// ones that have not arrived yet. does nothing without a pipeline in flight
+	void complete()
+	{
+		if(!_f_in_flight)
+		{
+			return;
+		}
+		redisContext* context = _redis_client.context_.get();
+		for(int i=0 ; i<_n_pending_writes ; i++)
+		{
+			void* reply;
+			if(redisGetReply(context, &reply) != REDIS_OK)
+			{
+				throw std::runtime_error("redis write failed in OverlappedRedisIO::complete()\n");
+			}
+			freeReplyObject(reply);
+		}
+		for(unsigned int i=0 ; i<_reads.size() ; i++)
+		{
+			void* reply;
+			if(redisGetReply(context, &reply) != REDIS_OK)
+			{
+				throw std::runtime_error("redis read of " + _reads[i].key + " failed in OverlappedRedisIO::complete()\n");
+			}
+			redisReply* r = (redisReply*) reply;
+			if(r->type == REDIS_REPLY_STRING)
+			{
+				try
+				{
+					_reads[i].decode(r->str, r->len);
+				}
+				catch(...)
+				{
+					freeReplyObject(reply);
+					throw;
+				}
+			}
+			freeReplyObject(reply);
+		}
+		_n_pending_writes = 0;
+		_f_in_flight = false;
+		_n_exchanges++;
+	}
+
+	bool inFlight() const { return _f_in_flight; }
+	// pipelines completed
+	unsigned long long numExchanges() const { return _n_exchanges; }
+	int numReads() const { return (int) _reads.size(); }
+	int numWrites() const { return (int) _writes.size(); }
+
+private:
+
+	struct Read {
+		std::string key;
+		std::function<void(const char*, size_t)> decode;
+	};
+
+	struct Write {
+		std::string key;
+		// of the last value, reserved on the arena for the next one
+		size_t size;
+		std::function<void(ArenaString&)> encode;
+	};
+
+	void send(const bool with_writes)
+	{
+		if(_f_in_flight)
+		{
+			throw std::logic_error("the replies of the previous pipeline were not taken in OverlappedRedisIO::send()\n");
+		}
+		redisContext* context = _redis_client.context_.get();
+		_n_pending_writes = 0;
+		if(with_writes)
+		{
+			// the values live until hiredis copied them into its output buffer
+			_arena.reset();
+			for(unsigned int i=0 ; i<_writes.size() ; i++)
+			{
+				Write& write = _writes[i];
+				ArenaString value(_arena);
+				value.reserve(write.size + 64);
+				write.encode(value);
+				write.size = value.size();
+				redisAppendCommand(context, "SET %b %b", write.key.data(), write.key.size(),
+					value.data(), value.size());
+			}
+			_n_pending_writes = _writes.size();
+		}
+		for(unsigned int i=0 ; i<_reads.size() ; i++)
+		{
+			redisAppendCommand(context, "GET %b", _reads[i].key.data(), _reads[i].key.size());
+		}
+		if(_n_pending_writes + _reads.size() == 0)
+		{
+			return;
+		}
+
+		// out on the socket now, the replies are read by complete()
+		int done = 0;
+		while(!done)
+		{
+			if(redisBufferWrite(context, &done) != REDIS_OK)
+			{
+				throw std::runtime_error("redis pipeline could not be sent in OverlappedRedisIO::send()\n");
+			}
+		}
+		_f_in_flight = true;
+	}
+
+	RedisClient& _redis_client;
+	CycleArena _arena;
+
+	std::vector<Read> _reads;
+	std::vector<Write> _writes;
+
+	int _n_pending_writes;
+	bool _f_in_flight;
+	unsigned long long _n_exchanges;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_REDIS_OVERLAPPED_REDIS_IO_H_
@@ -0,0 +1,213 @@
+#ifndef UTILS_REDIS_BINARY_EIGEN_H_
+#define UTILS_REDIS_BINARY_EIGEN_H_
+
+// Raw binary encoding of Eigen matrices for the hot robot state keys.
+//
+// Layout of a value (all fields little-endian):
+//   char[4]  magic "EGB1"
+//   uint32   rows
+//   uint32   cols
+//   double   data[rows*cols]  (column major, as stored by Eigen)
+//
+// The decoders fall back to the JSON format of RedisClient when the value
+// does not carry the binary magic, so a reader can be switched to binary
+// before (or independently of) its writer.
+
+#include "redis/RedisClient.h"
+#include <hiredis/hiredis.h>
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace PandaUtils {
+
+const char EIGEN_BINARY_MAGIC[4] = {'E', 'G', 'B', '1'};
+const size_t EIGEN_BINARY_HEADER_SIZE = 4 + 2 * sizeof(uint32_t);
+
+namespace internal {
+
+inline bool hostIsLittleEndian()
+{
+	const uint16_t probe = 1;
+	return *reinterpret_cast<const uint8_t*>(&probe) == 1;
+}
+
+// copy n 8 byte words from src to dst, swapping bytes on big endian hosts
+inline void copyLittleEndian64(void* dst, const void* src, const size_t n)
+{
+	std::memcpy(dst, src, 8 * n);
+	if(!hostIsLittleEndian())
+	{
+		uint8_t* bytes = static_cast<uint8_t*>(dst);
+		for(size_t i=0 ; i<n ; i++)
+		{
+			std::reverse(bytes + 8*i, bytes + 8*i + 8);
+		}
+	}
+}
+
+inline void writeLittleEndian32(char* dst, const uint32_t value)
+{
+	for(int i=0 ; i<4 ; i++)
+	{
+		dst[i] = static_cast<char>((value >> (8*i)) & 0xFF);
+	}
+}
+
+inline uint32_t readLittleEndian32(const char* src)
+{
+	uint32_t value = 0;
+	for(int i=0 ; i<4 ; i++)
+	{
+		value |= static_cast<uint32_t>(static_cast<uint8_t>(src[i])) << (8*i);
+	}
+	return value;
+}
+
+} /* namespace internal */
+
+// true if the buffer holds a binary encoded matrix
+inline bool isEigenMatrixBinary(const char* data, const size_t len)
+{
+	return len >= EIGEN_BINARY_HEADER_SIZE && std::memcmp(data, EIGEN_BINARY_MAGIC, 4) == 0;
+}
+
+inline bool isEigenMatrixBinary(const std::string& str)
+{
+	return isEigenMatrixBinary(str.data(), str.size());
+}
+
+// encode into a preallocated string (reuses its capacity between calls)
+template<typename Derived>
+void encodeEigenMatrixBinary(const Eigen::MatrixBase<Derived>& matrix, std::string& buffer)
+{
+	const uint32_t rows = matrix.rows();
+	const uint32_t cols = matrix.cols();
+	buffer.resize(EIGEN_BINARY_HEADER_SIZE + sizeof(double) * rows * cols);
+	char* dst = &buffer[0];
+	std::memcpy(dst, EIGEN_BINARY_MAGIC, 4);
+	internal::writeLittleEndian32(dst + 4, rows);
+	internal::writeLittleEndian32(dst + 8, cols);
+
+	// evaluate into a plain column major matrix so blocks and expressions are supported
+	const Eigen::Matrix<double, Derived::RowsAtCompileTime, Derived::ColsAtCompileTime,
+		Eigen::ColMajor, Derived::MaxRowsAtCompileTime, Derived::MaxColsAtCompileTime> plain = matrix;
+	internal::copyLittleEndian64(dst + EIGEN_BINARY_HEADER_SIZE, plain.data(), rows * cols);
+}
+
+template<typename Derived>
+std::string encodeEigenMatrixBinary(const Eigen::MatrixBase<Derived>& matrix)
+{
+	std::string buffer;
+	encodeEigenMatrixBinary(matrix, buffer);
+	return buffer;
+}
+
+// decode into an existing matrix or block (e.g. robot->_q or command_torques.head<7>()).
+// fixed size and block targets must have the right size, dynamic matrices are resized.
+template<typename Derived>
+void decodeEigenMatrixBinary(const char* data, const size_t len, const Eigen::MatrixBase<Derived>& output)
+{
+	Eigen::MatrixBase<Derived>& out = const_cast<Eigen::MatrixBase<Derived>&>(output);
+	if(!isEigenMatrixBinary(data, len))
+	{
+		out = RedisClient::decodeEigenMatrixJSON(std::string(data, len));
+		return;
+	}
+
+	const uint32_t rows = internal::readLittleEndian32(data + 4);
+	const uint32_t cols = internal::readLittleEndian32(data + 8);
+	const size_t n = static_cast<size_t>(rows) * cols;
+	if(len != EIGEN_BINARY_HEADER_SIZE + sizeof(double) * n)
+	{
+		throw std::runtime_error("decodeEigenMatrixBinary: size in header does not match payload size\n");
+	}
+	if(out.rows() != rows || out.cols() != cols)
+	{
+		out.derived().resize(rows, cols);
+	}
+
+	const char* payload = data + EIGEN_BINARY_HEADER_SIZE;
+	if(out.derived().innerStride() == 1 && out.derived().outerStride() == out.rows() && !Derived::IsRowMajor)
+	{
+		internal::copyLittleEndian64(out.derived().data(), payload, n);
+	}
+	else
+	{
+		for(uint32_t j=0 ; j<cols ; j++)
+		{
+			for(uint32_t i=0 ; i<rows ; i++)
+			{
+				double value;
+				internal::copyLittleEndian64(&value, payload + sizeof(double) * (j*rows + i), 1);
+				out(i,j) = value;
+			}
+		}
+	}
+}
+
+template<typename Derived>
+void decodeEigenMatrixBinary(const std::string& str, const Eigen::MatrixBase<Derived>& output)
+{
+	decodeEigenMatrixBinary(str.data(), str.size(), output);
+}
+
+inline Eigen::MatrixXd decodeEigenMatrixBinary(const std::string& str)
+{
+	Eigen::MatrixXd matrix;
+	decodeEigenMatrixBinary(str, matrix);
+	return matrix;
+}
+
+// set a key with a binary encoded value. the value is sent with %b so it
+// can contain null bytes, which RedisClient::set does not support.
+template<typename Derived>
+void setEigenMatrixBinary(RedisClient& redis_client, const std::string& key, const Eigen::MatrixBase<Derived>& value)
+{
+	static thread_local std::string buffer;
+	encodeEigenMatrixBinary(value, buffer);
+	redisReply* reply = (redisReply*) redisCommand(redis_client.context_.get(), "SET %b %b",
+			key.data(), key.size(), buffer.data(), buffer.size());
+	if(reply == NULL)
+	{
+		throw std::runtime_error("setEigenMatrixBinary: SET '" + key + "' failed.\n");
+	}
+	freeReplyObject(reply);
+}
+
+// read a key written by setEigenMatrixBinary (or setEigenMatrixJSON) into an existing matrix
+template<typename Derived>
+void getEigenMatrixBinary(RedisClient& redis_client, const std::string& key, const Eigen::MatrixBase<Derived>& output)
+{
+	redisReply* reply = (redisReply*) redisCommand(redis_client.context_.get(), "GET %b", key.data(), key.size());
+	if(reply == NULL || reply->type != REDIS_REPLY_STRING)
+	{
+		if(reply != NULL) freeReplyObject(reply);
+		throw std::runtime_error("getEigenMatrixBinary: GET '" + key + "' failed.\n");
+	}
+	try
+	{
+		decodeEigenMatrixBinary(reply->str, reply->len, output);
+	}
+	catch(...)
+	{
+		freeReplyObject(reply);
+		throw;
+	}
+	freeReplyObject(reply);
+}
+
+inline Eigen::MatrixXd getEigenMatrixBinary(RedisClient& redis_client, const std::string& key)
+{
+	Eigen::MatrixXd matrix;
+	getEigenMatrixBinary(redis_client, key, matrix);
+	return matrix;
+}
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_REDIS_BINARY_EIGEN_H_
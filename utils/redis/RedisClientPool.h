@@ -0,0 +1,72 @@
+#ifndef UTILS_REDIS_CLIENT_POOL_H_
+#define UTILS_REDIS_CLIENT_POOL_H_
+
+// One redis connection per thread.
+//
+// a RedisClient is a single synchronous connection: when several threads
+// of an app share it, a slow command of one thread (a large GET, a log
+// write, a reconnect) stalls the loops of all the others, and concurrent
+// commands on the same context are not safe anyway. the pool hands every
+// thread its own connection, opened the first time the thread asks for it:
+//
+//   PandaUtils::RedisClientPool redis_pool;
+//   ...
+//   void control(...)
+//   {
+//       RedisClient& redis_client = redis_pool.client();
+//       ...
+//   }
+//
+// the returned reference stays valid for the lifetime of the pool, keep it
+// in the thread instead of calling client() in the loop.
+
+#include "redis/RedisClient.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace PandaUtils {
+
+class RedisClientPool {
+public:
+
+	RedisClientPool(const std::string& hostname = "127.0.0.1", const int port = 6379)
+	: _hostname(hostname),
+	  _port(port)
+	{}
+
+	~RedisClientPool(){}
+
+	// connection of the calling thread, connected on the first call from that thread
+	RedisClient& client()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		std::unique_ptr<RedisClient>& entry = _clients[std::this_thread::get_id()];
+		if(!entry)
+		{
+			entry.reset(new RedisClient());
+			entry->connect(_hostname, _port);
+		}
+		return *entry;
+	}
+
+	int size()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _clients.size();
+	}
+
+private:
+	std::string _hostname;
+	int _port;
+
+	std::mutex _mutex;
+	std::map<std::thread::id, std::unique_ptr<RedisClient>> _clients;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_REDIS_CLIENT_POOL_H_
@@ -0,0 +1,185 @@
+#ifndef UTILS_REDIS_JSON_EIGEN_H_
+#define UTILS_REDIS_JSON_EIGEN_H_
+
+// The json format of the Eigen values of RedisClient, encoded into a given buffer and
+// decoded in place, without the temporary strings and matrices of
+// RedisClient::encodeEigenMatrixJSON() and RedisClient::decodeEigenMatrixJSON().
+//
+// a vector is [a,b,c] and a matrix the array of its rows [[a,b],[c,d]], the values are
+// written as std::to_string() does, so the keys read the same to every client. the buffer
+// is any string type, e.g. a PandaUtils::ArenaString on the arena of the cycle
+// (memory/CycleArena.h) :
+//
+//   PandaUtils::ArenaString payload(arena);
+//   PandaUtils::encodeEigenMatrixJSON(command_torques, payload);
+//   ...
+//   PandaUtils::decodeEigenMatrixJSON(reply->str, reply->len, robot->_q);
+//
+// the decoder accepts the whitespace of other writers. a fixed size target must have the
+// size of the value, dynamic ones are resized (without allocation when the size is the same).
+
+#include <Eigen/Dense>
+
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+namespace PandaUtils {
+
+namespace internal {
+
+template<typename String>
+void appendJSONDouble(const double value, String& buffer)
+{
+	// the longest %f of a double
+	char digits[330];
+	const int n = std::snprintf(digits, sizeof(digits), "%f", value);
+	buffer.append(digits, n);
+}
+
+inline const char* skipJSONSpaces(const char* p, const char* end)
+{
+	while(p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+	{
+		p++;
+	}
+	return p;
+}
+
+} /* namespace internal */
+
+// replaces the content of buffer, keeps its capacity
+template<typename Derived, typename String>
+void encodeEigenMatrixJSON(const Eigen::MatrixBase<Derived>& matrix, String& buffer)
+{
+	buffer.clear();
+	buffer.push_back('[');
+	if(matrix.cols() == 1)
+	{
+		for(int i=0 ; i<matrix.rows() ; i++)
+		{
+			if(i > 0) buffer.push_back(',');
+			internal::appendJSONDouble(matrix(i,0), buffer);
+		}
+	}
+	else
+	{
+		for(int i=0 ; i<matrix.rows() ; i++)
+		{
+			if(i > 0) buffer.push_back(',');
+			buffer.push_back('[');
+			for(int j=0 ; j<matrix.cols() ; j++)
+			{
+				if(j > 0) buffer.push_back(',');
+				internal::appendJSONDouble(matrix(i,j), buffer);
+			}
+			buffer.push_back(']');
+		}
+	}
+	buffer.push_back(']');
+}
+
+// decode into an existing matrix or block, as decodeEigenMatrixBinary()
+template<typename Derived>
+void decodeEigenMatrixJSON(const char* data, const size_t len, const Eigen::MatrixBase<Derived>& output)
+{
+	Eigen::MatrixBase<Derived>& out = const_cast<Eigen::MatrixBase<Derived>&>(output);
+	const char* const end = data + len;
+
+	// shape, from the brackets and commas
+	const char* p = internal::skipJSONSpaces(data, end);
+	if(p == end || *p != '[')
+	{
+		throw std::runtime_error("decodeEigenMatrixJSON: value is not a json array\n");
+	}
+	// a closing bracket ends the values, strtod() does not read past it
+	const char* last = end - 1;
+	while(last > p && (*last == ' ' || *last == '\t' || *last == '\n' || *last == '\r'))
+	{
+		last--;
+	}
+	if(*last != ']')
+	{
+		throw std::runtime_error("decodeEigenMatrixJSON: value is not a json array\n");
+	}
+	const char* first = internal::skipJSONSpaces(p + 1, end);
+	const bool nested = first < end && *first == '[';
+	int rows = 0;
+	int cols = 0;
+	int n_values = 0;
+	int depth = 0;
+	bool in_value = false;
+	for(const char* c = p ; c < end ; c++)
+	{
+		if(*c == '[')
+		{
+			depth++;
+			if(nested && depth == 2)
+			{
+				rows++;
+			}
+		}
+		else if(*c == ']' || *c == ',')
+		{
+			if(in_value)
+			{
+				n_values++;
+				in_value = false;
+			}
+			if(*c == ']')
+			{
+				depth--;
+			}
+		}
+		else if(*c != ' ' && *c != '\t' && *c != '\n' && *c != '\r')
+		{
+			in_value = true;
+		}
+	}
+	if(nested)
+	{
+		cols = rows > 0 ? n_values / rows : 0;
+		if(rows * cols != n_values)
+		{
+			throw std::runtime_error("decodeEigenMatrixJSON: rows of different sizes\n");
+		}
+	}
+	else
+	{
+		rows = n_values;
+		cols = 1;
+	}
+	if(out.rows() != rows || out.cols() != cols)
+	{
+		if(Derived::SizeAtCompileTime != Eigen::Dynamic)
+		{
+			throw std::runtime_error("decodeEigenMatrixJSON: size of the value does not match the size of the target\n");
+		}
+		out.derived().resize(rows, cols);
+	}
+
+	// values, row by row
+	int k = 0;
+	for(const char* c = p ; c < end && k < n_values ; )
+	{
+		if(*c == '[' || *c == ']' || *c == ',' || *c == ' ' || *c == '\t' || *c == '\n' || *c == '\r')
+		{
+			c++;
+			continue;
+		}
+		char* value_end;
+		const double value = std::strtod(c, &value_end);
+		if(value_end == c)
+		{
+			throw std::runtime_error("decodeEigenMatrixJSON: value is not a number\n");
+		}
+		out(k / cols, k % cols) = value;
+		k++;
+		c = value_end;
+	}
+}
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_REDIS_JSON_EIGEN_H_
@@ -0,0 +1,235 @@
+#ifndef UTILS_REDIS_LATENCY_STATS_H_
+#define UTILS_REDIS_LATENCY_STATS_H_
+
+// Per-key latency histograms for the redis accesses of a control loop.
+//
+// recording is lock-free (relaxed atomic increments), so a histogram can be
+// filled from the control thread while another thread publishes it.
+// histograms are registered once, at setup time, and the control loop only
+// keeps a reference:
+//
+//   PandaUtils::RedisLatencyStats redis_stats;
+//   auto& q_latency = redis_stats.histogram("get " + JOINT_ANGLES_KEY);
+//   ...
+//   {
+//       PandaUtils::ScopedLatency measure(q_latency);
+//       robot->_q = redis_client.getEigenMatrixJSON(JOINT_ANGLES_KEY);
+//   }
+//   ...
+//   redis_stats.publish(redis_client, LATENCY_STATS_KEY);  // every few seconds
+//   redis_stats.print(std::cout);                          // on shutdown
+
+#include "redis/RedisClient.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+namespace PandaUtils {
+
+// fixed bucket histogram of durations in nanoseconds.
+// 1 us buckets up to 2 ms, 100 us buckets up to 102 ms, then one overflow bucket.
+class LatencyHistogram {
+public:
+
+	static const int N_FINE_BUCKETS = 2000;
+	static const int N_COARSE_BUCKETS = 1000;
+	static const int N_BUCKETS = N_FINE_BUCKETS + N_COARSE_BUCKETS + 1;
+	static const uint64_t FINE_BUCKET_NS = 1000;
+	static const uint64_t COARSE_BUCKET_NS = 100000;
+
+	LatencyHistogram()
+	{
+		reset();
+	}
+
+	void record(const uint64_t duration_ns)
+	{
+		_buckets[bucketIndex(duration_ns)].fetch_add(1, std::memory_order_relaxed);
+		_count.fetch_add(1, std::memory_order_relaxed);
+		_sum_ns.fetch_add(duration_ns, std::memory_order_relaxed);
+		uint64_t current_max = _max_ns.load(std::memory_order_relaxed);
+		while(duration_ns > current_max &&
+			!_max_ns.compare_exchange_weak(current_max, duration_ns, std::memory_order_relaxed)) {}
+	}
+
+	void reset()
+	{
+		for(int i=0 ; i<N_BUCKETS ; i++)
+		{
+			_buckets[i].store(0, std::memory_order_relaxed);
+		}
+		_count.store(0, std::memory_order_relaxed);
+		_sum_ns.store(0, std::memory_order_relaxed);
+		_max_ns.store(0, std::memory_order_relaxed);
+	}
+
+	uint64_t count() const { return _count.load(std::memory_order_relaxed); }
+	double maxMicroseconds() const { return _max_ns.load(std::memory_order_relaxed) * 1e-3; }
+	double meanMicroseconds() const
+	{
+		const uint64_t n = count();
+		return n == 0 ? 0.0 : _sum_ns.load(std::memory_order_relaxed) * 1e-3 / n;
+	}
+
+	// upper edge of the bucket containing the requested percentile (0-100), in microseconds
+	double percentileMicroseconds(const double percentile) const
+	{
+		const uint64_t n = count();
+		if(n == 0)
+		{
+			return 0.0;
+		}
+		const uint64_t target = std::max<uint64_t>(1, (uint64_t) (percentile / 100.0 * n + 0.5));
+		uint64_t cumulative = 0;
+		for(int i=0 ; i<N_BUCKETS ; i++)
+		{
+			cumulative += _buckets[i].load(std::memory_order_relaxed);
+			if(cumulative >= target)
+			{
+				return std::min(bucketUpperEdgeNs(i) * 1e-3, maxMicroseconds());
+			}
+		}
+		return maxMicroseconds();
+	}
+
+private:
+
+	static int bucketIndex(const uint64_t duration_ns)
+	{
+		if(duration_ns < N_FINE_BUCKETS * FINE_BUCKET_NS)
+		{
+			return duration_ns / FINE_BUCKET_NS;
+		}
+		const uint64_t coarse = (duration_ns - N_FINE_BUCKETS * FINE_BUCKET_NS) / COARSE_BUCKET_NS;
+		if(coarse < (uint64_t) N_COARSE_BUCKETS)
+		{
+			return N_FINE_BUCKETS + coarse;
+		}
+		return N_BUCKETS - 1;
+	}
+
+	static double bucketUpperEdgeNs(const int i)
+	{
+		if(i < N_FINE_BUCKETS)
+		{
+			return (i + 1) * FINE_BUCKET_NS;
+		}
+		return N_FINE_BUCKETS * FINE_BUCKET_NS + (i - N_FINE_BUCKETS + 1) * COARSE_BUCKET_NS;
+	}
+
+	std::atomic<uint64_t> _buckets[N_BUCKETS];
+	std::atomic<uint64_t> _count;
+	std::atomic<uint64_t> _sum_ns;
+	std::atomic<uint64_t> _max_ns;
+};
+
+// records the lifetime of the object in a histogram
+class ScopedLatency {
+public:
+	ScopedLatency(LatencyHistogram& histogram)
+	: _histogram(histogram), _start(std::chrono::steady_clock::now())
+	{}
+
+	~ScopedLatency()
+	{
+		const auto elapsed = std::chrono::steady_clock::now() - _start;
+		_histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+	}
+
+private:
+	LatencyHistogram& _histogram;
+	std::chrono::steady_clock::time_point _start;
+};
+
+// named collection of histograms, one per key and operation
+class RedisLatencyStats {
+public:
+
+	RedisLatencyStats(){}
+	~RedisLatencyStats(){}
+
+	// get or create the histogram for a name. the reference stays valid for the lifetime of the object.
+	// takes a lock, so call it at setup and keep the reference in the control loop.
+	LatencyHistogram& histogram(const std::string& name)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		std::unique_ptr<LatencyHistogram>& entry = _histograms[name];
+		if(!entry)
+		{
+			entry.reset(new LatencyHistogram());
+		}
+		return *entry;
+	}
+
+	// one json object per histogram: {"name": {"n":..., "mean_us":..., "p50_us":..., "p99_us":..., "max_us":...}, ...}
+	std::string toJSON()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(1) << "{";
+		bool first = true;
+		for(auto it = _histograms.begin() ; it != _histograms.end() ; ++it)
+		{
+			const LatencyHistogram& h = *it->second;
+			ss << (first ? "" : ", ") << "\"" << it->first << "\": {"
+				<< "\"n\": " << h.count()
+				<< ", \"mean_us\": " << h.meanMicroseconds()
+				<< ", \"p50_us\": " << h.percentileMicroseconds(50)
+				<< ", \"p99_us\": " << h.percentileMicroseconds(99)
+				<< ", \"max_us\": " << h.maxMicroseconds() << "}";
+			first = false;
+		}
+		ss << "}";
+		return ss.str();
+	}
+
+	// write the summary to a stats key
+	void publish(RedisClient& redis_client, const std::string& stats_key)
+	{
+		redis_client.set(stats_key, toJSON());
+	}
+
+	void print(std::ostream& os)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		os << "redis latency (us)" << std::setw(44) << "n" << std::setw(10) << "mean"
+			<< std::setw(10) << "p50" << std::setw(10) << "p99" << std::setw(10) << "max" << "\n";
+		os << std::fixed << std::setprecision(1);
+		for(auto it = _histograms.begin() ; it != _histograms.end() ; ++it)
+		{
+			const LatencyHistogram& h = *it->second;
+			os << std::left << std::setw(50) << it->first << std::right
+				<< std::setw(12) << h.count()
+				<< std::setw(10) << h.meanMicroseconds()
+				<< std::setw(10) << h.percentileMicroseconds(50)
+				<< std::setw(10) << h.percentileMicroseconds(99)
+				<< std::setw(10) << h.maxMicroseconds() << "\n";
+		}
+	}
+
+	void reset()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		for(auto it = _histograms.begin() ; it != _histograms.end() ; ++it)
+		{
+			it->second->reset();
+		}
+	}
+
+private:
+	std::mutex _mutex;
+	std::map<std::string, std::unique_ptr<LatencyHistogram>> _histograms;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_REDIS_LATENCY_STATS_H_
@@ -0,0 +1,232 @@
+#ifndef UTILS_REDIS_MONITOR_H_
+#define UTILS_REDIS_MONITOR_H_
+
+// Every key written on a redis server, by any client, with the time of the server.
+//
+// the monitor has its own connection in MONITOR mode : the server sends it a line for each
+// command it executes, with the arguments, so the values of SET and MSET come with the update
+// itself (a keyspace notification, as in RedisParameterCache, only says that the key changed,
+// and the value read afterwards can already be the next one). only the keys that start with
+// one of the prefixes are kept :
+//
+//   PandaUtils::RedisMonitor monitor({"sai2::PandaApplication::", "sai2::FrankaPanda::"});
+//   if(!monitor.connect()) { ... monitor.error() ... }
+//   std::vector<PandaUtils::RedisKeyUpdate> updates;
+//   while(runloop && monitor.read(updates)) {
+//       for(const auto& update : updates) { ... update.time, update.key, update.value ... }
+//   }
+//
+// read() blocks until the server runs the next command, any command of any client. the
+// monitored server executes the commands a bit slower (it formats them for the monitor),
+// not the clients : the controllers do not see it besides that.
+
+#include <hiredis/hiredis.h>
+
+#include <cctype>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+struct RedisKeyUpdate {
+	// unix time of the server, in seconds
+	double time;
+	std::string key;
+	std::string value;
+};
+
+class RedisMonitor {
+public:
+
+	// empty prefixes for every key
+	RedisMonitor(const std::vector<std::string>& prefixes = std::vector<std::string>())
+	: _prefixes(prefixes),
+	  _context(NULL)
+	{}
+
+	~RedisMonitor()
+	{
+		disconnect();
+	}
+
+	bool connect(const std::string& hostname = "127.0.0.1", const int port = 6379)
+	{
+		disconnect();
+		_context = redisConnect(hostname.c_str(), port);
+		if(_context == NULL || _context->err)
+		{
+			_error = "could not connect to redis at " + hostname + ":" + std::to_string(port);
+			disconnect();
+			return false;
+		}
+		redisReply* reply = (redisReply*) redisCommand(_context, "MONITOR");
+		if(reply == NULL || reply->type != REDIS_REPLY_STATUS)
+		{
+			_error = "redis refused MONITOR";
+			if(reply != NULL)
+			{
+				freeReplyObject(reply);
+			}
+			disconnect();
+			return false;
+		}
+		freeReplyObject(reply);
+		return true;
+	}
+
+	void disconnect()
+	{
+		if(_context != NULL)
+		{
+			redisFree(_context);
+			_context = NULL;
+		}
+	}
+
+	// the updates of the next command executed by the server (none if it is not a SET or MSET
+	// of a monitored key). false when the connection is lost
+	bool read(std::vector<RedisKeyUpdate>& updates)
+	{
+		updates.clear();
+		if(_context == NULL)
+		{
+			return false;
+		}
+		redisReply* reply = NULL;
+		if(redisGetReply(_context, (void**) &reply) != REDIS_OK || reply == NULL)
+		{
+			_error = "lost the connection to redis";
+			disconnect();
+			return false;
+		}
+		if(reply->type == REDIS_REPLY_STATUS)
+		{
+			parseLine(std::string(reply->str, reply->len), updates);
+		}
+		freeReplyObject(reply);
+		return true;
+	}
+
+	const std::string& error() const { return _error; }
+
+	// a line of the monitor : 1339518083.107412 [0 127.0.0.1:60866] "set" "key" "value".
+	// false if it is not a command line
+	static bool parseMonitorLine(const std::string& line, double& time, std::vector<std::string>& arguments)
+	{
+		arguments.clear();
+		char* end = NULL;
+		time = strtod(line.c_str(), &end);
+		if(end == line.c_str())
+		{
+			return false;
+		}
+		size_t position = line.find(']', end - line.c_str());
+		if(position == std::string::npos)
+		{
+			return false;
+		}
+		position++;
+		while(position < line.size())
+		{
+			if(line[position] != '"')
+			{
+				position++;
+				continue;
+			}
+			position++;
+			std::string argument;
+			while(position < line.size() && line[position] != '"')
+			{
+				char c = line[position++];
+				if(c == '\\' && position < line.size())
+				{
+					c = line[position++];
+					switch(c)
+					{
+						case 'n': c = '\n'; break;
+						case 'r': c = '\r'; break;
+						case 't': c = '\t'; break;
+						case 'a': c = '\a'; break;
+						case 'b': c = '\b'; break;
+						case 'x':
+							if(position + 2 <= line.size())
+							{
+								c = (char) strtol(line.substr(position, 2).c_str(), NULL, 16);
+								position += 2;
+							}
+							break;
+						default: break;
+					}
+				}
+				argument.push_back(c);
+			}
+			position++;
+			arguments.push_back(argument);
+		}
+		return !arguments.empty();
+	}
+
+private:
+
+	bool monitored(const std::string& key) const
+	{
+		if(_prefixes.empty())
+		{
+			return true;
+		}
+		for(const std::string& prefix : _prefixes)
+		{
+			if(key.compare(0, prefix.size(), prefix) == 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void parseLine(const std::string& line, std::vector<RedisKeyUpdate>& updates)
+	{
+		double time;
+		if(!parseMonitorLine(line, time, _arguments))
+		{
+			return;
+		}
+		std::string& command = _arguments[0];
+		for(char& c : command)
+		{
+			c = std::tolower(c);
+		}
+		// SET key value [options], MSET key value key value ...
+		const unsigned int stride = 2;
+		unsigned int last = 0;
+		if(command == "set" && _arguments.size() >= 3)
+		{
+			last = 2;
+		}
+		else if(command == "mset")
+		{
+			last = _arguments.size() - 1;
+		}
+		for(unsigned int i=1 ; i+1<=last ; i+=stride)
+		{
+			if(monitored(_arguments[i]))
+			{
+				RedisKeyUpdate update;
+				update.time = time;
+				update.key = _arguments[i];
+				update.value = _arguments[i+1];
+				updates.push_back(update);
+			}
+		}
+	}
+
+	const std::vector<std::string> _prefixes;
+	redisContext* _context;
+	std::vector<std::string> _arguments;
+	std::string _error;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_REDIS_MONITOR_H_
@@ -0,0 +1,266 @@
+#ifndef UTILS_REDIS_PARAMETER_CACHE_H_
+#define UTILS_REDIS_PARAMETER_CACHE_H_
+
+// Cache for slowly changing parameter keys (gripper commands, modes, ...)
+// that a loop would otherwise GET on every tick.
+//
+// a background thread subscribes to the redis keyspace notifications of
+// the registered keys on its own connection and marks a key dirty when it
+// is written, by any client. update() only goes to redis for dirty keys,
+// so in steady state a loop iteration costs a few atomic loads and no
+// round trip.
+//
+// the keyspace notifications for string commands are enabled on the
+// server on start(). if the subscription cannot be set up, the cache
+// falls back to reading every key on every update().
+//
+//   PandaUtils::RedisParameterCache gripper_parameters(redis_client);
+//   gripper_parameters.addDouble(GRIPPER_DESIRED_WIDTH_KEY, gripper_desired_width);
+//   gripper_parameters.addString(GRIPPER_MODE_KEY, gripper_mode);
+//   gripper_parameters.start();
+//   while(...) {
+//       gripper_parameters.update();
+//       ...
+//   }
+//   gripper_parameters.stop();
+
+#include "redis/RedisClient.h"
+#include <hiredis/hiredis.h>
+
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace PandaUtils {
+
+class RedisParameterCache {
+public:
+
+	RedisParameterCache(RedisClient& redis_client,
+			const std::string& hostname = "127.0.0.1", const int port = 6379, const int database = 0)
+	: _redis_client(redis_client),
+	  _hostname(hostname),
+	  _port(port),
+	  _database(database),
+	  _subscribed(false),
+	  _running(false),
+	  _subscriber_context(NULL)
+	{}
+
+	~RedisParameterCache()
+	{
+		stop();
+	}
+
+	// the referenced variables are written by update() only
+	void addDouble(const std::string& key, double& value)
+	{
+		Entry entry;
+		entry.key = key;
+		entry.double_value = &value;
+		entry.string_value = NULL;
+		_entries.push_back(entry);
+	}
+
+	void addString(const std::string& key, std::string& value)
+	{
+		Entry entry;
+		entry.key = key;
+		entry.double_value = NULL;
+		entry.string_value = &value;
+		_entries.push_back(entry);
+	}
+
+	// read all the keys once and start listening for changes
+	void start()
+	{
+		_dirty.reset(new std::atomic<bool>[_entries.size()]);
+		for(unsigned int i=0 ; i<_entries.size() ; i++)
+		{
+			_dirty[i].store(false);
+			readEntry(i);
+		}
+
+		_subscribed = subscribe();
+		if(!_subscribed)
+		{
+			std::cout << "WARNING : RedisParameterCache could not subscribe to keyspace notifications, polling the keys on every update\n" << std::endl;
+			return;
+		}
+		_running = true;
+		_subscriber_thread = std::thread(&RedisParameterCache::subscriberWorker, this);
+
+		// values written between the first read and the subscription
+		invalidate();
+	}
+
+	void stop()
+	{
+		if(_running)
+		{
+			_running = false;
+			// wake up the subscriber, it is blocked waiting for the next notification
+			redisReply* reply = (redisReply*) redisCommand(_redis_client.context_.get(), "PUBLISH %s %s", wakeChannel().c_str(), "stop");
+			if(reply != NULL) freeReplyObject(reply);
+			_subscriber_thread.join();
+		}
+		if(_subscriber_context != NULL)
+		{
+			redisFree(_subscriber_context);
+			_subscriber_context = NULL;
+		}
+	}
+
+	// re-read the keys that changed since the last call. returns true if any value was refreshed.
+	bool update()
+	{
+		bool refreshed = false;
+		for(unsigned int i=0 ; i<_entries.size() ; i++)
+		{
+			if(!_subscribed || _dirty[i].exchange(false, std::memory_order_acquire))
+			{
+				readEntry(i);
+				refreshed = true;
+			}
+		}
+		return refreshed;
+	}
+
+	// force a refresh of every key on the next update()
+	void invalidate()
+	{
+		if(!_dirty)
+		{
+			return;
+		}
+		for(unsigned int i=0 ; i<_entries.size() ; i++)
+		{
+			_dirty[i].store(true, std::memory_order_release);
+		}
+	}
+
+private:
+
+	struct Entry {
+		std::string key;
+		double* double_value;
+		std::string* string_value;
+	};
+
+	std::string keyspaceChannel(const std::string& key) const
+	{
+		return "__keyspace@" + std::to_string(_database) + "__:" + key;
+	}
+
+	std::string wakeChannel() const
+	{
+		return "sai2::utils::parameter_cache::wake::" + std::to_string(reinterpret_cast<unsigned long>(this));
+	}
+
+	void readEntry(const unsigned int i)
+	{
+		const std::string value = _redis_client.get(_entries[i].key);
+		if(_entries[i].double_value != NULL)
+		{
+			*_entries[i].double_value = std::stod(value);
+		}
+		else
+		{
+			*_entries[i].string_value = value;
+		}
+	}
+
+	bool subscribe()
+	{
+		// enable keyspace events for string commands, keeping the flags already set on the server
+		redisReply* reply = (redisReply*) redisCommand(_redis_client.context_.get(), "CONFIG GET notify-keyspace-events");
+		std::string flags;
+		if(reply != NULL && reply->type == REDIS_REPLY_ARRAY && reply->elements == 2)
+		{
+			flags = std::string(reply->element[1]->str, reply->element[1]->len);
+		}
+		if(reply != NULL) freeReplyObject(reply);
+		if(flags.find('K') == std::string::npos) flags += "K";
+		if(flags.find('$') == std::string::npos && flags.find('A') == std::string::npos) flags += "$";
+		reply = (redisReply*) redisCommand(_redis_client.context_.get(), "CONFIG SET notify-keyspace-events %s", flags.c_str());
+		if(reply == NULL || reply->type == REDIS_REPLY_ERROR)
+		{
+			if(reply != NULL) freeReplyObject(reply);
+			return false;
+		}
+		freeReplyObject(reply);
+
+		_subscriber_context = redisConnect(_hostname.c_str(), _port);
+		if(_subscriber_context == NULL || _subscriber_context->err)
+		{
+			return false;
+		}
+
+		// a SUBSCRIBE reply per channel, the wake channel last
+		_channel_to_entry.clear();
+		for(unsigned int i=0 ; i<_entries.size() ; i++)
+		{
+			_channel_to_entry[keyspaceChannel(_entries[i].key)] = i;
+			redisAppendCommand(_subscriber_context, "SUBSCRIBE %s", keyspaceChannel(_entries[i].key).c_str());
+		}
+		redisAppendCommand(_subscriber_context, "SUBSCRIBE %s", wakeChannel().c_str());
+		for(unsigned int i=0 ; i<_entries.size() + 1 ; i++)
+		{
+			void* ack;
+			if(redisGetReply(_subscriber_context, &ack) != REDIS_OK)
+			{
+				return false;
+			}
+			freeReplyObject(ack);
+		}
+		return true;
+	}
+
+	void subscriberWorker()
+	{
+		while(_running)
+		{
+			void* message;
+			if(redisGetReply(_subscriber_context, &message) != REDIS_OK)
+			{
+				// connection lost, fall back to polling
+				std::cout << "WARNING : RedisParameterCache lost its subscription, polling the keys on every update\n" << std::endl;
+				_subscribed = false;
+				return;
+			}
+			redisReply* reply = (redisReply*) message;
+			if(reply->type == REDIS_REPLY_ARRAY && reply->elements == 3)
+			{
+				const std::string channel(reply->element[1]->str, reply->element[1]->len);
+				auto it = _channel_to_entry.find(channel);
+				if(it != _channel_to_entry.end())
+				{
+					_dirty[it->second].store(true, std::memory_order_release);
+				}
+			}
+			freeReplyObject(reply);
+		}
+	}
+
+	RedisClient& _redis_client;
+	std::string _hostname;
+	int _port;
+	int _database;
+
+	std::vector<Entry> _entries;
+	std::unique_ptr<std::atomic<bool>[]> _dirty;
+	std::map<std::string, unsigned int> _channel_to_entry;
+
+	std::atomic<bool> _subscribed;
+	std::atomic<bool> _running;
+	redisContext* _subscriber_context;
+	std::thread _subscriber_thread;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_REDIS_PARAMETER_CACHE_H_
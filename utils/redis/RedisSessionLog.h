@@ -0,0 +1,211 @@
+#ifndef UTILS_REDIS_SESSION_LOG_H_
+#define UTILS_REDIS_SESSION_LOG_H_
+
+// Binary log of the key updates of a redis session (from a RedisMonitor), for the
+// redis_session record / replay / diff tool.
+//
+// format, in the byte order of the machine :
+//   "SAI2RSES" magic, uint32 version, uint32 reserved, double unix time of the start (s)
+//   then the entries, each one starting with a uint8 type :
+//     0, a key : uint32 key id, uint32 length, name. before the first update of the key
+//     1, an update : double time from the start (s), uint32 key id, uint32 length, value
+// a key name is written once, an update costs 17 bytes and its value.
+//
+//   PandaUtils::RedisSessionWriter writer;
+//   writer.open("session.rses", start_time);
+//   writer.write(update.time - start_time, update.key, update.value);
+//
+//   PandaUtils::RedisSessionReader reader;
+//   reader.open("session.rses");
+//   PandaUtils::RedisSessionReader::Update update;
+//   while(reader.next(update)) { ... update.time, reader.key(update.key_id), update.value ... }
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+static const char REDIS_SESSION_MAGIC[8] = {'S','A','I','2','R','S','E','S'};
+static const uint32_t REDIS_SESSION_VERSION = 1;
+static const uint8_t REDIS_SESSION_KEY = 0;
+static const uint8_t REDIS_SESSION_UPDATE = 1;
+
+class RedisSessionWriter {
+public:
+
+	RedisSessionWriter()
+	: _n_updates(0)
+	{}
+
+	bool open(const std::string& fname, const double start_time)
+	{
+		_file.open(fname, std::ios::out | std::ios::binary | std::ios::trunc);
+		if(!_file)
+		{
+			return false;
+		}
+		const uint32_t reserved = 0;
+		_file.write(REDIS_SESSION_MAGIC, sizeof(REDIS_SESSION_MAGIC));
+		_file.write(reinterpret_cast<const char*>(&REDIS_SESSION_VERSION), sizeof(uint32_t));
+		_file.write(reinterpret_cast<const char*>(&reserved), sizeof(uint32_t));
+		_file.write(reinterpret_cast<const char*>(&start_time), sizeof(double));
+		_key_ids.clear();
+		_n_updates = 0;
+		return bool(_file);
+	}
+
+	// time from the start, in seconds
+	void write(const double time, const std::string& key, const std::string& value)
+	{
+		std::map<std::string, uint32_t>::const_iterator it = _key_ids.find(key);
+		uint32_t key_id;
+		if(it == _key_ids.end())
+		{
+			key_id = _key_ids.size();
+			_key_ids[key] = key_id;
+			_file.put(REDIS_SESSION_KEY);
+			writeString(key_id, key);
+		}
+		else
+		{
+			key_id = it->second;
+		}
+		_file.put(REDIS_SESSION_UPDATE);
+		_file.write(reinterpret_cast<const char*>(&time), sizeof(double));
+		writeString(key_id, value);
+		_n_updates++;
+	}
+
+	void close()
+	{
+		_file.close();
+	}
+
+	unsigned long long numUpdates() const { return _n_updates; }
+	int numKeys() const { return _key_ids.size(); }
+
+private:
+
+	void writeString(const uint32_t key_id, const std::string& data)
+	{
+		const uint32_t length = data.size();
+		_file.write(reinterpret_cast<const char*>(&key_id), sizeof(uint32_t));
+		_file.write(reinterpret_cast<const char*>(&length), sizeof(uint32_t));
+		_file.write(data.data(), length);
+	}
+
+	std::ofstream _file;
+	std::map<std::string, uint32_t> _key_ids;
+	unsigned long long _n_updates;
+};
+
+class RedisSessionReader {
+public:
+
+	struct Update {
+		// from the start of the session, in seconds
+		double time;
+		uint32_t key_id;
+		std::string value;
+	};
+
+	RedisSessionReader()
+	: _start_time(0)
+	{}
+
+	bool open(const std::string& fname)
+	{
+		_keys.clear();
+		_file.open(fname, std::ios::in | std::ios::binary);
+		if(!_file)
+		{
+			_error = "could not open " + fname;
+			return false;
+		}
+		char magic[8];
+		uint32_t version, reserved;
+		_file.read(magic, sizeof(magic));
+		_file.read(reinterpret_cast<char*>(&version), sizeof(uint32_t));
+		_file.read(reinterpret_cast<char*>(&reserved), sizeof(uint32_t));
+		_file.read(reinterpret_cast<char*>(&_start_time), sizeof(double));
+		if(!_file || memcmp(magic, REDIS_SESSION_MAGIC, sizeof(magic)) != 0)
+		{
+			_error = fname + " is not a redis session log";
+			return false;
+		}
+		if(version != REDIS_SESSION_VERSION)
+		{
+			_error = "unsupported redis session version " + std::to_string(version);
+			return false;
+		}
+		return true;
+	}
+
+	// next update, false at the end. a truncated last entry (recorder killed) is ignored
+	bool next(Update& update)
+	{
+		while(true)
+		{
+			const int type = _file.get();
+			if(type == REDIS_SESSION_KEY)
+			{
+				uint32_t key_id;
+				std::string name;
+				if(!readString(key_id, name) || key_id != _keys.size())
+				{
+					return false;
+				}
+				_keys.push_back(name);
+			}
+			else if(type == REDIS_SESSION_UPDATE)
+			{
+				_file.read(reinterpret_cast<char*>(&update.time), sizeof(double));
+				if(!_file || !readString(update.key_id, update.value) || update.key_id >= _keys.size())
+				{
+					return false;
+				}
+				return true;
+			}
+			else
+			{
+				return false;
+			}
+		}
+	}
+
+	// the keys seen so far
+	const std::string& key(const uint32_t key_id) const { return _keys[key_id]; }
+	int numKeys() const { return _keys.size(); }
+	// unix time, in seconds
+	double startTime() const { return _start_time; }
+	const std::string& error() const { return _error; }
+
+private:
+
+	bool readString(uint32_t& key_id, std::string& data)
+	{
+		uint32_t length;
+		_file.read(reinterpret_cast<char*>(&key_id), sizeof(uint32_t));
+		_file.read(reinterpret_cast<char*>(&length), sizeof(uint32_t));
+		if(!_file)
+		{
+			return false;
+		}
+		data.resize(length);
+		_file.read(&data[0], length);
+		return bool(_file);
+	}
+
+	std::ifstream _file;
+	std::vector<std::string> _keys;
+	double _start_time;
+	std::string _error;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_REDIS_SESSION_LOG_H_
@@ -0,0 +1,157 @@
+#ifndef UTILS_REDIS_ROBOT_STATE_BUNDLE_H_
+#define UTILS_REDIS_ROBOT_STATE_BUNDLE_H_
+
+// Reads the full state of a real robot (q, dq, mass matrix, coriolis,
+// gravity and any extra gains) in a single pipelined exchange, using the
+// read callbacks of RedisClient. The joint state and mass matrix are
+// unpacked directly into the robot model.
+//
+// typical use in the !flag_simulation branch of a controller:
+//
+//   PandaUtils::RobotStateBundle state_bundle(redis_client, robot);
+//   state_bundle.setJointKeys(JOINT_ANGLES_KEY, JOINT_VELOCITIES_KEY);
+//   state_bundle.setModelKeys(MASSMATRIX_KEY, CORIOLIS_KEY, ROBOT_GRAVITY_KEY);
+//   state_bundle.addDouble(KP_KEY, joint_task->_kp);
+//   state_bundle.initialize();
+//   ...
+//   state_bundle.read();   // once per control cycle
+
+#include "Sai2Model.h"
+#include "redis/RedisClient.h"
+#include <Eigen/Dense>
+
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+class RobotStateBundle {
+public:
+
+	RobotStateBundle(RedisClient& redis_client, Sai2Model::Sai2Model* robot, const int callback_number = 0)
+	: _redis_client(redis_client),
+	  _robot(robot),
+	  _callback_number(callback_number),
+	  _initialized(false)
+	{
+		_coriolis.setZero(robot->dof());
+		_gravity.setZero(robot->dof());
+	}
+
+	~RobotStateBundle(){}
+
+	void setJointKeys(const std::string& q_key, const std::string& dq_key)
+	{
+		checkNotInitialized();
+		_q_key = q_key;
+		_dq_key = dq_key;
+	}
+
+	// empty keys are not read
+	void setModelKeys(const std::string& massmatrix_key, const std::string& coriolis_key = "", const std::string& gravity_key = "")
+	{
+		checkNotInitialized();
+		_massmatrix_key = massmatrix_key;
+		_coriolis_key = coriolis_key;
+		_gravity_key = gravity_key;
+	}
+
+	// extra values read in the same exchange (e.g. gains). the references must outlive the bundle.
+	void addDouble(const std::string& key, double& value)
+	{
+		checkNotInitialized();
+		_extra_registrations.push_back([key, &value](RedisClient& client, const int n) {
+			client.addDoubleToReadCallback(n, key, value);
+		});
+	}
+
+	void addInt(const std::string& key, int& value)
+	{
+		checkNotInitialized();
+		_extra_registrations.push_back([key, &value](RedisClient& client, const int n) {
+			client.addIntToReadCallback(n, key, value);
+		});
+	}
+
+	template<typename Derived>
+	void addEigen(const std::string& key, Eigen::MatrixBase<Derived>& value)
+	{
+		checkNotInitialized();
+		_extra_registrations.push_back([key, &value](RedisClient& client, const int n) {
+			client.addEigenToReadCallback(n, key, value);
+		});
+	}
+
+	// register all the keys in the read callback. must be called once before read()
+	void initialize()
+	{
+		checkNotInitialized();
+		if(_q_key.empty() || _dq_key.empty())
+		{
+			throw std::invalid_argument("joint keys not set in RobotStateBundle::initialize()\n");
+		}
+
+		_redis_client.createReadCallback(_callback_number);
+		_redis_client.addEigenToReadCallback(_callback_number, _q_key, _robot->_q);
+		_redis_client.addEigenToReadCallback(_callback_number, _dq_key, _robot->_dq);
+		if(!_massmatrix_key.empty())
+		{
+			_redis_client.addEigenToReadCallback(_callback_number, _massmatrix_key, _robot->_M);
+		}
+		if(!_coriolis_key.empty())
+		{
+			_redis_client.addEigenToReadCallback(_callback_number, _coriolis_key, _coriolis);
+		}
+		if(!_gravity_key.empty())
+		{
+			_redis_client.addEigenToReadCallback(_callback_number, _gravity_key, _gravity);
+		}
+		for(unsigned int i=0 ; i<_extra_registrations.size() ; i++)
+		{
+			_extra_registrations[i](_redis_client, _callback_number);
+		}
+
+		_initialized = true;
+	}
+
+	// one pipelined round trip for the whole robot state
+	void read()
+	{
+		if(!_initialized)
+		{
+			throw std::runtime_error("RobotStateBundle::read() called before initialize()\n");
+		}
+		_redis_client.executeReadCallback(_callback_number);
+	}
+
+	// coriolis and gravity torques as sent by the robot driver
+	Eigen::VectorXd _coriolis;
+	Eigen::VectorXd _gravity;
+
+private:
+
+	void checkNotInitialized()
+	{
+		if(_initialized)
+		{
+			throw std::logic_error("RobotStateBundle cannot be modified after initialize()\n");
+		}
+	}
+
+	RedisClient& _redis_client;
+	Sai2Model::Sai2Model* _robot;
+	int _callback_number;
+	bool _initialized;
+
+	std::string _q_key, _dq_key;
+	std::string _massmatrix_key, _coriolis_key, _gravity_key;
+
+	// registrations of the extra values, applied in initialize()
+	std::vector<std::function<void(RedisClient&, const int)>> _extra_registrations;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_REDIS_ROBOT_STATE_BUNDLE_H_
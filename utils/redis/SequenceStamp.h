@@ -0,0 +1,245 @@
+#ifndef UTILS_REDIS_SEQUENCE_STAMP_H_
+#define UTILS_REDIS_SEQUENCE_STAMP_H_
+
+// Sensor to torque latency of a control loop, from sequence numbers echoed by the controller.
+//
+// the side that publishes the robot state (the simviz, or the driver) stamps every state
+// with a sequence number and its time. the controller reads the stamp with the state,
+// and publishes with its torques an echo of the stamp, with the times at which it read
+// the state and wrote the torques. when the state side reads the torques, it gets the
+// latencies of the loop from the echo :
+//
+//   // simviz                                               // controller
+//   PandaUtils::SequenceStamper stamper;                    PandaUtils::SequenceEcho sequence;
+//   while(fSimulationRunning)                               while(runloop)
+//   {                                                       {
+//       command_torques = redis_client.get...(TORQUES);         sequence.stateRead(redis_client
+//       stamper.receiveEcho(redis_client                                .getEigenMatrixJSON(SEQUENCE_KEY));
+//               .getEigenMatrixJSON(SEQUENCE_ECHO_KEY));        robot->_q = redis_client.get...(Q);
+//       sim->integrate(loop_dt);                                ...
+//       redis_client.set...(Q, robot->_q);                      sequence.torquesComputed();
+//       redis_client.setEigenMatrixJSON(SEQUENCE_KEY,           redis_client.set...(TORQUES, command_torques);
+//               stamper.next());                                redis_client.setEigenMatrixJSON(SEQUENCE_ECHO_KEY,
+//   }                                                                   sequence.echo());
+//   stamper.print(std::cout);                               }
+//
+// the stamp is published after the state and read before it, so that the state used is
+// never older than its stamp and the latencies are upper bounds, by at most a state period.
+// the stamp is [sequence, state time] and the echo [sequence, state time, read time, write
+// time], in us of CLOCK_MONOTONIC, so that they travel as the other eigen keys and fit in
+// the read and write callbacks. the times of the two sides are only comparable on the
+// same machine, the round trip is measured on the clock of the state side only.
+
+#include "redis/RedisLatencyStats.h"
+#include "redis/RedisClient.h"
+#include <Eigen/Dense>
+
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace PandaUtils {
+
+// us of CLOCK_MONOTONIC, exact in a double for years of uptime
+inline double monotonicMicroseconds()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// state side
+class SequenceStamper {
+public:
+
+	SequenceStamper()
+	: _sequence(0),
+	  _last_echo(0),
+	  _n_echoes(0),
+	  _sequence_lag(0)
+	{
+		_stamp.setZero();
+	}
+
+	// stamp of the state about to be published
+	const Eigen::Vector2d& next()
+	{
+		_sequence++;
+		_stamp << (double)_sequence, monotonicMicroseconds();
+		return _stamp;
+	}
+
+	const Eigen::Vector2d& stamp() const
+	{
+		return _stamp;
+	}
+
+	// the echo read with the torques. the latencies are recorded once per new echo, and not
+	// for the echoes of the states of another run
+	void receiveEcho(const Eigen::VectorXd& echo)
+	{
+		if(echo.size() != 4 || echo(0) <= _last_echo || echo(0) > _sequence)
+		{
+			return;
+		}
+		const double now = monotonicMicroseconds();
+		_last_echo = echo(0);
+		_n_echoes++;
+		record(_round_trip, now - echo(1));
+		record(_state_to_controller, echo(2) - echo(1));
+		record(_state_age, echo(3) - echo(1));
+		record(_controller_to_state, now - echo(3));
+		_sequence_lag = (double)_sequence - echo(0);
+	}
+
+	// state stamp to torques read back
+	const LatencyHistogram& roundTrip() const { return _round_trip; }
+	// state stamp to state read by the controller
+	const LatencyHistogram& stateToController() const { return _state_to_controller; }
+	// state stamp to torques written, the age of the state the torques are computed from
+	const LatencyHistogram& stateAge() const { return _state_age; }
+	// torques written to torques read back
+	const LatencyHistogram& controllerToState() const { return _controller_to_state; }
+
+	// states published since the one of the last echo
+	double sequenceLag() const
+	{
+		return _sequence_lag;
+	}
+
+	// {"echoes":..., "round_trip_us": {"mean":..., "p50":..., "p99":..., "max":...}, "state_to_controller_us": {...}, ...}
+	std::string toJSON() const
+	{
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(1)
+			<< "{\"echoes\": " << _n_echoes
+			<< ", \"round_trip_us\": " << histogramJSON(_round_trip)
+			<< ", \"state_to_controller_us\": " << histogramJSON(_state_to_controller)
+			<< ", \"state_age_us\": " << histogramJSON(_state_age)
+			<< ", \"controller_to_state_us\": " << histogramJSON(_controller_to_state) << "}";
+		return ss.str();
+	}
+
+	void publish(RedisClient& redis_client, const std::string& key) const
+	{
+		redis_client.set(key, toJSON());
+	}
+
+	void print(std::ostream& os) const
+	{
+		os << "loop latency (us)" << std::setw(19) << "mean" << std::setw(10) << "p50"
+			<< std::setw(10) << "p99" << std::setw(10) << "max" << "\n";
+		os << std::fixed << std::setprecision(1);
+		printHistogram(os, "round trip", _round_trip);
+		printHistogram(os, "state to controller", _state_to_controller);
+		printHistogram(os, "state age at torques", _state_age);
+		printHistogram(os, "torques to state side", _controller_to_state);
+		os << "echoes : " << _n_echoes << " for " << _sequence << " states\n";
+	}
+
+	void reset()
+	{
+		_round_trip.reset();
+		_state_to_controller.reset();
+		_state_age.reset();
+		_controller_to_state.reset();
+		_n_echoes = 0;
+	}
+
+private:
+
+	static void record(LatencyHistogram& histogram, const double microseconds)
+	{
+		histogram.record(microseconds > 0 ? (uint64_t)(microseconds * 1000) : 0);
+	}
+
+	static std::string histogramJSON(const LatencyHistogram& h)
+	{
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(1)
+			<< "{\"mean\": " << h.meanMicroseconds()
+			<< ", \"p50\": " << h.percentileMicroseconds(50)
+			<< ", \"p99\": " << h.percentileMicroseconds(99)
+			<< ", \"max\": " << h.maxMicroseconds() << "}";
+		return ss.str();
+	}
+
+	static void printHistogram(std::ostream& os, const std::string& name, const LatencyHistogram& h)
+	{
+		os << std::left << std::setw(26) << name << std::right
+			<< std::setw(10) << h.meanMicroseconds()
+			<< std::setw(10) << h.percentileMicroseconds(50)
+			<< std::setw(10) << h.percentileMicroseconds(99)
+			<< std::setw(10) << h.maxMicroseconds() << "\n";
+	}
+
+	unsigned long long _sequence;
+	Eigen::Vector2d _stamp;
+
+	double _last_echo;
+	unsigned long long _n_echoes;
+	double _sequence_lag;
+
+	LatencyHistogram _round_trip;
+	LatencyHistogram _state_to_controller;
+	LatencyHistogram _state_age;
+	LatencyHistogram _controller_to_state;
+};
+
+// controller side
+class SequenceEcho {
+public:
+
+	SequenceEcho()
+	{
+		_stamp.setZero();
+		_echo.setZero();
+		_read_time = 0;
+	}
+
+	// with the stamp read with the state
+	void stateRead(const Eigen::VectorXd& stamp)
+	{
+		_read_time = monotonicMicroseconds();
+		if(stamp.size() == 2)
+		{
+			_stamp = stamp;
+		}
+	}
+
+	// for a stamp read in a read callback, into stamp()
+	void stateRead()
+	{
+		_read_time = monotonicMicroseconds();
+	}
+
+	// just before the torques are written
+	const Eigen::Vector4d& torquesComputed()
+	{
+		_echo << _stamp(0), _stamp(1), _read_time, monotonicMicroseconds();
+		return _echo;
+	}
+
+	// target of a read callback
+	Eigen::Vector2d& stamp()
+	{
+		return _stamp;
+	}
+
+	// source of a write callback
+	const Eigen::Vector4d& echo() const
+	{
+		return _echo;
+	}
+
+private:
+	Eigen::Vector2d _stamp;
+	Eigen::Vector4d _echo;
+	double _read_time;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_REDIS_SEQUENCE_STAMP_H_
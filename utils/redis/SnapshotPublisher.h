@@ -0,0 +1,189 @@
+#ifndef UTILS_REDIS_SNAPSHOT_PUBLISHER_H_
+#define UTILS_REDIS_SNAPSHOT_PUBLISHER_H_
+
+// Decimated snapshots of a large matrix (the particles of a filter, a point cloud) sent to
+// redis by a background thread, for the visualizers.
+//
+// the producer asks due() after each of its updates, and fills and publishes a snapshot only
+// when the period of the publisher has passed : the columns are copied into a preallocated
+// buffer handed to the background thread through a triple buffer, and the thread encodes the
+// latest snapshot in the binary format of redis/RedisBinaryEigen.h and sends it on its own
+// connection. the producer does not encode, does not wait for redis and does not allocate :
+//
+//   PandaUtils::SnapshotPublisher particle_publisher(PARTICLE_POSITIONS_KEY, 3, n_particles, 30.0);
+//   particle_publisher.start();
+//   while(runloop)                                                   // particle filter thread
+//   {
+//       pfilter->update(...);
+//       if(particle_publisher.due())
+//       {
+//           Eigen::Ref<Eigen::MatrixXd> snapshot = particle_publisher.snapshot(pfilter->_particles.size());
+//           for(int i=0 ; i<snapshot.cols() ; i++)
+//           {
+//               snapshot.col(i) = pfilter->_particles[i];
+//           }
+//           particle_publisher.publish();
+//       }
+//   }
+//   particle_publisher.stop();
+//
+// the readers use getEigenMatrixBinary(), which also reads the json written by older
+// producers. a snapshot has at most max_cols columns, the count can change from one to the
+// next.
+
+#include "redis/RedisBinaryEigen.h"
+#include "redis/RedisClient.h"
+#include "threads/TripleBuffer.h"
+#include <Eigen/Dense>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace PandaUtils {
+
+class SnapshotPublisher {
+public:
+
+	// rows and most columns of a snapshot, most snapshots sent per second
+	SnapshotPublisher(const std::string& key, const int rows, const int max_cols, const double frequency = 30.0,
+			const std::string& hostname = "127.0.0.1", const int port = 6379)
+	: _key(key),
+	  _max_cols(max_cols),
+	  _hostname(hostname),
+	  _port(port),
+	  _snapshots(Snapshot(rows, max_cols)),
+	  _running(false),
+	  _n_published(0),
+	  _n_sent(0)
+	{
+		if(rows <= 0 || max_cols <= 0)
+		{
+			throw std::invalid_argument("snapshot size should be positive in SnapshotPublisher::SnapshotPublisher()\n");
+		}
+		if(frequency <= 0)
+		{
+			throw std::invalid_argument("frequency should be positive in SnapshotPublisher::SnapshotPublisher()\n");
+		}
+		_period = std::chrono::nanoseconds((int64_t)(1e9 / frequency + 0.5));
+		_next_snapshot = std::chrono::steady_clock::now();
+	}
+
+	~SnapshotPublisher()
+	{
+		stop();
+	}
+
+	void start()
+	{
+		if(_running)
+		{
+			return;
+		}
+		_redis_client.connect(_hostname, _port);
+		_running = true;
+		_thread = std::thread(&SnapshotPublisher::sendLoop, this);
+	}
+
+	// sends the last snapshot published and stops the thread
+	void stop()
+	{
+		if(!_running)
+		{
+			return;
+		}
+		_running = false;
+		_thread.join();
+	}
+
+	// producer : true once per period, when a snapshot should be filled and published
+	bool due()
+	{
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if(now < _next_snapshot)
+		{
+			return false;
+		}
+		_next_snapshot = now + _period;
+		return true;
+	}
+
+	// producer : the first cols columns of the buffer of the next snapshot, to fill before publish()
+	Eigen::Ref<Eigen::MatrixXd> snapshot(const int cols)
+	{
+		if(cols < 0 || cols > _max_cols)
+		{
+			throw std::invalid_argument("more columns than the snapshots hold in SnapshotPublisher::snapshot()\n");
+		}
+		Snapshot& snapshot = _snapshots.writeBuffer();
+		snapshot.cols = cols;
+		return snapshot.data.leftCols(cols);
+	}
+
+	// producer : hands the snapshot to the thread, a snapshot not sent yet is replaced
+	void publish()
+	{
+		_snapshots.publish();
+		_n_published.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	unsigned long long publishedCount() const { return _n_published.load(std::memory_order_relaxed); }
+	unsigned long long sentCount() const { return _n_sent.load(std::memory_order_relaxed); }
+
+private:
+
+	struct Snapshot {
+		Snapshot(const int rows = 0, const int max_cols = 0)
+		: data(Eigen::MatrixXd::Zero(rows, max_cols)),
+		  cols(0)
+		{}
+
+		Eigen::MatrixXd data;
+		int cols;
+	};
+
+	void sendLoop()
+	{
+		bool running = true;
+		while(running)
+		{
+			running = _running;
+			if(running)
+			{
+				std::this_thread::sleep_for(_period);
+			}
+			if(_snapshots.update())
+			{
+				const Snapshot& snapshot = _snapshots.latest();
+				setEigenMatrixBinary(_redis_client, _key, snapshot.data.leftCols(snapshot.cols));
+				_n_sent.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+	}
+
+	const std::string _key;
+	const int _max_cols;
+	const std::string _hostname;
+	const int _port;
+	std::chrono::nanoseconds _period;
+
+	// producer only
+	std::chrono::steady_clock::time_point _next_snapshot;
+
+	TripleBuffer<Snapshot> _snapshots;
+
+	// thread only
+	RedisClient _redis_client;
+	std::thread _thread;
+	std::atomic<bool> _running;
+
+	std::atomic<unsigned long long> _n_published;
+	std::atomic<unsigned long long> _n_sent;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_REDIS_SNAPSHOT_PUBLISHER_H_
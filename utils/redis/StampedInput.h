@@ -0,0 +1,113 @@
+#ifndef UTILS_REDIS_STAMPED_INPUT_H_
+#define UTILS_REDIS_STAMPED_INPUT_H_
+
+// A value read from redis with the time at which its source sampled it.
+//
+// the source publishes with the value a stamp [sequence, time] of a SequenceStamper (us of
+// CLOCK_MONOTONIC, see redis/SequenceStamp.h), in the same write callback as the value or
+// after it. the reader registers both in its read callback, and after each read gets whether
+// the source published a new sample since the previous read, and the source time of it :
+//
+//   // simviz                                                  // controller
+//   PandaUtils::SequenceStamper force_stamper;                 PandaUtils::StampedInput force_input(FORCE_SENSED_KEY, FORCE_SENSED_STAMP_KEY);
+//   while(fSimulationRunning)                                  force_input.addToReadCallback(redis_client, 0);
+//   {                                                          while(runloop)
+//       ...                                                    {
+//       redis_client.setEigenMatrixJSON(FORCE_SENSED_KEY,          redis_client.executeReadCallback(0);
+//               sensed_force_moment);                              if(force_input.receive(PandaUtils::monotonicMicroseconds()))
+//       redis_client.setEigenMatrixJSON(FORCE_SENSED_STAMP_KEY,    {
+//               force_stamper.next());                                 force_stream.push(force_input.time(), force_input.value());
+//   }                                                              }
+//                                                              }
+//
+// the sources that do not stamp their values (the drivers of the sensors, of the haptic
+// devices) are read without stamp key : a new sample is a value that changed, and its time
+// is the time of the read, an upper bound of the sample time by a read period and the
+// latency of redis. the value is never older than its stamp. the input must not move after
+// addToReadCallback(), the read callback holds references to its members.
+
+#include "redis/RedisClient.h"
+#include "redis/SequenceStamp.h"
+#include <Eigen/Dense>
+
+#include <string>
+
+namespace PandaUtils {
+
+class StampedInput {
+public:
+
+	// empty stamp key for a source that does not stamp its values
+	StampedInput(const std::string& value_key, const std::string& stamp_key = "", const int size = 0)
+	: _value_key(value_key),
+	  _stamp_key(stamp_key),
+	  _last_sequence(0),
+	  _time(0),
+	  _n_samples(0)
+	{
+		_value.setZero(size);
+		_previous_value.setZero(size);
+		_stamp.setZero(2);
+	}
+
+	void addToReadCallback(RedisClient& redis_client, const int callback_number)
+	{
+		redis_client.addEigenToReadCallback(callback_number, _value_key, _value);
+		if(sourceStamped())
+		{
+			redis_client.addEigenToReadCallback(callback_number, _stamp_key, _stamp);
+		}
+	}
+
+	// after the read of the callback, at read_time (us of CLOCK_MONOTONIC). true when the value
+	// is a new sample of the source
+	bool receive(const double read_time)
+	{
+		bool new_sample = false;
+		if(sourceStamped())
+		{
+			if(_stamp.size() == 2 && _stamp(0) != _last_sequence)
+			{
+				_last_sequence = _stamp(0);
+				_time = _stamp(1) * 1e-6;
+				new_sample = true;
+			}
+		}
+		else if(_n_samples == 0 || _value.size() != _previous_value.size() || _value != _previous_value)
+		{
+			_previous_value = _value;
+			_time = read_time * 1e-6;
+			new_sample = true;
+		}
+		if(new_sample)
+		{
+			_n_samples++;
+		}
+		return new_sample;
+	}
+
+	// of the last sample, in s of CLOCK_MONOTONIC
+	double time() const { return _time; }
+	const Eigen::VectorXd& value() const { return _value; }
+	// new samples received
+	unsigned long long numSamples() const { return _n_samples; }
+	bool sourceStamped() const { return !_stamp_key.empty(); }
+	const std::string& key() const { return _value_key; }
+
+private:
+
+	const std::string _value_key;
+	const std::string _stamp_key;
+
+	Eigen::VectorXd _value;
+	Eigen::VectorXd _previous_value;
+	Eigen::VectorXd _stamp;
+
+	double _last_sequence;
+	double _time;
+	unsigned long long _n_samples;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_REDIS_STAMPED_INPUT_H_
@@ -0,0 +1,279 @@
+#ifndef UTILS_REDIS_TELEMETRY_WRITER_H_
+#define UTILS_REDIS_TELEMETRY_WRITER_H_
+
+// Write-behind queue for telemetry-only redis keys (plots, debug values).
+//
+// the keys are bound to variables like with the write callbacks of
+// RedisClient. publish() copies the current values of all of them into one
+// record of a bounded single producer / single consumer ring, and returns.
+// a background thread drains the ring on its own connection, keeps only
+// the newest record (so each key is sent with its latest value) and sends
+// all the keys as one pipeline. when the drain thread falls behind and the
+// ring is full, the new record is dropped and counted instead of making the
+// control loop wait:
+//
+//   PandaUtils::TelemetryWriter telemetry;
+//   telemetry.addEigen(LOG_Q_KALMAN_KEY, q_kalman);
+//   telemetry.addDouble(ALPHA_KEY, alpha);
+//   telemetry.start();
+//   while(...) {
+//       ...
+//       telemetry.publish();   // control thread, copies only
+//   }
+//   telemetry.stop();
+//
+// publish() must be called from a single thread. the sizes of the bound
+// matrices are fixed at start(). doubles are written the same way as
+// RedisClient::addDoubleToWriteCallback does and matrices as json.
+
+#include "redis/RedisClient.h"
+#include <hiredis/hiredis.h>
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace PandaUtils {
+
+class TelemetryWriter {
+public:
+
+	TelemetryWriter(const std::string& hostname = "127.0.0.1", const int port = 6379,
+			const int capacity = 256, const int drain_period_ms = 5)
+	: _hostname(hostname),
+	  _port(port),
+	  _capacity(capacity + 1),
+	  _drain_period_ms(drain_period_ms),
+	  _record_size(0),
+	  _head(0),
+	  _tail(0),
+	  _running(false),
+	  _n_published(0),
+	  _n_dropped(0),
+	  _n_sent(0)
+	{}
+
+	~TelemetryWriter()
+	{
+		stop();
+	}
+
+	template<typename Derived>
+	void addEigen(const std::string& key, const Eigen::MatrixBase<Derived>& value)
+	{
+		checkNotRunning();
+		typedef typename Derived::PlainObject Plain;
+		const Eigen::MatrixBase<Derived>* source = &value;
+		Entry entry;
+		entry.key = key;
+		entry.is_matrix = true;
+		entry.rows = 0;
+		entry.cols = 0;
+		entry.size_of = [source](int& rows, int& cols){ rows = source->rows(); cols = source->cols(); };
+		entry.copy = [source](double* out, const int rows, const int cols)
+		{
+			if(source->rows() != rows || source->cols() != cols)
+			{
+				return false;
+			}
+			Eigen::Map<Plain>(out, rows, cols) = *source;
+			return true;
+		};
+		_entries.push_back(entry);
+	}
+
+	void addDouble(const std::string& key, const double& value)
+	{
+		checkNotRunning();
+		const double* source = &value;
+		Entry entry;
+		entry.key = key;
+		entry.is_matrix = false;
+		entry.rows = 1;
+		entry.cols = 1;
+		entry.size_of = [](int& rows, int& cols){ rows = 1; cols = 1; };
+		entry.copy = [source](double* out, const int, const int){ *out = *source; return true; };
+		_entries.push_back(entry);
+	}
+
+	// fix the layout of the records and start the drain thread
+	void start()
+	{
+		checkNotRunning();
+		_record_size = 0;
+		for(unsigned int i=0 ; i<_entries.size() ; i++)
+		{
+			_entries[i].size_of(_entries[i].rows, _entries[i].cols);
+			_entries[i].offset = _record_size;
+			_record_size += _entries[i].rows * _entries[i].cols;
+		}
+		_ring.assign(_capacity * _record_size, 0.0);
+		_latest.assign(_record_size, 0.0);
+		_head.store(0);
+		_tail.store(0);
+
+		_redis_client.connect(_hostname, _port);
+		_running = true;
+		_drain_thread = std::thread(&TelemetryWriter::drainWorker, this);
+	}
+
+	// send the records still in the ring and stop the drain thread
+	void stop()
+	{
+		if(_running)
+		{
+			_running = false;
+			_drain_thread.join();
+		}
+	}
+
+	// producer side: snapshot the bound values. returns false if the record was dropped.
+	bool publish()
+	{
+		if(_record_size == 0)
+		{
+			return true;
+		}
+		const unsigned int head = _head.load(std::memory_order_relaxed);
+		const unsigned int next = (head + 1) % _capacity;
+		if(next == _tail.load(std::memory_order_acquire))
+		{
+			_n_dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		double* record = &_ring[head * _record_size];
+		for(unsigned int i=0 ; i<_entries.size() ; i++)
+		{
+			if(!_entries[i].copy(record + _entries[i].offset, _entries[i].rows, _entries[i].cols))
+			{
+				throw std::logic_error("size of " + _entries[i].key + " changed after start() in TelemetryWriter::publish()\n");
+			}
+		}
+		_head.store(next, std::memory_order_release);
+		_n_published.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	int numKeys() const { return (int) _entries.size(); }
+	unsigned long long publishedCount() const { return _n_published.load(std::memory_order_relaxed); }
+	unsigned long long droppedCount() const { return _n_dropped.load(std::memory_order_relaxed); }
+	// number of pipelines sent, each one carrying the newest record available at the time
+	unsigned long long sentCount() const { return _n_sent.load(std::memory_order_relaxed); }
+
+private:
+
+	struct Entry {
+		std::string key;
+		bool is_matrix;
+		int rows;
+		int cols;
+		int offset;
+		std::function<void(int&, int&)> size_of;
+		std::function<bool(double*, int, int)> copy;
+	};
+
+	void checkNotRunning() const
+	{
+		if(_running)
+		{
+			throw std::logic_error("TelemetryWriter cannot be configured after start()\n");
+		}
+	}
+
+	void drainWorker()
+	{
+		bool running = true;
+		while(running)
+		{
+			running = _running;
+			if(running)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(_drain_period_ms));
+			}
+			if(popLatest())
+			{
+				send();
+			}
+		}
+	}
+
+	// consumer side: consume everything in the ring, keeping the newest record
+	bool popLatest()
+	{
+		const unsigned int tail = _tail.load(std::memory_order_relaxed);
+		const unsigned int head = _head.load(std::memory_order_acquire);
+		if(tail == head)
+		{
+			return false;
+		}
+		const unsigned int newest = (head + _capacity - 1) % _capacity;
+		std::copy(&_ring[newest * _record_size], &_ring[newest * _record_size] + _record_size, _latest.begin());
+		_tail.store(head, std::memory_order_release);
+		return true;
+	}
+
+	void send()
+	{
+		redisContext* context = _redis_client.context_.get();
+		_values.resize(_entries.size());
+		for(unsigned int i=0 ; i<_entries.size() ; i++)
+		{
+			const Entry& entry = _entries[i];
+			if(entry.is_matrix)
+			{
+				_values[i] = RedisClient::encodeEigenMatrixJSON(
+					Eigen::Map<const Eigen::MatrixXd>(&_latest[entry.offset], entry.rows, entry.cols));
+			}
+			else
+			{
+				_values[i] = std::to_string(_latest[entry.offset]);
+			}
+			redisAppendCommand(context, "SET %b %b", entry.key.data(), entry.key.size(),
+				_values[i].data(), _values[i].size());
+		}
+		for(unsigned int i=0 ; i<_entries.size() ; i++)
+		{
+			void* reply;
+			if(redisGetReply(context, &reply) != REDIS_OK)
+			{
+				throw std::runtime_error("redis write failed in TelemetryWriter::send()\n");
+			}
+			freeReplyObject(reply);
+		}
+		_n_sent.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	std::string _hostname;
+	int _port;
+	const unsigned int _capacity;
+	int _drain_period_ms;
+
+	std::vector<Entry> _entries;
+	int _record_size;
+
+	// ring of records, _head written by the producer, _tail by the drain thread
+	std::vector<double> _ring;
+	std::atomic<unsigned int> _head;
+	std::atomic<unsigned int> _tail;
+
+	// used by the drain thread only
+	RedisClient _redis_client;
+	std::vector<double> _latest;
+	std::vector<std::string> _values;
+	std::thread _drain_thread;
+
+	std::atomic<bool> _running;
+	std::atomic<unsigned long long> _n_published;
+	std::atomic<unsigned long long> _n_dropped;
+	std::atomic<unsigned long long> _n_sent;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_REDIS_TELEMETRY_WRITER_H_
@@ -0,0 +1,186 @@
+// Haptic driver side of the binary device records on redis (see redis/HapticDeviceBundle.h) :
+// packs the sensor keys of the chai haptic driver into the state record, and writes the
+// commands record of the controller to the actuator keys.
+//
+// usage : haptic_bundle_bridge [-d device] [-f hz] [--host h]
+//   -d n       device index of the haptic driver keys (default 0)
+//   -f hz      rate of the bridge, at or above the haptic loop of the controller (default 4000)
+//   --host h   redis server of the driver and the controller (default 127.0.0.1)
+//
+// the bridge runs on the machine of the redis server, next to the driver, so its round trips
+// are local, and the controllers then exchange one binary value each way per tick instead of
+// the 11 JSON keys. when no new commands record arrives for 0.1 s (the controller stopped),
+// the bridge commands zero force to the device, and at exit it deletes the state record so
+// that the controllers started later use the JSON keys.
+
+#include "redis/RedisClient.h"
+#include "redis/HapticDeviceBundle.h"
+#include "timer/LoopTimer.h"
+
+#include <signal.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace std;
+using namespace Eigen;
+
+bool runloop = false;
+void sighandler(int){runloop = false;}
+
+void deleteKey(RedisClient& redis_client, const string& key)
+{
+	redisReply* reply = (redisReply*) redisCommand(redis_client.context_.get(), "DEL %b", key.data(), key.size());
+	if(reply != NULL)
+	{
+		freeReplyObject(reply);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	int device_index = 0;
+	double frequency = 4000.0;
+	string host = "127.0.0.1";
+	for(int i=1 ; i<argc-1 ; i++)
+	{
+		const string arg = argv[i];
+		if(arg == "-d")
+		{
+			device_index = atoi(argv[++i]);
+		}
+		else if(arg == "-f")
+		{
+			frequency = atof(argv[++i]);
+		}
+		else if(arg == "--host")
+		{
+			host = argv[++i];
+		}
+	}
+	if(frequency <= 0 || device_index < 0)
+	{
+		cout << "usage : " << argv[0] << " [-d device] [-f hz] [--host h]" << endl;
+		return 2;
+	}
+
+	const string prefix = PandaUtils::HAPTIC_DEVICE_KEY_PREFIX + to_string(device_index);
+	const string COMMANDED_FORCE_KEY = prefix + "::actuators::commanded_force";
+	const string COMMANDED_TORQUE_KEY = prefix + "::actuators::commanded_torque";
+	const string COMMANDED_GRIPPER_FORCE_KEY = prefix + "::actuators::commanded_force_gripper";
+	const string STATE_KEY = PandaUtils::hapticDeviceStateKey(device_index);
+	const string COMMANDS_KEY = PandaUtils::hapticDeviceCommandsKey(device_index);
+
+	RedisClient redis_client;
+	redis_client.connect(host);
+
+	// device state, read in one round trip
+	Vector3d position = Vector3d::Zero();
+	Matrix3d rotation = Matrix3d::Identity();
+	Vector3d velocity = Vector3d::Zero();
+	Vector3d angular_velocity = Vector3d::Zero();
+	Vector3d sensed_force = Vector3d::Zero();
+	Vector3d sensed_torque = Vector3d::Zero();
+	double gripper_position = 0;
+	double gripper_velocity = 0;
+	redis_client.createReadCallback(0);
+	redis_client.addEigenToReadCallback(0, prefix + "::sensors::current_position", position);
+	redis_client.addEigenToReadCallback(0, prefix + "::sensors::current_rotation", rotation);
+	redis_client.addEigenToReadCallback(0, prefix + "::sensors::current_trans_velocity", velocity);
+	redis_client.addEigenToReadCallback(0, prefix + "::sensors::current_rot_velocity", angular_velocity);
+	redis_client.addEigenToReadCallback(0, prefix + "::sensors::sensed_force", sensed_force);
+	redis_client.addEigenToReadCallback(0, prefix + "::sensors::sensed_torque", sensed_torque);
+	redis_client.addDoubleToReadCallback(0, prefix + "::sensors::current_position_gripper", gripper_position);
+	redis_client.addDoubleToReadCallback(0, prefix + "::sensors::current_gripper_velocity", gripper_velocity);
+
+	// commands, written in one round trip
+	Vector3d commanded_force = Vector3d::Zero();
+	Vector3d commanded_torque = Vector3d::Zero();
+	double commanded_gripper_force = 0;
+	redis_client.createWriteCallback(0);
+	redis_client.addEigenToWriteCallback(0, COMMANDED_FORCE_KEY, commanded_force);
+	redis_client.addEigenToWriteCallback(0, COMMANDED_TORQUE_KEY, commanded_torque);
+	redis_client.addDoubleToWriteCallback(0, COMMANDED_GRIPPER_FORCE_KEY, commanded_gripper_force);
+
+	// the commands record of a previous run is not taken
+	deleteKey(redis_client, COMMANDS_KEY);
+
+	PandaUtils::TeleopPacket state;
+	PandaUtils::TeleopPacket command;
+	state.magic = PandaUtils::TeleopPacket::MAGIC;
+	state.version = PandaUtils::TeleopPacket::VERSION;
+	state.channel = device_index;
+	uint64_t last_command_sequence = 0;
+	unsigned long long n_commands = 0;
+	const double command_timeout = 0.1;
+	double last_command_time = -1;
+
+	LoopTimer timer;
+	timer.initializeTimer();
+	timer.setLoopFrequency(frequency);
+	double start_time = timer.elapsedTime();
+	bool f_commanding = false;
+
+	signal(SIGABRT, &sighandler);
+	signal(SIGTERM, &sighandler);
+	signal(SIGINT, &sighandler);
+	runloop = true;
+
+	cout << "bundling device " << device_index << " on " << host << " at " << frequency << " Hz" << endl;
+
+	while(runloop)
+	{
+		timer.waitForNextLoop();
+		const double time = timer.elapsedTime() - start_time;
+
+		redis_client.executeReadCallback(0);
+		Map<Vector3d>(state.position) = position;
+		Map<Matrix3d>(state.rotation) = rotation;
+		Map<Vector3d>(state.velocity) = velocity;
+		Map<Vector3d>(state.angular_velocity) = angular_velocity;
+		Map<Vector3d>(state.force) = sensed_force;
+		Map<Vector3d>(state.torque) = sensed_torque;
+		state.gripper_position = gripper_position;
+		state.gripper_velocity = gripper_velocity;
+		state.sequence++;
+		state.send_time = time;
+		PandaUtils::setTeleopPacket(redis_client, STATE_KEY, state);
+
+		if(PandaUtils::getTeleopPacket(redis_client, COMMANDS_KEY, device_index, command)
+			&& command.sequence != last_command_sequence)
+		{
+			last_command_sequence = command.sequence;
+			last_command_time = time;
+			n_commands++;
+			commanded_force = Map<const Vector3d>(command.force);
+			commanded_torque = Map<const Vector3d>(command.torque);
+			commanded_gripper_force = command.gripper_force;
+			if(!f_commanding)
+			{
+				cout << "commands from the controller" << endl;
+				f_commanding = true;
+			}
+		}
+		else if(last_command_time < 0 || time - last_command_time > command_timeout)
+		{
+			commanded_force.setZero();
+			commanded_torque.setZero();
+			commanded_gripper_force = 0;
+			if(f_commanding)
+			{
+				cout << "no commands for " << command_timeout << " s, zero force" << endl;
+				f_commanding = false;
+			}
+		}
+		redis_client.executeWriteCallback(0);
+	}
+
+	deleteKey(redis_client, STATE_KEY);
+	redis_client.setEigenMatrixJSON(COMMANDED_FORCE_KEY, Vector3d::Zero());
+	redis_client.setEigenMatrixJSON(COMMANDED_TORQUE_KEY, Vector3d::Zero());
+	redis_client.set(COMMANDED_GRIPPER_FORCE_KEY, "0.0");
+
+	cout << "\nstate records " << state.sequence << ", new commands records " << n_commands << endl;
+	return 0;
+}
@@ -0,0 +1,557 @@
+// Records the key updates of a session (controllers, simviz, drivers) and replays them into a
+// controller under test, for regression runs of controller changes against recorded sessions.
+//
+// usage :
+//   redis_session record session.rses [--host h] [-p prefix]...
+//   redis_session replay session.rses [captured.rses] [--host h] [-speed x] [-lockstep key_prefix]
+//                 [-outputs pattern,...] [-step_key key]
+//   redis_session diff recorded.rses captured.rses [-keys pattern,...] [-tol x]
+//
+// record : every SET and MSET of the keys starting with a prefix (default sai2::PandaApplication::
+// and sai2::FrankaPanda::), by any client, with the time of the server (see RedisMonitor), until
+// ctrl-c.
+//
+// replay : the keys that contain one of the output patterns (default ::actuators:: and
+// ::controller::, the torques and the telemetry of the controllers) are the outputs of the
+// controller under test, all the other keys are its inputs and are written again.
+//   - by default at the recorded times (-speed 2 for twice as fast), to a controller running
+//     on its loop timer, and the outputs it writes are monitored to captured.rses.
+//   - with -lockstep, as fast as the controller runs, with a controller built in lockstep mode
+//     (flag_lockstep, see redis/LockstepSync.h) : the tool takes the place of the simviz.
+//     the inputs recorded before each update of the step key (default the first output key of
+//     the session, the torques) are one step : the tool writes them, publishes the step, waits
+//     for the torques of the controller and reads the outputs to captured.rses. the replay is
+//     then deterministic, one controller step per recorded step.
+//
+// diff : compares the updates of the output keys (or the keys containing a -keys pattern) of two
+// sessions one by one, numerically when both values are numbers or json arrays of numbers, and
+// reports the largest difference per key. returns 1 if a difference is above -tol (default 1e-9)
+// or the number of updates differ, for scripts.
+
+#include "redis/RedisClient.h"
+#include "redis/RedisMonitor.h"
+#include "redis/RedisSessionLog.h"
+#include "redis/LockstepSync.h"
+
+#include <hiredis/hiredis.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+atomic<bool> runloop(true);
+void sighandler(int){runloop = false;}
+
+vector<string> splitList(const string& list)
+{
+	vector<string> items;
+	stringstream stream(list);
+	string item;
+	while(getline(stream, item, ','))
+	{
+		if(!item.empty())
+		{
+			items.push_back(item);
+		}
+	}
+	return items;
+}
+
+bool containsOne(const string& key, const vector<string>& patterns)
+{
+	for(const string& pattern : patterns)
+	{
+		if(key.find(pattern) != string::npos)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// updates written in one round trip
+void setKeys(RedisClient& redis_client, const vector<pair<string, string> >& updates)
+{
+	redisContext* context = redis_client.context_.get();
+	for(const auto& update : updates)
+	{
+		redisAppendCommand(context, "SET %b %b", update.first.data(), update.first.size(), update.second.data(), update.second.size());
+	}
+	for(unsigned int i=0 ; i<updates.size() ; i++)
+	{
+		redisReply* reply = NULL;
+		if(redisGetReply(context, (void**) &reply) != REDIS_OK)
+		{
+			throw runtime_error("redis_session: SET failed\n");
+		}
+		freeReplyObject(reply);
+	}
+}
+
+// values of some keys in one round trip, empty for a key that does not exist
+void getKeys(RedisClient& redis_client, const vector<string>& keys, vector<string>& values)
+{
+	redisContext* context = redis_client.context_.get();
+	for(const string& key : keys)
+	{
+		redisAppendCommand(context, "GET %b", key.data(), key.size());
+	}
+	values.resize(keys.size());
+	for(unsigned int i=0 ; i<keys.size() ; i++)
+	{
+		redisReply* reply = NULL;
+		if(redisGetReply(context, (void**) &reply) != REDIS_OK)
+		{
+			throw runtime_error("redis_session: GET failed\n");
+		}
+		values[i] = (reply->type == REDIS_REPLY_STRING) ? string(reply->str, reply->len) : string();
+		freeReplyObject(reply);
+	}
+}
+
+int record(const string& session_file, const string& host, vector<string> prefixes)
+{
+	if(prefixes.empty())
+	{
+		prefixes = {"sai2::PandaApplication::", "sai2::FrankaPanda::"};
+	}
+	PandaUtils::RedisMonitor monitor(prefixes);
+	if(!monitor.connect(host))
+	{
+		cout << monitor.error() << endl;
+		return 1;
+	}
+	cout << "recording to " << session_file << ", ctrl-c to stop" << endl;
+
+	PandaUtils::RedisSessionWriter writer;
+	vector<PandaUtils::RedisKeyUpdate> updates;
+	double start_time = -1;
+	while(runloop && monitor.read(updates))
+	{
+		for(const auto& update : updates)
+		{
+			if(start_time < 0)
+			{
+				start_time = update.time;
+				if(!writer.open(session_file, start_time))
+				{
+					cout << "could not create " << session_file << endl;
+					return 1;
+				}
+			}
+			writer.write(update.time - start_time, update.key, update.value);
+		}
+	}
+	if(!monitor.error().empty() && runloop)
+	{
+		cout << monitor.error() << endl;
+	}
+	writer.close();
+	cout << "recorded " << writer.numUpdates() << " updates of " << writer.numKeys() << " keys" << endl;
+	return 0;
+}
+
+// writes the outputs written by the controller under test during a replay on its loop timer
+void captureOutputs(const string& host, const vector<string>& output_patterns, PandaUtils::RedisSessionWriter* writer,
+		const double start_time, atomic<bool>* f_capturing, atomic<bool>* f_ready)
+{
+	PandaUtils::RedisMonitor monitor;
+	if(!monitor.connect(host))
+	{
+		cout << monitor.error() << endl;
+		*f_ready = true;
+		return;
+	}
+	*f_ready = true;
+	vector<PandaUtils::RedisKeyUpdate> updates;
+	while(*f_capturing && monitor.read(updates))
+	{
+		for(const auto& update : updates)
+		{
+			if(containsOne(update.key, output_patterns))
+			{
+				writer->write(update.time - start_time, update.key, update.value);
+			}
+		}
+	}
+}
+
+int replay(const string& session_file, const string& captured_file, const string& host, const double speed,
+		const string& lockstep_prefix, const vector<string>& output_patterns, string step_key)
+{
+	PandaUtils::RedisSessionReader reader;
+	if(!reader.open(session_file))
+	{
+		cout << reader.error() << endl;
+		return 1;
+	}
+	RedisClient redis_client;
+	redis_client.connect(host);
+
+	PandaUtils::RedisSessionWriter writer;
+	if(!captured_file.empty() && !writer.open(captured_file, reader.startTime()))
+	{
+		cout << "could not create " << captured_file << endl;
+		return 1;
+	}
+
+	PandaUtils::RedisSessionReader::Update update;
+	vector<pair<string, string> > inputs;
+	unsigned long long n_inputs = 0;
+	const auto wall_start = chrono::steady_clock::now();
+
+	if(!lockstep_prefix.empty())
+	{
+		PandaUtils::LockstepSync lockstep(redis_client, lockstep_prefix);
+		lockstep.reset();
+		vector<string> output_keys;
+		vector<string> output_values;
+		unsigned long long step = 0;
+		while(runloop && reader.next(update))
+		{
+			const string& key = reader.key(update.key_id);
+			if(!containsOne(key, output_patterns))
+			{
+				inputs.push_back(make_pair(key, update.value));
+				continue;
+			}
+			if(find(output_keys.begin(), output_keys.end(), key) == output_keys.end())
+			{
+				output_keys.push_back(key);
+			}
+			if(step_key.empty())
+			{
+				step_key = key;
+				cout << "one step per update of " << step_key << endl;
+			}
+			if(key != step_key)
+			{
+				continue;
+			}
+
+			// one controller step on the recorded inputs
+			setKeys(redis_client, inputs);
+			n_inputs += inputs.size();
+			inputs.clear();
+			lockstep.publishState(step);
+			int n_timeouts = 0;
+			while(runloop && !lockstep.waitForTorques(step))
+			{
+				if(++n_timeouts == 5)
+				{
+					cout << "no answer of the controller for step " << step << ", is it in lockstep mode ?" << endl;
+					runloop = false;
+				}
+			}
+			if(!runloop)
+			{
+				break;
+			}
+			if(!captured_file.empty())
+			{
+				getKeys(redis_client, output_keys, output_values);
+				for(unsigned int i=0 ; i<output_keys.size() ; i++)
+				{
+					writer.write(update.time, output_keys[i], output_values[i]);
+				}
+			}
+			step++;
+		}
+		cout << "replayed " << step << " steps, " << n_inputs << " input updates";
+	}
+	else
+	{
+		atomic<bool> f_capturing(true);
+		atomic<bool> f_ready(false);
+		thread capture_thread;
+		if(!captured_file.empty())
+		{
+			// the monitor times are unix times of the server, the capture starts with the replay
+			timespec now;
+			clock_gettime(CLOCK_REALTIME, &now);
+			const double start_time = now.tv_sec + 1e-9 * now.tv_nsec;
+			capture_thread = thread(captureOutputs, host, output_patterns, &writer, start_time, &f_capturing, &f_ready);
+			while(!f_ready)
+			{
+				usleep(1000);
+			}
+		}
+		while(runloop && reader.next(update))
+		{
+			const string& key = reader.key(update.key_id);
+			if(containsOne(key, output_patterns))
+			{
+				continue;
+			}
+			// the updates due by now in one round trip
+			const auto due = wall_start + chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(update.time / speed));
+			if(due > chrono::steady_clock::now() && !inputs.empty())
+			{
+				setKeys(redis_client, inputs);
+				n_inputs += inputs.size();
+				inputs.clear();
+			}
+			this_thread::sleep_until(due);
+			inputs.push_back(make_pair(key, update.value));
+		}
+		setKeys(redis_client, inputs);
+		n_inputs += inputs.size();
+		if(capture_thread.joinable())
+		{
+			// any command wakes the monitor up
+			f_capturing = false;
+			redisReply* reply = (redisReply*) redisCommand(redis_client.context_.get(), "PING");
+			if(reply != NULL)
+			{
+				freeReplyObject(reply);
+			}
+			capture_thread.join();
+		}
+		cout << "replayed " << n_inputs << " input updates";
+	}
+
+	const double wall_time = chrono::duration<double>(chrono::steady_clock::now() - wall_start).count();
+	cout << " in " << wall_time << " s" << endl;
+	if(!captured_file.empty())
+	{
+		writer.close();
+		cout << "captured " << writer.numUpdates() << " output updates to " << captured_file << endl;
+	}
+	return 0;
+}
+
+// numbers of a value : a number or a json array of numbers. false otherwise
+bool parseNumbers(const string& value, vector<double>& numbers)
+{
+	numbers.clear();
+	const char* c = value.c_str();
+	while(*c != '\0')
+	{
+		if(*c == '[' || *c == ']' || *c == ',' || isspace(*c))
+		{
+			c++;
+			continue;
+		}
+		char* end = NULL;
+		const double number = strtod(c, &end);
+		if(end == c)
+		{
+			return false;
+		}
+		numbers.push_back(number);
+		c = end;
+	}
+	return !numbers.empty();
+}
+
+int diff(const string& recorded_file, const string& captured_file, vector<string> key_patterns, const double tolerance)
+{
+	PandaUtils::RedisSessionReader recorded, captured;
+	if(!recorded.open(recorded_file))
+	{
+		cout << recorded.error() << endl;
+		return 2;
+	}
+	if(!captured.open(captured_file))
+	{
+		cout << captured.error() << endl;
+		return 2;
+	}
+	if(key_patterns.empty())
+	{
+		key_patterns = {"::actuators::", "::controller::"};
+	}
+
+	struct KeyDiff {
+		KeyDiff() : n_recorded(0), n_captured(0), n_different(0), max_difference(0), squared_differences(0), first_different(-1) {}
+		// values of the captured session not compared yet
+		vector<string> pending;
+		unsigned long n_recorded;
+		unsigned long n_captured;
+		unsigned long n_different;
+		double max_difference;
+		double squared_differences;
+		double first_different;
+	};
+	map<string, KeyDiff> keys;
+
+	// the captured updates, then the recorded ones compared in order
+	PandaUtils::RedisSessionReader::Update update;
+	while(captured.next(update))
+	{
+		const string& key = captured.key(update.key_id);
+		if(containsOne(key, key_patterns))
+		{
+			keys[key].pending.push_back(update.value);
+			keys[key].n_captured++;
+		}
+	}
+	vector<double> recorded_numbers, captured_numbers;
+	while(recorded.next(update))
+	{
+		const string& key = recorded.key(update.key_id);
+		if(!containsOne(key, key_patterns))
+		{
+			continue;
+		}
+		KeyDiff& key_diff = keys[key];
+		const unsigned long i = key_diff.n_recorded++;
+		if(i >= key_diff.pending.size())
+		{
+			continue;
+		}
+		const string& captured_value = key_diff.pending[i];
+		double difference = 0;
+		if(parseNumbers(update.value, recorded_numbers) && parseNumbers(captured_value, captured_numbers)
+				&& recorded_numbers.size() == captured_numbers.size())
+		{
+			for(unsigned int j=0 ; j<recorded_numbers.size() ; j++)
+			{
+				difference = max(difference, fabs(recorded_numbers[j] - captured_numbers[j]));
+			}
+		}
+		else if(update.value != captured_value)
+		{
+			difference = INFINITY;
+		}
+		key_diff.max_difference = max(key_diff.max_difference, difference);
+		key_diff.squared_differences += isinf(difference) ? 0 : difference * difference;
+		if(difference > tolerance)
+		{
+			if(key_diff.n_different++ == 0)
+			{
+				key_diff.first_different = update.time;
+			}
+		}
+	}
+
+	bool f_different = false;
+	for(const auto& entry : keys)
+	{
+		const KeyDiff& key_diff = entry.second;
+		const unsigned long n_compared = min(key_diff.n_recorded, key_diff.n_captured);
+		cout << entry.first << " : " << key_diff.n_recorded << " recorded, " << key_diff.n_captured << " captured";
+		if(n_compared > 0)
+		{
+			cout << ", max difference " << key_diff.max_difference << ", rms " << sqrt(key_diff.squared_differences / n_compared);
+		}
+		if(key_diff.n_different > 0)
+		{
+			cout << ", " << key_diff.n_different << " above " << tolerance << " from t = " << key_diff.first_different << " s";
+		}
+		cout << endl;
+		f_different = f_different || key_diff.n_different > 0 || key_diff.n_recorded != key_diff.n_captured;
+	}
+	if(keys.empty())
+	{
+		cout << "no key to compare" << endl;
+	}
+	return f_different ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+	const string usage = string("usage :\n")
+			+ "  " + argv[0] + " record session.rses [--host h] [-p prefix]...\n"
+			+ "  " + argv[0] + " replay session.rses [captured.rses] [--host h] [-speed x] [-lockstep key_prefix] [-outputs pattern,...] [-step_key key]\n"
+			+ "  " + argv[0] + " diff recorded.rses captured.rses [-keys pattern,...] [-tol x]";
+	if(argc < 3)
+	{
+		cout << usage << endl;
+		return 2;
+	}
+	const string mode = argv[1];
+	vector<string> files = {argv[2]};
+	string host = "127.0.0.1";
+	vector<string> prefixes;
+	double speed = 1.0;
+	string lockstep_prefix;
+	vector<string> output_patterns = {"::actuators::", "::controller::"};
+	string step_key;
+	vector<string> key_patterns;
+	double tolerance = 1e-9;
+	for(int i=3 ; i<argc ; i++)
+	{
+		const string arg = argv[i];
+		if(arg[0] != '-')
+		{
+			files.push_back(arg);
+			continue;
+		}
+		if(i + 1 >= argc)
+		{
+			cout << "missing value of option " << arg << endl;
+			return 2;
+		}
+		const string value = argv[++i];
+		if(arg == "--host")
+		{
+			host = value;
+		}
+		else if(arg == "-p")
+		{
+			prefixes.push_back(value);
+		}
+		else if(arg == "-speed")
+		{
+			speed = atof(value.c_str());
+		}
+		else if(arg == "-lockstep")
+		{
+			lockstep_prefix = value;
+		}
+		else if(arg == "-outputs")
+		{
+			output_patterns = splitList(value);
+		}
+		else if(arg == "-step_key")
+		{
+			step_key = value;
+		}
+		else if(arg == "-keys")
+		{
+			key_patterns = splitList(value);
+		}
+		else if(arg == "-tol")
+		{
+			tolerance = atof(value.c_str());
+		}
+		else
+		{
+			cout << "unknown option " << arg << endl;
+			return 2;
+		}
+	}
+
+	signal(SIGABRT, &sighandler);
+	signal(SIGTERM, &sighandler);
+	signal(SIGINT, &sighandler);
+
+	if(mode == "record" && files.size() == 1)
+	{
+		return record(files[0], host, prefixes);
+	}
+	if(mode == "replay" && files.size() <= 2 && speed > 0)
+	{
+		return replay(files[0], files.size() == 2 ? files[1] : "", host, speed, lockstep_prefix, output_patterns, step_key);
+	}
+	if(mode == "diff" && files.size() == 2)
+	{
+		return diff(files[0], files[1], key_patterns, tolerance);
+	}
+	cout << usage << endl;
+	return 2;
+}
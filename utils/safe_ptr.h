@@ -74,7 +74,7 @@ namespace sf {
             template<typename, typename, typename, typename> friend class safe_obj;
             template<typename some_type> friend struct xlocked_safe_ptr;
             template<typename some_type> friend struct slocked_safe_ptr;
-            template<typename, typename, size_t, size_t> friend class lock_timed_transaction;
+            template<size_t, typename, size_t, size_t> friend class lock_timed_any;
 #if (_MSC_VER && _MSC_VER == 1900)
             template<class... mutex_types> friend class std::lock_guard;  // MSVS2015
 #else
@@ -148,7 +148,7 @@ namespace sf {
             template<typename... Args> safe_hide_ptr(Args... args) : safe_ptr<T, mutex_t, x_lock_t, s_lock_t>(args...) {}
 
             friend struct link_safe_ptrs;
-            template<typename, typename, size_t, size_t> friend class lock_timed_transaction;
+            template<size_t, typename, size_t, size_t> friend class lock_timed_any;
             template<typename some_type> friend struct xlocked_safe_ptr;
             template<typename some_type> friend struct slocked_safe_ptr;
 
@@ -170,7 +170,7 @@ namespace sf {
             explicit operator T() const { return static_cast< safe_obj<T, mutex_t, x_lock_t, s_lock_t> >(*this); };
 
             friend struct link_safe_ptrs;
-            template<typename, typename, size_t, size_t> friend class lock_timed_transaction;
+            template<size_t, typename, size_t, size_t> friend class lock_timed_any;
             template<typename some_type> friend struct xlocked_safe_ptr;
             template<typename some_type> friend struct slocked_safe_ptr;
 
@@ -0,0 +1,185 @@
+#ifndef UTILS_SHM_SHARED_MEMORY_SLOT_H_
+#define UTILS_SHM_SHARED_MEMORY_SLOT_H_
+
+// Lock-free single writer / multiple reader exchange of an Eigen matrix
+// between processes on the same host, through a POSIX shared memory
+// segment protected by a seqlock.
+//
+// the writer bumps the sequence number to an odd value, copies the data
+// and bumps it again to an even value. readers copy the data and retry if
+// the sequence number was odd or changed during the copy. neither side
+// ever blocks the other.
+//
+// one slot is used per hot key (q, dq, torques). the segment name is
+// derived from the redis key so both processes can keep using the same
+// key constants:
+//
+//   PandaUtils::SharedMemorySlot q_slot(JOINT_ANGLES_KEY);
+//   q_slot.write(robot->_q);          // simviz
+//   q_slot.read(robot->_q);           // controller
+
+#include <Eigen/Dense>
+
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace PandaUtils {
+
+class SharedMemorySlot {
+public:
+
+	// maximum number of doubles in one slot (enough for the 2 arm mass matrix)
+	static const uint32_t MAX_SLOT_SIZE = 512;
+
+	// open the slot, creating it if the other process has not done it yet
+	SharedMemorySlot(const std::string& key)
+	: _name(segmentName(key)), _fd(-1), _data(NULL), _last_read_sequence(0)
+	{
+		_fd = shm_open(_name.c_str(), O_CREAT | O_RDWR, 0666);
+		if(_fd < 0)
+		{
+			throw std::runtime_error("SharedMemorySlot: could not open shared memory segment " + _name + "\n");
+		}
+		struct stat segment_stat;
+		if(fstat(_fd, &segment_stat) != 0 ||
+			(segment_stat.st_size < (off_t) sizeof(SlotData) && ftruncate(_fd, sizeof(SlotData)) != 0))
+		{
+			close(_fd);
+			throw std::runtime_error("SharedMemorySlot: could not size shared memory segment " + _name + "\n");
+		}
+		void* ptr = mmap(NULL, sizeof(SlotData), PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+		if(ptr == MAP_FAILED)
+		{
+			close(_fd);
+			throw std::runtime_error("SharedMemorySlot: could not map shared memory segment " + _name + "\n");
+		}
+		// newly created segments are zero filled, which is a valid empty slot
+		_data = static_cast<SlotData*>(ptr);
+	}
+
+	~SharedMemorySlot()
+	{
+		munmap(_data, sizeof(SlotData));
+		close(_fd);
+	}
+
+	// remove the segment from the system. call from the process that owns the key (usually simviz)
+	void unlink()
+	{
+		shm_unlink(_name.c_str());
+	}
+
+	// single writer only
+	template<typename Derived>
+	void write(const Eigen::MatrixBase<Derived>& value)
+	{
+		const uint32_t size = value.size();
+		if(size > MAX_SLOT_SIZE)
+		{
+			throw std::invalid_argument("SharedMemorySlot::write() value too large for slot " + _name + "\n");
+		}
+		const uint32_t seq = _data->sequence.load(std::memory_order_relaxed);
+		_data->sequence.store(seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		_data->rows = value.rows();
+		_data->cols = value.cols();
+		Eigen::Map<Eigen::Matrix<double, Derived::RowsAtCompileTime, Derived::ColsAtCompileTime> >(
+				_data->values, value.rows(), value.cols()) = value;
+
+		_data->sequence.store(seq + 2, std::memory_order_release);
+	}
+
+	// copy the latest value into output. returns false if nothing was ever written.
+	// fixed size and block outputs must have the size of the written value.
+	template<typename Derived>
+	bool read(const Eigen::MatrixBase<Derived>& output)
+	{
+		Eigen::MatrixBase<Derived>& out = const_cast<Eigen::MatrixBase<Derived>&>(output);
+		double buffer[MAX_SLOT_SIZE];
+		uint32_t rows, cols, seq_before, seq_after;
+		do
+		{
+			seq_before = _data->sequence.load(std::memory_order_acquire);
+			if(seq_before == 0)
+			{
+				return false;
+			}
+			rows = _data->rows;
+			cols = _data->cols;
+			if(rows * cols > MAX_SLOT_SIZE)
+			{
+				// torn header, retry
+				seq_after = seq_before + 1;
+				continue;
+			}
+			std::memcpy(buffer, _data->values, sizeof(double) * rows * cols);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			seq_after = _data->sequence.load(std::memory_order_relaxed);
+		} while((seq_before & 1) || seq_before != seq_after);
+
+		if(out.rows() != rows || out.cols() != cols)
+		{
+			out.derived().resize(rows, cols);
+		}
+		out = Eigen::Map<Eigen::MatrixXd>(buffer, rows, cols);
+		_last_read_sequence = seq_before;
+		return true;
+	}
+
+	// true if the writer published a value since the last successful read()
+	bool hasNewData() const
+	{
+		const uint32_t seq = _data->sequence.load(std::memory_order_acquire);
+		return seq != 0 && seq != _last_read_sequence;
+	}
+
+	// sleep until the first value is published
+	void waitForData(const unsigned int sleep_us = 100) const
+	{
+		while(_data->sequence.load(std::memory_order_acquire) == 0)
+		{
+			usleep(sleep_us);
+		}
+	}
+
+private:
+
+	struct SlotData {
+		std::atomic<uint32_t> sequence;
+		uint32_t rows;
+		uint32_t cols;
+		uint32_t padding;
+		double values[MAX_SLOT_SIZE];
+	};
+
+	// POSIX shared memory names must start with a slash and contain no other one
+	static std::string segmentName(const std::string& key)
+	{
+		std::string name = "/sai2";
+		for(unsigned int i=0 ; i<key.size() ; i++)
+		{
+			const char c = key[i];
+			name += (isalnum(c) || c == '_' || c == '.') ? c : '_';
+		}
+		return name;
+	}
+
+	std::string _name;
+	int _fd;
+	SlotData* _data;
+	uint32_t _last_read_sequence;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_SHM_SHARED_MEMORY_SLOT_H_
@@ -0,0 +1,235 @@
+#ifndef UTILS_SIM_ADAPTIVE_STEPPER_H_
+#define UTILS_SIM_ADAPTIVE_STEPPER_H_
+
+// Adaptive substeps of the integration of a simviz, fine only when the robots are in contact.
+//
+// the simulation loop still runs at its fixed rate, and publishes the robot state once
+// per loop, but the integration of a loop period is done in one step in free space, and
+// in substeps when a monitored link of a robot was in contact after the last loop : of
+// at most max_contact_dt, and shorter when the links in contact move fast, so that they
+// travel at most max_contact_travel per substep. the fine steps are kept hold_steps loops
+// after the last contact, for the contacts that come and go on a rough surface :
+//
+//   const bool f_adaptive = PandaUtils::AdaptiveStepper::requested(argc, argv);   // simviz --adaptive-substeps
+//   PandaUtils::AdaptiveStepper stepper(sim, robot_name, robot);
+//   while(fSimulationRunning)
+//   {
+//       sim->setJointTorques(robot_name, command_torques);
+//       stepper.integrate(loop_dt);                      // instead of sim->integrate(loop_dt), if f_adaptive
+//       sim->getJointPositions(robot_name, robot->_q);
+//       ...
+//       robot->updateKinematics();                       // the speeds of the links use the model
+//   }
+//
+// the joint torques are held over the substeps. the first step of a new contact is done
+// with the free space step, which should stay stable for the impacts, e.g. 1 ms.
+
+#include "Sai2Model.h"
+#include "Sai2Simulation.h"
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+struct AdaptiveStepperParameters
+{
+	// longest step in free space, a longer loop period is split
+	double max_free_dt;
+	// longest step in contact
+	double max_contact_dt;
+	// m per step of a link in contact
+	double max_contact_travel;
+	int max_substeps;
+	// loops in contact mode after the last contact
+	int hold_steps;
+
+	AdaptiveStepperParameters()
+	: max_free_dt(0.001),
+	  max_contact_dt(0.00025),
+	  max_contact_travel(0.0002),
+	  max_substeps(16),
+	  hold_steps(20)
+	{}
+};
+
+class AdaptiveStepper {
+public:
+
+	AdaptiveStepper(Simulation::Sai2Simulation* sim, const std::vector<std::string>& robot_names,
+			const std::vector<Sai2Model::Sai2Model*>& robots, const std::vector<std::string>& link_names = pandaLinks(),
+			const AdaptiveStepperParameters& parameters = AdaptiveStepperParameters())
+	: _sim(sim),
+	  _robot_names(robot_names),
+	  _robots(robots),
+	  _link_names(link_names),
+	  _parameters(parameters),
+	  _steps_since_contact(parameters.hold_steps + 1),
+	  _in_contact(false),
+	  _n_loops(0),
+	  _n_contact_loops(0),
+	  _n_substeps(0)
+	{
+		initialize();
+	}
+
+	AdaptiveStepper(Simulation::Sai2Simulation* sim, const std::string& robot_name, Sai2Model::Sai2Model* robot,
+			const std::vector<std::string>& link_names = pandaLinks(),
+			const AdaptiveStepperParameters& parameters = AdaptiveStepperParameters())
+	: _sim(sim),
+	  _robot_names(1, robot_name),
+	  _robots(1, robot),
+	  _link_names(link_names),
+	  _parameters(parameters),
+	  _steps_since_contact(parameters.hold_steps + 1),
+	  _in_contact(false),
+	  _n_loops(0),
+	  _n_contact_loops(0),
+	  _n_substeps(0)
+	{
+		initialize();
+	}
+
+	// --adaptive-substeps in the command line arguments
+	static bool requested(const int argc, char** argv)
+	{
+		for(int i=1 ; i<argc ; i++)
+		{
+			if(std::string(argv[i]) == "--adaptive-substeps")
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static std::vector<std::string> pandaLinks()
+	{
+		return {"link1", "link2", "link3", "link4", "link5", "link6", "link7"};
+	}
+
+	// integrates the loop period dt, returns the number of steps
+	int integrate(const double dt)
+	{
+		if(dt <= 0)
+		{
+			return 0;
+		}
+		const bool fine = _steps_since_contact <= _parameters.hold_steps;
+		double step_dt = _parameters.max_free_dt;
+		if(fine)
+		{
+			step_dt = _parameters.max_contact_dt;
+			if(_contact_speed * step_dt > _parameters.max_contact_travel)
+			{
+				step_dt = _parameters.max_contact_travel / _contact_speed;
+			}
+		}
+		const int n_steps = std::min(std::max(1, (int)std::ceil(dt / step_dt - 1e-9)), _parameters.max_substeps);
+		for(int i=0 ; i<n_steps ; i++)
+		{
+			_sim->integrate(dt / n_steps);
+		}
+
+		updateContacts();
+		_n_loops++;
+		_n_substeps += n_steps;
+		if(fine)
+		{
+			_n_contact_loops++;
+		}
+		return n_steps;
+	}
+
+	// a monitored link was in contact after the last loop
+	bool inContact() const
+	{
+		return _in_contact;
+	}
+
+	// fastest monitored link in contact after the last loop, m/s
+	double contactSpeed() const
+	{
+		return _contact_speed;
+	}
+
+	double meanSubsteps() const
+	{
+		return _n_loops == 0 ? 0.0 : (double)_n_substeps / _n_loops;
+	}
+
+	// fraction of the loops integrated with the contact steps
+	double contactFraction() const
+	{
+		return _n_loops == 0 ? 0.0 : (double)_n_contact_loops / _n_loops;
+	}
+
+private:
+
+	void initialize()
+	{
+		if(_robot_names.size() != _robots.size())
+		{
+			throw std::invalid_argument("one robot model per robot name in AdaptiveStepper::AdaptiveStepper()\n");
+		}
+		if(_parameters.max_free_dt <= 0 || _parameters.max_contact_dt <= 0 || _parameters.max_contact_travel <= 0
+				|| _parameters.max_substeps < 1 || _parameters.hold_steps < 0)
+		{
+			throw std::invalid_argument("invalid parameters in AdaptiveStepper::AdaptiveStepper()\n");
+		}
+		_contact_speed = 0;
+		_J.resize(_robots.size());
+		for(unsigned int i=0 ; i<_robots.size() ; i++)
+		{
+			_J[i].setZero(3, _robots[i]->dof());
+		}
+	}
+
+	void updateContacts()
+	{
+		_in_contact = false;
+		_contact_speed = 0;
+		for(unsigned int i=0 ; i<_robots.size() ; i++)
+		{
+			for(unsigned int j=0 ; j<_link_names.size() ; j++)
+			{
+				_sim->getContactList(_contact_points, _contact_forces, _robot_names[i], _link_names[j]);
+				if(_contact_points.empty())
+				{
+					continue;
+				}
+				_in_contact = true;
+				// of the link frame, from the model of the last loop
+				_robots[i]->Jv(_J[i], _link_names[j], Eigen::Vector3d::Zero());
+				_contact_speed = std::max(_contact_speed, (_J[i] * _robots[i]->_dq).norm());
+			}
+		}
+		_steps_since_contact = _in_contact ? 0 : std::min(_steps_since_contact + 1, _parameters.hold_steps + 1);
+	}
+
+	Simulation::Sai2Simulation* _sim;
+	const std::vector<std::string> _robot_names;
+	const std::vector<Sai2Model::Sai2Model*> _robots;
+	const std::vector<std::string> _link_names;
+	const AdaptiveStepperParameters _parameters;
+
+	int _steps_since_contact;
+	bool _in_contact;
+	double _contact_speed;
+
+	std::vector<Eigen::MatrixXd> _J;
+	std::vector<Eigen::Vector3d> _contact_points;
+	std::vector<Eigen::Vector3d> _contact_forces;
+
+	unsigned long long _n_loops;
+	unsigned long long _n_contact_loops;
+	unsigned long long _n_substeps;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_SIM_ADAPTIVE_STEPPER_H_
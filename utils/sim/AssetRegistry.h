@@ -0,0 +1,237 @@
+#ifndef UTILS_SIM_ASSET_REGISTRY_H_
+#define UTILS_SIM_ASSET_REGISTRY_H_
+
+// Process-wide registry of the simulations and robot models of a batch run, built once per
+// thread of the run and reused by the next scenarios, instead of parsed again for each one.
+//
+// a scenario of a BatchRunner builds a Sai2Simulation and its Sai2Models from the world and
+// robot files, which parses the urdf files and loads the collision meshes, then deletes them
+// after a few seconds of simulation. the registry leases the instances instead : a lease
+// takes an idle instance of its key (a file) or builds one, and gives it back to the registry
+// when it goes out of scope, for the next scenario. a leased simulation is restored to the
+// state it had when it was built, the joint positions and velocities of the robots and the
+// poses of the objects (see sim/SimSnapshot.h) :
+//
+//   SweepMetrics runScenario(const SweepParameters& parameters)
+//   {
+//       PandaUtils::AssetRegistry::Lease<PandaUtils::SimulationAsset> sim_asset = PandaUtils::leaseSimulation(world_file, {robot_name});
+//       Simulation::Sai2Simulation* sim = sim_asset->sim.get();
+//       sim->setCoeffFrictionStatic(parameters.friction);              // every parameter the scenario changes
+//       PandaUtils::AssetRegistry::Lease<Sai2Model::Sai2Model> robot = PandaUtils::leaseModel(robot_file);
+//       ...
+//       if(metrics.diverged)
+//       {
+//           sim_asset.discard();                                       // deleted, not given back
+//       }
+//       return metrics;
+//   }
+//
+// a sweep then builds as many instances as it has threads, not one per scenario. a scenario
+// sets every parameter of the simulation it changes (friction, restitution, gravity), and
+// the state of a model (_q, _dq) before its first update. each SAI2 instance keeps its own
+// copy of the parsed robot and of the meshes, the idle instances stay in memory until
+// clear(). an instance is leased to one scenario at a time, from any thread.
+
+#include "Sai2Model.h"
+#include "Sai2Simulation.h"
+#include "sim/SimSnapshot.h"
+
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+namespace PandaUtils {
+
+class AssetRegistry {
+public:
+
+	// an instance leased from the registry, given back when the lease is destroyed
+	template<typename T>
+	class Lease {
+	public:
+
+		Lease(Lease&& other)
+		: _registry(other._registry),
+		  _key(std::move(other._key)),
+		  _asset(std::move(other._asset)),
+		  _discarded(std::move(other._discarded))
+		{}
+
+		~Lease()
+		{
+			if(_asset)
+			{
+				_registry->giveBack(_key, _asset);
+			}
+		}
+
+		T* get() const { return _asset.get(); }
+		T* operator->() const { return _asset.get(); }
+		T& operator*() const { return *_asset; }
+
+		// for an instance in a state the next scenarios should not start from, e.g. after
+		// the simulation diverged. it is deleted when the lease is destroyed
+		void discard()
+		{
+			_discarded = _asset;
+			_asset.reset();
+		}
+
+	private:
+		friend class AssetRegistry;
+
+		Lease(AssetRegistry* registry, const std::string& key, const std::shared_ptr<T>& asset)
+		: _registry(registry),
+		  _key(key),
+		  _asset(asset)
+		{}
+
+		Lease(const Lease&);
+		Lease& operator=(const Lease&);
+
+		AssetRegistry* _registry;
+		std::string _key;
+		std::shared_ptr<T> _asset;
+		std::shared_ptr<T> _discarded;
+	};
+
+	AssetRegistry()
+	: _n_built(0),
+	  _n_leases(0)
+	{}
+
+	static AssetRegistry& shared()
+	{
+		static AssetRegistry registry;
+		return registry;
+	}
+
+	// an idle instance of T for the key, or a new one from build when there is none. build
+	// runs on the calling thread, without the lock of the registry
+	template<typename T>
+	Lease<T> lease(const std::string& key, const std::function<T*()>& build)
+	{
+		const std::string typed_key = std::string(typeid(T).name()) + " " + key;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_n_leases++;
+			std::vector<std::shared_ptr<void>>& idle = _idle[typed_key];
+			if(!idle.empty())
+			{
+				std::shared_ptr<T> asset = std::static_pointer_cast<T>(idle.back());
+				idle.pop_back();
+				return Lease<T>(this, typed_key, asset);
+			}
+		}
+		std::shared_ptr<T> asset(build());
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_n_built++;
+		}
+		return Lease<T>(this, typed_key, asset);
+	}
+
+	// deletes the idle instances, the leased ones are deleted when given back after it
+	void clear()
+	{
+		std::map<std::string, std::vector<std::shared_ptr<void>>> idle;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			idle.swap(_idle);
+		}
+	}
+
+	unsigned long long numBuilt() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _n_built;
+	}
+
+	unsigned long long numLeases() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _n_leases;
+	}
+
+	int numIdle() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		int n = 0;
+		for(const auto& idle : _idle)
+		{
+			n += idle.second.size();
+		}
+		return n;
+	}
+
+	void print(std::ostream& os) const
+	{
+		os << "assets : " << numBuilt() << " built for " << numLeases() << " leases, " << numIdle() << " idle\n";
+	}
+
+private:
+	AssetRegistry(const AssetRegistry&);
+	AssetRegistry& operator=(const AssetRegistry&);
+
+	void giveBack(const std::string& typed_key, const std::shared_ptr<void>& asset)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_idle[typed_key].push_back(asset);
+	}
+
+	mutable std::mutex _mutex;
+	std::map<std::string, std::vector<std::shared_ptr<void>>> _idle;
+	unsigned long long _n_built;
+	unsigned long long _n_leases;
+};
+
+// a simulation with the state of its world file
+struct SimulationAsset
+{
+	std::unique_ptr<Simulation::Sai2Simulation> sim;
+	SimSnapshot initial_state;
+
+	SimulationAsset(const std::string& world_file, const std::vector<std::string>& robot_names,
+			const std::vector<std::string>& object_names)
+	: sim(new Simulation::Sai2Simulation(world_file, false))
+	{
+		initial_state.capture(sim.get(), robot_names, object_names, 0);
+	}
+};
+
+// a simulation of the world file, in the state of the file for the robots and objects named
+inline AssetRegistry::Lease<SimulationAsset> leaseSimulation(const std::string& world_file,
+		const std::vector<std::string>& robot_names, const std::vector<std::string>& object_names = std::vector<std::string>(),
+		AssetRegistry& registry = AssetRegistry::shared())
+{
+	std::string key = world_file;
+	for(unsigned int i=0 ; i<robot_names.size() ; i++)
+	{
+		key += " robot " + robot_names[i];
+	}
+	for(unsigned int i=0 ; i<object_names.size() ; i++)
+	{
+		key += " object " + object_names[i];
+	}
+	AssetRegistry::Lease<SimulationAsset> asset = registry.lease<SimulationAsset>(key,
+			[&]() { return new SimulationAsset(world_file, robot_names, object_names); });
+	asset->initial_state.restore(asset->sim.get());
+	return asset;
+}
+
+inline AssetRegistry::Lease<Sai2Model::Sai2Model> leaseModel(const std::string& robot_file,
+		AssetRegistry& registry = AssetRegistry::shared())
+{
+	return registry.lease<Sai2Model::Sai2Model>(robot_file,
+			[&]() { return new Sai2Model::Sai2Model(robot_file, false); });
+}
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_SIM_ASSET_REGISTRY_H_
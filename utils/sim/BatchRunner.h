@@ -0,0 +1,149 @@
+#ifndef UTILS_SIM_BATCH_RUNNER_H_
+#define UTILS_SIM_BATCH_RUNNER_H_
+
+// Parallel runs of independent simulation and controller pairs, for parameter sweeps.
+//
+// a scenario builds its own Sai2Simulation, robot models and controller from one
+// parameter set, steps the controller and the simulation in lockstep in its thread,
+// exchanging the robot state and the torques through an InMemoryTransport instead of
+// redis, and returns its summary metrics. the runner gives the scenarios to the threads
+// of a WorkerPool as they finish the previous ones, so one process can use all the
+// cores of the machine for a sweep :
+//
+//   struct Gains { double kp, kv, friction; };
+//   struct Metrics { double rms_error, max_torque; };
+//   PandaUtils::BatchRunner<Gains, Metrics> runner(32);
+//   std::vector<Gains> sweep = ...;
+//   auto results = runner.run(sweep, [](const Gains& gains, const int index)
+//   {
+//       Metrics metrics;
+//       auto sim = new Simulation::Sai2Simulation(world_file, false);
+//       sim->setCoeffFrictionStatic(gains.friction);
+//       ...   // controller step, then simulation step, through an InMemoryTransport
+//       return metrics;
+//   });
+//   // results[i] is the result of sweep[i]
+//
+// nothing is shared between the scenarios, they must not use the global redis client.
+// an exception thrown by a scenario fails its result and does not stop the others.
+
+#include "threads/WorkerPool.h"
+#include <Eigen/Dense>
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+// sensed state and command torques of one simulation and controller pair, written by the
+// simulation step and by the controller step of the same thread
+struct InMemoryTransport
+{
+	Eigen::VectorXd q;
+	Eigen::VectorXd dq;
+	Eigen::VectorXd command_torques;
+	// sim time of the state
+	double time;
+	unsigned long long step;
+
+	InMemoryTransport(const int sensed_dof, const int command_dof)
+	: q(Eigen::VectorXd::Zero(sensed_dof)),
+	  dq(Eigen::VectorXd::Zero(sensed_dof)),
+	  command_torques(Eigen::VectorXd::Zero(command_dof)),
+	  time(0),
+	  step(0)
+	{}
+};
+
+template<typename Parameters, typename Metrics>
+class BatchRunner {
+public:
+
+	struct Result
+	{
+		// index of the parameter set given to run()
+		int index;
+		bool success;
+		// message of the exception of a failed scenario
+		std::string error;
+		double wall_time;
+		Metrics metrics;
+	};
+
+	typedef std::function<Metrics(const Parameters& parameters, const int index)> Scenario;
+
+	// n_threads counts the calling thread, see WorkerPool
+	BatchRunner(const int n_threads, const std::vector<int>& cpus = std::vector<int>())
+	: _pool(n_threads, cpus),
+	  _verbose(true)
+	{}
+
+	// prints a line per finished scenario
+	void setVerbose(const bool verbose)
+	{
+		_verbose = verbose;
+	}
+
+	int numThreads() const
+	{
+		return _pool.size();
+	}
+
+	// results of all the parameter sets, in their order
+	std::vector<Result> run(const std::vector<Parameters>& parameter_sets, const Scenario& scenario)
+	{
+		const int n_scenarios = parameter_sets.size();
+		std::vector<Result> results(n_scenarios);
+		std::atomic<int> next_scenario(0);
+		std::atomic<int> n_done(0);
+		std::mutex print_mutex;
+
+		// the scenarios can take very different times, e.g. when one diverges early
+		auto job = [&](const int index, const int n_threads)
+		{
+			int i;
+			while((i = next_scenario.fetch_add(1)) < n_scenarios)
+			{
+				Result& result = results[i];
+				result.index = i;
+				result.success = true;
+				const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				try
+				{
+					result.metrics = scenario(parameter_sets[i], i);
+				}
+				catch(const std::exception& e)
+				{
+					result.success = false;
+					result.error = e.what();
+				}
+				result.wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+				const int done = n_done.fetch_add(1) + 1;
+				if(_verbose)
+				{
+					std::lock_guard<std::mutex> lock(print_mutex);
+					std::cout << "scenario " << i << " " << (result.success ? "done" : "failed : " + result.error)
+							<< " in " << result.wall_time << " s (" << done << "/" << n_scenarios << ")" << std::endl;
+				}
+			}
+		};
+		_pool.run(job);
+		return results;
+	}
+
+private:
+
+	WorkerPool _pool;
+	bool _verbose;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_SIM_BATCH_RUNNER_H_
@@ -0,0 +1,612 @@
+#ifndef UTILS_SIM_CABLE_SIMULATION_H_
+#define UTILS_SIM_CABLE_SIMULATION_H_
+
+// Discrete cable, simulated next to the Sai2Simulation world with position based dynamics.
+//
+// the cable is a chain of particles, with stretch constraints between the neighbours and
+// bending constraints between every other particle (xpbd, with small substeps). it
+// collides with planes and spheres of the environment (e.g. the floor and spheres on the
+// robot links, moved every step), and with itself through a spatial hash of the
+// particles. a particle can be attached to a target, e.g. a fixed plug or the fingers of
+// a gripper : the attachment moves the particle with the target and measures the force
+// of the cable on the target, to apply to the robot in the simulation :
+//
+//   PandaUtils::CableSimulation::Parameters parameters;           // 100 segments
+//   PandaUtils::CableSimulation cable(start, end, parameters);
+//   cable.addPlane(Eigen::Vector3d::UnitZ(), floor_height);
+//   cable.attach(0, start);                                       // plugged end
+//   int grasp = cable.attach(cable.nearestParticle(gripper_position), gripper_position);
+//
+//   cable.setAttachmentTarget(grasp, gripper_position);           // simulation thread, every step
+//   cable.step(sim_dt);
+//   command_torques += J_gripper.transpose() * cable.attachmentForce(grasp);
+//   cable.publish();
+//
+//   if(cable.readPositions(particle_positions)) { ... }           // rendering loop
+//
+// a rigid attachment (compliance 0) makes its particle kinematic, it follows the target
+// from its previous position over the substeps. the self collisions are solved once per
+// step, the cable moves much less than its radius in a step at the sim rates. a step of
+// 100 segments with 10 substeps takes about 100 microseconds and allocates nothing.
+
+#include "threads/TripleBuffer.h"
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+class CableSimulation {
+public:
+
+	struct Parameters
+	{
+		int n_segments;
+		// kg, spread on the particles
+		double mass;
+		// m, for the collisions
+		double radius;
+		// m/N, xpbd compliance of the stretch and bending constraints, 0 for inextensible
+		double stretch_compliance;
+		double bend_compliance;
+		// fraction of the velocity lost per second
+		double damping;
+		// fraction of the tangential motion removed at a contact
+		double friction;
+		int n_substeps;
+		bool self_collision;
+		Eigen::Vector3d gravity;
+
+		Parameters()
+		: n_segments(100),
+		  mass(0.3),
+		  radius(0.006),
+		  stretch_compliance(0),
+		  bend_compliance(1e-5),
+		  damping(0.5),
+		  friction(0.5),
+		  n_substeps(10),
+		  self_collision(true),
+		  gravity(0, 0, -9.81)
+		{}
+	};
+
+	// straight cable from start towards end, of the distance between them or of length if it is larger
+	CableSimulation(const Eigen::Vector3d& start, const Eigen::Vector3d& end,
+			const Parameters& parameters = Parameters(), const double length = 0)
+	: _parameters(parameters)
+	{
+		const int n_particles = parameters.n_segments + 1;
+		if(parameters.n_segments < 2 || parameters.mass <= 0 || parameters.radius <= 0 || parameters.n_substeps < 1
+				|| parameters.stretch_compliance < 0 || parameters.bend_compliance < 0)
+		{
+			throw std::invalid_argument("invalid cable parameters in CableSimulation::CableSimulation()\n");
+		}
+		const double straight_length = (end - start).norm();
+		const double cable_length = std::max(length, straight_length);
+		if(cable_length <= 0)
+		{
+			throw std::invalid_argument("cable of zero length in CableSimulation::CableSimulation()\n");
+		}
+		_segment_length = cable_length / parameters.n_segments;
+		_particle_mass = parameters.mass / n_particles;
+
+		const Eigen::Vector3d direction = straight_length > 0 ? Eigen::Vector3d((end - start) / straight_length) : Eigen::Vector3d::UnitX();
+		for(int i=0 ; i<n_particles ; i++)
+		{
+			_positions.push_back(start + i * _segment_length * direction);
+		}
+		_velocities.assign(n_particles, Eigen::Vector3d::Zero());
+		_previous_positions = _positions;
+		_inverse_masses.assign(n_particles, 1.0 / _particle_mass);
+		_constraint_forces.assign(n_particles, Eigen::Vector3d::Zero());
+
+		// cells of the size of a contact, a table of twice the particles
+		_hash_cell_size = 2 * parameters.radius;
+		_hash_table_size = 2 * n_particles;
+		_hash_cell_start.assign(_hash_table_size + 1, 0);
+		_hash_particles.assign(n_particles, 0);
+		_particle_cells.assign(n_particles, 0);
+
+		_render_buffer.reset(_positions);
+	}
+
+	// collision with the half space normal^T x >= offset
+	int addPlane(const Eigen::Vector3d& normal, const double offset)
+	{
+		Plane plane;
+		plane.normal = normal.normalized();
+		plane.offset = offset / normal.norm();
+		_planes.push_back(plane);
+		return _planes.size() - 1;
+	}
+
+	// collision with a sphere, returns its index for setSphere()
+	int addSphere(const Eigen::Vector3d& center, const double radius)
+	{
+		Sphere sphere;
+		sphere.center = center;
+		sphere.radius = radius;
+		_spheres.push_back(sphere);
+		return _spheres.size() - 1;
+	}
+
+	void setSphere(const int sphere, const Eigen::Vector3d& center)
+	{
+		checkIndex(sphere, _spheres.size(), "setSphere");
+		_spheres[sphere].center = center;
+	}
+
+	// attaches the particle to target, rigidly with a compliance of 0 (m/N). returns the index of the attachment
+	int attach(const int particle, const Eigen::Vector3d& target, const double compliance = 0)
+	{
+		checkIndex(particle, _positions.size(), "attach");
+		if(compliance < 0)
+		{
+			throw std::invalid_argument("attachment compliance should be positive in CableSimulation::attach()\n");
+		}
+		Attachment attachment;
+		attachment.particle = particle;
+		attachment.target = target;
+		attachment.previous_target = _positions[particle];
+		attachment.compliance = compliance;
+		attachment.active = true;
+		attachment.force.setZero();
+		if(compliance == 0)
+		{
+			_inverse_masses[particle] = 0;
+		}
+
+		// reuse a released attachment
+		for(unsigned int i=0 ; i<_attachments.size() ; i++)
+		{
+			if(!_attachments[i].active)
+			{
+				_attachments[i] = attachment;
+				return i;
+			}
+		}
+		_attachments.push_back(attachment);
+		return _attachments.size() - 1;
+	}
+
+	void setAttachmentTarget(const int attachment, const Eigen::Vector3d& target)
+	{
+		checkIndex(attachment, _attachments.size(), "setAttachmentTarget");
+		_attachments[attachment].target = target;
+	}
+
+	void detach(const int attachment)
+	{
+		checkIndex(attachment, _attachments.size(), "detach");
+		Attachment& detached = _attachments[attachment];
+		if(!detached.active)
+		{
+			return;
+		}
+		detached.active = false;
+		detached.force.setZero();
+		// free again unless another rigid attachment holds the particle
+		bool held = false;
+		for(unsigned int i=0 ; i<_attachments.size() ; i++)
+		{
+			held = held || (_attachments[i].active && _attachments[i].particle == detached.particle && _attachments[i].compliance == 0);
+		}
+		if(!held)
+		{
+			_inverse_masses[detached.particle] = 1.0 / _particle_mass;
+		}
+	}
+
+	// force of the cable on the target during the last step, in N
+	Eigen::Vector3d attachmentForce(const int attachment) const
+	{
+		checkIndex(attachment, _attachments.size(), "attachmentForce");
+		return _attachments[attachment].force;
+	}
+
+	// particle closest to point
+	int nearestParticle(const Eigen::Vector3d& point) const
+	{
+		int nearest = 0;
+		for(unsigned int i=1 ; i<_positions.size() ; i++)
+		{
+			if((_positions[i] - point).squaredNorm() < (_positions[nearest] - point).squaredNorm())
+			{
+				nearest = i;
+			}
+		}
+		return nearest;
+	}
+
+	void step(const double dt)
+	{
+		if(dt <= 0)
+		{
+			return;
+		}
+		const int n_particles = _positions.size();
+		const int n_substeps = _parameters.n_substeps;
+		const double h = dt / n_substeps;
+		const double velocity_scale = std::max(0.0, 1.0 - _parameters.damping * h);
+
+		for(unsigned int a=0 ; a<_attachments.size() ; a++)
+		{
+			_attachments[a].force.setZero();
+		}
+		std::fill(_constraint_forces.begin(), _constraint_forces.end(), Eigen::Vector3d::Zero());
+
+		for(int substep=0 ; substep<n_substeps ; substep++)
+		{
+			for(int i=0 ; i<n_particles ; i++)
+			{
+				_previous_positions[i] = _positions[i];
+				if(_inverse_masses[i] > 0)
+				{
+					_velocities[i] = velocity_scale * (_velocities[i] + h * _parameters.gravity);
+					_positions[i] += h * _velocities[i];
+				}
+			}
+			moveRigidAttachments((substep + 1.0) / n_substeps);
+
+			// forward then backward, so the corrections cross the whole cable in a substep
+			solveStretch(h, true);
+			solveStretch(h, false);
+			solveBending(h);
+			solveCompliantAttachments(h);
+			if(_parameters.self_collision && substep == n_substeps - 1)
+			{
+				solveSelfCollisions();
+			}
+			solveEnvironmentCollisions();
+
+			for(int i=0 ; i<n_particles ; i++)
+			{
+				_velocities[i] = (_positions[i] - _previous_positions[i]) / h;
+			}
+		}
+
+		// the target holds the weight of a rigidly attached particle and the cable pulls it
+		for(unsigned int a=0 ; a<_attachments.size() ; a++)
+		{
+			Attachment& attachment = _attachments[a];
+			if(!attachment.active)
+			{
+				continue;
+			}
+			if(attachment.compliance == 0)
+			{
+				attachment.force = _constraint_forces[attachment.particle] / n_substeps + _particle_mass * _parameters.gravity;
+			}
+			else
+			{
+				attachment.force /= n_substeps;
+			}
+			attachment.previous_target = attachment.target;
+		}
+	}
+
+	// simulation thread : makes the current positions available to readPositions()
+	void publish()
+	{
+		std::vector<Eigen::Vector3d>& positions = _render_buffer.writeBuffer();
+		for(unsigned int i=0 ; i<_positions.size() ; i++)
+		{
+			positions[i] = _positions[i];
+		}
+		_render_buffer.publish();
+	}
+
+	// rendering thread : latest published positions, false if there are none since the last call
+	bool readPositions(std::vector<Eigen::Vector3d>& positions)
+	{
+		return _render_buffer.read(positions);
+	}
+
+	const std::vector<Eigen::Vector3d>& positions() const
+	{
+		return _positions;
+	}
+
+	const std::vector<Eigen::Vector3d>& velocities() const
+	{
+		return _velocities;
+	}
+
+	int numParticles() const
+	{
+		return _positions.size();
+	}
+
+	// length of the cable along its particles, the rest length plus the current stretch
+	double currentLength() const
+	{
+		double length = 0;
+		for(unsigned int i=0 ; i+1<_positions.size() ; i++)
+		{
+			length += (_positions[i+1] - _positions[i]).norm();
+		}
+		return length;
+	}
+
+	double restLength() const
+	{
+		return _segment_length * _parameters.n_segments;
+	}
+
+	const Parameters& parameters() const
+	{
+		return _parameters;
+	}
+
+private:
+
+	struct Plane
+	{
+		Eigen::Vector3d normal;
+		double offset;
+	};
+
+	struct Sphere
+	{
+		Eigen::Vector3d center;
+		double radius;
+	};
+
+	struct Attachment
+	{
+		int particle;
+		Eigen::Vector3d target;
+		// target at the start of the step
+		Eigen::Vector3d previous_target;
+		double compliance;
+		bool active;
+		Eigen::Vector3d force;
+	};
+
+	template<typename Size>
+	static void checkIndex(const int index, const Size size, const char* function)
+	{
+		if(index < 0 || index >= (int)size)
+		{
+			throw std::out_of_range(std::string("invalid index in CableSimulation::") + function + "()\n");
+		}
+	}
+
+	// rigidly attached particles at the fraction of the target motion of the step
+	void moveRigidAttachments(const double fraction)
+	{
+		for(unsigned int a=0 ; a<_attachments.size() ; a++)
+		{
+			const Attachment& attachment = _attachments[a];
+			if(attachment.active && attachment.compliance == 0)
+			{
+				_positions[attachment.particle] = attachment.previous_target + fraction * (attachment.target - attachment.previous_target);
+			}
+		}
+	}
+
+	// xpbd distance constraint between i and j, with one iteration per substep, so the
+	// multiplier is not kept. the force on a kinematic particle is kept for its attachment
+	void solveDistance(const int i, const int j, const double rest_length, const double alpha, const double h)
+	{
+		const double w_i = _inverse_masses[i];
+		const double w_j = _inverse_masses[j];
+		if(w_i + w_j == 0)
+		{
+			return;
+		}
+		const Eigen::Vector3d delta = _positions[j] - _positions[i];
+		const double squared_distance = delta.squaredNorm();
+		if(squared_distance < 1e-24)
+		{
+			return;
+		}
+		// a single division, the constraints are solved in sequence
+		const double distance = std::sqrt(squared_distance);
+		const double scale = (rest_length - distance) / (distance * (w_i + w_j + alpha));
+		_positions[i] -= (scale * w_i) * delta;
+		_positions[j] += (scale * w_j) * delta;
+		if(w_i == 0)
+		{
+			_constraint_forces[i] -= (scale / (h * h)) * delta;
+		}
+		if(w_j == 0)
+		{
+			_constraint_forces[j] += (scale / (h * h)) * delta;
+		}
+	}
+
+	void solveStretch(const double h, const bool forward)
+	{
+		const int n_segments = _parameters.n_segments;
+		const double alpha = _parameters.stretch_compliance / (h * h);
+		for(int k=0 ; k<n_segments ; k++)
+		{
+			const int i = forward ? k : n_segments - 1 - k;
+			solveDistance(i, i + 1, _segment_length, alpha, h);
+		}
+	}
+
+	// every other particle, only against the compression of a bent cable
+	void solveBending(const double h)
+	{
+		const int n_particles = _positions.size();
+		const double alpha = _parameters.bend_compliance / (h * h);
+		const double rest_length = 2 * _segment_length;
+		for(int i=0 ; i+2<n_particles ; i++)
+		{
+			if((_positions[i+2] - _positions[i]).squaredNorm() < rest_length * rest_length)
+			{
+				solveDistance(i, i + 2, rest_length, alpha, h);
+			}
+		}
+	}
+
+	// the target does not move with the particle
+	void solveCompliantAttachments(const double h)
+	{
+		for(unsigned int a=0 ; a<_attachments.size() ; a++)
+		{
+			Attachment& attachment = _attachments[a];
+			const double w = _inverse_masses[attachment.particle];
+			if(!attachment.active || attachment.compliance == 0 || w == 0)
+			{
+				continue;
+			}
+			const Eigen::Vector3d error = _positions[attachment.particle] - attachment.target;
+			const Eigen::Vector3d correction = -error * w / (w + attachment.compliance / (h * h));
+			_positions[attachment.particle] += correction;
+			// the target pushes the particle by m correction / h^2, the cable pulls it back
+			attachment.force -= correction / (w * h * h);
+		}
+	}
+
+	int hashCell(const int x, const int y, const int z) const
+	{
+		const uint32_t hash = ((uint32_t)x * 92837111u) ^ ((uint32_t)y * 689287499u) ^ ((uint32_t)z * 283923481u);
+		return hash % _hash_table_size;
+	}
+
+	int cellCoordinate(const double position) const
+	{
+		return (int)std::floor(position / _hash_cell_size);
+	}
+
+	// spatial hash of the particles by counting sort, then the pairs in the 27 neighbour cells
+	void solveSelfCollisions()
+	{
+		const int n_particles = _positions.size();
+		std::fill(_hash_cell_start.begin(), _hash_cell_start.end(), 0);
+		for(int i=0 ; i<n_particles ; i++)
+		{
+			_particle_cells[i] = hashCell(cellCoordinate(_positions[i](0)), cellCoordinate(_positions[i](1)), cellCoordinate(_positions[i](2)));
+			_hash_cell_start[_particle_cells[i]]++;
+		}
+		for(int c=1 ; c<=_hash_table_size ; c++)
+		{
+			_hash_cell_start[c] += _hash_cell_start[c-1];
+		}
+		for(int i=0 ; i<n_particles ; i++)
+		{
+			_hash_particles[--_hash_cell_start[_particle_cells[i]]] = i;
+		}
+
+		const double contact_distance = 2 * _parameters.radius;
+		// the neighbours along the cable are closer than a contact at rest
+		const int min_index_distance = std::max(2, (int)std::ceil(contact_distance / _segment_length) + 1);
+		for(int i=0 ; i<n_particles ; i++)
+		{
+			const int x = cellCoordinate(_positions[i](0));
+			const int y = cellCoordinate(_positions[i](1));
+			const int z = cellCoordinate(_positions[i](2));
+			for(int dx=-1 ; dx<=1 ; dx++)
+			{
+				for(int dy=-1 ; dy<=1 ; dy++)
+				{
+					for(int dz=-1 ; dz<=1 ; dz++)
+					{
+						const int cell = hashCell(x + dx, y + dy, z + dz);
+						for(int k=_hash_cell_start[cell] ; k<_hash_cell_start[cell+1] ; k++)
+						{
+							// each pair once
+							const int j = _hash_particles[k];
+							if(j < i + min_index_distance)
+							{
+								continue;
+							}
+							const double w_i = _inverse_masses[i];
+							const double w_j = _inverse_masses[j];
+							Eigen::Vector3d direction = _positions[j] - _positions[i];
+							const double squared_distance = direction.squaredNorm();
+							if(w_i + w_j == 0 || squared_distance >= contact_distance * contact_distance || squared_distance < 1e-24)
+							{
+								continue;
+							}
+							const double distance = std::sqrt(squared_distance);
+							direction *= (contact_distance - distance) / (distance * (w_i + w_j));
+							_positions[i] -= w_i * direction;
+							_positions[j] += w_j * direction;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// projection out of the planes and spheres, with the tangential motion of the substep
+	// reduced by the friction
+	void solveEnvironmentCollisions()
+	{
+		const int n_particles = _positions.size();
+		const double radius = _parameters.radius;
+		for(int i=0 ; i<n_particles ; i++)
+		{
+			if(_inverse_masses[i] == 0)
+			{
+				continue;
+			}
+			for(unsigned int p=0 ; p<_planes.size() ; p++)
+			{
+				const double penetration = radius - (_planes[p].normal.dot(_positions[i]) - _planes[p].offset);
+				if(penetration > 0)
+				{
+					_positions[i] += penetration * _planes[p].normal;
+					applyFriction(i, _planes[p].normal);
+				}
+			}
+			for(unsigned int s=0 ; s<_spheres.size() ; s++)
+			{
+				const Eigen::Vector3d offset = _positions[i] - _spheres[s].center;
+				const double contact_distance = _spheres[s].radius + radius;
+				const double squared_distance = offset.squaredNorm();
+				if(squared_distance < contact_distance * contact_distance && squared_distance > 1e-24)
+				{
+					const Eigen::Vector3d normal = offset / std::sqrt(squared_distance);
+					_positions[i] = _spheres[s].center + contact_distance * normal;
+					applyFriction(i, normal);
+				}
+			}
+		}
+	}
+
+	void applyFriction(const int i, const Eigen::Vector3d& normal)
+	{
+		const Eigen::Vector3d motion = _positions[i] - _previous_positions[i];
+		_positions[i] -= _parameters.friction * (motion - motion.dot(normal) * normal);
+	}
+
+	const Parameters _parameters;
+	double _segment_length;
+	double _particle_mass;
+
+	std::vector<Eigen::Vector3d> _positions;
+	std::vector<Eigen::Vector3d> _velocities;
+	std::vector<Eigen::Vector3d> _previous_positions;
+	// 0 for the rigidly attached particles
+	std::vector<double> _inverse_masses;
+	// sum over the substeps of the constraint forces on the kinematic particles
+	std::vector<Eigen::Vector3d> _constraint_forces;
+
+	std::vector<Plane> _planes;
+	std::vector<Sphere> _spheres;
+	std::vector<Attachment> _attachments;
+
+	// spatial hash, cell c holds _hash_particles[_hash_cell_start[c] .. _hash_cell_start[c+1])
+	double _hash_cell_size;
+	int _hash_table_size;
+	std::vector<int> _hash_cell_start;
+	std::vector<int> _hash_particles;
+	std::vector<int> _particle_cells;
+
+	TripleBuffer<std::vector<Eigen::Vector3d>> _render_buffer;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_SIM_CABLE_SIMULATION_H_
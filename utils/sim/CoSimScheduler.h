@@ -0,0 +1,336 @@
+#ifndef UTILS_SIM_CO_SIM_SCHEDULER_H_
+#define UTILS_SIM_CO_SIM_SCHEDULER_H_
+
+// Deterministic multi rate schedule of the simulation and control threads of an app.
+//
+// instead of two free running loops, the simulation and the controller are the two
+// stages of one schedule of sim_steps_per_control simulation steps per control step.
+// the order of the stages is fixed, so the runs are the same at any time scale, and a
+// stage that waits for the other one blocks instead of sleeping on a timer. with a time
+// scale of 0, the schedule runs as fast as possible :
+//
+//   PandaUtils::CoSimScheduler scheduler(sim_dt, 2, PandaUtils::SimClock::timeScale(argc, argv),
+//           PandaUtils::CoSimScheduler::pipelined(argc, argv));        // app [--time-scale 0] [--pipelined]
+//   scheduler.setExchange([&]()                              // before the first waitForControl()
+//   {
+//       sim->getJointPositions(robot_name, robot->_q);       // state of the control step
+//       robot->updateModel();
+//   },
+//   [&]()
+//   {
+//       sim->setJointTorques(robot_name, command_torques);   // torques of the control period
+//   });
+//
+//   while(scheduler.waitForSimStep())                        // simulation thread
+//   {
+//       sim->integrate(sim_dt);
+//       scheduler.simStepDone();
+//   }
+//
+//   while(scheduler.waitForControl())                        // control thread
+//   {
+//       const double time = scheduler.controlTime();
+//       ... from the exchanged state only
+//       scheduler.controlDone();
+//   }
+//
+//   scheduler.stop();                                        // e.g. when the window is closed
+//
+// the exchanges run at the handoffs between the stages, while both are blocked, and are
+// the only place where data moves between them. sequentially, control step k computes
+// the torques from the state at k * sim_steps_per_control steps, then the simulation
+// integrates them. pipelined, control step k runs on its core while the simulation
+// integrates the torques of control step k-1, so the torques are applied one control
+// period late, as on a robot with a sample of latency. both exchanges then run at the
+// start of the period, and the stages should only read what the other one writes in
+// the exchanges, e.g. the model updated in the exchange to the controller.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace PandaUtils {
+
+class CoSimScheduler {
+public:
+
+	typedef std::function<void()> Exchange;
+
+	CoSimScheduler(const double sim_dt, const int sim_steps_per_control, const double time_scale = 1.0,
+			const bool pipelined = false)
+	: _sim_dt(sim_dt),
+	  _sim_steps_per_control(sim_steps_per_control),
+	  _time_scale(time_scale),
+	  _pipelined(pipelined),
+	  _sim_steps(0),
+	  _control_steps(0),
+	  _sim_waiting(false),
+	  _control_waiting(false),
+	  _exchanged(false),
+	  _exchanged_sim_steps(0),
+	  _exchanged_control_steps(0),
+	  _control_running(false),
+	  _stopped(false),
+	  _started(false)
+	{
+		if(sim_dt <= 0 || sim_steps_per_control < 1)
+		{
+			throw std::invalid_argument("invalid step or steps per control in CoSimScheduler::CoSimScheduler()\n");
+		}
+		if(time_scale < 0)
+		{
+			throw std::invalid_argument("time scale should be positive or 0 in CoSimScheduler::CoSimScheduler()\n");
+		}
+	}
+
+	// --pipelined in the command line arguments
+	static bool pipelined(const int argc, char** argv)
+	{
+		for(int i=1 ; i<argc ; i++)
+		{
+			if(std::string(argv[i]) == "--pipelined")
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// before the first waitForControl(). to_control before every control step, to_simulation
+	// before the simulation steps of a control period
+	void setExchange(const Exchange& to_control, const Exchange& to_simulation)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_to_control = to_control;
+		_to_simulation = to_simulation;
+	}
+
+	// simulation thread : waits until the next step can start, false once stopped
+	bool waitForSimStep()
+	{
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_sim_waiting = true;
+			exchangeIfBlocked();
+			_condition.wait(lock, [&]
+			{
+				return _stopped || simStepReady();
+			});
+			_sim_waiting = false;
+			if(_stopped)
+			{
+				return false;
+			}
+		}
+
+		if(!_started.load())
+		{
+			_wall_start = std::chrono::steady_clock::now();
+			_started.store(true);
+		}
+		else if(_time_scale > 0)
+		{
+			std::this_thread::sleep_until(_wall_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+					std::chrono::duration<double>(simTime() / _time_scale)));
+		}
+		return true;
+	}
+
+	void simStepDone()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_sim_steps++;
+		}
+		_condition.notify_all();
+	}
+
+	// control thread : waits until the state of the next control step is exchanged, false once stopped
+	bool waitForControl()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		// the simulation waits for controlDone(), without it the schedule never advances
+		if(_control_running)
+		{
+			throw std::logic_error("control step not done before the next one in CoSimScheduler::waitForControl()\n");
+		}
+		_control_waiting = true;
+		exchangeIfBlocked();
+		_condition.wait(lock, [&]
+		{
+			return _stopped || controlReady();
+		});
+		_control_waiting = false;
+		_control_running = !_stopped;
+		return !_stopped;
+	}
+
+	// control thread : at the end of every control step, after the torques are computed
+	void controlDone()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_control_steps++;
+			_control_running = false;
+		}
+		_condition.notify_all();
+	}
+
+	// wakes up both stages, which then return false
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stopped = true;
+		}
+		_condition.notify_all();
+	}
+
+	// sim time of the next simulation step
+	double simTime() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _sim_steps * _sim_dt;
+	}
+
+	// sim time of the state of the current control step
+	double controlTime() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _control_steps * _sim_steps_per_control * _sim_dt;
+	}
+
+	double simDt() const
+	{
+		return _sim_dt;
+	}
+
+	double controlPeriod() const
+	{
+		return _sim_steps_per_control * _sim_dt;
+	}
+
+	bool isPipelined() const
+	{
+		return _pipelined;
+	}
+
+	unsigned long long numSimSteps() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _sim_steps;
+	}
+
+	unsigned long long numControlSteps() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _control_steps;
+	}
+
+	// sim seconds per wall second since the first step
+	double measuredTimeScale() const
+	{
+		if(!_started.load())
+		{
+			return 0;
+		}
+		const double wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - _wall_start).count();
+		return wall_time > 0 ? simTime() / wall_time : 0;
+	}
+
+private:
+
+	// with the lock. both stages are blocked with the simulation at the start of a control
+	// period, and the counts are the ones of a handoff that did not exchange yet
+	void exchangeIfBlocked()
+	{
+		if(!_sim_waiting || !_control_waiting || _sim_steps % _sim_steps_per_control != 0)
+		{
+			return;
+		}
+		// pipelined, the only handoff of a period is at its start, before its control step
+		if(_pipelined && _control_steps != _sim_steps / _sim_steps_per_control)
+		{
+			return;
+		}
+		if(exchanged(_sim_steps, _control_steps))
+		{
+			return;
+		}
+		// sequentially, the state goes to the control step of the period, then its torques to the simulation
+		const bool before_control = _pipelined || _control_steps == _sim_steps / _sim_steps_per_control;
+		const bool before_simulation = _pipelined || !before_control;
+		if(before_simulation && _to_simulation)
+		{
+			_to_simulation();
+		}
+		if(before_control && _to_control)
+		{
+			_to_control();
+		}
+		_exchanged = true;
+		_exchanged_sim_steps = _sim_steps;
+		_exchanged_control_steps = _control_steps;
+		_condition.notify_all();
+	}
+
+	bool exchanged(const unsigned long long sim_steps, const unsigned long long control_steps) const
+	{
+		return _exchanged && _exchanged_sim_steps == sim_steps && _exchanged_control_steps == control_steps;
+	}
+
+	bool simStepReady() const
+	{
+		const unsigned long long period = _sim_steps / _sim_steps_per_control;
+		// the torques of the period come from the control step before it when pipelined
+		const unsigned long long needed_control_steps = _pipelined ? period : period + 1;
+		if(_control_steps < needed_control_steps)
+		{
+			return false;
+		}
+		return _sim_steps % _sim_steps_per_control != 0 || exchanged(_sim_steps, needed_control_steps);
+	}
+
+	// the state of the control step was exchanged, the simulation may be further already
+	bool controlReady() const
+	{
+		return exchanged(_control_steps * _sim_steps_per_control, _control_steps);
+	}
+
+	const double _sim_dt;
+	const unsigned long long _sim_steps_per_control;
+	const double _time_scale;
+	const bool _pipelined;
+
+	mutable std::mutex _mutex;
+	std::condition_variable _condition;
+	Exchange _to_control;
+	Exchange _to_simulation;
+
+	unsigned long long _sim_steps;
+	unsigned long long _control_steps;
+	bool _sim_waiting;
+	bool _control_waiting;
+
+	// counts of the last exchange
+	bool _exchanged;
+	unsigned long long _exchanged_sim_steps;
+	unsigned long long _exchanged_control_steps;
+
+	// between waitForControl() and controlDone()
+	bool _control_running;
+	bool _stopped;
+
+	// set by the first step of the simulation
+	std::atomic<bool> _started;
+	std::chrono::steady_clock::time_point _wall_start;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_SIM_CO_SIM_SCHEDULER_H_
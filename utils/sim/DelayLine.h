@@ -0,0 +1,208 @@
+#ifndef UTILS_SIM_DELAY_LINE_H_
+#define UTILS_SIM_DELAY_LINE_H_
+
+// Emulated network link for the teleoperation apps : delay, jitter and packet loss.
+//
+// the sender pushes one message per cycle with its send time. every message is lost with
+// the loss rate, or arrives after the delay plus a random jitter. the receiver pops, at its
+// time, the latest sent message that arrived, as a receiver of udp state packets that drops
+// the ones older than the last it used : with a jitter larger than the send period, the
+// messages arrive out of order and the older ones are skipped. the messages in flight are
+// in a ring of CAPACITY preallocated messages, so nothing is allocated after construction
+// and the link can run at the control rate :
+//
+//   struct TeleopMessage { Vector3d position; Vector3d velocity; Matrix3d sigma_force; };
+//   PandaUtils::DelayLineConfig link_config = PandaUtils::DelayLineConfig::constant(0.05);
+//   link_config.jitter = 0.005;                        // 5 ms std
+//   link_config.jitter_distribution = PandaUtils::DelayLineConfig::GAUSSIAN_JITTER;
+//   link_config.loss_rate = 0.01;
+//   PandaUtils::DelayLine<TeleopMessage, 256> link(link_config);
+//
+//   while(runloop)                                      // at 1 kHz
+//   {
+//       link.push(time, message);                       // sender side
+//       if(link.pop(time, delayed_message))             // receiver side, same or another loop
+//       { ... }
+//   }
+//
+// CAPACITY should hold the messages sent over the longest delay, (delay + jitter) times the
+// send rate, with some margin. when it is full, the oldest message in flight is dropped and
+// counted as an overflow. push and pop are called by the same thread, the one that emulates
+// the link.
+
+#include "random/Xoshiro256.h"
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+
+namespace PandaUtils {
+
+struct DelayLineConfig
+{
+	enum JitterDistribution {NO_JITTER, UNIFORM_JITTER, GAUSSIAN_JITTER, EXPONENTIAL_JITTER};
+
+	// seconds, from the send time to the arrival without jitter
+	double delay;
+	// seconds : half width of the uniform jitter, std of the gaussian one, mean of the
+	// exponential one. the arrival is never before the send time
+	double jitter;
+	JitterDistribution jitter_distribution;
+	// probability that a message is lost, in [0, 1]
+	double loss_rate;
+
+	DelayLineConfig()
+	: delay(0),
+	  jitter(0),
+	  jitter_distribution(NO_JITTER),
+	  loss_rate(0)
+	{}
+
+	static DelayLineConfig constant(const double delay)
+	{
+		DelayLineConfig config;
+		config.delay = delay;
+		return config;
+	}
+};
+
+template<typename T, int CAPACITY>
+class DelayLine {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	DelayLine(const DelayLineConfig& config = DelayLineConfig(), const uint64_t seed = 1)
+	: _random_generator(seed),
+	  _head(0),
+	  _size(0),
+	  _n_sent(0),
+	  _n_lost(0),
+	  _n_overflowed(0),
+	  _n_delivered(0)
+	{
+		static_assert(CAPACITY > 0, "delay line needs a capacity");
+		setConfig(config);
+	}
+
+	// applies to the messages pushed after the call
+	void setConfig(const DelayLineConfig& config)
+	{
+		if(config.delay < 0 || config.jitter < 0)
+		{
+			throw std::invalid_argument("delay and jitter should be positive or 0 in DelayLine::setConfig()\n");
+		}
+		if(config.loss_rate < 0 || config.loss_rate > 1)
+		{
+			throw std::invalid_argument("loss rate should be in [0, 1] in DelayLine::setConfig()\n");
+		}
+		_config = config;
+	}
+
+	const DelayLineConfig& config() const
+	{
+		return _config;
+	}
+
+	// sends message at time (seconds), returns false when it is lost or dropped
+	bool push(const double time, const T& message)
+	{
+		_n_sent++;
+		if(_config.loss_rate > 0 && _random_generator.uniform() < _config.loss_rate)
+		{
+			_n_lost++;
+			return false;
+		}
+
+		bool dropped = false;
+		if(_size == CAPACITY)
+		{
+			_head = (_head + 1) % CAPACITY;
+			_size--;
+			_n_overflowed++;
+			dropped = true;
+		}
+		const int slot = (_head + _size) % CAPACITY;
+		_messages[slot] = message;
+		_arrivals[slot] = time + std::max(0.0, _config.delay + jitterSample());
+		_size++;
+		return !dropped;
+	}
+
+	// latest sent message arrived by time, if it is newer than the last one popped. the
+	// messages sent before it are discarded, arrived or not
+	bool pop(const double time, T& message)
+	{
+		int latest = -1;
+		for(int k=0 ; k<_size ; k++)
+		{
+			if(_arrivals[(_head + k) % CAPACITY] <= time)
+			{
+				latest = k;
+			}
+		}
+		if(latest < 0)
+		{
+			return false;
+		}
+		message = _messages[(_head + latest) % CAPACITY];
+		_head = (_head + latest + 1) % CAPACITY;
+		_size -= latest + 1;
+		_n_delivered++;
+		return true;
+	}
+
+	// drops the messages in flight
+	void clear()
+	{
+		_head = 0;
+		_size = 0;
+	}
+
+	int inFlight() const
+	{
+		return _size;
+	}
+
+	uint64_t sent() const { return _n_sent; }
+	uint64_t lost() const { return _n_lost; }
+	uint64_t overflowed() const { return _n_overflowed; }
+	// messages popped, the ones skipped because a newer one arrived are not counted
+	uint64_t delivered() const { return _n_delivered; }
+
+private:
+
+	double jitterSample()
+	{
+		switch(_config.jitter_distribution)
+		{
+			case DelayLineConfig::UNIFORM_JITTER :
+				return _random_generator.uniform(-_config.jitter, _config.jitter);
+			case DelayLineConfig::GAUSSIAN_JITTER :
+				return _random_generator.normal(0, _config.jitter);
+			case DelayLineConfig::EXPONENTIAL_JITTER :
+				return -_config.jitter * std::log(1.0 - _random_generator.uniform());
+			default :
+				return 0;
+		}
+	}
+
+	DelayLineConfig _config;
+	Xoshiro256 _random_generator;
+
+	// ring of the messages in flight, in send order
+	T _messages[CAPACITY];
+	double _arrivals[CAPACITY];
+	int _head;
+	int _size;
+
+	uint64_t _n_sent;
+	uint64_t _n_lost;
+	uint64_t _n_overflowed;
+	uint64_t _n_delivered;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_SIM_DELAY_LINE_H_
@@ -0,0 +1,196 @@
+#ifndef UTILS_SIM_GRIPPER_SIMULATION_H_
+#define UTILS_SIM_GRIPPER_SIMULATION_H_
+
+// Controllers of the simulated Franka grippers of a simviz, for up to N grippers in one call.
+//
+// the fingers of a simulated gripper are two prismatic joints of the robot model. a PD
+// centers them and, in move mode, a PD on the width brings them to the desired width and
+// opening speed; in grasp mode they squeeze with the desired force. the commands are set
+// when they change (e.g. when a RedisParameterCache refreshed them), clamped to the limits
+// of the gripper, and step() computes the finger torques of all the grippers from arrays
+// of size N, with no string compare or redis access :
+//
+//   PandaUtils::GripperSimulation<2> grippers;
+//   const int left = grippers.addGripper(robot->jointId("left_arm_finger_joint1"), robot->jointId("left_arm_finger_joint2"));
+//   const int right = grippers.addGripper(robot->jointId("right_arm_finger_joint1"), robot->jointId("right_arm_finger_joint2"));
+//   while(fSimulationRunning)
+//   {
+//       if(gripper_parameters.update())
+//       {
+//           grippers.setCommand(left, gripper_mode, gripper_desired_width, gripper_desired_speed, gripper_desired_force);
+//       }
+//       ...                                                   // arm torques from the controller
+//       grippers.step(robot->_q, robot->_dq, command_torques); // the finger torques of every gripper
+//       sim->setJointTorques(robot_name, command_torques);
+//       sim->integrate(dt);
+//   }
+//
+// a gripper with an unknown mode applies only the centering torques.
+
+#include <Eigen/Dense>
+
+#include <stdexcept>
+#include <string>
+
+namespace PandaUtils {
+
+template<int N>
+class GripperSimulation {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	typedef Eigen::Array<double, N, 1> ArrayN;
+
+	struct Command {
+		std::string mode;
+		double width;
+		double speed;
+		double force;
+	};
+
+	// gains of the Franka hand in the simviz apps
+	GripperSimulation(const double max_width = 0.08, const double kp = 400.0, const double kv = 30.0,
+			const double kp_center = 200.0, const double kv_center = 20.0)
+	: _max_width(max_width),
+	  _kp(kp),
+	  _kv(kv),
+	  _kp_center(kp_center),
+	  _kv_center(kv_center),
+	  _n_grippers(0)
+	{
+		_move.setZero();
+		_grasp.setZero();
+		_desired_width.setZero();
+		_desired_speed.setZero();
+		_desired_force.setZero();
+		_q_1.setZero();
+		_q_2.setZero();
+		_dq_1.setZero();
+		_dq_2.setZero();
+		_width.setZero();
+		_speed.setZero();
+	}
+
+	// the two finger joints of a gripper in the joint vector of the robot, returns its index
+	int addGripper(const int joint_index_1, const int joint_index_2)
+	{
+		if(_n_grippers >= N)
+		{
+			throw std::length_error("more than N grippers in GripperSimulation::addGripper()\n");
+		}
+		if(joint_index_1 < 0 || joint_index_2 < 0)
+		{
+			throw std::invalid_argument("finger joint not found in GripperSimulation::addGripper()\n");
+		}
+		const int gripper = _n_grippers++;
+		_joint_1[gripper] = joint_index_1;
+		_joint_2[gripper] = joint_index_2;
+		_move(gripper) = 1;
+		_commands[gripper].mode = "m";
+		_commands[gripper].width = 0;
+		_commands[gripper].speed = 0;
+		_commands[gripper].force = 0;
+		return gripper;
+	}
+
+	// mode "m" to move to the width at the speed, "g" to grasp with the force. the width is
+	// clamped to [0, max_width], the speed and force to positive values. returns false if the
+	// command had to be clamped or the mode is unknown, command() then gives the one applied
+	bool setCommand(const int gripper, const std::string& mode, const double width, const double speed, const double force)
+	{
+		checkGripper(gripper, "setCommand");
+		Command& command = _commands[gripper];
+		command.mode = mode;
+		command.width = width > _max_width ? _max_width : (width < 0 ? 0 : width);
+		command.speed = speed < 0 ? 0 : speed;
+		command.force = force < 0 ? 0 : force;
+
+		_move(gripper) = mode == "m" ? 1 : 0;
+		_grasp(gripper) = mode == "g" ? 1 : 0;
+		_desired_width(gripper) = command.width;
+		_desired_speed(gripper) = command.speed;
+		_desired_force(gripper) = command.force;
+
+		return command.width == width && command.speed == speed && command.force == force
+				&& (_move(gripper) != 0 || _grasp(gripper) != 0);
+	}
+
+	// writes the finger torques of all the grippers in torques, from the joint positions and
+	// velocities of the robot. the other joints are left as they are
+	void step(const Eigen::VectorXd& q, const Eigen::VectorXd& dq, Eigen::VectorXd& torques)
+	{
+		for(int i=0 ; i<_n_grippers ; i++)
+		{
+			_q_1(i) = q(_joint_1[i]);
+			_q_2(i) = q(_joint_2[i]);
+			_dq_1(i) = dq(_joint_1[i]);
+			_dq_2(i) = dq(_joint_2[i]);
+		}
+
+		_width = 0.5 * (_q_1 - _q_2);
+		_speed = 0.5 * (_dq_1 - _dq_2);
+		_constraint_force = -_kp_center * 0.5 * (_q_1 + _q_2) - _kv_center * 0.5 * (_dq_1 + _dq_2);
+		_behavior_force = _move * (-_kp * (_width - _desired_width) - _kv * (_speed - _desired_speed))
+				- _grasp * _desired_force;
+
+		for(int i=0 ; i<_n_grippers ; i++)
+		{
+			torques(_joint_1[i]) = _constraint_force(i) + _behavior_force(i);
+			torques(_joint_2[i]) = _constraint_force(i) - _behavior_force(i);
+		}
+	}
+
+	int numGrippers() const { return _n_grippers; }
+	const Command& command(const int gripper) const
+	{
+		checkGripper(gripper, "command");
+		return _commands[gripper];
+	}
+	// of the last step
+	double width(const int gripper) const
+	{
+		checkGripper(gripper, "width");
+		return _width(gripper);
+	}
+
+private:
+
+	void checkGripper(const int gripper, const std::string& method) const
+	{
+		if(gripper < 0 || gripper >= _n_grippers)
+		{
+			throw std::out_of_range("no gripper " + std::to_string(gripper) + " in GripperSimulation::" + method + "()\n");
+		}
+	}
+
+	const double _max_width;
+	const double _kp;
+	const double _kv;
+	const double _kp_center;
+	const double _kv_center;
+
+	int _n_grippers;
+	int _joint_1[N];
+	int _joint_2[N];
+	Command _commands[N];
+
+	// 1 for the grippers in that mode, 0 otherwise
+	ArrayN _move;
+	ArrayN _grasp;
+	ArrayN _desired_width;
+	ArrayN _desired_speed;
+	ArrayN _desired_force;
+
+	ArrayN _q_1;
+	ArrayN _q_2;
+	ArrayN _dq_1;
+	ArrayN _dq_2;
+	ArrayN _width;
+	ArrayN _speed;
+	ArrayN _constraint_force;
+	ArrayN _behavior_force;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_SIM_GRIPPER_SIMULATION_H_
@@ -0,0 +1,209 @@
+#ifndef UTILS_SIM_HEADLESS_SIMVIZ_H_
+#define UTILS_SIM_HEADLESS_SIMVIZ_H_
+
+// Headless mode of the simviz apps, for the controller regression runs on servers.
+//
+// with --headless, a simviz only runs its simulation thread and its redis or shared
+// memory io, without a window, without the vsync bound rendering loop and without the
+// camera control, until ctrl-c. with --render-rate, it also renders the scene in a
+// hidden window at a low rate, and writes the last frame to the --snapshot ppm file if
+// there is one. the hidden window still needs a display, e.g. a virtual one :
+//
+//   int main(int argc, char** argv) {
+//       PandaUtils::SimvizMode simviz_mode(argc, argv);     // simviz --headless [--render-rate 2] [--snapshot frame.ppm]
+//       ...
+//       fSimulationRunning = true;
+//       thread sim_thread(simulation, robot, sim);
+//       if(simviz_mode.headless)
+//       {
+//           PandaUtils::runHeadless(simviz_mode, graphics, camera_name, [&]() { graphics->updateGraphics(robot_name, robot); }, fSimulationRunning);
+//           sim_thread.join();
+//           return 0;
+//       }
+//       // window and rendering loop as before
+//
+// runHeadless() clears the running flag on SIGINT and SIGTERM, and returns once it is
+// cleared. the offscreen rendering is disabled when glfw cannot create the window.
+
+#include "Sai2Graphics.h"
+
+#include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
+
+#include <signal.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace PandaUtils {
+
+struct SimvizMode
+{
+	bool headless;
+	// offscreen renders per second in headless mode, 0 for none
+	double render_frequency;
+	int render_width;
+	int render_height;
+	// ppm file of the last offscreen render, none if empty
+	std::string snapshot_file;
+
+	SimvizMode(const int argc = 0, char** argv = NULL)
+	: headless(false),
+	  render_frequency(0),
+	  render_width(640),
+	  render_height(480)
+	{
+		for(int i=1 ; i<argc ; i++)
+		{
+			const std::string option = argv[i];
+			if(option == "--headless")
+			{
+				headless = true;
+			}
+			else if(option == "--render-rate" && i + 1 < argc)
+			{
+				render_frequency = std::atof(argv[++i]);
+			}
+			else if(option == "--snapshot" && i + 1 < argc)
+			{
+				snapshot_file = argv[++i];
+			}
+			else if(option == "--time-scale" && i + 1 < argc)
+			{
+				// read by SimClock::timeScale()
+				i++;
+			}
+			else if((option == "--save-state" || option == "--save-state-at" || option == "--restore-state") && i + 1 < argc)
+			{
+				// read by SimSnapshotService
+				i++;
+			}
+			else if(option == "--adaptive-substeps")
+			{
+				// read by AdaptiveStepper::requested()
+			}
+			else if(option == "--render-size" && i + 2 < argc)
+			{
+				render_width = std::atoi(argv[++i]);
+				render_height = std::atoi(argv[++i]);
+			}
+			else
+			{
+				std::cout << "unknown simviz option " << option << ", usage : [--headless] [--render-rate hz] [--snapshot frame.ppm] [--render-size width height]" << std::endl;
+			}
+		}
+		if(render_frequency < 0 || render_width <= 0 || render_height <= 0)
+		{
+			std::cout << "invalid offscreen rendering options, offscreen rendering disabled" << std::endl;
+			render_frequency = 0;
+		}
+	}
+};
+
+namespace internal {
+
+// running flag of the headless loop, cleared by SIGINT and SIGTERM
+inline bool*& headlessRunningFlag()
+{
+	static bool* running = NULL;
+	return running;
+}
+
+inline void headlessSignalHandler(int)
+{
+	if(headlessRunningFlag() != NULL)
+	{
+		*headlessRunningFlag() = false;
+	}
+}
+
+// binary ppm, the rows of glReadPixels start at the bottom
+inline bool writePpm(const std::string& filename, const int width, const int height, const std::vector<unsigned char>& pixels)
+{
+	std::ofstream file(filename.c_str(), std::ios::binary);
+	if(!file)
+	{
+		return false;
+	}
+	file << "P6\n" << width << " " << height << "\n255\n";
+	for(int row=height-1 ; row>=0 ; row--)
+	{
+		file.write(reinterpret_cast<const char*>(&pixels[3 * width * row]), 3 * width);
+	}
+	return (bool)file;
+}
+
+} /* namespace internal */
+
+// simulation only until running is cleared, with the optional offscreen rendering of the mode.
+// update_graphics() updates the graphics of the robots and objects before a render
+template<typename UpdateGraphics>
+void runHeadless(const SimvizMode& mode, Sai2Graphics::Sai2Graphics* graphics, const std::string& camera_name,
+		UpdateGraphics update_graphics, bool& running)
+{
+	internal::headlessRunningFlag() = &running;
+	signal(SIGINT, internal::headlessSignalHandler);
+	signal(SIGTERM, internal::headlessSignalHandler);
+
+	GLFWwindow* window = NULL;
+	std::vector<unsigned char> pixels;
+	if(mode.render_frequency > 0)
+	{
+		if(glfwInit())
+		{
+			glfwWindowHint(GLFW_VISIBLE, 0);
+			window = glfwCreateWindow(mode.render_width, mode.render_height, "SAI2.0 - PandaApplications", NULL, NULL);
+		}
+		if(window == NULL)
+		{
+			std::cout << "could not create the offscreen rendering window, running without rendering" << std::endl;
+		}
+		else
+		{
+			glfwMakeContextCurrent(window);
+			glfwSwapInterval(0);
+			pixels.resize(3 * mode.render_width * mode.render_height);
+		}
+	}
+
+	std::cout << "simviz running headless" << (window != NULL ? ", with offscreen rendering" : "") << ", ctrl-c to stop" << std::endl;
+
+	const std::chrono::milliseconds poll_period(10);
+	const std::chrono::duration<double> render_period(window != NULL ? 1.0 / mode.render_frequency : 0.0);
+	std::chrono::steady_clock::time_point next_render = std::chrono::steady_clock::now();
+	while(running)
+	{
+		if(window != NULL && std::chrono::steady_clock::now() >= next_render)
+		{
+			next_render += std::chrono::duration_cast<std::chrono::steady_clock::duration>(render_period);
+			update_graphics();
+			graphics->render(camera_name, mode.render_width, mode.render_height);
+			glFinish();
+			if(!mode.snapshot_file.empty())
+			{
+				glPixelStorei(GL_PACK_ALIGNMENT, 1);
+				glReadPixels(0, 0, mode.render_width, mode.render_height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+				if(!internal::writePpm(mode.snapshot_file, mode.render_width, mode.render_height, pixels))
+				{
+					std::cout << "could not write the snapshot " << mode.snapshot_file << std::endl;
+				}
+			}
+		}
+		std::this_thread::sleep_for(poll_period);
+	}
+
+	if(window != NULL)
+	{
+		glfwDestroyWindow(window);
+		glfwTerminate();
+	}
+	internal::headlessRunningFlag() = NULL;
+}
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_SIM_HEADLESS_SIMVIZ_H_
@@ -0,0 +1,154 @@
+#ifndef UTILS_SIM_RENDER_STATE_BUFFER_H_
+#define UTILS_SIM_RENDER_STATE_BUFFER_H_
+
+// Handoff of the simulated state from the simulation thread of a simviz to its rendering loop.
+//
+// the simulation thread publishes the joint positions and velocities of its robots and
+// the poses of the objects after every step, the rendering loop takes the latest ones
+// into its own copies of the robot models before it updates the graphics. the two
+// threads share no model and no lock (threads/TripleBuffer.h), so a frame never stalls
+// the simulation, and rendering reads nothing from redis :
+//
+//   auto robot = new Sai2Model::Sai2Model(robot_file, false);          // simulation thread
+//   auto render_robot = new Sai2Model::Sai2Model(robot_file, false);   // rendering loop
+//   PandaUtils::RenderStateBuffer render_state(robot, n_objects);      // before the threads start
+//
+//   sim->getJointPositions(robot_name, robot->_q);                     // simulation thread
+//   ...
+//   render_state.publish(robot, object_positions, object_orientations);
+//
+//   render_state.update(render_robot, render_object_positions, render_object_orientations);
+//   graphics->updateGraphics(robot_name, render_robot);                // rendering loop
+//
+// the buffer is sized for the dofs of the robots and the number of objects at the
+// construction, and nothing is allocated afterwards.
+
+#include "Sai2Model.h"
+#include "threads/TripleBuffer.h"
+#include <Eigen/Dense>
+
+#include <stdexcept>
+#include <vector>
+
+namespace PandaUtils {
+
+struct RenderState
+{
+	// one per robot
+	std::vector<Eigen::VectorXd> q;
+	std::vector<Eigen::VectorXd> dq;
+	std::vector<Eigen::Vector3d> object_positions;
+	std::vector<Eigen::Quaterniond> object_orientations;
+};
+
+class RenderStateBuffer {
+public:
+
+	RenderStateBuffer(const std::vector<Sai2Model::Sai2Model*>& robots, const int n_objects = 0)
+	{
+		initialize(robots, n_objects);
+	}
+
+	RenderStateBuffer(Sai2Model::Sai2Model* robot, const int n_objects = 0)
+	{
+		initialize(std::vector<Sai2Model::Sai2Model*>(1, robot), n_objects);
+	}
+
+	// simulation thread : robot states and object poses of the last step
+	void publish(const std::vector<Sai2Model::Sai2Model*>& robots,
+			const std::vector<Eigen::Vector3d>& object_positions = std::vector<Eigen::Vector3d>(),
+			const std::vector<Eigen::Quaterniond>& object_orientations = std::vector<Eigen::Quaterniond>())
+	{
+		RenderState& state = _buffer.writeBuffer();
+		if(robots.size() != state.q.size() || object_positions.size() != state.object_positions.size()
+				|| object_orientations.size() != state.object_orientations.size())
+		{
+			throw std::invalid_argument("robots and objects should be the ones of the construction in RenderStateBuffer::publish()\n");
+		}
+		for(unsigned int i=0 ; i<robots.size() ; i++)
+		{
+			state.q[i] = robots[i]->_q;
+			state.dq[i] = robots[i]->_dq;
+		}
+		for(unsigned int i=0 ; i<object_positions.size() ; i++)
+		{
+			state.object_positions[i] = object_positions[i];
+			state.object_orientations[i] = object_orientations[i];
+		}
+		_buffer.publish();
+	}
+
+	void publish(Sai2Model::Sai2Model* robot,
+			const std::vector<Eigen::Vector3d>& object_positions = std::vector<Eigen::Vector3d>(),
+			const std::vector<Eigen::Quaterniond>& object_orientations = std::vector<Eigen::Quaterniond>())
+	{
+		_robots_argument[0] = robot;
+		publish(_robots_argument, object_positions, object_orientations);
+	}
+
+	// rendering loop : sets the render models and updates their kinematics, and the object
+	// poses, to the latest published state. false and nothing changed if there is none since
+	// the last call
+	bool update(const std::vector<Sai2Model::Sai2Model*>& render_robots,
+			std::vector<Eigen::Vector3d>& object_positions, std::vector<Eigen::Quaterniond>& object_orientations)
+	{
+		if(!_buffer.update())
+		{
+			return false;
+		}
+		const RenderState& state = _buffer.latest();
+		for(unsigned int i=0 ; i<render_robots.size() && i<state.q.size() ; i++)
+		{
+			render_robots[i]->_q = state.q[i];
+			render_robots[i]->_dq = state.dq[i];
+			render_robots[i]->updateKinematics();
+		}
+		object_positions = state.object_positions;
+		object_orientations = state.object_orientations;
+		return true;
+	}
+
+	bool update(const std::vector<Sai2Model::Sai2Model*>& render_robots)
+	{
+		return update(render_robots, _object_positions, _object_orientations);
+	}
+
+	bool update(Sai2Model::Sai2Model* render_robot,
+			std::vector<Eigen::Vector3d>& object_positions, std::vector<Eigen::Quaterniond>& object_orientations)
+	{
+		return update(std::vector<Sai2Model::Sai2Model*>(1, render_robot), object_positions, object_orientations);
+	}
+
+	bool update(Sai2Model::Sai2Model* render_robot)
+	{
+		return update(std::vector<Sai2Model::Sai2Model*>(1, render_robot), _object_positions, _object_orientations);
+	}
+
+private:
+
+	void initialize(const std::vector<Sai2Model::Sai2Model*>& robots, const int n_objects)
+	{
+		RenderState state;
+		for(unsigned int i=0 ; i<robots.size() ; i++)
+		{
+			state.q.push_back(robots[i]->_q);
+			state.dq.push_back(robots[i]->_dq);
+		}
+		state.object_positions.resize(n_objects, Eigen::Vector3d::Zero());
+		state.object_orientations.resize(n_objects, Eigen::Quaterniond::Identity());
+		_buffer.reset(state);
+		_robots_argument.resize(1);
+	}
+
+	TripleBuffer<RenderState> _buffer;
+
+	// the single robot publish() without allocation
+	std::vector<Sai2Model::Sai2Model*> _robots_argument;
+	// object poses of the update() without objects
+	std::vector<Eigen::Vector3d> _object_positions;
+	std::vector<Eigen::Quaterniond> _object_orientations;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_SIM_RENDER_STATE_BUFFER_H_
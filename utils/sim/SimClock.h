@@ -0,0 +1,256 @@
+#ifndef UTILS_SIM_SIM_CLOCK_H_
+#define UTILS_SIM_SIM_CLOCK_H_
+
+// Simulated time source of the simulation and control loops, with a time scale.
+//
+// the simulation thread owns the clock : it waits for its next step, integrates,
+// then advances the sim time by its step. the control threads of the same process
+// are consumers : they wait for the sim time of their next tick instead of a
+// LoopTimer, and use time() as the loop time, e.g. for Logger::tick(). the time
+// scale is the number of sim seconds per wall second. with a time scale of 0, the
+// clock runs as fast as possible, in lockstep : a step only starts once every
+// consumer is done with the ticks before it :
+//
+//   PandaUtils::SimClock clock(PandaUtils::SimClock::timeScale(argc, argv));   // app --time-scale 10
+//   int control_consumer = clock.addConsumer(0.001);     // before the threads start
+//
+//   while(clock.waitForStep(sim_dt))                     // simulation thread
+//   {
+//       sim->setJointTorques(robot_name, command_torques);
+//       sim->integrate(sim_dt);
+//       ...
+//       clock.advance(sim_dt);
+//   }
+//
+//   while(clock.waitForNextLoop(control_consumer))       // control thread, at 1 kHz of sim time
+//   {
+//       const double time = clock.time();
+//       ...
+//       logger->tick(controller_counter, time);
+//   }
+//
+//   clock.stop();                                        // e.g. when the window is closed
+//
+// a loop of another process (e.g. a controller that talks to its simviz through redis)
+// owns its own clock at the same time scale, and calls waitForNextStep() with its period.
+// the two processes then run at the same scaled rate, but not in lockstep : a time scale
+// of 0 there needs the lockstep mode (redis/LockstepSync.h) :
+//
+//   PandaUtils::SimClock clock(PandaUtils::SimClock::timeScale(argc, argv, 1.0, false));
+//   while(runloop && clock.waitForNextStep(0.001))
+//   {
+//       const double time = clock.time();                // 0 at the first loop
+//       ...
+//   }
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace PandaUtils {
+
+class SimClock {
+public:
+
+	SimClock(const double time_scale = 1.0)
+	: _time_scale(time_scale),
+	  _time(0),
+	  _n_steps(0),
+	  _stopped(false),
+	  _started(false)
+	{
+		if(time_scale < 0)
+		{
+			throw std::invalid_argument("time scale should be positive or 0 in SimClock::SimClock()\n");
+		}
+	}
+
+	// value of --time-scale in the command line arguments, default_time_scale without it.
+	// without lockstep, 0 is replaced by 1
+	static double timeScale(const int argc, char** argv, const double default_time_scale = 1.0,
+			const bool lockstep_available = true)
+	{
+		double time_scale = default_time_scale;
+		for(int i=1 ; i<argc-1 ; i++)
+		{
+			if(std::string(argv[i]) == "--time-scale")
+			{
+				time_scale = std::atof(argv[i+1]);
+			}
+		}
+		if(time_scale < 0 || (time_scale == 0 && !lockstep_available))
+		{
+			std::cout << "time scale " << time_scale << " not available here, running in real time" << std::endl;
+			time_scale = 1.0;
+		}
+		return time_scale;
+	}
+
+	// control loop of period (sim seconds) waiting on the clock, returns its index.
+	// before the owner and the consumers start
+	int addConsumer(const double period)
+	{
+		if(period <= 0)
+		{
+			throw std::invalid_argument("consumer period should be positive in SimClock::addConsumer()\n");
+		}
+		std::lock_guard<std::mutex> lock(_mutex);
+		_consumer_periods.push_back(period);
+		_consumer_next_ticks.push_back(0);
+		// not waiting for its first tick yet
+		_consumer_waiting.push_back(false);
+		return _consumer_periods.size() - 1;
+	}
+
+	// owner : waits until the step from time() can start, in wall time and, in lockstep,
+	// once the consumers are done with the time before time() + dt. false once stopped
+	bool waitForStep(const double dt)
+	{
+		if(!_started.load())
+		{
+			_wall_start = std::chrono::steady_clock::now();
+			_started.store(true);
+		}
+		if(_time_scale > 0)
+		{
+			std::this_thread::sleep_until(_wall_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+					std::chrono::duration<double>(_time.load() / _time_scale)));
+			return !_stopped.load();
+		}
+
+		// lockstep : every consumer waits for a tick after the end of the step
+		const double step_end = _time.load() + dt;
+		std::unique_lock<std::mutex> lock(_mutex);
+		_step_condition.wait(lock, [&]
+		{
+			if(_stopped)
+			{
+				return true;
+			}
+			for(unsigned int i=0 ; i<_consumer_periods.size() ; i++)
+			{
+				if(!_consumer_waiting[i] || _consumer_next_ticks[i] < step_end - tickTolerance())
+				{
+					return false;
+				}
+			}
+			return true;
+		});
+		return !_stopped;
+	}
+
+	// owner : the state at time() + dt is written
+	void advance(const double dt)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_time.store(_time.load() + dt);
+			_n_steps++;
+		}
+		_tick_condition.notify_all();
+	}
+
+	// owner of a loop of period dt without consumers : advances the time by dt, except at
+	// the first call, and waits for it
+	bool waitForNextStep(const double dt)
+	{
+		if(_started.load())
+		{
+			advance(dt);
+		}
+		return waitForStep(dt);
+	}
+
+	// consumer : waits until the sim time reaches its next tick, false once stopped.
+	// a consumer behind by several ticks runs them without waiting
+	bool waitForNextLoop(const int consumer)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_consumer_waiting[consumer] = true;
+		const double next_tick = _consumer_next_ticks[consumer];
+		_step_condition.notify_all();
+		_tick_condition.wait(lock, [&]
+		{
+			return _stopped || _time.load() >= next_tick - tickTolerance();
+		});
+		_consumer_waiting[consumer] = false;
+		_consumer_next_ticks[consumer] = next_tick + _consumer_periods[consumer];
+		return !_stopped;
+	}
+
+	// wakes up the owner and the consumers, which then return false
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stopped = true;
+		}
+		_step_condition.notify_all();
+		_tick_condition.notify_all();
+	}
+
+	// sim time in seconds
+	double time() const
+	{
+		return _time.load();
+	}
+
+	unsigned long long numSteps() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _n_steps;
+	}
+
+	double timeScale() const
+	{
+		return _time_scale;
+	}
+
+	// sim seconds per wall second since the first step
+	double measuredTimeScale() const
+	{
+		if(!_started.load())
+		{
+			return 0;
+		}
+		const double wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - _wall_start).count();
+		return wall_time > 0 ? _time.load() / wall_time : 0;
+	}
+
+private:
+
+	// sums of steps and periods that differ by rounding are the same time
+	static double tickTolerance()
+	{
+		return 1e-9;
+	}
+
+	const double _time_scale;
+
+	mutable std::mutex _mutex;
+	std::condition_variable _step_condition;
+	std::condition_variable _tick_condition;
+
+	std::atomic<double> _time;
+	unsigned long long _n_steps;
+	std::atomic<bool> _stopped;
+
+	// set by the first step of the owner
+	std::atomic<bool> _started;
+	std::chrono::steady_clock::time_point _wall_start;
+
+	std::vector<double> _consumer_periods;
+	std::vector<double> _consumer_next_ticks;
+	std::vector<bool> _consumer_waiting;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_SIM_SIM_CLOCK_H_
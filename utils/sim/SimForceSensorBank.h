@@ -0,0 +1,275 @@
+#ifndef UTILS_SIM_SIM_FORCE_SENSOR_BANK_H_
+#define UTILS_SIM_SIM_FORCE_SENSOR_BANK_H_
+
+// Simulated force sensors of a simviz that share the contact queries and the filtering.
+//
+// every ForceSensorSim scans the contact list of its link and runs its own filter at
+// every step. the bank queries the contact list once per step for every link that has a
+// sensor, gives the contact wrench of the link to all the sensors on it, and filters the
+// wrenches of all the sensors in one ButterworthFilterBank update, so the cost of a step
+// grows with the links in contact and not with the sensors :
+//
+//   PandaUtils::SimForceSensorBank force_sensors;
+//   const int right = force_sensors.addSensor(robot_names[0], "link7", T_link_sensor, robots[0]);
+//   const int left = force_sensors.addSensor(robot_names[1], "link7", T_link_sensor, robots[1]);
+//   force_sensors.enableFilter(right, 0.005);    // normalized cutoff, as ForceSensorSim::enableFilter()
+//   while(fSimulationRunning)
+//   {
+//       sim->integrate(loop_dt);
+//       force_sensors.update(sim);
+//       force_sensors.getForceLocalFrame(right, sensed_force_right);
+//       ...
+//   }
+//
+// the wrenches are the ones of ForceSensorSim : the sum of the contact forces on the link,
+// and their moment about the sensor point, in the world frame or in the sensor frame. the
+// filters run in the sensor frame. the sensor poses use the kinematics of the robot models.
+
+#include "Sai2Model.h"
+#include "Sai2Simulation.h"
+#include "filters/ButterworthFilterBank.h"
+#include <Eigen/Dense>
+#include <Eigen/StdVector>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+class SimForceSensorBank {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	SimForceSensorBank()
+	: _filter(NULL),
+	  _n_filtered(0)
+	{}
+
+	~SimForceSensorBank()
+	{
+		delete _filter;
+	}
+
+	SimForceSensorBank(const SimForceSensorBank&) = delete;
+	SimForceSensorBank& operator=(const SimForceSensorBank&) = delete;
+
+	// returns the index of the sensor
+	int addSensor(const std::string& robot_name, const std::string& link_name,
+			const Eigen::Affine3d& T_link_sensor, Sai2Model::Sai2Model* robot)
+	{
+		Sensor sensor;
+		sensor.link = -1;
+		for(unsigned int i=0 ; i<_links.size() ; i++)
+		{
+			if(_links[i].robot_name == robot_name && _links[i].link_name == link_name)
+			{
+				sensor.link = i;
+				break;
+			}
+		}
+		if(sensor.link < 0)
+		{
+			ContactLink link;
+			link.robot_name = robot_name;
+			link.link_name = link_name;
+			link.robot = robot;
+			_links.push_back(link);
+			sensor.link = _links.size() - 1;
+		}
+		sensor.T_link_sensor = T_link_sensor;
+		sensor.cutoff = 0;
+		sensor.force.setZero();
+		sensor.moment.setZero();
+		sensor.force_local.setZero();
+		sensor.moment_local.setZero();
+		_sensors.push_back(sensor);
+
+		_raw.setZero(6 * _sensors.size());
+		resetFilter();
+		return _sensors.size() - 1;
+	}
+
+	// second order butterworth filter of the wrench, of normalized cutoff frequency in (0, 0.5)
+	void enableFilter(const int sensor, const double normalized_cutoff_freq)
+	{
+		checkSensor(sensor, "enableFilter");
+		if(normalized_cutoff_freq <= 0 || normalized_cutoff_freq >= 0.5)
+		{
+			throw std::invalid_argument("normalized cutoff frequency should be in (0, 0.5) in SimForceSensorBank::enableFilter()\n");
+		}
+		if(_sensors[sensor].cutoff == 0)
+		{
+			_n_filtered++;
+		}
+		_sensors[sensor].cutoff = normalized_cutoff_freq;
+		resetFilter();
+	}
+
+	void disableFilter(const int sensor)
+	{
+		checkSensor(sensor, "disableFilter");
+		if(_sensors[sensor].cutoff != 0)
+		{
+			_n_filtered--;
+		}
+		_sensors[sensor].cutoff = 0;
+		resetFilter();
+	}
+
+	// one contact query per link, then the wrenches of all the sensors
+	void update(Simulation::Sai2Simulation* sim)
+	{
+		for(unsigned int i=0 ; i<_links.size() ; i++)
+		{
+			sim->getContactList(_links[i].contact_points, _links[i].contact_forces, _links[i].robot_name, _links[i].link_name);
+		}
+
+		for(unsigned int i=0 ; i<_sensors.size() ; i++)
+		{
+			Sensor& sensor = _sensors[i];
+			ContactLink& link = _links[sensor.link];
+			link.robot->transformInWorld(_T_world_link, link.link_name);
+			_T_world_sensor = _T_world_link * sensor.T_link_sensor;
+			const Eigen::Vector3d sensor_position = _T_world_sensor.translation();
+
+			sensor.force.setZero();
+			sensor.moment.setZero();
+			for(unsigned int j=0 ; j<link.contact_points.size() ; j++)
+			{
+				sensor.force += link.contact_forces[j];
+				sensor.moment += (link.contact_points[j] - sensor_position).cross(link.contact_forces[j]);
+			}
+			sensor.R_world_sensor = _T_world_sensor.linear();
+			_raw.segment<3>(6*i) = sensor.R_world_sensor.transpose() * sensor.force;
+			_raw.segment<3>(6*i+3) = sensor.R_world_sensor.transpose() * sensor.moment;
+		}
+
+		if(_n_filtered == 0)
+		{
+			distribute(_raw, false);
+			return;
+		}
+		if(_filter == NULL)
+		{
+			createFilter();
+		}
+		distribute(_filter->update(_raw), true);
+	}
+
+	int nSensors() const
+	{
+		return _sensors.size();
+	}
+
+	// world frame
+	void getForce(const int sensor, Eigen::Vector3d& force) const
+	{
+		checkSensor(sensor, "getForce");
+		force = _sensors[sensor].force;
+	}
+
+	// world frame, about the sensor point
+	void getMoment(const int sensor, Eigen::Vector3d& moment) const
+	{
+		checkSensor(sensor, "getMoment");
+		moment = _sensors[sensor].moment;
+	}
+
+	void getForceLocalFrame(const int sensor, Eigen::Vector3d& force) const
+	{
+		checkSensor(sensor, "getForceLocalFrame");
+		force = _sensors[sensor].force_local;
+	}
+
+	void getMomentLocalFrame(const int sensor, Eigen::Vector3d& moment) const
+	{
+		checkSensor(sensor, "getMomentLocalFrame");
+		moment = _sensors[sensor].moment_local;
+	}
+
+private:
+
+	struct ContactLink
+	{
+		std::string robot_name;
+		std::string link_name;
+		Sai2Model::Sai2Model* robot;
+		// capacity kept between the steps
+		std::vector<Eigen::Vector3d> contact_points;
+		std::vector<Eigen::Vector3d> contact_forces;
+	};
+
+	struct Sensor
+	{
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+		int link;
+		Eigen::Affine3d T_link_sensor;
+		// 0 when not filtered
+		double cutoff;
+		Eigen::Matrix3d R_world_sensor;
+		Eigen::Vector3d force;
+		Eigen::Vector3d moment;
+		Eigen::Vector3d force_local;
+		Eigen::Vector3d moment_local;
+	};
+
+	void checkSensor(const int sensor, const std::string& method) const
+	{
+		if(sensor < 0 || sensor >= (int)_sensors.size())
+		{
+			throw std::out_of_range("no sensor " + std::to_string(sensor) + " in SimForceSensorBank::" + method + "()\n");
+		}
+	}
+
+	// the filters start again from the next sample
+	void resetFilter()
+	{
+		delete _filter;
+		_filter = NULL;
+	}
+
+	void createFilter()
+	{
+		// the channels of the sensors without filter are filtered too, and not used
+		_filter = new ButterworthFilterBank<Eigen::Dynamic>(6 * _sensors.size(), 0.25);
+		for(unsigned int i=0 ; i<_sensors.size() ; i++)
+		{
+			if(_sensors[i].cutoff != 0)
+			{
+				_filter->setCutoffFrequency(6*i, 6, _sensors[i].cutoff);
+			}
+		}
+	}
+
+	void distribute(const Eigen::VectorXd& wrenches, const bool filtered)
+	{
+		for(unsigned int i=0 ; i<_sensors.size() ; i++)
+		{
+			Sensor& sensor = _sensors[i];
+			const Eigen::VectorXd& source = (filtered && sensor.cutoff != 0) ? wrenches : _raw;
+			sensor.force_local = source.segment<3>(6*i);
+			sensor.moment_local = source.segment<3>(6*i+3);
+			if(filtered && sensor.cutoff != 0)
+			{
+				sensor.force = sensor.R_world_sensor * sensor.force_local;
+				sensor.moment = sensor.R_world_sensor * sensor.moment_local;
+			}
+		}
+	}
+
+	std::vector<ContactLink> _links;
+	std::vector<Sensor, Eigen::aligned_allocator<Sensor>> _sensors;
+
+	ButterworthFilterBank<Eigen::Dynamic>* _filter;
+	int _n_filtered;
+
+	// local frame wrenches of the sensors, force then moment
+	Eigen::VectorXd _raw;
+	Eigen::Affine3d _T_world_link;
+	Eigen::Affine3d _T_world_sensor;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_SIM_SIM_FORCE_SENSOR_BANK_H_
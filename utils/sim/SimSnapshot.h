@@ -0,0 +1,369 @@
+#ifndef UTILS_SIM_SIM_SNAPSHOT_H_
+#define UTILS_SIM_SIM_SNAPSHOT_H_
+
+// Binary checkpoint of a simviz, to start the trials of an experiment from the same state.
+//
+// a snapshot holds the joint positions and velocities of the robots, the poses of the
+// objects, and the values of redis keys : the gripper commands, and the state of the
+// controller state machine, that the controller publishes to a key. restoring it takes
+// milliseconds, instead of the settling and the homing of the controller :
+//
+//   simviz --save-state pre_contact.snap [--save-state-at 12.5]    // or set the save key to 1
+//   simviz --restore-state pre_contact.snap                        // then controller --restore-state
+//
+//   PandaUtils::SimSnapshotService snapshots(argc, argv, SAVE_STATE_KEY, robot_names, object_names, redis_keys);
+//   snapshots.restoreSimulation(sim);          // main, before the models are read from the simulation
+//   ...
+//   snapshots.restoreRedis(redis_client);      // simulation thread, after the default gripper commands
+//   while(fSimulationRunning)
+//   {
+//       ... integrate
+//       snapshots.update(sim, redis_client, loop_dt);
+//   }
+//
+// the object velocities are not restored, the snapshots are meant to be taken at rest,
+// e.g. before a contact. the file is in the byte order of the machine.
+
+#include "Sai2Simulation.h"
+#include "redis/RedisClient.h"
+#include <Eigen/Dense>
+#include <Eigen/StdVector>
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace PandaUtils {
+
+struct SimSnapshot
+{
+	struct RobotState
+	{
+		std::string name;
+		Eigen::VectorXd q;
+		Eigen::VectorXd dq;
+	};
+
+	struct ObjectState
+	{
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+		std::string name;
+		Eigen::Vector3d position;
+		Eigen::Quaterniond orientation;
+	};
+
+	// seconds of simulation when the snapshot was taken
+	double time;
+	std::vector<RobotState> robots;
+	std::vector<ObjectState, Eigen::aligned_allocator<ObjectState>> objects;
+	// key and value
+	std::vector<std::pair<std::string, std::string>> redis_values;
+
+	SimSnapshot() : time(0) {}
+
+	void capture(Simulation::Sai2Simulation* sim, const std::vector<std::string>& robot_names,
+			const std::vector<std::string>& object_names, const double sim_time)
+	{
+		time = sim_time;
+		robots.resize(robot_names.size());
+		for(unsigned int i=0 ; i<robot_names.size() ; i++)
+		{
+			robots[i].name = robot_names[i];
+			sim->getJointPositions(robot_names[i], robots[i].q);
+			sim->getJointVelocities(robot_names[i], robots[i].dq);
+		}
+		objects.resize(object_names.size());
+		for(unsigned int i=0 ; i<object_names.size() ; i++)
+		{
+			objects[i].name = object_names[i];
+			sim->getObjectPosition(object_names[i], objects[i].position, objects[i].orientation);
+		}
+	}
+
+	// keys that do not exist are skipped
+	void captureRedis(RedisClient& redis_client, const std::vector<std::string>& keys)
+	{
+		redis_values.clear();
+		for(unsigned int i=0 ; i<keys.size() ; i++)
+		{
+			if(redis_client.exists(keys[i]))
+			{
+				redis_values.push_back(std::make_pair(keys[i], redis_client.get(keys[i])));
+			}
+		}
+	}
+
+	void restore(Simulation::Sai2Simulation* sim) const
+	{
+		for(unsigned int i=0 ; i<robots.size() ; i++)
+		{
+			sim->setJointPositions(robots[i].name, robots[i].q);
+			sim->setJointVelocities(robots[i].name, robots[i].dq);
+		}
+		for(unsigned int i=0 ; i<objects.size() ; i++)
+		{
+			sim->setObjectPosition(objects[i].name, objects[i].position, objects[i].orientation);
+		}
+	}
+
+	void restoreRedis(RedisClient& redis_client) const
+	{
+		for(unsigned int i=0 ; i<redis_values.size() ; i++)
+		{
+			redis_client.set(redis_values[i].first, redis_values[i].second);
+		}
+	}
+
+	void save(const std::string& filename) const
+	{
+		std::ofstream file(filename.c_str(), std::ios::binary);
+		if(!file)
+		{
+			throw std::runtime_error("could not open " + filename + " in SimSnapshot::save()\n");
+		}
+		file.write(magic(), 8);
+		writeValue(file, version());
+		writeValue(file, time);
+		writeValue(file, (uint32_t)robots.size());
+		for(unsigned int i=0 ; i<robots.size() ; i++)
+		{
+			writeString(file, robots[i].name);
+			writeValue(file, (uint32_t)robots[i].q.size());
+			file.write(reinterpret_cast<const char*>(robots[i].q.data()), robots[i].q.size() * sizeof(double));
+			file.write(reinterpret_cast<const char*>(robots[i].dq.data()), robots[i].dq.size() * sizeof(double));
+		}
+		writeValue(file, (uint32_t)objects.size());
+		for(unsigned int i=0 ; i<objects.size() ; i++)
+		{
+			writeString(file, objects[i].name);
+			file.write(reinterpret_cast<const char*>(objects[i].position.data()), 3 * sizeof(double));
+			file.write(reinterpret_cast<const char*>(objects[i].orientation.coeffs().data()), 4 * sizeof(double));
+		}
+		writeValue(file, (uint32_t)redis_values.size());
+		for(unsigned int i=0 ; i<redis_values.size() ; i++)
+		{
+			writeString(file, redis_values[i].first);
+			writeString(file, redis_values[i].second);
+		}
+		if(!file)
+		{
+			throw std::runtime_error("could not write " + filename + " in SimSnapshot::save()\n");
+		}
+	}
+
+	void load(const std::string& filename)
+	{
+		std::ifstream file(filename.c_str(), std::ios::binary);
+		char file_magic[8];
+		if(!file || !file.read(file_magic, 8) || std::string(file_magic, 8) != std::string(magic(), 8))
+		{
+			throw std::runtime_error(filename + " is not a simulation snapshot in SimSnapshot::load()\n");
+		}
+		if(readValue<uint32_t>(file) != version())
+		{
+			throw std::runtime_error("snapshot " + filename + " of another version in SimSnapshot::load()\n");
+		}
+		time = readValue<double>(file);
+		robots.resize(readValue<uint32_t>(file));
+		for(unsigned int i=0 ; i<robots.size() ; i++)
+		{
+			robots[i].name = readString(file);
+			const uint32_t dof = readValue<uint32_t>(file);
+			robots[i].q.resize(dof);
+			robots[i].dq.resize(dof);
+			file.read(reinterpret_cast<char*>(robots[i].q.data()), dof * sizeof(double));
+			file.read(reinterpret_cast<char*>(robots[i].dq.data()), dof * sizeof(double));
+		}
+		objects.resize(readValue<uint32_t>(file));
+		for(unsigned int i=0 ; i<objects.size() ; i++)
+		{
+			objects[i].name = readString(file);
+			file.read(reinterpret_cast<char*>(objects[i].position.data()), 3 * sizeof(double));
+			file.read(reinterpret_cast<char*>(objects[i].orientation.coeffs().data()), 4 * sizeof(double));
+		}
+		redis_values.resize(readValue<uint32_t>(file));
+		for(unsigned int i=0 ; i<redis_values.size() ; i++)
+		{
+			redis_values[i].first = readString(file);
+			redis_values[i].second = readString(file);
+		}
+		if(!file)
+		{
+			throw std::runtime_error("truncated snapshot " + filename + " in SimSnapshot::load()\n");
+		}
+	}
+
+private:
+
+	static const char* magic()
+	{
+		return "SAI2SNAP";
+	}
+
+	static uint32_t version()
+	{
+		return 1;
+	}
+
+	template<typename T>
+	static void writeValue(std::ofstream& file, const T value)
+	{
+		file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	template<typename T>
+	static T readValue(std::ifstream& file)
+	{
+		T value = T();
+		file.read(reinterpret_cast<char*>(&value), sizeof(T));
+		return value;
+	}
+
+	static void writeString(std::ofstream& file, const std::string& value)
+	{
+		writeValue(file, (uint32_t)value.size());
+		file.write(value.data(), value.size());
+	}
+
+	static std::string readString(std::ifstream& file)
+	{
+		const uint32_t size = readValue<uint32_t>(file);
+		// a corrupted size would allocate gigabytes
+		if(!file || size > (1u << 20))
+		{
+			file.setstate(std::ios::failbit);
+			return std::string();
+		}
+		std::string value(size, '\0');
+		file.read(&value[0], size);
+		return value;
+	}
+};
+
+// --save-state, --save-state-at and --restore-state of a simviz
+class SimSnapshotService {
+public:
+
+	SimSnapshotService(const int argc, char** argv, const std::string& save_key,
+			const std::vector<std::string>& robot_names, const std::vector<std::string>& object_names,
+			const std::vector<std::string>& redis_keys, const int save_key_check_period = 100)
+	: _save_key(save_key),
+	  _robot_names(robot_names),
+	  _object_names(object_names),
+	  _redis_keys(redis_keys),
+	  _save_time(-1),
+	  _time(0),
+	  _save_key_check_period(save_key_check_period),
+	  _n_updates(0),
+	  _restored(false)
+	{
+		for(int i=1 ; i<argc-1 ; i++)
+		{
+			const std::string option = argv[i];
+			if(option == "--save-state")
+			{
+				_save_file = argv[i+1];
+			}
+			else if(option == "--save-state-at")
+			{
+				_save_time = std::atof(argv[i+1]);
+			}
+			else if(option == "--restore-state")
+			{
+				_restore_file = argv[i+1];
+			}
+		}
+	}
+
+	// main thread : restores the robots and objects of the --restore-state file, false without one
+	bool restoreSimulation(Simulation::Sai2Simulation* sim)
+	{
+		if(_restore_file.empty())
+		{
+			return false;
+		}
+		_snapshot.load(_restore_file);
+		_snapshot.restore(sim);
+		_time = _snapshot.time;
+		_restored = true;
+		std::cout << "restored the simulation state of " << _restore_file << " at " << _snapshot.time << " s" << std::endl;
+		return true;
+	}
+
+	// simulation thread : rewrites the redis values of the restored snapshot
+	void restoreRedis(RedisClient& redis_client)
+	{
+		if(_save_file.empty() == false)
+		{
+			redis_client.set(_save_key, "0");
+		}
+		if(_restored)
+		{
+			_snapshot.restoreRedis(redis_client);
+		}
+	}
+
+	// simulation thread, after every step of dt : saves the state to the --save-state file
+	// at the --save-state-at time, or when the save key is set to 1
+	void update(Simulation::Sai2Simulation* sim, RedisClient& redis_client, const double dt)
+	{
+		const double previous_time = _time;
+		_time += dt;
+		if(_save_file.empty())
+		{
+			return;
+		}
+		bool save = _save_time >= 0 && previous_time < _save_time && _time >= _save_time;
+		if(++_n_updates % _save_key_check_period == 0 && redis_client.get(_save_key) == "1")
+		{
+			redis_client.set(_save_key, "0");
+			save = true;
+		}
+		if(save)
+		{
+			_snapshot.capture(sim, _robot_names, _object_names, _time);
+			_snapshot.captureRedis(redis_client, _redis_keys);
+			try
+			{
+				_snapshot.save(_save_file);
+				std::cout << "saved the simulation state at " << _time << " s to " << _save_file << std::endl;
+			}
+			catch(const std::exception& e)
+			{
+				std::cout << e.what();
+			}
+		}
+	}
+
+	// seconds of simulation, from the restored snapshot
+	double time() const
+	{
+		return _time;
+	}
+
+private:
+
+	const std::string _save_key;
+	const std::vector<std::string> _robot_names;
+	const std::vector<std::string> _object_names;
+	const std::vector<std::string> _redis_keys;
+
+	std::string _save_file;
+	double _save_time;
+	std::string _restore_file;
+
+	SimSnapshot _snapshot;
+	double _time;
+	const int _save_key_check_period;
+	unsigned long long _n_updates;
+	bool _restored;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_SIM_SIM_SNAPSHOT_H_
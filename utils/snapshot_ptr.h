@@ -0,0 +1,213 @@
+#ifndef UTILS_SNAPSHOT_PTR_H_
+#define UTILS_SNAPSHOT_PTR_H_
+
+// Latest value handoff between one writer thread and several reader threads, with
+// reads that never wait, for the data that sf::safe_ptr protects with a lock.
+//
+// every publication is a snapshot : the writer fills a slot that no reader uses and
+// publishes it to all the readers at once. each reader swaps the slot it holds with
+// the newest published one when there is one, in a single atomic exchange, and keeps
+// reading it until its next get(). neither side ever waits for the other or retries,
+// so a 1 kHz control thread reading the output of a slower model thread cannot be
+// blocked by it (no priority inversion), and always reads a whole snapshot, possibly
+// skipping intermediate ones:
+//
+//   struct RobotModel { Eigen::MatrixXd M; Eigen::MatrixXd M_inv; Eigen::MatrixXd Lambda; };
+//   PandaUtils::snapshot_ptr<RobotModel> robot_model(2, RobotModel(...));    // 2 readers
+//
+//   RobotModel& model = robot_model.writeBuffer();        // model thread, e.g. at 200 Hz
+//   model.M = ...;
+//   robot_model.publish();
+//
+//   const RobotModel* model = robot_model.get(0);         // control thread, at 1 kHz
+//   const RobotModel* logged_model = robot_model.get(1);  // logger thread
+//
+// each reader has its own index, between 0 and n_readers-1, that only one thread uses.
+// a snapshot returned by get() is valid until the next get() or update() of the same
+// reader, so read it once per tick instead of through operator-> on every access.
+//
+// the writer cycles through 2 * n_readers + 1 copies of T, allocated by the constructor.
+// writeBuffer() holds the value of an older snapshot, write() or filling all the members
+// in place give the whole value. publish() costs one atomic exchange per reader, get()
+// one atomic load and at most one exchange, and none of them allocates. T is copied by
+// assignment, and needs EIGEN_MAKE_ALIGNED_OPERATOR_NEW for vectorizable fixed size
+// Eigen members.
+
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace PandaUtils {
+
+template<typename T>
+class snapshot_ptr {
+public:
+
+	// the readers get initial_value until the writer publishes
+	snapshot_ptr(const int n_readers = 1, const T& initial_value = T())
+	: _n_readers(n_readers),
+	  _n_slots(2 * n_readers + 1)
+	{
+		if(n_readers < 1)
+		{
+			throw std::invalid_argument("there should be at least one reader in snapshot_ptr::snapshot_ptr()\n");
+		}
+		_slots = new T[_n_slots];
+		_channels = new Channel[_n_readers];
+		_published.resize(_n_readers);
+		_held.resize(_n_readers);
+		_used.resize(_n_slots);
+		reset(initial_value);
+	}
+
+	~snapshot_ptr()
+	{
+		delete[] _slots;
+		delete[] _channels;
+	}
+
+	// sets every copy to value, with no published value. only while no thread uses the
+	// pointer (e.g. to size dynamic members before starting them)
+	void reset(const T& value)
+	{
+		for(int i=0 ; i<_n_slots ; i++)
+		{
+			_slots[i] = value;
+		}
+		// all the readers hold the slot 0
+		for(int r=0 ; r<_n_readers ; r++)
+		{
+			_channels[r].read_index = 0;
+			_channels[r].middle.store(0);
+			_published[r] = 0;
+			_held[r] = 0;
+		}
+		_write_index = 1;
+	}
+
+	// writer thread only
+	void write(const T& value)
+	{
+		_slots[_write_index] = value;
+		publish();
+	}
+
+	// writer thread only : fill the value in place then publish() it
+	T& writeBuffer()
+	{
+		return _slots[_write_index];
+	}
+
+	void publish()
+	{
+		const uint32_t published = (_write_index << 1) | NEW_VALUE;
+		for(int r=0 ; r<_n_readers ; r++)
+		{
+			const uint32_t previous = _channels[r].middle.exchange(published, std::memory_order_acq_rel);
+			// without the flag, the reader took the last published slot and gave back the one it held
+			if(!(previous & NEW_VALUE))
+			{
+				_held[r] = _published[r];
+			}
+			_published[r] = _write_index;
+		}
+
+		// next slot that no reader holds or can take
+		for(int i=0 ; i<_n_slots ; i++)
+		{
+			_used[i] = false;
+		}
+		for(int r=0 ; r<_n_readers ; r++)
+		{
+			_used[_published[r]] = true;
+			_used[_held[r]] = true;
+		}
+		for(int i=0 ; i<_n_slots ; i++)
+		{
+			if(!_used[i])
+			{
+				_write_index = i;
+				break;
+			}
+		}
+	}
+
+	// reader thread only : take the latest published snapshot, false if there is none since the last call
+	bool update(const int reader = 0)
+	{
+		Channel& channel = _channels[reader];
+		if(!(channel.middle.load(std::memory_order_relaxed) & NEW_VALUE))
+		{
+			return false;
+		}
+		const uint32_t previous = channel.middle.exchange(channel.read_index << 1, std::memory_order_acq_rel);
+		channel.read_index = previous >> 1;
+		return true;
+	}
+
+	// reader thread only : latest published snapshot, valid until the next get() or update() of the reader
+	const T* get(const int reader = 0)
+	{
+		update(reader);
+		return &_slots[_channels[reader].read_index];
+	}
+
+	// reader thread only : copies the latest published snapshot to output, returns true if
+	// it was published since the last read
+	bool read(T& output, const int reader = 0)
+	{
+		const bool new_value = update(reader);
+		output = _slots[_channels[reader].read_index];
+		return new_value;
+	}
+
+	// reader 0, latest published snapshot at every access
+	const T& operator*()
+	{
+		return *get(0);
+	}
+
+	const T* operator->()
+	{
+		return get(0);
+	}
+
+	int numReaders() const
+	{
+		return _n_readers;
+	}
+
+private:
+
+	snapshot_ptr(const snapshot_ptr&);
+	snapshot_ptr& operator=(const snapshot_ptr&);
+
+	// the middle slot of a reader holds its index in the high bits and this flag when it was not read yet
+	static const uint32_t NEW_VALUE = 1;
+
+	// one cache line per reader, so that the readers do not share lines
+	struct Channel {
+		std::atomic<uint32_t> middle;
+		// owned by the reader
+		uint32_t read_index;
+		char padding[64 - sizeof(std::atomic<uint32_t>) - sizeof(uint32_t)];
+	};
+
+	const int _n_readers;
+	const int _n_slots;
+
+	T* _slots;
+	Channel* _channels;
+
+	// owned by the writer : slot it fills, last slot published to every reader, and slot
+	// every reader held when it was published
+	uint32_t _write_index;
+	std::vector<uint32_t> _published;
+	std::vector<uint32_t> _held;
+	std::vector<bool> _used;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_SNAPSHOT_PTR_H_
@@ -0,0 +1,387 @@
+#ifndef UTILS_THREADS_APP_RUNTIME_H_
+#define UTILS_THREADS_APP_RUNTIME_H_
+
+// The main loop of a controller, shared by the apps instead of copied in each of them.
+//
+// the app registers its redis keys, its stages and their rates, and the runtime owns the
+// rest of the loop : the redis connection, the signal handlers, the timer, the real-time
+// setup of the thread, one pipelined read of all the keys at the start of the tick and one
+// pipelined write at its end (the read and write callbacks 0 of its RedisClient), the
+// telemetry, the loop health, and the shutdown. the keys of the robot come from RobotKeys,
+// in simulation or on the real robot :
+//
+//   const PandaUtils::RobotKeys keys = flag_simulation ? PandaUtils::RobotKeys::simulation()
+//                                                      : PandaUtils::RobotKeys::real("sai2::FrankaPanda::Bonnie");
+//   PandaUtils::AppRuntime app("controller", 1000);
+//   app.addEigenToRead(keys.joint_angles, robot->_q);
+//   app.addEigenToRead(keys.joint_velocities, robot->_dq);
+//   app.addEigenToWrite(keys.torques_commanded, command_torques);
+//   app.addStage("updateModel", [&](const double time) { robot->updateModel(); });
+//   app.addStage("computeTorques", [&](const double time) { ... command_torques = ...; });
+//   app.addStage("goal", [&](const double time) { ... }, 100);        // every 10th tick
+//   app.telemetry().addEigen(LOG_KEY, value);
+//   app.onShutdown([&]() { command_torques.setZero(); });              // written once more on exit
+//   app.run();                                                         // until SIGINT, SIGTERM or SIGABRT
+//   app.print(std::cout);
+//
+// the stages run in the order of registration, after the read and before the write, with
+// the time since the start of the loop in seconds. the frequency of a stage divides the one
+// of the loop, 0 for every tick. with PANDA_CYCLE_PROFILER every stage, the read and the
+// write are profiled (timer/CycleProfiler.h). the objects of the keys must not move after
+// they are registered, the callbacks hold references to them.
+//
+// with setOverlappedIO(true) the write of a tick and the read of the next one go out as one
+// pipeline right after the last stage, and the next tick starts from the replies that
+// arrived during the sleep (redis/OverlappedRedisIO.h) : no round trip is left on the
+// critical path, the state is older by the sleep of the loop. the stages do not use the
+// connection of redisClient() in that mode, a pipeline is in flight while they run.
+//
+// arena() is reset at the top of every tick, for the temporaries of the stages
+// (memory/CycleArena.h).
+
+#include "memory/CycleArena.h"
+#include "redis/OverlappedRedisIO.h"
+#include "redis/RedisClient.h"
+#include "redis/TelemetryWriter.h"
+#include "threads/RealtimeThread.h"
+#include "timer/CycleProfiler.h"
+#include "timer/LoopHealth.h"
+#include "timer/LoopTimer.h"
+#include <Eigen/Dense>
+
+#include <signal.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+// keys of the state and commands of a panda, in the simulation of the apps or from the driver
+struct RobotKeys {
+
+	static RobotKeys simulation()
+	{
+		RobotKeys keys;
+		keys.joint_angles = "sai2::PandaApplication::sensors::q";
+		keys.joint_velocities = "sai2::PandaApplication::sensors::dq";
+		keys.torques_commanded = "sai2::PandaApplication::actuators::fgc";
+		return keys;
+	}
+
+	// prefix of the driver, e.g. sai2::FrankaPanda::Bonnie
+	static RobotKeys real(const std::string& prefix = "sai2::FrankaPanda")
+	{
+		RobotKeys keys;
+		keys.joint_angles = prefix + "::sensors::q";
+		keys.joint_velocities = prefix + "::sensors::dq";
+		keys.torques_sensed = prefix + "::sensors::torques";
+		keys.mass_matrix = prefix + "::sensors::model::massmatrix";
+		keys.coriolis = prefix + "::sensors::model::coriolis";
+		keys.robot_gravity = prefix + "::sensors::model::robot_gravity";
+		keys.torques_commanded = prefix + "::actuators::fgc";
+		return keys;
+	}
+
+	// the model keys are only published by the driver of the real robot
+	bool hasModel() const { return !mass_matrix.empty(); }
+
+	std::string joint_angles;
+	std::string joint_velocities;
+	std::string torques_sensed;
+	std::string mass_matrix;
+	std::string coriolis;
+	std::string robot_gravity;
+	std::string torques_commanded;
+};
+
+class AppRuntime {
+public:
+
+	// name of the loop thread, frequency of the loop in Hz
+	AppRuntime(const std::string& name, const double frequency,
+			const std::string& hostname = "127.0.0.1", const int port = 6379)
+	: _name(name),
+	  _frequency(frequency),
+	  _n_reads(0),
+	  _n_writes(0),
+	  _overlapped_io(_redis_client),
+	  _f_overlapped_io(false),
+	  _n_ticks(0),
+	  _run_time(0),
+	  _telemetry(hostname, port),
+	  _loop_health(frequency > 0 ? frequency : 1.0),
+	  _read_stage(-1),
+	  _write_stage(-1)
+	{
+		if(frequency <= 0)
+		{
+			throw std::invalid_argument("loop frequency must be positive in AppRuntime::AppRuntime()\n");
+		}
+		_redis_client.connect(hostname, port);
+		_redis_client.createReadCallback(0);
+		_redis_client.createWriteCallback(0);
+		_read_stage = _profiler.addStage("redis read");
+		_write_stage = _profiler.addStage("redis write");
+
+		stopRequested() = false;
+		signal(SIGABRT, &AppRuntime::signalHandler);
+		signal(SIGTERM, &AppRuntime::signalHandler);
+		signal(SIGINT, &AppRuntime::signalHandler);
+	}
+
+	~AppRuntime()
+	{
+		_telemetry.stop();
+	}
+
+	// for the setup of the app (initial state, default gains), not in the stages
+	RedisClient& redisClient() { return _redis_client; }
+
+	// for the temporaries of the stages, valid until the end of the tick
+	CycleArena& arena() { return _arena; }
+
+	// telemetry-only keys, bound before run() and published every tick
+	TelemetryWriter& telemetry() { return _telemetry; }
+
+	// keys of the pipelined read and write of every tick, before run()
+	template<typename Scalar, int Rows, int Cols>
+	void addEigenToRead(const std::string& key, Eigen::Matrix<Scalar, Rows, Cols>& object)
+	{
+		_redis_client.addEigenToReadCallback(0, key, object);
+		_overlapped_io.addEigenToRead(key, object);
+		_n_reads++;
+	}
+
+	void addDoubleToRead(const std::string& key, double& object)
+	{
+		_redis_client.addDoubleToReadCallback(0, key, object);
+		_overlapped_io.addDoubleToRead(key, object);
+		_n_reads++;
+	}
+
+	template<typename Scalar, int Rows, int Cols>
+	void addEigenToWrite(const std::string& key, Eigen::Matrix<Scalar, Rows, Cols>& object)
+	{
+		_redis_client.addEigenToWriteCallback(0, key, object);
+		_overlapped_io.addEigenToWrite(key, object);
+		_n_writes++;
+	}
+
+	void addDoubleToWrite(const std::string& key, double& object)
+	{
+		_redis_client.addDoubleToWriteCallback(0, key, object);
+		_overlapped_io.addDoubleToWrite(key, object);
+		_n_writes++;
+	}
+
+	// before run(). frequency in Hz, dividing the one of the loop, 0 for every tick
+	void addStage(const std::string& name, const std::function<void(double)>& stage, const double frequency = 0)
+	{
+		int divider = 1;
+		if(frequency > 0)
+		{
+			divider = (int) std::round(_frequency / frequency);
+			if(frequency > _frequency || std::abs(divider * frequency - _frequency) > 1e-6 * _frequency)
+			{
+				throw std::invalid_argument("stage frequency must divide the loop frequency in AppRuntime::addStage()\n");
+			}
+		}
+		Stage s;
+		s.run = stage;
+		s.divider = divider;
+		s.profile = _profiler.addStage(name);
+		_stages.push_back(s);
+	}
+
+	// after the loop, before the last write (e.g. zero torques)
+	void onShutdown(const std::function<void()>& hook)
+	{
+		_shutdown_hooks.push_back(hook);
+	}
+
+	// before run(). the state of a tick is prefetched at the end of the previous one
+	void setOverlappedIO(const bool overlapped_io)
+	{
+		_f_overlapped_io = overlapped_io;
+	}
+
+	// key of the loop health and of the profile of the stages, published once per second
+	void setLoopHealthKey(const std::string& key)
+	{
+		_loop_health_key = key;
+	}
+
+	// the loop on the calling thread, until a signal or requestStop()
+	void run(const RealtimeConfig& config = RealtimeConfig::fifo(80))
+	{
+		const bool telemetry = _telemetry.numKeys() > 0;
+		if(telemetry)
+		{
+			_telemetry.start();
+		}
+
+		LoopTimer timer;
+		timer.initializeTimer();
+		timer.setLoopFrequency(_frequency);
+		configureRealtimeThread(_name, config);
+		const unsigned long long publish_divider = (unsigned long long) std::max(1.0, std::round(_frequency));
+		const double start_time = timer.elapsedTime();
+		if(_f_overlapped_io)
+		{
+			_overlapped_io.prefetch();
+		}
+
+		while(!stopRequested())
+		{
+			_loop_health.waitForNextLoop(timer);
+			const double time = timer.elapsedTime() - start_time;
+			_arena.reset();
+
+			PANDA_PROFILE_CYCLE(_profiler);
+			PANDA_PROFILE_STAGE(_read_stage);
+			if(_f_overlapped_io)
+			{
+				_overlapped_io.complete();
+			}
+			else if(_n_reads > 0)
+			{
+				_redis_client.executeReadCallback(0);
+			}
+			for(unsigned int i=0 ; i<_stages.size() ; i++)
+			{
+				if(_n_ticks % _stages[i].divider == 0)
+				{
+					PANDA_PROFILE_STAGE(_stages[i].profile);
+					_stages[i].run(time);
+				}
+			}
+			PANDA_PROFILE_STAGE(_write_stage);
+			if(_f_overlapped_io)
+			{
+				_overlapped_io.writeAndPrefetch();
+			}
+			else if(_n_writes > 0)
+			{
+				_redis_client.executeWriteCallback(0);
+			}
+			PANDA_PROFILE_STAGE(-1);
+			if(telemetry)
+			{
+				_telemetry.publish();
+			}
+
+			if(!_loop_health_key.empty() && _n_ticks % publish_divider == 0)
+			{
+				// the connection is free between the replies and the next prefetch
+				_overlapped_io.complete();
+				_loop_health.publish(_redis_client, _loop_health_key);
+#ifdef PANDA_CYCLE_PROFILER
+				_profiler.publish(_redis_client, _loop_health_key + "::profile");
+#endif
+				if(_f_overlapped_io)
+				{
+					_overlapped_io.prefetch();
+				}
+			}
+			_n_ticks++;
+		}
+		_run_time = timer.elapsedTime() - start_time;
+		_overlapped_io.complete();
+
+		for(unsigned int i=0 ; i<_shutdown_hooks.size() ; i++)
+		{
+			_shutdown_hooks[i]();
+		}
+		if(_n_writes > 0)
+		{
+			_redis_client.executeWriteCallback(0);
+		}
+		_telemetry.stop();
+	}
+
+	// ends run() after the current tick, as the signals
+	static void requestStop()
+	{
+		stopRequested() = true;
+	}
+
+	// run time, updates, frequency, loop health and, with PANDA_CYCLE_PROFILER, the stages
+	void print(std::ostream& os) const
+	{
+		os << "\n";
+		os << _name << " run time  : " << _run_time << " seconds\n";
+		os << _name << " updates   : " << _n_ticks << "\n";
+		os << _name << " frequency : " << (_run_time > 0 ? _n_ticks / _run_time : 0) << "Hz\n";
+		_loop_health.print(os);
+		if(_arena.highWaterMark() > 0)
+		{
+			os << _name << " arena     : " << _arena.highWaterMark() << " bytes per tick at most, "
+				<< _arena.numGrowths() << " growths\n";
+		}
+		if(_telemetry.numKeys() > 0)
+		{
+			os << _name << " telemetry : " << _telemetry.publishedCount() << " records, "
+				<< _telemetry.droppedCount() << " dropped\n";
+		}
+#ifdef PANDA_CYCLE_PROFILER
+		_profiler.print(os);
+#endif
+	}
+
+	unsigned long long numTicks() const { return _n_ticks; }
+	double frequency() const { return _frequency; }
+	const LoopHealth& loopHealth() const { return _loop_health; }
+	const CycleProfiler& profiler() const { return _profiler; }
+
+private:
+
+	struct Stage {
+		std::function<void(double)> run;
+		unsigned long long divider;
+		int profile;
+	};
+
+	static std::atomic<bool>& stopRequested()
+	{
+		static std::atomic<bool> stop(false);
+		return stop;
+	}
+
+	static void signalHandler(int)
+	{
+		stopRequested() = true;
+	}
+
+	const std::string _name;
+	const double _frequency;
+
+	RedisClient _redis_client;
+	int _n_reads;
+	int _n_writes;
+	OverlappedRedisIO _overlapped_io;
+	bool _f_overlapped_io;
+
+	std::vector<Stage> _stages;
+	std::vector<std::function<void()>> _shutdown_hooks;
+
+	unsigned long long _n_ticks;
+	double _run_time;
+
+	CycleArena _arena;
+	TelemetryWriter _telemetry;
+	LoopHealth _loop_health;
+	std::string _loop_health_key;
+	CycleProfiler _profiler;
+	int _read_stage;
+	int _write_stage;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_THREADS_APP_RUNTIME_H_
@@ -0,0 +1,465 @@
+#ifndef UTILS_THREADS_CONTROLLER_HOST_H_
+#define UTILS_THREADS_CONTROLLER_HOST_H_
+
+// Several controllers in one process : modules with their own rate and deadline, on a pool
+// of pinned workers, sharing one redis connection.
+//
+// instead of one process per arm, haptic device or gripper, each with its connection and
+// its timer, the controllers are modules of one host. the host thread runs the shared I/O
+// at the rate of the host : one pipelined read of the keys of all the modules with the read
+// callback of its RedisClient, the release of the modules due on this tick, and one
+// pipelined write. a released module is a job with an absolute deadline, the workers take
+// the ready job of the earliest deadline first (non preemptive EDF), so a 1 kHz arm is not
+// delayed by a 100 Hz gripper that was released at the same tick :
+//
+//   PandaUtils::ControllerHost host(redis_client, 1000.0, 2, {2, 3});   // 2 workers on cpus 2 and 3
+//   host.addEigenToRead(JOINT_ANGLES_KEYS[i], io_q[i]);                 // shared I/O, host thread only
+//   host.addEigenToWrite(JOINT_TORQUES_COMMANDED_KEYS[i], io_torques[i]);
+//   host.addModule("Clyde joint", 1000.0, 0.5e-3,
+//       [&](const double time) { joint_tasks[0]->computeTorques(torques[0]); },       // worker
+//       [&]() { robots[0]->_q = io_q[0]; },                                            // host thread, at the release
+//       [&]() { io_torques[0] = torques[0]; });                                        // host thread, when done
+//   host.addModule("gripper", 100.0, 5e-3, ...);
+//   host.run(runloop);
+//   host.print(std::cout);
+//
+// the input function of a module copies what it needs from the I/O objects before its job
+// is queued, the output function copies its results back once the job is done, both on the
+// host thread and never while the job runs. the host waits for the jobs with a deadline in
+// the current tick before the write, up to their deadline, so a 1 kHz module with a
+// deadline shorter than the host period reads, computes and writes in the same tick. a job
+// done after its deadline is a missed deadline, its output goes out on the next tick. a
+// module still running at its next release skips that release.
+//
+// the frequency of a module divides the one of the host and its deadline is at most its
+// period. the host thread and the workers are configured with threads/RealtimeThread.h.
+
+#include "redis/RedisClient.h"
+#include "redis/RedisLatencyStats.h"
+#include "threads/RealtimeThread.h"
+#include "timer/LoopHealth.h"
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace PandaUtils {
+
+class ControllerHost {
+public:
+
+	ControllerHost(RedisClient& redis_client, const double host_frequency, const int n_workers,
+			const std::vector<int>& worker_cpus = std::vector<int>(), const int worker_priority = 70,
+			const int read_callback_number = 0, const int write_callback_number = 0)
+	: _redis_client(redis_client),
+	  _n_workers(n_workers),
+	  _worker_cpus(worker_cpus),
+	  _worker_priority(worker_priority),
+	  _read_callback_number(read_callback_number),
+	  _write_callback_number(write_callback_number),
+	  _n_reads(0),
+	  _n_writes(0),
+	  _stop(false),
+	  _loop_health(host_frequency > 0 ? host_frequency : 1.0)
+	{
+		if(host_frequency <= 0)
+		{
+			throw std::invalid_argument("host frequency must be positive in ControllerHost::ControllerHost()\n");
+		}
+		if(n_workers < 1)
+		{
+			throw std::invalid_argument("at least one worker is needed in ControllerHost::ControllerHost()\n");
+		}
+		_host_frequency = host_frequency;
+		_host_period = std::chrono::nanoseconds((long long) (1e9 / host_frequency + 0.5));
+		_redis_client.createReadCallback(_read_callback_number);
+		_redis_client.createWriteCallback(_write_callback_number);
+	}
+
+	~ControllerHost()
+	{
+		stopWorkers();
+	}
+
+	// shared I/O, before run(). the objects are only accessed by the host thread
+	template<typename Scalar, int Rows, int Cols>
+	void addEigenToRead(const std::string& key, Eigen::Matrix<Scalar, Rows, Cols>& object)
+	{
+		_redis_client.addEigenToReadCallback(_read_callback_number, key, object);
+		_n_reads++;
+	}
+
+	void addDoubleToRead(const std::string& key, double& object)
+	{
+		_redis_client.addDoubleToReadCallback(_read_callback_number, key, object);
+		_n_reads++;
+	}
+
+	template<typename Scalar, int Rows, int Cols>
+	void addEigenToWrite(const std::string& key, Eigen::Matrix<Scalar, Rows, Cols>& object)
+	{
+		_redis_client.addEigenToWriteCallback(_write_callback_number, key, object);
+		_n_writes++;
+	}
+
+	void addDoubleToWrite(const std::string& key, double& object)
+	{
+		_redis_client.addDoubleToWriteCallback(_write_callback_number, key, object);
+		_n_writes++;
+	}
+
+	// before run(). compute(time) runs on a worker, input() and output() on the host thread.
+	// returns the index of the module
+	int addModule(const std::string& name, const double frequency, const double relative_deadline,
+			const std::function<void(double)>& compute,
+			const std::function<void()>& input = std::function<void()>(),
+			const std::function<void()>& output = std::function<void()>())
+	{
+		if(frequency <= 0 || frequency > _host_frequency)
+		{
+			throw std::invalid_argument("module frequency must be positive and at most the host frequency in ControllerHost::addModule()\n");
+		}
+		const double ticks = _host_frequency / frequency;
+		const long period_ticks = std::lround(ticks);
+		if(std::abs(ticks - period_ticks) > 1e-6 * ticks)
+		{
+			throw std::invalid_argument("module frequency must divide the host frequency in ControllerHost::addModule()\n");
+		}
+		if(relative_deadline <= 0 || relative_deadline > 1.0 / frequency + 1e-12)
+		{
+			throw std::invalid_argument("module deadline must be positive and at most its period in ControllerHost::addModule()\n");
+		}
+		if(!compute)
+		{
+			throw std::invalid_argument("module without compute function in ControllerHost::addModule()\n");
+		}
+
+		std::unique_ptr<Module> module(new Module());
+		module->name = name;
+		module->period_ticks = period_ticks;
+		module->relative_deadline = std::chrono::nanoseconds((long long) (relative_deadline * 1e9 + 0.5));
+		module->compute = compute;
+		module->input = input;
+		module->output = output;
+		module->state = IDLE;
+		module->missed = false;
+		module->n_releases = 0;
+		module->n_skipped = 0;
+		module->n_missed = 0;
+		_modules.push_back(std::move(module));
+		return _modules.size() - 1;
+	}
+
+	// the loop of the host on the calling thread, until runloop is false
+	void run(const bool& runloop, const RealtimeConfig& host_config = RealtimeConfig::fifo(80))
+	{
+		startWorkers();
+		configureRealtimeThread("controller host", host_config);
+
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		std::chrono::steady_clock::time_point tick_start = start;
+		unsigned long tick = 0;
+		while(runloop)
+		{
+			const bool did_sleep = std::chrono::steady_clock::now() < tick_start;
+			std::this_thread::sleep_until(tick_start);
+			_loop_health.startCycle(did_sleep);
+			const double time = std::chrono::duration<double>(tick_start - start).count();
+
+			_redis_client.executeReadCallback(_read_callback_number);
+			release(tick, tick_start, time);
+			waitAndCollect(tick_start + _host_period);
+			_redis_client.executeWriteCallback(_write_callback_number);
+
+			_loop_health.endCycle();
+			tick++;
+			tick_start += _host_period;
+			// after an overrun, restart the schedule from now instead of catching up
+			const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if(now > tick_start + _host_period)
+			{
+				tick_start = now;
+			}
+		}
+
+		// let the running jobs finish and write their outputs once more
+		waitForAll();
+		collect(std::chrono::steady_clock::now());
+		_redis_client.executeWriteCallback(_write_callback_number);
+		stopWorkers();
+	}
+
+	int modules() const { return _modules.size(); }
+	const std::string& moduleName(const int i) const { return _modules[i]->name; }
+	uint64_t releases(const int i) const { return _modules[i]->n_releases; }
+	// releases skipped because the previous job of the module was still running
+	uint64_t skippedReleases(const int i) const { return _modules[i]->n_skipped; }
+	uint64_t missedDeadlines(const int i) const { return _modules[i]->n_missed; }
+	// release to done
+	const LatencyHistogram& responseTime(const int i) const { return _modules[i]->response_time; }
+	const LoopHealth& hostHealth() const { return _loop_health; }
+
+	void print(std::ostream& os) const
+	{
+		os << "controller host : " << _modules.size() << " modules on " << _n_workers << " workers, "
+			<< _n_reads << " keys read and " << _n_writes << " keys written per tick at " << _host_frequency << " Hz\n";
+		os << "response (us)" << std::setw(29) << "mean" << std::setw(10) << "p50"
+			<< std::setw(10) << "p99" << std::setw(10) << "max" << std::setw(10) << "missed" << std::setw(10) << "skipped" << "\n";
+		os << std::fixed << std::setprecision(1);
+		for(unsigned int i=0 ; i<_modules.size() ; i++)
+		{
+			const Module& module = *_modules[i];
+			os << std::left << std::setw(32) << module.name.substr(0, 31) << std::right
+				<< std::setw(10) << module.response_time.meanMicroseconds()
+				<< std::setw(10) << module.response_time.percentileMicroseconds(50)
+				<< std::setw(10) << module.response_time.percentileMicroseconds(99)
+				<< std::setw(10) << module.response_time.maxMicroseconds()
+				<< std::setw(10) << module.n_missed
+				<< std::setw(10) << module.n_skipped << "\n";
+		}
+		_loop_health.print(os);
+	}
+
+private:
+
+	enum State { IDLE, READY, RUNNING, DONE };
+
+	struct Module {
+		std::string name;
+		long period_ticks;
+		std::chrono::nanoseconds relative_deadline;
+		std::function<void(double)> compute;
+		std::function<void()> input;
+		std::function<void()> output;
+
+		// under the mutex of the host
+		State state;
+		double release_time;
+		std::chrono::steady_clock::time_point release;
+		std::chrono::steady_clock::time_point deadline;
+		std::chrono::steady_clock::time_point done;
+
+		// host thread
+		bool missed;
+		uint64_t n_releases;
+		uint64_t n_skipped;
+		uint64_t n_missed;
+		LatencyHistogram response_time;
+	};
+
+	// the ready queue is a heap of the earliest deadline on top
+	struct LaterDeadline {
+		bool operator()(const Module* a, const Module* b) const { return a->deadline > b->deadline; }
+	};
+
+	void release(const unsigned long tick, const std::chrono::steady_clock::time_point tick_start, const double time)
+	{
+		bool released = false;
+		for(unsigned int i=0 ; i<_modules.size() ; i++)
+		{
+			Module& module = *_modules[i];
+			if(tick % module.period_ticks != 0)
+			{
+				continue;
+			}
+			State state;
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				state = module.state;
+			}
+			if(state != IDLE)
+			{
+				module.n_skipped++;
+				continue;
+			}
+			if(module.input)
+			{
+				module.input();
+			}
+			std::lock_guard<std::mutex> lock(_mutex);
+			module.state = READY;
+			module.release_time = time;
+			module.release = std::chrono::steady_clock::now();
+			module.deadline = tick_start + module.relative_deadline;
+			module.n_releases++;
+			module.missed = false;
+			_ready.push_back(&module);
+			std::push_heap(_ready.begin(), _ready.end(), LaterDeadline());
+			released = true;
+		}
+		if(released)
+		{
+			_work_condition.notify_all();
+		}
+	}
+
+	// wait for the jobs due before tick_end, up to their deadline, then collect the done jobs
+	void waitAndCollect(const std::chrono::steady_clock::time_point tick_end)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		while(true)
+		{
+			std::chrono::steady_clock::time_point wait_until = std::chrono::steady_clock::time_point::min();
+			for(unsigned int i=0 ; i<_modules.size() ; i++)
+			{
+				const Module& module = *_modules[i];
+				if((module.state == READY || module.state == RUNNING) && module.deadline <= tick_end)
+				{
+					wait_until = std::max(wait_until, module.deadline);
+				}
+			}
+			if(wait_until == std::chrono::steady_clock::time_point::min()
+				|| _done_condition.wait_until(lock, wait_until) == std::cv_status::timeout)
+			{
+				break;
+			}
+		}
+		lock.unlock();
+		collect(tick_end);
+	}
+
+	void waitForAll()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_done_condition.wait(lock, [this]()
+		{
+			for(unsigned int i=0 ; i<_modules.size() ; i++)
+			{
+				if(_modules[i]->state == READY || _modules[i]->state == RUNNING)
+				{
+					return false;
+				}
+			}
+			return true;
+		});
+	}
+
+	// outputs of the done jobs, and the missed deadlines, once per job
+	void collect(const std::chrono::steady_clock::time_point now)
+	{
+		for(unsigned int i=0 ; i<_modules.size() ; i++)
+		{
+			Module& module = *_modules[i];
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				if(module.state != DONE)
+				{
+					if(module.state != IDLE && module.deadline < now && !module.missed)
+					{
+						module.n_missed++;
+						module.missed = true;
+					}
+					continue;
+				}
+			}
+			if(module.done > module.deadline && !module.missed)
+			{
+				module.n_missed++;
+			}
+			module.response_time.record(std::chrono::duration_cast<std::chrono::nanoseconds>(module.done - module.release).count());
+			if(module.output)
+			{
+				module.output();
+			}
+			std::lock_guard<std::mutex> lock(_mutex);
+			module.state = IDLE;
+		}
+	}
+
+	void startWorkers()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if(!_workers.empty())
+		{
+			return;
+		}
+		_stop = false;
+		for(int i=0 ; i<_n_workers ; i++)
+		{
+			_workers.push_back(std::thread(&ControllerHost::workerLoop, this, i));
+		}
+	}
+
+	void stopWorkers()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_work_condition.notify_all();
+		for(unsigned int i=0 ; i<_workers.size() ; i++)
+		{
+			_workers[i].join();
+		}
+		_workers.clear();
+	}
+
+	void workerLoop(const int index)
+	{
+		RealtimeConfig config = RealtimeConfig::fifo(_worker_priority);
+		if(!_worker_cpus.empty())
+		{
+			config.cpus.push_back(_worker_cpus[index % _worker_cpus.size()]);
+		}
+		configureRealtimeThread("controller host worker " + std::to_string(index), config);
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		while(true)
+		{
+			_work_condition.wait(lock, [this]() { return _stop || !_ready.empty(); });
+			if(_ready.empty())
+			{
+				return;
+			}
+			std::pop_heap(_ready.begin(), _ready.end(), LaterDeadline());
+			Module* module = _ready.back();
+			_ready.pop_back();
+			module->state = RUNNING;
+			lock.unlock();
+
+			module->compute(module->release_time);
+
+			lock.lock();
+			module->done = std::chrono::steady_clock::now();
+			module->state = DONE;
+			_done_condition.notify_one();
+		}
+	}
+
+	RedisClient& _redis_client;
+	double _host_frequency;
+	std::chrono::nanoseconds _host_period;
+	int _n_workers;
+	std::vector<int> _worker_cpus;
+	int _worker_priority;
+	int _read_callback_number;
+	int _write_callback_number;
+	int _n_reads;
+	int _n_writes;
+
+	std::vector<std::unique_ptr<Module>> _modules;
+
+	std::mutex _mutex;
+	std::condition_variable _work_condition;
+	std::condition_variable _done_condition;
+	std::vector<Module*> _ready;
+	bool _stop;
+	std::vector<std::thread> _workers;
+
+	LoopHealth _loop_health;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_THREADS_CONTROLLER_HOST_H_
@@ -0,0 +1,135 @@
+#ifndef UTILS_THREADS_CONTROLLER_STAGE_H_
+#define UTILS_THREADS_CONTROLLER_STAGE_H_
+
+// Interface of the controllers built as loadable modules, that a running host swaps without
+// a restart (see threads/StageReloader.h).
+//
+// a module is a shared library with one class that implements ControllerStage, exported by
+// PANDA_CONTROLLER_STAGE. the host keeps the robot model and the redis I/O, it updates the
+// model before every compute() and writes the torques after it :
+//
+//   class JointHoldStage : public PandaUtils::ControllerStage {
+//   public:
+//       JointHoldStage(const PandaUtils::ControllerStageContext& context) : _robot(context.robot) {}
+//       void start(const PandaUtils::StageState& previous)
+//       {
+//           if(!previous.get("desired_position", _desired_position))  // the first stage of the host
+//           {
+//               _desired_position = _robot->_q;
+//           }
+//       }
+//       void compute(const double time, Eigen::VectorXd& torques) { ... }
+//       void exportState(PandaUtils::StageState& state) const { state.set("desired_position", _desired_position); }
+//   };
+//   PANDA_CONTROLLER_STAGE(JointHoldStage)
+//
+// the constructor runs on the thread of the loader while the control thread updates the
+// model, it should not read its state (_q, _dq, the tasks built on it). start(), compute()
+// and exportState() run on the control thread. the previous stage exports its state at the
+// tick of the swap and its successor starts from it, so a new variant takes over the desired
+// positions, integrators or phase of the state machine instead of starting from the current
+// configuration. the names of the state are a convention between the variants of a controller.
+//
+// the host and the modules are built with the same compiler and the same headers; a stage
+// should not leave objects of its library in the host (std::function, statics), the library
+// is closed after the stage is destroyed.
+
+#include "Sai2Model.h"
+#include <Eigen/Dense>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// the host refuses the modules built with another version of this header
+#define PANDA_CONTROLLER_STAGE_API_VERSION 1
+
+namespace PandaUtils {
+
+struct ControllerStageContext
+{
+	Sai2Model::Sai2Model* robot;
+	// seconds between two compute()
+	double period;
+	// of the module, e.g. to find its parameter files
+	std::string module_path;
+
+	ControllerStageContext() : robot(NULL), period(0) {}
+};
+
+// named vectors handed from a stage to the next one
+class StageState {
+public:
+
+	void set(const std::string& name, const Eigen::VectorXd& value)
+	{
+		for(unsigned int i=0 ; i<_values.size() ; i++)
+		{
+			if(_values[i].first == name)
+			{
+				_values[i].second = value;
+				return;
+			}
+		}
+		_values.push_back(std::make_pair(name, value));
+	}
+
+	// false when the previous stage did not export it, value is not changed
+	bool get(const std::string& name, Eigen::VectorXd& value) const
+	{
+		for(unsigned int i=0 ; i<_values.size() ; i++)
+		{
+			if(_values[i].first == name)
+			{
+				value = _values[i].second;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool empty() const { return _values.empty(); }
+	void clear() { _values.clear(); }
+
+private:
+	std::vector<std::pair<std::string, Eigen::VectorXd>> _values;
+};
+
+class ControllerStage {
+public:
+	virtual ~ControllerStage() {}
+
+	// at the tick of the swap, before the first compute(). previous is empty for the first
+	// stage of the host. an exception refuses the stage, the previous one keeps running
+	virtual void start(const StageState& previous) = 0;
+
+	// the torques of the tick, from the model updated by the host. an exception faults the
+	// stage, the host then holds the last torques
+	virtual void compute(const double time, Eigen::VectorXd& torques) = 0;
+
+	// at the tick of the swap, for the next stage
+	virtual void exportState(StageState& state) const = 0;
+};
+
+typedef ControllerStage* (*CreateControllerStageFunction)(const int api_version, const ControllerStageContext* context);
+typedef void (*DestroyControllerStageFunction)(ControllerStage* stage);
+
+} /* namespace PandaUtils */
+
+// in the source file of the module, once
+#define PANDA_CONTROLLER_STAGE(StageClass) \
+	extern "C" PandaUtils::ControllerStage* panda_create_controller_stage(const int api_version, \
+			const PandaUtils::ControllerStageContext* context) \
+	{ \
+		if(api_version != PANDA_CONTROLLER_STAGE_API_VERSION) \
+		{ \
+			return NULL; \
+		} \
+		return new StageClass(*context); \
+	} \
+	extern "C" void panda_destroy_controller_stage(PandaUtils::ControllerStage* stage) \
+	{ \
+		delete stage; \
+	}
+
+#endif //UTILS_THREADS_CONTROLLER_STAGE_H_
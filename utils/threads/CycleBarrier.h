@@ -0,0 +1,86 @@
+#ifndef UTILS_THREADS_CYCLE_BARRIER_H_
+#define UTILS_THREADS_CYCLE_BARRIER_H_
+
+// Barrier of a fixed set of periodic threads, for the points where they coordinate.
+//
+// wait() blocks until all the n_threads threads called it, then releases them together
+// and can be used again. it returns the time at which the last thread arrived, the same
+// for every thread, so that the threads of one app start their timers on the same clock
+// and keep the same deadlines without meeting again every cycle :
+//
+//   PandaUtils::CycleBarrier start_barrier(2);
+//
+//   void pairLoop(...)                                     // in each of the 2 threads
+//   {
+//       PandaUtils::configureRealtimeThread(...);
+//       ...
+//       PandaUtils::PrecisionLoopTimer timer(100e-6);
+//       timer.setLoopFrequency(1000);
+//       timer.initializeTimer(start_barrier.wait());       // shared clock
+//       while(runloop)
+//       { ... }
+//   }
+//
+// the waiting threads block on a condition variable, a barrier every cycle costs a wake up
+// per thread : the loops should use it at their rare coordination points (start, mode
+// changes), not as their periodic clock.
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+
+namespace PandaUtils {
+
+class CycleBarrier {
+public:
+
+	CycleBarrier(const int n_threads)
+	: _n_threads(n_threads),
+	  _n_waiting(0),
+	  _generation(0)
+	{
+		if(n_threads <= 0)
+		{
+			throw std::invalid_argument("number of threads should be positive in CycleBarrier::CycleBarrier()\n");
+		}
+	}
+
+	// time of the arrival of the last thread
+	std::chrono::steady_clock::time_point wait()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		const unsigned long long generation = _generation;
+		if(++_n_waiting == _n_threads)
+		{
+			_release_time = std::chrono::steady_clock::now();
+			_n_waiting = 0;
+			_generation++;
+			_condition.notify_all();
+			return _release_time;
+		}
+		_condition.wait(lock, [&](){return _generation != generation;});
+		// the next generation cannot be released before this thread waits on it again
+		return _release_time;
+	}
+
+	int size() const
+	{
+		return _n_threads;
+	}
+
+private:
+	CycleBarrier(const CycleBarrier&);
+	CycleBarrier& operator=(const CycleBarrier&);
+
+	const int _n_threads;
+	int _n_waiting;
+	unsigned long long _generation;
+	std::chrono::steady_clock::time_point _release_time;
+	std::mutex _mutex;
+	std::condition_variable _condition;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_THREADS_CYCLE_BARRIER_H_
@@ -0,0 +1,218 @@
+#ifndef UTILS_THREADS_REALTIME_THREAD_H_
+#define UTILS_THREADS_REALTIME_THREAD_H_
+
+// Real-time configuration of the calling thread : scheduling, cpus and memory.
+//
+// called once at the start of a periodic thread, before its loop. it sets the scheduling
+// policy and priority of the thread, pins it to a set of cpus, locks the memory of the
+// process so that the loop does not page fault, and prefaults the stack the loop will
+// use. every step that fails, e.g. SCHED_FIFO without CAP_SYS_NICE or an rtprio limit,
+// is reported once and skipped, and the thread keeps running with what was applied :
+//
+//   int main()
+//   {
+//       ...
+//       PandaUtils::configureRealtimeThread("controller", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
+//       while(runloop)
+//       { ... }
+//   }
+//
+//   void simulation(...)
+//   {
+//       PandaUtils::configureRealtimeThread("simulation", PandaUtils::RealtimeConfig::fifo(70, PandaUtils::simulationCpus()));
+//       ...
+//
+// the control threads of the controllers are on cpu 2 and the simulation loops of the simviz
+// on cpu 1 by default, PANDA_CONTROLLER_CPUS and PANDA_SIMULATION_CPUS in the environment
+// override them, e.g. PANDA_CONTROLLER_CPUS=4,5 for a second controller, or empty to not pin.
+//
+// for the priorities to work, e.g. in /etc/security/limits.conf : "@realtime - rtprio 99"
+// and "@realtime - memlock unlimited". PANDA_NO_REALTIME=1 in the environment skips it all.
+
+#include <alloca.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+struct RealtimeConfig
+{
+	// SCHED_FIFO, SCHED_RR, or SCHED_OTHER to keep the normal scheduling
+	int policy;
+	// 1 to 99 for SCHED_FIFO and SCHED_RR
+	int priority;
+	// not pinned when empty
+	std::vector<int> cpus;
+	// mlockall of the process, once for all the threads
+	bool lock_memory;
+	// bytes of the stack touched before the loop
+	size_t prefault_stack;
+
+	RealtimeConfig()
+	: policy(SCHED_OTHER),
+	  priority(0),
+	  lock_memory(true),
+	  prefault_stack(256 * 1024)
+	{}
+
+	static RealtimeConfig fifo(const int priority, const std::vector<int>& cpus = std::vector<int>())
+	{
+		RealtimeConfig config;
+		config.policy = SCHED_FIFO;
+		config.priority = priority;
+		config.cpus = cpus;
+		return config;
+	}
+};
+
+namespace internal {
+
+// the compiler cannot drop the writes of a volatile pointer
+inline void __attribute__((noinline)) prefaultStack(const size_t bytes)
+{
+	volatile unsigned char* stack = (volatile unsigned char*) alloca(bytes);
+	for(size_t i=0 ; i<bytes ; i+=4096)
+	{
+		stack[i] = 0;
+	}
+}
+
+inline bool lockProcessMemory()
+{
+	static std::atomic<int> locked(0);
+	int expected = 0;
+	if(!locked.compare_exchange_strong(expected, 1))
+	{
+		return locked.load() == 1;
+	}
+	if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+	{
+		std::cout << "could not lock the memory of the process (" << std::strerror(errno)
+			<< "), page faults can delay the loops" << std::endl;
+		locked.store(2);
+		return false;
+	}
+	return true;
+}
+
+// cpus of a list like 2,3, false if it is not one
+inline bool parseCpus(const std::string& list, std::vector<int>& cpus)
+{
+	cpus.clear();
+	size_t start = 0;
+	while(start < list.size())
+	{
+		size_t end = list.find(',', start);
+		if(end == std::string::npos)
+		{
+			end = list.size();
+		}
+		const std::string cpu = list.substr(start, end - start);
+		char* parsed_end = NULL;
+		const long value = std::strtol(cpu.c_str(), &parsed_end, 10);
+		if(cpu.empty() || *parsed_end != '\0' || value < 0 || value >= CPU_SETSIZE)
+		{
+			return false;
+		}
+		cpus.push_back(value);
+		start = end + 1;
+	}
+	return true;
+}
+
+} /* namespace internal */
+
+// cpus in the environment variable, e.g. 2,3, empty for not pinned, or default_cpus when it
+// is not set or not a list of cpus
+inline std::vector<int> cpusFromEnvironment(const std::string& variable, const std::vector<int>& default_cpus)
+{
+	const char* value = std::getenv(variable.c_str());
+	if(value == NULL)
+	{
+		return default_cpus;
+	}
+	std::vector<int> cpus;
+	if(!internal::parseCpus(value, cpus))
+	{
+		std::cout << variable << "=" << value << " is not a list of cpus, the default ones are used" << std::endl;
+		return default_cpus;
+	}
+	return cpus;
+}
+
+// cpus of the control thread of a controller
+inline std::vector<int> controllerCpus()
+{
+	return cpusFromEnvironment("PANDA_CONTROLLER_CPUS", std::vector<int>(1, 2));
+}
+
+// cpus of the simulation loop of a simviz
+inline std::vector<int> simulationCpus()
+{
+	return cpusFromEnvironment("PANDA_SIMULATION_CPUS", std::vector<int>(1, 1));
+}
+
+// returns true when everything was applied
+inline bool configureRealtimeThread(const std::string& thread_name, const RealtimeConfig& config)
+{
+	const char* disabled = std::getenv("PANDA_NO_REALTIME");
+	if(disabled != NULL && std::string(disabled) != "0")
+	{
+		return false;
+	}
+
+	bool applied = true;
+
+	if(!config.cpus.empty())
+	{
+		cpu_set_t cpu_set;
+		CPU_ZERO(&cpu_set);
+		for(unsigned int i=0 ; i<config.cpus.size() ; i++)
+		{
+			CPU_SET(config.cpus[i], &cpu_set);
+		}
+		if(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpu_set) != 0)
+		{
+			std::cout << "could not pin the " << thread_name << " thread to its cpus" << std::endl;
+			applied = false;
+		}
+	}
+
+	if(config.policy != SCHED_OTHER)
+	{
+		sched_param param;
+		param.sched_priority = config.priority;
+		const int error = pthread_setschedparam(pthread_self(), config.policy, &param);
+		if(error != 0)
+		{
+			std::cout << "could not set the real-time priority " << config.priority << " of the " << thread_name
+				<< " thread (" << std::strerror(error) << "), it keeps the normal scheduling" << std::endl;
+			applied = false;
+		}
+	}
+
+	if(config.lock_memory && !internal::lockProcessMemory())
+	{
+		applied = false;
+	}
+
+	if(config.prefault_stack > 0)
+	{
+		internal::prefaultStack(config.prefault_stack);
+	}
+
+	return applied;
+}
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_THREADS_REALTIME_THREAD_H_
@@ -0,0 +1,131 @@
+#ifndef UTILS_THREADS_SPSC_QUEUE_H_
+#define UTILS_THREADS_SPSC_QUEUE_H_
+
+// Bounded lock-free queue between one producer thread and one consumer thread.
+//
+// the elements live in a ring allocated once at construction, and are filled
+// and read in place, so pushing or popping is a copy into the ring and one
+// atomic store, never a wait nor an allocation. when the ring is full the
+// producer is told so and decides what to do (drop the value, count it):
+//
+//   PandaUtils::SpscQueue<Sample> queue(64, Sample(dof));
+//
+//   Sample* slot = queue.beginPush();         // producer thread
+//   if(slot) { slot->q = q; queue.endPush(); }
+//
+//   const Sample* sample = queue.front();     // consumer thread
+//   if(sample) { process(*sample); queue.pop(); }
+//
+// the capacity is rounded up to a power of two. for elements with fixed size
+// vectorizable Eigen members, use Eigen::aligned_allocator<T> as Allocator.
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace PandaUtils {
+
+template<typename T, typename Allocator = std::allocator<T> >
+class SpscQueue {
+public:
+
+	// every element of the ring starts as a copy of initial_value, so that
+	// dynamic size members are allocated here and not while pushing
+	SpscQueue(const size_t capacity, const T& initial_value = T())
+	: _head(0), _tail(0)
+	{
+		size_t size = 1;
+		while(size < capacity)
+		{
+			size <<= 1;
+		}
+		_ring.assign(size, initial_value);
+		_mask = size - 1;
+	}
+
+	size_t capacity() const
+	{
+		return _ring.size();
+	}
+
+	// producer thread only : element to fill, NULL if the queue is full
+	T* beginPush()
+	{
+		const size_t tail = _tail.load(std::memory_order_relaxed);
+		if(tail - _head.load(std::memory_order_acquire) == _ring.size())
+		{
+			return NULL;
+		}
+		return &_ring[tail & _mask];
+	}
+
+	// producer thread only : makes the element of beginPush() visible to the consumer
+	void endPush()
+	{
+		_tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	// producer thread only, false if the queue is full
+	bool push(const T& value)
+	{
+		T* slot = beginPush();
+		if(!slot)
+		{
+			return false;
+		}
+		*slot = value;
+		endPush();
+		return true;
+	}
+
+	// consumer thread only : oldest element, NULL if the queue is empty
+	const T* front() const
+	{
+		const size_t head = _head.load(std::memory_order_relaxed);
+		if(head == _tail.load(std::memory_order_acquire))
+		{
+			return NULL;
+		}
+		return &_ring[head & _mask];
+	}
+
+	// consumer thread only : releases the element of front()
+	void pop()
+	{
+		_head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	// consumer thread only, false if the queue is empty
+	bool pop(T& output)
+	{
+		const T* element = front();
+		if(!element)
+		{
+			return false;
+		}
+		output = *element;
+		pop();
+		return true;
+	}
+
+	// approximate when the other thread is running
+	size_t size() const
+	{
+		return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+	}
+
+private:
+
+	std::vector<T, Allocator> _ring;
+	size_t _mask;
+
+	// written by the consumer
+	alignas(64) std::atomic<size_t> _head;
+	// written by the producer
+	alignas(64) std::atomic<size_t> _tail;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_THREADS_SPSC_QUEUE_H_
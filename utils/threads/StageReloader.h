@@ -0,0 +1,390 @@
+#ifndef UTILS_THREADS_STAGE_RELOADER_H_
+#define UTILS_THREADS_STAGE_RELOADER_H_
+
+// Controller of a control loop from a loadable module, loaded again when the module is
+// rebuilt and swapped at a tick boundary, without restarting the process.
+//
+// changing the variant of a controller used to mean killing the process and going through
+// its startup again : urdf parsing, redis seeding, homing. with the controller built as a
+// module (see threads/ControllerStage.h), the process keeps the model and the I/O and only
+// the stage changes. a thread of the reloader watches the module file, and when it changed
+// (a new build, or a copy of another variant over it), loads it and builds the new stage
+// off the control thread. the next compute() of the control thread then exports the state
+// of the running stage, starts the new one from it and computes the torques of the tick
+// with it, so the swap costs one call and no tick is missed :
+//
+//   PandaUtils::ControllerStageContext context;
+//   context.robot = robot;
+//   context.period = 1.0 / control_frequency;
+//   PandaUtils::StageReloader stage("./modules/libjoint_hold_stage.so", context);   // throws if it does not load
+//   while(runloop)
+//   {
+//       ...                                          // read the robot state
+//       robot->updateModel();
+//       stage.compute(time, command_torques);        // swaps in a newly loaded stage first
+//       ...                                          // write the torques
+//   }
+//   stage.print(std::cout);
+//
+// a module that does not load, or whose stage refuses to start, is reported and the running
+// stage goes on. a stage whose compute() throws is faulted : the reloader holds the last
+// torques it computed until another module is loaded, faulted() tells the loop. dlopen keeps
+// one copy of a library per path, so the module is copied to a file of its own before every
+// load. the file is loaded once its modification time was the same for two polls, so a
+// build still being written is not loaded.
+
+#include "threads/ControllerStage.h"
+#include <Eigen/Dense>
+
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace PandaUtils {
+
+class StageReloader {
+public:
+
+	StageReloader(const std::string& module_path, const ControllerStageContext& context, const double poll_period = 0.2)
+	: _module_path(module_path),
+	  _context(context),
+	  _poll_period(poll_period),
+	  _current(NULL),
+	  _pending(NULL),
+	  _retired(NULL),
+	  _f_pending(false),
+	  _f_reload_requested(false),
+	  _stop(false),
+	  _f_faulted(false),
+	  _loaded_mtime(0),
+	  _seen_mtime(0),
+	  _n_loads(0),
+	  _n_swaps(0),
+	  _n_failed_loads(0),
+	  _n_refused_starts(0),
+	  _n_faults(0),
+	  _last_swap_duration(0)
+	{
+		if(poll_period <= 0)
+		{
+			throw std::invalid_argument("poll period should be positive in StageReloader::StageReloader()\n");
+		}
+		_context.module_path = module_path;
+		_loaded_mtime = modificationTime();
+		_seen_mtime = _loaded_mtime;
+		std::string error;
+		_current = load(error);
+		if(_current == NULL)
+		{
+			throw std::runtime_error(error + " in StageReloader::StageReloader()\n");
+		}
+		_current->stage->start(_handoff);
+		_watcher = std::thread(&StageReloader::watchLoop, this);
+	}
+
+	~StageReloader()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_watch_condition.notify_all();
+		_watcher.join();
+		unload(_retired);
+		unload(_pending);
+		unload(_current);
+	}
+
+	// control thread, once per tick. swaps in the stage loaded since the last call, if any,
+	// then computes the torques with the running stage
+	void compute(const double time, Eigen::VectorXd& torques)
+	{
+		if(_f_pending.load(std::memory_order_acquire))
+		{
+			swap();
+		}
+		if(_hold_torques.size() != torques.size())
+		{
+			_hold_torques = Eigen::VectorXd::Zero(torques.size());
+		}
+		if(_f_faulted)
+		{
+			torques = _hold_torques;
+			return;
+		}
+		try
+		{
+			_current->stage->compute(time, torques);
+			_hold_torques = torques;
+		}
+		catch(const std::exception& e)
+		{
+			_f_faulted = true;
+			_n_faults++;
+			torques = _hold_torques;
+			std::cout << "stage of " << _module_path << " faulted, holding its last torques : " << e.what() << std::endl;
+		}
+	}
+
+	// loads the module at the next poll even if its file did not change, e.g. after a fault
+	void requestReload()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_f_reload_requested = true;
+		_watch_condition.notify_all();
+	}
+
+	// the running stage threw, the torques are held until another one is loaded
+	bool faulted() const { return _f_faulted; }
+	unsigned long long numLoads() const { return _n_loads; }
+	unsigned long long numSwaps() const { return _n_swaps; }
+	unsigned long long numFailedLoads() const { return _n_failed_loads; }
+	unsigned long long numRefusedStarts() const { return _n_refused_starts; }
+	unsigned long long numFaults() const { return _n_faults; }
+	// seconds of the last swap, export, start and handoff included
+	double lastSwapDuration() const { return _last_swap_duration; }
+
+	void print(std::ostream& os) const
+	{
+		os << "stage of " << _module_path << " : " << _n_loads << " loads, " << _n_swaps << " swaps (last "
+			<< 1e6 * _last_swap_duration << " us), " << _n_failed_loads << " failed loads, "
+			<< _n_refused_starts << " refused starts, " << _n_faults << " faults\n";
+	}
+
+private:
+	StageReloader(const StageReloader&);
+	StageReloader& operator=(const StageReloader&);
+
+	struct LoadedStage
+	{
+		void* library;
+		ControllerStage* stage;
+		DestroyControllerStageFunction destroy;
+	};
+
+	void swap()
+	{
+		std::unique_lock<std::mutex> lock(_mutex, std::try_to_lock);
+		if(!lock.owns_lock() || _pending == NULL || _retired != NULL)
+		{
+			// the loader is busy, or the last stage is not unloaded yet, next tick
+			return;
+		}
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		_handoff.clear();
+		_current->stage->exportState(_handoff);
+		try
+		{
+			_pending->stage->start(_handoff);
+			_retired = _current;
+			_current = _pending;
+			_f_faulted = false;
+			_n_swaps++;
+		}
+		catch(const std::exception& e)
+		{
+			_retired = _pending;
+			_n_refused_starts++;
+			std::cout << "stage of " << _module_path << " refused to start, the running one goes on : " << e.what() << std::endl;
+		}
+		_pending = NULL;
+		_f_pending.store(false, std::memory_order_release);
+		_last_swap_duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		_watch_condition.notify_all();
+	}
+
+	long long modificationTime() const
+	{
+		struct stat info;
+		if(stat(_module_path.c_str(), &info) != 0)
+		{
+			return 0;
+		}
+		return (long long) info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+	}
+
+	// a stage from a fresh copy of the module, NULL and the error if it fails
+	LoadedStage* load(std::string& error)
+	{
+		std::ifstream source(_module_path.c_str(), std::ios::binary);
+		if(!source)
+		{
+			error = "could not read " + _module_path;
+			_n_failed_loads++;
+			return NULL;
+		}
+		std::ostringstream content;
+		content << source.rdbuf();
+		const std::string copy_path = "/tmp/" + _module_path.substr(_module_path.find_last_of('/') + 1)
+			+ "." + std::to_string(getpid()) + "." + std::to_string(_n_loads + _n_failed_loads) + ".so";
+		{
+			std::ofstream copy(copy_path.c_str(), std::ios::binary);
+			copy << content.str();
+			if(!copy)
+			{
+				error = "could not write " + copy_path;
+				_n_failed_loads++;
+				return NULL;
+			}
+		}
+		void* library = dlopen(copy_path.c_str(), RTLD_NOW | RTLD_LOCAL);
+		// the mapping stays after the file is removed
+		std::remove(copy_path.c_str());
+		if(library == NULL)
+		{
+			const char* dl_error = dlerror();
+			error = "could not load " + _module_path + " : " + (dl_error != NULL ? dl_error : "");
+			_n_failed_loads++;
+			return NULL;
+		}
+		CreateControllerStageFunction create = (CreateControllerStageFunction) dlsym(library, "panda_create_controller_stage");
+		DestroyControllerStageFunction destroy = (DestroyControllerStageFunction) dlsym(library, "panda_destroy_controller_stage");
+		if(create == NULL || destroy == NULL)
+		{
+			dlclose(library);
+			error = _module_path + " is not a controller stage module (no PANDA_CONTROLLER_STAGE)";
+			_n_failed_loads++;
+			return NULL;
+		}
+		ControllerStage* stage = NULL;
+		try
+		{
+			stage = create(PANDA_CONTROLLER_STAGE_API_VERSION, &_context);
+		}
+		catch(const std::exception& e)
+		{
+			error = std::string("the stage of ") + _module_path + " could not be built : " + e.what();
+		}
+		if(stage == NULL)
+		{
+			dlclose(library);
+			if(error.empty())
+			{
+				error = _module_path + " was built with another version of ControllerStage.h";
+			}
+			_n_failed_loads++;
+			return NULL;
+		}
+		LoadedStage* loaded = new LoadedStage();
+		loaded->library = library;
+		loaded->stage = stage;
+		loaded->destroy = destroy;
+		_n_loads++;
+		return loaded;
+	}
+
+	static void unload(LoadedStage* loaded)
+	{
+		if(loaded == NULL)
+		{
+			return;
+		}
+		loaded->destroy(loaded->stage);
+		dlclose(loaded->library);
+		delete loaded;
+	}
+
+	void watchLoop()
+	{
+		const std::chrono::nanoseconds poll_period((long long) (_poll_period * 1e9));
+		std::unique_lock<std::mutex> lock(_mutex);
+		while(!_stop)
+		{
+			_watch_condition.wait_for(lock, poll_period);
+			if(_stop)
+			{
+				break;
+			}
+			// the stages are destroyed and unloaded here, not on the control thread
+			if(_retired != NULL)
+			{
+				LoadedStage* retired = _retired;
+				_retired = NULL;
+				lock.unlock();
+				unload(retired);
+				lock.lock();
+			}
+			if(_pending != NULL)
+			{
+				continue;
+			}
+
+			const long long mtime = modificationTime();
+			const bool f_changed = mtime != 0 && mtime != _loaded_mtime && mtime == _seen_mtime;
+			_seen_mtime = mtime;
+			if(!f_changed && !_f_reload_requested)
+			{
+				continue;
+			}
+			_f_reload_requested = false;
+			_loaded_mtime = mtime;
+
+			lock.unlock();
+			std::string error;
+			LoadedStage* loaded = load(error);
+			if(loaded == NULL)
+			{
+				std::cout << error << ", the running stage goes on" << std::endl;
+			}
+			lock.lock();
+			if(loaded != NULL)
+			{
+				if(_stop)
+				{
+					lock.unlock();
+					unload(loaded);
+					lock.lock();
+					break;
+				}
+				_pending = loaded;
+				_f_pending.store(true, std::memory_order_release);
+			}
+		}
+	}
+
+	const std::string _module_path;
+	ControllerStageContext _context;
+	const double _poll_period;
+
+	// the running stage is only used by the control thread, the others under the mutex
+	LoadedStage* _current;
+	LoadedStage* _pending;
+	LoadedStage* _retired;
+	std::atomic<bool> _f_pending;
+	bool _f_reload_requested;
+	bool _stop;
+	std::mutex _mutex;
+	std::condition_variable _watch_condition;
+	std::thread _watcher;
+
+	StageState _handoff;
+	Eigen::VectorXd _hold_torques;
+	bool _f_faulted;
+
+	// loader thread
+	long long _loaded_mtime;
+	long long _seen_mtime;
+	unsigned long long _n_loads;
+
+	unsigned long long _n_swaps;
+	unsigned long long _n_failed_loads;
+	unsigned long long _n_refused_starts;
+	unsigned long long _n_faults;
+	double _last_swap_duration;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_THREADS_STAGE_RELOADER_H_
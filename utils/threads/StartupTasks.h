@@ -0,0 +1,165 @@
+#ifndef UTILS_THREADS_STARTUP_TASKS_H_
+#define UTILS_THREADS_STARTUP_TASKS_H_
+
+// Independent steps of the startup of an app run in parallel, each on a thread of its own.
+//
+// a simviz connects to redis, loads the meshes of the graphics, builds the simulation world
+// and parses the robot models one after the other, although none of them needs another. run()
+// starts a step on its own thread and gives a future of its result, get() joins it before
+// the code that needs it, and report() prints the time of each step and how much the
+// parallel startup saved :
+//
+//   PandaUtils::StartupTasks startup;
+//   auto redis_connected = startup.run("redis connect", []() { redis_client.connect(); });
+//   auto graphics_loaded = startup.run("graphics", []() { return new Sai2Graphics::Sai2Graphics(world_file, true); });
+//   auto sim_built = startup.run("simulation", []() { return new Simulation::Sai2Simulation(world_file, false); });
+//   redis_connected.get();
+//   auto graphics = graphics_loaded.get();
+//   auto sim = sim_built.get();
+//   startup.report(std::cout);
+//
+// get() throws the exception of a step that failed. the steps must not share state, they
+// run concurrently. the futures of std::async join their thread when destroyed, so a step
+// is always finished before the end of the scope of its future.
+
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace PandaUtils {
+
+class StartupTasks {
+public:
+
+	StartupTasks()
+	: _start(std::chrono::steady_clock::now())
+	{}
+
+	// starts the step on a new thread
+	template<typename Function>
+	std::future<typename std::result_of<Function()>::type> run(const std::string& name, Function function)
+	{
+		const int index = addStep(name);
+		return std::async(std::launch::async, [this, index, function]()
+		{
+			StepTimer timer(*this, index);
+			return function();
+		});
+	}
+
+	// a step that has to run on the calling thread (e.g. the glfw window), timed with the others
+	template<typename Function>
+	typename std::result_of<Function()>::type runHere(const std::string& name, Function function)
+	{
+		StepTimer timer(*this, addStep(name));
+		return function();
+	}
+
+	// seconds from the construction to the end of the last step, and the sum of the steps
+	double elapsedTime() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		double end = 0;
+		for(unsigned int i=0 ; i<_steps.size() ; i++)
+		{
+			if(_steps[i].end > end) end = _steps[i].end;
+		}
+		return end;
+	}
+
+	double serialTime() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		double sum = 0;
+		for(unsigned int i=0 ; i<_steps.size() ; i++)
+		{
+			sum += _steps[i].end - _steps[i].begin;
+		}
+		return sum;
+	}
+
+	// after the steps were joined
+	void report(std::ostream& os) const
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			for(unsigned int i=0 ; i<_steps.size() ; i++)
+			{
+				const Step& step = _steps[i];
+				os << "startup " << step.name << " : " << (step.end - step.begin) * 1e3 << " ms";
+				os << (step.done ? "" : " (running)") << "\n";
+			}
+		}
+		os << "startup : " << elapsedTime() * 1e3 << " ms, " << serialTime() * 1e3 << " ms one after the other\n";
+	}
+
+private:
+
+	struct Step {
+		std::string name;
+		// seconds from the construction
+		double begin;
+		double end;
+		bool done;
+	};
+
+	// records the end of a step when it returns or throws
+	class StepTimer {
+	public:
+		StepTimer(StartupTasks& tasks, const int index)
+		: _tasks(tasks), _index(index)
+		{
+			_tasks.mark(_index, false);
+		}
+		~StepTimer()
+		{
+			_tasks.mark(_index, true);
+		}
+	private:
+		StartupTasks& _tasks;
+		const int _index;
+	};
+
+	int addStep(const std::string& name)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		Step step;
+		step.name = name;
+		step.begin = secondsSinceStart();
+		step.end = step.begin;
+		step.done = false;
+		_steps.push_back(step);
+		return _steps.size() - 1;
+	}
+
+	void mark(const int index, const bool done)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if(done)
+		{
+			_steps[index].end = secondsSinceStart();
+		}
+		else
+		{
+			_steps[index].begin = secondsSinceStart();
+		}
+		_steps[index].done = done;
+	}
+
+	double secondsSinceStart() const
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+	}
+
+	const std::chrono::steady_clock::time_point _start;
+	mutable std::mutex _mutex;
+	std::vector<Step> _steps;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_THREADS_STARTUP_TASKS_H_
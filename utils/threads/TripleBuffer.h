@@ -0,0 +1,123 @@
+#ifndef UTILS_THREADS_TRIPLE_BUFFER_H_
+#define UTILS_THREADS_TRIPLE_BUFFER_H_
+
+// Latest value handoff between one writer thread and one reader thread.
+//
+// three copies of the value : the writer fills its own copy and swaps it
+// with the middle one, the reader swaps the middle one with its own copy
+// when a new value was published. the swaps are a single atomic exchange,
+// so neither side ever waits for the other, nothing is allocated, and the
+// reader always gets a whole value (never half of an old one and half of
+// a new one), possibly skipping intermediate values:
+//
+//   struct Estimate { int dimension; Eigen::Matrix3d sigma_force; };
+//   PandaUtils::TripleBuffer<Estimate> estimate_buffer;
+//
+//   estimate_buffer.write(estimate);       // writer thread, e.g. at 100 Hz
+//   estimate_buffer.read(estimate);        // reader thread, e.g. at 1 kHz
+//
+// T is copied by assignment. for a value with vectorizable fixed size
+// Eigen members, allocate the buffer statically or with
+// EIGEN_MAKE_ALIGNED_OPERATOR_NEW in the owning class.
+
+#include <atomic>
+#include <cstdint>
+
+namespace PandaUtils {
+
+template<typename T>
+class TripleBuffer {
+public:
+
+	// the reader gets initial_value until the writer publishes
+	TripleBuffer(const T& initial_value = T())
+	: _write_index(0), _read_index(2), _middle(1 << 1)
+	{
+		for(int i=0 ; i<3 ; i++)
+		{
+			_slots[i].value = initial_value;
+		}
+	}
+
+	// sets every copy to value, with no published value. only while neither thread uses the
+	// buffer (e.g. to size dynamic members before starting them)
+	void reset(const T& value)
+	{
+		for(int i=0 ; i<3 ; i++)
+		{
+			_slots[i].value = value;
+		}
+		_write_index = 0;
+		_read_index = 2;
+		_middle.store(1 << 1);
+	}
+
+	// writer thread only
+	void write(const T& value)
+	{
+		_slots[_write_index].value = value;
+		publish();
+	}
+
+	// writer thread only : fill the value in place then publish() it, to avoid a copy of large values
+	T& writeBuffer()
+	{
+		return _slots[_write_index].value;
+	}
+
+	void publish()
+	{
+		const uint8_t previous = _middle.exchange((_write_index << 1) | NEW_VALUE, std::memory_order_acq_rel);
+		_write_index = previous >> 1;
+	}
+
+	// reader thread only. copies the latest published value to output, returns true if
+	// it was published since the last read
+	bool read(T& output)
+	{
+		const bool new_value = update();
+		output = _slots[_read_index].value;
+		return new_value;
+	}
+
+	// reader thread only : latest published value, valid until the next update() or read()
+	const T& latest()
+	{
+		update();
+		return _slots[_read_index].value;
+	}
+
+	// reader thread only : take the latest published value, false if there is none since the last call
+	bool update()
+	{
+		if(!(_middle.load(std::memory_order_relaxed) & NEW_VALUE))
+		{
+			return false;
+		}
+		const uint8_t previous = _middle.exchange(_read_index << 1, std::memory_order_acq_rel);
+		_read_index = previous >> 1;
+		return true;
+	}
+
+private:
+
+	// the middle slot holds its index in the high bits and this flag when it was not read yet
+	static const uint8_t NEW_VALUE = 1;
+
+	// one cache line per slot, so that the writer and the reader do not share lines
+	struct alignas(64) Slot {
+		T value;
+	};
+
+	Slot _slots[3];
+
+	// owned by the writer
+	alignas(64) uint8_t _write_index;
+	// owned by the reader
+	alignas(64) uint8_t _read_index;
+	alignas(64) std::atomic<uint8_t> _middle;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_THREADS_TRIPLE_BUFFER_H_
@@ -0,0 +1,173 @@
+#ifndef UTILS_THREADS_WORKER_POOL_H_
+#define UTILS_THREADS_WORKER_POOL_H_
+
+// Small pool of persistent worker threads for data parallel loops.
+//
+// run() gives the job to every worker and to the calling thread, each one
+// gets its index in [0, size()) and processes its own part of the data,
+// then run() returns once all of them are done. the threads are created
+// once and can be pinned to cpus, so a periodic loop pays a wake up and
+// not a thread creation per call. nothing is allocated by run():
+//
+//   PandaUtils::WorkerPool pool(4, {2, 3, 4});   // calling thread + 3 workers on cpus 2, 3, 4
+//   auto job = [&](const int index, const int n_threads)
+//   {
+//       const int begin = n * index / n_threads;
+//       const int end = n * (index + 1) / n_threads;
+//       for(int i=begin ; i<end ; i++) { ... }
+//   };
+//   pool.run(job);
+//
+// forEach(n, function) is the same with function(i) called once for every i in [0, n).
+// run() must not be called concurrently, nor from inside a job.
+
+#include <pthread.h>
+
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace PandaUtils {
+
+class WorkerPool {
+public:
+
+	// n_threads counts the calling thread. cpus[i] is the cpu of worker i (thread
+	// index i+1), workers without a cpu are not pinned
+	WorkerPool(const int n_threads, const std::vector<int>& cpus = std::vector<int>())
+	: _n_threads(n_threads > 0 ? n_threads : 1),
+	  _job(NULL),
+	  _job_data(NULL),
+	  _generation(0),
+	  _n_running(0),
+	  _stop(false)
+	{
+		for(int i=1 ; i<_n_threads ; i++)
+		{
+			_workers.push_back(std::thread(&WorkerPool::workerLoop, this, i));
+			if(i - 1 < (int)cpus.size() && cpus[i-1] >= 0)
+			{
+				cpu_set_t cpu_set;
+				CPU_ZERO(&cpu_set);
+				CPU_SET(cpus[i-1], &cpu_set);
+				if(pthread_setaffinity_np(_workers.back().native_handle(), sizeof(cpu_set_t), &cpu_set) != 0)
+				{
+					std::cout << "could not pin worker " << i << " to cpu " << cpus[i-1] << std::endl;
+				}
+			}
+		}
+	}
+
+	~WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_start_condition.notify_all();
+		for(unsigned int i=0 ; i<_workers.size() ; i++)
+		{
+			_workers[i].join();
+		}
+	}
+
+	int size() const { return _n_threads; }
+
+	// job(index, n_threads) on all the threads, returns when all are done
+	template<typename Job>
+	void run(Job& job)
+	{
+		if(_n_threads == 1)
+		{
+			job(0, 1);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_job = &WorkerPool::callJob<Job>;
+			_job_data = &job;
+			_n_running = _n_threads - 1;
+			_generation++;
+		}
+		_start_condition.notify_all();
+
+		job(0, _n_threads);
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		_done_condition.wait(lock, [this]{ return _n_running == 0; });
+	}
+
+	// function(i) for i in [0, n), thread index takes i = index, index + size(), ...
+	// e.g. one robot per thread for the model updates of a multi robot controller
+	template<typename Function>
+	void forEach(const int n, Function& function)
+	{
+		auto job = [n, &function](const int index, const int n_threads)
+		{
+			for(int i=index ; i<n ; i+=n_threads)
+			{
+				function(i);
+			}
+		};
+		run(job);
+	}
+
+private:
+
+	template<typename Job>
+	static void callJob(void* job, const int index, const int n_threads)
+	{
+		(*static_cast<Job*>(job))(index, n_threads);
+	}
+
+	void workerLoop(const int index)
+	{
+		unsigned long long seen_generation = 0;
+		while(true)
+		{
+			void (*job)(void*, int, int);
+			void* job_data;
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_start_condition.wait(lock, [&]{ return _stop || _generation != seen_generation; });
+				if(_stop)
+				{
+					return;
+				}
+				seen_generation = _generation;
+				job = _job;
+				job_data = _job_data;
+			}
+
+			job(job_data, index, _n_threads);
+
+			bool last;
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				last = (--_n_running == 0);
+			}
+			if(last)
+			{
+				_done_condition.notify_one();
+			}
+		}
+	}
+
+	const int _n_threads;
+	std::vector<std::thread> _workers;
+
+	std::mutex _mutex;
+	std::condition_variable _start_condition;
+	std::condition_variable _done_condition;
+	void (*_job)(void*, int, int);
+	void* _job_data;
+	unsigned long long _generation;
+	int _n_running;
+	bool _stop;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_THREADS_WORKER_POOL_H_
@@ -0,0 +1,458 @@
+// Contention benchmark of the ways to share a robot model between the model thread and the
+// control thread.
+//
+// reproduces the access pattern of the multi-rate controllers : a reader thread at 1 kHz (the
+// control loop) makes a number of accesses per tick to a robot model sized object, and a writer
+// thread at 200 Hz (the model update thread) makes a full update of it, that takes update_us.
+// every variant runs for the same duration, and the benchmark reports the time the reader spends
+// in its accesses per tick (median, p99, p99.9 and max), the writer updates per second and the
+// time per update, waiting for the lock included :
+//
+//   safe_ptr        sf::safe_ptr with its default recursive mutex, one exclusive lock per access
+//                   (robots[i]->_q in the apps)
+//   shared_mutex    sf::shared_mutex_safe_ptr, one shared lock per read access (c++14)
+//   contfree        sf::contfree_safe_ptr, the contention free shared mutex of safe_ptr.h
+//   lock_timed      sf::lock_timed_any_infinity, one lock per tick for all the accesses of the tick
+//   snapshot_ptr    PandaUtils::snapshot_ptr, one wait free get() per tick
+//
+// usage : bench_shared_model [-t seconds] [-a accesses] [-u update_us] [-w writer_hz] [-c reader_cpu,writer_cpu] [-o results.csv]
+//   -t  duration of every variant (default 5)
+//   -a  accesses per reader tick (default 20)
+//   -u  duration of a writer update (default 50, about a panda updateModel())
+//   -w  writer rate, 0 for back to back updates, to measure the max writer throughput (default 200)
+//   -c  cpus of the reader and the writer threads (default not pinned)
+//   -o  also write the results as csv
+//
+// with both threads on the same cpu, the reader latencies of the locked variants include the
+// preemption of the writer while it holds the lock (priority inversion).
+
+#include "safe_ptr.h"
+#include "snapshot_ptr.h"
+#include <Eigen/Dense>
+
+#include <pthread.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+typedef chrono::steady_clock Clock;
+
+const int DOF = 7;
+const int TASK_DIM = 6;
+
+// the part of a Sai2Model and its tasks that the control loop reads
+struct ModelData
+{
+	ModelData()
+	{
+		q.setZero(DOF);
+		dq.setZero(DOF);
+		M.setIdentity(DOF, DOF);
+		M_inv.setIdentity(DOF, DOF);
+		J.setZero(TASK_DIM, DOF);
+		Lambda.setIdentity(TASK_DIM, TASK_DIM);
+		Jbar.setZero(DOF, TASK_DIM);
+		N.setIdentity(DOF, DOF);
+		g.setZero(DOF);
+	}
+
+	VectorXd q;
+	VectorXd dq;
+	MatrixXd M;
+	MatrixXd M_inv;
+	MatrixXd J;
+	MatrixXd Lambda;
+	MatrixXd Jbar;
+	MatrixXd N;
+	VectorXd g;
+};
+
+struct Options
+{
+	double seconds;
+	int n_accesses;
+	double update_us;
+	double writer_frequency;
+	int reader_cpu;
+	int writer_cpu;
+};
+
+struct BenchResult
+{
+	string variant;
+	long reader_ticks;
+	double reader_median_ns;
+	double reader_p99_ns;
+	double reader_p999_ns;
+	double reader_max_ns;
+	long writer_updates;
+	double writer_updates_per_second;
+	double writer_mean_update_us;
+	double writer_max_update_us;
+};
+
+// full model update for the joint positions q, busy for update_us in total
+void computeModel(const VectorXd& q, const double update_us, ModelData& model)
+{
+	const Clock::time_point start = Clock::now();
+	model.q = q;
+	model.dq = 0.1 * q;
+	for(int j=0 ; j<DOF ; j++)
+	{
+		for(int i=0 ; i<TASK_DIM ; i++)
+		{
+			model.J(i,j) = cos(q(j) + i);
+		}
+	}
+	model.M.setIdentity();
+	model.M.noalias() += model.J.transpose() * model.J;
+	model.M_inv = model.M.diagonal().cwiseInverse().asDiagonal();
+	model.Lambda.noalias() = model.J * model.M_inv * model.J.transpose();
+	model.Jbar.noalias() = model.M_inv * model.J.transpose();
+	model.N.setIdentity();
+	model.N.noalias() -= model.Jbar * model.J;
+	model.g = 9.81 * q.array().sin().matrix();
+
+	// rest of the update
+	while(chrono::duration<double, micro>(Clock::now() - start).count() < update_us)
+	{
+	}
+}
+
+// one access of the control loop, k-th of the tick
+inline double readAccess(const ModelData& model, const int k)
+{
+	const int j = k % DOF;
+	return model.q(j) + model.dq(j) + model.M(j,j) + model.N(j,(k + 1) % DOF) + model.Jbar(j,k % TASK_DIM);
+}
+
+// sf::safe_ptr and the variants with a shared lock, one lock per access
+template<typename SafePtr>
+class LockPerAccess
+{
+public:
+
+	double read(const int n_accesses)
+	{
+		// const access, shared lock for the shared mutex variants
+		const SafePtr& const_model = _model;
+		double sum = 0;
+		for(int k=0 ; k<n_accesses ; k++)
+		{
+			sum += readAccess(*const_model.operator->().operator->(), k);
+		}
+		return sum;
+	}
+
+	void update(const VectorXd& q, const double update_us)
+	{
+		// one exclusive lock for the whole update, robots[i]->updateModel() in the apps
+		auto locked_model = sf::xlock_safe_ptr(_model);
+		computeModel(q, update_us, *locked_model.operator->());
+	}
+
+private:
+
+	SafePtr _model;
+};
+
+// one lock_timed_any transaction per tick and per update
+class LockTimed
+{
+public:
+
+	double read(const int n_accesses)
+	{
+		sf::lock_timed_any_infinity lock(_model);
+		const ModelData& model = *_model.get_obj_ptr();
+		double sum = 0;
+		for(int k=0 ; k<n_accesses ; k++)
+		{
+			sum += readAccess(model, k);
+		}
+		return sum;
+	}
+
+	void update(const VectorXd& q, const double update_us)
+	{
+		sf::lock_timed_any_infinity lock(_model);
+		computeModel(q, update_us, *_model.get_obj_ptr());
+	}
+
+private:
+
+	sf::safe_ptr<ModelData> _model;
+};
+
+// one wait free get() per tick, the writer updates a snapshot no reader uses
+class Snapshot
+{
+public:
+
+	Snapshot()
+	: _model(1, ModelData())
+	{}
+
+	double read(const int n_accesses)
+	{
+		const ModelData* model = _model.get();
+		double sum = 0;
+		for(int k=0 ; k<n_accesses ; k++)
+		{
+			sum += readAccess(*model, k);
+		}
+		return sum;
+	}
+
+	void update(const VectorXd& q, const double update_us)
+	{
+		computeModel(q, update_us, _model.writeBuffer());
+		_model.publish();
+	}
+
+private:
+
+	PandaUtils::snapshot_ptr<ModelData> _model;
+};
+
+void pinThread(thread& worker, const int cpu)
+{
+	if(cpu < 0)
+	{
+		return;
+	}
+	cpu_set_t cpu_set;
+	CPU_ZERO(&cpu_set);
+	CPU_SET(cpu, &cpu_set);
+	if(pthread_setaffinity_np(worker.native_handle(), sizeof(cpu_set_t), &cpu_set) != 0)
+	{
+		cout << "could not pin a thread to cpu " << cpu << endl;
+	}
+}
+
+// value of the sorted values at quantile p
+double quantile(const vector<double>& sorted_values, const double p)
+{
+	if(sorted_values.empty())
+	{
+		return 0;
+	}
+	const size_t index = min(sorted_values.size() - 1, (size_t) (p * sorted_values.size()));
+	return sorted_values[index];
+}
+
+template<typename Variant>
+BenchResult runVariant(const string& name, const Options& options)
+{
+	Variant variant;
+	atomic<bool> running(true);
+
+	// preallocated, so that the reader does not allocate while it is measured
+	const long max_ticks = (long) (options.seconds * 1000) + 1;
+	vector<double> reader_latencies;
+	reader_latencies.reserve(max_ticks);
+	double reader_sink = 0;
+
+	long n_updates = 0;
+	double total_update_us = 0;
+	double max_update_us = 0;
+
+	thread reader([&]()
+	{
+		const Clock::time_point end = Clock::now() + chrono::microseconds((long) (options.seconds * 1e6));
+		Clock::time_point next_tick = Clock::now();
+		while((long) reader_latencies.size() < max_ticks)
+		{
+			next_tick += chrono::microseconds(1000);
+			this_thread::sleep_until(next_tick);
+			if(Clock::now() >= end)
+			{
+				break;
+			}
+			const Clock::time_point start = Clock::now();
+			reader_sink += variant.read(options.n_accesses);
+			reader_latencies.push_back(chrono::duration<double, nano>(Clock::now() - start).count());
+		}
+		running = false;
+	});
+
+	thread writer([&]()
+	{
+		VectorXd q = VectorXd::Zero(DOF);
+		const Clock::time_point writer_start = Clock::now();
+		Clock::time_point next_update = writer_start;
+		while(running)
+		{
+			const double t = chrono::duration<double>(Clock::now() - writer_start).count();
+			for(int j=0 ; j<DOF ; j++)
+			{
+				q(j) = sin(t + j);
+			}
+
+			const Clock::time_point start = Clock::now();
+			variant.update(q, options.update_us);
+			const double duration = chrono::duration<double, micro>(Clock::now() - start).count();
+			n_updates++;
+			total_update_us += duration;
+			max_update_us = max(max_update_us, duration);
+
+			if(options.writer_frequency > 0)
+			{
+				next_update += chrono::microseconds((long) (1e6 / options.writer_frequency));
+				this_thread::sleep_until(next_update);
+			}
+		}
+	});
+
+	pinThread(reader, options.reader_cpu);
+	pinThread(writer, options.writer_cpu);
+	reader.join();
+	writer.join();
+
+	BenchResult result;
+	result.variant = name;
+	sort(reader_latencies.begin(), reader_latencies.end());
+	result.reader_ticks = reader_latencies.size();
+	result.reader_median_ns = quantile(reader_latencies, 0.5);
+	result.reader_p99_ns = quantile(reader_latencies, 0.99);
+	result.reader_p999_ns = quantile(reader_latencies, 0.999);
+	result.reader_max_ns = reader_latencies.empty() ? 0 : reader_latencies.back();
+
+	result.writer_updates = n_updates;
+	result.writer_updates_per_second = n_updates / options.seconds;
+	result.writer_mean_update_us = n_updates > 0 ? total_update_us / n_updates : 0;
+	result.writer_max_update_us = max_update_us;
+
+	// keeps the reads
+	if(reader_sink == 1.2345)
+	{
+		cout << endl;
+	}
+	return result;
+}
+
+void writeTable(ostream& out, const vector<BenchResult>& results)
+{
+	out << left << setw(14) << "variant" << right
+			<< setw(8) << "ticks" << setw(12) << "median ns" << setw(12) << "p99 ns" << setw(12) << "p99.9 ns" << setw(12) << "max ns"
+			<< setw(10) << "updates" << setw(12) << "updates/s" << setw(14) << "mean upd us" << setw(13) << "max upd us" << endl;
+	for(unsigned int i=0 ; i<results.size() ; i++)
+	{
+		const BenchResult& r = results[i];
+		out << left << setw(14) << r.variant << right << fixed << setprecision(0)
+				<< setw(8) << r.reader_ticks << setw(12) << r.reader_median_ns << setw(12) << r.reader_p99_ns
+				<< setw(12) << r.reader_p999_ns << setw(12) << r.reader_max_ns
+				<< setw(10) << r.writer_updates << setw(12) << r.writer_updates_per_second
+				<< setprecision(1) << setw(14) << r.writer_mean_update_us << setw(13) << r.writer_max_update_us << endl;
+	}
+}
+
+void writeCsv(ostream& out, const vector<BenchResult>& results)
+{
+	out << "variant,reader_ticks,reader_median_ns,reader_p99_ns,reader_p999_ns,reader_max_ns,"
+			<< "writer_updates,writer_updates_per_second,writer_mean_update_us,writer_max_update_us" << endl;
+	for(unsigned int i=0 ; i<results.size() ; i++)
+	{
+		const BenchResult& r = results[i];
+		out << r.variant << "," << r.reader_ticks << "," << r.reader_median_ns << "," << r.reader_p99_ns << ","
+				<< r.reader_p999_ns << "," << r.reader_max_ns << "," << r.writer_updates << ","
+				<< r.writer_updates_per_second << "," << r.writer_mean_update_us << "," << r.writer_max_update_us << endl;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	options.seconds = 5;
+	options.n_accesses = 20;
+	options.update_us = 50;
+	options.writer_frequency = 200;
+	options.reader_cpu = -1;
+	options.writer_cpu = -1;
+	string output_file;
+
+	for(int i=1 ; i<argc ; i++)
+	{
+		const string arg = argv[i];
+		if(i + 1 >= argc)
+		{
+			cout << "missing value after " << arg << endl;
+			return 1;
+		}
+		const string value = argv[++i];
+		if(arg == "-t")
+		{
+			options.seconds = max(0.1, atof(value.c_str()));
+		}
+		else if(arg == "-a")
+		{
+			options.n_accesses = max(1, atoi(value.c_str()));
+		}
+		else if(arg == "-u")
+		{
+			options.update_us = max(0.0, atof(value.c_str()));
+		}
+		else if(arg == "-w")
+		{
+			options.writer_frequency = max(0.0, atof(value.c_str()));
+		}
+		else if(arg == "-c")
+		{
+			stringstream cpus(value);
+			string cpu;
+			if(getline(cpus, cpu, ','))
+			{
+				options.reader_cpu = atoi(cpu.c_str());
+			}
+			if(getline(cpus, cpu, ','))
+			{
+				options.writer_cpu = atoi(cpu.c_str());
+			}
+		}
+		else if(arg == "-o")
+		{
+			output_file = value;
+		}
+		else
+		{
+			cout << "usage : " << argv[0] << " [-t seconds] [-a accesses] [-u update_us] [-w writer_hz] [-c reader_cpu,writer_cpu] [-o results.csv]" << endl;
+			return 1;
+		}
+	}
+
+	cout << options.n_accesses << " accesses per reader tick at 1 kHz, " << options.update_us << " us updates at "
+			<< options.writer_frequency << " Hz, " << options.seconds << " s per variant" << endl;
+
+	vector<BenchResult> results;
+	results.push_back(runVariant<LockPerAccess<sf::safe_ptr<ModelData>>>("safe_ptr", options));
+#ifdef SHARED_MTX
+	results.push_back(runVariant<LockPerAccess<sf::shared_mutex_safe_ptr<ModelData>>>("shared_mutex", options));
+#else
+	cout << "shared_mutex_safe_ptr needs c++14, skipped" << endl;
+#endif
+	results.push_back(runVariant<LockPerAccess<sf::contfree_safe_ptr<ModelData>>>("contfree", options));
+	results.push_back(runVariant<LockTimed>("lock_timed", options));
+	results.push_back(runVariant<Snapshot>("snapshot_ptr", options));
+
+	writeTable(cout, results);
+	if(!output_file.empty())
+	{
+		ofstream output(output_file.c_str());
+		writeCsv(output, results);
+	}
+
+	return 0;
+}
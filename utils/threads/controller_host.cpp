@@ -0,0 +1,243 @@
+// Joint controllers of several arms in one process, on a PandaUtils::ControllerHost (see
+// threads/ControllerHost.h), instead of one controller process per arm.
+//
+// usage : controller_host [options]
+//   -r prefix    an arm, with the keys prefix::sensors::q, prefix::sensors::dq and
+//                prefix::actuators::fgc, repeated for every arm (default sai2::FrankaPanda)
+//   -u urdf      model of the arms (default ./resources/panda_arm.urdf)
+//   -f hz        rate of the host and of the arm modules (default 1000)
+//   -d s         deadline of the arm modules (default half of their period)
+//   -w n         number of workers (default 1 per arm)
+//   -c cpus      cpus of the workers, e.g. 2,3 (default not pinned)
+//   -p cpus      cpus of the host thread, e.g. 1 (default not pinned)
+//   -o           also run a 20 Hz module per arm that prints its joint error, as a slow module
+//   -m module    computes the torques of the arms with the controller stage of a loadable
+//                module instead of the joint task, swapped in again when the file changes
+//                (see threads/StageReloader.h), e.g. -m ./modules/libjoint_hold_stage.so
+//
+// every arm module holds the joint configuration the arm had at the start with a joint task,
+// the model update included. the host reads the state of all the arms in one pipelined read
+// and writes their torques in one pipelined write per tick, and prints the response time and
+// missed deadlines of every module on exit, e.g. for two arms :
+//
+//   controller_host -r sai2::FrankaPanda::Clyde -r sai2::FrankaPanda::Bonnie -c 2,3
+
+#include "Sai2Model.h"
+#include "redis/RedisClient.h"
+#include "tasks/JointTask.h"
+#include "threads/ControllerHost.h"
+#include "threads/StageReloader.h"
+
+#include <signal.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+bool runloop = true;
+void sighandler(int){runloop = false;}
+
+int main(int argc, char** argv)
+{
+	vector<string> prefixes;
+	string robot_file = "./resources/panda_arm.urdf";
+	double frequency = 1000.0;
+	double deadline = 0;
+	int n_workers = 0;
+	vector<int> cpus;
+	vector<int> host_cpus;
+	bool monitor = false;
+	string module_path;
+	for(int i=1 ; i<argc ; i++)
+	{
+		const string arg = argv[i];
+		if(arg == "-o")
+		{
+			monitor = true;
+			continue;
+		}
+		if(i == argc-1)
+		{
+			cout << "missing value of " << arg << endl;
+			return 2;
+		}
+		if(arg == "-r")
+		{
+			prefixes.push_back(argv[++i]);
+		}
+		else if(arg == "-m")
+		{
+			module_path = argv[++i];
+		}
+		else if(arg == "-u")
+		{
+			robot_file = argv[++i];
+		}
+		else if(arg == "-f")
+		{
+			frequency = atof(argv[++i]);
+		}
+		else if(arg == "-d")
+		{
+			deadline = atof(argv[++i]);
+		}
+		else if(arg == "-w")
+		{
+			n_workers = atoi(argv[++i]);
+		}
+		else if(arg == "-c")
+		{
+			stringstream ss(argv[++i]);
+			string cpu;
+			while(getline(ss, cpu, ','))
+			{
+				cpus.push_back(atoi(cpu.c_str()));
+			}
+		}
+		else if(arg == "-p")
+		{
+			stringstream ss(argv[++i]);
+			string cpu;
+			while(getline(ss, cpu, ','))
+			{
+				host_cpus.push_back(atoi(cpu.c_str()));
+			}
+		}
+		else
+		{
+			cout << "unknown option " << arg << endl;
+			return 2;
+		}
+	}
+	if(prefixes.empty())
+	{
+		prefixes.push_back("sai2::FrankaPanda");
+	}
+	if(frequency <= 0)
+	{
+		cout << "the rate should be positive" << endl;
+		return 2;
+	}
+	if(deadline <= 0)
+	{
+		deadline = 0.5 / frequency;
+	}
+	const int n_robots = prefixes.size();
+	if(n_workers <= 0)
+	{
+		n_workers = n_robots;
+	}
+
+	auto redis_client = RedisClient();
+	redis_client.connect();
+
+	signal(SIGABRT, &sighandler);
+	signal(SIGTERM, &sighandler);
+	signal(SIGINT, &sighandler);
+
+	// the I/O objects of the host, and the robots and tasks of the modules
+	vector<Sai2Model::Sai2Model*> robots;
+	vector<Sai2Primitives::JointTask*> joint_tasks;
+	vector<VectorXd> io_q, io_dq, io_command_torques, command_torques;
+	vector<MatrixXd> N_prec;
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		robots.push_back(new Sai2Model::Sai2Model(robot_file, false));
+		robots[i]->_q = redis_client.getEigenMatrixJSON(prefixes[i] + "::sensors::q");
+		robots[i]->updateModel();
+		const int dof = robots[i]->dof();
+
+		joint_tasks.push_back(new Sai2Primitives::JointTask(robots[i]));
+		joint_tasks[i]->_kp = 100.0;
+		joint_tasks[i]->_kv = 15.0;
+		joint_tasks[i]->_desired_position = robots[i]->_q;
+
+		io_q.push_back(robots[i]->_q);
+		io_dq.push_back(VectorXd::Zero(dof));
+		io_command_torques.push_back(VectorXd::Zero(dof));
+		command_torques.push_back(VectorXd::Zero(dof));
+		N_prec.push_back(MatrixXd::Identity(dof, dof));
+	}
+
+	// one stage per arm, each with its copy of the module
+	vector<unique_ptr<PandaUtils::StageReloader>> stages;
+	if(!module_path.empty())
+	{
+		for(int i=0 ; i<n_robots ; i++)
+		{
+			PandaUtils::ControllerStageContext context;
+			context.robot = robots[i];
+			context.period = 1.0 / frequency;
+			stages.push_back(unique_ptr<PandaUtils::StageReloader>(new PandaUtils::StageReloader(module_path, context)));
+		}
+	}
+
+	PandaUtils::ControllerHost host(redis_client, frequency, n_workers, cpus);
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		host.addEigenToRead(prefixes[i] + "::sensors::q", io_q[i]);
+		host.addEigenToRead(prefixes[i] + "::sensors::dq", io_dq[i]);
+		host.addEigenToWrite(prefixes[i] + "::actuators::fgc", io_command_torques[i]);
+	}
+
+	vector<double> joint_errors(n_robots, 0.0);
+	vector<double> monitor_errors(n_robots, 0.0);
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		host.addModule(prefixes[i] + " joint", frequency, deadline,
+			[&, i](const double time)
+			{
+				robots[i]->updateModel();
+				if(!stages.empty())
+				{
+					stages[i]->compute(time, command_torques[i]);
+					return;
+				}
+				joint_tasks[i]->updateTaskModel(N_prec[i]);
+				joint_tasks[i]->computeTorques(command_torques[i]);
+			},
+			[&, i]()
+			{
+				robots[i]->_q = io_q[i];
+				robots[i]->_dq = io_dq[i];
+			},
+			[&, i]()
+			{
+				io_command_torques[i] = command_torques[i];
+				joint_errors[i] = (joint_tasks[i]->_desired_position - robots[i]->_q).norm();
+			});
+
+		if(monitor)
+		{
+			host.addModule(prefixes[i] + " monitor", 20.0, 0.05,
+				[&, i](const double time)
+				{
+					cout << time << " s " << prefixes[i] << " joint error " << monitor_errors[i] << endl;
+				},
+				[&, i]()
+				{
+					monitor_errors[i] = joint_errors[i];
+				});
+		}
+	}
+
+	host.run(runloop, PandaUtils::RealtimeConfig::fifo(80, host_cpus));
+
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		redis_client.setEigenMatrixJSON(prefixes[i] + "::actuators::fgc", VectorXd::Zero(robots[i]->dof()));
+	}
+	host.print(cout);
+	for(unsigned int i=0 ; i<stages.size() ; i++)
+	{
+		stages[i]->print(cout);
+	}
+
+	return 0;
+}
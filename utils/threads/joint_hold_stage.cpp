@@ -0,0 +1,61 @@
+// Controller stage module that holds a joint configuration with a joint task, for the
+// -m option of controller_host (see threads/StageReloader.h).
+//
+// the desired position is the one of the previous stage when it exported one, so swapping
+// this module in keeps the arm where the previous variant held it, otherwise the current
+// configuration. a variant is a copy of this file with other gains or another task, built
+// as a module too and copied over the file the host loads :
+//
+//   controller_host -m ./modules/libjoint_hold_stage.so
+//   cp ./modules/libjoint_hold_stage_stiff.so ./modules/libjoint_hold_stage.so   // swapped in 0.4 s later
+
+#include "threads/ControllerStage.h"
+#include "tasks/JointTask.h"
+
+#include <memory>
+#include <stdexcept>
+
+using namespace std;
+using namespace Eigen;
+
+class JointHoldStage : public PandaUtils::ControllerStage {
+public:
+
+	JointHoldStage(const PandaUtils::ControllerStageContext& context)
+	: _robot(context.robot),
+	  _N_prec(MatrixXd::Identity(context.robot->dof(), context.robot->dof()))
+	{}
+
+	void start(const PandaUtils::StageState& previous)
+	{
+		// the task reads the state of the model, on the control thread
+		_joint_task.reset(new Sai2Primitives::JointTask(_robot));
+		_joint_task->_kp = 100.0;
+		_joint_task->_kv = 15.0;
+		VectorXd desired_position = _robot->_q;
+		previous.get("desired_position", desired_position);
+		if(desired_position.size() != _robot->dof())
+		{
+			throw runtime_error("desired position of the previous stage of the wrong size in JointHoldStage::start()\n");
+		}
+		_joint_task->_desired_position = desired_position;
+	}
+
+	void compute(const double time, VectorXd& torques)
+	{
+		_joint_task->updateTaskModel(_N_prec);
+		_joint_task->computeTorques(torques);
+	}
+
+	void exportState(PandaUtils::StageState& state) const
+	{
+		state.set("desired_position", _joint_task->_desired_position);
+	}
+
+private:
+	Sai2Model::Sai2Model* _robot;
+	unique_ptr<Sai2Primitives::JointTask> _joint_task;
+	MatrixXd _N_prec;
+};
+
+PANDA_CONTROLLER_STAGE(JointHoldStage)
@@ -0,0 +1,260 @@
+#ifndef UTILS_TIMER_CYCLE_PROFILER_H_
+#define UTILS_TIMER_CYCLE_PROFILER_H_
+
+// Split of the cycle time of a control loop between its stages.
+//
+// the stages are registered at setup in a preallocated table of histograms, and the loop
+// marks them with the macros, which compile to nothing unless PANDA_CYCLE_PROFILER is
+// defined (cmake -DPANDA_CYCLE_PROFILER=ON). PANDA_PROFILE_CYCLE starts the timing of a
+// loop body, then every PANDA_PROFILE_STAGE closes the current stage and opens the next
+// one, so the sequential code of a loop does not need new scopes. PANDA_PROFILE_SCOPE
+// times a block on its own, e.g. inside a branch :
+//
+//   PandaUtils::CycleProfiler profiler;
+//   const int READ = profiler.addStage("redis read");
+//   const int MODEL = profiler.addStage("updateModel");
+//   const int TORQUES = profiler.addStage("computeTorques");
+//   const int WRITE = profiler.addStage("redis write");
+//   while(runloop)
+//   {
+//       timer.waitForNextLoop();
+//       PANDA_PROFILE_CYCLE(profiler);
+//       PANDA_PROFILE_STAGE(READ);
+//       redis_client.executeReadCallback(0);
+//       PANDA_PROFILE_STAGE(MODEL);
+//       robot->updateModel();
+//       PANDA_PROFILE_STAGE(TORQUES);
+//       ...
+//       PANDA_PROFILE_STAGE(WRITE);
+//       redis_client.executeWriteCallback(0);
+//   }                                               // the last stage ends with the loop body
+//   profiler.print(std::cout);                      // stages ranked by their share of the time
+//
+// a mark is one clock read and one lock-free histogram record, about 40 ns. the times are
+// wall times, so a stage that is preempted, or waits on redis, is charged the wait.
+
+#include "redis/RedisLatencyStats.h"
+#include "redis/RedisClient.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+// preallocated stage table, recorded from one loop and read from any thread
+class CycleProfiler {
+public:
+
+	static const int MAX_STAGES = 32;
+
+	CycleProfiler()
+	: _n_stages(0)
+	{}
+
+	// at setup, before the loop. returns the index of the stage
+	int addStage(const std::string& name)
+	{
+		if(_n_stages >= MAX_STAGES)
+		{
+			throw std::length_error("too many stages in CycleProfiler::addStage()\n");
+		}
+		_names[_n_stages] = name;
+		return _n_stages++;
+	}
+
+	int nStages() const
+	{
+		return _n_stages;
+	}
+
+	void record(const int stage, const int64_t duration_ns)
+	{
+		_stages[stage].record(duration_ns > 0 ? duration_ns : 0);
+	}
+
+	const LatencyHistogram& stage(const int stage) const
+	{
+		return _stages[stage];
+	}
+
+	const std::string& stageName(const int stage) const
+	{
+		return _names[stage];
+	}
+
+	// indices of the stages by decreasing total time
+	std::vector<int> ranking() const
+	{
+		std::vector<int> ranked;
+		for(int i=0 ; i<_n_stages ; i++)
+		{
+			ranked.push_back(i);
+		}
+		std::stable_sort(ranked.begin(), ranked.end(), [&](const int a, const int b)
+		{
+			return totalMicroseconds(a) > totalMicroseconds(b);
+		});
+		return ranked;
+	}
+
+	// ranked as print(): [{"stage":..., "n":..., "share":..., "mean_us":..., "p50_us":..., "p99_us":..., "max_us":...}, ...]
+	std::string toJSON() const
+	{
+		const double total = totalMicroseconds();
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(1) << "[";
+		const std::vector<int> ranked = ranking();
+		for(unsigned int i=0 ; i<ranked.size() ; i++)
+		{
+			const LatencyHistogram& h = _stages[ranked[i]];
+			ss << (i == 0 ? "" : ", ") << "{\"stage\": \"" << _names[ranked[i]] << "\""
+				<< ", \"n\": " << h.count()
+				<< ", \"share\": " << (total > 0 ? 100.0 * totalMicroseconds(ranked[i]) / total : 0.0)
+				<< ", \"mean_us\": " << h.meanMicroseconds()
+				<< ", \"p50_us\": " << h.percentileMicroseconds(50)
+				<< ", \"p99_us\": " << h.percentileMicroseconds(99)
+				<< ", \"max_us\": " << h.maxMicroseconds() << "}";
+		}
+		ss << "]";
+		return ss.str();
+	}
+
+	void publish(RedisClient& redis_client, const std::string& key) const
+	{
+		redis_client.set(key, toJSON());
+	}
+
+	void print(std::ostream& os) const
+	{
+#ifndef PANDA_CYCLE_PROFILER
+		os << "cycle profile : not compiled in, build with -DPANDA_CYCLE_PROFILER=ON\n";
+#endif
+		const double total = totalMicroseconds();
+		os << "cycle profile (us)" << std::setw(20) << "n" << std::setw(10) << "share"
+			<< std::setw(10) << "mean" << std::setw(10) << "p50" << std::setw(10) << "p99"
+			<< std::setw(10) << "max" << "\n";
+		os << std::fixed << std::setprecision(1);
+		const std::vector<int> ranked = ranking();
+		for(unsigned int i=0 ; i<ranked.size() ; i++)
+		{
+			const LatencyHistogram& h = _stages[ranked[i]];
+			os << std::left << std::setw(26) << _names[ranked[i]] << std::right
+				<< std::setw(12) << h.count()
+				<< std::setw(9) << (total > 0 ? 100.0 * totalMicroseconds(ranked[i]) / total : 0.0) << "%"
+				<< std::setw(10) << h.meanMicroseconds()
+				<< std::setw(10) << h.percentileMicroseconds(50)
+				<< std::setw(10) << h.percentileMicroseconds(99)
+				<< std::setw(10) << h.maxMicroseconds() << "\n";
+		}
+	}
+
+	void reset()
+	{
+		for(int i=0 ; i<_n_stages ; i++)
+		{
+			_stages[i].reset();
+		}
+	}
+
+	// time spent in the stage since the start or the last reset()
+	double totalMicroseconds(const int stage) const
+	{
+		return _stages[stage].meanMicroseconds() * _stages[stage].count();
+	}
+
+	// of all the stages
+	double totalMicroseconds() const
+	{
+		double total = 0;
+		for(int i=0 ; i<_n_stages ; i++)
+		{
+			total += totalMicroseconds(i);
+		}
+		return total;
+	}
+
+private:
+
+	int _n_stages;
+	std::string _names[MAX_STAGES];
+	LatencyHistogram _stages[MAX_STAGES];
+};
+
+// times the stages of a loop body one after the other, the current one ends with the object
+class CycleStageTimer {
+public:
+
+	CycleStageTimer(CycleProfiler& profiler)
+	: _profiler(profiler),
+	  _stage(-1)
+	{}
+
+	~CycleStageTimer()
+	{
+		stage(-1);
+	}
+
+	// ends the current stage and starts the given one, -1 for none
+	void stage(const int next)
+	{
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if(_stage >= 0)
+		{
+			_profiler.record(_stage, std::chrono::duration_cast<std::chrono::nanoseconds>(now - _start).count());
+		}
+		_stage = next;
+		_start = now;
+	}
+
+private:
+	CycleProfiler& _profiler;
+	int _stage;
+	std::chrono::steady_clock::time_point _start;
+};
+
+// times its lifetime in one stage
+class ScopedStage {
+public:
+
+	ScopedStage(CycleProfiler& profiler, const int stage)
+	: _profiler(profiler),
+	  _stage(stage),
+	  _start(std::chrono::steady_clock::now())
+	{}
+
+	~ScopedStage()
+	{
+		_profiler.record(_stage, std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - _start).count());
+	}
+
+private:
+	CycleProfiler& _profiler;
+	const int _stage;
+	const std::chrono::steady_clock::time_point _start;
+};
+
+} /* namespace PandaUtils */
+
+#define PANDA_PROFILE_CONCAT_(a, b) a##b
+#define PANDA_PROFILE_CONCAT(a, b) PANDA_PROFILE_CONCAT_(a, b)
+
+#ifdef PANDA_CYCLE_PROFILER
+#define PANDA_PROFILE_CYCLE(profiler) PandaUtils::CycleStageTimer panda_profile_cycle_timer(profiler)
+#define PANDA_PROFILE_STAGE(stage_index) panda_profile_cycle_timer.stage(stage_index)
+#define PANDA_PROFILE_SCOPE(profiler, stage_index) \
+	PandaUtils::ScopedStage PANDA_PROFILE_CONCAT(panda_profile_scope_, __LINE__)(profiler, stage_index)
+#else
+#define PANDA_PROFILE_CYCLE(profiler) do { (void)(profiler); } while(0)
+#define PANDA_PROFILE_STAGE(stage_index) do { (void)(stage_index); } while(0)
+#define PANDA_PROFILE_SCOPE(profiler, stage_index) do { (void)(profiler); (void)(stage_index); } while(0)
+#endif
+
+#endif //UTILS_TIMER_CYCLE_PROFILER_H_
@@ -0,0 +1,158 @@
+#ifndef UTILS_TIMER_IDLE_SCHEDULER_H_
+#define UTILS_TIMER_IDLE_SCHEDULER_H_
+
+// Fewer model and task model updates in a control loop while the robot is idle.
+//
+// a controller that waits (for the camera, for an operator, in a hold of its initial
+// configuration) runs updateModel() and the task model updates at every tick although
+// nothing moves. the scheduler watches the measured joint velocities and a vector of the
+// commands of the controller (state, desired positions, ...). after hold_ticks ticks with
+// all the joint velocities below velocity_threshold and the commands unchanged, the loop
+// is idle and update() asks for the model updates only every idle_divider ticks. the
+// first tick that sees a motion or a new command asks for them again. the torques are
+// still computed at every tick, from the model terms of the last update :
+//
+//   PandaUtils::IdleScheduler idle_scheduler(20);                     // 50 Hz updates of a 1 kHz loop when idle
+//   VectorXd idle_command = VectorXd::Zero(1 + 3 + dof);
+//   while(runloop)
+//   {
+//       ...                                                           // read the robot state
+//       idle_command << state, posori_task->_desired_position, joint_task->_desired_position;
+//       const bool f_model_update = idle_scheduler.update(robot->_dq, idle_command);
+//       if(f_model_update)
+//       {
+//           robot->updateModel();
+//           ...                                                       // coriolis, task models
+//       }
+//       else
+//       {
+//           robot->updateKinematics();                                // positions of the tasks
+//       }
+//       ...                                                           // computeTorques() at every tick
+//   }
+//   idle_scheduler.print(std::cout);
+//
+// the commands are the ones set by the previous tick, so a new command gets its update
+// within one tick. terms that the controller modifies in place after an update (e.g. a
+// regularization added to Lambda) should only be modified on the ticks with an update.
+// wake() asks for an update at the next tick, for events the commands do not show.
+
+#include <Eigen/Dense>
+
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+namespace PandaUtils {
+
+class IdleScheduler {
+public:
+
+	IdleScheduler(const int idle_divider = 20, const double velocity_threshold = 0.01,
+			const double command_tolerance = 1e-6, const int hold_ticks = 500)
+	: _idle_divider(idle_divider),
+	  _velocity_threshold(velocity_threshold),
+	  _command_tolerance(command_tolerance),
+	  _hold_ticks(hold_ticks),
+	  _n_quiet_ticks(0),
+	  _n_ticks_since_update(0),
+	  _f_idle(false),
+	  _f_wake(false),
+	  _n_ticks(0),
+	  _n_updates(0),
+	  _n_idle_ticks(0)
+	{
+		if(idle_divider < 1 || hold_ticks < 0)
+		{
+			throw std::invalid_argument("idle divider should be positive and hold ticks not negative in IdleScheduler::IdleScheduler()\n");
+		}
+		if(velocity_threshold < 0 || command_tolerance < 0)
+		{
+			throw std::invalid_argument("thresholds should not be negative in IdleScheduler::IdleScheduler()\n");
+		}
+	}
+
+	// once per tick, true when the model and the task models should be updated at this tick.
+	// does not allocate after the first call
+	bool update(const Eigen::VectorXd& dq, const Eigen::VectorXd& command)
+	{
+		_n_ticks++;
+		bool quiet = dq.size() == 0 || dq.cwiseAbs().maxCoeff() <= _velocity_threshold;
+		if(command.size() != _command.size())
+		{
+			_command = command;
+			quiet = false;
+		}
+		else if(command.size() > 0 && (command - _command).cwiseAbs().maxCoeff() > _command_tolerance)
+		{
+			_command = command;
+			quiet = false;
+		}
+		if(_f_wake)
+		{
+			_f_wake = false;
+			quiet = false;
+		}
+
+		if(!quiet)
+		{
+			_n_quiet_ticks = 0;
+		}
+		else if(_n_quiet_ticks < _hold_ticks)
+		{
+			_n_quiet_ticks++;
+		}
+		_f_idle = quiet && _n_quiet_ticks >= _hold_ticks;
+
+		_n_ticks_since_update++;
+		if(_f_idle)
+		{
+			_n_idle_ticks++;
+		}
+		if(!_f_idle || _n_ticks_since_update >= _idle_divider)
+		{
+			_n_ticks_since_update = 0;
+			_n_updates++;
+			return true;
+		}
+		return false;
+	}
+
+	void wake()
+	{
+		_f_wake = true;
+	}
+
+	bool idle() const { return _f_idle; }
+	unsigned long long numTicks() const { return _n_ticks; }
+	unsigned long long numUpdates() const { return _n_updates; }
+	unsigned long long numIdleTicks() const { return _n_idle_ticks; }
+
+	void print(std::ostream& os) const
+	{
+		const double ratio = _n_ticks > 0 ? 100.0 * _n_updates / _n_ticks : 0.0;
+		os << "model updates : " << _n_updates << " of " << _n_ticks << " ticks ("
+			<< std::fixed << std::setprecision(1) << ratio << " %), " << _n_idle_ticks << " ticks idle\n";
+	}
+
+private:
+
+	const int _idle_divider;
+	const double _velocity_threshold;
+	const double _command_tolerance;
+	const int _hold_ticks;
+
+	Eigen::VectorXd _command;
+	int _n_quiet_ticks;
+	int _n_ticks_since_update;
+	bool _f_idle;
+	bool _f_wake;
+
+	unsigned long long _n_ticks;
+	unsigned long long _n_updates;
+	unsigned long long _n_idle_ticks;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_TIMER_IDLE_SCHEDULER_H_
@@ -0,0 +1,211 @@
+#ifndef UTILS_TIMER_LOOP_DASHBOARD_H_
+#define UTILS_TIMER_LOOP_DASHBOARD_H_
+
+// Compact health stats of the loop threads, published for the operators at a few Hz.
+//
+// every loop thread aggregates its LoopHealth, and its CycleProfiler if it has one, in a
+// LoopStats : the measured rate, the p99 of the compute time and of the wake-up lateness,
+// the missed deadlines, and the stage with the largest share of the cycle time. the stats
+// are published under a well-known key per thread, as a vector for getEigenMatrixJSON()
+// and the name of the top stage as a string, so that a dashboard or the overlay of
+// graphics/LoopDashboardOverlay.h can show all the threads of the running apps :
+//
+//   PandaUtils::LoopHealth loop_health(1000);
+//   PandaUtils::LoopDashboard dashboard("controller", loop_health, &profiler);   // profiler optional
+//   while(runloop)
+//   {
+//       loop_health.waitForNextLoop(timer);
+//       ...
+//       dashboard.publishIfDue(redis_client);        // 4 Hz by default, a clock read otherwise
+//   }
+//
+//   redis-cli get sai2::PandaApplications::dashboard::controller
+//   "[1000.2,312.0,41.0,3,565310,0.38]"  rate Hz, compute p99 us, lateness p99 us, missed, cycles, top stage share
+//
+// the rate is measured between two publications, the percentiles and the missed deadlines
+// are the ones of the LoopHealth since its start or its last reset().
+
+#include "timer/LoopHealth.h"
+#include "timer/CycleProfiler.h"
+#include "redis/RedisClient.h"
+#include <Eigen/Dense>
+
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+const std::string LOOP_DASHBOARD_KEY_PREFIX = "sai2::PandaApplications::dashboard::";
+
+struct LoopStats
+{
+	static const int SIZE = 6;
+	typedef Eigen::Matrix<double, SIZE, 1> Vector;
+
+	double rate_hz;
+	double compute_p99_us;
+	double lateness_p99_us;
+	double missed_deadlines;
+	double cycles;
+	// of the total time of the stages, 0 without profiler
+	double top_stage_share;
+	std::string top_stage;
+
+	LoopStats()
+	: rate_hz(0),
+	  compute_p99_us(0),
+	  lateness_p99_us(0),
+	  missed_deadlines(0),
+	  cycles(0),
+	  top_stage_share(0)
+	{}
+
+	Vector toVector() const
+	{
+		Vector v;
+		v << rate_hz, compute_p99_us, lateness_p99_us, missed_deadlines, cycles, top_stage_share;
+		return v;
+	}
+
+	// the top stage is not in the vector
+	static LoopStats fromVector(const Eigen::VectorXd& v)
+	{
+		if(v.size() != SIZE)
+		{
+			throw std::invalid_argument("loop stats vector of the wrong size in LoopStats::fromVector()\n");
+		}
+		LoopStats stats;
+		stats.rate_hz = v(0);
+		stats.compute_p99_us = v(1);
+		stats.lateness_p99_us = v(2);
+		stats.missed_deadlines = v(3);
+		stats.cycles = v(4);
+		stats.top_stage_share = v(5);
+		return stats;
+	}
+
+	// one line, e.g. "1000 Hz, p99 312.0 us, late 41.0 us, 3 missed, updateModel 38 %"
+	std::string summary() const
+	{
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(0) << rate_hz << " Hz, p99 " << std::setprecision(1)
+			<< compute_p99_us << " us, late " << lateness_p99_us << " us, " << std::setprecision(0)
+			<< missed_deadlines << " missed";
+		if(!top_stage.empty())
+		{
+			ss << ", " << top_stage << " " << 100 * top_stage_share << " %";
+		}
+		return ss.str();
+	}
+};
+
+class LoopDashboard {
+public:
+
+	LoopDashboard(const std::string& thread_name, const LoopHealth& loop_health,
+			const CycleProfiler* profiler = NULL, const double publish_frequency = 4.0)
+	: _thread_name(thread_name),
+	  _key(key(thread_name)),
+	  _stage_key(stageKey(thread_name)),
+	  _loop_health(loop_health),
+	  _profiler(profiler),
+	  _last_cycles(0)
+	{
+		if(publish_frequency <= 0)
+		{
+			throw std::invalid_argument("publish frequency should be positive in LoopDashboard::LoopDashboard()\n");
+		}
+		_publish_period = std::chrono::nanoseconds((int64_t)(1e9 / publish_frequency + 0.5));
+		_last_publish = std::chrono::steady_clock::now();
+		_next_publish = _last_publish + _publish_period;
+	}
+
+	static std::string key(const std::string& thread_name)
+	{
+		return LOOP_DASHBOARD_KEY_PREFIX + thread_name;
+	}
+
+	static std::string stageKey(const std::string& thread_name)
+	{
+		return LOOP_DASHBOARD_KEY_PREFIX + thread_name + "::top_stage";
+	}
+
+	// stats since the last call, for the rate
+	LoopStats stats()
+	{
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		const uint64_t cycles = _loop_health.cycles();
+		const double elapsed = std::chrono::duration<double>(now - _last_publish).count();
+
+		LoopStats stats;
+		stats.rate_hz = (elapsed > 0 && cycles >= _last_cycles) ? (cycles - _last_cycles) / elapsed : 0;
+		stats.compute_p99_us = _loop_health.compute().percentileMicroseconds(99);
+		stats.lateness_p99_us = _loop_health.lateness().percentileMicroseconds(99);
+		stats.missed_deadlines = _loop_health.missedDeadlines();
+		stats.cycles = cycles;
+		// nothing recorded when the profiler is not compiled in
+		if(_profiler != NULL && _profiler->totalMicroseconds() > 0)
+		{
+			const std::vector<int> ranked = _profiler->ranking();
+			stats.top_stage = _profiler->stageName(ranked[0]);
+			stats.top_stage_share = _profiler->totalMicroseconds(ranked[0]) / _profiler->totalMicroseconds();
+		}
+
+		_last_publish = now;
+		_last_cycles = cycles;
+		return stats;
+	}
+
+	void publish(RedisClient& redis_client)
+	{
+		const LoopStats loop_stats = stats();
+		redis_client.setEigenMatrixJSON(_key, loop_stats.toVector());
+		if(_profiler != NULL)
+		{
+			redis_client.set(_stage_key, loop_stats.top_stage);
+		}
+	}
+
+	// every cycle, publishes at the publish frequency. returns true when it published
+	bool publishIfDue(RedisClient& redis_client)
+	{
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if(now < _next_publish)
+		{
+			return false;
+		}
+		_next_publish += _publish_period;
+		if(_next_publish < now)
+		{
+			_next_publish = now + _publish_period;
+		}
+		publish(redis_client);
+		return true;
+	}
+
+	const std::string& threadName() const
+	{
+		return _thread_name;
+	}
+
+private:
+	const std::string _thread_name;
+	const std::string _key;
+	const std::string _stage_key;
+	const LoopHealth& _loop_health;
+	const CycleProfiler* _profiler;
+
+	std::chrono::nanoseconds _publish_period;
+	std::chrono::steady_clock::time_point _next_publish;
+	std::chrono::steady_clock::time_point _last_publish;
+	uint64_t _last_cycles;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_TIMER_LOOP_DASHBOARD_H_
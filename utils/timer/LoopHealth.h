@@ -0,0 +1,214 @@
+#ifndef UTILS_TIMER_LOOP_HEALTH_H_
+#define UTILS_TIMER_LOOP_HEALTH_H_
+
+// Overruns and jitter of a control loop paced by a LoopTimer.
+//
+// every cycle records its period (wake-up to wake-up), the lateness of its wake-up on the
+// schedule of the loop frequency, and its compute time (wake-up to the next wait), in the
+// lock-free histograms of redis/RedisLatencyStats.h. a cycle misses its deadline when it
+// computes longer than the period, or when the timer did not sleep before it. a tick is
+// two clock reads and three histogram records, about 0.15 us :
+//
+//   LoopTimer timer;
+//   timer.setLoopFrequency(1000);
+//   PandaUtils::LoopHealth loop_health(1000);
+//   while(runloop)
+//   {
+//       fTimerDidSleep = loop_health.waitForNextLoop(timer);    // instead of timer.waitForNextLoop()
+//       ...
+//       if(controller_counter % 1000 == 0)
+//       {
+//           loop_health.publish(redis_client, LOOP_HEALTH_KEY);  // or from another thread
+//       }
+//   }
+//   loop_health.print(std::cout);                                 // on shutdown
+//
+// after a missed deadline, the lateness is measured on the schedule from the late wake-up.
+
+#include "redis/RedisLatencyStats.h"
+#include "redis/RedisClient.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace PandaUtils {
+
+class LoopHealth {
+public:
+
+	LoopHealth(const double loop_frequency)
+	: _period_ns(0),
+	  _started(false),
+	  _overrun(false),
+	  _n_cycles(0),
+	  _n_missed(0)
+	{
+		if(loop_frequency <= 0)
+		{
+			throw std::invalid_argument("loop frequency should be positive in LoopHealth::LoopHealth()\n");
+		}
+		_period_ns = (int64_t)(1e9 / loop_frequency + 0.5);
+	}
+
+	// the end of the current cycle, the wait of the timer, then the start of the next cycle.
+	// returns the value of timer.waitForNextLoop()
+	template<typename Timer>
+	bool waitForNextLoop(Timer& timer)
+	{
+		endCycle();
+		const bool did_sleep = timer.waitForNextLoop();
+		startCycle(did_sleep);
+		return did_sleep;
+	}
+
+	// for loops that wait on something else than a LoopTimer : at the wake-up
+	void startCycle(const bool did_sleep = true)
+	{
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if(!_started)
+		{
+			_started = true;
+			_last_wake = now;
+			_scheduled_wake = now;
+			return;
+		}
+		_period.record(nanoseconds(now - _last_wake));
+		_scheduled_wake += std::chrono::nanoseconds(_period_ns);
+		const int64_t lateness = nanoseconds(now - _scheduled_wake);
+		_lateness.record(lateness > 0 ? lateness : 0);
+		if(!did_sleep || _overrun)
+		{
+			_n_missed.fetch_add(1, std::memory_order_relaxed);
+			_scheduled_wake = now;
+		}
+		_overrun = false;
+		_last_wake = now;
+	}
+
+	// and before the wait
+	void endCycle()
+	{
+		if(!_started)
+		{
+			return;
+		}
+		const int64_t compute = nanoseconds(std::chrono::steady_clock::now() - _last_wake);
+		_compute.record(compute);
+		_overrun = compute > _period_ns;
+		_n_cycles.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	uint64_t cycles() const
+	{
+		return _n_cycles.load(std::memory_order_relaxed);
+	}
+
+	uint64_t missedDeadlines() const
+	{
+		return _n_missed.load(std::memory_order_relaxed);
+	}
+
+	const LatencyHistogram& period() const
+	{
+		return _period;
+	}
+
+	const LatencyHistogram& lateness() const
+	{
+		return _lateness;
+	}
+
+	const LatencyHistogram& compute() const
+	{
+		return _compute;
+	}
+
+	// {"cycles":..., "missed":..., "period_us": {"mean":..., "p50":..., "p99":..., "max":...}, "lateness_us": {...}, "compute_us": {...}}
+	std::string toJSON() const
+	{
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(1)
+			<< "{\"cycles\": " << cycles()
+			<< ", \"missed\": " << missedDeadlines()
+			<< ", \"period_us\": " << histogramJSON(_period)
+			<< ", \"lateness_us\": " << histogramJSON(_lateness)
+			<< ", \"compute_us\": " << histogramJSON(_compute) << "}";
+		return ss.str();
+	}
+
+	void publish(RedisClient& redis_client, const std::string& key) const
+	{
+		redis_client.set(key, toJSON());
+	}
+
+	void print(std::ostream& os) const
+	{
+		os << "loop health (us)" << std::setw(16) << "mean" << std::setw(10) << "p50"
+			<< std::setw(10) << "p99" << std::setw(10) << "max" << "\n";
+		os << std::fixed << std::setprecision(1);
+		printHistogram(os, "period", _period);
+		printHistogram(os, "wake-up lateness", _lateness);
+		printHistogram(os, "compute", _compute);
+		os << "missed deadlines : " << missedDeadlines() << " of " << cycles() << " cycles\n";
+	}
+
+	void reset()
+	{
+		_period.reset();
+		_lateness.reset();
+		_compute.reset();
+		_n_cycles.store(0, std::memory_order_relaxed);
+		_n_missed.store(0, std::memory_order_relaxed);
+	}
+
+private:
+
+	static int64_t nanoseconds(const std::chrono::steady_clock::duration& duration)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+	}
+
+	static std::string histogramJSON(const LatencyHistogram& h)
+	{
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(1)
+			<< "{\"mean\": " << h.meanMicroseconds()
+			<< ", \"p50\": " << h.percentileMicroseconds(50)
+			<< ", \"p99\": " << h.percentileMicroseconds(99)
+			<< ", \"max\": " << h.maxMicroseconds() << "}";
+		return ss.str();
+	}
+
+	static void printHistogram(std::ostream& os, const std::string& name, const LatencyHistogram& h)
+	{
+		os << std::left << std::setw(22) << name << std::right
+			<< std::setw(10) << h.meanMicroseconds()
+			<< std::setw(10) << h.percentileMicroseconds(50)
+			<< std::setw(10) << h.percentileMicroseconds(99)
+			<< std::setw(10) << h.maxMicroseconds() << "\n";
+	}
+
+	int64_t _period_ns;
+
+	// loop thread only
+	bool _started;
+	bool _overrun;
+	std::chrono::steady_clock::time_point _last_wake;
+	std::chrono::steady_clock::time_point _scheduled_wake;
+
+	LatencyHistogram _period;
+	LatencyHistogram _lateness;
+	LatencyHistogram _compute;
+	std::atomic<uint64_t> _n_cycles;
+	std::atomic<uint64_t> _n_missed;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_TIMER_LOOP_HEALTH_H_
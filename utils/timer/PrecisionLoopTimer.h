@@ -0,0 +1,158 @@
+#ifndef UTILS_TIMER_PRECISION_LOOP_TIMER_H_
+#define UTILS_TIMER_PRECISION_LOOP_TIMER_H_
+
+// Loop timer that sleeps until shortly before the deadline, then spins to it.
+//
+// the LoopTimer sleeps until the deadline, and the wake-up of the kernel is late by the
+// scheduling latency, 50 to 200 us under load. this timer sleeps until spin_margin before
+// the deadline, on the same CLOCK_MONOTONIC schedule, then spins on the clock until the
+// deadline, so the loop starts within about a microsecond of it, at the cost of up to
+// spin_margin of cpu per cycle. it has the interface of the LoopTimer, so a fast loop can
+// use it while the background threads keep their LoopTimer, and a margin of 0 is a plain
+// sleeping timer :
+//
+//   PandaUtils::PrecisionLoopTimer timer(100e-6);     // instead of LoopTimer timer
+//   timer.initializeTimer();
+//   timer.setLoopFrequency(4000);
+//   while(runloop)
+//   {
+//       fTimerDidSleep = timer.waitForNextLoop();
+//       ...
+//   }
+//
+// steady_clock reads the TSC through the vdso on linux, so the spin does not enter the
+// kernel. the margin should cover the wake-up latency of the loaded machine, which the
+// lateness of LoopHealth shows, and the thread should have a real-time priority so that
+// it is not preempted in the spin.
+
+#include <time.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+
+namespace PandaUtils {
+
+class PrecisionLoopTimer {
+public:
+
+	// seconds before the deadline at which the sleep ends
+	PrecisionLoopTimer(const double spin_margin = 100e-6)
+	: _period_ns(1000000),
+	  _n_cycles(0),
+	  _spin_ns(0)
+	{
+		setSpinMargin(spin_margin);
+		initializeTimer();
+	}
+
+	void setSpinMargin(const double spin_margin)
+	{
+		if(spin_margin < 0)
+		{
+			throw std::invalid_argument("spin margin should be positive or 0 in PrecisionLoopTimer::setSpinMargin()\n");
+		}
+		_spin_margin_ns = (int64_t)(spin_margin * 1e9 + 0.5);
+	}
+
+	// the first deadline is initial_wait_nanoseconds from now
+	void initializeTimer(const unsigned int initial_wait_nanoseconds = 0)
+	{
+		initializeTimer(std::chrono::steady_clock::now(), initial_wait_nanoseconds);
+	}
+
+	// the first deadline is initial_wait_nanoseconds from start. the timers of several
+	// threads started on the same time point, at the same frequency, share their deadlines
+	void initializeTimer(const std::chrono::steady_clock::time_point start, const unsigned int initial_wait_nanoseconds = 0)
+	{
+		_start = start;
+		_next = _start + std::chrono::nanoseconds(initial_wait_nanoseconds);
+		_n_cycles = 0;
+		_spin_ns = 0;
+	}
+
+	void setLoopFrequency(const double frequency)
+	{
+		if(frequency <= 0)
+		{
+			throw std::invalid_argument("loop frequency should be positive in PrecisionLoopTimer::setLoopFrequency()\n");
+		}
+		_period_ns = (int64_t)(1e9 / frequency + 0.5);
+	}
+
+	// false when the deadline had already passed, as LoopTimer::waitForNextLoop()
+	bool waitForNextLoop()
+	{
+		_n_cycles++;
+		const std::chrono::steady_clock::time_point deadline = _next;
+		_next += std::chrono::nanoseconds(_period_ns);
+
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if(now >= deadline)
+		{
+			return false;
+		}
+
+		const std::chrono::steady_clock::time_point wake_up = deadline - std::chrono::nanoseconds(_spin_margin_ns);
+		if(now < wake_up)
+		{
+			// same clock as steady_clock on linux
+			const int64_t wake_up_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(wake_up.time_since_epoch()).count();
+			timespec t;
+			t.tv_sec = wake_up_ns / 1000000000;
+			t.tv_nsec = wake_up_ns % 1000000000;
+			while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR)
+			{}
+			now = std::chrono::steady_clock::now();
+		}
+
+		const std::chrono::steady_clock::time_point spin_start = now;
+		while(now < deadline)
+		{
+			pause();
+			now = std::chrono::steady_clock::now();
+		}
+		_spin_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(now - spin_start).count();
+		return true;
+	}
+
+	// seconds since initializeTimer()
+	double elapsedTime() const
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+	}
+
+	unsigned long long elapsedCycles() const
+	{
+		return _n_cycles;
+	}
+
+	// mean spin per cycle, seconds
+	double meanSpinTime() const
+	{
+		return _n_cycles == 0 ? 0.0 : _spin_ns * 1e-9 / _n_cycles;
+	}
+
+private:
+
+	static inline void pause()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#elif defined(__aarch64__)
+		asm volatile("yield");
+#endif
+	}
+
+	int64_t _period_ns;
+	int64_t _spin_margin_ns;
+	std::chrono::steady_clock::time_point _start;
+	std::chrono::steady_clock::time_point _next;
+	unsigned long long _n_cycles;
+	int64_t _spin_ns;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_TIMER_PRECISION_LOOP_TIMER_H_
@@ -0,0 +1,308 @@
+#ifndef UTILS_TIMER_TRACE_RECORDER_H_
+#define UTILS_TIMER_TRACE_RECORDER_H_
+
+// Timeline of the threads of an app, dumped as a Chrome trace (chrome://tracing or ui.perfetto.dev).
+//
+// every thread registers its own event buffer, and records the begin and end of its loop
+// iterations and stages in it without locks. the buffers are rings that keep the last
+// events of each thread, and the recorder writes them all in one json file on exit, so
+// the interleaving of the loops and the wake-up delays after the waits show on one
+// timeline. without a trace file, the buffers are NULL and the scopes do nothing :
+//
+//   PandaUtils::TraceRecorder tracer(PandaUtils::TraceRecorder::tracePath(argc, argv));   // app --trace app.json
+//
+//   PandaUtils::TraceBuffer* trace = tracer.registerThread("control");    // in the thread, once
+//   while(runloop)
+//   {
+//       {
+//           PandaUtils::TraceScope wait(trace, "wait");
+//           timer.waitForNextLoop();
+//       }
+//       PandaUtils::TraceScope iteration(trace, "control");
+//       PandaUtils::traceBegin(trace, "updateModel");
+//       robot->updateModel();
+//       PandaUtils::traceEnd(trace);
+//       ...
+//   }
+//
+//   tracer.dump();                                             // after the threads are joined
+//
+// the event names are not copied, and should be string literals. an event is one clock
+// read and a store in the ring, about 40 ns.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace PandaUtils {
+
+struct TraceEvent
+{
+	int64_t time_ns;
+	const char* name;
+	// 'B' begin, 'E' end, 'i' instant
+	char phase;
+};
+
+// events of one thread, written by that thread only
+class TraceBuffer {
+public:
+
+	TraceBuffer(const std::string& thread_name, const int thread_id, const size_t capacity,
+			const std::chrono::steady_clock::time_point& origin)
+	: _thread_name(thread_name),
+	  _thread_id(thread_id),
+	  _origin(origin),
+	  _events(capacity),
+	  _n_recorded(0)
+	{}
+
+	void begin(const char* name)
+	{
+		record(name, 'B');
+	}
+
+	// ends the last begun event
+	void end()
+	{
+		record(NULL, 'E');
+	}
+
+	void instant(const char* name)
+	{
+		record(name, 'i');
+	}
+
+	const std::string& threadName() const
+	{
+		return _thread_name;
+	}
+
+	int threadId() const
+	{
+		return _thread_id;
+	}
+
+	// including the ones overwritten in the ring
+	uint64_t recorded() const
+	{
+		return _n_recorded.load(std::memory_order_acquire);
+	}
+
+	// the events still in the ring, oldest first
+	std::vector<TraceEvent> events() const
+	{
+		const uint64_t n = recorded();
+		const uint64_t capacity = _events.size();
+		const uint64_t first = n > capacity ? n - capacity : 0;
+		std::vector<TraceEvent> events;
+		events.reserve(n - first);
+		for(uint64_t i=first ; i<n ; i++)
+		{
+			events.push_back(_events[i % capacity]);
+		}
+		return events;
+	}
+
+private:
+
+	void record(const char* name, const char phase)
+	{
+		const uint64_t n = _n_recorded.load(std::memory_order_relaxed);
+		TraceEvent& event = _events[n % _events.size()];
+		event.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _origin).count();
+		event.name = name;
+		event.phase = phase;
+		_n_recorded.store(n + 1, std::memory_order_release);
+	}
+
+	const std::string _thread_name;
+	const int _thread_id;
+	const std::chrono::steady_clock::time_point _origin;
+	std::vector<TraceEvent> _events;
+	std::atomic<uint64_t> _n_recorded;
+};
+
+// do nothing on a NULL buffer, i.e. when the trace is disabled
+inline void traceBegin(TraceBuffer* trace, const char* name)
+{
+	if(trace != NULL)
+	{
+		trace->begin(name);
+	}
+}
+
+inline void traceEnd(TraceBuffer* trace)
+{
+	if(trace != NULL)
+	{
+		trace->end();
+	}
+}
+
+inline void traceInstant(TraceBuffer* trace, const char* name)
+{
+	if(trace != NULL)
+	{
+		trace->instant(name);
+	}
+}
+
+// one event over the lifetime of the object
+class TraceScope {
+public:
+
+	TraceScope(TraceBuffer* trace, const char* name)
+	: _trace(trace)
+	{
+		traceBegin(_trace, name);
+	}
+
+	~TraceScope()
+	{
+		traceEnd(_trace);
+	}
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+	TraceBuffer* _trace;
+};
+
+class TraceRecorder {
+public:
+
+	// disabled with an empty path
+	TraceRecorder(const std::string& path, const size_t default_capacity = 1 << 18)
+	: _path(path),
+	  _default_capacity(default_capacity),
+	  _origin(std::chrono::steady_clock::now())
+	{
+		if(default_capacity == 0)
+		{
+			throw std::invalid_argument("trace buffers need a capacity in TraceRecorder::TraceRecorder()\n");
+		}
+	}
+
+	// value of --trace in the command line arguments, empty without it
+	static std::string tracePath(const int argc, char** argv)
+	{
+		for(int i=1 ; i<argc-1 ; i++)
+		{
+			if(std::string(argv[i]) == "--trace")
+			{
+				return argv[i+1];
+			}
+		}
+		return "";
+	}
+
+	bool enabled() const
+	{
+		return !_path.empty();
+	}
+
+	// buffer of the calling thread, valid for the lifetime of the recorder. NULL when disabled.
+	// capacity in events, the default one with 0
+	TraceBuffer* registerThread(const std::string& thread_name, const size_t capacity = 0)
+	{
+		if(!enabled())
+		{
+			return NULL;
+		}
+		std::lock_guard<std::mutex> lock(_mutex);
+		_buffers.emplace_back(new TraceBuffer(thread_name, _buffers.size() + 1,
+				capacity == 0 ? _default_capacity : capacity, _origin));
+		return _buffers.back().get();
+	}
+
+	// writes the trace file, returns false when disabled or on a write error.
+	// the threads should be stopped, an event being written is torn otherwise
+	bool dump()
+	{
+		if(!enabled())
+		{
+			return false;
+		}
+		std::ofstream file(_path);
+		if(!file)
+		{
+			std::cerr << "could not open trace file " << _path << " in TraceRecorder::dump()\n";
+			return false;
+		}
+		writeJSON(file);
+		file.close();
+		if(!file)
+		{
+			std::cerr << "could not write trace file " << _path << " in TraceRecorder::dump()\n";
+			return false;
+		}
+		std::cout << "trace of " << _buffers.size() << " threads written to " << _path << "\n";
+		return true;
+	}
+
+	void writeJSON(std::ostream& os)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		os << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+		bool first = true;
+		for(unsigned int i=0 ; i<_buffers.size() ; i++)
+		{
+			const TraceBuffer& buffer = *_buffers[i];
+			os << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+				<< buffer.threadId() << ", \"args\": {\"name\": \"" << buffer.threadName() << "\"}}";
+			first = false;
+
+			// the ends of the events begun before the oldest event of the ring are dropped
+			std::vector<const char*> open;
+			const std::vector<TraceEvent> events = buffer.events();
+			for(unsigned int j=0 ; j<events.size() ; j++)
+			{
+				const TraceEvent& event = events[j];
+				const char* name = event.name;
+				if(event.phase == 'B')
+				{
+					open.push_back(name);
+				}
+				else if(event.phase == 'E')
+				{
+					if(open.empty())
+					{
+						continue;
+					}
+					name = open.back();
+					open.pop_back();
+				}
+				os << ",\n{\"name\": \"" << name << "\", \"ph\": \"" << event.phase << "\"";
+				if(event.phase == 'i')
+				{
+					os << ", \"s\": \"t\"";
+				}
+				os << ", \"ts\": " << std::fixed << std::setprecision(3) << event.time_ns * 1e-3
+					<< ", \"pid\": 1, \"tid\": " << buffer.threadId() << "}";
+			}
+		}
+		os << "\n]}\n";
+	}
+
+private:
+	const std::string _path;
+	const size_t _default_capacity;
+	const std::chrono::steady_clock::time_point _origin;
+
+	std::mutex _mutex;
+	std::vector<std::unique_ptr<TraceBuffer>> _buffers;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_TIMER_TRACE_RECORDER_H_
@@ -0,0 +1,362 @@
+#ifndef UTILS_TRAJECTORIES_JERK_LIMITED_TRAJECTORY_H_
+#define UTILS_TRAJECTORIES_JERK_LIMITED_TRAJECTORY_H_
+
+// Time optimal, jerk limited rest to rest motions, planned once and sampled in a table.
+//
+// a motion goes along the straight line between the start and the goal (in joint space,
+// or for the position and the rotation about the fixed axis of R_start^T R_goal), at the
+// path parameter s(t) from 0 to 1. s follows the double S profile, the shortest in time
+// under the velocity, acceleration and jerk limits of the path : the limits of every axis
+// divided by its distance, the smallest of them for all the axes, so that all the axes
+// end together and none of them exceeds its limits. the profile is 7 segments of constant
+// jerk (+j 0 -j, a cruise at the velocity limit, -j 0 +j), some of them empty for short
+// motions, and it is sampled at the period of the control loop when planned, e.g. at the
+// entry of a state. the loop then only reads the table and interpolates the line :
+//
+//   PandaUtils::CartesianTrajectory trajectory(0.001, 0.3, 1.0, 5.0, 1.0, 3.0, 15.0);
+//   trajectory.plan(posori_task->_desired_position, posori_task->_desired_orientation,
+//           goal_position, goal_orientation, time);           // at the state entry
+//   ...
+//   trajectory.setpoint(time, posori_task->_desired_position, posori_task->_desired_orientation,
+//           posori_task->_desired_velocity, posori_task->_desired_angular_velocity,
+//           posori_task->_desired_acceleration, posori_task->_desired_angular_acceleration);
+//   if(trajectory.finished(time) && ...)                     // every tick
+//
+// JointTrajectory does the same for a joint configuration, with limits per joint. before
+// the start and after the end of a motion, the setpoint is its start and its goal at rest.
+// plan() allocates the table (duration / period samples), setpoint() does not allocate.
+
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+namespace PandaUtils {
+
+// double S profile of s from 0 to 1 at rest, sampled every period
+class DoubleSProfile {
+public:
+
+	DoubleSProfile(const double period)
+	: _period(period), _duration(0)
+	{
+		if(period <= 0)
+		{
+			throw std::invalid_argument("sampling period should be positive in DoubleSProfile::DoubleSProfile()\n");
+		}
+		_samples.push_back(Sample(1.0, 0.0, 0.0));
+	}
+
+	// limits of ds/dt, d2s/dt2 and d3s/dt3
+	void plan(const double v_max, const double a_max, const double j_max)
+	{
+		if(v_max <= 0 || a_max <= 0 || j_max <= 0)
+		{
+			throw std::invalid_argument("limits should be positive in DoubleSProfile::plan()\n");
+		}
+
+		// jerk and acceleration phase times, then the cruise time
+		double Tj, Ta;
+		if(v_max * j_max >= a_max * a_max)
+		{
+			Tj = a_max / j_max;
+			Ta = Tj + v_max / a_max;
+		}
+		else
+		{
+			Tj = std::sqrt(v_max / j_max);
+			Ta = 2 * Tj;
+		}
+		double Tv = 1.0 / v_max - Ta;
+		if(Tv < 0)
+		{
+			// the velocity limit is not reached
+			Tv = 0;
+			if(2 * std::pow(a_max, 3) / (j_max * j_max) <= 1.0)
+			{
+				Tj = a_max / j_max;
+				Ta = Tj / 2 + std::sqrt(Tj * Tj / 4 + 1.0 / a_max);
+			}
+			else
+			{
+				Tj = std::cbrt(1.0 / (2 * j_max));
+				Ta = 2 * Tj;
+			}
+		}
+		// the times and jerks of the 7 segments
+		const double durations[7] = {Tj, Ta - 2 * Tj, Tj, Tv, Tj, Ta - 2 * Tj, Tj};
+		const double jerks[7] = {j_max, 0, -j_max, 0, -j_max, 0, j_max};
+		_duration = 2 * Ta + Tv;
+
+		// samples by exact integration of the constant jerk segments
+		const int n_samples = (int) std::ceil(_duration / _period) + 1;
+		_samples.assign(n_samples, Sample(0.0, 0.0, 0.0));
+		double segment_start = 0;
+		double s0 = 0, v0 = 0, a0 = 0;
+		int segment = 0;
+		for(int k=0 ; k<n_samples ; k++)
+		{
+			const double t = std::min(k * _period, _duration);
+			while(segment < 6 && t > segment_start + durations[segment])
+			{
+				const double T = durations[segment];
+				const double jk = jerks[segment];
+				s0 += v0 * T + a0 * T * T / 2 + jk * T * T * T / 6;
+				v0 += a0 * T + jk * T * T / 2;
+				a0 += jk * T;
+				segment_start += T;
+				segment++;
+			}
+			const double tau = t - segment_start;
+			const double jk = jerks[segment];
+			_samples[k].s = s0 + v0 * tau + a0 * tau * tau / 2 + jk * tau * tau * tau / 6;
+			_samples[k].ds = v0 + a0 * tau + jk * tau * tau / 2;
+			_samples[k].dds = a0 + jk * tau;
+		}
+		// the rounding of the times leaves the end a few ulp off
+		const double scale = 1.0 / _samples.back().s;
+		for(int k=0 ; k<n_samples ; k++)
+		{
+			_samples[k].s *= scale;
+			_samples[k].ds *= scale;
+			_samples[k].dds *= scale;
+		}
+		_samples.back() = Sample(1.0, 0.0, 0.0);
+	}
+
+	// s, ds/dt and d2s/dt2 at t from the start, from the sample before t, the end after the duration
+	void sample(const double t, double& s, double& ds, double& dds) const
+	{
+		if(t <= 0)
+		{
+			s = 0; ds = 0; dds = 0;
+			return;
+		}
+		const int k = (t >= _duration) ? _samples.size() - 1 : std::min((int) (t / _period + 1e-9), (int) _samples.size() - 1);
+		s = _samples[k].s;
+		ds = _samples[k].ds;
+		dds = _samples[k].dds;
+	}
+
+	double duration() const
+	{
+		return _duration;
+	}
+
+	double period() const
+	{
+		return _period;
+	}
+
+private:
+
+	struct Sample
+	{
+		Sample(const double s_, const double ds_, const double dds_)
+		: s(s_), ds(ds_), dds(dds_)
+		{}
+
+		double s;
+		double ds;
+		double dds;
+	};
+
+	const double _period;
+	double _duration;
+	std::vector<Sample> _samples;
+};
+
+// straight line in joint space
+class JointTrajectory {
+public:
+
+	JointTrajectory(const double period, const Eigen::VectorXd& v_max,
+			const Eigen::VectorXd& a_max, const Eigen::VectorXd& j_max)
+	: _profile(period),
+	  _v_max(v_max),
+	  _a_max(a_max),
+	  _j_max(j_max),
+	  _start_time(0)
+	{
+		if(a_max.size() != v_max.size() || j_max.size() != v_max.size())
+		{
+			throw std::invalid_argument("limits of different sizes in JointTrajectory::JointTrajectory()\n");
+		}
+		_q_start.setZero(v_max.size());
+		_q_goal.setZero(v_max.size());
+	}
+
+	void plan(const Eigen::VectorXd& q_start, const Eigen::VectorXd& q_goal, const double start_time)
+	{
+		if(q_start.size() != _v_max.size() || q_goal.size() != _v_max.size())
+		{
+			throw std::invalid_argument("configuration of the wrong size in JointTrajectory::plan()\n");
+		}
+		_q_start = q_start;
+		_q_goal = q_goal;
+		_start_time = start_time;
+
+		// the limits of the path parameter, for the axis that moves the most relative to its limits
+		const Eigen::VectorXd distance = (q_goal - q_start).cwiseAbs();
+		double v = 1e9, a = 1e9, j = 1e9;
+		for(int i=0 ; i<distance.size() ; i++)
+		{
+			if(distance(i) > 1e-12)
+			{
+				v = std::min(v, _v_max(i) / distance(i));
+				a = std::min(a, _a_max(i) / distance(i));
+				j = std::min(j, _j_max(i) / distance(i));
+			}
+		}
+		_profile.plan(v, a, j);
+	}
+
+	// sizes of the outputs are the ones of the configuration
+	void setpoint(const double time, Eigen::VectorXd& q, Eigen::VectorXd& dq, Eigen::VectorXd& ddq) const
+	{
+		double s, ds, dds;
+		_profile.sample(time - _start_time, s, ds, dds);
+		q = _q_start + s * (_q_goal - _q_start);
+		dq = ds * (_q_goal - _q_start);
+		ddq = dds * (_q_goal - _q_start);
+	}
+
+	bool finished(const double time) const
+	{
+		return time - _start_time >= _profile.duration();
+	}
+
+	double duration() const
+	{
+		return _profile.duration();
+	}
+
+	const Eigen::VectorXd& goal() const
+	{
+		return _q_goal;
+	}
+
+private:
+
+	DoubleSProfile _profile;
+	Eigen::VectorXd _v_max;
+	Eigen::VectorXd _a_max;
+	Eigen::VectorXd _j_max;
+	Eigen::VectorXd _q_start;
+	Eigen::VectorXd _q_goal;
+	double _start_time;
+};
+
+// straight line of a position, and rotation about a fixed axis
+class CartesianTrajectory {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	CartesianTrajectory(const double period, const double v_max, const double a_max, const double j_max,
+			const double omega_max, const double alpha_max, const double angular_j_max)
+	: _profile(period),
+	  _v_max(v_max), _a_max(a_max), _j_max(j_max),
+	  _omega_max(omega_max), _alpha_max(alpha_max), _angular_j_max(angular_j_max),
+	  _x_start(Eigen::Vector3d::Zero()),
+	  _x_goal(Eigen::Vector3d::Zero()),
+	  _R_start(Eigen::Matrix3d::Identity()),
+	  _R_goal(Eigen::Matrix3d::Identity()),
+	  _axis_in_start(Eigen::Vector3d::UnitZ()),
+	  _axis(Eigen::Vector3d::UnitZ()),
+	  _angle(0),
+	  _start_time(0)
+	{}
+
+	void plan(const Eigen::Vector3d& x_start, const Eigen::Matrix3d& R_start,
+			const Eigen::Vector3d& x_goal, const Eigen::Matrix3d& R_goal, const double start_time)
+	{
+		_x_start = x_start;
+		_x_goal = x_goal;
+		_R_start = R_start;
+		_R_goal = R_goal;
+		_start_time = start_time;
+
+		const Eigen::AngleAxisd rotation(R_start.transpose() * R_goal);
+		_angle = rotation.angle();
+		_axis_in_start = rotation.axis();
+		_axis = R_start * _axis_in_start;
+
+		double v = 1e9, a = 1e9, j = 1e9;
+		const double distance = (x_goal - x_start).norm();
+		if(distance > 1e-12)
+		{
+			v = std::min(v, _v_max / distance);
+			a = std::min(a, _a_max / distance);
+			j = std::min(j, _j_max / distance);
+		}
+		if(_angle > 1e-12)
+		{
+			v = std::min(v, _omega_max / _angle);
+			a = std::min(a, _alpha_max / _angle);
+			j = std::min(j, _angular_j_max / _angle);
+		}
+		_profile.plan(v, a, j);
+	}
+
+	void setpoint(const double time, Eigen::Vector3d& x, Eigen::Matrix3d& R,
+			Eigen::Vector3d& v, Eigen::Vector3d& omega, Eigen::Vector3d& a, Eigen::Vector3d& alpha) const
+	{
+		double s, ds, dds;
+		_profile.sample(time - _start_time, s, ds, dds);
+		x = _x_start + s * (_x_goal - _x_start);
+		v = ds * (_x_goal - _x_start);
+		a = dds * (_x_goal - _x_start);
+		if(s >= 1.0)
+		{
+			R = _R_goal;
+		}
+		else
+		{
+			R = _R_start * Eigen::AngleAxisd(s * _angle, _axis_in_start).toRotationMatrix();
+		}
+		omega = ds * _angle * _axis;
+		alpha = dds * _angle * _axis;
+	}
+
+	bool finished(const double time) const
+	{
+		return time - _start_time >= _profile.duration();
+	}
+
+	double duration() const
+	{
+		return _profile.duration();
+	}
+
+	const Eigen::Vector3d& goalPosition() const
+	{
+		return _x_goal;
+	}
+
+	const Eigen::Matrix3d& goalOrientation() const
+	{
+		return _R_goal;
+	}
+
+private:
+
+	DoubleSProfile _profile;
+	const double _v_max, _a_max, _j_max;
+	const double _omega_max, _alpha_max, _angular_j_max;
+
+	Eigen::Vector3d _x_start;
+	Eigen::Vector3d _x_goal;
+	Eigen::Matrix3d _R_start;
+	Eigen::Matrix3d _R_goal;
+	// of the rotation from the start to the goal, in the start frame and in world
+	Eigen::Vector3d _axis_in_start;
+	Eigen::Vector3d _axis;
+	double _angle;
+	double _start_time;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_TRAJECTORIES_JERK_LIMITED_TRAJECTORY_H_
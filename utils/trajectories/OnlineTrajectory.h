@@ -0,0 +1,309 @@
+#ifndef UTILS_TRAJECTORIES_ONLINE_TRAJECTORY_H_
+#define UTILS_TRAJECTORIES_ONLINE_TRAJECTORY_H_
+
+// Jerk limited motions toward goals that can change at every tick, computed one tick at a
+// time from the current motion.
+//
+// an axis is a position, velocity and acceleration state, and every tick picks the largest
+// jerk toward the goal that still lets the axis stop at rest on the goal : the motion that
+// brings the velocity and the acceleration to zero the fastest under the limits (the end of
+// a double S profile) is in closed form, and the displacement it needs grows with the jerk,
+// so the jerk is found by bisection on it. the axis accelerates while it can, cruises at the
+// velocity limit, and rides the braking motion to the goal, without overshoot because it
+// never leaves a state from which it can stop before it. a goal that moves behind the
+// braking distance is passed at the most braking, and joined back from the other side.
+//
+// OnlineCartesianTrajectory runs an axis per coordinate of the position, and per coordinate
+// of the rotation vector from the current orientation to the goal (in the current frame,
+// where its derivatives are the angular velocity and acceleration), so the limits are per
+// axis and a motion along several axes is not on a straight line. everything is fixed size,
+// a tick is a few microseconds :
+//
+//   PandaUtils::OnlineCartesianTrajectory trajectory(0.001, 0.3, 1.0, 5.0, 1.0, 3.0, 15.0);
+//   trajectory.reset(posori_task->_current_position, posori_task->_current_orientation);
+//   while(...) {                                                  // control loop
+//       trajectory.setGoal(goal_position, goal_orientation);       // any time
+//       trajectory.update();
+//       posori_task->_desired_position = trajectory.position();
+//       posori_task->_desired_velocity = trajectory.velocity();
+//       ...
+//   }
+//
+// update() does not allocate.
+
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace PandaUtils {
+
+// one coordinate, limits of the velocity, acceleration and jerk
+class JerkLimitedAxis {
+public:
+
+	JerkLimitedAxis(const double v_max = 1.0, const double a_max = 1.0, const double j_max = 1.0)
+	: _x(0), _v(0), _a(0), _j(0)
+	{
+		setLimits(v_max, a_max, j_max);
+	}
+
+	void setLimits(const double v_max, const double a_max, const double j_max)
+	{
+		if(v_max <= 0 || a_max <= 0 || j_max <= 0)
+		{
+			throw std::invalid_argument("limits should be positive in JerkLimitedAxis::setLimits()\n");
+		}
+		_v_max = v_max;
+		_a_max = a_max;
+		_j_max = j_max;
+	}
+
+	void reset(const double x, const double v = 0, const double a = 0)
+	{
+		_x = x;
+		_v = v;
+		_a = a;
+	}
+
+	// one tick of dt toward the goal, at rest on it at the end
+	void update(const double goal, const double dt)
+	{
+		// the last tick of the braking does not end on a tick, the rest within a tick of jerk
+		if(std::abs(goal - _x) <= _j_max * dt * dt * dt && std::abs(_v) <= _j_max * dt * dt && std::abs(_a) <= _j_max * dt)
+		{
+			_j = -_a / dt;
+			reset(goal);
+			return;
+		}
+
+		// in the frame where the goal is ahead of the braking point
+		const double d = (_x + brakingDistance(_v, _a) <= goal) ? 1.0 : -1.0;
+		const double x = d * _x, v = d * _v, a = d * _a, g = d * goal;
+
+		double j_low = std::max(-_j_max, (-_a_max - a) / dt);
+		double j_high = std::min(_j_max, (_a_max - a) / dt);
+		if(j_low > j_high)
+		{
+			j_high = j_low;
+		}
+		double j;
+		if(feasible(j_high, x, v, a, g, dt))
+		{
+			j = j_high;
+		}
+		else if(!feasible(j_low, x, v, a, g, dt))
+		{
+			// the goal or the limits changed inside the braking distance, the most braking
+			j = j_low;
+		}
+		else
+		{
+			for(int k=0 ; k<30 ; k++)
+			{
+				const double j_mid = 0.5 * (j_low + j_high);
+				if(feasible(j_mid, x, v, a, g, dt))
+				{
+					j_low = j_mid;
+				}
+				else
+				{
+					j_high = j_mid;
+				}
+			}
+			j = j_low;
+		}
+
+		j *= d;
+		_x += _v * dt + _a * dt * dt / 2 + j * dt * dt * dt / 6;
+		_v += _a * dt + j * dt * dt / 2;
+		_a += j * dt;
+		_j = j;
+	}
+
+	// displacement of the fastest motion from (v, a) to rest under the limits
+	double brakingDistance(const double v, const double a) const
+	{
+		// decelerate if the velocity stays positive once the acceleration is zeroed
+		const double s = (v + a * std::abs(a) / (2 * _j_max) >= 0) ? 1.0 : -1.0;
+		const double v0 = s * v, a0 = s * a;
+
+		// a0 -> a_peak at -j_max, a_peak for t2, a_peak -> 0 at +j_max
+		const double peak_squared = _j_max * v0 + a0 * a0 / 2;
+		double a_peak, t2;
+		if(peak_squared <= _a_max * _a_max)
+		{
+			a_peak = -std::sqrt(std::max(0.0, peak_squared));
+			t2 = 0;
+		}
+		else
+		{
+			a_peak = -_a_max;
+			t2 = (v0 + a0 * a0 / (2 * _j_max) - _a_max * _a_max / _j_max) / _a_max;
+		}
+		const double t1 = std::max(0.0, (a0 - a_peak) / _j_max);
+		const double t3 = -a_peak / _j_max;
+
+		const double d1 = v0 * t1 + a0 * t1 * t1 / 2 - _j_max * t1 * t1 * t1 / 6;
+		const double v1 = v0 + a0 * t1 - _j_max * t1 * t1 / 2;
+		const double d2 = v1 * t2 + a_peak * t2 * t2 / 2;
+		const double v2 = v1 + a_peak * t2;
+		const double d3 = v2 * t3 + a_peak * t3 * t3 / 2 + _j_max * t3 * t3 * t3 / 6;
+		return s * (d1 + d2 + d3);
+	}
+
+	double position() const { return _x; }
+	double velocity() const { return _v; }
+	double acceleration() const { return _a; }
+	// of the last tick
+	double jerk() const { return _j; }
+
+private:
+
+	// after a tick of jerk j, the velocity can stay within its limit and the axis stop before g
+	bool feasible(const double j, const double x, const double v, const double a, const double g, const double dt) const
+	{
+		const double a1 = a + j * dt;
+		const double v1 = v + a * dt + j * dt * dt / 2;
+		const double x1 = x + v * dt + a * dt * dt / 2 + j * dt * dt * dt / 6;
+		return (v1 + a1 * std::abs(a1) / (2 * _j_max) <= _v_max) && (x1 + brakingDistance(v1, a1) <= g);
+	}
+
+	double _v_max, _a_max, _j_max;
+	double _x, _v, _a;
+	double _j;
+};
+
+// position and orientation
+class OnlineCartesianTrajectory {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	OnlineCartesianTrajectory(const double period, const double v_max, const double a_max, const double j_max,
+			const double omega_max, const double alpha_max, const double angular_j_max)
+	: _period(period),
+	  _x(Eigen::Vector3d::Zero()),
+	  _v(Eigen::Vector3d::Zero()),
+	  _a(Eigen::Vector3d::Zero()),
+	  _q(Eigen::Quaterniond::Identity()),
+	  _omega(Eigen::Vector3d::Zero()),
+	  _alpha(Eigen::Vector3d::Zero()),
+	  _x_goal(Eigen::Vector3d::Zero()),
+	  _q_goal(Eigen::Quaterniond::Identity())
+	{
+		if(period <= 0)
+		{
+			throw std::invalid_argument("period should be positive in OnlineCartesianTrajectory::OnlineCartesianTrajectory()\n");
+		}
+		for(int i=0 ; i<3 ; i++)
+		{
+			_position_axes[i].setLimits(v_max, a_max, j_max);
+			_rotation_axes[i].setLimits(omega_max, alpha_max, angular_j_max);
+		}
+	}
+
+	// at rest at this pose, also the goal
+	void reset(const Eigen::Vector3d& x, const Eigen::Matrix3d& R)
+	{
+		_x = x;
+		_v.setZero();
+		_a.setZero();
+		_q = Eigen::Quaterniond(R).normalized();
+		_omega.setZero();
+		_alpha.setZero();
+		_x_goal = x;
+		_q_goal = _q;
+		for(int i=0 ; i<3 ; i++)
+		{
+			_position_axes[i].reset(x(i));
+		}
+	}
+
+	void setGoal(const Eigen::Vector3d& x_goal, const Eigen::Matrix3d& R_goal)
+	{
+		_x_goal = x_goal;
+		_q_goal = Eigen::Quaterniond(R_goal).normalized();
+	}
+
+	// one period
+	void update()
+	{
+		for(int i=0 ; i<3 ; i++)
+		{
+			_position_axes[i].update(_x_goal(i), _period);
+			_x(i) = _position_axes[i].position();
+			_v(i) = _position_axes[i].velocity();
+			_a(i) = _position_axes[i].acceleration();
+		}
+
+		// rotation vector from the current orientation to the goal, in the current frame, the
+		// short way around
+		Eigen::Quaterniond q_error = _q.conjugate() * _q_goal;
+		if(q_error.w() < 0)
+		{
+			q_error.coeffs() = -q_error.coeffs();
+		}
+		const double sin_half = q_error.vec().norm();
+		const Eigen::Vector3d theta_goal = (sin_half > 1e-12) ?
+				Eigen::Vector3d(2 * std::atan2(sin_half, q_error.w()) / sin_half * q_error.vec()) : Eigen::Vector3d(2 * q_error.vec());
+
+		// the axes start from the current orientation, with the rates in the current frame
+		const Eigen::Matrix3d R = _q.toRotationMatrix();
+		const Eigen::Vector3d omega_body = R.transpose() * _omega;
+		const Eigen::Vector3d alpha_body = R.transpose() * _alpha;
+		Eigen::Vector3d theta;
+		for(int i=0 ; i<3 ; i++)
+		{
+			_rotation_axes[i].reset(0, omega_body(i), alpha_body(i));
+			_rotation_axes[i].update(theta_goal(i), _period);
+			theta(i) = _rotation_axes[i].position();
+			_omega(i) = _rotation_axes[i].velocity();
+			_alpha(i) = _rotation_axes[i].acceleration();
+		}
+		const double angle = theta.norm();
+		if(angle > 1e-12)
+		{
+			_q = (_q * Eigen::Quaterniond(Eigen::AngleAxisd(angle, theta / angle))).normalized();
+		}
+		const Eigen::Matrix3d R_new = _q.toRotationMatrix();
+		_omega = R_new * _omega;
+		_alpha = R_new * _alpha;
+	}
+
+	// at rest on the goal
+	bool reached(const double position_tolerance = 1e-6, const double angle_tolerance = 1e-6) const
+	{
+		return (_x - _x_goal).norm() < position_tolerance && _v.isZero() && _omega.isZero()
+				&& _q.angularDistance(_q_goal) < angle_tolerance;
+	}
+
+	const Eigen::Vector3d& position() const { return _x; }
+	const Eigen::Vector3d& velocity() const { return _v; }
+	const Eigen::Vector3d& acceleration() const { return _a; }
+	Eigen::Matrix3d orientation() const { return _q.toRotationMatrix(); }
+	const Eigen::Quaterniond& quaternion() const { return _q; }
+	const Eigen::Vector3d& angularVelocity() const { return _omega; }
+	const Eigen::Vector3d& angularAcceleration() const { return _alpha; }
+
+private:
+
+	const double _period;
+	JerkLimitedAxis _position_axes[3];
+	JerkLimitedAxis _rotation_axes[3];
+
+	Eigen::Vector3d _x;
+	Eigen::Vector3d _v;
+	Eigen::Vector3d _a;
+	Eigen::Quaterniond _q;
+	// in world
+	Eigen::Vector3d _omega;
+	Eigen::Vector3d _alpha;
+
+	Eigen::Vector3d _x_goal;
+	Eigen::Quaterniond _q_goal;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_TRAJECTORIES_ONLINE_TRAJECTORY_H_
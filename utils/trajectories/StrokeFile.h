@@ -0,0 +1,286 @@
+#ifndef UTILS_TRAJECTORIES_STROKE_FILE_H_
+#define UTILS_TRAJECTORIES_STROKE_FILE_H_
+
+// Binary file of a painting job, the strokes of a CAD plan, read through a memory mapping.
+//
+// the file is a header, the table of the strokes, then the points of all the strokes one
+// after the other :
+//
+//   StrokeFileHeader   magic "PSTROKES", version, number of strokes and of points
+//   StrokeRecord       x n_strokes : first point, number of points, speed along the
+//                      stroke (m/s) and orientation of the brush (quaternion w x y z)
+//   StrokePoint        x n_points : position of the brush, in world frame (m)
+//
+// in the byte order of the machine, every field 8 byte aligned. the file is mapped and not
+// read : opening a job of any size is a few system calls, and the pages of a stroke are
+// loaded when it is used. prefetch() asks the kernel to read the next strokes ahead, and
+// release() gives back the pages of the strokes already painted, so the resident memory
+// stays the strokes around the current one whatever the size of the job :
+//
+//   PandaUtils::StrokeFile job("facade.strokes");
+//   for(unsigned long k=0 ; k<job.numStrokes() ; k++) {
+//       job.prefetch(k+1, 8);
+//       const PandaUtils::StrokeRecord& stroke = job.stroke(k);
+//       const PandaUtils::StrokePoint* points = job.points(k);
+//       ...
+//       job.release(k);
+//   }
+//
+// StrokeFileWriter writes the format, e.g. for the strokes_from_csv tool.
+
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace PandaUtils {
+
+static const char STROKE_FILE_MAGIC[8] = {'P','S','T','R','O','K','E','S'};
+static const uint32_t STROKE_FILE_VERSION = 1;
+
+struct StrokeFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t n_strokes;
+	uint64_t n_points;
+};
+
+struct StrokeRecord {
+	uint64_t first_point;
+	uint32_t n_points;
+	uint32_t reserved;
+	double speed;
+	// w x y z
+	double orientation[4];
+
+	Eigen::Quaterniond brushOrientation() const
+	{
+		return Eigen::Quaterniond(orientation[0], orientation[1], orientation[2], orientation[3]).normalized();
+	}
+};
+
+struct StrokePoint {
+	double position[3];
+
+	Eigen::Vector3d vector() const
+	{
+		return Eigen::Vector3d(position[0], position[1], position[2]);
+	}
+};
+
+class StrokeFile {
+public:
+
+	StrokeFile(const std::string& file_name)
+	: _file_name(file_name),
+	  _data(NULL),
+	  _size(0)
+	{
+		const int fd = open(file_name.c_str(), O_RDONLY);
+		if(fd < 0)
+		{
+			throw std::runtime_error("could not open " + file_name + " in StrokeFile::StrokeFile()\n");
+		}
+		struct stat file_stat;
+		if(fstat(fd, &file_stat) != 0 || file_stat.st_size < (off_t) sizeof(StrokeFileHeader))
+		{
+			close(fd);
+			throw std::runtime_error(file_name + " is not a stroke file in StrokeFile::StrokeFile()\n");
+		}
+		_size = file_stat.st_size;
+		void* data = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+		// the mapping keeps the file
+		close(fd);
+		if(data == MAP_FAILED)
+		{
+			throw std::runtime_error("could not map " + file_name + " in StrokeFile::StrokeFile()\n");
+		}
+		_data = static_cast<const char*>(data);
+
+		const StrokeFileHeader* header = reinterpret_cast<const StrokeFileHeader*>(_data);
+		if(memcmp(header->magic, STROKE_FILE_MAGIC, sizeof(STROKE_FILE_MAGIC)) != 0 || header->version != STROKE_FILE_VERSION)
+		{
+			unmap();
+			throw std::runtime_error(file_name + " is not a stroke file of version " + std::to_string(STROKE_FILE_VERSION) + " in StrokeFile::StrokeFile()\n");
+		}
+		_n_strokes = header->n_strokes;
+		_n_points = header->n_points;
+		const uint64_t expected_size = sizeof(StrokeFileHeader) + _n_strokes * sizeof(StrokeRecord) + _n_points * sizeof(StrokePoint);
+		if(expected_size != _size)
+		{
+			unmap();
+			throw std::runtime_error(file_name + " is truncated in StrokeFile::StrokeFile()\n");
+		}
+		_strokes = reinterpret_cast<const StrokeRecord*>(_data + sizeof(StrokeFileHeader));
+		_points = reinterpret_cast<const StrokePoint*>(_data + sizeof(StrokeFileHeader) + _n_strokes * sizeof(StrokeRecord));
+
+		// read in order, the strokes are checked when they are used and not here
+		madvise(const_cast<char*>(_data), _size, MADV_SEQUENTIAL);
+	}
+
+	~StrokeFile()
+	{
+		unmap();
+	}
+
+	StrokeFile(const StrokeFile&) = delete;
+	StrokeFile& operator=(const StrokeFile&) = delete;
+
+	uint64_t numStrokes() const { return _n_strokes; }
+	uint64_t numPoints() const { return _n_points; }
+
+	const StrokeRecord& stroke(const uint64_t k) const
+	{
+		return _strokes[k];
+	}
+
+	const StrokePoint* points(const uint64_t k) const
+	{
+		return _points + _strokes[k].first_point;
+	}
+
+	// points inside the file and a positive speed
+	bool validStroke(const uint64_t k) const
+	{
+		return k < _n_strokes && _strokes[k].n_points > 0 && _strokes[k].first_point <= _n_points
+			&& _strokes[k].n_points <= _n_points - _strokes[k].first_point && _strokes[k].speed > 0;
+	}
+
+	// starts reading the points of the strokes [first, first + n) in the background
+	void prefetch(const uint64_t first, const uint64_t n) const
+	{
+		if(first >= _n_strokes)
+		{
+			return;
+		}
+		const uint64_t last = std::min(first + n, _n_strokes) - 1;
+		advise(points(first), points(last) + _strokes[last].n_points, MADV_WILLNEED);
+	}
+
+	// the points of the strokes up to k are not needed anymore
+	void release(const uint64_t k) const
+	{
+		advise(_points, points(k) + _strokes[k].n_points, MADV_DONTNEED);
+	}
+
+	const std::string& fileName() const { return _file_name; }
+
+private:
+
+	// whole pages inside [begin, end) only, a page shared with the next stroke is kept. the
+	// range is clamped to the points, an invalid stroke never advises outside the mapping
+	void advise(const StrokePoint* begin, const StrokePoint* end, const int advice) const
+	{
+		const uintptr_t page = sysconf(_SC_PAGESIZE);
+		const uintptr_t points_begin = reinterpret_cast<uintptr_t>(_points);
+		const uintptr_t points_end = reinterpret_cast<uintptr_t>(_points + _n_points);
+		uintptr_t first = std::max(points_begin, std::min(points_end, reinterpret_cast<uintptr_t>(begin)));
+		uintptr_t last = std::max(points_begin, std::min(points_end, reinterpret_cast<uintptr_t>(end)));
+		if(advice == MADV_WILLNEED)
+		{
+			first = first & ~(page - 1);
+		}
+		else
+		{
+			first = (first + page - 1) & ~(page - 1);
+			last = last & ~(page - 1);
+		}
+		if(last > first)
+		{
+			madvise(reinterpret_cast<void*>(first), last - first, advice);
+		}
+	}
+
+	void unmap()
+	{
+		if(_data)
+		{
+			munmap(const_cast<char*>(_data), _size);
+			_data = NULL;
+		}
+	}
+
+	std::string _file_name;
+	const char* _data;
+	uint64_t _size;
+	uint64_t _n_strokes;
+	uint64_t _n_points;
+	const StrokeRecord* _strokes;
+	const StrokePoint* _points;
+};
+
+// collects the strokes one after the other, and writes them all at once
+class StrokeFileWriter {
+public:
+
+	void addStroke(const std::vector<Eigen::Vector3d>& points, const double speed,
+			const Eigen::Quaterniond& brush_orientation)
+	{
+		if(points.empty() || !(speed > 0))
+		{
+			throw std::invalid_argument("stroke without points or speed in StrokeFileWriter::addStroke()\n");
+		}
+		StrokeRecord record;
+		memset(&record, 0, sizeof(record));
+		record.first_point = _points.size();
+		record.n_points = points.size();
+		record.speed = speed;
+		record.orientation[0] = brush_orientation.w();
+		record.orientation[1] = brush_orientation.x();
+		record.orientation[2] = brush_orientation.y();
+		record.orientation[3] = brush_orientation.z();
+		_strokes.push_back(record);
+		for(unsigned int i=0 ; i<points.size() ; i++)
+		{
+			StrokePoint point;
+			point.position[0] = points[i](0);
+			point.position[1] = points[i](1);
+			point.position[2] = points[i](2);
+			_points.push_back(point);
+		}
+	}
+
+	void write(const std::string& file_name) const
+	{
+		std::ofstream out(file_name, std::ios::out | std::ios::binary | std::ios::trunc);
+		if(!out)
+		{
+			throw std::runtime_error("could not open " + file_name + " in StrokeFileWriter::write()\n");
+		}
+		StrokeFileHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, STROKE_FILE_MAGIC, sizeof(STROKE_FILE_MAGIC));
+		header.version = STROKE_FILE_VERSION;
+		header.n_strokes = _strokes.size();
+		header.n_points = _points.size();
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(_strokes.data()), _strokes.size() * sizeof(StrokeRecord));
+		out.write(reinterpret_cast<const char*>(_points.data()), _points.size() * sizeof(StrokePoint));
+		if(!out)
+		{
+			throw std::runtime_error("could not write " + file_name + " in StrokeFileWriter::write()\n");
+		}
+	}
+
+	unsigned long numStrokes() const { return _strokes.size(); }
+
+private:
+
+	std::vector<StrokeRecord> _strokes;
+	std::vector<StrokePoint> _points;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_TRAJECTORIES_STROKE_FILE_H_
@@ -0,0 +1,259 @@
+#ifndef UTILS_TRAJECTORIES_STROKE_STREAMER_H_
+#define UTILS_TRAJECTORIES_STROKE_STREAMER_H_
+
+// Setpoints of a painting job computed on a reader thread, ahead of the control loop.
+//
+// the reader thread goes through the strokes of a StrokeFile (see trajectories/StrokeFile.h)
+// in order. it moves the brush to the first point of a stroke and to its orientation on a
+// jerk limited transit (see trajectories/JerkLimitedTrajectory.h), then along the points of
+// the stroke at its speed on a blended path (see trajectories/ViaPointPath.h). the setpoints
+// of both are sampled at the period of the control loop, already in the robot frame, and
+// pushed to a bounded lock-free queue (see threads/SpscQueue.h). the thread blocks when the
+// queue is full, so it stays at most the capacity of the queue ahead of the loop, whatever
+// the size of the job. the loop pops one setpoint per cycle and copies it to its task :
+//
+//   PandaUtils::StrokeStreamer streamer(job_file, 0.001, T_robot_world);
+//   streamer.start(posori_task->_current_position, posori_task->_current_orientation);
+//   while(...) {
+//       PandaUtils::PaintingSetpoint setpoint;
+//       if(streamer.next(setpoint)) {                          // 1 kHz loop
+//           posori_task->_desired_position = setpoint.position;
+//           ...
+//       }
+//       if(streamer.finished()) ...
+//   }
+//
+// an empty queue while the job is not finished is an underrun, counted, the loop keeps its
+// last setpoint. invalid strokes of the file are skipped and counted.
+
+#include "trajectories/JerkLimitedTrajectory.h"
+#include "trajectories/StrokeFile.h"
+#include "trajectories/ViaPointPath.h"
+#include "threads/SpscQueue.h"
+#include <Eigen/Dense>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+namespace PandaUtils {
+
+struct PaintingSetpoint {
+	Eigen::Vector3d position;
+	Eigen::Matrix3d orientation;
+	Eigen::Vector3d velocity;
+	Eigen::Vector3d angular_velocity;
+	Eigen::Vector3d acceleration;
+	Eigen::Vector3d angular_acceleration;
+	// stroke painted, -1 on the transits between the strokes
+	long stroke;
+
+	PaintingSetpoint()
+	: position(Eigen::Vector3d::Zero()),
+	  orientation(Eigen::Matrix3d::Identity()),
+	  velocity(Eigen::Vector3d::Zero()),
+	  angular_velocity(Eigen::Vector3d::Zero()),
+	  acceleration(Eigen::Vector3d::Zero()),
+	  angular_acceleration(Eigen::Vector3d::Zero()),
+	  stroke(-1)
+	{}
+};
+
+class StrokeStreamer {
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+	struct Limits {
+		// transits
+		double v_max, a_max, j_max;
+		double omega_max, alpha_max, angular_j_max;
+		// along the strokes, at the speed of each stroke times speed_scale, e.g. to paint a
+		// captured session faster than the operator did
+		double stroke_a_max;
+		double corner_deviation;
+		double speed_scale;
+
+		Limits()
+		: v_max(0.3), a_max(1.0), j_max(5.0),
+		  omega_max(1.0), alpha_max(3.0), angular_j_max(15.0),
+		  stroke_a_max(1.0), corner_deviation(0.002), speed_scale(1.0)
+		{}
+	};
+
+	StrokeStreamer(const std::string& file_name, const double period,
+			const Eigen::Affine3d& T_robot_world = Eigen::Affine3d::Identity(),
+			const Limits& limits = Limits(), const int queue_capacity = 2048, const int prefetch_strokes = 16)
+	: _file(file_name),
+	  _period(period),
+	  _T_robot_world(T_robot_world),
+	  _limits(limits),
+	  _prefetch_strokes(prefetch_strokes),
+	  _queue(queue_capacity),
+	  _f_stop(false),
+	  _f_done(false),
+	  _f_started(false),
+	  _n_underruns(0),
+	  _n_skipped_strokes(0),
+	  _current_stroke(-1)
+	{}
+
+	~StrokeStreamer()
+	{
+		stop();
+	}
+
+	StrokeStreamer(const StrokeStreamer&) = delete;
+	StrokeStreamer& operator=(const StrokeStreamer&) = delete;
+
+	// the job starts from this pose of the brush, in the robot frame
+	void start(const Eigen::Vector3d& start_position, const Eigen::Matrix3d& start_orientation)
+	{
+		if(_f_started)
+		{
+			throw std::runtime_error("streamer already started in StrokeStreamer::start()\n");
+		}
+		_f_started = true;
+		_thread = std::thread(&StrokeStreamer::run, this, start_position, start_orientation);
+	}
+
+	void stop()
+	{
+		_f_stop = true;
+		if(_thread.joinable())
+		{
+			_thread.join();
+		}
+	}
+
+	// control thread only : the next setpoint, false if there is none ready
+	bool next(PaintingSetpoint& setpoint)
+	{
+		if(_queue.pop(setpoint))
+		{
+			_current_stroke = setpoint.stroke;
+			return true;
+		}
+		if(!_f_done.load(std::memory_order_acquire))
+		{
+			_n_underruns++;
+		}
+		return false;
+	}
+
+	// control thread only : all the setpoints of the job were popped
+	bool finished() const
+	{
+		return _f_done.load(std::memory_order_acquire) && _queue.front() == NULL;
+	}
+
+	// stroke of the last setpoint popped, -1 on a transit
+	long currentStroke() const { return _current_stroke; }
+	unsigned long numStrokes() const { return _file.numStrokes(); }
+	unsigned long long numUnderruns() const { return _n_underruns; }
+	unsigned long numSkippedStrokes() const { return _n_skipped_strokes; }
+
+private:
+
+	void run(Eigen::Vector3d position, Eigen::Matrix3d orientation)
+	{
+		CartesianTrajectory transit(_period, _limits.v_max, _limits.a_max, _limits.j_max,
+				_limits.omega_max, _limits.alpha_max, _limits.angular_j_max);
+		PaintingSetpoint setpoint;
+		std::vector<Eigen::Vector3d> via_points;
+
+		for(uint64_t k=0 ; k<_file.numStrokes() && !_f_stop ; k++)
+		{
+			_file.prefetch(k + 1, _prefetch_strokes);
+			if(!_file.validStroke(k))
+			{
+				_n_skipped_strokes++;
+				continue;
+			}
+			const StrokeRecord& stroke = _file.stroke(k);
+			const StrokePoint* points = _file.points(k);
+			const Eigen::Vector3d first_point = _T_robot_world * points[0].vector();
+			const Eigen::Matrix3d brush_orientation = _T_robot_world.linear() * stroke.brushOrientation().toRotationMatrix();
+
+			// transit to the start of the stroke
+			transit.plan(position, orientation, first_point, brush_orientation, 0);
+			setpoint.stroke = -1;
+			for(long i=0 ; !_f_stop ; i++)
+			{
+				const double t = i * _period;
+				transit.setpoint(t, setpoint.position, setpoint.orientation, setpoint.velocity,
+						setpoint.angular_velocity, setpoint.acceleration, setpoint.angular_acceleration);
+				if(!push(setpoint) || transit.finished(t))
+				{
+					break;
+				}
+			}
+
+			// along the stroke, at a constant orientation
+			via_points.clear();
+			for(uint32_t i=1 ; i<stroke.n_points ; i++)
+			{
+				via_points.push_back(_T_robot_world * points[i].vector());
+			}
+			ViaPointPath path(stroke.speed * _limits.speed_scale, _limits.stroke_a_max, _limits.corner_deviation);
+			path.plan(first_point, via_points, 0);
+			setpoint.stroke = k;
+			setpoint.orientation = brush_orientation;
+			setpoint.angular_velocity.setZero();
+			setpoint.angular_acceleration.setZero();
+			for(long i=0 ; !_f_stop ; i++)
+			{
+				const double t = i * _period;
+				path.sample(t, setpoint.position, setpoint.velocity, setpoint.acceleration);
+				if(!push(setpoint) || path.finished(t))
+				{
+					break;
+				}
+			}
+
+			position = path.goal();
+			orientation = brush_orientation;
+			_file.release(k);
+		}
+		_f_done.store(true, std::memory_order_release);
+	}
+
+	// blocks while the queue is full, false if stopped meanwhile
+	bool push(const PaintingSetpoint& setpoint)
+	{
+		PaintingSetpoint* slot;
+		while(!(slot = _queue.beginPush()))
+		{
+			if(_f_stop)
+			{
+				return false;
+			}
+			usleep(1000);
+		}
+		*slot = setpoint;
+		_queue.endPush();
+		return true;
+	}
+
+	StrokeFile _file;
+	const double _period;
+	const Eigen::Affine3d _T_robot_world;
+	const Limits _limits;
+	const int _prefetch_strokes;
+
+	SpscQueue<PaintingSetpoint> _queue;
+	std::thread _thread;
+	std::atomic<bool> _f_stop;
+	std::atomic<bool> _f_done;
+	bool _f_started;
+
+	unsigned long long _n_underruns;
+	std::atomic<unsigned long> _n_skipped_strokes;
+	long _current_stroke;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_TRAJECTORIES_STROKE_STREAMER_H_
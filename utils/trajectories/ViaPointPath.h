@@ -0,0 +1,334 @@
+#ifndef UTILS_TRAJECTORIES_VIA_POINT_PATH_H_
+#define UTILS_TRAJECTORIES_VIA_POINT_PATH_H_
+
+// Continuous path of a position through a list of via points, planned once and followed
+// without stopping at the via points.
+//
+// the path is the polyline from the start through the via points, at the velocity limit
+// along every segment, with a parabolic blend of bounded acceleration around every via
+// point (linear segments with parabolic blends) :
+//
+//   - the segment k takes T_k = |p_k+1 - p_k| / v_max, at the constant velocity v_k
+//   - around the via point p_i the velocity changes from v_i-1 to v_i at a_max, over
+//     tb_i = |v_i - v_i-1| / a_max centered on the time the polyline passes p_i
+//   - the blends of the two ends of a segment take at most T_k, the segments that are too
+//     short for their blends are slowed down, by forward and backward passes over the
+//     segments so that a ramp of the velocity spreads over several short segments (then
+//     the whole path if it is not enough)
+//
+// the path starts and ends at rest exactly at the start and at the last via point, and cuts
+// the corners at the via points in between by |v_i - v_i-1|^2 / (8 a_max), the more the
+// sharper the corner. the segments around a corner cut by more than max_corner_deviation
+// are slowed down until it is not. the velocity never exceeds v_max, the acceleration
+// a_max. the path is a few coefficients per via point, and a sample is a closed form
+// evaluation :
+//
+//   PandaUtils::ViaPointPath path(0.12, 0.2, 0.015);
+//   path.plan(posori_task->_desired_position, via_points, time);    // at the state entry
+//   ...
+//   path.sample(time, posori_task->_desired_position,
+//           posori_task->_desired_velocity, posori_task->_desired_acceleration);
+//   if(path.finished(time))                                     // every tick
+//
+// via points closer than 1e-9 to the previous one are dropped. plan() allocates,
+// sample() does not.
+
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace PandaUtils {
+
+class ViaPointPath {
+public:
+
+	ViaPointPath(const double v_max, const double a_max,
+			const double max_corner_deviation = std::numeric_limits<double>::infinity())
+	: _v_max(v_max),
+	  _a_max(a_max),
+	  _max_velocity_change(std::sqrt(8 * a_max * max_corner_deviation)),
+	  _start_time(0),
+	  _duration(0),
+	  _cursor(0)
+	{
+		if(v_max <= 0 || a_max <= 0 || max_corner_deviation <= 0)
+		{
+			throw std::invalid_argument("limits should be positive in ViaPointPath::ViaPointPath()\n");
+		}
+		_points.push_back(Eigen::Vector3d::Zero());
+		_velocities.push_back(Eigen::Vector3d::Zero());
+		_blend_times.push_back(0);
+		_passage_times.push_back(0);
+	}
+
+	void plan(const Eigen::Vector3d& start, const std::vector<Eigen::Vector3d>& via_points, const double start_time)
+	{
+		_start_time = start_time;
+		_cursor = 0;
+
+		_points.clear();
+		_points.push_back(start);
+		for(unsigned int k=0 ; k<via_points.size() ; k++)
+		{
+			if((via_points[k] - _points.back()).norm() > 1e-9)
+			{
+				_points.push_back(via_points[k]);
+			}
+		}
+		const int n = _points.size() - 1;
+
+		// speeds of the segments, from the velocity limit down to what the via points allow
+		_directions.resize(n);
+		_lengths.resize(n);
+		_speeds.assign(n, _v_max);
+		for(int k=0 ; k<n ; k++)
+		{
+			_lengths[k] = (_points[k+1] - _points[k]).norm();
+			_directions[k] = (_points[k+1] - _points[k]) / _lengths[k];
+		}
+
+		// forward passes lower the speed after a via point, backward passes the speed before
+		// it. the ramps of the velocity spread over as many segments as they need, e.g. from
+		// rest along a stroke of dense points
+		for(int iteration=0 ; iteration<50 ; iteration++)
+		{
+			bool f_changed = false;
+			for(int i=0 ; i<=n ; i++)
+			{
+				f_changed |= limitSpeed(i, i);
+			}
+			for(int i=n ; i>=0 ; i--)
+			{
+				f_changed |= limitSpeed(i, i-1);
+			}
+			if(!f_changed)
+			{
+				break;
+			}
+		}
+		std::vector<double> T(n);
+		for(int k=0 ; k<n ; k++)
+		{
+			T[k] = _lengths[k] / _speeds[k];
+		}
+		computeBlends(T);
+
+		// what is left, by a common time scaling c of all the segments : the blends scale by
+		// 1/c and the segments by c
+		double ratio = 1.0;
+		for(int k=0 ; k<n ; k++)
+		{
+			ratio = std::max(ratio, (_blend_times[k] + _blend_times[k+1]) / (2 * T[k]));
+		}
+		if(ratio > 1.0)
+		{
+			const double c = std::sqrt(ratio) * (1 + 1e-12);
+			for(int k=0 ; k<n ; k++)
+			{
+				T[k] *= c;
+			}
+		}
+		computeBlends(T);
+
+		_passage_times.resize(n + 1);
+		_passage_times[0] = _blend_times[0] / 2;
+		for(int k=0 ; k<n ; k++)
+		{
+			_passage_times[k+1] = _passage_times[k] + T[k];
+		}
+		_duration = _passage_times[n] + _blend_times[n] / 2;
+	}
+
+	// position, velocity and acceleration at the time, at rest at the ends outside the path
+	void sample(const double time, Eigen::Vector3d& x, Eigen::Vector3d& v, Eigen::Vector3d& a)
+	{
+		const double t = time - _start_time;
+		const int n = _points.size() - 1;
+		if(t <= 0 || n == 0)
+		{
+			x = _points[0];
+			v.setZero();
+			a.setZero();
+			return;
+		}
+		if(t >= _duration)
+		{
+			x = _points[n];
+			v.setZero();
+			a.setZero();
+			return;
+		}
+
+		// the via point whose blend and following segment contain t, from the previous one
+		if(t < blendStart(_cursor))
+		{
+			_cursor = 0;
+		}
+		while(_cursor < n && t >= blendStart(_cursor + 1))
+		{
+			_cursor++;
+		}
+		const int i = _cursor;
+
+		const double tau = t - blendStart(i);
+		if(tau < _blend_times[i])
+		{
+			const Eigen::Vector3d v_in = (i > 0) ? _velocities[i-1] : Eigen::Vector3d::Zero();
+			const Eigen::Vector3d acceleration = (_velocities[i] - v_in) / _blend_times[i];
+			x = _points[i] - v_in * _blend_times[i] / 2 + v_in * tau + acceleration * tau * tau / 2;
+			v = v_in + acceleration * tau;
+			a = acceleration;
+		}
+		else
+		{
+			x = _points[i] + _velocities[i] * (t - _passage_times[i]);
+			v = _velocities[i];
+			a.setZero();
+		}
+	}
+
+	bool finished(const double time) const
+	{
+		return time - _start_time >= _duration;
+	}
+
+	// segment followed at the time, from the times the polyline passes the via points
+	int segment(const double time) const
+	{
+		const int n = _points.size() - 1;
+		const double t = time - _start_time;
+		int k = 0;
+		while(k < n - 1 && t >= _passage_times[k+1])
+		{
+			k++;
+		}
+		return k;
+	}
+
+	int numSegments() const
+	{
+		return _points.size() - 1;
+	}
+
+	double duration() const
+	{
+		return _duration;
+	}
+
+	const Eigen::Vector3d& goal() const
+	{
+		return _points.back();
+	}
+
+private:
+
+	// change of velocity at the via point i, from the segment i-1 to the segment i (rest
+	// before the first one and after the last one)
+	double velocityChange(const int i) const
+	{
+		const int n = _speeds.size();
+		const Eigen::Vector3d v_in = (i > 0) ? Eigen::Vector3d(_speeds[i-1] * _directions[i-1]) : Eigen::Vector3d::Zero();
+		const Eigen::Vector3d v_out = (i < n) ? Eigen::Vector3d(_speeds[i] * _directions[i]) : Eigen::Vector3d::Zero();
+		return (v_out - v_in).norm();
+	}
+
+	// the blend at the via point i within the corner deviation and within each of the two
+	// segments around it, then the blends of both ends of a segment fit in the segment
+	bool feasible(const int i) const
+	{
+		const int n = _speeds.size();
+		double max_change = _max_velocity_change;
+		if(i > 0)
+		{
+			max_change = std::min(max_change, _a_max * _lengths[i-1] / _speeds[i-1]);
+		}
+		if(i < n)
+		{
+			max_change = std::min(max_change, _a_max * _lengths[i] / _speeds[i]);
+		}
+		return velocityChange(i) <= max_change * (1 + 1e-9);
+	}
+
+	// lowers the speed of the segment k, next to the via point i, until the blend at i is
+	// feasible. it can not always be with the other segment as it is, the other pass lowers it
+	bool limitSpeed(const int i, const int k)
+	{
+		const int n = _speeds.size();
+		if(k < 0 || k >= n || feasible(i))
+		{
+			return false;
+		}
+		// a corner cut too much slows both segments alike, the change of velocity scales with them
+		const double velocity_change = velocityChange(i);
+		if(i > 0 && i < n && velocity_change > _max_velocity_change)
+		{
+			const double scale = _max_velocity_change / velocity_change;
+			_speeds[i-1] *= scale;
+			_speeds[i] *= scale;
+			if(feasible(i))
+			{
+				return true;
+			}
+		}
+		const double speed = _speeds[k];
+		while(!feasible(i) && _speeds[k] > 1e-6 * _v_max)
+		{
+			_speeds[k] *= 0.98;
+		}
+		if(!feasible(i))
+		{
+			_speeds[k] = speed;
+			return false;
+		}
+		return true;
+	}
+
+	// velocities of the segments for the durations T, and the blend times at the via points
+	void computeBlends(const std::vector<double>& T)
+	{
+		const int n = _points.size() - 1;
+		_velocities.assign(n + 1, Eigen::Vector3d::Zero());
+		for(int k=0 ; k<n ; k++)
+		{
+			_velocities[k] = (_points[k+1] - _points[k]) / T[k];
+		}
+		_blend_times.assign(n + 1, 0.0);
+		for(int i=0 ; i<=n ; i++)
+		{
+			const Eigen::Vector3d v_in = (i > 0) ? _velocities[i-1] : Eigen::Vector3d::Zero();
+			_blend_times[i] = (_velocities[i] - v_in).norm() / _a_max;
+		}
+	}
+
+	double blendStart(const int i) const
+	{
+		return _passage_times[i] - _blend_times[i] / 2;
+	}
+
+	double _v_max;
+	double _a_max;
+	double _max_velocity_change;
+
+	// the start and the via points, the velocity of the segment from each of them (zero
+	// after the last one), the blend around each of them and the time the polyline passes it
+	std::vector<Eigen::Vector3d> _points;
+	std::vector<Eigen::Vector3d> _velocities;
+	std::vector<double> _blend_times;
+	std::vector<double> _passage_times;
+	// lengths, directions and speeds of the segments while planning
+	std::vector<double> _lengths;
+	std::vector<Eigen::Vector3d> _directions;
+	std::vector<double> _speeds;
+
+	double _start_time;
+	double _duration;
+	int _cursor;
+};
+
+} /* namespace PandaUtils */
+
+#endif //UTILS_TRAJECTORIES_VIA_POINT_PATH_H_
@@ -0,0 +1,114 @@
+// Converts a stroke plan exported from CAD as csv to the stroke file of the painting
+// controller (see trajectories/StrokeFile.h).
+//
+// usage : strokes_from_csv plan.csv [plan.strokes]
+// one line per point : stroke,x,y,z[,speed,qw,qx,qy,qz] in world frame, the points of a
+// stroke on consecutive lines. the speed (m/s, default 0.1) and the brush orientation
+// (default identity) are read on the first point of each stroke. lines starting with #
+// are skipped.
+
+#include "trajectories/StrokeFile.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+int main(int argc, char** argv)
+{
+	if(argc < 2)
+	{
+		cout << "usage : " << argv[0] << " plan.csv [plan.strokes]" << endl;
+		return 1;
+	}
+	const string input_file = argv[1];
+	string output_file;
+	if(argc > 2)
+	{
+		output_file = argv[2];
+	}
+	else
+	{
+		const size_t extension = input_file.find_last_of('.');
+		output_file = (extension == string::npos ? input_file : input_file.substr(0, extension)) + ".strokes";
+	}
+
+	ifstream in(input_file);
+	if(!in)
+	{
+		cout << "could not open " << input_file << endl;
+		return 1;
+	}
+
+	PandaUtils::StrokeFileWriter writer;
+	vector<Vector3d> points;
+	double speed = 0.1;
+	Quaterniond orientation = Quaterniond::Identity();
+	long current_stroke = -1;
+	string line;
+	int line_number = 0;
+	unsigned long n_points = 0;
+
+	try
+	{
+		while(getline(in, line))
+		{
+			line_number++;
+			if(line.empty() || line[0] == '#')
+			{
+				continue;
+			}
+			for(unsigned int i=0 ; i<line.size() ; i++)
+			{
+				if(line[i] == ',')
+				{
+					line[i] = ' ';
+				}
+			}
+			stringstream fields(line);
+			vector<double> values;
+			double value;
+			while(fields >> value)
+			{
+				values.push_back(value);
+			}
+			if(values.size() != 4 && values.size() != 5 && values.size() != 9)
+			{
+				cout << "line " << line_number << " of " << input_file << " should be stroke,x,y,z[,speed[,qw,qx,qy,qz]]" << endl;
+				return 1;
+			}
+
+			const long stroke = (long) values[0];
+			if(stroke != current_stroke)
+			{
+				if(!points.empty())
+				{
+					writer.addStroke(points, speed, orientation);
+				}
+				points.clear();
+				current_stroke = stroke;
+				speed = (values.size() > 4) ? values[4] : 0.1;
+				orientation = (values.size() > 5) ? Quaterniond(values[5], values[6], values[7], values[8]).normalized() : Quaterniond::Identity();
+			}
+			points.push_back(Vector3d(values[1], values[2], values[3]));
+			n_points++;
+		}
+		if(!points.empty())
+		{
+			writer.addStroke(points, speed, orientation);
+		}
+		writer.write(output_file);
+	}
+	catch(const std::exception& e)
+	{
+		cout << e.what();
+		return 1;
+	}
+
+	cout << writer.numStrokes() << " strokes and " << n_points << " points written to " << output_file << endl;
+	return 0;
+}
@@ -0,0 +1,205 @@
+// Cycle time of the model and task model updates of the coordinated two arm controller,
+// serial against the parallel pipeline (see model/DualArmTaskPipeline.h).
+//
+// every cycle draws random joint angles for the two robots, then updates the models, the
+// object space task model of the two contacts and the joint task models in its nullspace,
+// either serially (pool of the calling thread only) or with the robots on two threads. the
+// same cycles are run with the Sai2Primitives::TwoHandTwoRobotsTask model as the coupled
+// step, as in controller.cpp, and the object space model is checked against the one of the
+// 14 dof formulas of tests.cpp.
+//
+// usage : benchzz [-n cycles] [-c cpu of the worker]
+
+#include "Sai2Model.h"
+#include "tasks/JointTask.h"
+#include "tasks/TwoHandTwoRobotsTask.h"
+#include "model/DualArmTaskPipeline.h"
+#include "threads/WorkerPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+const string robot_file = "./resources/panda_arm_flat_ee.urdf";
+const string link_name = "link7";
+const Vector3d pos_in_link = Vector3d(0.0, 0.0, 0.115);
+
+const int n_robots = 2;
+
+// p50, p99 and mean of the cycle times in us
+void printCycleTimes(const string& name, vector<double> cycle_times)
+{
+	sort(cycle_times.begin(), cycle_times.end());
+	double mean = 0;
+	for(unsigned int k=0 ; k<cycle_times.size() ; k++)
+	{
+		mean += cycle_times[k];
+	}
+	mean /= cycle_times.size();
+	cout << name << " : p50 " << cycle_times[cycle_times.size() / 2]
+		<< " us, p99 " << cycle_times[cycle_times.size() * 99 / 100]
+		<< " us, mean " << mean << " us" << endl;
+}
+
+// the object space nullspace of tests.cpp, with the 14 dof mass matrix
+MatrixXd monolithicObjectNullspace(Sai2Model::Sai2Model* robot_1, Sai2Model::Sai2Model* robot_2,
+		const MatrixXd& G)
+{
+	MatrixXd JC1, JC2;
+	robot_1->J_0WorldFrame(JC1, link_name, pos_in_link);
+	robot_2->J_0WorldFrame(JC2, link_name, pos_in_link);
+	MatrixXd J_tot = MatrixXd::Zero(12,14);
+	J_tot.block<3,7>(0,0) = JC1.block<3,7>(0,0);
+	J_tot.block<3,7>(3,7) = JC2.block<3,7>(0,0);
+	J_tot.block<3,7>(6,0) = JC1.block<3,7>(3,0);
+	J_tot.block<3,7>(9,7) = JC2.block<3,7>(3,0);
+
+	MatrixXd M_tot = MatrixXd::Zero(14,14);
+	M_tot.block<7,7>(0,0) = robot_1->_M;
+	M_tot.block<7,7>(7,7) = robot_2->_M;
+	MatrixXd M_tot_inv = M_tot.inverse();
+
+	MatrixXd Jri = G.inverse().transpose() * J_tot;
+	MatrixXd Lambda_ri = (Jri * M_tot_inv * Jri.transpose()).inverse();
+	MatrixXd Jbar_ri = M_tot_inv * Jri.transpose() * Lambda_ri;
+	return MatrixXd::Identity(14,14) - Jbar_ri*Jri;
+}
+
+int main(int argc, char** argv)
+{
+	int n_cycles = 10000;
+	int worker_cpu = -1;
+	for(int i=1 ; i<argc-1 ; i++)
+	{
+		const string arg = argv[i];
+		if(arg == "-n")
+		{
+			n_cycles = atoi(argv[i+1]);
+		}
+		else if(arg == "-c")
+		{
+			worker_cpu = atoi(argv[i+1]);
+		}
+	}
+
+	// position of robots in world, as in tests.cpp
+	vector<Affine3d> robot_pose_in_world;
+	Affine3d pose = Affine3d::Identity();
+	pose.translation() = Vector3d(0, -0.5, 0.0);
+	robot_pose_in_world.push_back(pose);
+	pose.translation() = Vector3d(0, 0.5, 0.0);
+	robot_pose_in_world.push_back(pose);
+
+	vector<Sai2Model::Sai2Model*> robots;
+	vector<Sai2Primitives::JointTask*> joint_tasks;
+	vector<MatrixXd> N_prec;
+	for(int i=0 ; i<n_robots ; i++)
+	{
+		robots.push_back(new Sai2Model::Sai2Model(robot_file, false, robot_pose_in_world[i]));
+		robots[i]->_q << 0,0.5,0,0.2,0,0.1,0;
+		robots[i]->updateModel();
+		joint_tasks.push_back(new Sai2Primitives::JointTask(robots[i]));
+		N_prec.push_back(MatrixXd::Identity(robots[i]->dof(), robots[i]->dof()));
+	}
+	Affine3d control_frame = Affine3d::Identity();
+	control_frame.translation() = pos_in_link;
+	auto two_hand_task = new Sai2Primitives::TwoHandTwoRobotsTask(robots[0], robots[1],
+			link_name, link_name, control_frame, control_frame);
+
+	PandaUtils::WorkerPool serial_pool(1);
+	PandaUtils::WorkerPool parallel_pool(n_robots, vector<int>(1, worker_cpu));
+
+	// random joint angles of the cycles, the same for all the variants
+	vector<VectorXd> q_cycles;
+	for(int k=0 ; k<n_cycles * n_robots ; k++)
+	{
+		q_cycles.push_back(VectorXd::Random(7));
+	}
+
+	// object space task model as the coupled step
+	int k = 0;
+	auto set_joint_angles = [&](const int i)
+	{
+		robots[i]->_q = q_cycles[(n_robots * k + i) % q_cycles.size()];
+	};
+	auto no_robot_job = [](const int) {};
+	auto no_coupled_job = []() {};
+	PandaUtils::DualArmTaskPipeline* object_pipeline = NULL;
+	auto update_joint_task_object = [&](const int i)
+	{
+		N_prec[i] = object_pipeline->objectNullspace(i);
+		joint_tasks[i]->updateTaskModel(N_prec[i]);
+	};
+
+	// two hand task as the coupled step
+	auto update_two_hand_model = [&]()
+	{
+		for(int i=0 ; i<n_robots ; i++)
+		{
+			N_prec[i].setIdentity();
+		}
+		two_hand_task->updateTaskModel(N_prec[0], N_prec[1]);
+		N_prec[0] = two_hand_task->_N_1;
+		N_prec[1] = two_hand_task->_N_2;
+	};
+	auto update_joint_task = [&](const int i)
+	{
+		joint_tasks[i]->updateTaskModel(N_prec[i]);
+	};
+
+	PandaUtils::WorkerPool* pools[2] = {&serial_pool, &parallel_pool};
+	const string pool_names[2] = {"serial", "parallel"};
+	for(int variant=0 ; variant<2 ; variant++)
+	{
+		PandaUtils::DualArmTaskPipeline pipeline(*pools[variant], robots[0], robots[1]);
+		pipeline.setContacts(link_name, pos_in_link, link_name, pos_in_link);
+		object_pipeline = &pipeline;
+
+		vector<double> cycle_times;
+		double max_error = 0;
+		for(k=0 ; k<n_cycles ; k++)
+		{
+			for(int i=0 ; i<n_robots ; i++)
+			{
+				set_joint_angles(i);
+			}
+			auto start = chrono::high_resolution_clock::now();
+			pipeline.update(no_robot_job, no_coupled_job, update_joint_task_object);
+			cycle_times.push_back(1e6 * chrono::duration<double>(chrono::high_resolution_clock::now() - start).count());
+
+			if(k % 100 == 0)
+			{
+				const double error = (monolithicObjectNullspace(robots[0], robots[1], pipeline.graspMatrix()) - pipeline.objectNullspace()).norm();
+				max_error = max(max_error, error);
+			}
+		}
+		printCycleTimes(pool_names[variant] + " object space model", cycle_times);
+		cout << "  max error of the object space nullspace against the 14 dof model : " << max_error << endl;
+	}
+
+	for(int variant=0 ; variant<2 ; variant++)
+	{
+		PandaUtils::DualArmTaskPipeline pipeline(*pools[variant], robots[0], robots[1]);
+
+		vector<double> cycle_times;
+		for(k=0 ; k<n_cycles ; k++)
+		{
+			for(int i=0 ; i<n_robots ; i++)
+			{
+				set_joint_angles(i);
+			}
+			auto start = chrono::high_resolution_clock::now();
+			pipeline.update(no_robot_job, update_two_hand_model, update_joint_task);
+			cycle_times.push_back(1e6 * chrono::duration<double>(chrono::high_resolution_clock::now() - start).count());
+		}
+		printCycleTimes(pool_names[variant] + " two hand task model", cycle_times);
+	}
+
+	return 0;
+}
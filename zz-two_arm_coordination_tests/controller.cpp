@@ -5,9 +5,13 @@
 #include "Sai2Model.h"
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
+#include "timer/LoopHealth.h"
+#include "threads/RealtimeThread.h"
 #include "tasks/JointTask.h"
 #include "tasks/PosOriTask.h"
 #include "tasks/TwoHandTwoRobotsTask.h"
+#include "threads/WorkerPool.h"
+#include "model/DualArmTaskPipeline.h"
 
 #include <iostream>
 #include <string>
@@ -50,6 +54,7 @@ const vector<string> SENSED_FORCES_KEYS = {
 };
 
 const string OBJECT_POSITION_KEY = "sai2::PandaApplications::object_position";
+const string LOOP_HEALTH_KEY = "sai2::PandaApplications::controller::loop_health";
 
 // - write
 const vector<string> TORQUES_COMMANDED_KEYS = {
@@ -57,11 +62,8 @@ const vector<string> TORQUES_COMMANDED_KEYS = {
 	"sai2::PandaApplications::panda2::actuators::fgc",
 };
 
-// function to update model at a slower rate
-void updateModelThread(vector<sf::safe_ptr<Sai2Model::Sai2Model>> robots, 
-		vector<sf::safe_ptr<Sai2Primitives::JointTask>> joint_tasks, 
-		vector<sf::safe_ptr<Sai2Primitives::PosOriTask>> posori_tasks,
-		sf::safe_ptr<Sai2Primitives::TwoHandTwoRobotsTask> two_hand_task);
+// the calling thread updates the first robot, the workers the next ones on these cpus
+const vector<int> MODEL_UPDATE_CPUS = {3, 4, 5};
 
 // state machine
 #define INDEPENDANT_ARMS                       0
@@ -241,17 +243,49 @@ int main() {
 	posori_tasks[1]->_desired_position = robot_pose_in_world[1].linear().transpose()*(robot2_desired_position_in_world - robot_pose_in_world[1].translation());
 	posori_tasks[1]->_desired_orientation = robot_pose_in_world[1].linear().transpose()*robot2_desired_orientation_in_world;
 
-	// start update_model thread
-	thread model_update_thread(updateModelThread, robots, joint_tasks, posori_tasks, two_hand_task);
+	// model and task model updates of the robots in parallel, one robot per thread, then the
+	// two hand task model that couples them, then the joint task models below it in parallel
+	PandaUtils::WorkerPool model_update_pool(n_robots, MODEL_UPDATE_CPUS);
+	PandaUtils::DualArmTaskPipeline model_update_pipeline(model_update_pool, robots[0].get_obj_ptr(), robots[1].get_obj_ptr());
+	auto update_robot_model = [&](const int i)
+	{
+		robots[i]->coriolisForce(coriolis[i]);
+
+		N_prec[i].setIdentity();
+		if(state == INDEPENDANT_ARMS)
+		{
+			posori_tasks[i]->updateTaskModel(N_prec[i]);
+
+			N_prec[i] = posori_tasks[i]->_N;
+			joint_tasks[i]->updateTaskModel(N_prec[i]);
+		}
+	};
+	auto update_two_hand_model = [&]()
+	{
+		if(state == COORDINATED_ARMS || state == COORDINATED_ARMS_INTERNAL_FORCE)
+		{
+			two_hand_task->updateTaskModel(N_prec[0], N_prec[1]);
+			N_prec[0] = two_hand_task->_N_1;
+			N_prec[1] = two_hand_task->_N_2;
+		}
+	};
+	auto update_joint_task_model = [&](const int i)
+	{
+		if(state == COORDINATED_ARMS || state == COORDINATED_ARMS_INTERNAL_FORCE)
+		{
+			joint_tasks[i]->updateTaskModel(N_prec[i]);
+		}
+	};
 
 	// create a timer
 	LoopTimer timer;
 	timer.initializeTimer();
 	timer.setLoopFrequency(1000); 
+	PandaUtils::LoopHealth loop_health(1000);
+	PandaUtils::configureRealtimeThread("controller", PandaUtils::RealtimeConfig::fifo(80, PandaUtils::controllerCpus()));
 	double current_time = 0;
 	double prev_time = 0;
 	double dt = 0;
-	bool fTimerDidSleep = true;
 	double start_time = timer.elapsedTime(); //secs
 
 	double initial_time = 0;
@@ -259,7 +293,7 @@ int main() {
 	runloop = true;
 	while (runloop) {
 		// wait for next scheduled loop
-		timer.waitForNextLoop();
+		loop_health.waitForNextLoop(timer);
 		current_time = timer.elapsedTime() - start_time;
 		dt = current_time - prev_time;
 
@@ -268,10 +302,8 @@ int main() {
 		{
 			robots[i]->_q = redis_client.getEigenMatrixJSON(JOINT_ANGLES_KEYS[i]);
 			robots[i]->_dq = redis_client.getEigenMatrixJSON(JOINT_VELOCITIES_KEYS[i]);
-
-			robots[i]->updateKinematics();
-			robots[i]->coriolisForce(coriolis[i]);
 		}
+		model_update_pipeline.update(update_robot_model, update_two_hand_model, update_joint_task_model);
 		sensed_force_moment_1 = redis_client.getEigenMatrixJSON(SENSED_FORCES_KEYS[0]);
 		sensed_force_moment_2 = redis_client.getEigenMatrixJSON(SENSED_FORCES_KEYS[1]);
 
@@ -453,6 +485,12 @@ int main() {
 		}
 
 		prev_time = current_time;
+
+		if(controller_counter % 1000 == 0)
+		{
+			loop_health.publish(redis_client, LOOP_HEALTH_KEY);
+		}
+
 		controller_counter++;
 	}
 
@@ -462,77 +500,12 @@ int main() {
 		redis_client.setEigenMatrixJSON(TORQUES_COMMANDED_KEYS[i], command_torques[i]);
 	}
 
-	model_update_thread.join();
-
 	double end_time = timer.elapsedTime();
 	std::cout << "\n";
 	std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
 	std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
     std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+    loop_health.print(std::cout);
 
 	return 0;
 }
-
-void updateModelThread(vector<sf::safe_ptr<Sai2Model::Sai2Model>> robots, 
-		vector<sf::safe_ptr<Sai2Primitives::JointTask>> joint_tasks, 
-		vector<sf::safe_ptr<Sai2Primitives::PosOriTask>> posori_tasks,
-		sf::safe_ptr<Sai2Primitives::TwoHandTwoRobotsTask> two_hand_task)
-{
-	// prepare task controllers
-	vector<int> dof;
-	vector<MatrixXd> N_prec;
-
-	for(int i=0 ; i<n_robots ; i++)
-	{
-		dof.push_back(robots[i]->dof());
-		N_prec.push_back(MatrixXd::Identity(dof[i],dof[i]));
-	}
-
-	// create a timer
-	LoopTimer timer;
-	timer.initializeTimer();
-	timer.setLoopFrequency(50); 
-	double current_time = 0;
-	double prev_time = 0;
-	double dt = 0;
-	bool fTimerDidSleep = true;
-	double start_time = timer.elapsedTime(); //secs
-
-	while(runloop)
-	{
-		timer.waitForNextLoop();
-		for(int i=0 ; i<n_robots ; i++)
-		{
-			robots[i]->updateModel();
-		}
-
-		if(state == INDEPENDANT_ARMS)
-		{
-			for(int i=0 ; i<n_robots ; i++)
-			{
-				N_prec[i].setIdentity();
-				posori_tasks[i]->updateTaskModel(N_prec[i]);
-
-				N_prec[i] = posori_tasks[i]->_N;
-				joint_tasks[i]->updateTaskModel(N_prec[i]);
-			}
-		}
-
-		else if(state == COORDINATED_ARMS || state == COORDINATED_ARMS_INTERNAL_FORCE)
-		{
-			for(int i=0 ; i<n_robots ; i++)
-			{
-				N_prec[i].setIdentity();
-			}
-
-			two_hand_task->updateTaskModel(N_prec[0], N_prec[1]);
-			N_prec[0] = two_hand_task->_N_1;
-			N_prec[1] = two_hand_task->_N_2;
-
-			for(int i=0 ; i<n_robots ; i++)
-			{
-				joint_tasks[i]->updateTaskModel(N_prec[i]);
-			}
-		}
-	}
-}